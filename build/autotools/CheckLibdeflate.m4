@@ -0,0 +1,40 @@
+# If --with-libdeflate=auto, determine if there is a system installed
+# libdeflate. It only speeds up zlib, so it's skipped without zlib.
+found_libdeflate=no
+
+AS_IF([test "x${with_zlib}" = xno], [
+   with_libdeflate=no
+])
+
+AS_IF([test "x${with_libdeflate}" = xauto -o "x${with_libdeflate}" = xsystem], [
+   PKG_CHECK_MODULES(LIBDEFLATE, [libdeflate], [
+      found_libdeflate=yes
+   ], [
+      # If we didn't find libdeflate with pkgconfig, search manually.
+      AC_CHECK_LIB([deflate], [libdeflate_zlib_decompress], [
+         AC_CHECK_HEADER([libdeflate.h], [
+            found_libdeflate=yes
+            LIBDEFLATE_LIBS=-ldeflate
+         ])
+      ])
+   ])
+])
+
+AS_IF([test "x${found_libdeflate}" = xyes], [
+   with_libdeflate=system
+], [
+   AS_IF([test "x${with_libdeflate}" = xsystem], [
+      AC_MSG_ERROR([Cannot find system installed libdeflate. try --with-libdeflate=no])
+   ])
+   with_libdeflate=no
+   LIBDEFLATE_LIBS=
+   LIBDEFLATE_CFLAGS=
+])
+
+if test "x${with_libdeflate}" != "xno"; then
+   AC_SUBST(MONGOC_ENABLE_COMPRESSION_LIBDEFLATE, 1)
+else
+   AC_SUBST(MONGOC_ENABLE_COMPRESSION_LIBDEFLATE, 0)
+fi
+AC_SUBST(LIBDEFLATE_LIBS)
+AC_SUBST(LIBDEFLATE_CFLAGS)
@@ -0,0 +1,36 @@
+# If --with-zstd=auto, determine if there is a system installed zstd.
+# There is no bundled zstd.
+found_zstd=no
+
+AS_IF([test "x${with_zstd}" = xauto -o "x${with_zstd}" = xsystem], [
+   PKG_CHECK_MODULES(ZSTD, [libzstd], [
+      found_zstd=yes
+   ], [
+      # If we didn't find zstd with pkgconfig, search manually.
+      AC_CHECK_LIB([zstd], [ZSTD_compressStream], [
+         AC_CHECK_HEADER([zstd.h], [
+            found_zstd=yes
+            ZSTD_LIBS=-lzstd
+         ])
+      ])
+   ])
+])
+
+AS_IF([test "x${found_zstd}" = xyes], [
+   with_zstd=system
+], [
+   AS_IF([test "x${with_zstd}" = xsystem], [
+      AC_MSG_ERROR([Cannot find system installed zstd. try --with-zstd=no])
+   ])
+   with_zstd=no
+   ZSTD_LIBS=
+   ZSTD_CFLAGS=
+])
+
+if test "x${with_zstd}" != "xno"; then
+   AC_SUBST(MONGOC_ENABLE_COMPRESSION_ZSTD, 1)
+else
+   AC_SUBST(MONGOC_ENABLE_COMPRESSION_ZSTD, 0)
+fi
+AC_SUBST(ZSTD_LIBS)
+AC_SUBST(ZSTD_CFLAGS)
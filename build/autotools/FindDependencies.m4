@@ -33,4 +33,21 @@ AC_CHECK_TYPE([socklen_t],
               [AC_SUBST(MONGOC_HAVE_SOCKLEN, 0)],
               [#include <sys/socket.h>])
 
+AC_CHECK_FUNC([epoll_create1],
+              [AC_SUBST(MONGOC_HAVE_EPOLL, 1)],
+              [AC_SUBST(MONGOC_HAVE_EPOLL, 0)])
+
+AC_SUBST(MONGOC_HAVE_IO_URING, 0)
+AC_CHECK_DECL([IORING_FEAT_FAST_POLL],
+              [AC_CHECK_DECL([__NR_io_uring_setup],
+                             [AC_SUBST(MONGOC_HAVE_IO_URING, 1)],
+                             [],
+                             [#include <sys/syscall.h>])],
+              [],
+              [#include <linux/io_uring.h>])
+
+AC_CHECK_FUNC([kqueue],
+              [AC_SUBST(MONGOC_HAVE_KQUEUE, 1)],
+              [AC_SUBST(MONGOC_HAVE_KQUEUE, 0)])
+
 AX_PTHREAD
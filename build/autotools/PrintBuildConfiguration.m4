@@ -49,6 +49,8 @@ Build configuration:
   SSL                                              : ${enable_ssl}
   Snappy Compression                               : ${with_snappy}
   Zlib Compression                                 : ${with_zlib}
+  Zstd Compression                                 : ${with_zstd}
+  Libdeflate                                       : ${with_libdeflate}
   Libbson                                          : ${with_libbson}
 ${experimental_features}
 Documentation:
@@ -114,6 +114,22 @@ AC_ARG_WITH(zlib,
 AS_IF([test "x$with_zlib" != xbundled -a "x$with_zlib" != xsystem -a "x$with_zlib" != xauto -a "x$with_zlib" != xno],
       [AC_MSG_ERROR([Invalid --with-zlib option: must be system, bundled, auto, no])])
 
+AC_ARG_WITH(zstd,
+    AC_HELP_STRING([--with-zstd=@<:@auto/system/no@:>@],
+                   [use system installed zstd. default=auto]),
+    [],
+    [with_zstd=auto])
+AS_IF([test "x$with_zstd" != xsystem -a "x$with_zstd" != xauto -a "x$with_zstd" != xno],
+      [AC_MSG_ERROR([Invalid --with-zstd option: must be system, auto, no])])
+
+AC_ARG_WITH(libdeflate,
+    AC_HELP_STRING([--with-libdeflate=@<:@auto/system/no@:>@],
+                   [use system installed libdeflate for one-shot zlib compression. default=auto]),
+    [],
+    [with_libdeflate=auto])
+AS_IF([test "x$with_libdeflate" != xsystem -a "x$with_libdeflate" != xauto -a "x$with_libdeflate" != xno],
+      [AC_MSG_ERROR([Invalid --with-libdeflate option: must be system, auto, no])])
+
 AC_ARG_ENABLE([html-docs],
               [AS_HELP_STRING([--enable-html-docs=@<:@yes/no@:>@],
                               [build HTML documentation @<:@default=no@:>@])],
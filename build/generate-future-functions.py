@@ -71,6 +71,7 @@ typedef_list = [
     # libmongoc.
     typedef("mongoc_bulk_operation_ptr", "mongoc_bulk_operation_t *"),
     typedef("mongoc_client_ptr", "mongoc_client_t *"),
+    typedef("mongoc_client_session_ptr", "mongoc_client_session_t *"),
     typedef("mongoc_collection_ptr", "mongoc_collection_t *"),
     typedef("mongoc_cursor_ptr", "mongoc_cursor_t *"),
     typedef("mongoc_database_ptr", "mongoc_database_t *"),
@@ -128,6 +129,16 @@ future_functions = [
                      param("bson_ptr", "reply"),
                      param("bson_error_ptr", "error")]),
 
+    future_function("bool",
+                    "mongoc_client_read_commands_pipelined",
+                    [param("mongoc_client_ptr", "client"),
+                     param("const_char_ptr", "db_name"),
+                     param("const_bson_ptr_ptr", "commands"),
+                     param("size_t", "n_commands"),
+                     param("const_mongoc_read_prefs_ptr", "read_prefs"),
+                     param("bson_ptr", "replies"),
+                     param("bson_error_ptr", "error")]),
+
     future_function("bool",
                     "mongoc_client_write_command_with_opts",
                     [param("mongoc_client_ptr", "client"),
@@ -152,6 +163,17 @@ future_functions = [
                     [param("mongoc_client_ptr", "client"),
                      param("int64_t", "cursor_id")]),
 
+    future_function("bool",
+                    "mongoc_client_session_abort_transaction",
+                    [param("mongoc_client_session_ptr", "session"),
+                     param("bson_error_ptr", "error")]),
+
+    future_function("bool",
+                    "mongoc_client_session_commit_transaction",
+                    [param("mongoc_client_session_ptr", "session"),
+                     param("bson_ptr", "reply"),
+                     param("bson_error_ptr", "error")]),
+
     future_function("mongoc_cursor_ptr",
                     "mongoc_collection_aggregate",
                     [param("mongoc_collection_ptr", "collection"),
@@ -160,6 +182,15 @@ future_functions = [
                      param("const_bson_ptr", "options"),
                      param("const_mongoc_read_prefs_ptr", "read_prefs")]),
 
+    future_function("bool",
+                    "mongoc_collection_aggregate_one",
+                    [param("mongoc_collection_ptr", "collection"),
+                     param("const_bson_ptr", "pipeline"),
+                     param("const_bson_ptr", "opts"),
+                     param("const_mongoc_read_prefs_ptr", "read_prefs"),
+                     param("bson_ptr", "doc"),
+                     param("bson_error_ptr", "error")]),
+
     future_function("int64_t",
                     "mongoc_collection_count",
                     [param("mongoc_collection_ptr", "collection"),
@@ -181,6 +212,14 @@ future_functions = [
                      param("const_mongoc_read_prefs_ptr", "read_prefs"),
                      param("bson_error_ptr", "error")]),
 
+    future_function("int64_t",
+                    "mongoc_collection_estimated_document_count",
+                    [param("mongoc_collection_ptr", "collection"),
+                     param("const_bson_ptr", "opts"),
+                     param("const_mongoc_read_prefs_ptr", "read_prefs"),
+                     param("bson_ptr", "reply"),
+                     param("bson_error_ptr", "error")]),
+
     future_function("bool",
                     "mongoc_collection_create_index_with_opts",
                     [param("mongoc_collection_ptr", "collection"),
@@ -198,6 +237,15 @@ future_functions = [
                      param("bson_ptr", "reply"),
                      param("bson_error_ptr", "error")]),
 
+    future_function("bool",
+                    "mongoc_collection_find_one_with_opts",
+                    [param("mongoc_collection_ptr", "collection"),
+                     param("const_bson_ptr", "filter"),
+                     param("const_bson_ptr", "opts"),
+                     param("const_mongoc_read_prefs_ptr", "read_prefs"),
+                     param("bson_ptr", "doc"),
+                     param("bson_error_ptr", "error")]),
+
     future_function("bool",
                     "mongoc_collection_find_and_modify",
                     [param("mongoc_collection_ptr", "collection"),
@@ -302,6 +350,10 @@ future_functions = [
                     [param("mongoc_gridfs_file_ptr", "file"),
                      param("bson_error_ptr", "error")]),
 
+    future_function("bool",
+                    "mongoc_gridfs_file_save",
+                    [param("mongoc_gridfs_file_ptr", "file")]),
+
     future_function("int",
                     "mongoc_gridfs_file_seek",
                     [param("mongoc_gridfs_file_ptr", "file"),
@@ -322,6 +374,13 @@ future_functions = [
                      param("const_bson_ptr", "opts"),
                      param("bson_error_ptr", "error")]),
 
+    future_function("mongoc_gridfs_file_ptr",
+                    "mongoc_gridfs_find_one_with_chunks",
+                    [param("mongoc_gridfs_ptr", "gridfs"),
+                     param("const_bson_ptr", "filter"),
+                     param("uint32_t", "n_chunks"),
+                     param("bson_error_ptr", "error")]),
+
     future_function("mongoc_server_description_ptr",
                     "mongoc_topology_select",
                     [param("mongoc_topology_ptr", "topology"),
@@ -18,6 +18,18 @@
 #include <bson.h>
 #include <fcntl.h>
 #include <mongoc.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+
+/* with -j, this many threads dump collections concurrently, and each
+ * collection is split into this many ranges, with clients from this pool */
+static int jobs = 1;
+static bool gzip;
+static mongoc_client_pool_t *pool;
 
 
 static bool
@@ -35,6 +47,425 @@ mongoc_dump_mkdir_p (const char *path, int mode)
 }
 
 
+/* one collection's dump file, written by each of its ranges in turn */
+typedef struct {
+   char *path;
+   FILE *stream;
+#ifndef _WIN32
+   pid_t gzip_pid;
+   pthread_mutex_t mutex;
+   uint32_t n_ranges;
+#endif
+   int ret;
+} mongoc_dump_file_t;
+
+
+#ifndef _WIN32
+/* start "gzip -c" writing to @fd, and return a pipe to its stdin. only the
+ * main thread forks, so no child inherits another's pipe. */
+static int
+mongoc_dump_gzip (int fd, pid_t *pid)
+{
+   int fds[2];
+
+   if (pipe (fds) != 0) {
+      close (fd);
+      return -1;
+   }
+
+   fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+
+   *pid = fork ();
+   if (*pid == 0) {
+      dup2 (fds[0], STDIN_FILENO);
+      dup2 (fd, STDOUT_FILENO);
+      execlp ("gzip", "gzip", "-c", (char *) NULL);
+      _exit (127);
+   }
+
+   close (fds[0]);
+   close (fd);
+
+   if (*pid < 0) {
+      close (fds[1]);
+      return -1;
+   }
+
+   return fds[1];
+}
+#endif
+
+
+static mongoc_dump_file_t *
+mongoc_dump_file_new (const char *database, const char *collection)
+{
+   mongoc_dump_file_t *file;
+#ifndef _WIN32
+   int fd;
+#endif
+
+   file = bson_malloc0 (sizeof *file);
+   file->path = bson_strdup_printf (
+      "dump/%s/%s.bson%s", database, collection, gzip ? ".gz" : "");
+   file->ret = EXIT_SUCCESS;
+
+#ifdef _WIN32
+   _unlink (file->path);
+   file->stream = fopen (file->path, "w");
+#else
+   unlink (file->path);
+   if (gzip) {
+      fd = open (file->path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+      if (fd >= 0) {
+         fcntl (fd, F_SETFD, FD_CLOEXEC);
+         fd = mongoc_dump_gzip (fd, &file->gzip_pid);
+      }
+
+      file->stream = fd >= 0 ? fdopen (fd, "w") : NULL;
+   } else {
+      file->stream = fopen (file->path, "w");
+   }
+
+   pthread_mutex_init (&file->mutex, NULL);
+#endif
+
+   if (!file->stream) {
+      fprintf (stderr, "Failed to open \"%s\", aborting.\n", file->path);
+      exit (EXIT_FAILURE);
+   }
+
+   return file;
+}
+
+
+static bool
+mongoc_dump_file_write (mongoc_dump_file_t *file,
+                        const uint8_t *data,
+                        uint32_t len)
+{
+   if (BSON_UNLIKELY (len != fwrite (data, 1, len, file->stream))) {
+      fprintf (stderr, "Failed to write %u bytes to %s\n", len, file->path);
+      file->ret = EXIT_FAILURE;
+      return false;
+   }
+
+   return true;
+}
+
+
+/* close the file, wait for gzip to finish, and return the dump's status */
+static int
+mongoc_dump_file_destroy (mongoc_dump_file_t *file)
+{
+   int ret = file->ret;
+#ifndef _WIN32
+   int status;
+#endif
+
+   if (fclose (file->stream) != 0) {
+      fprintf (stderr, "Failed to write %s\n", file->path);
+      ret = EXIT_FAILURE;
+   }
+
+#ifndef _WIN32
+   if (file->gzip_pid > 0 &&
+       (waitpid (file->gzip_pid, &status, 0) < 0 || !WIFEXITED (status) ||
+        WEXITSTATUS (status) != 0)) {
+      fprintf (stderr, "Failed to compress %s\n", file->path);
+      ret = EXIT_FAILURE;
+   }
+
+   pthread_mutex_destroy (&file->mutex);
+#endif
+
+   bson_free (file->path);
+   bson_free (file);
+
+   return ret;
+}
+
+
+/* write the collection's indexes to dump/DB/COLL.metadata.json, for
+ * mongoc-restore to build once the documents are restored */
+static int
+mongoc_dump_indexes (mongoc_client_t *client,
+                     const char *database,
+                     const char *collection)
+{
+   mongoc_collection_t *col;
+   mongoc_cursor_t *cursor;
+   const bson_t *index;
+   bson_t metadata = BSON_INITIALIZER;
+   bson_t indexes;
+   bson_error_t error;
+   char key[16];
+   const char *k;
+   uint32_t i = 0;
+   char *path;
+   char *json;
+   FILE *stream;
+   int ret = EXIT_SUCCESS;
+
+   col = mongoc_client_get_collection (client, database, collection);
+   cursor = mongoc_collection_find_indexes (col, &error);
+
+   BSON_APPEND_ARRAY_BEGIN (&metadata, "indexes", &indexes);
+   while (cursor && mongoc_cursor_next (cursor, &index)) {
+      bson_uint32_to_string (i++, &k, key, sizeof key);
+      BSON_APPEND_DOCUMENT (&indexes, k, index);
+   }
+
+   bson_append_array_end (&metadata, &indexes);
+
+   if (!cursor || mongoc_cursor_error (cursor, &error)) {
+      fprintf (stderr, "ERROR: %s\n", error.message);
+      ret = EXIT_FAILURE;
+      goto cleanup;
+   }
+
+   path = bson_strdup_printf ("dump/%s/%s.metadata.json", database, collection);
+   json = bson_as_canonical_extended_json (&metadata, NULL);
+   stream = fopen (path, "w");
+   if (!stream || fputs (json, stream) == EOF || fclose (stream) != 0) {
+      fprintf (stderr, "Failed to write %s\n", path);
+      ret = EXIT_FAILURE;
+   }
+
+   bson_free (json);
+   bson_free (path);
+
+cleanup:
+   mongoc_cursor_destroy (cursor);
+   mongoc_collection_destroy (col);
+   bson_destroy (&metadata);
+
+   return ret;
+}
+
+
+#ifndef _WIN32
+/* one range of a collection from mongoc_collection_parallel_scan, with the
+ * pooled client its cursor belongs to */
+typedef struct _mongoc_dump_range_t {
+   mongoc_dump_file_t *file;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   struct _mongoc_dump_range_t *next;
+} mongoc_dump_range_t;
+
+
+/* ranges of all collections, queued by the main thread for the workers */
+static struct {
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   mongoc_dump_range_t *head;
+   mongoc_dump_range_t *tail;
+   bool done;
+   int ret;
+} queue;
+static pthread_t *workers;
+
+
+/* write one range's documents a batch at a time, then close the file if
+ * this was its last range */
+static void
+mongoc_dump_range (mongoc_dump_range_t *range)
+{
+   mongoc_dump_file_t *file = range->file;
+   const uint8_t *batch;
+   size_t batch_len;
+   const uint32_t *offsets;
+   uint32_t n_docs;
+   uint32_t i;
+   uint32_t len;
+   bool failed = false;
+   bool last;
+   bson_error_t error;
+
+   while (!failed && mongoc_cursor_next_batch (range->cursor,
+                                               &batch,
+                                               &batch_len,
+                                               &offsets,
+                                               &n_docs)) {
+      pthread_mutex_lock (&file->mutex);
+      for (i = 0; i < n_docs && file->ret == EXIT_SUCCESS; i++) {
+         memcpy (&len, batch + offsets[i], sizeof len);
+         mongoc_dump_file_write (
+            file, batch + offsets[i], BSON_UINT32_FROM_LE (len));
+      }
+
+      failed = file->ret != EXIT_SUCCESS;
+      pthread_mutex_unlock (&file->mutex);
+   }
+
+   pthread_mutex_lock (&file->mutex);
+   if (mongoc_cursor_error (range->cursor, &error)) {
+      fprintf (stderr, "ERROR: %s\n", error.message);
+      file->ret = EXIT_FAILURE;
+   }
+
+   last = --file->n_ranges == 0;
+   pthread_mutex_unlock (&file->mutex);
+
+   mongoc_cursor_destroy (range->cursor);
+   mongoc_collection_destroy (range->collection);
+   mongoc_client_pool_push (pool, range->client);
+   bson_free (range);
+
+   if (last && mongoc_dump_file_destroy (file) != EXIT_SUCCESS) {
+      pthread_mutex_lock (&queue.mutex);
+      queue.ret = EXIT_FAILURE;
+      pthread_mutex_unlock (&queue.mutex);
+   }
+}
+
+
+static void *
+mongoc_dump_worker (void *data)
+{
+   mongoc_dump_range_t *range;
+
+   for (;;) {
+      pthread_mutex_lock (&queue.mutex);
+      while (!queue.head && !queue.done) {
+         pthread_cond_wait (&queue.cond, &queue.mutex);
+      }
+
+      range = queue.head;
+      if (range) {
+         queue.head = range->next;
+         if (!queue.head) {
+            queue.tail = NULL;
+         }
+      }
+      pthread_mutex_unlock (&queue.mutex);
+
+      if (!range) {
+         return NULL;
+      }
+
+      mongoc_dump_range (range);
+   }
+}
+
+
+static void
+mongoc_dump_workers_start (void)
+{
+   int i;
+
+   pthread_mutex_init (&queue.mutex, NULL);
+   pthread_cond_init (&queue.cond, NULL);
+   queue.ret = EXIT_SUCCESS;
+
+   workers = bson_malloc0 (jobs * sizeof (pthread_t));
+   for (i = 0; i < jobs; i++) {
+      pthread_create (&workers[i], NULL, mongoc_dump_worker, NULL);
+   }
+}
+
+
+/* wait for every queued range to be written */
+static int
+mongoc_dump_workers_join (void)
+{
+   int i;
+
+   pthread_mutex_lock (&queue.mutex);
+   queue.done = true;
+   pthread_cond_broadcast (&queue.cond);
+   pthread_mutex_unlock (&queue.mutex);
+
+   for (i = 0; i < jobs; i++) {
+      pthread_join (workers[i], NULL);
+   }
+
+   bson_free (workers);
+   pthread_cond_destroy (&queue.cond);
+   pthread_mutex_destroy (&queue.mutex);
+
+   return queue.ret;
+}
+
+
+/* split the collection with mongoc_collection_parallel_scan and queue each
+ * range, with its own client, for the workers. the next collection is
+ * scanned while this one's ranges are written. */
+static int
+mongoc_dump_collection_parallel (const char *database,
+                                 const char *collection,
+                                 mongoc_dump_file_t *file)
+{
+   mongoc_client_t **clients;
+   mongoc_collection_t **cols;
+   mongoc_cursor_t **cursors;
+   mongoc_dump_range_t *range;
+   bson_t query = BSON_INITIALIZER;
+   bson_error_t error;
+   uint32_t n_cursors = 0;
+   uint32_t i;
+   int ret = EXIT_SUCCESS;
+
+   clients = bson_malloc0 (jobs * sizeof (mongoc_client_t *));
+   cols = bson_malloc0 (jobs * sizeof (mongoc_collection_t *));
+   cursors = bson_malloc0 (jobs * sizeof (mongoc_cursor_t *));
+
+   for (i = 0; i < (uint32_t) jobs; i++) {
+      clients[i] = mongoc_client_pool_pop (pool);
+      cols[i] = mongoc_client_get_collection (clients[i], database, collection);
+   }
+
+   if (!mongoc_collection_parallel_scan (cols,
+                                         (uint32_t) jobs,
+                                         &query,
+                                         NULL,
+                                         NULL,
+                                         cursors,
+                                         &n_cursors,
+                                         &error)) {
+      fprintf (stderr, "ERROR: %s\n", error.message);
+      file->ret = ret = EXIT_FAILURE;
+      mongoc_dump_file_destroy (file);
+   } else {
+      file->n_ranges = n_cursors;
+   }
+
+   pthread_mutex_lock (&queue.mutex);
+   for (i = 0; i < n_cursors; i++) {
+      range = bson_malloc0 (sizeof *range);
+      range->file = file;
+      range->client = clients[i];
+      range->collection = cols[i];
+      range->cursor = cursors[i];
+
+      if (queue.tail) {
+         queue.tail->next = range;
+      } else {
+         queue.head = range;
+      }
+
+      queue.tail = range;
+   }
+
+   pthread_cond_broadcast (&queue.cond);
+   pthread_mutex_unlock (&queue.mutex);
+
+   /* ranges own the rest */
+   for (i = n_cursors; i < (uint32_t) jobs; i++) {
+      mongoc_collection_destroy (cols[i]);
+      mongoc_client_pool_push (pool, clients[i]);
+   }
+
+   bson_free (cursors);
+   bson_free (cols);
+   bson_free (clients);
+
+   return ret;
+}
+#endif
+
+
 static int
 mongoc_dump_collection (mongoc_client_t *client,
                         const char *database,
@@ -42,46 +473,40 @@ mongoc_dump_collection (mongoc_client_t *client,
 {
    mongoc_collection_t *col;
    mongoc_cursor_t *cursor;
+   mongoc_dump_file_t *file;
    const bson_t *doc;
    bson_error_t error;
    bson_t query = BSON_INITIALIZER;
-   FILE *stream;
-   char *path;
-   int ret = EXIT_SUCCESS;
+   int ret;
 
-   path = bson_strdup_printf ("dump/%s/%s.bson", database, collection);
-#ifdef _WIN32
-   _unlink (path);
-#else
-   unlink (path);
-#endif
+   if (EXIT_SUCCESS != mongoc_dump_indexes (client, database, collection)) {
+      return EXIT_FAILURE;
+   }
 
-   stream = fopen (path, "w");
-   if (!stream) {
-      fprintf (stderr, "Failed to open \"%s\", aborting.\n", path);
-      exit (EXIT_FAILURE);
+   file = mongoc_dump_file_new (database, collection);
+
+#ifndef _WIN32
+   if (pool) {
+      return mongoc_dump_collection_parallel (database, collection, file);
    }
+#endif
 
    col = mongoc_client_get_collection (client, database, collection);
    cursor = mongoc_collection_find_with_opts (col, &query, NULL, NULL);
 
    while (mongoc_cursor_next (cursor, &doc)) {
-      if (BSON_UNLIKELY (doc->len !=
-                         fwrite (bson_get_data (doc), 1, doc->len, stream))) {
-         fprintf (stderr, "Failed to write %u bytes to %s\n", doc->len, path);
-         ret = EXIT_FAILURE;
+      if (!mongoc_dump_file_write (file, bson_get_data (doc), doc->len)) {
          goto cleanup;
       }
    }
 
    if (mongoc_cursor_error (cursor, &error)) {
       fprintf (stderr, "ERROR: %s\n", error.message);
-      ret = EXIT_FAILURE;
+      file->ret = EXIT_FAILURE;
    }
 
 cleanup:
-   bson_free (path);
-   fclose (stream);
+   ret = mongoc_dump_file_destroy (file);
    mongoc_cursor_destroy (cursor);
    mongoc_collection_destroy (col);
 
@@ -181,6 +606,9 @@ usage (FILE *stream)
             "  -p PORT      Optional port to connect to [27017].\n"
             "  -d DBNAME    Optional database name to dump.\n"
             "  -c COLNAME   Optional collection name to dump.\n"
+            "  -j JOBS      Optional number of threads to dump collections,\n"
+            "               and ranges of each collection, with [1].\n"
+            "  --gzip       Compress each collection with gzip(1).\n"
             "  --ssl        Use SSL when connecting to server.\n"
             "\n");
 }
@@ -190,6 +618,7 @@ int
 main (int argc, char *argv[])
 {
    mongoc_client_t *client;
+   mongoc_uri_t *mongoc_uri = NULL;
    const char *collection = NULL;
    const char *database = NULL;
    const char *host = "127.0.0.1";
@@ -206,6 +635,21 @@ main (int argc, char *argv[])
          collection = argv[++i];
       } else if (0 == strcmp (argv[i], "-d") && ((i + 1) < argc)) {
          database = argv[++i];
+      } else if (0 == strcmp (argv[i], "-j") && ((i + 1) < argc)) {
+         jobs = atoi (argv[++i]);
+         if (jobs < 1) {
+            fprintf (stderr, "Invalid jobs \"%s\"", argv[i]);
+            return EXIT_FAILURE;
+         }
+#ifdef _WIN32
+         jobs = 1;
+#endif
+      } else if (0 == strcmp (argv[i], "--gzip")) {
+#ifdef _WIN32
+         fprintf (stderr, "--gzip is not supported on Windows\n");
+         return EXIT_FAILURE;
+#endif
+         gzip = true;
       } else if (0 == strcmp (argv[i], "--help")) {
          usage (stdout);
          return EXIT_SUCCESS;
@@ -231,16 +675,47 @@ main (int argc, char *argv[])
                              database ? database : "",
                              ssl ? "true" : "false");
 
-   if (!(client = mongoc_client_new (uri))) {
-      fprintf (stderr, "Invalid connection URI: %s\n", uri);
-      return EXIT_FAILURE;
+   if (jobs > 1) {
+      if (!(mongoc_uri = mongoc_uri_new (uri))) {
+         fprintf (stderr, "Invalid connection URI: %s\n", uri);
+         return EXIT_FAILURE;
+      }
+
+      pool = mongoc_client_pool_new (mongoc_uri);
+      mongoc_client_pool_set_error_api (pool, 2);
+      /* this client, the ranges being written, and the next collection's */
+      mongoc_client_pool_max_size (pool, (uint32_t) jobs * 2 + 1);
+      client = mongoc_client_pool_pop (pool);
+   } else {
+      if (!(client = mongoc_client_new (uri))) {
+         fprintf (stderr, "Invalid connection URI: %s\n", uri);
+         return EXIT_FAILURE;
+      }
+
+      mongoc_client_set_error_api (client, 2);
    }
 
-   mongoc_client_set_error_api (client, 2);
+#ifndef _WIN32
+   if (pool) {
+      mongoc_dump_workers_start ();
+   }
+#endif
 
    ret = mongoc_dump (client, database, collection);
 
-   mongoc_client_destroy (client);
+#ifndef _WIN32
+   if (pool && mongoc_dump_workers_join () != EXIT_SUCCESS) {
+      ret = EXIT_FAILURE;
+   }
+#endif
+
+   if (pool) {
+      mongoc_client_pool_push (pool, client);
+      mongoc_client_pool_destroy (pool);
+      mongoc_uri_destroy (mongoc_uri);
+   } else {
+      mongoc_client_destroy (client);
+   }
 
    return ret;
 }
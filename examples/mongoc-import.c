@@ -0,0 +1,478 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* import a .bson file, or a file of JSON documents one per line, as fast as
+ * the driver can: the file is memory-mapped and split into parts at
+ * document boundaries, each part is parsed on its own thread into an
+ * unordered bulk writer, and each writer keeps several batches in flight on
+ * clients from a pool */
+
+#include <bson.h>
+#include <fcntl.h>
+#include <mongoc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static int threads = 1;
+static int in_flight = 2;
+static mongoc_client_pool_t *pool;
+static const char *database = "test";
+static const char *collection;
+
+/* documents parsed so far, and parts still being imported */
+static volatile int64_t n_parsed;
+static volatile int32_t n_running;
+
+
+/* a range of whole documents in the mapping, imported by one thread */
+typedef struct {
+   const uint8_t *data;
+   size_t len;
+   size_t offset;
+   bool json;
+   pthread_t thread;
+   bson_t reply;
+   int ret;
+} mongoc_import_part_t;
+
+
+/* split @data into up to @n parts at document boundaries. a corrupt length
+ * ends the part, whose reader then reports it. */
+static size_t
+mongoc_import_split_bson (const uint8_t *data,
+                          size_t len,
+                          size_t n,
+                          mongoc_import_part_t *parts)
+{
+   size_t start = 0;
+   size_t offset = 0;
+   size_t target;
+   uint32_t doc_len;
+   size_t i;
+
+   for (i = 0; i < n && start < len; i++) {
+      target = i + 1 == n ? len : len / n * (i + 1);
+      while (offset < target) {
+         if (len - offset < sizeof doc_len) {
+            offset = len;
+            break;
+         }
+
+         memcpy (&doc_len, data + offset, sizeof doc_len);
+         doc_len = BSON_UINT32_FROM_LE (doc_len);
+         if (doc_len < 5 || doc_len > len - offset) {
+            offset = len;
+            break;
+         }
+
+         offset += doc_len;
+      }
+
+      parts[i].data = data + start;
+      parts[i].len = offset - start;
+      parts[i].offset = start;
+      start = offset;
+   }
+
+   return i;
+}
+
+
+/* split @data into up to @n parts after newlines */
+static size_t
+mongoc_import_split_json (const uint8_t *data,
+                          size_t len,
+                          size_t n,
+                          mongoc_import_part_t *parts)
+{
+   const uint8_t *nl;
+   size_t start = 0;
+   size_t offset;
+   size_t i;
+
+   for (i = 0; i < n && start < len; i++) {
+      offset = BSON_MAX (start, len / n * (i + 1));
+      nl = i + 1 == n ? NULL : memchr (data + offset, '\n', len - offset);
+      offset = nl ? (size_t) (nl - data) + 1 : len;
+
+      parts[i].data = data + start;
+      parts[i].len = offset - start;
+      parts[i].offset = start;
+      start = offset;
+   }
+
+   return i;
+}
+
+
+static bool
+mongoc_import_bson (mongoc_import_part_t *part,
+                    mongoc_bulk_writer_t *writer,
+                    bson_error_t *error)
+{
+   bson_reader_t *reader;
+   const bson_t *doc;
+   bool eof = false;
+   int64_t n = 0;
+   bool ret = true;
+
+   reader = bson_reader_new_from_data (part->data, part->len);
+   while ((doc = bson_reader_read (reader, &eof))) {
+      if (!mongoc_bulk_writer_insert (writer, doc, NULL, error)) {
+         ret = false;
+         break;
+      }
+
+      if (++n % 1000 == 0) {
+         bson_atomic_int64_add (&n_parsed, 1000);
+      }
+   }
+
+   bson_atomic_int64_add (&n_parsed, n % 1000);
+
+   if (ret && !eof) {
+      bson_set_error (
+         error,
+         0,
+         0,
+         "Corrupt BSON at byte %llu",
+         (unsigned long long) (part->offset + bson_reader_tell (reader)));
+      ret = false;
+   }
+
+   bson_reader_destroy (reader);
+
+   return ret;
+}
+
+
+static bool
+mongoc_import_json (mongoc_import_part_t *part,
+                    mongoc_bulk_writer_t *writer,
+                    bson_error_t *error)
+{
+   const char *line = (const char *) part->data;
+   const char *end = line + part->len;
+   const char *nl;
+   size_t len;
+   bson_t doc;
+   int64_t n = 0;
+   bool ret = true;
+
+   while (ret && line < end) {
+      nl = memchr (line, '\n', (size_t) (end - line));
+      len = (size_t) ((nl ? nl : end) - line);
+
+      if (len && line[len - 1] == '\r') {
+         len--;
+      }
+
+      if (len) {
+         if (!bson_init_from_json (&doc, line, (ssize_t) len, error)) {
+            ret = false;
+            break;
+         }
+
+         ret = mongoc_bulk_writer_insert (writer, &doc, NULL, error);
+         bson_destroy (&doc);
+
+         if (++n % 1000 == 0) {
+            bson_atomic_int64_add (&n_parsed, 1000);
+         }
+      }
+
+      line = nl ? nl + 1 : end;
+   }
+
+   bson_atomic_int64_add (&n_parsed, n % 1000);
+
+   return ret;
+}
+
+
+static void *
+mongoc_import_thread (void *data)
+{
+   mongoc_import_part_t *part = (mongoc_import_part_t *) data;
+   mongoc_client_t *client;
+   mongoc_collection_t *col;
+   mongoc_bulk_writer_t *writer;
+   bson_error_t error;
+   bool ok;
+
+   client = mongoc_client_pool_pop (pool);
+   col = mongoc_client_get_collection (client, database, collection);
+   writer = mongoc_bulk_writer_new (col, false /* ordered */);
+   mongoc_bulk_writer_set_pool (writer, pool, (uint32_t) in_flight);
+
+   ok = part->json ? mongoc_import_json (part, writer, &error)
+                   : mongoc_import_bson (part, writer, &error);
+
+   /* after a parse error, keep it and send what was parsed */
+   if (!mongoc_bulk_writer_finish (writer, &part->reply, ok ? &error : NULL) ||
+       !ok) {
+      fprintf (stderr, "ERROR: %s\n", error.message);
+      part->ret = EXIT_FAILURE;
+   }
+
+   mongoc_bulk_writer_destroy (writer);
+   mongoc_collection_destroy (col);
+   mongoc_client_pool_push (pool, client);
+
+   bson_atomic_int_add (&n_running, -1);
+
+   return NULL;
+}
+
+
+/* print the documents parsed so far each second, until every part is done */
+static void
+mongoc_import_progress (int64_t start)
+{
+   int64_t last = start;
+   int64_t now;
+   int64_t n;
+
+   while (bson_atomic_int_add (&n_running, 0) > 0) {
+      usleep (100 * 1000);
+      now = bson_get_monotonic_time ();
+      if (now - last < 1000 * 1000) {
+         continue;
+      }
+
+      n = bson_atomic_int64_add (&n_parsed, 0);
+      printf ("%" PRId64 " documents, %.0f documents/s\n",
+              n,
+              n * 1e6 / (double) (now - start));
+      last = now;
+   }
+}
+
+
+static int
+mongoc_import (const uint8_t *data, size_t len, bool json)
+{
+   mongoc_import_part_t *parts;
+   bson_iter_t iter;
+   int64_t start;
+   int64_t n_inserted = 0;
+   double secs;
+   size_t n_parts;
+   size_t i;
+   int ret = EXIT_SUCCESS;
+
+   parts = bson_malloc0 (threads * sizeof (mongoc_import_part_t));
+   n_parts = json ? mongoc_import_split_json (data, len, threads, parts)
+                  : mongoc_import_split_bson (data, len, threads, parts);
+
+   start = bson_get_monotonic_time ();
+   n_running = (int32_t) n_parts;
+   for (i = 0; i < n_parts; i++) {
+      parts[i].json = json;
+      parts[i].ret = EXIT_SUCCESS;
+      pthread_create (
+         &parts[i].thread, NULL, mongoc_import_thread, &parts[i]);
+   }
+
+   mongoc_import_progress (start);
+
+   for (i = 0; i < n_parts; i++) {
+      pthread_join (parts[i].thread, NULL);
+      if (parts[i].ret != EXIT_SUCCESS) {
+         ret = EXIT_FAILURE;
+      }
+
+      if (bson_iter_init_find (&iter, &parts[i].reply, "nInserted")) {
+         n_inserted += bson_iter_as_int64 (&iter);
+      }
+
+      bson_destroy (&parts[i].reply);
+   }
+
+   secs = (bson_get_monotonic_time () - start) / 1e6;
+   printf ("imported %" PRId64 " documents, %.1f MB in %.2f s:"
+           " %.0f documents/s, %.1f MB/s\n",
+           n_inserted,
+           len / 1e6,
+           secs,
+           secs > 0 ? n_inserted / secs : 0,
+           secs > 0 ? len / 1e6 / secs : 0);
+
+   bson_free (parts);
+
+   return ret;
+}
+
+
+static void
+usage (FILE *stream)
+{
+   fprintf (stream,
+            "Usage: mongoc-import [OPTIONS] -c COLNAME FILE\n"
+            "\n"
+            "Imports FILE.bson, or FILE of JSON documents, one per line.\n"
+            "\n"
+            "Options:\n"
+            "\n"
+            "  -h HOST          Optional hostname to connect to [127.0.0.1].\n"
+            "  -p PORT          Optional port to connect to [27017].\n"
+            "  -d DBNAME        Optional database name [test].\n"
+            "  -c COLNAME       Collection name to import into.\n"
+            "  -j THREADS       Optional number of threads parsing [1].\n"
+            "  --in-flight N    Optional number of batches in flight for\n"
+            "                   each thread [2].\n"
+            "  --drop           Drop the collection before importing.\n"
+            "  --ssl            Use SSL when connecting to server.\n"
+            "\n");
+}
+
+
+int
+main (int argc, char *argv[])
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *col;
+   mongoc_uri_t *mongoc_uri;
+   const char *path = NULL;
+   const char *host = "127.0.0.1";
+   uint16_t port = 27017;
+   bool drop = false;
+   bool ssl = false;
+   bool json;
+   bson_error_t error;
+   struct stat st;
+   void *data = NULL;
+   char *uri;
+   int fd;
+   int ret;
+   int i;
+
+   mongoc_init ();
+
+   for (i = 1; i < argc; i++) {
+      if (0 == strcmp (argv[i], "-c") && ((i + 1) < argc)) {
+         collection = argv[++i];
+      } else if (0 == strcmp (argv[i], "-d") && ((i + 1) < argc)) {
+         database = argv[++i];
+      } else if (0 == strcmp (argv[i], "--drop")) {
+         drop = true;
+      } else if (0 == strcmp (argv[i], "-j") && ((i + 1) < argc)) {
+         threads = atoi (argv[++i]);
+         if (threads < 1) {
+            fprintf (stderr, "Invalid threads \"%s\"", argv[i]);
+            return EXIT_FAILURE;
+         }
+      } else if (0 == strcmp (argv[i], "--in-flight") && ((i + 1) < argc)) {
+         in_flight = atoi (argv[++i]);
+         if (in_flight < 1) {
+            fprintf (stderr, "Invalid in-flight \"%s\"", argv[i]);
+            return EXIT_FAILURE;
+         }
+      } else if (0 == strcmp (argv[i], "--help")) {
+         usage (stdout);
+         return EXIT_SUCCESS;
+      } else if (0 == strcmp (argv[i], "-h") && ((i + 1) < argc)) {
+         host = argv[++i];
+      } else if (0 == strcmp (argv[i], "--ssl")) {
+         ssl = true;
+      } else if (0 == strcmp (argv[i], "-p") && ((i + 1) < argc)) {
+         port = atoi (argv[++i]);
+         if (!port) {
+            fprintf (stderr, "Invalid port \"%s\"", argv[i]);
+            return EXIT_FAILURE;
+         }
+      } else if (argv[i][0] != '-' && !path) {
+         path = argv[i];
+      } else {
+         fprintf (stderr, "Unknown argument \"%s\"\n", argv[i]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (!path || !collection) {
+      usage (stderr);
+      return EXIT_FAILURE;
+   }
+
+   json = strlen (path) < 5 || strcmp (path + strlen (path) - 5, ".bson");
+
+   if ((fd = open (path, O_RDONLY)) < 0 || fstat (fd, &st) != 0) {
+      fprintf (stderr, "Failed to open \"%s\"\n", path);
+      return EXIT_FAILURE;
+   }
+
+   /* the threads parse straight from the page cache, with no copies */
+   if (st.st_size > 0) {
+      data = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+         perror ("mmap");
+         close (fd);
+         return EXIT_FAILURE;
+      }
+
+#ifdef MADV_SEQUENTIAL
+      madvise (data, (size_t) st.st_size, MADV_SEQUENTIAL);
+#endif
+   }
+
+   uri = bson_strdup_printf (
+      "mongodb://%s:%hu/?appname=import-example&ssl=%s",
+      host,
+      port,
+      ssl ? "true" : "false");
+
+   if (!(mongoc_uri = mongoc_uri_new (uri))) {
+      fprintf (stderr, "Invalid connection URI: %s\n", uri);
+      return EXIT_FAILURE;
+   }
+
+   pool = mongoc_client_pool_new (mongoc_uri);
+   mongoc_client_pool_set_error_api (pool, 2);
+
+   ret = EXIT_SUCCESS;
+   if (drop) {
+      client = mongoc_client_pool_pop (pool);
+      col = mongoc_client_get_collection (client, database, collection);
+      /* 26 is NamespaceNotFound */
+      if (!mongoc_collection_drop (col, &error) && error.code != 26) {
+         fprintf (stderr, "Failed to drop: %s\n", error.message);
+         ret = EXIT_FAILURE;
+      }
+
+      mongoc_collection_destroy (col);
+      mongoc_client_pool_push (pool, client);
+   }
+
+   if (ret == EXIT_SUCCESS) {
+      ret = mongoc_import ((const uint8_t *) data, (size_t) st.st_size, json);
+   }
+
+   if (data) {
+      munmap (data, (size_t) st.st_size);
+   }
+
+   close (fd);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (mongoc_uri);
+   bson_free (uri);
+   mongoc_cleanup ();
+
+   return ret;
+}
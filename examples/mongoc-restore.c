@@ -0,0 +1,587 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* restore a mongoc-dump directory: collections are restored concurrently,
+ * each with pipelined unordered bulk inserts, then all their indexes are
+ * built at once */
+
+#include <bson.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mongoc.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+/* this many threads restore collections concurrently, each with this many
+ * insert batches in flight */
+static int jobs = 1;
+static bool gzip;
+static bool drop;
+static mongoc_client_pool_t *pool;
+
+
+/* a collection to restore from DIR/DB/COLL.bson, and its index specs */
+typedef struct {
+   char *database;
+   char *collection;
+   char *path;
+   bson_t **indexes;
+   size_t n_indexes;
+   int ret;
+} mongoc_restore_task_t;
+
+
+/* all collections to restore, taken in turn by the worker threads */
+static struct {
+   pthread_mutex_t mutex;
+   mongoc_restore_task_t *tasks;
+   size_t n_tasks;
+   size_t next;
+} queue = {PTHREAD_MUTEX_INITIALIZER};
+
+
+/* workers fork gzip one at a time, so no child inherits another's pipe */
+static pthread_mutex_t fork_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* start "gzip -dc" reading from @fd, and return a pipe from its stdout */
+static int
+mongoc_restore_gunzip (int fd, pid_t *pid)
+{
+   int fds[2];
+
+   pthread_mutex_lock (&fork_mutex);
+   if (pipe (fds) != 0) {
+      pthread_mutex_unlock (&fork_mutex);
+      close (fd);
+      return -1;
+   }
+
+   fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+   fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+
+   *pid = fork ();
+   if (*pid == 0) {
+      dup2 (fd, STDIN_FILENO);
+      dup2 (fds[1], STDOUT_FILENO);
+      execlp ("gzip", "gzip", "-dc", (char *) NULL);
+      _exit (127);
+   }
+
+   close (fds[1]);
+   close (fd);
+   pthread_mutex_unlock (&fork_mutex);
+
+   if (*pid < 0) {
+      close (fds[0]);
+      return -1;
+   }
+
+   return fds[0];
+}
+
+
+/* read the index specs from DIR/DB/COLL.metadata.json, if there is one,
+ * except the _id index the server creates */
+static bool
+mongoc_restore_load_indexes (mongoc_restore_task_t *task, const char *base)
+{
+   bson_json_reader_t *reader;
+   bson_t metadata = BSON_INITIALIZER;
+   bson_t spec;
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_iter_t name;
+   bson_error_t error;
+   const uint8_t *data;
+   uint32_t len;
+   char *path;
+   bool ret = true;
+
+   path = bson_strdup_printf ("%s.metadata.json", base);
+   if (access (path, F_OK) != 0) {
+      bson_free (path);
+      return true;
+   }
+
+   reader = bson_json_reader_new_from_file (path, &error);
+   if (!reader || bson_json_reader_read (reader, &metadata, &error) != 1) {
+      fprintf (stderr, "Failed to read %s: %s\n", path, error.message);
+      ret = false;
+      goto cleanup;
+   }
+
+   if (!bson_iter_init_find (&iter, &metadata, "indexes") ||
+       !BSON_ITER_HOLDS_ARRAY (&iter) || !bson_iter_recurse (&iter, &child)) {
+      goto cleanup;
+   }
+
+   while (bson_iter_next (&child)) {
+      if (!BSON_ITER_HOLDS_DOCUMENT (&child)) {
+         continue;
+      }
+
+      bson_iter_document (&child, &len, &data);
+      bson_init_static (&spec, data, len);
+      if (bson_iter_init_find (&name, &spec, "name") &&
+          BSON_ITER_HOLDS_UTF8 (&name) &&
+          !strcmp (bson_iter_utf8 (&name, NULL), "_id_")) {
+         continue;
+      }
+
+      /* the dumped namespace may not be the one restored to */
+      task->indexes = bson_realloc (
+         task->indexes, (task->n_indexes + 1) * sizeof (bson_t *));
+      task->indexes[task->n_indexes] = bson_new ();
+      bson_copy_to_excluding_noinit (
+         &spec, task->indexes[task->n_indexes++], "ns", NULL);
+   }
+
+cleanup:
+   if (reader) {
+      bson_json_reader_destroy (reader);
+   }
+
+   bson_destroy (&metadata);
+   bson_free (path);
+
+   return ret;
+}
+
+
+/* queue each collection dumped in DIR/DB, or only @collection */
+static int
+mongoc_restore_add_database (const char *dir,
+                             const char *database,
+                             const char *collection)
+{
+   mongoc_restore_task_t *task;
+   const char *suffix = gzip ? ".bson.gz" : ".bson";
+   struct dirent *entry;
+   DIR *d;
+   char *path;
+   char *name;
+   size_t len;
+   int ret = EXIT_SUCCESS;
+
+   path = bson_strdup_printf ("%s/%s", dir, database);
+   if (!(d = opendir (path))) {
+      fprintf (stderr, "Failed to open directory \"%s\"\n", path);
+      bson_free (path);
+      return EXIT_FAILURE;
+   }
+
+   while (ret == EXIT_SUCCESS && (entry = readdir (d))) {
+      len = strlen (entry->d_name);
+      if (len <= strlen (suffix) ||
+          strcmp (entry->d_name + len - strlen (suffix), suffix)) {
+         continue;
+      }
+
+      /* system collections like system.indexes are the server's */
+      name = bson_strndup (entry->d_name, len - strlen (suffix));
+      if ((collection && strcmp (name, collection)) ||
+          !strncmp (name, "system.", 7)) {
+         bson_free (name);
+         continue;
+      }
+
+      queue.tasks = bson_realloc (
+         queue.tasks, (queue.n_tasks + 1) * sizeof (mongoc_restore_task_t));
+      task = &queue.tasks[queue.n_tasks++];
+      memset (task, 0, sizeof *task);
+      task->database = bson_strdup (database);
+      task->collection = name;
+      task->path = bson_strdup_printf ("%s/%s", path, entry->d_name);
+      task->ret = EXIT_SUCCESS;
+
+      name = bson_strdup_printf ("%s/%s", path, task->collection);
+      if (!mongoc_restore_load_indexes (task, name)) {
+         ret = EXIT_FAILURE;
+      }
+
+      bson_free (name);
+   }
+
+   closedir (d);
+   bson_free (path);
+
+   return ret;
+}
+
+
+static int
+mongoc_restore_add (const char *dir,
+                    const char *database,
+                    const char *collection)
+{
+   struct dirent *entry;
+   struct stat st;
+   DIR *d;
+   char *path;
+   int ret = EXIT_SUCCESS;
+
+   if (database) {
+      return mongoc_restore_add_database (dir, database, collection);
+   }
+
+   if (!(d = opendir (dir))) {
+      fprintf (stderr, "Failed to open directory \"%s\"\n", dir);
+      return EXIT_FAILURE;
+   }
+
+   while (ret == EXIT_SUCCESS && (entry = readdir (d))) {
+      if (entry->d_name[0] == '.') {
+         continue;
+      }
+
+      /* skip anything but a database's directory */
+      path = bson_strdup_printf ("%s/%s", dir, entry->d_name);
+      if (stat (path, &st) == 0 && S_ISDIR (st.st_mode)) {
+         ret = mongoc_restore_add_database (dir, entry->d_name, NULL);
+      }
+
+      bson_free (path);
+   }
+
+   closedir (d);
+
+   return ret;
+}
+
+
+/* insert the collection's documents with an unordered bulk writer, which
+ * keeps up to "jobs" batches in flight on other pooled clients while this
+ * thread reads and decompresses the next */
+static void
+mongoc_restore_collection (mongoc_restore_task_t *task)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *col;
+   mongoc_bulk_writer_t *writer;
+   bson_reader_t *reader = NULL;
+   const bson_t *doc;
+   bson_t reply;
+   bson_iter_t iter;
+   bson_error_t error;
+   bool eof = false;
+   pid_t pid = 0;
+   int status;
+   int fd;
+
+   client = mongoc_client_pool_pop (pool);
+   col = mongoc_client_get_collection (
+      client, task->database, task->collection);
+
+   /* 26 is NamespaceNotFound */
+   if (drop && !mongoc_collection_drop (col, &error) && error.code != 26) {
+      fprintf (stderr, "Failed to drop %s: %s\n", task->path, error.message);
+      task->ret = EXIT_FAILURE;
+      goto cleanup;
+   }
+
+   fd = open (task->path, O_RDONLY);
+   if (fd >= 0) {
+      fcntl (fd, F_SETFD, FD_CLOEXEC);
+      if (gzip) {
+         fd = mongoc_restore_gunzip (fd, &pid);
+      }
+   }
+
+   if (fd < 0) {
+      fprintf (stderr, "Failed to open \"%s\"\n", task->path);
+      task->ret = EXIT_FAILURE;
+      goto cleanup;
+   }
+
+   reader = bson_reader_new_from_fd (fd, true /* close_on_destroy */);
+   writer = mongoc_bulk_writer_new (col, false /* ordered */);
+   mongoc_bulk_writer_set_pool (writer, pool, (uint32_t) jobs);
+
+   while ((doc = bson_reader_read (reader, &eof))) {
+      if (!mongoc_bulk_writer_insert (writer, doc, NULL, &error)) {
+         break;
+      }
+   }
+
+   if (!eof && !doc) {
+      bson_set_error (&error, 0, 0, "Corrupt BSON in \"%s\"", task->path);
+   }
+
+   /* if reading stopped early, keep its error and send what was read */
+   if (!mongoc_bulk_writer_finish (writer, &reply, eof ? &error : NULL) ||
+       !eof) {
+      fprintf (stderr,
+               "Failed to restore %s.%s: %s\n",
+               task->database,
+               task->collection,
+               error.message);
+      task->ret = EXIT_FAILURE;
+   } else if (bson_iter_init_find (&iter, &reply, "nInserted")) {
+      printf ("%s.%s: restored %d documents\n",
+              task->database,
+              task->collection,
+              bson_iter_int32 (&iter));
+   }
+
+   bson_destroy (&reply);
+   mongoc_bulk_writer_destroy (writer);
+
+cleanup:
+   if (reader) {
+      bson_reader_destroy (reader);
+   }
+
+   if (pid > 0 && (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status) ||
+                   WEXITSTATUS (status) != 0) &&
+       task->ret == EXIT_SUCCESS) {
+      fprintf (stderr, "Failed to decompress \"%s\"\n", task->path);
+      task->ret = EXIT_FAILURE;
+   }
+
+   mongoc_collection_destroy (col);
+   mongoc_client_pool_push (pool, client);
+}
+
+
+static void *
+mongoc_restore_worker (void *data)
+{
+   mongoc_restore_task_t *task;
+
+   for (;;) {
+      pthread_mutex_lock (&queue.mutex);
+      task = queue.next < queue.n_tasks ? &queue.tasks[queue.next++] : NULL;
+      pthread_mutex_unlock (&queue.mutex);
+
+      if (!task) {
+         return NULL;
+      }
+
+      mongoc_restore_collection (task);
+   }
+}
+
+
+static void
+mongoc_restore_indexes_done (bool success,
+                             const bson_t *reply,
+                             const bson_error_t *error,
+                             void *ctx)
+{
+   mongoc_restore_task_t *task = (mongoc_restore_task_t *) ctx;
+
+   if (success) {
+      printf ("%s.%s: built %d indexes\n",
+              task->database,
+              task->collection,
+              (int) task->n_indexes);
+   } else {
+      fprintf (stderr,
+               "Failed to build indexes on %s.%s: %s\n",
+               task->database,
+               task->collection,
+               error->message);
+      task->ret = EXIT_FAILURE;
+   }
+}
+
+
+/* once the documents are in, build every restored collection's indexes at
+ * once: one createIndexes per collection, each on its own connection */
+static void
+mongoc_restore_indexes (void)
+{
+   mongoc_async_client_t *async_client;
+   mongoc_restore_task_t *task;
+   size_t i;
+
+   async_client = mongoc_async_client_new (pool);
+
+   for (i = 0; i < queue.n_tasks; i++) {
+      task = &queue.tasks[i];
+      if (task->ret != EXIT_SUCCESS || !task->n_indexes) {
+         continue;
+      }
+
+      mongoc_async_client_create_indexes (
+         async_client,
+         task->database,
+         task->collection,
+         (const bson_t *const *) task->indexes,
+         task->n_indexes,
+         mongoc_restore_indexes_done,
+         task);
+   }
+
+   mongoc_async_client_run (async_client);
+   mongoc_async_client_destroy (async_client);
+}
+
+
+static int
+mongoc_restore (void)
+{
+   mongoc_restore_task_t *task;
+   pthread_t *threads;
+   size_t i;
+   size_t j;
+   int ret = EXIT_SUCCESS;
+
+   threads = bson_malloc0 (jobs * sizeof (pthread_t));
+   for (i = 0; i < (size_t) jobs; i++) {
+      pthread_create (&threads[i], NULL, mongoc_restore_worker, NULL);
+   }
+
+   for (i = 0; i < (size_t) jobs; i++) {
+      pthread_join (threads[i], NULL);
+   }
+
+   mongoc_restore_indexes ();
+
+   for (i = 0; i < queue.n_tasks; i++) {
+      task = &queue.tasks[i];
+      if (task->ret != EXIT_SUCCESS) {
+         ret = EXIT_FAILURE;
+      }
+
+      for (j = 0; j < task->n_indexes; j++) {
+         bson_destroy (task->indexes[j]);
+      }
+
+      bson_free (task->indexes);
+      bson_free (task->database);
+      bson_free (task->collection);
+      bson_free (task->path);
+   }
+
+   bson_free (queue.tasks);
+   bson_free (threads);
+
+   return ret;
+}
+
+
+static void
+usage (FILE *stream)
+{
+   fprintf (stream,
+            "Usage: mongoc-restore [OPTIONS]\n"
+            "\n"
+            "Options:\n"
+            "\n"
+            "  -h HOST      Optional hostname to connect to [127.0.0.1].\n"
+            "  -p PORT      Optional port to connect to [27017].\n"
+            "  -d DBNAME    Optional database name to restore.\n"
+            "  -c COLNAME   Optional collection name to restore, with -d.\n"
+            "  -j JOBS      Optional number of collections to restore at\n"
+            "               once, and of batches in flight for each [1].\n"
+            "  --dir DIR    Optional directory mongoc-dump wrote [dump].\n"
+            "  --drop       Drop each collection before restoring it.\n"
+            "  --gzip       Restore files compressed by mongoc-dump --gzip.\n"
+            "  --ssl        Use SSL when connecting to server.\n"
+            "\n");
+}
+
+
+int
+main (int argc, char *argv[])
+{
+   mongoc_uri_t *mongoc_uri;
+   const char *collection = NULL;
+   const char *database = NULL;
+   const char *dir = "dump";
+   const char *host = "127.0.0.1";
+   uint16_t port = 27017;
+   bool ssl = false;
+   char *uri;
+   int ret;
+   int i;
+
+   mongoc_init ();
+
+   for (i = 1; i < argc; i++) {
+      if (0 == strcmp (argv[i], "-c") && ((i + 1) < argc)) {
+         collection = argv[++i];
+      } else if (0 == strcmp (argv[i], "-d") && ((i + 1) < argc)) {
+         database = argv[++i];
+      } else if (0 == strcmp (argv[i], "--dir") && ((i + 1) < argc)) {
+         dir = argv[++i];
+      } else if (0 == strcmp (argv[i], "--drop")) {
+         drop = true;
+      } else if (0 == strcmp (argv[i], "--gzip")) {
+         gzip = true;
+      } else if (0 == strcmp (argv[i], "-j") && ((i + 1) < argc)) {
+         jobs = atoi (argv[++i]);
+         if (jobs < 1) {
+            fprintf (stderr, "Invalid jobs \"%s\"", argv[i]);
+            return EXIT_FAILURE;
+         }
+      } else if (0 == strcmp (argv[i], "--help")) {
+         usage (stdout);
+         return EXIT_SUCCESS;
+      } else if (0 == strcmp (argv[i], "-h") && ((i + 1) < argc)) {
+         host = argv[++i];
+      } else if (0 == strcmp (argv[i], "--ssl")) {
+         ssl = true;
+      } else if (0 == strcmp (argv[i], "-p") && ((i + 1) < argc)) {
+         port = atoi (argv[++i]);
+         if (!port) {
+            fprintf (stderr, "Invalid port \"%s\"", argv[i]);
+            return EXIT_FAILURE;
+         }
+      } else {
+         fprintf (stderr, "Unknown argument \"%s\"\n", argv[i]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (collection && !database) {
+      fprintf (stderr, "-c requires -d\n");
+      return EXIT_FAILURE;
+   }
+
+   if (EXIT_SUCCESS != mongoc_restore_add (dir, database, collection)) {
+      return EXIT_FAILURE;
+   }
+
+   uri = bson_strdup_printf (
+      "mongodb://%s:%hu/?appname=restore-example&ssl=%s",
+      host,
+      port,
+      ssl ? "true" : "false");
+
+   if (!(mongoc_uri = mongoc_uri_new (uri))) {
+      fprintf (stderr, "Invalid connection URI: %s\n", uri);
+      return EXIT_FAILURE;
+   }
+
+   pool = mongoc_client_pool_new (mongoc_uri);
+   mongoc_client_pool_set_error_api (pool, 2);
+
+   ret = mongoc_restore ();
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (mongoc_uri);
+   bson_free (uri);
+   mongoc_cleanup ();
+
+   return ret;
+}
@@ -31,6 +31,8 @@ MD_FLAGS = [
     "MONGOC_MD_FLAG_ENABLE_RES_NCLOSE",
     "MONGOC_MD_FLAG_ENABLE_RES_QUERY",
     "MONGOC_MD_FLAG_ENABLE_DNSAPI",
+    "MONGOC_MD_FLAG_ENABLE_COMPRESSION_ZSTD",
+    "MONGOC_MD_FLAG_ENABLE_COMPRESSION_LIBDEFLATE",
 ]
 
 def main():
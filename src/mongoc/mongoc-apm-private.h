@@ -30,6 +30,7 @@ struct _mongoc_apm_callbacks_t {
    mongoc_apm_command_started_cb_t started;
    mongoc_apm_command_succeeded_cb_t succeeded;
    mongoc_apm_command_failed_cb_t failed;
+   mongoc_apm_command_span_cb_t span;
    mongoc_apm_server_changed_cb_t server_changed;
    mongoc_apm_server_opening_cb_t server_opening;
    mongoc_apm_server_closed_cb_t server_closed;
@@ -39,15 +40,26 @@ struct _mongoc_apm_callbacks_t {
    mongoc_apm_server_heartbeat_started_cb_t server_heartbeat_started;
    mongoc_apm_server_heartbeat_succeeded_cb_t server_heartbeat_succeeded;
    mongoc_apm_server_heartbeat_failed_cb_t server_heartbeat_failed;
+   mongoc_apm_connection_created_cb_t connection_created;
+   mongoc_apm_connection_ready_cb_t connection_ready;
+   mongoc_apm_connection_closed_cb_t connection_closed;
+   /* monitor the commands of one operation in this many, 0 or 1 for all */
+   uint32_t command_sample_rate;
 };
 
+/* builds an event's command or reply when a callback first asks for it */
+typedef void (*mongoc_apm_build_doc_t) (void *ctx, bson_t *doc);
+
 /*
  * command monitoring events
  */
 
 struct _mongoc_apm_command_started_t {
-   bson_t *command;
-   bool command_owned;
+   const bson_t *command;
+   bson_t command_storage;
+   mongoc_apm_build_doc_t build_command;
+   void *build_ctx;
+   bool command_built;
    const char *database_name;
    const char *command_name;
    int64_t request_id;
@@ -60,6 +72,10 @@ struct _mongoc_apm_command_started_t {
 struct _mongoc_apm_command_succeeded_t {
    int64_t duration;
    const bson_t *reply;
+   bson_t reply_storage;
+   mongoc_apm_build_doc_t build_reply;
+   void *build_ctx;
+   bool reply_built;
    const char *command_name;
    int64_t request_id;
    int64_t operation_id;
@@ -79,6 +95,19 @@ struct _mongoc_apm_command_failed_t {
    void *context;
 };
 
+struct _mongoc_apm_command_span_t {
+   const char *command_name;
+   int64_t request_id;
+   int64_t operation_id;
+   const mongoc_host_list_t *host;
+   uint32_t server_id;
+   bool succeeded;
+   int64_t start_time;
+   int64_t duration;
+   const int64_t *phases; /* MONGOC_APM_SPAN_LAST durations */
+   void *context;
+};
+
 /*
  * SDAM monitoring events
  */
@@ -139,6 +168,31 @@ struct _mongoc_apm_server_heartbeat_failed_t {
    void *context;
 };
 
+/*
+ * connection monitoring events
+ */
+
+struct _mongoc_apm_connection_created_t {
+   const mongoc_host_list_t *host;
+   uint32_t server_id;
+   void *context;
+};
+
+struct _mongoc_apm_connection_ready_t {
+   const mongoc_host_list_t *host;
+   uint32_t server_id;
+   int64_t duration;
+   const int64_t *phases; /* MONGOC_APM_CONNECTION_PHASE_LAST durations */
+   void *context;
+};
+
+struct _mongoc_apm_connection_closed_t {
+   const mongoc_host_list_t *host;
+   uint32_t server_id;
+   mongoc_apm_connection_closed_reason_t reason;
+   void *context;
+};
+
 void
 mongoc_apm_command_started_init (mongoc_apm_command_started_t *event,
                                  const bson_t *command,
@@ -150,6 +204,18 @@ mongoc_apm_command_started_init (mongoc_apm_command_started_t *event,
                                  uint32_t server_id,
                                  void *context);
 
+void
+mongoc_apm_command_started_init_lazy (mongoc_apm_command_started_t *event,
+                                      mongoc_apm_build_doc_t build_command,
+                                      void *build_ctx,
+                                      const char *database_name,
+                                      const char *command_name,
+                                      int64_t request_id,
+                                      int64_t operation_id,
+                                      const mongoc_host_list_t *host,
+                                      uint32_t server_id,
+                                      void *context);
+
 void
 mongoc_apm_command_started_cleanup (mongoc_apm_command_started_t *event);
 
@@ -164,6 +230,18 @@ mongoc_apm_command_succeeded_init (mongoc_apm_command_succeeded_t *event,
                                    uint32_t server_id,
                                    void *context);
 
+void
+mongoc_apm_command_succeeded_init_lazy (mongoc_apm_command_succeeded_t *event,
+                                        int64_t duration,
+                                        mongoc_apm_build_doc_t build_reply,
+                                        void *build_ctx,
+                                        const char *command_name,
+                                        int64_t request_id,
+                                        int64_t operation_id,
+                                        const mongoc_host_list_t *host,
+                                        uint32_t server_id,
+                                        void *context);
+
 void
 mongoc_apm_command_succeeded_cleanup (mongoc_apm_command_succeeded_t *event);
 
@@ -181,6 +259,10 @@ mongoc_apm_command_failed_init (mongoc_apm_command_failed_t *event,
 void
 mongoc_apm_command_failed_cleanup (mongoc_apm_command_failed_t *event);
 
+bool
+_mongoc_apm_command_sampled (const mongoc_apm_callbacks_t *callbacks,
+                             int64_t operation_id);
+
 BSON_END_DECLS
 
 #endif /* MONGOC_APM_PRIVATE_H */
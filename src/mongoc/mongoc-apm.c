@@ -42,6 +42,10 @@ mongoc_apm_command_started_init (mongoc_apm_command_started_t *event,
    uint32_t len;
    const uint8_t *data;
 
+   event->build_command = NULL;
+   event->build_ctx = NULL;
+   event->command_built = false;
+
    /* Command Monitoring Spec:
     *
     * In cases where queries or commands are embedded in a $query parameter
@@ -50,22 +54,18 @@ mongoc_apm_command_started_init (mongoc_apm_command_started_t *event,
     * event. The read preference will subsequently be dropped as it is
     * considered metadata and metadata is not currently provided in the command
     * events.
+    *
+    * The embedded document is used in place, without a copy.
     */
-   if (bson_has_field (command, "$readPreference")) {
-      if (bson_iter_init_find (&iter, command, "$query") &&
-          BSON_ITER_HOLDS_DOCUMENT (&iter)) {
-         bson_iter_document (&iter, &len, &data);
-         event->command = bson_new_from_data (data, len);
-         event->command_owned = true;
-      } else {
-         /* Got $readPreference without $query, probably OP_MSG */
-         event->command = (bson_t *) command;
-         event->command_owned = false;
-      }
+   if (bson_has_field (command, "$readPreference") &&
+       bson_iter_init_find (&iter, command, "$query") &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_iter_document (&iter, &len, &data);
+      BSON_ASSERT (bson_init_static (&event->command_storage, data, len));
+      event->command = &event->command_storage;
    } else {
-      /* discard "const", we promise not to modify "command" */
-      event->command = (bson_t *) command;
-      event->command_owned = false;
+      /* no $readPreference, or without $query as in OP_MSG */
+      event->command = command;
    }
 
    event->database_name = database_name;
@@ -78,11 +78,42 @@ mongoc_apm_command_started_init (mongoc_apm_command_started_t *event,
 }
 
 
+/* like mongoc_apm_command_started_init, but the command is built by
+ * @build_command only if a callback calls
+ * mongoc_apm_command_started_get_command. @build_ctx must outlive the event */
+void
+mongoc_apm_command_started_init_lazy (mongoc_apm_command_started_t *event,
+                                      mongoc_apm_build_doc_t build_command,
+                                      void *build_ctx,
+                                      const char *database_name,
+                                      const char *command_name,
+                                      int64_t request_id,
+                                      int64_t operation_id,
+                                      const mongoc_host_list_t *host,
+                                      uint32_t server_id,
+                                      void *context)
+{
+   BSON_ASSERT (build_command);
+
+   event->command = NULL;
+   event->build_command = build_command;
+   event->build_ctx = build_ctx;
+   event->command_built = false;
+   event->database_name = database_name;
+   event->command_name = command_name;
+   event->request_id = request_id;
+   event->operation_id = operation_id;
+   event->host = host;
+   event->server_id = server_id;
+   event->context = context;
+}
+
+
 void
 mongoc_apm_command_started_cleanup (mongoc_apm_command_started_t *event)
 {
-   if (event->command_owned) {
-      bson_destroy (event->command);
+   if (event->command_built) {
+      bson_destroy (&event->command_storage);
    }
 }
 
@@ -102,6 +133,40 @@ mongoc_apm_command_succeeded_init (mongoc_apm_command_succeeded_t *event,
 
    event->duration = duration;
    event->reply = reply;
+   event->build_reply = NULL;
+   event->build_ctx = NULL;
+   event->reply_built = false;
+   event->command_name = command_name;
+   event->request_id = request_id;
+   event->operation_id = operation_id;
+   event->host = host;
+   event->server_id = server_id;
+   event->context = context;
+}
+
+
+/* like mongoc_apm_command_succeeded_init, but the reply is built by
+ * @build_reply only if a callback calls
+ * mongoc_apm_command_succeeded_get_reply. @build_ctx must outlive the event */
+void
+mongoc_apm_command_succeeded_init_lazy (mongoc_apm_command_succeeded_t *event,
+                                        int64_t duration,
+                                        mongoc_apm_build_doc_t build_reply,
+                                        void *build_ctx,
+                                        const char *command_name,
+                                        int64_t request_id,
+                                        int64_t operation_id,
+                                        const mongoc_host_list_t *host,
+                                        uint32_t server_id,
+                                        void *context)
+{
+   BSON_ASSERT (build_reply);
+
+   event->duration = duration;
+   event->reply = NULL;
+   event->build_reply = build_reply;
+   event->build_ctx = build_ctx;
+   event->reply_built = false;
    event->command_name = command_name;
    event->request_id = request_id;
    event->operation_id = operation_id;
@@ -114,7 +179,9 @@ mongoc_apm_command_succeeded_init (mongoc_apm_command_succeeded_t *event,
 void
 mongoc_apm_command_succeeded_cleanup (mongoc_apm_command_succeeded_t *event)
 {
-   /* no-op */
+   if (event->reply_built) {
+      bson_destroy (&event->reply_storage);
+   }
 }
 
 
@@ -147,6 +214,27 @@ mongoc_apm_command_failed_cleanup (mongoc_apm_command_failed_t *event)
 }
 
 
+/* Sampling is by operation, so a sampled operation's commands, such as a
+ * cursor's find and getMores or a bulk write's batches, are all monitored
+ * and each command's started event is paired with its succeeded or failed
+ * event. Operation ids count up, so they're hashed to spread them evenly. */
+bool
+_mongoc_apm_command_sampled (const mongoc_apm_callbacks_t *callbacks,
+                             int64_t operation_id)
+{
+   uint64_t hash;
+
+   if (callbacks->command_sample_rate <= 1) {
+      return true;
+   }
+
+   /* Fibonacci hashing */
+   hash = (uint64_t) operation_id * 11400714819323198485ull;
+
+   return (hash >> 32) % callbacks->command_sample_rate == 0;
+}
+
+
 /*
  * event field accessors
  */
@@ -157,6 +245,17 @@ const bson_t *
 mongoc_apm_command_started_get_command (
    const mongoc_apm_command_started_t *event)
 {
+   mongoc_apm_command_started_t *e;
+
+   if (!event->command) {
+      /* discard "const", the command is built the first time it's needed */
+      e = (mongoc_apm_command_started_t *) event;
+      bson_init (&e->command_storage);
+      e->build_command (e->build_ctx, &e->command_storage);
+      e->command_built = true;
+      e->command = &e->command_storage;
+   }
+
    return event->command;
 }
 
@@ -230,6 +329,17 @@ const bson_t *
 mongoc_apm_command_succeeded_get_reply (
    const mongoc_apm_command_succeeded_t *event)
 {
+   mongoc_apm_command_succeeded_t *e;
+
+   if (!event->reply) {
+      /* discard "const", the reply is built the first time it's needed */
+      e = (mongoc_apm_command_succeeded_t *) event;
+      bson_init (&e->reply_storage);
+      e->build_reply (e->build_ctx, &e->reply_storage);
+      e->reply_built = true;
+      e->reply = &e->reply_storage;
+   }
+
    return event->reply;
 }
 
@@ -346,6 +456,85 @@ mongoc_apm_command_failed_get_context (const mongoc_apm_command_failed_t *event)
 }
 
 
+/* command-span event fields */
+
+const char *
+mongoc_apm_command_span_get_command_name (
+   const mongoc_apm_command_span_t *event)
+{
+   return event->command_name;
+}
+
+
+int64_t
+mongoc_apm_command_span_get_request_id (const mongoc_apm_command_span_t *event)
+{
+   return event->request_id;
+}
+
+
+int64_t
+mongoc_apm_command_span_get_operation_id (
+   const mongoc_apm_command_span_t *event)
+{
+   return event->operation_id;
+}
+
+
+const mongoc_host_list_t *
+mongoc_apm_command_span_get_host (const mongoc_apm_command_span_t *event)
+{
+   return event->host;
+}
+
+
+uint32_t
+mongoc_apm_command_span_get_server_id (const mongoc_apm_command_span_t *event)
+{
+   return event->server_id;
+}
+
+
+bool
+mongoc_apm_command_span_get_succeeded (const mongoc_apm_command_span_t *event)
+{
+   return event->succeeded;
+}
+
+
+int64_t
+mongoc_apm_command_span_get_start_time (const mongoc_apm_command_span_t *event)
+{
+   return event->start_time;
+}
+
+
+int64_t
+mongoc_apm_command_span_get_duration (const mongoc_apm_command_span_t *event)
+{
+   return event->duration;
+}
+
+
+int64_t
+mongoc_apm_command_span_get_phase_duration (
+   const mongoc_apm_command_span_t *event, mongoc_apm_span_phase_t phase)
+{
+   if ((int) phase < 0 || phase >= MONGOC_APM_SPAN_LAST) {
+      return 0;
+   }
+
+   return event->phases[phase];
+}
+
+
+void *
+mongoc_apm_command_span_get_context (const mongoc_apm_command_span_t *event)
+{
+   return event->context;
+}
+
+
 /* server-changed event fields */
 
 const mongoc_host_list_t *
@@ -590,6 +779,113 @@ mongoc_apm_server_heartbeat_failed_get_context (
 }
 
 
+/* connection-created event fields */
+
+const mongoc_host_list_t *
+mongoc_apm_connection_created_get_host (
+   const mongoc_apm_connection_created_t *event)
+{
+   return event->host;
+}
+
+
+uint32_t
+mongoc_apm_connection_created_get_server_id (
+   const mongoc_apm_connection_created_t *event)
+{
+   return event->server_id;
+}
+
+
+void *
+mongoc_apm_connection_created_get_context (
+   const mongoc_apm_connection_created_t *event)
+{
+   return event->context;
+}
+
+
+/* connection-ready event fields */
+
+const mongoc_host_list_t *
+mongoc_apm_connection_ready_get_host (
+   const mongoc_apm_connection_ready_t *event)
+{
+   return event->host;
+}
+
+
+uint32_t
+mongoc_apm_connection_ready_get_server_id (
+   const mongoc_apm_connection_ready_t *event)
+{
+   return event->server_id;
+}
+
+
+int64_t
+mongoc_apm_connection_ready_get_duration (
+   const mongoc_apm_connection_ready_t *event)
+{
+   return event->duration;
+}
+
+
+int64_t
+mongoc_apm_connection_ready_get_phase_duration (
+   const mongoc_apm_connection_ready_t *event,
+   mongoc_apm_connection_phase_t phase)
+{
+   if ((int) phase < 0 || phase >= MONGOC_APM_CONNECTION_PHASE_LAST) {
+      return 0;
+   }
+
+   return event->phases[phase];
+}
+
+
+void *
+mongoc_apm_connection_ready_get_context (
+   const mongoc_apm_connection_ready_t *event)
+{
+   return event->context;
+}
+
+
+/* connection-closed event fields */
+
+const mongoc_host_list_t *
+mongoc_apm_connection_closed_get_host (
+   const mongoc_apm_connection_closed_t *event)
+{
+   return event->host;
+}
+
+
+uint32_t
+mongoc_apm_connection_closed_get_server_id (
+   const mongoc_apm_connection_closed_t *event)
+{
+   return event->server_id;
+}
+
+
+mongoc_apm_connection_closed_reason_t
+mongoc_apm_connection_closed_get_reason (
+   const mongoc_apm_connection_closed_t *event)
+{
+   return event->reason;
+}
+
+
+void *
+mongoc_apm_connection_closed_get_context (
+   const mongoc_apm_connection_closed_t *event)
+{
+   return event->context;
+}
+
+
 /*
  * registering callbacks
  */
@@ -633,6 +929,20 @@ mongoc_apm_set_command_failed_cb (mongoc_apm_callbacks_t *callbacks,
    callbacks->failed = cb;
 }
 
+void
+mongoc_apm_set_command_span_cb (mongoc_apm_callbacks_t *callbacks,
+                                mongoc_apm_command_span_cb_t cb)
+{
+   callbacks->span = cb;
+}
+
+void
+mongoc_apm_set_command_sample_rate (mongoc_apm_callbacks_t *callbacks,
+                                    uint32_t one_in)
+{
+   callbacks->command_sample_rate = one_in;
+}
+
 void
 mongoc_apm_set_server_changed_cb (mongoc_apm_callbacks_t *callbacks,
                                   mongoc_apm_server_changed_cb_t cb)
@@ -706,3 +1016,27 @@ mongoc_apm_set_server_heartbeat_failed_cb (
 {
    callbacks->server_heartbeat_failed = cb;
 }
+
+
+void
+mongoc_apm_set_connection_created_cb (mongoc_apm_callbacks_t *callbacks,
+                                      mongoc_apm_connection_created_cb_t cb)
+{
+   callbacks->connection_created = cb;
+}
+
+
+void
+mongoc_apm_set_connection_ready_cb (mongoc_apm_callbacks_t *callbacks,
+                                    mongoc_apm_connection_ready_cb_t cb)
+{
+   callbacks->connection_ready = cb;
+}
+
+
+void
+mongoc_apm_set_connection_closed_cb (mongoc_apm_callbacks_t *callbacks,
+                                     mongoc_apm_connection_closed_cb_t cb)
+{
+   callbacks->connection_closed = cb;
+}
@@ -56,6 +56,20 @@ typedef struct _mongoc_apm_callbacks_t mongoc_apm_callbacks_t;
 typedef struct _mongoc_apm_command_started_t mongoc_apm_command_started_t;
 typedef struct _mongoc_apm_command_succeeded_t mongoc_apm_command_succeeded_t;
 typedef struct _mongoc_apm_command_failed_t mongoc_apm_command_failed_t;
+typedef struct _mongoc_apm_command_span_t mongoc_apm_command_span_t;
+
+/* where the time before and during a command went, in order */
+typedef enum {
+   MONGOC_APM_SPAN_CLIENT_CHECKOUT,
+   MONGOC_APM_SPAN_SERVER_SELECTION,
+   MONGOC_APM_SPAN_CONNECTION,
+   MONGOC_APM_SPAN_COMPRESS,
+   MONGOC_APM_SPAN_SEND,
+   MONGOC_APM_SPAN_SERVER_WAIT,
+   MONGOC_APM_SPAN_RECEIVE,
+   MONGOC_APM_SPAN_DECOMPRESS,
+   MONGOC_APM_SPAN_LAST
+} mongoc_apm_span_phase_t;
 
 
 /*
@@ -75,6 +89,33 @@ typedef struct _mongoc_apm_server_heartbeat_succeeded_t
 typedef struct _mongoc_apm_server_heartbeat_failed_t
    mongoc_apm_server_heartbeat_failed_t;
 
+
+/*
+ * connection monitoring events
+ */
+
+typedef struct _mongoc_apm_connection_created_t
+   mongoc_apm_connection_created_t;
+typedef struct _mongoc_apm_connection_ready_t mongoc_apm_connection_ready_t;
+typedef struct _mongoc_apm_connection_closed_t mongoc_apm_connection_closed_t;
+
+/* the steps of establishing a connection, in order */
+typedef enum {
+   MONGOC_APM_CONNECTION_PHASE_CONNECT,
+   MONGOC_APM_CONNECTION_PHASE_TLS,
+   MONGOC_APM_CONNECTION_PHASE_HANDSHAKE,
+   MONGOC_APM_CONNECTION_PHASE_AUTH,
+   MONGOC_APM_CONNECTION_PHASE_LAST
+} mongoc_apm_connection_phase_t;
+
+typedef enum {
+   MONGOC_APM_CONNECTION_CLOSED_CLIENT_CLOSED,
+   MONGOC_APM_CONNECTION_CLOSED_ERROR,
+   MONGOC_APM_CONNECTION_CLOSED_STALE,
+   MONGOC_APM_CONNECTION_CLOSED_IDLE,
+   MONGOC_APM_CONNECTION_CLOSED_EXPIRED
+} mongoc_apm_connection_closed_reason_t;
+
 /*
  * event field accessors
  */
@@ -159,6 +200,32 @@ MONGOC_EXPORT (void *)
 mongoc_apm_command_failed_get_context (
    const mongoc_apm_command_failed_t *event);
 
+/* command-span event fields */
+
+MONGOC_EXPORT (const char *)
+mongoc_apm_command_span_get_command_name (
+   const mongoc_apm_command_span_t *event);
+MONGOC_EXPORT (int64_t)
+mongoc_apm_command_span_get_request_id (const mongoc_apm_command_span_t *event);
+MONGOC_EXPORT (int64_t)
+mongoc_apm_command_span_get_operation_id (
+   const mongoc_apm_command_span_t *event);
+MONGOC_EXPORT (const mongoc_host_list_t *)
+mongoc_apm_command_span_get_host (const mongoc_apm_command_span_t *event);
+MONGOC_EXPORT (uint32_t)
+mongoc_apm_command_span_get_server_id (const mongoc_apm_command_span_t *event);
+MONGOC_EXPORT (bool)
+mongoc_apm_command_span_get_succeeded (const mongoc_apm_command_span_t *event);
+MONGOC_EXPORT (int64_t)
+mongoc_apm_command_span_get_start_time (const mongoc_apm_command_span_t *event);
+MONGOC_EXPORT (int64_t)
+mongoc_apm_command_span_get_duration (const mongoc_apm_command_span_t *event);
+MONGOC_EXPORT (int64_t)
+mongoc_apm_command_span_get_phase_duration (
+   const mongoc_apm_command_span_t *event, mongoc_apm_span_phase_t phase);
+MONGOC_EXPORT (void *)
+mongoc_apm_command_span_get_context (const mongoc_apm_command_span_t *event);
+
 /* server-changed event fields */
 
 MONGOC_EXPORT (const mongoc_host_list_t *)
@@ -269,6 +336,52 @@ MONGOC_EXPORT (void *)
 mongoc_apm_server_heartbeat_failed_get_context (
    const mongoc_apm_server_heartbeat_failed_t *event);
 
+/* connection-created event fields */
+
+MONGOC_EXPORT (const mongoc_host_list_t *)
+mongoc_apm_connection_created_get_host (
+   const mongoc_apm_connection_created_t *event);
+MONGOC_EXPORT (uint32_t)
+mongoc_apm_connection_created_get_server_id (
+   const mongoc_apm_connection_created_t *event);
+MONGOC_EXPORT (void *)
+mongoc_apm_connection_created_get_context (
+   const mongoc_apm_connection_created_t *event);
+
+/* connection-ready event fields */
+
+MONGOC_EXPORT (const mongoc_host_list_t *)
+mongoc_apm_connection_ready_get_host (
+   const mongoc_apm_connection_ready_t *event);
+MONGOC_EXPORT (uint32_t)
+mongoc_apm_connection_ready_get_server_id (
+   const mongoc_apm_connection_ready_t *event);
+MONGOC_EXPORT (int64_t)
+mongoc_apm_connection_ready_get_duration (
+   const mongoc_apm_connection_ready_t *event);
+MONGOC_EXPORT (int64_t)
+mongoc_apm_connection_ready_get_phase_duration (
+   const mongoc_apm_connection_ready_t *event,
+   mongoc_apm_connection_phase_t phase);
+MONGOC_EXPORT (void *)
+mongoc_apm_connection_ready_get_context (
+   const mongoc_apm_connection_ready_t *event);
+
+/* connection-closed event fields */
+
+MONGOC_EXPORT (const mongoc_host_list_t *)
+mongoc_apm_connection_closed_get_host (
+   const mongoc_apm_connection_closed_t *event);
+MONGOC_EXPORT (uint32_t)
+mongoc_apm_connection_closed_get_server_id (
+   const mongoc_apm_connection_closed_t *event);
+MONGOC_EXPORT (mongoc_apm_connection_closed_reason_t)
+mongoc_apm_connection_closed_get_reason (
+   const mongoc_apm_connection_closed_t *event);
+MONGOC_EXPORT (void *)
+mongoc_apm_connection_closed_get_context (
+   const mongoc_apm_connection_closed_t *event);
+
 
 /*
  * callbacks
@@ -280,6 +393,8 @@ typedef void (*mongoc_apm_command_succeeded_cb_t) (
    const mongoc_apm_command_succeeded_t *event);
 typedef void (*mongoc_apm_command_failed_cb_t) (
    const mongoc_apm_command_failed_t *event);
+typedef void (*mongoc_apm_command_span_cb_t) (
+   const mongoc_apm_command_span_t *event);
 typedef void (*mongoc_apm_server_changed_cb_t) (
    const mongoc_apm_server_changed_t *event);
 typedef void (*mongoc_apm_server_opening_cb_t) (
@@ -298,6 +413,12 @@ typedef void (*mongoc_apm_server_heartbeat_succeeded_cb_t) (
    const mongoc_apm_server_heartbeat_succeeded_t *event);
 typedef void (*mongoc_apm_server_heartbeat_failed_cb_t) (
    const mongoc_apm_server_heartbeat_failed_t *event);
+typedef void (*mongoc_apm_connection_created_cb_t) (
+   const mongoc_apm_connection_created_t *event);
+typedef void (*mongoc_apm_connection_ready_cb_t) (
+   const mongoc_apm_connection_ready_t *event);
+typedef void (*mongoc_apm_connection_closed_cb_t) (
+   const mongoc_apm_connection_closed_t *event);
 
 /*
  * registering callbacks
@@ -317,6 +438,12 @@ MONGOC_EXPORT (void)
 mongoc_apm_set_command_failed_cb (mongoc_apm_callbacks_t *callbacks,
                                   mongoc_apm_command_failed_cb_t cb);
 MONGOC_EXPORT (void)
+mongoc_apm_set_command_span_cb (mongoc_apm_callbacks_t *callbacks,
+                                mongoc_apm_command_span_cb_t cb);
+MONGOC_EXPORT (void)
+mongoc_apm_set_command_sample_rate (mongoc_apm_callbacks_t *callbacks,
+                                    uint32_t one_in);
+MONGOC_EXPORT (void)
 mongoc_apm_set_server_changed_cb (mongoc_apm_callbacks_t *callbacks,
                                   mongoc_apm_server_changed_cb_t cb);
 MONGOC_EXPORT (void)
@@ -346,6 +473,15 @@ MONGOC_EXPORT (void)
 mongoc_apm_set_server_heartbeat_failed_cb (
    mongoc_apm_callbacks_t *callbacks,
    mongoc_apm_server_heartbeat_failed_cb_t cb);
+MONGOC_EXPORT (void)
+mongoc_apm_set_connection_created_cb (mongoc_apm_callbacks_t *callbacks,
+                                      mongoc_apm_connection_created_cb_t cb);
+MONGOC_EXPORT (void)
+mongoc_apm_set_connection_ready_cb (mongoc_apm_callbacks_t *callbacks,
+                                    mongoc_apm_connection_ready_cb_t cb);
+MONGOC_EXPORT (void)
+mongoc_apm_set_connection_closed_cb (mongoc_apm_callbacks_t *callbacks,
+                                     mongoc_apm_connection_closed_cb_t cb);
 BSON_END_DECLS
 
 #endif /* MONGOC_APM_H */
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_ARENA_PRIVATE_H
+#define MONGOC_ARENA_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+BSON_BEGIN_DECLS
+
+#define MONGOC_ARENA_SIZE 4096
+
+/* A bump allocator for an operation's short-lived objects, such as its
+ * server stream. Allocations come from one block, allocated on first use
+ * and kept; the block is rewound once everything allocated from it has
+ * been freed, which happens at the end of each operation. Allocations that
+ * don't fit, because the block is full or is pinned by a long-lived object
+ * such as a prefetching cursor's stream, fall back to the heap.
+ *
+ * Like its cluster, not thread-safe. */
+typedef struct _mongoc_arena_t {
+   uint8_t *block;
+   size_t used;
+   uint32_t n_live;
+} mongoc_arena_t;
+
+void
+_mongoc_arena_init (mongoc_arena_t *arena);
+
+void *
+_mongoc_arena_alloc (mongoc_arena_t *arena, size_t size);
+
+void *
+_mongoc_arena_alloc0 (mongoc_arena_t *arena, size_t size);
+
+void
+_mongoc_arena_free (mongoc_arena_t *arena, void *mem);
+
+void
+_mongoc_arena_destroy (mongoc_arena_t *arena);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_ARENA_PRIVATE_H */
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-arena-private.h"
+
+/* malloc's alignment, enough for any object */
+#define MONGOC_ARENA_ALIGN 16
+
+
+void
+_mongoc_arena_init (mongoc_arena_t *arena)
+{
+   arena->block = NULL;
+   arena->used = 0;
+   arena->n_live = 0;
+}
+
+
+static bool
+_mongoc_arena_owns (const mongoc_arena_t *arena, const void *mem)
+{
+   return arena->block && (const uint8_t *) mem >= arena->block &&
+          (const uint8_t *) mem < arena->block + MONGOC_ARENA_SIZE;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_arena_alloc --
+ *
+ *       Allocate @size bytes from @arena's block, or from the heap if
+ *       they don't fit. @arena may be NULL, to allocate from the heap.
+ *
+ * Returns:
+ *       Memory to release with _mongoc_arena_free.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+_mongoc_arena_alloc (mongoc_arena_t *arena, size_t size)
+{
+   size_t rounded;
+   void *mem;
+
+   /* keep each allocation aligned, and at least one byte so it's owned */
+   rounded = (BSON_MAX (size, (size_t) 1) + MONGOC_ARENA_ALIGN - 1) &
+             ~((size_t) MONGOC_ARENA_ALIGN - 1);
+
+   if (!arena || rounded > MONGOC_ARENA_SIZE - arena->used) {
+      return bson_malloc (size);
+   }
+
+   if (!arena->block) {
+      arena->block = (uint8_t *) bson_malloc (MONGOC_ARENA_SIZE);
+   }
+
+   mem = arena->block + arena->used;
+   arena->used += rounded;
+   arena->n_live++;
+
+   return mem;
+}
+
+
+void *
+_mongoc_arena_alloc0 (mongoc_arena_t *arena, size_t size)
+{
+   void *mem;
+
+   mem = _mongoc_arena_alloc (arena, size);
+   memset (mem, 0, size);
+
+   return mem;
+}
+
+
+/* release memory from _mongoc_arena_alloc, rewinding the block once its
+ * last allocation is freed */
+void
+_mongoc_arena_free (mongoc_arena_t *arena, void *mem)
+{
+   if (!arena || !_mongoc_arena_owns (arena, mem)) {
+      bson_free (mem);
+      return;
+   }
+
+   BSON_ASSERT (arena->n_live > 0);
+   if (--arena->n_live == 0) {
+      arena->used = 0;
+   }
+}
+
+
+void
+_mongoc_arena_destroy (mongoc_arena_t *arena)
+{
+   /* everything allocated from the block must have been freed */
+   BSON_ASSERT (arena->n_live == 0);
+
+   bson_free (arena->block);
+   arena->block = NULL;
+   arena->used = 0;
+}
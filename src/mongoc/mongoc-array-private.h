@@ -35,6 +35,7 @@ struct _mongoc_array_t {
    size_t element_size;
    size_t allocated;
    void *data;
+   void *inline_data; /* caller's buffer, used until it's outgrown */
 };
 
 
@@ -46,6 +47,11 @@ struct _mongoc_array_t {
 void
 _mongoc_array_init (mongoc_array_t *array, size_t element_size);
 void
+_mongoc_array_init_inline (mongoc_array_t *array,
+                           size_t element_size,
+                           void *buf,
+                           size_t buf_size);
+void
 _mongoc_array_copy (mongoc_array_t *dst, const mongoc_array_t *src);
 void
 _mongoc_array_append_vals (mongoc_array_t *array,
@@ -28,6 +28,39 @@ _mongoc_array_init (mongoc_array_t *array, size_t element_size)
    array->element_size = element_size;
    array->allocated = 128;
    array->data = (void *) bson_malloc0 (array->allocated);
+   array->inline_data = NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_array_init_inline --
+ *
+ *       Initialize @array to store its elements in @buf, which the caller
+ *       provides, usually on the stack or beside @array in a struct, and
+ *       keeps alive until the array is destroyed. The array moves to the
+ *       heap only if it outgrows @buf_size bytes, so short-lived arrays
+ *       that stay small never allocate.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_array_init_inline (mongoc_array_t *array,
+                           size_t element_size,
+                           void *buf,
+                           size_t buf_size)
+{
+   BSON_ASSERT (array);
+   BSON_ASSERT (element_size);
+   BSON_ASSERT (buf);
+
+   array->len = 0;
+   array->element_size = element_size;
+   array->allocated = buf_size;
+   array->data = buf;
+   array->inline_data = buf;
 }
 
 
@@ -56,6 +89,7 @@ _mongoc_array_copy (mongoc_array_t *dst, const mongoc_array_t *src)
    dst->element_size = src->element_size;
    dst->allocated = src->allocated;
    dst->data = (void *) bson_malloc (dst->allocated);
+   dst->inline_data = NULL;
    memcpy (dst->data, src->data, dst->allocated);
 }
 
@@ -63,7 +97,7 @@ _mongoc_array_copy (mongoc_array_t *dst, const mongoc_array_t *src)
 void
 _mongoc_array_destroy (mongoc_array_t *array)
 {
-   if (array && array->data) {
+   if (array && array->data && array->data != array->inline_data) {
       bson_free (array->data);
    }
 }
@@ -85,7 +119,13 @@ _mongoc_array_append_vals (mongoc_array_t *array,
    len = (size_t) n_elements * array->element_size;
    if ((off + len) > array->allocated) {
       next_size = bson_next_power_of_two (off + len);
-      array->data = (void *) bson_realloc (array->data, next_size);
+      if (array->inline_data && array->data == array->inline_data) {
+         /* spill from the caller's buffer to the heap */
+         array->data = (void *) bson_malloc (next_size);
+         memcpy (array->data, array->inline_data, off);
+      } else {
+         array->data = (void *) bson_realloc (array->data, next_size);
+      }
       array->allocated = next_size;
    }
 
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_ASYNC_CLIENT_PRIVATE_H
+#define MONGOC_ASYNC_CLIENT_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-async-client.h"
+
+
+BSON_BEGIN_DECLS
+
+
+void
+_mongoc_async_client_command_server_id (mongoc_async_client_t *async_client,
+                                        const char *db_name,
+                                        const bson_t *command,
+                                        const mongoc_read_prefs_t *read_prefs,
+                                        uint32_t *server_id,
+                                        mongoc_async_client_cb_t cb,
+                                        void *ctx);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_ASYNC_CLIENT_PRIVATE_H */
@@ -0,0 +1,903 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-async-client.h"
+#include "mongoc-async-client-private.h"
+#include "mongoc-async-cmd-private.h"
+#include "mongoc-async-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-cluster-private.h"
+#include "mongoc-collection-private.h"
+#include "mongoc-error.h"
+#include "mongoc-read-prefs-private.h"
+#include "mongoc-rpc-private.h"
+#include "mongoc-set-private.h"
+#include "mongoc-topology-private.h"
+#include "mongoc-trace-private.h"
+#include "mongoc-util-private.h"
+#include "utlist.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "async-client"
+
+
+/* how often to retry server selection while no server is suitable */
+#define MONGOC_ASYNC_CLIENT_SELECTION_RETRY_MS 50
+
+
+typedef struct _mongoc_async_client_op_t {
+   mongoc_async_client_t *async_client;
+   char *db_name;
+   bson_t command;
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_async_client_cb_t cb;
+   void *ctx;
+   int64_t expire_at; /* for server selection */
+   uint32_t server_id;
+   uint32_t *selected_server_id; /* to record the selected server */
+   mongoc_cluster_node_t *node; /* while the command runs */
+   bool success;
+   bson_t reply;
+   bson_error_t error;
+   struct _mongoc_async_client_op_t *next;
+   struct _mongoc_async_client_op_t *prev;
+} mongoc_async_client_op_t;
+
+
+/* one server's connections */
+typedef struct {
+   uint32_t server_id;
+   uint32_t n_connections; /* idle, in use, and connecting */
+   mongoc_array_t idle;    /* mongoc_cluster_node_t *, most recently used last */
+   mongoc_async_client_op_t *waiting; /* for a connection, at maxPoolSize */
+} mongoc_async_client_server_t;
+
+
+struct _mongoc_async_client_t {
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client; /* for the topology, URI, and credentials */
+   mongoc_async_t *async;
+   mongoc_set_t *servers; /* mongoc_async_client_server_t */
+   uint32_t max_connections;
+   int64_t timeout_msec;
+   mongoc_async_client_op_t *selecting;
+   mongoc_async_client_op_t *done; /* callbacks due */
+   size_t n_ops;
+   bool shutting_down;
+};
+
+
+static void
+_mongoc_async_client_server_dtor (void *item, void *ctx)
+{
+   mongoc_async_client_server_t *server = (mongoc_async_client_server_t *) item;
+   size_t i;
+
+   BSON_ASSERT (!server->waiting);
+
+   for (i = 0; i < server->idle.len; i++) {
+      _mongoc_cluster_node_destroy (
+         _mongoc_array_index (&server->idle, mongoc_cluster_node_t *, i));
+   }
+
+   _mongoc_array_destroy (&server->idle);
+   bson_free (server);
+}
+
+
+static mongoc_async_client_server_t *
+_mongoc_async_client_server (mongoc_async_client_t *async_client,
+                             uint32_t server_id)
+{
+   mongoc_async_client_server_t *server;
+
+   server = (mongoc_async_client_server_t *) mongoc_set_get (
+      async_client->servers, server_id);
+
+   if (!server) {
+      server = (mongoc_async_client_server_t *) bson_malloc0 (sizeof *server);
+      server->server_id = server_id;
+      _mongoc_array_init (&server->idle, sizeof (mongoc_cluster_node_t *));
+      mongoc_set_add (async_client->servers, server_id, server);
+   }
+
+   return server;
+}
+
+
+static void
+_mongoc_async_client_op_destroy (mongoc_async_client_op_t *op)
+{
+   bson_free (op->db_name);
+   bson_destroy (&op->command);
+   mongoc_read_prefs_destroy (op->read_prefs);
+   bson_destroy (&op->reply);
+   bson_free (op);
+}
+
+
+/* the operation is over, its callback runs at the end of this pass */
+static void
+_mongoc_async_client_op_done (mongoc_async_client_op_t *op)
+{
+   DL_APPEND (op->async_client->done, op);
+}
+
+
+static void
+_mongoc_async_client_op_fail (mongoc_async_client_op_t *op,
+                              const bson_error_t *error)
+{
+   op->success = false;
+   memcpy (&op->error, error, sizeof op->error);
+   _mongoc_async_client_op_done (op);
+}
+
+
+/* call back for finished operations. Callbacks may add operations */
+static void
+_mongoc_async_client_deliver (mongoc_async_client_t *async_client)
+{
+   mongoc_async_client_op_t *op;
+
+   while ((op = async_client->done)) {
+      DL_DELETE (async_client->done, op);
+      async_client->n_ops--;
+
+      op->cb (op->success,
+              &op->reply,
+              op->success ? NULL : &op->error,
+              op->ctx);
+
+      _mongoc_async_client_op_destroy (op);
+   }
+}
+
+
+static void
+_mongoc_async_client_connect (mongoc_async_client_op_t *op,
+                              mongoc_async_client_server_t *server);
+
+
+static void
+_mongoc_async_client_cmd_cb (mongoc_async_cmd_result_t result,
+                             const bson_t *reply,
+                             int64_t rtt_msec,
+                             void *data,
+                             bson_error_t *error);
+
+
+static void
+_mongoc_async_client_release (mongoc_async_client_t *async_client,
+                              uint32_t server_id,
+                              mongoc_cluster_node_t *node,
+                              bool healthy,
+                              const bson_error_t *error);
+
+
+/* send @op's command on @node, an established connection to its server */
+static void
+_mongoc_async_client_send (mongoc_async_client_op_t *op,
+                           mongoc_cluster_node_t *node)
+{
+   mongoc_async_client_t *async_client = op->async_client;
+   mongoc_topology_t *topology = async_client->client->topology;
+   mongoc_assemble_query_result_t result = ASSEMBLE_QUERY_RESULT_INIT;
+   mongoc_server_stream_t *server_stream;
+   bson_error_t error;
+
+   ENTRY;
+
+   node->last_used = bson_get_monotonic_time ();
+
+   server_stream = _mongoc_cluster_create_server_stream (
+      topology, op->server_id, node->stream, &error);
+
+   if (!server_stream) {
+      /* removed from the topology since selection */
+      _mongoc_async_client_op_fail (op, &error);
+      _mongoc_async_client_release (
+         async_client, op->server_id, node, false, &error);
+      EXIT;
+   }
+
+   op->node = node;
+
+   if (server_stream->topology_type == MONGOC_TOPOLOGY_UNKNOWN) {
+      result.assembled_query = &op->command;
+   } else {
+      /* $readPreference for mongos, and $clusterTime */
+      assemble_query (op->read_prefs,
+                      server_stream,
+                      &op->command,
+                      MONGOC_QUERY_NONE,
+                      true,
+                      &result);
+   }
+
+   mongoc_async_cmd_new (async_client->async,
+                         node->stream,
+                         NULL,
+                         NULL,
+                         op->db_name,
+                         result.assembled_query,
+                         _mongoc_async_client_cmd_cb,
+                         op,
+                         async_client->timeout_msec);
+
+   assemble_query_result_cleanup (&result);
+   mongoc_server_stream_cleanup (server_stream);
+
+   EXIT;
+}
+
+
+/* return @node to its server after an operation. Unless @healthy, the
+ * connection failed: close it and mark the server Unknown */
+static void
+_mongoc_async_client_release (mongoc_async_client_t *async_client,
+                              uint32_t server_id,
+                              mongoc_cluster_node_t *node,
+                              bool healthy,
+                              const bson_error_t *error)
+{
+   mongoc_async_client_server_t *server;
+   mongoc_async_client_op_t *op;
+
+   server = _mongoc_async_client_server (async_client, server_id);
+
+   if (!healthy) {
+      if (node) {
+         _mongoc_cluster_node_destroy (node);
+         node = NULL;
+      }
+
+      server->n_connections--;
+
+      if (!async_client->shutting_down) {
+         mongoc_topology_invalidate_server (
+            async_client->client->topology, server_id, error);
+      }
+   }
+
+   /* hand the connection, or the free slot, to the next waiting operation */
+   if ((op = server->waiting)) {
+      DL_DELETE (server->waiting, op);
+
+      if (async_client->shutting_down) {
+         _mongoc_async_client_op_fail (op, error);
+      } else if (node) {
+         _mongoc_async_client_send (op, node);
+         return;
+      } else {
+         _mongoc_async_client_connect (op, server);
+      }
+   }
+
+   if (node) {
+      _mongoc_array_append_val (&server->idle, node);
+   }
+}
+
+
+static void
+_mongoc_async_client_cmd_cb (mongoc_async_cmd_result_t result,
+                             const bson_t *reply,
+                             int64_t rtt_msec,
+                             void *data,
+                             bson_error_t *error)
+{
+   mongoc_async_client_op_t *op = (mongoc_async_client_op_t *) data;
+   mongoc_async_client_t *async_client = op->async_client;
+   mongoc_cluster_node_t *node = op->node;
+
+   op->node = NULL;
+
+   if (result != MONGOC_ASYNC_CMD_SUCCESS) {
+      _mongoc_async_client_release (
+         async_client, op->server_id, node, false, error);
+      _mongoc_async_client_op_fail (op, error);
+      return;
+   }
+
+   bson_destroy (&op->reply);
+   bson_copy_to (reply, &op->reply);
+
+   _mongoc_topology_update_cluster_time (async_client->client->topology,
+                                         reply);
+
+   op->success = _mongoc_cmd_check_ok (
+      reply, async_client->client->error_api_version, &op->error);
+
+   /* the operation is done before its connection goes to the next one */
+   _mongoc_async_client_op_done (op);
+   _mongoc_async_client_release (
+      async_client, op->server_id, node, true, NULL);
+}
+
+
+static void
+_mongoc_async_client_connected (mongoc_cluster_node_t *node,
+                                const bson_error_t *error,
+                                void *ctx)
+{
+   mongoc_async_client_op_t *op = (mongoc_async_client_op_t *) ctx;
+
+   if (!node) {
+      _mongoc_async_client_op_fail (op, error);
+      _mongoc_async_client_release (
+         op->async_client, op->server_id, NULL, false, error);
+      return;
+   }
+
+   _mongoc_async_client_send (op, node);
+}
+
+
+static void
+_mongoc_async_client_connect (mongoc_async_client_op_t *op,
+                              mongoc_async_client_server_t *server)
+{
+   server->n_connections++;
+
+   /* the handshake and SCRAM run in the async loop, too */
+   _mongoc_cluster_connect_async (&op->async_client->client->cluster,
+                                  op->async_client->async,
+                                  op->server_id,
+                                  _mongoc_async_client_connected,
+                                  op);
+}
+
+
+/* an idle connection to @server that is still current, or NULL */
+static mongoc_cluster_node_t *
+_mongoc_async_client_checkout (mongoc_async_client_t *async_client,
+                               mongoc_async_client_server_t *server)
+{
+   mongoc_cluster_t *cluster = &async_client->client->cluster;
+   mongoc_cluster_node_t *node;
+   int64_t timestamp;
+   int64_t now;
+
+   timestamp = mongoc_topology_server_timestamp (
+      async_client->client->topology, server->server_id);
+   now = bson_get_monotonic_time ();
+
+   while (server->idle.len) {
+      node = _mongoc_array_index (
+         &server->idle, mongoc_cluster_node_t *, server->idle.len - 1);
+      server->idle.len--;
+
+      /* as in mongoc_cluster_fetch_stream_pooled */
+      if (timestamp == -1 || node->timestamp < timestamp ||
+          (cluster->maxidletimems &&
+           now - node->last_used > (int64_t) cluster->maxidletimems * 1000)) {
+         _mongoc_cluster_node_destroy (node);
+         server->n_connections--;
+         continue;
+      }
+
+      return node;
+   }
+
+   return NULL;
+}
+
+
+/* run @op on its selected server */
+static void
+_mongoc_async_client_start (mongoc_async_client_op_t *op)
+{
+   mongoc_async_client_t *async_client = op->async_client;
+   mongoc_async_client_server_t *server;
+   mongoc_cluster_node_t *node;
+
+   server = _mongoc_async_client_server (async_client, op->server_id);
+   node = _mongoc_async_client_checkout (async_client, server);
+
+   if (node) {
+      _mongoc_async_client_send (op, node);
+   } else if (server->n_connections < async_client->max_connections) {
+      _mongoc_async_client_connect (op, server);
+   } else {
+      DL_APPEND (server->waiting, op);
+   }
+}
+
+
+/* select @op's server, or leave it in async_client->selecting to retry */
+static void
+_mongoc_async_client_select (mongoc_async_client_op_t *op)
+{
+   mongoc_async_client_t *async_client = op->async_client;
+   bson_error_t error;
+
+   if (!_mongoc_topology_try_select_server_id (async_client->client->topology,
+                                               MONGOC_SS_READ,
+                                               op->read_prefs,
+                                               op->expire_at,
+                                               &op->server_id,
+                                               &error)) {
+      DL_APPEND (async_client->selecting, op);
+      return;
+   }
+
+   if (!op->server_id) {
+      _mongoc_async_client_op_fail (op, &error);
+      return;
+   }
+
+   if (op->selected_server_id) {
+      *op->selected_server_id = op->server_id;
+   }
+
+   _mongoc_async_client_start (op);
+}
+
+
+/* retry selection for operations that found no suitable server */
+static void
+_mongoc_async_client_retry_selection (mongoc_async_client_t *async_client)
+{
+   mongoc_async_client_op_t *selecting;
+   mongoc_async_client_op_t *op, *tmp;
+
+   selecting = async_client->selecting;
+   async_client->selecting = NULL;
+   DL_FOREACH_SAFE (selecting, op, tmp)
+   {
+      DL_DELETE (selecting, op);
+      _mongoc_async_client_select (op);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_client_new --
+ *
+ *       Create an async client that runs commands on servers of @pool's
+ *       topology. It pops one client from @pool for its settings and
+ *       keeps its own connections, up to maxPoolSize per server.
+ *
+ *       An async client must be used by one thread at a time; make one
+ *       per thread to use @pool from several threads.
+ *
+ * Returns:
+ *       A newly allocated mongoc_async_client_t.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_async_client_t *
+mongoc_async_client_new (mongoc_client_pool_t *pool)
+{
+   mongoc_async_client_t *async_client;
+   const mongoc_uri_t *uri;
+
+   BSON_ASSERT (pool);
+
+   async_client =
+      (mongoc_async_client_t *) bson_malloc0 (sizeof *async_client);
+   async_client->pool = pool;
+   async_client->client = mongoc_client_pool_pop (pool);
+   async_client->async = mongoc_async_new ();
+   async_client->servers =
+      mongoc_set_new (8, _mongoc_async_client_server_dtor, NULL);
+
+   uri = mongoc_client_get_uri (async_client->client);
+   async_client->max_connections = (uint32_t) BSON_MAX (
+      1, mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_MAXPOOLSIZE, 100));
+
+   /* socketTimeoutMS=0 means no timeout */
+   async_client->timeout_msec = async_client->client->cluster.sockettimeoutms;
+   if (!async_client->timeout_msec) {
+      async_client->timeout_msec = INT32_MAX / 2;
+   }
+
+   return async_client;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_client_destroy --
+ *
+ *       Cancel operations still in progress, calling their callbacks with
+ *       MONGOC_ERROR_CLIENT_OPERATION_CANCELED, then close connections and
+ *       return the client to the pool.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_async_client_destroy (mongoc_async_client_t *async_client)
+{
+   mongoc_async_cmd_t *acmd;
+   mongoc_async_client_op_t *op, *tmp;
+   bson_error_t error;
+
+   if (!async_client) {
+      return;
+   }
+
+   async_client->shutting_down = true;
+
+   bson_set_error (&error,
+                   MONGOC_ERROR_CLIENT,
+                   MONGOC_ERROR_CLIENT_OPERATION_CANCELED,
+                   "The async client was destroyed");
+
+   DL_FOREACH_SAFE (async_client->selecting, op, tmp)
+   {
+      DL_DELETE (async_client->selecting, op);
+      _mongoc_async_client_op_fail (op, &error);
+   }
+
+   /* commands in flight fail through their callbacks as canceled. Failed
+    * connections fail the operations waiting on them */
+   while (async_client->async->ncmds) {
+      DL_FOREACH (async_client->async->cmds, acmd)
+      {
+         memcpy (&acmd->error, &error, sizeof error);
+         acmd->state = MONGOC_ASYNC_CMD_CANCELED_STATE;
+      }
+
+      mongoc_async_run_once (async_client->async, 0);
+   }
+
+   _mongoc_async_client_deliver (async_client);
+   BSON_ASSERT (!async_client->n_ops);
+
+   mongoc_set_destroy (async_client->servers);
+   mongoc_async_destroy (async_client->async);
+   mongoc_client_pool_push (async_client->pool, async_client->client);
+
+   bson_free (async_client);
+}
+
+
+/* queue @command, or fail it at once with @invalid if set. If @server_id
+ * is set and nonzero, run on that server, otherwise select one and record
+ * it in @server_id if set */
+static void
+_mongoc_async_client_queue (mongoc_async_client_t *async_client,
+                            const char *db_name,
+                            const bson_t *command,
+                            const mongoc_read_prefs_t *read_prefs,
+                            uint32_t *server_id,
+                            mongoc_async_client_cb_t cb,
+                            void *ctx,
+                            const bson_error_t *invalid)
+{
+   mongoc_async_client_op_t *op;
+   bson_error_t error;
+
+   ENTRY;
+
+   op = (mongoc_async_client_op_t *) bson_malloc0 (sizeof *op);
+   op->async_client = async_client;
+   op->db_name = bson_strdup (db_name);
+   bson_copy_to (command, &op->command);
+   op->read_prefs = mongoc_read_prefs_copy (read_prefs);
+   op->cb = cb;
+   op->ctx = ctx;
+   op->expire_at =
+      bson_get_monotonic_time () +
+      async_client->client->topology->server_selection_timeout_msec * 1000;
+   bson_init (&op->reply);
+
+   async_client->n_ops++;
+
+   if (async_client->shutting_down) {
+      bson_set_error (&error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_OPERATION_CANCELED,
+                      "The async client was destroyed");
+      _mongoc_async_client_op_fail (op, &error);
+   } else if (invalid) {
+      _mongoc_async_client_op_fail (op, invalid);
+   } else if (!_mongoc_read_prefs_validate (read_prefs, &error)) {
+      _mongoc_async_client_op_fail (op, &error);
+   } else if (server_id && *server_id) {
+      op->server_id = *server_id;
+      _mongoc_async_client_start (op);
+   } else {
+      op->selected_server_id = server_id;
+      _mongoc_async_client_select (op);
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_client_command --
+ *
+ *       Begin running @command on @db_name and return at once. The server
+ *       is selected with @read_prefs, or the primary if NULL. When the
+ *       command completes, @cb receives its reply and @ctx from
+ *       mongoc_async_client_run_once or mongoc_async_client_run.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_async_client_command (mongoc_async_client_t *async_client,
+                             const char *db_name,
+                             const bson_t *command,
+                             const mongoc_read_prefs_t *read_prefs,
+                             mongoc_async_client_cb_t cb,
+                             void *ctx)
+{
+   BSON_ASSERT (async_client);
+   BSON_ASSERT (db_name);
+   BSON_ASSERT (command);
+   BSON_ASSERT (cb);
+
+   _mongoc_async_client_queue (
+      async_client, db_name, command, read_prefs, NULL, cb, ctx, NULL);
+}
+
+
+/* like mongoc_async_client_command, but run on *@server_id if it's nonzero,
+ * for example a getMore on the server that has the cursor. Otherwise,
+ * *@server_id is set when a server is selected. @server_id must be valid
+ * until @cb is called */
+void
+_mongoc_async_client_command_server_id (mongoc_async_client_t *async_client,
+                                        const char *db_name,
+                                        const bson_t *command,
+                                        const mongoc_read_prefs_t *read_prefs,
+                                        uint32_t *server_id,
+                                        mongoc_async_client_cb_t cb,
+                                        void *ctx)
+{
+   BSON_ASSERT (async_client);
+   BSON_ASSERT (db_name);
+   BSON_ASSERT (command);
+   BSON_ASSERT (server_id);
+   BSON_ASSERT (cb);
+
+   _mongoc_async_client_queue (
+      async_client, db_name, command, read_prefs, server_id, cb, ctx, NULL);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_client_create_indexes --
+ *
+ *       Begin creating @n_models indexes on @collection_name with one
+ *       createIndexes command on the primary, like
+ *       mongoc_collection_create_indexes_with_opts. Call this once per
+ *       collection to build indexes on many collections concurrently:
+ *       each command runs on its own pooled connection.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_async_client_create_indexes (mongoc_async_client_t *async_client,
+                                    const char *db_name,
+                                    const char *collection_name,
+                                    const bson_t *const *models,
+                                    size_t n_models,
+                                    mongoc_async_client_cb_t cb,
+                                    void *ctx)
+{
+   bson_t cmd;
+   bson_error_t error;
+   bool r;
+
+   BSON_ASSERT (async_client);
+   BSON_ASSERT (db_name);
+   BSON_ASSERT (collection_name);
+   BSON_ASSERT (models || n_models == 0);
+   BSON_ASSERT (cb);
+
+   r = _mongoc_collection_create_indexes_cmd (
+      collection_name, models, n_models, &cmd, &error);
+
+   _mongoc_async_client_queue (
+      async_client, db_name, &cmd, NULL, NULL, cb, ctx, r ? NULL : &error);
+
+   bson_destroy (&cmd);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_client_run_once --
+ *
+ *       Make progress on all operations, waiting up to @timeout_msec for
+ *       network activity, and call back for those that completed. A
+ *       negative @timeout_msec waits until something happens. Call this
+ *       from an application's event loop, with 0 not to block at all.
+ *
+ * Returns:
+ *       The number of operations still in progress.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+mongoc_async_client_run_once (mongoc_async_client_t *async_client,
+                              int32_t timeout_msec)
+{
+   ENTRY;
+
+   BSON_ASSERT (async_client);
+
+   _mongoc_async_client_retry_selection (async_client);
+   _mongoc_async_client_deliver (async_client);
+
+   if (async_client->selecting) {
+      /* the background thread may find a server meanwhile */
+      if (timeout_msec < 0 ||
+          timeout_msec > MONGOC_ASYNC_CLIENT_SELECTION_RETRY_MS) {
+         timeout_msec = MONGOC_ASYNC_CLIENT_SELECTION_RETRY_MS;
+      }
+
+      if (!async_client->async->ncmds) {
+         _mongoc_usleep ((int64_t) timeout_msec * 1000);
+      }
+   }
+
+   if (async_client->async->ncmds) {
+      mongoc_async_run_once (async_client->async, timeout_msec);
+   }
+
+   _mongoc_async_client_deliver (async_client);
+
+   RETURN (async_client->n_ops);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_client_run --
+ *
+ *       Run until all operations, including those added by callbacks,
+ *       have completed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_async_client_run (mongoc_async_client_t *async_client)
+{
+   BSON_ASSERT (async_client);
+
+   while (mongoc_async_client_run_once (async_client, -1)) {
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_client_get_fds --
+ *
+ *       For an application that runs its own event loop instead of
+ *       mongoc_async_client_run_once: copy up to @n_fds of the sockets
+ *       that operations wait on to @fds, with "events" set to the poll
+ *       events to wait for, and set *@timeout_msec to the longest the
+ *       application may wait before calling mongoc_async_client_process
+ *       anyway: 0 if callbacks are due, -1 if there is nothing to wait
+ *       for.
+ *
+ *       A socket may appear more than once. The set changes as
+ *       operations progress; get it again before each wait.
+ *
+ * Returns:
+ *       The number of sockets. If it is more than @n_fds, call again
+ *       with a larger array.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+mongoc_async_client_get_fds (mongoc_async_client_t *async_client,
+                             mongoc_async_client_fd_t *fds,
+                             size_t n_fds,
+                             int32_t *timeout_msec)
+{
+   int64_t expire_at = INT64_MAX;
+   int64_t now;
+   size_t count;
+
+   ENTRY;
+
+   BSON_ASSERT (async_client);
+   BSON_ASSERT (fds || !n_fds);
+   BSON_ASSERT (timeout_msec);
+
+   now = bson_get_monotonic_time ();
+
+   count =
+      mongoc_async_get_fds (async_client->async, fds, n_fds, &expire_at);
+
+   if (async_client->done) {
+      expire_at = now;
+   } else if (async_client->selecting) {
+      /* the background thread may find a server meanwhile */
+      expire_at = BSON_MIN (
+         expire_at, now + MONGOC_ASYNC_CLIENT_SELECTION_RETRY_MS * 1000);
+   }
+
+   if (expire_at == INT64_MAX) {
+      *timeout_msec = -1;
+   } else if (expire_at <= now) {
+      *timeout_msec = 0;
+   } else {
+      /* round up, so the deadline has passed when the application wakes */
+      *timeout_msec =
+         (int32_t) BSON_MIN ((expire_at - now + 999) / 1000, INT32_MAX);
+   }
+
+   RETURN (count);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_client_process --
+ *
+ *       After an application's event loop waited on the sockets from
+ *       mongoc_async_client_get_fds, make progress on operations whose
+ *       sockets are ready and call back for those that completed. @fds
+ *       are the entries from mongoc_async_client_get_fds, with "revents"
+ *       set to the events that occurred, or 0. Entries may be omitted
+ *       or reordered.
+ *
+ * Returns:
+ *       The number of operations still in progress.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+mongoc_async_client_process (mongoc_async_client_t *async_client,
+                             const mongoc_async_client_fd_t *fds,
+                             size_t n_fds)
+{
+   ENTRY;
+
+   BSON_ASSERT (async_client);
+   BSON_ASSERT (fds || !n_fds);
+
+   _mongoc_async_client_retry_selection (async_client);
+   _mongoc_async_client_deliver (async_client);
+
+   if (async_client->async->ncmds) {
+      mongoc_async_process (async_client->async, fds, n_fds);
+   }
+
+   _mongoc_async_client_deliver (async_client);
+
+   RETURN (async_client->n_ops);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_ASYNC_CLIENT_H
+#define MONGOC_ASYNC_CLIENT_H
+
+#if !defined(MONGOC_INSIDE) && !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-macros.h"
+#include "mongoc-client-pool.h"
+#include "mongoc-read-prefs.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_async_client_t mongoc_async_client_t;
+
+typedef void (*mongoc_async_client_cb_t) (bool success,
+                                          const bson_t *reply,
+                                          const bson_error_t *error,
+                                          void *ctx);
+
+typedef struct _mongoc_async_client_fd_t {
+   int fd;
+   int events;
+   int revents;
+} mongoc_async_client_fd_t;
+
+
+MONGOC_EXPORT (mongoc_async_client_t *)
+mongoc_async_client_new (mongoc_client_pool_t *pool);
+MONGOC_EXPORT (void)
+mongoc_async_client_destroy (mongoc_async_client_t *async_client);
+MONGOC_EXPORT (void)
+mongoc_async_client_command (mongoc_async_client_t *async_client,
+                             const char *db_name,
+                             const bson_t *command,
+                             const mongoc_read_prefs_t *read_prefs,
+                             mongoc_async_client_cb_t cb,
+                             void *ctx);
+MONGOC_EXPORT (void)
+mongoc_async_client_create_indexes (mongoc_async_client_t *async_client,
+                                    const char *db_name,
+                                    const char *collection_name,
+                                    const bson_t *const *models,
+                                    size_t n_models,
+                                    mongoc_async_client_cb_t cb,
+                                    void *ctx);
+MONGOC_EXPORT (size_t)
+mongoc_async_client_run_once (mongoc_async_client_t *async_client,
+                              int32_t timeout_msec);
+MONGOC_EXPORT (void)
+mongoc_async_client_run (mongoc_async_client_t *async_client);
+MONGOC_EXPORT (size_t)
+mongoc_async_client_get_fds (mongoc_async_client_t *async_client,
+                             mongoc_async_client_fd_t *fds,
+                             size_t n_fds,
+                             int32_t *timeout_msec);
+MONGOC_EXPORT (size_t)
+mongoc_async_client_process (mongoc_async_client_t *async_client,
+                             const mongoc_async_client_fd_t *fds,
+                             size_t n_fds);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_ASYNC_CLIENT_H */
@@ -33,6 +33,7 @@
 BSON_BEGIN_DECLS
 
 typedef enum {
+   MONGOC_ASYNC_CMD_INITIATE,
    MONGOC_ASYNC_CMD_SETUP,
    MONGOC_ASYNC_CMD_SEND,
    MONGOC_ASYNC_CMD_RECV_LEN,
@@ -41,12 +42,25 @@ typedef enum {
    MONGOC_ASYNC_CMD_CANCELED_STATE,
 } mongoc_async_cmd_state_t;
 
+struct _mongoc_async_cmd;
+
+/* creates the stream for a command from mongoc_async_cmd_new_delayed */
+typedef mongoc_stream_t *(*mongoc_async_cmd_initiate_t) (
+   struct _mongoc_async_cmd *acmd, bson_error_t *error);
+
 typedef struct _mongoc_async_cmd {
    mongoc_stream_t *stream;
 
    mongoc_async_t *async;
    mongoc_async_cmd_state_t state;
    int events;
+   /* the socket and events registered with async->poller, or -1 and 0 */
+   int poller_fd;
+   int poller_events;
+   /* for delayed commands, the stream is created at initiate_at */
+   mongoc_async_cmd_initiate_t initiator;
+   int64_t initiate_delay_msec;
+   int64_t initiate_at;
    mongoc_async_cmd_setup_t setup;
    void *setup_ctx;
    mongoc_async_cmd_cb_t cb;
@@ -58,10 +72,13 @@ typedef struct _mongoc_async_cmd {
    bson_t cmd;
    mongoc_buffer_t buffer;
    mongoc_array_t array;
+   mongoc_iovec_t array_buf[MONGOC_RPC_INLINE_IOVECS];
    mongoc_iovec_t *iovec;
    size_t niovec;
    size_t bytes_to_read;
    mongoc_rpc_t rpc;
+   /* from mongoc_async_cmd_set_msg */
+   mongoc_rpc_header_t msg_header;
    bson_t reply;
    bool reply_needs_cleanup;
    char ns[MONGOC_NAMESPACE_MAX];
@@ -81,9 +98,29 @@ mongoc_async_cmd_new (mongoc_async_t *async,
                       void *cb_data,
                       int64_t timeout_msec);
 
+mongoc_async_cmd_t *
+mongoc_async_cmd_new_delayed (mongoc_async_t *async,
+                              mongoc_async_cmd_initiate_t initiator,
+                              int64_t initiate_delay_msec,
+                              mongoc_async_cmd_setup_t setup,
+                              void *setup_ctx,
+                              const char *dbname,
+                              const bson_t *cmd,
+                              mongoc_async_cmd_cb_t cb,
+                              void *cb_data,
+                              int64_t timeout_msec);
+
+void
+mongoc_async_cmd_set_msg (mongoc_async_cmd_t *acmd,
+                          const uint8_t *msg,
+                          size_t msg_len);
+
 void
 mongoc_async_cmd_destroy (mongoc_async_cmd_t *acmd);
 
+void
+_mongoc_async_cmd_free_unused (mongoc_async_t *async);
+
 bool
 mongoc_async_cmd_run (mongoc_async_cmd_t *acmd);
 
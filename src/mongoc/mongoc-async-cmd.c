@@ -26,6 +26,8 @@
 #include "mongoc-stream-private.h"
 #include "mongoc-server-description-private.h"
 #include "mongoc-log.h"
+#include "mongoc-memory-private.h"
+#include "mongoc-poller-private.h"
 #include "utlist.h"
 
 #ifdef MONGOC_ENABLE_SSL
@@ -38,6 +40,8 @@
 typedef mongoc_async_cmd_result_t (*_mongoc_async_cmd_phase_t) (
    mongoc_async_cmd_t *cmd);
 
+mongoc_async_cmd_result_t
+_mongoc_async_cmd_phase_initiate (mongoc_async_cmd_t *cmd);
 mongoc_async_cmd_result_t
 _mongoc_async_cmd_phase_setup (mongoc_async_cmd_t *cmd);
 mongoc_async_cmd_result_t
@@ -48,6 +52,7 @@ mongoc_async_cmd_result_t
 _mongoc_async_cmd_phase_recv_rpc (mongoc_async_cmd_t *cmd);
 
 static const _mongoc_async_cmd_phase_t gMongocCMDPhases[] = {
+   _mongoc_async_cmd_phase_initiate,
    _mongoc_async_cmd_phase_setup,
    _mongoc_async_cmd_phase_send,
    _mongoc_async_cmd_phase_recv_len,
@@ -132,7 +137,7 @@ _mongoc_async_cmd_init_send (mongoc_async_cmd_t *acmd, const char *dbname)
    acmd->rpc.query.query = bson_get_data (&acmd->cmd);
    acmd->rpc.query.fields = NULL;
 
-   /* This will always be isMaster, which are not allowed to be compressed */
+   /* isMaster or authentication, which are not allowed to be compressed */
    _mongoc_rpc_gather (&acmd->rpc, &acmd->array);
    acmd->iovec = (mongoc_iovec_t *) acmd->array.data;
    acmd->niovec = acmd->array.len;
@@ -151,24 +156,34 @@ _mongoc_async_cmd_state_start (mongoc_async_cmd_t *acmd)
    acmd->events = POLLOUT;
 }
 
-mongoc_async_cmd_t *
-mongoc_async_cmd_new (mongoc_async_t *async,
-                      mongoc_stream_t *stream,
-                      mongoc_async_cmd_setup_t setup,
-                      void *setup_ctx,
-                      const char *dbname,
-                      const bson_t *cmd,
-                      mongoc_async_cmd_cb_t cb,
-                      void *cb_data,
-                      int64_t timeout_msec)
+static mongoc_async_cmd_t *
+_mongoc_async_cmd_new (mongoc_async_t *async,
+                       mongoc_stream_t *stream,
+                       mongoc_async_cmd_setup_t setup,
+                       void *setup_ctx,
+                       const char *dbname,
+                       const bson_t *cmd,
+                       mongoc_async_cmd_cb_t cb,
+                       void *cb_data,
+                       int64_t timeout_msec)
 {
    mongoc_async_cmd_t *acmd;
+   mongoc_buffer_t buffer;
 
-   BSON_ASSERT (cmd);
    BSON_ASSERT (dbname);
-   BSON_ASSERT (stream);
 
-   acmd = (mongoc_async_cmd_t *) bson_malloc0 (sizeof (*acmd));
+   /* a heartbeat reuses a finished command and its reply buffer */
+   acmd = async->free_cmds;
+   if (acmd) {
+      DL_DELETE (async->free_cmds, acmd);
+      buffer = acmd->buffer;
+      memset (acmd, 0, sizeof (*acmd));
+      acmd->buffer = buffer;
+   } else {
+      acmd = (mongoc_async_cmd_t *) bson_malloc0 (sizeof (*acmd));
+      _mongoc_buffer_init_tagged (&acmd->buffer, MONGOC_MEMORY_TAG_TOPOLOGY);
+   }
+
    acmd->async = async;
    acmd->timeout_msec = timeout_msec;
    acmd->stream = stream;
@@ -177,14 +192,20 @@ mongoc_async_cmd_new (mongoc_async_t *async,
    acmd->cb = cb;
    acmd->data = cb_data;
    acmd->connect_started = bson_get_monotonic_time ();
-   bson_copy_to (cmd, &acmd->cmd);
+   acmd->poller_fd = -1;
 
-   _mongoc_array_init (&acmd->array, sizeof (mongoc_iovec_t));
-   _mongoc_buffer_init (&acmd->buffer, NULL, 0, NULL, NULL);
+   _mongoc_array_init_inline (&acmd->array,
+                              sizeof (mongoc_iovec_t),
+                              acmd->array_buf,
+                              sizeof acmd->array_buf);
 
-   _mongoc_async_cmd_init_send (acmd, dbname);
-
-   _mongoc_async_cmd_state_start (acmd);
+   /* with no @cmd the caller sets a message with mongoc_async_cmd_set_msg */
+   if (cmd) {
+      bson_copy_to (cmd, &acmd->cmd);
+      _mongoc_async_cmd_init_send (acmd, dbname);
+   } else {
+      bson_init (&acmd->cmd);
+   }
 
    async->ncmds++;
    DL_APPEND (async->cmds, acmd);
@@ -192,6 +213,99 @@ mongoc_async_cmd_new (mongoc_async_t *async,
    return acmd;
 }
 
+mongoc_async_cmd_t *
+mongoc_async_cmd_new (mongoc_async_t *async,
+                      mongoc_stream_t *stream,
+                      mongoc_async_cmd_setup_t setup,
+                      void *setup_ctx,
+                      const char *dbname,
+                      const bson_t *cmd,
+                      mongoc_async_cmd_cb_t cb,
+                      void *cb_data,
+                      int64_t timeout_msec)
+{
+   mongoc_async_cmd_t *acmd;
+
+   BSON_ASSERT (stream);
+
+   acmd = _mongoc_async_cmd_new (
+      async, stream, setup, setup_ctx, dbname, cmd, cb, cb_data, timeout_msec);
+
+   _mongoc_async_cmd_state_start (acmd);
+
+   return acmd;
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_cmd_set_msg --
+ *
+ *       Send @msg, an OP_QUERY encoded once with _mongoc_rpc_encode_query,
+ *       instead of encoding a command for each connection. @acmd must
+ *       have been created with no command, and @msg must outlive it.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_async_cmd_set_msg (mongoc_async_cmd_t *acmd,
+                          const uint8_t *msg,
+                          size_t msg_len)
+{
+   BSON_ASSERT (bson_empty (&acmd->cmd));
+
+   _mongoc_array_clear (&acmd->array);
+   _mongoc_rpc_gather_encoded (msg,
+                               msg_len,
+                               (int32_t) ++acmd->async->request_id,
+                               &acmd->msg_header,
+                               &acmd->array);
+   acmd->iovec = (mongoc_iovec_t *) acmd->array.data;
+   acmd->niovec = acmd->array.len;
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_cmd_new_delayed --
+ *
+ *       Like mongoc_async_cmd_new, but @initiator creates the stream
+ *       @initiate_delay_msec after mongoc_async_run begins. The command's
+ *       timeout starts then. Callers may set acmd->initiate_at to start it
+ *       sooner, and @initiator may return NULL after setting initiate_at
+ *       to a later time to be called again then.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_async_cmd_t *
+mongoc_async_cmd_new_delayed (mongoc_async_t *async,
+                              mongoc_async_cmd_initiate_t initiator,
+                              int64_t initiate_delay_msec,
+                              mongoc_async_cmd_setup_t setup,
+                              void *setup_ctx,
+                              const char *dbname,
+                              const bson_t *cmd,
+                              mongoc_async_cmd_cb_t cb,
+                              void *cb_data,
+                              int64_t timeout_msec)
+{
+   mongoc_async_cmd_t *acmd;
+
+   BSON_ASSERT (initiator);
+
+   acmd = _mongoc_async_cmd_new (
+      async, NULL, setup, setup_ctx, dbname, cmd, cb, cb_data, timeout_msec);
+
+   acmd->initiator = initiator;
+   acmd->initiate_delay_msec = initiate_delay_msec;
+   acmd->initiate_at = acmd->connect_started + initiate_delay_msec * 1000;
+   acmd->state = MONGOC_ASYNC_CMD_INITIATE;
+   acmd->events = 0;
+
+   return acmd;
+}
 
 void
 mongoc_async_cmd_destroy (mongoc_async_cmd_t *acmd)
@@ -201,6 +315,12 @@ mongoc_async_cmd_destroy (mongoc_async_cmd_t *acmd)
    DL_DELETE (acmd->async->cmds, acmd);
    acmd->async->ncmds--;
 
+#ifdef MONGOC_ENABLE_POLLER
+   if (acmd->poller_fd != -1) {
+      _mongoc_poller_remove (acmd->async->poller, acmd->poller_fd);
+   }
+#endif
+
    bson_destroy (&acmd->cmd);
 
    if (acmd->reply_needs_cleanup) {
@@ -208,9 +328,43 @@ mongoc_async_cmd_destroy (mongoc_async_cmd_t *acmd)
    }
 
    _mongoc_array_destroy (&acmd->array);
-   _mongoc_buffer_destroy (&acmd->buffer);
+   _mongoc_buffer_clear (&acmd->buffer, false);
 
-   bson_free (acmd);
+   /* keep it for the next command, see _mongoc_async_cmd_new */
+   DL_PREPEND (acmd->async->free_cmds, acmd);
+}
+
+/* free the commands mongoc_async_cmd_destroy kept for reuse */
+void
+_mongoc_async_cmd_free_unused (mongoc_async_t *async)
+{
+   mongoc_async_cmd_t *acmd, *tmp;
+
+   DL_FOREACH_SAFE (async->free_cmds, acmd, tmp)
+   {
+      DL_DELETE (async->free_cmds, acmd);
+      _mongoc_buffer_destroy (&acmd->buffer);
+      bson_free (acmd);
+   }
+}
+
+mongoc_async_cmd_result_t
+_mongoc_async_cmd_phase_initiate (mongoc_async_cmd_t *acmd)
+{
+   acmd->stream = acmd->initiator (acmd, &acmd->error);
+   if (!acmd->stream) {
+      /* the initiator may postpone itself by moving initiate_at ahead */
+      if (acmd->initiate_at > bson_get_monotonic_time ()) {
+         return MONGOC_ASYNC_CMD_IN_PROGRESS;
+      }
+
+      return MONGOC_ASYNC_CMD_ERROR;
+   }
+
+   acmd->connect_started = bson_get_monotonic_time ();
+   _mongoc_async_cmd_state_start (acmd);
+
+   return MONGOC_ASYNC_CMD_IN_PROGRESS;
 }
 
 mongoc_async_cmd_result_t
@@ -267,6 +421,16 @@ _mongoc_async_cmd_phase_send (mongoc_async_cmd_t *acmd)
       }
    }
 
+   while (acmd->niovec && !acmd->iovec->iov_len) {
+      acmd->iovec++;
+      acmd->niovec--;
+   }
+
+   if (acmd->niovec) {
+      /* a large command fills the socket buffer, wait for POLLOUT again */
+      return MONGOC_ASYNC_CMD_IN_PROGRESS;
+   }
+
    acmd->state = MONGOC_ASYNC_CMD_RECV_LEN;
    acmd->bytes_to_read = 4;
    acmd->events = POLLIN;
@@ -362,9 +526,10 @@ _mongoc_async_cmd_phase_recv_rpc (mongoc_async_cmd_t *acmd)
             BSON_UINT32_FROM_LE (acmd->rpc.compressed.uncompressed_size) +
             sizeof (mongoc_rpc_header_t);
 
-         buf = bson_malloc0 (len);
-         if (!_mongoc_rpc_decompress (&acmd->rpc, buf, len)) {
-            bson_free (buf);
+         buf = (uint8_t *) _mongoc_malloc_tagged (MONGOC_MEMORY_TAG_TOPOLOGY,
+                                                  len);
+         if (!_mongoc_rpc_decompress (&acmd->rpc, buf, len, NULL)) {
+            _mongoc_free_tagged (MONGOC_MEMORY_TAG_TOPOLOGY, buf);
             bson_set_error (&acmd->error,
                             MONGOC_ERROR_PROTOCOL,
                             MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
@@ -373,7 +538,12 @@ _mongoc_async_cmd_phase_recv_rpc (mongoc_async_cmd_t *acmd)
          }
 
          _mongoc_buffer_destroy (&acmd->buffer);
-         _mongoc_buffer_init (&acmd->buffer, buf, len, NULL, NULL);
+         _mongoc_buffer_init (
+            &acmd->buffer,
+            buf,
+            len,
+            _mongoc_realloc_tagged_ctx,
+            _mongoc_memory_tag_ctx (MONGOC_MEMORY_TAG_TOPOLOGY));
       }
 
       _mongoc_rpc_swab_from_le (&acmd->rpc);
@@ -22,16 +22,31 @@
 #endif
 
 #include <bson.h>
+#include "mongoc-async-client.h"
 #include "mongoc-stream.h"
 
 BSON_BEGIN_DECLS
 
+/* how often mongoc_async_process polls streams that have no socket */
+#define MONGOC_ASYNC_POLL_INTERVAL_MS 10
+
 struct _mongoc_async_cmd;
+struct _mongoc_poller_t;
+struct _mongoc_poller_event_t;
 
 typedef struct _mongoc_async {
    struct _mongoc_async_cmd *cmds;
    size_t ncmds;
+   /* finished commands and their reply buffers, reused by the next ones */
+   struct _mongoc_async_cmd *free_cmds;
    uint32_t request_id;
+   /* epoll or kqueue, NULL if unavailable */
+   struct _mongoc_poller_t *poller;
+   /* reused by each mongoc_async_run_once */
+   struct _mongoc_poller_event_t *events;
+   size_t events_size;
+   mongoc_stream_poll_t *poll;
+   size_t poll_size;
 } mongoc_async_t;
 
 typedef enum {
@@ -60,9 +75,33 @@ mongoc_async_new ();
 void
 mongoc_async_destroy (mongoc_async_t *async);
 
+void
+_mongoc_async_reset_after_fork (mongoc_async_t *async);
+
+typedef bool (*mongoc_async_done_t) (void *ctx);
+
 void
 mongoc_async_run (mongoc_async_t *async);
 
+void
+mongoc_async_run_until (mongoc_async_t *async,
+                        mongoc_async_done_t done,
+                        void *ctx);
+
+size_t
+mongoc_async_run_once (mongoc_async_t *async, int32_t timeout_msec);
+
+size_t
+mongoc_async_get_fds (mongoc_async_t *async,
+                      mongoc_async_client_fd_t *fds,
+                      size_t n_fds,
+                      int64_t *expire_at);
+
+void
+mongoc_async_process (mongoc_async_t *async,
+                      const mongoc_async_client_fd_t *fds,
+                      size_t n_fds);
+
 BSON_END_DECLS
 
 #endif /* MONGOC_ASYNC_PRIVATE_H */
@@ -19,6 +19,11 @@
 
 #include "mongoc-async-private.h"
 #include "mongoc-async-cmd-private.h"
+#include "mongoc-poller-private.h"
+#include "mongoc-socket-private.h"
+#include "mongoc-stream-private.h"
+#include "mongoc-stream-socket.h"
+#include "mongoc-util-private.h"
 #include "utlist.h"
 #include "mongoc.h"
 
@@ -31,6 +36,10 @@ mongoc_async_new ()
 {
    mongoc_async_t *async = (mongoc_async_t *) bson_malloc0 (sizeof (*async));
 
+#ifdef MONGOC_ENABLE_POLLER
+   async->poller = _mongoc_poller_new ();
+#endif
+
    return async;
 }
 
@@ -44,119 +53,577 @@ mongoc_async_destroy (mongoc_async_t *async)
       mongoc_async_cmd_destroy (acmd);
    }
 
+   _mongoc_async_cmd_free_unused (async);
+
+#ifdef MONGOC_ENABLE_POLLER
+   _mongoc_poller_destroy (async->poller);
+   bson_free (async->events);
+#endif
+
+   bson_free (async->poll);
    bson_free (async);
 }
 
+/* in a child process after fork, before destroying the commands: an epoll
+ * set is shared with the parent, so removing the inherited sockets from it
+ * would remove them from the parent's too. use a new one instead */
 void
-mongoc_async_run (mongoc_async_t *async)
+_mongoc_async_reset_after_fork (mongoc_async_t *async)
+{
+#ifdef MONGOC_ENABLE_POLLER
+   mongoc_async_cmd_t *acmd;
+
+   _mongoc_poller_destroy (async->poller);
+   async->poller = _mongoc_poller_new ();
+
+   DL_FOREACH (async->cmds, acmd)
+   {
+      acmd->poller_fd = -1;
+   }
+#endif
+}
+
+/* returns true if @acmd was run */
+static bool
+_mongoc_async_cmd_ready (mongoc_async_cmd_t *acmd, int revents)
+{
+   int hup;
+
+   if (revents & (POLLERR | POLLHUP)) {
+      hup = revents & POLLHUP;
+      if (acmd->state == MONGOC_ASYNC_CMD_SEND) {
+         bson_set_error (&acmd->error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_CONNECT,
+                         hup ? "connection refused"
+                             : "unknown connection error");
+      } else {
+         bson_set_error (&acmd->error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_SOCKET,
+                         hup ? "connection closed" : "unknown socket error");
+      }
+
+      acmd->state = MONGOC_ASYNC_CMD_ERROR_STATE;
+   }
+
+   if ((revents & acmd->events) ||
+       acmd->state == MONGOC_ASYNC_CMD_ERROR_STATE) {
+      mongoc_async_cmd_run (acmd);
+      return true;
+   }
+
+   return false;
+}
+
+#ifdef MONGOC_ENABLE_POLLER
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_async_register --
+ *
+ *       Register new commands' sockets with the poller, and update the
+ *       events of commands whose state changed since the last pass.
+ *
+ * Returns:
+ *       false if some command's stream isn't a socket stream, or the
+ *       kernel rejected it: the caller must use mongoc_stream_poll.
+ *
+ *--------------------------------------------------------------------------
+ */
+static bool
+_mongoc_async_register (mongoc_async_t *async)
+{
+   mongoc_async_cmd_t *acmd;
+   mongoc_stream_t *root;
+   mongoc_socket_t *sock;
+
+   DL_FOREACH (async->cmds, acmd)
+   {
+      if (!acmd->stream ||
+          (acmd->poller_fd != -1 && acmd->poller_events == acmd->events)) {
+         continue;
+      }
+
+      root = mongoc_stream_get_root_stream (acmd->stream);
+      if (root->type != MONGOC_STREAM_SOCKET) {
+         return false;
+      }
+
+      sock = mongoc_stream_socket_get_socket ((mongoc_stream_socket_t *) root);
+      if (!sock || !_mongoc_poller_set (async->poller,
+                                        sock,
+                                        acmd->poller_fd != -1,
+                                        acmd->events,
+                                        acmd)) {
+         return false;
+      }
+
+      acmd->poller_fd = sock->sd;
+      acmd->poller_events = acmd->events;
+   }
+
+   return true;
+}
+#endif
+
+/* true if @acmd waits for a reply its TLS stream has already received,
+ * which polling the socket won't report */
+static bool
+_mongoc_async_cmd_buffered (mongoc_async_cmd_t *acmd)
+{
+   return acmd->stream &&
+          (acmd->state == MONGOC_ASYNC_CMD_RECV_LEN ||
+           acmd->state == MONGOC_ASYNC_CMD_RECV_RPC) &&
+          _mongoc_stream_has_buffered_data (acmd->stream);
+}
+
+
+/* advance commands whose reply is buffered, returns how many ran */
+static size_t
+_mongoc_async_run_buffered (mongoc_async_t *async)
+{
+   mongoc_async_cmd_t *acmd, *tmp;
+   size_t n = 0;
+
+   DL_FOREACH_SAFE (async->cmds, acmd, tmp)
+   {
+      if (_mongoc_async_cmd_buffered (acmd)) {
+         _mongoc_async_cmd_ready (acmd, POLLIN);
+         n++;
+      }
+   }
+
+   return n;
+}
+
+
+/* start delayed commands that are due, and reap canceled ones */
+static void
+_mongoc_async_start_due (mongoc_async_t *async, int64_t now)
+{
+   mongoc_async_cmd_t *acmd, *tmp;
+
+   DL_FOREACH_SAFE (async->cmds, acmd, tmp)
+   {
+      if ((acmd->state == MONGOC_ASYNC_CMD_INITIATE &&
+           acmd->initiate_at <= now) ||
+          acmd->state == MONGOC_ASYNC_CMD_CANCELED_STATE) {
+         mongoc_async_cmd_run (acmd);
+      }
+   }
+}
+
+
+/* fail commands whose timeout passed before @now */
+static void
+_mongoc_async_expire (mongoc_async_t *async, int64_t now)
+{
+   mongoc_async_cmd_t *acmd, *tmp;
+
+   DL_FOREACH_SAFE (async->cmds, acmd, tmp)
+   {
+      if (acmd->stream &&
+          now > acmd->connect_started + acmd->timeout_msec * 1000) {
+         bson_set_error (&acmd->error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_CONNECT,
+                         acmd->state == MONGOC_ASYNC_CMD_SEND
+                            ? "connection timeout"
+                            : "socket timeout");
+
+         acmd->cb (MONGOC_ASYNC_CMD_TIMEOUT,
+                   NULL,
+                   (now - acmd->connect_started) / 1000,
+                   acmd->data,
+                   &acmd->error);
+
+         /* Remove acmd from the async->cmds doubly-linked list */
+         mongoc_async_cmd_destroy (acmd);
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_run_once --
+ *
+ *       Start delayed commands that are due, wait up to @timeout_msec for
+ *       any command's stream to be ready, and advance the ready commands.
+ *       Commands whose timeout expired fail. A negative @timeout_msec
+ *       waits until the next command can make progress or times out.
+ *
+ *       Callbacks run from here and may add commands.
+ *
+ * Returns:
+ *       The number of commands still in progress.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+mongoc_async_run_once (mongoc_async_t *async, int32_t timeout_msec)
 {
    mongoc_async_cmd_t *acmd, *tmp;
-   mongoc_stream_poll_t *poller = NULL;
    int i;
    ssize_t nactive;
    int64_t now;
    int64_t expire_at;
    int64_t poll_timeout_msec;
-   size_t poll_size;
+   size_t npollable;
 
    now = bson_get_monotonic_time ();
-   poll_size = 0;
 
-   /* CDRIVER-1571 reset start times in case a stream initiator was slow */
+   _mongoc_async_start_due (async, now);
+
+   /* don't wait for the socket if more of a reply is already buffered */
+   if (_mongoc_async_run_buffered (async)) {
+      timeout_msec = 0;
+   }
+
+   if (!async->ncmds) {
+      return 0;
+   }
+
+   expire_at = INT64_MAX;
+   npollable = 0;
    DL_FOREACH (async->cmds, acmd)
    {
-      acmd->connect_started = now;
+      if (!acmd->stream) {
+         /* not initiated yet */
+         expire_at = BSON_MIN (expire_at, acmd->initiate_at);
+         continue;
+      }
+
+      BSON_ASSERT (acmd->connect_started > 0);
+      expire_at = BSON_MIN (expire_at,
+                            acmd->connect_started + acmd->timeout_msec * 1000);
+      npollable++;
    }
 
-   while (async->ncmds) {
-      /* ncmds grows if we discover a replica & start calling ismaster on it */
-      if (poll_size < async->ncmds) {
-         poller = (mongoc_stream_poll_t *) bson_realloc (
-            poller, sizeof (*poller) * async->ncmds);
+   poll_timeout_msec = BSON_MAX (0, (expire_at - now) / 1000);
+   if (timeout_msec >= 0) {
+      poll_timeout_msec = BSON_MIN (poll_timeout_msec, timeout_msec);
+   }
 
-         poll_size = async->ncmds;
+   BSON_ASSERT (poll_timeout_msec < INT32_MAX);
+
+   if (!npollable) {
+      /* every command is waiting for its initiate_at */
+      _mongoc_usleep (poll_timeout_msec * 1000);
+      return async->ncmds;
+   }
+
+#ifdef MONGOC_ENABLE_POLLER
+   /* sockets stay registered between passes, only ready ones are seen */
+   if (async->poller && _mongoc_async_register (async)) {
+      if (async->events_size < async->ncmds) {
+         async->events = (mongoc_poller_event_t *) bson_realloc (
+            async->events, sizeof (mongoc_poller_event_t) * async->ncmds);
+
+         async->events_size = async->ncmds;
+      }
+
+      nactive = _mongoc_poller_wait (async->poller,
+                                     async->events,
+                                     (int) npollable,
+                                     (int32_t) poll_timeout_msec);
+
+      for (i = 0; i < nactive; i++) {
+         _mongoc_async_cmd_ready (
+            (mongoc_async_cmd_t *) async->events[i].data,
+            async->events[i].revents);
       }
 
+      goto TIMEOUTS;
+   }
+#endif
+
+   /* ncmds grows if we discover a replica & start calling ismaster on it */
+   if (async->poll_size < async->ncmds) {
+      async->poll = (mongoc_stream_poll_t *) bson_realloc (
+         async->poll, sizeof (mongoc_stream_poll_t) * async->ncmds);
+
+      async->poll_size = async->ncmds;
+   }
+
+   i = 0;
+   DL_FOREACH (async->cmds, acmd)
+   {
+      if (!acmd->stream) {
+         continue;
+      }
+
+      async->poll[i].stream = acmd->stream;
+      async->poll[i].events = acmd->events;
+      async->poll[i].revents = 0;
+      i++;
+   }
+
+   nactive =
+      mongoc_stream_poll (async->poll, npollable, (int32_t) poll_timeout_msec);
+
+   if (nactive > 0) {
       i = 0;
-      expire_at = INT64_MAX;
-      DL_FOREACH (async->cmds, acmd)
+      DL_FOREACH_SAFE (async->cmds, acmd, tmp)
       {
-         poller[i].stream = acmd->stream;
-         poller[i].events = acmd->events;
-         poller[i].revents = 0;
-         BSON_ASSERT (acmd->connect_started > 0);
-         expire_at = BSON_MIN (
-            expire_at, acmd->connect_started + acmd->timeout_msec * 1000);
+         /* commands added by callbacks weren't polled */
+         if (i == (int) npollable) {
+            break;
+         }
+
+         if (!acmd->stream) {
+            continue;
+         }
+
+         if (_mongoc_async_cmd_ready (acmd, async->poll[i].revents)) {
+            nactive--;
+         }
+
+         if (!nactive) {
+            break;
+         }
+
          i++;
       }
+   }
 
-      poll_timeout_msec = BSON_MAX (0, (expire_at - now) / 1000);
-      BSON_ASSERT (poll_timeout_msec < INT32_MAX);
-      nactive =
-         mongoc_stream_poll (poller, async->ncmds, (int32_t) poll_timeout_msec);
-
-      if (nactive) {
-         i = 0;
-         DL_FOREACH_SAFE (async->cmds, acmd, tmp)
-         {
-            if (poller[i].revents & (POLLERR | POLLHUP)) {
-               int hup = poller[i].revents & POLLHUP;
-               if (acmd->state == MONGOC_ASYNC_CMD_SEND) {
-                  bson_set_error (&acmd->error,
-                                  MONGOC_ERROR_STREAM,
-                                  MONGOC_ERROR_STREAM_CONNECT,
-                                  hup ? "connection refused"
-                                      : "unknown connection error");
-               } else {
-                  bson_set_error (&acmd->error,
-                                  MONGOC_ERROR_STREAM,
-                                  MONGOC_ERROR_STREAM_SOCKET,
-                                  hup ? "connection closed"
-                                      : "unknown socket error");
-               }
-
-               acmd->state = MONGOC_ASYNC_CMD_ERROR_STATE;
-            }
+#ifdef MONGOC_ENABLE_POLLER
+TIMEOUTS:
+#endif
+   _mongoc_async_expire (async, now);
+
+   return async->ncmds;
+}
+
+
+/* the socket descriptor @acmd's stream is built on, or -1 */
+static int
+_mongoc_async_cmd_fd (mongoc_async_cmd_t *acmd)
+{
+   mongoc_stream_t *root;
+   mongoc_socket_t *sock;
+
+   root = mongoc_stream_get_root_stream (acmd->stream);
+   if (root->type != MONGOC_STREAM_SOCKET) {
+      return -1;
+   }
+
+   sock = mongoc_stream_socket_get_socket ((mongoc_stream_socket_t *) root);
+
+   return sock ? (int) sock->sd : -1;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_get_fds --
+ *
+ *       For an application's event loop, copy up to @n_fds of the sockets
+ *       that commands wait on, and the events they wait for, to @fds.
+ *       Lower *@expire_at to when mongoc_async_process must be called
+ *       even if no socket is ready.
+ *
+ *       Commands on streams without a socket can't be waited on; they
+ *       are polled by mongoc_async_process every few milliseconds.
+ *
+ * Returns:
+ *       The number of sockets, which may be more than @n_fds.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+mongoc_async_get_fds (mongoc_async_t *async,
+                      mongoc_async_client_fd_t *fds,
+                      size_t n_fds,
+                      int64_t *expire_at)
+{
+   mongoc_async_cmd_t *acmd;
+   size_t count = 0;
+   int fd;
+
+   DL_FOREACH (async->cmds, acmd)
+   {
+      if (acmd->state == MONGOC_ASYNC_CMD_CANCELED_STATE) {
+         *expire_at = 0;
+         continue;
+      }
+
+      if (!acmd->stream) {
+         *expire_at = BSON_MIN (*expire_at, acmd->initiate_at);
+         continue;
+      }
+
+      *expire_at = BSON_MIN (*expire_at,
+                             acmd->connect_started + acmd->timeout_msec * 1000);
+
+      if (_mongoc_async_cmd_buffered (acmd)) {
+         /* the socket won't be ready for what's already received */
+         *expire_at = 0;
+      }
+
+      fd = _mongoc_async_cmd_fd (acmd);
+      if (fd == -1) {
+         *expire_at = BSON_MIN (
+            *expire_at,
+            bson_get_monotonic_time () + MONGOC_ASYNC_POLL_INTERVAL_MS * 1000);
+         continue;
+      }
+
+      if (count < n_fds) {
+         fds[count].fd = fd;
+         fds[count].events = acmd->events;
+         fds[count].revents = 0;
+      }
+
+      count++;
+   }
+
+   return count;
+}
 
-            if ((poller[i].revents & poller[i].events) ||
-                acmd->state == MONGOC_ASYNC_CMD_ERROR_STATE) {
-               mongoc_async_cmd_run (acmd);
-               nactive--;
+
+static int
+_mongoc_async_fd_cmp (const void *a, const void *b)
+{
+   const mongoc_async_client_fd_t *fd_a = (const mongoc_async_client_fd_t *) a;
+   const mongoc_async_client_fd_t *fd_b = (const mongoc_async_client_fd_t *) b;
+
+   return fd_a->fd < fd_b->fd ? -1 : fd_a->fd > fd_b->fd;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_process --
+ *
+ *       Like mongoc_async_run_once, but an application's event loop has
+ *       already waited: @fds are sockets from mongoc_async_get_fds, with
+ *       revents set for those that are ready. Advance their commands,
+ *       poll commands on streams without a socket, then fail commands
+ *       that timed out.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_async_process (mongoc_async_t *async,
+                      const mongoc_async_client_fd_t *fds,
+                      size_t n_fds)
+{
+   mongoc_async_cmd_t *acmd, *tmp, *last;
+   mongoc_async_client_fd_t *ready;
+   mongoc_async_client_fd_t key;
+   mongoc_async_client_fd_t *found;
+   mongoc_stream_poll_t poll;
+   size_t n_ready = 0;
+   size_t i;
+   int64_t now;
+   int fd;
+
+   now = bson_get_monotonic_time ();
+
+   _mongoc_async_start_due (async, now);
+
+   ready = (mongoc_async_client_fd_t *) bson_malloc (
+      sizeof (mongoc_async_client_fd_t) * (n_fds ? n_fds : 1));
+
+   for (i = 0; i < n_fds; i++) {
+      if (fds[i].revents) {
+         ready[n_ready++] = fds[i];
+      }
+   }
+
+   qsort (ready,
+          n_ready,
+          sizeof (mongoc_async_client_fd_t),
+          _mongoc_async_fd_cmp);
+
+   /* commands added by callbacks, often on the same socket, wait for the
+    * application to poll them */
+   last = async->cmds ? async->cmds->prev : NULL;
+
+   for (acmd = async->cmds; acmd; acmd = tmp) {
+      bool is_last = acmd == last;
+
+      tmp = acmd->next;
+
+      if (acmd->stream) {
+         fd = _mongoc_async_cmd_fd (acmd);
+
+         if (fd == -1) {
+            poll.stream = acmd->stream;
+            poll.events = acmd->events;
+            poll.revents = 0;
+
+            if (mongoc_stream_poll (&poll, 1, 0) > 0) {
+               _mongoc_async_cmd_ready (acmd, poll.revents);
             }
+         } else {
+            found = NULL;
 
-            if (!nactive) {
-               break;
+            if (n_ready) {
+               key.fd = fd;
+               found = (mongoc_async_client_fd_t *) bsearch (
+                  &key,
+                  ready,
+                  n_ready,
+                  sizeof (mongoc_async_client_fd_t),
+                  _mongoc_async_fd_cmp);
             }
 
-            i++;
+            if (found) {
+               _mongoc_async_cmd_ready (acmd, found->revents);
+            } else if (_mongoc_async_cmd_buffered (acmd)) {
+               _mongoc_async_cmd_ready (acmd, POLLIN);
+            }
          }
       }
 
-      DL_FOREACH_SAFE (async->cmds, acmd, tmp)
-      {
-         if (now > acmd->connect_started + acmd->timeout_msec * 1000) {
-            bson_set_error (&acmd->error,
-                            MONGOC_ERROR_STREAM,
-                            MONGOC_ERROR_STREAM_CONNECT,
-                            acmd->state == MONGOC_ASYNC_CMD_SEND
-                               ? "connection timeout"
-                               : "socket timeout");
-
-            acmd->cb (MONGOC_ASYNC_CMD_TIMEOUT,
-                      NULL,
-                      (now - acmd->connect_started) / 1000,
-                      acmd->data,
-                      &acmd->error);
-
-            /* Remove acmd from the async->cmds doubly-linked list */
-            mongoc_async_cmd_destroy (acmd);
-         }
+      if (is_last) {
+         break;
       }
+   }
 
-      now = bson_get_monotonic_time ();
+   bson_free (ready);
+
+   _mongoc_async_expire (async, now);
+}
+
+void
+mongoc_async_run (mongoc_async_t *async)
+{
+   mongoc_async_run_until (async, NULL, NULL);
+}
+
+
+/* like mongoc_async_run, but return as soon as @done returns true after a
+ * pass. commands still in progress are left for later passes */
+void
+mongoc_async_run_until (mongoc_async_t *async,
+                        mongoc_async_done_t done,
+                        void *ctx)
+{
+   mongoc_async_cmd_t *acmd;
+   int64_t now;
+
+   now = bson_get_monotonic_time ();
+
+   /* CDRIVER-1571 reset start times in case a stream initiator was slow */
+   DL_FOREACH (async->cmds, acmd)
+   {
+      acmd->connect_started = now;
+      acmd->initiate_at = now + acmd->initiate_delay_msec * 1000;
    }
 
-   if (poll_size) {
-      bson_free (poller);
+   while (mongoc_async_run_once (async, -1)) {
+      if (done && done (ctx)) {
+         break;
+      }
    }
 }
@@ -23,6 +23,8 @@
 
 #include <bson.h>
 
+#include "mongoc-memory-budget-private.h"
+#include "mongoc-memory-private.h"
 #include "mongoc-stream.h"
 
 
@@ -39,6 +41,7 @@ struct _mongoc_buffer_t {
    size_t len;
    bson_realloc_func realloc_func;
    void *realloc_data;
+   mongoc_memory_budget_t *budget; /* charged for datalen, or NULL */
 };
 
 
@@ -49,6 +52,9 @@ _mongoc_buffer_init (mongoc_buffer_t *buffer,
                      bson_realloc_func realloc_func,
                      void *realloc_data);
 
+void
+_mongoc_buffer_init_tagged (mongoc_buffer_t *buffer, mongoc_memory_tag_t tag);
+
 bool
 _mongoc_buffer_append (mongoc_buffer_t *buffer,
                        const uint8_t *data,
@@ -74,6 +80,13 @@ _mongoc_buffer_fill (mongoc_buffer_t *buffer,
                      int32_t timeout_msec,
                      bson_error_t *error);
 
+void
+_mongoc_buffer_set_budget (mongoc_buffer_t *buffer,
+                           mongoc_memory_budget_t *budget);
+
+void
+_mongoc_buffer_shrink (mongoc_buffer_t *buffer, size_t datalen);
+
 void
 _mongoc_buffer_destroy (mongoc_buffer_t *buffer);
 
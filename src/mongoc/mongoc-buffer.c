@@ -68,7 +68,7 @@ _mongoc_buffer_init (mongoc_buffer_t *buffer,
    }
 
    if (!buf) {
-      buf = (uint8_t *) realloc_func (NULL, buflen, NULL);
+      buf = (uint8_t *) realloc_func (NULL, buflen, realloc_data);
    }
 
    memset (buffer, 0, sizeof *buffer);
@@ -82,6 +82,79 @@ _mongoc_buffer_init (mongoc_buffer_t *buffer,
 }
 
 
+/**
+ * _mongoc_buffer_init_tagged:
+ * @buffer: A mongoc_buffer_t to initialize.
+ * @tag: The subsystem to account @buffer's memory to.
+ *
+ * Initializes @buffer with data from @tag's allocator.
+ */
+void
+_mongoc_buffer_init_tagged (mongoc_buffer_t *buffer, mongoc_memory_tag_t tag)
+{
+   _mongoc_buffer_init (buffer,
+                        NULL,
+                        0,
+                        _mongoc_realloc_tagged_ctx,
+                        _mongoc_memory_tag_ctx (tag));
+}
+
+
+/**
+ * _mongoc_buffer_set_budget:
+ * @buffer: A mongoc_buffer_t.
+ * @budget: A mongoc_memory_budget_t, or NULL.
+ *
+ * Charge @budget for the memory @buffer holds now and as it grows, until
+ * @buffer is destroyed.
+ */
+void
+_mongoc_buffer_set_budget (mongoc_buffer_t *buffer,
+                           mongoc_memory_budget_t *budget)
+{
+   BSON_ASSERT (buffer);
+
+   _mongoc_memory_budget_charge (buffer->budget, -(int64_t) buffer->datalen);
+   buffer->budget = budget;
+   _mongoc_memory_budget_charge (buffer->budget, (int64_t) buffer->datalen);
+}
+
+
+/* resize @buffer's data to @datalen bytes */
+static void
+_mongoc_buffer_grow (mongoc_buffer_t *buffer, size_t datalen)
+{
+   _mongoc_memory_budget_charge (buffer->budget,
+                                 (int64_t) datalen - (int64_t) buffer->datalen);
+   buffer->datalen = datalen;
+   buffer->data = (uint8_t *) buffer->realloc_func (
+      buffer->data, buffer->datalen, buffer->realloc_data);
+}
+
+
+/**
+ * _mongoc_buffer_shrink:
+ * @buffer: A mongoc_buffer_t.
+ * @datalen: The new size, at least @buffer's length.
+ *
+ * Move @buffer's contents to the start of its data and resize it to
+ * @datalen bytes, to release memory after it grew for a large read.
+ */
+void
+_mongoc_buffer_shrink (mongoc_buffer_t *buffer, size_t datalen)
+{
+   BSON_ASSERT (buffer);
+   BSON_ASSERT (datalen >= buffer->len);
+
+   if (buffer->len && buffer->off) {
+      memmove (&buffer->data[0], &buffer->data[buffer->off], buffer->len);
+   }
+
+   buffer->off = 0;
+   _mongoc_buffer_grow (buffer, datalen);
+}
+
+
 /**
  * _mongoc_buffer_destroy:
  * @buffer: A mongoc_buffer_t.
@@ -97,6 +170,8 @@ _mongoc_buffer_destroy (mongoc_buffer_t *buffer)
       buffer->realloc_func (buffer->data, 0, buffer->realloc_data);
    }
 
+   _mongoc_memory_budget_charge (buffer->budget, -(int64_t) buffer->datalen);
+
    memset (buffer, 0, sizeof *buffer);
 }
 
@@ -145,10 +220,9 @@ _mongoc_buffer_append (mongoc_buffer_t *buffer,
       }
       buffer->off = 0;
       if (!SPACE_FOR (buffer, data_size)) {
-         buffer->datalen =
-            bson_next_power_of_two (data_size + buffer->len + buffer->off);
-         buffer->data = (uint8_t *) buffer->realloc_func (
-            buffer->data, buffer->datalen, NULL);
+         _mongoc_buffer_grow (
+            buffer,
+            bson_next_power_of_two (data_size + buffer->len + buffer->off));
       }
    }
 
@@ -203,10 +277,8 @@ _mongoc_buffer_append_from_stream (mongoc_buffer_t *buffer,
       }
       buffer->off = 0;
       if (!SPACE_FOR (buffer, size)) {
-         buffer->datalen =
-            bson_next_power_of_two (size + buffer->len + buffer->off);
-         buffer->data = (uint8_t *) buffer->realloc_func (
-            buffer->data, buffer->datalen, NULL);
+         _mongoc_buffer_grow (
+            buffer, bson_next_power_of_two (size + buffer->len + buffer->off));
       }
    }
 
@@ -273,9 +345,8 @@ _mongoc_buffer_fill (mongoc_buffer_t *buffer,
    buffer->off = 0;
 
    if (!SPACE_FOR (buffer, min_bytes)) {
-      buffer->datalen = bson_next_power_of_two (buffer->len + min_bytes);
-      buffer->data = (uint8_t *) buffer->realloc_func (
-         buffer->data, buffer->datalen, buffer->realloc_data);
+      _mongoc_buffer_grow (buffer,
+                           bson_next_power_of_two (buffer->len + min_bytes));
    }
 
    avail_bytes = buffer->datalen - buffer->len;
@@ -348,10 +419,8 @@ _mongoc_buffer_try_append_from_stream (mongoc_buffer_t *buffer,
       }
       buffer->off = 0;
       if (!SPACE_FOR (buffer, size)) {
-         buffer->datalen =
-            bson_next_power_of_two (size + buffer->len + buffer->off);
-         buffer->data = (uint8_t *) buffer->realloc_func (
-            buffer->data, buffer->datalen, NULL);
+         _mongoc_buffer_grow (
+            buffer, bson_next_power_of_two (size + buffer->len + buffer->off));
       }
    }
 
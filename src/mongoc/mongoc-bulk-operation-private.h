@@ -23,6 +23,8 @@
 
 #include "mongoc-array-private.h"
 #include "mongoc-client.h"
+#include "mongoc-client-pool.h"
+#include "mongoc-shard-router.h"
 #include "mongoc-write-command-private.h"
 
 
@@ -40,6 +42,19 @@ struct _mongoc_bulk_operation_t {
    mongoc_write_result_t result;
    bool executed;
    int64_t operation_id;
+   /* for unordered bulks, send batches on up to this many clients at once,
+    * borrowing all but bulk->client from the pool */
+   mongoc_client_pool_t *pool;
+   uint32_t max_connections;
+   /* how inserted and replacement documents are validated, unless an
+    * operation's "validate" option overrides it */
+   bson_validate_flags_t vflags;
+   /* for unordered bulks, merge updates that $set fields of the same _id
+    * before executing */
+   bool coalesce_updates;
+   /* for unordered bulks, order each insert command's documents by the
+    * shard that owns them, or NULL. not owned */
+   mongoc_shard_router_t *router;
 };
 
 
@@ -18,6 +18,9 @@
 #include "mongoc-bulk-operation.h"
 #include "mongoc-bulk-operation-private.h"
 #include "mongoc-client-private.h"
+#include "mongoc-client-session-private.h"
+#include "mongoc-shard-router-private.h"
+#include "mongoc-thread-private.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-write-concern-private.h"
 #include "mongoc-util-private.h"
@@ -52,6 +55,7 @@ mongoc_bulk_operation_new (bool ordered)
       MONGOC_BYPASS_DOCUMENT_VALIDATION_DEFAULT;
    bulk->flags.ordered = ordered;
    bulk->server_id = 0;
+   bulk->vflags = _mongoc_insert_vflags;
 
    _mongoc_array_init (&bulk->commands, sizeof (mongoc_write_command_t));
    _mongoc_write_result_init (&bulk->result);
@@ -115,6 +119,19 @@ mongoc_bulk_operation_destroy (mongoc_bulk_operation_t *bulk) /* IN */
 }
 
 
+/* add @command, its payload charged to the client's memory budget */
+static void
+_mongoc_bulk_operation_append_command (mongoc_bulk_operation_t *bulk,
+                                       mongoc_write_command_t *command)
+{
+   if (bulk->client) {
+      _mongoc_buffer_set_budget (&command->payload, bulk->client->budget);
+   }
+
+   _mongoc_array_append_val (&bulk->commands, *command);
+}
+
+
 /* already failed, e.g. a bad call to mongoc_bulk_operation_insert? */
 #define BULK_EXIT_IF_PRIOR_ERROR       \
    do {                                \
@@ -166,7 +183,7 @@ _mongoc_bulk_operation_remove_with_opts (mongoc_bulk_operation_t *bulk,
    _mongoc_write_command_init_delete (
       &command, selector, opts, bulk->flags, bulk->operation_id);
 
-   _mongoc_array_append_val (&bulk->commands, command);
+   _mongoc_bulk_operation_append_command (bulk, &command);
 
    RETURN (true);
 }
@@ -341,46 +358,159 @@ mongoc_bulk_operation_insert (mongoc_bulk_operation_t *bulk,
    EXIT;
 }
 
+/* the insert command to add to, a new one unless inserts were queued last */
+static mongoc_write_command_t *
+_mongoc_bulk_operation_last_insert (mongoc_bulk_operation_t *bulk)
+{
+   mongoc_write_command_t command = {0};
+   mongoc_write_command_t *last = NULL;
+
+   if (bulk->commands.len) {
+      last = &_mongoc_array_index (
+         &bulk->commands, mongoc_write_command_t, bulk->commands.len - 1);
+   }
+
+   if (!last || last->type != MONGOC_WRITE_COMMAND_INSERT) {
+      _mongoc_write_command_init_insert (
+         &command,
+         NULL,
+         bulk->flags,
+         bulk->operation_id,
+         !mongoc_write_concern_is_acknowledged (bulk->write_concern));
+
+      _mongoc_bulk_operation_append_command (bulk, &command);
+      last = &_mongoc_array_index (
+         &bulk->commands, mongoc_write_command_t, bulk->commands.len - 1);
+   }
+
+   /* set each time, mongoc_bulk_operation_set_client may have changed it */
+   last->oid_context =
+      bulk->client ? _mongoc_client_get_oid_context (bulk->client) : NULL;
+
+   return last;
+}
+
+/* queue @document, which the bulk owns on success if @steal */
+static bool
+_mongoc_bulk_operation_insert (mongoc_bulk_operation_t *bulk,
+                               bson_t *document,
+                               const bson_t *opts,
+                               bool steal,
+                               bson_error_t *error)
+{
+   mongoc_write_command_t *last;
+   bson_validate_flags_t vflags = bulk->vflags;
+
+   ENTRY;
+
+   BULK_RETURN_IF_PRIOR_ERROR;
+
+   if (!_mongoc_validate_flags_from_opts (opts, &vflags, error) ||
+       !_mongoc_validate_new_document (document, vflags, error)) {
+      return false;
+   }
+
+   last = _mongoc_bulk_operation_last_insert (bulk);
+
+   if (steal) {
+      _mongoc_write_command_insert_steal (last, document);
+   } else {
+      _mongoc_write_command_insert_append (last, document);
+   }
+
+   return true;
+}
+
 bool
 mongoc_bulk_operation_insert_with_opts (mongoc_bulk_operation_t *bulk,
                                         const bson_t *document,
                                         const bson_t *opts,
                                         bson_error_t *error)
 {
-   mongoc_write_command_t command = {0};
-   mongoc_write_command_t *last;
+   BSON_ASSERT (bulk);
+   BSON_ASSERT (document);
 
-   ENTRY;
+   return _mongoc_bulk_operation_insert (
+      bulk, (bson_t *) document, opts, false, error);
+}
 
+bool
+mongoc_bulk_operation_insert_steal (mongoc_bulk_operation_t *bulk,
+                                    bson_t *document,
+                                    const bson_t *opts,
+                                    bson_error_t *error)
+{
    BSON_ASSERT (bulk);
    BSON_ASSERT (document);
 
-   BULK_RETURN_IF_PRIOR_ERROR;
-
-   if (!_mongoc_validate_new_document (document, error)) {
+   if (!_mongoc_bulk_operation_insert (bulk, document, opts, true, error)) {
+      bson_destroy (document);
       return false;
    }
 
-   if (bulk->commands.len) {
-      last = &_mongoc_array_index (
-         &bulk->commands, mongoc_write_command_t, bulk->commands.len - 1);
+   return true;
+}
 
-      if (last->type == MONGOC_WRITE_COMMAND_INSERT) {
-         _mongoc_write_command_insert_append (last, document);
-         return true;
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_bulk_operation_insert_raw --
+ *
+ *       Queue inserts of the BSON documents laid end to end in @data, as
+ *       a file of BSON or a bson_reader_t's source holds them. Only their
+ *       framing is checked. They are sent from @data, which must outlive
+ *       the bulk operation.
+ *
+ * Returns:
+ *       true, or false with @error set and nothing queued if a document's
+ *       length runs past @len or it lacks its terminating byte.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_bulk_operation_insert_raw (mongoc_bulk_operation_t *bulk,
+                                  const uint8_t *data,
+                                  size_t len,
+                                  bson_error_t *error)
+{
+   uint32_t doc_len;
+   size_t offset = 0;
+
+   ENTRY;
+
+   BSON_ASSERT (bulk);
+   BSON_ASSERT (data || len == 0);
+
+   BULK_RETURN_IF_PRIOR_ERROR;
+
+   while (offset < len) {
+      if (len - offset < 5) {
+         doc_len = 0;
+      } else {
+         memcpy (&doc_len, data + offset, 4);
+         doc_len = BSON_UINT32_FROM_LE (doc_len);
       }
-   }
 
-   _mongoc_write_command_init_insert (
-      &command,
-      document,
-      bulk->flags,
-      bulk->operation_id,
-      !mongoc_write_concern_is_acknowledged (bulk->write_concern));
+      if (doc_len < 5 || doc_len > len - offset ||
+          data[offset + doc_len - 1] != '\0') {
+         bson_set_error (error,
+                         MONGOC_ERROR_BSON,
+                         MONGOC_ERROR_BSON_INVALID,
+                         "Invalid document at byte %" PRIu64,
+                         (uint64_t) offset);
+         RETURN (false);
+      }
 
-   _mongoc_array_append_val (&bulk->commands, command);
+      offset += doc_len;
+   }
 
-   return true;
+   if (len) {
+      _mongoc_write_command_insert_raw (
+         _mongoc_bulk_operation_last_insert (bulk), data, len);
+   }
+
+   RETURN (true);
 }
 
 bool
@@ -392,6 +522,9 @@ _mongoc_bulk_operation_replace_one_with_opts (mongoc_bulk_operation_t *bulk,
 {
    mongoc_write_command_t command = {0};
    mongoc_write_command_t *last;
+   bson_validate_flags_t vflags = bulk->vflags;
+   bson_t opts_copy;
+   bool copied = false;
 
    ENTRY;
 
@@ -401,22 +534,36 @@ _mongoc_bulk_operation_replace_one_with_opts (mongoc_bulk_operation_t *bulk,
    BSON_ASSERT (selector);
    BSON_ASSERT (document);
 
-   if (!_mongoc_validate_replace (document, error)) {
+   if (!_mongoc_validate_flags_from_opts (opts, &vflags, error) ||
+       !_mongoc_validate_replace (document, vflags, error)) {
       RETURN (false);
    }
 
+   /* the rest of @opts goes in the update statement */
+   if (opts && bson_has_field (opts, "validate")) {
+      bson_init (&opts_copy);
+      bson_copy_to_excluding_noinit (opts, &opts_copy, "validate", NULL);
+      opts = &opts_copy;
+      copied = true;
+   }
+
+   last = NULL;
    if (bulk->commands.len) {
       last = &_mongoc_array_index (
          &bulk->commands, mongoc_write_command_t, bulk->commands.len - 1);
-      if (last->type == MONGOC_WRITE_COMMAND_UPDATE) {
-         _mongoc_write_command_update_append (last, selector, document, opts);
-         RETURN (true);
-      }
    }
 
-   _mongoc_write_command_init_update (
-      &command, selector, document, opts, bulk->flags, bulk->operation_id);
-   _mongoc_array_append_val (&bulk->commands, command);
+   if (last && last->type == MONGOC_WRITE_COMMAND_UPDATE) {
+      _mongoc_write_command_update_append (last, selector, document, opts);
+   } else {
+      _mongoc_write_command_init_update (
+         &command, selector, document, opts, bulk->flags, bulk->operation_id);
+      _mongoc_bulk_operation_append_command (bulk, &command);
+   }
+
+   if (copied) {
+      bson_destroy (&opts_copy);
+   }
 
    RETURN (true);
 }
@@ -523,7 +670,7 @@ _mongoc_bulk_operation_update_with_opts (mongoc_bulk_operation_t *bulk,
 
    _mongoc_write_command_init_update (
       &command, selector, document, opts, bulk->flags, bulk->operation_id);
-   _mongoc_array_append_val (&bulk->commands, command);
+   _mongoc_bulk_operation_append_command (bulk, &command);
 
    RETURN (true);
 }
@@ -664,6 +811,181 @@ mongoc_bulk_operation_update_one (mongoc_bulk_operation_t *bulk,
    EXIT;
 }
 
+typedef struct {
+   mongoc_bulk_operation_t *bulk;
+   mongoc_mutex_t mutex;
+   size_t next;                    /* the next command to send */
+   uint32_t *offsets;              /* each command's first document */
+   uint32_t *server_ids;           /* where each was sent, or 0 */
+   mongoc_write_result_t *results; /* each command's result */
+   bool stop;
+} mongoc_bulk_dispatch_t;
+
+
+typedef struct {
+   mongoc_bulk_dispatch_t *dispatch;
+   mongoc_client_t *client; /* NULL to borrow one from the pool */
+   mongoc_thread_t thread;
+} mongoc_bulk_worker_t;
+
+
+/* send the bulk's commands one at a time until none are left */
+static void *
+_mongoc_bulk_operation_worker (void *data)
+{
+   mongoc_bulk_worker_t *worker = (mongoc_bulk_worker_t *) data;
+   mongoc_bulk_dispatch_t *dispatch = worker->dispatch;
+   mongoc_bulk_operation_t *bulk = dispatch->bulk;
+   mongoc_client_t *client = worker->client;
+   mongoc_server_stream_t *server_stream = NULL;
+   mongoc_write_command_t *command;
+   mongoc_write_result_t *result;
+   size_t i;
+   bool stop;
+
+   if (!client) {
+      /* the caller's thread sends the commands if the pool is empty */
+      client = mongoc_client_pool_try_pop (bulk->pool);
+      if (!client) {
+         return NULL;
+      }
+   }
+
+   for (;;) {
+      mongoc_mutex_lock (&dispatch->mutex);
+      i = dispatch->next++;
+      stop = dispatch->stop;
+      mongoc_mutex_unlock (&dispatch->mutex);
+
+      if (stop || i >= bulk->commands.len) {
+         break;
+      }
+
+      command =
+         &_mongoc_array_index (&bulk->commands, mongoc_write_command_t, i);
+      result = &dispatch->results[i];
+
+      if (!server_stream) {
+         server_stream =
+            mongoc_cluster_stream_for_writes (&client->cluster, &result->error);
+         if (!server_stream) {
+            result->failed = true;
+            break;
+         }
+      }
+
+      _mongoc_write_command_execute (command,
+                                     client,
+                                     server_stream,
+                                     bulk->database,
+                                     bulk->collection,
+                                     bulk->write_concern,
+                                     dispatch->offsets[i],
+                                     NULL /* session */,
+                                     result);
+
+      dispatch->server_ids[i] = server_stream->sd->id;
+
+      if (result->must_stop) {
+         mongoc_mutex_lock (&dispatch->mutex);
+         dispatch->stop = true;
+         mongoc_mutex_unlock (&dispatch->mutex);
+      }
+   }
+
+   mongoc_server_stream_cleanup (server_stream); /* null ok */
+
+   if (client != worker->client) {
+      mongoc_client_pool_push (bulk->pool, client);
+   }
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bulk_operation_execute_concurrent --
+ *
+ *       Send an unordered bulk's commands on bulk->client and up to
+ *       bulk->max_connections - 1 clients from bulk->pool at once, each
+ *       client taking the next unsent command when it is done with one.
+ *       Then merge the results in order into bulk->result.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_bulk_operation_execute_concurrent (mongoc_bulk_operation_t *bulk)
+{
+   mongoc_bulk_dispatch_t dispatch = {0};
+   mongoc_bulk_worker_t *workers;
+   mongoc_write_command_t *command;
+   uint32_t n_workers;
+   uint32_t offset = 0;
+   size_t i;
+
+   ENTRY;
+
+   n_workers =
+      (uint32_t) BSON_MIN ((size_t) bulk->max_connections, bulk->commands.len);
+
+   dispatch.bulk = bulk;
+   mongoc_mutex_init (&dispatch.mutex);
+   dispatch.offsets = bson_malloc (bulk->commands.len * sizeof (uint32_t));
+   dispatch.server_ids = bson_malloc0 (bulk->commands.len * sizeof (uint32_t));
+   dispatch.results =
+      bson_malloc (bulk->commands.len * sizeof (mongoc_write_result_t));
+
+   for (i = 0; i < bulk->commands.len; i++) {
+      command =
+         &_mongoc_array_index (&bulk->commands, mongoc_write_command_t, i);
+      dispatch.offsets[i] = offset;
+      offset += command->n_documents;
+      _mongoc_write_result_init (&dispatch.results[i]);
+   }
+
+   workers = bson_malloc0 (n_workers * sizeof (mongoc_bulk_worker_t));
+   for (i = 0; i < n_workers; i++) {
+      workers[i].dispatch = &dispatch;
+   }
+
+   /* the first worker is this thread, with the bulk's own client */
+   workers[0].client = bulk->client;
+   for (i = 1; i < n_workers; i++) {
+      _mongoc_thread_create (MONGOC_THREAD_BULK_WORKER,
+                             &workers[i].thread,
+                             _mongoc_bulk_operation_worker,
+                             &workers[i]);
+   }
+
+   _mongoc_bulk_operation_worker (&workers[0]);
+
+   for (i = 1; i < n_workers; i++) {
+      mongoc_thread_join (workers[i].thread);
+   }
+
+   for (i = 0; i < bulk->commands.len; i++) {
+      if (!bulk->server_id) {
+         bulk->server_id = dispatch.server_ids[i];
+      }
+
+      _mongoc_write_result_merge_result (
+         &bulk->result, &dispatch.results[i], 0 /* already offset */);
+      _mongoc_write_result_destroy (&dispatch.results[i]);
+   }
+
+   bson_free (workers);
+   bson_free (dispatch.results);
+   bson_free (dispatch.server_ids);
+   bson_free (dispatch.offsets);
+   mongoc_mutex_destroy (&dispatch.mutex);
+
+   EXIT;
+}
+
+
 uint32_t
 mongoc_bulk_operation_execute (mongoc_bulk_operation_t *bulk, /* IN */
                                bson_t *reply,                 /* OUT */
@@ -672,6 +994,7 @@ mongoc_bulk_operation_execute (mongoc_bulk_operation_t *bulk, /* IN */
    mongoc_cluster_t *cluster;
    mongoc_write_command_t *command;
    mongoc_server_stream_t *server_stream;
+   bool began = false;
    bool ret;
    uint32_t offset = 0;
    int i;
@@ -734,7 +1057,39 @@ mongoc_bulk_operation_execute (mongoc_bulk_operation_t *bulk, /* IN */
       RETURN (false);
    }
 
-   if (bulk->server_id) {
+   if (bulk->coalesce_updates && !bulk->flags.ordered) {
+      for (i = 0; i < bulk->commands.len; i++) {
+         command =
+            &_mongoc_array_index (&bulk->commands, mongoc_write_command_t, i);
+         if (command->type == MONGOC_WRITE_COMMAND_UPDATE) {
+            _mongoc_write_command_coalesce_updates (command);
+         }
+      }
+   }
+
+   if (bulk->router && !bulk->flags.ordered) {
+      for (i = 0; i < bulk->commands.len; i++) {
+         command =
+            &_mongoc_array_index (&bulk->commands, mongoc_write_command_t, i);
+         if (command->type == MONGOC_WRITE_COMMAND_INSERT) {
+            _mongoc_shard_router_group_inserts (bulk->router, command);
+         }
+      }
+   }
+
+   if (bulk->pool && bulk->max_connections > 1 && !bulk->flags.ordered &&
+       !bulk->session && !bulk->server_id && bulk->commands.len > 1) {
+      server_stream = NULL;
+      _mongoc_bulk_operation_execute_concurrent (bulk);
+      GOTO (cleanup);
+   }
+
+   began = _mongoc_cluster_deadline_begin (cluster, -1);
+
+   if (_mongoc_client_session_in_transaction (bulk->session)) {
+      /* where the transaction's first statement went */
+      server_stream = _mongoc_client_session_stream (bulk->session, error);
+   } else if (bulk->server_id) {
       server_stream = mongoc_cluster_stream_for_server (
          cluster, bulk->server_id, true /* reconnect_ok */, error);
    } else {
@@ -742,6 +1097,7 @@ mongoc_bulk_operation_execute (mongoc_bulk_operation_t *bulk, /* IN */
    }
 
    if (!server_stream) {
+      _mongoc_cluster_deadline_end (cluster, began, error);
       RETURN (false);
    }
 
@@ -777,6 +1133,7 @@ cleanup:
                                         reply,
                                         error);
    mongoc_server_stream_cleanup (server_stream);
+   _mongoc_cluster_deadline_end (cluster, began, ret ? NULL : error);
 
    RETURN (ret ? bulk->server_id : 0);
 }
@@ -838,10 +1195,19 @@ mongoc_bulk_operation_set_collection (mongoc_bulk_operation_t *bulk,
 void
 mongoc_bulk_operation_set_client (mongoc_bulk_operation_t *bulk, void *client)
 {
+   mongoc_write_command_t *command;
+   int i;
+
    BSON_ASSERT (bulk);
 
    bulk->client = (mongoc_client_t *) client;
 
+   for (i = 0; i < bulk->commands.len; i++) {
+      command =
+         &_mongoc_array_index (&bulk->commands, mongoc_write_command_t, i);
+      _mongoc_buffer_set_budget (&command->payload, bulk->client->budget);
+   }
+
    /* if you call set_client, bulk was likely made by mongoc_bulk_operation_new,
     * not mongoc_collection_create_bulk_operation(), so operation_id is 0. */
    if (!bulk->operation_id) {
@@ -850,6 +1216,56 @@ mongoc_bulk_operation_set_client (mongoc_bulk_operation_t *bulk, void *client)
 }
 
 
+/* run the bulk operation's commands in @client_session, a transaction's
+ * statements if it's in one. the session must be the bulk client's */
+void
+mongoc_bulk_operation_set_client_session (
+   mongoc_bulk_operation_t *bulk,
+   struct _mongoc_client_session_t *client_session)
+{
+   BSON_ASSERT (bulk);
+   BSON_ASSERT (client_session);
+
+   if (bulk->client) {
+      BSON_ASSERT (bulk->client == client_session->client);
+   }
+
+   bulk->session = client_session;
+}
+
+
+void
+mongoc_bulk_operation_set_concurrency (mongoc_bulk_operation_t *bulk,
+                                       void *pool,
+                                       uint32_t max_connections)
+{
+   BSON_ASSERT (bulk);
+
+   bulk->pool = (mongoc_client_pool_t *) pool;
+   bulk->max_connections = pool ? max_connections : 0;
+}
+
+
+void
+mongoc_bulk_operation_set_coalesce_updates (mongoc_bulk_operation_t *bulk,
+                                            bool coalesce)
+{
+   BSON_ASSERT (bulk);
+
+   bulk->coalesce_updates = coalesce;
+}
+
+
+void
+mongoc_bulk_operation_set_shard_router (mongoc_bulk_operation_t *bulk,
+                                        mongoc_shard_router_t *router)
+{
+   BSON_ASSERT (bulk);
+
+   bulk->router = router;
+}
+
+
 uint32_t
 mongoc_bulk_operation_get_hint (const mongoc_bulk_operation_t *bulk)
 {
@@ -34,6 +34,10 @@ BSON_BEGIN_DECLS
 
 typedef struct _mongoc_bulk_operation_t mongoc_bulk_operation_t;
 typedef struct _mongoc_bulk_write_flags_t mongoc_bulk_write_flags_t;
+/* mongoc_client_session_t, typedef'ed in mongoc-client.h */
+struct _mongoc_client_session_t;
+/* mongoc_shard_router_t, typedef'ed in mongoc-shard-router.h */
+struct _mongoc_shard_router_t;
 
 
 MONGOC_EXPORT (void)
@@ -58,6 +62,16 @@ mongoc_bulk_operation_insert_with_opts (mongoc_bulk_operation_t *bulk,
                                         const bson_t *document,
                                         const bson_t *opts,
                                         bson_error_t *error); /* OUT */
+MONGOC_EXPORT (bool)
+mongoc_bulk_operation_insert_steal (mongoc_bulk_operation_t *bulk,
+                                    bson_t *document,
+                                    const bson_t *opts,
+                                    bson_error_t *error); /* OUT */
+MONGOC_EXPORT (bool)
+mongoc_bulk_operation_insert_raw (mongoc_bulk_operation_t *bulk,
+                                  const uint8_t *data,
+                                  size_t len,
+                                  bson_error_t *error); /* OUT */
 MONGOC_EXPORT (void)
 mongoc_bulk_operation_remove (mongoc_bulk_operation_t *bulk,
                               const bson_t *selector);
@@ -130,6 +144,20 @@ mongoc_bulk_operation_set_collection (mongoc_bulk_operation_t *bulk,
                                       const char *collection);
 MONGOC_EXPORT (void)
 mongoc_bulk_operation_set_client (mongoc_bulk_operation_t *bulk, void *client);
+MONGOC_EXPORT (void)
+mongoc_bulk_operation_set_client_session (
+   mongoc_bulk_operation_t *bulk,
+   struct _mongoc_client_session_t *client_session);
+MONGOC_EXPORT (void)
+mongoc_bulk_operation_set_concurrency (mongoc_bulk_operation_t *bulk,
+                                       void *pool,
+                                       uint32_t max_connections);
+MONGOC_EXPORT (void)
+mongoc_bulk_operation_set_coalesce_updates (mongoc_bulk_operation_t *bulk,
+                                            bool coalesce);
+MONGOC_EXPORT (void)
+mongoc_bulk_operation_set_shard_router (
+   mongoc_bulk_operation_t *bulk, struct _mongoc_shard_router_t *router);
 /* These names include the term "hint" for backward compatibility, should be
  * mongoc_bulk_operation_get_server_id, mongoc_bulk_operation_set_server_id. */
 MONGOC_EXPORT (void)
@@ -0,0 +1,583 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-bulk-writer.h"
+#include "mongoc-bulk-operation-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-client-pool.h"
+#include "mongoc-collection-private.h"
+#include "mongoc-error.h"
+#include "mongoc-server-description-private.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-trace-private.h"
+#include "mongoc-write-command-private.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "bulk-writer"
+
+
+/* a full batch, queued for a worker */
+typedef struct _mongoc_bulk_writer_batch_t {
+   mongoc_bulk_operation_t *bulk;
+   uint32_t offset; /* index of the batch's first operation */
+   struct _mongoc_bulk_writer_batch_t *next;
+} mongoc_bulk_writer_batch_t;
+
+
+typedef struct {
+   mongoc_bulk_writer_t *writer;
+   mongoc_client_t *client;
+   mongoc_thread_t thread;
+} mongoc_bulk_writer_worker_t;
+
+
+struct _mongoc_bulk_writer_t {
+   mongoc_collection_t *collection;
+   bool ordered;
+   uint32_t max_operations;
+   uint32_t max_bytes;
+   mongoc_client_pool_t *pool;
+   uint32_t max_in_flight;
+   bool finished;
+
+   /* the batch being filled, only the caller's thread touches it */
+   mongoc_bulk_operation_t *current;
+   uint32_t current_operations;
+   uint32_t current_bytes;
+   uint32_t offset; /* index of current's first operation */
+
+   /* with a pool, the workers share the rest under the mutex */
+   mongoc_mutex_t mutex;
+   mongoc_cond_t cond;
+   mongoc_bulk_writer_batch_t *head;
+   mongoc_bulk_writer_batch_t *tail;
+   uint32_t in_flight; /* queued or being sent */
+   bool shutdown;
+   mongoc_bulk_writer_worker_t *workers;
+   uint32_t n_workers;
+   mongoc_write_result_t result;
+};
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_bulk_writer_new --
+ *
+ *       Create a writer that buffers operations for @collection in a bulk
+ *       operation and sends it as soon as it is full, so memory use does
+ *       not grow with the number of operations.
+ *
+ * Returns:
+ *       A writer that must be freed with mongoc_bulk_writer_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_bulk_writer_t *
+mongoc_bulk_writer_new (mongoc_collection_t *collection, bool ordered)
+{
+   mongoc_bulk_writer_t *writer;
+
+   BSON_ASSERT (collection);
+
+   writer = (mongoc_bulk_writer_t *) bson_malloc0 (sizeof *writer);
+   writer->collection = collection;
+   writer->ordered = ordered;
+   writer->max_operations = MONGOC_DEFAULT_WRITE_BATCH_SIZE;
+   writer->max_bytes = MONGOC_DEFAULT_MAX_MSG_SIZE;
+   writer->max_in_flight = 1;
+   mongoc_mutex_init (&writer->mutex);
+   mongoc_cond_init (&writer->cond);
+   _mongoc_write_result_init (&writer->result);
+
+   return writer;
+}
+
+
+void
+mongoc_bulk_writer_set_max_batch (mongoc_bulk_writer_t *writer,
+                                  uint32_t max_operations,
+                                  uint32_t max_bytes)
+{
+   BSON_ASSERT (writer);
+
+   writer->max_operations =
+      max_operations ? max_operations : MONGOC_DEFAULT_WRITE_BATCH_SIZE;
+   writer->max_bytes = max_bytes ? max_bytes : MONGOC_DEFAULT_MAX_MSG_SIZE;
+}
+
+
+void
+mongoc_bulk_writer_set_pool (mongoc_bulk_writer_t *writer,
+                             void *pool,
+                             uint32_t max_in_flight)
+{
+   BSON_ASSERT (writer);
+
+   if (writer->workers) {
+      MONGOC_ERROR ("Cannot set the pool after the first batch is sent");
+      return;
+   }
+
+   writer->pool = (mongoc_client_pool_t *) pool;
+   writer->max_in_flight = BSON_MAX (max_in_flight, 1);
+}
+
+
+static bool
+_mongoc_bulk_writer_stopped (const mongoc_bulk_writer_t *writer)
+{
+   return writer->result.must_stop ||
+          (writer->ordered && writer->result.failed);
+}
+
+
+/* send @batch on @client and destroy it, merging its result under the
+ * mutex if there are workers */
+static void
+_mongoc_bulk_writer_send (mongoc_bulk_writer_t *writer,
+                          mongoc_bulk_writer_batch_t *batch,
+                          mongoc_client_t *client,
+                          bool stopped)
+{
+   mongoc_write_result_t *result = &batch->bulk->result;
+   bson_error_t error;
+
+   if (!stopped) {
+      mongoc_bulk_operation_set_client (batch->bulk, client);
+      if (!mongoc_bulk_operation_execute (batch->bulk, NULL, &error) &&
+          !result->failed) {
+         /* like server selection errors, not recorded in the result */
+         memcpy (&result->error, &error, sizeof error);
+         result->failed = true;
+         result->must_stop = true;
+      }
+
+      if (writer->workers) {
+         mongoc_mutex_lock (&writer->mutex);
+      }
+
+      _mongoc_write_result_merge_result (
+         &writer->result, result, batch->offset);
+
+      if (writer->workers) {
+         mongoc_mutex_unlock (&writer->mutex);
+      }
+   }
+
+   mongoc_bulk_operation_destroy (batch->bulk);
+   bson_free (batch);
+}
+
+
+static void *
+_mongoc_bulk_writer_worker (void *data)
+{
+   mongoc_bulk_writer_worker_t *worker = (mongoc_bulk_writer_worker_t *) data;
+   mongoc_bulk_writer_t *writer = worker->writer;
+   mongoc_bulk_writer_batch_t *batch;
+   bool stopped;
+
+   mongoc_mutex_lock (&writer->mutex);
+
+   for (;;) {
+      while (!writer->head && !writer->shutdown) {
+         mongoc_cond_wait (&writer->cond, &writer->mutex);
+      }
+
+      batch = writer->head;
+      if (!batch) {
+         break;
+      }
+
+      writer->head = batch->next;
+      if (!writer->head) {
+         writer->tail = NULL;
+      }
+
+      /* an ordered writer has one worker, so it sends batches in order */
+      stopped = _mongoc_bulk_writer_stopped (writer);
+      mongoc_mutex_unlock (&writer->mutex);
+
+      _mongoc_bulk_writer_send (writer, batch, worker->client, stopped);
+
+      mongoc_mutex_lock (&writer->mutex);
+      writer->in_flight--;
+      mongoc_cond_broadcast (&writer->cond);
+   }
+
+   mongoc_mutex_unlock (&writer->mutex);
+
+   return NULL;
+}
+
+
+/* borrow a client for each worker, if the pool has any to spare */
+static void
+_mongoc_bulk_writer_start_workers (mongoc_bulk_writer_t *writer)
+{
+   mongoc_client_t *client;
+   uint32_t n;
+   uint32_t i;
+
+   n = writer->ordered ? 1 : writer->max_in_flight;
+   writer->workers = (mongoc_bulk_writer_worker_t *) bson_malloc0 (
+      n * sizeof (mongoc_bulk_writer_worker_t));
+
+   for (i = 0; i < n; i++) {
+      client = mongoc_client_pool_try_pop (writer->pool);
+      if (!client) {
+         break;
+      }
+
+      writer->workers[i].writer = writer;
+      writer->workers[i].client = client;
+      writer->n_workers++;
+   }
+
+   if (!writer->n_workers) {
+      /* send batches from the caller's thread instead */
+      bson_free (writer->workers);
+      writer->workers = NULL;
+      writer->pool = NULL;
+      return;
+   }
+
+   for (i = 0; i < writer->n_workers; i++) {
+      _mongoc_thread_create (MONGOC_THREAD_BULK_WORKER,
+                             &writer->workers[i].thread,
+                             _mongoc_bulk_writer_worker,
+                             &writer->workers[i]);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bulk_writer_flush --
+ *
+ *       Send the batch being filled. With a pool, queue it for the workers,
+ *       first waiting while max_in_flight batches are queued or being sent.
+ *       Otherwise send it and wait for the reply.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_bulk_writer_flush (mongoc_bulk_writer_t *writer)
+{
+   mongoc_bulk_writer_batch_t *batch;
+
+   ENTRY;
+
+   if (!writer->current_operations) {
+      EXIT;
+   }
+
+   batch = (mongoc_bulk_writer_batch_t *) bson_malloc0 (sizeof *batch);
+   batch->bulk = writer->current;
+   batch->offset = writer->offset;
+
+   writer->offset += writer->current_operations;
+   writer->current = NULL;
+   writer->current_operations = 0;
+   writer->current_bytes = 0;
+
+   if (writer->pool && !writer->workers) {
+      _mongoc_bulk_writer_start_workers (writer);
+   }
+
+   if (!writer->workers) {
+      _mongoc_bulk_writer_send (writer,
+                                batch,
+                                writer->collection->client,
+                                _mongoc_bulk_writer_stopped (writer));
+      EXIT;
+   }
+
+   mongoc_mutex_lock (&writer->mutex);
+
+   while (writer->in_flight >= writer->max_in_flight) {
+      mongoc_cond_wait (&writer->cond, &writer->mutex);
+   }
+
+   if (writer->tail) {
+      writer->tail->next = batch;
+   } else {
+      writer->head = batch;
+   }
+
+   writer->tail = batch;
+   writer->in_flight++;
+   mongoc_cond_signal (&writer->cond);
+   mongoc_mutex_unlock (&writer->mutex);
+
+   EXIT;
+}
+
+
+/* before adding an operation, check the writer can still send it */
+static bool
+_mongoc_bulk_writer_check (mongoc_bulk_writer_t *writer, bson_error_t *error)
+{
+   bool stopped;
+
+   if (writer->finished) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Cannot add operations to a finished bulk writer");
+      return false;
+   }
+
+   if (writer->workers) {
+      mongoc_mutex_lock (&writer->mutex);
+   }
+
+   stopped = _mongoc_bulk_writer_stopped (writer);
+   if (stopped) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Bulk writer is stopped from prior error: %s",
+                      writer->result.error.message);
+   }
+
+   if (writer->workers) {
+      mongoc_mutex_unlock (&writer->mutex);
+   }
+
+   if (stopped) {
+      return false;
+   }
+
+   if (!writer->current) {
+      writer->current = mongoc_collection_create_bulk_operation (
+         writer->collection, writer->ordered, NULL);
+   }
+
+   return true;
+}
+
+
+/* after adding an operation of @len bytes, send the batch if it is full */
+static void
+_mongoc_bulk_writer_added (mongoc_bulk_writer_t *writer, uint32_t len)
+{
+   writer->current_operations++;
+   writer->current_bytes += len;
+
+   if (writer->current_operations >= writer->max_operations ||
+       writer->current_bytes >= writer->max_bytes) {
+      _mongoc_bulk_writer_flush (writer);
+   }
+}
+
+
+bool
+mongoc_bulk_writer_insert (mongoc_bulk_writer_t *writer,
+                           const bson_t *document,
+                           const bson_t *opts,
+                           bson_error_t *error)
+{
+   BSON_ASSERT (writer);
+   BSON_ASSERT (document);
+
+   if (!_mongoc_bulk_writer_check (writer, error)) {
+      return false;
+   }
+
+   if (!mongoc_bulk_operation_insert_with_opts (
+          writer->current, document, opts, error)) {
+      return false;
+   }
+
+   _mongoc_bulk_writer_added (writer, document->len);
+
+   return true;
+}
+
+
+bool
+mongoc_bulk_writer_update_one (mongoc_bulk_writer_t *writer,
+                               const bson_t *selector,
+                               const bson_t *document,
+                               const bson_t *opts,
+                               bson_error_t *error)
+{
+   BSON_ASSERT (writer);
+   BSON_ASSERT (selector);
+   BSON_ASSERT (document);
+
+   if (!_mongoc_bulk_writer_check (writer, error)) {
+      return false;
+   }
+
+   if (!mongoc_bulk_operation_update_one_with_opts (
+          writer->current, selector, document, opts, error)) {
+      return false;
+   }
+
+   _mongoc_bulk_writer_added (writer, selector->len + document->len);
+
+   return true;
+}
+
+
+bool
+mongoc_bulk_writer_remove_one (mongoc_bulk_writer_t *writer,
+                               const bson_t *selector,
+                               const bson_t *opts,
+                               bson_error_t *error)
+{
+   BSON_ASSERT (writer);
+   BSON_ASSERT (selector);
+
+   if (!_mongoc_bulk_writer_check (writer, error)) {
+      return false;
+   }
+
+   if (!mongoc_bulk_operation_remove_one_with_opts (
+          writer->current, selector, opts, error)) {
+      return false;
+   }
+
+   _mongoc_bulk_writer_added (writer, selector->len);
+
+   return true;
+}
+
+
+/* wait for the queued batches to be sent, then stop the workers */
+static void
+_mongoc_bulk_writer_stop_workers (mongoc_bulk_writer_t *writer)
+{
+   uint32_t i;
+
+   if (!writer->workers) {
+      return;
+   }
+
+   mongoc_mutex_lock (&writer->mutex);
+   writer->shutdown = true;
+   mongoc_cond_broadcast (&writer->cond);
+   mongoc_mutex_unlock (&writer->mutex);
+
+   for (i = 0; i < writer->n_workers; i++) {
+      mongoc_thread_join (writer->workers[i].thread);
+      mongoc_client_pool_push (writer->pool, writer->workers[i].client);
+   }
+
+   bson_free (writer->workers);
+   writer->workers = NULL;
+   writer->n_workers = 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_bulk_writer_finish --
+ *
+ *       Send the last batch, wait for every batch's reply, and report the
+ *       combined result like mongoc_bulk_operation_execute().
+ *
+ * Returns:
+ *       true if every operation succeeded, otherwise false and @error is
+ *       set.
+ *
+ * Side effects:
+ *       @reply is always initialized, if not NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_bulk_writer_finish (mongoc_bulk_writer_t *writer,
+                           bson_t *reply,
+                           bson_error_t *error)
+{
+   ENTRY;
+
+   BSON_ASSERT (writer);
+
+   if (reply) {
+      bson_init (reply);
+   }
+
+   if (writer->finished) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "The bulk writer is already finished");
+      RETURN (false);
+   }
+
+   writer->finished = true;
+
+   if (!writer->offset && !writer->current_operations) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Cannot do an empty bulk write");
+      RETURN (false);
+   }
+
+   _mongoc_bulk_writer_flush (writer);
+   _mongoc_bulk_writer_stop_workers (writer);
+
+   RETURN (_mongoc_write_result_complete (
+      &writer->result,
+      writer->collection->client->error_api_version,
+      writer->collection->write_concern,
+      MONGOC_ERROR_COMMAND /* err domain */,
+      reply,
+      error));
+}
+
+
+void
+mongoc_bulk_writer_destroy (mongoc_bulk_writer_t *writer)
+{
+   mongoc_bulk_writer_batch_t *batch;
+
+   if (!writer) {
+      return;
+   }
+
+   /* without finish, drop unsent batches but let the workers exit */
+   mongoc_mutex_lock (&writer->mutex);
+   writer->result.must_stop = true;
+   mongoc_mutex_unlock (&writer->mutex);
+
+   _mongoc_bulk_writer_stop_workers (writer);
+
+   while (writer->head) {
+      batch = writer->head;
+      writer->head = batch->next;
+      mongoc_bulk_operation_destroy (batch->bulk);
+      bson_free (batch);
+   }
+
+   mongoc_bulk_operation_destroy (writer->current); /* null ok */
+   _mongoc_write_result_destroy (&writer->result);
+   mongoc_cond_destroy (&writer->cond);
+   mongoc_mutex_destroy (&writer->mutex);
+   bson_free (writer);
+}
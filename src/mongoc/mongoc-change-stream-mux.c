@@ -0,0 +1,226 @@
+/*
+ * Copyright 2017-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mongoc-change-stream-mux.h"
+#include "mongoc-array-private.h"
+#include "mongoc-change-stream-private.h"
+#include "mongoc-matcher.h"
+#include "mongoc-trace-private.h"
+#include "mongoc-util-private.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "change-stream-mux"
+
+
+typedef struct {
+   uint32_t id;
+   mongoc_matcher_t *matcher; /* NULL to receive every event */
+   mongoc_change_stream_mux_cb_t cb;
+   void *context;
+} mongoc_change_stream_mux_subscriber_t;
+
+
+struct _mongoc_change_stream_mux_t {
+   mongoc_change_stream_t *stream;
+   mongoc_array_t subscribers;
+   uint32_t next_id;
+};
+
+
+mongoc_change_stream_mux_t *
+mongoc_change_stream_mux_new (const mongoc_collection_t *coll,
+                              const bson_t *pipeline,
+                              const bson_t *opts)
+{
+   mongoc_change_stream_mux_t *mux;
+
+   BSON_ASSERT (coll);
+
+   mux = (mongoc_change_stream_mux_t *) bson_malloc0 (sizeof *mux);
+   mux->stream = mongoc_collection_watch (coll, pipeline, opts);
+   _mongoc_array_init (&mux->subscribers,
+                       sizeof (mongoc_change_stream_mux_subscriber_t));
+   mux->next_id = 1;
+
+   return mux;
+}
+
+
+void
+mongoc_change_stream_mux_destroy (mongoc_change_stream_mux_t *mux)
+{
+   mongoc_change_stream_mux_subscriber_t *subscriber;
+   size_t i;
+
+   if (!mux) {
+      return;
+   }
+
+   for (i = 0; i < mux->subscribers.len; i++) {
+      subscriber = &_mongoc_array_index (
+         &mux->subscribers, mongoc_change_stream_mux_subscriber_t, i);
+      BEGIN_IGNORE_DEPRECATIONS
+      mongoc_matcher_destroy (subscriber->matcher);
+      END_IGNORE_DEPRECATIONS
+   }
+
+   _mongoc_array_destroy (&mux->subscribers);
+   mongoc_change_stream_destroy (mux->stream);
+   bson_free (mux);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_change_stream_mux_subscribe --
+ *
+ *       Deliver the events matching @filter, or every event if @filter is
+ *       NULL or empty, to @cb from now on.
+ *
+ * Returns:
+ *       A subscriber id for mongoc_change_stream_mux_unsubscribe, or 0
+ *       with @error set if @filter is invalid.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+mongoc_change_stream_mux_subscribe (mongoc_change_stream_mux_t *mux,
+                                    const bson_t *filter,
+                                    mongoc_change_stream_mux_cb_t cb,
+                                    void *context,
+                                    bson_error_t *error)
+{
+   mongoc_change_stream_mux_subscriber_t subscriber;
+
+   BSON_ASSERT (mux);
+   BSON_ASSERT (cb);
+
+   subscriber.matcher = NULL;
+
+   if (filter && !bson_empty (filter)) {
+      BEGIN_IGNORE_DEPRECATIONS
+      subscriber.matcher = mongoc_matcher_new (filter, error);
+      END_IGNORE_DEPRECATIONS
+
+      if (!subscriber.matcher) {
+         return 0;
+      }
+   }
+
+   subscriber.id = mux->next_id++;
+   subscriber.cb = cb;
+   subscriber.context = context;
+   _mongoc_array_append_val (&mux->subscribers, subscriber);
+
+   return subscriber.id;
+}
+
+
+bool
+mongoc_change_stream_mux_unsubscribe (mongoc_change_stream_mux_t *mux,
+                                      uint32_t subscriber_id)
+{
+   mongoc_change_stream_mux_subscriber_t *subscribers;
+   size_t i;
+
+   BSON_ASSERT (mux);
+
+   subscribers =
+      (mongoc_change_stream_mux_subscriber_t *) mux->subscribers.data;
+
+   for (i = 0; i < mux->subscribers.len; i++) {
+      if (subscribers[i].id == subscriber_id) {
+         BEGIN_IGNORE_DEPRECATIONS
+         mongoc_matcher_destroy (subscribers[i].matcher);
+         END_IGNORE_DEPRECATIONS
+
+         memmove (&subscribers[i],
+                  &subscribers[i + 1],
+                  (mux->subscribers.len - i - 1) * sizeof *subscribers);
+         mux->subscribers.len--;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/* deliver @event to the matching subscribers */
+void
+_mongoc_change_stream_mux_dispatch (mongoc_change_stream_mux_t *mux,
+                                    const bson_t *event)
+{
+   mongoc_change_stream_mux_subscriber_t *subscriber;
+   bool match;
+   size_t i;
+
+   for (i = 0; i < mux->subscribers.len; i++) {
+      subscriber = &_mongoc_array_index (
+         &mux->subscribers, mongoc_change_stream_mux_subscriber_t, i);
+
+      BEGIN_IGNORE_DEPRECATIONS
+      match = !subscriber->matcher ||
+              mongoc_matcher_match (subscriber->matcher, event);
+      END_IGNORE_DEPRECATIONS
+
+      if (match) {
+         subscriber->cb (event, subscriber->context);
+      }
+   }
+}
+
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_change_stream_mux_poll --
+ *
+ *       Read the events of the next server reply with
+ *       mongoc_change_stream_next_batch and deliver each to the
+ *       subscribers whose filters match it. The change stream resumes on
+ *       its own after resumable errors.
+ *
+ * Returns:
+ *       true if no error occurred, even if no event was available.
+ *       Otherwise false, with @error set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_change_stream_mux_poll (mongoc_change_stream_mux_t *mux,
+                               bson_error_t *error)
+{
+   const bson_t *events;
+   size_t n_events;
+   size_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (mux);
+
+   if (mongoc_change_stream_next_batch (mux->stream, &events, &n_events)) {
+      for (i = 0; i < n_events; i++) {
+         _mongoc_change_stream_mux_dispatch (mux, &events[i]);
+      }
+   }
+
+   RETURN (!mongoc_change_stream_error_document (mux->stream, error, NULL));
+}
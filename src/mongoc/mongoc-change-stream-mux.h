@@ -0,0 +1,57 @@
+/*
+ * Copyright 2017-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_CHANGE_STREAM_MUX_H
+#define MONGOC_CHANGE_STREAM_MUX_H
+
+#if !defined(MONGOC_INSIDE) && !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-macros.h"
+#include "mongoc-collection.h"
+
+BSON_BEGIN_DECLS
+
+typedef struct _mongoc_change_stream_mux_t mongoc_change_stream_mux_t;
+
+typedef void (*mongoc_change_stream_mux_cb_t) (const bson_t *event,
+                                               void *context);
+
+MONGOC_EXPORT (mongoc_change_stream_mux_t *)
+mongoc_change_stream_mux_new (const mongoc_collection_t *coll,
+                              const bson_t *pipeline,
+                              const bson_t *opts);
+MONGOC_EXPORT (void)
+mongoc_change_stream_mux_destroy (mongoc_change_stream_mux_t *mux);
+MONGOC_EXPORT (uint32_t)
+mongoc_change_stream_mux_subscribe (mongoc_change_stream_mux_t *mux,
+                                    const bson_t *filter,
+                                    mongoc_change_stream_mux_cb_t cb,
+                                    void *context,
+                                    bson_error_t *error);
+MONGOC_EXPORT (bool)
+mongoc_change_stream_mux_unsubscribe (mongoc_change_stream_mux_t *mux,
+                                      uint32_t subscriber_id);
+MONGOC_EXPORT (bool)
+mongoc_change_stream_mux_poll (mongoc_change_stream_mux_t *mux,
+                               bson_error_t *error);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_CHANGE_STREAM_MUX_H */
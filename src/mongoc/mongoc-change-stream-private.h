@@ -17,9 +17,18 @@
 #ifndef LIBMONGOC_MONGOC_CHANGE_STREAM_PRIVATE_H
 #define LIBMONGOC_MONGOC_CHANGE_STREAM_PRIVATE_H
 
+#include "mongoc-change-stream-mux.h"
+
 mongoc_change_stream_t *
 _mongoc_change_stream_new (const mongoc_collection_t *coll,
                            const bson_t *pipeline,
                            const bson_t *opts);
 
+bool
+_mongoc_change_stream_error_is_resumable (const bson_error_t *error);
+
+void
+_mongoc_change_stream_mux_dispatch (mongoc_change_stream_mux_t *mux,
+                                    const bson_t *event);
+
 #endif /* LIBMONGOC_MONGOC_CHANGE_STREAM_PRIVATE_H */
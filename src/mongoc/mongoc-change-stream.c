@@ -15,37 +15,412 @@
  */
 
 #include "mongoc-change-stream.h"
+#include "mongoc-change-stream-private.h"
+#include "mongoc-array-private.h"
 #include "mongoc-collection.h"
+#include "mongoc-cursor-private.h"
+#include "mongoc-error.h"
+#include "mongoc-trace-private.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "change-stream"
+
 
 struct _mongoc_change_stream_t {
-   int dummy;
+   mongoc_collection_t *coll;
+   bson_t pipeline;      /* the application's stages, after $changeStream */
+   bson_t full_document; /* {fullDocument: ...} */
+   bson_t opts;          /* for the aggregate, like batchSize */
+   bool has_resume_token;
+   bson_t resume_token;
+   mongoc_cursor_t *cursor;
+   bson_error_t err;
+   bson_t err_doc;
+   mongoc_array_t batch; /* bson_t views of mongoc_change_stream_next_batch */
 };
 
+
+static void
+_mongoc_change_stream_make_cursor (mongoc_change_stream_t *stream)
+{
+   bson_t pipeline;
+   bson_t stages;
+   bson_t stage;
+   bson_t change_stream;
+   bson_iter_t iter;
+   const char *key;
+   char buf[16];
+   uint32_t i;
+
+   bson_init (&pipeline);
+   BSON_APPEND_ARRAY_BEGIN (&pipeline, "pipeline", &stages);
+   BSON_APPEND_DOCUMENT_BEGIN (&stages, "0", &stage);
+   BSON_APPEND_DOCUMENT_BEGIN (&stage, "$changeStream", &change_stream);
+   bson_concat (&change_stream, &stream->full_document);
+   if (stream->has_resume_token) {
+      BSON_APPEND_DOCUMENT (
+         &change_stream, "resumeAfter", &stream->resume_token);
+   }
+   bson_append_document_end (&stage, &change_stream);
+   bson_append_document_end (&stages, &stage);
+
+   bson_iter_init (&iter, &stream->pipeline);
+   for (i = 1; bson_iter_next (&iter); i++) {
+      bson_uint32_to_string (i, &key, buf, sizeof buf);
+      bson_append_iter (&stages, key, -1, &iter);
+   }
+
+   bson_append_array_end (&pipeline, &stages);
+
+   /* the getMores wait up to maxAwaitTimeMS for events */
+   stream->cursor = mongoc_collection_aggregate (
+      stream->coll,
+      MONGOC_QUERY_TAILABLE_CURSOR | MONGOC_QUERY_AWAIT_DATA,
+      &pipeline,
+      &stream->opts,
+      NULL /* read prefs */);
+
+   bson_destroy (&pipeline);
+}
+
+
+mongoc_change_stream_t *
+_mongoc_change_stream_new (const mongoc_collection_t *coll,
+                           const bson_t *pipeline,
+                           const bson_t *opts)
+{
+   mongoc_change_stream_t *stream;
+   bson_iter_t iter;
+   bson_iter_t child;
+   const uint8_t *data;
+   uint32_t len;
+   bson_t resume_token;
+   const char *key;
+   char buf[16];
+   uint32_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (coll);
+
+   stream = (mongoc_change_stream_t *) bson_malloc0 (sizeof *stream);
+   stream->coll = mongoc_collection_copy ((mongoc_collection_t *) coll);
+   bson_init (&stream->pipeline);
+   bson_init (&stream->full_document);
+   bson_init (&stream->opts);
+   bson_init (&stream->resume_token);
+   bson_init (&stream->err_doc);
+   _mongoc_array_init (&stream->batch, sizeof (bson_t));
+
+   /* like mongoc_collection_aggregate, accept [...] or {pipeline: [...]} */
+   if (pipeline) {
+      if (bson_iter_init_find (&iter, pipeline, "pipeline") &&
+          BSON_ITER_HOLDS_ARRAY (&iter)) {
+         bson_iter_recurse (&iter, &child);
+      } else {
+         bson_iter_init (&child, pipeline);
+      }
+
+      for (i = 0; bson_iter_next (&child); i++) {
+         bson_uint32_to_string (i, &key, buf, sizeof buf);
+         bson_append_iter (&stream->pipeline, key, -1, &child);
+      }
+   }
+
+   if (opts && bson_iter_init (&iter, opts)) {
+      while (bson_iter_next (&iter)) {
+         if (BSON_ITER_IS_KEY (&iter, "fullDocument")) {
+            if (!BSON_ITER_HOLDS_UTF8 (&iter)) {
+               bson_set_error (&stream->err,
+                               MONGOC_ERROR_COMMAND,
+                               MONGOC_ERROR_COMMAND_INVALID_ARG,
+                               "fullDocument must be a string");
+               RETURN (stream);
+            }
+
+            bson_append_iter (&stream->full_document, NULL, 0, &iter);
+         } else if (BSON_ITER_IS_KEY (&iter, "resumeAfter")) {
+            if (!BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+               bson_set_error (&stream->err,
+                               MONGOC_ERROR_COMMAND,
+                               MONGOC_ERROR_COMMAND_INVALID_ARG,
+                               "resumeAfter must be a document");
+               RETURN (stream);
+            }
+
+            bson_iter_document (&iter, &len, &data);
+            BSON_ASSERT (bson_init_static (&resume_token, data, len));
+            bson_destroy (&stream->resume_token);
+            bson_copy_to (&resume_token, &stream->resume_token);
+            stream->has_resume_token = true;
+         } else {
+            /* batchSize, maxAwaitTimeMS, collation, etc. */
+            bson_append_iter (&stream->opts, NULL, 0, &iter);
+         }
+      }
+   }
+
+   if (bson_empty (&stream->full_document)) {
+      BSON_APPEND_UTF8 (&stream->full_document, "fullDocument", "default");
+   }
+
+   /* the aggregate is sent with the first mongoc_change_stream_next */
+   RETURN (stream);
+}
+
+
+/* errors after which the Change Streams Spec resumes: network errors,
+ * "not master" errors, and a cursor the server has killed */
+bool
+_mongoc_change_stream_error_is_resumable (const bson_error_t *error)
+{
+   if (error->domain == MONGOC_ERROR_STREAM) {
+      return true;
+   }
+
+   if (error->domain != MONGOC_ERROR_QUERY &&
+       error->domain != MONGOC_ERROR_SERVER) {
+      return false;
+   }
+
+   switch (error->code) {
+   case 43:    /* CursorNotFound */
+   case 91:    /* ShutdownInProgress */
+   case 189:   /* PrimarySteppedDown */
+   case 10107: /* NotMaster */
+   case 11600: /* InterruptedAtShutdown */
+   case 11602: /* InterruptedDueToReplStateChange */
+   case 13435: /* NotMasterNoSlaveOk */
+   case 13436: /* NotMasterOrSecondary */
+      return true;
+   default:
+      return false;
+   }
+}
+
+
+/* after the cursor returns no event: if it failed with a resumable error,
+ * replace it with one that resumes after the last event returned */
+static bool
+_mongoc_change_stream_resume (mongoc_change_stream_t *stream)
+{
+   bson_error_t error;
+
+   if (!mongoc_cursor_error (stream->cursor, &error) ||
+       !_mongoc_change_stream_error_is_resumable (&error)) {
+      return false;
+   }
+
+   TRACE ("resuming after error: %s", error.message);
+   mongoc_cursor_destroy (stream->cursor);
+   _mongoc_change_stream_make_cursor (stream);
+
+   return true;
+}
+
+
+/* save @event's _id to resume after it */
+static bool
+_mongoc_change_stream_save_resume_token (mongoc_change_stream_t *stream,
+                                         const bson_t *event)
+{
+   bson_iter_t iter;
+   const uint8_t *data;
+   uint32_t len;
+   bson_t resume_token;
+
+   if (!bson_iter_init_find (&iter, event, "_id") ||
+       !BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_set_error (&stream->err,
+                      MONGOC_ERROR_CURSOR,
+                      MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                      "Cannot provide resume functionality when the resume "
+                      "token is missing");
+      return false;
+   }
+
+   bson_iter_document (&iter, &len, &data);
+   BSON_ASSERT (bson_init_static (&resume_token, data, len));
+   bson_destroy (&stream->resume_token);
+   bson_copy_to (&resume_token, &stream->resume_token);
+   stream->has_resume_token = true;
+
+   return true;
+}
+
+
 bool
 mongoc_change_stream_next (mongoc_change_stream_t *stream, const bson_t **bson)
 {
-   return false;
+   bool resumed = false;
+
+   ENTRY;
+
+   BSON_ASSERT (stream);
+   BSON_ASSERT (bson);
+
+   *bson = NULL;
+
+   if (stream->err.code) {
+      RETURN (false);
+   }
+
+   if (!stream->cursor) {
+      _mongoc_change_stream_make_cursor (stream);
+   }
+
+   while (!mongoc_cursor_next (stream->cursor, bson)) {
+      if (resumed || !_mongoc_change_stream_resume (stream)) {
+         RETURN (false);
+      }
+
+      resumed = true;
+   }
+
+   if (!_mongoc_change_stream_save_resume_token (stream, *bson)) {
+      *bson = NULL;
+      RETURN (false);
+   }
+
+   RETURN (true);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_change_stream_next_batch --
+ *
+ *       Return all the events of the next server reply at once, as views
+ *       of the reply with mongoc_cursor_next_batch. Only the last event's
+ *       resume token is saved.
+ *
+ * Returns:
+ *       true and sets @events to an array of @n_events, valid until the
+ *       next call. false if no events arrived before maxAwaitTimeMS or
+ *       on error.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_change_stream_next_batch (mongoc_change_stream_t *stream,
+                                 const bson_t **events,
+                                 size_t *n_events)
+{
+   const uint8_t *data;
+   size_t data_len;
+   const uint32_t *offsets;
+   uint32_t n_docs;
+   int32_t doc_len;
+   bson_t view;
+   bson_t *views;
+   bool resumed = false;
+   uint32_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (stream);
+   BSON_ASSERT (events);
+   BSON_ASSERT (n_events);
+
+   *events = NULL;
+   *n_events = 0;
+
+   if (stream->err.code) {
+      RETURN (false);
+   }
+
+   if (!stream->cursor) {
+      _mongoc_change_stream_make_cursor (stream);
+   }
+
+   while (!mongoc_cursor_next_batch (
+      stream->cursor, &data, &data_len, &offsets, &n_docs)) {
+      if (resumed || !_mongoc_change_stream_resume (stream)) {
+         RETURN (false);
+      }
+
+      resumed = true;
+   }
+
+   /* size the array first: a static bson_t points into itself, so the
+    * views must not move once initialized */
+   _mongoc_array_clear (&stream->batch);
+   memset (&view, 0, sizeof view);
+   for (i = 0; i < n_docs; i++) {
+      _mongoc_array_append_val (&stream->batch, view);
+   }
+
+   views = (bson_t *) stream->batch.data;
+   for (i = 0; i < n_docs; i++) {
+      /* documents in a reply are valid BSON, read each one's length */
+      memcpy (&doc_len, data + offsets[i], sizeof doc_len);
+      BSON_ASSERT (bson_init_static (&views[i],
+                                     data + offsets[i],
+                                     (size_t) BSON_UINT32_FROM_LE (doc_len)));
+   }
+
+   if (!_mongoc_change_stream_save_resume_token (stream,
+                                                 &views[n_docs - 1])) {
+      RETURN (false);
+   }
+
+   *events = views;
+   *n_events = n_docs;
+
+   RETURN (true);
 }
 
+
 bool
 mongoc_change_stream_error_document (const mongoc_change_stream_t *stream,
                                      bson_error_t *err,
                                      const bson_t **err_doc)
 {
-   return false;
+   BSON_ASSERT (stream);
+
+   if (stream->err.code) {
+      if (err) {
+         memcpy (err, &stream->err, sizeof *err);
+      }
+
+      if (err_doc) {
+         *err_doc = &stream->err_doc;
+      }
+
+      return true;
+   }
+
+   if (!stream->cursor) {
+      if (err_doc) {
+         *err_doc = NULL;
+      }
+
+      return false;
+   }
+
+   return mongoc_cursor_error_document (stream->cursor, err, err_doc);
 }
 
+
 void
 mongoc_change_stream_destroy (mongoc_change_stream_t *stream)
 {
+   if (!stream) {
+      return;
+   }
+
+   if (stream->cursor) {
+      mongoc_cursor_destroy (stream->cursor);
+   }
+
+   _mongoc_array_destroy (&stream->batch);
+   bson_destroy (&stream->err_doc);
+   bson_destroy (&stream->resume_token);
+   bson_destroy (&stream->opts);
+   bson_destroy (&stream->full_document);
+   bson_destroy (&stream->pipeline);
+   mongoc_collection_destroy (stream->coll);
    bson_free (stream);
 }
-
-mongoc_change_stream_t *
-_mongoc_change_stream_new (const mongoc_collection_t *coll,
-                           const bson_t *pipeline,
-                           const bson_t *opts)
-{
-   return (mongoc_change_stream_t *) bson_malloc (
-      sizeof (mongoc_change_stream_t));
-}
\ No newline at end of file
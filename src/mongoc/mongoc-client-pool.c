@@ -18,6 +18,8 @@
 #include "mongoc.h"
 #include "mongoc-apm-private.h"
 #include "mongoc-counters-private.h"
+#include "mongoc-dns-private.h"
+#include "mongoc-memory-budget-private.h"
 #include "mongoc-client-pool-private.h"
 #include "mongoc-client-pool.h"
 #include "mongoc-client-private.h"
@@ -25,25 +27,73 @@
 #include "mongoc-thread-private.h"
 #include "mongoc-topology-private.h"
 #include "mongoc-trace-private.h"
+#include "mongoc-write-coalescer-private.h"
 
 #ifdef MONGOC_ENABLE_SSL
 #include "mongoc-ssl-private.h"
 #endif
 
+#define MONGOC_CLIENT_POOL_MAX_SHARDS 16
+#define MONGOC_CLIENT_POOL_CACHELINE 64
+
+#if defined(ENABLE_RDTSCP) || defined(HAVE_SCHED_GETCPU)
+#define MONGOC_CLIENT_POOL_CPU_SHARDS
+#endif
+
+/* idle clients are kept in several LIFO shards, each with its own lock. a
+ * thread pops and pushes its "home" shard, and only takes pool->mutex to
+ * steal from other shards, create a client, or wait for one. the padding
+ * keeps neighboring shards' locks off each other's cache lines. */
+typedef struct {
+   mongoc_mutex_t mutex;
+   mongoc_queue_t queue;
+   uint8_t padding[MONGOC_CLIENT_POOL_CACHELINE];
+} mongoc_client_pool_shard_t;
+
 struct _mongoc_client_pool_t {
    mongoc_mutex_t mutex;
    mongoc_cond_t cond;
-   mongoc_queue_t queue;
+   /* high-priority pops wait here, and are woken before those on cond */
+   mongoc_cond_t cond_high;
+   mongoc_client_pool_shard_t *shards;
+   uint32_t n_shards;
+   uint32_t n_cpus;
+   volatile int32_t n_idle;
+   volatile int32_t n_waiters;
+   volatile int32_t n_waiters_high;
    mongoc_topology_t *topology;
    mongoc_uri_t *uri;
    uint32_t min_pool_size;
    uint32_t max_pool_size;
    uint32_t size;
+   /* reservedPoolSize: capacity only high-priority pops may use */
+   uint32_t reserved_pool_size;
+   int32_t wait_queue_timeout_msec;
+   int32_t wait_queue_multiple;
+   uint32_t n_blocked;
+   /* for mongoc_client_pool_get_stats, which reads them without the mutex.
+    * the maximums are only written with the mutex held */
+   volatile int64_t n_created;
+   volatile int64_t n_destroyed;
+   volatile int64_t n_waits;
+   volatile int64_t wait_usec;
+   volatile int64_t max_wait_usec;
+   volatile int32_t peak_blocked;
+   mongoc_cluster_shared_t *shared;
+   /* standbyConnections: how many to keep to each electable secondary, in
+    * shared if set, otherwise in standby for clients to take over */
+   int32_t standby_connections;
+   mongoc_cluster_shared_t *standby;
+   mongoc_write_coalescer_t *coalescer;
+   mongoc_memory_budget_t *budget; /* memoryBudgetMB, or NULL */
+   uint32_t maxidletimems;
 #ifdef MONGOC_ENABLE_SSL
    bool ssl_opts_set;
    mongoc_ssl_opt_t ssl_opts;
 #endif
    bool apm_callbacks_set;
+   /* the topology's SDAM callbacks are ours, see shareTopology */
+   bool topology_callbacks_set;
    mongoc_apm_callbacks_t apm_callbacks;
    void *apm_context;
    int32_t error_api_version;
@@ -51,6 +101,131 @@ struct _mongoc_client_pool_t {
 };
 
 
+/* per-thread shard hint, 1-based so that zero means "not yet assigned" */
+static MONGOC_THREAD_LOCAL uint32_t gHomeShard;
+static volatile int32_t gNextHomeShard;
+
+
+/* the shard for the CPU the thread runs on, if we can tell: each shard
+ * serves a range of adjacent CPU numbers, which usually share a socket,
+ * so clients stay on the NUMA node that last used them. otherwise each
+ * thread is assigned a shard round-robin. */
+static mongoc_client_pool_shard_t *
+_mongoc_client_pool_home_shard (mongoc_client_pool_t *pool)
+{
+#ifdef MONGOC_CLIENT_POOL_CPU_SHARDS
+   int cpu;
+
+   cpu = (int) _mongoc_sched_getcpu ();
+   if (cpu >= 0) {
+      return &pool->shards[((uint32_t) cpu % pool->n_cpus) * pool->n_shards /
+                           pool->n_cpus];
+   }
+#endif
+
+   if (!gHomeShard) {
+      gHomeShard =
+         (uint32_t) bson_atomic_int_add (&gNextHomeShard, 1) & 0x7fffffff;
+      if (!gHomeShard) {
+         gHomeShard = 1;
+      }
+   }
+
+   return &pool->shards[(gHomeShard - 1) % pool->n_shards];
+}
+
+
+static mongoc_client_t *
+_mongoc_client_pool_shard_pop (mongoc_client_pool_t *pool,
+                               mongoc_client_pool_shard_t *shard)
+{
+   mongoc_client_t *client;
+
+   mongoc_mutex_lock (&shard->mutex);
+   client = (mongoc_client_t *) _mongoc_queue_pop_head (&shard->queue);
+   mongoc_mutex_unlock (&shard->mutex);
+
+   if (client) {
+      bson_atomic_int_add (&pool->n_idle, -1);
+   }
+
+   return client;
+}
+
+
+/* pop from any shard but @skip, starting with the one after @skip */
+static mongoc_client_t *
+_mongoc_client_pool_steal (mongoc_client_pool_t *pool,
+                           mongoc_client_pool_shard_t *skip)
+{
+   mongoc_client_t *client;
+   uint32_t start;
+   uint32_t i;
+
+   start = skip ? (uint32_t) (skip - pool->shards) + 1 : 0;
+
+   for (i = 0; i < pool->n_shards; i++) {
+      mongoc_client_pool_shard_t *shard;
+
+      shard = &pool->shards[(start + i) % pool->n_shards];
+      if (shard == skip) {
+         continue;
+      }
+
+      client = _mongoc_client_pool_shard_pop (pool, shard);
+      if (client) {
+         return client;
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ * Topology maintenance callback: take the connections that idle clients
+ * have not used for maxIdleTimeMS into @reaped, for the background thread
+ * to close once it releases the topology mutex, and replace standby
+ * connections. Runs with the topology mutex held; clients in the shards
+ * aren't checked out, so holding each shard's lock is enough to own their
+ * clusters.
+ */
+static void
+_mongoc_client_pool_reap_idle (void *ctx, mongoc_array_t *reaped)
+{
+   mongoc_client_pool_t *pool = (mongoc_client_pool_t *) ctx;
+   mongoc_client_pool_shard_t *shard;
+   int64_t now;
+   uint32_t i;
+   uint32_t j;
+
+   now = bson_get_monotonic_time ();
+
+   for (i = 0; i < pool->n_shards; i++) {
+      shard = &pool->shards[i];
+
+      mongoc_mutex_lock (&shard->mutex);
+      for (j = 0; j < _mongoc_queue_get_length (&shard->queue); j++) {
+         _mongoc_cluster_reap_idle_nodes (
+            &((mongoc_client_t *) _mongoc_queue_get (&shard->queue, j))
+                ->cluster,
+            now,
+            reaped);
+      }
+      mongoc_mutex_unlock (&shard->mutex);
+   }
+
+   _mongoc_cluster_shared_reap_idle (
+      pool->shared, now, pool->maxidletimems, reaped);
+   _mongoc_cluster_shared_reap_idle (
+      pool->standby, now, pool->maxidletimems, reaped);
+
+   _mongoc_cluster_shared_top_up (pool->shared ? pool->shared : pool->standby,
+                                  &pool->topology->description,
+                                  pool->standby_connections);
+}
+
+
 #ifdef MONGOC_ENABLE_SSL
 void
 mongoc_client_pool_set_ssl_opts (mongoc_client_pool_t *pool,
@@ -70,14 +245,21 @@ mongoc_client_pool_set_ssl_opts (mongoc_client_pool_t *pool,
       pool->ssl_opts_set = true;
    }
 
-   mongoc_topology_scanner_set_ssl_opts (pool->topology->scanner,
-                                         &pool->ssl_opts);
+   /* a shared topology monitors with its URI's TLS options */
+   if (!pool->topology->registry_key) {
+      mongoc_topology_scanner_set_ssl_opts (pool->topology->scanner,
+                                            &pool->ssl_opts);
+   }
 
    mongoc_mutex_unlock (&pool->mutex);
 }
 #endif
 
 
+static mongoc_client_t *
+_mongoc_client_pool_establisher_client (void *ctx);
+
+
 mongoc_client_pool_t *
 mongoc_client_pool_new (const mongoc_uri_t *uri)
 {
@@ -86,6 +268,9 @@ mongoc_client_pool_new (const mongoc_uri_t *uri)
    const bson_t *b;
    bson_iter_t iter;
    const char *appname;
+   int32_t n_shards;
+   int32_t budget_mb;
+   uint32_t i;
 
 
    ENTRY;
@@ -102,13 +287,35 @@ mongoc_client_pool_new (const mongoc_uri_t *uri)
 
    pool = (mongoc_client_pool_t *) bson_malloc0 (sizeof *pool);
    mongoc_mutex_init (&pool->mutex);
-   _mongoc_queue_init (&pool->queue);
+   mongoc_cond_init (&pool->cond);
+   mongoc_cond_init (&pool->cond_high);
    pool->uri = mongoc_uri_copy (uri);
+
+   /* poolShards: e.g. the number of NUMA nodes, at most one per CPU */
+   pool->n_cpus = BSON_MAX (1, _mongoc_get_cpu_count ());
+   n_shards =
+      mongoc_uri_get_option_as_int32 (pool->uri, MONGOC_URI_POOLSHARDS, 0);
+   if (n_shards > 0) {
+      pool->n_shards = BSON_MIN ((uint32_t) n_shards, pool->n_cpus);
+   } else {
+      pool->n_shards = BSON_MIN (pool->n_cpus, MONGOC_CLIENT_POOL_MAX_SHARDS);
+   }
+   pool->shards = (mongoc_client_pool_shard_t *) bson_malloc0 (
+      pool->n_shards * sizeof (mongoc_client_pool_shard_t));
+   for (i = 0; i < pool->n_shards; i++) {
+      mongoc_mutex_init (&pool->shards[i].mutex);
+      _mongoc_queue_init (&pool->shards[i].queue);
+   }
    pool->min_pool_size = 0;
    pool->max_pool_size = 100;
    pool->size = 0;
 
-   topology = mongoc_topology_new (uri, false);
+   if (mongoc_uri_get_option_as_bool (uri, MONGOC_URI_SHARETOPOLOGY, false)) {
+      topology = _mongoc_topology_registry_acquire (uri);
+   } else {
+      topology = mongoc_topology_new (uri, false);
+   }
+
    pool->topology = topology;
    pool->error_api_version = MONGOC_ERROR_API_VERSION_LEGACY;
 
@@ -126,9 +333,73 @@ mongoc_client_pool_new (const mongoc_uri_t *uri)
       }
    }
 
+   pool->reserved_pool_size = (uint32_t) BSON_MAX (
+      0,
+      mongoc_uri_get_option_as_int32 (
+         pool->uri, MONGOC_URI_RESERVEDPOOLSIZE, 0));
+
+   pool->wait_queue_timeout_msec = BSON_MAX (
+      0,
+      mongoc_uri_get_option_as_int32 (
+         pool->uri, MONGOC_URI_WAITQUEUETIMEOUTMS, 0));
+   pool->wait_queue_multiple = BSON_MAX (
+      0,
+      mongoc_uri_get_option_as_int32 (
+         pool->uri, MONGOC_URI_WAITQUEUEMULTIPLE, 0));
+
+   budget_mb =
+      mongoc_uri_get_option_as_int32 (pool->uri, MONGOC_URI_MEMORYBUDGETMB, 0);
+   if (budget_mb > 0) {
+      pool->budget =
+         _mongoc_memory_budget_new ((int64_t) budget_mb * 1024 * 1024);
+   }
+
+   if (mongoc_uri_get_option_as_bool (
+          pool->uri, MONGOC_URI_SHAREDCONNECTIONS, false)) {
+      pool->shared = _mongoc_cluster_shared_new (
+         mongoc_uri_get_option_as_int32 (
+            pool->uri, MONGOC_URI_MAXCONNECTING, 2),
+         _mongoc_client_pool_establisher_client,
+         pool);
+   }
+
+   pool->standby_connections = BSON_MAX (
+      0,
+      mongoc_uri_get_option_as_int32 (
+         pool->uri, MONGOC_URI_STANDBYCONNECTIONS, 0));
+   if (pool->standby_connections && !pool->shared) {
+      pool->standby = _mongoc_cluster_shared_new (
+         mongoc_uri_get_option_as_int32 (
+            pool->uri, MONGOC_URI_MAXCONNECTING, 2),
+         _mongoc_client_pool_establisher_client,
+         pool);
+   }
+
+   if (mongoc_uri_get_option_as_int32 (
+          pool->uri, MONGOC_URI_COALESCEINSERTSMS, 0) > 0) {
+      pool->coalescer = _mongoc_write_coalescer_new (
+         mongoc_uri_get_option_as_int32 (
+            pool->uri, MONGOC_URI_COALESCEINSERTSMS, 0),
+         (uint32_t) mongoc_uri_get_option_as_int32 (
+            pool->uri,
+            MONGOC_URI_COALESCEINSERTSMAX,
+            MONGOC_DEFAULT_WRITE_BATCH_SIZE));
+   }
+
+   pool->maxidletimems = (uint32_t) BSON_MAX (
+      0,
+      mongoc_uri_get_option_as_int32 (pool->uri, MONGOC_URI_MAXIDLETIMEMS, 0));
+
+   if (pool->maxidletimems || pool->standby_connections ||
+       mongoc_uri_get_option_as_int32 (
+          pool->uri, MONGOC_URI_MAXCONNECTIONLIFETIMEMS, 0) > 0) {
+      _mongoc_topology_set_maintenance_cb (
+         topology, _mongoc_client_pool_reap_idle, pool);
+   }
+
    appname =
       mongoc_uri_get_option_as_utf8 (pool->uri, MONGOC_URI_APPNAME, NULL);
-   if (appname) {
+   if (appname && !topology->registry_key) {
       /* the appname should have already been validated */
       BSON_ASSERT (mongoc_client_pool_set_appname (pool, appname));
    }
@@ -152,21 +423,55 @@ void
 mongoc_client_pool_destroy (mongoc_client_pool_t *pool)
 {
    mongoc_client_t *client;
+   uint32_t i;
 
    ENTRY;
 
    BSON_ASSERT (pool);
 
-   while (
-      (client = (mongoc_client_t *) _mongoc_queue_pop_head (&pool->queue))) {
-      mongoc_client_destroy (client);
+   /* waits for a running reaper, so it can't touch clients we destroy */
+   _mongoc_topology_set_maintenance_cb (pool->topology, NULL, pool);
+
+   for (i = 0; i < pool->n_shards; i++) {
+      while ((client = (mongoc_client_t *) _mongoc_queue_pop_head (
+                 &pool->shards[i].queue))) {
+         mongoc_client_destroy (client);
+      }
+
+      _mongoc_queue_destroy (&pool->shards[i].queue);
+      mongoc_mutex_destroy (&pool->shards[i].mutex);
+   }
+
+   bson_free (pool->shards);
+
+   /* after the clients, which may have returned connections to it */
+   _mongoc_cluster_shared_destroy (pool->shared);
+   _mongoc_cluster_shared_destroy (pool->standby);
+   _mongoc_write_coalescer_destroy (pool->coalescer);
+   if (pool->budget) {
+      _mongoc_memory_budget_destroy (pool->budget);
    }
 
-   mongoc_topology_destroy (pool->topology);
+   if (pool->topology->registry_key) {
+      if (pool->topology_callbacks_set) {
+         /* other pools go on using the topology, stop sending us events */
+         mongoc_apm_callbacks_t no_callbacks = {0};
+
+         mongoc_mutex_lock (&pool->topology->mutex);
+         mongoc_topology_set_apm_callbacks (
+            pool->topology, &no_callbacks, NULL);
+         mongoc_mutex_unlock (&pool->topology->mutex);
+      }
+
+      _mongoc_topology_registry_release (pool->topology);
+   } else {
+      mongoc_topology_destroy (pool->topology);
+   }
 
    mongoc_uri_destroy (pool->uri);
    mongoc_mutex_destroy (&pool->mutex);
    mongoc_cond_destroy (&pool->cond);
+   mongoc_cond_destroy (&pool->cond_high);
 
 #ifdef MONGOC_ENABLE_SSL
    _mongoc_ssl_opts_cleanup (&pool->ssl_opts);
@@ -195,46 +500,287 @@ _start_scanner_if_needed (mongoc_client_pool_t *pool)
    }
 }
 
+/*
+ * Wake a thread waiting for a client, high-priority waiters first.
+ *
+ * This function assumes the pool's mutex is locked
+ */
+static void
+_mongoc_client_pool_signal (mongoc_client_pool_t *pool)
+{
+   if (pool->n_waiters_high) {
+      mongoc_cond_signal (&pool->cond_high);
+   } else {
+      mongoc_cond_signal (&pool->cond);
+   }
+}
+
+
+/*
+ * Whether a normal-priority pop may take a client now: none are waiting
+ * with high priority, and at least reservedPoolSize clients would still be
+ * idle or creatable afterward.
+ *
+ * The lock-free fast path calls this without the pool's mutex, so with
+ * concurrent pops the reserve may briefly run a client or two short.
+ */
+static bool
+_mongoc_client_pool_normal_may_take (mongoc_client_pool_t *pool)
+{
+   uint32_t available;
+
+   if (pool->n_waiters_high) {
+      return false;
+   }
+
+   if (!pool->reserved_pool_size) {
+      return true;
+   }
+
+   available = (uint32_t) BSON_MAX (0, pool->n_idle);
+   if (pool->size < pool->max_pool_size) {
+      available += pool->max_pool_size - pool->size;
+   }
+
+   return available > pool->reserved_pool_size;
+}
+
+
+/*
+ * Block on @cond until another thread pushes a client or destroys one.
+ * @wait_start
+ * is zero on the first call, then the time the caller began waiting.
+ *
+ * Returns false and sets @error if the wait queue is full or the caller has
+ * waited longer than waitQueueTimeoutMS.
+ *
+ * This function assumes the pool's mutex is locked
+ */
+static bool
+_mongoc_client_pool_wait (mongoc_client_pool_t *pool,
+                          mongoc_cond_t *cond,
+                          int64_t *wait_start,
+                          bson_error_t *error)
+{
+   int64_t remaining_msec = 0;
+
+   if (!*wait_start) {
+      if (pool->wait_queue_multiple &&
+          pool->n_blocked >=
+             (uint32_t) pool->wait_queue_multiple * pool->max_pool_size) {
+         mongoc_counter_client_pools_wait_queue_full_inc ();
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_POOL_WAIT_QUEUE_FULL,
+                         "Too many threads are already waiting for a client,"
+                         " waitQueueMultiple is %" PRId32,
+                         pool->wait_queue_multiple);
+         return false;
+      }
+
+      *wait_start = bson_get_monotonic_time ();
+      mongoc_counter_client_pools_waits_inc ();
+   }
+
+   if (pool->wait_queue_timeout_msec) {
+      remaining_msec = pool->wait_queue_timeout_msec -
+                       (bson_get_monotonic_time () - *wait_start) / 1000;
+
+      if (remaining_msec <= 0) {
+         mongoc_counter_client_pools_wait_timeouts_inc ();
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_POOL_WAIT_TIMEOUT,
+                         "Timed out after %" PRId32
+                         "ms waiting for a client from the pool",
+                         pool->wait_queue_timeout_msec);
+         return false;
+      }
+   }
+
+   pool->n_blocked++;
+   if ((int32_t) pool->n_blocked > pool->peak_blocked) {
+      bson_atomic_int_add (&pool->peak_blocked,
+                           (int32_t) pool->n_blocked - pool->peak_blocked);
+   }
+
+   if (pool->wait_queue_timeout_msec) {
+      mongoc_cond_timedwait (cond, &pool->mutex, remaining_msec);
+   } else {
+      mongoc_cond_wait (cond, &pool->mutex);
+   }
+
+   pool->n_blocked--;
+
+   return true;
+}
+
+
 mongoc_client_t *
 mongoc_client_pool_pop (mongoc_client_pool_t *pool)
+{
+   return mongoc_client_pool_pop_with_error (pool, NULL);
+}
+
+
+/* create a client configured from the pool. pool->mutex must be held */
+static mongoc_client_t *
+_mongoc_client_pool_create_client (mongoc_client_pool_t *pool)
+{
+   mongoc_client_t *client;
+
+   client = _mongoc_client_new_from_uri (pool->uri, pool->topology);
+
+   /* for tests */
+   mongoc_client_set_stream_initiator (
+      client,
+      pool->topology->scanner->initiator,
+      pool->topology->scanner->initiator_context);
+
+   client->coalescer = pool->coalescer;
+   if (pool->budget) {
+      _mongoc_client_set_budget (client, pool->budget);
+   }
+
+   client->error_api_version = pool->error_api_version;
+   _mongoc_client_set_apm_callbacks_private (
+      client, &pool->apm_callbacks, pool->apm_context);
+#ifdef MONGOC_ENABLE_SSL
+   if (pool->ssl_opts_set) {
+      mongoc_client_set_ssl_opts (client, &pool->ssl_opts);
+   }
+#endif
+
+   return client;
+}
+
+
+/* create a client, configured like the others. pool->mutex must be held */
+static mongoc_client_t *
+_mongoc_client_pool_new_client (mongoc_client_pool_t *pool)
 {
    mongoc_client_t *client;
 
+   client = _mongoc_client_pool_create_client (pool);
+   client->cluster.shared = pool->shared;
+   client->cluster.standby = pool->standby;
+   pool->size++;
+   bson_atomic_int64_add (&pool->n_created, 1);
+
+   return client;
+}
+
+
+/* the client that pool->shared's or pool->standby's establishers connect
+ * with. it isn't counted in the pool's size, and connects to servers
+ * directly */
+static mongoc_client_t *
+_mongoc_client_pool_establisher_client (void *ctx)
+{
+   mongoc_client_pool_t *pool = (mongoc_client_pool_t *) ctx;
+   mongoc_client_t *client;
+
+   mongoc_mutex_lock (&pool->mutex);
+   client = _mongoc_client_pool_create_client (pool);
+   mongoc_mutex_unlock (&pool->mutex);
+
+   return client;
+}
+
+
+mongoc_client_t *
+mongoc_client_pool_pop_with_error (mongoc_client_pool_t *pool,
+                                   bson_error_t *error)
+{
+   return mongoc_client_pool_pop_with_priority (
+      pool, MONGOC_CLIENT_POOL_PRIORITY_NORMAL, error);
+}
+
+
+mongoc_client_t *
+mongoc_client_pool_pop_with_priority (mongoc_client_pool_t *pool,
+                                      mongoc_client_pool_priority_t priority,
+                                      bson_error_t *error)
+{
+   mongoc_client_pool_shard_t *home;
+   mongoc_client_t *client = NULL;
+   bool high;
+   int64_t started = bson_get_monotonic_time ();
+   int64_t wait_start = 0;
+   int64_t waited = 0;
+
    ENTRY;
 
    BSON_ASSERT (pool);
 
+   high = priority == MONGOC_CLIENT_POOL_PRIORITY_HIGH;
+
+   /* fast path: the scanner was started when this client was created */
+   home = _mongoc_client_pool_home_shard (pool);
+   if ((high || _mongoc_client_pool_normal_may_take (pool)) &&
+       (client = _mongoc_client_pool_shard_pop (pool, home))) {
+      mongoc_counter_client_pools_checkout_fast_inc ();
+      mongoc_histogram_client_pool_checkout_record_since (started);
+      _mongoc_cluster_span_client_checkout (&client->cluster, started);
+      RETURN (client);
+   }
+
+   mongoc_counter_client_pools_checkout_slow_inc ();
+
    mongoc_mutex_lock (&pool->mutex);
 
+   /* announce ourselves before rescanning, so a concurrent push either
+    * lands where we look or sees n_waiters and signals us */
+   bson_atomic_int_add (&pool->n_waiters, 1);
+   if (high) {
+      bson_atomic_int_add (&pool->n_waiters_high, 1);
+   }
+
 again:
-   if (!(client = (mongoc_client_t *) _mongoc_queue_pop_head (&pool->queue))) {
-      if (pool->size < pool->max_pool_size) {
-         client = _mongoc_client_new_from_uri (pool->uri, pool->topology);
+   if (high || _mongoc_client_pool_normal_may_take (pool)) {
+      client = _mongoc_client_pool_steal (pool, NULL);
+      if (!client && pool->size < pool->max_pool_size) {
+         client = _mongoc_client_pool_new_client (pool);
+      }
+   }
 
-         /* for tests */
-         mongoc_client_set_stream_initiator (
-            client,
-            pool->topology->scanner->initiator,
-            pool->topology->scanner->initiator_context);
+   if (!client &&
+       _mongoc_client_pool_wait (
+          pool, high ? &pool->cond_high : &pool->cond, &wait_start, error)) {
+      GOTO (again);
+   }
 
-         client->error_api_version = pool->error_api_version;
-         _mongoc_client_set_apm_callbacks_private (
-            client, &pool->apm_callbacks, pool->apm_context);
-#ifdef MONGOC_ENABLE_SSL
-         if (pool->ssl_opts_set) {
-            mongoc_client_set_ssl_opts (client, &pool->ssl_opts);
-         }
-#endif
-         pool->size++;
-      } else {
-         mongoc_cond_wait (&pool->cond, &pool->mutex);
-         GOTO (again);
+   bson_atomic_int_add (&pool->n_waiters, -1);
+   if (high && !bson_atomic_int_add (&pool->n_waiters_high, -1) &&
+       pool->n_blocked) {
+      /* normal-priority waiters may go ahead now */
+      mongoc_cond_signal (&pool->cond);
+   }
+
+   if (wait_start) {
+      waited = bson_get_monotonic_time () - wait_start;
+      bson_atomic_int64_add (&pool->n_waits, 1);
+      bson_atomic_int64_add (&pool->wait_usec, waited);
+      if (waited > pool->max_wait_usec) {
+         bson_atomic_int64_add (&pool->max_wait_usec,
+                                waited - pool->max_wait_usec);
       }
    }
 
-   _start_scanner_if_needed (pool);
+   if (client) {
+      _start_scanner_if_needed (pool);
+   }
    mongoc_mutex_unlock (&pool->mutex);
 
+   if (wait_start) {
+      mongoc_counter_client_pools_wait_msec_add (waited / 1000);
+   }
+
+   if (client) {
+      mongoc_histogram_client_pool_checkout_record_since (started);
+      _mongoc_cluster_span_client_checkout (&client->cluster, started);
+   }
+
    RETURN (client);
 }
 
@@ -242,23 +788,33 @@ again:
 mongoc_client_t *
 mongoc_client_pool_try_pop (mongoc_client_pool_t *pool)
 {
+   mongoc_client_pool_shard_t *home;
    mongoc_client_t *client;
 
    ENTRY;
 
    BSON_ASSERT (pool);
 
+   /* try_pop has normal priority, and doesn't use the reserve */
+   if (!_mongoc_client_pool_normal_may_take (pool)) {
+      RETURN (NULL);
+   }
+
+   home = _mongoc_client_pool_home_shard (pool);
+   if ((client = _mongoc_client_pool_shard_pop (pool, home))) {
+      mongoc_counter_client_pools_checkout_fast_inc ();
+      RETURN (client);
+   }
+
+   mongoc_counter_client_pools_checkout_slow_inc ();
+
    mongoc_mutex_lock (&pool->mutex);
 
-   if (!(client = (mongoc_client_t *) _mongoc_queue_pop_head (&pool->queue))) {
+   if (!_mongoc_client_pool_normal_may_take (pool)) {
+      client = NULL;
+   } else if (!(client = _mongoc_client_pool_steal (pool, home))) {
       if (pool->size < pool->max_pool_size) {
-         client = _mongoc_client_new_from_uri (pool->uri, pool->topology);
-#ifdef MONGOC_ENABLE_SSL
-         if (pool->ssl_opts_set) {
-            mongoc_client_set_ssl_opts (client, &pool->ssl_opts);
-         }
-#endif
-         pool->size++;
+         client = _mongoc_client_pool_new_client (pool);
       }
    }
 
@@ -271,33 +827,226 @@ mongoc_client_pool_try_pop (mongoc_client_pool_t *pool)
 }
 
 
+bool
+mongoc_client_pool_warm (mongoc_client_pool_t *pool, bson_error_t *error)
+{
+   mongoc_topology_t *topology;
+   mongoc_client_t **clients;
+   mongoc_cluster_t **clusters;
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_server_description_t *sd;
+   mongoc_set_t *servers;
+   uint32_t *server_ids = NULL;
+   uint32_t min_pool_size;
+   uint32_t id;
+   size_t n_clients = 0;
+   size_t n_server_ids = 0;
+   size_t i;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (pool);
+
+   topology = pool->topology;
+
+   mongoc_mutex_lock (&pool->mutex);
+   min_pool_size = pool->min_pool_size;
+   mongoc_mutex_unlock (&pool->mutex);
+
+   if (!min_pool_size) {
+      RETURN (true);
+   }
+
+   clients = (mongoc_client_t **) bson_malloc0 (min_pool_size *
+                                                sizeof (mongoc_client_t *));
+   clusters = (mongoc_cluster_t **) bson_malloc0 (min_pool_size *
+                                                  sizeof (mongoc_cluster_t *));
+
+   /* check out at most minPoolSize clients without blocking */
+   while (n_clients < min_pool_size &&
+          (clients[n_clients] = mongoc_client_pool_try_pop (pool))) {
+      clusters[n_clients] = &clients[n_clients]->cluster;
+      n_clients++;
+   }
+
+   /* wait for the first scan, so the topology knows the servers */
+   read_prefs = mongoc_read_prefs_new (MONGOC_READ_NEAREST);
+   sd = mongoc_topology_select (topology, MONGOC_SS_READ, read_prefs, error);
+   mongoc_read_prefs_destroy (read_prefs);
+
+   if (!sd) {
+      GOTO (done);
+   }
+
+   mongoc_server_description_destroy (sd);
+
+   mongoc_mutex_lock (&topology->mutex);
+   servers = topology->description.servers;
+   server_ids = (uint32_t *) bson_malloc0 (
+      BSON_MAX (servers->items_len, 1) * sizeof (uint32_t));
+
+   for (i = 0; i < servers->items_len; i++) {
+      sd = (mongoc_server_description_t *) mongoc_set_get_item_and_id (
+         servers, (int) i, &id);
+
+      switch (sd->type) {
+      case MONGOC_SERVER_STANDALONE:
+      case MONGOC_SERVER_MONGOS:
+      case MONGOC_SERVER_RS_PRIMARY:
+      case MONGOC_SERVER_RS_SECONDARY:
+         server_ids[n_server_ids++] = id;
+         break;
+      default:
+         break;
+      }
+   }
+
+   mongoc_mutex_unlock (&topology->mutex);
+
+   ret = _mongoc_cluster_warm (
+      clusters, n_clients, server_ids, n_server_ids, error);
+
+done:
+   for (i = 0; i < n_clients; i++) {
+      mongoc_client_pool_push (pool, clients[i]);
+   }
+
+   bson_free (server_ids);
+   bson_free (clusters);
+   bson_free (clients);
+
+   RETURN (ret);
+}
+
+
 void
 mongoc_client_pool_push (mongoc_client_pool_t *pool, mongoc_client_t *client)
 {
+   mongoc_client_pool_shard_t *home;
+   mongoc_client_t *old_client = NULL;
+   uint32_t min_pool_size;
+   int32_t n_idle;
+
    ENTRY;
 
    BSON_ASSERT (pool);
    BSON_ASSERT (client);
 
-   mongoc_mutex_lock (&pool->mutex);
-   _mongoc_queue_push_head (&pool->queue, client);
+   /* a racy read is fine, min_pool_size is only a trimming threshold */
+   min_pool_size = pool->min_pool_size;
+   home = _mongoc_client_pool_home_shard (pool);
 
-   if (pool->min_pool_size &&
-       _mongoc_queue_get_length (&pool->queue) > pool->min_pool_size) {
-      mongoc_client_t *old_client;
-      old_client = (mongoc_client_t *) _mongoc_queue_pop_tail (&pool->queue);
+   mongoc_mutex_lock (&home->mutex);
+   _mongoc_queue_push_head (&home->queue, client);
+   n_idle = bson_atomic_int_add (&pool->n_idle, 1);
+
+   if (min_pool_size && (uint32_t) n_idle > min_pool_size) {
+      /* the oldest client in this shard */
+      old_client = (mongoc_client_t *) _mongoc_queue_pop_tail (&home->queue);
       if (old_client) {
-         mongoc_client_destroy (old_client);
-         pool->size--;
+         bson_atomic_int_add (&pool->n_idle, -1);
       }
    }
 
-   mongoc_cond_signal (&pool->cond);
-   mongoc_mutex_unlock (&pool->mutex);
+   mongoc_mutex_unlock (&home->mutex);
+
+   if (old_client) {
+      mongoc_client_destroy (old_client);
+      bson_atomic_int64_add (&pool->n_destroyed, 1);
+      mongoc_mutex_lock (&pool->mutex);
+      pool->size--;
+      _mongoc_client_pool_signal (pool);
+      mongoc_mutex_unlock (&pool->mutex);
+   } else {
+      /* pairs with the atomic increment of n_waiters in pop: either the
+       * waiter sees our client when it rescans, or we see the waiter */
+      bson_memory_barrier ();
+      if (pool->n_waiters) {
+         mongoc_mutex_lock (&pool->mutex);
+         _mongoc_client_pool_signal (pool);
+         mongoc_mutex_unlock (&pool->mutex);
+      }
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_reset_after_fork --
+ *
+ *       Call in a child process right after fork, before the child uses
+ *       @pool or its clients. Only the forking thread runs in the child:
+ *       the locks the parent's threads may have held are reinitialized,
+ *       and the clients they had checked out are forgotten. The idle
+ *       clients' connections are closed without shutting down their
+ *       sockets or TLS sessions, which the parent goes on using, and they
+ *       reconnect when next used. The URI, TLS options, topology and TLS
+ *       session cache are kept, and the background thread is restarted
+ *       if it was running.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_pool_reset_after_fork (mongoc_client_pool_t *pool)
+{
+   mongoc_client_pool_shard_t *shard;
+   mongoc_client_t *client;
+   uint32_t n_idle = 0;
+   uint32_t i;
+   uint32_t j;
+
+   ENTRY;
+
+   BSON_ASSERT (pool);
+
+   mongoc_mutex_init (&pool->mutex);
+   mongoc_cond_init (&pool->cond);
+   mongoc_cond_init (&pool->cond_high);
+
+   for (i = 0; i < pool->n_shards; i++) {
+      shard = &pool->shards[i];
+      mongoc_mutex_init (&shard->mutex);
+
+      for (j = 0; j < _mongoc_queue_get_length (&shard->queue); j++) {
+         client = (mongoc_client_t *) _mongoc_queue_get (&shard->queue, j);
+         _mongoc_cluster_reset_after_fork (&client->cluster);
+         n_idle++;
+      }
+   }
+
+   /* count the clients checked out in the parent as destroyed */
+   if (pool->size > n_idle) {
+      bson_atomic_int64_add (&pool->n_destroyed,
+                             (int64_t) (pool->size - n_idle));
+   }
+
+   pool->size = n_idle;
+   pool->n_idle = (int32_t) n_idle;
+   pool->n_waiters = 0;
+   pool->n_waiters_high = 0;
+   pool->n_blocked = 0;
+
+   _mongoc_dns_reset_after_fork ();
+   _mongoc_cluster_shared_reset_after_fork (pool->shared);
+   _mongoc_cluster_shared_reset_after_fork (pool->standby);
+   _mongoc_write_coalescer_reset_after_fork (pool->coalescer);
+
+   /* last, it may restart the background thread */
+   if (pool->topology->registry_key) {
+      _mongoc_topology_registry_reset_after_fork (pool->topology);
+   } else {
+      _mongoc_topology_reset_after_fork (pool->topology);
+   }
 
    EXIT;
 }
 
+
 /* for tests */
 void
 _mongoc_client_pool_set_stream_initiator (mongoc_client_pool_t *pool,
@@ -331,14 +1080,67 @@ mongoc_client_pool_num_pushed (mongoc_client_pool_t *pool)
 
    ENTRY;
 
-   mongoc_mutex_lock (&pool->mutex);
-   num_pushed = pool->queue.length;
-   mongoc_mutex_unlock (&pool->mutex);
+   num_pushed = (size_t) BSON_MAX (0, pool->n_idle);
 
    RETURN (num_pushed);
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_get_stats --
+ *
+ *       Sample the pool's client and wait statistics without locking it.
+ *       Each field is read atomically, but while clients are checked out
+ *       and in the fields may disagree by a client or two.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_pool_get_stats (mongoc_client_pool_t *pool,
+                              mongoc_client_pool_stats_t *stats)
+{
+   BSON_ASSERT (pool);
+   BSON_ASSERT (stats);
+
+   memset (stats, 0, sizeof *stats);
+
+   stats->clients_created = bson_atomic_int64_add (&pool->n_created, 0);
+   stats->clients_destroyed = bson_atomic_int64_add (&pool->n_destroyed, 0);
+   stats->clients_idle = BSON_MAX (0, bson_atomic_int_add (&pool->n_idle, 0));
+   stats->clients_in_use =
+      BSON_MAX (0,
+                stats->clients_created - stats->clients_destroyed -
+                   stats->clients_idle);
+   stats->waiters = (int64_t) pool->n_blocked;
+   stats->peak_waiters = bson_atomic_int_add (&pool->peak_blocked, 0);
+   stats->waits = bson_atomic_int64_add (&pool->n_waits, 0);
+   stats->wait_time_msec = bson_atomic_int64_add (&pool->wait_usec, 0) / 1000;
+   stats->max_wait_time_msec =
+      bson_atomic_int64_add (&pool->max_wait_usec, 0) / 1000;
+}
+
+
+mongoc_server_description_t **
+mongoc_client_pool_get_server_descriptions (mongoc_client_pool_t *pool,
+                                            size_t *n /* OUT */)
+{
+   mongoc_server_description_t **sds;
+
+   BSON_ASSERT (pool);
+   BSON_ASSERT (n);
+
+   mongoc_mutex_lock (&pool->topology->mutex);
+   sds = mongoc_topology_description_get_servers (&pool->topology->description,
+                                                  n);
+   mongoc_mutex_unlock (&pool->topology->mutex);
+
+   return sds;
+}
+
+
 mongoc_topology_t *
 _mongoc_client_pool_get_topology (mongoc_client_pool_t *pool)
 {
@@ -384,6 +1186,20 @@ mongoc_client_pool_set_apm_callbacks (mongoc_client_pool_t *pool,
       return false;
    }
 
+   if (_mongoc_topology_registry_is_shared (topology)) {
+      /* SDAM events from a topology other pools use aren't ours */
+      MONGOC_WARNING ("The pool shares its topology, only command monitoring"
+                      " callbacks are set");
+      if (callbacks) {
+         memcpy (
+            &pool->apm_callbacks, callbacks, sizeof (mongoc_apm_callbacks_t));
+      }
+
+      pool->apm_context = context;
+      pool->apm_callbacks_set = true;
+      return true;
+   }
+
    mongoc_mutex_lock (&topology->mutex);
 
    if (callbacks) {
@@ -397,6 +1213,7 @@ mongoc_client_pool_set_apm_callbacks (mongoc_client_pool_t *pool,
    topology->description.apm_context = context;
    pool->apm_context = context;
    pool->apm_callbacks_set = true;
+   pool->topology_callbacks_set = topology->registry_key != NULL;
 
    mongoc_mutex_unlock (&topology->mutex);
 
@@ -38,6 +38,24 @@ BSON_BEGIN_DECLS
 
 typedef struct _mongoc_client_pool_t mongoc_client_pool_t;
 
+typedef enum {
+   MONGOC_CLIENT_POOL_PRIORITY_NORMAL,
+   MONGOC_CLIENT_POOL_PRIORITY_HIGH,
+} mongoc_client_pool_priority_t;
+
+typedef struct {
+   int64_t clients_created;
+   int64_t clients_destroyed;
+   int64_t clients_in_use;
+   int64_t clients_idle;
+   int64_t waiters;
+   int64_t peak_waiters;
+   int64_t waits;
+   int64_t wait_time_msec;
+   int64_t max_wait_time_msec;
+   void *padding[8];
+} mongoc_client_pool_stats_t;
+
 
 MONGOC_EXPORT (mongoc_client_pool_t *)
 mongoc_client_pool_new (const mongoc_uri_t *uri);
@@ -45,8 +63,17 @@ MONGOC_EXPORT (void)
 mongoc_client_pool_destroy (mongoc_client_pool_t *pool);
 MONGOC_EXPORT (mongoc_client_t *)
 mongoc_client_pool_pop (mongoc_client_pool_t *pool);
+MONGOC_EXPORT (mongoc_client_t *)
+mongoc_client_pool_pop_with_error (mongoc_client_pool_t *pool,
+                                   bson_error_t *error);
+MONGOC_EXPORT (mongoc_client_t *)
+mongoc_client_pool_pop_with_priority (mongoc_client_pool_t *pool,
+                                      mongoc_client_pool_priority_t priority,
+                                      bson_error_t *error);
 MONGOC_EXPORT (void)
 mongoc_client_pool_push (mongoc_client_pool_t *pool, mongoc_client_t *client);
+MONGOC_EXPORT (bool)
+mongoc_client_pool_warm (mongoc_client_pool_t *pool, bson_error_t *error);
 MONGOC_EXPORT (mongoc_client_t *)
 mongoc_client_pool_try_pop (mongoc_client_pool_t *pool);
 MONGOC_EXPORT (void)
@@ -69,6 +96,14 @@ mongoc_client_pool_set_error_api (mongoc_client_pool_t *pool, int32_t version);
 MONGOC_EXPORT (bool)
 mongoc_client_pool_set_appname (mongoc_client_pool_t *pool,
                                 const char *appname);
+MONGOC_EXPORT (void)
+mongoc_client_pool_get_stats (mongoc_client_pool_t *pool,
+                              mongoc_client_pool_stats_t *stats);
+MONGOC_EXPORT (mongoc_server_description_t **)
+mongoc_client_pool_get_server_descriptions (mongoc_client_pool_t *pool,
+                                            size_t *n);
+MONGOC_EXPORT (void)
+mongoc_client_pool_reset_after_fork (mongoc_client_pool_t *pool);
 BSON_END_DECLS
 
 
@@ -29,8 +29,10 @@
 #include "mongoc-cluster-private.h"
 #include "mongoc-config.h"
 #include "mongoc-host-list.h"
+#include "mongoc-metadata-cache-private.h"
 #include "mongoc-read-prefs.h"
 #include "mongoc-rpc-private.h"
+#include "mongoc-set-private.h"
 #include "mongoc-opcode.h"
 #ifdef MONGOC_ENABLE_SSL
 #include "mongoc-ssl.h"
@@ -70,6 +72,19 @@ BSON_BEGIN_DECLS
 #define WIRE_VERSION_OP_MSG 6
 /* first version to support $clusterTime and causally consistent reads */
 #define WIRE_VERSION_CLUSTER_TIME 6
+/* first version to support retryable writes with "txnNumber" */
+#define WIRE_VERSION_RETRYABLE_WRITES 6
+/* first version whose reads the driver retries */
+#define WIRE_VERSION_RETRYABLE_READS 6
+/* first version to support $lookup with "let" and "pipeline" */
+#define WIRE_VERSION_LOOKUP_PIPELINE 6
+/* first version to support multi-document transactions */
+#define WIRE_VERSION_TRANSACTIONS 7
+/* first version to stream getMore replies for OP_MSG exhaustAllowed */
+#define WIRE_VERSION_OP_MSG_EXHAUST 8
+
+/* how many destroyed cursors a client keeps for reuse */
+#define MONGOC_CLIENT_CURSOR_CACHE_SIZE 4
 
 
 struct _mongoc_client_t {
@@ -96,6 +111,32 @@ struct _mongoc_client_t {
 
    int32_t error_api_version;
    bool error_api_set;
+
+   /* a pool's, to send inserts from several threads together, or NULL */
+   struct _mongoc_write_coalescer_t *coalescer;
+
+   /* "memoryBudgetMB": the pool's, a single client's own, or NULL */
+   mongoc_memory_budget_t *budget;
+
+   /* destroyed cursors, kept to reuse their allocations */
+   struct _mongoc_cursor_t *cursor_cache[MONGOC_CLIENT_CURSOR_CACHE_SIZE];
+   uint32_t n_cached_cursors;
+
+   /* "metadataCacheTTLMS": listIndexes and listCollections results, or NULL */
+   mongoc_metadata_cache_t *metadata_cache;
+
+   /* generates "_id"s for inserts, created on first use. a client is used
+    * by one thread at a time, so unlike the default context it needs no
+    * atomic counter */
+   bson_context_t *oid_context;
+
+   /* the find caches of this client's collections, a linked list */
+   struct _mongoc_find_cache_t *find_caches;
+
+   /* sessions started with this client, by id, and the last id given out.
+    * operations find their session from the "sessionId" in their opts */
+   mongoc_set_t *client_sessions;
+   uint32_t client_session_id;
 };
 
 
@@ -119,17 +160,18 @@ mongoc_client_t *
 _mongoc_client_new_from_uri (const mongoc_uri_t *uri,
                              mongoc_topology_t *topology);
 
+bson_context_t *
+_mongoc_client_get_oid_context (mongoc_client_t *client);
+
+void
+_mongoc_client_set_budget (mongoc_client_t *client,
+                           mongoc_memory_budget_t *budget);
+
 bool
 _mongoc_client_set_apm_callbacks_private (mongoc_client_t *client,
                                           mongoc_apm_callbacks_t *callbacks,
                                           void *context);
 
-mongoc_stream_t *
-mongoc_client_default_stream_initiator (const mongoc_uri_t *uri,
-                                        const mongoc_host_list_t *host,
-                                        void *user_data,
-                                        bson_error_t *error);
-
 mongoc_stream_t *
 _mongoc_client_create_stream (mongoc_client_t *client,
                               const mongoc_host_list_t *host,
@@ -149,6 +191,9 @@ _mongoc_client_kill_cursor (mongoc_client_t *client,
                             int64_t operation_id,
                             const char *db,
                             const char *collection);
+void
+_mongoc_client_flush_killcursors (mongoc_client_t *client,
+                                  mongoc_server_stream_t *server_stream);
 bool
 _mongoc_client_command_with_opts (mongoc_client_t *client,
                                   const char *db_name,
@@ -161,6 +206,40 @@ _mongoc_client_command_with_opts (mongoc_client_t *client,
                                   mongoc_write_concern_t *default_wc,
                                   bson_t *reply,
                                   bson_error_t *error);
+mongoc_server_stream_t *
+_mongoc_client_stream_for_opts (mongoc_client_t *client,
+                                const bson_t *opts,
+                                mongoc_command_mode_t mode,
+                                const mongoc_read_prefs_t *read_prefs,
+                                bson_error_t *error);
+bool
+_mongoc_client_command_with_opts_and_stream (
+   mongoc_client_t *client,
+   const char *db_name,
+   const bson_t *command,
+   mongoc_command_mode_t mode,
+   const bson_t *opts,
+   mongoc_query_flags_t flags,
+   const mongoc_read_prefs_t *default_prefs,
+   mongoc_read_concern_t *default_rc,
+   mongoc_write_concern_t *default_wc,
+   mongoc_server_stream_t *server_stream,
+   bson_t *reply,
+   bson_error_t *error);
+bool
+_mongoc_client_command_append_opts (mongoc_cmd_parts_t *parts,
+                                    mongoc_command_mode_t mode,
+                                    const bson_t *opts,
+                                    mongoc_read_concern_t *default_rc,
+                                    mongoc_write_concern_t *default_wc,
+                                    const mongoc_server_stream_t *server_stream,
+                                    bson_error_t *error);
+bool
+_mongoc_client_command_with_stream (mongoc_client_t *client,
+                                    mongoc_cmd_parts_t *parts,
+                                    mongoc_server_stream_t *server_stream,
+                                    bson_t *reply,
+                                    bson_error_t *error);
 
 BSON_END_DECLS
 
@@ -23,6 +23,7 @@
 
 #include <bson.h>
 #include "mongoc-client-session.h"
+#include "mongoc-server-stream-private.h"
 
 typedef enum {
    MONGOC_SESSION_NO_OPTS = 0,
@@ -34,10 +35,47 @@ struct _mongoc_session_opt_t {
 };
 
 
+typedef enum {
+   MONGOC_TRANSACTION_NONE = 0,
+   /* started, no statement sent yet */
+   MONGOC_TRANSACTION_STARTING,
+   MONGOC_TRANSACTION_IN_PROGRESS,
+   MONGOC_TRANSACTION_COMMITTED,
+   MONGOC_TRANSACTION_ABORTED,
+} mongoc_transaction_state_t;
+
+
+/* a logical session id, recycled through the topology's session pool */
+typedef struct _mongoc_server_session_t {
+   struct _mongoc_server_session_t *prev, *next;
+   int64_t last_used_usec;
+   bson_t lsid; /* logical session id */
+   /* the last "txnNumber" sent with this lsid, for retryable writes */
+   int64_t txn_number;
+} mongoc_server_session_t;
+
+
 struct _mongoc_client_session_t {
    mongoc_client_t *client;
    mongoc_session_opt_t opts;
-   bson_t lsid; /* logical session id */
+   mongoc_server_session_t *server_session;
+   /* identifies the session in operation opts, see
+    * mongoc_client_session_append */
+   uint32_t client_session_id;
+   /* the greatest "operationTime" the session's operations have seen, a
+    * BSON timestamp, or 0/0 */
+   uint32_t operation_timestamp;
+   uint32_t operation_increment;
+   /* see mongoc_client_session_start_transaction. its number is the
+    * server session's txn_number */
+   mongoc_transaction_state_t txn_state;
+   bson_t txn_opts; /* its "readConcern" and "writeConcern" */
+   /* the server the first statement selected, where the others, the
+    * commit, and the abort go, or 0 */
+   uint32_t pinned_server_id;
+   /* whether the client's cluster holds a connection for the transaction,
+    * see _mongoc_cluster_pin */
+   bool pinned_connection;
 };
 
 
@@ -46,4 +84,46 @@ _mongoc_client_session_new (mongoc_client_t *client,
                             const mongoc_session_opt_t *opts,
                             bson_error_t *error);
 
+bool
+_mongoc_client_session_from_iter (mongoc_client_t *client,
+                                  const bson_iter_t *iter,
+                                  mongoc_client_session_t **cs,
+                                  bson_error_t *error);
+
+bool
+_mongoc_client_session_from_opts (mongoc_client_t *client,
+                                  const bson_t *opts,
+                                  mongoc_client_session_t **cs,
+                                  bson_error_t *error);
+
+void
+_mongoc_client_session_advance_operation_time (
+   mongoc_client_session_t *session, const bson_t *reply);
+
+bool
+_mongoc_client_session_needs_after_cluster_time (
+   const mongoc_client_session_t *session);
+
+mongoc_read_prefs_t *
+_mongoc_client_session_read_prefs (const mongoc_client_session_t *session,
+                                   const mongoc_read_prefs_t *read_prefs);
+
+bool
+_mongoc_client_session_in_transaction (const mongoc_client_session_t *session);
+
+mongoc_server_stream_t *
+_mongoc_client_session_stream (mongoc_client_session_t *session,
+                               bson_error_t *error);
+
+mongoc_server_session_t *
+_mongoc_server_session_new (bson_error_t *error);
+
+bool
+_mongoc_server_session_timed_out (
+   const mongoc_server_session_t *server_session,
+   int64_t session_timeout_minutes);
+
+void
+_mongoc_server_session_destroy (mongoc_server_session_t *server_session);
+
 #endif /* MONGOC_SESSION_PRIVATE_H */
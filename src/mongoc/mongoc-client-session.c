@@ -18,7 +18,14 @@
 #include "mongoc-client-session-private.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-client-private.h"
+#include "mongoc-cluster-private.h"
 #include "mongoc-rand-private.h"
+#include "mongoc-read-concern-private.h"
+#include "mongoc-read-prefs-private.h"
+#include "mongoc-set-private.h"
+#include "mongoc-topology-private.h"
+#include "mongoc-util-private.h"
+#include "mongoc-write-concern-private.h"
 
 
 mongoc_session_opt_t *
@@ -111,7 +118,7 @@ _mongoc_client_session_uuid(uint8_t *data /* OUT */,
     *      values.
    */
 
-   if (!_mongoc_rand_bytes (data, 16)) {
+   if (!_mongoc_rand_buffered_bytes (data, 16)) {
       bson_set_error (error,
                       MONGOC_ERROR_CLIENT,
                       MONGOC_ERROR_CLIENT_AUTHENTICATE,
@@ -125,7 +132,7 @@ _mongoc_client_session_uuid(uint8_t *data /* OUT */,
 
    return true;
 #else
-   /* no _mongoc_rand_bytes without a crypto library */
+   /* no _mongoc_rand_buffered_bytes without a crypto library */
    bson_set_error (error,
                    MONGOC_ERROR_CLIENT,
                    MONGOC_ERROR_CLIENT_AUTHENTICATE,
@@ -137,28 +144,83 @@ _mongoc_client_session_uuid(uint8_t *data /* OUT */,
 }
 
 
+mongoc_server_session_t *
+_mongoc_server_session_new (bson_error_t *error)
+{
+   mongoc_server_session_t *server_session;
+   uint8_t uuid_data[16];
+
+   ENTRY;
+
+   if (!_mongoc_client_session_uuid (uuid_data, error)) {
+      RETURN (NULL);
+   }
+
+   server_session = bson_malloc0 (sizeof (mongoc_server_session_t));
+   server_session->last_used_usec = bson_get_monotonic_time ();
+
+   bson_init (&server_session->lsid);
+   bson_append_binary (&server_session->lsid,
+                       "id",
+                       2,
+                       BSON_SUBTYPE_UUID,
+                       uuid_data,
+                       sizeof uuid_data);
+
+   RETURN (server_session);
+}
+
+
+/* true if the server may expire @server_session within a minute. with
+ * no logicalSessionTimeoutMinutes known yet, keep it */
+bool
+_mongoc_server_session_timed_out (
+   const mongoc_server_session_t *server_session,
+   int64_t session_timeout_minutes)
+{
+   int64_t timeout_usec;
+
+   if (session_timeout_minutes == MONGOC_NO_SESSIONS) {
+      return false;
+   }
+
+   timeout_usec = (session_timeout_minutes - 1) * 60 * 1000 * 1000;
+
+   return bson_get_monotonic_time () - server_session->last_used_usec >=
+          timeout_usec;
+}
+
+
+void
+_mongoc_server_session_destroy (mongoc_server_session_t *server_session)
+{
+   bson_destroy (&server_session->lsid);
+   bson_free (server_session);
+}
+
+
 mongoc_client_session_t *
 _mongoc_client_session_new (mongoc_client_t *client,
                             const mongoc_session_opt_t *opts,
                             bson_error_t *error)
 {
    mongoc_client_session_t *session;
-   uint8_t uuid_data[16];
+   mongoc_server_session_t *server_session;
 
    ENTRY;
 
    BSON_ASSERT (client);
 
-   if (!_mongoc_client_session_uuid (uuid_data, error)) {
+   server_session =
+      _mongoc_topology_pop_server_session (client->topology, error);
+   if (!server_session) {
       RETURN (NULL);
    }
 
    session = bson_malloc0 (sizeof (mongoc_client_session_t));
    session->client = client;
-
-   bson_init (&session->lsid);
-   bson_append_binary (
-      &session->lsid, "id", 2, BSON_SUBTYPE_UUID, uuid_data, sizeof uuid_data);
+   session->server_session = server_session;
+   bson_init (&session->txn_opts);
 
    if (opts) {
       _mongoc_session_opts_copy (opts, &session->opts);
@@ -166,10 +228,246 @@ _mongoc_client_session_new (mongoc_client_t *client,
       session->opts.flags = MONGOC_SESSION_NO_OPTS;
    }
 
+   /* 0 is never a session id */
+   do {
+      session->client_session_id = ++client->client_session_id;
+   } while (!session->client_session_id ||
+            mongoc_set_get (client->client_sessions,
+                            session->client_session_id));
+
+   mongoc_set_add (
+      client->client_sessions, session->client_session_id, session);
+
    RETURN (session);
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_session_from_iter --
+ *
+ *       The session whose id @iter holds, the "sessionId" that
+ *       mongoc_client_session_append added to an operation's opts.
+ *
+ * Returns:
+ *       True and sets *cs on success, false and fills out @error if the
+ *       id isn't an integer or isn't one of @client's sessions.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_client_session_from_iter (mongoc_client_t *client,
+                                  const bson_iter_t *iter,
+                                  mongoc_client_session_t **cs,
+                                  bson_error_t *error)
+{
+   int64_t id;
+
+   ENTRY;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (iter);
+   BSON_ASSERT (cs);
+
+   id = BSON_ITER_HOLDS_INT (iter) ? bson_iter_as_int64 (iter) : 0;
+   *cs = id > 0 && id <= UINT32_MAX
+            ? mongoc_set_get (client->client_sessions, (uint32_t) id)
+            : NULL;
+
+   if (!*cs) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Invalid sessionId");
+      RETURN (false);
+   }
+
+   RETURN (true);
+}
+
+
+/* the session in @opts, or NULL if there's no "sessionId" */
+bool
+_mongoc_client_session_from_opts (mongoc_client_t *client,
+                                  const bson_t *opts,
+                                  mongoc_client_session_t **cs,
+                                  bson_error_t *error)
+{
+   bson_iter_t iter;
+
+   *cs = NULL;
+
+   if (!opts || !bson_iter_init_find (&iter, opts, "sessionId")) {
+      return true;
+   }
+
+   return _mongoc_client_session_from_iter (client, &iter, cs, error);
+}
+
+
+/* Causal Consistency Spec: "the driver MUST examine all responses from the
+ * server for the presence of an operationTime field and store the value in
+ * the ClientSession", unless it's older than what the session has seen */
+void
+_mongoc_client_session_advance_operation_time (
+   mongoc_client_session_t *session, const bson_t *reply)
+{
+   bson_iter_t iter;
+   uint32_t timestamp;
+   uint32_t increment;
+
+   if (!session || !reply ||
+       !bson_iter_init_find (&iter, reply, "operationTime") ||
+       !BSON_ITER_HOLDS_TIMESTAMP (&iter)) {
+      return;
+   }
+
+   bson_iter_timestamp (&iter, &timestamp, &increment);
+
+   if (timestamp > session->operation_timestamp ||
+       (timestamp == session->operation_timestamp &&
+        increment > session->operation_increment)) {
+      session->operation_timestamp = timestamp;
+      session->operation_increment = increment;
+   }
+}
+
+
+/* true if reads in @session must wait for its last operation's time */
+bool
+_mongoc_client_session_needs_after_cluster_time (
+   const mongoc_client_session_t *session)
+{
+   return session &&
+          (session->opts.flags & MONGOC_SESSION_CAUSALLY_CONSISTENT_READS) &&
+          (session->operation_timestamp || session->operation_increment);
+}
+
+
+/* a copy of @read_prefs that prefers secondaries which have replicated the
+ * session's last operation, or NULL to select with @read_prefs as is */
+mongoc_read_prefs_t *
+_mongoc_client_session_read_prefs (const mongoc_client_session_t *session,
+                                   const mongoc_read_prefs_t *read_prefs)
+{
+   mongoc_read_prefs_t *prefs;
+
+   if (!read_prefs ||
+       mongoc_read_prefs_get_mode (read_prefs) == MONGOC_READ_PRIMARY ||
+       !_mongoc_client_session_needs_after_cluster_time (session)) {
+      return NULL;
+   }
+
+   prefs = mongoc_read_prefs_copy (read_prefs);
+   _mongoc_read_prefs_set_after_cluster_time (
+      prefs, session->operation_timestamp, session->operation_increment);
+
+   return prefs;
+}
+
+
+/* true between mongoc_client_session_start_transaction and the commit or
+ * abort, while operations in @session are the transaction's statements */
+bool
+_mongoc_client_session_in_transaction (const mongoc_client_session_t *session)
+{
+   return session && (session->txn_state == MONGOC_TRANSACTION_STARTING ||
+                      session->txn_state == MONGOC_TRANSACTION_IN_PROGRESS);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_session_stream --
+ *
+ *       A stream for a statement of @session's transaction. The first
+ *       selects a primary; the others, and the commit or abort, go to
+ *       the same server without selecting it again, and with shared
+ *       connections over the same connection.
+ *
+ * Returns:
+ *       A server stream, or NULL and @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_server_stream_t *
+_mongoc_client_session_stream (mongoc_client_session_t *session,
+                               bson_error_t *error)
+{
+   mongoc_cluster_t *cluster = &session->client->cluster;
+   mongoc_server_stream_t *server_stream;
+
+   if (session->pinned_server_id) {
+      return mongoc_cluster_stream_for_server (
+         cluster, session->pinned_server_id, true /* reconnect_ok */, error);
+   }
+
+   server_stream = mongoc_cluster_stream_for_writes (cluster, error);
+   if (server_stream) {
+      session->pinned_server_id = server_stream->sd->id;
+      session->pinned_connection = true;
+      _mongoc_cluster_pin (cluster, server_stream);
+   }
+
+   return server_stream;
+}
+
+
+/* the transaction is over, its connection is free for other operations */
+static void
+_mongoc_client_session_unpin (mongoc_client_session_t *session)
+{
+   if (session->pinned_connection) {
+      _mongoc_cluster_unpin (&session->client->cluster);
+      session->pinned_connection = false;
+   }
+}
+
+
+/* run "commitTransaction" or "abortTransaction" on the server the
+ * transaction's statements ran on, with its write concern */
+static bool
+_mongoc_client_session_end_transaction (mongoc_client_session_t *session,
+                                        const char *cmd_name,
+                                        bson_t *reply,
+                                        bson_error_t *error)
+{
+   bson_t cmd = BSON_INITIALIZER;
+   bson_t opts = BSON_INITIALIZER;
+   bson_iter_t iter;
+   bool ret;
+
+   if (!session->pinned_server_id) {
+      /* no statement was sent, there's nothing to end */
+      _mongoc_bson_init_if_set (reply);
+      return true;
+   }
+
+   BSON_APPEND_INT32 (&cmd, cmd_name, 1);
+   BSON_APPEND_INT64 (&cmd, "txnNumber", session->server_session->txn_number);
+   BSON_APPEND_BOOL (&cmd, "autocommit", false);
+
+   BSON_ASSERT (mongoc_client_session_append (session, &opts, NULL));
+   BSON_APPEND_INT32 (&opts, "serverId", (int32_t) session->pinned_server_id);
+   if (bson_iter_init_find (&iter, &session->txn_opts, "writeConcern")) {
+      bson_append_iter (&opts, NULL, 0, &iter);
+   }
+
+   ret = mongoc_client_write_command_with_opts (
+      session->client, "admin", &cmd, &opts, reply, error);
+
+   _mongoc_client_session_unpin (session);
+   bson_destroy (&opts);
+   bson_destroy (&cmd);
+
+   return ret;
+}
+
+
 mongoc_client_t *
 mongoc_client_session_get_client (const mongoc_client_session_t *session)
 {
@@ -193,7 +491,237 @@ mongoc_client_session_get_session_id (const mongoc_client_session_t *session)
 {
    BSON_ASSERT (session);
 
-   return &session->lsid;
+   return &session->server_session->lsid;
+}
+
+
+bool
+mongoc_client_session_append (const mongoc_client_session_t *client_session,
+                              bson_t *opts,
+                              bson_error_t *error)
+{
+   ENTRY;
+
+   BSON_ASSERT (client_session);
+   BSON_ASSERT (opts);
+
+   if (!bson_append_int64 (
+          opts, "sessionId", 9, client_session->client_session_id)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_BSON,
+                      MONGOC_ERROR_BSON_INVALID,
+                      "invalid opts");
+
+      RETURN (false);
+   }
+
+   RETURN (true);
+}
+
+
+void
+mongoc_client_session_get_operation_time (
+   const mongoc_client_session_t *session,
+   uint32_t *timestamp,
+   uint32_t *increment)
+{
+   BSON_ASSERT (session);
+   BSON_ASSERT (timestamp);
+   BSON_ASSERT (increment);
+
+   *timestamp = session->operation_timestamp;
+   *increment = session->operation_increment;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_session_start_transaction --
+ *
+ *       Begin a multi-document transaction. Operations in @session until
+ *       the commit or abort are its statements. @opts may have the
+ *       transaction's "readConcern" and "writeConcern", otherwise it has
+ *       the client's.
+ *
+ *       Nothing is sent until the first statement, which carries
+ *       "startTransaction" itself.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_client_session_start_transaction (mongoc_client_session_t *session,
+                                         const bson_t *opts,
+                                         bson_error_t *error)
+{
+   const mongoc_read_concern_t *read_concern;
+   bson_iter_t iter;
+
+   ENTRY;
+
+   BSON_ASSERT (session);
+
+   if (_mongoc_client_session_in_transaction (session)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Transaction already in progress");
+      RETURN (false);
+   }
+
+   bson_reinit (&session->txn_opts);
+
+   if (opts && bson_iter_init (&iter, opts)) {
+      while (bson_iter_next (&iter)) {
+         if (!(BSON_ITER_IS_KEY (&iter, "readConcern") &&
+               BSON_ITER_HOLDS_DOCUMENT (&iter)) &&
+             !(BSON_ITER_IS_KEY (&iter, "writeConcern") &&
+               _mongoc_write_concern_iter_is_valid (&iter))) {
+            bson_set_error (error,
+                            MONGOC_ERROR_COMMAND,
+                            MONGOC_ERROR_COMMAND_INVALID_ARG,
+                            "Invalid transaction option \"%s\"",
+                            bson_iter_key (&iter));
+            bson_reinit (&session->txn_opts);
+            RETURN (false);
+         }
+
+         bson_append_iter (&session->txn_opts, NULL, 0, &iter);
+      }
+   }
+
+   read_concern = mongoc_client_get_read_concern (session->client);
+   if (!bson_has_field (&session->txn_opts, "readConcern") &&
+       !mongoc_read_concern_is_default (read_concern)) {
+      bson_append_document (&session->txn_opts,
+                            "readConcern",
+                            11,
+                            _mongoc_read_concern_get_bson (
+                               (mongoc_read_concern_t *) read_concern));
+   }
+
+   /* a previous transaction's statements may have gone elsewhere */
+   _mongoc_client_session_unpin (session);
+   session->pinned_server_id = 0;
+
+   /* all the transaction's statements share the next number */
+   session->server_session->txn_number++;
+   session->txn_state = MONGOC_TRANSACTION_STARTING;
+
+   RETURN (true);
+}
+
+
+bool
+mongoc_client_session_in_transaction (const mongoc_client_session_t *session)
+{
+   BSON_ASSERT (session);
+
+   return _mongoc_client_session_in_transaction (session);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_session_commit_transaction --
+ *
+ *       Commit the transaction with "commitTransaction", or do nothing if
+ *       it has no statements. A commit may be attempted again, e.g. after
+ *       a network error.
+ *
+ * Returns:
+ *       True on success. False and fills out @error if no transaction was
+ *       started or it was aborted, or the commit failed.
+ *
+ * Side effects:
+ *       @reply is always initialized if not NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_client_session_commit_transaction (mongoc_client_session_t *session,
+                                          bson_t *reply,
+                                          bson_error_t *error)
+{
+   bool ret;
+
+   ENTRY;
+
+   BSON_ASSERT (session);
+
+   switch (session->txn_state) {
+   case MONGOC_TRANSACTION_NONE:
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "No transaction started");
+      _mongoc_bson_init_if_set (reply);
+      RETURN (false);
+   case MONGOC_TRANSACTION_ABORTED:
+      bson_set_error (
+         error,
+         MONGOC_ERROR_COMMAND,
+         MONGOC_ERROR_COMMAND_INVALID_ARG,
+         "Cannot call commitTransaction after calling abortTransaction");
+      _mongoc_bson_init_if_set (reply);
+      RETURN (false);
+   case MONGOC_TRANSACTION_STARTING:
+   case MONGOC_TRANSACTION_IN_PROGRESS:
+   case MONGOC_TRANSACTION_COMMITTED:
+   default:
+      break;
+   }
+
+   session->txn_state = MONGOC_TRANSACTION_COMMITTED;
+   ret = _mongoc_client_session_end_transaction (
+      session, "commitTransaction", reply, error);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_session_abort_transaction --
+ *
+ *       Abort the transaction with "abortTransaction", or do nothing if
+ *       it has no statements. The server aborts it anyway once the
+ *       session is idle too long, so errors from the server are ignored.
+ *
+ * Returns:
+ *       False and fills out @error if no transaction is in progress.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_client_session_abort_transaction (mongoc_client_session_t *session,
+                                         bson_error_t *error)
+{
+   ENTRY;
+
+   BSON_ASSERT (session);
+
+   if (!_mongoc_client_session_in_transaction (session)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      session->txn_state == MONGOC_TRANSACTION_NONE
+                         ? "No transaction started"
+                         : "Cannot call abortTransaction after the "
+                           "transaction was committed or aborted");
+      RETURN (false);
+   }
+
+   session->txn_state = MONGOC_TRANSACTION_ABORTED;
+   _mongoc_client_session_end_transaction (
+      session, "abortTransaction", NULL, NULL);
+
+   RETURN (true);
 }
 
 
@@ -204,7 +732,16 @@ mongoc_client_session_destroy (mongoc_client_session_t *session)
 
    BSON_ASSERT (session);
 
-   bson_destroy (&session->lsid);
+   if (_mongoc_client_session_in_transaction (session)) {
+      mongoc_client_session_abort_transaction (session, NULL);
+   }
+
+   _mongoc_client_session_unpin (session);
+   bson_destroy (&session->txn_opts);
+   mongoc_set_rm (session->client->client_sessions,
+                  session->client_session_id);
+   _mongoc_topology_push_server_session (session->client->topology,
+                                         session->server_session);
    bson_free (session);
 
    EXIT;
@@ -54,6 +54,34 @@ mongoc_client_session_get_opts (const mongoc_client_session_t *session);
 MONGOC_EXPORT (const bson_t *)
 mongoc_client_session_get_session_id (const mongoc_client_session_t *session);
 
+MONGOC_EXPORT (bool)
+mongoc_client_session_append (const mongoc_client_session_t *client_session,
+                              bson_t *opts,
+                              bson_error_t *error);
+
+MONGOC_EXPORT (void)
+mongoc_client_session_get_operation_time (
+   const mongoc_client_session_t *session,
+   uint32_t *timestamp,
+   uint32_t *increment);
+
+MONGOC_EXPORT (bool)
+mongoc_client_session_start_transaction (mongoc_client_session_t *session,
+                                         const bson_t *opts,
+                                         bson_error_t *error);
+
+MONGOC_EXPORT (bool)
+mongoc_client_session_in_transaction (const mongoc_client_session_t *session);
+
+MONGOC_EXPORT (bool)
+mongoc_client_session_commit_transaction (mongoc_client_session_t *session,
+                                          bson_t *reply,
+                                          bson_error_t *error);
+
+MONGOC_EXPORT (bool)
+mongoc_client_session_abort_transaction (mongoc_client_session_t *session,
+                                         bson_error_t *error);
+
 
 /* There is no mongoc_client_session_end, only mongoc_client_session_destroy.
  * Driver Sessions Spec: "In languages that have idiomatic ways of disposing of
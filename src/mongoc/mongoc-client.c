@@ -36,12 +36,14 @@
 #include "mongoc-collection-private.h"
 #include "mongoc-counters-private.h"
 #include "mongoc-database-private.h"
+#include "mongoc-dns-private.h"
 #include "mongoc-gridfs-private.h"
 #include "mongoc-error.h"
 #include "mongoc-log.h"
 #include "mongoc-queue-private.h"
-#include "mongoc-socket.h"
+#include "mongoc-socket-private.h"
 #include "mongoc-stream-buffered.h"
+#include "mongoc-stream-private.h"
 #include "mongoc-stream-socket.h"
 #include "mongoc-thread-private.h"
 #include "mongoc-trace-private.h"
@@ -78,9 +80,8 @@ _mongoc_client_op_killcursors (mongoc_cluster_t *cluster,
 static void
 _mongoc_client_killcursors_command (mongoc_cluster_t *cluster,
                                     mongoc_server_stream_t *server_stream,
-                                    int64_t cursor_id,
                                     const char *db,
-                                    const char *collection);
+                                    const bson_t *command);
 
 
 #define RR_ERR(_msg, ...)                                  \
@@ -105,7 +106,8 @@ _mongoc_client_killcursors_command (mongoc_cluster_t *cluster,
  *
  * Returns:
  *       A newly allocated host list that must be freed with
- *       _mongoc_host_list_destroy_all.
+ *       _mongoc_host_list_destroy_all. @ttl_sec is set to the least TTL
+ *       of the records.
  *
  * Side effects:
  *       @error is set if return value is NULL.
@@ -115,7 +117,9 @@ _mongoc_client_killcursors_command (mongoc_cluster_t *cluster,
 
 #ifdef MONGOC_HAVE_DNSAPI
 static mongoc_host_list_t *
-_mongoc_get_srv_dnsapi (const char *service, bson_error_t *error)
+_mongoc_get_srv_dnsapi (const char *service,
+                        uint32_t *ttl_sec,
+                        bson_error_t *error)
 {
    mongoc_host_list_t *h = NULL;
    PDNS_RECORD pdns;
@@ -151,9 +155,12 @@ _mongoc_get_srv_dnsapi (const char *service, bson_error_t *error)
       RR_ERR ("No SRV records for [%s]", service);
    }
 
+   *ttl_sec = pdns->dwTtl;
+
    do {
       h = _mongoc_host_list_push (
          pdns->Data.SRV.pNameTarget, pdns->Data.SRV.wPort, AF_UNSPEC, h);
+      *ttl_sec = BSON_MIN (*ttl_sec, pdns->dwTtl);
 
       pdns = pdns->pNext;
    } while (pdns);
@@ -179,7 +186,8 @@ done:
  *
  * Returns:
  *       A newly allocated host list that must be freed with
- *       _mongoc_host_list_destroy_all.
+ *       _mongoc_host_list_destroy_all. @ttl_sec is set to the least TTL
+ *       of the records.
  *
  * Side effects:
  *       @error is set if return value is NULL.
@@ -188,7 +196,9 @@ done:
  */
 
 static mongoc_host_list_t *
-_mongoc_get_srv_query (const char *service, bson_error_t *error)
+_mongoc_get_srv_query (const char *service,
+                       uint32_t *ttl_sec,
+                       bson_error_t *error)
 {
 #ifdef MONGOC_HAVE_RES_NQUERY
    struct __res_state state = {0};
@@ -254,6 +264,8 @@ _mongoc_get_srv_query (const char *service, bson_error_t *error)
       }
 
       h = _mongoc_host_list_push (name, port, AF_UNSPEC, h);
+      *ttl_sec = i ? BSON_MIN (*ttl_sec, ns_rr_ttl (resource_record))
+                   : ns_rr_ttl (resource_record);
    }
 
 done:
@@ -274,7 +286,9 @@ done:
  *
  * _mongoc_client_get_srv --
  *
- *       Fetch an SRV resource record. See RFC 2782.
+ *       Fetch an SRV resource record. See RFC 2782. Answers are cached
+ *       for all clients and pools in the process, see
+ *       _mongoc_dns_srv_cache_put.
  *
  * Returns:
  *       A newly allocated host list that must be freed with
@@ -289,22 +303,54 @@ done:
 mongoc_host_list_t *
 _mongoc_client_get_srv (const char *service, bson_error_t *error)
 {
+   mongoc_host_list_t *hosts;
+   uint32_t ttl_sec = 0;
+
+   ENTRY;
+
+   if (_mongoc_dns_srv_cache_get (service, &hosts, error)) {
+      RETURN (hosts);
+   }
+
 #ifdef MONGOC_HAVE_DNSAPI
-   return _mongoc_get_srv_dnsapi (service, error);
+   hosts = _mongoc_get_srv_dnsapi (service, &ttl_sec, error);
 #elif (defined(MONGOC_HAVE_RES_NQUERY) || defined(MONGOC_HAVE_RES_QUERY))
-   return _mongoc_get_srv_query (service, error);
+   hosts = _mongoc_get_srv_query (service, &ttl_sec, error);
 #else
    bson_set_error (error,
                    MONGOC_ERROR_STREAM,
                    MONGOC_ERROR_STREAM_NAME_RESOLUTION,
                    "libresolv unavailable, cannot use mongodb+srv URI");
 
-   RETURN (NULL);
+   hosts = NULL;
 #endif
+
+   _mongoc_dns_srv_cache_put (service, hosts, ttl_sec, error);
+
+   RETURN (hosts);
 }
 
 #undef RR_ERR
 
+
+/* wrap a connected socket, and use io_uring for it if the URI asks to and
+ * the kernel supports it */
+static mongoc_stream_t *
+_mongoc_client_socket_stream_new (const mongoc_uri_t *uri,
+                                  mongoc_socket_t *sock)
+{
+   mongoc_stream_t *stream;
+
+   stream = mongoc_stream_socket_new (sock);
+
+   if (mongoc_uri_get_option_as_bool (uri, MONGOC_URI_IOURING, false) &&
+       !_mongoc_stream_socket_use_uring (stream)) {
+      TRACE ("%s", "io_uring unavailable, polling the socket");
+   }
+
+   return stream;
+}
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -331,12 +377,9 @@ mongoc_client_connect_tcp (const mongoc_uri_t *uri,
                            bson_error_t *error)
 {
    mongoc_socket_t *sock = NULL;
-   struct addrinfo hints;
-   struct addrinfo *result, *rp;
+   mongoc_socket_opts_t opts;
+   struct addrinfo *result;
    int32_t connecttimeoutms;
-   int64_t expire_at;
-   char portstr[8];
-   int s;
 
    ENTRY;
 
@@ -348,63 +391,17 @@ mongoc_client_connect_tcp (const mongoc_uri_t *uri,
 
    BSON_ASSERT (connecttimeoutms);
 
-   bson_snprintf (portstr, sizeof portstr, "%hu", host->port);
+   _mongoc_uri_get_socket_opts (uri, &opts);
 
-   memset (&hints, 0, sizeof hints);
-   hints.ai_family = host->family;
-   hints.ai_socktype = SOCK_STREAM;
-   hints.ai_flags = 0;
-   hints.ai_protocol = 0;
-
-   s = getaddrinfo (host->host, portstr, &hints, &result);
-
-   if (s != 0) {
-      mongoc_counter_dns_failure_inc ();
-      bson_set_error (error,
-                      MONGOC_ERROR_STREAM,
-                      MONGOC_ERROR_STREAM_NAME_RESOLUTION,
-                      "Failed to resolve %s",
-                      host->host);
+   result = _mongoc_dns_getaddrinfo (host, error);
+   if (!result) {
       RETURN (NULL);
    }
 
-   mongoc_counter_dns_success_inc ();
-
-   for (rp = result; rp; rp = rp->ai_next) {
-      /*
-       * Create a new non-blocking socket.
-       */
-      if (!(sock = mongoc_socket_new (
-               rp->ai_family, rp->ai_socktype, rp->ai_protocol))) {
-         continue;
-      }
-
-      /*
-       * Try to connect to the peer.
-       */
-      expire_at = bson_get_monotonic_time () + (connecttimeoutms * 1000L);
-      if (0 !=
-          mongoc_socket_connect (
-             sock, rp->ai_addr, (mongoc_socklen_t) rp->ai_addrlen, expire_at)) {
-         char *errmsg;
-         char errmsg_buf[BSON_ERROR_BUFFER_SIZE];
-         char ip[255];
-
-         mongoc_socket_inet_ntop (rp, ip, sizeof ip);
-         errmsg = bson_strerror_r (
-            mongoc_socket_errno (sock), errmsg_buf, sizeof errmsg_buf);
-         MONGOC_WARNING ("Failed to connect to: %s:%d, error: %d, %s\n",
-                         ip,
-                         host->port,
-                         mongoc_socket_errno (sock),
-                         errmsg);
-         mongoc_socket_destroy (sock);
-         sock = NULL;
-         continue;
-      }
-
-      break;
-   }
+   /* race the addresses so a dead one, typically IPv6, doesn't cost
+    * connectTimeoutMS before the next is tried */
+   sock = _mongoc_socket_connect_happy_eyeballs (
+      result, host->port, connecttimeoutms, &opts);
 
    if (!sock) {
       bson_set_error (error,
@@ -412,13 +409,13 @@ mongoc_client_connect_tcp (const mongoc_uri_t *uri,
                       MONGOC_ERROR_STREAM_CONNECT,
                       "Failed to connect to target host: %s",
                       host->host_and_port);
-      freeaddrinfo (result);
+      _mongoc_dns_results_free (result);
       RETURN (NULL);
    }
 
-   freeaddrinfo (result);
+   _mongoc_dns_results_free (result);
 
-   return mongoc_stream_socket_new (sock);
+   return _mongoc_client_socket_stream_new (uri, sock);
 }
 
 
@@ -485,7 +482,7 @@ mongoc_client_connect_unix (const mongoc_uri_t *uri,
       RETURN (NULL);
    }
 
-   ret = mongoc_stream_socket_new (sock);
+   ret = _mongoc_client_socket_stream_new (uri, sock);
 
    RETURN (ret);
 #endif
@@ -519,6 +516,7 @@ mongoc_client_default_stream_initiator (const mongoc_uri_t *uri,
                                         bson_error_t *error)
 {
    mongoc_stream_t *base_stream = NULL;
+   mongoc_host_list_t unix_host;
 #ifdef MONGOC_ENABLE_SSL
    mongoc_client_t *client = (mongoc_client_t *) user_data;
    const char *mechanism;
@@ -545,7 +543,16 @@ mongoc_client_default_stream_initiator (const mongoc_uri_t *uri,
    case AF_INET6:
 #endif
    case AF_INET:
-      base_stream = mongoc_client_connect_tcp (uri, host, error);
+      /* skip the TCP stack to reach a mongod or mongos on this machine */
+      if (mongoc_uri_get_option_as_bool (
+             uri, MONGOC_URI_PREFERUNIXSOCKET, false) &&
+          _mongoc_host_list_local_unix (host, &unix_host)) {
+         base_stream = mongoc_client_connect_unix (uri, &unix_host, NULL);
+      }
+
+      if (!base_stream) {
+         base_stream = mongoc_client_connect_tcp (uri, host, error);
+      }
       break;
    case AF_UNIX:
       base_stream = mongoc_client_connect_unix (uri, host, error);
@@ -579,6 +586,16 @@ mongoc_client_default_stream_initiator (const mongoc_uri_t *uri,
             return NULL;
          }
 
+         _mongoc_stream_tls_set_session_cache (
+            base_stream,
+            client->topology->scanner->tls_sessions,
+            host->host_and_port);
+
+         if (mongoc_uri_get_option_as_bool (
+                uri, MONGOC_URI_SSLKERNELOFFLOAD, false)) {
+            _mongoc_stream_tls_set_kernel_offload (base_stream);
+         }
+
          connecttimeoutms = mongoc_uri_get_option_as_int32 (
             uri, MONGOC_URI_CONNECTTIMEOUTMS, MONGOC_DEFAULT_CONNECTTIMEOUTMS);
 
@@ -591,7 +608,8 @@ mongoc_client_default_stream_initiator (const mongoc_uri_t *uri,
    }
 #endif
 
-   return base_stream ? mongoc_stream_buffered_new (base_stream, 1024) : NULL;
+   return base_stream ? _mongoc_stream_buffered_new_for_uri (base_stream, uri)
+                      : NULL;
 }
 
 
@@ -801,10 +819,9 @@ _mongoc_client_new_from_uri (const mongoc_uri_t *uri,
                              mongoc_topology_t *topology)
 {
    mongoc_client_t *client;
-   const mongoc_read_prefs_t *read_prefs;
-   const mongoc_read_concern_t *read_concern;
-   const mongoc_write_concern_t *write_concern;
    const char *appname;
+   int32_t budget_mb;
+   int32_t metadata_ttl_ms;
 
    BSON_ASSERT (uri);
 
@@ -816,21 +833,32 @@ _mongoc_client_new_from_uri (const mongoc_uri_t *uri,
 #endif
 
    client = (mongoc_client_t *) bson_malloc0 (sizeof *client);
-   client->uri = mongoc_uri_copy (uri);
+   if (topology->single_threaded) {
+      client->uri = mongoc_uri_copy (uri);
+   } else {
+      /* the pool's, which outlives its clients and never changes */
+      client->uri = (mongoc_uri_t *) uri;
+   }
+
    client->initiator = mongoc_client_default_stream_initiator;
    client->initiator_data = client;
    client->topology = topology;
    client->error_api_version = MONGOC_ERROR_API_VERSION_LEGACY;
    client->error_api_set = false;
 
-   write_concern = mongoc_uri_get_write_concern (client->uri);
-   client->write_concern = mongoc_write_concern_copy (write_concern);
+   /* use the URI's own defaults, not copies, until they're overridden with
+    * mongoc_client_set_write_concern and friends: a pool's clients all share
+    * them. compile their BSON now, so threads only ever read it. */
+   client->write_concern =
+      (mongoc_write_concern_t *) mongoc_uri_get_write_concern (client->uri);
+   _mongoc_write_concern_get_bson (client->write_concern);
 
-   read_concern = mongoc_uri_get_read_concern (client->uri);
-   client->read_concern = mongoc_read_concern_copy (read_concern);
+   client->read_concern =
+      (mongoc_read_concern_t *) mongoc_uri_get_read_concern (client->uri);
+   _mongoc_read_concern_get_bson (client->read_concern);
 
-   read_prefs = mongoc_uri_get_read_prefs_t (client->uri);
-   client->read_prefs = mongoc_read_prefs_copy (read_prefs);
+   client->read_prefs =
+      (mongoc_read_prefs_t *) mongoc_uri_get_read_prefs_t (client->uri);
 
    appname =
       mongoc_uri_get_option_as_utf8 (client->uri, MONGOC_URI_APPNAME, NULL);
@@ -841,6 +869,23 @@ _mongoc_client_new_from_uri (const mongoc_uri_t *uri,
 
    mongoc_cluster_init (&client->cluster, client->uri, client);
 
+   /* a pool's clients share the pool's budget */
+   budget_mb = mongoc_uri_get_option_as_int32 (
+      client->uri, MONGOC_URI_MEMORYBUDGETMB, 0);
+   if (budget_mb > 0 && client->topology->single_threaded) {
+      _mongoc_client_set_budget (
+         client, _mongoc_memory_budget_new ((int64_t) budget_mb * 1024 * 1024));
+   }
+
+   metadata_ttl_ms = mongoc_uri_get_option_as_int32 (
+      client->uri, MONGOC_URI_METADATACACHETTLMS, 0);
+   if (metadata_ttl_ms > 0) {
+      client->metadata_cache =
+         _mongoc_metadata_cache_new ((int64_t) metadata_ttl_ms * 1000);
+   }
+
+   client->client_sessions = mongoc_set_new (8, NULL, NULL);
+
 #ifdef MONGOC_ENABLE_SSL
    client->use_ssl = false;
    if (mongoc_uri_get_ssl (client->uri)) {
@@ -857,6 +902,111 @@ _mongoc_client_new_from_uri (const mongoc_uri_t *uri,
    return client;
 }
 
+
+/* charge @budget for the memory @client's buffers hold */
+void
+_mongoc_client_set_budget (mongoc_client_t *client,
+                           mongoc_memory_budget_t *budget)
+{
+   client->budget = budget;
+   _mongoc_cluster_set_budget (&client->cluster, budget);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_get_oid_context --
+ *
+ *       The context to generate ObjectIds for documents inserted through
+ *       @client. It caches the process id, so like the rest of the client
+ *       it must not be used from both sides of a fork ().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_context_t *
+_mongoc_client_get_oid_context (mongoc_client_t *client)
+{
+   if (!client->oid_context) {
+      client->oid_context = bson_context_new (BSON_CONTEXT_NONE);
+   }
+
+   return client->oid_context;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_invalidate_metadata_cache --
+ *
+ *       With "metadataCacheTTLMS", forget cached listCollections results
+ *       for @db and listIndexes results for @collection, or for all of
+ *       @db's collections if @collection is NULL. If @db is NULL, forget
+ *       everything cached.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_invalidate_metadata_cache (mongoc_client_t *client,
+                                         const char *db,
+                                         const char *collection)
+{
+   BSON_ASSERT (client);
+
+   if (client->metadata_cache) {
+      _mongoc_metadata_cache_invalidate (
+         client->metadata_cache, db, collection);
+   }
+}
+
+
+/* with "deferKillCursors", kill the cursors still queued on any server */
+static void
+_mongoc_client_flush_all_killcursors (mongoc_client_t *client)
+{
+   mongoc_array_t *queue = &client->cluster.dead_cursors;
+   mongoc_server_stream_t *server_stream;
+   uint32_t *server_ids;
+   size_t n_servers = 0;
+   size_t i;
+   size_t j;
+
+   if (!queue->len) {
+      return;
+   }
+
+   server_ids = bson_malloc (queue->len * sizeof (uint32_t));
+   for (i = 0; i < queue->len; i++) {
+      server_ids[n_servers] =
+         _mongoc_array_index (queue, mongoc_cluster_dead_cursor_t, i)
+            .server_id;
+      for (j = 0; j < n_servers; j++) {
+         if (server_ids[j] == server_ids[n_servers]) {
+            break;
+         }
+      }
+
+      if (j == n_servers) {
+         n_servers++;
+      }
+   }
+
+   /* getting a server's stream flushes its cursors. if the server is gone
+    * they are left to time out */
+   for (i = 0; i < n_servers; i++) {
+      server_stream = mongoc_cluster_stream_for_server (
+         &client->cluster, server_ids[i], false /* reconnect_ok */, NULL);
+      mongoc_server_stream_cleanup (server_stream); /* null ok */
+   }
+
+   _mongoc_array_clear (queue);
+   bson_free (server_ids);
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -877,16 +1027,49 @@ _mongoc_client_new_from_uri (const mongoc_uri_t *uri,
 void
 mongoc_client_destroy (mongoc_client_t *client)
 {
+   bool single_threaded;
+
    if (client) {
-      if (client->topology->single_threaded) {
+      _mongoc_client_flush_all_killcursors (client);
+      _mongoc_cursor_cache_destroy (client);
+
+      single_threaded = client->topology->single_threaded;
+      if (single_threaded) {
          mongoc_topology_destroy (client->topology);
       }
 
-      mongoc_write_concern_destroy (client->write_concern);
-      mongoc_read_concern_destroy (client->read_concern);
-      mongoc_read_prefs_destroy (client->read_prefs);
+      /* free only what the client set, not the URI's defaults */
+      if (client->write_concern !=
+          mongoc_uri_get_write_concern (client->uri)) {
+         mongoc_write_concern_destroy (client->write_concern);
+      }
+
+      if (client->read_concern != mongoc_uri_get_read_concern (client->uri)) {
+         mongoc_read_concern_destroy (client->read_concern);
+      }
+
+      if (client->read_prefs != mongoc_uri_get_read_prefs_t (client->uri)) {
+         mongoc_read_prefs_destroy (client->read_prefs);
+      }
+
       mongoc_cluster_destroy (&client->cluster);
-      mongoc_uri_destroy (client->uri);
+
+      if (client->metadata_cache) {
+         _mongoc_metadata_cache_destroy (client->metadata_cache);
+      }
+
+      if (client->oid_context) {
+         bson_context_destroy (client->oid_context);
+      }
+
+      mongoc_set_destroy (client->client_sessions);
+
+      if (single_threaded) {
+         mongoc_uri_destroy (client->uri);
+         if (client->budget) {
+            _mongoc_memory_budget_destroy (client->budget);
+         }
+      }
 
 #ifdef MONGOC_ENABLE_SSL
       _mongoc_ssl_opts_cleanup (&client->ssl_opts);
@@ -1157,7 +1340,7 @@ mongoc_client_set_write_concern (mongoc_client_t *client,
    BSON_ASSERT (client);
 
    if (write_concern != client->write_concern) {
-      if (client->write_concern) {
+      if (client->write_concern != mongoc_uri_get_write_concern (client->uri)) {
          mongoc_write_concern_destroy (client->write_concern);
       }
       client->write_concern = write_concern
@@ -1215,7 +1398,7 @@ mongoc_client_set_read_concern (mongoc_client_t *client,
    BSON_ASSERT (client);
 
    if (read_concern != client->read_concern) {
-      if (client->read_concern) {
+      if (client->read_concern != mongoc_uri_get_read_concern (client->uri)) {
          mongoc_read_concern_destroy (client->read_concern);
       }
       client->read_concern = read_concern
@@ -1273,7 +1456,7 @@ mongoc_client_set_read_prefs (mongoc_client_t *client,
    BSON_ASSERT (client);
 
    if (read_prefs != client->read_prefs) {
-      if (client->read_prefs) {
+      if (client->read_prefs != mongoc_uri_get_read_prefs_t (client->uri)) {
          mongoc_read_prefs_destroy (client->read_prefs);
       }
       client->read_prefs = read_prefs
@@ -1316,7 +1499,7 @@ mongoc_client_command (mongoc_client_t *client,
 }
 
 
-static bool
+bool
 _mongoc_client_command_with_stream (mongoc_client_t *client,
                                     mongoc_cmd_parts_t *parts,
                                     mongoc_server_stream_t *server_stream,
@@ -1347,6 +1530,7 @@ mongoc_client_command_simple (mongoc_client_t *client,
    mongoc_cluster_t *cluster;
    mongoc_server_stream_t *server_stream = NULL;
    mongoc_cmd_parts_t parts;
+   bool began;
    bool ret;
 
    ENTRY;
@@ -1360,6 +1544,7 @@ mongoc_client_command_simple (mongoc_client_t *client,
    }
 
    cluster = &client->cluster;
+   began = _mongoc_cluster_deadline_begin (cluster, -1);
    mongoc_cmd_parts_init (&parts, db_name, MONGOC_QUERY_NONE, command);
    parts.read_prefs = read_prefs;
 
@@ -1384,6 +1569,7 @@ mongoc_client_command_simple (mongoc_client_t *client,
 
    mongoc_cmd_parts_cleanup (&parts);
    mongoc_server_stream_cleanup (server_stream);
+   _mongoc_cluster_deadline_end (cluster, began, ret ? NULL : error);
 
    RETURN (ret);
 }
@@ -1471,35 +1657,121 @@ _mongoc_client_command_with_opts (mongoc_client_t *client,
                                   bson_t *reply,
                                   bson_error_t *error)
 {
-   mongoc_cmd_parts_t parts;
-   mongoc_server_stream_t *server_stream = NULL;
-   mongoc_cluster_t *cluster;
-   bson_t reply_local;
-   bson_t *reply_ptr;
-   uint32_t server_id;
-   bool ret = false;
+   mongoc_server_stream_t *server_stream;
+   mongoc_server_stream_t *retry_stream = NULL;
+   mongoc_client_session_t *cs;
+   bson_iter_t iter;
+   int32_t timeout_msec = -1;
+   bool began;
+   bool ret;
 
    ENTRY;
 
-   BSON_ASSERT (client);
-   BSON_ASSERT (db_name);
-   BSON_ASSERT (command);
+   if (opts && bson_iter_init_find (&iter, opts, "timeoutMS") &&
+       BSON_ITER_HOLDS_NUMBER (&iter)) {
+      timeout_msec = (int32_t) BSON_MAX (0, bson_iter_as_int64 (&iter));
+   }
 
-   mongoc_cmd_parts_init (&parts, db_name, flags, command);
-   parts.is_write_command = (mode & MONGOC_CMD_WRITE);
+   began = _mongoc_cluster_deadline_begin (&client->cluster, timeout_msec);
 
-   reply_ptr = reply ? reply : &reply_local;
+   server_stream = _mongoc_client_stream_for_opts (
+      client, opts, mode, default_prefs, error);
 
-   if (mode == MONGOC_CMD_READ) {
-      /* NULL read pref is ok */
-      if (!_mongoc_read_prefs_validate (default_prefs, error)) {
-         GOTO (err);
+   if (!server_stream) {
+      if (reply) {
+         bson_init (reply);
       }
 
-      parts.read_prefs = default_prefs;
-   } else {
-      /* this is a command that writes */
-      default_prefs = NULL;
+      _mongoc_cluster_deadline_end (&client->cluster, began, error);
+      RETURN (false);
+   }
+
+   ret = _mongoc_client_command_with_opts_and_stream (client,
+                                                      db_name,
+                                                      command,
+                                                      mode,
+                                                      opts,
+                                                      flags,
+                                                      default_prefs,
+                                                      default_rc,
+                                                      default_wc,
+                                                      server_stream,
+                                                      reply,
+                                                      error);
+
+   /* a read for a server chosen with "serverId", or a transaction's, isn't
+    * retried elsewhere */
+   if (!ret && mode == MONGOC_CMD_READ &&
+       !(opts && bson_has_field (opts, "serverId")) &&
+       _mongoc_client_session_from_opts (client, opts, &cs, NULL) &&
+       !_mongoc_client_session_in_transaction (cs)) {
+      retry_stream = _mongoc_cluster_stream_for_read_retry (
+         &client->cluster, default_prefs, server_stream, error);
+   }
+
+   if (retry_stream) {
+      if (reply) {
+         bson_destroy (reply);
+      }
+
+      ret = _mongoc_client_command_with_opts_and_stream (client,
+                                                         db_name,
+                                                         command,
+                                                         mode,
+                                                         opts,
+                                                         flags,
+                                                         default_prefs,
+                                                         default_rc,
+                                                         default_wc,
+                                                         retry_stream,
+                                                         reply,
+                                                         error);
+   }
+
+   mongoc_server_stream_cleanup (server_stream);
+   mongoc_server_stream_cleanup (retry_stream);
+   _mongoc_cluster_deadline_end (&client->cluster, began, ret ? NULL : error);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_stream_for_opts --
+ *
+ *       Select the server for _mongoc_client_command_with_opts: the one
+ *       with the "serverId" in @opts, if any, or the transaction's if the
+ *       session in @opts is in one, otherwise a primary for commands
+ *       that write or one suitable for @read_prefs for reads.
+ *
+ * Returns:
+ *       A server stream, or NULL and @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_server_stream_t *
+_mongoc_client_stream_for_opts (mongoc_client_t *client,
+                                const bson_t *opts,
+                                mongoc_command_mode_t mode,
+                                const mongoc_read_prefs_t *read_prefs,
+                                bson_error_t *error)
+{
+   mongoc_cluster_t *cluster;
+   mongoc_client_session_t *cs;
+   mongoc_read_prefs_t *session_prefs;
+   mongoc_server_stream_t *server_stream;
+   uint32_t server_id;
+
+   BSON_ASSERT (client);
+
+   if ((mode & MONGOC_CMD_WRITE) == 0) {
+      /* NULL read pref is ok */
+      if (!_mongoc_read_prefs_validate (read_prefs, error)) {
+         return NULL;
+      }
    }
 
    cluster = &client->cluster;
@@ -1508,80 +1780,174 @@ _mongoc_client_command_with_opts (mongoc_client_t *client,
                                          MONGOC_ERROR_COMMAND_INVALID_ARG,
                                          &server_id,
                                          error)) {
-      GOTO (err);
+      return NULL;
+   }
+
+   if (!_mongoc_client_session_from_opts (client, opts, &cs, error)) {
+      return NULL;
    }
 
    if (server_id) {
       /* "serverId" passed in opts */
-      server_stream = mongoc_cluster_stream_for_server (
+      return mongoc_cluster_stream_for_server (
          cluster, server_id, true /* reconnect ok */, error);
+   } else if (_mongoc_client_session_in_transaction (cs)) {
+      /* where the transaction's first statement went */
+      return _mongoc_client_session_stream (cs, error);
+   } else if (mode & MONGOC_CMD_WRITE) {
+      return mongoc_cluster_stream_for_writes (cluster, error);
+   }
+
+   /* in a causally consistent session, prefer caught-up secondaries */
+   session_prefs = _mongoc_client_session_read_prefs (cs, read_prefs);
+   server_stream = mongoc_cluster_stream_for_reads (
+      cluster, COALESCE (session_prefs, read_prefs), error);
+   mongoc_read_prefs_destroy (session_prefs);
+
+   return server_stream;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_command_append_opts --
+ *
+ *       Append @opts to @parts->extra for @server_stream, and the default
+ *       write concern and read concern unless @opts has its own.
+ *
+ * Returns:
+ *       True on success, false and @error is set if @opts are invalid.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_client_command_append_opts (mongoc_cmd_parts_t *parts,
+                                    mongoc_command_mode_t mode,
+                                    const bson_t *opts,
+                                    mongoc_read_concern_t *default_rc,
+                                    mongoc_write_concern_t *default_wc,
+                                    const mongoc_server_stream_t *server_stream,
+                                    bson_error_t *error)
+{
+   bson_iter_t iter;
 
-      if (server_stream && server_stream->sd->type != MONGOC_SERVER_MONGOS) {
-         parts.user_query_flags |= MONGOC_QUERY_SLAVE_OK;
+   if (opts && bson_iter_init (&iter, opts)) {
+      if (!mongoc_cmd_parts_append_opts (
+             parts, &iter, server_stream->sd->max_wire_version, error)) {
+         return false;
       }
-   } else if (parts.is_write_command) {
-      server_stream = mongoc_cluster_stream_for_writes (cluster, error);
-   } else {
-      server_stream =
-         mongoc_cluster_stream_for_reads (cluster, default_prefs, error);
    }
 
-   if (server_stream) {
-      bson_iter_t iter;
+   /* use default write concern unless it's in opts */
+   if ((mode & MONGOC_CMD_WRITE) &&
+       server_stream->sd->max_wire_version >= WIRE_VERSION_CMD_WRITE_CONCERN &&
+       !mongoc_write_concern_is_default (default_wc) &&
+       (!opts || !bson_has_field (opts, "writeConcern"))) {
+      bson_append_document (&parts->extra,
+                            "writeConcern",
+                            12,
+                            _mongoc_write_concern_get_bson (default_wc));
+   }
 
-      if (opts && bson_iter_init (&iter, opts)) {
-         if (!mongoc_cmd_parts_append_opts (
-                &parts, &iter, server_stream->sd->max_wire_version, error)) {
-            GOTO (err);
-         }
-      }
+   /* use read prefs and read concern for read commands, unless in opts */
+   if ((mode & MONGOC_CMD_READ) &&
+       server_stream->sd->max_wire_version >= WIRE_VERSION_READ_CONCERN &&
+       !mongoc_read_concern_is_default (default_rc) &&
+       (!opts || !bson_has_field (opts, "readConcern"))) {
+      bson_append_document (&parts->extra,
+                            "readConcern",
+                            11,
+                            _mongoc_read_concern_get_bson (default_rc));
+   }
 
-      /* use default write concern unless it's in opts */
-      if ((mode & MONGOC_CMD_WRITE) &&
-          server_stream->sd->max_wire_version >=
-             WIRE_VERSION_CMD_WRITE_CONCERN &&
-          !mongoc_write_concern_is_default (default_wc) &&
-          (!opts || !bson_has_field (opts, "writeConcern"))) {
-         bson_append_document (&parts.extra,
-                               "writeConcern",
-                               12,
-                               _mongoc_write_concern_get_bson (default_wc));
-      }
+   return true;
+}
 
-      /* use read prefs and read concern for read commands, unless in opts */
-      if ((mode & MONGOC_CMD_READ) &&
-          server_stream->sd->max_wire_version >= WIRE_VERSION_READ_CONCERN &&
-          !mongoc_read_concern_is_default (default_rc) &&
-          (!opts || !bson_has_field (opts, "readConcern"))) {
-         bson_append_document (&parts.extra,
-                               "readConcern",
-                               11,
-                               _mongoc_read_concern_get_bson (default_rc));
-      }
 
-      ret = _mongoc_client_command_with_stream (
-         client, &parts, server_stream, reply_ptr, error);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_command_with_opts_and_stream --
+ *
+ *       Like _mongoc_client_command_with_opts, on @server_stream from
+ *       _mongoc_client_stream_for_opts, for callers that must check the
+ *       server before they choose how to run a command.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-      if (ret && (mode & MONGOC_CMD_WRITE)) {
-         ret = !_mongoc_parse_wc_err (reply_ptr, error);
-      }
-      if (reply_ptr == &reply_local) {
-         bson_destroy (reply_ptr);
+bool
+_mongoc_client_command_with_opts_and_stream (
+   mongoc_client_t *client,
+   const char *db_name,
+   const bson_t *command,
+   mongoc_command_mode_t mode,
+   const bson_t *opts,
+   mongoc_query_flags_t flags,
+   const mongoc_read_prefs_t *default_prefs,
+   mongoc_read_concern_t *default_rc,
+   mongoc_write_concern_t *default_wc,
+   mongoc_server_stream_t *server_stream,
+   bson_t *reply,
+   bson_error_t *error)
+{
+   mongoc_cmd_parts_t parts;
+   bson_t reply_local;
+   bson_t *reply_ptr;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (db_name);
+   BSON_ASSERT (command);
+   BSON_ASSERT (server_stream);
+
+   mongoc_cmd_parts_init (&parts, db_name, flags, command);
+   parts.is_write_command = (mode & MONGOC_CMD_WRITE);
+
+   reply_ptr = reply ? reply : &reply_local;
+
+   if (!_mongoc_client_session_from_opts (
+          client, opts, &parts.session, error)) {
+      if (reply) {
+         bson_init (reply);
       }
+
       GOTO (done);
    }
 
-err:
-   if (reply) {
-      bson_init (reply);
+   if (mode == MONGOC_CMD_READ) {
+      parts.read_prefs = default_prefs;
    }
 
-done:
+   if (opts && bson_has_field (opts, "serverId") &&
+       server_stream->sd->type != MONGOC_SERVER_MONGOS) {
+      parts.user_query_flags |= MONGOC_QUERY_SLAVE_OK;
+   }
 
-   if (server_stream) {
-      mongoc_server_stream_cleanup (server_stream);
+   if (!_mongoc_client_command_append_opts (
+          &parts, mode, opts, default_rc, default_wc, server_stream, error)) {
+      if (reply) {
+         bson_init (reply);
+      }
+
+      GOTO (done);
+   }
+
+   ret = _mongoc_client_command_with_stream (
+      client, &parts, server_stream, reply_ptr, error);
+
+   if (ret && (mode & MONGOC_CMD_WRITE)) {
+      ret = !_mongoc_parse_wc_err (reply_ptr, error);
+   }
+   if (reply_ptr == &reply_local) {
+      bson_destroy (reply_ptr);
    }
 
+done:
    mongoc_cmd_parts_cleanup (&parts);
 
    RETURN (ret);
@@ -1612,6 +1978,130 @@ mongoc_client_read_command_with_opts (mongoc_client_t *client,
 }
 
 
+bool
+mongoc_client_read_commands_pipelined (mongoc_client_t *client,
+                                       const char *db_name,
+                                       const bson_t **commands,
+                                       size_t n_commands,
+                                       const mongoc_read_prefs_t *read_prefs,
+                                       bson_t *replies,
+                                       bson_error_t *error)
+{
+   mongoc_cluster_t *cluster;
+   mongoc_server_stream_t *server_stream = NULL;
+   mongoc_cmd_parts_t *parts;
+   mongoc_cmd_t **cmds;
+   bson_error_t *errors;
+   size_t n_parts = 0;
+   size_t i;
+   bool ran = false;
+   bool ret = false;
+   bool r;
+
+   ENTRY;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (db_name);
+   BSON_ASSERT (commands || !n_commands);
+   BSON_ASSERT (replies || !n_commands);
+
+   if (!n_commands) {
+      RETURN (true);
+   }
+
+   cluster = &client->cluster;
+   read_prefs = COALESCE (read_prefs, client->read_prefs);
+   parts = (mongoc_cmd_parts_t *) bson_malloc0 (n_commands *
+                                                sizeof (mongoc_cmd_parts_t));
+   cmds = (mongoc_cmd_t **) bson_malloc0 (n_commands * sizeof (mongoc_cmd_t *));
+   errors =
+      (bson_error_t *) bson_malloc0 (n_commands * sizeof (bson_error_t));
+
+   if (!_mongoc_read_prefs_validate (read_prefs, error)) {
+      GOTO (done);
+   }
+
+   server_stream = mongoc_cluster_stream_for_reads (cluster, read_prefs, error);
+   if (!server_stream) {
+      GOTO (done);
+   }
+
+   for (n_parts = 0; n_parts < n_commands;) {
+      i = n_parts++;
+      mongoc_cmd_parts_init (
+         &parts[i], db_name, MONGOC_QUERY_NONE, commands[i]);
+      parts[i].read_prefs = read_prefs;
+
+      if (server_stream->sd->max_wire_version >= WIRE_VERSION_READ_CONCERN &&
+          !mongoc_read_concern_is_default (client->read_concern) &&
+          !bson_has_field (commands[i], "readConcern")) {
+         bson_append_document (
+            &parts[i].extra,
+            "readConcern",
+            11,
+            _mongoc_read_concern_get_bson (client->read_concern));
+      }
+
+      parts[i].assembled.operation_id = ++cluster->operation_id;
+      if (!mongoc_cmd_parts_assemble (&parts[i], server_stream, error)) {
+         GOTO (done);
+      }
+
+      cmds[i] = &parts[i].assembled;
+   }
+
+   ran = true;
+
+   if (server_stream->sd->max_wire_version >= WIRE_VERSION_OP_MSG) {
+      ret = _mongoc_cluster_run_opmsg_pipelined (
+         cluster, cmds, n_commands, replies, errors);
+   } else {
+      /* no OP_MSG, run the commands one at a time */
+      ret = true;
+      for (i = 0; i < n_commands; i++) {
+         if (i > 0 && errors[i - 1].domain == MONGOC_ERROR_STREAM) {
+            /* the connection is gone */
+            bson_init (&replies[i]);
+            memcpy (&errors[i], &errors[i - 1], sizeof (bson_error_t));
+            continue;
+         }
+
+         r = mongoc_cluster_run_command_monitored (
+            cluster, cmds[i], &replies[i], &errors[i]);
+         ret = ret && r;
+      }
+   }
+
+   if (!ret && error) {
+      /* report the first failure */
+      for (i = 0; i < n_commands; i++) {
+         if (errors[i].code) {
+            memcpy (error, &errors[i], sizeof (bson_error_t));
+            break;
+         }
+      }
+   }
+
+done:
+   if (!ran) {
+      for (i = 0; i < n_commands; i++) {
+         bson_init (&replies[i]);
+      }
+   }
+
+   for (i = 0; i < n_parts; i++) {
+      mongoc_cmd_parts_cleanup (&parts[i]);
+   }
+
+   mongoc_server_stream_cleanup (server_stream);
+   bson_free (errors);
+   bson_free (cmds);
+   bson_free (parts);
+
+   RETURN (ret);
+}
+
+
 bool
 mongoc_client_write_command_with_opts (mongoc_client_t *client,
                                        const char *db_name,
@@ -1671,6 +2161,7 @@ mongoc_client_command_simple_with_server_id (
 {
    mongoc_server_stream_t *server_stream;
    mongoc_cmd_parts_t parts;
+   bool began;
    bool ret;
 
    ENTRY;
@@ -1686,6 +2177,7 @@ mongoc_client_command_simple_with_server_id (
    mongoc_cmd_parts_init (&parts, db_name, MONGOC_QUERY_NONE, command);
    parts.read_prefs = read_prefs;
 
+   began = _mongoc_cluster_deadline_begin (&client->cluster, -1);
    server_stream = mongoc_cluster_stream_for_server (
       &client->cluster, server_id, true /* reconnect ok */, error);
 
@@ -1694,14 +2186,17 @@ mongoc_client_command_simple_with_server_id (
          client, &parts, server_stream, reply, error);
 
       mongoc_server_stream_cleanup (server_stream);
-      RETURN (ret);
    } else {
       if (reply) {
          bson_init (reply);
       }
 
-      RETURN (false);
+      ret = false;
    }
+
+   _mongoc_cluster_deadline_end (&client->cluster, began, ret ? NULL : error);
+
+   RETURN (ret);
 }
 
 
@@ -1728,12 +2223,24 @@ _mongoc_client_kill_cursor (mongoc_client_t *client,
                             const char *collection)
 {
    mongoc_server_stream_t *server_stream;
+   mongoc_cluster_dead_cursor_t dead;
+   bson_t command = BSON_INITIALIZER;
 
    ENTRY;
 
    BSON_ASSERT (client);
    BSON_ASSERT (cursor_id);
 
+   if (client->cluster.defer_killcursors && db && collection) {
+      /* killed with others before the next operation on this server */
+      dead.server_id = server_id;
+      dead.cursor_id = cursor_id;
+      bson_strncpy (dead.db, db, sizeof dead.db);
+      bson_strncpy (dead.collection, collection, sizeof dead.collection);
+      _mongoc_array_append_val (&client->cluster.dead_cursors, dead);
+      EXIT;
+   }
+
    /* don't attempt reconnect if server unavailable, and ignore errors */
    server_stream = mongoc_cluster_stream_for_server (
       &client->cluster, server_id, false /* reconnect_ok */, NULL /* error */);
@@ -1744,8 +2251,10 @@ _mongoc_client_kill_cursor (mongoc_client_t *client,
 
    if (db && collection &&
        server_stream->sd->max_wire_version >= WIRE_VERSION_KILLCURSORS_CMD) {
+      _mongoc_client_prepare_killcursors_command (
+         cursor_id, collection, &command);
       _mongoc_client_killcursors_command (
-         &client->cluster, server_stream, cursor_id, db, collection);
+         &client->cluster, server_stream, db, &command);
    } else {
       _mongoc_client_op_killcursors (&client->cluster,
                                      server_stream,
@@ -1755,12 +2264,111 @@ _mongoc_client_kill_cursor (mongoc_client_t *client,
                                      collection);
    }
 
+   bson_destroy (&command);
    mongoc_server_stream_cleanup (server_stream);
 
    EXIT;
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_flush_killcursors --
+ *
+ *       With "deferKillCursors", kill the cursors destroyed on
+ *       @server_stream's server since it was last used, with one
+ *       "killCursors" command per collection.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_client_flush_killcursors (mongoc_client_t *client,
+                                  mongoc_server_stream_t *server_stream)
+{
+   mongoc_array_t *queue = &client->cluster.dead_cursors;
+   mongoc_array_t dead_cursors;
+   mongoc_cluster_dead_cursor_t *dead;
+   mongoc_cluster_dead_cursor_t *other;
+   bson_t command;
+   bson_t child;
+   const char *key;
+   char buf[16];
+   uint32_t n;
+   size_t i;
+   size_t j;
+
+   ENTRY;
+
+   /* take this server's cursors from the queue before sending anything */
+   _mongoc_array_init (&dead_cursors, sizeof (mongoc_cluster_dead_cursor_t));
+   for (i = 0, j = 0; i < queue->len; i++) {
+      dead = &_mongoc_array_index (queue, mongoc_cluster_dead_cursor_t, i);
+      if (dead->server_id == server_stream->sd->id) {
+         _mongoc_array_append_vals (&dead_cursors, dead, 1);
+      } else {
+         if (i != j) {
+            memcpy (&_mongoc_array_index (
+                       queue, mongoc_cluster_dead_cursor_t, j),
+                    dead,
+                    sizeof *dead);
+         }
+
+         j++;
+      }
+   }
+
+   queue->len = j;
+
+   for (i = 0; i < dead_cursors.len; i++) {
+      dead =
+         &_mongoc_array_index (&dead_cursors, mongoc_cluster_dead_cursor_t, i);
+
+      if (!dead->cursor_id) {
+         /* killed with an earlier cursor on its collection */
+         continue;
+      }
+
+      if (server_stream->sd->max_wire_version < WIRE_VERSION_KILLCURSORS_CMD) {
+         _mongoc_client_op_killcursors (&client->cluster,
+                                        server_stream,
+                                        dead->cursor_id,
+                                        ++client->cluster.operation_id,
+                                        dead->db,
+                                        dead->collection);
+         continue;
+      }
+
+      bson_init (&command);
+      bson_append_utf8 (&command, "killCursors", 11, dead->collection, -1);
+      bson_append_array_begin (&command, "cursors", 7, &child);
+      n = 0;
+      for (j = i; j < dead_cursors.len; j++) {
+         other = &_mongoc_array_index (
+            &dead_cursors, mongoc_cluster_dead_cursor_t, j);
+         if (other->cursor_id && !strcmp (other->db, dead->db) &&
+             !strcmp (other->collection, dead->collection)) {
+            bson_uint32_to_string (n++, &key, buf, sizeof buf);
+            bson_append_int64 (&child, key, -1, other->cursor_id);
+            if (j > i) {
+               other->cursor_id = 0;
+            }
+         }
+      }
+
+      bson_append_array_end (&command, &child);
+      _mongoc_client_killcursors_command (
+         &client->cluster, server_stream, dead->db, &command);
+      bson_destroy (&command);
+   }
+
+   _mongoc_array_destroy (&dead_cursors);
+
+   EXIT;
+}
+
+
 static void
 _mongoc_client_monitor_op_killcursors (mongoc_cluster_t *cluster,
                                        mongoc_server_stream_t *server_stream,
@@ -1777,7 +2385,8 @@ _mongoc_client_monitor_op_killcursors (mongoc_cluster_t *cluster,
 
    client = cluster->client;
 
-   if (!client->apm_callbacks.started) {
+   if (!client->apm_callbacks.started ||
+       !_mongoc_apm_command_sampled (&client->apm_callbacks, operation_id)) {
       return;
    }
 
@@ -1818,7 +2427,8 @@ _mongoc_client_monitor_op_killcursors_succeeded (
 
    client = cluster->client;
 
-   if (!client->apm_callbacks.succeeded) {
+   if (!client->apm_callbacks.succeeded ||
+       !_mongoc_apm_command_sampled (&client->apm_callbacks, operation_id)) {
       EXIT;
    }
 
@@ -1861,7 +2471,8 @@ _mongoc_client_monitor_op_killcursors_failed (
 
    client = cluster->client;
 
-   if (!client->apm_callbacks.failed) {
+   if (!client->apm_callbacks.failed ||
+       !_mongoc_apm_command_sampled (&client->apm_callbacks, operation_id)) {
       EXIT;
    }
 
@@ -1940,17 +2551,14 @@ _mongoc_client_op_killcursors (mongoc_cluster_t *cluster,
 static void
 _mongoc_client_killcursors_command (mongoc_cluster_t *cluster,
                                     mongoc_server_stream_t *server_stream,
-                                    int64_t cursor_id,
                                     const char *db,
-                                    const char *collection)
+                                    const bson_t *command)
 {
-   bson_t command = BSON_INITIALIZER;
    mongoc_cmd_parts_t parts;
 
    ENTRY;
 
-   _mongoc_client_prepare_killcursors_command (cursor_id, collection, &command);
-   mongoc_cmd_parts_init (&parts, db, MONGOC_QUERY_SLAVE_OK, &command);
+   mongoc_cmd_parts_init (&parts, db, MONGOC_QUERY_SLAVE_OK, command);
    parts.assembled.operation_id = ++cluster->operation_id;
 
    if (mongoc_cmd_parts_assemble (&parts, server_stream, NULL)) {
@@ -1962,7 +2570,6 @@ _mongoc_client_killcursors_command (mongoc_cluster_t *cluster,
    }
 
    mongoc_cmd_parts_cleanup (&parts);
-   bson_destroy (&command);
 
    EXIT;
 }
@@ -2246,6 +2853,69 @@ mongoc_server_descriptions_destroy_all (mongoc_server_description_t **sds,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_get_connection_stats --
+ *
+ *       Snapshot the connections @client holds, ordered by server id. A
+ *       single-threaded client's connections belong to its topology
+ *       scanner and aren't listed, nor are a pool's shared idle
+ *       connections until a client takes one.
+ *
+ * Returns:
+ *       An array of *@n structs, to be freed with bson_free, or NULL if
+ *       there are none.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_connection_stats_t *
+mongoc_client_get_connection_stats (mongoc_client_t *client,
+                                    size_t *n /* OUT */)
+{
+   mongoc_set_t *nodes;
+   mongoc_cluster_node_t *node;
+   mongoc_connection_stats_t *stats;
+   int64_t now;
+   size_t i;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (n);
+
+   nodes = client->cluster.nodes;
+   *n = 0;
+
+   if (client->topology->single_threaded || !nodes->items_len) {
+      return NULL;
+   }
+
+   stats = (mongoc_connection_stats_t *) bson_malloc0 (nodes->items_len *
+                                                       sizeof *stats);
+   now = bson_get_monotonic_time ();
+
+   for (i = 0; i < nodes->items_len; i++) {
+      node = (mongoc_cluster_node_t *) nodes->items[i].item;
+
+      stats[i].server_id = nodes->items[i].id;
+      bson_strncpy (stats[i].host_and_port,
+                    node->connection_address,
+                    sizeof stats[i].host_and_port);
+      stats[i].age_msec = (now - node->timestamp) / 1000;
+      stats[i].idle_msec = (now - node->last_used) / 1000;
+      stats[i].ops = node->ops;
+      stats[i].egress_bytes = node->egress_bytes;
+      stats[i].ingress_bytes = node->ingress_bytes;
+      stats[i].round_trip_time_usec = node->rtt_usec;
+      stats[i].in_use_usec = node->in_use_usec;
+   }
+
+   *n = nodes->items_len;
+
+   return stats;
+}
+
+
 mongoc_server_description_t *
 mongoc_client_select_server (mongoc_client_t *client,
                              bool for_writes,
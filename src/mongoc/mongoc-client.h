@@ -100,6 +100,26 @@ typedef mongoc_stream_t *(*mongoc_stream_initiator_t) (
    bson_error_t *error);
 
 
+/**
+ * mongoc_connection_stats_t:
+ *
+ * A snapshot of one of a client's connections, filled in by
+ * mongoc_client_get_connection_stats.
+ */
+typedef struct {
+   uint32_t server_id;
+   char host_and_port[BSON_HOST_NAME_MAX + 7];
+   int64_t age_msec;
+   int64_t idle_msec;
+   int64_t ops;
+   int64_t egress_bytes;
+   int64_t ingress_bytes;
+   int64_t round_trip_time_usec;
+   int64_t in_use_usec;
+   void *padding[8];
+} mongoc_connection_stats_t;
+
+
 MONGOC_EXPORT (mongoc_client_t *)
 mongoc_client_new (const char *uri_string);
 MONGOC_EXPORT (mongoc_client_t *)
@@ -110,6 +130,11 @@ MONGOC_EXPORT (void)
 mongoc_client_set_stream_initiator (mongoc_client_t *client,
                                     mongoc_stream_initiator_t initiator,
                                     void *user_data);
+MONGOC_EXPORT (mongoc_stream_t *)
+mongoc_client_default_stream_initiator (const mongoc_uri_t *uri,
+                                        const mongoc_host_list_t *host,
+                                        void *user_data,
+                                        bson_error_t *error);
 MONGOC_EXPORT (mongoc_cursor_t *)
 mongoc_client_command (mongoc_client_t *client,
                        const char *db_name,
@@ -147,6 +172,14 @@ mongoc_client_read_command_with_opts (mongoc_client_t *client,
                                       bson_t *reply,
                                       bson_error_t *error);
 MONGOC_EXPORT (bool)
+mongoc_client_read_commands_pipelined (mongoc_client_t *client,
+                                       const char *db_name,
+                                       const bson_t **commands,
+                                       size_t n_commands,
+                                       const mongoc_read_prefs_t *read_prefs,
+                                       bson_t *replies,
+                                       bson_error_t *error);
+MONGOC_EXPORT (bool)
 mongoc_client_write_command_with_opts (mongoc_client_t *client,
                                        const char *db_name,
                                        const bson_t *command,
@@ -237,6 +270,8 @@ mongoc_client_get_server_descriptions (const mongoc_client_t *client,
 MONGOC_EXPORT (void)
 mongoc_server_descriptions_destroy_all (mongoc_server_description_t **sds,
                                         size_t n);
+MONGOC_EXPORT (mongoc_connection_stats_t *)
+mongoc_client_get_connection_stats (mongoc_client_t *client, size_t *n);
 MONGOC_EXPORT (mongoc_server_description_t *)
 mongoc_client_select_server (mongoc_client_t *client,
                              bool for_writes,
@@ -246,6 +281,10 @@ MONGOC_EXPORT (bool)
 mongoc_client_set_error_api (mongoc_client_t *client, int32_t version);
 MONGOC_EXPORT (bool)
 mongoc_client_set_appname (mongoc_client_t *client, const char *appname);
+MONGOC_EXPORT (void)
+mongoc_client_invalidate_metadata_cache (mongoc_client_t *client,
+                                         const char *db,
+                                         const char *collection);
 BSON_END_DECLS
 
 
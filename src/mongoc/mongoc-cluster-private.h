@@ -24,6 +24,8 @@
 #include <bson.h>
 
 #include "mongoc-array-private.h"
+#include "mongoc-arena-private.h"
+#include "mongoc-async-private.h"
 #include "mongoc-buffer-private.h"
 #include "mongoc-config.h"
 #include "mongoc-client.h"
@@ -38,9 +40,35 @@
 #include "mongoc-write-concern.h"
 #include "mongoc-scram-private.h"
 #include "mongoc-cmd-private.h"
+#include "mongoc-compression-private.h"
 
 BSON_BEGIN_DECLS
 
+/* reads a reply that an earlier operation left on a connection, see
+ * _mongoc_cluster_set_pending */
+typedef void (*mongoc_cluster_pending_cb_t) (void *ctx);
+
+/* with "deferKillCursors", a destroyed cursor waits here to be killed
+ * before the next operation on its server */
+typedef struct _mongoc_cluster_dead_cursor_t {
+   uint32_t server_id;
+   int64_t cursor_id;
+   char db[MONGOC_NAMESPACE_MAX];
+   char collection[MONGOC_NAMESPACE_MAX];
+} mongoc_cluster_dead_cursor_t;
+
+/* the phases timed so far for the next command's span, see
+ * mongoc_apm_set_command_span_cb */
+typedef struct _mongoc_cluster_span_t {
+   int64_t start_time; /* when the first phase began, or 0 */
+   int64_t phases[MONGOC_APM_SPAN_LAST];
+   /* handshakes and auth count as the connection phase, not broken down */
+   bool connecting;
+} mongoc_cluster_span_t;
+
+/* reply buffers that grow past replyBufferMaxSize are freed after use */
+#define MONGOC_DEFAULT_REPLY_BUFFER_MAX_SIZE (16 * 1024 * 1024)
+
 
 typedef struct _mongoc_cluster_node_t {
    mongoc_stream_t *stream;
@@ -53,8 +81,58 @@ typedef struct _mongoc_cluster_node_t {
    int32_t max_msg_size;
 
    int64_t timestamp;
+   /* monotonic time of the last checkout, for maxIdleTimeMS */
+   int64_t last_used;
+   /* maxConnectionLifetimeMS: when to close this connection, or 0 */
+   int64_t expire_at;
+   /* with shared connections: the server's generation at connect time */
+   uint32_t generation;
+   /* counts this connection in the server's counters until destroyed */
+   mongoc_server_counters_ref_t counters;
+   uint32_t server_id;
+
+   /* for mongoc_client_get_connection_stats */
+   int64_t ops;
+   int64_t egress_bytes;
+   int64_t ingress_bytes;
+   int64_t sent_at; /* when the last message was sent, until its reply */
+   int64_t rtt_usec;
+   int64_t in_use_usec;
+
+   /* the connecting client's connection-closed callback, copied since a
+    * shared connection may outlive the client */
+   mongoc_apm_connection_closed_cb_t closed_cb;
+   void *apm_context;
+   mongoc_apm_connection_closed_reason_t close_reason;
 } mongoc_cluster_node_t;
 
+/* creates the client that the shared connections' establishers use */
+typedef mongoc_client_t *(*mongoc_cluster_shared_client_cb_t) (void *ctx);
+
+/* idle connections to each server, shared by all clusters in a client pool
+ * when the "sharedConnections" URI option is set.
+ *
+ * new connections are established by max_connecting background threads,
+ * at most max_connecting to a server at once. a client that needs one
+ * waits on cond for whichever comes first, the new connection or one
+ * released by another client. */
+typedef struct _mongoc_cluster_shared_t {
+   mongoc_mutex_t mutex;
+   mongoc_set_t *servers;
+   uint32_t generation;
+   mongoc_cond_t cond;
+   uint32_t n_waiting;
+   int32_t max_connecting;
+   mongoc_array_t requests; /* server ids and generations to connect */
+   mongoc_cond_t cond_requests;
+   bool started;
+   bool shutdown;
+   mongoc_thread_t *establishers;
+   mongoc_client_t *client; /* owned, the establishers connect with it */
+   mongoc_cluster_shared_client_cb_t client_cb;
+   void *client_ctx;
+} mongoc_cluster_shared_t;
+
 typedef struct _mongoc_cluster_t {
    int64_t operation_id;
    uint32_t request_id;
@@ -63,13 +141,73 @@ typedef struct _mongoc_cluster_t {
    uint8_t scram_server_key[MONGOC_SCRAM_HASH_SIZE];
    uint8_t scram_salted_password[MONGOC_SCRAM_HASH_SIZE];
    uint32_t socketcheckintervalms;
-   mongoc_uri_t *uri;
+   bool socketchecklocal; /* poll and peek before falling back to ping */
+   uint32_t maxidletimems;
+   uint32_t maxlifetimems; /* maxConnectionLifetimeMS */
+   const mongoc_uri_t *uri; /* the client's */
    unsigned requires_auth : 1;
 
    mongoc_client_t *client;
 
    mongoc_set_t *nodes;
+   mongoc_cluster_shared_t *shared; /* borrowed from the pool, or NULL */
+   /* standbyConnections without sharedConnections: idle connections a
+    * client takes over the first time it uses a server. borrowed from the
+    * pool, or NULL */
+   mongoc_cluster_shared_t *standby;
+   /* with shared connections: the connection kept out of shared for the
+    * statements of sessions' transactions, see _mongoc_cluster_pin */
+   mongoc_cluster_node_t *pinned;
+   uint32_t n_pinned;
    mongoc_array_t iov;
+   /* each operation's server stream and scratch arrays */
+   mongoc_arena_t arena;
+   mongoc_compress_scratch_t compress; /* for _mongoc_rpc_compress */
+   mongoc_compress_history_t compress_history; /* compressionAdaptive */
+   /* compressionMinRTTMS, compressionOutsideZone, and compressionHosts:
+    * which servers get compressed messages, see
+    * _mongoc_cluster_compressor_id. compression_policy is false if none
+    * is set, and every server that accepts compression gets it */
+   bool compression_policy;
+   int32_t compression_min_rtt_msec;
+   bool compression_outside_zone;
+   const char *compression_hosts; /* points into the URI */
+
+   /* reused to read and decompress each reply, see
+    * _mongoc_cluster_trim_reply_buffers */
+   mongoc_buffer_t reply_buffer;
+   uint8_t *decompress_buffer;
+   size_t decompress_buffer_len;
+   size_t reply_buffer_max_size;
+
+   /* charged for the buffers above, or NULL. see memoryBudgetMB */
+   mongoc_memory_budget_t *budget;
+
+   /* set while a reply is still unread on a connection */
+   mongoc_cluster_pending_cb_t pending_cb;
+   void *pending_ctx;
+
+   /* mongoc_cluster_dead_cursor_t, killed in batches if deferKillCursors */
+   bool defer_killcursors;
+   mongoc_array_t dead_cursors;
+
+   mongoc_cluster_span_t span;
+
+   /* commands taking at least this long are logged, or -1 */
+   int64_t slow_op_threshold_usec;
+
+   /* "retryWrites": retry eligible OP_MSG writes once on a new primary */
+   bool retry_writes;
+   /* "retryReads": retry cursor-creating and read commands once */
+   bool retry_reads;
+   /* "opmsgChecksum": append a CRC-32C to each OP_MSG sent */
+   bool opmsg_checksum;
+
+   /* "timeoutMS": how long each operation may take in all, or 0 */
+   int32_t timeout_msec;
+   /* when the current operation must be done, or 0 if it has no time
+    * limit. see _mongoc_cluster_deadline_begin */
+   int64_t deadline;
 } mongoc_cluster_t;
 
 void
@@ -80,6 +218,13 @@ mongoc_cluster_init (mongoc_cluster_t *cluster,
 void
 mongoc_cluster_destroy (mongoc_cluster_t *cluster);
 
+void
+_mongoc_cluster_reset_after_fork (mongoc_cluster_t *cluster);
+
+void
+_mongoc_cluster_set_budget (mongoc_cluster_t *cluster,
+                            mongoc_memory_budget_t *budget);
+
 void
 mongoc_cluster_disconnect_node (mongoc_cluster_t *cluster,
                                 uint32_t id,
@@ -101,6 +246,76 @@ _mongoc_cluster_buffer_iovec (mongoc_iovec_t *iov,
 bool
 mongoc_cluster_check_interval (mongoc_cluster_t *cluster, uint32_t server_id);
 
+void
+_mongoc_cluster_span_client_checkout (mongoc_cluster_t *cluster,
+                                      int64_t started);
+
+mongoc_cluster_shared_t *
+_mongoc_cluster_shared_new (int32_t max_connecting,
+                            mongoc_cluster_shared_client_cb_t client_cb,
+                            void *client_ctx);
+
+void
+_mongoc_cluster_shared_destroy (mongoc_cluster_shared_t *shared);
+
+void
+_mongoc_cluster_shared_reset_after_fork (mongoc_cluster_shared_t *shared);
+
+void
+_mongoc_cluster_shared_release (mongoc_cluster_shared_t *shared,
+                                uint32_t server_id,
+                                mongoc_cluster_node_t *node);
+
+void
+_mongoc_cluster_pin (mongoc_cluster_t *cluster,
+                     mongoc_server_stream_t *server_stream);
+
+void
+_mongoc_cluster_unpin (mongoc_cluster_t *cluster);
+
+uint32_t
+_mongoc_cluster_shared_reap_idle (mongoc_cluster_shared_t *shared,
+                                  int64_t now,
+                                  uint32_t maxidletimems,
+                                  mongoc_array_t *reaped);
+
+void
+_mongoc_cluster_shared_top_up (mongoc_cluster_shared_t *shared,
+                               const mongoc_topology_description_t *td,
+                               int32_t count);
+
+bool
+_mongoc_cluster_warm (mongoc_cluster_t **clusters,
+                      size_t n_clusters,
+                      const uint32_t *server_ids,
+                      size_t n_server_ids,
+                      bson_error_t *error);
+
+/* receives a new, authenticated node, or NULL and why it failed */
+typedef void (*mongoc_cluster_connect_cb_t) (mongoc_cluster_node_t *node,
+                                             const bson_error_t *error,
+                                             void *ctx);
+
+void
+_mongoc_cluster_connect_async (mongoc_cluster_t *cluster,
+                               mongoc_async_t *async,
+                               uint32_t server_id,
+                               mongoc_cluster_connect_cb_t cb,
+                               void *ctx);
+
+void
+_mongoc_cluster_node_destroy (mongoc_cluster_node_t *node);
+
+uint32_t
+_mongoc_cluster_reap_idle_nodes (mongoc_cluster_t *cluster,
+                                 int64_t now,
+                                 mongoc_array_t *reaped);
+
+void
+_mongoc_cluster_node_released (mongoc_cluster_t *cluster,
+                               uint32_t server_id,
+                               mongoc_stream_t *stream);
+
 bool
 mongoc_cluster_legacy_rpc_sendv_to_server (
    mongoc_cluster_t *cluster,
@@ -124,6 +339,34 @@ mongoc_server_stream_t *
 mongoc_cluster_stream_for_writes (mongoc_cluster_t *cluster,
                                   bson_error_t *error);
 
+bool
+_mongoc_cluster_deadline_begin (mongoc_cluster_t *cluster,
+                                int32_t timeout_msec);
+
+void
+_mongoc_cluster_deadline_end (mongoc_cluster_t *cluster,
+                              bool began,
+                              bson_error_t *error);
+
+bool
+_mongoc_cluster_deadline_check (const mongoc_cluster_t *cluster,
+                                bson_error_t *error);
+
+bool
+_mongoc_cluster_error_is_retryable (const bson_error_t *error);
+
+void
+_mongoc_cluster_invalidate_for_retry (mongoc_cluster_t *cluster,
+                                      uint32_t server_id,
+                                      const bson_error_t *error);
+
+mongoc_server_stream_t *
+_mongoc_cluster_stream_for_read_retry (
+   mongoc_cluster_t *cluster,
+   const mongoc_read_prefs_t *read_prefs,
+   const mongoc_server_stream_t *server_stream,
+   const bson_error_t *error);
+
 mongoc_server_stream_t *
 mongoc_cluster_stream_for_server (mongoc_cluster_t *cluster,
                                   uint32_t server_id,
@@ -163,6 +406,112 @@ mongoc_cluster_run_opmsg (mongoc_cluster_t *cluster,
                           bson_t *reply,
                           bson_error_t *error);
 
+bool
+_mongoc_cluster_run_opmsg_exhaust (mongoc_cluster_t *cluster,
+                                   mongoc_cmd_t *cmd,
+                                   bool *more_to_come,
+                                   bson_t *reply,
+                                   bson_error_t *error);
+
+bool
+_mongoc_cluster_recv_opmsg_exhaust (mongoc_cluster_t *cluster,
+                                    mongoc_cmd_t *cmd,
+                                    bool *more_to_come,
+                                    bson_t *reply,
+                                    bson_error_t *error);
+
+bool
+_mongoc_cluster_run_opmsg_begin (mongoc_cluster_t *cluster,
+                                 mongoc_cmd_t *cmd,
+                                 int32_t *request_id,
+                                 int64_t *started,
+                                 bson_error_t *error);
+
+bool
+_mongoc_cluster_run_opmsg_end (mongoc_cluster_t *cluster,
+                               mongoc_cmd_t *cmd,
+                               int32_t request_id,
+                               int64_t started,
+                               bson_t *reply,
+                               bson_error_t *error);
+
+void
+_mongoc_cluster_set_pending (mongoc_cluster_t *cluster,
+                             mongoc_cluster_pending_cb_t pending_cb,
+                             void *pending_ctx);
+
+void
+_mongoc_cluster_finish_pending (mongoc_cluster_t *cluster);
+
+/* where _mongoc_cluster_stream_opmsg_next is in the reply */
+typedef enum {
+   MONGOC_OPMSG_STREAM_BODY,   /* the reply document's fields */
+   MONGOC_OPMSG_STREAM_CURSOR, /* its "cursor" subdocument's fields */
+   MONGOC_OPMSG_STREAM_BATCH,  /* the documents of the batch */
+   MONGOC_OPMSG_STREAM_DONE,
+} mongoc_opmsg_stream_state_t;
+
+/* an OP_MSG reply to a cursor command, read off the connection a batch
+ * document at a time, see _mongoc_cluster_stream_opmsg_begin */
+typedef struct _mongoc_cluster_opmsg_stream_t {
+   mongoc_cluster_t *cluster;
+   mongoc_cmd_t *cmd;
+   int32_t request_id;
+   int64_t started;
+   int32_t msg_len;
+   int32_t remaining; /* bytes of the message still on the connection */
+   bool received;     /* remaining reached 0 */
+   bool pending;      /* set as the cluster's pending reply */
+   bool failed;
+   bson_error_t error;
+   mongoc_opmsg_stream_state_t state;
+   mongoc_buffer_t buffer;  /* bytes read off the connection */
+   mongoc_buffer_t drained; /* or the rest of the message, read at once */
+   mongoc_buffer_t *in;     /* the one being parsed */
+   size_t pos;              /* of the first unparsed byte in @in */
+   bson_t reply;            /* the reply without the batch's documents */
+   bson_t cursor;           /* its "cursor" subdocument, likewise */
+   char batch_key[16];      /* "firstBatch" or "nextBatch" */
+   bson_t current;          /* the document returned last */
+   uint32_t n_docs;
+   uint32_t n_bytes;
+} mongoc_cluster_opmsg_stream_t;
+
+bool
+_mongoc_cluster_stream_opmsg_begin (mongoc_cluster_t *cluster,
+                                    mongoc_cmd_t *cmd,
+                                    mongoc_cluster_opmsg_stream_t *stream,
+                                    bson_error_t *error);
+
+bool
+_mongoc_cluster_stream_opmsg_next (mongoc_cluster_opmsg_stream_t *stream,
+                                   const bson_t **doc,
+                                   bson_error_t *error);
+
+void
+_mongoc_cluster_stream_opmsg_destroy (mongoc_cluster_opmsg_stream_t *stream);
+
+bool
+_mongoc_cluster_run_opmsg_pipelined (mongoc_cluster_t *cluster,
+                                     mongoc_cmd_t **cmds,
+                                     size_t n_cmds,
+                                     bson_t *replies,
+                                     bson_error_t *errors);
+
+/* returns the hedged copy of a command, assembled for another server, or
+ * NULL if there is none */
+typedef mongoc_cmd_t *(*mongoc_cluster_hedge_cb_t) (void *ctx);
+
+bool
+_mongoc_cluster_run_opmsg_hedged (mongoc_cluster_t *cluster,
+                                  mongoc_cmd_t *cmd,
+                                  int32_t delay_msec,
+                                  mongoc_cluster_hedge_cb_t hedge_cb,
+                                  void *hedge_ctx,
+                                  mongoc_cmd_t **winner,
+                                  bson_t *reply,
+                                  bson_error_t *error);
+
 mongoc_server_stream_t *
 _mongoc_cluster_create_server_stream (mongoc_topology_t *topology,
                                       uint32_t server_id,
@@ -27,7 +27,7 @@
 
 
 mongoc_sspi_client_state_t *
-_mongoc_cluster_sspi_new (mongoc_uri_t *uri, const char *hostname)
+_mongoc_cluster_sspi_new (const mongoc_uri_t *uri, const char *hostname)
 {
    WCHAR *service; /* L"serviceName@hostname@REALM" */
    const char *service_name = "mongodb";
@@ -17,15 +17,20 @@
 
 #include "mongoc-config.h"
 
+#include <ctype.h>
 #include <string.h>
 
 #include "mongoc-cluster-private.h"
 #include "mongoc-client-private.h"
+#include "mongoc-client-session-private.h"
 #include "mongoc-counters-private.h"
+#include "mongoc-dns-private.h"
 #include "mongoc-config.h"
 #include "mongoc-error.h"
+#include "mongoc-find-cache-private.h"
 #include "mongoc-host-list-private.h"
 #include "mongoc-log.h"
+#include "mongoc-memory-private.h"
 #ifdef MONGOC_ENABLE_SASL
 #include "mongoc-cluster-sasl-private.h"
 #endif
@@ -33,11 +38,13 @@
 #include "mongoc-ssl.h"
 #include "mongoc-ssl-private.h"
 #include "mongoc-stream-tls.h"
+#include "mongoc-stream-tls-private.h"
 #endif
 #include "mongoc-b64-private.h"
 #include "mongoc-scram-private.h"
 #include "mongoc-set-private.h"
 #include "mongoc-socket.h"
+#include "mongoc-socket-private.h"
 #include "mongoc-stream-private.h"
 #include "mongoc-stream-socket.h"
 #include "mongoc-stream-tls.h"
@@ -86,6 +93,35 @@ static void
 _bson_error_message_printf (bson_error_t *error, const char *format, ...)
    BSON_GNUC_PRINTF (2, 3);
 
+/* authentication begun in the isMaster handshake, for servers that
+ * support "speculativeAuthenticate" */
+typedef struct {
+   const char *mechanism; /* NULL if not begun */
+#ifdef MONGOC_ENABLE_CRYPTO
+   mongoc_scram_t scram;
+#endif
+   bson_t *reply; /* NULL if the server ignored it */
+} mongoc_cluster_speculative_t;
+
+static void
+_mongoc_cluster_speculative_begin (mongoc_cluster_t *cluster,
+                                   mongoc_cluster_speculative_t *speculative,
+                                   bson_t *ismaster);
+
+static void
+_mongoc_cluster_speculative_reply (mongoc_cluster_speculative_t *speculative,
+                                   const bson_t *ismaster_reply);
+
+static void
+_mongoc_cluster_speculative_cleanup (
+   mongoc_cluster_speculative_t *speculative);
+
+static void
+_mongoc_cluster_shared_close_idle (
+   mongoc_cluster_shared_t *shared,
+   uint32_t server_id,
+   mongoc_apm_connection_closed_reason_t reason);
+
 
 size_t
 _mongoc_cluster_buffer_iovec (mongoc_iovec_t *iov,
@@ -155,2477 +191,7417 @@ _bson_error_message_printf (bson_error_t *error, const char *format, ...)
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_run_command_opquery --
- *
- *       Internal function to run a command on a given stream. @error and
- *       @reply are optional out-pointers.
- *
- * Returns:
- *       true if successful; otherwise false and @error is set.
+ * _mongoc_cluster_reply_buffer --
  *
- * Side effects:
- *       @reply is set and should ALWAYS be released with bson_destroy().
- *       On failure, @error is filled out. If this was a network error
- *       and server_id is nonzero, the cluster disconnects from the server.
+ *       Get the cluster's reply buffer, emptied but keeping the memory
+ *       it grew to for earlier replies.
  *
  *--------------------------------------------------------------------------
  */
 
-static bool
-mongoc_cluster_run_command_opquery (mongoc_cluster_t *cluster,
-                                    mongoc_cmd_t *cmd,
-                                    mongoc_stream_t *stream,
-                                    int32_t compressor_id,
-                                    const mongoc_host_list_t *host,
-                                    bson_t *reply,
-                                    bson_error_t *error)
+static mongoc_buffer_t *
+_mongoc_cluster_reply_buffer (mongoc_cluster_t *cluster)
 {
-   const size_t reply_header_size = sizeof (mongoc_rpc_reply_header_t);
-   uint8_t reply_header_buf[sizeof (mongoc_rpc_reply_header_t)];
-   uint8_t *reply_buf; /* reply body */
-   mongoc_rpc_t rpc;   /* sent to server */
-   bson_t reply_local;
-   bson_t *reply_ptr;
-   char cmd_ns[MONGOC_NAMESPACE_MAX];
-   uint32_t request_id;
-   int32_t msg_len;
-   size_t doc_len;
-   bool ret = false;
-   char *output = NULL;
-   uint32_t server_id;
-
-   ENTRY;
-
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (cmd);
-   BSON_ASSERT (stream);
-
-   /*
-    * setup
-    */
-   reply_ptr = reply ? reply : &reply_local;
-   bson_init (reply_ptr);
-
-   error->code = 0;
-
-   /*
-    * prepare the request
-    */
-
-   _mongoc_array_clear (&cluster->iov);
+   _mongoc_buffer_clear (&cluster->reply_buffer, false);
 
-   bson_snprintf (cmd_ns, sizeof cmd_ns, "%s.$cmd", cmd->db_name);
-   request_id = ++cluster->request_id;
-   _mongoc_rpc_prep_command (&rpc, cmd_ns, cmd);
-   rpc.header.request_id = request_id;
-   server_id = cmd->server_stream->sd->id;
+   return &cluster->reply_buffer;
+}
 
-   _mongoc_rpc_gather (&rpc, &cluster->iov);
-   _mongoc_rpc_swab_to_le (&rpc);
 
-   if (compressor_id != -1 && IS_NOT_COMMAND ("ismaster") &&
-       IS_NOT_COMMAND ("saslstart") && IS_NOT_COMMAND ("saslcontinue") &&
-       IS_NOT_COMMAND ("getnonce") && IS_NOT_COMMAND ("authenticate") &&
-       IS_NOT_COMMAND ("createuser") && IS_NOT_COMMAND ("updateuser") &&
-       IS_NOT_COMMAND ("copydbsaslstart") &&
-       IS_NOT_COMMAND ("copydbgetnonce") && IS_NOT_COMMAND ("copydb")) {
-      output = _mongoc_rpc_compress (cluster, compressor_id, &rpc, error);
-      if (output == NULL) {
-         GOTO (done);
+/* whether @host matches the @pattern_len bytes at @pattern, in which "*"
+ * matches any run of characters. case-insensitive */
+static bool
+_mongoc_cluster_host_matches (const char *pattern,
+                              size_t pattern_len,
+                              const char *host)
+{
+   const char *end = pattern + pattern_len;
+   const char *star = NULL;
+   const char *retry = NULL;
+
+   while (*host) {
+      if (pattern < end && *pattern == '*') {
+         star = ++pattern;
+         retry = host;
+      } else if (pattern < end &&
+                 tolower ((unsigned char) *pattern) ==
+                    tolower ((unsigned char) *host)) {
+         pattern++;
+         host++;
+      } else if (star) {
+         /* let the last "*" match one more character */
+         pattern = star;
+         host = ++retry;
+      } else {
+         return false;
       }
    }
 
-   if (cluster->client->in_exhaust) {
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_IN_EXHAUST,
-                      "A cursor derived from this client is in exhaust.");
-      GOTO (done);
+   while (pattern < end && *pattern == '*') {
+      pattern++;
    }
 
-   /*
-    * send and receive
-    */
-   if (!_mongoc_stream_writev_full (stream,
-                                    cluster->iov.data,
-                                    cluster->iov.len,
-                                    cluster->sockettimeoutms,
-                                    error)) {
-      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
+   return pattern == end;
+}
 
-      /* add info about the command to writev_full's error message */
-      _bson_error_message_printf (
-         error,
-         "Failed to send \"%s\" command with database \"%s\": %s",
-         cmd->command_name,
-         cmd->db_name,
-         error->message);
 
-      GOTO (done);
-   }
+/* whether a pattern in the comma-separated compressionHosts matches
+ * @host's name, or its name and port */
+static bool
+_mongoc_cluster_compression_host (const char *patterns,
+                                  const mongoc_host_list_t *host)
+{
+   const char *comma;
+   size_t len;
 
-   if (reply_header_size != mongoc_stream_read (stream,
-                                                &reply_header_buf,
-                                                reply_header_size,
-                                                reply_header_size,
-                                                cluster->sockettimeoutms)) {
-      RUN_CMD_ERR (MONGOC_ERROR_STREAM,
-                   MONGOC_ERROR_STREAM_SOCKET,
-                   "socket error or timeout");
+   for (;;) {
+      comma = strchr (patterns, ',');
+      len = comma ? (size_t) (comma - patterns) : strlen (patterns);
 
-      mongoc_cluster_disconnect_node (
-         cluster, server_id, !mongoc_stream_timed_out (stream), error);
-      GOTO (done);
-   }
+      if (len && (_mongoc_cluster_host_matches (patterns, len, host->host) ||
+                  _mongoc_cluster_host_matches (
+                     patterns, len, host->host_and_port))) {
+         return true;
+      }
 
-   memcpy (&msg_len, reply_header_buf, 4);
-   msg_len = BSON_UINT32_FROM_LE (msg_len);
-   if ((msg_len < reply_header_size) ||
-       (msg_len > MONGOC_DEFAULT_MAX_MSG_SIZE)) {
-      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
-      GOTO (done);
-   }
+      if (!comma) {
+         return false;
+      }
 
-   if (!_mongoc_rpc_scatter_reply_header_only (
-          &rpc, reply_header_buf, reply_header_size)) {
-      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
-      GOTO (done);
+      patterns = comma + 1;
    }
-   doc_len = (size_t) msg_len - reply_header_size;
-
-   if (BSON_UINT32_FROM_LE (rpc.header.opcode) == MONGOC_OPCODE_COMPRESSED) {
-      bson_t tmp = BSON_INITIALIZER;
-      uint8_t *buf = NULL;
-      size_t len = BSON_UINT32_FROM_LE (rpc.compressed.uncompressed_size) +
-                   sizeof (mongoc_rpc_header_t);
-
-      reply_buf = bson_malloc0 (msg_len);
-      memcpy (reply_buf, reply_header_buf, reply_header_size);
+}
 
-      if (doc_len != mongoc_stream_read (stream,
-                                         reply_buf + reply_header_size,
-                                         doc_len,
-                                         doc_len,
-                                         cluster->sockettimeoutms)) {
-         RUN_CMD_ERR (MONGOC_ERROR_STREAM,
-                      MONGOC_ERROR_STREAM_SOCKET,
-                      "socket error or timeout");
-         mongoc_cluster_disconnect_node (cluster, server_id, true, error);
-         GOTO (done);
-      }
-      if (!_mongoc_rpc_scatter (&rpc, reply_buf, msg_len)) {
-         GOTO (done);
-      }
 
-      buf = bson_malloc0 (len);
-      if (!_mongoc_rpc_decompress (&rpc, buf, len)) {
-         RUN_CMD_ERR (MONGOC_ERROR_PROTOCOL,
-                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                      "Could not decompress server reply");
-         bson_free (reply_buf);
-         bson_free (buf);
-         GOTO (done);
-      }
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_compressor_id --
+ *
+ *       The compressor to send messages to @sd's server with: the one it
+ *       negotiated, if any. With a compression policy, only servers that
+ *       match one of its rules get compressed messages: a round trip time
+ *       of at least compressionMinRTTMS, a zone tag other than localZone
+ *       with compressionOutsideZone, or a name in compressionHosts. Links
+ *       to nearby servers are fast enough that compressing only costs
+ *       CPU time.
+ *
+ * Returns:
+ *       A compressor id, or -1 to send uncompressed.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-      _mongoc_rpc_swab_from_le (&rpc);
+static int32_t
+_mongoc_cluster_compressor_id (mongoc_cluster_t *cluster,
+                               const mongoc_server_description_t *sd)
+{
+   const mongoc_topology_description_t *td;
+   int32_t compressor_id;
 
-      _mongoc_rpc_get_first_document (&rpc, &tmp);
-      bson_copy_to (&tmp, reply_ptr);
-      bson_free (reply_buf);
-      bson_free (buf);
-   } else if (BSON_UINT32_FROM_LE (rpc.header.opcode) == MONGOC_OPCODE_REPLY &&
-              BSON_UINT32_FROM_LE (rpc.reply_header.n_returned) == 1) {
-      reply_buf = bson_reserve_buffer (reply_ptr, (uint32_t) doc_len);
-      BSON_ASSERT (reply_buf);
+   compressor_id = mongoc_server_description_compressor_id (sd);
+   if (compressor_id == -1 || !cluster->compression_policy) {
+      return compressor_id;
+   }
 
-      if (doc_len != mongoc_stream_read (stream,
-                                         (void *) reply_buf,
-                                         doc_len,
-                                         doc_len,
-                                         cluster->sockettimeoutms)) {
-         RUN_CMD_ERR (MONGOC_ERROR_STREAM,
-                      MONGOC_ERROR_STREAM_SOCKET,
-                      "socket error or timeout");
-         mongoc_cluster_disconnect_node (cluster, server_id, true, error);
-         GOTO (done);
-      }
-      _mongoc_rpc_swab_from_le (&rpc);
-   } else {
-      GOTO (done);
+   if (cluster->compression_min_rtt_msec > 0 &&
+       sd->round_trip_time_msec >= cluster->compression_min_rtt_msec) {
+      return compressor_id;
    }
 
-   if (!_mongoc_cmd_check_ok (
-          reply_ptr, cluster->client->error_api_version, error)) {
-      GOTO (done);
+   /* the zone settings don't change after the topology is created */
+   td = &cluster->client->topology->description;
+   if (cluster->compression_outside_zone && td->local_zone &&
+       !_mongoc_topology_description_in_local_zone (td, sd)) {
+      return compressor_id;
    }
 
-   _mongoc_topology_update_cluster_time (cluster->client->topology, reply_ptr);
+   if (cluster->compression_hosts &&
+       _mongoc_cluster_compression_host (cluster->compression_hosts,
+                                         &sd->host)) {
+      return compressor_id;
+   }
 
-   ret = true;
+   return -1;
+}
 
-done:
 
-   if (!ret && error->code == 0) {
-      /* generic error */
-      RUN_CMD_ERR (MONGOC_ERROR_PROTOCOL,
-                   MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                   "Invalid reply from server.");
-   }
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_decompress_buffer --
+ *
+ *       Get the cluster's decompression buffer, grown to at least @len
+ *       bytes.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   if (reply_ptr == &reply_local) {
-      bson_destroy (reply_ptr);
+static uint8_t *
+_mongoc_cluster_decompress_buffer (mongoc_cluster_t *cluster, size_t len)
+{
+   if (cluster->decompress_buffer_len < len) {
+      _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION,
+                           cluster->decompress_buffer);
+      _mongoc_memory_budget_charge (
+         cluster->budget,
+         (int64_t) bson_next_power_of_two (len) -
+            (int64_t) cluster->decompress_buffer_len);
+      cluster->decompress_buffer_len = bson_next_power_of_two (len);
+      cluster->decompress_buffer = (uint8_t *) _mongoc_malloc_tagged (
+         MONGOC_MEMORY_TAG_COMPRESSION, cluster->decompress_buffer_len);
    }
-   bson_free (output);
 
-   RETURN (ret);
+   return cluster->decompress_buffer;
 }
 
+
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_run_command_monitored --
- *
- *       Internal function to run a command on a given stream.
- *       @error and @reply are optional out-pointers.
- *
- * Returns:
- *       true if successful; otherwise false and @error is set.
+ * _mongoc_cluster_trim_reply_buffers --
  *
- * Side effects:
- *       If the client's APM callbacks are set, they are executed.
- *       @reply is set and should ALWAYS be released with bson_destroy().
+ *       Once a reply has been copied out, release whichever buffer grew
+ *       past replyBufferMaxSize, so a rare huge reply doesn't pin its
+ *       memory for the life of the client.
  *
  *--------------------------------------------------------------------------
  */
 
-bool
-mongoc_cluster_run_command_monitored (mongoc_cluster_t *cluster,
-                                      mongoc_cmd_t *cmd,
-                                      bson_t *reply,
-                                      bson_error_t *error)
+static void
+_mongoc_cluster_trim_reply_buffers (mongoc_cluster_t *cluster)
 {
-   bool retval;
-   uint32_t request_id = ++cluster->request_id;
-   mongoc_apm_callbacks_t *callbacks;
-   mongoc_apm_command_started_t started_event;
-   mongoc_apm_command_succeeded_t succeeded_event;
-   mongoc_apm_command_failed_t failed_event;
-   int64_t started = bson_get_monotonic_time ();
-   const mongoc_server_stream_t *server_stream;
-   bson_t reply_local;
-   bson_error_t error_local;
-   int32_t compressor_id;
-
-   server_stream = cmd->server_stream;
-   compressor_id = mongoc_server_description_compressor_id (server_stream->sd);
-
-   callbacks = &cluster->client->apm_callbacks;
-   if (!reply) {
-      reply = &reply_local;
+   if (cluster->reply_buffer.datalen > cluster->reply_buffer_max_size) {
+      _mongoc_buffer_destroy (&cluster->reply_buffer);
+      _mongoc_buffer_init_tagged (&cluster->reply_buffer,
+                                  MONGOC_MEMORY_TAG_REPLY_BUFFER);
+      _mongoc_buffer_set_budget (&cluster->reply_buffer, cluster->budget);
    }
-   if (!error) {
-      error = &error_local;
+
+   if (cluster->decompress_buffer_len > cluster->reply_buffer_max_size) {
+      _mongoc_memory_budget_charge (
+         cluster->budget, -(int64_t) cluster->decompress_buffer_len);
+      _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION,
+                           cluster->decompress_buffer);
+      cluster->decompress_buffer = NULL;
+      cluster->decompress_buffer_len = 0;
    }
+}
 
-   if (callbacks->started) {
-      mongoc_apm_command_started_init (&started_event,
-                                       cmd->command,
-                                       cmd->db_name,
-                                       cmd->command_name,
-                                       request_id,
-                                       cmd->operation_id,
-                                       &server_stream->sd->host,
-                                       server_stream->sd->id,
-                                       cluster->client->apm_context);
 
-      callbacks->started (&started_event);
-      mongoc_apm_command_started_cleanup (&started_event);
+/* the pooled connection @server_stream uses, or NULL. a single-threaded
+ * client's connections belong to the topology scanner */
+static mongoc_cluster_node_t *
+_mongoc_cluster_stream_node (mongoc_cluster_t *cluster,
+                             const mongoc_server_stream_t *server_stream)
+{
+   mongoc_cluster_node_t *node;
+
+   if (server_stream->node) {
+      return server_stream->node;
    }
 
-   if (server_stream->sd->max_wire_version >= WIRE_VERSION_OP_MSG) {
-      retval = mongoc_cluster_run_opmsg (cluster, cmd, reply, error);
-   } else {
-      retval = mongoc_cluster_run_command_opquery (cluster,
-                                                   cmd,
-                                                   server_stream->stream,
-                                                   compressor_id,
-                                                   &server_stream->sd->host,
-                                                   reply,
-                                                   error);
-   }
-   if (retval && callbacks->succeeded) {
-      mongoc_apm_command_succeeded_init (&succeeded_event,
-                                         bson_get_monotonic_time () - started,
-                                         reply,
-                                         cmd->command_name,
-                                         request_id,
-                                         cmd->operation_id,
-                                         &server_stream->sd->host,
-                                         server_stream->sd->id,
-                                         cluster->client->apm_context);
-
-      callbacks->succeeded (&succeeded_event);
-      mongoc_apm_command_succeeded_cleanup (&succeeded_event);
+   if (cluster->client->topology->single_threaded) {
+      return NULL;
    }
-   if (!retval && callbacks->failed) {
-      mongoc_apm_command_failed_init (&failed_event,
-                                      bson_get_monotonic_time () - started,
-                                      cmd->command_name,
-                                      error,
-                                      request_id,
-                                      cmd->operation_id,
-                                      &server_stream->sd->host,
-                                      server_stream->sd->id,
-                                      cluster->client->apm_context);
 
-      callbacks->failed (&failed_event);
-      mongoc_apm_command_failed_cleanup (&failed_event);
-   }
+   node = (mongoc_cluster_node_t *) mongoc_set_get (cluster->nodes,
+                                                    server_stream->sd->id);
 
-   if (reply == &reply_local) {
-      bson_destroy (&reply_local);
-   }
-   return retval;
+   return node && node->stream == server_stream->stream ? node : NULL;
 }
 
 
-/*
- *--------------------------------------------------------------------------
- *
- * mongoc_cluster_run_command_private --
- *
- *       Internal function to run a command on a given stream.
- *       @error and @reply are optional out-pointers.
- *       The client's APM callbacks are not executed.
- *
- * Returns:
- *       true if successful; otherwise false and @error is set.
- *
- * Side effects:
- *       @reply is set and should ALWAYS be released with bson_destroy().
- *
- *--------------------------------------------------------------------------
- */
-
-bool
-mongoc_cluster_run_command_private (mongoc_cluster_t *cluster,
-                                    mongoc_cmd_t *cmd,
-                                    bson_t *reply,
-                                    bson_error_t *error)
+/* count a message sent to the server in its per-server counters, and in
+ * its connection's */
+static void
+_mongoc_cluster_count_egress (mongoc_cluster_t *cluster,
+                              const mongoc_server_stream_t *server_stream,
+                              int32_t msg_len_le)
 {
-   bool retval;
-   const mongoc_server_stream_t *server_stream;
-   bson_t reply_local;
+   const mongoc_server_description_t *sd = server_stream->sd;
+   mongoc_cluster_node_t *node;
+   int64_t msg_len = (int64_t) BSON_UINT32_FROM_LE (msg_len_le);
 
-   if (!reply) {
-      reply = &reply_local;
-   }
-   server_stream = cmd->server_stream;
-   if (server_stream->sd->max_wire_version >= WIRE_VERSION_OP_MSG) {
-      retval = mongoc_cluster_run_opmsg (cluster, cmd, reply, error);
-   } else {
-      retval = mongoc_cluster_run_command_opquery (
-         cluster, cmd, cmd->server_stream->stream, -1, NULL, reply, error);
+   _mongoc_server_counter_add (&sd->counters, MONGOC_SERVER_COUNTER_OPS, 1);
+   _mongoc_server_counter_add (
+      &sd->counters, MONGOC_SERVER_COUNTER_EGRESS_BYTES, msg_len);
+
+   node = _mongoc_cluster_stream_node (cluster, server_stream);
+   if (node) {
+      node->ops++;
+      node->egress_bytes += msg_len;
+      node->sent_at = bson_get_monotonic_time ();
    }
-   if (reply == &reply_local) {
-      bson_destroy (&reply_local);
+}
+
+
+/* call before disconnecting after a failed read, which may destroy the
+ * stream */
+static void
+_mongoc_cluster_count_timeout (const mongoc_server_description_t *sd,
+                               mongoc_stream_t *stream)
+{
+   if (mongoc_stream_timed_out (stream)) {
+      _mongoc_server_counter_add (
+         &sd->counters, MONGOC_SERVER_COUNTER_TIMEOUTS, 1);
    }
-   return retval;
 }
 
-/*
- *--------------------------------------------------------------------------
- *
- * mongoc_cluster_run_command_parts --
- *
- *       Internal function to assemble command parts and run a command
- *       on a given stream. @error and @reply are optional out-pointers.
- *       The client's APM callbacks are not executed.
- *
- * Returns:
- *       true if successful; otherwise false and @error is set.
- *
- * Side effects:
- *       @reply is set and should ALWAYS be released with bson_destroy().
- *
- *--------------------------------------------------------------------------
- */
 
-bool
-mongoc_cluster_run_command_parts (mongoc_cluster_t *cluster,
-                                  mongoc_server_stream_t *server_stream,
-                                  mongoc_cmd_parts_t *parts,
-                                  bson_t *reply,
-                                  bson_error_t *error)
+/* count a message received from the server. the first reply to a message
+ * times the connection's round trip */
+static void
+_mongoc_cluster_count_ingress (mongoc_cluster_t *cluster,
+                               const mongoc_server_stream_t *server_stream,
+                               int32_t msg_len)
 {
-   if (!mongoc_cmd_parts_assemble (parts, server_stream, error)) {
-      _mongoc_bson_init_if_set (reply);
-      mongoc_cmd_parts_cleanup (parts);
-      return false;
+   const mongoc_server_description_t *sd = server_stream->sd;
+   mongoc_cluster_node_t *node;
+
+   _mongoc_server_counter_add (
+      &sd->counters, MONGOC_SERVER_COUNTER_INGRESS_BYTES, (int64_t) msg_len);
+
+   node = _mongoc_cluster_stream_node (cluster, server_stream);
+   if (node) {
+      node->ingress_bytes += msg_len;
+      if (node->sent_at) {
+         node->rtt_usec = bson_get_monotonic_time () - node->sent_at;
+         node->in_use_usec += node->rtt_usec;
+         node->sent_at = 0;
+      }
    }
 
-   return mongoc_cluster_run_command_private (
-      cluster, &parts->assembled, reply, error);
+   /* the server is responsive, even if the reply is an error */
+   _mongoc_topology_breaker_success (cluster->client->topology, sd->id);
 }
 
-/*
- *--------------------------------------------------------------------------
- *
- * _mongoc_stream_run_ismaster --
- *
- *       Run an ismaster command on the given stream.
- *
- * Returns:
- *       A mongoc_server_description_t you must destroy. If the call failed
- *       its error is set and its type is MONGOC_SERVER_UNKNOWN.
- *
- *--------------------------------------------------------------------------
- */
-static mongoc_server_description_t *
-_mongoc_stream_run_ismaster (mongoc_cluster_t *cluster,
-                             mongoc_stream_t *stream,
-                             const char *address,
-                             uint32_t server_id)
+
+/* count a failed operation, network or server error */
+static void
+_mongoc_cluster_count_error (const mongoc_server_description_t *sd)
 {
-   const bson_t *command;
-   mongoc_cmd_parts_t parts;
-   bson_t reply;
-   bson_error_t error;
-   int64_t start;
-   int64_t rtt_msec;
-   mongoc_server_description_t *sd;
-   mongoc_server_stream_t *server_stream;
-   bool r;
+   _mongoc_server_counter_add (&sd->counters, MONGOC_SERVER_COUNTER_ERRORS, 1);
+}
 
-   ENTRY;
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (stream);
+/* the start of a phase of the next command's span, or 0 if the span
+ * callback isn't set and the phase needn't be timed */
+static int64_t
+_mongoc_cluster_span_now (mongoc_cluster_t *cluster)
+{
+   if (!cluster->client->apm_callbacks.span || cluster->span.connecting) {
+      return 0;
+   }
 
-   command = _mongoc_topology_scanner_get_ismaster (
-      cluster->client->topology->scanner);
+   return bson_get_monotonic_time ();
+}
 
-   start = bson_get_monotonic_time ();
-   server_stream = _mongoc_cluster_create_server_stream (
-      cluster->client->topology, server_id, stream, &error);
-   if (!server_stream) {
-      RETURN (NULL);
-   }
 
-   mongoc_cmd_parts_init (&parts, "admin", MONGOC_QUERY_SLAVE_OK, command);
-   if (!mongoc_cluster_run_command_parts (
-          cluster, server_stream, &parts, &reply, &error)) {
-      mongoc_server_stream_cleanup (server_stream);
-      RETURN (NULL);
+/* add the time since @since, from _mongoc_cluster_span_now, to @phase */
+static void
+_mongoc_cluster_span_add (mongoc_cluster_t *cluster,
+                          mongoc_apm_span_phase_t phase,
+                          int64_t since)
+{
+   if (!since) {
+      return;
    }
 
-   rtt_msec = (bson_get_monotonic_time () - start) / 1000;
+   if (!cluster->span.start_time) {
+      cluster->span.start_time = since;
+   }
 
-   sd = (mongoc_server_description_t *) bson_malloc0 (
-      sizeof (mongoc_server_description_t));
+   cluster->span.phases[phase] += bson_get_monotonic_time () - since;
+}
 
-   mongoc_server_description_init (sd, address, server_id);
-   /* send the error from run_command IN to handle_ismaster */
-   mongoc_server_description_handle_ismaster (sd, &reply, rtt_msec, &error);
 
-   bson_destroy (&reply);
+/* a client pool checked out the cluster's client, it waited since
+ * @started. the wait is reported with the client's first command */
+void
+_mongoc_cluster_span_client_checkout (mongoc_cluster_t *cluster,
+                                      int64_t started)
+{
+   memset (&cluster->span, 0, sizeof cluster->span);
 
-   r = _mongoc_topology_update_from_handshake (cluster->client->topology, sd);
-   if (!r) {
-      mongoc_server_description_reset (sd);
-      bson_set_error (&sd->error,
-                      MONGOC_ERROR_STREAM,
-                      MONGOC_ERROR_STREAM_NOT_ESTABLISHED,
-                      "\"%s\" removed from topology",
-                      address);
+   if (cluster->client->apm_callbacks.span) {
+      _mongoc_cluster_span_add (
+         cluster, MONGOC_APM_SPAN_CLIENT_CHECKOUT, started);
    }
-
-   mongoc_cmd_parts_cleanup (&parts);
-   mongoc_server_stream_cleanup (server_stream);
-
-   RETURN (sd);
 }
 
-/*
- *--------------------------------------------------------------------------
- *
- * _mongoc_cluster_run_ismaster --
- *
- *       Run an ismaster command for the given node and handle result.
- *
- * Returns:
- *       mongoc_server_description_t on success, NULL otherwise.
- *       the mongoc_server_description_t MUST BE DESTROYED BY THE CALLER.
- *
- * Side effects:
- *       Makes a blocking I/O call, updates cluster->topology->description
- *       with ismaster result.
- *
- *--------------------------------------------------------------------------
- */
-static mongoc_server_description_t *
-_mongoc_cluster_run_ismaster (mongoc_cluster_t *cluster,
-                              mongoc_cluster_node_t *node,
-                              uint32_t server_id,
-                              bson_error_t *error /* OUT */)
+
+/* forget phases timed for a command that never ran, except the client
+ * checkout, which belongs to whichever command runs first */
+static void
+_mongoc_cluster_span_restart (mongoc_cluster_t *cluster)
 {
-   mongoc_server_description_t *sd;
+   int64_t checkout;
+   int64_t start_time;
 
-   ENTRY;
+   if (!cluster->client->apm_callbacks.span) {
+      return;
+   }
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (node);
-   BSON_ASSERT (node->stream);
+   checkout = cluster->span.phases[MONGOC_APM_SPAN_CLIENT_CHECKOUT];
+   start_time = checkout ? cluster->span.start_time : 0;
+   memset (cluster->span.phases, 0, sizeof cluster->span.phases);
+   cluster->span.phases[MONGOC_APM_SPAN_CLIENT_CHECKOUT] = checkout;
+   cluster->span.start_time = start_time;
+}
 
-   sd = _mongoc_stream_run_ismaster (
-      cluster, node->stream, node->connection_address, server_id);
 
-   if (sd->type == MONGOC_SERVER_UNKNOWN) {
-      memcpy (error, &sd->error, sizeof (bson_error_t));
-      mongoc_server_description_destroy (sd);
-      return NULL;
-   } else {
-      node->max_write_batch_size = sd->max_write_batch_size;
-      node->min_wire_version = sd->min_wire_version;
-      node->max_wire_version = sd->max_wire_version;
-      node->max_bson_obj_size = sd->max_bson_obj_size;
-      node->max_msg_size = sd->max_msg_size;
+/* call the span callback for @cmd, which just finished, and begin the
+ * next span */
+static void
+_mongoc_cluster_span_end (mongoc_cluster_t *cluster,
+                          const mongoc_cmd_t *cmd,
+                          int64_t request_id,
+                          bool succeeded)
+{
+   mongoc_apm_callbacks_t *callbacks = &cluster->client->apm_callbacks;
+   mongoc_apm_command_span_t event;
+
+   if (!callbacks->span || cluster->span.connecting ||
+       !cluster->span.start_time) {
+      return;
    }
 
-   return sd;
+   if (_mongoc_apm_command_sampled (callbacks, cmd->operation_id)) {
+      event.command_name = cmd->command_name;
+      event.request_id = request_id;
+      event.operation_id = cmd->operation_id;
+      event.host = &cmd->server_stream->sd->host;
+      event.server_id = cmd->server_stream->sd->id;
+      event.succeeded = succeeded;
+      event.start_time = cluster->span.start_time;
+      event.duration = bson_get_monotonic_time () - cluster->span.start_time;
+      event.phases = cluster->span.phases;
+      event.context = cluster->client->apm_context;
+
+      callbacks->span (&event);
+   }
+
+   memset (&cluster->span, 0, sizeof cluster->span);
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_build_basic_auth_digest --
+ * _mongoc_cluster_deadline_begin --
  *
- *       Computes the Basic Authentication digest using the credentials
- *       configured for @cluster and the @nonce provided.
+ *       Start an operation's "timeoutMS" deadline, @timeout_msec from now,
+ *       or the client's timeoutMS if @timeout_msec is negative. Until
+ *       _mongoc_cluster_deadline_end, it limits server selection, waiting
+ *       for a connection, connecting, each send and receive, and the
+ *       maxTimeMS sent with each command.
  *
- *       The result should be freed by the caller using bson_free() when
- *       they are finished with it.
+ *       An operation run by another, such as a command helper's cursor,
+ *       keeps the outer operation's deadline.
  *
  * Returns:
- *       A newly allocated string containing the digest.
- *
- * Side effects:
- *       None.
+ *       True if this call set the deadline; pass it to
+ *       _mongoc_cluster_deadline_end.
  *
  *--------------------------------------------------------------------------
  */
 
-static char *
-_mongoc_cluster_build_basic_auth_digest (mongoc_cluster_t *cluster,
-                                         const char *nonce)
+bool
+_mongoc_cluster_deadline_begin (mongoc_cluster_t *cluster,
+                                int32_t timeout_msec)
 {
-   const char *username;
-   const char *password;
-   char *password_digest;
-   char *password_md5;
-   char *digest_in;
-   char *ret;
+   if (cluster->deadline) {
+      return false;
+   }
 
-   ENTRY;
-
-   /*
-    * The following generates the digest to be used for basic authentication
-    * with a MongoDB server. More information on the format can be found
-    * at the following location:
-    *
-    * http://docs.mongodb.org/meta-driver/latest/legacy/
-    *   implement-authentication-in-driver/
-    */
+   if (timeout_msec < 0) {
+      timeout_msec = cluster->timeout_msec;
+   }
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (cluster->uri);
+   if (timeout_msec <= 0) {
+      return false;
+   }
 
-   username = mongoc_uri_get_username (cluster->uri);
-   password = mongoc_uri_get_password (cluster->uri);
-   password_digest = bson_strdup_printf ("%s:mongo:%s", username, password);
-   password_md5 = _mongoc_hex_md5 (password_digest);
-   digest_in = bson_strdup_printf ("%s%s%s", nonce, username, password_md5);
-   ret = _mongoc_hex_md5 (digest_in);
-   bson_free (digest_in);
-   bson_free (password_md5);
-   bson_free (password_digest);
+   cluster->deadline =
+      bson_get_monotonic_time () + (int64_t) timeout_msec * 1000;
 
-   RETURN (ret);
+   return true;
 }
 
 
-/*
- *--------------------------------------------------------------------------
- *
- * _mongoc_cluster_auth_node_cr --
- *
- *       Performs authentication of @node using the credentials provided
- *       when configuring the @cluster instance.
- *
- *       This is the Challenge-Response mode of authentication.
- *
- * Returns:
- *       true if authentication was successful; otherwise false and
- *       @error is set.
- *
- * Side effects:
- *       None.
- *
- *--------------------------------------------------------------------------
- */
+static bool
+_mongoc_cluster_deadline_expired (const mongoc_cluster_t *cluster)
+{
+   return cluster->deadline && bson_get_monotonic_time () >= cluster->deadline;
+}
+
 
 static bool
-_mongoc_cluster_auth_node_cr (mongoc_cluster_t *cluster,
-                              mongoc_stream_t *stream,
-                              mongoc_server_description_t *sd,
-                              bson_error_t *error)
+_mongoc_cluster_error_is_timeout (const bson_error_t *error)
 {
-   mongoc_cmd_parts_t parts;
-   bson_iter_t iter;
-   const char *auth_source;
-   bson_t command;
-   bson_t reply;
-   char *digest;
-   char *nonce;
-   bool ret;
-   mongoc_server_stream_t *server_stream;
+   return error->domain == MONGOC_ERROR_CLIENT &&
+          error->code == MONGOC_ERROR_CLIENT_OPERATION_TIMEOUT;
+}
 
-   ENTRY;
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (stream);
+/* an error from an operation whose deadline passed, such as a socket or
+ * server selection timeout, becomes a timeoutMS error */
+static void
+_mongoc_cluster_deadline_error (const mongoc_cluster_t *cluster,
+                                bson_error_t *error)
+{
+   char message[sizeof error->message];
 
-   if (!(auth_source = mongoc_uri_get_auth_source (cluster->uri)) ||
-       (*auth_source == '\0')) {
-      auth_source = "admin";
+   if (!error || !error->code || _mongoc_cluster_error_is_timeout (error) ||
+       !_mongoc_cluster_deadline_expired (cluster)) {
+      return;
    }
 
-   /*
-    * To authenticate a node using basic authentication, we need to first
-    * get the nonce from the server. We use that to hash our password which
-    * is sent as a reply to the server. If everything went good we get a
-    * success notification back from the server.
-    */
+   bson_strncpy (message, error->message, sizeof message);
+   bson_set_error (error,
+                   MONGOC_ERROR_CLIENT,
+                   MONGOC_ERROR_CLIENT_OPERATION_TIMEOUT,
+                   "Operation exceeded timeoutMS: %s",
+                   message);
+}
 
-   /*
-    * Execute the getnonce command to fetch the nonce used for generating
-    * md5 digest of our password information.
-    */
-   bson_init (&command);
-   bson_append_int32 (&command, "getnonce", 8, 1);
-   mongoc_cmd_parts_init (&parts, auth_source, MONGOC_QUERY_SLAVE_OK, &command);
-   server_stream = _mongoc_cluster_create_server_stream (
-      cluster->client->topology, sd->id, stream, error);
 
-   if (!mongoc_cluster_run_command_parts (
-          cluster, server_stream, &parts, &reply, error)) {
-      mongoc_server_stream_cleanup (server_stream);
-      bson_destroy (&command);
-      bson_destroy (&reply);
-      RETURN (false);
+/* finish the operation begun with _mongoc_cluster_deadline_begin, which
+ * returned @began. pass its @error if it failed, or NULL */
+void
+_mongoc_cluster_deadline_end (mongoc_cluster_t *cluster,
+                              bool began,
+                              bson_error_t *error)
+{
+   if (!began) {
+      return;
    }
-   bson_destroy (&command);
-   if (!bson_iter_init_find_case (&iter, &reply, "nonce")) {
+
+   _mongoc_cluster_deadline_error (cluster, error);
+   cluster->deadline = 0;
+}
+
+
+/* false, and @error is set, if the operation's deadline has passed */
+bool
+_mongoc_cluster_deadline_check (const mongoc_cluster_t *cluster,
+                                bson_error_t *error)
+{
+   if (_mongoc_cluster_deadline_expired (cluster)) {
       bson_set_error (error,
                       MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_GETNONCE,
-                      "Invalid reply from getnonce");
-      bson_destroy (&reply);
-      RETURN (false);
+                      MONGOC_ERROR_CLIENT_OPERATION_TIMEOUT,
+                      "Operation exceeded timeoutMS");
+      return false;
    }
 
-   /*
-    * Build our command to perform the authentication.
-    */
-   nonce = bson_iter_dup_utf8 (&iter, NULL);
-   digest = _mongoc_cluster_build_basic_auth_digest (cluster, nonce);
-   bson_init (&command);
-   bson_append_int32 (&command, "authenticate", 12, 1);
-   bson_append_utf8 (
-      &command, "user", 4, mongoc_uri_get_username (cluster->uri), -1);
-   bson_append_utf8 (&command, "nonce", 5, nonce, -1);
-   bson_append_utf8 (&command, "key", 3, digest, -1);
-   bson_destroy (&reply);
-   bson_free (nonce);
-   bson_free (digest);
+   return true;
+}
 
-   /*
-    * Execute the authenticate command. mongoc_cluster_run_command_private
-    * checks for {ok: 1} in the response.
-    */
-   mongoc_cmd_parts_cleanup (&parts);
-   mongoc_cmd_parts_init (&parts, auth_source, MONGOC_QUERY_SLAVE_OK, &command);
-   ret = mongoc_cluster_run_command_parts (
-      cluster, server_stream, &parts, &reply, error);
 
-   if (!ret) {
-      /* error->message is already set */
-      error->domain = MONGOC_ERROR_CLIENT;
-      error->code = MONGOC_ERROR_CLIENT_AUTHENTICATE;
-   }
+/* milliseconds until the deadline, rounded up so a timeout that ends in
+ * time finds the deadline passed, and at least 1: a timeout of 0 would mean
+ * a nonblocking attempt, not one that fails */
+static int64_t
+_mongoc_cluster_deadline_remaining_msec (const mongoc_cluster_t *cluster)
+{
+   int64_t remaining;
 
-   mongoc_server_stream_cleanup (server_stream);
-   mongoc_cmd_parts_cleanup (&parts);
-   bson_destroy (&command);
-   bson_destroy (&reply);
+   BSON_ASSERT (cluster->deadline);
 
-   RETURN (ret);
-}
+   remaining = (cluster->deadline - bson_get_monotonic_time () + 999) / 1000;
 
+   return BSON_MAX (remaining, 1);
+}
 
-/*
- *--------------------------------------------------------------------------
- *
- * _mongoc_cluster_auth_node_plain --
- *
- *       Perform SASL PLAIN authentication for @node. We do this manually
- *       instead of using the SASL module because its rather simplistic.
- *
- * Returns:
- *       true if successful; otherwise false and error is set.
- *
- * Side effects:
- *       error may be set.
- *
- *--------------------------------------------------------------------------
- */
 
-static bool
-_mongoc_cluster_auth_node_plain (mongoc_cluster_t *cluster,
-                                 mongoc_stream_t *stream,
-                                 mongoc_server_description_t *sd,
-                                 bson_error_t *error)
+/* socketTimeoutMS, or less if the operation's deadline is sooner */
+static int32_t
+_mongoc_cluster_io_timeout_msec (const mongoc_cluster_t *cluster)
 {
-   mongoc_cmd_parts_t parts;
-   char buf[4096];
-   int buflen = 0;
-   const char *username;
-   const char *password;
-   bson_t b = BSON_INITIALIZER;
-   bson_t reply;
-   size_t len;
-   char *str;
-   bool ret;
-   mongoc_server_stream_t *server_stream;
-
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (stream);
+   int64_t remaining;
 
-   username = mongoc_uri_get_username (cluster->uri);
-   if (!username) {
-      username = "";
+   if (!cluster->deadline) {
+      return (int32_t) cluster->sockettimeoutms;
    }
 
-   password = mongoc_uri_get_password (cluster->uri);
-   if (!password) {
-      password = "";
+   remaining = _mongoc_cluster_deadline_remaining_msec (cluster);
+   if (cluster->sockettimeoutms > 0 &&
+       (int64_t) cluster->sockettimeoutms < remaining) {
+      return (int32_t) cluster->sockettimeoutms;
    }
 
-   str = bson_strdup_printf ("%c%s%c%s", '\0', username, '\0', password);
-   len = strlen (username) + strlen (password) + 2;
-   buflen = mongoc_b64_ntop ((const uint8_t *) str, len, buf, sizeof buf);
-   bson_free (str);
+   return (int32_t) BSON_MIN (remaining, INT32_MAX);
+}
 
-   if (buflen == -1) {
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                      "failed base64 encoding message");
-      return false;
-   }
 
-   BSON_APPEND_INT32 (&b, "saslStart", 1);
-   BSON_APPEND_UTF8 (&b, "mechanism", "PLAIN");
-   bson_append_utf8 (&b, "payload", 7, (const char *) buf, buflen);
-   BSON_APPEND_INT32 (&b, "autoAuthorize", 1);
+/* connectTimeoutMS, or less if the operation's deadline is sooner */
+static int32_t
+_mongoc_cluster_connect_timeout_msec (const mongoc_cluster_t *cluster)
+{
+   int64_t timeout_msec;
 
-   mongoc_cmd_parts_init (&parts, "$external", MONGOC_QUERY_SLAVE_OK, &b);
-   server_stream = _mongoc_cluster_create_server_stream (
-      cluster->client->topology, sd->id, stream, error);
-   ret = mongoc_cluster_run_command_parts (
-      cluster, server_stream, &parts, &reply, error);
-   mongoc_server_stream_cleanup (server_stream);
-   if (!ret) {
-      /* error->message is already set */
-      error->domain = MONGOC_ERROR_CLIENT;
-      error->code = MONGOC_ERROR_CLIENT_AUTHENTICATE;
+   timeout_msec = cluster->client->topology->connect_timeout_msec;
+   if (cluster->deadline) {
+      timeout_msec = BSON_MIN (
+         timeout_msec, _mongoc_cluster_deadline_remaining_msec (cluster));
    }
 
-   mongoc_cmd_parts_cleanup (&parts);
-   bson_destroy (&b);
-   bson_destroy (&reply);
+   return (int32_t) BSON_MIN (timeout_msec, INT32_MAX);
+}
 
-   return ret;
+
+#define MONGOC_SLOW_OP_SHAPE_MAX 256
+
+/* append @doc with its values replaced by "?", stopping once @str is
+ * MONGOC_SLOW_OP_SHAPE_MAX bytes long */
+static void
+_mongoc_cluster_append_shape (bson_string_t *str,
+                              const bson_t *doc,
+                              bool is_array)
+{
+   bson_iter_t iter;
+   bson_t child;
+   const uint8_t *data;
+   uint32_t len;
+   char *key;
+   bool first = true;
+
+   bson_string_append (str, is_array ? "[" : "{");
+
+   if (bson_iter_init (&iter, doc)) {
+      while (bson_iter_next (&iter)) {
+         if (str->len >= MONGOC_SLOW_OP_SHAPE_MAX) {
+            bson_string_append (str, " ...");
+            break;
+         }
+
+         bson_string_append (str, first ? " " : ", ");
+         first = false;
+
+         if (!is_array) {
+            key = bson_utf8_escape_for_json (bson_iter_key (&iter), -1);
+            bson_string_append_printf (str, "\"%s\" : ", key);
+            bson_free (key);
+         }
+
+         if (BSON_ITER_HOLDS_DOCUMENT (&iter) ||
+             BSON_ITER_HOLDS_ARRAY (&iter)) {
+            if (BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+               bson_iter_document (&iter, &len, &data);
+            } else {
+               bson_iter_array (&iter, &len, &data);
+            }
+
+            if (bson_init_static (&child, data, len)) {
+               _mongoc_cluster_append_shape (
+                  str, &child, BSON_ITER_HOLDS_ARRAY (&iter));
+            }
+         } else {
+            bson_string_append (str, "?");
+         }
+      }
+   }
+
+   bson_string_append (str, is_array ? " ]" : " }");
 }
 
 
-#ifdef MONGOC_ENABLE_SSL
+/* the filter of a find, count or distinct, or an aggregation's leading
+ * $match, or false if @command has none */
 static bool
-_mongoc_cluster_auth_node_x509 (mongoc_cluster_t *cluster,
-                                mongoc_stream_t *stream,
-                                mongoc_server_description_t *sd,
-                                bson_error_t *error)
+_mongoc_cluster_slow_op_filter (const bson_t *command, bson_t *filter)
 {
-   mongoc_cmd_parts_t parts;
-   const char *username_from_uri = NULL;
-   char *username_from_subject = NULL;
-   bson_t cmd;
-   bson_t reply;
-   bool ret;
-   mongoc_server_stream_t *server_stream;
+   bson_iter_t iter;
+   bson_iter_t stage;
+   const uint8_t *data;
+   uint32_t len;
+
+   if ((bson_iter_init_find (&iter, command, "filter") ||
+        bson_iter_init_find (&iter, command, "query")) &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_iter_document (&iter, &len, &data);
+      return bson_init_static (filter, data, len);
+   }
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (stream);
+   if (bson_iter_init_find (&iter, command, "pipeline") &&
+       BSON_ITER_HOLDS_ARRAY (&iter) && bson_iter_recurse (&iter, &stage) &&
+       bson_iter_next (&stage) && BSON_ITER_HOLDS_DOCUMENT (&stage) &&
+       bson_iter_recurse (&stage, &iter) && bson_iter_find (&iter, "$match") &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_iter_document (&iter, &len, &data);
+      return bson_init_static (filter, data, len);
+   }
 
-   username_from_uri = mongoc_uri_get_username (cluster->uri);
-   if (username_from_uri) {
-      TRACE ("%s", "X509: got username from URI");
-   } else {
-      if (!cluster->client->ssl_opts.pem_file) {
-         bson_set_error (error,
-                         MONGOC_ERROR_CLIENT,
-                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                         "cannot determine username for "
-                         "X-509 authentication.");
-         return false;
-      }
-
-      username_from_subject = mongoc_ssl_extract_subject (
-         cluster->client->ssl_opts.pem_file, cluster->client->ssl_opts.pem_pwd);
-      if (!username_from_subject) {
-         bson_set_error (error,
-                         MONGOC_ERROR_CLIENT,
-                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                         "No username provided for X509 authentication.");
-         return false;
-      }
-
-      TRACE ("%s", "X509: got username from certificate");
-   }
-
-   bson_init (&cmd);
-   BSON_APPEND_INT32 (&cmd, "authenticate", 1);
-   BSON_APPEND_UTF8 (&cmd, "mechanism", "MONGODB-X509");
-   BSON_APPEND_UTF8 (&cmd,
-                     "user",
-                     username_from_uri ? username_from_uri
-                                       : username_from_subject);
-
-   mongoc_cmd_parts_init (&parts, "$external", MONGOC_QUERY_SLAVE_OK, &cmd);
-   server_stream = _mongoc_cluster_create_server_stream (
-      cluster->client->topology, sd->id, stream, error);
-   ret = mongoc_cluster_run_command_parts (
-      cluster, server_stream, &parts, &reply, error);
-   mongoc_server_stream_cleanup (server_stream);
-   if (!ret) {
-      /* error->message is already set */
-      error->domain = MONGOC_ERROR_CLIENT;
-      error->code = MONGOC_ERROR_CLIENT_AUTHENTICATE;
-   }
-
-   if (username_from_subject) {
-      bson_free (username_from_subject);
-   }
-
-   mongoc_cmd_parts_cleanup (&parts);
-   bson_destroy (&cmd);
-   bson_destroy (&reply);
-
-   return ret;
+   return false;
 }
-#endif
 
 
-#ifdef MONGOC_ENABLE_CRYPTO
-static bool
-_mongoc_cluster_auth_node_scram (mongoc_cluster_t *cluster,
-                                 mongoc_stream_t *stream,
-                                 mongoc_server_description_t *sd,
-                                 bson_error_t *error)
+/* log @cmd if it took at least slowOpThresholdMS. @reply is the reply of a
+ * command that succeeded, or NULL if it failed with @error */
+static void
+_mongoc_cluster_log_slow_op (mongoc_cluster_t *cluster,
+                             const mongoc_cmd_t *cmd,
+                             int64_t started,
+                             const bson_t *reply,
+                             const bson_error_t *error)
 {
-   mongoc_cmd_parts_t parts;
-   uint32_t buflen = 0;
-   mongoc_scram_t scram;
+   int64_t usec;
    bson_iter_t iter;
-   bool ret = false;
-   const char *tmpstr;
-   const char *auth_source;
-   uint8_t buf[4096] = {0};
-   bson_t cmd;
-   bson_t reply;
-   int conv_id = 0;
-   bson_subtype_t btype;
-   mongoc_server_stream_t *server_stream;
-
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (stream);
+   bson_t filter;
+   bson_string_t *str;
+   const bson_t *command;
+   bson_t command_storage;
 
-   if (!(auth_source = mongoc_uri_get_auth_source (cluster->uri)) ||
-       (*auth_source == '\0')) {
-      auth_source = "admin";
+   if (cluster->slow_op_threshold_usec < 0) {
+      return;
    }
 
-   _mongoc_scram_init (&scram);
-
-   _mongoc_scram_set_pass (&scram, mongoc_uri_get_password (cluster->uri));
-   _mongoc_scram_set_user (&scram, mongoc_uri_get_username (cluster->uri));
-   if (*cluster->scram_client_key) {
-      _mongoc_scram_set_client_key (
-         &scram, cluster->scram_client_key, sizeof (cluster->scram_client_key));
-   }
-   if (*cluster->scram_server_key) {
-      _mongoc_scram_set_server_key (
-         &scram, cluster->scram_server_key, sizeof (cluster->scram_server_key));
-   }
-   if (*cluster->scram_salted_password) {
-      _mongoc_scram_set_salted_password (
-         &scram,
-         cluster->scram_salted_password,
-         sizeof (cluster->scram_salted_password));
+   usec = bson_get_monotonic_time () - started;
+   if (usec < cluster->slow_op_threshold_usec) {
+      return;
    }
 
-   for (;;) {
-      if (!_mongoc_scram_step (
-             &scram, buf, buflen, buf, sizeof buf, &buflen, error)) {
-         goto failure;
-      }
-
-      bson_init (&cmd);
-
-      if (scram.step == 1) {
-         BSON_APPEND_INT32 (&cmd, "saslStart", 1);
-         BSON_APPEND_UTF8 (&cmd, "mechanism", "SCRAM-SHA-1");
-         bson_append_binary (
-            &cmd, "payload", 7, BSON_SUBTYPE_BINARY, buf, buflen);
-         BSON_APPEND_INT32 (&cmd, "autoAuthorize", 1);
-      } else {
-         BSON_APPEND_INT32 (&cmd, "saslContinue", 1);
-         BSON_APPEND_INT32 (&cmd, "conversationId", conv_id);
-         bson_append_binary (
-            &cmd, "payload", 7, BSON_SUBTYPE_BINARY, buf, buflen);
-      }
-
-      TRACE ("SCRAM: authenticating (step %d)", scram.step);
-
-      mongoc_cmd_parts_init (&parts, auth_source, MONGOC_QUERY_SLAVE_OK, &cmd);
-      server_stream = _mongoc_cluster_create_server_stream (
-         cluster->client->topology, sd->id, stream, error);
-      if (!mongoc_cluster_run_command_parts (
-             cluster, server_stream, &parts, &reply, error)) {
-         mongoc_server_stream_cleanup (server_stream);
-         bson_destroy (&cmd);
-         bson_destroy (&reply);
-
-         /* error->message is already set */
-         error->domain = MONGOC_ERROR_CLIENT;
-         error->code = MONGOC_ERROR_CLIENT_AUTHENTICATE;
-         goto failure;
-      }
-      mongoc_server_stream_cleanup (server_stream);
-
-      mongoc_cmd_parts_cleanup (&parts);
-      bson_destroy (&cmd);
-
-      if (bson_iter_init_find (&iter, &reply, "done") &&
-          bson_iter_as_bool (&iter)) {
-         bson_destroy (&reply);
-         break;
-      }
-
-      if (!bson_iter_init_find (&iter, &reply, "conversationId") ||
-          !BSON_ITER_HOLDS_INT32 (&iter) ||
-          !(conv_id = bson_iter_int32 (&iter)) ||
-          !bson_iter_init_find (&iter, &reply, "payload") ||
-          !BSON_ITER_HOLDS_BINARY (&iter)) {
-         const char *errmsg =
-            "Received invalid SCRAM reply from MongoDB server.";
-
-         MONGOC_DEBUG ("SCRAM: authentication failed");
-
-         if (bson_iter_init_find (&iter, &reply, "errmsg") &&
-             BSON_ITER_HOLDS_UTF8 (&iter)) {
-            errmsg = bson_iter_utf8 (&iter, NULL);
-         }
-
-         bson_set_error (error,
-                         MONGOC_ERROR_CLIENT,
-                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                         "%s",
-                         errmsg);
-         bson_destroy (&reply);
-         goto failure;
-      }
-
-      bson_iter_binary (&iter, &btype, &buflen, (const uint8_t **) &tmpstr);
-
-      if (buflen > sizeof buf) {
-         bson_set_error (error,
-                         MONGOC_ERROR_CLIENT,
-                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                         "SCRAM reply from MongoDB is too large.");
-         bson_destroy (&reply);
-         goto failure;
-      }
+   command = cmd->command
+                ? mongoc_cmd_get_command (cmd, &command_storage)
+                : NULL;
+
+   str = bson_string_new (NULL);
+   bson_string_append_printf (
+      str, "command=%s ns=%s", cmd->command_name, cmd->db_name);
+   /* the collection name, if the command's first field is one */
+   if (command && bson_iter_init (&iter, command) &&
+       bson_iter_next (&iter) && BSON_ITER_HOLDS_UTF8 (&iter)) {
+      bson_string_append_printf (str, ".%s", bson_iter_utf8 (&iter, NULL));
+   }
 
-      memcpy (buf, tmpstr, buflen);
+   bson_string_append_printf (str,
+                              " server=%s durationMS=%" PRId64 ".%03" PRId64,
+                              cmd->server_stream->sd->host.host_and_port,
+                              usec / 1000,
+                              usec % 1000);
 
-      bson_destroy (&reply);
+   if (reply) {
+      bson_string_append_printf (str, " replyBytes=%" PRIu32, reply->len);
+   } else {
+      bson_string_append_printf (
+         str, " error=\"%s\"", error ? error->message : "");
    }
 
-   TRACE ("%s", "SCRAM: authenticated");
-
-   ret = true;
-   memcpy (cluster->scram_client_key,
-           scram.client_key,
-           sizeof (cluster->scram_client_key));
-   memcpy (cluster->scram_server_key,
-           scram.server_key,
-           sizeof (cluster->scram_server_key));
-   memcpy (cluster->scram_salted_password,
-           scram.salted_password,
-           sizeof (cluster->scram_salted_password));
+   if (command && _mongoc_cluster_slow_op_filter (command, &filter)) {
+      bson_string_append (str, " filter=");
+      _mongoc_cluster_append_shape (str, &filter, false);
+   }
 
-failure:
-   _mongoc_scram_destroy (&scram);
+   mongoc_log (MONGOC_LOG_LEVEL_MESSAGE, "slowop", "%s", str->str);
+   bson_string_free (str, true);
 
-   return ret;
+   if (command) {
+      bson_destroy (&command_storage);
+   }
 }
-#endif
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_auth_node --
+ * mongoc_cluster_run_command_opquery --
  *
- *       Authenticate a cluster node depending on the required mechanism.
+ *       Internal function to run a command on a given stream. @error and
+ *       @reply are optional out-pointers.
  *
  * Returns:
- *       true if authenticated. false on failure and @error is set.
+ *       true if successful; otherwise false and @error is set.
  *
  * Side effects:
- *       @error is set on failure.
+ *       @reply is set and should ALWAYS be released with bson_destroy().
+ *       On failure, @error is filled out. If this was a network error
+ *       and server_id is nonzero, the cluster disconnects from the server.
  *
  *--------------------------------------------------------------------------
  */
 
 static bool
-_mongoc_cluster_auth_node (mongoc_cluster_t *cluster,
-                           mongoc_stream_t *stream,
-                           mongoc_server_description_t *sd,
-                           bson_error_t *error)
+mongoc_cluster_run_command_opquery (mongoc_cluster_t *cluster,
+                                    mongoc_cmd_t *cmd,
+                                    mongoc_stream_t *stream,
+                                    int32_t compressor_id,
+                                    const mongoc_host_list_t *host,
+                                    bson_t *reply,
+                                    bson_error_t *error)
 {
+   const size_t reply_header_size = sizeof (mongoc_rpc_reply_header_t);
+   uint8_t reply_header_buf[sizeof (mongoc_rpc_reply_header_t)];
+   uint8_t *reply_buf; /* reply body */
+   mongoc_rpc_t rpc;   /* sent to server */
+   mongoc_rpc_header_t encoded_header;
+   bson_t reply_local;
+   bson_t *reply_ptr;
+   char cmd_ns[MONGOC_NAMESPACE_MAX];
+   uint32_t request_id;
+   int32_t msg_len;
+   size_t doc_len;
    bool ret = false;
-   const char *mechanism;
+   uint32_t server_id;
+   int64_t since;
+
    ENTRY;
 
    BSON_ASSERT (cluster);
+   BSON_ASSERT (cmd);
    BSON_ASSERT (stream);
 
-   mechanism = mongoc_uri_get_auth_mechanism (cluster->uri);
+   /*
+    * setup
+    */
+   reply_ptr = reply ? reply : &reply_local;
+   bson_init (reply_ptr);
 
-   /* Use cached max_wire_version, not value from sd */
-   if (!mechanism) {
-      if (sd->max_wire_version < WIRE_VERSION_SCRAM_DEFAULT) {
-         mechanism = "MONGODB-CR";
-      } else {
-         mechanism = "SCRAM-SHA-1";
+   error->code = 0;
+
+   /*
+    * prepare the request
+    */
+
+   _mongoc_array_clear (&cluster->iov);
+
+   request_id = ++cluster->request_id;
+   server_id = cmd->server_stream->sd->id;
+
+   if (cmd->encoded_opquery) {
+      _mongoc_rpc_gather_encoded (cmd->encoded_opquery,
+                                  cmd->encoded_opquery_len,
+                                  (int32_t) request_id,
+                                  &encoded_header,
+                                  &cluster->iov);
+      rpc.header.msg_len =
+         (int32_t) BSON_UINT32_TO_LE ((uint32_t) cmd->encoded_opquery_len);
+   } else {
+      bson_snprintf (cmd_ns, sizeof cmd_ns, "%s.$cmd", cmd->db_name);
+      _mongoc_rpc_prep_command (&rpc, cmd_ns, cmd);
+      rpc.header.request_id = request_id;
+
+      _mongoc_rpc_gather (&rpc, &cluster->iov);
+      _mongoc_rpc_swab_to_le (&rpc);
+   }
+
+   if (compressor_id != -1 && IS_NOT_COMMAND ("ismaster") &&
+       IS_NOT_COMMAND ("saslstart") && IS_NOT_COMMAND ("saslcontinue") &&
+       IS_NOT_COMMAND ("getnonce") && IS_NOT_COMMAND ("authenticate") &&
+       IS_NOT_COMMAND ("createuser") && IS_NOT_COMMAND ("updateuser") &&
+       IS_NOT_COMMAND ("copydbsaslstart") &&
+       IS_NOT_COMMAND ("copydbgetnonce") && IS_NOT_COMMAND ("copydb")) {
+      since = _mongoc_cluster_span_now (cluster);
+      if (!_mongoc_rpc_compress (
+             cluster, compressor_id, cmd->command_name, &rpc, error)) {
+         GOTO (done);
       }
+      _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_COMPRESS, since);
    }
 
-   if (0 == strcasecmp (mechanism, "MONGODB-CR")) {
-      ret = _mongoc_cluster_auth_node_cr (cluster, stream, sd, error);
-   } else if (0 == strcasecmp (mechanism, "MONGODB-X509")) {
-#ifdef MONGOC_ENABLE_SSL
-      ret = _mongoc_cluster_auth_node_x509 (cluster, stream, sd, error);
-#else
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                      "The \"%s\" authentication mechanism requires libmongoc "
-                      "built with --enable-ssl",
-                      mechanism);
-#endif
-   } else if (0 == strcasecmp (mechanism, "SCRAM-SHA-1")) {
-#ifdef MONGOC_ENABLE_CRYPTO
-      ret = _mongoc_cluster_auth_node_scram (cluster, stream, sd, error);
-#else
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                      "The \"%s\" authentication mechanism requires libmongoc "
-                      "built with --enable-ssl",
-                      mechanism);
-#endif
-   } else if (0 == strcasecmp (mechanism, "GSSAPI")) {
-#ifdef MONGOC_ENABLE_SASL
-      ret = _mongoc_cluster_auth_node_sasl (cluster, stream, sd, error);
-#else
+   if (cluster->client->in_exhaust) {
       bson_set_error (error,
                       MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                      "The \"%s\" authentication mechanism requires libmongoc "
-                      "built with --enable-sasl",
-                      mechanism);
-#endif
-   } else if (0 == strcasecmp (mechanism, "PLAIN")) {
-      ret = _mongoc_cluster_auth_node_plain (cluster, stream, sd, error);
+                      MONGOC_ERROR_CLIENT_IN_EXHAUST,
+                      "A cursor derived from this client is in exhaust.");
+      GOTO (done);
+   }
+
+   /*
+    * send and receive
+    */
+   since = _mongoc_cluster_span_now (cluster);
+   if (!_mongoc_stream_writev_full (stream,
+                                    cluster->iov.data,
+                                    cluster->iov.len,
+                                    _mongoc_cluster_io_timeout_msec (cluster),
+                                    error)) {
+      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
+
+      /* add info about the command to writev_full's error message */
+      _bson_error_message_printf (
+         error,
+         "Failed to send \"%s\" command with database \"%s\": %s",
+         cmd->command_name,
+         cmd->db_name,
+         error->message);
+
+      GOTO (done);
+   }
+
+   _mongoc_cluster_count_egress (
+      cluster, cmd->server_stream, rpc.header.msg_len);
+   _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_SEND, since);
+
+   since = _mongoc_cluster_span_now (cluster);
+   if (reply_header_size !=
+       mongoc_stream_read (stream,
+                           &reply_header_buf,
+                           reply_header_size,
+                           reply_header_size,
+                           _mongoc_cluster_io_timeout_msec (cluster))) {
+      RUN_CMD_ERR (MONGOC_ERROR_STREAM,
+                   MONGOC_ERROR_STREAM_SOCKET,
+                   "socket error or timeout");
+
+      _mongoc_cluster_count_timeout (cmd->server_stream->sd, stream);
+      mongoc_cluster_disconnect_node (
+         cluster, server_id, !mongoc_stream_timed_out (stream), error);
+      GOTO (done);
+   }
+
+   _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_SERVER_WAIT, since);
+
+   memcpy (&msg_len, reply_header_buf, 4);
+   msg_len = BSON_UINT32_FROM_LE (msg_len);
+   if ((msg_len < reply_header_size) ||
+       (msg_len > MONGOC_DEFAULT_MAX_MSG_SIZE)) {
+      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
+      GOTO (done);
+   }
+
+   if (!_mongoc_rpc_scatter_reply_header_only (
+          &rpc, reply_header_buf, reply_header_size)) {
+      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
+      GOTO (done);
+   }
+   doc_len = (size_t) msg_len - reply_header_size;
+   _mongoc_cluster_count_ingress (cluster, cmd->server_stream, msg_len);
+
+   if (BSON_UINT32_FROM_LE (rpc.header.opcode) == MONGOC_OPCODE_COMPRESSED) {
+      bson_t tmp = BSON_INITIALIZER;
+      mongoc_buffer_t *buffer;
+      uint8_t *buf = NULL;
+      size_t len = BSON_UINT32_FROM_LE (rpc.compressed.uncompressed_size) +
+                   sizeof (mongoc_rpc_header_t);
+
+      buffer = _mongoc_cluster_reply_buffer (cluster);
+      _mongoc_buffer_append (buffer, reply_header_buf, reply_header_size);
+
+      since = _mongoc_cluster_span_now (cluster);
+      if (!_mongoc_buffer_append_from_stream (
+             buffer,
+             stream,
+             doc_len,
+             _mongoc_cluster_io_timeout_msec (cluster),
+             error)) {
+         RUN_CMD_ERR (MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_SOCKET,
+                      "socket error or timeout");
+         mongoc_cluster_disconnect_node (cluster, server_id, true, error);
+         GOTO (done);
+      }
+      _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_RECEIVE, since);
+      if (!_mongoc_rpc_scatter (&rpc, buffer->data, buffer->len)) {
+         GOTO (done);
+      }
+
+      since = _mongoc_cluster_span_now (cluster);
+      buf = _mongoc_cluster_decompress_buffer (cluster, len);
+      if (!_mongoc_rpc_decompress (&rpc, buf, len, &cluster->compress)) {
+         RUN_CMD_ERR (MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Could not decompress server reply");
+         _mongoc_cluster_trim_reply_buffers (cluster);
+         GOTO (done);
+      }
+      _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_DECOMPRESS, since);
+
+      _mongoc_rpc_swab_from_le (&rpc);
+
+      _mongoc_rpc_get_first_document (&rpc, &tmp);
+      bson_copy_to (&tmp, reply_ptr);
+      _mongoc_cluster_trim_reply_buffers (cluster);
+   } else if (BSON_UINT32_FROM_LE (rpc.header.opcode) == MONGOC_OPCODE_REPLY &&
+              BSON_UINT32_FROM_LE (rpc.reply_header.n_returned) == 1) {
+      reply_buf = bson_reserve_buffer (reply_ptr, (uint32_t) doc_len);
+      BSON_ASSERT (reply_buf);
+
+      since = _mongoc_cluster_span_now (cluster);
+      if (doc_len !=
+          mongoc_stream_read (stream,
+                              (void *) reply_buf,
+                              doc_len,
+                              doc_len,
+                              _mongoc_cluster_io_timeout_msec (cluster))) {
+         RUN_CMD_ERR (MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_SOCKET,
+                      "socket error or timeout");
+         mongoc_cluster_disconnect_node (cluster, server_id, true, error);
+         GOTO (done);
+      }
+      _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_RECEIVE, since);
+      _mongoc_rpc_swab_from_le (&rpc);
    } else {
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                      "Unknown authentication mechanism \"%s\".",
-                      mechanism);
+      GOTO (done);
+   }
+
+   if (!_mongoc_cmd_check_ok (
+          reply_ptr, cluster->client->error_api_version, error)) {
+      GOTO (done);
+   }
+
+   _mongoc_topology_update_cluster_time (cluster->client->topology, reply_ptr);
+   _mongoc_client_session_advance_operation_time (cmd->session, reply_ptr);
+
+   ret = true;
+
+done:
+
+   if (!ret && error->code == 0) {
+      /* generic error */
+      RUN_CMD_ERR (MONGOC_ERROR_PROTOCOL,
+                   MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                   "Invalid reply from server.");
    }
 
    if (!ret) {
-      mongoc_counter_auth_failure_inc ();
-      MONGOC_DEBUG ("Authentication failed: %s", error->message);
-   } else {
-      mongoc_counter_auth_success_inc ();
-      TRACE ("%s", "Authentication succeeded");
+      _mongoc_cluster_count_error (cmd->server_stream->sd);
+   }
+
+   if (reply_ptr == &reply_local) {
+      bson_destroy (reply_ptr);
    }
 
    RETURN (ret);
 }
 
 
+/* record a command's round trip in its "Command Latency" histogram */
+static void
+_mongoc_cluster_record_command_latency (const char *command_name,
+                                        int64_t started)
+{
+   int64_t usec = bson_get_monotonic_time () - started;
+
+   if (!strcasecmp (command_name, "find")) {
+      mongoc_histogram_cmd_find_record (usec);
+   } else if (!strcasecmp (command_name, "getMore")) {
+      mongoc_histogram_cmd_getmore_record (usec);
+   } else if (!strcasecmp (command_name, "insert")) {
+      mongoc_histogram_cmd_insert_record (usec);
+   } else if (!strcasecmp (command_name, "update")) {
+      mongoc_histogram_cmd_update_record (usec);
+   } else if (!strcasecmp (command_name, "delete")) {
+      mongoc_histogram_cmd_delete_record (usec);
+   } else if (!strcasecmp (command_name, "aggregate")) {
+      mongoc_histogram_cmd_aggregate_record (usec);
+   } else {
+      mongoc_histogram_cmd_other_record (usec);
+   }
+}
+
+static void
+_mongoc_cluster_build_command (void *ctx, bson_t *doc)
+{
+   const mongoc_cmd_t *cmd = (const mongoc_cmd_t *) ctx;
+
+   bson_concat (doc, cmd->command);
+   bson_concat (doc, cmd->command_suffix);
+}
+
+
+/* an OP_MSG command's suffix is only concatenated to it for the event if a
+ * callback asks for the command */
+static void
+_mongoc_cluster_started_init (mongoc_cluster_t *cluster,
+                              mongoc_apm_command_started_t *event,
+                              const mongoc_cmd_t *cmd,
+                              int64_t request_id)
+{
+   if (cmd->command_suffix) {
+      mongoc_apm_command_started_init_lazy (event,
+                                            _mongoc_cluster_build_command,
+                                            (void *) cmd,
+                                            cmd->db_name,
+                                            cmd->command_name,
+                                            request_id,
+                                            cmd->operation_id,
+                                            &cmd->server_stream->sd->host,
+                                            cmd->server_stream->sd->id,
+                                            cluster->client->apm_context);
+   } else {
+      mongoc_apm_command_started_init (event,
+                                       cmd->command,
+                                       cmd->db_name,
+                                       cmd->command_name,
+                                       request_id,
+                                       cmd->operation_id,
+                                       &cmd->server_stream->sd->host,
+                                       cmd->server_stream->sd->id,
+                                       cluster->client->apm_context);
+   }
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_disconnect_node --
- *
- *       Remove a node from the set of nodes. This should be done if
- *       a stream in the set is found to be invalid. If @invalidate is
- *       true, also mark the server Unknown in the topology description,
- *       passing the error information from @why as the reason.
+ * mongoc_cluster_run_command_monitored --
  *
- *       WARNING: pointers to a disconnected mongoc_cluster_node_t or
- *       its stream are now invalid, be careful of dangling pointers.
+ *       Internal function to run a command on a given stream.
+ *       @error and @reply are optional out-pointers.
  *
  * Returns:
- *       None.
+ *       true if successful; otherwise false and @error is set.
  *
  * Side effects:
- *       Removes node from cluster's set of nodes, and frees the
- *       mongoc_cluster_node_t if pooled.
+ *       If the client's APM callbacks are set, they are executed.
+ *       @reply is set and should ALWAYS be released with bson_destroy().
  *
  *--------------------------------------------------------------------------
  */
 
-void
-mongoc_cluster_disconnect_node (mongoc_cluster_t *cluster,
-                                uint32_t server_id,
-                                bool invalidate,
-                                const bson_error_t *why /* IN */)
+bool
+mongoc_cluster_run_command_monitored (mongoc_cluster_t *cluster,
+                                      mongoc_cmd_t *cmd,
+                                      bson_t *reply,
+                                      bson_error_t *error)
+{
+   bool retval;
+   uint32_t request_id = ++cluster->request_id;
+   mongoc_apm_callbacks_t *callbacks;
+   mongoc_apm_command_started_t started_event;
+   mongoc_apm_command_succeeded_t succeeded_event;
+   mongoc_apm_command_failed_t failed_event;
+   int64_t started = bson_get_monotonic_time ();
+   const mongoc_server_stream_t *server_stream;
+   bson_t reply_local;
+   bson_error_t error_local;
+   int32_t compressor_id;
+
+   server_stream = cmd->server_stream;
+   compressor_id = _mongoc_cluster_compressor_id (cluster, server_stream->sd);
+
+   callbacks = &cluster->client->apm_callbacks;
+   if (!reply) {
+      reply = &reply_local;
+   }
+   if (!error) {
+      error = &error_local;
+   }
+
+   if (callbacks->started &&
+       _mongoc_apm_command_sampled (callbacks, cmd->operation_id)) {
+      _mongoc_cluster_started_init (cluster, &started_event, cmd, request_id);
+
+      callbacks->started (&started_event);
+      mongoc_apm_command_started_cleanup (&started_event);
+   }
+
+   _mongoc_topology_load_begin (cluster->client->topology,
+                                server_stream->sd->id);
+   if (server_stream->sd->max_wire_version >= WIRE_VERSION_OP_MSG &&
+       !cmd->encoded_opquery) {
+      retval = mongoc_cluster_run_opmsg (cluster, cmd, reply, error);
+   } else {
+      retval = mongoc_cluster_run_command_opquery (cluster,
+                                                   cmd,
+                                                   server_stream->stream,
+                                                   compressor_id,
+                                                   &server_stream->sd->host,
+                                                   reply,
+                                                   error);
+   }
+   _mongoc_topology_load_end (
+      cluster->client->topology, server_stream->sd->id, started);
+   _mongoc_cluster_record_command_latency (cmd->command_name, started);
+
+   /* even a failed command may have changed collections or indexes */
+   if (cluster->client->metadata_cache) {
+      _mongoc_metadata_cache_command (
+         cluster->client->metadata_cache, cmd->db_name, cmd->command);
+   }
+
+   if (cluster->client->find_caches) {
+      _mongoc_find_cache_command (
+         cluster->client->find_caches, cmd->db_name, cmd->command);
+   }
+
+   if (retval && callbacks->succeeded &&
+       _mongoc_apm_command_sampled (callbacks, cmd->operation_id)) {
+      mongoc_apm_command_succeeded_init (&succeeded_event,
+                                         bson_get_monotonic_time () - started,
+                                         reply,
+                                         cmd->command_name,
+                                         request_id,
+                                         cmd->operation_id,
+                                         &server_stream->sd->host,
+                                         server_stream->sd->id,
+                                         cluster->client->apm_context);
+
+      callbacks->succeeded (&succeeded_event);
+      mongoc_apm_command_succeeded_cleanup (&succeeded_event);
+   }
+   if (!retval && callbacks->failed &&
+       _mongoc_apm_command_sampled (callbacks, cmd->operation_id)) {
+      mongoc_apm_command_failed_init (&failed_event,
+                                      bson_get_monotonic_time () - started,
+                                      cmd->command_name,
+                                      error,
+                                      request_id,
+                                      cmd->operation_id,
+                                      &server_stream->sd->host,
+                                      server_stream->sd->id,
+                                      cluster->client->apm_context);
+
+      callbacks->failed (&failed_event);
+      mongoc_apm_command_failed_cleanup (&failed_event);
+   }
+
+   _mongoc_cluster_span_end (cluster, cmd, request_id, retval);
+   _mongoc_cluster_log_slow_op (
+      cluster, cmd, started, retval ? reply : NULL, error);
+
+   if (reply == &reply_local) {
+      bson_destroy (&reply_local);
+   }
+   return retval;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_run_command_private --
+ *
+ *       Internal function to run a command on a given stream.
+ *       @error and @reply are optional out-pointers.
+ *       The client's APM callbacks are not executed.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @reply is set and should ALWAYS be released with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cluster_run_command_private (mongoc_cluster_t *cluster,
+                                    mongoc_cmd_t *cmd,
+                                    bson_t *reply,
+                                    bson_error_t *error)
+{
+   bool retval;
+   const mongoc_server_stream_t *server_stream;
+   bson_t reply_local;
+
+   if (!reply) {
+      reply = &reply_local;
+   }
+   server_stream = cmd->server_stream;
+   if (server_stream->sd->max_wire_version >= WIRE_VERSION_OP_MSG &&
+       !cmd->encoded_opquery) {
+      retval = mongoc_cluster_run_opmsg (cluster, cmd, reply, error);
+   } else {
+      retval = mongoc_cluster_run_command_opquery (
+         cluster, cmd, cmd->server_stream->stream, -1, NULL, reply, error);
+   }
+   if (reply == &reply_local) {
+      bson_destroy (&reply_local);
+   }
+   return retval;
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_run_command_parts --
+ *
+ *       Internal function to assemble command parts and run a command
+ *       on a given stream. @error and @reply are optional out-pointers.
+ *       The client's APM callbacks are not executed.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @reply is set and should ALWAYS be released with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cluster_run_command_parts (mongoc_cluster_t *cluster,
+                                  mongoc_server_stream_t *server_stream,
+                                  mongoc_cmd_parts_t *parts,
+                                  bson_t *reply,
+                                  bson_error_t *error)
+{
+   if (!mongoc_cmd_parts_assemble (parts, server_stream, error)) {
+      _mongoc_bson_init_if_set (reply);
+      mongoc_cmd_parts_cleanup (parts);
+      return false;
+   }
+
+   return mongoc_cluster_run_command_private (
+      cluster, &parts->assembled, reply, error);
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_run_ismaster --
+ *
+ *       Run an ismaster command on the given stream. If @speculative is
+ *       not NULL, the command also begins authentication, see
+ *       _mongoc_cluster_speculative_begin. Otherwise it is sent as the
+ *       OP_QUERY message the topology scanner encoded once. If @handshake
+ *       is false the stream has already sent its client metadata, and a
+ *       plain ismaster is sent instead.
+ *
+ * Returns:
+ *       A mongoc_server_description_t you must destroy. If the call failed
+ *       its error is set and its type is MONGOC_SERVER_UNKNOWN.
+ *
+ *--------------------------------------------------------------------------
+ */
+static mongoc_server_description_t *
+_mongoc_stream_run_ismaster (mongoc_cluster_t *cluster,
+                             mongoc_stream_t *stream,
+                             const char *address,
+                             uint32_t server_id,
+                             bool handshake,
+                             mongoc_cluster_speculative_t *speculative)
+{
+   mongoc_topology_scanner_t *scanner;
+   const bson_t *ismaster;
+   bson_t command;
+   mongoc_cmd_parts_t parts;
+   bson_t reply;
+   bson_error_t error;
+   int64_t start;
+   int64_t rtt_msec;
+   mongoc_server_description_t *sd;
+   mongoc_server_stream_t *server_stream;
+   bool r;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (stream);
+
+   scanner = cluster->client->topology->scanner;
+   ismaster = handshake ? _mongoc_topology_scanner_get_ismaster (scanner)
+                        : &scanner->ismaster_cmd;
+
+   if (speculative) {
+      bson_copy_to (ismaster, &command);
+      _mongoc_cluster_speculative_begin (cluster, speculative, &command);
+   } else {
+      bson_init_static (&command, bson_get_data (ismaster), ismaster->len);
+   }
+
+   start = bson_get_monotonic_time ();
+   server_stream = _mongoc_cluster_create_server_stream (
+      cluster->client->topology, server_id, stream, &error);
+   if (!server_stream) {
+      bson_destroy (&command);
+      RETURN (NULL);
+   }
+
+   mongoc_cmd_parts_init (&parts, "admin", MONGOC_QUERY_SLAVE_OK, &command);
+   if (!mongoc_cmd_parts_assemble (&parts, server_stream, &error)) {
+      mongoc_cmd_parts_cleanup (&parts);
+      mongoc_server_stream_cleanup (server_stream);
+      bson_destroy (&command);
+      RETURN (NULL);
+   }
+
+   if (handshake && !speculative) {
+      parts.assembled.encoded_opquery =
+         _mongoc_topology_scanner_get_ismaster_msg (
+            scanner, &parts.assembled.encoded_opquery_len);
+   }
+
+   if (!mongoc_cluster_run_command_private (
+          cluster, &parts.assembled, &reply, &error)) {
+      mongoc_cmd_parts_cleanup (&parts);
+      mongoc_server_stream_cleanup (server_stream);
+      bson_destroy (&command);
+      RETURN (NULL);
+   }
+
+   rtt_msec = (bson_get_monotonic_time () - start) / 1000;
+
+   if (speculative) {
+      _mongoc_cluster_speculative_reply (speculative, &reply);
+   }
+
+   sd = (mongoc_server_description_t *) bson_malloc0 (
+      sizeof (mongoc_server_description_t));
+
+   mongoc_server_description_init (sd, address, server_id);
+   /* send the error from run_command IN to handle_ismaster */
+   mongoc_server_description_handle_ismaster (sd, &reply, rtt_msec, &error);
+
+   bson_destroy (&reply);
+
+   r = _mongoc_topology_update_from_handshake (cluster->client->topology, sd);
+   if (!r) {
+      mongoc_server_description_reset (sd);
+      bson_set_error (&sd->error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_NOT_ESTABLISHED,
+                      "\"%s\" removed from topology",
+                      address);
+   }
+
+   mongoc_cmd_parts_cleanup (&parts);
+   mongoc_server_stream_cleanup (server_stream);
+   bson_destroy (&command);
+
+   RETURN (sd);
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_run_ismaster --
+ *
+ *       Run an ismaster command for the given node and handle result.
+ *
+ * Returns:
+ *       mongoc_server_description_t on success, NULL otherwise.
+ *       the mongoc_server_description_t MUST BE DESTROYED BY THE CALLER.
+ *
+ * Side effects:
+ *       Makes a blocking I/O call, updates cluster->topology->description
+ *       with ismaster result.
+ *
+ *--------------------------------------------------------------------------
+ */
+static mongoc_server_description_t *
+_mongoc_cluster_run_ismaster (mongoc_cluster_t *cluster,
+                              mongoc_cluster_node_t *node,
+                              uint32_t server_id,
+                              bool handshake,
+                              mongoc_cluster_speculative_t *speculative,
+                              bson_error_t *error /* OUT */)
+{
+   mongoc_server_description_t *sd;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+   BSON_ASSERT (node->stream);
+
+   sd = _mongoc_stream_run_ismaster (cluster,
+                                     node->stream,
+                                     node->connection_address,
+                                     server_id,
+                                     handshake,
+                                     speculative);
+
+   if (sd->type == MONGOC_SERVER_UNKNOWN) {
+      memcpy (error, &sd->error, sizeof (bson_error_t));
+      mongoc_server_description_destroy (sd);
+      return NULL;
+   } else {
+      node->max_write_batch_size = sd->max_write_batch_size;
+      node->min_wire_version = sd->min_wire_version;
+      node->max_wire_version = sd->max_wire_version;
+      node->max_bson_obj_size = sd->max_bson_obj_size;
+      node->max_msg_size = sd->max_msg_size;
+   }
+
+   return sd;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_build_basic_auth_digest --
+ *
+ *       Computes the Basic Authentication digest using the credentials
+ *       configured for @cluster and the @nonce provided.
+ *
+ *       The result should be freed by the caller using bson_free() when
+ *       they are finished with it.
+ *
+ * Returns:
+ *       A newly allocated string containing the digest.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static char *
+_mongoc_cluster_build_basic_auth_digest (mongoc_cluster_t *cluster,
+                                         const char *nonce)
+{
+   const char *username;
+   const char *password;
+   char *password_digest;
+   char *password_md5;
+   char *digest_in;
+   char *ret;
+
+   ENTRY;
+
+   /*
+    * The following generates the digest to be used for basic authentication
+    * with a MongoDB server. More information on the format can be found
+    * at the following location:
+    *
+    * http://docs.mongodb.org/meta-driver/latest/legacy/
+    *   implement-authentication-in-driver/
+    */
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (cluster->uri);
+
+   username = mongoc_uri_get_username (cluster->uri);
+   password = mongoc_uri_get_password (cluster->uri);
+   password_digest = bson_strdup_printf ("%s:mongo:%s", username, password);
+   password_md5 = _mongoc_hex_md5 (password_digest);
+   digest_in = bson_strdup_printf ("%s%s%s", nonce, username, password_md5);
+   ret = _mongoc_hex_md5 (digest_in);
+   bson_free (digest_in);
+   bson_free (password_md5);
+   bson_free (password_digest);
+
+   RETURN (ret);
+}
+
+
+/* the database to authenticate on, "admin" unless authSource is set */
+static const char *
+_mongoc_cluster_auth_source (mongoc_cluster_t *cluster)
+{
+   const char *auth_source;
+
+   if (!(auth_source = mongoc_uri_get_auth_source (cluster->uri)) ||
+       (*auth_source == '\0')) {
+      auth_source = "admin";
+   }
+
+   return auth_source;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_auth_node_cr --
+ *
+ *       Performs authentication of @node using the credentials provided
+ *       when configuring the @cluster instance.
+ *
+ *       This is the Challenge-Response mode of authentication.
+ *
+ * Returns:
+ *       true if authentication was successful; otherwise false and
+ *       @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_auth_node_cr (mongoc_cluster_t *cluster,
+                              mongoc_stream_t *stream,
+                              mongoc_server_description_t *sd,
+                              bson_error_t *error)
+{
+   mongoc_cmd_parts_t parts;
+   bson_iter_t iter;
+   const char *auth_source;
+   bson_t command;
+   bson_t reply;
+   char *digest;
+   char *nonce;
+   bool ret;
+   mongoc_server_stream_t *server_stream;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (stream);
+
+   auth_source = _mongoc_cluster_auth_source (cluster);
+
+   /*
+    * To authenticate a node using basic authentication, we need to first
+    * get the nonce from the server. We use that to hash our password which
+    * is sent as a reply to the server. If everything went good we get a
+    * success notification back from the server.
+    */
+
+   /*
+    * Execute the getnonce command to fetch the nonce used for generating
+    * md5 digest of our password information.
+    */
+   bson_init (&command);
+   bson_append_int32 (&command, "getnonce", 8, 1);
+   mongoc_cmd_parts_init (&parts, auth_source, MONGOC_QUERY_SLAVE_OK, &command);
+   server_stream = _mongoc_cluster_create_server_stream (
+      cluster->client->topology, sd->id, stream, error);
+
+   if (!mongoc_cluster_run_command_parts (
+          cluster, server_stream, &parts, &reply, error)) {
+      mongoc_server_stream_cleanup (server_stream);
+      bson_destroy (&command);
+      bson_destroy (&reply);
+      RETURN (false);
+   }
+   bson_destroy (&command);
+   if (!bson_iter_init_find_case (&iter, &reply, "nonce")) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_GETNONCE,
+                      "Invalid reply from getnonce");
+      bson_destroy (&reply);
+      RETURN (false);
+   }
+
+   /*
+    * Build our command to perform the authentication.
+    */
+   nonce = bson_iter_dup_utf8 (&iter, NULL);
+   digest = _mongoc_cluster_build_basic_auth_digest (cluster, nonce);
+   bson_init (&command);
+   bson_append_int32 (&command, "authenticate", 12, 1);
+   bson_append_utf8 (
+      &command, "user", 4, mongoc_uri_get_username (cluster->uri), -1);
+   bson_append_utf8 (&command, "nonce", 5, nonce, -1);
+   bson_append_utf8 (&command, "key", 3, digest, -1);
+   bson_destroy (&reply);
+   bson_free (nonce);
+   bson_free (digest);
+
+   /*
+    * Execute the authenticate command. mongoc_cluster_run_command_private
+    * checks for {ok: 1} in the response.
+    */
+   mongoc_cmd_parts_cleanup (&parts);
+   mongoc_cmd_parts_init (&parts, auth_source, MONGOC_QUERY_SLAVE_OK, &command);
+   ret = mongoc_cluster_run_command_parts (
+      cluster, server_stream, &parts, &reply, error);
+
+   if (!ret) {
+      /* error->message is already set */
+      error->domain = MONGOC_ERROR_CLIENT;
+      error->code = MONGOC_ERROR_CLIENT_AUTHENTICATE;
+   }
+
+   mongoc_server_stream_cleanup (server_stream);
+   mongoc_cmd_parts_cleanup (&parts);
+   bson_destroy (&command);
+   bson_destroy (&reply);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_auth_node_plain --
+ *
+ *       Perform SASL PLAIN authentication for @node. We do this manually
+ *       instead of using the SASL module because its rather simplistic.
+ *
+ * Returns:
+ *       true if successful; otherwise false and error is set.
+ *
+ * Side effects:
+ *       error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_auth_node_plain (mongoc_cluster_t *cluster,
+                                 mongoc_stream_t *stream,
+                                 mongoc_server_description_t *sd,
+                                 bson_error_t *error)
+{
+   mongoc_cmd_parts_t parts;
+   char buf[4096];
+   int buflen = 0;
+   const char *username;
+   const char *password;
+   bson_t b = BSON_INITIALIZER;
+   bson_t reply;
+   size_t len;
+   char *str;
+   bool ret;
+   mongoc_server_stream_t *server_stream;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (stream);
+
+   username = mongoc_uri_get_username (cluster->uri);
+   if (!username) {
+      username = "";
+   }
+
+   password = mongoc_uri_get_password (cluster->uri);
+   if (!password) {
+      password = "";
+   }
+
+   str = bson_strdup_printf ("%c%s%c%s", '\0', username, '\0', password);
+   len = strlen (username) + strlen (password) + 2;
+   buflen = mongoc_b64_ntop ((const uint8_t *) str, len, buf, sizeof buf);
+   bson_free (str);
+
+   if (buflen == -1) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                      "failed base64 encoding message");
+      return false;
+   }
+
+   BSON_APPEND_INT32 (&b, "saslStart", 1);
+   BSON_APPEND_UTF8 (&b, "mechanism", "PLAIN");
+   bson_append_utf8 (&b, "payload", 7, (const char *) buf, buflen);
+   BSON_APPEND_INT32 (&b, "autoAuthorize", 1);
+
+   mongoc_cmd_parts_init (&parts, "$external", MONGOC_QUERY_SLAVE_OK, &b);
+   server_stream = _mongoc_cluster_create_server_stream (
+      cluster->client->topology, sd->id, stream, error);
+   ret = mongoc_cluster_run_command_parts (
+      cluster, server_stream, &parts, &reply, error);
+   mongoc_server_stream_cleanup (server_stream);
+   if (!ret) {
+      /* error->message is already set */
+      error->domain = MONGOC_ERROR_CLIENT;
+      error->code = MONGOC_ERROR_CLIENT_AUTHENTICATE;
+   }
+
+   mongoc_cmd_parts_cleanup (&parts);
+   bson_destroy (&b);
+   bson_destroy (&reply);
+
+   return ret;
+}
+
+
+#ifdef MONGOC_ENABLE_SSL
+/* build the MONGODB-X509 authenticate command */
+static bool
+_mongoc_cluster_x509_cmd (mongoc_cluster_t *cluster,
+                          bson_t *cmd,
+                          bson_error_t *error)
+{
+   const char *username_from_uri = NULL;
+   char *username_from_subject = NULL;
+
+   username_from_uri = mongoc_uri_get_username (cluster->uri);
+   if (username_from_uri) {
+      TRACE ("%s", "X509: got username from URI");
+   } else {
+      if (!cluster->client->ssl_opts.pem_file) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                         "cannot determine username for "
+                         "X-509 authentication.");
+         return false;
+      }
+
+      username_from_subject = mongoc_ssl_extract_subject (
+         cluster->client->ssl_opts.pem_file, cluster->client->ssl_opts.pem_pwd);
+      if (!username_from_subject) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                         "No username provided for X509 authentication.");
+         return false;
+      }
+
+      TRACE ("%s", "X509: got username from certificate");
+   }
+
+   bson_init (cmd);
+   BSON_APPEND_INT32 (cmd, "authenticate", 1);
+   BSON_APPEND_UTF8 (cmd, "mechanism", "MONGODB-X509");
+   BSON_APPEND_UTF8 (cmd,
+                     "user",
+                     username_from_uri ? username_from_uri
+                                       : username_from_subject);
+
+   if (username_from_subject) {
+      bson_free (username_from_subject);
+   }
+
+   return true;
+}
+
+
+static bool
+_mongoc_cluster_auth_node_x509 (mongoc_cluster_t *cluster,
+                                mongoc_stream_t *stream,
+                                mongoc_server_description_t *sd,
+                                mongoc_cluster_speculative_t *speculative,
+                                bson_error_t *error)
+{
+   mongoc_cmd_parts_t parts;
+   bson_t cmd;
+   bson_t reply;
+   bool ret;
+   mongoc_server_stream_t *server_stream;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (stream);
+
+   if (speculative) {
+      /* the server accepted the command in the handshake */
+      TRACE ("%s", "X509: authenticated in the handshake");
+      return true;
+   }
+
+   if (!_mongoc_cluster_x509_cmd (cluster, &cmd, error)) {
+      return false;
+   }
+
+   mongoc_cmd_parts_init (&parts, "$external", MONGOC_QUERY_SLAVE_OK, &cmd);
+   server_stream = _mongoc_cluster_create_server_stream (
+      cluster->client->topology, sd->id, stream, error);
+   ret = mongoc_cluster_run_command_parts (
+      cluster, server_stream, &parts, &reply, error);
+   mongoc_server_stream_cleanup (server_stream);
+   if (!ret) {
+      /* error->message is already set */
+      error->domain = MONGOC_ERROR_CLIENT;
+      error->code = MONGOC_ERROR_CLIENT_AUTHENTICATE;
+   }
+
+   mongoc_cmd_parts_cleanup (&parts);
+   bson_destroy (&cmd);
+   bson_destroy (&reply);
+
+   return ret;
+}
+#endif
+
+
+#ifdef MONGOC_ENABLE_CRYPTO
+static void
+_mongoc_cluster_init_scram (mongoc_cluster_t *cluster, mongoc_scram_t *scram)
+{
+   _mongoc_scram_init (scram);
+
+   _mongoc_scram_set_pass (scram, mongoc_uri_get_password (cluster->uri));
+   _mongoc_scram_set_user (scram, mongoc_uri_get_username (cluster->uri));
+   if (*cluster->scram_client_key) {
+      _mongoc_scram_set_client_key (
+         scram, cluster->scram_client_key, sizeof (cluster->scram_client_key));
+   }
+   if (*cluster->scram_server_key) {
+      _mongoc_scram_set_server_key (
+         scram, cluster->scram_server_key, sizeof (cluster->scram_server_key));
+   }
+   if (*cluster->scram_salted_password) {
+      _mongoc_scram_set_salted_password (
+         scram,
+         cluster->scram_salted_password,
+         sizeof (cluster->scram_salted_password));
+   }
+}
+
+
+/* keep the keys a successful conversation derived, so later connections
+ * skip the expensive salting of the password */
+static void
+_mongoc_cluster_scram_cache_keys (mongoc_cluster_t *cluster,
+                                  const mongoc_scram_t *scram)
+{
+   memcpy (cluster->scram_client_key,
+           scram->client_key,
+           sizeof (cluster->scram_client_key));
+   memcpy (cluster->scram_server_key,
+           scram->server_key,
+           sizeof (cluster->scram_server_key));
+   memcpy (cluster->scram_salted_password,
+           scram->salted_password,
+           sizeof (cluster->scram_salted_password));
+}
+
+
+/* run the client's next step on the server payload in @buf, and build the
+ * saslStart or saslContinue command that sends the result */
+static bool
+_mongoc_cluster_scram_cmd (mongoc_scram_t *scram,
+                           uint8_t *buf,
+                           uint32_t bufmax,
+                           uint32_t *buflen,
+                           int32_t conv_id,
+                           bson_t *cmd,
+                           bson_error_t *error)
+{
+   if (!_mongoc_scram_step (scram, buf, *buflen, buf, bufmax, buflen, error)) {
+      return false;
+   }
+
+   bson_init (cmd);
+
+   if (scram->step == 1) {
+      BSON_APPEND_INT32 (cmd, "saslStart", 1);
+      BSON_APPEND_UTF8 (cmd, "mechanism", "SCRAM-SHA-1");
+      bson_append_binary (cmd, "payload", 7, BSON_SUBTYPE_BINARY, buf, *buflen);
+      BSON_APPEND_INT32 (cmd, "autoAuthorize", 1);
+   } else {
+      BSON_APPEND_INT32 (cmd, "saslContinue", 1);
+      BSON_APPEND_INT32 (cmd, "conversationId", conv_id);
+      bson_append_binary (cmd, "payload", 7, BSON_SUBTYPE_BINARY, buf, *buflen);
+   }
+
+   TRACE ("SCRAM: authenticating (step %d)", scram->step);
+
+   return true;
+}
+
+
+/* read a saslStart or saslContinue reply: either the conversation is
+ * @done, or the server's next payload is copied to @buf */
+static bool
+_mongoc_cluster_scram_reply (const bson_t *reply,
+                             bool *done,
+                             int32_t *conv_id,
+                             uint8_t *buf,
+                             uint32_t bufmax,
+                             uint32_t *buflen,
+                             bson_error_t *error)
+{
+   bson_iter_t iter;
+   bson_subtype_t btype;
+   const uint8_t *payload;
+
+   if (bson_iter_init_find (&iter, reply, "done") &&
+       bson_iter_as_bool (&iter)) {
+      *done = true;
+      return true;
+   }
+
+   if (!bson_iter_init_find (&iter, reply, "conversationId") ||
+       !BSON_ITER_HOLDS_INT32 (&iter) ||
+       !(*conv_id = bson_iter_int32 (&iter)) ||
+       !bson_iter_init_find (&iter, reply, "payload") ||
+       !BSON_ITER_HOLDS_BINARY (&iter)) {
+      const char *errmsg = "Received invalid SCRAM reply from MongoDB server.";
+
+      MONGOC_DEBUG ("SCRAM: authentication failed");
+
+      if (bson_iter_init_find (&iter, reply, "errmsg") &&
+          BSON_ITER_HOLDS_UTF8 (&iter)) {
+         errmsg = bson_iter_utf8 (&iter, NULL);
+      }
+
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                      "%s",
+                      errmsg);
+      return false;
+   }
+
+   bson_iter_binary (&iter, &btype, buflen, &payload);
+
+   if (*buflen > bufmax) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                      "SCRAM reply from MongoDB is too large.");
+      return false;
+   }
+
+   memcpy (buf, payload, *buflen);
+
+   return true;
+}
+
+
+static bool
+_mongoc_cluster_auth_node_scram (mongoc_cluster_t *cluster,
+                                 mongoc_stream_t *stream,
+                                 mongoc_server_description_t *sd,
+                                 mongoc_cluster_speculative_t *speculative,
+                                 bson_error_t *error)
+{
+   mongoc_cmd_parts_t parts;
+   uint32_t buflen = 0;
+   mongoc_scram_t local_scram;
+   mongoc_scram_t *scram;
+   bool ret = false;
+   bool done = false;
+   const char *auth_source;
+   uint8_t buf[4096] = {0};
+   bson_t cmd;
+   bson_t reply;
+   int32_t conv_id = 0;
+   mongoc_server_stream_t *server_stream;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (stream);
+
+   auth_source = _mongoc_cluster_auth_source (cluster);
+
+   if (speculative) {
+      /* the server replied to saslStart in the handshake */
+      scram = &speculative->scram;
+      if (!_mongoc_cluster_scram_reply (speculative->reply,
+                                        &done,
+                                        &conv_id,
+                                        buf,
+                                        sizeof buf,
+                                        &buflen,
+                                        error)) {
+         return false;
+      }
+   } else {
+      scram = &local_scram;
+      _mongoc_cluster_init_scram (cluster, scram);
+   }
+
+   while (!done) {
+      if (!_mongoc_cluster_scram_cmd (
+             scram, buf, sizeof buf, &buflen, conv_id, &cmd, error)) {
+         goto failure;
+      }
+
+      mongoc_cmd_parts_init (&parts, auth_source, MONGOC_QUERY_SLAVE_OK, &cmd);
+      server_stream = _mongoc_cluster_create_server_stream (
+         cluster->client->topology, sd->id, stream, error);
+      if (!mongoc_cluster_run_command_parts (
+             cluster, server_stream, &parts, &reply, error)) {
+         mongoc_server_stream_cleanup (server_stream);
+         mongoc_cmd_parts_cleanup (&parts);
+         bson_destroy (&cmd);
+         bson_destroy (&reply);
+
+         /* error->message is already set */
+         error->domain = MONGOC_ERROR_CLIENT;
+         error->code = MONGOC_ERROR_CLIENT_AUTHENTICATE;
+         goto failure;
+      }
+      mongoc_server_stream_cleanup (server_stream);
+
+      mongoc_cmd_parts_cleanup (&parts);
+      bson_destroy (&cmd);
+
+      if (!_mongoc_cluster_scram_reply (
+             &reply, &done, &conv_id, buf, sizeof buf, &buflen, error)) {
+         bson_destroy (&reply);
+         goto failure;
+      }
+
+      bson_destroy (&reply);
+   }
+
+   TRACE ("%s", "SCRAM: authenticated");
+
+   ret = true;
+   _mongoc_cluster_scram_cache_keys (cluster, scram);
+
+failure:
+   if (scram == &local_scram) {
+      _mongoc_scram_destroy (scram);
+   }
+
+   return ret;
+}
+#endif
+
+
+/* the mechanism from the URI, or the server's default */
+static const char *
+_mongoc_cluster_auth_mechanism (mongoc_cluster_t *cluster,
+                                mongoc_server_description_t *sd)
+{
+   const char *mechanism;
+
+   mechanism = mongoc_uri_get_auth_mechanism (cluster->uri);
+
+   /* Use cached max_wire_version, not value from sd */
+   if (!mechanism) {
+      if (sd->max_wire_version < WIRE_VERSION_SCRAM_DEFAULT) {
+         mechanism = "MONGODB-CR";
+      } else {
+         mechanism = "SCRAM-SHA-1";
+      }
+   }
+
+   return mechanism;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_auth_node --
+ *
+ *       Authenticate a cluster node depending on the required mechanism.
+ *       If @speculative is not NULL and the server replied to it in the
+ *       handshake, continue that conversation instead of starting over.
+ *
+ * Returns:
+ *       true if authenticated. false on failure and @error is set.
+ *
+ * Side effects:
+ *       @error is set on failure.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_auth_node (mongoc_cluster_t *cluster,
+                           mongoc_stream_t *stream,
+                           mongoc_server_description_t *sd,
+                           mongoc_cluster_speculative_t *speculative,
+                           bson_error_t *error)
+{
+   bool ret = false;
+   const char *mechanism;
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (stream);
+
+   mechanism = _mongoc_cluster_auth_mechanism (cluster, sd);
+
+   /* continue only what the server accepted in the handshake */
+   if (speculative &&
+       (!speculative->reply || !speculative->mechanism ||
+        strcasecmp (speculative->mechanism, mechanism))) {
+      speculative = NULL;
+   }
+
+   if (0 == strcasecmp (mechanism, "MONGODB-CR")) {
+      ret = _mongoc_cluster_auth_node_cr (cluster, stream, sd, error);
+   } else if (0 == strcasecmp (mechanism, "MONGODB-X509")) {
+#ifdef MONGOC_ENABLE_SSL
+      ret = _mongoc_cluster_auth_node_x509 (
+         cluster, stream, sd, speculative, error);
+#else
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                      "The \"%s\" authentication mechanism requires libmongoc "
+                      "built with --enable-ssl",
+                      mechanism);
+#endif
+   } else if (0 == strcasecmp (mechanism, "SCRAM-SHA-1")) {
+#ifdef MONGOC_ENABLE_CRYPTO
+      ret = _mongoc_cluster_auth_node_scram (
+         cluster, stream, sd, speculative, error);
+#else
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                      "The \"%s\" authentication mechanism requires libmongoc "
+                      "built with --enable-ssl",
+                      mechanism);
+#endif
+   } else if (0 == strcasecmp (mechanism, "GSSAPI")) {
+#ifdef MONGOC_ENABLE_SASL
+      ret = _mongoc_cluster_auth_node_sasl (cluster, stream, sd, error);
+#else
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                      "The \"%s\" authentication mechanism requires libmongoc "
+                      "built with --enable-sasl",
+                      mechanism);
+#endif
+   } else if (0 == strcasecmp (mechanism, "PLAIN")) {
+      ret = _mongoc_cluster_auth_node_plain (cluster, stream, sd, error);
+   } else {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                      "Unknown authentication mechanism \"%s\".",
+                      mechanism);
+   }
+
+   if (!ret) {
+      mongoc_counter_auth_failure_inc ();
+      MONGOC_DEBUG ("Authentication failed: %s", error->message);
+   } else {
+      mongoc_counter_auth_success_inc ();
+      TRACE ("%s", "Authentication succeeded");
+   }
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_speculative_begin --
+ *
+ *       If @cluster requires SCRAM-SHA-1 or MONGODB-X509 authentication,
+ *       append its first command to @ismaster as
+ *       "speculativeAuthenticate", saving a round trip on servers that
+ *       reply to it. Other servers ignore the field, and the connection
+ *       authenticates after the handshake as usual.
+ *
+ *       Without an explicit mechanism, begin SCRAM-SHA-1: every server
+ *       that supports speculative authentication defaults to it.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_speculative_begin (mongoc_cluster_t *cluster,
+                                   mongoc_cluster_speculative_t *speculative,
+                                   bson_t *ismaster)
+{
+   const char *mechanism;
+   bson_error_t error; /* authenticating after the handshake reports it */
+   bson_t cmd;
+#ifdef MONGOC_ENABLE_CRYPTO
+   uint8_t buf[4096];
+   uint32_t buflen = 0;
+#endif
+
+   if (!cluster->requires_auth) {
+      return;
+   }
+
+   mechanism = mongoc_uri_get_auth_mechanism (cluster->uri);
+
+#ifdef MONGOC_ENABLE_CRYPTO
+   if (!mechanism || !strcasecmp (mechanism, "SCRAM-SHA-1")) {
+      _mongoc_cluster_init_scram (cluster, &speculative->scram);
+      if (!_mongoc_cluster_scram_cmd (&speculative->scram,
+                                      buf,
+                                      sizeof buf,
+                                      &buflen,
+                                      0,
+                                      &cmd,
+                                      &error)) {
+         _mongoc_scram_destroy (&speculative->scram);
+         return;
+      }
+
+      BSON_APPEND_UTF8 (&cmd, "db", _mongoc_cluster_auth_source (cluster));
+      speculative->mechanism = "SCRAM-SHA-1";
+   }
+#endif
+
+#ifdef MONGOC_ENABLE_SSL
+   if (mechanism && !strcasecmp (mechanism, "MONGODB-X509")) {
+      if (!_mongoc_cluster_x509_cmd (cluster, &cmd, &error)) {
+         return;
+      }
+
+      BSON_APPEND_UTF8 (&cmd, "db", "$external");
+      speculative->mechanism = "MONGODB-X509";
+   }
+#endif
+
+   if (speculative->mechanism) {
+      TRACE ("speculative %s authentication", speculative->mechanism);
+      BSON_APPEND_DOCUMENT (ismaster, "speculativeAuthenticate", &cmd);
+      bson_destroy (&cmd);
+   }
+}
+
+
+/* keep the server's reply to "speculativeAuthenticate", if any */
+static void
+_mongoc_cluster_speculative_reply (mongoc_cluster_speculative_t *speculative,
+                                   const bson_t *ismaster_reply)
+{
+   bson_iter_t iter;
+   const uint8_t *data;
+   uint32_t len;
+
+   if (speculative->mechanism &&
+       bson_iter_init_find (
+          &iter, ismaster_reply, "speculativeAuthenticate") &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_iter_document (&iter, &len, &data);
+      speculative->reply = bson_new_from_data (data, len);
+      mongoc_counter_auth_speculative_inc ();
+   }
+}
+
+
+static void
+_mongoc_cluster_speculative_cleanup (mongoc_cluster_speculative_t *speculative)
+{
+#ifdef MONGOC_ENABLE_CRYPTO
+   if (speculative->mechanism &&
+       !strcmp (speculative->mechanism, "SCRAM-SHA-1")) {
+      _mongoc_scram_destroy (&speculative->scram);
+   }
+#endif
+
+   if (speculative->reply) {
+      bson_destroy (speculative->reply);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_disconnect_node --
+ *
+ *       Remove a node from the set of nodes. This should be done if
+ *       a stream in the set is found to be invalid. If @invalidate is
+ *       true, also mark the server Unknown in the topology description,
+ *       passing the error information from @why as the reason.
+ *
+ *       WARNING: pointers to a disconnected mongoc_cluster_node_t or
+ *       its stream are now invalid, be careful of dangling pointers.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Removes node from cluster's set of nodes, and frees the
+ *       mongoc_cluster_node_t if pooled.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_cluster_disconnect_node (mongoc_cluster_t *cluster,
+                                uint32_t server_id,
+                                bool invalidate,
+                                const bson_error_t *why /* IN */)
+{
+   mongoc_topology_t *topology = cluster->client->topology;
+   mongoc_apm_connection_closed_reason_t reason;
+   mongoc_cluster_node_t *node;
+
+   ENTRY;
+
+   if (topology->single_threaded) {
+      mongoc_topology_scanner_node_t *scanner_node;
+
+      scanner_node =
+         mongoc_topology_scanner_get_node (topology->scanner, server_id);
+
+      /* might never actually have connected */
+      if (scanner_node && scanner_node->stream) {
+         mongoc_topology_scanner_node_disconnect (scanner_node, true);
+      }
+   } else {
+      reason = why ? MONGOC_APM_CONNECTION_CLOSED_ERROR
+                   : MONGOC_APM_CONNECTION_CLOSED_STALE;
+
+      /* keep the reason _mongoc_cluster_node_expired recorded */
+      node = (mongoc_cluster_node_t *) mongoc_set_get (cluster->nodes,
+                                                       server_id);
+      if (node && (why || node->close_reason ==
+                             MONGOC_APM_CONNECTION_CLOSED_CLIENT_CLOSED)) {
+         node->close_reason = reason;
+      }
+
+      mongoc_set_rm (cluster->nodes, server_id);
+
+      if (cluster->shared) {
+         /* connections still checked out are closed when released */
+         mongoc_mutex_lock (&cluster->shared->mutex);
+         _mongoc_cluster_shared_close_idle (cluster->shared, server_id, reason);
+         mongoc_mutex_unlock (&cluster->shared->mutex);
+      }
+   }
+
+   if (why) {
+      /* a network error, perhaps the server's last before its circuit
+       * breaker opens */
+      _mongoc_topology_breaker_failure (topology, server_id, why);
+   }
+
+   if (invalidate) {
+      mongoc_topology_invalidate_server (topology, server_id, why);
+   }
+
+   EXIT;
+}
+
+/* connection monitoring: @cluster's client is connecting to @host */
+static void
+_mongoc_cluster_connection_created (mongoc_cluster_t *cluster,
+                                    uint32_t server_id,
+                                    const mongoc_host_list_t *host)
+{
+   mongoc_apm_callbacks_t *callbacks = &cluster->client->apm_callbacks;
+   mongoc_apm_connection_created_t event;
+
+   if (!callbacks->connection_created) {
+      return;
+   }
+
+   event.host = host;
+   event.server_id = server_id;
+   event.context = cluster->client->apm_context;
+
+   callbacks->connection_created (&event);
+}
+
+
+/* connection monitoring: @node is established and authenticated, @phases
+ * are the MONGOC_APM_CONNECTION_PHASE_LAST durations since @started */
+static void
+_mongoc_cluster_connection_ready (mongoc_cluster_t *cluster,
+                                  const mongoc_cluster_node_t *node,
+                                  const mongoc_host_list_t *host,
+                                  int64_t started,
+                                  const int64_t *phases)
+{
+   mongoc_apm_callbacks_t *callbacks = &cluster->client->apm_callbacks;
+   mongoc_apm_connection_ready_t event;
+
+   if (!callbacks->connection_ready) {
+      return;
+   }
+
+   event.host = host;
+   event.server_id = node->server_id;
+   event.duration = bson_get_monotonic_time () - started;
+   event.phases = phases;
+   event.context = cluster->client->apm_context;
+
+   callbacks->connection_ready (&event);
+}
+
+
+/* connection monitoring: a connection to @host_and_port closed, or failed
+ * before it was ready */
+static void
+_mongoc_cluster_connection_closed (mongoc_apm_connection_closed_cb_t cb,
+                                   void *context,
+                                   uint32_t server_id,
+                                   const char *host_and_port,
+                                   mongoc_apm_connection_closed_reason_t reason)
+{
+   mongoc_apm_connection_closed_t event;
+   mongoc_host_list_t host;
+
+   if (!cb || !_mongoc_host_list_from_string (&host, host_and_port)) {
+      return;
+   }
+
+   event.host = &host;
+   event.server_id = server_id;
+   event.reason = reason;
+   event.context = context;
+
+   cb (&event);
+}
+
+
+void
+_mongoc_cluster_node_destroy (mongoc_cluster_node_t *node)
+{
+   _mongoc_server_counter_add (
+      &node->counters, MONGOC_SERVER_COUNTER_CONNECTIONS, -1);
+
+   _mongoc_cluster_connection_closed (node->closed_cb,
+                                      node->apm_context,
+                                      node->server_id,
+                                      node->connection_address,
+                                      node->close_reason);
+
+   /* Failure, or Replica Set reconfigure without this node */
+   mongoc_stream_failed (node->stream);
+   bson_free (node->connection_address);
+
+   bson_free (node);
+}
+
+static void
+_mongoc_cluster_node_dtor (void *data_, void *ctx_)
+{
+   mongoc_cluster_node_t *node = (mongoc_cluster_node_t *) data_;
+
+   _mongoc_cluster_node_destroy (node);
+}
+
+static mongoc_cluster_node_t *
+_mongoc_cluster_node_new (mongoc_cluster_t *cluster,
+                          uint32_t server_id,
+                          mongoc_stream_t *stream,
+                          const char *connection_address)
+{
+   mongoc_cluster_node_t *node;
+   unsigned int seed;
+   int64_t lifetime_usec;
+
+   if (!stream) {
+      return NULL;
+   }
+
+   node = (mongoc_cluster_node_t *) bson_malloc0 (sizeof *node);
+
+   node->stream = stream;
+   node->connection_address = bson_strdup (connection_address);
+   node->timestamp = bson_get_monotonic_time ();
+   node->last_used = node->timestamp;
+   node->server_id = server_id;
+   node->closed_cb = cluster->client->apm_callbacks.connection_closed;
+   node->apm_context = cluster->client->apm_context;
+
+   if (cluster->maxlifetimems) {
+      /* up to 10% sooner, so connections opened together don't all expire
+       * and reconnect together */
+      seed = (unsigned int) node->timestamp ^ (unsigned int) (size_t) node;
+      lifetime_usec = (int64_t) cluster->maxlifetimems * 1000;
+      node->expire_at =
+         node->timestamp + lifetime_usec -
+         lifetime_usec / 1000 * (_mongoc_rand_simple (&seed) % 100);
+   }
+
+   node->max_wire_version = MONGOC_DEFAULT_WIRE_VERSION;
+   node->min_wire_version = MONGOC_DEFAULT_WIRE_VERSION;
+
+   node->max_write_batch_size = MONGOC_DEFAULT_WRITE_BATCH_SIZE;
+   node->max_bson_obj_size = MONGOC_DEFAULT_BSON_OBJ_SIZE;
+   node->max_msg_size = MONGOC_DEFAULT_MAX_MSG_SIZE;
+
+   _mongoc_topology_server_counters (
+      cluster->client->topology, server_id, &node->counters);
+   _mongoc_server_counter_add (
+      &node->counters, MONGOC_SERVER_COUNTER_CONNECTIONS, 1);
+
+   return node;
+}
+
+
+/* whether to close a pooled connection instead of using it: it's past
+ * maxConnectionLifetimeMS, or unused for longer than @maxidletimems.
+ * counts the connection as expired or reaped, and records why, if so. */
+static bool
+_mongoc_cluster_node_expired (mongoc_cluster_node_t *node,
+                              int64_t now,
+                              uint32_t maxidletimems)
+{
+   if (node->expire_at && now >= node->expire_at) {
+      mongoc_counter_streams_expired_inc ();
+      node->close_reason = MONGOC_APM_CONNECTION_CLOSED_EXPIRED;
+      return true;
+   }
+
+   if (maxidletimems &&
+       now - node->last_used > (int64_t) maxidletimems * 1000) {
+      mongoc_counter_streams_reaped_idle_inc ();
+      node->close_reason = MONGOC_APM_CONNECTION_CLOSED_IDLE;
+      return true;
+   }
+
+   return false;
+}
+
+/* give an expired node to the caller in @reaped to close without holding
+ * locks, or close it now if @reaped is NULL */
+static void
+_mongoc_cluster_reaped (mongoc_array_t *reaped, mongoc_cluster_node_t *node)
+{
+   if (reaped) {
+      _mongoc_array_append_val (reaped, node);
+   } else {
+      _mongoc_cluster_node_destroy (node);
+   }
+}
+
+/* a server's idle connections in a mongoc_cluster_shared_t */
+typedef struct {
+   uint32_t generation;
+   mongoc_array_t idle; /* mongoc_cluster_node_t *, most recently used last */
+   int32_t n_connecting;
+   /* background connections that failed, and the last one's error */
+   uint32_t n_failures;
+   bson_error_t error;
+} mongoc_cluster_shared_server_t;
+
+/* a connection for a background establisher to make */
+typedef struct {
+   uint32_t server_id;
+   uint32_t generation;
+} mongoc_cluster_shared_request_t;
+
+
+static void
+_mongoc_cluster_shared_server_dtor (void *data_, void *ctx_)
+{
+   mongoc_cluster_shared_server_t *server =
+      (mongoc_cluster_shared_server_t *) data_;
+   size_t i;
+
+   for (i = 0; i < server->idle.len; i++) {
+      _mongoc_cluster_node_destroy (
+         _mongoc_array_index (&server->idle, mongoc_cluster_node_t *, i));
+   }
+
+   _mongoc_array_destroy (&server->idle);
+   bson_free (server);
+}
+
+
+mongoc_cluster_shared_t *
+_mongoc_cluster_shared_new (int32_t max_connecting,
+                            mongoc_cluster_shared_client_cb_t client_cb,
+                            void *client_ctx)
+{
+   mongoc_cluster_shared_t *shared;
+
+   shared = (mongoc_cluster_shared_t *) bson_malloc0 (sizeof *shared);
+   mongoc_mutex_init (&shared->mutex);
+   mongoc_cond_init (&shared->cond);
+   mongoc_cond_init (&shared->cond_requests);
+   shared->servers = mongoc_set_new (8, _mongoc_cluster_shared_server_dtor, NULL);
+   shared->max_connecting = BSON_MAX (1, max_connecting);
+   _mongoc_array_init (&shared->requests,
+                       sizeof (mongoc_cluster_shared_request_t));
+   shared->client_cb = client_cb;
+   shared->client_ctx = client_ctx;
+
+   return shared;
+}
+
+
+void
+_mongoc_cluster_shared_destroy (mongoc_cluster_shared_t *shared)
+{
+   int32_t i;
+
+   if (shared) {
+      if (shared->started) {
+         mongoc_mutex_lock (&shared->mutex);
+         shared->shutdown = true;
+         mongoc_cond_broadcast (&shared->cond_requests);
+         mongoc_mutex_unlock (&shared->mutex);
+
+         for (i = 0; i < shared->max_connecting; i++) {
+            mongoc_thread_join (shared->establishers[i]);
+         }
+
+         bson_free (shared->establishers);
+         mongoc_client_destroy (shared->client);
+      }
+
+      mongoc_set_destroy (shared->servers);
+      _mongoc_array_destroy (&shared->requests);
+      mongoc_cond_destroy (&shared->cond_requests);
+      mongoc_cond_destroy (&shared->cond);
+      mongoc_mutex_destroy (&shared->mutex);
+      bson_free (shared);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_shared_reset_after_fork --
+ *
+ *       In a child process after fork, where the establisher threads no
+ *       longer run: close the inherited idle connections like
+ *       _mongoc_cluster_reset_after_fork, forget the parent's requests,
+ *       and start new establishers when a client next needs a connection.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_shared_reset_after_fork (mongoc_cluster_shared_t *shared)
+{
+   uint32_t server_id;
+   int i;
+
+   if (!shared) {
+      return;
+   }
+
+   mongoc_mutex_init (&shared->mutex);
+   mongoc_cond_init (&shared->cond);
+   mongoc_cond_init (&shared->cond_requests);
+
+   for (i = (int) shared->servers->items_len - 1; i >= 0; i--) {
+      mongoc_set_get_item_and_id (shared->servers, i, &server_id);
+      _mongoc_cluster_shared_close_idle (
+         shared, server_id, MONGOC_APM_CONNECTION_CLOSED_STALE);
+   }
+
+   shared->requests.len = 0;
+   shared->n_waiting = 0;
+   shared->shutdown = false;
+
+   if (shared->started) {
+      _mongoc_cluster_reset_after_fork (&shared->client->cluster);
+      mongoc_client_destroy (shared->client);
+      shared->client = NULL;
+      bson_free (shared->establishers);
+      shared->establishers = NULL;
+      shared->started = false;
+   }
+}
+
+
+/* the entry for @server_id, created if needed. shared->mutex must be held */
+static mongoc_cluster_shared_server_t *
+_mongoc_cluster_shared_server (mongoc_cluster_shared_t *shared,
+                               uint32_t server_id)
+{
+   mongoc_cluster_shared_server_t *server;
+
+   server = (mongoc_cluster_shared_server_t *) mongoc_set_get (shared->servers,
+                                                               server_id);
+   if (!server) {
+      server = (mongoc_cluster_shared_server_t *) bson_malloc0 (sizeof *server);
+      server->generation = ++shared->generation;
+      _mongoc_array_init (&server->idle, sizeof (mongoc_cluster_node_t *));
+      mongoc_set_add (shared->servers, server_id, server);
+   }
+
+   return server;
+}
+
+
+/* forget @server_id's idle connections in @shared, closing them for
+ * @reason, so later connections begin a new generation. shared->mutex
+ * must be held */
+static void
+_mongoc_cluster_shared_close_idle (
+   mongoc_cluster_shared_t *shared,
+   uint32_t server_id,
+   mongoc_apm_connection_closed_reason_t reason)
+{
+   mongoc_cluster_shared_server_t *server;
+   size_t i;
+
+   server = (mongoc_cluster_shared_server_t *) mongoc_set_get (shared->servers,
+                                                               server_id);
+   if (!server) {
+      return;
+   }
+
+   for (i = 0; i < server->idle.len; i++) {
+      _mongoc_array_index (&server->idle, mongoc_cluster_node_t *, i)
+         ->close_reason = reason;
+   }
+
+   mongoc_set_rm (shared->servers, server_id);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_shared_release --
+ *
+ *       Return a connection borrowed from @shared. If the server's
+ *       connections were cleared since @node was connected, for example
+ *       after a network error, @node is destroyed instead.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_shared_release (mongoc_cluster_shared_t *shared,
+                                uint32_t server_id,
+                                mongoc_cluster_node_t *node)
+{
+   mongoc_cluster_shared_server_t *server;
+
+   BSON_ASSERT (shared);
+   BSON_ASSERT (node);
+
+   /* idle from now, however long the operation took */
+   node->last_used = bson_get_monotonic_time ();
+
+   mongoc_mutex_lock (&shared->mutex);
+   server = (mongoc_cluster_shared_server_t *) mongoc_set_get (shared->servers,
+                                                               server_id);
+   if (server && server->generation == node->generation) {
+      _mongoc_array_append_val (&server->idle, node);
+      node = NULL;
+
+      if (shared->n_waiting) {
+         mongoc_cond_broadcast (&shared->cond);
+      }
+   }
+   mongoc_mutex_unlock (&shared->mutex);
+
+   if (node) {
+      node->close_reason = MONGOC_APM_CONNECTION_CLOSED_STALE;
+      _mongoc_cluster_node_destroy (node);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_pin --
+ *
+ *       A session's transaction began on @server_stream: keep its
+ *       connection for the transaction's statements, which
+ *       _mongoc_cluster_fetch_stream_shared returns instead of borrowing
+ *       one from shared, until the last such session calls
+ *       _mongoc_cluster_unpin. Without shared connections the cluster
+ *       has one connection to each server anyway.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_pin (mongoc_cluster_t *cluster,
+                     mongoc_server_stream_t *server_stream)
+{
+   cluster->n_pinned++;
+
+   if (server_stream->node && !cluster->pinned) {
+      cluster->pinned = server_stream->node;
+      /* not released when the stream is cleaned up */
+      server_stream->node = NULL;
+   }
+}
+
+
+void
+_mongoc_cluster_unpin (mongoc_cluster_t *cluster)
+{
+   BSON_ASSERT (cluster->n_pinned > 0);
+
+   if (--cluster->n_pinned == 0 && cluster->pinned) {
+      _mongoc_cluster_shared_release (
+         cluster->shared, cluster->pinned->server_id, cluster->pinned);
+      cluster->pinned = NULL;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_shared_reap_idle --
+ *
+ *       Close idle connections in @shared unused for longer than
+ *       @maxidletimems, or past maxConnectionLifetimeMS.
+ *
+ * Returns:
+ *       The number of connections closed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+_mongoc_cluster_shared_reap_idle (mongoc_cluster_shared_t *shared,
+                                  int64_t now,
+                                  uint32_t maxidletimems,
+                                  mongoc_array_t *reaped)
+{
+   mongoc_cluster_shared_server_t *server;
+   mongoc_cluster_node_t *node;
+   uint32_t server_id;
+   uint32_t n_reaped = 0;
+   size_t i, j, kept;
+
+   if (!shared) {
+      return 0;
+   }
+
+   mongoc_mutex_lock (&shared->mutex);
+
+   for (i = 0; i < shared->servers->items_len; i++) {
+      server = (mongoc_cluster_shared_server_t *) mongoc_set_get_item_and_id (
+         shared->servers, (int) i, &server_id);
+
+      /* compact the array, keeping the most-recently-used order */
+      for (j = 0, kept = 0; j < server->idle.len; j++) {
+         node = _mongoc_array_index (&server->idle, mongoc_cluster_node_t *, j);
+
+         if (_mongoc_cluster_node_expired (node, now, maxidletimems)) {
+            _mongoc_cluster_reaped (reaped, node);
+            n_reaped++;
+         } else {
+            _mongoc_array_index (
+               &server->idle, mongoc_cluster_node_t *, kept++) = node;
+         }
+      }
+
+      server->idle.len = kept;
+   }
+
+   mongoc_mutex_unlock (&shared->mutex);
+
+   return n_reaped;
+}
+
+
+/* whether @sd may be elected primary: a secondary that isn't passive,
+ * with priority 0. hidden members are RS_OTHER */
+static bool
+_mongoc_cluster_electable_secondary (const mongoc_server_description_t *sd)
+{
+   bson_iter_t iter;
+
+   if (sd->type != MONGOC_SERVER_RS_SECONDARY) {
+      return false;
+   }
+
+   return !(bson_iter_init_find (&iter, &sd->last_is_master, "passive") &&
+            bson_iter_as_bool (&iter));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_shared_top_up --
+ *
+ *       Ask @shared's establishers for connections to each electable
+ *       secondary in @td until it has @count idle or being connected,
+ *       and close idle connections to servers no longer in @td. Does
+ *       nothing until a client has started the establishers.
+ *
+ *       The pool's maintenance callback calls this with the topology
+ *       mutex held, for "standbyConnections".
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_shared_top_up (mongoc_cluster_shared_t *shared,
+                               const mongoc_topology_description_t *td,
+                               int32_t count)
+{
+   mongoc_cluster_shared_server_t *server;
+   mongoc_cluster_shared_request_t request;
+   mongoc_server_description_t *sd;
+   uint32_t server_id;
+   int i;
+
+   if (!shared || count <= 0) {
+      return;
+   }
+
+   mongoc_mutex_lock (&shared->mutex);
+
+   if (!shared->started) {
+      mongoc_mutex_unlock (&shared->mutex);
+      return;
+   }
+
+   for (i = (int) shared->servers->items_len - 1; i >= 0; i--) {
+      mongoc_set_get_item_and_id (shared->servers, i, &server_id);
+      if (!mongoc_set_get (td->servers, server_id)) {
+         _mongoc_cluster_shared_close_idle (
+            shared, server_id, MONGOC_APM_CONNECTION_CLOSED_STALE);
+      }
+   }
+
+   for (i = 0; i < (int) td->servers->items_len; i++) {
+      sd = (mongoc_server_description_t *) mongoc_set_get_item_and_id (
+         td->servers, i, &server_id);
+      if (!_mongoc_cluster_electable_secondary (sd)) {
+         continue;
+      }
+
+      /* like a client's requests, at most max_connecting at once */
+      server = _mongoc_cluster_shared_server (shared, server_id);
+      while ((int32_t) server->idle.len + server->n_connecting < count &&
+             server->n_connecting < shared->max_connecting) {
+         server->n_connecting++;
+         request.server_id = server_id;
+         request.generation = server->generation;
+         _mongoc_array_append_val (&shared->requests, request);
+         mongoc_cond_signal (&shared->cond_requests);
+      }
+   }
+
+   mongoc_mutex_unlock (&shared->mutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_connect --
+ *
+ *       Connect to the given server, run isMaster, and authenticate.
+ *
+ * Returns:
+ *       A new mongoc_cluster_node_t, or NULL on failure.
+ *
+ * Side effects:
+ *       Sets error on failure.
+ *
+ *--------------------------------------------------------------------------
+ */
+static mongoc_cluster_node_t *
+_mongoc_cluster_node_connect (mongoc_cluster_t *cluster,
+                              uint32_t server_id,
+                              bson_error_t *error /* OUT */)
+{
+   mongoc_host_list_t *host = NULL;
+   mongoc_cluster_node_t *cluster_node = NULL;
+   mongoc_cluster_speculative_t speculative = {0};
+   mongoc_stream_t *stream;
+   mongoc_server_description_t *sd;
+   int64_t phases[MONGOC_APM_CONNECTION_PHASE_LAST] = {0};
+   int64_t started;
+   int64_t since;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (!cluster->client->topology->single_threaded);
+
+   host =
+      _mongoc_topology_host_by_id (cluster->client->topology, server_id, error);
+
+   if (!host) {
+      GOTO (error);
+   }
+
+   TRACE ("Adding new server to cluster: %s", host->host_and_port);
+
+   started = bson_get_monotonic_time ();
+   _mongoc_cluster_connection_created (cluster, server_id, host);
+
+   stream = _mongoc_client_create_stream (cluster->client, host, error);
+
+   if (!stream) {
+      MONGOC_WARNING (
+         "Failed connection to %s (%s)", host->host_and_port, error->message);
+      _mongoc_cluster_connection_closed (
+         cluster->client->apm_callbacks.connection_closed,
+         cluster->client->apm_context,
+         server_id,
+         host->host_and_port,
+         MONGOC_APM_CONNECTION_CLOSED_ERROR);
+      GOTO (error);
+   }
+
+   /* the stream initiator connects and does the TLS handshake */
+   since = bson_get_monotonic_time ();
+#ifdef MONGOC_ENABLE_SSL
+   phases[MONGOC_APM_CONNECTION_PHASE_TLS] =
+      _mongoc_stream_tls_get_handshake_usec (stream);
+#endif
+   phases[MONGOC_APM_CONNECTION_PHASE_CONNECT] =
+      since - started - phases[MONGOC_APM_CONNECTION_PHASE_TLS];
+
+   /* take critical fields from a fresh ismaster */
+   cluster_node = _mongoc_cluster_node_new (
+      cluster, server_id, stream, host->host_and_port);
+   cluster_node->close_reason = MONGOC_APM_CONNECTION_CLOSED_ERROR;
+
+   sd = _mongoc_cluster_run_ismaster (
+      cluster, cluster_node, server_id, true, &speculative, error);
+   if (!sd) {
+      GOTO (error);
+   }
+
+   phases[MONGOC_APM_CONNECTION_PHASE_HANDSHAKE] =
+      bson_get_monotonic_time () - since;
+   since = bson_get_monotonic_time ();
+
+   if (cluster->requires_auth) {
+      if (!_mongoc_cluster_auth_node (
+             cluster, cluster_node->stream, sd, &speculative, error)) {
+         MONGOC_WARNING ("Failed authentication to %s (%s)",
+                         host->host_and_port,
+                         error->message);
+         mongoc_server_description_destroy (sd);
+         GOTO (error);
+      }
+   }
+   mongoc_server_description_destroy (sd);
+
+   phases[MONGOC_APM_CONNECTION_PHASE_AUTH] =
+      bson_get_monotonic_time () - since;
+   cluster_node->close_reason = MONGOC_APM_CONNECTION_CLOSED_CLIENT_CLOSED;
+   _mongoc_cluster_connection_ready (
+      cluster, cluster_node, host, started, phases);
+
+   _mongoc_cluster_speculative_cleanup (&speculative);
+   _mongoc_host_list_destroy_all (host);
+
+   RETURN (cluster_node);
+
+error:
+   _mongoc_cluster_speculative_cleanup (&speculative);
+   _mongoc_host_list_destroy_all (host); /* null ok */
+
+   if (cluster_node) {
+      _mongoc_cluster_node_destroy (cluster_node); /* also destroys stream */
+   }
+
+   RETURN (NULL);
+}
+
+
+/* an establisher thread: make the connections clients are waiting for */
+static void *
+_mongoc_cluster_shared_establisher (void *data)
+{
+   mongoc_cluster_shared_t *shared = (mongoc_cluster_shared_t *) data;
+   mongoc_cluster_shared_request_t request;
+   mongoc_cluster_shared_server_t *server;
+   mongoc_cluster_node_t *node;
+   bson_error_t error;
+
+   mongoc_mutex_lock (&shared->mutex);
+
+   for (;;) {
+      while (!shared->shutdown && !shared->requests.len) {
+         mongoc_cond_wait (&shared->cond_requests, &shared->mutex);
+      }
+
+      if (shared->shutdown) {
+         break;
+      }
+
+      /* first come, first served */
+      request = _mongoc_array_index (
+         &shared->requests, mongoc_cluster_shared_request_t, 0);
+      shared->requests.len--;
+      memmove (shared->requests.data,
+               (mongoc_cluster_shared_request_t *) shared->requests.data + 1,
+               shared->requests.len * sizeof request);
+
+      mongoc_mutex_unlock (&shared->mutex);
+      node = _mongoc_cluster_node_connect (
+         &shared->client->cluster, request.server_id, &error);
+      mongoc_mutex_lock (&shared->mutex);
+
+      /* the server's connections may have been cleared meanwhile */
+      server = (mongoc_cluster_shared_server_t *) mongoc_set_get (
+         shared->servers, request.server_id);
+
+      if (server && server->generation == request.generation) {
+         server->n_connecting--;
+
+         if (node) {
+            node->generation = request.generation;
+            _mongoc_array_append_val (&server->idle, node);
+            node = NULL;
+         } else {
+            server->n_failures++;
+            memcpy (&server->error, &error, sizeof error);
+         }
+      }
+
+      if (node) {
+         node->close_reason = MONGOC_APM_CONNECTION_CLOSED_STALE;
+         _mongoc_cluster_node_destroy (node);
+      }
+
+      mongoc_cond_broadcast (&shared->cond);
+   }
+
+   mongoc_mutex_unlock (&shared->mutex);
+
+   return NULL;
+}
+
+
+/* start the establishers, the first time a client needs a connection */
+static void
+_mongoc_cluster_shared_start (mongoc_cluster_shared_t *shared)
+{
+   bool start;
+   int32_t i;
+
+   mongoc_mutex_lock (&shared->mutex);
+   start = !shared->started;
+   shared->started = true;
+   mongoc_mutex_unlock (&shared->mutex);
+
+   if (!start) {
+      return;
+   }
+
+   /* without shared->mutex, creating a client may take other locks */
+   shared->client = shared->client_cb (shared->client_ctx);
+   shared->establishers = (mongoc_thread_t *) bson_malloc0 (
+      shared->max_connecting * sizeof (mongoc_thread_t));
+
+   for (i = 0; i < shared->max_connecting; i++) {
+      _mongoc_thread_create (MONGOC_THREAD_CONNECTION_ESTABLISHER,
+                             &shared->establishers[i],
+                             _mongoc_cluster_shared_establisher,
+                             shared);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_add_node --
+ *
+ *       Add a new node to this cluster for the given server description.
+ *
+ *       NOTE: does NOT check if this server is already in the cluster.
+ *
+ * Returns:
+ *       A stream connected to the server, or NULL on failure.
+ *
+ * Side effects:
+ *       Adds a cluster node, or sets error on failure.
+ *
+ *--------------------------------------------------------------------------
+ */
+static mongoc_stream_t *
+_mongoc_cluster_add_node (mongoc_cluster_t *cluster,
+                          uint32_t server_id,
+                          bson_error_t *error /* OUT */)
+{
+   mongoc_cluster_node_t *cluster_node;
+
+   cluster_node = _mongoc_cluster_node_connect (cluster, server_id, error);
+   if (!cluster_node) {
+      return NULL;
+   }
+
+   mongoc_set_add (cluster->nodes, server_id, cluster_node);
+
+   return cluster_node->stream;
+}
+
+static void
+node_not_found (mongoc_topology_t *topology,
+                uint32_t server_id,
+                bson_error_t *error /* OUT */)
+{
+   mongoc_server_description_t *sd;
+
+   if (!error) {
+      return;
+   }
+
+   sd = mongoc_topology_server_by_id (topology, server_id, error);
+
+   if (!sd) {
+      return;
+   }
+
+   if (sd->error.code) {
+      memcpy (error, &sd->error, sizeof *error);
+   } else {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_NOT_ESTABLISHED,
+                      "Could not find node %s",
+                      sd->host.host_and_port);
+   }
+
+   mongoc_server_description_destroy (sd);
+}
+
+static void
+stream_not_found (mongoc_topology_t *topology,
+                  uint32_t server_id,
+                  const char *connection_address,
+                  bson_error_t *error /* OUT */)
+{
+   mongoc_server_description_t *sd;
+
+   sd = mongoc_topology_server_by_id (topology, server_id, error);
+
+   if (error) {
+      if (sd && sd->error.code) {
+         memcpy (error, &sd->error, sizeof *error);
+      } else {
+         bson_set_error (error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_NOT_ESTABLISHED,
+                         "Could not find stream for node %s",
+                         connection_address);
+      }
+   }
+
+   if (sd) {
+      mongoc_server_description_destroy (sd);
+   }
+}
+
+mongoc_server_stream_t *
+_mongoc_cluster_stream_for_server (mongoc_cluster_t *cluster,
+                                   uint32_t server_id,
+                                   bool reconnect_ok,
+                                   bson_error_t *error /* OUT */)
+{
+   mongoc_topology_t *topology;
+   mongoc_server_stream_t *server_stream;
+   bson_error_t err_local;
+   /* if fetch_stream fails we need a place to receive error details and pass
+    * them to mongoc_topology_invalidate_server. */
+   bson_error_t *err_ptr = error ? error : &err_local;
+   int64_t started;
+   int64_t since;
+   bool connecting;
+
+   ENTRY;
+
+   _mongoc_cluster_finish_pending (cluster);
+
+   if (!_mongoc_cluster_deadline_check (cluster, err_ptr)) {
+      RETURN (NULL);
+   }
+
+   topology = cluster->client->topology;
+
+   /* maxInFlightPerServer: a busy server is not a network error, don't
+    * disconnect from it */
+   if (!_mongoc_topology_in_flight_admit (topology, server_id, err_ptr)) {
+      RETURN (NULL);
+   }
+
+   started = bson_get_monotonic_time ();
+   since = _mongoc_cluster_span_now (cluster);
+   connecting = cluster->span.connecting;
+   cluster->span.connecting = true;
+
+   /* in the single-threaded use case we share topology's streams */
+   if (topology->single_threaded) {
+      server_stream = mongoc_cluster_fetch_stream_single (
+         cluster, server_id, reconnect_ok, err_ptr);
+
+   } else {
+      server_stream = mongoc_cluster_fetch_stream_pooled (
+         cluster, server_id, reconnect_ok, err_ptr);
+   }
+
+   mongoc_histogram_connection_checkout_record_since (started);
+   cluster->span.connecting = connecting;
+   _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_CONNECTION, since);
+
+   if (!server_stream) {
+      /* Server Discovery And Monitoring Spec: "When an application operation
+       * fails because of any network error besides a socket timeout, the
+       * client MUST replace the server's description with a default
+       * ServerDescription of type Unknown, and fill the ServerDescription's
+       * error field with useful information."
+       *
+       * error was filled by fetch_stream_single/pooled, pass it to disconnect()
+       *
+       * running out of timeoutMS says nothing about the server.
+       */
+      _mongoc_cluster_deadline_error (cluster, err_ptr);
+      if (!_mongoc_cluster_error_is_timeout (err_ptr)) {
+         mongoc_cluster_disconnect_node (cluster, server_id, true, err_ptr);
+      }
+
+      _mongoc_topology_in_flight_release (topology, server_id);
+   } else {
+      server_stream->deadline = cluster->deadline;
+
+      if (topology->max_in_flight) {
+         server_stream->in_flight_topology = topology;
+      }
+
+      if (cluster->dead_cursors.len && !cluster->client->in_exhaust) {
+         /* kill cursors destroyed since this server was last used */
+         _mongoc_client_flush_killcursors (cluster->client, server_stream);
+      }
+   }
+
+   RETURN (server_stream);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_stream_for_server --
+ *
+ *       Fetch the stream for @server_id. If @reconnect_ok and there is no
+ *       valid stream, attempts to reconnect; if not @reconnect_ok then only
+ *       an existing stream can be returned, or NULL.
+ *
+ * Returns:
+ *       A mongoc_server_stream_t, or NULL
+ *
+ * Side effects:
+ *       May add a node or reconnect one, if @reconnect_ok.
+ *       Authenticates the stream if needed.
+ *       May set @error.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_server_stream_t *
+mongoc_cluster_stream_for_server (mongoc_cluster_t *cluster,
+                                  uint32_t server_id,
+                                  bool reconnect_ok,
+                                  bson_error_t *error)
+{
+   mongoc_server_stream_t *server_stream = NULL;
+   bson_error_t err_local = {0};
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (server_id);
+
+   if (!error) {
+      error = &err_local;
+   }
+
+   /* no server selection, the span starts with the connection */
+   _mongoc_cluster_span_restart (cluster);
+
+   server_stream = _mongoc_cluster_stream_for_server (
+      cluster, server_id, reconnect_ok, error);
+
+   if (!server_stream) {
+      /* failed */
+      if (error->domain != MONGOC_ERROR_CLIENT ||
+          (error->code != MONGOC_ERROR_CLIENT_SERVER_BUSY &&
+           error->code != MONGOC_ERROR_CLIENT_OPERATION_TIMEOUT)) {
+         mongoc_cluster_disconnect_node (cluster, server_id, true, error);
+      }
+
+      _mongoc_cluster_span_restart (cluster);
+   }
+
+   RETURN (server_stream);
+}
+
+
+static mongoc_server_stream_t *
+mongoc_cluster_fetch_stream_single (mongoc_cluster_t *cluster,
+                                    uint32_t server_id,
+                                    bool reconnect_ok,
+                                    bson_error_t *error /* OUT */)
+{
+   mongoc_topology_t *topology;
+   mongoc_server_description_t *sd;
+   mongoc_stream_t *stream;
+   mongoc_topology_scanner_node_t *scanner_node;
+   mongoc_cluster_speculative_t speculative = {0};
+   int64_t expire_at;
+   bool r;
+
+   topology = cluster->client->topology;
+   _mongoc_topology_finish_server_check (topology, server_id);
+   scanner_node =
+      mongoc_topology_scanner_get_node (topology->scanner, server_id);
+   if (!scanner_node) {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_NOT_ESTABLISHED,
+                      "Could not find server %u",
+                      server_id);
+      return NULL;
+   }
+
+   BSON_ASSERT (!scanner_node->retired);
+   stream = scanner_node->stream;
+
+   if (stream) {
+      sd = mongoc_topology_server_by_id (topology, server_id, error);
+
+      if (!sd) {
+         return NULL;
+      }
+   } else {
+      if (!reconnect_ok) {
+         stream_not_found (
+            topology, server_id, scanner_node->host.host_and_port, error);
+         return NULL;
+      }
+
+      if (!mongoc_topology_scanner_node_setup (scanner_node, error)) {
+         return NULL;
+      }
+      stream = scanner_node->stream;
+
+      expire_at = bson_get_monotonic_time () +
+                  _mongoc_cluster_connect_timeout_msec (cluster) * 1000;
+      if (!mongoc_stream_wait (stream, expire_at)) {
+         bson_set_error (error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_CONNECT,
+                         "Failed to connect to target host: '%s'",
+                         scanner_node->host.host_and_port);
+         return NULL;
+      }
+
+#ifdef MONGOC_ENABLE_SSL
+      if (cluster->client->use_ssl) {
+         mongoc_stream_t *tls_stream;
+
+         for (tls_stream = stream; tls_stream->type != MONGOC_STREAM_TLS;
+              tls_stream = mongoc_stream_get_base_stream (tls_stream)) {
+         }
+
+         r = mongoc_stream_tls_handshake_block (
+            tls_stream,
+            scanner_node->host.host,
+            _mongoc_cluster_connect_timeout_msec (cluster) * 1000,
+            error);
+
+         if (!r) {
+            mongoc_topology_scanner_node_disconnect (scanner_node, true);
+            return NULL;
+         }
+      }
+#endif
+
+      sd = _mongoc_stream_run_ismaster (cluster,
+                                        stream,
+                                        scanner_node->host.host_and_port,
+                                        server_id,
+                                        true,
+                                        &speculative);
+
+      if (!sd) {
+         _mongoc_cluster_speculative_cleanup (&speculative);
+         return NULL;
+      }
+   }
+
+   if (sd->type == MONGOC_SERVER_UNKNOWN) {
+      memcpy (error, &sd->error, sizeof *error);
+      mongoc_server_description_destroy (sd);
+      _mongoc_cluster_speculative_cleanup (&speculative);
+      return NULL;
+   }
+
+   /* stream open but not auth'ed: first use since connect or reconnect */
+   if (cluster->requires_auth && !scanner_node->has_auth) {
+      r = _mongoc_cluster_auth_node (
+         cluster, stream, sd, &speculative, &sd->error);
+      if (!r) {
+         memcpy (error, &sd->error, sizeof *error);
+         mongoc_server_description_destroy (sd);
+         _mongoc_cluster_speculative_cleanup (&speculative);
+         return NULL;
+      }
+
+      scanner_node->has_auth = true;
+   }
+
+   _mongoc_cluster_speculative_cleanup (&speculative);
+
+   return mongoc_server_stream_new (
+      &cluster->arena, &topology->description, sd, stream);
+}
+
+
+/* a server stream allocated from @arena, which may be NULL. see
+ * _mongoc_cluster_create_server_stream */
+static mongoc_server_stream_t *
+_mongoc_cluster_new_server_stream (mongoc_topology_t *topology,
+                                   mongoc_arena_t *arena,
+                                   uint32_t server_id,
+                                   mongoc_stream_t *stream,
+                                   bson_error_t *error /* OUT */)
+{
+   mongoc_topology_snapshot_t *snapshot;
+   mongoc_server_description_t *sd;
+   mongoc_server_stream_t *server_stream = NULL;
+
+   /* pooled: borrow the server description from the latest snapshot, rather
+    * than copy it under the topology lock */
+   snapshot = _mongoc_topology_get_snapshot (topology);
+   if (snapshot) {
+      sd = mongoc_topology_description_server_by_id (
+         &snapshot->description, server_id, error);
+
+      if (!sd) {
+         _mongoc_topology_snapshot_release (snapshot);
+         return NULL;
+      }
+
+      server_stream = _mongoc_server_stream_new_from_snapshot (
+         arena, snapshot, sd, stream);
+      _mongoc_topology_get_cluster_time (topology,
+                                         &server_stream->cluster_time);
+
+      return server_stream;
+   }
+
+   /* can't just use mongoc_topology_server_by_id(), since we must hold the
+    * lock while copying topology->description.logical_time below */
+   mongoc_mutex_lock (&topology->mutex);
+
+   sd = mongoc_server_description_new_copy (
+      mongoc_topology_description_server_by_id (
+         &topology->description, server_id, error));
+
+   if (sd) {
+      server_stream =
+         mongoc_server_stream_new (arena, &topology->description, sd, stream);
+   }
+
+   mongoc_mutex_unlock (&topology->mutex);
+
+   return server_stream;
+}
+
+
+mongoc_server_stream_t *
+_mongoc_cluster_create_server_stream (mongoc_topology_t *topology,
+                                      uint32_t server_id,
+                                      mongoc_stream_t *stream,
+                                      bson_error_t *error /* OUT */)
+{
+   return _mongoc_cluster_new_server_stream (
+      topology, NULL, server_id, stream, error);
+}
+
+
+/* pop @server's most recently used idle connection that is still current.
+ * shared->mutex must be held */
+static mongoc_cluster_node_t *
+_mongoc_cluster_shared_take_idle (mongoc_cluster_t *cluster,
+                                  mongoc_cluster_shared_server_t *server,
+                                  int64_t timestamp,
+                                  int64_t now)
+{
+   mongoc_cluster_node_t *node;
+
+   while (server->idle.len) {
+      server->idle.len--;
+      node = _mongoc_array_index (
+         &server->idle, mongoc_cluster_node_t *, server->idle.len);
+
+      if (timestamp == -1 || node->timestamp < timestamp) {
+         /* the server was removed or replaced since node's birth */
+         node->close_reason = MONGOC_APM_CONNECTION_CLOSED_STALE;
+         _mongoc_cluster_node_destroy (node);
+      } else if (_mongoc_cluster_node_expired (
+                    node, now, cluster->maxidletimems)) {
+         _mongoc_cluster_node_destroy (node);
+      } else {
+         return node;
+      }
+   }
+
+   return NULL;
+}
+
+
+/* borrow a connection from cluster->shared for one operation. if none is
+ * idle, an establisher connects in the background while we wait for its
+ * connection or one that another client releases, whichever comes first */
+static mongoc_server_stream_t *
+_mongoc_cluster_fetch_stream_shared (mongoc_cluster_t *cluster,
+                                     uint32_t server_id,
+                                     bool reconnect_ok,
+                                     bson_error_t *error /* OUT */)
+{
+   mongoc_topology_t *topology;
+   mongoc_cluster_shared_t *shared;
+   mongoc_cluster_shared_server_t *server;
+   mongoc_cluster_shared_request_t request;
+   mongoc_cluster_node_t *node = NULL;
+   mongoc_server_stream_t *server_stream;
+   uint32_t generation;
+   uint32_t n_failures;
+   int64_t timestamp;
+   int64_t now;
+
+   topology = cluster->client->topology;
+   shared = cluster->shared;
+   timestamp = mongoc_topology_server_timestamp (topology, server_id);
+   now = bson_get_monotonic_time ();
+
+   _mongoc_cluster_shared_start (shared);
+
+   mongoc_mutex_lock (&shared->mutex);
+
+   server = (mongoc_cluster_shared_server_t *) mongoc_set_get (shared->servers,
+                                                               server_id);
+   if (!server && reconnect_ok) {
+      server = _mongoc_cluster_shared_server (shared, server_id);
+   }
+
+   if (!server) {
+      /* without reconnect_ok, only connect if the server's connections
+       * haven't been cleared, e.g. to continue a cursor */
+      mongoc_mutex_unlock (&shared->mutex);
+      node_not_found (topology, server_id, error);
+      return NULL;
+   }
+
+   if (cluster->pinned && cluster->pinned->server_id == server_id) {
+      node = cluster->pinned;
+      if (node->generation == server->generation && timestamp != -1 &&
+          node->timestamp >= timestamp) {
+         mongoc_mutex_unlock (&shared->mutex);
+
+         /* server_stream->node stays NULL, the cluster keeps it */
+         return _mongoc_cluster_new_server_stream (
+            topology, &cluster->arena, server_id, node->stream, error);
+      }
+
+      /* cleared since, e.g. by a network error: the transaction's later
+       * statements borrow connections like any other operation */
+      node->close_reason = MONGOC_APM_CONNECTION_CLOSED_STALE;
+      _mongoc_cluster_node_destroy (node);
+      cluster->pinned = node = NULL;
+   }
+
+   generation = server->generation;
+   n_failures = server->n_failures;
+
+   while (!(node = _mongoc_cluster_shared_take_idle (
+               cluster, server, timestamp, now))) {
+      if (server->n_failures != n_failures) {
+         /* a background connection to the server failed */
+         memcpy (error, &server->error, sizeof *error);
+         break;
+      }
+
+      if (server->n_connecting < shared->max_connecting) {
+         server->n_connecting++;
+         request.server_id = server_id;
+         request.generation = server->generation;
+         _mongoc_array_append_val (&shared->requests, request);
+         mongoc_cond_signal (&shared->cond_requests);
+      }
+
+      if (!_mongoc_cluster_deadline_check (cluster, error)) {
+         break;
+      }
+
+      shared->n_waiting++;
+      if (cluster->deadline) {
+         mongoc_cond_timedwait (
+            &shared->cond,
+            &shared->mutex,
+            _mongoc_cluster_deadline_remaining_msec (cluster));
+      } else {
+         mongoc_cond_wait (&shared->cond, &shared->mutex);
+      }
+      shared->n_waiting--;
+
+      /* the server's connections may have been cleared meanwhile */
+      server = (mongoc_cluster_shared_server_t *) mongoc_set_get (
+         shared->servers, server_id);
+      if (!server && !reconnect_ok) {
+         node_not_found (topology, server_id, error);
+         break;
+      }
+
+      server = _mongoc_cluster_shared_server (shared, server_id);
+      if (server->generation != generation) {
+         generation = server->generation;
+         n_failures = server->n_failures;
+      }
+
+      now = bson_get_monotonic_time ();
+   }
+
+   mongoc_mutex_unlock (&shared->mutex);
+
+   if (!node) {
+      return NULL;
+   }
+
+   server_stream = _mongoc_cluster_new_server_stream (
+      topology, &cluster->arena, server_id, node->stream, error);
+
+   if (!server_stream) {
+      _mongoc_cluster_shared_release (shared, server_id, node);
+      return NULL;
+   }
+
+   server_stream->shared = shared;
+   server_stream->node = node;
+
+   return server_stream;
+}
+
+
+/* heartbeatPiggyback: check the server on an application connection, in
+ * place of the background thread. a failure disconnects the node and marks
+ * the server Unknown, as a network error in an operation would */
+static bool
+_mongoc_cluster_piggyback_check (mongoc_cluster_t *cluster,
+                                 mongoc_cluster_node_t *cluster_node,
+                                 uint32_t server_id,
+                                 bson_error_t *error)
+{
+   mongoc_server_description_t *sd;
+
+   sd = _mongoc_cluster_run_ismaster (
+      cluster, cluster_node, server_id, false, NULL, error);
+   if (!sd) {
+      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
+      return false;
+   }
+
+   mongoc_server_description_destroy (sd);
+   return true;
+}
+
+
+/* a server stream on one of a pooled client's own nodes, which marks the
+ * node idle when the stream is cleaned up */
+static mongoc_server_stream_t *
+_mongoc_cluster_new_pooled_stream (mongoc_cluster_t *cluster,
+                                   uint32_t server_id,
+                                   mongoc_stream_t *stream,
+                                   bson_error_t *error /* OUT */)
+{
+   mongoc_server_stream_t *server_stream;
+
+   server_stream = _mongoc_cluster_new_server_stream (
+      cluster->client->topology, &cluster->arena, server_id, stream, error);
+   if (server_stream) {
+      server_stream->cluster = cluster;
+   }
+
+   return server_stream;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_released --
+ *
+ *       An operation on @stream, @cluster's connection to @server_id,
+ *       finished: the connection is idle from now. Does nothing if the
+ *       node was replaced meanwhile.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_node_released (mongoc_cluster_t *cluster,
+                               uint32_t server_id,
+                               mongoc_stream_t *stream)
+{
+   mongoc_cluster_node_t *node;
+
+   node = (mongoc_cluster_node_t *) mongoc_set_get (cluster->nodes, server_id);
+   if (node && node->stream == stream) {
+      node->last_used = bson_get_monotonic_time ();
+   }
+}
+
+
+/* standbyConnections: take over an idle connection to @server_id from the
+ * pool's standby connections, or return NULL */
+static mongoc_cluster_node_t *
+_mongoc_cluster_take_standby (mongoc_cluster_t *cluster, uint32_t server_id)
+{
+   mongoc_cluster_shared_t *standby = cluster->standby;
+   mongoc_cluster_shared_server_t *server;
+   mongoc_cluster_node_t *node = NULL;
+   int64_t timestamp;
+   int64_t now;
+
+   _mongoc_cluster_shared_start (standby);
+
+   timestamp =
+      mongoc_topology_server_timestamp (cluster->client->topology, server_id);
+   now = bson_get_monotonic_time ();
+
+   mongoc_mutex_lock (&standby->mutex);
+   server = (mongoc_cluster_shared_server_t *) mongoc_set_get (
+      standby->servers, server_id);
+   if (server) {
+      node = _mongoc_cluster_shared_take_idle (cluster, server, timestamp, now);
+   }
+   mongoc_mutex_unlock (&standby->mutex);
+
+   if (node) {
+      node->last_used = now;
+      mongoc_counter_client_pools_standby_used_inc ();
+   }
+
+   return node;
+}
+
+
+static mongoc_server_stream_t *
+mongoc_cluster_fetch_stream_pooled (mongoc_cluster_t *cluster,
+                                    uint32_t server_id,
+                                    bool reconnect_ok,
+                                    bson_error_t *error /* OUT */)
+{
+   mongoc_topology_t *topology;
+   mongoc_stream_t *stream;
+   mongoc_cluster_node_t *cluster_node;
+   int64_t timestamp;
+   int64_t now;
+
+   if (cluster->shared) {
+      return _mongoc_cluster_fetch_stream_shared (
+         cluster, server_id, reconnect_ok, error);
+   }
+
+   cluster_node =
+      (mongoc_cluster_node_t *) mongoc_set_get (cluster->nodes, server_id);
+
+   topology = cluster->client->topology;
+
+   if (cluster_node) {
+      BSON_ASSERT (cluster_node->stream);
+
+      timestamp = mongoc_topology_server_timestamp (topology, server_id);
+      now = bson_get_monotonic_time ();
+      if (timestamp == -1 || cluster_node->timestamp < timestamp) {
+         /* topology change or net error during background scan made us remove
+          * or replace server description since node's birth. destroy node. */
+         mongoc_cluster_disconnect_node (
+            cluster, server_id, false /* invalidate */, NULL);
+      } else if (_mongoc_cluster_node_expired (
+                    cluster_node, now, cluster->maxidletimems)) {
+         /* idle or open too long, the reaper hasn't run yet */
+         mongoc_cluster_disconnect_node (
+            cluster, server_id, false /* invalidate */, NULL);
+      } else if (_mongoc_topology_piggyback_due (topology, server_id) &&
+                 !_mongoc_cluster_piggyback_check (
+                    cluster, cluster_node, server_id, error)) {
+         return NULL;
+      } else {
+         return _mongoc_cluster_new_pooled_stream (
+            cluster, server_id, cluster_node->stream, error);
+      }
+   }
+
+   /* no node, or out of date */
+   if (!reconnect_ok) {
+      node_not_found (topology, server_id, error);
+      return NULL;
+   }
+
+   /* e.g. a secondary just elected primary: it's already authenticated */
+   if (cluster->standby &&
+       (cluster_node = _mongoc_cluster_take_standby (cluster, server_id))) {
+      mongoc_set_add (cluster->nodes, server_id, cluster_node);
+      return _mongoc_cluster_new_pooled_stream (
+         cluster, server_id, cluster_node->stream, error);
+   }
+
+   stream = _mongoc_cluster_add_node (cluster, server_id, error);
+   if (stream) {
+      return _mongoc_cluster_new_pooled_stream (
+         cluster, server_id, stream, error);
+   } else {
+      return NULL;
+   }
+}
+
+typedef struct {
+   mongoc_cluster_t *cluster;
+   uint32_t server_id;
+   mongoc_host_list_t *host;
+   mongoc_stream_t *stream;
+   mongoc_server_description_t *sd;
+   uint32_t generation;
+   bool connected;
+   bson_error_t error;
+   /* set by _mongoc_cluster_connect_async, which frees the struct */
+   mongoc_cluster_connect_cb_t connect_cb;
+   void *connect_ctx;
+   /* connection monitoring: set once the created event is sent */
+   bool created;
+   int64_t started;
+   int64_t handshake_done;
+   int64_t handshake_usec;
+#ifdef MONGOC_ENABLE_CRYPTO
+   /* the SCRAM conversation continues on @stream in the same async run */
+   mongoc_async_t *async;
+   mongoc_scram_t scram;
+   bool scram_started;
+   bool authenticated;
+   int32_t conv_id;
+   uint32_t scram_buflen;
+   uint8_t scram_buf[4096];
+#endif
+} mongoc_cluster_warm_t;
+
+
+/* begin a non-blocking connect, as the topology scanner does */
+static mongoc_stream_t *
+_mongoc_cluster_connect_nonblocking (mongoc_cluster_t *cluster,
+                                     const mongoc_host_list_t *host,
+                                     bool *needs_tls_setup,
+                                     bson_error_t *error)
+{
+   struct addrinfo *result;
+   struct addrinfo *rp;
+   mongoc_socket_t *sock = NULL;
+   mongoc_socket_opts_t opts;
+   mongoc_stream_t *stream;
+
+   *needs_tls_setup = false;
+
+   /* custom initiators (and UNIX sockets) connect the usual, blocking way */
+   if (cluster->client->initiator != mongoc_client_default_stream_initiator ||
+       host->family == AF_UNIX) {
+      return _mongoc_client_create_stream (cluster->client, host, error);
+   }
+
+   result = _mongoc_dns_getaddrinfo (host, error);
+   if (!result) {
+      return NULL;
+   }
+
+   _mongoc_uri_get_socket_opts (cluster->uri, &opts);
+
+   for (rp = result; rp; rp = rp->ai_next) {
+      if ((sock = mongoc_socket_new (
+              rp->ai_family, rp->ai_socktype, rp->ai_protocol))) {
+         _mongoc_socket_set_opts (sock, &opts);
+         mongoc_socket_connect (
+            sock, rp->ai_addr, (mongoc_socklen_t) rp->ai_addrlen, 0);
+         break;
+      }
+   }
+
+   _mongoc_dns_results_free (result);
+
+   if (!sock) {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_CONNECT,
+                      "Failed to connect to target host: '%s'",
+                      host->host_and_port);
+      return NULL;
+   }
+
+   stream = mongoc_stream_socket_new (sock);
+
+#ifdef MONGOC_ENABLE_SSL
+   if (cluster->client->use_ssl) {
+      mongoc_stream_t *original = stream;
+
+      stream = mongoc_stream_tls_new_with_hostname (
+         stream, host->host, &cluster->client->ssl_opts, true);
+
+      if (!stream) {
+         mongoc_stream_destroy (original);
+         bson_set_error (error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_SOCKET,
+                         "Failed initialize TLS state.");
+         return NULL;
+      }
+
+      _mongoc_stream_tls_set_session_cache (
+         stream,
+         cluster->client->topology->scanner->tls_sessions,
+         host->host_and_port);
+
+      if (mongoc_uri_get_option_as_bool (
+             cluster->uri, MONGOC_URI_SSLKERNELOFFLOAD, false)) {
+         _mongoc_stream_tls_set_kernel_offload (stream);
+      }
+
+      *needs_tls_setup = true;
+   }
+#endif
+
+   return _mongoc_stream_buffered_new_for_uri (stream, cluster->uri);
+}
+
+
+static void
+_mongoc_cluster_warm_done (mongoc_cluster_warm_t *warm);
+
+
+#ifdef MONGOC_ENABLE_CRYPTO
+static void
+_mongoc_cluster_warm_scram_cb (mongoc_async_cmd_result_t result,
+                               const bson_t *reply,
+                               int64_t rtt_msec,
+                               void *data,
+                               bson_error_t *error);
+
+
+/* send the next step of @warm's SCRAM conversation, as an async command
+ * on the connection that just replied */
+static bool
+_mongoc_cluster_warm_scram_next (mongoc_cluster_warm_t *warm)
+{
+   bson_t cmd;
+
+   if (!_mongoc_cluster_scram_cmd (&warm->scram,
+                                   warm->scram_buf,
+                                   sizeof warm->scram_buf,
+                                   &warm->scram_buflen,
+                                   warm->conv_id,
+                                   &cmd,
+                                   &warm->error)) {
+      return false;
+   }
+
+   mongoc_async_cmd_new (warm->async,
+                         warm->stream,
+                         NULL,
+                         NULL,
+                         _mongoc_cluster_auth_source (warm->cluster),
+                         &cmd,
+                         _mongoc_cluster_warm_scram_cb,
+                         warm,
+                         warm->cluster->client->topology->connect_timeout_msec);
+
+   bson_destroy (&cmd);
+
+   return true;
+}
+
+
+static void
+_mongoc_cluster_warm_scram_cb (mongoc_async_cmd_result_t result,
+                               const bson_t *reply,
+                               int64_t rtt_msec,
+                               void *data,
+                               bson_error_t *error)
+{
+   mongoc_cluster_warm_t *warm = (mongoc_cluster_warm_t *) data;
+   bool done = false;
+
+   if (result != MONGOC_ASYNC_CMD_SUCCESS) {
+      if (result == MONGOC_ASYNC_CMD_TIMEOUT) {
+         bson_set_error (&warm->error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                         "authentication to %s timed out",
+                         warm->host->host_and_port);
+      } else {
+         memcpy (&warm->error, error, sizeof warm->error);
+         warm->error.domain = MONGOC_ERROR_CLIENT;
+         warm->error.code = MONGOC_ERROR_CLIENT_AUTHENTICATE;
+      }
+
+      _mongoc_cluster_warm_done (warm);
+      return;
+   }
+
+   if (!_mongoc_cluster_scram_reply (reply,
+                                     &done,
+                                     &warm->conv_id,
+                                     warm->scram_buf,
+                                     sizeof warm->scram_buf,
+                                     &warm->scram_buflen,
+                                     &warm->error)) {
+      _mongoc_cluster_warm_done (warm);
+      return;
+   }
+
+   if (done) {
+      TRACE ("SCRAM: authenticated to %s", warm->host->host_and_port);
+      warm->authenticated = true;
+      _mongoc_cluster_scram_cache_keys (warm->cluster, &warm->scram);
+      _mongoc_cluster_warm_done (warm);
+      return;
+   }
+
+   if (!_mongoc_cluster_warm_scram_next (warm)) {
+      _mongoc_cluster_warm_done (warm);
+   }
+}
+#endif
+
+
+/* authenticate @warm's new connection, unless its SCRAM conversation
+ * already ran in mongoc_async_run. Other mechanisms block */
+static bool
+_mongoc_cluster_warm_auth (mongoc_cluster_warm_t *warm,
+                           mongoc_cluster_node_t *node)
+{
+   if (!warm->cluster->requires_auth) {
+      return true;
+   }
+
+#ifdef MONGOC_ENABLE_CRYPTO
+   if (warm->scram_started) {
+      if (!warm->authenticated) {
+         mongoc_counter_auth_failure_inc ();
+         MONGOC_DEBUG ("Authentication failed: %s", warm->error.message);
+         return false;
+      }
+
+      mongoc_counter_auth_success_inc ();
+      return true;
+   }
+#endif
+
+   return _mongoc_cluster_auth_node (
+      warm->cluster, node->stream, warm->sd, NULL, &warm->error);
+}
+
+
+/* after the async run, make @warm's connection into an authenticated
+ * node, or return NULL with warm->error set */
+static mongoc_cluster_node_t *
+_mongoc_cluster_warm_node (mongoc_cluster_warm_t *warm)
+{
+   mongoc_cluster_node_t *node;
+   int64_t phases[MONGOC_APM_CONNECTION_PHASE_LAST] = {0};
+   int64_t connect_usec;
+
+   if (!warm->sd || warm->sd->type == MONGOC_SERVER_UNKNOWN) {
+      if (warm->sd) {
+         memcpy (&warm->error, &warm->sd->error, sizeof warm->error);
+      }
+
+      if (warm->created) {
+         _mongoc_cluster_connection_closed (
+            warm->cluster->client->apm_callbacks.connection_closed,
+            warm->cluster->client->apm_context,
+            warm->server_id,
+            warm->host->host_and_port,
+            MONGOC_APM_CONNECTION_CLOSED_ERROR);
+      }
+
+      return NULL;
+   }
+
+   node = _mongoc_cluster_node_new (warm->cluster,
+                                    warm->server_id,
+                                    warm->stream,
+                                    warm->host->host_and_port);
+   warm->stream = NULL; /* owned by node */
+   node->close_reason = MONGOC_APM_CONNECTION_CLOSED_ERROR;
+   node->max_write_batch_size = warm->sd->max_write_batch_size;
+   node->min_wire_version = warm->sd->min_wire_version;
+   node->max_wire_version = warm->sd->max_wire_version;
+   node->max_bson_obj_size = warm->sd->max_bson_obj_size;
+   node->max_msg_size = warm->sd->max_msg_size;
+
+   if (!_mongoc_cluster_warm_auth (warm, node)) {
+      _mongoc_cluster_node_destroy (node);
+      return NULL;
+   }
+
+   /* connecting, TLS, and isMaster ran as one async command; the rest of
+    * its time went to connecting */
+#ifdef MONGOC_ENABLE_SSL
+   phases[MONGOC_APM_CONNECTION_PHASE_TLS] =
+      _mongoc_stream_tls_get_handshake_usec (node->stream);
+#endif
+   phases[MONGOC_APM_CONNECTION_PHASE_HANDSHAKE] = warm->handshake_usec;
+   connect_usec = warm->handshake_done - warm->started -
+                  phases[MONGOC_APM_CONNECTION_PHASE_TLS] -
+                  phases[MONGOC_APM_CONNECTION_PHASE_HANDSHAKE];
+   phases[MONGOC_APM_CONNECTION_PHASE_CONNECT] = BSON_MAX (0, connect_usec);
+   phases[MONGOC_APM_CONNECTION_PHASE_AUTH] =
+      bson_get_monotonic_time () - warm->handshake_done;
+
+   node->close_reason = MONGOC_APM_CONNECTION_CLOSED_CLIENT_CLOSED;
+   _mongoc_cluster_connection_ready (
+      warm->cluster, node, warm->host, warm->started, phases);
+
+   return node;
+}
+
+
+static void
+_mongoc_cluster_warm_cleanup (mongoc_cluster_warm_t *warm)
+{
+   if (warm->stream) {
+      mongoc_stream_destroy (warm->stream);
+   }
+
+   if (warm->sd) {
+      mongoc_server_description_destroy (warm->sd);
+   }
+
+#ifdef MONGOC_ENABLE_CRYPTO
+   if (warm->scram_started) {
+      _mongoc_scram_destroy (&warm->scram);
+   }
+#endif
+
+   _mongoc_host_list_destroy_all (warm->host);
+}
+
+
+/* the async commands for @warm's connection have finished. For
+ * _mongoc_cluster_connect_async, pass the result to its callback now;
+ * _mongoc_cluster_warm collects results after the async run instead */
+static void
+_mongoc_cluster_warm_done (mongoc_cluster_warm_t *warm)
+{
+   mongoc_cluster_node_t *node;
+
+   if (!warm->connect_cb) {
+      return;
+   }
+
+   node = _mongoc_cluster_warm_node (warm);
+   warm->connect_cb (node, node ? NULL : &warm->error, warm->connect_ctx);
+
+   _mongoc_cluster_warm_cleanup (warm);
+   bson_free (warm);
+}
+
+
+static void
+_mongoc_cluster_warm_ismaster_cb (mongoc_async_cmd_result_t result,
+                                  const bson_t *ismaster_response,
+                                  int64_t rtt_msec,
+                                  void *data,
+                                  bson_error_t *error)
+{
+   mongoc_cluster_warm_t *warm = (mongoc_cluster_warm_t *) data;
+   mongoc_server_description_t *sd;
+
+   warm->handshake_done = bson_get_monotonic_time ();
+   warm->handshake_usec = rtt_msec * 1000;
+
+   if (result != MONGOC_ASYNC_CMD_SUCCESS) {
+      if (result == MONGOC_ASYNC_CMD_TIMEOUT) {
+         bson_set_error (&warm->error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_CONNECT,
+                         "connection to %s timed out",
+                         warm->host->host_and_port);
+      } else {
+         memcpy (&warm->error, error, sizeof warm->error);
+      }
+
+      _mongoc_cluster_warm_done (warm);
+      return;
+   }
+
+   sd = (mongoc_server_description_t *) bson_malloc0 (sizeof *sd);
+   mongoc_server_description_init (
+      sd, warm->host->host_and_port, warm->server_id);
+   mongoc_server_description_handle_ismaster (
+      sd, ismaster_response, rtt_msec, error);
+
+   if (!_mongoc_topology_update_from_handshake (
+          warm->cluster->client->topology, sd)) {
+      mongoc_server_description_reset (sd);
+      bson_set_error (&sd->error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_NOT_ESTABLISHED,
+                      "\"%s\" removed from topology",
+                      warm->host->host_and_port);
+   }
+
+   warm->sd = sd;
+
+#ifdef MONGOC_ENABLE_CRYPTO
+   if (sd->type != MONGOC_SERVER_UNKNOWN && warm->cluster->requires_auth &&
+       !strcasecmp (_mongoc_cluster_auth_mechanism (warm->cluster, sd),
+                    "SCRAM-SHA-1")) {
+      _mongoc_cluster_init_scram (warm->cluster, &warm->scram);
+      warm->scram_started = true;
+      if (_mongoc_cluster_warm_scram_next (warm)) {
+         return;
+      }
+   }
+#endif
+
+   _mongoc_cluster_warm_done (warm);
+}
+
+
+/* begin @warm's connection: connect, TLS handshake, and isMaster */
+static void
+_mongoc_cluster_warm_begin (mongoc_cluster_warm_t *warm,
+                            mongoc_async_t *async)
+{
+   mongoc_topology_t *topology = warm->cluster->client->topology;
+   mongoc_async_cmd_t *acmd;
+   const uint8_t *msg;
+   size_t len;
+   bool needs_tls_setup;
+
+   warm->started = bson_get_monotonic_time ();
+   warm->created = true;
+   _mongoc_cluster_connection_created (
+      warm->cluster, warm->server_id, warm->host);
+
+   warm->stream = _mongoc_cluster_connect_nonblocking (
+      warm->cluster, warm->host, &needs_tls_setup, &warm->error);
+
+   if (!warm->stream) {
+      return;
+   }
+
+   acmd = mongoc_async_cmd_new (
+      async,
+      warm->stream,
+#ifdef MONGOC_ENABLE_SSL
+      needs_tls_setup ? mongoc_async_cmd_tls_setup : NULL,
+#else
+      NULL,
+#endif
+      warm->host->host,
+      "admin",
+      NULL,
+      _mongoc_cluster_warm_ismaster_cb,
+      warm,
+      topology->connect_timeout_msec);
+
+   msg = _mongoc_topology_scanner_get_ismaster_msg (topology->scanner, &len);
+   mongoc_async_cmd_set_msg (acmd, msg, len);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_warm --
+ *
+ *       Connect each of @clusters to each server in @server_ids that it
+ *       has no connection to yet. Connecting, the TLS handshake, the
+ *       isMaster call, and SCRAM authentication run concurrently for all
+ *       connections using mongoc_async_t. Connections that use other
+ *       authentication mechanisms authenticate one by one afterward.
+ *
+ *       With shared connections, the connections go to the pool's
+ *       shared set instead, until each server has one per cluster.
+ *
+ *       The caller must own every cluster in @clusters.
+ *
+ * Returns:
+ *       true if every connection was established, otherwise false and
+ *       @error is set to the last failure.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cluster_warm (mongoc_cluster_t **clusters,
+                      size_t n_clusters,
+                      const uint32_t *server_ids,
+                      size_t n_server_ids,
+                      bson_error_t *error)
+{
+   mongoc_topology_t *topology;
+   mongoc_cluster_shared_t *shared;
+   mongoc_cluster_shared_server_t *server;
+   mongoc_async_t *async;
+   mongoc_array_t warms;
+   mongoc_cluster_warm_t *warm;
+   mongoc_cluster_node_t *node;
+   bool ret = true;
+   size_t i, j;
+
+   ENTRY;
+
+   if (!n_clusters) {
+      RETURN (true);
+   }
+
+   topology = clusters[0]->client->topology;
+   shared = clusters[0]->shared; /* the same for all clusters in a pool */
+   BSON_ASSERT (!topology->single_threaded);
+
+   async = mongoc_async_new ();
+   _mongoc_array_init (&warms, sizeof (mongoc_cluster_warm_t));
+
+   for (i = 0; i < n_clusters; i++) {
+      for (j = 0; j < n_server_ids; j++) {
+         mongoc_cluster_warm_t w = {0};
+         bool skip;
+
+         if (shared) {
+            /* one connection per cluster, counting those already idle */
+            mongoc_mutex_lock (&shared->mutex);
+            server = _mongoc_cluster_shared_server (shared, server_ids[j]);
+            w.generation = server->generation;
+            skip = i < server->idle.len;
+            mongoc_mutex_unlock (&shared->mutex);
+         } else {
+            skip = mongoc_set_get (clusters[i]->nodes, server_ids[j]) != NULL;
+         }
+
+         if (skip) {
+            continue;
+         }
+
+         w.cluster = clusters[i];
+         w.server_id = server_ids[j];
+#ifdef MONGOC_ENABLE_CRYPTO
+         w.async = async;
+#endif
+         w.host = _mongoc_topology_host_by_id (topology, w.server_id, &w.error);
+         _mongoc_array_append_val (&warms, w);
+      }
+   }
+
+   /* begin all connections, the array doesn't grow from here on */
+   for (i = 0; i < warms.len; i++) {
+      warm = &_mongoc_array_index (&warms, mongoc_cluster_warm_t, i);
+      if (warm->host) {
+         _mongoc_cluster_warm_begin (warm, async);
+      }
+   }
+
+   mongoc_async_run (async);
+
+   /* SCRAM conversations ran in the async loop, other mechanisms block */
+   for (i = 0; i < warms.len; i++) {
+      warm = &_mongoc_array_index (&warms, mongoc_cluster_warm_t, i);
+
+      node = _mongoc_cluster_warm_node (warm);
+      if (node) {
+         if (shared) {
+            node->generation = warm->generation;
+            _mongoc_cluster_shared_release (shared, warm->server_id, node);
+         } else {
+            mongoc_set_add (warm->cluster->nodes, warm->server_id, node);
+         }
+
+         warm->connected = true;
+      }
+
+      if (!warm->connected) {
+         ret = false;
+         if (error) {
+            memcpy (error, &warm->error, sizeof *error);
+         }
+      }
+
+      _mongoc_cluster_warm_cleanup (warm);
+   }
+
+   _mongoc_array_destroy (&warms);
+   mongoc_async_destroy (async);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_connect_async --
+ *
+ *       Begin a new connection to @server_id in @async, like one of
+ *       _mongoc_cluster_warm's. Once it is established and authenticated,
+ *       or has failed, @cb receives the new node or NULL and an error.
+ *       @cb runs from the async loop, or from here if the connection
+ *       can't begin. SCRAM-SHA-1 runs in the loop, other authentication
+ *       mechanisms block in the loop before @cb is called.
+ *
+ *       The node is @cb's to keep or destroy; it isn't added to @cluster.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_connect_async (mongoc_cluster_t *cluster,
+                               mongoc_async_t *async,
+                               uint32_t server_id,
+                               mongoc_cluster_connect_cb_t cb,
+                               void *ctx)
+{
+   mongoc_cluster_warm_t *warm;
+
+   ENTRY;
+
+   warm = (mongoc_cluster_warm_t *) bson_malloc0 (sizeof *warm);
+   warm->cluster = cluster;
+   warm->server_id = server_id;
+   warm->connect_cb = cb;
+   warm->connect_ctx = ctx;
+#ifdef MONGOC_ENABLE_CRYPTO
+   warm->async = async;
+#endif
+   warm->host = _mongoc_topology_host_by_id (
+      cluster->client->topology, server_id, &warm->error);
+
+   if (warm->host) {
+      _mongoc_cluster_warm_begin (warm, async);
+   }
+
+   if (!warm->stream) {
+      /* nothing was queued */
+      _mongoc_cluster_warm_done (warm);
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_reap_idle_nodes --
+ *
+ *       Close the pooled connections in @cluster that have not been
+ *       checked out for longer than maxIdleTimeMS, or are past
+ *       maxConnectionLifetimeMS. The caller must own
+ *       @cluster: the client pool calls this for clients that are idle in
+ *       the pool, from the topology background thread.
+ *
+ * Returns:
+ *       The number of connections closed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+_mongoc_cluster_reap_idle_nodes (mongoc_cluster_t *cluster,
+                                 int64_t now,
+                                 mongoc_array_t *reaped)
+{
+   mongoc_cluster_node_t *node;
+   uint32_t server_id;
+   uint32_t n_reaped = 0;
+   size_t i;
+
+   if ((!cluster->maxidletimems && !cluster->maxlifetimems) ||
+       cluster->client->topology->single_threaded) {
+      return 0;
+   }
+
+   /* iterate backwards, mongoc_set_rm shifts the items after the removed one */
+   for (i = cluster->nodes->items_len; i > 0; i--) {
+      node = (mongoc_cluster_node_t *) mongoc_set_get_item_and_id (
+         cluster->nodes, (int) i - 1, &server_id);
+
+      if (_mongoc_cluster_node_expired (node, now, cluster->maxidletimems)) {
+         _mongoc_cluster_reaped (reaped,
+                                 mongoc_set_take (cluster->nodes, server_id));
+         n_reaped++;
+      }
+   }
+
+   return n_reaped;
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_init --
+ *
+ *       Initializes @cluster using the @uri and @client provided. The
+ *       @uri is used to determine the "mode" of the cluster. Based on the
+ *       uri we can determine if we are connected to a single host, a
+ *       replicaSet, or a shardedCluster. @uri is the client's, and must
+ *       outlive @cluster.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @cluster is initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_cluster_init (mongoc_cluster_t *cluster,
+                     const mongoc_uri_t *uri,
+                     void *client)
+{
+   int32_t slow_op_threshold_ms;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (uri);
+
+   memset (cluster, 0, sizeof *cluster);
+
+   cluster->uri = uri;
+   cluster->client = (mongoc_client_t *) client;
+   cluster->requires_auth =
+      (mongoc_uri_get_username (uri) || mongoc_uri_get_auth_mechanism (uri));
+
+   cluster->sockettimeoutms = mongoc_uri_get_option_as_int32 (
+      uri, MONGOC_URI_SOCKETTIMEOUTMS, MONGOC_DEFAULT_SOCKETTIMEOUTMS);
+
+   cluster->timeout_msec =
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_TIMEOUTMS, 0);
+
+   cluster->compression_min_rtt_msec =
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_COMPRESSIONMINRTTMS, 0);
+   cluster->compression_outside_zone = mongoc_uri_get_option_as_bool (
+      uri, MONGOC_URI_COMPRESSIONOUTSIDEZONE, false);
+   cluster->compression_hosts =
+      mongoc_uri_get_option_as_utf8 (uri, MONGOC_URI_COMPRESSIONHOSTS, NULL);
+   cluster->compression_policy = cluster->compression_min_rtt_msec > 0 ||
+                                 cluster->compression_outside_zone ||
+                                 cluster->compression_hosts;
+
+   cluster->socketcheckintervalms =
+      mongoc_uri_get_option_as_int32 (uri,
+                                      MONGOC_URI_SOCKETCHECKINTERVALMS,
+                                      MONGOC_TOPOLOGY_SOCKET_CHECK_INTERVAL_MS);
+   cluster->socketchecklocal =
+      mongoc_uri_get_option_as_bool (uri, MONGOC_URI_SOCKETCHECKLOCAL, false);
+
+   cluster->maxidletimems =
+      (uint32_t) BSON_MAX (0,
+                           mongoc_uri_get_option_as_int32 (
+                              uri, MONGOC_URI_MAXIDLETIMEMS, 0));
+   cluster->maxlifetimems =
+      (uint32_t) BSON_MAX (0,
+                           mongoc_uri_get_option_as_int32 (
+                              uri, MONGOC_URI_MAXCONNECTIONLIFETIMEMS, 0));
+
+   /* TODO for single-threaded case we don't need this */
+   cluster->nodes = mongoc_set_new (8, _mongoc_cluster_node_dtor, NULL);
+
+   _mongoc_array_init (&cluster->iov, sizeof (mongoc_iovec_t));
+   _mongoc_arena_init (&cluster->arena);
+   mongoc_compress_scratch_init (&cluster->compress);
+   mongoc_compress_history_init (&cluster->compress_history);
+
+   _mongoc_buffer_init_tagged (&cluster->reply_buffer,
+                               MONGOC_MEMORY_TAG_REPLY_BUFFER);
+   cluster->reply_buffer_max_size = (size_t) BSON_MAX (
+      0,
+      mongoc_uri_get_option_as_int32 (uri,
+                                      MONGOC_URI_REPLYBUFFERMAXSIZE,
+                                      MONGOC_DEFAULT_REPLY_BUFFER_MAX_SIZE));
+
+   cluster->defer_killcursors =
+      mongoc_uri_get_option_as_bool (uri, MONGOC_URI_DEFERKILLCURSORS, false);
+   cluster->retry_writes =
+      mongoc_uri_get_option_as_bool (uri, MONGOC_URI_RETRYWRITES, false);
+   cluster->retry_reads =
+      mongoc_uri_get_option_as_bool (uri, MONGOC_URI_RETRYREADS, false);
+   cluster->opmsg_checksum =
+      mongoc_uri_get_option_as_bool (uri, MONGOC_URI_OPMSGCHECKSUM, false);
+
+   slow_op_threshold_ms =
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_SLOWOPTHRESHOLDMS, -1);
+   cluster->slow_op_threshold_usec =
+      slow_op_threshold_ms < 0 ? -1 : (int64_t) slow_op_threshold_ms * 1000;
+   _mongoc_array_init (&cluster->dead_cursors,
+                       sizeof (mongoc_cluster_dead_cursor_t));
+
+   cluster->operation_id = rand ();
+
+   EXIT;
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_destroy --
+ *
+ *       Clean up after @cluster and destroy all active connections.
+ *       All resources for @cluster are released.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Everything.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_cluster_destroy (mongoc_cluster_t *cluster) /* INOUT */
+{
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+
+   mongoc_set_destroy (cluster->nodes);
+
+   if (cluster->pinned) {
+      _mongoc_cluster_shared_release (
+         cluster->shared, cluster->pinned->server_id, cluster->pinned);
+   }
+
+   _mongoc_array_destroy (&cluster->iov);
+   _mongoc_arena_destroy (&cluster->arena);
+   mongoc_compress_scratch_destroy (&cluster->compress);
+   _mongoc_buffer_destroy (&cluster->reply_buffer);
+   _mongoc_memory_budget_charge (cluster->budget,
+                                 -(int64_t) cluster->decompress_buffer_len);
+   _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION,
+                        cluster->decompress_buffer);
+   _mongoc_array_destroy (&cluster->dead_cursors);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_reset_after_fork --
+ *
+ *       In a child process after fork: close the connections @cluster
+ *       inherited, which the parent goes on using. Their sockets aren't
+ *       shut down and nothing is sent on them, see mongoc_socket_close.
+ *       The cursors waiting to be killed and an unread reply belong to
+ *       the parent too, and are forgotten.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_reset_after_fork (mongoc_cluster_t *cluster)
+{
+   mongoc_cluster_node_t *node;
+   size_t i;
+
+   for (i = 0; i < cluster->nodes->items_len; i++) {
+      node = (mongoc_cluster_node_t *) mongoc_set_get_item (cluster->nodes,
+                                                            (int) i);
+      node->close_reason = MONGOC_APM_CONNECTION_CLOSED_STALE;
+   }
+
+   mongoc_set_destroy (cluster->nodes);
+   cluster->nodes = mongoc_set_new (8, _mongoc_cluster_node_dtor, NULL);
+
+   cluster->dead_cursors.len = 0;
+   cluster->pending_cb = NULL;
+   cluster->pending_ctx = NULL;
+}
+
+
+/* charge @budget for the buffers @cluster reads, decompresses and
+ * compresses messages with */
+void
+_mongoc_cluster_set_budget (mongoc_cluster_t *cluster,
+                            mongoc_memory_budget_t *budget)
+{
+   _mongoc_memory_budget_charge (cluster->budget,
+                                 -(int64_t) cluster->decompress_buffer_len);
+   cluster->budget = budget;
+   _mongoc_memory_budget_charge (cluster->budget,
+                                 (int64_t) cluster->decompress_buffer_len);
+
+   _mongoc_buffer_set_budget (&cluster->reply_buffer, budget);
+   mongoc_compress_scratch_set_budget (&cluster->compress, budget);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_stream_for_optype --
+ *
+ *       Internal server selection.
+ *
+ * Returns:
+ *       A mongoc_server_stream_t on which you must call
+ *       mongoc_server_stream_cleanup, or NULL on failure (sets @error)
+ *
+ * Side effects:
+ *       May set @error.
+ *       May add new nodes to @cluster->nodes.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_server_stream_t *
+_mongoc_cluster_stream_for_optype (mongoc_cluster_t *cluster,
+                                   mongoc_ss_optype_t optype,
+                                   const mongoc_read_prefs_t *read_prefs,
+                                   bson_error_t *error)
+{
+   mongoc_server_stream_t *server_stream;
+   uint32_t server_id;
+   mongoc_topology_t *topology = cluster->client->topology;
+   int64_t since;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+
+   /* single-threaded server selection may check the servers on the
+    * cluster's own connections */
+   _mongoc_cluster_finish_pending (cluster);
+
+   _mongoc_cluster_span_restart (cluster);
+   since = _mongoc_cluster_span_now (cluster);
+
+   server_id = _mongoc_topology_select_server_id_until (
+      topology, optype, read_prefs, cluster->deadline, error);
+
+   if (!server_id) {
+      _mongoc_cluster_deadline_error (cluster, error);
+      _mongoc_cluster_span_restart (cluster);
+      RETURN (NULL);
+   }
+
+   if (!mongoc_cluster_check_interval (cluster, server_id)) {
+      /* Server Selection Spec: try once more */
+      server_id = _mongoc_topology_select_server_id_until (
+         topology, optype, read_prefs, cluster->deadline, error);
+
+      if (!server_id) {
+         _mongoc_cluster_deadline_error (cluster, error);
+         _mongoc_cluster_span_restart (cluster);
+         RETURN (NULL);
+      }
+   }
+
+   _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_SERVER_SELECTION, since);
+
+   /* connect or reconnect to server if necessary */
+   server_stream = _mongoc_cluster_stream_for_server (
+      cluster, server_id, true /* reconnect_ok */, error);
+
+   if (!server_stream) {
+      _mongoc_cluster_span_restart (cluster);
+      RETURN (NULL);
+   }
+
+   /* a server whose round trip alone outlasts the time left can't answer
+    * in time, don't send it the operation */
+   if (cluster->deadline && server_stream->sd->round_trip_time_msec >= 0 &&
+       server_stream->sd->round_trip_time_msec >=
+          _mongoc_cluster_deadline_remaining_msec (cluster)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_OPERATION_TIMEOUT,
+                      "Operation exceeded timeoutMS: the round trip time to"
+                      " %s is %" PRId64 "ms",
+                      server_stream->sd->host.host_and_port,
+                      server_stream->sd->round_trip_time_msec);
+      mongoc_server_stream_cleanup (server_stream);
+      _mongoc_cluster_span_restart (cluster);
+      RETURN (NULL);
+   }
+
+   RETURN (server_stream);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_stream_for_reads --
+ *
+ *       Internal server selection.
+ *
+ * Returns:
+ *       A mongoc_server_stream_t on which you must call
+ *       mongoc_server_stream_cleanup, or NULL on failure (sets @error)
+ *
+ * Side effects:
+ *       May set @error.
+ *       May add new nodes to @cluster->nodes.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_server_stream_t *
+mongoc_cluster_stream_for_reads (mongoc_cluster_t *cluster,
+                                 const mongoc_read_prefs_t *read_prefs,
+                                 bson_error_t *error)
+{
+   return _mongoc_cluster_stream_for_optype (
+      cluster, MONGOC_SS_READ, read_prefs, error);
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_stream_for_writes --
+ *
+ *       Get a stream for write operations.
+ *
+ * Returns:
+ *       A mongoc_server_stream_t on which you must call
+ *       mongoc_server_stream_cleanup, or NULL on failure (sets @error)
+ *
+ * Side effects:
+ *       May set @error.
+ *       May add new nodes to @cluster->nodes.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_server_stream_t *
+mongoc_cluster_stream_for_writes (mongoc_cluster_t *cluster,
+                                  bson_error_t *error)
+{
+   return _mongoc_cluster_stream_for_optype (
+      cluster, MONGOC_SS_WRITE, NULL, error);
+}
+
+
+/* network errors, and errors from a server that stepped down or is shutting
+ * down: the operation may succeed on a newly selected server */
+bool
+_mongoc_cluster_error_is_retryable (const bson_error_t *error)
+{
+   if (error->domain == MONGOC_ERROR_STREAM) {
+      return true;
+   }
+
+   if (error->domain != MONGOC_ERROR_QUERY &&
+       error->domain != MONGOC_ERROR_SERVER) {
+      return false;
+   }
+
+   switch (error->code) {
+   case 6:     /* HostUnreachable */
+   case 7:     /* HostNotFound */
+   case 89:    /* NetworkTimeout */
+   case 91:    /* ShutdownInProgress */
+   case 189:   /* PrimarySteppedDown */
+   case 9001:  /* SocketException */
+   case 10107: /* NotMaster */
+   case 11600: /* InterruptedAtShutdown */
+   case 11602: /* InterruptedDueToReplStateChange */
+   case 13435: /* NotMasterNoSlaveOk */
+   case 13436: /* NotMasterOrSecondary */
+      return true;
+   default:
+      return false;
+   }
+}
+
+
+/* before retrying after @error from @server_id: network errors already
+ * invalidated the server, one that stepped down must not be selected again */
+void
+_mongoc_cluster_invalidate_for_retry (mongoc_cluster_t *cluster,
+                                      uint32_t server_id,
+                                      const bson_error_t *error)
+{
+   if (error->domain != MONGOC_ERROR_STREAM) {
+      mongoc_topology_invalidate_server (
+         cluster->client->topology, server_id, error);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_stream_for_read_retry --
+ *
+ *       After a read on @server_stream failed with @error, select a server
+ *       for @read_prefs to retry it once, if "retryReads" is set and the
+ *       error is retryable.
+ *
+ * Returns:
+ *       A server stream, or NULL if the caller should report @error.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_server_stream_t *
+_mongoc_cluster_stream_for_read_retry (
+   mongoc_cluster_t *cluster,
+   const mongoc_read_prefs_t *read_prefs,
+   const mongoc_server_stream_t *server_stream,
+   const bson_error_t *error)
+{
+   mongoc_server_stream_t *retry_stream;
+   bson_error_t ignored;
+
+   if (!cluster->retry_reads ||
+       server_stream->sd->max_wire_version < WIRE_VERSION_RETRYABLE_READS ||
+       !_mongoc_cluster_error_is_retryable (error)) {
+      return NULL;
+   }
+
+   _mongoc_cluster_invalidate_for_retry (cluster, server_stream->sd->id, error);
+
+   retry_stream =
+      mongoc_cluster_stream_for_reads (cluster, read_prefs, &ignored);
+   if (retry_stream &&
+       retry_stream->sd->max_wire_version < WIRE_VERSION_RETRYABLE_READS) {
+      mongoc_server_stream_cleanup (retry_stream);
+      return NULL;
+   }
+
+   if (retry_stream) {
+      mongoc_counter_op_egress_retried_reads_inc ();
+   }
+
+   return retry_stream;
+}
+
+static bool
+_mongoc_cluster_min_of_max_obj_size_sds (void *item, void *ctx)
+{
+   mongoc_server_description_t *sd = (mongoc_server_description_t *) item;
+   int32_t *current_min = (int32_t *) ctx;
+
+   if (sd->max_bson_obj_size < *current_min) {
+      *current_min = sd->max_bson_obj_size;
+   }
+   return true;
+}
+
+static bool
+_mongoc_cluster_min_of_max_obj_size_nodes (void *item, void *ctx)
+{
+   mongoc_cluster_node_t *node = (mongoc_cluster_node_t *) item;
+   int32_t *current_min = (int32_t *) ctx;
+
+   if (node->max_bson_obj_size < *current_min) {
+      *current_min = node->max_bson_obj_size;
+   }
+   return true;
+}
+
+static bool
+_mongoc_cluster_min_of_max_msg_size_sds (void *item, void *ctx)
+{
+   mongoc_server_description_t *sd = (mongoc_server_description_t *) item;
+   int32_t *current_min = (int32_t *) ctx;
+
+   if (sd->max_msg_size < *current_min) {
+      *current_min = sd->max_msg_size;
+   }
+   return true;
+}
+
+static bool
+_mongoc_cluster_min_of_max_msg_size_nodes (void *item, void *ctx)
+{
+   mongoc_cluster_node_t *node = (mongoc_cluster_node_t *) item;
+   int32_t *current_min = (int32_t *) ctx;
+
+   if (node->max_msg_size < *current_min) {
+      *current_min = node->max_msg_size;
+   }
+   return true;
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_get_max_bson_obj_size --
+ *
+ *      Return the minimum max_bson_obj_size across all servers in cluster.
+ *
+ *      NOTE: this method uses the topology's mutex.
+ *
+ * Returns:
+ *      The minimum max_bson_obj_size.
+ *
+ * Side effects:
+ *      None
+ *
+ *--------------------------------------------------------------------------
+ */
+int32_t
+mongoc_cluster_get_max_bson_obj_size (mongoc_cluster_t *cluster)
+{
+   int32_t max_bson_obj_size = -1;
+
+   max_bson_obj_size = MONGOC_DEFAULT_BSON_OBJ_SIZE;
+
+   if (!cluster->client->topology->single_threaded) {
+      mongoc_set_for_each (cluster->nodes,
+                           _mongoc_cluster_min_of_max_obj_size_nodes,
+                           &max_bson_obj_size);
+   } else {
+      mongoc_set_for_each (cluster->client->topology->description.servers,
+                           _mongoc_cluster_min_of_max_obj_size_sds,
+                           &max_bson_obj_size);
+   }
+
+   return max_bson_obj_size;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_get_max_msg_size --
+ *
+ *      Return the minimum max msg size across all servers in cluster.
+ *
+ *      NOTE: this method uses the topology's mutex.
+ *
+ * Returns:
+ *      The minimum max_msg_size
+ *
+ * Side effects:
+ *      None
+ *
+ *--------------------------------------------------------------------------
+ */
+int32_t
+mongoc_cluster_get_max_msg_size (mongoc_cluster_t *cluster)
+{
+   int32_t max_msg_size = MONGOC_DEFAULT_MAX_MSG_SIZE;
+
+   if (!cluster->client->topology->single_threaded) {
+      mongoc_set_for_each (cluster->nodes,
+                           _mongoc_cluster_min_of_max_msg_size_nodes,
+                           &max_msg_size);
+   } else {
+      mongoc_set_for_each (cluster->client->topology->description.servers,
+                           _mongoc_cluster_min_of_max_msg_size_sds,
+                           &max_msg_size);
+   }
+
+   return max_msg_size;
+}
+
+
+/* poll and peek at an idle connection's socket without a round trip. TLS
+ * and other wrapping streams are checked at their root socket stream */
+static mongoc_socket_liveness_t
+_mongoc_cluster_check_liveness (mongoc_stream_t *stream)
+{
+   mongoc_stream_t *root;
+   mongoc_socket_t *sock;
+
+   root = mongoc_stream_get_root_stream (stream);
+   if (root->type != MONGOC_STREAM_SOCKET) {
+      return MONGOC_SOCKET_LIVENESS_UNKNOWN;
+   }
+
+   sock = mongoc_stream_socket_get_socket ((mongoc_stream_socket_t *) root);
+   if (!sock) {
+      return MONGOC_SOCKET_LIVENESS_UNKNOWN;
+   }
+
+   return _mongoc_socket_check_liveness (sock);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_check_interval --
+ *
+ *      Server Selection Spec:
+ *
+ *      Only for single-threaded drivers.
+ *
+ *      If a server is selected that has an existing connection that has been
+ *      idle for socketCheckIntervalMS, the driver MUST check the connection
+ *      with the "ping" command. If the ping succeeds, use the selected
+ *      connection. If not, set the server's type to Unknown and update the
+ *      Topology Description according to the Server Discovery and Monitoring
+ *      Spec, and attempt once more to select a server.
+ *
+ *      With socketCheckLocal, the connection is first checked locally and
+ *      only pinged if the local check is inconclusive.
+ *
+ * Returns:
+ *      True if the check succeeded or no check was required, false if the
+ *      check failed.
+ *
+ * Side effects:
+ *      If a check fails, closes stream and may set server type Unknown.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cluster_check_interval (mongoc_cluster_t *cluster, uint32_t server_id)
+{
+   mongoc_cmd_parts_t parts;
+   mongoc_topology_t *topology;
+   mongoc_topology_scanner_node_t *scanner_node;
+   mongoc_stream_t *stream;
+   int64_t now;
+   bson_t command;
+   bson_error_t error;
+   bool r = true;
+   mongoc_server_stream_t *server_stream;
+
+   topology = cluster->client->topology;
+
+   if (!topology->single_threaded) {
+      return true;
+   }
+
+   _mongoc_topology_finish_server_check (topology, server_id);
+   scanner_node =
+      mongoc_topology_scanner_get_node (topology->scanner, server_id);
+
+   if (!scanner_node) {
+      return false;
+   }
+
+   BSON_ASSERT (!scanner_node->retired);
+
+   stream = scanner_node->stream;
+
+   if (!stream) {
+      return false;
+   }
+
+   now = bson_get_monotonic_time ();
+
+   if (scanner_node->last_used + (1000 * CHECK_CLOSED_DURATION_MSEC) < now) {
+      if (mongoc_stream_check_closed (stream)) {
+         bson_set_error (&error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_SOCKET,
+                         "connection closed");
+         mongoc_cluster_disconnect_node (cluster, server_id, true, &error);
+         return false;
+      }
+   }
+
+   if (scanner_node->last_used + (1000 * cluster->socketcheckintervalms) <
+       now) {
+      if (cluster->socketchecklocal) {
+         switch (_mongoc_cluster_check_liveness (stream)) {
+         case MONGOC_SOCKET_ALIVE:
+            return true;
+         case MONGOC_SOCKET_CLOSED:
+            bson_set_error (&error,
+                            MONGOC_ERROR_STREAM,
+                            MONGOC_ERROR_STREAM_SOCKET,
+                            "connection closed");
+            mongoc_cluster_disconnect_node (cluster, server_id, true, &error);
+            return false;
+         case MONGOC_SOCKET_LIVENESS_UNKNOWN:
+         default:
+            /* inconclusive, ask the server */
+            break;
+         }
+      }
+
+      bson_init (&command);
+      BSON_APPEND_INT32 (&command, "ping", 1);
+      mongoc_cmd_parts_init (&parts, "admin", MONGOC_QUERY_SLAVE_OK, &command);
+      server_stream = _mongoc_cluster_create_server_stream (
+         cluster->client->topology, server_id, stream, &error);
+      r = mongoc_cluster_run_command_parts (
+         cluster, server_stream, &parts, NULL, &error);
+
+      mongoc_server_stream_cleanup (server_stream);
+      mongoc_cmd_parts_cleanup (&parts);
+      bson_destroy (&command);
+
+      if (!r) {
+         mongoc_cluster_disconnect_node (cluster, server_id, true, &error);
+      }
+   }
+
+   return r;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_legacy_rpc_sendv_to_server --
+ *
+ *       Sends the given RPCs to the given server.
+ *
+ * Returns:
+ *       True if successful.
+ *
+ * Side effects:
+ *       @rpc may be mutated and should be considered invalid after calling
+ *       this method.
+ *
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cluster_legacy_rpc_sendv_to_server (
+   mongoc_cluster_t *cluster,
+   mongoc_rpc_t *rpc,
+   mongoc_server_stream_t *server_stream,
+   bson_error_t *error)
+{
+   uint32_t server_id;
+   mongoc_topology_scanner_node_t *scanner_node;
+   int32_t max_msg_size;
+   bool ret = false;
+   int32_t compressor_id = 0;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (rpc);
+   BSON_ASSERT (server_stream);
+
+   server_id = server_stream->sd->id;
+
+   if (cluster->client->in_exhaust) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_IN_EXHAUST,
+                      "A cursor derived from this client is in exhaust.");
+      GOTO (done);
+   }
+
+   _mongoc_array_clear (&cluster->iov);
+   compressor_id = _mongoc_cluster_compressor_id (cluster, server_stream->sd);
+
+   _mongoc_rpc_gather (rpc, &cluster->iov);
+   _mongoc_rpc_swab_to_le (rpc);
+
+   if (compressor_id != -1) {
+      if (!_mongoc_rpc_compress (cluster, compressor_id, NULL, rpc, error)) {
+         GOTO (done);
+      }
+   }
+
+   max_msg_size = mongoc_server_stream_max_msg_size (server_stream);
+
+   if (BSON_UINT32_FROM_LE (rpc->header.msg_len) > max_msg_size) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_TOO_BIG,
+                      "Attempted to send an RPC larger than the "
+                      "max allowed message size. Was %u, allowed %u.",
+                      BSON_UINT32_FROM_LE (rpc->header.msg_len),
+                      max_msg_size);
+      GOTO (done);
+   }
+
+   if (!_mongoc_stream_writev_full (server_stream->stream,
+                                    cluster->iov.data,
+                                    cluster->iov.len,
+                                    _mongoc_cluster_io_timeout_msec (cluster),
+                                    error)) {
+      GOTO (done);
+   }
+
+   _mongoc_cluster_count_egress (cluster, server_stream, rpc->header.msg_len);
+
+   if (cluster->client->topology->single_threaded) {
+      scanner_node = mongoc_topology_scanner_get_node (
+         cluster->client->topology->scanner, server_id);
+
+      if (scanner_node) {
+         scanner_node->last_used = bson_get_monotonic_time ();
+      }
+   }
+
+   ret = true;
+
+done:
+   if (!ret) {
+      _mongoc_cluster_count_error (server_stream->sd);
+   }
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_try_recv --
+ *
+ *       Tries to receive the next event from the MongoDB server.
+ *       The contents are loaded into @buffer and then
+ *       scattered into the @rpc structure. @rpc is valid as long as
+ *       @buffer contains the contents read into it.
+ *
+ *       Callers that can optimize a reuse of @buffer should do so. It
+ *       can save many memory allocations.
+ *
+ * Returns:
+ *       True if successful.
+ *
+ * Side effects:
+ *       @rpc is set on success, @error on failure.
+ *       @buffer will be filled with the input data.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cluster_try_recv (mongoc_cluster_t *cluster,
+                         mongoc_rpc_t *rpc,
+                         mongoc_buffer_t *buffer,
+                         mongoc_server_stream_t *server_stream,
+                         bson_error_t *error)
+{
+   uint32_t server_id;
+   bson_error_t err_local;
+   int32_t msg_len;
+   int32_t max_msg_size;
+   off_t pos;
+   mongoc_memory_budget_t *budget;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (rpc);
+   BSON_ASSERT (buffer);
+   BSON_ASSERT (server_stream);
+
+   server_id = server_stream->sd->id;
+
+   TRACE ("Waiting for reply from server_id \"%u\"", server_id);
+
+   if (!error) {
+      error = &err_local;
+   }
+
+   /*
+    * Buffer the message length to determine how much more to read.
+    */
+   pos = buffer->len;
+   if (!_mongoc_buffer_append_from_stream (
+          buffer,
+          server_stream->stream,
+          4,
+          _mongoc_cluster_io_timeout_msec (cluster),
+          error)) {
+      MONGOC_DEBUG (
+         "Could not read 4 bytes, stream probably closed or timed out");
+      mongoc_counter_protocol_ingress_error_inc ();
+      _mongoc_cluster_count_error (server_stream->sd);
+      _mongoc_cluster_count_timeout (server_stream->sd, server_stream->stream);
+      mongoc_cluster_disconnect_node (
+         cluster,
+         server_id,
+         !mongoc_stream_timed_out (server_stream->stream),
+         error);
+      RETURN (false);
+   }
+
+   /*
+    * Read the msg length from the buffer.
+    */
+   memcpy (&msg_len, &buffer->data[buffer->off + pos], 4);
+   msg_len = BSON_UINT32_FROM_LE (msg_len);
+   max_msg_size = mongoc_server_stream_max_msg_size (server_stream);
+   if ((msg_len < 16) || (msg_len > max_msg_size)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Corrupt or malicious reply received.");
+      _mongoc_cluster_count_error (server_stream->sd);
+      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
+      mongoc_counter_protocol_ingress_error_inc ();
+      RETURN (false);
+   }
+
+   /*
+    * Read the rest of the message from the stream.
+    */
+   if (!_mongoc_buffer_append_from_stream (
+          buffer,
+          server_stream->stream,
+          msg_len - 4,
+          _mongoc_cluster_io_timeout_msec (cluster),
+          error)) {
+      _mongoc_cluster_count_error (server_stream->sd);
+      _mongoc_cluster_count_timeout (server_stream->sd, server_stream->stream);
+      mongoc_cluster_disconnect_node (
+         cluster,
+         server_id,
+         !mongoc_stream_timed_out (server_stream->stream),
+         error);
+      mongoc_counter_protocol_ingress_error_inc ();
+      RETURN (false);
+   }
+
+   _mongoc_cluster_count_ingress (cluster, server_stream, msg_len);
+
+   /*
+    * Scatter the buffer into the rpc structure.
+    */
+   if (!_mongoc_rpc_scatter (rpc, &buffer->data[buffer->off + pos], msg_len)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Failed to decode reply from server.");
+      _mongoc_cluster_count_error (server_stream->sd);
+      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
+      mongoc_counter_protocol_ingress_error_inc ();
+      RETURN (false);
+   }
+
+   if (BSON_UINT32_FROM_LE (rpc->header.opcode) == MONGOC_OPCODE_COMPRESSED) {
+      uint8_t *buf = NULL;
+      size_t len = BSON_UINT32_FROM_LE (rpc->compressed.uncompressed_size) +
+                   sizeof (mongoc_rpc_header_t);
+      bson_realloc_func realloc_func;
+      void *realloc_data;
+
+      /* from the buffer's own allocator, since the buffer adopts it */
+      buf = (uint8_t *) buffer->realloc_func (NULL, len, buffer->realloc_data);
+      if (!_mongoc_rpc_decompress (rpc, buf, len, &cluster->compress)) {
+         _mongoc_cluster_count_error (server_stream->sd);
+         buffer->realloc_func (buf, 0, buffer->realloc_data);
+         bson_set_error (error,
+                         MONGOC_ERROR_PROTOCOL,
+                         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                         "Could not decompress server reply");
+         RETURN (false);
+      }
+
+      budget = buffer->budget;
+      realloc_func = buffer->realloc_func;
+      realloc_data = buffer->realloc_data;
+      _mongoc_buffer_destroy (buffer);
+      _mongoc_buffer_init (buffer, buf, len, realloc_func, realloc_data);
+      _mongoc_buffer_set_budget (buffer, budget);
+   }
+   _mongoc_rpc_swab_from_le (rpc);
+
+   RETURN (true);
+}
+
+/* in the gathered OP_MSG, replace section 0's single iovec for
+ * @cmd->command with one for @len_le, the whole command's length, one for
+ * the elements of @cmd->command, and one for @cmd->command_suffix's elements
+ * and terminator. returns the bytes added to the message */
+static int32_t
+_mongoc_cluster_gather_suffix (mongoc_cluster_t *cluster,
+                               const mongoc_cmd_t *cmd,
+                               int32_t *len_le)
+{
+   const uint8_t *body = bson_get_data (cmd->command);
+   const uint8_t *suffix = bson_get_data (cmd->command_suffix);
+   mongoc_iovec_t split[3];
+   mongoc_iovec_t *iov;
+   size_t n;
+   size_t i;
+
+   n = cluster->iov.len;
+   iov = (mongoc_iovec_t *) cluster->iov.data;
+   for (i = 0; i < n; i++) {
+      if (iov[i].iov_base == (void *) body) {
+         break;
+      }
+   }
+
+   BSON_ASSERT (i < n);
+
+   *len_le = (int32_t) BSON_UINT32_TO_LE (mongoc_cmd_get_len (cmd));
+   split[0].iov_base = (void *) len_le;
+   split[0].iov_len = 4;
+   split[1].iov_base = (void *) (body + 4);
+   split[1].iov_len = cmd->command->len - 5;
+   split[2].iov_base = (void *) (suffix + 4);
+   split[2].iov_len = cmd->command_suffix->len - 4;
+
+   /* make room for two more, then shift the iovecs after section 0 */
+   _mongoc_array_append_vals (&cluster->iov, split, 2);
+   iov = (mongoc_iovec_t *) cluster->iov.data;
+   memmove (&iov[i + 3], &iov[i + 1], (n - i - 1) * sizeof (mongoc_iovec_t));
+   memcpy (&iov[i], split, sizeof split);
+
+   return (int32_t) cmd->command_suffix->len - 5;
+}
+
+
+/* write @cmd as an OP_MSG with the given request id */
+static bool
+_mongoc_cluster_send_opmsg (mongoc_cluster_t *cluster,
+                            mongoc_cmd_t *cmd,
+                            int32_t request_id,
+                            bson_error_t *error)
+{
+   mongoc_rpc_section_t section[2];
+   mongoc_rpc_t rpc;
+   bool ok;
+   const mongoc_server_stream_t *server_stream;
+   int64_t since;
+   int32_t len_le;
+   uint32_t checksum_le;
+
+   server_stream = cmd->server_stream;
+   if (!cmd->command_name) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Empty command document");
+      return false;
+   }
+   if (cluster->client->in_exhaust) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_IN_EXHAUST,
+                      "A cursor derived from this client is in exhaust.");
+      return false;
+   }
+
+   _mongoc_array_clear (&cluster->iov);
+
+   rpc.header.msg_len = 0;
+   rpc.header.request_id = request_id;
+   rpc.header.response_to = 0;
+   rpc.header.opcode = MONGOC_OPCODE_MSG;
+   rpc.msg.flags = (cmd->more_to_come ? MONGOC_MSG_MORE_TO_COME : 0) |
+                   (cmd->exhaust_allowed ? MONGOC_MSG_EXHAUST_ALLOWED : 0) |
+                   (cluster->opmsg_checksum ? MONGOC_MSG_CHECKSUM_PRESENT : 0);
+   rpc.msg.n_sections = 1;
+
+   section[0].payload_type = 0;
+   section[0].payload.bson_document = bson_get_data (cmd->command);
+   rpc.msg.sections[0] = section[0];
+
+   if (cmd->payload || cmd->payload_iovcnt) {
+      section[1].payload_type = 1;
+      section[1].payload.sequence.size = cmd->payload_size +
+                                         strlen (cmd->payload_identifier) + 1 +
+                                         sizeof (int32_t);
+      section[1].payload.sequence.identifier = cmd->payload_identifier;
+      section[1].payload.sequence.bson_documents = cmd->payload;
+      rpc.msg.sections[1] = section[1];
+      rpc.msg.n_sections++;
+   }
+
+   _mongoc_rpc_gather (&rpc, &cluster->iov);
+
+   if (cmd->command_suffix) {
+      rpc.header.msg_len +=
+         _mongoc_cluster_gather_suffix (cluster, cmd, &len_le);
+   }
+
+   if (cmd->payload_iovcnt) {
+      /* the documents are scattered, replace the sequence's single iovec
+       * with the caller's; msg_len already counts their bytes */
+      BSON_ASSERT (!cmd->payload);
+      cluster->iov.len--;
+      _mongoc_array_append_vals (
+         &cluster->iov, cmd->payload_iov, (uint32_t) cmd->payload_iovcnt);
+   }
+
+   if (cluster->opmsg_checksum) {
+      /* of the whole uncompressed message, so before compressing it */
+      rpc.header.msg_len += 4;
+      _mongoc_rpc_swab_to_le (&rpc);
+      _mongoc_rpc_append_checksum (&cluster->iov, &checksum_le);
+   } else {
+      _mongoc_rpc_swab_to_le (&rpc);
+   }
+
+   if (mongoc_cmd_is_compressable (cmd)) {
+      int32_t compressor_id =
+         _mongoc_cluster_compressor_id (cluster, server_stream->sd);
+
+      TRACE (
+         "Function '%s' is compressable: %d", cmd->command_name, compressor_id);
+      if (compressor_id != -1) {
+         since = _mongoc_cluster_span_now (cluster);
+         if (!_mongoc_rpc_compress (
+                cluster, compressor_id, cmd->command_name, &rpc, error)) {
+            return false;
+         }
+         _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_COMPRESS, since);
+      }
+   }
+   since = _mongoc_cluster_span_now (cluster);
+   ok = _mongoc_stream_writev_full (server_stream->stream,
+                                    (mongoc_iovec_t *) cluster->iov.data,
+                                    cluster->iov.len,
+                                    _mongoc_cluster_io_timeout_msec (cluster),
+                                    error);
+   if (ok) {
+      _mongoc_cluster_count_egress (
+         cluster, server_stream, rpc.header.msg_len);
+      _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_SEND, since);
+   } else {
+      mongoc_cluster_disconnect_node (
+         cluster, server_stream->sd->id, true, error);
+   }
+
+   return ok;
+}
+
+
+/* read one OP_MSG reply, copy its body to @reply, which is always
+ * initialized, and set @response_to and, if not NULL, @flags. false on
+ * network or protocol error */
+static bool
+_mongoc_cluster_recv_opmsg (mongoc_cluster_t *cluster,
+                            const mongoc_server_stream_t *server_stream,
+                            int32_t *response_to,
+                            uint32_t *flags,
+                            bson_t *reply,
+                            bson_error_t *error)
+{
+   mongoc_buffer_t *buffer;
+   bson_t reply_local;
+   uint8_t *output;
+   mongoc_rpc_t rpc;
+   int32_t msg_len;
+   int64_t since;
+   bool ok;
+
+   buffer = _mongoc_cluster_reply_buffer (cluster);
+
+   since = _mongoc_cluster_span_now (cluster);
+   ok = _mongoc_buffer_append_from_stream (
+      buffer,
+      server_stream->stream,
+      4,
+      _mongoc_cluster_io_timeout_msec (cluster),
+      error);
+   if (!ok) {
+      _mongoc_cluster_count_timeout (server_stream->sd, server_stream->stream);
+      mongoc_cluster_disconnect_node (
+         cluster, server_stream->sd->id, true, error);
+      GOTO (done);
+   }
+   _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_SERVER_WAIT, since);
+
+   BSON_ASSERT (buffer->len == 4);
+   memcpy (&msg_len, buffer->data, 4);
+   msg_len = BSON_UINT32_FROM_LE (msg_len);
+   if ((msg_len < 16) || (msg_len > server_stream->sd->max_msg_size)) {
+      bson_set_error (
+         error,
+         MONGOC_ERROR_PROTOCOL,
+         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+         "Message size %d is not within expected range 16-%d bytes",
+         msg_len,
+         server_stream->sd->max_msg_size);
+      mongoc_cluster_disconnect_node (
+         cluster, server_stream->sd->id, true, error);
+      ok = false;
+      GOTO (done);
+   }
+
+   since = _mongoc_cluster_span_now (cluster);
+   ok = _mongoc_buffer_append_from_stream (
+      buffer,
+      server_stream->stream,
+      (size_t) msg_len - 4,
+      _mongoc_cluster_io_timeout_msec (cluster),
+      error);
+   if (!ok) {
+      _mongoc_cluster_count_timeout (server_stream->sd, server_stream->stream);
+      mongoc_cluster_disconnect_node (
+         cluster, server_stream->sd->id, true, error);
+      GOTO (done);
+   }
+
+   _mongoc_cluster_count_ingress (cluster, server_stream, msg_len);
+   _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_RECEIVE, since);
+
+   ok = _mongoc_rpc_scatter (&rpc, buffer->data, buffer->len);
+   if (!ok) {
+      /* including a checksum mismatch: don't trust the connection */
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Malformed message from server");
+      mongoc_cluster_disconnect_node (
+         cluster, server_stream->sd->id, true, error);
+      GOTO (done);
+   }
+   if (BSON_UINT32_FROM_LE (rpc.header.opcode) == MONGOC_OPCODE_COMPRESSED) {
+      size_t len = BSON_UINT32_FROM_LE (rpc.compressed.uncompressed_size) +
+                   sizeof (mongoc_rpc_header_t);
+
+      since = _mongoc_cluster_span_now (cluster);
+      output = _mongoc_cluster_decompress_buffer (cluster, len);
+      if (!_mongoc_rpc_decompress (
+             &rpc, output, len, &cluster->compress)) {
+         bson_set_error (error,
+                         MONGOC_ERROR_PROTOCOL,
+                         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                         "Could not decompress message from server");
+         mongoc_cluster_disconnect_node (
+            cluster, server_stream->sd->id, true, error);
+         ok = false;
+         GOTO (done);
+      }
+      _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_DECOMPRESS, since);
+   }
+   _mongoc_rpc_swab_from_le (&rpc);
+
+   *response_to = rpc.header.response_to;
+   if (flags) {
+      *flags = rpc.msg.flags;
+   }
+
+   memcpy (&msg_len, rpc.msg.sections[0].payload.bson_document, 4);
+   msg_len = BSON_UINT32_FROM_LE (msg_len);
+   bson_init_static (
+      &reply_local, rpc.msg.sections[0].payload.bson_document, msg_len);
+
+   bson_copy_to (&reply_local, reply);
+
+done:
+   if (!ok) {
+      bson_init (reply);
+   }
+
+   _mongoc_cluster_trim_reply_buffers (cluster);
+
+   return ok;
+}
+
+
+/* the command's own result, once the reply has been received */
+static bool
+_mongoc_cluster_check_opmsg_reply (mongoc_cluster_t *cluster,
+                                   const mongoc_cmd_t *cmd,
+                                   const bson_t *reply,
+                                   bson_error_t *error)
 {
-   mongoc_topology_t *topology = cluster->client->topology;
+   _mongoc_topology_update_cluster_time (cluster->client->topology, reply);
+   _mongoc_client_session_advance_operation_time (cmd->session, reply);
 
-   ENTRY;
+   return _mongoc_cmd_check_ok (
+      reply, cluster->client->error_api_version, error);
+}
 
-   if (topology->single_threaded) {
-      mongoc_topology_scanner_node_t *scanner_node;
 
-      scanner_node =
-         mongoc_topology_scanner_get_node (topology->scanner, server_id);
+bool
+mongoc_cluster_run_opmsg (mongoc_cluster_t *cluster,
+                          mongoc_cmd_t *cmd,
+                          bson_t *reply,
+                          bson_error_t *error)
+{
+   bson_t reply_local;
+   int32_t response_to;
+   bool ok;
 
-      /* might never actually have connected */
-      if (scanner_node && scanner_node->stream) {
-         mongoc_topology_scanner_node_disconnect (scanner_node, true);
-      }
+   if (!reply) {
+      reply = &reply_local;
+   }
+
+   if (!_mongoc_cluster_send_opmsg (
+          cluster, cmd, (int32_t) ++cluster->request_id, error)) {
+      _mongoc_cluster_count_error (cmd->server_stream->sd);
+      bson_init (reply);
+      return false;
+   }
+
+   if (cmd->more_to_come) {
+      /* the server sends nothing back, succeed as w:0 replies would */
+      bson_init (reply);
+      BSON_APPEND_INT32 (reply, "ok", 1);
+      ok = true;
+   } else if (!_mongoc_cluster_recv_opmsg (cluster,
+                                           cmd->server_stream,
+                                           &response_to,
+                                           NULL,
+                                           reply,
+                                           error)) {
+      ok = false;
    } else {
-      mongoc_set_rm (cluster->nodes, server_id);
+      ok = _mongoc_cluster_check_opmsg_reply (cluster, cmd, reply, error);
    }
 
-   if (invalidate) {
-      mongoc_topology_invalidate_server (topology, server_id, why);
+   if (!ok) {
+      _mongoc_cluster_count_error (cmd->server_stream->sd);
    }
 
-   EXIT;
+   if (reply == &reply_local) {
+      bson_destroy (&reply_local);
+   }
+
+   return ok;
 }
 
+
 static void
-_mongoc_cluster_node_destroy (mongoc_cluster_node_t *node)
+_mongoc_cluster_monitor_started (mongoc_cluster_t *cluster,
+                                 const mongoc_cmd_t *cmd,
+                                 int32_t request_id)
 {
-   /* Failure, or Replica Set reconfigure without this node */
-   mongoc_stream_failed (node->stream);
-   bson_free (node->connection_address);
+   mongoc_apm_callbacks_t *callbacks = &cluster->client->apm_callbacks;
+   mongoc_apm_command_started_t started_event;
 
-   bson_free (node);
+   if (callbacks->started &&
+       _mongoc_apm_command_sampled (callbacks, cmd->operation_id)) {
+      _mongoc_cluster_started_init (cluster, &started_event, cmd, request_id);
+
+      callbacks->started (&started_event);
+      mongoc_apm_command_started_cleanup (&started_event);
+   }
 }
 
+
 static void
-_mongoc_cluster_node_dtor (void *data_, void *ctx_)
+_mongoc_cluster_monitor_succeeded (mongoc_cluster_t *cluster,
+                                   const mongoc_cmd_t *cmd,
+                                   int32_t request_id,
+                                   int64_t started,
+                                   const bson_t *reply)
 {
-   mongoc_cluster_node_t *node = (mongoc_cluster_node_t *) data_;
-
-   _mongoc_cluster_node_destroy (node);
-}
+   mongoc_apm_callbacks_t *callbacks = &cluster->client->apm_callbacks;
+   mongoc_apm_command_succeeded_t succeeded_event;
 
-static mongoc_cluster_node_t *
-_mongoc_cluster_node_new (mongoc_stream_t *stream,
-                          const char *connection_address)
-{
-   mongoc_cluster_node_t *node;
+   if (callbacks->succeeded &&
+       _mongoc_apm_command_sampled (callbacks, cmd->operation_id)) {
+      mongoc_apm_command_succeeded_init (&succeeded_event,
+                                         bson_get_monotonic_time () - started,
+                                         reply,
+                                         cmd->command_name,
+                                         request_id,
+                                         cmd->operation_id,
+                                         &cmd->server_stream->sd->host,
+                                         cmd->server_stream->sd->id,
+                                         cluster->client->apm_context);
 
-   if (!stream) {
-      return NULL;
+      callbacks->succeeded (&succeeded_event);
+      mongoc_apm_command_succeeded_cleanup (&succeeded_event);
    }
 
-   node = (mongoc_cluster_node_t *) bson_malloc0 (sizeof *node);
+   _mongoc_cluster_span_end (cluster, cmd, request_id, true);
+   _mongoc_cluster_log_slow_op (cluster, cmd, started, reply, NULL);
+}
 
-   node->stream = stream;
-   node->connection_address = bson_strdup (connection_address);
-   node->timestamp = bson_get_monotonic_time ();
 
-   node->max_wire_version = MONGOC_DEFAULT_WIRE_VERSION;
-   node->min_wire_version = MONGOC_DEFAULT_WIRE_VERSION;
+static void
+_mongoc_cluster_monitor_failed (mongoc_cluster_t *cluster,
+                                const mongoc_cmd_t *cmd,
+                                int32_t request_id,
+                                int64_t started,
+                                const bson_error_t *error)
+{
+   mongoc_apm_callbacks_t *callbacks = &cluster->client->apm_callbacks;
+   mongoc_apm_command_failed_t failed_event;
 
-   node->max_write_batch_size = MONGOC_DEFAULT_WRITE_BATCH_SIZE;
-   node->max_bson_obj_size = MONGOC_DEFAULT_BSON_OBJ_SIZE;
-   node->max_msg_size = MONGOC_DEFAULT_MAX_MSG_SIZE;
+   _mongoc_cluster_count_error (cmd->server_stream->sd);
 
-   return node;
+   if (callbacks->failed &&
+       _mongoc_apm_command_sampled (callbacks, cmd->operation_id)) {
+      mongoc_apm_command_failed_init (&failed_event,
+                                      bson_get_monotonic_time () - started,
+                                      cmd->command_name,
+                                      error,
+                                      request_id,
+                                      cmd->operation_id,
+                                      &cmd->server_stream->sd->host,
+                                      cmd->server_stream->sd->id,
+                                      cluster->client->apm_context);
+
+      callbacks->failed (&failed_event);
+      mongoc_apm_command_failed_cleanup (&failed_event);
+   }
+
+   _mongoc_cluster_span_end (cluster, cmd, request_id, false);
+   _mongoc_cluster_log_slow_op (cluster, cmd, started, NULL, error);
 }
 
+
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_add_node --
+ * _mongoc_cluster_run_opmsg_exhaust --
  *
- *       Add a new node to this cluster for the given server description.
+ *       Send @cmd, a getMore, with the exhaustAllowed flag and read the
+ *       reply. If the server sets @more_to_come it streams the following
+ *       batches without further getMores: read each with
+ *       _mongoc_cluster_recv_opmsg_exhaust, and until one arrives without
+ *       @more_to_come use the connection for nothing else.
  *
- *       NOTE: does NOT check if this server is already in the cluster.
+ *       The client's APM callbacks are executed.
  *
  * Returns:
- *       A stream connected to the server, or NULL on failure.
+ *       true if successful; otherwise false and @error is set.
  *
  * Side effects:
- *       Adds a cluster node, or sets error on failure.
+ *       @reply is always initialized.
  *
  *--------------------------------------------------------------------------
  */
-static mongoc_stream_t *
-_mongoc_cluster_add_node (mongoc_cluster_t *cluster,
-                          uint32_t server_id,
-                          bson_error_t *error /* OUT */)
-{
-   mongoc_host_list_t *host = NULL;
-   mongoc_cluster_node_t *cluster_node = NULL;
-   mongoc_stream_t *stream;
-   mongoc_server_description_t *sd;
-
-   ENTRY;
-
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (!cluster->client->topology->single_threaded);
 
-   host =
-      _mongoc_topology_host_by_id (cluster->client->topology, server_id, error);
-
-   if (!host) {
-      GOTO (error);
-   }
+bool
+_mongoc_cluster_run_opmsg_exhaust (mongoc_cluster_t *cluster,
+                                   mongoc_cmd_t *cmd,
+                                   bool *more_to_come,
+                                   bson_t *reply,
+                                   bson_error_t *error)
+{
+   int32_t request_id = (int32_t) ++cluster->request_id;
+   int64_t started = bson_get_monotonic_time ();
+   int32_t response_to;
+   uint32_t flags = 0;
+   bool ok;
 
-   TRACE ("Adding new server to cluster: %s", host->host_and_port);
+   *more_to_come = false;
+   cmd->exhaust_allowed = true;
 
-   stream = _mongoc_client_create_stream (cluster->client, host, error);
+   _mongoc_cluster_monitor_started (cluster, cmd, request_id);
 
-   if (!stream) {
-      MONGOC_WARNING (
-         "Failed connection to %s (%s)", host->host_and_port, error->message);
-      GOTO (error);
+   if (!_mongoc_cluster_send_opmsg (cluster, cmd, request_id, error)) {
+      bson_init (reply);
+      ok = false;
+   } else {
+      ok = _mongoc_cluster_recv_opmsg (cluster,
+                                       cmd->server_stream,
+                                       &response_to,
+                                       &flags,
+                                       reply,
+                                       error) &&
+           _mongoc_cluster_check_opmsg_reply (cluster, cmd, reply, error);
    }
 
-   /* take critical fields from a fresh ismaster */
-   cluster_node = _mongoc_cluster_node_new (stream, host->host_and_port);
-
-   sd = _mongoc_cluster_run_ismaster (cluster, cluster_node, server_id, error);
-   if (!sd) {
-      GOTO (error);
-   }
+   _mongoc_cluster_record_command_latency (cmd->command_name, started);
 
-   if (cluster->requires_auth) {
-      if (!_mongoc_cluster_auth_node (
-             cluster, cluster_node->stream, sd, error)) {
-         MONGOC_WARNING ("Failed authentication to %s (%s)",
-                         host->host_and_port,
-                         error->message);
-         mongoc_server_description_destroy (sd);
-         GOTO (error);
-      }
+   if (ok) {
+      *more_to_come = (flags & MONGOC_MSG_MORE_TO_COME) != 0;
+      _mongoc_cluster_monitor_succeeded (
+         cluster, cmd, request_id, started, reply);
+   } else {
+      _mongoc_cluster_monitor_failed (cluster, cmd, request_id, started, error);
    }
-   mongoc_server_description_destroy (sd);
-
-   mongoc_set_add (cluster->nodes, server_id, cluster_node);
-   _mongoc_host_list_destroy_all (host);
-
-   RETURN (stream);
 
-error:
-   _mongoc_host_list_destroy_all (host); /* null ok */
+   return ok;
+}
 
-   if (cluster_node) {
-      _mongoc_cluster_node_destroy (cluster_node); /* also destroys stream */
-   }
 
-   RETURN (NULL);
-}
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_recv_opmsg_exhaust --
+ *
+ *       Read the next reply the server streams after
+ *       _mongoc_cluster_run_opmsg_exhaust set @more_to_come. @cmd is the
+ *       getMore that started the stream, for APM: each batch is reported
+ *       as though @cmd had been sent for it.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set. On network
+ *       error the node is disconnected.
+ *
+ * Side effects:
+ *       @reply is always initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-static void
-node_not_found (mongoc_topology_t *topology,
-                uint32_t server_id,
-                bson_error_t *error /* OUT */)
+bool
+_mongoc_cluster_recv_opmsg_exhaust (mongoc_cluster_t *cluster,
+                                    mongoc_cmd_t *cmd,
+                                    bool *more_to_come,
+                                    bson_t *reply,
+                                    bson_error_t *error)
 {
-   mongoc_server_description_t *sd;
+   int32_t request_id = (int32_t) cluster->request_id;
+   int64_t started = bson_get_monotonic_time ();
+   int32_t response_to;
+   uint32_t flags = 0;
+   bool ok;
 
-   if (!error) {
-      return;
-   }
+   *more_to_come = false;
 
-   sd = mongoc_topology_server_by_id (topology, server_id, error);
+   _mongoc_cluster_monitor_started (cluster, cmd, request_id);
 
-   if (!sd) {
-      return;
-   }
+   ok = _mongoc_cluster_recv_opmsg (cluster,
+                                    cmd->server_stream,
+                                    &response_to,
+                                    &flags,
+                                    reply,
+                                    error) &&
+        _mongoc_cluster_check_opmsg_reply (cluster, cmd, reply, error);
 
-   if (sd->error.code) {
-      memcpy (error, &sd->error, sizeof *error);
+   if (ok) {
+      *more_to_come = (flags & MONGOC_MSG_MORE_TO_COME) != 0;
+      mongoc_counter_cursors_exhaust_batches_inc ();
+      _mongoc_cluster_monitor_succeeded (
+         cluster, cmd, request_id, started, reply);
    } else {
-      bson_set_error (error,
-                      MONGOC_ERROR_STREAM,
-                      MONGOC_ERROR_STREAM_NOT_ESTABLISHED,
-                      "Could not find node %s",
-                      sd->host.host_and_port);
+      _mongoc_cluster_monitor_failed (cluster, cmd, request_id, started, error);
    }
 
-   mongoc_server_description_destroy (sd);
+   return ok;
 }
 
-static void
-stream_not_found (mongoc_topology_t *topology,
-                  uint32_t server_id,
-                  const char *connection_address,
-                  bson_error_t *error /* OUT */)
-{
-   mongoc_server_description_t *sd;
 
-   sd = mongoc_topology_server_by_id (topology, server_id, error);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_run_opmsg_begin --
+ *
+ *       Send @cmd and return without reading the reply, so the caller can
+ *       do other work while the server runs it. The OP_MSG's requestId and
+ *       send time are stored in @request_id and @started: pass them to
+ *       _mongoc_cluster_run_opmsg_end to read the reply. In between, the
+ *       connection must not be used for anything else, see
+ *       _mongoc_cluster_set_pending.
+ *
+ *       The APM started event is executed, and on error the failed event.
+ *
+ * Returns:
+ *       true if the command was sent; otherwise false and @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   if (error) {
-      if (sd && sd->error.code) {
-         memcpy (error, &sd->error, sizeof *error);
-      } else {
-         bson_set_error (error,
-                         MONGOC_ERROR_STREAM,
-                         MONGOC_ERROR_STREAM_NOT_ESTABLISHED,
-                         "Could not find stream for node %s",
-                         connection_address);
-      }
+bool
+_mongoc_cluster_run_opmsg_begin (mongoc_cluster_t *cluster,
+                                 mongoc_cmd_t *cmd,
+                                 int32_t *request_id,
+                                 int64_t *started,
+                                 bson_error_t *error)
+{
+   *request_id = (int32_t) ++cluster->request_id;
+   *started = bson_get_monotonic_time ();
+
+   _mongoc_cluster_monitor_started (cluster, cmd, *request_id);
+   _mongoc_topology_load_begin (cluster->client->topology,
+                                cmd->server_stream->sd->id);
+
+   if (!_mongoc_cluster_send_opmsg (cluster, cmd, *request_id, error)) {
+      _mongoc_topology_load_end (
+         cluster->client->topology, cmd->server_stream->sd->id, *started);
+      _mongoc_cluster_monitor_failed (
+         cluster, cmd, *request_id, *started, error);
+      return false;
    }
 
-   if (sd) {
-      mongoc_server_description_destroy (sd);
-   }
+   return true;
 }
 
-mongoc_server_stream_t *
-_mongoc_cluster_stream_for_server (mongoc_cluster_t *cluster,
-                                   uint32_t server_id,
-                                   bool reconnect_ok,
-                                   bson_error_t *error /* OUT */)
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_run_opmsg_end --
+ *
+ *       Read the reply to a command sent by _mongoc_cluster_run_opmsg_begin.
+ *       The APM succeeded or failed event is executed.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @reply is always initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cluster_run_opmsg_end (mongoc_cluster_t *cluster,
+                               mongoc_cmd_t *cmd,
+                               int32_t request_id,
+                               int64_t started,
+                               bson_t *reply,
+                               bson_error_t *error)
 {
-   mongoc_topology_t *topology;
-   mongoc_server_stream_t *server_stream;
-   bson_error_t err_local;
-   /* if fetch_stream fails we need a place to receive error details and pass
-    * them to mongoc_topology_invalidate_server. */
-   bson_error_t *err_ptr = error ? error : &err_local;
+   int32_t response_to;
+   bool ok;
 
-   ENTRY;
+   ok = _mongoc_cluster_recv_opmsg (
+      cluster, cmd->server_stream, &response_to, NULL, reply, error);
 
-   topology = cluster->client->topology;
+   if (ok && response_to != request_id) {
+      bson_destroy (reply);
+      bson_init (reply);
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Unexpected responseTo %d, expected %d",
+                      response_to,
+                      request_id);
+      mongoc_cluster_disconnect_node (
+         cluster, cmd->server_stream->sd->id, true, error);
+      ok = false;
+   }
 
-   /* in the single-threaded use case we share topology's streams */
-   if (topology->single_threaded) {
-      server_stream = mongoc_cluster_fetch_stream_single (
-         cluster, server_id, reconnect_ok, err_ptr);
+   _mongoc_topology_load_end (
+      cluster->client->topology, cmd->server_stream->sd->id, started);
 
-   } else {
-      server_stream = mongoc_cluster_fetch_stream_pooled (
-         cluster, server_id, reconnect_ok, err_ptr);
-   }
+   ok = ok && _mongoc_cluster_check_opmsg_reply (cluster, cmd, reply, error);
 
-   if (!server_stream) {
-      /* Server Discovery And Monitoring Spec: "When an application operation
-       * fails because of any network error besides a socket timeout, the
-       * client MUST replace the server's description with a default
-       * ServerDescription of type Unknown, and fill the ServerDescription's
-       * error field with useful information."
-       *
-       * error was filled by fetch_stream_single/pooled, pass it to disconnect()
-       */
-      mongoc_cluster_disconnect_node (cluster, server_id, true, err_ptr);
+   if (ok) {
+      _mongoc_cluster_monitor_succeeded (
+         cluster, cmd, request_id, started, reply);
+   } else {
+      _mongoc_cluster_monitor_failed (cluster, cmd, request_id, started, error);
    }
 
-   RETURN (server_stream);
+   return ok;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_stream_for_server --
- *
- *       Fetch the stream for @server_id. If @reconnect_ok and there is no
- *       valid stream, attempts to reconnect; if not @reconnect_ok then only
- *       an existing stream can be returned, or NULL.
- *
- * Returns:
- *       A mongoc_server_stream_t, or NULL
+ * _mongoc_cluster_set_pending --
  *
- * Side effects:
- *       May add a node or reconnect one, if @reconnect_ok.
- *       Authenticates the stream if needed.
- *       May set @error.
+ *       Record that a reply is unread on one of @cluster's connections,
+ *       e.g. after _mongoc_cluster_run_opmsg_begin. Before the cluster
+ *       selects a server or fetches a stream again, it calls @pending_cb
+ *       with @pending_ctx to read that reply off the connection. Pass a
+ *       NULL @pending_cb once the reply has been read.
  *
  *--------------------------------------------------------------------------
  */
 
-mongoc_server_stream_t *
-mongoc_cluster_stream_for_server (mongoc_cluster_t *cluster,
-                                  uint32_t server_id,
-                                  bool reconnect_ok,
-                                  bson_error_t *error)
+void
+_mongoc_cluster_set_pending (mongoc_cluster_t *cluster,
+                             mongoc_cluster_pending_cb_t pending_cb,
+                             void *pending_ctx)
 {
-   mongoc_server_stream_t *server_stream = NULL;
-   bson_error_t err_local = {0};
+   BSON_ASSERT (!pending_cb || !cluster->pending_cb);
 
-   ENTRY;
+   cluster->pending_cb = pending_cb;
+   cluster->pending_ctx = pending_ctx;
+}
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (server_id);
 
-   if (!error) {
-      error = &err_local;
+/* read the reply left on a connection, if any, before using the cluster */
+void
+_mongoc_cluster_finish_pending (mongoc_cluster_t *cluster)
+{
+   mongoc_cluster_pending_cb_t pending_cb = cluster->pending_cb;
+
+   if (pending_cb) {
+      cluster->pending_cb = NULL;
+      pending_cb (cluster->pending_ctx);
    }
+}
 
-   server_stream = _mongoc_cluster_stream_for_server (
-      cluster, server_id, reconnect_ok, error);
 
-   if (!server_stream) {
-      /* failed */
-      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
+/* read-ahead while streaming a reply: a few small documents per read,
+ * without buffering much of a large batch */
+#define MONGOC_OPMSG_STREAM_CHUNK 4096
+
+
+/* the whole message is off the connection */
+static void
+_mongoc_opmsg_stream_received (mongoc_cluster_opmsg_stream_t *stream)
+{
+   mongoc_cluster_t *cluster = stream->cluster;
+   const mongoc_server_stream_t *server_stream = stream->cmd->server_stream;
+
+   if (stream->pending) {
+      _mongoc_cluster_set_pending (cluster, NULL, NULL);
+      stream->pending = false;
    }
 
-   RETURN (server_stream);
+   _mongoc_cluster_count_ingress (cluster, server_stream, stream->msg_len);
+   _mongoc_topology_load_end (
+      cluster->client->topology, server_stream->sd->id, stream->started);
+   stream->received = true;
 }
 
 
-static mongoc_server_stream_t *
-mongoc_cluster_fetch_stream_single (mongoc_cluster_t *cluster,
-                                    uint32_t server_id,
-                                    bool reconnect_ok,
-                                    bson_error_t *error /* OUT */)
+/* end the command with @error, closing the connection if @disconnect */
+static void
+_mongoc_opmsg_stream_fail (mongoc_cluster_opmsg_stream_t *stream,
+                           const bson_error_t *error,
+                           bool disconnect)
 {
-   mongoc_topology_t *topology;
-   mongoc_server_description_t *sd;
-   mongoc_stream_t *stream;
-   mongoc_topology_scanner_node_t *scanner_node;
-   int64_t expire_at;
+   mongoc_cluster_t *cluster = stream->cluster;
+   const mongoc_server_stream_t *server_stream = stream->cmd->server_stream;
 
-   topology = cluster->client->topology;
-   scanner_node =
-      mongoc_topology_scanner_get_node (topology->scanner, server_id);
-   BSON_ASSERT (scanner_node && !scanner_node->retired);
-   stream = scanner_node->stream;
-
-   if (stream) {
-      sd = mongoc_topology_server_by_id (topology, server_id, error);
+   if (disconnect) {
+      mongoc_cluster_disconnect_node (
+         cluster, server_stream->sd->id, true, error);
+   }
 
-      if (!sd) {
-         return NULL;
-      }
-   } else {
-      if (!reconnect_ok) {
-         stream_not_found (
-            topology, server_id, scanner_node->host.host_and_port, error);
-         return NULL;
-      }
+   if (stream->pending) {
+      _mongoc_cluster_set_pending (cluster, NULL, NULL);
+      stream->pending = false;
+   }
 
-      if (!mongoc_topology_scanner_node_setup (scanner_node, error)) {
-         return NULL;
-      }
-      stream = scanner_node->stream;
+   if (!stream->received) {
+      _mongoc_topology_load_end (
+         cluster->client->topology, server_stream->sd->id, stream->started);
+      stream->received = true;
+   }
 
-      expire_at =
-         bson_get_monotonic_time () + topology->connect_timeout_msec * 1000;
-      if (!mongoc_stream_wait (stream, expire_at)) {
-         bson_set_error (error,
-                         MONGOC_ERROR_STREAM,
-                         MONGOC_ERROR_STREAM_CONNECT,
-                         "Failed to connect to target host: '%s'",
-                         scanner_node->host.host_and_port);
-         return NULL;
-      }
+   _mongoc_cluster_monitor_failed (
+      cluster, stream->cmd, stream->request_id, stream->started, error);
 
-#ifdef MONGOC_ENABLE_SSL
-      if (cluster->client->use_ssl) {
-         bool r;
-         mongoc_stream_t *tls_stream;
+   memcpy (&stream->error, error, sizeof (bson_error_t));
+   stream->failed = true;
+   stream->state = MONGOC_OPMSG_STREAM_DONE;
+}
 
-         for (tls_stream = stream; tls_stream->type != MONGOC_STREAM_TLS;
-              tls_stream = mongoc_stream_get_base_stream (tls_stream)) {
-         }
 
-         r = mongoc_stream_tls_handshake_block (
-            tls_stream,
-            scanner_node->host.host,
-            (int32_t) topology->connect_timeout_msec * 1000,
-            error);
+static void
+_mongoc_opmsg_stream_malformed (bson_error_t *error)
+{
+   bson_set_error (error,
+                   MONGOC_ERROR_PROTOCOL,
+                   MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                   "Malformed message from server");
+}
 
-         if (!r) {
-            mongoc_topology_scanner_node_disconnect (scanner_node, true);
-            return NULL;
-         }
-      }
-#endif
 
-      sd = _mongoc_stream_run_ismaster (
-         cluster, stream, scanner_node->host.host_and_port, server_id);
+/* read @n bytes of the message off the connection into stream->buffer */
+static bool
+_mongoc_opmsg_stream_read (mongoc_cluster_opmsg_stream_t *stream,
+                           size_t n,
+                           bson_error_t *error)
+{
+   mongoc_cluster_t *cluster = stream->cluster;
+   const mongoc_server_stream_t *server_stream = stream->cmd->server_stream;
+   int64_t since;
 
-      if (!sd) {
-         return NULL;
-      }
+   if (n > (size_t) stream->remaining) {
+      _mongoc_opmsg_stream_malformed (error);
+      return false;
    }
 
-   if (sd->type == MONGOC_SERVER_UNKNOWN) {
-      memcpy (error, &sd->error, sizeof *error);
-      mongoc_server_description_destroy (sd);
-      return NULL;
+   since = _mongoc_cluster_span_now (cluster);
+   if (!_mongoc_buffer_append_from_stream (
+          &stream->buffer,
+          server_stream->stream,
+          n,
+          _mongoc_cluster_io_timeout_msec (cluster),
+          error)) {
+      _mongoc_cluster_count_timeout (server_stream->sd, server_stream->stream);
+      return false;
    }
 
-   /* stream open but not auth'ed: first use since connect or reconnect */
-   if (cluster->requires_auth && !scanner_node->has_auth) {
-      if (!_mongoc_cluster_auth_node (cluster, stream, sd, &sd->error)) {
-         memcpy (error, &sd->error, sizeof *error);
-         mongoc_server_description_destroy (sd);
-         return NULL;
-      }
+   _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_RECEIVE, since);
 
-      scanner_node->has_auth = true;
+   stream->remaining -= (int32_t) n;
+   if (!stream->remaining) {
+      _mongoc_opmsg_stream_received (stream);
    }
 
-   return mongoc_server_stream_new (&topology->description, sd, stream);
+   return true;
 }
 
 
-mongoc_server_stream_t *
-_mongoc_cluster_create_server_stream (mongoc_topology_t *topology,
-                                      uint32_t server_id,
-                                      mongoc_stream_t *stream,
-                                      bson_error_t *error /* OUT */)
+/* make @n bytes from stream->pos on available, reading ahead. the
+ * document returned last may be moved */
+static bool
+_mongoc_opmsg_stream_fill (mongoc_cluster_opmsg_stream_t *stream,
+                           size_t n,
+                           bson_error_t *error)
 {
-   mongoc_server_description_t *sd;
-   mongoc_server_stream_t *server_stream = NULL;
+   mongoc_buffer_t *in = stream->in;
+   size_t avail = in->len - stream->pos;
 
-   /* can't just use mongoc_topology_server_by_id(), since we must hold the
-    * lock while copying topology->description.logical_time below */
-   mongoc_mutex_lock (&topology->mutex);
+   if (avail >= n) {
+      return true;
+   }
 
-   sd = mongoc_server_description_new_copy (
-      mongoc_topology_description_server_by_id (
-         &topology->description, server_id, error));
+   if (in != &stream->buffer) {
+      _mongoc_opmsg_stream_malformed (error);
+      return false;
+   }
 
-   if (sd) {
-      server_stream =
-         mongoc_server_stream_new (&topology->description, sd, stream);
+   /* discard what has been parsed, the buffer holds one document or so */
+   if (stream->pos) {
+      memmove (in->data, in->data + stream->pos, avail);
+      in->len = avail;
+      stream->pos = 0;
    }
 
-   mongoc_mutex_unlock (&topology->mutex);
+   return _mongoc_opmsg_stream_read (
+      stream,
+      BSON_MAX (n - avail,
+                BSON_MIN ((size_t) stream->remaining,
+                          (size_t) MONGOC_OPMSG_STREAM_CHUNK)),
+      error);
+}
 
-   return server_stream;
+
+static const uint8_t *
+_mongoc_opmsg_stream_data (const mongoc_cluster_opmsg_stream_t *stream)
+{
+   return stream->in->data + stream->pos;
 }
 
 
-static mongoc_server_stream_t *
-mongoc_cluster_fetch_stream_pooled (mongoc_cluster_t *cluster,
-                                    uint32_t server_id,
-                                    bool reconnect_ok,
-                                    bson_error_t *error /* OUT */)
+static int32_t
+_mongoc_opmsg_stream_int32 (const mongoc_cluster_opmsg_stream_t *stream,
+                            size_t off)
 {
-   mongoc_topology_t *topology;
-   mongoc_stream_t *stream;
-   mongoc_cluster_node_t *cluster_node;
-   int64_t timestamp;
+   int32_t v;
 
-   cluster_node =
-      (mongoc_cluster_node_t *) mongoc_set_get (cluster->nodes, server_id);
+   memcpy (&v, _mongoc_opmsg_stream_data (stream) + off, sizeof v);
 
-   topology = cluster->client->topology;
+   return (int32_t) BSON_UINT32_FROM_LE (v);
+}
 
-   if (cluster_node) {
-      BSON_ASSERT (cluster_node->stream);
 
-      timestamp = mongoc_topology_server_timestamp (topology, server_id);
-      if (timestamp == -1 || cluster_node->timestamp < timestamp) {
-         /* topology change or net error during background scan made us remove
-          * or replace server description since node's birth. destroy node. */
-         mongoc_cluster_disconnect_node (
-            cluster, server_id, false /* invalidate */, NULL);
-      } else {
-         return _mongoc_cluster_create_server_stream (
-            topology, server_id, cluster_node->stream, error);
+/* the length, with its NUL, of the string @off bytes past stream->pos */
+static bool
+_mongoc_opmsg_stream_cstring_len (mongoc_cluster_opmsg_stream_t *stream,
+                                  size_t off,
+                                  size_t *len,
+                                  bson_error_t *error)
+{
+   const uint8_t *start;
+   const uint8_t *nul;
+   size_t scanned = 0;
+
+   for (;;) {
+      if (!_mongoc_opmsg_stream_fill (stream, off + scanned + 1, error)) {
+         return false;
+      }
+
+      start = _mongoc_opmsg_stream_data (stream) + off;
+      nul = (const uint8_t *) memchr (
+         start + scanned, 0, stream->in->len - stream->pos - off - scanned);
+      if (nul) {
+         *len = (size_t) (nul - start) + 1;
+         return true;
+      }
+
+      scanned = stream->in->len - stream->pos - off;
+   }
+}
+
+
+/* the length of a BSON value of @type @off bytes past stream->pos */
+static bool
+_mongoc_opmsg_stream_value_len (mongoc_cluster_opmsg_stream_t *stream,
+                                bson_type_t type,
+                                size_t off,
+                                size_t *len,
+                                bson_error_t *error)
+{
+   size_t pattern_len;
+   size_t options_len;
+   int32_t prefix;
+
+   switch (type) {
+   case BSON_TYPE_UNDEFINED:
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_MINKEY:
+   case BSON_TYPE_MAXKEY:
+      *len = 0;
+      return true;
+   case BSON_TYPE_BOOL:
+      *len = 1;
+      return true;
+   case BSON_TYPE_INT32:
+      *len = 4;
+      return true;
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_DATE_TIME:
+   case BSON_TYPE_TIMESTAMP:
+   case BSON_TYPE_INT64:
+      *len = 8;
+      return true;
+   case BSON_TYPE_OID:
+      *len = 12;
+      return true;
+   case BSON_TYPE_DECIMAL128:
+      *len = 16;
+      return true;
+   case BSON_TYPE_REGEX:
+      if (!_mongoc_opmsg_stream_cstring_len (
+             stream, off, &pattern_len, error) ||
+          !_mongoc_opmsg_stream_cstring_len (
+             stream, off + pattern_len, &options_len, error)) {
+         return false;
       }
+      *len = pattern_len + options_len;
+      return true;
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_CODE:
+   case BSON_TYPE_SYMBOL:
+   case BSON_TYPE_DBPOINTER:
+   case BSON_TYPE_BINARY:
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+   case BSON_TYPE_CODEWSCOPE:
+      break;
+   case BSON_TYPE_EOD:
+   default:
+      _mongoc_opmsg_stream_malformed (error);
+      return false;
+   }
+
+   /* the rest begin with an int32 length */
+   if (!_mongoc_opmsg_stream_fill (stream, off + 4, error)) {
+      return false;
    }
 
-   /* no node, or out of date */
-   if (!reconnect_ok) {
-      node_not_found (topology, server_id, error);
-      return NULL;
+   prefix = _mongoc_opmsg_stream_int32 (stream, off);
+   if (prefix < 0 || prefix > stream->msg_len) {
+      _mongoc_opmsg_stream_malformed (error);
+      return false;
    }
 
-   stream = _mongoc_cluster_add_node (cluster, server_id, error);
-   if (stream) {
-      return _mongoc_cluster_create_server_stream (
-         topology, server_id, stream, error);
+   if (type == BSON_TYPE_DOCUMENT || type == BSON_TYPE_ARRAY ||
+       type == BSON_TYPE_CODEWSCOPE) {
+      *len = (size_t) prefix;
+   } else if (type == BSON_TYPE_BINARY) {
+      *len = 5 + (size_t) prefix;
+   } else if (type == BSON_TYPE_DBPOINTER) {
+      *len = 4 + (size_t) prefix + 12;
    } else {
-      return NULL;
+      *len = 4 + (size_t) prefix;
    }
+
+   return true;
 }
 
-/*
- *--------------------------------------------------------------------------
- *
- * mongoc_cluster_init --
- *
- *       Initializes @cluster using the @uri and @client provided. The
- *       @uri is used to determine the "mode" of the cluster. Based on the
- *       uri we can determine if we are connected to a single host, a
- *       replicaSet, or a shardedCluster.
- *
- * Returns:
- *       None.
- *
- * Side effects:
- *       @cluster is initialized.
- *
- *--------------------------------------------------------------------------
- */
 
-void
-mongoc_cluster_init (mongoc_cluster_t *cluster,
-                     const mongoc_uri_t *uri,
-                     void *client)
+/* copy the @len byte element at stream->pos to @dst and parse past it */
+static bool
+_mongoc_opmsg_stream_copy_element (mongoc_cluster_opmsg_stream_t *stream,
+                                   bson_t *dst,
+                                   size_t len,
+                                   bson_error_t *error)
 {
-   ENTRY;
+   uint8_t *data;
+   uint32_t doc_len = (uint32_t) len + 5;
+   bson_t doc;
+   bson_iter_t iter;
+   bool ok;
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (uri);
+   /* wrap the element in a document of its own, to validate it */
+   data = (uint8_t *) bson_malloc (doc_len);
+   doc_len = BSON_UINT32_TO_LE (doc_len);
+   memcpy (data, &doc_len, 4);
+   memcpy (data + 4, _mongoc_opmsg_stream_data (stream), len);
+   data[len + 4] = '\0';
 
-   memset (cluster, 0, sizeof *cluster);
+   ok = bson_init_static (&doc, data, len + 5) &&
+        bson_iter_init (&iter, &doc) && bson_iter_next (&iter) &&
+        bson_append_iter (dst, NULL, 0, &iter);
 
-   cluster->uri = mongoc_uri_copy (uri);
-   cluster->client = (mongoc_client_t *) client;
-   cluster->requires_auth =
-      (mongoc_uri_get_username (uri) || mongoc_uri_get_auth_mechanism (uri));
+   bson_free (data);
 
-   cluster->sockettimeoutms = mongoc_uri_get_option_as_int32 (
-      uri, MONGOC_URI_SOCKETTIMEOUTMS, MONGOC_DEFAULT_SOCKETTIMEOUTMS);
+   if (!ok) {
+      _mongoc_opmsg_stream_malformed (error);
+      return false;
+   }
 
-   cluster->socketcheckintervalms =
-      mongoc_uri_get_option_as_int32 (uri,
-                                      MONGOC_URI_SOCKETCHECKINTERVALMS,
-                                      MONGOC_TOPOLOGY_SOCKET_CHECK_INTERVAL_MS);
+   stream->pos += len;
 
-   /* TODO for single-threaded case we don't need this */
-   cluster->nodes = mongoc_set_new (8, _mongoc_cluster_node_dtor, NULL);
+   return true;
+}
 
-   _mongoc_array_init (&cluster->iov, sizeof (mongoc_iovec_t));
 
-   cluster->operation_id = rand ();
+/* the command's reply is read: check it and run the APM callbacks */
+static void
+_mongoc_opmsg_stream_finish (mongoc_cluster_opmsg_stream_t *stream)
+{
+   mongoc_cluster_t *cluster = stream->cluster;
+   bson_error_t error;
 
-   EXIT;
+   stream->state = MONGOC_OPMSG_STREAM_DONE;
+
+   if (!_mongoc_cluster_check_opmsg_reply (
+          cluster, stream->cmd, &stream->reply, &error)) {
+      _mongoc_opmsg_stream_fail (stream, &error, false /* disconnect */);
+      return;
+   }
+
+   mongoc_counter_cursors_streamed_inc ();
+   _mongoc_cluster_monitor_succeeded (cluster,
+                                      stream->cmd,
+                                      stream->request_id,
+                                      stream->started,
+                                      &stream->reply);
 }
 
-/*
- *--------------------------------------------------------------------------
- *
- * mongoc_cluster_destroy --
- *
- *       Clean up after @cluster and destroy all active connections.
- *       All resources for @cluster are released.
- *
- * Returns:
- *       None.
- *
- * Side effects:
- *       Everything.
- *
- *--------------------------------------------------------------------------
- */
 
-void
-mongoc_cluster_destroy (mongoc_cluster_t *cluster) /* INOUT */
+/* the end of the document or array being parsed */
+static bool
+_mongoc_opmsg_stream_end_document (mongoc_cluster_opmsg_stream_t *stream,
+                                   bson_error_t *error)
 {
-   ENTRY;
-
-   BSON_ASSERT (cluster);
+   bson_t empty = BSON_INITIALIZER;
 
-   mongoc_uri_destroy (cluster->uri);
+   switch (stream->state) {
+   case MONGOC_OPMSG_STREAM_BATCH:
+      /* the reply shows an empty batch, its documents were returned */
+      bson_append_array (&stream->cursor, stream->batch_key, -1, &empty);
+      stream->state = MONGOC_OPMSG_STREAM_CURSOR;
+      return true;
+   case MONGOC_OPMSG_STREAM_CURSOR:
+      bson_append_document (&stream->reply, "cursor", 6, &stream->cursor);
+      stream->state = MONGOC_OPMSG_STREAM_BODY;
+      return true;
+   case MONGOC_OPMSG_STREAM_BODY:
+   case MONGOC_OPMSG_STREAM_DONE:
+   default:
+      break;
+   }
 
-   mongoc_set_destroy (cluster->nodes);
+   /* skip what follows the body, like a checksum */
+   while (stream->remaining) {
+      stream->pos = stream->in->len;
+      if (!_mongoc_opmsg_stream_fill (stream, 1, error)) {
+         return false;
+      }
+   }
 
-   _mongoc_array_destroy (&cluster->iov);
+   _mongoc_opmsg_stream_finish (stream);
 
-   EXIT;
+   return true;
 }
 
 
-/*
- *--------------------------------------------------------------------------
- *
- * mongoc_cluster_stream_for_optype --
- *
- *       Internal server selection.
- *
- * Returns:
- *       A mongoc_server_stream_t on which you must call
- *       mongoc_server_stream_cleanup, or NULL on failure (sets @error)
- *
- * Side effects:
- *       May set @error.
- *       May add new nodes to @cluster->nodes.
- *
- *--------------------------------------------------------------------------
- */
-
-static mongoc_server_stream_t *
-_mongoc_cluster_stream_for_optype (mongoc_cluster_t *cluster,
-                                   mongoc_ss_optype_t optype,
-                                   const mongoc_read_prefs_t *read_prefs,
-                                   bson_error_t *error)
+/* parse the next element of the reply. a batch document is returned in
+ * @doc, the other elements are copied to stream->reply */
+static bool
+_mongoc_opmsg_stream_step (mongoc_cluster_opmsg_stream_t *stream,
+                           const bson_t **doc,
+                           bson_error_t *error)
 {
-   mongoc_server_stream_t *server_stream;
-   uint32_t server_id;
-   mongoc_topology_t *topology = cluster->client->topology;
-
-   ENTRY;
+   bson_type_t type;
+   const char *key;
+   size_t key_len;
+   size_t value_len;
+   int32_t len;
 
-   BSON_ASSERT (cluster);
+   if (!_mongoc_opmsg_stream_fill (stream, 1, error)) {
+      return false;
+   }
 
-   server_id =
-      mongoc_topology_select_server_id (topology, optype, read_prefs, error);
+   type = (bson_type_t) _mongoc_opmsg_stream_data (stream)[0];
+   if (type == BSON_TYPE_EOD) {
+      stream->pos++;
+      return _mongoc_opmsg_stream_end_document (stream, error);
+   }
 
-   if (!server_id) {
-      RETURN (NULL);
+   if (!_mongoc_opmsg_stream_cstring_len (stream, 1, &key_len, error)) {
+      return false;
    }
 
-   if (!mongoc_cluster_check_interval (cluster, server_id)) {
-      /* Server Selection Spec: try once more */
-      server_id =
-         mongoc_topology_select_server_id (topology, optype, read_prefs, error);
+   if (stream->state == MONGOC_OPMSG_STREAM_BATCH) {
+      if (type != BSON_TYPE_DOCUMENT) {
+         _mongoc_opmsg_stream_malformed (error);
+         return false;
+      }
 
-      if (!server_id) {
-         RETURN (NULL);
+      if (!_mongoc_opmsg_stream_fill (stream, 1 + key_len + 4, error)) {
+         return false;
       }
-   }
 
-   /* connect or reconnect to server if necessary */
-   server_stream = _mongoc_cluster_stream_for_server (
-      cluster, server_id, true /* reconnect_ok */, error);
+      len = _mongoc_opmsg_stream_int32 (stream, 1 + key_len);
+      if (len < 5 || len > stream->msg_len) {
+         _mongoc_opmsg_stream_malformed (error);
+         return false;
+      }
 
-   RETURN (server_stream);
-}
+      if (!_mongoc_opmsg_stream_fill (
+             stream, 1 + key_len + (size_t) len, error)) {
+         return false;
+      }
 
+      stream->pos += 1 + key_len;
+      if (!bson_init_static (
+             &stream->current, _mongoc_opmsg_stream_data (stream), len)) {
+         _mongoc_opmsg_stream_malformed (error);
+         return false;
+      }
 
-/*
- *--------------------------------------------------------------------------
- *
- * mongoc_cluster_stream_for_reads --
- *
- *       Internal server selection.
- *
- * Returns:
- *       A mongoc_server_stream_t on which you must call
- *       mongoc_server_stream_cleanup, or NULL on failure (sets @error)
- *
- * Side effects:
- *       May set @error.
- *       May add new nodes to @cluster->nodes.
- *
- *--------------------------------------------------------------------------
- */
+      stream->pos += len;
+      stream->n_docs++;
+      stream->n_bytes += (uint32_t) len;
+      *doc = &stream->current;
 
-mongoc_server_stream_t *
-mongoc_cluster_stream_for_reads (mongoc_cluster_t *cluster,
-                                 const mongoc_read_prefs_t *read_prefs,
-                                 bson_error_t *error)
-{
-   return _mongoc_cluster_stream_for_optype (
-      cluster, MONGOC_SS_READ, read_prefs, error);
-}
+      return true;
+   }
 
-/*
- *--------------------------------------------------------------------------
- *
- * mongoc_cluster_stream_for_writes --
- *
- *       Get a stream for write operations.
- *
- * Returns:
- *       A mongoc_server_stream_t on which you must call
- *       mongoc_server_stream_cleanup, or NULL on failure (sets @error)
- *
- * Side effects:
- *       May set @error.
- *       May add new nodes to @cluster->nodes.
- *
- *--------------------------------------------------------------------------
- */
+   key = (const char *) _mongoc_opmsg_stream_data (stream) + 1;
 
-mongoc_server_stream_t *
-mongoc_cluster_stream_for_writes (mongoc_cluster_t *cluster,
-                                  bson_error_t *error)
-{
-   return _mongoc_cluster_stream_for_optype (
-      cluster, MONGOC_SS_WRITE, NULL, error);
-}
+   if ((stream->state == MONGOC_OPMSG_STREAM_BODY &&
+        type == BSON_TYPE_DOCUMENT && !strcmp (key, "cursor")) ||
+       (stream->state == MONGOC_OPMSG_STREAM_CURSOR &&
+        type == BSON_TYPE_ARRAY &&
+        (!strcmp (key, "firstBatch") || !strcmp (key, "nextBatch")))) {
+      if (stream->state == MONGOC_OPMSG_STREAM_CURSOR) {
+         bson_strncpy (stream->batch_key, key, sizeof stream->batch_key);
+      }
 
-static bool
-_mongoc_cluster_min_of_max_obj_size_sds (void *item, void *ctx)
-{
-   mongoc_server_description_t *sd = (mongoc_server_description_t *) item;
-   int32_t *current_min = (int32_t *) ctx;
+      /* descend, skipping the length: the end is marked */
+      if (!_mongoc_opmsg_stream_fill (stream, 1 + key_len + 4, error)) {
+         return false;
+      }
 
-   if (sd->max_bson_obj_size < *current_min) {
-      *current_min = sd->max_bson_obj_size;
+      stream->pos += 1 + key_len + 4;
+      stream->state = stream->state == MONGOC_OPMSG_STREAM_BODY
+                         ? MONGOC_OPMSG_STREAM_CURSOR
+                         : MONGOC_OPMSG_STREAM_BATCH;
+
+      return true;
    }
-   return true;
+
+   if (!_mongoc_opmsg_stream_value_len (
+          stream, type, 1 + key_len, &value_len, error) ||
+       !_mongoc_opmsg_stream_fill (stream, 1 + key_len + value_len, error)) {
+      return false;
+   }
+
+   return _mongoc_opmsg_stream_copy_element (
+      stream,
+      stream->state == MONGOC_OPMSG_STREAM_BODY ? &stream->reply
+                                                : &stream->cursor,
+      1 + key_len + value_len,
+      error);
 }
 
-static bool
-_mongoc_cluster_min_of_max_obj_size_nodes (void *item, void *ctx)
+
+/* a mongoc_cluster_pending_cb_t: the client needs the connection before
+ * the batch has been read, read the rest of the message into memory */
+static void
+_mongoc_opmsg_stream_drain (void *ctx)
 {
-   mongoc_cluster_node_t *node = (mongoc_cluster_node_t *) item;
-   int32_t *current_min = (int32_t *) ctx;
+   mongoc_cluster_opmsg_stream_t *stream =
+      (mongoc_cluster_opmsg_stream_t *) ctx;
+   const mongoc_server_stream_t *server_stream = stream->cmd->server_stream;
+   mongoc_cluster_t *cluster = stream->cluster;
+   size_t avail = stream->buffer.len - stream->pos;
+   bson_error_t error;
 
-   if (node->max_bson_obj_size < *current_min) {
-      *current_min = node->max_bson_obj_size;
+   /* the cluster has cleared its pending reply */
+   stream->pending = false;
+
+   /* stream->buffer is left alone, it holds the document returned last */
+   if (avail) {
+      _mongoc_buffer_append (
+         &stream->drained, stream->buffer.data + stream->pos, avail);
    }
-   return true;
+
+   if (!_mongoc_buffer_append_from_stream (
+          &stream->drained,
+          server_stream->stream,
+          (size_t) stream->remaining,
+          _mongoc_cluster_io_timeout_msec (cluster),
+          &error)) {
+      _mongoc_cluster_count_timeout (server_stream->sd, server_stream->stream);
+      _mongoc_opmsg_stream_fail (stream, &error, true /* disconnect */);
+      return;
+   }
+
+   stream->remaining = 0;
+   _mongoc_opmsg_stream_received (stream);
+
+   stream->in = &stream->drained;
+   stream->pos = 0;
 }
 
+
+/* for a compressed reply, read and decompress it all; the rest of @stream
+ * parses it from memory */
 static bool
-_mongoc_cluster_min_of_max_msg_size_sds (void *item, void *ctx)
+_mongoc_opmsg_stream_decompress (mongoc_cluster_opmsg_stream_t *stream,
+                                 bson_error_t *error)
 {
-   mongoc_server_description_t *sd = (mongoc_server_description_t *) item;
-   int32_t *current_min = (int32_t *) ctx;
+   mongoc_cluster_t *cluster = stream->cluster;
+   mongoc_rpc_t rpc;
+   uint8_t *output;
+   size_t len;
+   int64_t since;
 
-   if (sd->max_msg_size < *current_min) {
-      *current_min = sd->max_msg_size;
+   if (!stream->remaining) {
+      _mongoc_opmsg_stream_malformed (error);
+      return false;
+   }
+
+   if (!_mongoc_opmsg_stream_read (
+          stream, (size_t) stream->remaining, error)) {
+      return false;
+   }
+
+   if (!_mongoc_rpc_scatter (&rpc, stream->buffer.data, stream->buffer.len) ||
+       BSON_UINT32_FROM_LE (rpc.compressed.original_opcode) !=
+          MONGOC_OPCODE_MSG) {
+      _mongoc_opmsg_stream_malformed (error);
+      return false;
    }
-   return true;
-}
 
-static bool
-_mongoc_cluster_min_of_max_msg_size_nodes (void *item, void *ctx)
-{
-   mongoc_cluster_node_t *node = (mongoc_cluster_node_t *) item;
-   int32_t *current_min = (int32_t *) ctx;
+   len = BSON_UINT32_FROM_LE (rpc.compressed.uncompressed_size) +
+         sizeof (mongoc_rpc_header_t);
 
-   if (node->max_msg_size < *current_min) {
-      *current_min = node->max_msg_size;
+   since = _mongoc_cluster_span_now (cluster);
+   output = _mongoc_cluster_decompress_buffer (cluster, len);
+   if (!_mongoc_rpc_decompress (&rpc, output, len, &cluster->compress)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Could not decompress message from server");
+      return false;
    }
+
+   _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_DECOMPRESS, since);
+
+   _mongoc_buffer_append (&stream->drained, output, len);
+   _mongoc_cluster_trim_reply_buffers (cluster);
+   stream->in = &stream->drained;
+
    return true;
 }
 
+
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_get_max_bson_obj_size --
+ * _mongoc_cluster_stream_opmsg_begin --
  *
- *      Return the minimum max_bson_obj_size across all servers in cluster.
+ *       Send @cmd, a command that replies with a cursor, and read the
+ *       start of its reply. Then call _mongoc_cluster_stream_opmsg_next
+ *       for each document of the reply's "firstBatch" or "nextBatch" as it
+ *       arrives, instead of waiting for the whole message.
  *
- *      NOTE: this method uses the topology's mutex.
+ *       Until the message has been read the connection is the cluster's
+ *       pending reply, see _mongoc_cluster_set_pending: if the client
+ *       needs it first, the rest of the message is read into memory.
+ *       Compressed replies are always read whole.
+ *
+ *       The APM started event is executed, and on error the failed event.
  *
  * Returns:
- *      The minimum max_bson_obj_size.
+ *       true if successful; otherwise false and @error is set.
  *
  * Side effects:
- *      None
+ *       @stream is always initialized, free it with
+ *       _mongoc_cluster_stream_opmsg_destroy.
  *
  *--------------------------------------------------------------------------
  */
-int32_t
-mongoc_cluster_get_max_bson_obj_size (mongoc_cluster_t *cluster)
+
+bool
+_mongoc_cluster_stream_opmsg_begin (mongoc_cluster_t *cluster,
+                                    mongoc_cmd_t *cmd,
+                                    mongoc_cluster_opmsg_stream_t *stream,
+                                    bson_error_t *error)
 {
-   int32_t max_bson_obj_size = -1;
+   const mongoc_server_stream_t *server_stream = cmd->server_stream;
+   int32_t response_to;
+   int32_t opcode;
+   int64_t since;
+
+   memset (stream, 0, sizeof *stream);
+   stream->cluster = cluster;
+   stream->cmd = cmd;
+   stream->state = MONGOC_OPMSG_STREAM_BODY;
+   _mongoc_buffer_init (&stream->buffer, NULL, 0, NULL, NULL);
+   _mongoc_buffer_set_budget (&stream->buffer, cluster->budget);
+   _mongoc_buffer_init (&stream->drained, NULL, 0, NULL, NULL);
+   _mongoc_buffer_set_budget (&stream->drained, cluster->budget);
+   stream->in = &stream->buffer;
+   bson_init (&stream->reply);
+   bson_init (&stream->cursor);
+
+   if (!_mongoc_cluster_run_opmsg_begin (
+          cluster, cmd, &stream->request_id, &stream->started, error)) {
+      memcpy (&stream->error, error, sizeof (bson_error_t));
+      stream->received = true;
+      stream->failed = true;
+      stream->state = MONGOC_OPMSG_STREAM_DONE;
+      return false;
+   }
 
-   max_bson_obj_size = MONGOC_DEFAULT_BSON_OBJ_SIZE;
+   /* the header, the flagBits, and the first section's kind */
+   since = _mongoc_cluster_span_now (cluster);
+   if (!_mongoc_buffer_append_from_stream (
+          &stream->buffer,
+          server_stream->stream,
+          16 + 4 + 1,
+          _mongoc_cluster_io_timeout_msec (cluster),
+          error)) {
+      _mongoc_cluster_count_timeout (server_stream->sd, server_stream->stream);
+      GOTO (failure);
+   }
 
-   if (!cluster->client->topology->single_threaded) {
-      mongoc_set_for_each (cluster->nodes,
-                           _mongoc_cluster_min_of_max_obj_size_nodes,
-                           &max_bson_obj_size);
-   } else {
-      mongoc_set_for_each (cluster->client->topology->description.servers,
-                           _mongoc_cluster_min_of_max_obj_size_sds,
-                           &max_bson_obj_size);
+   _mongoc_cluster_span_add (cluster, MONGOC_APM_SPAN_SERVER_WAIT, since);
+
+   stream->msg_len = _mongoc_opmsg_stream_int32 (stream, 0);
+   response_to = _mongoc_opmsg_stream_int32 (stream, 8);
+   opcode = _mongoc_opmsg_stream_int32 (stream, 12);
+
+   if (stream->msg_len < 16 + 4 + 1 ||
+       stream->msg_len > server_stream->sd->max_msg_size) {
+      bson_set_error (
+         error,
+         MONGOC_ERROR_PROTOCOL,
+         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+         "Message size %d is not within expected range 16-%d bytes",
+         stream->msg_len,
+         server_stream->sd->max_msg_size);
+      GOTO (failure);
    }
 
-   return max_bson_obj_size;
-}
+   if (response_to != stream->request_id) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Unexpected responseTo %d, expected %d",
+                      response_to,
+                      stream->request_id);
+      GOTO (failure);
+   }
 
+   stream->remaining = stream->msg_len - (16 + 4 + 1);
+   if (!stream->remaining) {
+      _mongoc_opmsg_stream_received (stream);
+   }
 
-/*
- *--------------------------------------------------------------------------
- *
- * mongoc_cluster_get_max_msg_size --
- *
- *      Return the minimum max msg size across all servers in cluster.
- *
- *      NOTE: this method uses the topology's mutex.
- *
- * Returns:
- *      The minimum max_msg_size
- *
- * Side effects:
- *      None
- *
- *--------------------------------------------------------------------------
- */
-int32_t
-mongoc_cluster_get_max_msg_size (mongoc_cluster_t *cluster)
-{
-   int32_t max_msg_size = MONGOC_DEFAULT_MAX_MSG_SIZE;
+   if (opcode == MONGOC_OPCODE_COMPRESSED) {
+      if (!_mongoc_opmsg_stream_decompress (stream, error)) {
+         GOTO (failure);
+      }
+   } else if (opcode != MONGOC_OPCODE_MSG) {
+      _mongoc_opmsg_stream_malformed (error);
+      GOTO (failure);
+   }
 
-   if (!cluster->client->topology->single_threaded) {
-      mongoc_set_for_each (cluster->nodes,
-                           _mongoc_cluster_min_of_max_msg_size_nodes,
-                           &max_msg_size);
-   } else {
-      mongoc_set_for_each (cluster->client->topology->description.servers,
-                           _mongoc_cluster_min_of_max_msg_size_sds,
-                           &max_msg_size);
+   /* past the header and flagBits, a kind 0 section must come first. skip
+    * its document's length, the end is marked */
+   stream->pos = 16 + 4;
+   if (!_mongoc_opmsg_stream_fill (stream, 1 + 4, error) ||
+       _mongoc_opmsg_stream_data (stream)[0] != 0) {
+      _mongoc_opmsg_stream_malformed (error);
+      GOTO (failure);
    }
 
-   return max_msg_size;
+   stream->pos += 1 + 4;
+
+   if (stream->remaining) {
+      _mongoc_cluster_set_pending (cluster, _mongoc_opmsg_stream_drain, stream);
+      stream->pending = true;
+   }
+
+   return true;
+
+failure:
+   _mongoc_opmsg_stream_fail (stream, error, true /* disconnect */);
+
+   return false;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_check_interval --
- *
- *      Server Selection Spec:
+ * _mongoc_cluster_stream_opmsg_next --
  *
- *      Only for single-threaded drivers.
+ *       Read the reply begun by _mongoc_cluster_stream_opmsg_begin up to
+ *       the batch's next document, and return it in @doc. It is valid
+ *       until the next call. At the end of the batch, read the rest of the
+ *       reply into stream->reply, with the batch empty, check it, and set
+ *       @doc to NULL.
  *
- *      If a server is selected that has an existing connection that has been
- *      idle for socketCheckIntervalMS, the driver MUST check the connection
- *      with the "ping" command. If the ping succeeds, use the selected
- *      connection. If not, set the server's type to Unknown and update the
- *      Topology Description according to the Server Discovery and Monitoring
- *      Spec, and attempt once more to select a server.
+ *       At the end, the APM succeeded or failed event is executed.
  *
  * Returns:
- *      True if the check succeeded or no check was required, false if the
- *      check failed.
- *
- * Side effects:
- *      If a check fails, closes stream and may set server type Unknown.
+ *       true if successful; otherwise false and @error is set. On network
+ *       error the node is disconnected.
  *
  *--------------------------------------------------------------------------
  */
 
 bool
-mongoc_cluster_check_interval (mongoc_cluster_t *cluster, uint32_t server_id)
+_mongoc_cluster_stream_opmsg_next (mongoc_cluster_opmsg_stream_t *stream,
+                                   const bson_t **doc,
+                                   bson_error_t *error)
 {
-   mongoc_cmd_parts_t parts;
-   mongoc_topology_t *topology;
-   mongoc_topology_scanner_node_t *scanner_node;
-   mongoc_stream_t *stream;
-   int64_t now;
-   bson_t command;
-   bson_error_t error;
-   bool r = true;
-   mongoc_server_stream_t *server_stream;
+   bson_error_t error_local;
 
-   topology = cluster->client->topology;
+   *doc = NULL;
 
-   if (!topology->single_threaded) {
-      return true;
-   }
+   while (stream->state != MONGOC_OPMSG_STREAM_DONE) {
+      if (!_mongoc_opmsg_stream_step (stream, doc, &error_local)) {
+         _mongoc_opmsg_stream_fail (
+            stream, &error_local, !stream->received /* disconnect */);
+         break;
+      }
 
-   scanner_node =
-      mongoc_topology_scanner_get_node (topology->scanner, server_id);
+      if (*doc) {
+         return true;
+      }
+   }
 
-   if (!scanner_node) {
+   if (stream->failed) {
+      memcpy (error, &stream->error, sizeof (bson_error_t));
       return false;
    }
 
-   BSON_ASSERT (!scanner_node->retired);
-
-   stream = scanner_node->stream;
+   return true;
+}
 
-   if (!stream) {
-      return false;
-   }
 
-   now = bson_get_monotonic_time ();
+/* free @stream. a message not read to the end is left on the connection,
+ * so it is closed */
+void
+_mongoc_cluster_stream_opmsg_destroy (mongoc_cluster_opmsg_stream_t *stream)
+{
+   bson_error_t error;
 
-   if (scanner_node->last_used + (1000 * CHECK_CLOSED_DURATION_MSEC) < now) {
-      if (mongoc_stream_check_closed (stream)) {
-         bson_set_error (&error,
-                         MONGOC_ERROR_STREAM,
-                         MONGOC_ERROR_STREAM_SOCKET,
-                         "connection closed");
-         mongoc_cluster_disconnect_node (cluster, server_id, true, &error);
-         return false;
-      }
+   if (stream->state != MONGOC_OPMSG_STREAM_DONE) {
+      bson_set_error (&error,
+                      MONGOC_ERROR_CURSOR,
+                      MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                      "The reply was abandoned before it was read");
+      _mongoc_opmsg_stream_fail (
+         stream, &error, !stream->received /* disconnect */);
    }
 
-   if (scanner_node->last_used + (1000 * cluster->socketcheckintervalms) <
-       now) {
-      bson_init (&command);
-      BSON_APPEND_INT32 (&command, "ping", 1);
-      mongoc_cmd_parts_init (&parts, "admin", MONGOC_QUERY_SLAVE_OK, &command);
-      server_stream = _mongoc_cluster_create_server_stream (
-         cluster->client->topology, server_id, stream, &error);
-      r = mongoc_cluster_run_command_parts (
-         cluster, server_stream, &parts, NULL, &error);
+   _mongoc_buffer_destroy (&stream->buffer);
+   _mongoc_buffer_destroy (&stream->drained);
+   bson_destroy (&stream->reply);
+   bson_destroy (&stream->cursor);
+}
 
-      mongoc_server_stream_cleanup (server_stream);
-      mongoc_cmd_parts_cleanup (&parts);
-      bson_destroy (&command);
 
-      if (!r) {
-         mongoc_cluster_disconnect_node (cluster, server_id, true, &error);
-      }
-   }
+/* a pipeline doesn't write more requests before reading replies: else the
+ * server can block writing replies the client isn't reading yet, and stop
+ * reading the requests the client is blocked writing. the bytes in flight
+ * stay well under what the socket buffers on both ends hold */
+#define MONGOC_PIPELINE_MAX_IN_FLIGHT 16
+#define MONGOC_PIPELINE_MAX_BYTES_IN_FLIGHT (64 * 1024)
 
-   return r;
+
+/* about the bytes @cmd takes on the wire as an OP_MSG */
+static size_t
+_mongoc_cluster_opmsg_size (const mongoc_cmd_t *cmd)
+{
+   return 16 + 4 + 1 + cmd->command->len + (size_t) cmd->payload_size;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_legacy_rpc_sendv_to_server --
- *
- *       Sends the given RPCs to the given server.
+ * _mongoc_cluster_run_opmsg_pipelined --
  *
- * Returns:
- *       True if successful.
+ *       Write @n_cmds OP_MSG requests on one connection without waiting
+ *       for each reply, and read the replies, matching each to its
+ *       command by responseTo. Once MONGOC_PIPELINE_MAX_IN_FLIGHT
+ *       requests or MONGOC_PIPELINE_MAX_BYTES_IN_FLIGHT bytes await
+ *       replies, a reply is read before the next request is written.
+ *       Every cmd in @cmds must use the same server stream. The client's
+ *       APM callbacks are executed for each command.
  *
- * Side effects:
- *       @rpc may be mutated and should be considered invalid after calling
- *       this method.
+ *       @replies is an array of @n_cmds bson_t, all initialized on
+ *       return. @errors is an array of @n_cmds bson_error_t.
  *
- *       @error may be set.
+ * Returns:
+ *       true if every command succeeded, otherwise false.
  *
  *--------------------------------------------------------------------------
  */
 
 bool
-mongoc_cluster_legacy_rpc_sendv_to_server (
-   mongoc_cluster_t *cluster,
-   mongoc_rpc_t *rpc,
-   mongoc_server_stream_t *server_stream,
-   bson_error_t *error)
+_mongoc_cluster_run_opmsg_pipelined (mongoc_cluster_t *cluster,
+                                     mongoc_cmd_t **cmds,
+                                     size_t n_cmds,
+                                     bson_t *replies,
+                                     bson_error_t *errors)
 {
-   uint32_t server_id;
-   mongoc_topology_scanner_node_t *scanner_node;
-   int32_t max_msg_size;
-   bool ret = false;
-   int32_t compressor_id = 0;
-   char *output = NULL;
+   const mongoc_server_stream_t *server_stream;
+   int32_t *request_ids;
+   bool *done;
+   int64_t started;
+   int32_t response_to;
+   size_t n_sent = 0;
+   size_t n_done = 0;
+   size_t bytes_in_flight = 0;
+   size_t i;
+   bool send_failed = false;
+   bool ok = true;
+   bool r;
+   bson_t reply;
+   bson_error_t error = {0};
 
    ENTRY;
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (rpc);
-   BSON_ASSERT (server_stream);
-
-   server_id = server_stream->sd->id;
+   BSON_ASSERT (n_cmds);
+
+   server_stream = cmds[0]->server_stream;
+   request_ids = (int32_t *) _mongoc_arena_alloc0 (&cluster->arena,
+                                                   n_cmds * sizeof (int32_t));
+   done =
+      (bool *) _mongoc_arena_alloc0 (&cluster->arena, n_cmds * sizeof (bool));
+   started = bson_get_monotonic_time ();
+
+   while (n_done < n_cmds) {
+      /* fill the window, a request larger than it goes alone */
+      while (n_sent < n_cmds &&
+             (n_sent == n_done ||
+              (n_sent - n_done < MONGOC_PIPELINE_MAX_IN_FLIGHT &&
+               bytes_in_flight + _mongoc_cluster_opmsg_size (cmds[n_sent]) <=
+                  MONGOC_PIPELINE_MAX_BYTES_IN_FLIGHT))) {
+         BSON_ASSERT (cmds[n_sent]->server_stream == server_stream);
+
+         request_ids[n_sent] = (int32_t) ++cluster->request_id;
+
+         _mongoc_cluster_monitor_started (
+            cluster, cmds[n_sent], request_ids[n_sent]);
+
+         if (!_mongoc_cluster_send_opmsg (
+                cluster, cmds[n_sent], request_ids[n_sent], &error)) {
+            _mongoc_cluster_monitor_failed (
+               cluster, cmds[n_sent], request_ids[n_sent], started, &error);
+            send_failed = true;
+            break;
+         }
 
-   if (cluster->client->in_exhaust) {
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_IN_EXHAUST,
-                      "A cursor derived from this client is in exhaust.");
-      GOTO (done);
-   }
+         bytes_in_flight += _mongoc_cluster_opmsg_size (cmds[n_sent]);
+         n_sent++;
+      }
 
-   _mongoc_array_clear (&cluster->iov);
-   compressor_id = mongoc_server_description_compressor_id (server_stream->sd);
+      /* after a failed send the stream is disconnected, don't read from it */
+      if (send_failed) {
+         break;
+      }
 
-   _mongoc_rpc_gather (rpc, &cluster->iov);
-   _mongoc_rpc_swab_to_le (rpc);
+      if (!_mongoc_cluster_recv_opmsg (
+             cluster, server_stream, &response_to, NULL, &reply, &error)) {
+         bson_destroy (&reply);
+         break;
+      }
 
-   if (compressor_id != -1) {
-      output = _mongoc_rpc_compress (cluster, compressor_id, rpc, error);
-      if (output == NULL) {
-         GOTO (done);
+      for (i = 0; i < n_sent; i++) {
+         if (!done[i] && request_ids[i] == response_to) {
+            break;
+         }
       }
-   }
 
-   max_msg_size = mongoc_server_stream_max_msg_size (server_stream);
+      if (i == n_sent) {
+         bson_destroy (&reply);
+         bson_set_error (&error,
+                         MONGOC_ERROR_PROTOCOL,
+                         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                         "Unexpected responseTo %d in pipelined reply",
+                         response_to);
+         mongoc_cluster_disconnect_node (
+            cluster, server_stream->sd->id, true, &error);
+         break;
+      }
 
-   if (BSON_UINT32_FROM_LE (rpc->header.msg_len) > max_msg_size) {
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_TOO_BIG,
-                      "Attempted to send an RPC larger than the "
-                      "max allowed message size. Was %u, allowed %u.",
-                      BSON_UINT32_FROM_LE (rpc->header.msg_len),
-                      max_msg_size);
-      GOTO (done);
-   }
+      done[i] = true;
+      n_done++;
+      bytes_in_flight -= _mongoc_cluster_opmsg_size (cmds[i]);
+      bson_copy_to (&reply, &replies[i]);
+      bson_destroy (&reply);
+      r = _mongoc_cluster_check_opmsg_reply (
+         cluster, cmds[i], &replies[i], &errors[i]);
+      ok = ok && r;
 
-   if (!_mongoc_stream_writev_full (server_stream->stream,
-                                    cluster->iov.data,
-                                    cluster->iov.len,
-                                    cluster->sockettimeoutms,
-                                    error)) {
-      GOTO (done);
+      if (r) {
+         _mongoc_cluster_monitor_succeeded (
+            cluster, cmds[i], request_ids[i], started, &replies[i]);
+      } else {
+         _mongoc_cluster_monitor_failed (
+            cluster, cmds[i], request_ids[i], started, &errors[i]);
+      }
    }
 
-   if (cluster->client->topology->single_threaded) {
-      scanner_node = mongoc_topology_scanner_get_node (
-         cluster->client->topology->scanner, server_id);
+   /* the connection is gone: outstanding replies and the requests not
+    * sent yet fail with the same error. a failed send had its event */
+   for (i = 0; i < n_cmds; i++) {
+      if (done[i]) {
+         continue;
+      }
 
-      if (scanner_node) {
-         scanner_node->last_used = bson_get_monotonic_time ();
+      bson_init (&replies[i]);
+      memcpy (&errors[i], &error, sizeof error);
+      ok = false;
+
+      if (i < n_sent) {
+         _mongoc_cluster_monitor_failed (
+            cluster, cmds[i], request_ids[i], started, &errors[i]);
       }
    }
 
-   ret = true;
+   _mongoc_arena_free (&cluster->arena, done);
+   _mongoc_arena_free (&cluster->arena, request_ids);
 
-done:
+   RETURN (ok);
+}
 
-   if (compressor_id) {
-      bson_free (output);
+
+/* send one command of a hedged read: APM started event, load table, wire */
+static bool
+_mongoc_cluster_hedged_send (mongoc_cluster_t *cluster,
+                             mongoc_cmd_t *cmd,
+                             int32_t *request_id,
+                             int64_t started,
+                             bson_error_t *error)
+{
+   *request_id = (int32_t) ++cluster->request_id;
+   _mongoc_cluster_monitor_started (cluster, cmd, *request_id);
+   _mongoc_topology_load_begin (cluster->client->topology,
+                                cmd->server_stream->sd->id);
+
+   if (!_mongoc_cluster_send_opmsg (cluster, cmd, *request_id, error)) {
+      _mongoc_topology_load_end (
+         cluster->client->topology, cmd->server_stream->sd->id, started);
+      _mongoc_cluster_monitor_failed (
+         cluster, cmd, *request_id, started, error);
+      return false;
    }
 
-   RETURN (ret);
+   return true;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_try_recv --
+ * _mongoc_cluster_run_opmsg_hedged --
  *
- *       Tries to receive the next event from the MongoDB server.
- *       The contents are loaded into @buffer and then
- *       scattered into the @rpc structure. @rpc is valid as long as
- *       @buffer contains the contents read into it.
+ *       Send @cmd as an OP_MSG. If its reply hasn't begun to arrive after
+ *       @delay_msec, call @hedge_cb for the same command assembled for
+ *       another server, send that too, and use whichever reply arrives
+ *       first. The slower server's reply can't be read in order anymore,
+ *       so its connection is closed.
  *
- *       Callers that can optimize a reuse of @buffer should do so. It
- *       can save many memory allocations.
+ *       @hedge_cb may return NULL if no other server is eligible, then
+ *       this is the same as mongoc_cluster_run_opmsg. The client's APM
+ *       callbacks are executed for each command sent; the slower one
+ *       fails with MONGOC_ERROR_STREAM_SOCKET.
  *
  * Returns:
- *       True if successful.
- *
- * Side effects:
- *       @rpc is set on success, @error on failure.
- *       @buffer will be filled with the input data.
+ *       true if successful; otherwise false and @error is set. @reply is
+ *       always initialized. @winner is set to the command whose reply
+ *       is in @reply, or that failed last.
  *
  *--------------------------------------------------------------------------
  */
 
 bool
-mongoc_cluster_try_recv (mongoc_cluster_t *cluster,
-                         mongoc_rpc_t *rpc,
-                         mongoc_buffer_t *buffer,
-                         mongoc_server_stream_t *server_stream,
-                         bson_error_t *error)
+_mongoc_cluster_run_opmsg_hedged (mongoc_cluster_t *cluster,
+                                  mongoc_cmd_t *cmd,
+                                  int32_t delay_msec,
+                                  mongoc_cluster_hedge_cb_t hedge_cb,
+                                  void *hedge_ctx,
+                                  mongoc_cmd_t **winner,
+                                  bson_t *reply,
+                                  bson_error_t *error)
 {
-   uint32_t server_id;
-   bson_error_t err_local;
-   int32_t msg_len;
-   int32_t max_msg_size;
-   off_t pos;
+   mongoc_cmd_t *cmds[2];
+   int32_t request_ids[2];
+   bool pending[2] = {false, false};
+   bool have_reply = false;
+   mongoc_stream_poll_t poller[2];
+   bson_error_t hedge_error;
+   int64_t started[2];
+   int64_t timeout_msec;
+   int64_t remaining_msec;
+   int32_t response_to;
+   int n_cmds = 1;
+   int n_pending = 0;
+   int i;
+   ssize_t r;
+   bool ok = false;
 
    ENTRY;
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (rpc);
-   BSON_ASSERT (buffer);
-   BSON_ASSERT (server_stream);
-
-   server_id = server_stream->sd->id;
-
-   TRACE ("Waiting for reply from server_id \"%u\"", server_id);
-
-   if (!error) {
-      error = &err_local;
-   }
+   started[0] = bson_get_monotonic_time ();
+   cmds[0] = cmd;
+   *winner = cmd;
 
-   /*
-    * Buffer the message length to determine how much more to read.
-    */
-   pos = buffer->len;
-   if (!_mongoc_buffer_append_from_stream (
-          buffer, server_stream->stream, 4, cluster->sockettimeoutms, error)) {
-      MONGOC_DEBUG (
-         "Could not read 4 bytes, stream probably closed or timed out");
-      mongoc_counter_protocol_ingress_error_inc ();
-      mongoc_cluster_disconnect_node (
-         cluster,
-         server_id,
-         !mongoc_stream_timed_out (server_stream->stream),
-         error);
+   if (!_mongoc_cluster_hedged_send (
+          cluster, cmd, &request_ids[0], started[0], error)) {
+      bson_init (reply);
       RETURN (false);
    }
 
-   /*
-    * Read the msg length from the buffer.
-    */
-   memcpy (&msg_len, &buffer->data[buffer->off + pos], 4);
-   msg_len = BSON_UINT32_FROM_LE (msg_len);
-   max_msg_size = mongoc_server_stream_max_msg_size (server_stream);
-   if ((msg_len < 16) || (msg_len > max_msg_size)) {
-      bson_set_error (error,
-                      MONGOC_ERROR_PROTOCOL,
-                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                      "Corrupt or malicious reply received.");
-      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
-      mongoc_counter_protocol_ingress_error_inc ();
-      RETURN (false);
+   pending[0] = true;
+   n_pending = 1;
+
+   poller[0].stream = cmd->server_stream->stream;
+   poller[0].events = POLLIN;
+   poller[0].revents = 0;
+
+   if (mongoc_stream_poll (poller, 1, delay_msec) == 0) {
+      cmds[1] = hedge_cb (hedge_ctx);
+      started[1] = bson_get_monotonic_time ();
+      if (cmds[1] &&
+          _mongoc_cluster_hedged_send (
+             cluster, cmds[1], &request_ids[1], started[1], &hedge_error)) {
+         mongoc_counter_op_egress_hedged_inc ();
+         pending[1] = true;
+         n_pending++;
+         n_cmds = 2;
+      }
    }
 
-   /*
-    * Read the rest of the message from the stream.
-    */
-   if (!_mongoc_buffer_append_from_stream (buffer,
-                                           server_stream->stream,
-                                           msg_len - 4,
-                                           cluster->sockettimeoutms,
-                                           error)) {
-      mongoc_cluster_disconnect_node (
-         cluster,
-         server_id,
-         !mongoc_stream_timed_out (server_stream->stream),
-         error);
-      mongoc_counter_protocol_ingress_error_inc ();
-      RETURN (false);
-   }
+   while (n_pending > 0 && !have_reply) {
+      if (n_pending == 2) {
+         timeout_msec = -1;
+         if (cluster->sockettimeoutms > 0) {
+            timeout_msec = (int64_t) cluster->sockettimeoutms -
+                           (bson_get_monotonic_time () - started[0]) / 1000;
+            timeout_msec = BSON_MAX (timeout_msec, 0);
+         }
 
-   /*
-    * Scatter the buffer into the rpc structure.
-    */
-   if (!_mongoc_rpc_scatter (rpc, &buffer->data[buffer->off + pos], msg_len)) {
-      bson_set_error (error,
-                      MONGOC_ERROR_PROTOCOL,
-                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                      "Failed to decode reply from server.");
-      mongoc_cluster_disconnect_node (cluster, server_id, true, error);
-      mongoc_counter_protocol_ingress_error_inc ();
-      RETURN (false);
-   }
+         if (cluster->deadline) {
+            remaining_msec = _mongoc_cluster_deadline_remaining_msec (cluster);
+            timeout_msec = timeout_msec < 0
+                              ? remaining_msec
+                              : BSON_MIN (timeout_msec, remaining_msec);
+         }
 
-   if (BSON_UINT32_FROM_LE (rpc->header.opcode) == MONGOC_OPCODE_COMPRESSED) {
-      uint8_t *buf = NULL;
-      size_t len = BSON_UINT32_FROM_LE (rpc->compressed.uncompressed_size) +
-                   sizeof (mongoc_rpc_header_t);
+         for (i = 0; i < 2; i++) {
+            poller[i].stream = cmds[i]->server_stream->stream;
+            poller[i].events = POLLIN;
+            poller[i].revents = 0;
+         }
+
+         r = mongoc_stream_poll (poller, 2, (int32_t) timeout_msec);
+         if (r <= 0) {
+            bson_set_error (error,
+                            MONGOC_ERROR_STREAM,
+                            MONGOC_ERROR_STREAM_SOCKET,
+                            "Failed to read hedged replies: %s",
+                            r == 0 ? "timeout" : "poll error");
+            break;
+         }
+
+         i = poller[0].revents ? 0 : 1;
+      } else {
+         i = pending[0] ? 0 : 1;
+      }
 
-      buf = bson_malloc0 (len);
-      if (!_mongoc_rpc_decompress (rpc, buf, len)) {
-         bson_free (buf);
+      pending[i] = false;
+      n_pending--;
+      *winner = cmds[i];
+
+      /* on network error, the node is disconnected; try the other one */
+      if (!_mongoc_cluster_recv_opmsg (cluster,
+                                       cmds[i]->server_stream,
+                                       &response_to,
+                                       NULL,
+                                       reply,
+                                       error)) {
+         bson_destroy (reply);
+      } else if (response_to != request_ids[i]) {
+         bson_destroy (reply);
          bson_set_error (error,
                          MONGOC_ERROR_PROTOCOL,
                          MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                         "Could not decompress server reply");
-         RETURN (false);
+                         "Unexpected responseTo %d in hedged reply",
+                         response_to);
+         mongoc_cluster_disconnect_node (
+            cluster, cmds[i]->server_stream->sd->id, true, error);
+      } else {
+         have_reply = true;
+         ok = _mongoc_cluster_check_opmsg_reply (
+            cluster, cmds[i], reply, error);
       }
 
-      _mongoc_buffer_destroy (buffer);
-      _mongoc_buffer_init (buffer, buf, len, NULL, NULL);
-   }
-   _mongoc_rpc_swab_from_le (rpc);
-
-   RETURN (true);
-}
-
-bool
-mongoc_cluster_run_opmsg (mongoc_cluster_t *cluster,
-                          mongoc_cmd_t *cmd,
-                          bson_t *reply,
-                          bson_error_t *error)
-{
-   mongoc_rpc_section_t section[2];
-   mongoc_buffer_t buffer;
-   bson_t reply_local;
-   char *output = NULL;
-   mongoc_rpc_t rpc;
-   int32_t msg_len;
-   bool ok;
-   const mongoc_server_stream_t *server_stream;
-
-   server_stream = cmd->server_stream;
-   if (!cmd->command_name) {
-      bson_set_error (error,
-                      MONGOC_ERROR_COMMAND,
-                      MONGOC_ERROR_COMMAND_INVALID_ARG,
-                      "Empty command document");
-      bson_init (reply);
-      return false;
-   }
-   if (cluster->client->in_exhaust) {
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_IN_EXHAUST,
-                      "A cursor derived from this client is in exhaust.");
-      bson_init (reply);
-      return false;
-   }
-
-   _mongoc_array_clear (&cluster->iov);
-   _mongoc_buffer_init (&buffer, NULL, 0, NULL, NULL);
-
-   rpc.header.msg_len = 0;
-   rpc.header.request_id = ++cluster->request_id;
-   rpc.header.response_to = 0;
-   rpc.header.opcode = MONGOC_OPCODE_MSG;
-   rpc.msg.flags = 0;
-   rpc.msg.n_sections = 1;
-
-   section[0].payload_type = 0;
-   section[0].payload.bson_document = bson_get_data (cmd->command);
-   rpc.msg.sections[0] = section[0];
-
-   if (cmd->payload) {
-      section[1].payload_type = 1;
-      section[1].payload.sequence.size = cmd->payload_size +
-                                         strlen (cmd->payload_identifier) + 1 +
-                                         sizeof (int32_t);
-      section[1].payload.sequence.identifier = cmd->payload_identifier;
-      section[1].payload.sequence.bson_documents = cmd->payload;
-      rpc.msg.sections[1] = section[1];
-      rpc.msg.n_sections++;
-   }
-
-   _mongoc_rpc_gather (&rpc, &cluster->iov);
-   _mongoc_rpc_swab_to_le (&rpc);
-
-   if (mongoc_cmd_is_compressable (cmd)) {
-      int32_t compressor_id =
-         mongoc_server_description_compressor_id (server_stream->sd);
+      _mongoc_topology_load_end (
+         cluster->client->topology,
+         cmds[i]->server_stream->sd->id,
+         started[i]);
 
-      TRACE (
-         "Function '%s' is compressable: %d", cmd->command_name, compressor_id);
-      if (compressor_id != -1) {
-         output = _mongoc_rpc_compress (cluster, compressor_id, &rpc, error);
-         if (output == NULL) {
-            bson_init (reply);
-            return false;
-         }
+      if (ok) {
+         _mongoc_cluster_monitor_succeeded (
+            cluster, cmds[i], request_ids[i], started[i], reply);
+      } else {
+         _mongoc_cluster_monitor_failed (
+            cluster, cmds[i], request_ids[i], started[i], error);
       }
    }
-   ok = _mongoc_stream_writev_full (server_stream->stream,
-                                    (mongoc_iovec_t *) cluster->iov.data,
-                                    cluster->iov.len,
-                                    cluster->sockettimeoutms,
-                                    error);
-   if (!ok) {
-      mongoc_cluster_disconnect_node (
-         cluster, server_stream->sd->id, true, error);
-      bson_free (output);
-      bson_init (reply);
-      return false;
-   }
 
-   ok = _mongoc_buffer_append_from_stream (
-      &buffer, server_stream->stream, 4, cluster->sockettimeoutms, error);
-   if (!ok) {
-      mongoc_cluster_disconnect_node (
-         cluster, server_stream->sd->id, true, error);
-      bson_free (output);
-      bson_init (reply);
-      return false;
-   }
+   /* abandon the slower server's reply */
+   for (i = 0; i < n_cmds; i++) {
+      bson_error_t abandoned;
 
-   BSON_ASSERT (buffer.len == 4);
-   memcpy (&msg_len, buffer.data, 4);
-   msg_len = BSON_UINT32_FROM_LE (msg_len);
-   if ((msg_len < 16) || (msg_len > server_stream->sd->max_msg_size)) {
-      bson_set_error (
-         error,
-         MONGOC_ERROR_PROTOCOL,
-         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-         "Message size %d is not within expected range 16-%d bytes",
-         msg_len,
-         server_stream->sd->max_msg_size);
-      mongoc_cluster_disconnect_node (
-         cluster, server_stream->sd->id, true, error);
-      bson_free (output);
-      bson_init (reply);
-      return false;
-   }
+      if (!pending[i]) {
+         continue;
+      }
 
-   ok = _mongoc_buffer_append_from_stream (&buffer,
-                                           server_stream->stream,
-                                           (size_t) msg_len - 4,
-                                           cluster->sockettimeoutms,
-                                           error);
-   if (!ok) {
+      bson_set_error (&abandoned,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_SOCKET,
+                      "Abandoned hedged read on %s",
+                      cmds[i]->server_stream->sd->host.host_and_port);
       mongoc_cluster_disconnect_node (
-         cluster, server_stream->sd->id, true, error);
-      bson_free (output);
-      bson_init (reply);
-      return false;
+         cluster, cmds[i]->server_stream->sd->id, false, NULL);
+      _mongoc_topology_load_end (
+         cluster->client->topology,
+         cmds[i]->server_stream->sd->id,
+         started[i]);
+      _mongoc_cluster_monitor_failed (
+         cluster, cmds[i], request_ids[i], started[i], &abandoned);
    }
 
-   ok = _mongoc_rpc_scatter (&rpc, buffer.data, buffer.len);
-   if (!ok) {
-      bson_set_error (error,
-                      MONGOC_ERROR_PROTOCOL,
-                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                      "Malformed message from server");
-      bson_free (output);
+   if (!have_reply) {
       bson_init (reply);
-      return false;
-   }
-   if (BSON_UINT32_FROM_LE (rpc.header.opcode) == MONGOC_OPCODE_COMPRESSED) {
-      size_t len = BSON_UINT32_FROM_LE (rpc.compressed.uncompressed_size) +
-                   sizeof (mongoc_rpc_header_t);
-
-      output = bson_realloc (output, len);
-      if (!_mongoc_rpc_decompress (&rpc, (uint8_t *) output, len)) {
-         bson_set_error (error,
-                         MONGOC_ERROR_PROTOCOL,
-                         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                         "Could not decompress message from server");
-         mongoc_cluster_disconnect_node (
-            cluster, server_stream->sd->id, true, error);
-         bson_free (output);
-         bson_init (reply);
-         return false;
-      }
-   }
-   _mongoc_rpc_swab_from_le (&rpc);
-
-   memcpy (&msg_len, rpc.msg.sections[0].payload.bson_document, 4);
-   msg_len = BSON_UINT32_FROM_LE (msg_len);
-   bson_init_static (
-      &reply_local, rpc.msg.sections[0].payload.bson_document, msg_len);
-
-   _mongoc_topology_update_cluster_time (cluster->client->topology,
-                                         &reply_local);
-   ok = _mongoc_cmd_check_ok (
-      &reply_local, cluster->client->error_api_version, error);
-
-   if (reply) {
-      bson_copy_to (&reply_local, reply);
    }
 
-   _mongoc_buffer_destroy (&buffer);
-   bson_free (output);
-
-   return ok;
+   RETURN (ok);
 }
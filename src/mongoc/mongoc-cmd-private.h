@@ -41,12 +41,29 @@ typedef struct _mongoc_cmd_t {
    const char *db_name;
    mongoc_query_flags_t query_flags;
    const bson_t *command;
+   /* fields the driver appends to an OP_MSG command, sent after those of
+    * @command without copying it, or NULL */
+   const bson_t *command_suffix;
    const char *command_name;
    const uint8_t *payload;
+   /* instead of @payload, the documents as separate buffers */
+   const mongoc_iovec_t *payload_iov;
+   size_t payload_iovcnt;
    int32_t payload_size;
    const char *payload_identifier;
    const mongoc_server_stream_t *server_stream;
    int64_t operation_id;
+   /* an unacknowledged OP_MSG write: set moreToCome, expect no reply */
+   bool more_to_come;
+   /* a getMore the server may answer with a stream of replies */
+   bool exhaust_allowed;
+   /* if not NULL, sent instead of encoding @command: the handshake as an
+    * OP_QUERY from _mongoc_topology_scanner_get_ismaster_msg */
+   const uint8_t *encoded_opquery;
+   size_t encoded_opquery_len;
+   /* the session the command runs in, whose operation time its reply
+    * advances, or NULL */
+   mongoc_client_session_t *session;
 } mongoc_cmd_t;
 
 
@@ -80,6 +97,15 @@ mongoc_cmd_parts_assemble (mongoc_cmd_parts_t *parts,
                            const mongoc_server_stream_t *server_stream,
                            bson_error_t *error);
 
+void
+mongoc_cmd_parts_continue_transaction (mongoc_cmd_parts_t *parts);
+
+const bson_t *
+mongoc_cmd_get_command (const mongoc_cmd_t *cmd, bson_t *storage);
+
+uint32_t
+mongoc_cmd_get_len (const mongoc_cmd_t *cmd);
+
 bool
 mongoc_cmd_is_compressable (mongoc_cmd_t *cmd);
 
@@ -41,9 +41,17 @@ mongoc_cmd_parts_init (mongoc_cmd_parts_t *parts,
 
    parts->assembled.db_name = db_name;
    parts->assembled.command = NULL;
+   parts->assembled.command_suffix = NULL;
    parts->assembled.query_flags = MONGOC_QUERY_NONE;
    parts->assembled.payload_identifier = NULL;
    parts->assembled.payload = NULL;
+   parts->assembled.payload_iov = NULL;
+   parts->assembled.payload_iovcnt = 0;
+   parts->assembled.more_to_come = false;
+   parts->assembled.exhaust_allowed = false;
+   parts->assembled.encoded_opquery = NULL;
+   parts->assembled.encoded_opquery_len = 0;
+   parts->assembled.session = NULL;
 }
 
 
@@ -74,6 +82,7 @@ mongoc_cmd_parts_append_opts (mongoc_cmd_parts_t *parts,
                               bson_error_t *error)
 {
    bool is_fam;
+   bool is_aggregate;
 
    ENTRY;
 
@@ -82,6 +91,8 @@ mongoc_cmd_parts_append_opts (mongoc_cmd_parts_t *parts,
 
    is_fam =
       !strcasecmp (_mongoc_get_command_name (parts->body), "findandmodify");
+   is_aggregate =
+      !strcasecmp (_mongoc_get_command_name (parts->body), "aggregate");
 
    while (bson_iter_next (iter)) {
       if (BSON_ITER_IS_KEY (iter, "collation")) {
@@ -116,7 +127,13 @@ mongoc_cmd_parts_append_opts (mongoc_cmd_parts_t *parts,
             RETURN (false);
          }
       } else if (BSON_ITER_IS_KEY (iter, "serverId") ||
-                 BSON_ITER_IS_KEY (iter, "maxAwaitTimeMS")) {
+                 BSON_ITER_IS_KEY (iter, "sessionId") ||
+                 BSON_ITER_IS_KEY (iter, "maxAwaitTimeMS") ||
+                 BSON_ITER_IS_KEY (iter, "timeoutMS")) {
+         continue;
+      } else if (is_aggregate && (BSON_ITER_IS_KEY (iter, "tailable") ||
+                                  BSON_ITER_IS_KEY (iter, "awaitData"))) {
+         /* a change stream's, they only configure its getMores */
          continue;
       }
 
@@ -138,6 +155,17 @@ _mongoc_cmd_parts_ensure_copied (mongoc_cmd_parts_t *parts)
 }
 
 
+/* the server restarts a session's timeout with each command using it */
+static void
+_mongoc_cmd_parts_add_lsid (mongoc_cmd_parts_t *parts, bson_t *doc)
+{
+   mongoc_server_session_t *server_session = parts->session->server_session;
+
+   server_session->last_used_usec = bson_get_monotonic_time ();
+   bson_append_document (doc, "lsid", 4, &server_session->lsid);
+}
+
+
 /* The server type must be mongos. */
 static void
 _mongoc_cmd_parts_add_cluster_time (mongoc_cmd_parts_t *parts,
@@ -160,26 +188,8 @@ _mongoc_cmd_parts_add_read_prefs (bson_t *query,
                                   const mongoc_read_prefs_t *prefs,
                                   const mongoc_server_stream_t *server_stream)
 {
-   bson_t child;
-   const char *mode_str;
-   const bson_t *tags;
-   int64_t stale;
-
-   mode_str = _mongoc_read_mode_as_str (mongoc_read_prefs_get_mode (prefs));
-   tags = mongoc_read_prefs_get_tags (prefs);
-   stale = mongoc_read_prefs_get_max_staleness_seconds (prefs);
-
-   bson_append_document_begin (query, "$readPreference", 15, &child);
-   bson_append_utf8 (&child, "mode", 4, mode_str, -1);
-   if (!bson_empty0 (tags)) {
-      bson_append_array (&child, "tags", 4, tags);
-   }
-
-   if (stale != MONGOC_NO_MAX_STALENESS) {
-      bson_append_int64 (&child, "maxStalenessSeconds", 19, stale);
-   }
-
-   bson_append_document_end (query, &child);
+   bson_append_document (
+      query, "$readPreference", 15, _mongoc_read_prefs_get_bson (prefs));
 }
 
 
@@ -295,8 +305,7 @@ _mongoc_cmd_parts_assemble_mongos (mongoc_cmd_parts_t *parts,
    }
 
    if (parts->session) {
-      bson_append_document (
-         &parts->assembled_body, "lsid", 4, &parts->session->lsid);
+      _mongoc_cmd_parts_add_lsid (parts, &parts->assembled_body);
    }
 
    if (!bson_empty (&parts->extra)) {
@@ -354,8 +363,7 @@ _mongoc_cmd_parts_assemble_mongod (mongoc_cmd_parts_t *parts,
 
    if (parts->session) {
       _mongoc_cmd_parts_ensure_copied (parts);
-      bson_append_document (
-         &parts->assembled_body, "lsid", 4, &parts->session->lsid);
+      _mongoc_cmd_parts_add_lsid (parts, &parts->assembled_body);
    }
 
    EXIT;
@@ -382,6 +390,216 @@ _mongoc_cmd_parts_assemble_mongod (mongoc_cmd_parts_t *parts,
  *--------------------------------------------------------------------------
  */
 
+/* commands that don't take maxTimeMS, or for which it means something else:
+ * a getMore's maxTimeMS is how long a tailable cursor awaits data */
+static const char *gNoMaxTimeMSCommands[] = {
+   "delete", "getMore", "insert", "isMaster", "ismaster", "killCursors",
+   "update", NULL};
+
+
+/* send the server the time left before timeoutMS expires, less a round trip,
+ * so it gives up on the operation when the client does */
+static void
+_mongoc_cmd_parts_add_max_time_ms (mongoc_cmd_parts_t *parts,
+                                   const mongoc_server_stream_t *server_stream)
+{
+   const char **name;
+   int64_t remaining_msec;
+   int64_t rtt_msec;
+
+   if (!server_stream->deadline) {
+      return;
+   }
+
+   for (name = gNoMaxTimeMSCommands; *name; name++) {
+      if (!strcmp (parts->assembled.command_name, *name)) {
+         return;
+      }
+   }
+
+   if (bson_has_field (parts->body, "maxTimeMS") ||
+       bson_has_field (&parts->extra, "maxTimeMS")) {
+      return;
+   }
+
+   remaining_msec =
+      (server_stream->deadline - bson_get_monotonic_time ()) / 1000;
+   rtt_msec = BSON_MAX (server_stream->sd->round_trip_time_msec, 0);
+   remaining_msec = BSON_MAX (remaining_msec - rtt_msec, 1);
+
+   BSON_APPEND_INT64 (&parts->extra, "maxTimeMS", remaining_msec);
+}
+
+
+/* Causal Consistency Spec: the read commands that take a readConcern, and
+ * so an afterClusterTime */
+static const char *gCausalReadCommands[] = {"aggregate",
+                                            "count",
+                                            "distinct",
+                                            "find",
+                                            "geoNear",
+                                            "geoSearch",
+                                            "group",
+                                            "mapReduce",
+                                            "parallelCollectionScan",
+                                            NULL};
+
+
+/* @read_concern's fields besides "afterClusterTime", if any, then the
+ * session's operation time as "afterClusterTime" if reads must wait for it */
+static void
+_mongoc_cmd_parts_append_read_concern (mongoc_cmd_parts_t *parts,
+                                       bson_t *doc,
+                                       const bson_iter_t *read_concern)
+{
+   const uint8_t *data;
+   uint32_t len;
+   bson_t existing;
+   bson_t child;
+
+   bson_append_document_begin (doc, "readConcern", 11, &child);
+
+   if (read_concern && BSON_ITER_HOLDS_DOCUMENT (read_concern)) {
+      bson_iter_document (read_concern, &len, &data);
+      BSON_ASSERT (bson_init_static (&existing, data, len));
+      bson_copy_to_excluding_noinit (
+         &existing, &child, "afterClusterTime", NULL);
+   }
+
+   if (_mongoc_client_session_needs_after_cluster_time (parts->session)) {
+      bson_append_timestamp (&child,
+                             "afterClusterTime",
+                             16,
+                             parts->session->operation_timestamp,
+                             parts->session->operation_increment);
+   }
+
+   bson_append_document_end (doc, &child);
+}
+
+
+/* a read in a causally consistent session must see the session's last
+ * operation: add the operation time to the command's readConcern, whether
+ * the readConcern is from the user's command, the opts, or the default */
+static void
+_mongoc_cmd_parts_add_after_cluster_time (mongoc_cmd_parts_t *parts)
+{
+   const char **name;
+   bson_iter_t iter;
+   bson_t extra;
+
+   if (parts->is_write_command ||
+       !_mongoc_client_session_needs_after_cluster_time (parts->session)) {
+      return;
+   }
+
+   for (name = gCausalReadCommands; *name; name++) {
+      if (!strcmp (parts->assembled.command_name, *name)) {
+         break;
+      }
+   }
+
+   if (!*name) {
+      return;
+   }
+
+   if (bson_iter_init_find (&iter, &parts->extra, "readConcern")) {
+      bson_init (&extra);
+      bson_copy_to_excluding_noinit (
+         &parts->extra, &extra, "readConcern", NULL);
+      _mongoc_cmd_parts_append_read_concern (parts, &extra, &iter);
+      bson_reinit (&parts->extra);
+      bson_concat (&parts->extra, &extra);
+      bson_destroy (&extra);
+   } else if (bson_iter_init_find (&iter, parts->body, "readConcern")) {
+      /* copy the command to replace its readConcern */
+      bson_copy_to_excluding_noinit (
+         parts->body, &parts->assembled_body, "readConcern", NULL);
+      _mongoc_cmd_parts_append_read_concern (
+         parts, &parts->assembled_body, &iter);
+      parts->assembled.command = &parts->assembled_body;
+   } else {
+      _mongoc_cmd_parts_append_read_concern (parts, &parts->extra, NULL);
+   }
+}
+
+
+/* Transactions Spec: each statement of a transaction sends its number and
+ * "autocommit: false". the first also sends "startTransaction" and the
+ * transaction's readConcern, so starting it costs no round trip; the
+ * statements' own read and write concerns are left out, the transaction's
+ * apply */
+static void
+_mongoc_cmd_parts_add_transaction (mongoc_cmd_parts_t *parts)
+{
+   mongoc_client_session_t *cs = parts->session;
+   bson_iter_t iter;
+   bson_t extra;
+   bool has_read_concern;
+
+   if (bson_has_field (&parts->extra, "readConcern") ||
+       bson_has_field (&parts->extra, "writeConcern")) {
+      bson_init (&extra);
+      bson_copy_to_excluding_noinit (
+         &parts->extra, &extra, "readConcern", "writeConcern", NULL);
+      bson_reinit (&parts->extra);
+      bson_concat (&parts->extra, &extra);
+      bson_destroy (&extra);
+   }
+
+   if (bson_has_field (parts->body, "readConcern") ||
+       bson_has_field (parts->body, "writeConcern")) {
+      /* e.g. a write command's writeConcern */
+      bson_copy_to_excluding_noinit (parts->body,
+                                     &parts->assembled_body,
+                                     "readConcern",
+                                     "writeConcern",
+                                     NULL);
+      parts->assembled.command = &parts->assembled_body;
+   }
+
+   bson_append_int64 (
+      &parts->extra, "txnNumber", 9, cs->server_session->txn_number);
+
+   if (cs->txn_state == MONGOC_TRANSACTION_STARTING) {
+      bson_append_bool (&parts->extra, "startTransaction", 16, true);
+
+      has_read_concern =
+         bson_iter_init_find (&iter, &cs->txn_opts, "readConcern");
+      if (has_read_concern ||
+          _mongoc_client_session_needs_after_cluster_time (cs)) {
+         _mongoc_cmd_parts_append_read_concern (
+            parts, &parts->extra, has_read_concern ? &iter : NULL);
+      }
+
+      cs->txn_state = MONGOC_TRANSACTION_IN_PROGRESS;
+   }
+
+   bson_append_bool (&parts->extra, "autocommit", 10, false);
+}
+
+
+/* a write command sent in batches that began a transaction: the later
+ * batches are its later statements, without "startTransaction" and the
+ * readConcern. the assembled command's suffix is still parts->extra */
+void
+mongoc_cmd_parts_continue_transaction (mongoc_cmd_parts_t *parts)
+{
+   bson_t extra;
+
+   if (!bson_has_field (&parts->extra, "startTransaction")) {
+      return;
+   }
+
+   bson_init (&extra);
+   bson_copy_to_excluding_noinit (
+      &parts->extra, &extra, "startTransaction", "readConcern", NULL);
+   bson_reinit (&parts->extra);
+   bson_concat (&parts->extra, &extra);
+   bson_destroy (&extra);
+}
+
+
 bool
 mongoc_cmd_parts_assemble (mongoc_cmd_parts_t *parts,
                            const mongoc_server_stream_t *server_stream,
@@ -404,6 +622,7 @@ mongoc_cmd_parts_assemble (mongoc_cmd_parts_t *parts,
    parts->assembled.command = parts->body;
    parts->assembled.query_flags = parts->user_query_flags;
    parts->assembled.server_stream = server_stream;
+   parts->assembled.session = parts->session;
    parts->assembled.command_name =
       _mongoc_get_command_name (parts->assembled.command);
 
@@ -417,6 +636,15 @@ mongoc_cmd_parts_assemble (mongoc_cmd_parts_t *parts,
 
    TRACE ("Preparing '%s'", parts->assembled.command_name);
 
+   if (_mongoc_client_session_in_transaction (parts->session) &&
+       server_stream->sd->max_wire_version < WIRE_VERSION_TRANSACTIONS) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_PROTOCOL_BAD_WIRE_VERSION,
+                      "The selected server does not support transactions");
+      RETURN (false);
+   }
+
    if (server_stream->sd->max_wire_version >= WIRE_VERSION_OP_MSG) {
       if (!bson_has_field (parts->body, "$db")) {
          BSON_APPEND_UTF8 (&parts->extra, "$db", parts->assembled.db_name);
@@ -424,43 +652,33 @@ mongoc_cmd_parts_assemble (mongoc_cmd_parts_t *parts,
 
       if (parts->read_prefs &&
           !bson_has_field (parts->body, "$readPreference")) {
-         bson_t child;
-         const bson_t *tags = NULL;
-         const char *mode_str;
-         int64_t stale;
-
-         bson_append_document_begin (
-            &parts->extra, "$readPreference", 15, &child);
-
-         mode_str = _mongoc_read_mode_as_str (
-            mongoc_read_prefs_get_mode (parts->read_prefs));
-         bson_append_utf8 (&child, "mode", 4, mode_str, -1);
-
-         tags = mongoc_read_prefs_get_tags (parts->read_prefs);
-         if (!bson_empty0 (tags)) {
-            bson_append_array (&child, "tags", 4, tags);
-         }
-
-         stale =
-            mongoc_read_prefs_get_max_staleness_seconds (parts->read_prefs);
-         if (stale != MONGOC_NO_MAX_STALENESS) {
-            bson_append_int64 (&child, "maxStalenessSeconds", 19, stale);
-         }
-
-         bson_append_document_end (&parts->extra, &child);
+         bson_append_document (&parts->extra,
+                               "$readPreference",
+                               15,
+                               _mongoc_read_prefs_get_bson (parts->read_prefs));
       }
 
-      if (!bson_empty (&parts->extra)) {
-         _mongoc_cmd_parts_ensure_copied (parts);
+      if (_mongoc_client_session_in_transaction (parts->session)) {
+         _mongoc_cmd_parts_add_lsid (parts, &parts->extra);
+         _mongoc_cmd_parts_add_transaction (parts);
+      } else if (parts->session) {
+         _mongoc_cmd_parts_add_lsid (parts, &parts->extra);
+         _mongoc_cmd_parts_add_after_cluster_time (parts);
       }
 
-      if (parts->session) {
-         _mongoc_cmd_parts_ensure_copied (parts);
+      _mongoc_cmd_parts_add_max_time_ms (parts, server_stream);
+
+      if (!bson_empty (&server_stream->cluster_time) &&
+          server_stream->sd->max_wire_version >= WIRE_VERSION_CLUSTER_TIME) {
          bson_append_document (
-            &parts->assembled_body, "lsid", 4, &parts->session->lsid);
+            &parts->extra, "$clusterTime", 12, &server_stream->cluster_time);
       }
 
-      _mongoc_cmd_parts_add_cluster_time (parts, server_stream);
+      /* the body is sent as is, followed by the fields in "extra", instead
+       * of being copied to append them */
+      if (!bson_empty (&parts->extra)) {
+         parts->assembled.command_suffix = &parts->extra;
+      }
 
       RETURN (true);
    }
@@ -494,6 +712,50 @@ mongoc_cmd_parts_cleanup (mongoc_cmd_parts_t *parts)
    bson_destroy (&parts->assembled_body);
 }
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cmd_get_command --
+ *
+ *       The whole command: @cmd->command itself, or, if the driver's fields
+ *       are kept apart in @cmd->command_suffix, both concatenated in
+ *       @storage.
+ *
+ * Side effects:
+ *       @storage is initialized and must be freed with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const bson_t *
+mongoc_cmd_get_command (const mongoc_cmd_t *cmd, bson_t *storage)
+{
+   bson_init (storage);
+
+   if (!cmd->command_suffix) {
+      return cmd->command;
+   }
+
+   bson_concat (storage, cmd->command);
+   bson_concat (storage, cmd->command_suffix);
+
+   return storage;
+}
+
+
+/* the length of the whole command, see mongoc_cmd_get_command */
+uint32_t
+mongoc_cmd_get_len (const mongoc_cmd_t *cmd)
+{
+   if (!cmd->command_suffix) {
+      return cmd->command->len;
+   }
+
+   /* one document header and terminator for both */
+   return cmd->command->len + cmd->command_suffix->len - 5;
+}
+
+
 bool
 mongoc_cmd_is_compressable (mongoc_cmd_t *cmd)
 {
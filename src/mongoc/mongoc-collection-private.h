@@ -39,6 +39,13 @@ struct _mongoc_collection_t {
    mongoc_read_concern_t *read_concern;
    mongoc_write_concern_t *write_concern;
    bson_t *gle;
+   /* how inserted and replacement documents are validated */
+   bson_validate_flags_t vflags;
+   /* from mongoc_collection_enable_find_cache, or NULL */
+   struct _mongoc_find_cache_t *find_cache;
+   /* the last estimated_document_count reply with "cacheTTLMS", or NULL */
+   bson_t *estimated_count_reply;
+   int64_t estimated_count_time;
 };
 
 
@@ -52,6 +59,12 @@ _mongoc_collection_new (mongoc_client_t *client,
 mongoc_cursor_t *
 _mongoc_collection_find_indexes_legacy (mongoc_collection_t *collection,
                                         bson_error_t *error);
+bool
+_mongoc_collection_create_indexes_cmd (const char *collection_name,
+                                       const bson_t *const *models,
+                                       size_t n_models,
+                                       bson_t *cmd,
+                                       bson_error_t *error);
 
 
 BSON_END_DECLS
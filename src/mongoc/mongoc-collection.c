@@ -23,6 +23,7 @@
 #include "mongoc-client-private.h"
 #include "mongoc-find-and-modify-private.h"
 #include "mongoc-find-and-modify.h"
+#include "mongoc-find-cache-private.h"
 #include "mongoc-collection.h"
 #include "mongoc-collection-private.h"
 #include "mongoc-cursor-private.h"
@@ -33,6 +34,7 @@
 #include "mongoc-log.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-read-concern-private.h"
+#include "mongoc-write-coalescer-private.h"
 #include "mongoc-write-concern-private.h"
 #include "mongoc-read-prefs-private.h"
 #include "mongoc-util-private.h"
@@ -85,15 +87,18 @@ _mongoc_collection_write_command_execute (
    const mongoc_write_concern_t *write_concern,
    mongoc_write_result_t *result)
 {
+   mongoc_cluster_t *cluster = &collection->client->cluster;
    mongoc_server_stream_t *server_stream;
+   bool began;
 
    ENTRY;
 
-   server_stream = mongoc_cluster_stream_for_writes (
-      &collection->client->cluster, &result->error);
+   began = _mongoc_cluster_deadline_begin (cluster, -1);
+   server_stream = mongoc_cluster_stream_for_writes (cluster, &result->error);
 
    if (!server_stream) {
       /* result->error has been filled out */
+      _mongoc_cluster_deadline_end (cluster, began, &result->error);
       EXIT;
    }
 
@@ -108,6 +113,8 @@ _mongoc_collection_write_command_execute (
                                   result);
 
    mongoc_server_stream_cleanup (server_stream);
+   _mongoc_cluster_deadline_end (
+      cluster, began, result->failed ? &result->error : NULL);
 
    EXIT;
 }
@@ -156,12 +163,14 @@ _mongoc_collection_new (mongoc_client_t *client,
 
    col = (mongoc_collection_t *) bson_malloc0 (sizeof *col);
    col->client = client;
+   /* the client's or database's, shared: the setters replace them with
+    * copies rather than modifying them */
    col->write_concern = write_concern
-                           ? mongoc_write_concern_copy (write_concern)
+                           ? _mongoc_write_concern_ref (write_concern)
                            : mongoc_write_concern_new ();
-   col->read_concern = read_concern ? mongoc_read_concern_copy (read_concern)
+   col->read_concern = read_concern ? _mongoc_read_concern_ref (read_concern)
                                     : mongoc_read_concern_new ();
-   col->read_prefs = read_prefs ? mongoc_read_prefs_copy (read_prefs)
+   col->read_prefs = read_prefs ? _mongoc_read_prefs_ref (read_prefs)
                                 : mongoc_read_prefs_new (MONGOC_READ_PRIMARY);
 
    bson_snprintf (col->ns, sizeof col->ns, "%s.%s", db, collection);
@@ -172,6 +181,7 @@ _mongoc_collection_new (mongoc_client_t *client,
    col->nslen = (uint32_t) strlen (col->ns);
 
    col->gle = NULL;
+   col->vflags = _mongoc_insert_vflags;
 
    RETURN (col);
 }
@@ -203,6 +213,12 @@ mongoc_collection_destroy (mongoc_collection_t *collection) /* IN */
 
    bson_clear (&collection->gle);
 
+   if (collection->find_cache) {
+      _mongoc_find_cache_destroy (collection->find_cache);
+   }
+
+   bson_clear (&collection->estimated_count_reply);
+
    if (collection->read_prefs) {
       mongoc_read_prefs_destroy (collection->read_prefs);
       collection->read_prefs = NULL;
@@ -244,16 +260,21 @@ mongoc_collection_destroy (mongoc_collection_t *collection) /* IN */
 mongoc_collection_t *
 mongoc_collection_copy (mongoc_collection_t *collection) /* IN */
 {
+   mongoc_collection_t *copy;
+
    ENTRY;
 
    BSON_ASSERT (collection);
 
-   RETURN (_mongoc_collection_new (collection->client,
-                                   collection->db,
-                                   collection->collection,
-                                   collection->read_prefs,
-                                   collection->read_concern,
-                                   collection->write_concern));
+   copy = _mongoc_collection_new (collection->client,
+                                  collection->db,
+                                  collection->collection,
+                                  collection->read_prefs,
+                                  collection->read_concern,
+                                  collection->write_concern);
+   copy->vflags = collection->vflags;
+
+   RETURN (copy);
 }
 
 
@@ -403,11 +424,36 @@ mongoc_collection_aggregate (mongoc_collection_t *collection,       /* IN */
    }
    bson_append_document_end (&command, &child);
 
+   if (opts &&
+       bson_iter_init_find (&iter, opts, MONGOC_CURSOR_ADAPTIVE_BATCH_BYTES)) {
+      if (!BSON_ITER_HOLDS_INT (&iter) || bson_iter_as_int64 (&iter) < 0 ||
+          bson_iter_as_int64 (&iter) > INT32_MAX) {
+         bson_set_error (&cursor->error,
+                         MONGOC_ERROR_CURSOR,
+                         MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                         "The adaptiveBatchBytes option must be a "
+                         "non-negative 32-bit integer");
+         GOTO (done);
+      }
+
+      /* a batchSize applies to every batch */
+      if (!has_batch_size) {
+         cursor->adaptive_batch_bytes = (int32_t) bson_iter_as_int64 (&iter);
+      }
+   }
+
    if (opts) {
       if (has_batch_size) {
-         bson_copy_to_excluding_noinit (opts, &cursor->opts, "batchSize", NULL);
+         bson_copy_to_excluding_noinit (opts,
+                                        &cursor->opts,
+                                        "batchSize",
+                                        MONGOC_CURSOR_ADAPTIVE_BATCH_BYTES,
+                                        NULL);
       } else {
-         bson_concat (&cursor->opts, opts);
+         bson_copy_to_excluding_noinit (opts,
+                                        &cursor->opts,
+                                        MONGOC_CURSOR_ADAPTIVE_BATCH_BYTES,
+                                        NULL);
       }
    }
 
@@ -556,6 +602,8 @@ mongoc_collection_find_with_opts (mongoc_collection_t *collection,
                                   const bson_t *opts,
                                   const mongoc_read_prefs_t *read_prefs)
 {
+   mongoc_cursor_t *cursor;
+
    BSON_ASSERT (collection);
    BSON_ASSERT (filter);
 
@@ -565,7 +613,15 @@ mongoc_collection_find_with_opts (mongoc_collection_t *collection,
       read_prefs = collection->read_prefs;
    }
 
-   return _mongoc_cursor_new_with_opts (
+   if (collection->find_cache) {
+      cursor = _mongoc_find_cache_find (
+         collection->find_cache, filter, opts, read_prefs);
+      if (cursor) {
+         return cursor;
+      }
+   }
+
+   cursor = _mongoc_cursor_new_with_opts (
       collection->client,
       collection->ns,
       false /* is_command */,
@@ -573,6 +629,620 @@ mongoc_collection_find_with_opts (mongoc_collection_t *collection,
       opts,
       COALESCE (read_prefs, collection->read_prefs),
       collection->read_concern);
+
+   if (collection->find_cache) {
+      cursor = _mongoc_find_cache_fill (
+         collection->find_cache, filter, opts, read_prefs, cursor);
+   }
+
+   return cursor;
+}
+
+
+/* run @filter as a mongoc_collection_find_with_opts cursor, for servers
+ * without the "find" command, or through the collection's find cache */
+static bool
+_mongoc_collection_find_one_legacy (mongoc_collection_t *collection,
+                                    const bson_t *filter,
+                                    const bson_t *opts,
+                                    const mongoc_read_prefs_t *read_prefs,
+                                    bson_t *doc,
+                                    bson_error_t *error)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *found;
+   bool ret = false;
+
+   cursor = mongoc_collection_find_with_opts (
+      collection, filter, opts, read_prefs);
+
+   if (mongoc_cursor_next (cursor, &found)) {
+      bson_copy_to (found, doc);
+      ret = true;
+   } else {
+      bson_init (doc);
+
+      if (!mongoc_cursor_error (cursor, error) && error) {
+         /* no error, but an error out-pointer was provided - clear it */
+         memset (error, 0, sizeof (*error));
+      }
+   }
+
+   mongoc_cursor_destroy (cursor);
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_find_one_with_opts --
+ *
+ *       Find the first document matching @filter with a "find" command
+ *       for a single batch of one document, read straight from the
+ *       command's reply instead of through a cursor.
+ *
+ * Returns:
+ *       true if a document matched, and @doc is initialized with a copy.
+ *       Otherwise false and @doc is initialized empty; @error is set on
+ *       failure, and zeroed if no document matched.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_collection_find_one_with_opts (mongoc_collection_t *collection,
+                                      const bson_t *filter,
+                                      const bson_t *opts,
+                                      const mongoc_read_prefs_t *read_prefs,
+                                      bson_t *doc,
+                                      bson_error_t *error)
+{
+   mongoc_server_stream_t *server_stream;
+   bson_t find_opts = BSON_INITIALIZER;
+   bson_t cmd = BSON_INITIALIZER;
+   bson_t reply;
+   bson_iter_t iter;
+   bson_iter_t batch;
+   const uint8_t *data;
+   uint32_t len;
+   bson_t found;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (collection);
+   BSON_ASSERT (filter);
+   BSON_ASSERT (doc);
+
+   bson_clear (&collection->gle);
+
+   if (!read_prefs) {
+      read_prefs = collection->read_prefs;
+   }
+
+   /* one document in one batch, on no cursor to iterate or kill */
+   if (opts) {
+      bson_copy_to_excluding_noinit (opts,
+                                     &find_opts,
+                                     MONGOC_CURSOR_LIMIT,
+                                     MONGOC_CURSOR_BATCH_SIZE,
+                                     MONGOC_CURSOR_SINGLE_BATCH,
+                                     MONGOC_CURSOR_TAILABLE,
+                                     MONGOC_CURSOR_AWAIT_DATA,
+                                     MONGOC_CURSOR_EXHAUST,
+                                     MONGOC_CURSOR_EXHAUST_ALLOWED,
+                                     MONGOC_CURSOR_PREFETCH,
+                                     MONGOC_CURSOR_ADAPTIVE_BATCH_BYTES,
+                                     MONGOC_CURSOR_SPILL_BATCH_BYTES,
+                                     MONGOC_CURSOR_STREAM_BATCHES,
+                                     "hedgeDelayMS",
+                                     NULL);
+   }
+
+   if (collection->find_cache) {
+      BSON_APPEND_INT32 (&find_opts, MONGOC_CURSOR_LIMIT, 1);
+      BSON_APPEND_BOOL (&find_opts, MONGOC_CURSOR_SINGLE_BATCH, true);
+      ret = _mongoc_collection_find_one_legacy (
+         collection, filter, &find_opts, read_prefs, doc, error);
+
+      GOTO (done);
+   }
+
+   server_stream = _mongoc_client_stream_for_opts (
+      collection->client, &find_opts, MONGOC_CMD_READ, read_prefs, error);
+
+   if (!server_stream) {
+      bson_init (doc);
+      GOTO (done);
+   }
+
+   if (server_stream->sd->max_wire_version < WIRE_VERSION_FIND_CMD) {
+      mongoc_server_stream_cleanup (server_stream);
+
+      BSON_APPEND_INT32 (&find_opts, MONGOC_CURSOR_LIMIT, 1);
+      BSON_APPEND_BOOL (&find_opts, MONGOC_CURSOR_SINGLE_BATCH, true);
+      ret = _mongoc_collection_find_one_legacy (
+         collection, filter, &find_opts, read_prefs, doc, error);
+
+      GOTO (done);
+   }
+
+   bson_append_utf8 (&cmd,
+                     MONGOC_CURSOR_FIND,
+                     MONGOC_CURSOR_FIND_LEN,
+                     collection->collection,
+                     collection->collectionlen);
+   bson_append_document (
+      &cmd, MONGOC_CURSOR_FILTER, MONGOC_CURSOR_FILTER_LEN, filter);
+   bson_append_int64 (&cmd, MONGOC_CURSOR_LIMIT, MONGOC_CURSOR_LIMIT_LEN, 1);
+   bson_append_bool (
+      &cmd, MONGOC_CURSOR_SINGLE_BATCH, MONGOC_CURSOR_SINGLE_BATCH_LEN, true);
+
+   if (!_mongoc_client_command_with_opts_and_stream (collection->client,
+                                                     collection->db,
+                                                     &cmd,
+                                                     MONGOC_CMD_READ,
+                                                     &find_opts,
+                                                     MONGOC_QUERY_NONE,
+                                                     read_prefs,
+                                                     collection->read_concern,
+                                                     collection->write_concern,
+                                                     server_stream,
+                                                     &reply,
+                                                     error)) {
+      bson_init (doc);
+      GOTO (cleanup);
+   }
+
+   /* the document is copied straight out of the reply's firstBatch */
+   if (bson_iter_init (&iter, &reply) &&
+       bson_iter_find_descendant (&iter, "cursor.firstBatch", &batch) &&
+       BSON_ITER_HOLDS_ARRAY (&batch) && bson_iter_recurse (&batch, &iter) &&
+       bson_iter_next (&iter) && BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_iter_document (&iter, &len, &data);
+      BSON_ASSERT (bson_init_static (&found, data, len));
+      bson_copy_to (&found, doc);
+      ret = true;
+   } else {
+      bson_init (doc);
+
+      if (error) {
+         memset (error, 0, sizeof (*error));
+      }
+   }
+
+cleanup:
+   bson_destroy (&reply);
+   mongoc_server_stream_cleanup (server_stream);
+
+done:
+   bson_destroy (&cmd);
+   bson_destroy (&find_opts);
+
+   RETURN (ret);
+}
+
+
+static void
+_mongoc_collection_aggregate_one_too_many (bson_error_t *error)
+{
+   bson_set_error (error,
+                   MONGOC_ERROR_CURSOR,
+                   MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                   "The aggregation returned more than one document");
+}
+
+
+/* servers older than 2.6 reply to "aggregate" without a cursor, the
+ * cursor's legacy path handles them */
+static bool
+_mongoc_collection_aggregate_one_legacy (mongoc_collection_t *collection,
+                                         const bson_t *pipeline,
+                                         const bson_t *opts,
+                                         const mongoc_read_prefs_t *read_prefs,
+                                         bson_t *doc,
+                                         bson_error_t *error)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *found;
+   bool ret = false;
+
+   cursor = mongoc_collection_aggregate (
+      collection, MONGOC_QUERY_NONE, pipeline, opts, read_prefs);
+
+   if (mongoc_cursor_next (cursor, &found)) {
+      bson_copy_to (found, doc);
+
+      if (mongoc_cursor_next (cursor, &found)) {
+         bson_destroy (doc);
+         bson_init (doc);
+         _mongoc_collection_aggregate_one_too_many (error);
+      } else if (mongoc_cursor_error (cursor, error)) {
+         bson_destroy (doc);
+         bson_init (doc);
+      } else {
+         ret = true;
+      }
+   } else {
+      bson_init (doc);
+
+      if (!mongoc_cursor_error (cursor, error) && error) {
+         memset (error, 0, sizeof (*error));
+      }
+   }
+
+   mongoc_cursor_destroy (cursor);
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_aggregate_one --
+ *
+ *       Run @pipeline, which must produce at most one document, e.g. one
+ *       ending in "$count" or a "$group" on a constant _id, as a single
+ *       "aggregate" command. The result is read straight from the reply's
+ *       firstBatch instead of through a cursor.
+ *
+ *       The first batch is allowed two documents, so a pipeline with one
+ *       result is exhausted by it and the server closes the cursor. If
+ *       the server left one open anyway, it is killed.
+ *
+ * Returns:
+ *       true if the pipeline produced a document, and @doc is initialized
+ *       with a copy. Otherwise false and @doc is initialized empty; @error
+ *       is set on failure or if there was more than one document, and
+ *       zeroed if there was none.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_collection_aggregate_one (mongoc_collection_t *collection,
+                                 const bson_t *pipeline,
+                                 const bson_t *opts,
+                                 const mongoc_read_prefs_t *read_prefs,
+                                 bson_t *doc,
+                                 bson_error_t *error)
+{
+   mongoc_server_stream_t *server_stream;
+   bson_t agg_opts = BSON_INITIALIZER;
+   bson_t cmd = BSON_INITIALIZER;
+   bson_t child;
+   bson_t reply;
+   bson_iter_t iter;
+   bson_iter_t stage;
+   bson_iter_t batch;
+   const uint8_t *data;
+   uint32_t len;
+   int64_t cursor_id = 0;
+   bson_t found;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (collection);
+   BSON_ASSERT (pipeline);
+   BSON_ASSERT (doc);
+
+   bson_clear (&collection->gle);
+
+   if (!read_prefs) {
+      read_prefs = collection->read_prefs;
+   }
+
+   bson_append_utf8 (&cmd,
+                     "aggregate",
+                     9,
+                     collection->collection,
+                     collection->collectionlen);
+
+   /* like mongoc_collection_aggregate, an array or {"pipeline": [...]} */
+   if (bson_iter_init_find (&iter, pipeline, "pipeline") &&
+       BSON_ITER_HOLDS_ARRAY (&iter)) {
+      bson_append_iter (&cmd, "pipeline", 8, &iter);
+      bson_iter_recurse (&iter, &stage);
+   } else {
+      bson_append_array (&cmd, "pipeline", 8, pipeline);
+      bson_iter_init (&stage, pipeline);
+   }
+
+   /* a $out stage writes its results instead of returning them */
+   while (bson_iter_next (&stage)) {
+      if (BSON_ITER_HOLDS_DOCUMENT (&stage) &&
+          bson_iter_recurse (&stage, &iter) && bson_iter_find (&iter, "$out")) {
+         bson_set_error (error,
+                         MONGOC_ERROR_COMMAND,
+                         MONGOC_ERROR_COMMAND_INVALID_ARG,
+                         "Cannot use $out with "
+                         "mongoc_collection_aggregate_one");
+         bson_init (doc);
+         GOTO (done);
+      }
+   }
+
+   if (opts) {
+      bson_copy_to_excluding_noinit (opts,
+                                     &agg_opts,
+                                     MONGOC_CURSOR_BATCH_SIZE,
+                                     MONGOC_CURSOR_ADAPTIVE_BATCH_BYTES,
+                                     NULL);
+   }
+
+   server_stream = _mongoc_client_stream_for_opts (
+      collection->client, &agg_opts, MONGOC_CMD_READ, read_prefs, error);
+
+   if (!server_stream) {
+      bson_init (doc);
+      GOTO (done);
+   }
+
+   if (server_stream->sd->max_wire_version < WIRE_VERSION_AGG_CURSOR) {
+      mongoc_server_stream_cleanup (server_stream);
+      ret = _mongoc_collection_aggregate_one_legacy (
+         collection, pipeline, &agg_opts, read_prefs, doc, error);
+
+      GOTO (done);
+   }
+
+   bson_append_document_begin (&cmd, "cursor", 6, &child);
+   BSON_APPEND_INT32 (&child, MONGOC_CURSOR_BATCH_SIZE, 2);
+   bson_append_document_end (&cmd, &child);
+
+   if (!_mongoc_client_command_with_opts_and_stream (collection->client,
+                                                     collection->db,
+                                                     &cmd,
+                                                     MONGOC_CMD_READ,
+                                                     &agg_opts,
+                                                     MONGOC_QUERY_NONE,
+                                                     read_prefs,
+                                                     collection->read_concern,
+                                                     collection->write_concern,
+                                                     server_stream,
+                                                     &reply,
+                                                     error)) {
+      bson_init (doc);
+      GOTO (cleanup);
+   }
+
+   if (bson_iter_init (&iter, &reply) &&
+       bson_iter_find_descendant (&iter, "cursor.id", &batch) &&
+       BSON_ITER_HOLDS_INT (&batch)) {
+      cursor_id = bson_iter_as_int64 (&batch);
+   }
+
+   bson_init (doc);
+
+   if (bson_iter_init (&iter, &reply) &&
+       bson_iter_find_descendant (&iter, "cursor.firstBatch", &batch) &&
+       BSON_ITER_HOLDS_ARRAY (&batch) && bson_iter_recurse (&batch, &iter) &&
+       bson_iter_next (&iter) && BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      if (cursor_id || bson_iter_next (&iter)) {
+         _mongoc_collection_aggregate_one_too_many (error);
+      } else {
+         bson_iter_document (&iter, &len, &data);
+         BSON_ASSERT (bson_init_static (&found, data, len));
+         bson_destroy (doc);
+         bson_copy_to (&found, doc);
+         ret = true;
+      }
+   } else if (cursor_id) {
+      _mongoc_collection_aggregate_one_too_many (error);
+   } else if (error) {
+      memset (error, 0, sizeof (*error));
+   }
+
+   /* no cursor outlives the call */
+   if (cursor_id) {
+      _mongoc_client_kill_cursor (collection->client,
+                                  server_stream->sd->id,
+                                  cursor_id,
+                                  0 /* operation_id */,
+                                  collection->db,
+                                  collection->collection);
+   }
+
+cleanup:
+   bson_destroy (&reply);
+   mongoc_server_stream_cleanup (server_stream);
+
+done:
+   bson_destroy (&cmd);
+   bson_destroy (&agg_opts);
+
+   RETURN (ret);
+}
+
+
+/* _ids sampled per cursor, more make the ranges' sizes more even */
+#define MONGOC_PARALLEL_SCAN_SAMPLES 16
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_parallel_scan --
+ *
+ *       Split the documents matching @filter into up to @n ranges of
+ *       _id, using the _ids of a $sample, and open a cursor for each.
+ *       Cursor i uses collections[i]: pass handles from different pooled
+ *       clients to drain the cursors on different threads, or the same
+ *       handle @n times. All must be for the same collection.
+ *
+ *       The ranges are bounded with "min" and "max" on the _id index,
+ *       which orders values of different BSON types, so every document
+ *       is in exactly one range.
+ *
+ * Returns:
+ *       true and sets @n_cursors, at most @n, if the collection was
+ *       sampled; otherwise false and sets @error. The cursors must be
+ *       freed with mongoc_cursor_destroy(), and may still fail like
+ *       mongoc_collection_find_with_opts() cursors.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_collection_parallel_scan (mongoc_collection_t **collections,
+                                 uint32_t n,
+                                 const bson_t *filter,
+                                 const bson_t *opts,
+                                 const mongoc_read_prefs_t *read_prefs,
+                                 mongoc_cursor_t **cursors,
+                                 uint32_t *n_cursors,
+                                 bson_error_t *error)
+{
+   mongoc_cursor_t *sample;
+   const bson_t *doc;
+   bson_t **samples;
+   bson_t **splits;
+   bson_t *pipeline;
+   bson_t range_opts;
+   bson_t hint = BSON_INITIALIZER;
+   int32_t size;
+   uint32_t n_samples = 0;
+   uint32_t n_splits;
+   uint32_t i;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (collections);
+   BSON_ASSERT (filter);
+   BSON_ASSERT (cursors);
+   BSON_ASSERT (n_cursors);
+
+   *n_cursors = 0;
+
+   if (!n) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Cannot scan with 0 cursors");
+      RETURN (false);
+   }
+
+   for (i = 1; i < n; i++) {
+      if (strcmp (collections[i]->ns, collections[0]->ns)) {
+         bson_set_error (error,
+                         MONGOC_ERROR_COMMAND,
+                         MONGOC_ERROR_COMMAND_INVALID_ARG,
+                         "Cannot scan \"%s\" and \"%s\" together",
+                         collections[0]->ns,
+                         collections[i]->ns);
+         RETURN (false);
+      }
+   }
+
+   if (opts && (bson_has_field (opts, "min") || bson_has_field (opts, "max") ||
+                bson_has_field (opts, "hint"))) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Cannot use \"min\", \"max\", or \"hint\" with a "
+                      "parallel scan");
+      RETURN (false);
+   }
+
+   size = (int32_t) BSON_MIN ((int64_t) n * MONGOC_PARALLEL_SCAN_SAMPLES,
+                              (int64_t) INT32_MAX);
+   pipeline = BCON_NEW ("pipeline",
+                        "[",
+                        "{",
+                        "$match",
+                        BCON_DOCUMENT (filter),
+                        "}",
+                        "{",
+                        "$sample",
+                        "{",
+                        "size",
+                        BCON_INT32 (size),
+                        "}",
+                        "}",
+                        "{",
+                        "$project",
+                        "{",
+                        "_id",
+                        BCON_INT32 (1),
+                        "}",
+                        "}",
+                        "{",
+                        "$sort",
+                        "{",
+                        "_id",
+                        BCON_INT32 (1),
+                        "}",
+                        "}",
+                        "]");
+
+   sample = mongoc_collection_aggregate (
+      collections[0], MONGOC_QUERY_NONE, pipeline, NULL, read_prefs);
+
+   /* sorted {_id: value} documents, $sample may repeat one */
+   samples = (bson_t **) bson_malloc0 ((size_t) size * sizeof (bson_t *));
+   while (n_samples < (uint32_t) size && mongoc_cursor_next (sample, &doc)) {
+      if (!n_samples || !bson_equal (doc, samples[n_samples - 1])) {
+         samples[n_samples++] = bson_copy (doc);
+      }
+   }
+
+   if (mongoc_cursor_error (sample, error)) {
+      GOTO (done);
+   }
+
+   /* split at n - 1 evenly spaced samples, or at every one if there are
+    * fewer than n */
+   n_splits = BSON_MIN (n - 1, n_samples);
+   splits = (bson_t **) bson_malloc0 ((n_splits + 1) * sizeof (bson_t *));
+   for (i = 0; i < n_splits; i++) {
+      splits[i] = n_samples >= n
+                     ? samples[(uint64_t) (i + 1) * n_samples / n]
+                     : samples[i];
+   }
+
+   BSON_APPEND_INT32 (&hint, "_id", 1);
+   for (i = 0; i <= n_splits; i++) {
+      bson_init (&range_opts);
+      if (opts) {
+         bson_concat (&range_opts, opts);
+      }
+
+      if (n_splits) {
+         BSON_APPEND_DOCUMENT (&range_opts, "hint", &hint);
+         if (i > 0) {
+            BSON_APPEND_DOCUMENT (&range_opts, "min", splits[i - 1]);
+         }
+
+         if (i < n_splits) {
+            BSON_APPEND_DOCUMENT (&range_opts, "max", splits[i]);
+         }
+      }
+
+      cursors[i] = mongoc_collection_find_with_opts (
+         collections[i], filter, &range_opts, read_prefs);
+      bson_destroy (&range_opts);
+   }
+
+   *n_cursors = n_splits + 1;
+   bson_free (splits);
+   ret = true;
+
+done:
+   for (i = 0; i < n_samples; i++) {
+      bson_destroy (samples[i]);
+   }
+
+   bson_free (samples);
+   mongoc_cursor_destroy (sample);
+   bson_destroy (pipeline);
+   bson_destroy (&hint);
+
+   RETURN (ret);
 }
 
 
@@ -877,6 +1547,122 @@ mongoc_collection_count_with_opts (
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_estimated_document_count --
+ *
+ *       Count the collection's documents from its metadata, with a "count"
+ *       command without a query, which never scans the collection. With
+ *       "cacheTTLMS" in @opts, a reply received that recently by an
+ *       earlier call with "cacheTTLMS" is used instead of a command.
+ *
+ * Returns:
+ *       The count, or -1 and @error is set. @reply is always initialized
+ *       if it is not NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int64_t
+mongoc_collection_estimated_document_count (
+   mongoc_collection_t *collection,
+   const bson_t *opts,
+   const mongoc_read_prefs_t *read_prefs,
+   bson_t *reply,
+   bson_error_t *error)
+{
+   bson_iter_t iter;
+   int64_t cache_ttl_usec = -1;
+   int64_t now;
+   int64_t ret = -1;
+   bson_t cmd = BSON_INITIALIZER;
+   bson_t cmd_opts = BSON_INITIALIZER;
+   bson_t reply_local;
+
+   ENTRY;
+
+   BSON_ASSERT (collection);
+
+   if (opts && bson_iter_init_find (&iter, opts, "cacheTTLMS")) {
+      if (!BSON_ITER_HOLDS_INT32 (&iter) || bson_iter_int32 (&iter) < 0) {
+         bson_set_error (error,
+                         MONGOC_ERROR_COMMAND,
+                         MONGOC_ERROR_COMMAND_INVALID_ARG,
+                         "\"cacheTTLMS\" must be a non-negative int32");
+         _mongoc_bson_init_if_set (reply);
+         GOTO (done);
+      }
+
+      cache_ttl_usec = (int64_t) bson_iter_int32 (&iter) * 1000;
+   }
+
+   now = bson_get_monotonic_time ();
+   if (cache_ttl_usec >= 0 && collection->estimated_count_reply &&
+       now - collection->estimated_count_time < cache_ttl_usec) {
+      BSON_ASSERT (bson_iter_init_find (
+         &iter, collection->estimated_count_reply, "n"));
+      ret = bson_iter_as_int64 (&iter);
+      if (reply) {
+         bson_copy_to (collection->estimated_count_reply, reply);
+      }
+
+      GOTO (done);
+   }
+
+   if (opts) {
+      bson_copy_to_excluding_noinit (opts, &cmd_opts, "cacheTTLMS", NULL);
+   }
+
+   bson_append_utf8 (
+      &cmd, "count", 5, collection->collection, collection->collectionlen);
+
+   if (!_mongoc_client_command_with_opts (
+          collection->client,
+          collection->db,
+          &cmd,
+          MONGOC_CMD_READ,
+          &cmd_opts,
+          MONGOC_QUERY_NONE,
+          COALESCE (read_prefs, collection->read_prefs),
+          collection->read_concern,
+          collection->write_concern,
+          &reply_local,
+          error)) {
+      GOTO (copy_reply);
+   }
+
+   if (!bson_iter_init_find (&iter, &reply_local, "n")) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "\"count\" reply has no \"n\"");
+      GOTO (copy_reply);
+   }
+
+   ret = bson_iter_as_int64 (&iter);
+
+   if (cache_ttl_usec >= 0) {
+      bson_clear (&collection->estimated_count_reply);
+      collection->estimated_count_reply = bson_copy (&reply_local);
+      collection->estimated_count_time = now;
+   }
+
+copy_reply:
+   if (reply) {
+      bson_copy_to (&reply_local, reply);
+   }
+
+   bson_destroy (&reply_local);
+
+done:
+   bson_destroy (&cmd);
+   bson_destroy (&cmd_opts);
+
+   RETURN (ret);
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1242,6 +2028,137 @@ done:
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_collection_create_indexes_cmd --
+ *
+ *       Build a createIndexes command for @collection_name from @n_models
+ *       index specs like {key: {...}, name: "...", ...}. Specs without a
+ *       name get one generated from their keys.
+ *
+ * Returns:
+ *       true on success, false on invalid specs with @error set.
+ *       @cmd is always initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_collection_create_indexes_cmd (const char *collection_name,
+                                       const bson_t *const *models,
+                                       size_t n_models,
+                                       bson_t *cmd,
+                                       bson_error_t *error)
+{
+   bson_t ar;
+   bson_t doc;
+   bson_t keys;
+   bson_iter_t iter;
+   const uint8_t *data;
+   uint32_t len;
+   const char *key;
+   char buf[16];
+   char *name;
+   size_t i;
+
+   bson_init (cmd);
+
+   if (n_models == 0) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Cannot create an empty list of indexes");
+      return false;
+   }
+
+   BSON_APPEND_UTF8 (cmd, "createIndexes", collection_name);
+   BSON_APPEND_ARRAY_BEGIN (cmd, "indexes", &ar);
+
+   for (i = 0; i < n_models; i++) {
+      BSON_ASSERT (models[i]);
+
+      if (!bson_iter_init_find (&iter, models[i], "key") ||
+          !BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         bson_set_error (error,
+                         MONGOC_ERROR_COMMAND,
+                         MONGOC_ERROR_COMMAND_INVALID_ARG,
+                         "Index %d has no \"key\" document",
+                         (int) i);
+         return false;
+      }
+
+      bson_iter_document (&iter, &len, &data);
+      BSON_ASSERT (bson_init_static (&keys, data, len));
+
+      bson_uint32_to_string ((uint32_t) i, &key, buf, sizeof buf);
+      bson_append_document_begin (&ar, key, (int) strlen (key), &doc);
+      bson_concat (&doc, models[i]);
+
+      if (!bson_has_field (models[i], "name")) {
+         name = mongoc_collection_keys_to_index_string (&keys);
+         if (!name) {
+            bson_set_error (
+               error,
+               MONGOC_ERROR_BSON,
+               MONGOC_ERROR_BSON_INVALID,
+               "Cannot generate index name from invalid `keys` argument");
+            return false;
+         }
+
+         BSON_APPEND_UTF8 (&doc, "name", name);
+         bson_free (name);
+      }
+
+      bson_append_document_end (&ar, &doc);
+   }
+
+   bson_append_array_end (cmd, &ar);
+
+   return true;
+}
+
+
+bool
+mongoc_collection_create_indexes_with_opts (mongoc_collection_t *collection,
+                                            const bson_t *const *models,
+                                            size_t n_models,
+                                            const bson_t *opts,
+                                            bson_t *reply,
+                                            bson_error_t *error)
+{
+   bson_t cmd;
+   bool ret;
+
+   ENTRY;
+
+   BSON_ASSERT (collection);
+   BSON_ASSERT (models || n_models == 0);
+
+   if (!_mongoc_collection_create_indexes_cmd (
+          collection->collection, models, n_models, &cmd, error)) {
+      bson_destroy (&cmd);
+      _mongoc_bson_init_if_set (reply);
+      RETURN (false);
+   }
+
+   ret = _mongoc_client_command_with_opts (collection->client,
+                                           collection->db,
+                                           &cmd,
+                                           MONGOC_CMD_WRITE,
+                                           opts,
+                                           MONGOC_QUERY_NONE,
+                                           collection->read_prefs,
+                                           collection->read_concern,
+                                           collection->write_concern,
+                                           reply,
+                                           error);
+   bson_destroy (&cmd);
+
+   RETURN (ret);
+}
+
+
 bool
 mongoc_collection_ensure_index (mongoc_collection_t *collection,
                                 const bson_t *keys,
@@ -1290,6 +2207,7 @@ mongoc_cursor_t *
 mongoc_collection_find_indexes (mongoc_collection_t *collection,
                                 bson_error_t *error)
 {
+   mongoc_metadata_cache_t *cache;
    mongoc_cursor_t *cursor;
    bson_t cmd = BSON_INITIALIZER;
    bson_t child;
@@ -1305,6 +2223,16 @@ mongoc_collection_find_indexes (mongoc_collection_t *collection,
    BSON_APPEND_DOCUMENT_BEGIN (&cmd, "cursor", &child);
    bson_append_document_end (&cmd, &child);
 
+   cache = collection->client->metadata_cache;
+   if (cache) {
+      cursor = _mongoc_metadata_cache_find (
+         cache, collection->client, collection->db, &cmd);
+      if (cursor) {
+         bson_destroy (&cmd);
+         return cursor;
+      }
+   }
+
    /* Set slaveOk but no read preference: Index Enumeration Spec says
     * "listIndexes can be run on a secondary" when directly connected but
     * "run listIndexes on the primary node in replicaSet mode". */
@@ -1342,6 +2270,15 @@ mongoc_collection_find_indexes (mongoc_collection_t *collection,
       }
    }
 
+   if (cursor && cache) {
+      cursor = _mongoc_metadata_cache_fill (cache,
+                                            collection->client,
+                                            collection->db,
+                                            collection->collection,
+                                            &cmd,
+                                            cursor);
+   }
+
    bson_destroy (&cmd);
 
    return cursor;
@@ -1399,7 +2336,8 @@ mongoc_collection_insert_bulk (mongoc_collection_t *collection,
 
    if (!(flags & MONGOC_INSERT_NO_VALIDATE)) {
       for (i = 0; i < n_documents; i++) {
-         if (!_mongoc_validate_new_document (documents[i], error)) {
+         if (!_mongoc_validate_new_document (
+                documents[i], collection->vflags, error)) {
             RETURN (false);
          }
       }
@@ -1417,9 +2355,11 @@ mongoc_collection_insert_bulk (mongoc_collection_t *collection,
       write_flags,
       ++collection->client->cluster.operation_id,
       true);
+   command.oid_context = _mongoc_client_get_oid_context (collection->client);
 
+   /* the documents outlive the command, send them in place */
    for (i = 0; i < n_documents; i++) {
-      _mongoc_write_command_insert_append (&command, documents[i]);
+      _mongoc_write_command_insert_borrow (&command, documents[i]);
    }
 
    _mongoc_collection_write_command_execute (
@@ -1493,20 +2433,36 @@ mongoc_collection_insert (mongoc_collection_t *collection,
    }
 
    if (!(flags & MONGOC_INSERT_NO_VALIDATE) &&
-       !_mongoc_validate_new_document (document, error)) {
+       !_mongoc_validate_new_document (document, collection->vflags, error)) {
       RETURN (false);
    }
 
    _mongoc_write_result_init (&result);
-   _mongoc_write_command_init_insert (
-      &command,
-      document,
-      write_flags,
-      ++collection->client->cluster.operation_id,
-      false);
 
-   _mongoc_collection_write_command_execute (
-      &command, collection, write_concern, &result);
+   if (collection->client->coalescer &&
+       mongoc_write_concern_is_acknowledged (write_concern)) {
+      /* sent with other threads' inserts to this collection */
+      _mongoc_write_coalescer_insert (collection->client->coalescer,
+                                      collection,
+                                      document,
+                                      write_concern,
+                                      &result);
+   } else {
+      _mongoc_write_command_init_insert (
+         &command,
+         NULL,
+         write_flags,
+         ++collection->client->cluster.operation_id,
+         false);
+      command.oid_context =
+         _mongoc_client_get_oid_context (collection->client);
+      _mongoc_write_command_insert_borrow (&command, document);
+
+      _mongoc_collection_write_command_execute (
+         &command, collection, write_concern, &result);
+
+      _mongoc_write_command_destroy (&command);
+   }
 
    collection->gle = bson_new ();
    ret = _mongoc_write_result_complete (&result,
@@ -1518,7 +2474,6 @@ mongoc_collection_insert (mongoc_collection_t *collection,
                                         error);
 
    _mongoc_write_result_destroy (&result);
-   _mongoc_write_command_destroy (&command);
 
    RETURN (ret);
 }
@@ -1585,7 +2540,7 @@ mongoc_collection_update (mongoc_collection_t *collection,
             return false;
          }
       } else {
-         if (!_mongoc_validate_replace (update, error)) {
+         if (!_mongoc_validate_replace (update, collection->vflags, error)) {
             return false;
          }
       }
@@ -1617,8 +2572,89 @@ mongoc_collection_update (mongoc_collection_t *collection,
                                         collection->gle,
                                         error);
 
-   _mongoc_write_result_destroy (&result);
-   _mongoc_write_command_destroy (&command);
+   _mongoc_write_result_destroy (&result);
+   _mongoc_write_command_destroy (&command);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_update_diff --
+ *
+ *       Update the document @old_doc was read as to @new_doc, sending
+ *       only the fields that changed: a "$set" and "$unset" computed on
+ *       the client, recursing into subdocuments. If that would be no
+ *       smaller than @new_doc, or a field name can't be in a dotted path,
+ *       @new_doc replaces the document instead. If nothing changed,
+ *       nothing is sent.
+ *
+ *       The document is selected by the "_id" both must have.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_collection_update_diff (mongoc_collection_t *collection,
+                               const bson_t *old_doc,
+                               const bson_t *new_doc,
+                               const mongoc_write_concern_t *write_concern,
+                               bson_error_t *error)
+{
+   bson_t selector = BSON_INITIALIZER;
+   bson_t diff = BSON_INITIALIZER;
+   const bson_t *update = new_doc;
+   bson_iter_t old_id;
+   bson_iter_t new_id;
+   bool ret;
+
+   ENTRY;
+
+   BSON_ASSERT (collection);
+   BSON_ASSERT (old_doc);
+   BSON_ASSERT (new_doc);
+
+   if (!bson_iter_init_find (&old_id, old_doc, "_id") ||
+       !bson_iter_init_find (&new_id, new_doc, "_id") ||
+       old_id.next_off - old_id.off != new_id.next_off - new_id.off ||
+       memcmp (old_id.raw + old_id.off,
+               new_id.raw + new_id.off,
+               new_id.next_off - new_id.off)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "The old and new documents must have the same \"_id\"");
+      RETURN (false);
+   }
+
+   if (_mongoc_update_diff (old_doc, new_doc, &diff)) {
+      if (bson_empty (&diff)) {
+         bson_clear (&collection->gle);
+         bson_destroy (&diff);
+         RETURN (true);
+      }
+
+      if (diff.len < new_doc->len) {
+         update = &diff;
+      }
+   }
+
+   bson_append_iter (&selector, NULL, 0, &old_id);
+
+   ret = mongoc_collection_update (collection,
+                                   MONGOC_UPDATE_NONE,
+                                   &selector,
+                                   update,
+                                   write_concern,
+                                   error);
+
+   bson_destroy (&selector);
+   bson_destroy (&diff);
 
    RETURN (ret);
 }
@@ -1672,7 +2708,7 @@ mongoc_collection_save (mongoc_collection_t *collection,
    }
 
    /* this document will be inserted, validate same as for inserts */
-   if (!_mongoc_validate_new_document (document, error)) {
+   if (!_mongoc_validate_new_document (document, collection->vflags, error)) {
       return false;
    }
 
@@ -1962,6 +2998,95 @@ mongoc_collection_set_write_concern (
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_get_validate_flags --
+ *
+ *       Fetches how documents inserted or used as replacements through
+ *       this collection are validated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_validate_flags_t
+mongoc_collection_get_validate_flags (const mongoc_collection_t *collection)
+{
+   BSON_ASSERT (collection);
+
+   return collection->vflags;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_set_validate_flags --
+ *
+ *       Sets how documents inserted or used as replacements through this
+ *       collection, or bulk operations created from it, are validated
+ *       before they are sent. BSON_VALIDATE_NONE skips validation.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_collection_set_validate_flags (mongoc_collection_t *collection,
+                                      bson_validate_flags_t vflags)
+{
+   BSON_ASSERT (collection);
+
+   collection->vflags = vflags;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_enable_find_cache --
+ *
+ *       Cache the results of mongoc_collection_find_with_opts on this
+ *       collection with @opts, replacing any earlier cache.
+ *
+ * Returns:
+ *       true if successful, otherwise false and @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_collection_enable_find_cache (mongoc_collection_t *collection,
+                                     const bson_t *opts,
+                                     bson_error_t *error)
+{
+   mongoc_find_cache_t *cache;
+
+   BSON_ASSERT (collection);
+
+   cache = _mongoc_find_cache_new (collection, opts, error);
+   if (!cache) {
+      return false;
+   }
+
+   mongoc_collection_disable_find_cache (collection);
+   collection->find_cache = cache;
+
+   return true;
+}
+
+
+void
+mongoc_collection_disable_find_cache (mongoc_collection_t *collection)
+{
+   BSON_ASSERT (collection);
+
+   if (collection->find_cache) {
+      _mongoc_find_cache_destroy (collection->find_cache);
+      collection->find_cache = NULL;
+   }
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -2259,6 +3384,8 @@ mongoc_collection_create_bulk_operation (
    const mongoc_write_concern_t *write_concern)
 {
    mongoc_bulk_write_flags_t write_flags = MONGOC_BULK_WRITE_FLAGS_INIT;
+   mongoc_bulk_operation_t *bulk;
+
    BSON_ASSERT (collection);
 
    if (!write_concern) {
@@ -2267,14 +3394,136 @@ mongoc_collection_create_bulk_operation (
 
    write_flags.ordered = ordered;
 
-   return _mongoc_bulk_operation_new (collection->client,
+   bulk = _mongoc_bulk_operation_new (collection->client,
                                       collection->db,
                                       collection->collection,
                                       NULL /* session */,
                                       write_flags,
                                       write_concern);
+   bulk->vflags = collection->vflags;
+
+   return bulk;
+}
+
+/* build the findAndModify command in @command, and assemble it in @parts
+ * for @server_stream. @parts is initialized, even on error */
+static bool
+_mongoc_collection_find_and_modify_assemble (
+   mongoc_collection_t *collection,
+   const bson_t *query,
+   const mongoc_find_and_modify_opts_t *opts,
+   mongoc_server_stream_t *server_stream,
+   bson_t *command,
+   mongoc_cmd_parts_t *parts,
+   bson_error_t *error)
+{
+   bson_iter_t iter;
+
+   mongoc_cmd_parts_init (parts, collection->db, MONGOC_QUERY_NONE, command);
+   parts->is_write_command = true;
+
+   BSON_APPEND_UTF8 (
+      command, "findAndModify", mongoc_collection_get_name (collection));
+   BSON_APPEND_DOCUMENT (command, "query", query);
+
+   if (opts->sort) {
+      BSON_APPEND_DOCUMENT (command, "sort", opts->sort);
+   }
+
+   if (opts->update) {
+      BSON_APPEND_DOCUMENT (command, "update", opts->update);
+   }
+
+   if (opts->fields) {
+      BSON_APPEND_DOCUMENT (command, "fields", opts->fields);
+   }
+
+   if (opts->flags & MONGOC_FIND_AND_MODIFY_REMOVE) {
+      BSON_APPEND_BOOL (command, "remove", true);
+   }
+
+   if (opts->flags & MONGOC_FIND_AND_MODIFY_UPSERT) {
+      BSON_APPEND_BOOL (command, "upsert", true);
+   }
+
+   if (opts->flags & MONGOC_FIND_AND_MODIFY_RETURN_NEW) {
+      BSON_APPEND_BOOL (command, "new", true);
+   }
+
+   if (opts->bypass_document_validation !=
+       MONGOC_BYPASS_DOCUMENT_VALIDATION_DEFAULT) {
+      BSON_APPEND_BOOL (command,
+                        "bypassDocumentValidation",
+                        !!opts->bypass_document_validation);
+   }
+
+   if (opts->max_time_ms > 0) {
+      BSON_APPEND_INT32 (command, "maxTimeMS", opts->max_time_ms);
+   }
+
+   if (!bson_has_field (&opts->extra, "writeConcern")) {
+      if (server_stream->sd->max_wire_version >=
+          WIRE_VERSION_FAM_WRITE_CONCERN) {
+         if (!mongoc_write_concern_is_valid (collection->write_concern)) {
+            bson_set_error (error,
+                            MONGOC_ERROR_COMMAND,
+                            MONGOC_ERROR_COMMAND_INVALID_ARG,
+                            "The write concern is invalid.");
+            return false;
+         }
+
+         if (mongoc_write_concern_is_acknowledged (collection->write_concern)) {
+            _BSON_APPEND_WRITE_CONCERN (command, collection->write_concern);
+         }
+      }
+   }
+
+   if (bson_iter_init (&iter, &opts->extra)) {
+      if (!mongoc_cmd_parts_append_opts (
+             parts, &iter, server_stream->sd->max_wire_version, error)) {
+         return false;
+      }
+   }
+
+   parts->assembled.operation_id = ++collection->client->cluster.operation_id;
+
+   return mongoc_cmd_parts_assemble (parts, server_stream, error);
+}
+
+
+/* if the findAndModify @reply has a writeConcernError, set @error from it */
+static bool
+_mongoc_collection_find_and_modify_wc_error (const bson_t *reply,
+                                             bson_error_t *error)
+{
+   bson_iter_t iter;
+   bson_iter_t inner;
+   const char *errmsg = NULL;
+   int32_t code = 0;
+
+   if (!bson_iter_init_find (&iter, reply, "writeConcernError") ||
+       !BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      return false;
+   }
+
+   bson_iter_recurse (&iter, &inner);
+   while (bson_iter_next (&inner)) {
+      if (BSON_ITER_IS_KEY (&inner, "code")) {
+         code = bson_iter_int32 (&inner);
+      } else if (BSON_ITER_IS_KEY (&inner, "errmsg")) {
+         errmsg = bson_iter_utf8 (&inner, NULL);
+      }
+   }
+   bson_set_error (error,
+                   MONGOC_ERROR_WRITE_CONCERN,
+                   code,
+                   "Write Concern error: %s",
+                   errmsg);
+
+   return true;
 }
 
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -2308,12 +3557,9 @@ mongoc_collection_find_and_modify_with_opts (
    mongoc_cluster_t *cluster;
    mongoc_cmd_parts_t parts;
    mongoc_server_stream_t *server_stream;
-   bson_iter_t iter;
-   bson_iter_t inner;
-   const char *name;
    bson_t reply_local;
    bson_t *reply_ptr;
-   bool ret;
+   bool ret = false;
    bson_t command = BSON_INITIALIZER;
 
    ENTRY;
@@ -2330,120 +3576,196 @@ mongoc_collection_find_and_modify_with_opts (
       RETURN (false);
    }
 
-   name = mongoc_collection_get_name (collection);
-   BSON_APPEND_UTF8 (&command, "findAndModify", name);
-   BSON_APPEND_DOCUMENT (&command, "query", query);
-
-   if (opts->sort) {
-      BSON_APPEND_DOCUMENT (&command, "sort", opts->sort);
+   if (!_mongoc_collection_find_and_modify_assemble (
+          collection, query, opts, server_stream, &command, &parts, error)) {
+      GOTO (done);
    }
 
-   if (opts->update) {
-      BSON_APPEND_DOCUMENT (&command, "update", opts->update);
-   }
+   ret = mongoc_cluster_run_command_monitored (
+      cluster, &parts.assembled, reply_ptr, error);
 
-   if (opts->fields) {
-      BSON_APPEND_DOCUMENT (&command, "fields", opts->fields);
+   if (_mongoc_collection_find_and_modify_wc_error (reply_ptr, error)) {
+      ret = false;
    }
 
-   if (opts->flags & MONGOC_FIND_AND_MODIFY_REMOVE) {
-      BSON_APPEND_BOOL (&command, "remove", true);
+done:
+   if (reply_ptr == &reply_local) {
+      bson_destroy (reply_ptr);
    }
 
-   if (opts->flags & MONGOC_FIND_AND_MODIFY_UPSERT) {
-      BSON_APPEND_BOOL (&command, "upsert", true);
+   mongoc_cmd_parts_cleanup (&parts);
+   bson_destroy (&command);
+   mongoc_server_stream_cleanup (server_stream);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_find_and_modify_pipelined --
+ *
+ *       Run @n findAndModify commands described by @query and @opts on
+ *       one connection, to claim up to @n documents, such as jobs from
+ *       a queue. With OP_MSG all commands are sent before any reply is
+ *       read. Otherwise they run one at a time, until one finds nothing.
+ *
+ *       @docs is an array of @n bson_t, all initialized on return. The
+ *       first @n_docs hold the documents found, even if false is
+ *       returned: some commands may have claimed a document before
+ *       another failed.
+ *
+ * Returns:
+ *       true if every command succeeded; false on failure.
+ *
+ * Side effects:
+ *       @docs and @n_docs are set.
+ *       error is set if false is returned.
+ *
+ *--------------------------------------------------------------------------
+ */
+bool
+mongoc_collection_find_and_modify_pipelined (
+   mongoc_collection_t *collection,
+   const bson_t *query,
+   const mongoc_find_and_modify_opts_t *opts,
+   uint32_t n,
+   bson_t *docs,
+   uint32_t *n_docs,
+   bson_error_t *error)
+{
+   mongoc_cluster_t *cluster;
+   mongoc_server_stream_t *server_stream = NULL;
+   mongoc_cmd_parts_t *parts = NULL;
+   mongoc_cmd_t **cmds = NULL;
+   bson_t *commands = NULL;
+   bson_t *replies = NULL;
+   bson_error_t *errors = NULL;
+   bson_iter_t iter;
+   const uint8_t *data;
+   uint32_t len;
+   bson_t value;
+   uint32_t n_parts = 0;
+   uint32_t n_ran = 0;
+   uint32_t i;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (collection);
+   BSON_ASSERT (query);
+   BSON_ASSERT (opts);
+   BSON_ASSERT (docs || !n);
+   BSON_ASSERT (n_docs);
+
+   *n_docs = 0;
+   for (i = 0; i < n; i++) {
+      bson_init (&docs[i]);
    }
 
-   if (opts->flags & MONGOC_FIND_AND_MODIFY_RETURN_NEW) {
-      BSON_APPEND_BOOL (&command, "new", true);
+   if (!opts->update && !(opts->flags & MONGOC_FIND_AND_MODIFY_REMOVE)) {
+      /* each command would find the same document */
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Pipelined findAndModify must update or remove");
+      RETURN (false);
    }
 
-   if (opts->bypass_document_validation !=
-       MONGOC_BYPASS_DOCUMENT_VALIDATION_DEFAULT) {
-      BSON_APPEND_BOOL (&command,
-                        "bypassDocumentValidation",
-                        !!opts->bypass_document_validation);
+   if (!n) {
+      RETURN (true);
    }
 
-   if (opts->max_time_ms > 0) {
-      BSON_APPEND_INT32 (&command, "maxTimeMS", opts->max_time_ms);
+   cluster = &collection->client->cluster;
+   server_stream = mongoc_cluster_stream_for_writes (cluster, error);
+   if (!server_stream) {
+      RETURN (false);
    }
 
-   if (!bson_has_field (&opts->extra, "writeConcern")) {
-      if (server_stream->sd->max_wire_version >=
-          WIRE_VERSION_FAM_WRITE_CONCERN) {
-         if (!mongoc_write_concern_is_valid (collection->write_concern)) {
-            bson_set_error (error,
-                            MONGOC_ERROR_COMMAND,
-                            MONGOC_ERROR_COMMAND_INVALID_ARG,
-                            "The write concern is invalid.");
-            bson_destroy (&command);
-            mongoc_server_stream_cleanup (server_stream);
-            RETURN (false);
-         }
+   parts = (mongoc_cmd_parts_t *) bson_malloc0 (n * sizeof *parts);
+   cmds = (mongoc_cmd_t **) bson_malloc0 (n * sizeof *cmds);
+   commands = (bson_t *) bson_malloc0 (n * sizeof *commands);
+   replies = (bson_t *) bson_malloc0 (n * sizeof *replies);
+   errors = (bson_error_t *) bson_malloc0 (n * sizeof *errors);
+
+   for (n_parts = 0; n_parts < n;) {
+      i = n_parts++;
+      bson_init (&commands[i]);
+      if (!_mongoc_collection_find_and_modify_assemble (collection,
+                                                        query,
+                                                        opts,
+                                                        server_stream,
+                                                        &commands[i],
+                                                        &parts[i],
+                                                        error)) {
+         GOTO (done);
+      }
 
-         if (mongoc_write_concern_is_acknowledged (collection->write_concern)) {
-            _BSON_APPEND_WRITE_CONCERN (&command, collection->write_concern);
+      cmds[i] = &parts[i].assembled;
+   }
+
+   if (server_stream->sd->max_wire_version >= WIRE_VERSION_OP_MSG) {
+      _mongoc_cluster_run_opmsg_pipelined (cluster, cmds, n, replies, errors);
+      n_ran = n;
+   } else {
+      /* no OP_MSG, run the commands until the query matches nothing */
+      while (n_ran < n) {
+         i = n_ran++;
+         if (!mongoc_cluster_run_command_monitored (
+                cluster, cmds[i], &replies[i], &errors[i]) ||
+             !bson_iter_init_find (&iter, &replies[i], "value") ||
+             !BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+            break;
          }
       }
    }
 
-   mongoc_cmd_parts_init (&parts, collection->db, MONGOC_QUERY_NONE, &command);
-   parts.is_write_command = true;
+   ret = true;
 
-   if (bson_iter_init (&iter, &opts->extra)) {
-      bool ok = mongoc_cmd_parts_append_opts (
-         &parts, &iter, server_stream->sd->max_wire_version, error);
-      if (!ok) {
-         bson_destroy (&command);
-         mongoc_server_stream_cleanup (server_stream);
-         RETURN (false);
+   /* keep every document claimed, and report the first failure */
+   for (i = 0; i < n_ran; i++) {
+      if (bson_iter_init_find (&iter, &replies[i], "value") &&
+          BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         bson_iter_document (&iter, &len, &data);
+         bson_init_static (&value, data, len);
+         bson_concat (&docs[(*n_docs)++], &value);
       }
-   }
-
-   parts.assembled.operation_id = ++cluster->operation_id;
-   if (!mongoc_cmd_parts_assemble (&parts, server_stream, error)) {
-      bson_init (reply_ptr);
-      bson_destroy (&command);
-      mongoc_cmd_parts_cleanup (&parts);
-      mongoc_server_stream_cleanup (server_stream);
-      RETURN (false);
-   }
 
-   ret = mongoc_cluster_run_command_monitored (
-      cluster, &parts.assembled, reply_ptr, error);
+      if (!errors[i].code) {
+         _mongoc_collection_find_and_modify_wc_error (&replies[i], &errors[i]);
+      }
 
-   if (bson_iter_init_find (&iter, reply_ptr, "writeConcernError") &&
-       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
-      const char *errmsg = NULL;
-      int32_t code = 0;
-
-      bson_iter_recurse (&iter, &inner);
-      while (bson_iter_next (&inner)) {
-         if (BSON_ITER_IS_KEY (&inner, "code")) {
-            code = bson_iter_int32 (&inner);
-         } else if (BSON_ITER_IS_KEY (&inner, "errmsg")) {
-            errmsg = bson_iter_utf8 (&inner, NULL);
+      if (errors[i].code && ret) {
+         if (error) {
+            memcpy (error, &errors[i], sizeof (bson_error_t));
          }
+
+         ret = false;
       }
-      bson_set_error (error,
-                      MONGOC_ERROR_WRITE_CONCERN,
-                      code,
-                      "Write Concern error: %s",
-                      errmsg);
-      ret = false;
    }
-   if (reply_ptr == &reply_local) {
-      bson_destroy (reply_ptr);
+
+done:
+   for (i = 0; i < n_ran; i++) {
+      bson_destroy (&replies[i]);
+   }
+
+   for (i = 0; i < n_parts; i++) {
+      mongoc_cmd_parts_cleanup (&parts[i]);
+      bson_destroy (&commands[i]);
    }
 
-   mongoc_cmd_parts_cleanup (&parts);
-   bson_destroy (&command);
    mongoc_server_stream_cleanup (server_stream);
+   bson_free (errors);
+   bson_free (replies);
+   bson_free (commands);
+   bson_free (cmds);
+   bson_free (parts);
 
    RETURN (ret);
 }
 
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -104,6 +104,13 @@ mongoc_collection_count_with_opts (mongoc_collection_t *collection,
                                    const bson_t *opts,
                                    const mongoc_read_prefs_t *read_prefs,
                                    bson_error_t *error);
+MONGOC_EXPORT (int64_t)
+mongoc_collection_estimated_document_count (
+   mongoc_collection_t *collection,
+   const bson_t *opts,
+   const mongoc_read_prefs_t *read_prefs,
+   bson_t *reply,
+   bson_error_t *error);
 MONGOC_EXPORT (bool)
 mongoc_collection_drop (mongoc_collection_t *collection, bson_error_t *error);
 MONGOC_EXPORT (bool)
@@ -133,6 +140,13 @@ mongoc_collection_create_index_with_opts (mongoc_collection_t *collection,
                                           bson_error_t *error)
    BSON_GNUC_DEPRECATED;
 MONGOC_EXPORT (bool)
+mongoc_collection_create_indexes_with_opts (mongoc_collection_t *collection,
+                                            const bson_t *const *models,
+                                            size_t n_models,
+                                            const bson_t *opts,
+                                            bson_t *reply,
+                                            bson_error_t *error);
+MONGOC_EXPORT (bool)
 mongoc_collection_ensure_index (mongoc_collection_t *collection,
                                 const bson_t *keys,
                                 const mongoc_index_opt_t *opt,
@@ -158,6 +172,29 @@ mongoc_collection_find_with_opts (mongoc_collection_t *collection,
                                   const mongoc_read_prefs_t *read_prefs)
    BSON_GNUC_WARN_UNUSED_RESULT;
 MONGOC_EXPORT (bool)
+mongoc_collection_find_one_with_opts (mongoc_collection_t *collection,
+                                      const bson_t *filter,
+                                      const bson_t *opts,
+                                      const mongoc_read_prefs_t *read_prefs,
+                                      bson_t *doc,
+                                      bson_error_t *error);
+MONGOC_EXPORT (bool)
+mongoc_collection_aggregate_one (mongoc_collection_t *collection,
+                                 const bson_t *pipeline,
+                                 const bson_t *opts,
+                                 const mongoc_read_prefs_t *read_prefs,
+                                 bson_t *doc,
+                                 bson_error_t *error);
+MONGOC_EXPORT (bool)
+mongoc_collection_parallel_scan (mongoc_collection_t **collections,
+                                 uint32_t n,
+                                 const bson_t *filter,
+                                 const bson_t *opts,
+                                 const mongoc_read_prefs_t *read_prefs,
+                                 mongoc_cursor_t **cursors,
+                                 uint32_t *n_cursors,
+                                 bson_error_t *error);
+MONGOC_EXPORT (bool)
 mongoc_collection_insert (mongoc_collection_t *collection,
                           mongoc_insert_flags_t flags,
                           const bson_t *document,
@@ -179,6 +216,12 @@ mongoc_collection_update (mongoc_collection_t *collection,
                           const mongoc_write_concern_t *write_concern,
                           bson_error_t *error);
 MONGOC_EXPORT (bool)
+mongoc_collection_update_diff (mongoc_collection_t *collection,
+                               const bson_t *old_doc,
+                               const bson_t *new_doc,
+                               const mongoc_write_concern_t *write_concern,
+                               bson_error_t *error);
+MONGOC_EXPORT (bool)
 mongoc_collection_delete (mongoc_collection_t *collection,
                           mongoc_delete_flags_t flags,
                           const bson_t *selector,
@@ -219,6 +262,15 @@ mongoc_collection_find_and_modify_with_opts (
    bson_t *reply,
    bson_error_t *error);
 MONGOC_EXPORT (bool)
+mongoc_collection_find_and_modify_pipelined (
+   mongoc_collection_t *collection,
+   const bson_t *query,
+   const mongoc_find_and_modify_opts_t *opts,
+   uint32_t n,
+   bson_t *docs,
+   uint32_t *n_docs,
+   bson_error_t *error);
+MONGOC_EXPORT (bool)
 mongoc_collection_find_and_modify (mongoc_collection_t *collection,
                                    const bson_t *query,
                                    const bson_t *sort,
@@ -255,6 +307,17 @@ MONGOC_EXPORT (void)
 mongoc_collection_set_write_concern (
    mongoc_collection_t *collection,
    const mongoc_write_concern_t *write_concern);
+MONGOC_EXPORT (bson_validate_flags_t)
+mongoc_collection_get_validate_flags (const mongoc_collection_t *collection);
+MONGOC_EXPORT (void)
+mongoc_collection_set_validate_flags (mongoc_collection_t *collection,
+                                      bson_validate_flags_t vflags);
+MONGOC_EXPORT (bool)
+mongoc_collection_enable_find_cache (mongoc_collection_t *collection,
+                                     const bson_t *opts,
+                                     bson_error_t *error);
+MONGOC_EXPORT (void)
+mongoc_collection_disable_find_cache (mongoc_collection_t *collection);
 MONGOC_EXPORT (const char *)
 mongoc_collection_get_name (mongoc_collection_t *collection);
 MONGOC_EXPORT (const bson_t *)
@@ -0,0 +1,526 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-columns.h"
+#include "mongoc-array-private.h"
+#include "mongoc-error.h"
+#include "mongoc-trace-private.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "columns"
+
+
+/* one component of a column's path. The paths of all columns make a tree,
+ * so each document is walked once however many columns there are */
+typedef struct {
+   char *key;
+   int32_t column; /* the column whose path ends here, or -1 */
+   int32_t first_child;
+   int32_t next_sibling;
+   uint32_t n_children;
+} mongoc_columns_node_t;
+
+
+typedef struct {
+   mongoc_column_t pub;
+   bson_type_t type;
+   size_t width; /* bytes per value, or 0 for bit-packed or UTF-8 */
+   uint8_t *values;
+   size_t values_len;
+   size_t values_alloc;
+   uint8_t *validity;
+   size_t validity_alloc;
+   int32_t *offsets;
+   size_t offsets_alloc;
+} mongoc_columns_column_t;
+
+
+struct _mongoc_columns_t {
+   mongoc_array_t nodes;   /* mongoc_columns_node_t */
+   mongoc_array_t columns; /* mongoc_columns_column_t */
+   int32_t first_root;
+   uint32_t n_roots;
+};
+
+
+#define NODE(c, i) \
+   (&_mongoc_array_index (&(c)->nodes, mongoc_columns_node_t, i))
+#define COLUMN(c, i) \
+   (&_mongoc_array_index (&(c)->columns, mongoc_columns_column_t, i))
+
+
+mongoc_columns_t *
+mongoc_columns_new (void)
+{
+   mongoc_columns_t *columns;
+
+   columns = (mongoc_columns_t *) bson_malloc0 (sizeof *columns);
+   _mongoc_array_init (&columns->nodes, sizeof (mongoc_columns_node_t));
+   _mongoc_array_init (&columns->columns, sizeof (mongoc_columns_column_t));
+   columns->first_root = -1;
+
+   return columns;
+}
+
+
+void
+mongoc_columns_destroy (mongoc_columns_t *columns)
+{
+   mongoc_columns_column_t *column;
+   size_t i;
+
+   if (!columns) {
+      return;
+   }
+
+   for (i = 0; i < columns->nodes.len; i++) {
+      bson_free (NODE (columns, i)->key);
+   }
+
+   for (i = 0; i < columns->columns.len; i++) {
+      column = COLUMN (columns, i);
+      bson_free (column->values);
+      bson_free (column->validity);
+      bson_free (column->offsets);
+   }
+
+   _mongoc_array_destroy (&columns->nodes);
+   _mongoc_array_destroy (&columns->columns);
+   bson_free (columns);
+}
+
+
+/* the child of @parent (-1 for the root) named @key, created if needed */
+static int32_t
+_mongoc_columns_child (mongoc_columns_t *columns,
+                       int32_t parent,
+                       const char *key,
+                       size_t key_len)
+{
+   mongoc_columns_node_t node;
+   int32_t *first;
+   uint32_t *n_children;
+   int32_t i;
+
+   if (parent < 0) {
+      first = &columns->first_root;
+      n_children = &columns->n_roots;
+   } else {
+      first = &NODE (columns, parent)->first_child;
+      n_children = &NODE (columns, parent)->n_children;
+   }
+
+   for (i = *first; i >= 0; i = NODE (columns, i)->next_sibling) {
+      if (strlen (NODE (columns, i)->key) == key_len &&
+          !memcmp (NODE (columns, i)->key, key, key_len)) {
+         return i;
+      }
+   }
+
+   node.key = bson_strndup (key, key_len);
+   node.column = -1;
+   node.first_child = -1;
+   node.next_sibling = *first;
+   node.n_children = 0;
+   i = (int32_t) columns->nodes.len;
+
+   /* update the parent first, appending may move it */
+   (*n_children)++;
+   *first = i;
+   _mongoc_array_append_val (&columns->nodes, node);
+
+   return i;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_columns_add --
+ *
+ *       Add a column of the values at @path, a dotted path like "a.b",
+ *       decoded as @type. Columns are numbered from 0 in the order they
+ *       are added.
+ *
+ * Returns:
+ *       True if the column was added. False and fills out @error if
+ *       @type isn't supported or @path is empty or already added.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_columns_add (mongoc_columns_t *columns,
+                    const char *path,
+                    bson_type_t type,
+                    bson_error_t *error)
+{
+   mongoc_columns_column_t column = {{0}};
+   const char *key;
+   const char *dot;
+   int32_t node = -1;
+
+   BSON_ASSERT (columns);
+   BSON_ASSERT (path);
+
+   switch (type) {
+   case BSON_TYPE_INT32:
+      column.width = sizeof (int32_t);
+      break;
+   case BSON_TYPE_INT64:
+   case BSON_TYPE_DATE_TIME:
+      column.width = sizeof (int64_t);
+      break;
+   case BSON_TYPE_DOUBLE:
+      column.width = sizeof (double);
+      break;
+   case BSON_TYPE_BOOL:
+   case BSON_TYPE_UTF8:
+      break;
+   default:
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Cannot decode column \"%s\" as BSON type 0x%02x",
+                      path,
+                      (int) type);
+      return false;
+   }
+
+   /* no empty components */
+   if (!*path || path[0] == '.' || path[strlen (path) - 1] == '.' ||
+       strstr (path, "..")) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Invalid column path \"%s\"",
+                      path);
+      return false;
+   }
+
+   for (key = path; (dot = strchr (key, '.')); key = dot + 1) {
+      node =
+         _mongoc_columns_child (columns, node, key, (size_t) (dot - key));
+   }
+
+   node = _mongoc_columns_child (columns, node, key, strlen (key));
+
+   if (NODE (columns, node)->column >= 0) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Column \"%s\" was already added",
+                      path);
+      return false;
+   }
+
+   NODE (columns, node)->column = (int32_t) columns->columns.len;
+   column.type = type;
+   _mongoc_array_append_val (&columns->columns, column);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_columns_get --
+ *
+ *       The @i'th column decoded by the last call to
+ *       mongoc_cursor_next_columns. Good until the next call to
+ *       mongoc_columns_add, mongoc_cursor_next_columns, or
+ *       mongoc_columns_destroy.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const mongoc_column_t *
+mongoc_columns_get (const mongoc_columns_t *columns, size_t i)
+{
+   BSON_ASSERT (columns);
+   BSON_ASSERT (i < columns->columns.len);
+
+   return &COLUMN (columns, i)->pub;
+}
+
+
+static void
+_mongoc_columns_grow (uint8_t **buf, size_t *alloc, size_t size)
+{
+   if (size > *alloc) {
+      *alloc = bson_next_power_of_two (size);
+      *buf = (uint8_t *) bson_realloc (*buf, *alloc);
+   }
+}
+
+
+/* size and zero @column's buffers for @n_rows */
+static void
+_mongoc_columns_reset (mongoc_columns_column_t *column, uint32_t n_rows)
+{
+   size_t bitmap_len = ((size_t) n_rows + 7) / 8;
+   size_t len;
+
+   /* allocate at least a byte, so the pointers aren't NULL */
+   _mongoc_columns_grow (&column->validity,
+                         &column->validity_alloc,
+                         BSON_MAX (bitmap_len, (size_t) 1));
+   memset (column->validity, 0, bitmap_len);
+
+   if (column->type == BSON_TYPE_UTF8) {
+      len = ((size_t) n_rows + 1) * sizeof (int32_t);
+      _mongoc_columns_grow (
+         (uint8_t **) &column->offsets, &column->offsets_alloc, len);
+      column->offsets[0] = 0;
+      column->values_len = 0;
+      _mongoc_columns_grow (&column->values, &column->values_alloc, 1);
+   } else {
+      len = column->width ? n_rows * column->width : bitmap_len;
+      _mongoc_columns_grow (
+         &column->values, &column->values_alloc, BSON_MAX (len, (size_t) 1));
+      memset (column->values, 0, len);
+   }
+
+   column->pub.null_count = 0;
+}
+
+
+/* store @iter's value in @row of @column if it's of a matching type */
+static void
+_mongoc_columns_set (mongoc_columns_column_t *column,
+                     uint32_t row,
+                     const bson_iter_t *iter)
+{
+   uint8_t *dst;
+   const char *str;
+   uint32_t len;
+   int32_t i32;
+   int64_t i64;
+   double d;
+
+   if (column->validity[row / 8] & (1u << (row % 8))) {
+      /* a duplicate key, the first one wins */
+      return;
+   }
+
+   dst = column->values + row * column->width;
+
+   switch (column->type) {
+   case BSON_TYPE_INT32:
+      if (!BSON_ITER_HOLDS_INT32 (iter)) {
+         return;
+      }
+
+      i32 = bson_iter_int32 (iter);
+      memcpy (dst, &i32, sizeof i32);
+      break;
+   case BSON_TYPE_INT64:
+      /* int32 widens without loss */
+      if (!BSON_ITER_HOLDS_INT32 (iter) && !BSON_ITER_HOLDS_INT64 (iter)) {
+         return;
+      }
+
+      i64 = bson_iter_as_int64 (iter);
+      memcpy (dst, &i64, sizeof i64);
+      break;
+   case BSON_TYPE_DATE_TIME:
+      if (!BSON_ITER_HOLDS_DATE_TIME (iter)) {
+         return;
+      }
+
+      i64 = bson_iter_date_time (iter);
+      memcpy (dst, &i64, sizeof i64);
+      break;
+   case BSON_TYPE_DOUBLE:
+      if (!BSON_ITER_HOLDS_NUMBER (iter)) {
+         return;
+      }
+
+      d = BSON_ITER_HOLDS_DOUBLE (iter) ? bson_iter_double (iter)
+                                        : (double) bson_iter_as_int64 (iter);
+      memcpy (dst, &d, sizeof d);
+      break;
+   case BSON_TYPE_BOOL:
+      if (!BSON_ITER_HOLDS_BOOL (iter)) {
+         return;
+      }
+
+      if (bson_iter_bool (iter)) {
+         column->values[row / 8] |= (uint8_t) (1u << (row % 8));
+      }
+
+      break;
+   case BSON_TYPE_UTF8:
+      if (!BSON_ITER_HOLDS_UTF8 (iter)) {
+         return;
+      }
+
+      /* rows are filled in order, so this row's string goes last */
+      str = bson_iter_utf8 (iter, &len);
+      _mongoc_columns_grow (
+         &column->values, &column->values_alloc, column->values_len + len);
+      memcpy (column->values + column->values_len, str, len);
+      column->values_len += len;
+      break;
+   default:
+      BSON_ASSERT (false);
+      return;
+   }
+
+   column->validity[row / 8] |= (uint8_t) (1u << (row % 8));
+}
+
+
+/* decode the fields of @iter's document that are under @first, the first
+ * of @n_nodes sibling nodes, into @row. Stops once each node was found, so
+ * a duplicate key may hide a later field */
+static void
+_mongoc_columns_walk (mongoc_columns_t *columns,
+                      bson_iter_t *iter,
+                      int32_t first,
+                      uint32_t n_nodes,
+                      uint32_t row)
+{
+   mongoc_columns_node_t *node;
+   bson_iter_t child;
+   const char *key;
+   uint32_t n_found = 0;
+   int32_t i;
+
+   while (n_found < n_nodes && bson_iter_next (iter)) {
+      key = bson_iter_key (iter);
+
+      for (i = first; i >= 0; i = node->next_sibling) {
+         node = NODE (columns, i);
+         if (!strcmp (node->key, key)) {
+            break;
+         }
+      }
+
+      if (i < 0) {
+         continue;
+      }
+
+      n_found++;
+
+      if (node->column >= 0) {
+         _mongoc_columns_set (COLUMN (columns, node->column), row, iter);
+      }
+
+      if (node->first_child >= 0 &&
+          (BSON_ITER_HOLDS_DOCUMENT (iter) || BSON_ITER_HOLDS_ARRAY (iter)) &&
+          bson_iter_recurse (iter, &child)) {
+         _mongoc_columns_walk (
+            columns, &child, node->first_child, node->n_children, row);
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_next_columns --
+ *
+ *       Read the cursor's next batch, like mongoc_cursor_next_batch, and
+ *       decode each of @columns from all its documents at once. Each
+ *       document is walked once, whatever the number of columns.
+ *
+ * Returns:
+ *       True and sets @n_rows to the number of documents if a batch was
+ *       read. False at the end of the cursor or on error: check
+ *       mongoc_cursor_error.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cursor_next_columns (mongoc_cursor_t *cursor,
+                            mongoc_columns_t *columns,
+                            uint32_t *n_rows)
+{
+   mongoc_columns_column_t *column;
+   const uint8_t *data;
+   size_t data_len;
+   const uint32_t *offsets;
+   uint32_t n_docs;
+   uint32_t row;
+   int32_t len;
+   size_t i;
+   bson_t doc;
+   bson_iter_t iter;
+   bool has_utf8 = false;
+
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+   BSON_ASSERT (columns);
+   BSON_ASSERT (n_rows);
+
+   *n_rows = 0;
+
+   if (!mongoc_cursor_next_batch (
+          cursor, &data, &data_len, &offsets, &n_docs)) {
+      RETURN (false);
+   }
+
+   for (i = 0; i < columns->columns.len; i++) {
+      column = COLUMN (columns, i);
+      _mongoc_columns_reset (column, n_docs);
+      has_utf8 = has_utf8 || column->type == BSON_TYPE_UTF8;
+   }
+
+   for (row = 0; row < n_docs; row++) {
+      memcpy (&len, data + offsets[row], sizeof len);
+      if (bson_init_static (&doc,
+                            data + offsets[row],
+                            (size_t) BSON_UINT32_FROM_LE (len)) &&
+          bson_iter_init (&iter, &doc)) {
+         _mongoc_columns_walk (
+            columns, &iter, columns->first_root, columns->n_roots, row);
+      }
+
+      if (has_utf8) {
+         for (i = 0; i < columns->columns.len; i++) {
+            column = COLUMN (columns, i);
+            if (column->type == BSON_TYPE_UTF8) {
+               column->offsets[row + 1] = (int32_t) column->values_len;
+            }
+         }
+      }
+   }
+
+   for (i = 0; i < columns->columns.len; i++) {
+      column = COLUMN (columns, i);
+      for (row = 0; row < n_docs; row++) {
+         if (!(column->validity[row / 8] & (1u << (row % 8)))) {
+            column->pub.null_count++;
+         }
+      }
+
+      column->pub.values = column->values;
+      column->pub.validity = column->validity;
+      column->pub.offsets =
+         column->type == BSON_TYPE_UTF8 ? column->offsets : NULL;
+   }
+
+   *n_rows = n_docs;
+
+   RETURN (true);
+}
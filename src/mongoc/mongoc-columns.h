@@ -0,0 +1,64 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_COLUMNS_H
+#define MONGOC_COLUMNS_H
+
+#if !defined(MONGOC_INSIDE) && !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-macros.h"
+#include "mongoc-cursor.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_columns_t mongoc_columns_t;
+
+
+typedef struct _mongoc_column_t {
+   const void *values;
+   const uint8_t *validity;
+   const int32_t *offsets;
+   uint32_t null_count;
+} mongoc_column_t;
+
+
+MONGOC_EXPORT (mongoc_columns_t *)
+mongoc_columns_new (void);
+MONGOC_EXPORT (void)
+mongoc_columns_destroy (mongoc_columns_t *columns);
+MONGOC_EXPORT (bool)
+mongoc_columns_add (mongoc_columns_t *columns,
+                    const char *path,
+                    bson_type_t type,
+                    bson_error_t *error);
+MONGOC_EXPORT (const mongoc_column_t *)
+mongoc_columns_get (const mongoc_columns_t *columns, size_t i);
+MONGOC_EXPORT (bool)
+mongoc_cursor_next_columns (mongoc_cursor_t *cursor,
+                            mongoc_columns_t *columns,
+                            uint32_t *n_rows);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_COLUMNS_H */
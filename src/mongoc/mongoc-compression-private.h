@@ -23,6 +23,9 @@
 #endif
 #include <bson.h>
 
+#include "mongoc-iovec.h"
+#include "mongoc-memory-budget-private.h"
+
 
 /* Compressor IDs */
 #define MONGOC_COMPRESSOR_NOOP_ID 0
@@ -34,10 +37,60 @@
 #define MONGOC_COMPRESSOR_ZLIB_ID 2
 #define MONGOC_COMPRESSOR_ZLIB_STR "zlib"
 
+#define MONGOC_COMPRESSOR_ZSTD_ID 3
+#define MONGOC_COMPRESSOR_ZSTD_STR "zstd"
+
+/* messages are compressed from their iovecs this many bytes at a time */
+#define MONGOC_COMPRESS_CHUNK_SIZE (64 * 1024)
+
+/* with compressionAdaptive, a command type is sampled this many times, and
+ * stops being compressed if it shrank to more than RATIO percent of its
+ * size. Every RETRY uncompressed messages it is sampled again. */
+#define MONGOC_COMPRESS_HISTORY_SAMPLES 16
+#define MONGOC_COMPRESS_HISTORY_RATIO 90
+#define MONGOC_COMPRESS_HISTORY_RETRY 1024
+#define MONGOC_COMPRESS_HISTORY_LEN 16
+
 
 BSON_BEGIN_DECLS
 
 
+/* reusable memory for mongoc_compress_iovec, so compressing a message
+ * needs no allocation once the buffers have grown to fit */
+typedef struct _mongoc_compress_scratch_t {
+   uint8_t *out; /* the last compressed message */
+   size_t out_len;
+   size_t out_allocated;
+   char *chunk;     /* snappy: a chunk of input, staged */
+   char *chunk_out; /* snappy: that chunk, compressed */
+   void *zstd;      /* zstd: a ZSTD_CStream, reset for each message */
+   void *zlib;      /* zlib: a deflating z_stream, reset for each message */
+   int32_t zlib_level; /* the level zlib was initialized with */
+   void *inflate;   /* zlib: an inflating z_stream or a libdeflate
+                     * decompressor, for replies */
+   mongoc_memory_budget_t *budget; /* charged for the buffers, or NULL */
+   size_t budgeted;
+} mongoc_compress_scratch_t;
+
+
+typedef struct _mongoc_compress_history_entry_t {
+   char name[32]; /* command name, or legacy opcode name */
+   int64_t in;    /* bytes in the current sample */
+   int64_t out;   /* those bytes, compressed */
+   uint32_t samples;
+   uint32_t skipped; /* messages sent uncompressed since disabled */
+   bool disabled;
+} mongoc_compress_history_entry_t;
+
+
+/* how well each command type has compressed, for compressionAdaptive.
+ * Types past the first MONGOC_COMPRESS_HISTORY_LEN are always compressed. */
+typedef struct _mongoc_compress_history_t {
+   mongoc_compress_history_entry_t entries[MONGOC_COMPRESS_HISTORY_LEN];
+   int n_entries;
+} mongoc_compress_history_t;
+
+
 size_t
 mongoc_compressor_max_compressed_length (int32_t compressor_id, size_t size);
 
@@ -57,6 +110,14 @@ mongoc_uncompress (int32_t compressor_id,
                    uint8_t *uncompressed,
                    size_t *uncompressed_size);
 
+bool
+mongoc_uncompress_scratch (int32_t compressor_id,
+                           const uint8_t *compressed,
+                           size_t compressed_len,
+                           uint8_t *uncompressed,
+                           size_t *uncompressed_size,
+                           mongoc_compress_scratch_t *scratch);
+
 bool
 mongoc_compress (int32_t compressor_id,
                  int32_t compression_level,
@@ -65,6 +126,37 @@ mongoc_compress (int32_t compressor_id,
                  char *compressed,
                  size_t *compressed_len);
 
+void
+mongoc_compress_scratch_init (mongoc_compress_scratch_t *scratch);
+
+void
+mongoc_compress_scratch_set_budget (mongoc_compress_scratch_t *scratch,
+                                    mongoc_memory_budget_t *budget);
+
+void
+mongoc_compress_scratch_destroy (mongoc_compress_scratch_t *scratch);
+
+bool
+mongoc_compress_iovec (int32_t compressor_id,
+                       int32_t compression_level,
+                       const mongoc_iovec_t *iov,
+                       size_t iovcnt,
+                       size_t skip,
+                       mongoc_compress_scratch_t *scratch);
+
+void
+mongoc_compress_history_init (mongoc_compress_history_t *history);
+
+bool
+mongoc_compress_history_wanted (mongoc_compress_history_t *history,
+                                const char *name);
+
+void
+mongoc_compress_history_record (mongoc_compress_history_t *history,
+                                const char *name,
+                                size_t in,
+                                size_t out);
+
 BSON_END_DECLS
 
 #endif
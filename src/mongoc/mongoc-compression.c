@@ -18,6 +18,7 @@
 #include "mongoc-config.h"
 
 #include "mongoc-compression-private.h"
+#include "mongoc-memory-private.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-util-private.h"
 
@@ -25,9 +26,196 @@
 #ifdef MONGOC_ENABLE_COMPRESSION_ZLIB
 #include <zlib.h>
 #endif
+#ifdef MONGOC_ENABLE_COMPRESSION_LIBDEFLATE
+#include <libdeflate.h>
+#endif
 #ifdef MONGOC_ENABLE_COMPRESSION_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+#include <zstd.h>
+#endif
+#endif
+
+#if defined(MONGOC_ENABLE_COMPRESSION_ZSTD) && !defined(ZSTD_CLEVEL_DEFAULT)
+#define ZSTD_CLEVEL_DEFAULT 3
+#endif
+
+
+#ifdef MONGOC_ENABLE_COMPRESSION_ZLIB
+/* zlib's window and hash tables are accounted for as compression memory */
+static voidpf
+_mongoc_zlib_alloc (voidpf opaque, uInt items, uInt size)
+{
+   return _mongoc_malloc_tagged (MONGOC_MEMORY_TAG_COMPRESSION,
+                                 (size_t) items * size);
+}
+
+
+static void
+_mongoc_zlib_free (voidpf opaque, voidpf address)
+{
+   _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION, address);
+}
+
+
+static z_stream *
+_mongoc_zlib_stream_new (void)
+{
+   z_stream *strm;
+
+   strm = (z_stream *) _mongoc_malloc0_tagged (MONGOC_MEMORY_TAG_COMPRESSION,
+                                               sizeof *strm);
+   strm->zalloc = _mongoc_zlib_alloc;
+   strm->zfree = _mongoc_zlib_free;
+
+   return strm;
+}
+
+
+/* the scratch's deflate stream, reset, or initialized the first time or
+ * when @level changes. deflateReset keeps the ~256 KB of state that
+ * deflateInit allocates. NULL on error */
+static z_stream *
+_mongoc_zlib_deflater (mongoc_compress_scratch_t *scratch, int32_t level)
+{
+   z_stream *strm = (z_stream *) scratch->zlib;
+
+   if (strm && scratch->zlib_level == level) {
+      return deflateReset (strm) == Z_OK ? strm : NULL;
+   }
+
+   if (strm) {
+      deflateEnd (strm);
+      _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION, strm);
+   }
+
+   strm = _mongoc_zlib_stream_new ();
+   if (deflateInit (strm, level) != Z_OK) {
+      _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION, strm);
+      scratch->zlib = NULL;
+      return NULL;
+   }
+
+   scratch->zlib = strm;
+   scratch->zlib_level = level;
+
+   return strm;
+}
+
+
+/* inflate a zlib reply into @uncompressed, reusing @scratch's inflater or
+ * decompressor if @scratch is not NULL */
+static bool
+_mongoc_uncompress_zlib (const uint8_t *compressed,
+                         size_t compressed_len,
+                         uint8_t *uncompressed,
+                         size_t *uncompressed_len,
+                         mongoc_compress_scratch_t *scratch)
+{
+#ifdef MONGOC_ENABLE_COMPRESSION_LIBDEFLATE
+   struct libdeflate_decompressor *d;
+   enum libdeflate_result r;
+
+   if (scratch) {
+      if (!scratch->inflate) {
+         scratch->inflate = libdeflate_alloc_decompressor ();
+      }
+
+      d = (struct libdeflate_decompressor *) scratch->inflate;
+   } else {
+      d = libdeflate_alloc_decompressor ();
+   }
+
+   if (!d) {
+      return false;
+   }
+
+   r = libdeflate_zlib_decompress (d,
+                                   compressed,
+                                   compressed_len,
+                                   uncompressed,
+                                   *uncompressed_len,
+                                   uncompressed_len);
+   if (!scratch) {
+      libdeflate_free_decompressor (d);
+   }
+
+   return r == LIBDEFLATE_SUCCESS;
+#else
+   z_stream *strm;
+   int r;
+
+   if (!scratch) {
+      return uncompress (uncompressed,
+                         (unsigned long *) uncompressed_len,
+                         compressed,
+                         compressed_len) == Z_OK;
+   }
+
+   strm = (z_stream *) scratch->inflate;
+   if (!strm) {
+      strm = _mongoc_zlib_stream_new ();
+      if (inflateInit (strm) != Z_OK) {
+         _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION, strm);
+         return false;
+      }
+
+      scratch->inflate = strm;
+   } else if (inflateReset (strm) != Z_OK) {
+      return false;
+   }
+
+   /* replies are at most 48 MB, well within uInt */
+   strm->next_in = (Bytef *) compressed;
+   strm->avail_in = (uInt) compressed_len;
+   strm->next_out = uncompressed;
+   strm->avail_out = (uInt) *uncompressed_len;
+
+   r = inflate (strm, Z_FINISH);
+   if (r != Z_STREAM_END) {
+      return false;
+   }
+
+   *uncompressed_len = (size_t) strm->total_out;
+
+   return true;
+#endif
+}
+
+
+#ifdef MONGOC_ENABLE_COMPRESSION_LIBDEFLATE
+/* one buffer at once with libdeflate. false if it failed or the output
+ * didn't fit, for zlib to try */
+static bool
+_mongoc_compress_libdeflate (int32_t compression_level,
+                             const char *uncompressed,
+                             size_t uncompressed_len,
+                             char *compressed,
+                             size_t *compressed_len)
+{
+   struct libdeflate_compressor *c;
+   size_t r;
+
+   /* zlib's default level is 6 */
+   c = libdeflate_alloc_compressor (
+      compression_level == -1 ? 6 : compression_level);
+   if (!c) {
+      return false;
+   }
+
+   r = libdeflate_zlib_compress (
+      c, uncompressed, uncompressed_len, compressed, *compressed_len);
+   libdeflate_free_compressor (c);
+
+   if (!r) {
+      return false;
+   }
+
+   *compressed_len = r;
+   return true;
+}
+#endif
 #endif
 
 size_t
@@ -49,6 +237,12 @@ mongoc_compressor_max_compressed_length (int32_t compressor_id, size_t len)
       break;
 #endif
 
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+   case MONGOC_COMPRESSOR_ZSTD_ID:
+      return ZSTD_compressBound (len);
+      break;
+#endif
+
    case MONGOC_COMPRESSOR_NOOP_ID:
       return len;
       break;
@@ -72,6 +266,12 @@ mongoc_compressor_supported (const char *compressor)
    }
 #endif
 
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+   if (!strcasecmp (compressor, MONGOC_COMPRESSOR_ZSTD_STR)) {
+      return true;
+   }
+#endif
+
    if (!strcasecmp (compressor, MONGOC_COMPRESSOR_NOOP_STR)) {
       return true;
    }
@@ -89,6 +289,9 @@ mongoc_compressor_id_to_name (int32_t compressor_id)
    case MONGOC_COMPRESSOR_ZLIB_ID:
       return MONGOC_COMPRESSOR_ZLIB_STR;
 
+   case MONGOC_COMPRESSOR_ZSTD_ID:
+      return MONGOC_COMPRESSOR_ZSTD_STR;
+
    case MONGOC_COMPRESSOR_NOOP_ID:
       return MONGOC_COMPRESSOR_NOOP_STR;
 
@@ -112,6 +315,12 @@ mongoc_compressor_name_to_id (const char *compressor)
    }
 #endif
 
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+   if (strcasecmp (MONGOC_COMPRESSOR_ZSTD_STR, compressor) == 0) {
+      return MONGOC_COMPRESSOR_ZSTD_ID;
+   }
+#endif
+
    if (strcasecmp (MONGOC_COMPRESSOR_NOOP_STR, compressor) == 0) {
       return MONGOC_COMPRESSOR_NOOP_ID;
    }
@@ -125,6 +334,24 @@ mongoc_uncompress (int32_t compressor_id,
                    size_t compressed_len,
                    uint8_t *uncompressed,
                    size_t *uncompressed_len)
+{
+   return mongoc_uncompress_scratch (compressor_id,
+                                     compressed,
+                                     compressed_len,
+                                     uncompressed,
+                                     uncompressed_len,
+                                     NULL);
+}
+
+
+/* like mongoc_uncompress, reusing @scratch's zlib state if not NULL */
+bool
+mongoc_uncompress_scratch (int32_t compressor_id,
+                           const uint8_t *compressed,
+                           size_t compressed_len,
+                           uint8_t *uncompressed,
+                           size_t *uncompressed_len,
+                           mongoc_compress_scratch_t *scratch)
 {
    TRACE ("Uncompressing with '%s' (%d)",
           mongoc_compressor_id_to_name (compressor_id),
@@ -149,16 +376,30 @@ mongoc_uncompress (int32_t compressor_id,
 
    case MONGOC_COMPRESSOR_ZLIB_ID: {
 #ifdef MONGOC_ENABLE_COMPRESSION_ZLIB
-      int ok;
+      return _mongoc_uncompress_zlib (
+         compressed, compressed_len, uncompressed, uncompressed_len, scratch);
+#else
+      MONGOC_WARNING ("Received zlib compressed opcode, but zlib "
+                      "compression is not compiled in");
+      return false;
+#endif
+      break;
+   }
 
-      ok = uncompress (uncompressed,
-                       (unsigned long *) uncompressed_len,
-                       compressed,
-                       compressed_len);
+   case MONGOC_COMPRESSOR_ZSTD_ID: {
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+      size_t r;
 
-      return ok == Z_OK;
+      r = ZSTD_decompress (
+         uncompressed, *uncompressed_len, compressed, compressed_len);
+      if (ZSTD_isError (r)) {
+         return false;
+      }
+
+      *uncompressed_len = r;
+      return true;
 #else
-      MONGOC_WARNING ("Received zlib compressed opcode, but zlib "
+      MONGOC_WARNING ("Received zstd compressed opcode, but zstd "
                       "compression is not compiled in");
       return false;
 #endif
@@ -203,6 +444,15 @@ mongoc_compress (int32_t compressor_id,
 
    case MONGOC_COMPRESSOR_ZLIB_ID:
 #ifdef MONGOC_ENABLE_COMPRESSION_ZLIB
+#ifdef MONGOC_ENABLE_COMPRESSION_LIBDEFLATE
+      if (_mongoc_compress_libdeflate (compression_level,
+                                       uncompressed,
+                                       uncompressed_len,
+                                       compressed,
+                                       compressed_len)) {
+         return true;
+      }
+#endif
       return compress2 ((unsigned char *) compressed,
                         (unsigned long *) compressed_len,
                         (unsigned char *) uncompressed,
@@ -214,6 +464,31 @@ mongoc_compress (int32_t compressor_id,
                     "compression is not compiled in");
       return false;
 #endif
+
+   case MONGOC_COMPRESSOR_ZSTD_ID:
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+   {
+      size_t r;
+
+      r = ZSTD_compress (compressed,
+                         *compressed_len,
+                         uncompressed,
+                         uncompressed_len,
+                         compression_level == -1 ? ZSTD_CLEVEL_DEFAULT
+                                                 : compression_level);
+      if (ZSTD_isError (r)) {
+         return false;
+      }
+
+      *compressed_len = r;
+      return true;
+   }
+#else
+      MONGOC_ERROR ("Client attempting to use compress with zstd, but zstd "
+                    "compression is not compiled in");
+      return false;
+#endif
+
    case MONGOC_COMPRESSOR_NOOP_ID:
       memcpy (compressed, uncompressed, uncompressed_len);
       *compressed_len = uncompressed_len;
@@ -223,3 +498,527 @@ mongoc_compress (int32_t compressor_id,
       return false;
    }
 }
+
+
+void
+mongoc_compress_scratch_init (mongoc_compress_scratch_t *scratch)
+{
+   memset (scratch, 0, sizeof *scratch);
+}
+
+
+/* charge @budget for the buffers @scratch holds now and as they grow */
+void
+mongoc_compress_scratch_set_budget (mongoc_compress_scratch_t *scratch,
+                                    mongoc_memory_budget_t *budget)
+{
+   _mongoc_memory_budget_charge (scratch->budget, -(int64_t) scratch->budgeted);
+   scratch->budget = budget;
+   _mongoc_memory_budget_charge (scratch->budget, (int64_t) scratch->budgeted);
+}
+
+
+/* @scratch allocated @len more bytes */
+static void
+_mongoc_compress_scratch_charge (mongoc_compress_scratch_t *scratch,
+                                 size_t len)
+{
+   scratch->budgeted += len;
+   _mongoc_memory_budget_charge (scratch->budget, (int64_t) len);
+}
+
+
+void
+mongoc_compress_scratch_destroy (mongoc_compress_scratch_t *scratch)
+{
+   _mongoc_memory_budget_charge (scratch->budget, -(int64_t) scratch->budgeted);
+   _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION, scratch->out);
+   _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION, scratch->chunk);
+   _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION, scratch->chunk_out);
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+   ZSTD_freeCStream ((ZSTD_CStream *) scratch->zstd);
+#endif
+#ifdef MONGOC_ENABLE_COMPRESSION_ZLIB
+   if (scratch->zlib) {
+      deflateEnd ((z_stream *) scratch->zlib);
+      _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION, scratch->zlib);
+   }
+#ifdef MONGOC_ENABLE_COMPRESSION_LIBDEFLATE
+   libdeflate_free_decompressor (
+      (struct libdeflate_decompressor *) scratch->inflate);
+#else
+   if (scratch->inflate) {
+      inflateEnd ((z_stream *) scratch->inflate);
+      _mongoc_free_tagged (MONGOC_MEMORY_TAG_COMPRESSION, scratch->inflate);
+   }
+#endif
+#endif
+}
+
+
+/* a read position within an array of iovecs */
+typedef struct {
+   const mongoc_iovec_t *iov;
+   size_t iovcnt;
+   size_t n;
+   size_t off;
+} mongoc_iovec_pos_t;
+
+
+static void
+_mongoc_iovec_pos_init (mongoc_iovec_pos_t *pos,
+                        const mongoc_iovec_t *iov,
+                        size_t iovcnt,
+                        size_t skip)
+{
+   pos->iov = iov;
+   pos->iovcnt = iovcnt;
+   pos->n = 0;
+   pos->off = skip;
+
+   while (pos->n < iovcnt && pos->off >= iov[pos->n].iov_len) {
+      pos->off -= iov[pos->n].iov_len;
+      pos->n++;
+   }
+}
+
+
+/* point @data at up to @max bytes that are contiguous in the current
+ * iovec, and move past them. returns 0 at the end */
+static size_t
+_mongoc_iovec_pos_next (mongoc_iovec_pos_t *pos,
+                        const uint8_t **data,
+                        size_t max)
+{
+   size_t len;
+
+   if (pos->n == pos->iovcnt) {
+      return 0;
+   }
+
+   len = BSON_MIN (max, pos->iov[pos->n].iov_len - pos->off);
+   *data = (const uint8_t *) pos->iov[pos->n].iov_base + pos->off;
+
+   pos->off += len;
+   while (pos->n < pos->iovcnt && pos->off == pos->iov[pos->n].iov_len) {
+      pos->off = 0;
+      pos->n++;
+   }
+
+   return len;
+}
+
+
+/* make room for @len more bytes of output */
+static void
+_mongoc_compress_reserve (mongoc_compress_scratch_t *scratch, size_t len)
+{
+   size_t need = scratch->out_len + len;
+
+   if (need > scratch->out_allocated) {
+      need = BSON_MAX (need, 2 * scratch->out_allocated);
+      _mongoc_compress_scratch_charge (scratch, need - scratch->out_allocated);
+      scratch->out_allocated = need;
+      scratch->out = (uint8_t *) _mongoc_realloc_tagged (
+         MONGOC_MEMORY_TAG_COMPRESSION, scratch->out, scratch->out_allocated);
+   }
+}
+
+
+#ifdef MONGOC_ENABLE_COMPRESSION_ZLIB
+static bool
+_mongoc_compress_iovec_zlib (int32_t compression_level,
+                             mongoc_iovec_pos_t *pos,
+                             mongoc_compress_scratch_t *scratch)
+{
+   z_stream *strm;
+   const uint8_t *data = NULL;
+   size_t len;
+   uInt avail;
+   int flush;
+   int r;
+
+   strm = _mongoc_zlib_deflater (scratch, compression_level);
+   if (!strm) {
+      return false;
+   }
+
+   /* feed the iovecs straight to deflate, growing the output as needed */
+   do {
+      len = _mongoc_iovec_pos_next (pos, &data, MONGOC_COMPRESS_CHUNK_SIZE);
+      flush = len ? Z_NO_FLUSH : Z_FINISH;
+      strm->next_in = (Bytef *) data;
+      strm->avail_in = (uInt) len;
+
+      do {
+         _mongoc_compress_reserve (scratch, MONGOC_COMPRESS_CHUNK_SIZE);
+         avail = (uInt) BSON_MIN (scratch->out_allocated - scratch->out_len,
+                                  MONGOC_COMPRESS_CHUNK_SIZE);
+         strm->next_out = scratch->out + scratch->out_len;
+         strm->avail_out = avail;
+
+         r = deflate (strm, flush);
+         if (r == Z_STREAM_ERROR) {
+            return false;
+         }
+
+         scratch->out_len += avail - strm->avail_out;
+      } while (strm->avail_out == 0);
+   } while (flush != Z_FINISH);
+
+   /* the stream is reset before its next message */
+   return r == Z_STREAM_END;
+}
+#endif
+
+
+#ifdef MONGOC_ENABLE_COMPRESSION_SNAPPY
+/* snappy has no streaming C API, but its raw format is a varint length
+ * followed by literals and back-references. snappy itself never refers
+ * across 64k blocks, so compressing blocks separately and concatenating
+ * them, without their own length prefixes, is a valid snappy message */
+static bool
+_mongoc_compress_iovec_snappy (mongoc_iovec_pos_t *pos,
+                               size_t total,
+                               mongoc_compress_scratch_t *scratch)
+{
+   size_t max_chunk_out;
+   size_t chunk_len;
+   size_t chunk_out_len;
+   const uint8_t *data;
+   const char *input;
+   size_t len;
+   size_t i;
+
+   max_chunk_out = snappy_max_compressed_length (MONGOC_COMPRESS_CHUNK_SIZE);
+   if (!scratch->chunk) {
+      scratch->chunk = (char *) _mongoc_malloc_tagged (
+         MONGOC_MEMORY_TAG_COMPRESSION, MONGOC_COMPRESS_CHUNK_SIZE);
+      scratch->chunk_out = (char *) _mongoc_malloc_tagged (
+         MONGOC_MEMORY_TAG_COMPRESSION, max_chunk_out);
+      _mongoc_compress_scratch_charge (
+         scratch, MONGOC_COMPRESS_CHUNK_SIZE + max_chunk_out);
+   }
+
+   _mongoc_compress_reserve (scratch, 5);
+   while (total >= 0x80) {
+      scratch->out[scratch->out_len++] = (uint8_t) (total | 0x80);
+      total >>= 7;
+   }
+   scratch->out[scratch->out_len++] = (uint8_t) total;
+
+   for (;;) {
+      len = _mongoc_iovec_pos_next (pos, &data, MONGOC_COMPRESS_CHUNK_SIZE);
+      if (!len) {
+         break;
+      }
+
+      if (len == MONGOC_COMPRESS_CHUNK_SIZE) {
+         /* a whole block in one iovec, compress it in place */
+         input = (const char *) data;
+         chunk_len = len;
+      } else {
+         memcpy (scratch->chunk, data, len);
+         chunk_len = len;
+         while (chunk_len < MONGOC_COMPRESS_CHUNK_SIZE &&
+                (len = _mongoc_iovec_pos_next (
+                    pos, &data, MONGOC_COMPRESS_CHUNK_SIZE - chunk_len))) {
+            memcpy (scratch->chunk + chunk_len, data, len);
+            chunk_len += len;
+         }
+
+         input = scratch->chunk;
+      }
+
+      chunk_out_len = max_chunk_out;
+      if (snappy_compress (
+             input, chunk_len, scratch->chunk_out, &chunk_out_len) !=
+          SNAPPY_OK) {
+         return false;
+      }
+
+      /* skip the block's own length prefix */
+      for (i = 0; scratch->chunk_out[i] & 0x80; i++) {
+      }
+      i++;
+
+      _mongoc_compress_reserve (scratch, chunk_out_len - i);
+      memcpy (scratch->out + scratch->out_len,
+              scratch->chunk_out + i,
+              chunk_out_len - i);
+      scratch->out_len += chunk_out_len - i;
+   }
+
+   return true;
+}
+#endif
+
+
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+static bool
+_mongoc_compress_iovec_zstd (int32_t compression_level,
+                             mongoc_iovec_pos_t *pos,
+                             mongoc_compress_scratch_t *scratch)
+{
+   ZSTD_CStream *zcs;
+   ZSTD_inBuffer in;
+   ZSTD_outBuffer out;
+   const uint8_t *data;
+   size_t len;
+   size_t r;
+
+   if (!scratch->zstd) {
+      scratch->zstd = ZSTD_createCStream ();
+      if (!scratch->zstd) {
+         return false;
+      }
+   }
+
+   zcs = (ZSTD_CStream *) scratch->zstd;
+   r = ZSTD_initCStream (zcs,
+                         compression_level == -1 ? ZSTD_CLEVEL_DEFAULT
+                                                 : compression_level);
+   if (ZSTD_isError (r)) {
+      return false;
+   }
+
+   while ((len = _mongoc_iovec_pos_next (
+              pos, &data, MONGOC_COMPRESS_CHUNK_SIZE))) {
+      in.src = data;
+      in.size = len;
+      in.pos = 0;
+
+      while (in.pos < in.size) {
+         _mongoc_compress_reserve (scratch, ZSTD_CStreamOutSize ());
+         out.dst = scratch->out + scratch->out_len;
+         out.size = scratch->out_allocated - scratch->out_len;
+         out.pos = 0;
+
+         r = ZSTD_compressStream (zcs, &out, &in);
+         if (ZSTD_isError (r)) {
+            return false;
+         }
+
+         scratch->out_len += out.pos;
+      }
+   }
+
+   /* flush until zstd reports nothing left */
+   do {
+      _mongoc_compress_reserve (scratch, ZSTD_CStreamOutSize ());
+      out.dst = scratch->out + scratch->out_len;
+      out.size = scratch->out_allocated - scratch->out_len;
+      out.pos = 0;
+
+      r = ZSTD_endStream (zcs, &out);
+      if (ZSTD_isError (r)) {
+         return false;
+      }
+
+      scratch->out_len += out.pos;
+   } while (r > 0);
+
+   return true;
+}
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_compress_iovec --
+ *
+ *       Compress the bytes of @iov after the first @skip into
+ *       @scratch->out, without first copying them into one buffer.
+ *       @scratch->out is valid until the next call with @scratch.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_compress_iovec (int32_t compressor_id,
+                       int32_t compression_level,
+                       const mongoc_iovec_t *iov,
+                       size_t iovcnt,
+                       size_t skip,
+                       mongoc_compress_scratch_t *scratch)
+{
+   mongoc_iovec_pos_t pos;
+   const uint8_t *data;
+   size_t total = 0;
+   size_t len;
+   size_t i;
+
+   TRACE ("Compressing iovecs with '%s' (%d)",
+          mongoc_compressor_id_to_name (compressor_id),
+          compressor_id);
+
+   for (i = 0; i < iovcnt; i++) {
+      total += iov[i].iov_len;
+   }
+
+   BSON_ASSERT (total >= skip);
+   total -= skip;
+
+   _mongoc_iovec_pos_init (&pos, iov, iovcnt, skip);
+   scratch->out_len = 0;
+
+   switch (compressor_id) {
+   case MONGOC_COMPRESSOR_SNAPPY_ID:
+#ifdef MONGOC_ENABLE_COMPRESSION_SNAPPY
+      return _mongoc_compress_iovec_snappy (&pos, total, scratch);
+#else
+      MONGOC_ERROR ("Client attempting to use compress with snappy, but snappy "
+                    "compression is not compiled in");
+      return false;
+#endif
+
+   case MONGOC_COMPRESSOR_ZLIB_ID:
+#ifdef MONGOC_ENABLE_COMPRESSION_ZLIB
+      return _mongoc_compress_iovec_zlib (compression_level, &pos, scratch);
+#else
+      MONGOC_ERROR ("Client attempting to use compress with zlib, but zlib "
+                    "compression is not compiled in");
+      return false;
+#endif
+
+   case MONGOC_COMPRESSOR_ZSTD_ID:
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+      return _mongoc_compress_iovec_zstd (compression_level, &pos, scratch);
+#else
+      MONGOC_ERROR ("Client attempting to use compress with zstd, but zstd "
+                    "compression is not compiled in");
+      return false;
+#endif
+
+   case MONGOC_COMPRESSOR_NOOP_ID:
+      _mongoc_compress_reserve (scratch, total);
+      while ((len = _mongoc_iovec_pos_next (&pos, &data, total))) {
+         memcpy (scratch->out + scratch->out_len, data, len);
+         scratch->out_len += len;
+      }
+      return true;
+
+   default:
+      return false;
+   }
+}
+
+
+void
+mongoc_compress_history_init (mongoc_compress_history_t *history)
+{
+   memset (history, 0, sizeof *history);
+}
+
+
+static mongoc_compress_history_entry_t *
+_mongoc_compress_history_find (mongoc_compress_history_t *history,
+                               const char *name,
+                               bool create)
+{
+   mongoc_compress_history_entry_t *entry;
+   int i;
+
+   for (i = 0; i < history->n_entries; i++) {
+      if (!strcasecmp (history->entries[i].name, name)) {
+         return &history->entries[i];
+      }
+   }
+
+   if (!create || history->n_entries == MONGOC_COMPRESS_HISTORY_LEN) {
+      return NULL;
+   }
+
+   entry = &history->entries[history->n_entries++];
+   bson_strncpy (entry->name, name, sizeof entry->name);
+
+   return entry;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_compress_history_wanted --
+ *
+ *       Decide whether to compress a message of command type @name.
+ *
+ * Returns:
+ *       false if @name has not been compressing well, except periodically
+ *       to sample it again.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_compress_history_wanted (mongoc_compress_history_t *history,
+                                const char *name)
+{
+   mongoc_compress_history_entry_t *entry;
+
+   entry = _mongoc_compress_history_find (history, name, false);
+   if (!entry || !entry->disabled) {
+      return true;
+   }
+
+   if (++entry->skipped < MONGOC_COMPRESS_HISTORY_RETRY) {
+      return false;
+   }
+
+   /* the data may have changed, sample it again */
+   entry->disabled = false;
+   entry->skipped = 0;
+   entry->samples = 0;
+   entry->in = 0;
+   entry->out = 0;
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_compress_history_record --
+ *
+ *       Record that a message of command type @name compressed from @in
+ *       bytes to @out. After each full sample, disable compression for
+ *       @name if it did not shrink enough.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_compress_history_record (mongoc_compress_history_t *history,
+                                const char *name,
+                                size_t in,
+                                size_t out)
+{
+   mongoc_compress_history_entry_t *entry;
+
+   entry = _mongoc_compress_history_find (history, name, true);
+   if (!entry) {
+      return;
+   }
+
+   entry->in += (int64_t) in;
+   entry->out += (int64_t) out;
+
+   if (++entry->samples < MONGOC_COMPRESS_HISTORY_SAMPLES) {
+      return;
+   }
+
+   if (entry->out * 100 > entry->in * MONGOC_COMPRESS_HISTORY_RATIO) {
+      TRACE ("stop compressing \"%s\", %" PRId64 " bytes became %" PRId64,
+             name,
+             entry->in,
+             entry->out);
+      entry->disabled = true;
+      entry->skipped = 0;
+   }
+
+   entry->samples = 0;
+   entry->in = 0;
+   entry->out = 0;
+}
@@ -23,6 +23,8 @@
 
 #include <bson.h>
 
+#include "mongoc-server-description.h"
+
 #ifdef __linux__
 #include <sched.h>
 #include <sys/sysinfo.h>
@@ -167,6 +169,178 @@ enum {
 #undef COUNTER
 
 
+/*
+ * Histograms are HDR-style: values under 4 have a bucket each, and every
+ * power of two above that is split into 4 linear sub-buckets, so a bucket's
+ * width is at most a quarter of its lower bound. 128 buckets reach 2^33
+ * microseconds; larger values land in the last bucket.
+ */
+#define MONGOC_HISTOGRAM_SUB_BUCKETS 4
+#define MONGOC_HISTOGRAM_BUCKETS 128
+
+
+typedef struct {
+   int64_t buckets[MONGOC_HISTOGRAM_BUCKETS];
+} mongoc_histogram_slots_t;
+
+
+typedef struct {
+   mongoc_histogram_slots_t *cpus;
+} mongoc_histogram_t;
+
+
+static BSON_INLINE uint32_t
+_mongoc_histogram_bucket (int64_t usec)
+{
+   uint64_t v;
+   uint32_t msb;
+   uint32_t bucket;
+
+   if (usec < MONGOC_HISTOGRAM_SUB_BUCKETS) {
+      return usec > 0 ? (uint32_t) usec : 0;
+   }
+
+   v = (uint64_t) usec;
+#if defined(__GNUC__)
+   msb = 63 - (uint32_t) __builtin_clzll (v);
+#else
+   for (msb = 0; v >> (msb + 1); msb++) {
+   }
+#endif
+
+   /* the two bits below the most significant one pick the sub-bucket */
+   bucket = MONGOC_HISTOGRAM_SUB_BUCKETS * (msb - 1) +
+            (uint32_t) ((v >> (msb - 2)) & (MONGOC_HISTOGRAM_SUB_BUCKETS - 1));
+
+   return BSON_MIN (bucket, MONGOC_HISTOGRAM_BUCKETS - 1);
+}
+
+
+#define HISTOGRAM(ident, Category, Name, Description) \
+   extern mongoc_histogram_t __mongoc_histogram_##ident;
+#include "mongoc-histograms.defs"
+#undef HISTOGRAM
+
+
+enum {
+#define HISTOGRAM(ident, Category, Name, Description) HISTOGRAM_##ident,
+#include "mongoc-histograms.defs"
+#undef HISTOGRAM
+   LAST_HISTOGRAM
+};
+
+
+#define HISTOGRAM(ident, Category, Name, Description)                         \
+   static BSON_INLINE void mongoc_histogram_##ident##_record (int64_t usec)  \
+   {                                                                         \
+      (void) _mongoc_counter_add (                                           \
+         __mongoc_histogram_##ident.cpus[_mongoc_sched_getcpu ()]            \
+            .buckets[_mongoc_histogram_bucket (usec)],                       \
+         1);                                                                 \
+   }                                                                         \
+   static BSON_INLINE void mongoc_histogram_##ident##_record_since (         \
+      int64_t started)                                                       \
+   {                                                                         \
+      mongoc_histogram_##ident##_record (bson_get_monotonic_time () -        \
+                                         started);                           \
+   }
+#include "mongoc-histograms.defs"
+#undef HISTOGRAM
+
+
+/*
+ * Per-server counters. Each server in a topology description claims one of
+ * MONGOC_SERVER_COUNTERS_MAX slots in the segment when it is added, and
+ * retires it when it is removed. A slot has one cache line of counters per
+ * CPU, like a group of global counters. A retired slot keeps its values for
+ * mongoc-stat until a new server reuses it.
+ */
+#define MONGOC_SERVER_COUNTERS_MAX 64
+
+enum {
+   MONGOC_SERVER_COUNTER_OPS,
+   MONGOC_SERVER_COUNTER_EGRESS_BYTES,
+   MONGOC_SERVER_COUNTER_INGRESS_BYTES,
+   MONGOC_SERVER_COUNTER_ERRORS,
+   MONGOC_SERVER_COUNTER_TIMEOUTS,
+   MONGOC_SERVER_COUNTER_CONNECTIONS,
+   MONGOC_SERVER_COUNTER_LAST
+};
+
+typedef enum {
+   MONGOC_SERVER_COUNTERS_FREE,
+   MONGOC_SERVER_COUNTERS_ACTIVE,
+   MONGOC_SERVER_COUNTERS_RETIRED
+} mongoc_server_counters_state_t;
+
+
+#pragma pack(1)
+typedef struct {
+   uint32_t offset;
+   uint32_t state;
+   uint32_t generation;
+   uint32_t padding;
+   int64_t round_trip_time_msec;
+   char host_and_port[104];
+} mongoc_server_counters_info_t;
+#pragma pack()
+
+
+typedef struct {
+   mongoc_server_counters_info_t *infos;
+   mongoc_counter_slots_t *cpus;
+   uint32_t n_cpu;
+} mongoc_server_counters_segment_t;
+
+
+extern mongoc_server_counters_segment_t __mongoc_server_counters;
+
+
+/* a server description's claim on a slot. copies of the description share
+ * the slot but not ownership; a slot whose generation has moved on belongs
+ * to another server, and updates through a stale reference are dropped */
+typedef struct {
+   uint32_t slot; /* 1-based, 0 if none */
+   uint32_t generation;
+   bool owner;
+} mongoc_server_counters_ref_t;
+
+
+void
+_mongoc_server_counters_claim (mongoc_server_counters_ref_t *ref,
+                               const char *host_and_port);
+void
+_mongoc_server_counters_retire (mongoc_server_counters_ref_t *ref);
+void
+_mongoc_server_counters_set_rtt (const mongoc_server_counters_ref_t *ref,
+                                 int64_t rtt_msec);
+bool
+_mongoc_server_counters_get (const mongoc_server_counters_ref_t *ref,
+                             mongoc_server_counters_t *counters);
+
+
+static BSON_INLINE void
+_mongoc_server_counter_add (const mongoc_server_counters_ref_t *ref,
+                            int counter,
+                            int64_t val)
+{
+   mongoc_server_counters_segment_t *seg = &__mongoc_server_counters;
+   uint32_t i;
+
+   if (!ref->slot) {
+      return;
+   }
+
+   i = ref->slot - 1;
+   if (seg->infos[i].generation != ref->generation) {
+      return;
+   }
+
+   (void) _mongoc_counter_add (
+      seg->cpus[i * seg->n_cpu + _mongoc_sched_getcpu ()].slots[counter], val);
+}
+
+
 BSON_END_DECLS
 
 
@@ -32,6 +32,7 @@
 
 #include "mongoc-counters-private.h"
 #include "mongoc-log.h"
+#include "mongoc-thread-private.h"
 
 
 #pragma pack(1)
@@ -48,6 +49,22 @@ typedef struct {
 BSON_STATIC_ASSERT (sizeof (mongoc_counter_info_t) == 128);
 
 
+#pragma pack(1)
+typedef struct {
+   uint32_t offset;
+   uint32_t n_buckets;
+   char category[24];
+   char name[32];
+   char description[64];
+} mongoc_histogram_info_t;
+#pragma pack()
+
+
+BSON_STATIC_ASSERT (sizeof (mongoc_histogram_info_t) == 128);
+BSON_STATIC_ASSERT (sizeof (mongoc_server_counters_info_t) == 128);
+BSON_STATIC_ASSERT (MONGOC_SERVER_COUNTER_LAST <= SLOTS_PER_CACHELINE);
+
+
 #pragma pack(1)
 typedef struct {
    uint32_t size;
@@ -55,7 +72,13 @@ typedef struct {
    uint32_t n_counters;
    uint32_t infos_offset;
    uint32_t values_offset;
-   uint8_t padding[44];
+   uint32_t n_histograms;
+   uint32_t histogram_infos_offset;
+   uint32_t histogram_values_offset;
+   uint32_t n_server_slots;
+   uint32_t server_infos_offset;
+   uint32_t server_values_offset;
+   uint8_t padding[20];
 } mongoc_counters_t;
 #pragma pack()
 
@@ -63,6 +86,7 @@ typedef struct {
 BSON_STATIC_ASSERT (sizeof (mongoc_counters_t) == 64);
 
 static void *gCounterFallback = NULL;
+static mongoc_mutex_t gServerCountersMutex;
 
 
 #define COUNTER(ident, Category, Name, Description) \
@@ -71,6 +95,15 @@ static void *gCounterFallback = NULL;
 #undef COUNTER
 
 
+#define HISTOGRAM(ident, Category, Name, Description) \
+   mongoc_histogram_t __mongoc_histogram_##ident;
+#include "mongoc-histograms.defs"
+#undef HISTOGRAM
+
+
+mongoc_server_counters_segment_t __mongoc_server_counters;
+
+
 /**
  * mongoc_counters_use_shm:
  *
@@ -91,8 +124,8 @@ mongoc_counters_use_shm (void)
  * mongoc_counters_calc_size:
  *
  * Returns the number of bytes required for the shared memory segment of
- * the process. This segment contains the various statistical counters for
- * the process.
+ * the process. This segment contains the various statistical counters and
+ * latency histograms for the process.
  *
  * Returns: The number of bytes required.
  */
@@ -107,7 +140,12 @@ mongoc_counters_calc_size (void)
    n_groups = (LAST_COUNTER / SLOTS_PER_CACHELINE) + 1;
    size = (sizeof (mongoc_counters_t) +
            (LAST_COUNTER * sizeof (mongoc_counter_info_t)) +
-           (n_cpu * n_groups * sizeof (mongoc_counter_slots_t)));
+           (LAST_HISTOGRAM * sizeof (mongoc_histogram_info_t)) +
+           (n_cpu * n_groups * sizeof (mongoc_counter_slots_t)) +
+           (n_cpu * LAST_HISTOGRAM * sizeof (mongoc_histogram_slots_t)) +
+           (MONGOC_SERVER_COUNTERS_MAX *
+            (sizeof (mongoc_server_counters_info_t) +
+             n_cpu * sizeof (mongoc_counter_slots_t))));
 
 #ifdef BSON_OS_UNIX
    return BSON_MAX (getpagesize (), size);
@@ -125,6 +163,9 @@ mongoc_counters_calc_size (void)
 void
 _mongoc_counters_cleanup (void)
 {
+   memset (&__mongoc_server_counters, 0, sizeof __mongoc_server_counters);
+   mongoc_mutex_destroy (&gServerCountersMutex);
+
    if (gCounterFallback) {
       bson_free (gCounterFallback);
       gCounterFallback = NULL;
@@ -270,6 +311,59 @@ mongoc_counters_register (mongoc_counters_t *counters,
 }
 
 
+/**
+ * mongoc_counters_register_histogram:
+ * @counters: A mongoc_counter_t.
+ * @num: The histogram number.
+ * @category: The histogram category.
+ * @name: The histogram name.
+ * @description The histogram description.
+ *
+ * Registers a new histogram in the memory segment, after the counters. Each
+ * CPU has its own run of MONGOC_HISTOGRAM_BUCKETS buckets, like the per-CPU
+ * slots of a counter.
+ *
+ * Returns: The offset to the data for the histogram's buckets.
+ */
+static size_t
+mongoc_counters_register_histogram (mongoc_counters_t *counters,
+                                    uint32_t num,
+                                    const char *category,
+                                    const char *name,
+                                    const char *description)
+{
+   mongoc_histogram_info_t *infos;
+   char *segment;
+   int n_cpu;
+
+   BSON_ASSERT (counters);
+   BSON_ASSERT (category);
+   BSON_ASSERT (name);
+   BSON_ASSERT (description);
+
+   n_cpu = _mongoc_get_cpu_count ();
+   segment = (char *) counters;
+
+   infos =
+      (mongoc_histogram_info_t *) (segment + counters->histogram_infos_offset);
+   infos = &infos[counters->n_histograms];
+   infos->n_buckets = MONGOC_HISTOGRAM_BUCKETS;
+   infos->offset = (counters->histogram_values_offset +
+                    (num * n_cpu * sizeof (mongoc_histogram_slots_t)));
+
+   bson_strncpy (infos->category, category, sizeof infos->category);
+   bson_strncpy (infos->name, name, sizeof infos->name);
+   bson_strncpy (infos->description, description, sizeof infos->description);
+
+   /* as in mongoc_counters_register, publish the histogram last */
+   bson_memory_barrier ();
+
+   counters->n_histograms++;
+
+   return infos->offset;
+}
+
+
 /**
  * mongoc_counters_init:
  *
@@ -282,6 +376,10 @@ _mongoc_counters_init (void)
    mongoc_counter_info_t *info;
    mongoc_counters_t *counters;
    size_t infos_size;
+   size_t histogram_infos_size;
+   size_t server_infos_size;
+   size_t n_groups;
+   uint32_t i;
    size_t off;
    size_t size;
    char *segment;
@@ -289,14 +387,33 @@ _mongoc_counters_init (void)
    size = mongoc_counters_calc_size ();
    segment = (char *) mongoc_counters_alloc (size);
    infos_size = LAST_COUNTER * sizeof *info;
+   histogram_infos_size = LAST_HISTOGRAM * sizeof (mongoc_histogram_info_t);
+   server_infos_size =
+      MONGOC_SERVER_COUNTERS_MAX * sizeof (mongoc_server_counters_info_t);
+   n_groups = (LAST_COUNTER / SLOTS_PER_CACHELINE) + 1;
 
    counters = (mongoc_counters_t *) segment;
    counters->n_cpu = _mongoc_get_cpu_count ();
    counters->n_counters = 0;
+   counters->n_histograms = 0;
    counters->infos_offset = sizeof *counters;
-   counters->values_offset = (uint32_t) (counters->infos_offset + infos_size);
+   counters->histogram_infos_offset =
+      (uint32_t) (counters->infos_offset + infos_size);
+   counters->server_infos_offset =
+      (uint32_t) (counters->histogram_infos_offset + histogram_infos_size);
+   counters->values_offset =
+      (uint32_t) (counters->server_infos_offset + server_infos_size);
+   counters->histogram_values_offset =
+      (uint32_t) (counters->values_offset +
+                  counters->n_cpu * n_groups * sizeof (mongoc_counter_slots_t));
+   counters->server_values_offset =
+      (uint32_t) (counters->histogram_values_offset +
+                  counters->n_cpu * LAST_HISTOGRAM *
+                     sizeof (mongoc_histogram_slots_t));
 
    BSON_ASSERT ((counters->values_offset % 64) == 0);
+   BSON_ASSERT ((counters->histogram_values_offset % 64) == 0);
+   BSON_ASSERT ((counters->server_values_offset % 64) == 0);
 
 #define COUNTER(ident, Category, Name, Desc)            \
    off = mongoc_counters_register (                     \
@@ -305,6 +422,32 @@ _mongoc_counters_init (void)
 #include "mongoc-counters.defs"
 #undef COUNTER
 
+#define HISTOGRAM(ident, Category, Name, Desc)                \
+   off = mongoc_counters_register_histogram (                 \
+      counters, HISTOGRAM_##ident, Category, Name, Desc);     \
+   __mongoc_histogram_##ident.cpus =                          \
+      (mongoc_histogram_slots_t *) (segment + off);
+#include "mongoc-histograms.defs"
+#undef HISTOGRAM
+
+   /* server slots are all free; servers claim them as they are added */
+   mongoc_mutex_init (&gServerCountersMutex);
+   __mongoc_server_counters.infos =
+      (mongoc_server_counters_info_t *) (segment +
+                                         counters->server_infos_offset);
+   __mongoc_server_counters.cpus =
+      (mongoc_counter_slots_t *) (segment + counters->server_values_offset);
+   __mongoc_server_counters.n_cpu = counters->n_cpu;
+
+   for (i = 0; i < MONGOC_SERVER_COUNTERS_MAX; i++) {
+      __mongoc_server_counters.infos[i].offset =
+         (uint32_t) (counters->server_values_offset +
+                     i * counters->n_cpu * sizeof (mongoc_counter_slots_t));
+      __mongoc_server_counters.infos[i].round_trip_time_msec = -1;
+   }
+
+   counters->n_server_slots = MONGOC_SERVER_COUNTERS_MAX;
+
    /*
     * NOTE:
     *
@@ -315,3 +458,177 @@ _mongoc_counters_init (void)
    bson_memory_barrier ();
    counters->size = (uint32_t) size;
 }
+
+
+/**
+ * _mongoc_server_counters_claim:
+ * @ref: The server description's reference to fill in.
+ * @host_and_port: The server's address.
+ *
+ * Claims a slot for a server that was added to a topology description,
+ * preferring one that has never been used over a retired one. If every
+ * slot is active the server is not counted, and @ref's slot is 0.
+ */
+void
+_mongoc_server_counters_claim (mongoc_server_counters_ref_t *ref,
+                               const char *host_and_port)
+{
+   mongoc_server_counters_segment_t *seg = &__mongoc_server_counters;
+   mongoc_server_counters_info_t *info;
+   uint32_t retired = 0;
+   uint32_t slot = 0;
+   uint32_t i;
+
+   BSON_ASSERT (ref);
+   BSON_ASSERT (host_and_port);
+
+   memset (ref, 0, sizeof *ref);
+
+   if (!seg->infos) {
+      return;
+   }
+
+   mongoc_mutex_lock (&gServerCountersMutex);
+
+   for (i = 0; i < MONGOC_SERVER_COUNTERS_MAX; i++) {
+      if (seg->infos[i].state == MONGOC_SERVER_COUNTERS_FREE) {
+         slot = i + 1;
+         break;
+      } else if (!retired &&
+                 seg->infos[i].state == MONGOC_SERVER_COUNTERS_RETIRED) {
+         retired = i + 1;
+      }
+   }
+
+   if (!slot) {
+      slot = retired;
+   }
+
+   if (slot) {
+      info = &seg->infos[slot - 1];
+
+      /* drop updates from references to the previous server first */
+      info->generation++;
+      bson_memory_barrier ();
+
+      for (i = 0; i < seg->n_cpu; i++) {
+         memset (&seg->cpus[(slot - 1) * seg->n_cpu + i],
+                 0,
+                 sizeof (mongoc_counter_slots_t));
+      }
+
+      info->round_trip_time_msec = -1;
+      bson_strncpy (
+         info->host_and_port, host_and_port, sizeof info->host_and_port);
+
+      bson_memory_barrier ();
+      info->state = MONGOC_SERVER_COUNTERS_ACTIVE;
+
+      ref->slot = slot;
+      ref->generation = info->generation;
+      ref->owner = true;
+   }
+
+   mongoc_mutex_unlock (&gServerCountersMutex);
+}
+
+
+/**
+ * _mongoc_server_counters_retire:
+ * @ref: A reference from _mongoc_server_counters_claim.
+ *
+ * Marks the slot retired when its server leaves the topology description.
+ * Only the reference that claimed the slot retires it; copies are ignored.
+ */
+void
+_mongoc_server_counters_retire (mongoc_server_counters_ref_t *ref)
+{
+   mongoc_server_counters_segment_t *seg = &__mongoc_server_counters;
+   mongoc_server_counters_info_t *info;
+
+   BSON_ASSERT (ref);
+
+   if (!ref->slot || !ref->owner || !seg->infos) {
+      return;
+   }
+
+   mongoc_mutex_lock (&gServerCountersMutex);
+
+   info = &seg->infos[ref->slot - 1];
+   if (info->generation == ref->generation) {
+      info->state = MONGOC_SERVER_COUNTERS_RETIRED;
+   }
+
+   mongoc_mutex_unlock (&gServerCountersMutex);
+
+   ref->owner = false;
+}
+
+
+/**
+ * _mongoc_server_counters_set_rtt:
+ * @ref: A server's counters reference.
+ * @rtt_msec: The server's round trip time, or -1 if unknown.
+ *
+ * Publishes the server's round trip time from its latest check.
+ */
+void
+_mongoc_server_counters_set_rtt (const mongoc_server_counters_ref_t *ref,
+                                 int64_t rtt_msec)
+{
+   mongoc_server_counters_segment_t *seg = &__mongoc_server_counters;
+
+   if (!ref->slot || seg->infos[ref->slot - 1].generation != ref->generation) {
+      return;
+   }
+
+   seg->infos[ref->slot - 1].round_trip_time_msec = rtt_msec;
+}
+
+
+/**
+ * _mongoc_server_counters_get:
+ * @ref: A server's counters reference.
+ * @counters: Location for the sums of the server's per-CPU counters.
+ *
+ * Returns: true if @ref's slot still belongs to its server, otherwise false
+ * and @counters is zeroed.
+ */
+bool
+_mongoc_server_counters_get (const mongoc_server_counters_ref_t *ref,
+                             mongoc_server_counters_t *counters)
+{
+   mongoc_server_counters_segment_t *seg = &__mongoc_server_counters;
+   int64_t values[MONGOC_SERVER_COUNTER_LAST] = {0};
+   mongoc_counter_slots_t *cpu;
+   uint32_t i;
+   int j;
+
+   BSON_ASSERT (ref);
+   BSON_ASSERT (counters);
+
+   memset (counters, 0, sizeof *counters);
+   counters->round_trip_time_msec = -1;
+
+   if (!ref->slot || seg->infos[ref->slot - 1].generation != ref->generation) {
+      return false;
+   }
+
+   for (i = 0; i < seg->n_cpu; i++) {
+      cpu = &seg->cpus[(ref->slot - 1) * seg->n_cpu + i];
+      for (j = 0; j < MONGOC_SERVER_COUNTER_LAST; j++) {
+         values[j] += cpu->slots[j];
+      }
+   }
+
+   counters->ops = values[MONGOC_SERVER_COUNTER_OPS];
+   counters->egress_bytes = values[MONGOC_SERVER_COUNTER_EGRESS_BYTES];
+   counters->ingress_bytes = values[MONGOC_SERVER_COUNTER_INGRESS_BYTES];
+   counters->errors = values[MONGOC_SERVER_COUNTER_ERRORS];
+   counters->timeouts = values[MONGOC_SERVER_COUNTER_TIMEOUTS];
+   counters->connections = values[MONGOC_SERVER_COUNTER_CONNECTIONS];
+   counters->round_trip_time_msec =
+      seg->infos[ref->slot - 1].round_trip_time_msec;
+
+   return true;
+}
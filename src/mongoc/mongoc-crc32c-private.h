@@ -0,0 +1,52 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_CRC32C_PRIVATE_H
+#define MONGOC_CRC32C_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-iovec.h"
+
+BSON_BEGIN_DECLS
+
+/* CRC-32C (Castagnoli), as in OP_MSG's checksum. Pass 0 to start, or a
+ * previous result to continue over more data. */
+
+void
+_mongoc_crc32c_init (void);
+
+uint32_t
+_mongoc_crc32c (uint32_t crc, const void *data, size_t len);
+
+uint32_t
+_mongoc_crc32c_iovec (const mongoc_iovec_t *iov, size_t iovcnt);
+
+/* the table implementation, for tests to compare with */
+uint32_t
+_mongoc_crc32c_sw (uint32_t crc, const void *data, size_t len);
+
+/* "sse4.2", "armv8", or "table" */
+const char *
+_mongoc_crc32c_impl (void);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_CRC32C_PRIVATE_H */
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-crc32c-private.h"
+
+/* SSE4.2's crc32 instruction, chosen at runtime: the driver isn't built
+ * with -msse4.2 */
+#if (defined(__GNUC__) || defined(__clang__)) && \
+   (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define MONGOC_CRC32C_SSE42 1
+#define MONGOC_CRC32C_TARGET_SSE42 __attribute__ ((target ("sse4.2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <nmmintrin.h>
+#define MONGOC_CRC32C_SSE42 1
+#define MONGOC_CRC32C_TARGET_SSE42
+#endif
+
+/* ARMv8's crc32c instructions, when the build targets them */
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define MONGOC_CRC32C_ARMV8 1
+#endif
+
+
+typedef uint32_t (*mongoc_crc32c_func_t) (uint32_t crc,
+                                          const uint8_t *data,
+                                          size_t len);
+
+/* slicing-by-8 tables for the reflected polynomial 0x82F63B78 */
+static uint32_t gCrc32cTable[8][256];
+static mongoc_crc32c_func_t gCrc32cFunc;
+static const char *gCrc32cImpl = "table";
+
+
+static uint32_t
+_mongoc_crc32c_table (uint32_t crc, const uint8_t *data, size_t len)
+{
+   uint32_t lo;
+   uint32_t hi;
+
+   while (len && ((uintptr_t) data & 7)) {
+      crc = gCrc32cTable[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+      len--;
+   }
+
+   while (len >= 8) {
+      memcpy (&lo, data, 4);
+      memcpy (&hi, data + 4, 4);
+      lo = BSON_UINT32_FROM_LE (lo) ^ crc;
+      hi = BSON_UINT32_FROM_LE (hi);
+      crc = gCrc32cTable[7][lo & 0xff] ^ gCrc32cTable[6][(lo >> 8) & 0xff] ^
+            gCrc32cTable[5][(lo >> 16) & 0xff] ^ gCrc32cTable[4][lo >> 24] ^
+            gCrc32cTable[3][hi & 0xff] ^ gCrc32cTable[2][(hi >> 8) & 0xff] ^
+            gCrc32cTable[1][(hi >> 16) & 0xff] ^ gCrc32cTable[0][hi >> 24];
+      data += 8;
+      len -= 8;
+   }
+
+   while (len--) {
+      crc = gCrc32cTable[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+   }
+
+   return crc;
+}
+
+
+#ifdef MONGOC_CRC32C_SSE42
+MONGOC_CRC32C_TARGET_SSE42
+static uint32_t
+_mongoc_crc32c_sse42 (uint32_t crc, const uint8_t *data, size_t len)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+   uint64_t crc64;
+   uint64_t word;
+#else
+   uint32_t word;
+#endif
+
+   while (len && ((uintptr_t) data & 7)) {
+      crc = _mm_crc32_u8 (crc, *data++);
+      len--;
+   }
+
+#if defined(__x86_64__) || defined(_M_X64)
+   crc64 = crc;
+   while (len >= 8) {
+      memcpy (&word, data, 8);
+      crc64 = _mm_crc32_u64 (crc64, word);
+      data += 8;
+      len -= 8;
+   }
+
+   crc = (uint32_t) crc64;
+#else
+   while (len >= 4) {
+      memcpy (&word, data, 4);
+      crc = _mm_crc32_u32 (crc, word);
+      data += 4;
+      len -= 4;
+   }
+#endif
+
+   while (len--) {
+      crc = _mm_crc32_u8 (crc, *data++);
+   }
+
+   return crc;
+}
+
+
+static bool
+_mongoc_crc32c_have_sse42 (void)
+{
+#if defined(_MSC_VER)
+   int info[4];
+
+   __cpuid (info, 1);
+   return (info[2] & (1 << 20)) != 0;
+#else
+   __builtin_cpu_init ();
+   return __builtin_cpu_supports ("sse4.2") != 0;
+#endif
+}
+#endif
+
+
+#ifdef MONGOC_CRC32C_ARMV8
+static uint32_t
+_mongoc_crc32c_armv8 (uint32_t crc, const uint8_t *data, size_t len)
+{
+   uint64_t word;
+
+   while (len && ((uintptr_t) data & 7)) {
+      crc = __crc32cb (crc, *data++);
+      len--;
+   }
+
+   while (len >= 8) {
+      memcpy (&word, data, 8);
+      crc = __crc32cd (crc, word);
+      data += 8;
+      len -= 8;
+   }
+
+   while (len--) {
+      crc = __crc32cb (crc, *data++);
+   }
+
+   return crc;
+}
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_crc32c_init --
+ *
+ *       Build the tables and choose the fastest implementation the CPU
+ *       supports. Called once, by mongoc_init.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_crc32c_init (void)
+{
+   uint32_t crc;
+   int i;
+   int j;
+
+   for (i = 0; i < 256; i++) {
+      crc = (uint32_t) i;
+      for (j = 0; j < 8; j++) {
+         crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+      }
+
+      gCrc32cTable[0][i] = crc;
+   }
+
+   for (i = 0; i < 256; i++) {
+      for (j = 1; j < 8; j++) {
+         crc = gCrc32cTable[j - 1][i];
+         gCrc32cTable[j][i] = gCrc32cTable[0][crc & 0xff] ^ (crc >> 8);
+      }
+   }
+
+   gCrc32cFunc = _mongoc_crc32c_table;
+   gCrc32cImpl = "table";
+
+#if defined(MONGOC_CRC32C_SSE42)
+   if (_mongoc_crc32c_have_sse42 ()) {
+      gCrc32cFunc = _mongoc_crc32c_sse42;
+      gCrc32cImpl = "sse4.2";
+   }
+#elif defined(MONGOC_CRC32C_ARMV8)
+   gCrc32cFunc = _mongoc_crc32c_armv8;
+   gCrc32cImpl = "armv8";
+#endif
+}
+
+
+uint32_t
+_mongoc_crc32c (uint32_t crc, const void *data, size_t len)
+{
+   BSON_ASSERT (gCrc32cFunc);
+
+   return ~gCrc32cFunc (~crc, (const uint8_t *) data, len);
+}
+
+
+uint32_t
+_mongoc_crc32c_iovec (const mongoc_iovec_t *iov, size_t iovcnt)
+{
+   uint32_t crc = ~0u;
+   size_t i;
+
+   BSON_ASSERT (gCrc32cFunc);
+
+   for (i = 0; i < iovcnt; i++) {
+      crc = gCrc32cFunc (
+         crc, (const uint8_t *) iov[i].iov_base, (size_t) iov[i].iov_len);
+   }
+
+   return ~crc;
+}
+
+
+uint32_t
+_mongoc_crc32c_sw (uint32_t crc, const void *data, size_t len)
+{
+   return ~_mongoc_crc32c_table (~crc, (const uint8_t *) data, len);
+}
+
+
+const char *
+_mongoc_crc32c_impl (void)
+{
+   return gCrc32cImpl;
+}
@@ -20,6 +20,7 @@
 #include "mongoc-crypto-common-crypto-private.h"
 #include <CommonCrypto/CommonHMAC.h>
 #include <CommonCrypto/CommonDigest.h>
+#include <CommonCrypto/CommonKeyDerivation.h>
 
 
 void
@@ -46,5 +47,27 @@ mongoc_crypto_common_crypto_sha1 (mongoc_crypto_t *crypto,
    return false;
 }
 
+bool
+mongoc_crypto_common_crypto_pbkdf2_hmac_sha1 (mongoc_crypto_t *crypto,
+                                              const char *password,
+                                              size_t password_len,
+                                              const uint8_t *salt,
+                                              size_t salt_len,
+                                              uint32_t iterations,
+                                              size_t output_len,
+                                              unsigned char *output /* OUT */)
+{
+   /* Hi() from RFC 5802 is PBKDF2 with HMAC-SHA1 */
+   return kCCSuccess == CCKeyDerivationPBKDF (kCCPBKDF2,
+                                              password,
+                                              password_len,
+                                              salt,
+                                              salt_len,
+                                              kCCPRFHmacAlgSHA1,
+                                              iterations,
+                                              output,
+                                              output_len);
+}
+
 
 #endif
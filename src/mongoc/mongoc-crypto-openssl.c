@@ -78,5 +78,25 @@ cleanup:
    return rval;
 }
 
+bool
+mongoc_crypto_openssl_pbkdf2_hmac_sha1 (mongoc_crypto_t *crypto,
+                                        const char *password,
+                                        size_t password_len,
+                                        const uint8_t *salt,
+                                        size_t salt_len,
+                                        uint32_t iterations,
+                                        size_t output_len,
+                                        unsigned char *output /* OUT */)
+{
+   /* Hi() from RFC 5802 is PBKDF2 with HMAC-SHA1 */
+   return 1 == PKCS5_PBKDF2_HMAC_SHA1 (password,
+                                       (int) password_len,
+                                       salt,
+                                       (int) salt_len,
+                                       (int) iterations,
+                                       (int) output_len,
+                                       output);
+}
+
 
 #endif
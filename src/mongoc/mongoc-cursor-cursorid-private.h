@@ -33,7 +33,10 @@ typedef struct {
    bson_t array;
    bool in_batch;
    bool in_reader;
+   bool in_stream; /* "streamBatches", reading the batch off the connection */
    bson_iter_t batch_iter;
+   uint32_t batch_len; /* documents in the batch */
+   uint32_t batch_pos; /* documents read from it */
    bson_t current_doc;
 } mongoc_cursor_cursorid_t;
 
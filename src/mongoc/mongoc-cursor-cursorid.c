@@ -18,6 +18,7 @@
 #include "mongoc-cursor.h"
 #include "mongoc-cursor-private.h"
 #include "mongoc-cursor-cursorid-private.h"
+#include "mongoc-counters-private.h"
 #include "mongoc-log.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-error.h"
@@ -40,6 +41,7 @@ _mongoc_cursor_cursorid_new (void)
    bson_init (&cid->array);
    cid->in_batch = false;
    cid->in_reader = false;
+   cid->in_stream = false;
 
    RETURN (cid);
 }
@@ -74,8 +76,11 @@ _mongoc_cursor_cursorid_start_batch (mongoc_cursor_t *cursor)
    mongoc_cursor_cursorid_t *cid;
    bson_iter_t iter;
    bson_iter_t child;
+   bson_iter_t batch;
    const char *ns;
    uint32_t nslen;
+   const uint8_t *data;
+   uint32_t data_len;
 
    cid = (mongoc_cursor_cursorid_t *) cursor->iface_data;
 
@@ -94,6 +99,26 @@ _mongoc_cursor_cursorid_start_batch (mongoc_cursor_t *cursor)
             if (BSON_ITER_HOLDS_ARRAY (&child) &&
                 bson_iter_recurse (&child, &cid->batch_iter)) {
                cid->in_batch = true;
+               cid->batch_len = 0;
+               cid->batch_pos = 0;
+
+               /* count the documents, to prefetch halfway through or to
+                * size the next batch */
+               if ((cursor->prefetch || cursor->adaptive_batch_bytes ||
+                    cursor->client->budget) &&
+                   bson_iter_recurse (&child, &batch)) {
+                  while (bson_iter_next (&batch)) {
+                     cid->batch_len++;
+                  }
+               }
+
+               if (cursor->adaptive_batch_bytes || cursor->client->budget) {
+                  bson_iter_array (&child, &data_len, &data);
+                  cursor->batch_stats.n_docs = cid->batch_len;
+                  cursor->batch_stats.n_bytes = data_len;
+                  cursor->batch_stats.received = bson_get_monotonic_time ();
+                  cursor->batch_stats.next_batch_size = 0;
+               }
             }
          }
       }
@@ -106,9 +131,11 @@ _mongoc_cursor_cursorid_start_batch (mongoc_cursor_t *cursor)
 static bool
 _mongoc_cursor_cursorid_refresh_from_command (mongoc_cursor_t *cursor,
                                               const bson_t *command,
-                                              const bson_t *opts)
+                                              const bson_t *opts,
+                                              bool exhaust)
 {
    mongoc_cursor_cursorid_t *cid;
+   bool ret;
 
    ENTRY;
 
@@ -116,11 +143,24 @@ _mongoc_cursor_cursorid_refresh_from_command (mongoc_cursor_t *cursor,
    BSON_ASSERT (cid);
 
    bson_destroy (&cid->array);
+   _mongoc_cursor_spill_release (cursor);
+   cursor->batch_stats.sent = bson_get_monotonic_time ();
+
+   if (cursor->prefetched) {
+      ret = _mongoc_cursor_prefetch_take (cursor, &cid->array);
+   } else if (exhaust) {
+      ret = _mongoc_cursor_run_exhaust (cursor, command, &cid->array);
+   } else {
+      ret = _mongoc_cursor_run_command (cursor, command, opts, &cid->array);
+   }
+
+   if (ret) {
+      _mongoc_cursor_spill (cursor, &cid->array);
+   }
 
    /* server replies to find / aggregate with {cursor: {id: N, firstBatch: []}},
     * to getMore command with {cursor: {id: N, nextBatch: []}}. */
-   if (_mongoc_cursor_run_command (cursor, command, opts, &cid->array) &&
-       _mongoc_cursor_cursorid_start_batch (cursor)) {
+   if (ret && _mongoc_cursor_cursorid_start_batch (cursor)) {
       RETURN (true);
    }
 
@@ -139,6 +179,51 @@ _mongoc_cursor_cursorid_refresh_from_command (mongoc_cursor_t *cursor,
 }
 
 
+/* with "streamBatches", the batch's documents have been returned as they
+ * arrived; the rest of the getMore reply has the cursor id */
+static bool
+_mongoc_cursor_cursorid_end_stream (mongoc_cursor_t *cursor)
+{
+   mongoc_cursor_cursorid_t *cid;
+   uint32_t n_docs;
+   uint32_t n_bytes;
+
+   ENTRY;
+
+   cid = (mongoc_cursor_cursorid_t *) cursor->iface_data;
+   BSON_ASSERT (cid);
+
+   cid->in_stream = false;
+   bson_destroy (&cid->array);
+   _mongoc_cursor_spill_release (cursor);
+
+   if (_mongoc_cursor_streaming_take (
+          cursor, &cid->array, &n_docs, &n_bytes) &&
+       _mongoc_cursor_cursorid_start_batch (cursor)) {
+      /* the reply's batch is empty, size the next by the one streamed */
+      cid->in_batch = false;
+      if (cursor->adaptive_batch_bytes || cursor->client->budget) {
+         cursor->batch_stats.n_docs = n_docs;
+         cursor->batch_stats.n_bytes = n_bytes;
+      }
+
+      RETURN (true);
+   }
+
+   bson_destroy (&cursor->error_doc);
+   bson_copy_to (&cid->array, &cursor->error_doc);
+
+   if (!cursor->error.domain) {
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Invalid reply to getMore command.");
+   }
+
+   RETURN (false);
+}
+
+
 static void
 _mongoc_cursor_cursorid_read_from_batch (mongoc_cursor_t *cursor,
                                          const bson_t **bson)
@@ -159,6 +244,7 @@ _mongoc_cursor_cursorid_read_from_batch (mongoc_cursor_t *cursor,
       /* bson_iter_next guarantees valid BSON, so this must succeed */
       bson_init_static (&cid->current_doc, data, data_len);
       *bson = &cid->current_doc;
+      cid->batch_pos++;
 
       cursor->end_of_event = false;
    } else {
@@ -173,7 +259,113 @@ _mongoc_cursor_cursorid_prime (mongoc_cursor_t *cursor)
    cursor->sent = true;
    cursor->operation_id = ++cursor->client->cluster.operation_id;
    return _mongoc_cursor_cursorid_refresh_from_command (
-      cursor, &cursor->filter, &cursor->opts);
+      cursor, &cursor->filter, &cursor->opts, false /* exhaust */);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_adaptive_batch_size --
+ *
+ *       For "adaptiveBatchBytes", choose the getMore batchSize that follows
+ *       the current batch. The size doubles while the application reads
+ *       batches faster than they arrive, so round trips dominate, and stays
+ *       put otherwise. It never asks for more than adaptiveBatchBytes of
+ *       documents as large as the current batch's, or more than the limit
+ *       leaves.
+ *
+ *       The choice is made once per batch, since the getMore command may
+ *       be prepared more than once.
+ *
+ * Returns:
+ *       The batchSize, or 0 to let the server choose.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int64_t
+_mongoc_cursor_adaptive_batch_size (mongoc_cursor_t *cursor)
+{
+   mongoc_cursor_batch_stats_t *stats = &cursor->batch_stats;
+   int64_t batch_size;
+   int64_t max_docs;
+   int64_t doc_bytes;
+   int64_t limit;
+   int64_t fetch_usec;
+   int64_t read_usec;
+
+   if (stats->next_batch_size) {
+      return stats->next_batch_size;
+   }
+
+   batch_size = stats->batch_size ? stats->batch_size : stats->n_docs;
+   if (!batch_size) {
+      /* nothing to go by yet */
+      return 0;
+   }
+
+   fetch_usec = stats->sent ? stats->received - stats->sent : 0;
+   read_usec = bson_get_monotonic_time () - stats->received;
+   if (read_usec <= fetch_usec) {
+      batch_size *= 2;
+   }
+
+   if (stats->n_docs) {
+      doc_bytes = BSON_MAX (1, stats->n_bytes / stats->n_docs);
+      max_docs = BSON_MAX (1, cursor->adaptive_batch_bytes / doc_bytes);
+      batch_size = BSON_MIN (batch_size, max_docs);
+   }
+
+   limit = mongoc_cursor_get_limit (cursor);
+   if (limit > 0 && limit > cursor->count) {
+      batch_size = BSON_MIN (batch_size, limit - cursor->count);
+   }
+
+   batch_size = BSON_MIN (batch_size, INT32_MAX);
+   stats->batch_size = batch_size;
+   stats->next_batch_size = batch_size;
+
+   return batch_size;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_budget_batch_size --
+ *
+ *       If the client's memory budget is under pressure, limit the getMore
+ *       @batch_size to the documents that fit the budget's batch bytes,
+ *       judged by the current batch's.
+ *
+ * Returns:
+ *       The batchSize, or 0 to let the server choose.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int64_t
+_mongoc_cursor_budget_batch_size (mongoc_cursor_t *cursor, int64_t batch_size)
+{
+   mongoc_cursor_batch_stats_t *stats = &cursor->batch_stats;
+   int64_t budget_bytes;
+   int64_t max_docs;
+
+   budget_bytes = _mongoc_memory_budget_batch_bytes (cursor->client->budget);
+   if (!budget_bytes || !stats->n_docs) {
+      return batch_size;
+   }
+
+   max_docs = BSON_MAX (
+      1, budget_bytes / BSON_MAX (1, stats->n_bytes / stats->n_docs));
+   if (batch_size && batch_size <= max_docs) {
+      return batch_size;
+   }
+
+   mongoc_counter_memory_smaller_batches_inc ();
+
+   return BSON_MIN (max_docs, INT32_MAX);
 }
 
 
@@ -198,11 +390,18 @@ _mongoc_cursor_prepare_getmore_command (mongoc_cursor_t *cursor,
    batch_size = mongoc_cursor_get_batch_size (cursor);
 
    /* See find, getMore, and killCursors Spec for batchSize rules */
+   if (batch_size) {
+      batch_size = abs (_mongoc_n_return (cursor));
+   } else if (cursor->adaptive_batch_bytes) {
+      batch_size = _mongoc_cursor_adaptive_batch_size (cursor);
+   }
+
+   batch_size = _mongoc_cursor_budget_batch_size (cursor, batch_size);
    if (batch_size) {
       bson_append_int64 (command,
                          MONGOC_CURSOR_BATCH_SIZE,
                          MONGOC_CURSOR_BATCH_SIZE_LEN,
-                         abs (_mongoc_n_return (cursor)));
+                         batch_size);
    }
 
    /* Find, getMore And killCursors Commands Spec: "In the case of a tailable
@@ -244,6 +443,24 @@ _mongoc_cursor_cursorid_get_more (mongoc_cursor_t *cursor)
    cid = (mongoc_cursor_cursorid_t *) cursor->iface_data;
    BSON_ASSERT (cid);
 
+   if (cursor->prefetched) {
+      /* the getMore went out halfway through the last batch */
+      _mongoc_cursor_prepare_getmore_command (cursor, &command);
+      ret = _mongoc_cursor_cursorid_refresh_from_command (
+         cursor, &command, NULL /* opts */, false /* exhaust */);
+      bson_destroy (&command);
+      RETURN (ret);
+   }
+
+   if (cursor->exhaust_allowed && cursor->in_exhaust) {
+      /* the server is streaming batches, read the next without a request */
+      _mongoc_cursor_prepare_getmore_command (cursor, &command);
+      ret = _mongoc_cursor_cursorid_refresh_from_command (
+         cursor, &command, NULL /* opts */, true /* exhaust */);
+      bson_destroy (&command);
+      RETURN (ret);
+   }
+
    server_stream = _mongoc_cursor_fetch_stream (cursor);
 
    if (!server_stream) {
@@ -256,9 +473,20 @@ _mongoc_cursor_cursorid_get_more (mongoc_cursor_t *cursor)
          RETURN (false);
       }
 
-      /* don't pass cursor->opts to getMore */
-      ret = _mongoc_cursor_cursorid_refresh_from_command (
-         cursor, &command, NULL /* opts */);
+      if (_mongoc_cursor_use_streaming (cursor, server_stream)) {
+         /* the cursor takes the stream until the batch has been read */
+         cursor->batch_stats.sent = bson_get_monotonic_time ();
+         ret = _mongoc_cursor_streaming_begin (cursor, server_stream, &command);
+         server_stream = NULL;
+         cid->in_stream = ret;
+      } else {
+         /* don't pass cursor->opts to getMore */
+         ret = _mongoc_cursor_cursorid_refresh_from_command (
+            cursor,
+            &command,
+            NULL /* opts */,
+            _mongoc_cursor_use_opmsg_exhaust (cursor, server_stream));
+      }
 
       bson_destroy (&command);
    } else {
@@ -271,6 +499,35 @@ _mongoc_cursor_cursorid_get_more (mongoc_cursor_t *cursor)
 }
 
 
+/* with "prefetch", once half the batch is read send the getMore for the
+ * next, so the server's reply arrives while the application works */
+static void
+_mongoc_cursor_cursorid_maybe_prefetch (mongoc_cursor_t *cursor)
+{
+   mongoc_cursor_cursorid_t *cid;
+   int64_t limit;
+
+   cid = (mongoc_cursor_cursorid_t *) cursor->iface_data;
+
+   if (!cursor->prefetch || cursor->prefetched || cursor->exhaust_allowed ||
+       !mongoc_cursor_get_id (cursor) || cid->batch_pos * 2 < cid->batch_len ||
+       _mongoc_cursor_get_opt_bool (cursor, MONGOC_CURSOR_TAILABLE) ||
+       cursor->client->cluster.shared) {
+      return;
+   }
+
+   /* nothing to prefetch if this batch reaches the limit. cursor->count
+    * doesn't include the document being returned yet */
+   limit = mongoc_cursor_get_limit (cursor);
+   if (limit > 0 &&
+       cursor->count + 1 + (cid->batch_len - cid->batch_pos) >= limit) {
+      return;
+   }
+
+   _mongoc_cursor_prefetch_send (cursor);
+}
+
+
 bool
 _mongoc_cursor_cursorid_next (mongoc_cursor_t *cursor, const bson_t **bson)
 {
@@ -301,6 +558,7 @@ again:
       _mongoc_cursor_cursorid_read_from_batch (cursor, bson);
 
       if (*bson) {
+         _mongoc_cursor_cursorid_maybe_prefetch (cursor);
          GOTO (done);
       }
 
@@ -313,6 +571,14 @@ again:
       }
 
       cid->in_reader = false;
+   } else if (cid->in_stream) {
+      if (_mongoc_cursor_streaming_next (cursor, bson)) {
+         GOTO (done);
+      }
+
+      if (!_mongoc_cursor_cursorid_end_stream (cursor)) {
+         GOTO (done);
+      }
    }
 
    if (!refreshed && mongoc_cursor_get_id (cursor)) {
@@ -333,6 +599,31 @@ done:
 }
 
 
+static bool
+_mongoc_cursor_cursorid_next_in_batch (mongoc_cursor_t *cursor,
+                                       const bson_t **bson)
+{
+   mongoc_cursor_cursorid_t *cid;
+
+   cid = (mongoc_cursor_cursorid_t *) cursor->iface_data;
+   BSON_ASSERT (cid);
+
+   if (cid->in_batch) {
+      _mongoc_cursor_cursorid_read_from_batch (cursor, bson);
+      if (*bson) {
+         /* the application is about to process the whole batch */
+         _mongoc_cursor_cursorid_maybe_prefetch (cursor);
+      }
+   } else if (cid->in_reader) {
+      _mongoc_read_from_buffer (cursor, bson);
+   }
+
+   /* streamed documents don't share a buffer, each is its own batch */
+
+   return *bson != NULL;
+}
+
+
 static mongoc_cursor_t *
 _mongoc_cursor_cursorid_clone (const mongoc_cursor_t *cursor)
 {
@@ -352,6 +643,9 @@ static mongoc_cursor_interface_t gMongocCursorCursorid = {
    _mongoc_cursor_cursorid_destroy,
    NULL,
    _mongoc_cursor_cursorid_next,
+   NULL,
+   NULL,
+   _mongoc_cursor_cursorid_next_in_batch,
 };
 
 
@@ -0,0 +1,431 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-cursor-group.h"
+#include "mongoc-async-client.h"
+#include "mongoc-async-client-private.h"
+#include "mongoc-error.h"
+#include "mongoc-trace-private.h"
+#include "utlist.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "cursor-group"
+
+
+typedef struct _mongoc_cursor_group_member_t {
+   mongoc_cursor_group_t *group;
+   void *ctx;
+   char *db_name;    /* from the cursor's namespace, once known */
+   char *collection; /* for getMore */
+   int64_t cursor_id;
+   uint32_t server_id; /* the server that has the cursor */
+   int64_t max_await_time_ms;
+   bson_t reply;       /* the current batch */
+   bson_iter_t batch;  /* positioned on the next document if has_doc */
+   bool has_doc;
+   bool failed;
+   bson_error_t error;
+   struct _mongoc_cursor_group_member_t *next;
+   struct _mongoc_cursor_group_member_t *prev;
+} mongoc_cursor_group_member_t;
+
+
+struct _mongoc_cursor_group_t {
+   mongoc_async_client_t *async_client;
+   /* each cursor is either waiting for a reply in the async client, or in
+    * "ready", with documents to return or finished */
+   mongoc_cursor_group_member_t *ready;
+   size_t n_members;
+   bson_t doc; /* the last document returned, in its cursor's batch */
+};
+
+
+static void
+_mongoc_cursor_group_member_destroy (mongoc_cursor_group_member_t *member)
+{
+   bson_free (member->db_name);
+   bson_free (member->collection);
+   bson_destroy (&member->reply);
+   bson_free (member);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_group_new --
+ *
+ *       Create a group of tailable cursors on @pool's servers, all of
+ *       whose getMore commands are outstanding at once on one thread. The
+ *       group has its own mongoc_async_client_t, so it pops one client
+ *       from @pool until it is destroyed.
+ *
+ * Returns:
+ *       A newly allocated mongoc_cursor_group_t.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_cursor_group_t *
+mongoc_cursor_group_new (mongoc_client_pool_t *pool)
+{
+   mongoc_cursor_group_t *group;
+
+   BSON_ASSERT (pool);
+
+   group = (mongoc_cursor_group_t *) bson_malloc0 (sizeof *group);
+   group->async_client = mongoc_async_client_new (pool);
+   bson_init (&group->doc);
+
+   return group;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_group_destroy --
+ *
+ *       Close the group's connections, canceling getMore commands in
+ *       progress, and free its cursors. The server closes the cursors
+ *       when they time out.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_cursor_group_destroy (mongoc_cursor_group_t *group)
+{
+   mongoc_cursor_group_member_t *member, *tmp;
+
+   if (!group) {
+      return;
+   }
+
+   /* commands in progress fail as canceled, so every cursor is ready */
+   mongoc_async_client_destroy (group->async_client);
+
+   DL_FOREACH_SAFE (group->ready, member, tmp)
+   {
+      DL_DELETE (group->ready, member);
+      _mongoc_cursor_group_member_destroy (member);
+   }
+
+   bson_free (group);
+}
+
+
+static void
+_mongoc_cursor_group_cb (bool success,
+                         const bson_t *reply,
+                         const bson_error_t *error,
+                         void *ctx);
+
+
+/* request @member's next batch from the server that has its cursor */
+static void
+_mongoc_cursor_group_get_more (mongoc_cursor_group_member_t *member)
+{
+   bson_t cmd = BSON_INITIALIZER;
+
+   BSON_APPEND_INT64 (&cmd, "getMore", member->cursor_id);
+   BSON_APPEND_UTF8 (&cmd, "collection", member->collection);
+   if (member->max_await_time_ms > 0) {
+      BSON_APPEND_INT64 (&cmd, "maxTimeMS", member->max_await_time_ms);
+   }
+
+   _mongoc_async_client_command_server_id (member->group->async_client,
+                                           member->db_name,
+                                           &cmd,
+                                           NULL,
+                                           &member->server_id,
+                                           _mongoc_cursor_group_cb,
+                                           member);
+
+   bson_destroy (&cmd);
+}
+
+
+/* parse the reply to a cursor command or getMore, as
+ * _mongoc_cursor_cursorid_start_batch does:
+ *
+ *    {cursor: {id: 1234, ns: "db.collection", firstBatch: [...]}}
+ */
+static bool
+_mongoc_cursor_group_start_batch (mongoc_cursor_group_member_t *member)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+   const char *ns;
+   const char *dot;
+   bool has_batch = false;
+
+   member->cursor_id = 0;
+   member->has_doc = false;
+
+   if (!bson_iter_init_find (&iter, &member->reply, "cursor") ||
+       !BSON_ITER_HOLDS_DOCUMENT (&iter) ||
+       !bson_iter_recurse (&iter, &child)) {
+      return false;
+   }
+
+   while (bson_iter_next (&child)) {
+      if (BSON_ITER_IS_KEY (&child, "id")) {
+         member->cursor_id = bson_iter_as_int64 (&child);
+      } else if (BSON_ITER_IS_KEY (&child, "ns") &&
+                 BSON_ITER_HOLDS_UTF8 (&child)) {
+         ns = bson_iter_utf8 (&child, NULL);
+         dot = strchr (ns, '.');
+         if (dot) {
+            bson_free (member->db_name);
+            bson_free (member->collection);
+            member->db_name = bson_strndup (ns, (size_t) (dot - ns));
+            member->collection = bson_strdup (dot + 1);
+         }
+      } else if ((BSON_ITER_IS_KEY (&child, "firstBatch") ||
+                  BSON_ITER_IS_KEY (&child, "nextBatch")) &&
+                 BSON_ITER_HOLDS_ARRAY (&child) &&
+                 bson_iter_recurse (&child, &member->batch)) {
+         has_batch = true;
+      }
+   }
+
+   if (!has_batch || (member->cursor_id && !member->collection)) {
+      return false;
+   }
+
+   /* skip anything that isn't a document */
+   while ((member->has_doc = bson_iter_next (&member->batch)) &&
+          !BSON_ITER_HOLDS_DOCUMENT (&member->batch)) {
+   }
+
+   return true;
+}
+
+
+static void
+_mongoc_cursor_group_cb (bool success,
+                         const bson_t *reply,
+                         const bson_error_t *error,
+                         void *ctx)
+{
+   mongoc_cursor_group_member_t *member = (mongoc_cursor_group_member_t *) ctx;
+   mongoc_cursor_group_t *group = member->group;
+
+   bson_destroy (&member->reply);
+   bson_copy_to (reply, &member->reply);
+
+   if (!success) {
+      member->failed = true;
+      member->cursor_id = 0;
+      member->has_doc = false;
+      memcpy (&member->error, error, sizeof member->error);
+   } else if (!_mongoc_cursor_group_start_batch (member)) {
+      member->failed = true;
+      member->cursor_id = 0;
+      member->has_doc = false;
+      bson_set_error (&member->error,
+                      MONGOC_ERROR_CURSOR,
+                      MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                      "Invalid reply to cursor command");
+   } else if (!member->has_doc && member->cursor_id) {
+      /* the server waited maxAwaitTimeMS with no new data: wait again */
+      _mongoc_cursor_group_get_more (member);
+      return;
+   }
+
+   DL_APPEND (group->ready, member);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_group_add --
+ *
+ *       Begin running @command, which creates a cursor, such as a "find"
+ *       with "tailable" and "awaitData" or an "aggregate" with
+ *       "$changeStream", on a server selected with @read_prefs. Its
+ *       getMore commands run on the same server, with "maxTimeMS" set
+ *       to @max_await_time_ms if it is positive. @ctx identifies the
+ *       cursor in mongoc_cursor_group_next.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_cursor_group_add (mongoc_cursor_group_t *group,
+                         const char *db_name,
+                         const bson_t *command,
+                         const mongoc_read_prefs_t *read_prefs,
+                         int64_t max_await_time_ms,
+                         void *ctx)
+{
+   mongoc_cursor_group_member_t *member;
+
+   ENTRY;
+
+   BSON_ASSERT (group);
+   BSON_ASSERT (db_name);
+   BSON_ASSERT (command);
+
+   member = (mongoc_cursor_group_member_t *) bson_malloc0 (sizeof *member);
+   member->group = group;
+   member->ctx = ctx;
+   member->db_name = bson_strdup (db_name);
+   member->max_await_time_ms = max_await_time_ms;
+   bson_init (&member->reply);
+
+   group->n_members++;
+
+   _mongoc_async_client_command_server_id (group->async_client,
+                                           db_name,
+                                           command,
+                                           read_prefs,
+                                           &member->server_id,
+                                           _mongoc_cursor_group_cb,
+                                           member);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_group_next --
+ *
+ *       Wait up to @timeout_msec, or indefinitely if it is negative, for
+ *       any cursor in the group to have a document. Cursors with
+ *       documents take turns, one document each.
+ *
+ * Returns:
+ *       true with *@doc set to the document and *@ctx to its cursor's ctx.
+ *       *@doc is valid until the next call or mongoc_cursor_group_destroy.
+ *
+ *       false with *@ctx set if a cursor failed, and @error is set, or
+ *       the server closed it: it's removed from the group.
+ *
+ *       false with *@ctx NULL if @timeout_msec passed, or the group is
+ *       empty.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cursor_group_next (mongoc_cursor_group_t *group,
+                          int32_t timeout_msec,
+                          const bson_t **doc,
+                          void **ctx,
+                          bson_error_t *error)
+{
+   mongoc_cursor_group_member_t *member;
+   int64_t expire_at = 0;
+   int64_t now;
+   int32_t wait_msec;
+   const uint8_t *data;
+   uint32_t len;
+
+   ENTRY;
+
+   BSON_ASSERT (group);
+   BSON_ASSERT (doc);
+   BSON_ASSERT (ctx);
+
+   *doc = NULL;
+   *ctx = NULL;
+   if (error) {
+      memset (error, 0, sizeof *error);
+   }
+
+   if (timeout_msec >= 0) {
+      expire_at = bson_get_monotonic_time () + (int64_t) timeout_msec * 1000;
+   }
+
+   while (!group->ready && group->n_members) {
+      if (timeout_msec < 0) {
+         wait_msec = -1;
+      } else {
+         now = bson_get_monotonic_time ();
+         wait_msec = expire_at > now
+                        ? (int32_t) ((expire_at - now + 999) / 1000)
+                        : 0;
+      }
+
+      mongoc_async_client_run_once (group->async_client, wait_msec);
+
+      if (!wait_msec) {
+         break;
+      }
+   }
+
+   if (!(member = group->ready)) {
+      RETURN (false);
+   }
+
+   DL_DELETE (group->ready, member);
+   *ctx = member->ctx;
+
+   if (member->has_doc) {
+      bson_iter_document (&member->batch, &len, &data);
+      BSON_ASSERT (bson_init_static (&group->doc, data, len));
+      *doc = &group->doc;
+
+      while ((member->has_doc = bson_iter_next (&member->batch)) &&
+             !BSON_ITER_HOLDS_DOCUMENT (&member->batch)) {
+      }
+
+      if (member->has_doc || !member->cursor_id) {
+         /* the next document, or the end, after the other cursors' turn */
+         DL_APPEND (group->ready, member);
+      } else {
+         _mongoc_cursor_group_get_more (member);
+      }
+
+      RETURN (true);
+   }
+
+   if (member->failed && error) {
+      memcpy (error, &member->error, sizeof *error);
+   }
+
+   group->n_members--;
+   _mongoc_cursor_group_member_destroy (member);
+
+   RETURN (false);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_group_size --
+ *
+ *       The number of cursors in the group: those added and not yet
+ *       removed by mongoc_cursor_group_next.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+mongoc_cursor_group_size (const mongoc_cursor_group_t *group)
+{
+   BSON_ASSERT (group);
+
+   return group->n_members;
+}
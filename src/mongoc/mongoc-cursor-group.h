@@ -0,0 +1,61 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_CURSOR_GROUP_H
+#define MONGOC_CURSOR_GROUP_H
+
+#if !defined(MONGOC_INSIDE) && !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-macros.h"
+#include "mongoc-client-pool.h"
+#include "mongoc-read-prefs.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_cursor_group_t mongoc_cursor_group_t;
+
+
+MONGOC_EXPORT (mongoc_cursor_group_t *)
+mongoc_cursor_group_new (mongoc_client_pool_t *pool);
+MONGOC_EXPORT (void)
+mongoc_cursor_group_destroy (mongoc_cursor_group_t *group);
+MONGOC_EXPORT (void)
+mongoc_cursor_group_add (mongoc_cursor_group_t *group,
+                         const char *db_name,
+                         const bson_t *command,
+                         const mongoc_read_prefs_t *read_prefs,
+                         int64_t max_await_time_ms,
+                         void *ctx);
+MONGOC_EXPORT (bool)
+mongoc_cursor_group_next (mongoc_cursor_group_t *group,
+                          int32_t timeout_msec,
+                          const bson_t **doc,
+                          void **ctx,
+                          bson_error_t *error);
+MONGOC_EXPORT (size_t)
+mongoc_cursor_group_size (const mongoc_cursor_group_t *group);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_CURSOR_GROUP_H */
@@ -0,0 +1,454 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-cursor.h"
+#include "mongoc-cursor-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-error.h"
+#include "mongoc-trace-private.h"
+#include "mongoc-util-private.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "cursor-merge"
+
+
+typedef struct {
+   mongoc_cursor_t **children;
+   size_t n_children;
+   bson_t sort;
+   bson_t null_doc;
+   bson_iter_t null_value; /* for a missing sort field */
+   const bson_t **heads; /* each child's next document, or NULL */
+   size_t *heap;         /* children with a head, least first */
+   size_t heap_len;
+   bool started;
+   /* the child whose head was returned last, to advance on the next call,
+    * or n_children */
+   size_t last;
+} mongoc_cursor_merge_t;
+
+
+static void
+_mongoc_cursor_merge_init (mongoc_cursor_t *cursor,
+                           mongoc_cursor_t **children,
+                           size_t n_children,
+                           const bson_t *sort);
+
+
+static void
+_mongoc_cursor_merge_destroy (mongoc_cursor_t *cursor)
+{
+   mongoc_cursor_merge_t *merge;
+   size_t i;
+
+   ENTRY;
+
+   merge = (mongoc_cursor_merge_t *) cursor->iface_data;
+
+   for (i = 0; i < merge->n_children; i++) {
+      mongoc_cursor_destroy (merge->children[i]);
+   }
+
+   bson_free (merge->children);
+   bson_free (merge->heads);
+   bson_free (merge->heap);
+   bson_destroy (&merge->sort);
+   bson_destroy (&merge->null_doc);
+   bson_free (merge);
+
+   _mongoc_cursor_destroy (cursor);
+
+   EXIT;
+}
+
+
+/* the value of @doc's possibly dotted @field, or null if it's missing */
+static const bson_iter_t *
+_mongoc_cursor_merge_value (const mongoc_cursor_merge_t *merge,
+                            const bson_t *doc,
+                            const char *field,
+                            bson_iter_t *iter,
+                            bson_iter_t *value)
+{
+   if (bson_iter_init (iter, doc) &&
+       bson_iter_find_descendant (iter, field, value)) {
+      return value;
+   }
+
+   return &merge->null_value;
+}
+
+
+/* compare documents by the sort spec */
+static int
+_mongoc_cursor_merge_cmp (const mongoc_cursor_merge_t *merge,
+                          const bson_t *a,
+                          const bson_t *b)
+{
+   bson_iter_t sort_iter;
+   bson_iter_t iter;
+   bson_iter_t iter_a;
+   bson_iter_t iter_b;
+   const char *field;
+   int cmp = 0;
+
+   BSON_ASSERT (bson_iter_init (&sort_iter, &merge->sort));
+
+   while (!cmp && bson_iter_next (&sort_iter)) {
+      field = bson_iter_key (&sort_iter);
+
+      /* values of a type that isn't compared are equal */
+      if (!_mongoc_bson_iter_cmp (
+             _mongoc_cursor_merge_value (merge, a, field, &iter, &iter_a),
+             _mongoc_cursor_merge_value (merge, b, field, &iter, &iter_b),
+             &cmp)) {
+         cmp = 0;
+      }
+
+      if (bson_iter_as_int64 (&sort_iter) < 0) {
+         cmp = -cmp;
+      }
+   }
+
+   return cmp;
+}
+
+
+/* whether child @a's head sorts before child @b's. Ties go to the child
+ * passed first, so the merge is stable */
+static bool
+_mongoc_cursor_merge_less (const mongoc_cursor_merge_t *merge,
+                           size_t a,
+                           size_t b)
+{
+   int cmp;
+
+   cmp = _mongoc_cursor_merge_cmp (merge, merge->heads[a], merge->heads[b]);
+
+   return cmp < 0 || (cmp == 0 && a < b);
+}
+
+
+static void
+_mongoc_cursor_merge_swap (mongoc_cursor_merge_t *merge, size_t i, size_t j)
+{
+   size_t tmp;
+
+   tmp = merge->heap[i];
+   merge->heap[i] = merge->heap[j];
+   merge->heap[j] = tmp;
+}
+
+
+static void
+_mongoc_cursor_merge_push (mongoc_cursor_merge_t *merge, size_t child)
+{
+   size_t i;
+   size_t parent;
+
+   i = merge->heap_len++;
+   merge->heap[i] = child;
+
+   while (i > 0) {
+      parent = (i - 1) / 2;
+      if (!_mongoc_cursor_merge_less (
+             merge, merge->heap[i], merge->heap[parent])) {
+         break;
+      }
+
+      _mongoc_cursor_merge_swap (merge, i, parent);
+      i = parent;
+   }
+}
+
+
+static size_t
+_mongoc_cursor_merge_pop (mongoc_cursor_merge_t *merge)
+{
+   size_t top;
+   size_t i = 0;
+   size_t child;
+
+   BSON_ASSERT (merge->heap_len);
+
+   top = merge->heap[0];
+   merge->heap[0] = merge->heap[--merge->heap_len];
+
+   for (;;) {
+      child = 2 * i + 1;
+      if (child >= merge->heap_len) {
+         break;
+      }
+
+      if (child + 1 < merge->heap_len &&
+          _mongoc_cursor_merge_less (
+             merge, merge->heap[child + 1], merge->heap[child])) {
+         child++;
+      }
+
+      if (!_mongoc_cursor_merge_less (
+             merge, merge->heap[child], merge->heap[i])) {
+         break;
+      }
+
+      _mongoc_cursor_merge_swap (merge, i, child);
+      i = child;
+   }
+
+   return top;
+}
+
+
+/* get child @i's next document onto the heap. false if the child failed */
+static bool
+_mongoc_cursor_merge_advance (mongoc_cursor_t *cursor, size_t i)
+{
+   mongoc_cursor_merge_t *merge;
+   const bson_t *doc;
+
+   merge = (mongoc_cursor_merge_t *) cursor->iface_data;
+   merge->heads[i] = NULL;
+
+   if (mongoc_cursor_next (merge->children[i], &doc)) {
+      merge->heads[i] = doc;
+      _mongoc_cursor_merge_push (merge, i);
+      return true;
+   }
+
+   if (mongoc_cursor_error (merge->children[i], &cursor->error)) {
+      return false;
+   }
+
+   return true;
+}
+
+
+static bool
+_mongoc_cursor_merge_next (mongoc_cursor_t *cursor, const bson_t **bson)
+{
+   mongoc_cursor_merge_t *merge;
+   size_t i;
+
+   ENTRY;
+
+   merge = (mongoc_cursor_merge_t *) cursor->iface_data;
+   *bson = NULL;
+
+   if (!merge->started) {
+      merge->started = true;
+      /* each child sends its initial command; children with "prefetch"
+       * request their next batches while the merge reads this one */
+      for (i = 0; i < merge->n_children; i++) {
+         if (!_mongoc_cursor_merge_advance (cursor, i)) {
+            cursor->done = true;
+            RETURN (false);
+         }
+      }
+   } else if (merge->last < merge->n_children) {
+      /* the previous document is no longer needed */
+      i = merge->last;
+      merge->last = merge->n_children;
+      if (!_mongoc_cursor_merge_advance (cursor, i)) {
+         cursor->done = true;
+         RETURN (false);
+      }
+   }
+
+   if (!merge->heap_len) {
+      cursor->done = true;
+      RETURN (false);
+   }
+
+   merge->last = _mongoc_cursor_merge_pop (merge);
+   *bson = merge->heads[merge->last];
+
+   RETURN (true);
+}
+
+
+static bool
+_mongoc_cursor_merge_more (mongoc_cursor_t *cursor)
+{
+   mongoc_cursor_merge_t *merge;
+
+   merge = (mongoc_cursor_merge_t *) cursor->iface_data;
+
+   if (CURSOR_FAILED (cursor)) {
+      return false;
+   }
+
+   if (!merge->started || merge->heap_len) {
+      return true;
+   }
+
+   return merge->last < merge->n_children &&
+          mongoc_cursor_more (merge->children[merge->last]);
+}
+
+
+/* the host of the child that returned the last document */
+static void
+_mongoc_cursor_merge_get_host (mongoc_cursor_t *cursor,
+                               mongoc_host_list_t *host)
+{
+   mongoc_cursor_merge_t *merge;
+
+   merge = (mongoc_cursor_merge_t *) cursor->iface_data;
+
+   if (merge->last < merge->n_children) {
+      mongoc_cursor_get_host (merge->children[merge->last], host);
+   } else {
+      mongoc_cursor_get_host (merge->children[0], host);
+   }
+}
+
+
+static mongoc_cursor_t *
+_mongoc_cursor_merge_clone (const mongoc_cursor_t *cursor)
+{
+   mongoc_cursor_merge_t *merge;
+   mongoc_cursor_t **children;
+   mongoc_cursor_t *clone_;
+   size_t i;
+
+   ENTRY;
+
+   merge = (mongoc_cursor_merge_t *) cursor->iface_data;
+
+   children = (mongoc_cursor_t **) bson_malloc (merge->n_children *
+                                                sizeof (mongoc_cursor_t *));
+   for (i = 0; i < merge->n_children; i++) {
+      children[i] = mongoc_cursor_clone (merge->children[i]);
+   }
+
+   clone_ = _mongoc_cursor_clone (cursor);
+   _mongoc_cursor_merge_init (
+      clone_, children, merge->n_children, &merge->sort);
+   bson_free (children);
+
+   RETURN (clone_);
+}
+
+
+static mongoc_cursor_interface_t gMongocCursorMerge = {
+   _mongoc_cursor_merge_clone,
+   _mongoc_cursor_merge_destroy,
+   _mongoc_cursor_merge_more,
+   _mongoc_cursor_merge_next,
+   NULL,
+   _mongoc_cursor_merge_get_host,
+};
+
+
+static void
+_mongoc_cursor_merge_init (mongoc_cursor_t *cursor,
+                           mongoc_cursor_t **children,
+                           size_t n_children,
+                           const bson_t *sort)
+{
+   mongoc_cursor_merge_t *merge;
+
+   ENTRY;
+
+   merge = (mongoc_cursor_merge_t *) bson_malloc0 (sizeof *merge);
+   merge->children = (mongoc_cursor_t **) bson_malloc (
+      n_children * sizeof (mongoc_cursor_t *));
+   memcpy (merge->children, children, n_children * sizeof (mongoc_cursor_t *));
+   merge->n_children = n_children;
+   bson_copy_to (sort, &merge->sort);
+   bson_init (&merge->null_doc);
+   BSON_APPEND_NULL (&merge->null_doc, "null");
+   BSON_ASSERT (
+      bson_iter_init_find (&merge->null_value, &merge->null_doc, "null"));
+   merge->heads =
+      (const bson_t **) bson_malloc0 (n_children * sizeof (const bson_t *));
+   merge->heap = (size_t *) bson_malloc0 (n_children * sizeof (size_t));
+   merge->last = n_children;
+
+   cursor->iface_data = merge;
+   memcpy (
+      &cursor->iface, &gMongocCursorMerge, sizeof (mongoc_cursor_interface_t));
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_new_merged --
+ *
+ *       Create a cursor that merges @n_children cursors, each already
+ *       sorted by @sort, like {"a": 1, "b": -1}, into one stream sorted
+ *       by @sort. The new cursor takes ownership of the children, even
+ *       if they are from different clients.
+ *
+ * Returns:
+ *       A new cursor, to be freed with mongoc_cursor_destroy.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_cursor_t *
+mongoc_cursor_new_merged (mongoc_cursor_t **children,
+                          size_t n_children,
+                          const bson_t *sort)
+{
+   mongoc_cursor_t *cursor;
+   bson_iter_t iter;
+   size_t i;
+
+   BSON_ASSERT (children);
+   BSON_ASSERT (n_children > 0);
+   BSON_ASSERT (sort);
+
+   for (i = 0; i < n_children; i++) {
+      BSON_ASSERT (children[i]);
+   }
+
+   cursor = _mongoc_cursor_new_with_opts (children[0]->client,
+                                          NULL,
+                                          false /* is_command */,
+                                          NULL,
+                                          NULL,
+                                          NULL,
+                                          NULL);
+
+   _mongoc_cursor_merge_init (cursor, children, n_children, sort);
+
+   if (bson_empty (sort) || !bson_iter_init (&iter, sort)) {
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_CURSOR,
+                      MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                      "Cannot merge cursors without a sort specification");
+      return cursor;
+   }
+
+   while (bson_iter_next (&iter)) {
+      if (!BSON_ITER_HOLDS_NUMBER (&iter) || !bson_iter_as_int64 (&iter)) {
+         bson_set_error (&cursor->error,
+                         MONGOC_ERROR_CURSOR,
+                         MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                         "Invalid sort direction for \"%s\", expected 1 or -1",
+                         bson_iter_key (&iter));
+         return cursor;
+      }
+   }
+
+   return cursor;
+}
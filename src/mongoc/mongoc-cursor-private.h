@@ -24,6 +24,7 @@
 #include <bson.h>
 
 #include "mongoc-client.h"
+#include "mongoc-array-private.h"
 #include "mongoc-buffer-private.h"
 #include "mongoc-rpc-private.h"
 #include "mongoc-server-stream-private.h"
@@ -43,8 +44,14 @@ struct _mongoc_cursor_interface_t {
                            bson_error_t *error,
                            const bson_t **doc);
    void (*get_host) (mongoc_cursor_t *cursor, mongoc_host_list_t *host);
+   /* the next document in the current batch, without a getMore */
+   bool (*next_in_batch) (mongoc_cursor_t *cursor, const bson_t **bson);
 };
 
+#define CURSOR_FAILED(cursor_) ((cursor_)->error.domain != 0)
+
+#define MONGOC_CURSOR_ADAPTIVE_BATCH_BYTES "adaptiveBatchBytes"
+#define MONGOC_CURSOR_ADAPTIVE_BATCH_BYTES_LEN 18
 #define MONGOC_CURSOR_ALLOW_PARTIAL_RESULTS "allowPartialResults"
 #define MONGOC_CURSOR_ALLOW_PARTIAL_RESULTS_LEN 19
 #define MONGOC_CURSOR_AWAIT_DATA "awaitData"
@@ -57,6 +64,8 @@ struct _mongoc_cursor_interface_t {
 #define MONGOC_CURSOR_COMMENT_LEN 7
 #define MONGOC_CURSOR_EXHAUST "exhaust"
 #define MONGOC_CURSOR_EXHAUST_LEN 7
+#define MONGOC_CURSOR_EXHAUST_ALLOWED "exhaustAllowed"
+#define MONGOC_CURSOR_EXHAUST_ALLOWED_LEN 14
 #define MONGOC_CURSOR_FILTER "filter"
 #define MONGOC_CURSOR_FILTER_LEN 6
 #define MONGOC_CURSOR_FIND "find"
@@ -81,6 +90,8 @@ struct _mongoc_cursor_interface_t {
 #define MONGOC_CURSOR_OPLOG_REPLAY_LEN 11
 #define MONGOC_CURSOR_ORDERBY "orderby"
 #define MONGOC_CURSOR_ORDERBY_LEN 7
+#define MONGOC_CURSOR_PREFETCH "prefetch"
+#define MONGOC_CURSOR_PREFETCH_LEN 8
 #define MONGOC_CURSOR_PROJECTION "projection"
 #define MONGOC_CURSOR_PROJECTION_LEN 10
 #define MONGOC_CURSOR_QUERY "query"
@@ -101,9 +112,23 @@ struct _mongoc_cursor_interface_t {
 #define MONGOC_CURSOR_SNAPSHOT_LEN 8
 #define MONGOC_CURSOR_SORT "sort"
 #define MONGOC_CURSOR_SORT_LEN 4
+#define MONGOC_CURSOR_SPILL_BATCH_BYTES "spillBatchBytes"
+#define MONGOC_CURSOR_SPILL_BATCH_BYTES_LEN 15
+#define MONGOC_CURSOR_STREAM_BATCHES "streamBatches"
+#define MONGOC_CURSOR_STREAM_BATCHES_LEN 13
 #define MONGOC_CURSOR_TAILABLE "tailable"
 #define MONGOC_CURSOR_TAILABLE_LEN 8
 
+/* the current batch, to size the next with "adaptiveBatchBytes" */
+typedef struct _mongoc_cursor_batch_stats_t {
+   uint32_t n_docs;
+   uint32_t n_bytes;
+   int64_t sent;            /* when its command was sent, or 0 */
+   int64_t received;        /* when it arrived */
+   int64_t batch_size;      /* batchSize of the last getMore, or 0 */
+   int64_t next_batch_size; /* batchSize for the next getMore, or 0 */
+} mongoc_cursor_batch_stats_t;
+
 struct _mongoc_cursor_t {
    mongoc_client_t *client;
 
@@ -117,6 +142,10 @@ struct _mongoc_cursor_t {
    unsigned end_of_event : 1;
    unsigned has_fields : 1;
    unsigned in_exhaust : 1;
+   unsigned sent_hedged : 1;
+   unsigned exhaust_allowed : 1; /* let OP_MSG getMores stream batches */
+   unsigned prefetch : 1;        /* send getMores halfway through a batch */
+   unsigned stream_batches : 1;  /* return getMore documents as they arrive */
 
    bson_t filter;
    bson_t opts;
@@ -141,11 +170,38 @@ struct _mongoc_cursor_t {
    bson_reader_t *reader;
    const bson_t *current;
 
+   /* for mongoc_cursor_next_batch, uint32_t offsets of its documents */
+   mongoc_array_t batch_offsets;
+
    mongoc_cursor_interface_t iface;
    void *iface_data;
 
    int64_t operation_id;
    mongoc_client_session_t *session;
+
+   /* hedgeDelayMS: send the initial command to a second server if the
+    * first hasn't replied after this long. 0 to never hedge */
+   int32_t hedge_delay_msec;
+
+   /* adaptiveBatchBytes: without a batchSize, size getMores to return up
+    * to this many bytes, judged by the documents so far. 0 to let the
+    * server choose */
+   int32_t adaptive_batch_bytes;
+   mongoc_cursor_batch_stats_t batch_stats;
+
+   /* the getMore "prefetch" sent before the end of the batch, or NULL */
+   struct _mongoc_cursor_prefetch_t *prefetched;
+
+   /* with "streamBatches", the getMore whose batch is being read off the
+    * connection, or NULL */
+   struct _mongoc_cursor_streaming_t *streaming;
+
+   /* spillBatchBytes: command replies larger than this are moved to a
+    * mapped temporary file, spill_map, of spill_len bytes. 0 to never
+    * spill */
+   int32_t spill_batch_bytes;
+   void *spill_map;
+   size_t spill_len;
 };
 
 
@@ -179,6 +235,8 @@ mongoc_cursor_t *
 _mongoc_cursor_clone (const mongoc_cursor_t *cursor);
 void
 _mongoc_cursor_destroy (mongoc_cursor_t *cursor);
+void
+_mongoc_cursor_cache_destroy (mongoc_client_t *client);
 bool
 _mongoc_read_from_buffer (mongoc_cursor_t *cursor, const bson_t **bson);
 bool
@@ -202,6 +260,35 @@ _mongoc_cursor_run_command (mongoc_cursor_t *cursor,
                             const bson_t *opts,
                             bson_t *reply);
 bool
+_mongoc_cursor_use_opmsg_exhaust (const mongoc_cursor_t *cursor,
+                                  const mongoc_server_stream_t *server_stream);
+bool
+_mongoc_cursor_run_exhaust (mongoc_cursor_t *cursor,
+                            const bson_t *command,
+                            bson_t *reply);
+void
+_mongoc_cursor_prefetch_send (mongoc_cursor_t *cursor);
+bool
+_mongoc_cursor_prefetch_take (mongoc_cursor_t *cursor, bson_t *reply);
+void
+_mongoc_cursor_spill (mongoc_cursor_t *cursor, bson_t *reply);
+void
+_mongoc_cursor_spill_release (mongoc_cursor_t *cursor);
+bool
+_mongoc_cursor_use_streaming (const mongoc_cursor_t *cursor,
+                              const mongoc_server_stream_t *server_stream);
+bool
+_mongoc_cursor_streaming_begin (mongoc_cursor_t *cursor,
+                                mongoc_server_stream_t *server_stream,
+                                const bson_t *command);
+bool
+_mongoc_cursor_streaming_next (mongoc_cursor_t *cursor, const bson_t **bson);
+bool
+_mongoc_cursor_streaming_take (mongoc_cursor_t *cursor,
+                               bson_t *reply,
+                               uint32_t *n_docs,
+                               uint32_t *n_bytes);
+bool
 _mongoc_cursor_more (mongoc_cursor_t *cursor);
 bool
 _mongoc_cursor_next (mongoc_cursor_t *cursor, const bson_t **bson);
@@ -15,12 +15,22 @@
  */
 
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#endif
+
 #include "mongoc-cursor.h"
 #include "mongoc-cursor-private.h"
 #include "mongoc-client-private.h"
+#include "mongoc-client-session-private.h"
 #include "mongoc-counters-private.h"
 #include "mongoc-error.h"
 #include "mongoc-log.h"
+#include "mongoc-memory-private.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-cursor-cursorid-private.h"
 #include "mongoc-read-concern-private.h"
@@ -33,8 +43,6 @@
 #define MONGOC_LOG_DOMAIN "cursor"
 
 
-#define CURSOR_FAILED(cursor_) ((cursor_)->error.domain != 0)
-
 static bool
 _translate_query_opt (const char *query_field,
                       const char **cmd_field,
@@ -201,6 +209,89 @@ _first_dollar_field (const bson_t *bson)
 }
 
 
+/* a cached cursor keeps a reply buffer up to this size, not larger ones
+ * grown by an unusually large batch */
+#define MONGOC_CURSOR_CACHE_MAX_BUFFER (64 * 1024)
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_alloc --
+ *
+ *       Allocate a zeroed cursor with an initialized reply buffer and
+ *       batch offsets array, reusing a cursor that @client cached when
+ *       it was destroyed, along with its buffer and array, if any.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_cursor_t *
+_mongoc_cursor_alloc (mongoc_client_t *client)
+{
+   mongoc_cursor_t *cursor;
+   mongoc_buffer_t buffer;
+   mongoc_array_t batch_offsets;
+
+   if (!client->n_cached_cursors) {
+      cursor = (mongoc_cursor_t *) _mongoc_malloc0_tagged (
+         MONGOC_MEMORY_TAG_CURSOR, sizeof *cursor);
+      _mongoc_array_init (&cursor->batch_offsets, sizeof (uint32_t));
+      _mongoc_buffer_init_tagged (&cursor->buffer, MONGOC_MEMORY_TAG_CURSOR);
+      _mongoc_buffer_set_budget (&cursor->buffer, client->budget);
+
+      return cursor;
+   }
+
+   cursor = client->cursor_cache[--client->n_cached_cursors];
+
+   /* neither has pointers into itself, so they survive the memset */
+   buffer = cursor->buffer;
+   batch_offsets = cursor->batch_offsets;
+
+   memset (cursor, 0, sizeof *cursor);
+
+   cursor->buffer = buffer;
+   _mongoc_buffer_clear (&cursor->buffer, false);
+   cursor->batch_offsets = batch_offsets;
+   _mongoc_array_clear (&cursor->batch_offsets);
+
+   return cursor;
+}
+
+
+/* free @cursor, or keep it in its client's cache for _mongoc_cursor_alloc */
+static void
+_mongoc_cursor_free (mongoc_cursor_t *cursor)
+{
+   mongoc_client_t *client = cursor->client;
+
+   if (client->n_cached_cursors < MONGOC_CLIENT_CURSOR_CACHE_SIZE &&
+       cursor->buffer.datalen <= MONGOC_CURSOR_CACHE_MAX_BUFFER) {
+      client->cursor_cache[client->n_cached_cursors++] = cursor;
+      return;
+   }
+
+   _mongoc_buffer_destroy (&cursor->buffer);
+   _mongoc_array_destroy (&cursor->batch_offsets);
+   _mongoc_free_tagged (MONGOC_MEMORY_TAG_CURSOR, cursor);
+}
+
+
+void
+_mongoc_cursor_cache_destroy (mongoc_client_t *client)
+{
+   mongoc_cursor_t *cursor;
+
+   while (client->n_cached_cursors) {
+      cursor = client->cursor_cache[--client->n_cached_cursors];
+      _mongoc_buffer_destroy (&cursor->buffer);
+      _mongoc_array_destroy (&cursor->batch_offsets);
+      _mongoc_free_tagged (MONGOC_MEMORY_TAG_CURSOR, cursor);
+   }
+}
+
+
 #define MARK_FAILED(c)          \
    do {                         \
       (c)->done = true;         \
@@ -223,12 +314,13 @@ _mongoc_cursor_new_with_opts (mongoc_client_t *client,
    uint32_t server_id;
    bson_error_t validate_err;
    const char *dollar_field;
+   bson_iter_t iter;
 
    ENTRY;
 
    BSON_ASSERT (client);
 
-   cursor = (mongoc_cursor_t *) bson_malloc0 (sizeof *cursor);
+   cursor = _mongoc_cursor_alloc (client);
    cursor->client = client;
    cursor->is_command = is_command ? 1 : 0;
 
@@ -275,7 +367,17 @@ _mongoc_cursor_new_with_opts (mongoc_client_t *client,
          GOTO (finish);
       }
 
-      bson_copy_to_excluding_noinit (opts, &cursor->opts, "serverId", NULL);
+      bson_copy_to_excluding_noinit (opts,
+                                     &cursor->opts,
+                                     "serverId",
+                                     "sessionId",
+                                     "hedgeDelayMS",
+                                     MONGOC_CURSOR_EXHAUST_ALLOWED,
+                                     MONGOC_CURSOR_PREFETCH,
+                                     MONGOC_CURSOR_ADAPTIVE_BATCH_BYTES,
+                                     MONGOC_CURSOR_SPILL_BATCH_BYTES,
+                                     MONGOC_CURSOR_STREAM_BATCHES,
+                                     NULL);
 
       /* true if there's a valid serverId or no serverId, false on err */
       if (!_mongoc_get_server_id_from_opts (opts,
@@ -290,6 +392,97 @@ _mongoc_cursor_new_with_opts (mongoc_client_t *client,
       if (server_id) {
          mongoc_cursor_set_hint (cursor, server_id);
       }
+
+      if (!_mongoc_client_session_from_opts (
+             client, opts, &cursor->session, &cursor->error)) {
+         MARK_FAILED (cursor);
+         GOTO (finish);
+      }
+
+      if (bson_iter_init_find (&iter, opts, "hedgeDelayMS")) {
+         if (!BSON_ITER_HOLDS_INT (&iter) || bson_iter_as_int64 (&iter) < 0 ||
+             bson_iter_as_int64 (&iter) > INT32_MAX) {
+            bson_set_error (&cursor->error,
+                            MONGOC_ERROR_CURSOR,
+                            MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                            "The hedgeDelayMS option must be a non-negative "
+                            "32-bit integer");
+            MARK_FAILED (cursor);
+            GOTO (finish);
+         }
+
+         cursor->hedge_delay_msec = (int32_t) bson_iter_as_int64 (&iter);
+      }
+
+      if (bson_iter_init_find (&iter, opts, MONGOC_CURSOR_EXHAUST_ALLOWED)) {
+         if (!BSON_ITER_HOLDS_BOOL (&iter)) {
+            bson_set_error (&cursor->error,
+                            MONGOC_ERROR_CURSOR,
+                            MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                            "The exhaustAllowed option must be a boolean");
+            MARK_FAILED (cursor);
+            GOTO (finish);
+         }
+
+         cursor->exhaust_allowed = bson_iter_bool (&iter);
+      }
+
+      if (bson_iter_init_find (&iter, opts, MONGOC_CURSOR_PREFETCH)) {
+         if (!BSON_ITER_HOLDS_BOOL (&iter)) {
+            bson_set_error (&cursor->error,
+                            MONGOC_ERROR_CURSOR,
+                            MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                            "The prefetch option must be a boolean");
+            MARK_FAILED (cursor);
+            GOTO (finish);
+         }
+
+         cursor->prefetch = bson_iter_bool (&iter);
+      }
+
+      if (bson_iter_init_find (&iter, opts, MONGOC_CURSOR_STREAM_BATCHES)) {
+         if (!BSON_ITER_HOLDS_BOOL (&iter)) {
+            bson_set_error (&cursor->error,
+                            MONGOC_ERROR_CURSOR,
+                            MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                            "The streamBatches option must be a boolean");
+            MARK_FAILED (cursor);
+            GOTO (finish);
+         }
+
+         cursor->stream_batches = bson_iter_bool (&iter);
+      }
+
+      if (bson_iter_init_find (
+             &iter, opts, MONGOC_CURSOR_ADAPTIVE_BATCH_BYTES)) {
+         if (!BSON_ITER_HOLDS_INT (&iter) || bson_iter_as_int64 (&iter) < 0 ||
+             bson_iter_as_int64 (&iter) > INT32_MAX) {
+            bson_set_error (&cursor->error,
+                            MONGOC_ERROR_CURSOR,
+                            MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                            "The adaptiveBatchBytes option must be a "
+                            "non-negative 32-bit integer");
+            MARK_FAILED (cursor);
+            GOTO (finish);
+         }
+
+         cursor->adaptive_batch_bytes = (int32_t) bson_iter_as_int64 (&iter);
+      }
+
+      if (bson_iter_init_find (&iter, opts, MONGOC_CURSOR_SPILL_BATCH_BYTES)) {
+         if (!BSON_ITER_HOLDS_INT (&iter) || bson_iter_as_int64 (&iter) < 0 ||
+             bson_iter_as_int64 (&iter) > INT32_MAX) {
+            bson_set_error (&cursor->error,
+                            MONGOC_ERROR_CURSOR,
+                            MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                            "The spillBatchBytes option must be a "
+                            "non-negative 32-bit integer");
+            MARK_FAILED (cursor);
+            GOTO (finish);
+         }
+
+         cursor->spill_batch_bytes = (int32_t) bson_iter_as_int64 (&iter);
+      }
    }
 
    cursor->read_prefs = read_prefs
@@ -324,9 +517,18 @@ _mongoc_cursor_new_with_opts (mongoc_client_t *client,
          MARK_FAILED (cursor);
          GOTO (finish);
       }
+
+      /* an exhaust cursor needs the same connection for every batch */
+      if (client->cluster.shared) {
+         bson_set_error (&cursor->error,
+                         MONGOC_ERROR_CURSOR,
+                         MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                         "Cannot use exhaust cursor with sharedConnections.");
+         MARK_FAILED (cursor);
+         GOTO (finish);
+      }
    }
 
-   _mongoc_buffer_init (&cursor->buffer, NULL, 0, NULL, NULL);
    _mongoc_read_prefs_validate (read_prefs, &cursor->error);
 
 finish:
@@ -523,6 +725,28 @@ _mongoc_cursor_destroy (mongoc_cursor_t *cursor)
 
    BSON_ASSERT (cursor);
 
+   if (cursor->prefetched) {
+      /* read the getMore's reply off the connection, then kill the cursor
+       * as usual */
+      bson_t reply;
+
+      _mongoc_cursor_prefetch_take (cursor, &reply);
+      bson_destroy (&reply);
+   }
+
+   if (cursor->streaming) {
+      /* likewise, read the rest of the batch off the connection */
+      const bson_t *doc;
+      bson_t reply;
+
+      while (_mongoc_cursor_streaming_next (cursor, &doc)) {
+         /* discard it */
+      }
+
+      _mongoc_cursor_streaming_take (cursor, &reply, NULL, NULL);
+      bson_destroy (&reply);
+   }
+
    if (cursor->in_exhaust) {
       cursor->client->in_exhaust = false;
       if (!cursor->done) {
@@ -546,7 +770,6 @@ _mongoc_cursor_destroy (mongoc_cursor_t *cursor)
       cursor->reader = NULL;
    }
 
-   _mongoc_buffer_destroy (&cursor->buffer);
    mongoc_read_prefs_destroy (cursor->read_prefs);
    mongoc_read_concern_destroy (cursor->read_concern);
    mongoc_write_concern_destroy (cursor->write_concern);
@@ -554,7 +777,8 @@ _mongoc_cursor_destroy (mongoc_cursor_t *cursor)
    bson_destroy (&cursor->filter);
    bson_destroy (&cursor->opts);
    bson_destroy (&cursor->error_doc);
-   bson_free (cursor);
+   _mongoc_cursor_spill_release (cursor);
+   _mongoc_cursor_free (cursor);
 
    mongoc_counter_cursors_active_dec ();
    mongoc_counter_cursors_disposed_inc ();
@@ -566,6 +790,7 @@ _mongoc_cursor_destroy (mongoc_cursor_t *cursor)
 mongoc_server_stream_t *
 _mongoc_cursor_fetch_stream (mongoc_cursor_t *cursor)
 {
+   mongoc_read_prefs_t *session_prefs;
    mongoc_server_stream_t *server_stream;
 
    ENTRY;
@@ -576,9 +801,23 @@ _mongoc_cursor_fetch_stream (mongoc_cursor_t *cursor)
                                            cursor->server_id,
                                            true /* reconnect_ok */,
                                            &cursor->error);
+   } else if (_mongoc_client_session_in_transaction (cursor->session)) {
+      /* where the transaction's first statement went */
+      server_stream =
+         _mongoc_client_session_stream (cursor->session, &cursor->error);
+
+      if (server_stream) {
+         cursor->server_id = server_stream->sd->id;
+      }
    } else {
+      /* in a causally consistent session, prefer caught-up secondaries */
+      session_prefs = _mongoc_client_session_read_prefs (cursor->session,
+                                                         cursor->read_prefs);
       server_stream = mongoc_cluster_stream_for_reads (
-         &cursor->client->cluster, cursor->read_prefs, &cursor->error);
+         &cursor->client->cluster,
+         COALESCE (session_prefs, cursor->read_prefs),
+         &cursor->error);
+      mongoc_read_prefs_destroy (session_prefs);
 
       if (server_stream) {
          cursor->server_id = server_stream->sd->id;
@@ -671,7 +910,9 @@ _mongoc_cursor_monitor_command (mongoc_cursor_t *cursor,
    ENTRY;
 
    client = cursor->client;
-   if (!client->apm_callbacks.started) {
+   if (!client->apm_callbacks.started ||
+       !_mongoc_apm_command_sampled (&client->apm_callbacks,
+                                     cursor->operation_id)) {
       /* successful */
       RETURN (true);
    }
@@ -707,7 +948,9 @@ _mongoc_cursor_monitor_legacy_query (mongoc_cursor_t *cursor,
    ENTRY;
 
    client = cursor->client;
-   if (!client->apm_callbacks.started) {
+   if (!client->apm_callbacks.started ||
+       !_mongoc_apm_command_sampled (&client->apm_callbacks,
+                                     cursor->operation_id)) {
       /* successful */
       RETURN (true);
    }
@@ -753,6 +996,39 @@ _mongoc_cursor_append_docs_array (mongoc_cursor_t *cursor, bson_t *docs)
 }
 
 
+typedef struct {
+   mongoc_cursor_t *cursor;
+   bool first_batch;
+} _mongoc_cursor_reply_ctx_t;
+
+
+/* fake reply to find/getMore command:
+ * {ok: 1, cursor: {id: 17, ns: "...", first/nextBatch: [ ... docs ... ]}}
+ * it copies the whole batch, so it's only built if a callback asks for it */
+static void
+_mongoc_cursor_build_reply (void *ctx, bson_t *reply)
+{
+   _mongoc_cursor_reply_ctx_t *reply_ctx = (_mongoc_cursor_reply_ctx_t *) ctx;
+   mongoc_cursor_t *cursor = reply_ctx->cursor;
+   bson_t docs_array;
+   bson_t reply_cursor;
+
+   bson_init (&docs_array);
+   _mongoc_cursor_append_docs_array (cursor, &docs_array);
+
+   bson_append_int32 (reply, "ok", 2, 1);
+   bson_append_document_begin (reply, "cursor", 6, &reply_cursor);
+   bson_append_int64 (&reply_cursor, "id", 2, mongoc_cursor_get_id (cursor));
+   bson_append_utf8 (&reply_cursor, "ns", 2, cursor->ns, cursor->nslen);
+   bson_append_array (&reply_cursor,
+                      reply_ctx->first_batch ? "firstBatch" : "nextBatch",
+                      reply_ctx->first_batch ? 10 : 9,
+                      &docs_array);
+   bson_append_document_end (reply, &reply_cursor);
+   bson_destroy (&docs_array);
+}
+
+
 static void
 _mongoc_cursor_monitor_succeeded (mongoc_cursor_t *cursor,
                                   int64_t duration,
@@ -762,14 +1038,16 @@ _mongoc_cursor_monitor_succeeded (mongoc_cursor_t *cursor,
 {
    mongoc_apm_command_succeeded_t event;
    mongoc_client_t *client;
+   _mongoc_cursor_reply_ctx_t reply_ctx;
    bson_t reply;
-   bson_t reply_cursor;
 
    ENTRY;
 
    client = cursor->client;
 
-   if (!client->apm_callbacks.succeeded) {
+   if (!client->apm_callbacks.succeeded ||
+       !_mongoc_apm_command_sampled (&client->apm_callbacks,
+                                     cursor->operation_id)) {
       EXIT;
    }
 
@@ -779,42 +1057,34 @@ _mongoc_cursor_monitor_succeeded (mongoc_cursor_t *cursor,
          MONGOC_ERROR ("_mongoc_cursor_monitor_succeeded can't parse reply");
          EXIT;
       }
-   } else {
-      bson_t docs_array;
 
-      /* fake reply to find/getMore command:
-       * {ok: 1, cursor: {id: 17, ns: "...", first/nextBatch: [ ... docs ... ]}}
-       */
-      bson_init (&docs_array);
-      _mongoc_cursor_append_docs_array (cursor, &docs_array);
-
-      bson_init (&reply);
-      bson_append_int32 (&reply, "ok", 2, 1);
-      bson_append_document_begin (&reply, "cursor", 6, &reply_cursor);
-      bson_append_int64 (&reply_cursor, "id", 2, mongoc_cursor_get_id (cursor));
-      bson_append_utf8 (&reply_cursor, "ns", 2, cursor->ns, cursor->nslen);
-      bson_append_array (&reply_cursor,
-                         first_batch ? "firstBatch" : "nextBatch",
-                         first_batch ? 10 : 9,
-                         &docs_array);
-      bson_append_document_end (&reply, &reply_cursor);
-      bson_destroy (&docs_array);
-   }
-
-   mongoc_apm_command_succeeded_init (&event,
-                                      duration,
-                                      &reply,
-                                      cmd_name,
-                                      client->cluster.request_id,
-                                      cursor->operation_id,
-                                      &stream->sd->host,
-                                      stream->sd->id,
-                                      client->apm_context);
+      mongoc_apm_command_succeeded_init (&event,
+                                         duration,
+                                         &reply,
+                                         cmd_name,
+                                         client->cluster.request_id,
+                                         cursor->operation_id,
+                                         &stream->sd->host,
+                                         stream->sd->id,
+                                         client->apm_context);
+   } else {
+      reply_ctx.cursor = cursor;
+      reply_ctx.first_batch = first_batch;
+      mongoc_apm_command_succeeded_init_lazy (&event,
+                                              duration,
+                                              _mongoc_cursor_build_reply,
+                                              &reply_ctx,
+                                              cmd_name,
+                                              client->cluster.request_id,
+                                              cursor->operation_id,
+                                              &stream->sd->host,
+                                              stream->sd->id,
+                                              client->apm_context);
+   }
 
    client->apm_callbacks.succeeded (&event);
 
    mongoc_apm_command_succeeded_cleanup (&event);
-   bson_destroy (&reply);
 
    EXIT;
 }
@@ -833,7 +1103,9 @@ _mongoc_cursor_monitor_failed (mongoc_cursor_t *cursor,
 
    client = cursor->client;
 
-   if (!client->apm_callbacks.failed) {
+   if (!client->apm_callbacks.failed ||
+       !_mongoc_apm_command_sampled (&client->apm_callbacks,
+                                     cursor->operation_id)) {
       EXIT;
    }
 
@@ -1296,6 +1568,118 @@ done:
 }
 
 
+/* append @opts and the cursor's flags and write concern to @parts, and
+ * assemble the command for @server_stream */
+static bool
+_mongoc_cursor_assemble_command (mongoc_cursor_t *cursor,
+                                 mongoc_cmd_parts_t *parts,
+                                 const bson_t *opts,
+                                 char *db,
+                                 mongoc_server_stream_t *server_stream,
+                                 bson_error_t *error)
+{
+   bson_iter_t iter;
+
+   if (opts) {
+      bson_iter_init (&iter, opts);
+      if (!mongoc_cmd_parts_append_opts (parts,
+                                         &iter,
+                                         server_stream->sd->max_wire_version,
+                                         error)) {
+         return false;
+      }
+   }
+
+   bson_strncpy (db, cursor->ns, cursor->dblen + 1);
+   parts->assembled.db_name = db;
+
+   if (!_mongoc_cursor_flags (
+          cursor, server_stream, &parts->user_query_flags)) {
+      return false;
+   }
+
+   if (cursor->write_concern &&
+       !mongoc_write_concern_is_default (cursor->write_concern) &&
+       server_stream->sd->max_wire_version >= WIRE_VERSION_CMD_WRITE_CONCERN) {
+      mongoc_write_concern_append (cursor->write_concern, &parts->extra);
+   }
+
+   return mongoc_cmd_parts_assemble (parts, server_stream, error);
+}
+
+
+/* the second server's copy of a hedged initial command */
+typedef struct _mongoc_cursor_hedge_t {
+   mongoc_cursor_t *cursor;
+   const bson_t *command;
+   const bson_t *opts;
+   uint32_t first_server_id;
+   mongoc_server_stream_t *server_stream;
+   mongoc_cmd_parts_t parts;
+   bool parts_initialized;
+   char db[MONGOC_NAMESPACE_MAX];
+} mongoc_cursor_hedge_t;
+
+
+/* a mongoc_cluster_hedge_cb_t: select another server and assemble the
+ * command for it. Failures just mean the read isn't hedged. */
+static mongoc_cmd_t *
+_mongoc_cursor_hedge_cb (void *ctx)
+{
+   mongoc_cursor_hedge_t *hedge = (mongoc_cursor_hedge_t *) ctx;
+   mongoc_cursor_t *cursor = hedge->cursor;
+   uint32_t server_id;
+   bson_error_t error;
+
+   server_id = _mongoc_topology_select_hedge_server_id (
+      cursor->client->topology, cursor->read_prefs, hedge->first_server_id);
+   if (!server_id) {
+      return NULL;
+   }
+
+   hedge->server_stream = mongoc_cluster_stream_for_server (
+      &cursor->client->cluster, server_id, true /* reconnect_ok */, &error);
+   if (!hedge->server_stream ||
+       hedge->server_stream->sd->max_wire_version < WIRE_VERSION_OP_MSG) {
+      return NULL;
+   }
+
+   mongoc_cmd_parts_init (
+      &hedge->parts, hedge->db, MONGOC_QUERY_NONE, hedge->command);
+   hedge->parts_initialized = true;
+   hedge->parts.read_prefs = cursor->read_prefs;
+   hedge->parts.session = cursor->session;
+   hedge->parts.assembled.operation_id = cursor->operation_id;
+
+   if (!_mongoc_cursor_assemble_command (cursor,
+                                         &hedge->parts,
+                                         hedge->opts,
+                                         hedge->db,
+                                         hedge->server_stream,
+                                         &error)) {
+      return NULL;
+   }
+
+   return &hedge->parts.assembled;
+}
+
+
+/* hedge the first command of a cursor created with hedgeDelayMS, unless
+ * it targets a server, or can't be sent as OP_MSG, or must go to the
+ * primary, or is a transaction's */
+static bool
+_mongoc_cursor_use_hedge (const mongoc_cursor_t *cursor,
+                          const mongoc_server_stream_t *server_stream)
+{
+   return cursor->hedge_delay_msec > 0 && !cursor->server_id_set &&
+          !cursor->sent_hedged &&
+          !_mongoc_client_session_in_transaction (cursor->session) &&
+          server_stream->sd->max_wire_version >= WIRE_VERSION_OP_MSG &&
+          mongoc_read_prefs_get_mode (cursor->read_prefs) !=
+             MONGOC_READ_PRIMARY;
+}
+
+
 bool
 _mongoc_cursor_run_command (mongoc_cursor_t *cursor,
                             const bson_t *command,
@@ -1304,9 +1688,12 @@ _mongoc_cursor_run_command (mongoc_cursor_t *cursor,
 {
    mongoc_cluster_t *cluster;
    mongoc_server_stream_t *server_stream;
-   bson_iter_t iter;
+   mongoc_server_stream_t *retry_stream = NULL;
    mongoc_cmd_parts_t parts;
+   mongoc_cursor_hedge_t hedge = {0};
+   mongoc_cmd_t *winner;
    char db[MONGOC_NAMESPACE_MAX];
+   bool selected;
    bool ret = false;
 
    ENTRY;
@@ -1316,43 +1703,74 @@ _mongoc_cursor_run_command (mongoc_cursor_t *cursor,
    parts.read_prefs = cursor->read_prefs;
    parts.session = cursor->session;
    parts.assembled.operation_id = cursor->operation_id;
+
+   /* getMore, commands for a server chosen with a hint, and a transaction's
+    * commands must run on cursor->server_id and aren't retried elsewhere */
+   selected = !cursor->server_id &&
+              !_mongoc_client_session_in_transaction (cursor->session);
    server_stream = _mongoc_cursor_fetch_stream (cursor);
 
    if (!server_stream) {
       GOTO (done);
    }
 
-   if (opts) {
-      bson_iter_init (&iter, opts);
-      if (!mongoc_cmd_parts_append_opts (&parts,
-                                         &iter,
-                                         server_stream->sd->max_wire_version,
-                                         &cursor->error)) {
-         GOTO (done);
-      }
+   if (!_mongoc_cursor_assemble_command (
+          cursor, &parts, opts, db, server_stream, &cursor->error)) {
+      _mongoc_bson_init_if_set (reply);
+      GOTO (done);
    }
 
-   bson_strncpy (db, cursor->ns, cursor->dblen + 1);
-   parts.assembled.db_name = db;
+   if (_mongoc_cursor_use_hedge (cursor, server_stream)) {
+      cursor->sent_hedged = true;
+      hedge.cursor = cursor;
+      hedge.command = command;
+      hedge.opts = opts;
+      hedge.first_server_id = server_stream->sd->id;
+
+      ret = _mongoc_cluster_run_opmsg_hedged (cluster,
+                                              &parts.assembled,
+                                              cursor->hedge_delay_msec,
+                                              _mongoc_cursor_hedge_cb,
+                                              &hedge,
+                                              &winner,
+                                              reply,
+                                              &cursor->error);
+
+      /* getMore and killCursors must go where the cursor was created */
+      cursor->server_id = winner->server_stream->sd->id;
+   } else {
+      ret = mongoc_cluster_run_command_monitored (
+         cluster, &parts.assembled, reply, &cursor->error);
 
-   if (!_mongoc_cursor_flags (cursor, server_stream, &parts.user_query_flags)) {
-      GOTO (done);
-   }
+      /* "aggregate" with "$out" has a write concern, and isn't retried */
+      if (!ret && selected && !cursor->write_concern) {
+         retry_stream = _mongoc_cluster_stream_for_read_retry (
+            cluster, cursor->read_prefs, server_stream, &cursor->error);
+      }
 
-   if (cursor->write_concern &&
-       !mongoc_write_concern_is_default (cursor->write_concern) &&
-       server_stream->sd->max_wire_version >= WIRE_VERSION_CMD_WRITE_CONCERN) {
-      mongoc_write_concern_append (cursor->write_concern, &parts.extra);
-   }
+      if (retry_stream) {
+         /* assemble again, the command depends on the server type */
+         mongoc_cmd_parts_cleanup (&parts);
+         mongoc_cmd_parts_init (&parts, db, MONGOC_QUERY_NONE, command);
+         parts.read_prefs = cursor->read_prefs;
+         parts.session = cursor->session;
+         parts.assembled.operation_id = cursor->operation_id;
+         cursor->server_id = retry_stream->sd->id;
+         memset (&cursor->error, 0, sizeof (bson_error_t));
+         if (reply) {
+            bson_destroy (reply);
+         }
 
-   if (!mongoc_cmd_parts_assemble (&parts, server_stream, &cursor->error)) {
-      _mongoc_bson_init_if_set (reply);
-      GOTO (done);
+         if (_mongoc_cursor_assemble_command (
+                cursor, &parts, opts, db, retry_stream, &cursor->error)) {
+            ret = mongoc_cluster_run_command_monitored (
+               cluster, &parts.assembled, reply, &cursor->error);
+         } else {
+            _mongoc_bson_init_if_set (reply);
+         }
+      }
    }
 
-   ret = mongoc_cluster_run_command_monitored (
-      cluster, &parts.assembled, reply, &cursor->error);
-
    /* Read and Write Concern Spec: "Drivers SHOULD parse server replies for a
     * "writeConcernError" field and report the error only in command-specific
     * helper methods that take a separate write concern parameter or an options
@@ -1367,12 +1785,546 @@ _mongoc_cursor_run_command (mongoc_cursor_t *cursor,
 
 done:
    mongoc_server_stream_cleanup (server_stream);
+   mongoc_server_stream_cleanup (retry_stream);
    mongoc_cmd_parts_cleanup (&parts);
+   mongoc_server_stream_cleanup (hedge.server_stream);
+   if (hedge.parts_initialized) {
+      mongoc_cmd_parts_cleanup (&hedge.parts);
+   }
 
    return ret;
 }
 
 
+/* with exhaustAllowed, the server may stream getMore batches. Not with
+ * sharedConnections, where other clients need the connection between
+ * batches */
+bool
+_mongoc_cursor_use_opmsg_exhaust (const mongoc_cursor_t *cursor,
+                                  const mongoc_server_stream_t *server_stream)
+{
+   return cursor->exhaust_allowed && !cursor->client->cluster.shared &&
+          server_stream->sd->max_wire_version >= WIRE_VERSION_OP_MSG_EXHAUST;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_run_exhaust --
+ *
+ *       Send the getMore @command with exhaustAllowed, or if the server is
+ *       already streaming batches to @cursor, read the next one. While it
+ *       streams, @cursor and its client are "in exhaust": the connection
+ *       is reserved for the cursor, and destroying the cursor early
+ *       closes it.
+ *
+ * Returns:
+ *       true if successful; otherwise false and cursor->error is set.
+ *
+ * Side effects:
+ *       @reply is always initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cursor_run_exhaust (mongoc_cursor_t *cursor,
+                            const bson_t *command,
+                            bson_t *reply)
+{
+   mongoc_cluster_t *cluster;
+   mongoc_server_stream_t *server_stream;
+   mongoc_cmd_parts_t parts;
+   char db[MONGOC_NAMESPACE_MAX];
+   bool more_to_come = false;
+   bool ret = false;
+
+   ENTRY;
+
+   cluster = &cursor->client->cluster;
+   mongoc_cmd_parts_init (&parts, db, MONGOC_QUERY_NONE, command);
+   parts.read_prefs = cursor->read_prefs;
+   parts.session = cursor->session;
+   parts.assembled.operation_id = cursor->operation_id;
+
+   if (cursor->in_exhaust) {
+      /* the batch is on the connection the getMore went out on, never a
+       * new one */
+      server_stream = mongoc_cluster_stream_for_server (
+         cluster, cursor->server_id, false /* reconnect_ok */, &cursor->error);
+   } else {
+      server_stream = _mongoc_cursor_fetch_stream (cursor);
+   }
+
+   if (!server_stream) {
+      bson_init (reply);
+      GOTO (done);
+   }
+
+   if (!_mongoc_cursor_assemble_command (
+          cursor, &parts, NULL, db, server_stream, &cursor->error)) {
+      bson_init (reply);
+      GOTO (done);
+   }
+
+   if (cursor->in_exhaust) {
+      ret = _mongoc_cluster_recv_opmsg_exhaust (
+         cluster, &parts.assembled, &more_to_come, reply, &cursor->error);
+   } else {
+      ret = _mongoc_cluster_run_opmsg_exhaust (
+         cluster, &parts.assembled, &more_to_come, reply, &cursor->error);
+   }
+
+done:
+   cursor->in_exhaust = more_to_come;
+   cursor->client->in_exhaust = more_to_come;
+
+   mongoc_server_stream_cleanup (server_stream);
+   mongoc_cmd_parts_cleanup (&parts);
+
+   RETURN (ret);
+}
+
+
+/* a getMore sent before the cursor reached the end of its batch */
+typedef struct _mongoc_cursor_prefetch_t {
+   bson_t command;
+   mongoc_cmd_parts_t parts;
+   char db[MONGOC_NAMESPACE_MAX];
+   mongoc_server_stream_t *server_stream;
+   int32_t request_id;
+   int64_t started;
+   bool received; /* the reply has been read off the connection */
+   bool ok;
+   bson_t reply;
+   bson_error_t error;
+} mongoc_cursor_prefetch_t;
+
+
+static void
+_mongoc_cursor_prefetch_destroy (mongoc_cursor_prefetch_t *prefetch)
+{
+   if (prefetch->received) {
+      bson_destroy (&prefetch->reply);
+   }
+
+   mongoc_server_stream_cleanup (prefetch->server_stream);
+   mongoc_cmd_parts_cleanup (&prefetch->parts);
+   bson_destroy (&prefetch->command);
+   bson_free (prefetch);
+}
+
+
+/* a mongoc_cluster_pending_cb_t: read the prefetched getMore's reply, and
+ * keep it until the cursor needs it */
+static void
+_mongoc_cursor_prefetch_recv (void *ctx)
+{
+   mongoc_cursor_t *cursor = (mongoc_cursor_t *) ctx;
+   mongoc_cursor_prefetch_t *prefetch = cursor->prefetched;
+
+   BSON_ASSERT (prefetch && !prefetch->received);
+
+   prefetch->ok = _mongoc_cluster_run_opmsg_end (&cursor->client->cluster,
+                                                 &prefetch->parts.assembled,
+                                                 prefetch->request_id,
+                                                 prefetch->started,
+                                                 &prefetch->reply,
+                                                 &prefetch->error);
+   prefetch->received = true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_prefetch_send --
+ *
+ *       For the "prefetch" option: send the getMore for the next batch
+ *       without waiting for its reply. If the client uses the connection
+ *       for anything else first, the reply is read and kept; either way
+ *       _mongoc_cursor_prefetch_take returns it.
+ *
+ *       A failure only means the batch isn't prefetched, the cursor sends
+ *       its getMore at the end of the batch as usual.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cursor_prefetch_send (mongoc_cursor_t *cursor)
+{
+   mongoc_cluster_t *cluster;
+   mongoc_cursor_prefetch_t *prefetch;
+   bson_error_t error;
+
+   ENTRY;
+
+   BSON_ASSERT (!cursor->prefetched);
+
+   cluster = &cursor->client->cluster;
+   if (cluster->pending_cb) {
+      /* another cursor's prefetch is on a connection */
+      EXIT;
+   }
+
+   prefetch = (mongoc_cursor_prefetch_t *) bson_malloc0 (sizeof *prefetch);
+   _mongoc_cursor_prepare_getmore_command (cursor, &prefetch->command);
+   mongoc_cmd_parts_init (
+      &prefetch->parts, prefetch->db, MONGOC_QUERY_NONE, &prefetch->command);
+   prefetch->parts.read_prefs = cursor->read_prefs;
+   prefetch->parts.session = cursor->session;
+   prefetch->parts.assembled.operation_id = cursor->operation_id;
+
+   prefetch->server_stream = mongoc_cluster_stream_for_server (
+      cluster, cursor->server_id, true /* reconnect_ok */, &error);
+
+   if (!prefetch->server_stream ||
+       prefetch->server_stream->sd->max_wire_version < WIRE_VERSION_OP_MSG ||
+       !_mongoc_cursor_assemble_command (cursor,
+                                         &prefetch->parts,
+                                         NULL /* opts */,
+                                         prefetch->db,
+                                         prefetch->server_stream,
+                                         &error) ||
+       !_mongoc_cluster_run_opmsg_begin (cluster,
+                                         &prefetch->parts.assembled,
+                                         &prefetch->request_id,
+                                         &prefetch->started,
+                                         &error)) {
+      _mongoc_cursor_prefetch_destroy (prefetch);
+      EXIT;
+   }
+
+   cursor->prefetched = prefetch;
+   _mongoc_cluster_set_pending (cluster, _mongoc_cursor_prefetch_recv, cursor);
+   mongoc_counter_cursors_prefetched_inc ();
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_prefetch_take --
+ *
+ *       Get the reply to the getMore sent by _mongoc_cursor_prefetch_send,
+ *       reading it off the connection if it's still there.
+ *
+ * Returns:
+ *       true if successful; otherwise false and cursor->error is set.
+ *
+ * Side effects:
+ *       @reply is always initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cursor_prefetch_take (mongoc_cursor_t *cursor, bson_t *reply)
+{
+   mongoc_cursor_prefetch_t *prefetch = cursor->prefetched;
+   bool ok;
+
+   BSON_ASSERT (prefetch);
+
+   if (!prefetch->received) {
+      _mongoc_cluster_set_pending (&cursor->client->cluster, NULL, NULL);
+      _mongoc_cursor_prefetch_recv (cursor);
+   }
+
+   ok = prefetch->ok;
+   if (!ok) {
+      memcpy (&cursor->error, &prefetch->error, sizeof (bson_error_t));
+   }
+
+   bson_copy_to (&prefetch->reply, reply);
+
+   cursor->prefetched = NULL;
+   _mongoc_cursor_prefetch_destroy (prefetch);
+
+   return ok;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_spill --
+ *
+ *       For "spillBatchBytes": if @reply, a command reply the cursor is
+ *       about to iterate, is larger, copy it to an unlinked temporary file
+ *       and make @reply a view of the file's read-only mapping. The kernel
+ *       can then drop the batch's pages under memory pressure and read
+ *       them back as needed, instead of the process holding the batch.
+ *       The file is in $TMPDIR, or /tmp.
+ *
+ *       A failure only means the reply stays in memory. Not on Windows.
+ *
+ * Side effects:
+ *       The mapping lasts until _mongoc_cursor_spill_release.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cursor_spill (mongoc_cursor_t *cursor, bson_t *reply)
+{
+#ifndef _WIN32
+   char path[PATH_MAX];
+   const char *dir;
+   const uint8_t *data;
+   size_t len;
+   size_t written = 0;
+   ssize_t r;
+   void *map;
+   int fd;
+
+   ENTRY;
+
+   BSON_ASSERT (!cursor->spill_map);
+
+   if (!cursor->spill_batch_bytes ||
+       reply->len <= (uint32_t) cursor->spill_batch_bytes) {
+      EXIT;
+   }
+
+   dir = getenv ("TMPDIR");
+   if (!dir || !*dir) {
+      dir = "/tmp";
+   }
+
+   bson_snprintf (path, sizeof path, "%s/mongoc-spill-XXXXXX", dir);
+   fd = mkstemp (path);
+   if (fd < 0) {
+      MONGOC_WARNING ("Cannot spill a cursor batch to \"%s\": %s",
+                      path,
+                      strerror (errno));
+      EXIT;
+   }
+
+   /* nothing else opens it, it goes away with the mapping */
+   (void) unlink (path);
+
+   data = bson_get_data (reply);
+   len = reply->len;
+   while (written < len) {
+      r = write (fd, data + written, len - written);
+      if (r < 0 && errno == EINTR) {
+         continue;
+      }
+
+      if (r <= 0) {
+         MONGOC_WARNING ("Cannot spill a cursor batch: %s", strerror (errno));
+         GOTO (done);
+      }
+
+      written += (size_t) r;
+   }
+
+   map = mmap (NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED) {
+      MONGOC_WARNING ("Cannot map a spilled cursor batch: %s",
+                      strerror (errno));
+      GOTO (done);
+   }
+
+   (void) posix_madvise (map, len, POSIX_MADV_SEQUENTIAL);
+
+   bson_destroy (reply);
+   bson_init_static (reply, (const uint8_t *) map, len);
+
+   cursor->spill_map = map;
+   cursor->spill_len = len;
+   mongoc_counter_cursors_spilled_inc ();
+
+done:
+   close (fd);
+
+   EXIT;
+#endif
+}
+
+
+/* unmap the batch _mongoc_cursor_spill moved to a file, if any. the reply
+ * viewing it must not be used after */
+void
+_mongoc_cursor_spill_release (mongoc_cursor_t *cursor)
+{
+#ifndef _WIN32
+   if (cursor->spill_map) {
+      munmap (cursor->spill_map, cursor->spill_len);
+      cursor->spill_map = NULL;
+      cursor->spill_len = 0;
+   }
+#endif
+}
+
+
+/* a getMore whose batch is read off the connection a document at a time */
+typedef struct _mongoc_cursor_streaming_t {
+   bson_t command;
+   mongoc_cmd_parts_t parts;
+   char db[MONGOC_NAMESPACE_MAX];
+   mongoc_server_stream_t *server_stream;
+   mongoc_cluster_opmsg_stream_t reply;
+} mongoc_cursor_streaming_t;
+
+
+/* with "streamBatches", return a getMore's documents as they arrive. Not
+ * with exhaustAllowed or prefetch, which read whole batches ahead, nor
+ * with sharedConnections, where other clients need the connection */
+bool
+_mongoc_cursor_use_streaming (const mongoc_cursor_t *cursor,
+                              const mongoc_server_stream_t *server_stream)
+{
+   return cursor->stream_batches && !cursor->exhaust_allowed &&
+          !cursor->prefetch && !cursor->client->cluster.shared &&
+          !cursor->client->cluster.pending_cb &&
+          server_stream->sd->max_wire_version >= WIRE_VERSION_OP_MSG;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_streaming_begin --
+ *
+ *       For the "streamBatches" option: send the getMore @command on
+ *       @server_stream, which @cursor takes, and read the start of the
+ *       reply. Call _mongoc_cursor_streaming_next for each document of the
+ *       batch, then _mongoc_cursor_streaming_take for the rest of the
+ *       reply.
+ *
+ * Returns:
+ *       true if successful; otherwise false and cursor->error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cursor_streaming_begin (mongoc_cursor_t *cursor,
+                                mongoc_server_stream_t *server_stream,
+                                const bson_t *command)
+{
+   mongoc_cursor_streaming_t *streaming;
+
+   ENTRY;
+
+   BSON_ASSERT (!cursor->streaming);
+
+   streaming = (mongoc_cursor_streaming_t *) bson_malloc0 (sizeof *streaming);
+   bson_copy_to (command, &streaming->command);
+   mongoc_cmd_parts_init (
+      &streaming->parts, streaming->db, MONGOC_QUERY_NONE, &streaming->command);
+   streaming->parts.read_prefs = cursor->read_prefs;
+   streaming->parts.session = cursor->session;
+   streaming->parts.assembled.operation_id = cursor->operation_id;
+   streaming->server_stream = server_stream;
+
+   if (!_mongoc_cursor_assemble_command (cursor,
+                                         &streaming->parts,
+                                         NULL /* opts */,
+                                         streaming->db,
+                                         server_stream,
+                                         &cursor->error)) {
+      mongoc_server_stream_cleanup (streaming->server_stream);
+      mongoc_cmd_parts_cleanup (&streaming->parts);
+      bson_destroy (&streaming->command);
+      bson_free (streaming);
+      RETURN (false);
+   }
+
+   cursor->streaming = streaming;
+
+   if (!_mongoc_cluster_stream_opmsg_begin (&cursor->client->cluster,
+                                            &streaming->parts.assembled,
+                                            &streaming->reply,
+                                            &cursor->error)) {
+      bson_t reply;
+
+      _mongoc_cursor_streaming_take (cursor, &reply, NULL, NULL);
+      bson_destroy (&reply);
+      RETURN (false);
+   }
+
+   RETURN (true);
+}
+
+
+/* the next document of the streamed batch, or false at its end or on
+ * error. the document is valid until the next call */
+bool
+_mongoc_cursor_streaming_next (mongoc_cursor_t *cursor, const bson_t **bson)
+{
+   BSON_ASSERT (cursor->streaming);
+
+   *bson = NULL;
+
+   return _mongoc_cluster_stream_opmsg_next (
+             &cursor->streaming->reply, bson, &cursor->error) &&
+          *bson;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_streaming_take --
+ *
+ *       After _mongoc_cursor_streaming_next returned false, get the rest of
+ *       the getMore's reply, with an empty batch, and the number of
+ *       documents and bytes the batch had in @n_docs and @n_bytes if not
+ *       NULL.
+ *
+ * Returns:
+ *       true if successful; otherwise false and cursor->error is set.
+ *
+ * Side effects:
+ *       @reply is always initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cursor_streaming_take (mongoc_cursor_t *cursor,
+                               bson_t *reply,
+                               uint32_t *n_docs,
+                               uint32_t *n_bytes)
+{
+   mongoc_cursor_streaming_t *streaming = cursor->streaming;
+   bool ok;
+
+   BSON_ASSERT (streaming);
+
+   ok = !streaming->reply.failed;
+   if (!ok) {
+      memcpy (&cursor->error, &streaming->reply.error, sizeof (bson_error_t));
+   }
+
+   bson_copy_to (&streaming->reply.reply, reply);
+
+   if (n_docs) {
+      *n_docs = streaming->reply.n_docs;
+   }
+
+   if (n_bytes) {
+      *n_bytes = streaming->reply.n_bytes;
+   }
+
+   cursor->streaming = NULL;
+   _mongoc_cluster_stream_opmsg_destroy (&streaming->reply);
+   mongoc_server_stream_cleanup (streaming->server_stream);
+   mongoc_cmd_parts_cleanup (&streaming->parts);
+   bson_destroy (&streaming->command);
+   bson_free (streaming);
+
+   return ok;
+}
+
+
 static bool
 _translate_query_opt (const char *query_field, const char **cmd_field, int *len)
 {
@@ -1549,7 +2501,9 @@ _mongoc_cursor_monitor_legacy_get_more (mongoc_cursor_t *cursor,
    ENTRY;
 
    client = cursor->client;
-   if (!client->apm_callbacks.started) {
+   if (!client->apm_callbacks.started ||
+       !_mongoc_apm_command_sampled (&client->apm_callbacks,
+                                     cursor->operation_id)) {
       /* successful */
       RETURN (true);
    }
@@ -1752,6 +2706,7 @@ bool
 mongoc_cursor_next (mongoc_cursor_t *cursor, const bson_t **bson)
 {
    bool ret;
+   bool began;
 
    ENTRY;
 
@@ -1787,12 +2742,20 @@ mongoc_cursor_next (mongoc_cursor_t *cursor, const bson_t **bson)
       RETURN (false);
    }
 
+   /* each batch the cursor fetches is one operation for timeoutMS */
+   began = _mongoc_cluster_deadline_begin (&cursor->client->cluster, -1);
+
    if (cursor->iface.next) {
       ret = cursor->iface.next (cursor, bson);
    } else {
       ret = _mongoc_cursor_next (cursor, bson);
    }
 
+   _mongoc_cluster_deadline_end (
+      &cursor->client->cluster,
+      began,
+      CURSOR_FAILED (cursor) ? &cursor->error : NULL);
+
    cursor->current = *bson;
 
    cursor->count++;
@@ -1801,6 +2764,88 @@ mongoc_cursor_next (mongoc_cursor_t *cursor, const bson_t **bson)
 }
 
 
+/* the next document from the current OP_REPLY or command reply batch, or
+ * false at the end of the batch */
+static bool
+_mongoc_cursor_next_in_batch (mongoc_cursor_t *cursor, const bson_t **bson)
+{
+   *bson = NULL;
+
+   if (cursor->iface.next_in_batch) {
+      return cursor->iface.next_in_batch (cursor, bson);
+   }
+
+   if (cursor->iface.next || !cursor->reader) {
+      /* array and transform cursors return one document per batch */
+      return false;
+   }
+
+   return _mongoc_read_from_buffer (cursor, bson);
+}
+
+
+bool
+mongoc_cursor_next_batch (mongoc_cursor_t *cursor,
+                          const uint8_t **data,
+                          size_t *data_len,
+                          const uint32_t **offsets,
+                          uint32_t *n_docs)
+{
+   const bson_t *doc;
+   const uint8_t *end;
+   int64_t limit;
+   uint32_t offset;
+
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+   BSON_ASSERT (data);
+   BSON_ASSERT (data_len);
+   BSON_ASSERT (offsets);
+   BSON_ASSERT (n_docs);
+
+   *data = NULL;
+   *data_len = 0;
+   *offsets = NULL;
+   *n_docs = 0;
+
+   /* the first document sends the initial command or a getMore if needed,
+    * and checks the cursor's state and errors */
+   if (!mongoc_cursor_next (cursor, &doc)) {
+      RETURN (false);
+   }
+
+   _mongoc_array_clear (&cursor->batch_offsets);
+
+   *data = bson_get_data (doc);
+   end = *data + doc->len;
+   offset = 0;
+   _mongoc_array_append_val (&cursor->batch_offsets, offset);
+
+   /* the rest of the batch, up to the limit. the documents of one reply
+    * are in order in one buffer, but in a command reply they're elements
+    * of an array, with their keys between them */
+   limit = mongoc_cursor_get_limit (cursor);
+
+   while ((!limit || cursor->count < llabs (limit)) &&
+          _mongoc_cursor_next_in_batch (cursor, &doc)) {
+      BSON_ASSERT (bson_get_data (doc) >= end);
+
+      offset = (uint32_t) (bson_get_data (doc) - *data);
+      _mongoc_array_append_val (&cursor->batch_offsets, offset);
+      end = bson_get_data (doc) + doc->len;
+      cursor->current = doc;
+      cursor->count++;
+   }
+
+   *data_len = (size_t) (end - *data);
+   *offsets = (const uint32_t *) cursor->batch_offsets.data;
+   *n_docs = (uint32_t) cursor->batch_offsets.len;
+
+   RETURN (true);
+}
+
+
 bool
 _mongoc_read_from_buffer (mongoc_cursor_t *cursor, const bson_t **bson)
 {
@@ -1979,13 +3024,17 @@ _mongoc_cursor_clone (const mongoc_cursor_t *cursor)
 
    BSON_ASSERT (cursor);
 
-   _clone = (mongoc_cursor_t *) bson_malloc0 (sizeof *_clone);
+   _clone = _mongoc_cursor_alloc (cursor->client);
 
    _clone->client = cursor->client;
    _clone->is_command = cursor->is_command;
    _clone->nslen = cursor->nslen;
    _clone->dblen = cursor->dblen;
    _clone->has_fields = cursor->has_fields;
+   _clone->hedge_delay_msec = cursor->hedge_delay_msec;
+   _clone->exhaust_allowed = cursor->exhaust_allowed;
+   _clone->prefetch = cursor->prefetch;
+   _clone->adaptive_batch_bytes = cursor->adaptive_batch_bytes;
 
    if (cursor->read_prefs) {
       _clone->read_prefs = mongoc_read_prefs_copy (cursor->read_prefs);
@@ -2002,8 +3051,6 @@ _mongoc_cursor_clone (const mongoc_cursor_t *cursor)
 
    bson_strncpy (_clone->ns, cursor->ns, sizeof _clone->ns);
 
-   _mongoc_buffer_init (&_clone->buffer, NULL, 0, NULL, NULL);
-
    mongoc_counter_cursors_active_inc ();
 
    RETURN (_clone);
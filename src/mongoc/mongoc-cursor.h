@@ -45,6 +45,12 @@ mongoc_cursor_more (mongoc_cursor_t *cursor);
 MONGOC_EXPORT (bool)
 mongoc_cursor_next (mongoc_cursor_t *cursor, const bson_t **bson);
 MONGOC_EXPORT (bool)
+mongoc_cursor_next_batch (mongoc_cursor_t *cursor,
+                          const uint8_t **data,
+                          size_t *data_len,
+                          const uint32_t **offsets,
+                          uint32_t *n_docs);
+MONGOC_EXPORT (bool)
 mongoc_cursor_error (mongoc_cursor_t *cursor, bson_error_t *error);
 MONGOC_EXPORT (bool)
 mongoc_cursor_error_document (mongoc_cursor_t *cursor,
@@ -82,6 +88,10 @@ mongoc_cursor_new_from_command_reply (struct _mongoc_client_t *client,
                                       bson_t *reply,
                                       uint32_t server_id)
    BSON_GNUC_WARN_UNUSED_RESULT;
+MONGOC_EXPORT (mongoc_cursor_t *)
+mongoc_cursor_new_merged (mongoc_cursor_t **children,
+                          size_t n_children,
+                          const bson_t *sort) BSON_GNUC_WARN_UNUSED_RESULT;
 
 BSON_END_DECLS
 
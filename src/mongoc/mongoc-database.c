@@ -27,6 +27,8 @@
 #include "mongoc-database-private.h"
 #include "mongoc-error.h"
 #include "mongoc-log.h"
+#include "mongoc-read-concern-private.h"
+#include "mongoc-read-prefs-private.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-util-private.h"
 #include "mongoc-write-concern-private.h"
@@ -72,11 +74,12 @@ _mongoc_database_new (mongoc_client_t *client,
 
    db = (mongoc_database_t *) bson_malloc0 (sizeof *db);
    db->client = client;
-   db->write_concern = write_concern ? mongoc_write_concern_copy (write_concern)
+   /* shared like a collection's, see _mongoc_collection_new */
+   db->write_concern = write_concern ? _mongoc_write_concern_ref (write_concern)
                                      : mongoc_write_concern_new ();
-   db->read_concern = read_concern ? mongoc_read_concern_copy (read_concern)
+   db->read_concern = read_concern ? _mongoc_read_concern_ref (read_concern)
                                    : mongoc_read_concern_new ();
-   db->read_prefs = read_prefs ? mongoc_read_prefs_copy (read_prefs)
+   db->read_prefs = read_prefs ? _mongoc_read_prefs_ref (read_prefs)
                                : mongoc_read_prefs_new (MONGOC_READ_PRIMARY);
 
    bson_strncpy (db->name, name, sizeof db->name);
@@ -815,6 +818,7 @@ mongoc_database_find_collections (mongoc_database_t *database,
                                   const bson_t *filter,
                                   bson_error_t *error)
 {
+   mongoc_metadata_cache_t *cache;
    mongoc_cursor_t *cursor;
    bson_t cmd = BSON_INITIALIZER;
    bson_t child;
@@ -830,6 +834,16 @@ mongoc_database_find_collections (mongoc_database_t *database,
       bson_append_document_end (&cmd, &child);
    }
 
+   cache = database->client->metadata_cache;
+   if (cache) {
+      cursor = _mongoc_metadata_cache_find (
+         cache, database->client, database->name, &cmd);
+      if (cursor) {
+         bson_destroy (&cmd);
+         return cursor;
+      }
+   }
+
    /* Enumerate Collections Spec: "run listCollections on the primary node in
     * replicaset mode" */
    cursor = _mongoc_cursor_new_with_opts (database->client,
@@ -861,6 +875,11 @@ mongoc_database_find_collections (mongoc_database_t *database,
       }
    }
 
+   if (cursor && cache) {
+      cursor = _mongoc_metadata_cache_fill (
+         cache, database->client, database->name, NULL, &cmd, cursor);
+   }
+
    bson_destroy (&cmd);
 
    return cursor;
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_DNS_PRIVATE_H
+#define MONGOC_DNS_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-host-list.h"
+#include "mongoc-socket.h"
+
+BSON_BEGIN_DECLS
+
+/* getaddrinfo doesn't report record TTLs, so answers are cached this long */
+#define MONGOC_DNS_CACHE_TTL_MS 30000
+/* failures are cached briefly, so reconnect storms don't flood the resolver */
+#define MONGOC_DNS_CACHE_NEGATIVE_TTL_MS 1000
+#define MONGOC_DNS_CACHE_SIZE 64
+/* SRV answers are cached for their TTL, but at least this long */
+#define MONGOC_DNS_SRV_CACHE_MIN_TTL_MS 60000
+#define MONGOC_DNS_SRV_CACHE_SIZE 16
+
+/* resolves hosts on a background thread, see _mongoc_dns_resolver_lookup */
+typedef struct _mongoc_dns_resolver_t mongoc_dns_resolver_t;
+typedef struct _mongoc_dns_request_t mongoc_dns_request_t;
+
+void
+_mongoc_dns_init (void);
+
+void
+_mongoc_dns_cleanup (void);
+
+void
+_mongoc_dns_reset_after_fork (void);
+
+struct addrinfo *
+_mongoc_dns_getaddrinfo (const mongoc_host_list_t *host, bson_error_t *error);
+
+bool
+_mongoc_dns_cache_get (const mongoc_host_list_t *host,
+                       struct addrinfo **results,
+                       bson_error_t *error);
+
+void
+_mongoc_dns_cache_clear (void);
+
+bool
+_mongoc_dns_srv_cache_get (const char *service,
+                           mongoc_host_list_t **hosts,
+                           bson_error_t *error);
+
+void
+_mongoc_dns_srv_cache_put (const char *service,
+                           const mongoc_host_list_t *hosts,
+                           uint32_t ttl_sec,
+                           const bson_error_t *error);
+
+void
+_mongoc_dns_results_free (struct addrinfo *results);
+
+mongoc_dns_resolver_t *
+_mongoc_dns_resolver_new (void);
+
+void
+_mongoc_dns_resolver_destroy (mongoc_dns_resolver_t *resolver);
+
+void
+_mongoc_dns_resolver_reset_after_fork (mongoc_dns_resolver_t *resolver);
+
+mongoc_dns_request_t *
+_mongoc_dns_resolver_lookup (mongoc_dns_resolver_t *resolver,
+                             const mongoc_host_list_t *host);
+
+bool
+_mongoc_dns_request_take (mongoc_dns_request_t *request,
+                          struct addrinfo **results,
+                          bson_error_t *error);
+
+void
+_mongoc_dns_request_destroy (mongoc_dns_request_t *request);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_DNS_PRIVATE_H */
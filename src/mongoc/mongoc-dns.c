@@ -0,0 +1,671 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-counters-private.h"
+#include "mongoc-dns-private.h"
+#include "mongoc-error.h"
+#include "mongoc-host-list-private.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-trace-private.h"
+#include "mongoc-util-private.h"
+#include "utlist.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "dns"
+
+
+typedef struct {
+   char host_and_port[BSON_HOST_NAME_MAX + 7];
+   int family;
+   int64_t expire_at;         /* 0 if the entry is unused */
+   struct addrinfo *results;  /* NULL if the lookup failed */
+   bson_error_t error;
+} mongoc_dns_cache_entry_t;
+
+
+typedef struct {
+   char service[BSON_HOST_NAME_MAX + 1];
+   int64_t expire_at;         /* 0 if the entry is unused */
+   mongoc_host_list_t *hosts; /* NULL if the lookup failed */
+   bson_error_t error;
+} mongoc_dns_srv_cache_entry_t;
+
+
+struct _mongoc_dns_request_t {
+   mongoc_dns_resolver_t *resolver;
+   mongoc_host_list_t host;
+   bool queued;    /* waiting for the resolver thread */
+   bool done;      /* results or error are set */
+   bool abandoned; /* destroyed while the lookup ran, the thread frees it */
+   struct addrinfo *results;
+   bson_error_t error;
+   struct _mongoc_dns_request_t *next;
+};
+
+
+struct _mongoc_dns_resolver_t {
+   mongoc_mutex_t mutex;
+   mongoc_cond_t cond;
+   mongoc_thread_t thread;
+   bool thread_started;
+   bool shutdown;
+   mongoc_dns_request_t *queue;
+};
+
+
+static mongoc_mutex_t gDNSCacheMutex;
+static mongoc_dns_cache_entry_t gDNSCache[MONGOC_DNS_CACHE_SIZE];
+static mongoc_dns_srv_cache_entry_t gDNSSRVCache[MONGOC_DNS_SRV_CACHE_SIZE];
+
+
+void
+_mongoc_dns_init (void)
+{
+   mongoc_mutex_init (&gDNSCacheMutex);
+}
+
+
+void
+_mongoc_dns_cleanup (void)
+{
+   _mongoc_dns_cache_clear ();
+   mongoc_mutex_destroy (&gDNSCacheMutex);
+}
+
+
+/* in a child process after fork: a thread of the parent's may have held
+ * the cache's lock. the cached results are still good */
+void
+_mongoc_dns_reset_after_fork (void)
+{
+   mongoc_mutex_init (&gDNSCacheMutex);
+}
+
+
+/* copy a getaddrinfo result into memory we can cache and free ourselves */
+static struct addrinfo *
+_mongoc_dns_results_copy (const struct addrinfo *results)
+{
+   struct addrinfo *head = NULL;
+   struct addrinfo **tail = &head;
+   struct addrinfo *rp;
+
+   for (; results; results = results->ai_next) {
+      rp = (struct addrinfo *) bson_malloc0 (sizeof (*rp) +
+                                             results->ai_addrlen);
+      rp->ai_flags = results->ai_flags;
+      rp->ai_family = results->ai_family;
+      rp->ai_socktype = results->ai_socktype;
+      rp->ai_protocol = results->ai_protocol;
+      rp->ai_addrlen = results->ai_addrlen;
+      rp->ai_addr = (struct sockaddr *) (rp + 1);
+      memcpy (rp->ai_addr, results->ai_addr, results->ai_addrlen);
+
+      *tail = rp;
+      tail = &rp->ai_next;
+   }
+
+   return head;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_results_free --
+ *
+ *       Free results from _mongoc_dns_getaddrinfo or
+ *       _mongoc_dns_request_take. Not for use on getaddrinfo's results.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_dns_results_free (struct addrinfo *results)
+{
+   struct addrinfo *next;
+
+   for (; results; results = next) {
+      next = results->ai_next;
+      bson_free (results);
+   }
+}
+
+
+static bool
+_mongoc_dns_cache_entry_matches (const mongoc_dns_cache_entry_t *entry,
+                                 const mongoc_host_list_t *host)
+{
+   return entry->expire_at && entry->family == host->family &&
+          !strcasecmp (entry->host_and_port, host->host_and_port);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_cache_get --
+ *
+ *       Look up @host in the cache.
+ *
+ * Returns:
+ *       false on a cache miss. Otherwise true, and @results is set to a
+ *       copy of the addresses, or to NULL with @error set if the cached
+ *       lookup failed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_dns_cache_get (const mongoc_host_list_t *host,
+                       struct addrinfo **results,
+                       bson_error_t *error)
+{
+   mongoc_dns_cache_entry_t *entry;
+   int64_t now;
+   bool found = false;
+   int i;
+
+   now = bson_get_monotonic_time ();
+
+   mongoc_mutex_lock (&gDNSCacheMutex);
+
+   for (i = 0; i < MONGOC_DNS_CACHE_SIZE; i++) {
+      entry = &gDNSCache[i];
+      if (_mongoc_dns_cache_entry_matches (entry, host) &&
+          entry->expire_at > now) {
+         found = true;
+         *results = _mongoc_dns_results_copy (entry->results);
+         if (!entry->results) {
+            memcpy (error, &entry->error, sizeof (bson_error_t));
+         }
+
+         break;
+      }
+   }
+
+   mongoc_mutex_unlock (&gDNSCacheMutex);
+
+   if (found) {
+      mongoc_counter_dns_cache_hits_inc ();
+   }
+
+   return found;
+}
+
+
+static void
+_mongoc_dns_cache_put (const mongoc_host_list_t *host,
+                       const struct addrinfo *results,
+                       const bson_error_t *error)
+{
+   mongoc_dns_cache_entry_t *entry;
+   mongoc_dns_cache_entry_t *victim = NULL;
+   int64_t now;
+   int i;
+
+   now = bson_get_monotonic_time ();
+
+   mongoc_mutex_lock (&gDNSCacheMutex);
+
+   /* reuse this host's entry, else the entry that expires soonest */
+   for (i = 0; i < MONGOC_DNS_CACHE_SIZE; i++) {
+      entry = &gDNSCache[i];
+      if (_mongoc_dns_cache_entry_matches (entry, host)) {
+         victim = entry;
+         break;
+      }
+
+      if (!victim || entry->expire_at < victim->expire_at) {
+         victim = entry;
+      }
+   }
+
+   _mongoc_dns_results_free (victim->results);
+   bson_strncpy (victim->host_and_port,
+                 host->host_and_port,
+                 sizeof victim->host_and_port);
+   victim->family = host->family;
+
+   if (results) {
+      victim->results = _mongoc_dns_results_copy (results);
+      victim->expire_at = now + MONGOC_DNS_CACHE_TTL_MS * 1000;
+   } else {
+      victim->results = NULL;
+      memcpy (&victim->error, error, sizeof (bson_error_t));
+      victim->expire_at = now + MONGOC_DNS_CACHE_NEGATIVE_TTL_MS * 1000;
+   }
+
+   mongoc_mutex_unlock (&gDNSCacheMutex);
+}
+
+
+void
+_mongoc_dns_cache_clear (void)
+{
+   int i;
+
+   mongoc_mutex_lock (&gDNSCacheMutex);
+
+   for (i = 0; i < MONGOC_DNS_CACHE_SIZE; i++) {
+      _mongoc_dns_results_free (gDNSCache[i].results);
+      memset (&gDNSCache[i], 0, sizeof (mongoc_dns_cache_entry_t));
+   }
+
+   for (i = 0; i < MONGOC_DNS_SRV_CACHE_SIZE; i++) {
+      _mongoc_host_list_destroy_all (gDNSSRVCache[i].hosts);
+      memset (&gDNSSRVCache[i], 0, sizeof (mongoc_dns_srv_cache_entry_t));
+   }
+
+   mongoc_mutex_unlock (&gDNSCacheMutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_srv_cache_get --
+ *
+ *       Look up the SRV records for @service in the cache, which is shared
+ *       by all clients and pools in the process.
+ *
+ * Returns:
+ *       false on a cache miss. Otherwise true, and @hosts is set to a copy
+ *       of the hosts, or to NULL with @error set if the cached lookup
+ *       failed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_dns_srv_cache_get (const char *service,
+                           mongoc_host_list_t **hosts,
+                           bson_error_t *error)
+{
+   mongoc_dns_srv_cache_entry_t *entry;
+   int64_t now;
+   bool found = false;
+   int i;
+
+   now = bson_get_monotonic_time ();
+
+   mongoc_mutex_lock (&gDNSCacheMutex);
+
+   for (i = 0; i < MONGOC_DNS_SRV_CACHE_SIZE; i++) {
+      entry = &gDNSSRVCache[i];
+      if (entry->expire_at > now &&
+          !strcasecmp (entry->service, service)) {
+         found = true;
+         *hosts = _mongoc_host_list_copy_all (entry->hosts);
+         if (!entry->hosts) {
+            memcpy (error, &entry->error, sizeof (bson_error_t));
+         }
+
+         break;
+      }
+   }
+
+   mongoc_mutex_unlock (&gDNSCacheMutex);
+
+   if (found) {
+      mongoc_counter_dns_cache_hits_inc ();
+   }
+
+   return found;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_srv_cache_put --
+ *
+ *       Cache @hosts for @service for @ttl_sec, the least TTL of the SRV
+ *       records, but no less than MONGOC_DNS_SRV_CACHE_MIN_TTL_MS. If
+ *       @hosts is NULL, cache @error briefly instead.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_dns_srv_cache_put (const char *service,
+                           const mongoc_host_list_t *hosts,
+                           uint32_t ttl_sec,
+                           const bson_error_t *error)
+{
+   mongoc_dns_srv_cache_entry_t *entry;
+   mongoc_dns_srv_cache_entry_t *victim = NULL;
+   int64_t ttl_msec;
+   int64_t now;
+   int i;
+
+   now = bson_get_monotonic_time ();
+
+   mongoc_mutex_lock (&gDNSCacheMutex);
+
+   /* reuse this service's entry, else the entry that expires soonest */
+   for (i = 0; i < MONGOC_DNS_SRV_CACHE_SIZE; i++) {
+      entry = &gDNSSRVCache[i];
+      if (entry->expire_at && !strcasecmp (entry->service, service)) {
+         victim = entry;
+         break;
+      }
+
+      if (!victim || entry->expire_at < victim->expire_at) {
+         victim = entry;
+      }
+   }
+
+   _mongoc_host_list_destroy_all (victim->hosts);
+   bson_strncpy (victim->service, service, sizeof victim->service);
+
+   if (hosts) {
+      victim->hosts = _mongoc_host_list_copy_all (hosts);
+      ttl_msec = BSON_MAX ((int64_t) ttl_sec * 1000,
+                           MONGOC_DNS_SRV_CACHE_MIN_TTL_MS);
+      victim->expire_at = now + ttl_msec * 1000;
+   } else {
+      victim->hosts = NULL;
+      memcpy (&victim->error, error, sizeof (bson_error_t));
+      victim->expire_at = now + MONGOC_DNS_CACHE_NEGATIVE_TTL_MS * 1000;
+   }
+
+   mongoc_mutex_unlock (&gDNSCacheMutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_getaddrinfo --
+ *
+ *       Resolve @host, blocking, unless the cache has a recent answer.
+ *
+ * Returns:
+ *       A list of addresses to free with _mongoc_dns_results_free, or NULL
+ *       and @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+struct addrinfo *
+_mongoc_dns_getaddrinfo (const mongoc_host_list_t *host, bson_error_t *error)
+{
+   struct addrinfo hints;
+   struct addrinfo *gai_results;
+   struct addrinfo *results;
+   char portstr[8];
+   int64_t start;
+   int s;
+
+   ENTRY;
+
+   if (_mongoc_dns_cache_get (host, &results, error)) {
+      RETURN (results);
+   }
+
+   bson_snprintf (portstr, sizeof portstr, "%hu", host->port);
+
+   memset (&hints, 0, sizeof hints);
+   hints.ai_family = host->family;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = 0;
+   hints.ai_protocol = 0;
+
+   start = bson_get_monotonic_time ();
+   s = getaddrinfo (host->host, portstr, &hints, &gai_results);
+   mongoc_counter_dns_msec_add ((bson_get_monotonic_time () - start) / 1000);
+
+   if (s != 0) {
+      mongoc_counter_dns_failure_inc ();
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_NAME_RESOLUTION,
+                      "Failed to resolve '%s'",
+                      host->host);
+      _mongoc_dns_cache_put (host, NULL, error);
+      RETURN (NULL);
+   }
+
+   mongoc_counter_dns_success_inc ();
+
+   results = _mongoc_dns_results_copy (gai_results);
+   freeaddrinfo (gai_results);
+   _mongoc_dns_cache_put (host, results, NULL);
+
+   RETURN (results);
+}
+
+
+static void *
+_mongoc_dns_resolver_run (void *data)
+{
+   mongoc_dns_resolver_t *resolver = (mongoc_dns_resolver_t *) data;
+   mongoc_dns_request_t *request;
+   struct addrinfo *results;
+   bson_error_t error;
+
+   mongoc_mutex_lock (&resolver->mutex);
+
+   while (!resolver->shutdown) {
+      if (!resolver->queue) {
+         mongoc_cond_wait (&resolver->cond, &resolver->mutex);
+         continue;
+      }
+
+      request = resolver->queue;
+      LL_DELETE (resolver->queue, request);
+      request->queued = false;
+
+      mongoc_mutex_unlock (&resolver->mutex);
+      memset (&error, 0, sizeof error);
+      results = _mongoc_dns_getaddrinfo (&request->host, &error);
+      mongoc_mutex_lock (&resolver->mutex);
+
+      if (request->abandoned) {
+         _mongoc_dns_results_free (results);
+         bson_free (request);
+      } else {
+         request->results = results;
+         memcpy (&request->error, &error, sizeof error);
+         request->done = true;
+      }
+   }
+
+   mongoc_mutex_unlock (&resolver->mutex);
+
+   return NULL;
+}
+
+
+mongoc_dns_resolver_t *
+_mongoc_dns_resolver_new (void)
+{
+   mongoc_dns_resolver_t *resolver;
+
+   resolver = (mongoc_dns_resolver_t *) bson_malloc0 (sizeof *resolver);
+   mongoc_mutex_init (&resolver->mutex);
+   mongoc_cond_init (&resolver->cond);
+
+   return resolver;
+}
+
+
+/* pending requests must have been destroyed */
+void
+_mongoc_dns_resolver_destroy (mongoc_dns_resolver_t *resolver)
+{
+   if (!resolver) {
+      return;
+   }
+
+   BSON_ASSERT (!resolver->queue);
+
+   mongoc_mutex_lock (&resolver->mutex);
+   resolver->shutdown = true;
+   mongoc_cond_signal (&resolver->cond);
+   mongoc_mutex_unlock (&resolver->mutex);
+
+   if (resolver->thread_started) {
+      mongoc_thread_join (resolver->thread);
+   }
+
+   mongoc_cond_destroy (&resolver->cond);
+   mongoc_mutex_destroy (&resolver->mutex);
+   bson_free (resolver);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_resolver_reset_after_fork --
+ *
+ *       In a child process after fork, where the resolver's thread no
+ *       longer runs: start a new one with the next lookup. The caller
+ *       destroys its requests first, since a lookup the old thread was
+ *       running never finishes.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_dns_resolver_reset_after_fork (mongoc_dns_resolver_t *resolver)
+{
+   mongoc_mutex_init (&resolver->mutex);
+   mongoc_cond_init (&resolver->cond);
+   resolver->thread_started = false;
+   resolver->shutdown = false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_resolver_lookup --
+ *
+ *       Begin resolving @host on the resolver's thread, which is started
+ *       on first use. Poll for the result with _mongoc_dns_request_take.
+ *
+ * Returns:
+ *       A request to free with _mongoc_dns_request_destroy.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_dns_request_t *
+_mongoc_dns_resolver_lookup (mongoc_dns_resolver_t *resolver,
+                             const mongoc_host_list_t *host)
+{
+   mongoc_dns_request_t *request;
+   int r;
+
+   request = (mongoc_dns_request_t *) bson_malloc0 (sizeof *request);
+   request->resolver = resolver;
+   memcpy (&request->host, host, sizeof request->host);
+   request->host.next = NULL;
+   request->queued = true;
+
+   mongoc_mutex_lock (&resolver->mutex);
+
+   if (!resolver->thread_started) {
+      r = _mongoc_thread_create (MONGOC_THREAD_DNS_RESOLVER,
+                                 &resolver->thread,
+                                 _mongoc_dns_resolver_run,
+                                 resolver);
+      BSON_ASSERT (r == 0);
+      resolver->thread_started = true;
+   }
+
+   LL_APPEND (resolver->queue, request);
+   mongoc_cond_signal (&resolver->cond);
+
+   mongoc_mutex_unlock (&resolver->mutex);
+
+   return request;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_request_take --
+ *
+ *       Check if @request finished.
+ *
+ * Returns:
+ *       false if the lookup is still running. Otherwise true, and @results
+ *       is set to the addresses, which the caller must free with
+ *       _mongoc_dns_results_free, or to NULL with @error set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_dns_request_take (mongoc_dns_request_t *request,
+                          struct addrinfo **results,
+                          bson_error_t *error)
+{
+   bool done;
+
+   mongoc_mutex_lock (&request->resolver->mutex);
+
+   done = request->done;
+   if (done) {
+      *results = request->results;
+      request->results = NULL;
+      if (!*results) {
+         memcpy (error, &request->error, sizeof (bson_error_t));
+      }
+   }
+
+   mongoc_mutex_unlock (&request->resolver->mutex);
+
+   return done;
+}
+
+
+void
+_mongoc_dns_request_destroy (mongoc_dns_request_t *request)
+{
+   mongoc_dns_resolver_t *resolver;
+
+   if (!request) {
+      return;
+   }
+
+   resolver = request->resolver;
+
+   mongoc_mutex_lock (&resolver->mutex);
+
+   if (request->queued) {
+      LL_DELETE (resolver->queue, request);
+   } else if (!request->done) {
+      /* the resolver thread is running getaddrinfo */
+      request->abandoned = true;
+      request = NULL;
+   }
+
+   mongoc_mutex_unlock (&resolver->mutex);
+
+   if (request) {
+      _mongoc_dns_results_free (request->results);
+      bson_free (request);
+   }
+}
@@ -102,6 +102,15 @@ typedef enum {
    MONGOC_ERROR_GRIDFS_CHUNK_MISSING,
    MONGOC_ERROR_GRIDFS_PROTOCOL_ERROR,
 
+   MONGOC_ERROR_CLIENT_POOL_WAIT_TIMEOUT,
+   MONGOC_ERROR_CLIENT_POOL_WAIT_QUEUE_FULL,
+
+   MONGOC_ERROR_CLIENT_OPERATION_CANCELED,
+
+   MONGOC_ERROR_CLIENT_SERVER_BUSY,
+
+   MONGOC_ERROR_CLIENT_OPERATION_TIMEOUT,
+
    /* Dup with query failure. */
    MONGOC_ERROR_PROTOCOL_ERROR = 17,
 
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_FIND_CACHE_PRIVATE_H
+#define MONGOC_FIND_CACHE_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-change-stream.h"
+#include "mongoc-client.h"
+#include "mongoc-collection.h"
+#include "mongoc-cursor.h"
+
+BSON_BEGIN_DECLS
+
+#define MONGOC_FIND_CACHE_DEFAULT_TTL_MS 1000
+#define MONGOC_FIND_CACHE_DEFAULT_MAX_BYTES (16 * 1024 * 1024)
+#define MONGOC_FIND_CACHE_DEFAULT_POLL_MS 100
+
+typedef struct _mongoc_find_cache_entry_t {
+   struct _mongoc_find_cache_entry_t *next;
+   uint32_t hash;
+   bson_t filter;
+   bson_t opts;
+   bson_t read_prefs;
+   /* the result documents, keyed "0", "1", ... */
+   bson_t docs;
+   int64_t expire_at;
+} mongoc_find_cache_entry_t;
+
+/* For mongoc_collection_enable_find_cache: a collection's recent
+ * mongoc_collection_find_with_opts results, newest first. Entries expire
+ * after the TTL, and the cache is emptied when the client writes to the
+ * collection, or when the change stream, polled at most every pollMS,
+ * reports a change from anywhere. Like its collection, not thread-safe. */
+typedef struct _mongoc_find_cache_t {
+   /* the client's other find caches */
+   struct _mongoc_find_cache_t *next;
+   mongoc_client_t *client;
+   char *db;
+   char *collection;
+   int64_t ttl_usec;
+   uint32_t max_bytes;
+   uint32_t n_bytes;
+   mongoc_find_cache_entry_t *entries;
+   /* with "changeStream": the stream, or NULL after it failed */
+   bool watch;
+   mongoc_change_stream_t *change_stream;
+   int64_t poll_usec;
+   int64_t next_poll;
+} mongoc_find_cache_t;
+
+mongoc_find_cache_t *
+_mongoc_find_cache_new (mongoc_collection_t *collection,
+                        const bson_t *opts,
+                        bson_error_t *error);
+
+void
+_mongoc_find_cache_destroy (mongoc_find_cache_t *cache);
+
+mongoc_cursor_t *
+_mongoc_find_cache_find (mongoc_find_cache_t *cache,
+                         const bson_t *filter,
+                         const bson_t *opts,
+                         const mongoc_read_prefs_t *read_prefs);
+
+mongoc_cursor_t *
+_mongoc_find_cache_fill (mongoc_find_cache_t *cache,
+                         const bson_t *filter,
+                         const bson_t *opts,
+                         const mongoc_read_prefs_t *read_prefs,
+                         mongoc_cursor_t *cursor);
+
+void
+_mongoc_find_cache_clear (mongoc_find_cache_t *cache);
+
+void
+_mongoc_find_cache_command (mongoc_find_cache_t *caches,
+                            const char *db,
+                            const bson_t *command);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_FIND_CACHE_PRIVATE_H */
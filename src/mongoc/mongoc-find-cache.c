@@ -0,0 +1,568 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-find-cache-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-collection-private.h"
+#include "mongoc-counters-private.h"
+#include "mongoc-cursor-array-private.h"
+#include "mongoc-cursor-private.h"
+#include "mongoc-error.h"
+#include "mongoc-metadata-cache-private.h"
+#include "mongoc-read-prefs-private.h"
+#include "mongoc-trace-private.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "find-cache"
+
+
+static bool
+_mongoc_find_cache_int32_opt (const bson_iter_t *iter,
+                              int32_t min,
+                              int32_t *value,
+                              bson_error_t *error)
+{
+   if (!BSON_ITER_HOLDS_INT32 (iter) || bson_iter_int32 (iter) < min) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "\"%s\" must be an int32 of at least %d",
+                      bson_iter_key (iter),
+                      min);
+      return false;
+   }
+
+   *value = bson_iter_int32 (iter);
+   return true;
+}
+
+
+/* open a change stream on the cached collection and send its "aggregate",
+ * so later polls report every change made after this call */
+static mongoc_change_stream_t *
+_mongoc_find_cache_watch (mongoc_find_cache_t *cache, bson_error_t *error)
+{
+   mongoc_collection_t *collection;
+   mongoc_change_stream_t *change_stream;
+   const bson_t *event;
+   bson_t opts = BSON_INITIALIZER;
+
+   /* a poll's getMore returns as soon as there are no more events */
+   BSON_APPEND_INT32 (&opts, "maxAwaitTimeMS", 1);
+
+   collection = mongoc_client_get_collection (
+      cache->client, cache->db, cache->collection);
+   change_stream = mongoc_collection_watch (collection, NULL, &opts);
+   mongoc_collection_destroy (collection);
+   bson_destroy (&opts);
+
+   (void) mongoc_change_stream_next (change_stream, &event);
+   if (mongoc_change_stream_error_document (change_stream, error, NULL)) {
+      mongoc_change_stream_destroy (change_stream);
+      return NULL;
+   }
+
+   return change_stream;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_find_cache_new --
+ *
+ *       Create a find cache for @collection with @opts: "ttlMS",
+ *       "maxBytes", "changeStream" and "pollMS". The cache is added to the
+ *       collection's client, which empties it when it writes to the
+ *       collection.
+ *
+ * Returns:
+ *       A new cache, or NULL and @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_find_cache_t *
+_mongoc_find_cache_new (mongoc_collection_t *collection,
+                        const bson_t *opts,
+                        bson_error_t *error)
+{
+   mongoc_find_cache_t *cache;
+   int32_t ttl_ms = MONGOC_FIND_CACHE_DEFAULT_TTL_MS;
+   int32_t max_bytes = MONGOC_FIND_CACHE_DEFAULT_MAX_BYTES;
+   int32_t poll_ms = MONGOC_FIND_CACHE_DEFAULT_POLL_MS;
+   bool change_stream = false;
+   bson_iter_t iter;
+
+   ENTRY;
+
+   if (opts && bson_iter_init (&iter, opts)) {
+      while (bson_iter_next (&iter)) {
+         if (BSON_ITER_IS_KEY (&iter, "ttlMS")) {
+            if (!_mongoc_find_cache_int32_opt (&iter, 1, &ttl_ms, error)) {
+               RETURN (NULL);
+            }
+         } else if (BSON_ITER_IS_KEY (&iter, "maxBytes")) {
+            if (!_mongoc_find_cache_int32_opt (&iter, 1, &max_bytes, error)) {
+               RETURN (NULL);
+            }
+         } else if (BSON_ITER_IS_KEY (&iter, "pollMS")) {
+            if (!_mongoc_find_cache_int32_opt (&iter, 0, &poll_ms, error)) {
+               RETURN (NULL);
+            }
+         } else if (BSON_ITER_IS_KEY (&iter, "changeStream")) {
+            if (!BSON_ITER_HOLDS_BOOL (&iter)) {
+               bson_set_error (error,
+                               MONGOC_ERROR_COMMAND,
+                               MONGOC_ERROR_COMMAND_INVALID_ARG,
+                               "\"changeStream\" must be a boolean");
+               RETURN (NULL);
+            }
+
+            change_stream = bson_iter_bool (&iter);
+         } else {
+            bson_set_error (error,
+                            MONGOC_ERROR_COMMAND,
+                            MONGOC_ERROR_COMMAND_INVALID_ARG,
+                            "Invalid find cache option \"%s\"",
+                            bson_iter_key (&iter));
+            RETURN (NULL);
+         }
+      }
+   }
+
+   cache = (mongoc_find_cache_t *) bson_malloc0 (sizeof *cache);
+   cache->client = collection->client;
+   cache->db = bson_strdup (collection->db);
+   cache->collection = bson_strdup (collection->collection);
+   cache->ttl_usec = (int64_t) ttl_ms * 1000;
+   cache->max_bytes = (uint32_t) max_bytes;
+   cache->poll_usec = (int64_t) poll_ms * 1000;
+
+   if (change_stream) {
+      cache->change_stream = _mongoc_find_cache_watch (cache, error);
+      if (!cache->change_stream) {
+         bson_free (cache->db);
+         bson_free (cache->collection);
+         bson_free (cache);
+         RETURN (NULL);
+      }
+
+      cache->watch = true;
+      cache->next_poll = bson_get_monotonic_time () + cache->poll_usec;
+   }
+
+   cache->next = cache->client->find_caches;
+   cache->client->find_caches = cache;
+
+   RETURN (cache);
+}
+
+
+static void
+_mongoc_find_cache_entry_destroy (mongoc_find_cache_entry_t *entry)
+{
+   bson_destroy (&entry->filter);
+   bson_destroy (&entry->opts);
+   bson_destroy (&entry->read_prefs);
+   bson_destroy (&entry->docs);
+   bson_free (entry);
+}
+
+
+static uint32_t
+_mongoc_find_cache_entry_size (const mongoc_find_cache_entry_t *entry)
+{
+   return entry->filter.len + entry->opts.len + entry->read_prefs.len +
+          entry->docs.len;
+}
+
+
+/* unlink the entry @prev points to and destroy it */
+static void
+_mongoc_find_cache_remove (mongoc_find_cache_t *cache,
+                           mongoc_find_cache_entry_t **prev)
+{
+   mongoc_find_cache_entry_t *entry = *prev;
+
+   *prev = entry->next;
+   cache->n_bytes -= _mongoc_find_cache_entry_size (entry);
+   _mongoc_find_cache_entry_destroy (entry);
+}
+
+
+void
+_mongoc_find_cache_clear (mongoc_find_cache_t *cache)
+{
+   while (cache->entries) {
+      _mongoc_find_cache_remove (cache, &cache->entries);
+   }
+}
+
+
+void
+_mongoc_find_cache_destroy (mongoc_find_cache_t *cache)
+{
+   mongoc_find_cache_t **prev;
+
+   for (prev = &cache->client->find_caches; *prev != cache;
+        prev = &(*prev)->next) {
+   }
+
+   *prev = cache->next;
+
+   _mongoc_find_cache_clear (cache);
+   if (cache->change_stream) {
+      mongoc_change_stream_destroy (cache->change_stream);
+   }
+
+   bson_free (cache->db);
+   bson_free (cache->collection);
+   bson_free (cache);
+}
+
+
+/* tailable and exhaust cursors, and finds in a session, aren't cached */
+static bool
+_mongoc_find_cache_can_cache (const bson_t *opts)
+{
+   return !opts ||
+          (!bson_has_field (opts, "tailable") &&
+           !bson_has_field (opts, "awaitData") &&
+           !bson_has_field (opts, "exhaust") &&
+           !bson_has_field (opts, "sessionId"));
+}
+
+
+/* FNV-1a of the find's arguments, compared before the documents are */
+static uint32_t
+_mongoc_find_cache_hash (const bson_t *filter,
+                         const bson_t *opts,
+                         const bson_t *read_prefs)
+{
+   const bson_t *docs[3];
+   const uint8_t *data;
+   uint32_t hash = 2166136261u;
+   uint32_t i;
+   uint32_t j;
+
+   docs[0] = filter;
+   docs[1] = opts;
+   docs[2] = read_prefs;
+
+   for (i = 0; i < 3; i++) {
+      data = bson_get_data (docs[i]);
+      for (j = 0; j < docs[i]->len; j++) {
+         hash = (hash ^ data[j]) * 16777619u;
+      }
+   }
+
+   return hash;
+}
+
+
+/* with "changeStream", empty the cache if anything changed since the last
+ * poll. returns false if the change stream failed and could not be
+ * reopened: then nothing may be served from the cache */
+static bool
+_mongoc_find_cache_poll (mongoc_find_cache_t *cache)
+{
+   const bson_t *event;
+   bson_error_t error;
+   int64_t now;
+   bool changed = false;
+
+   if (!cache->watch) {
+      return true;
+   }
+
+   now = bson_get_monotonic_time ();
+   if (cache->change_stream && now < cache->next_poll) {
+      return true;
+   }
+
+   cache->next_poll = now + cache->poll_usec;
+
+   if (cache->change_stream) {
+      while (mongoc_change_stream_next (cache->change_stream, &event)) {
+         changed = true;
+      }
+
+      if (mongoc_change_stream_error_document (
+             cache->change_stream, &error, NULL)) {
+         MONGOC_WARNING ("Find cache change stream failed: %s",
+                         error.message);
+         mongoc_change_stream_destroy (cache->change_stream);
+         cache->change_stream = NULL;
+      }
+   }
+
+   if (changed || !cache->change_stream) {
+      _mongoc_find_cache_clear (cache);
+   }
+
+   if (!cache->change_stream) {
+      cache->change_stream = _mongoc_find_cache_watch (cache, &error);
+   }
+
+   return cache->change_stream != NULL;
+}
+
+
+/* a cursor over documents from the cache, which sends no command */
+static mongoc_cursor_t *
+_mongoc_find_cache_cursor (mongoc_find_cache_t *cache, const bson_t *docs)
+{
+   mongoc_cursor_t *cursor;
+
+   cursor = _mongoc_cursor_new_with_opts (
+      cache->client, cache->db, true /* is_command */, NULL, NULL, NULL, NULL);
+   _mongoc_cursor_array_init (cursor, NULL, NULL);
+   _mongoc_cursor_array_set_bson (cursor, docs);
+
+   return cursor;
+}
+
+
+static const bson_t *
+_mongoc_find_cache_read_prefs (const mongoc_read_prefs_t *read_prefs,
+                               const bson_t *empty)
+{
+   return read_prefs ? _mongoc_read_prefs_get_bson (read_prefs) : empty;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_find_cache_find --
+ *
+ *       Look for a fresh result of a find with @filter, @opts and
+ *       @read_prefs, and move it to the front of the cache.
+ *
+ * Returns:
+ *       A cursor over the cached result, or NULL if there is none.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_cursor_t *
+_mongoc_find_cache_find (mongoc_find_cache_t *cache,
+                         const bson_t *filter,
+                         const bson_t *opts,
+                         const mongoc_read_prefs_t *read_prefs)
+{
+   mongoc_find_cache_entry_t **prev;
+   mongoc_find_cache_entry_t *entry;
+   const bson_t *prefs;
+   bson_t empty = BSON_INITIALIZER;
+   uint32_t hash;
+
+   ENTRY;
+
+   if (!_mongoc_find_cache_can_cache (opts) ||
+       !_mongoc_find_cache_poll (cache)) {
+      RETURN (NULL);
+   }
+
+   if (!opts) {
+      opts = &empty;
+   }
+
+   prefs = _mongoc_find_cache_read_prefs (read_prefs, &empty);
+   hash = _mongoc_find_cache_hash (filter, opts, prefs);
+
+   for (prev = &cache->entries; (entry = *prev); prev = &entry->next) {
+      if (entry->hash == hash && bson_equal (&entry->filter, filter) &&
+          bson_equal (&entry->opts, opts) &&
+          bson_equal (&entry->read_prefs, prefs)) {
+         break;
+      }
+   }
+
+   if (entry && entry->expire_at <= bson_get_monotonic_time ()) {
+      _mongoc_find_cache_remove (cache, prev);
+      entry = NULL;
+   }
+
+   if (!entry) {
+      mongoc_counter_find_cache_misses_inc ();
+      RETURN (NULL);
+   }
+
+   mongoc_counter_find_cache_hits_inc ();
+
+   *prev = entry->next;
+   entry->next = cache->entries;
+   cache->entries = entry;
+
+   RETURN (_mongoc_find_cache_cursor (cache, &entry->docs));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_find_cache_fill --
+ *
+ *       Read all the documents from @cursor, the result of a find with
+ *       @filter, @opts and @read_prefs that _mongoc_find_cache_find did
+ *       not have, and cache them unless they take more than "maxBytes".
+ *
+ * Returns:
+ *       A cursor over the documents. @cursor is destroyed.
+ *
+ *       If the find can't be cached, @cursor is returned unread. If
+ *       @cursor fails, it is returned, so the application sees its error
+ *       from mongoc_cursor_next.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_cursor_t *
+_mongoc_find_cache_fill (mongoc_find_cache_t *cache,
+                         const bson_t *filter,
+                         const bson_t *opts,
+                         const mongoc_read_prefs_t *read_prefs,
+                         mongoc_cursor_t *cursor)
+{
+   mongoc_find_cache_entry_t **prev;
+   mongoc_find_cache_entry_t *entry;
+   mongoc_cursor_t *cached;
+   bson_t empty = BSON_INITIALIZER;
+   const bson_t *doc;
+   const char *key;
+   uint32_t size;
+   char buf[16];
+   uint32_t i = 0;
+
+   ENTRY;
+
+   if (!_mongoc_find_cache_can_cache (opts) ||
+       (cache->watch && !cache->change_stream)) {
+      RETURN (cursor);
+   }
+
+   entry = (mongoc_find_cache_entry_t *) bson_malloc0 (sizeof *entry);
+   bson_init (&entry->docs);
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      bson_uint32_to_string (i++, &key, buf, sizeof buf);
+      bson_append_document (&entry->docs, key, -1, doc);
+   }
+
+   if (mongoc_cursor_error (cursor, NULL)) {
+      bson_destroy (&entry->docs);
+      bson_free (entry);
+      RETURN (cursor);
+   }
+
+   mongoc_cursor_destroy (cursor);
+
+   bson_copy_to (filter, &entry->filter);
+   bson_copy_to (opts ? opts : &empty, &entry->opts);
+   bson_copy_to (_mongoc_find_cache_read_prefs (read_prefs, &empty),
+                 &entry->read_prefs);
+   entry->hash = _mongoc_find_cache_hash (
+      &entry->filter, &entry->opts, &entry->read_prefs);
+   entry->expire_at = bson_get_monotonic_time () + cache->ttl_usec;
+
+   cached = _mongoc_find_cache_cursor (cache, &entry->docs);
+   size = _mongoc_find_cache_entry_size (entry);
+
+   if (size > cache->max_bytes) {
+      _mongoc_find_cache_entry_destroy (entry);
+      RETURN (cached);
+   }
+
+   /* evict the least recently used */
+   while (cache->n_bytes + size > cache->max_bytes) {
+      prev = &cache->entries;
+      while ((*prev)->next) {
+         prev = &(*prev)->next;
+      }
+
+      _mongoc_find_cache_remove (cache, prev);
+   }
+
+   entry->next = cache->entries;
+   cache->entries = entry;
+   cache->n_bytes += size;
+
+   RETURN (cached);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_find_cache_command --
+ *
+ *       Called for each command the client runs on @db. Empty the caches
+ *       in the list @caches whose collections @command may change.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_find_cache_command (mongoc_find_cache_t *caches,
+                            const char *db,
+                            const bson_t *command)
+{
+   mongoc_find_cache_t *cache;
+   bson_iter_t iter;
+   const char *name;
+   const char *collection;
+   bool whole_db;
+
+   if (!bson_iter_init (&iter, command) || !bson_iter_next (&iter)) {
+      return;
+   }
+
+   name = bson_iter_key (&iter);
+   collection = BSON_ITER_HOLDS_UTF8 (&iter) ? bson_iter_utf8 (&iter, NULL)
+                                             : NULL;
+
+   if (!strcmp (name, "renameCollection")) {
+      /* on "admin", naming collections in any database */
+      for (cache = caches; cache; cache = cache->next) {
+         _mongoc_find_cache_clear (cache);
+      }
+
+      return;
+   }
+
+   whole_db = !strcmp (name, "dropDatabase") || !strcmp (name, "mapReduce") ||
+              !strcmp (name, "applyOps") ||
+              (!strcmp (name, "aggregate") &&
+               _mongoc_metadata_cache_pipeline_writes (command));
+
+   if (!whole_db && strcmp (name, "insert") && strcmp (name, "update") &&
+       strcmp (name, "delete") && strcmp (name, "findAndModify") &&
+       strcmp (name, "findandmodify") && strcmp (name, "drop") &&
+       strcmp (name, "convertToCapped") && strcmp (name, "collMod")) {
+      return;
+   }
+
+   for (cache = caches; cache; cache = cache->next) {
+      if (!strcmp (cache->db, db) &&
+          (whole_db ||
+           (collection && !strcmp (cache->collection, collection)))) {
+         _mongoc_find_cache_clear (cache);
+      }
+   }
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_GRIDFS_CHUNK_CACHE_PRIVATE_H
+#define MONGOC_GRIDFS_CHUNK_CACHE_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-gridfs-file.h"
+
+BSON_BEGIN_DECLS
+
+typedef struct _mongoc_gridfs_chunk_cache_entry_t {
+   struct _mongoc_gridfs_chunk_cache_entry_t *prev;
+   struct _mongoc_gridfs_chunk_cache_entry_t *next;
+   uint32_t hash;
+   /* {"": files_id, "n": n} */
+   bson_t key;
+   /* the file's upload date and length when the chunk was read */
+   int64_t upload_date;
+   int64_t length;
+   /* the chunk as fetched, with "n" and "data" */
+   bson_t *chunk;
+} mongoc_gridfs_chunk_cache_entry_t;
+
+/* For mongoc_gridfs_set_chunk_cache_size: chunks read through a GridFS's
+ * files, most recently used first, up to max_bytes. An entry is only used
+ * for a file with the upload date and length it was read with, and is
+ * dropped when a file writes the chunk. Like its GridFS, not thread-safe. */
+typedef struct _mongoc_gridfs_chunk_cache_t {
+   size_t max_bytes;
+   size_t n_bytes;
+   mongoc_gridfs_chunk_cache_entry_t *entries;
+} mongoc_gridfs_chunk_cache_t;
+
+mongoc_gridfs_chunk_cache_t *
+_mongoc_gridfs_chunk_cache_new (size_t max_bytes);
+
+void
+_mongoc_gridfs_chunk_cache_destroy (mongoc_gridfs_chunk_cache_t *cache);
+
+void
+_mongoc_gridfs_chunk_cache_set_max_bytes (mongoc_gridfs_chunk_cache_t *cache,
+                                          size_t max_bytes);
+
+const bson_t *
+_mongoc_gridfs_chunk_cache_get (mongoc_gridfs_chunk_cache_t *cache,
+                                const mongoc_gridfs_file_t *file,
+                                int32_t n);
+
+void
+_mongoc_gridfs_chunk_cache_put (mongoc_gridfs_chunk_cache_t *cache,
+                                const mongoc_gridfs_file_t *file,
+                                int32_t n,
+                                const bson_t *chunk);
+
+void
+_mongoc_gridfs_chunk_cache_remove (mongoc_gridfs_chunk_cache_t *cache,
+                                   const mongoc_gridfs_file_t *file,
+                                   int32_t n);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_GRIDFS_CHUNK_CACHE_PRIVATE_H */
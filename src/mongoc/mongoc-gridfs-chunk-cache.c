@@ -0,0 +1,216 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-gridfs-chunk-cache-private.h"
+#include "mongoc-gridfs-file-private.h"
+#include "mongoc-trace-private.h"
+#include "utlist.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "gridfs-chunk-cache"
+
+
+mongoc_gridfs_chunk_cache_t *
+_mongoc_gridfs_chunk_cache_new (size_t max_bytes)
+{
+   mongoc_gridfs_chunk_cache_t *cache;
+
+   cache = (mongoc_gridfs_chunk_cache_t *) bson_malloc0 (sizeof *cache);
+   cache->max_bytes = max_bytes;
+
+   return cache;
+}
+
+
+static size_t
+_mongoc_gridfs_chunk_cache_entry_size (
+   const mongoc_gridfs_chunk_cache_entry_t *entry)
+{
+   return sizeof *entry + entry->key.len + entry->chunk->len;
+}
+
+
+static void
+_mongoc_gridfs_chunk_cache_evict (mongoc_gridfs_chunk_cache_t *cache,
+                                  mongoc_gridfs_chunk_cache_entry_t *entry)
+{
+   DL_DELETE (cache->entries, entry);
+   cache->n_bytes -= _mongoc_gridfs_chunk_cache_entry_size (entry);
+   bson_destroy (&entry->key);
+   bson_destroy (entry->chunk);
+   bson_free (entry);
+}
+
+
+void
+_mongoc_gridfs_chunk_cache_destroy (mongoc_gridfs_chunk_cache_t *cache)
+{
+   while (cache->entries) {
+      _mongoc_gridfs_chunk_cache_evict (cache, cache->entries);
+   }
+
+   bson_free (cache);
+}
+
+
+/* evict the least recently used chunks until the cache fits */
+static void
+_mongoc_gridfs_chunk_cache_trim (mongoc_gridfs_chunk_cache_t *cache)
+{
+   while (cache->entries && cache->n_bytes > cache->max_bytes) {
+      /* the list's head points back to its tail */
+      _mongoc_gridfs_chunk_cache_evict (cache, cache->entries->prev);
+   }
+}
+
+
+void
+_mongoc_gridfs_chunk_cache_set_max_bytes (mongoc_gridfs_chunk_cache_t *cache,
+                                          size_t max_bytes)
+{
+   cache->max_bytes = max_bytes;
+   _mongoc_gridfs_chunk_cache_trim (cache);
+}
+
+
+/* the key for chunk @n of @file, and its FNV-1a hash */
+static uint32_t
+_mongoc_gridfs_chunk_cache_key (const mongoc_gridfs_file_t *file,
+                                int32_t n,
+                                bson_t *key)
+{
+   const uint8_t *data;
+   uint32_t hash = 2166136261u;
+   uint32_t i;
+
+   bson_init (key);
+   BSON_APPEND_VALUE (key, "", &file->files_id);
+   BSON_APPEND_INT32 (key, "n", n);
+
+   data = bson_get_data (key);
+   for (i = 0; i < key->len; i++) {
+      hash = (hash ^ data[i]) * 16777619u;
+   }
+
+   return hash;
+}
+
+
+static mongoc_gridfs_chunk_cache_entry_t *
+_mongoc_gridfs_chunk_cache_find (mongoc_gridfs_chunk_cache_t *cache,
+                                 const mongoc_gridfs_file_t *file,
+                                 int32_t n)
+{
+   mongoc_gridfs_chunk_cache_entry_t *entry;
+   bson_t key;
+   uint32_t hash;
+
+   hash = _mongoc_gridfs_chunk_cache_key (file, n, &key);
+
+   DL_FOREACH (cache->entries, entry)
+   {
+      if (entry->hash == hash && bson_equal (&entry->key, &key)) {
+         break;
+      }
+   }
+
+   bson_destroy (&key);
+
+   return entry;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_gridfs_chunk_cache_get --
+ *
+ *       Find chunk @n of @file, and make it the most recently used. A
+ *       chunk read when the file had another upload date or length is
+ *       stale: it is evicted.
+ *
+ * Returns:
+ *       The chunk, valid until the cache is next modified, or NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const bson_t *
+_mongoc_gridfs_chunk_cache_get (mongoc_gridfs_chunk_cache_t *cache,
+                                const mongoc_gridfs_file_t *file,
+                                int32_t n)
+{
+   mongoc_gridfs_chunk_cache_entry_t *entry;
+
+   entry = _mongoc_gridfs_chunk_cache_find (cache, file, n);
+   if (!entry) {
+      return NULL;
+   }
+
+   if (entry->upload_date != file->upload_date ||
+       entry->length != file->length) {
+      TRACE ("evicting stale chunk %" PRId32, n);
+      _mongoc_gridfs_chunk_cache_evict (cache, entry);
+      return NULL;
+   }
+
+   if (entry != cache->entries) {
+      DL_DELETE (cache->entries, entry);
+      DL_PREPEND (cache->entries, entry);
+   }
+
+   return entry->chunk;
+}
+
+
+/* add a copy of chunk @n of @file, evicting older chunks to make room */
+void
+_mongoc_gridfs_chunk_cache_put (mongoc_gridfs_chunk_cache_t *cache,
+                                const mongoc_gridfs_file_t *file,
+                                int32_t n,
+                                const bson_t *chunk)
+{
+   mongoc_gridfs_chunk_cache_entry_t *entry;
+
+   _mongoc_gridfs_chunk_cache_remove (cache, file, n);
+
+   entry = (mongoc_gridfs_chunk_cache_entry_t *) bson_malloc0 (sizeof *entry);
+   entry->hash = _mongoc_gridfs_chunk_cache_key (file, n, &entry->key);
+   entry->upload_date = file->upload_date;
+   entry->length = file->length;
+   entry->chunk = bson_copy (chunk);
+
+   DL_PREPEND (cache->entries, entry);
+   cache->n_bytes += _mongoc_gridfs_chunk_cache_entry_size (entry);
+
+   /* a chunk larger than the whole cache evicts itself */
+   _mongoc_gridfs_chunk_cache_trim (cache);
+}
+
+
+void
+_mongoc_gridfs_chunk_cache_remove (mongoc_gridfs_chunk_cache_t *cache,
+                                   const mongoc_gridfs_file_t *file,
+                                   int32_t n)
+{
+   mongoc_gridfs_chunk_cache_entry_t *entry;
+
+   entry = _mongoc_gridfs_chunk_cache_find (cache, file, n);
+   if (entry) {
+      _mongoc_gridfs_chunk_cache_evict (cache, entry);
+   }
+}
@@ -23,15 +23,53 @@
 
 #include <bson.h>
 
+#include "mongoc-array-private.h"
+#include "mongoc-bulk-operation.h"
 #include "mongoc-gridfs.h"
 #include "mongoc-gridfs-file.h"
 #include "mongoc-gridfs-file-page.h"
 #include "mongoc-cursor.h"
+#include "mongoc-client-pool.h"
+#include "mongoc-thread-private.h"
 
 
 BSON_BEGIN_DECLS
 
 
+/* a thread on a pool client that fetches chunks ahead of the reader into a
+ * ring of n_slots chunks */
+typedef struct _mongoc_gridfs_file_prefetch_t {
+   mongoc_client_t *client;
+   mongoc_collection_t *chunks;
+   bson_t query;
+   bson_t opts;
+   mongoc_thread_t thread;
+   mongoc_mutex_t mutex;
+   mongoc_cond_t cond;
+   bson_t **ring;
+   uint32_t n_slots;
+   uint32_t head;  /* slot of the next chunk to read */
+   uint32_t count; /* chunks fetched and not yet read */
+   int32_t n;      /* chunk number of the head slot */
+   bool done;      /* the thread's cursor is exhausted or failed */
+   bool stop;
+   bson_error_t error;
+} mongoc_gridfs_file_prefetch_t;
+
+
+/* a thread on a pool client that sends a full batch of chunks while the
+ * writer queues the next */
+typedef struct _mongoc_gridfs_file_write_behind_t {
+   mongoc_client_t *client;
+   mongoc_thread_t thread;
+   mongoc_mutex_t mutex;
+   mongoc_cond_t cond;
+   mongoc_bulk_operation_t *bulk; /* being sent, or NULL */
+   bool stop;
+   bson_error_t error; /* of the last batch that failed */
+} mongoc_gridfs_file_write_behind_t;
+
+
 struct _mongoc_gridfs_file_t {
    mongoc_gridfs_t *gridfs;
    bson_t bson;
@@ -43,6 +81,25 @@ struct _mongoc_gridfs_file_t {
    uint32_t cursor_range[2]; /* current chunk, # of chunks */
    bool is_dirty;
 
+   uint32_t read_ahead; /* chunks per batch, 0 for the server's default */
+   mongoc_client_pool_t *read_ahead_pool;
+   mongoc_gridfs_file_prefetch_t *prefetch;
+   bson_t *chunk; /* prefetched chunk the page reads from */
+
+   /* bson_t *, chunks 0 to len - 1 from mongoc_gridfs_find_one_with_chunks.
+    * element_size is 0 if there are none */
+   mongoc_array_t first_chunks;
+
+   mongoc_bulk_operation_t *pending; /* flushed chunks not yet sent */
+   size_t pending_bytes;
+   mongoc_client_pool_t *write_behind_pool;
+   mongoc_gridfs_file_write_behind_t *write_behind;
+
+   bool compute_md5;
+   bool md5_valid; /* md5_ctx digests bytes [0, md5_pos) */
+   uint64_t md5_pos;
+   bson_md5_t md5_ctx;
+
    bson_value_t files_id;
    int64_t length;
    int32_t chunk_size;
@@ -66,6 +123,32 @@ _mongoc_gridfs_file_new_from_bson (mongoc_gridfs_t *gridfs, const bson_t *data);
 mongoc_gridfs_file_t *
 _mongoc_gridfs_file_new (mongoc_gridfs_t *gridfs,
                          mongoc_gridfs_file_opt_t *opt);
+bool
+_mongoc_gridfs_file_append_chunks (mongoc_gridfs_file_t *file,
+                                   const uint8_t *data,
+                                   size_t len);
+void
+_mongoc_gridfs_file_set_first_chunks (mongoc_gridfs_file_t *file,
+                                      const bson_t *chunks);
+void
+_mongoc_gridfs_file_set_write_behind (mongoc_gridfs_file_t *file,
+                                      mongoc_client_pool_t *pool);
+bool
+_mongoc_gridfs_file_can_read (mongoc_gridfs_file_t *file);
+bool
+_mongoc_gridfs_file_can_write (mongoc_gridfs_file_t *file);
+void
+_mongoc_gridfs_file_wait (mongoc_gridfs_file_t *file,
+                          bool for_write,
+                          int64_t expire_at);
+ssize_t
+_mongoc_gridfs_file_try_readv (mongoc_gridfs_file_t *file,
+                               mongoc_iovec_t *iov,
+                               size_t iovcnt);
+ssize_t
+_mongoc_gridfs_file_try_writev (mongoc_gridfs_file_t *file,
+                                const mongoc_iovec_t *iov,
+                                size_t iovcnt);
 
 
 BSON_END_DECLS
@@ -25,6 +25,7 @@
 #include "mongoc-cursor.h"
 #include "mongoc-cursor-private.h"
 #include "mongoc-collection.h"
+#include "mongoc-collection-private.h"
 #include "mongoc-gridfs.h"
 #include "mongoc-gridfs-private.h"
 #include "mongoc-gridfs-file.h"
@@ -35,6 +36,10 @@
 #include "mongoc-trace-private.h"
 #include "mongoc-error.h"
 
+/* send flushed chunks once this much is queued, the bulk operation splits
+ * it further by the server's maxMessageSizeBytes */
+#define MONGOC_GRIDFS_FILE_MAX_PENDING_BYTES (16 * 1024 * 1024)
+
 static bool
 _mongoc_gridfs_file_refresh_page (mongoc_gridfs_file_t *file);
 
@@ -44,6 +49,21 @@ _mongoc_gridfs_file_flush_page (mongoc_gridfs_file_t *file);
 static ssize_t
 _mongoc_gridfs_file_extend (mongoc_gridfs_file_t *file);
 
+static void
+_mongoc_gridfs_file_prefetch_stop (mongoc_gridfs_file_t *file);
+
+static void
+missing_chunk (mongoc_gridfs_file_t *file);
+
+static bool
+_mongoc_gridfs_file_send_chunks (mongoc_gridfs_file_t *file);
+
+static void
+_mongoc_gridfs_file_drop_first_chunks (mongoc_gridfs_file_t *file, int32_t n);
+
+static void
+_mongoc_gridfs_file_write_behind_stop (mongoc_gridfs_file_t *file);
+
 
 /*****************************************************************
 * Magic accessor generation
@@ -119,6 +139,91 @@ mongoc_gridfs_file_set_id (mongoc_gridfs_file_t *file,
    return true;
 }
 
+
+/**
+ * mongoc_gridfs_file_set_read_ahead:
+ *
+ * read chunks in batches of @n_chunks. with a @pool, a thread on one of its
+ * clients fetches up to @n_chunks ahead of the reader.
+ *
+ */
+
+void
+mongoc_gridfs_file_set_read_ahead (mongoc_gridfs_file_t *file,
+                                   void *pool,
+                                   uint32_t n_chunks)
+{
+   BSON_ASSERT (file);
+
+   _mongoc_gridfs_file_prefetch_stop (file);
+
+   /* the next read starts a cursor with the new batch size */
+   if (file->cursor) {
+      mongoc_cursor_destroy (file->cursor);
+      file->cursor = NULL;
+   }
+
+   file->read_ahead = n_chunks;
+   file->read_ahead_pool = n_chunks ? (mongoc_client_pool_t *) pool : NULL;
+}
+
+/**
+ * mongoc_gridfs_file_set_compute_md5:
+ *
+ * digest the bytes written in order from the start of the file, and save
+ * the digest as the file's md5.
+ *
+ */
+
+void
+mongoc_gridfs_file_set_compute_md5 (mongoc_gridfs_file_t *file, bool compute)
+{
+   BSON_ASSERT (file);
+
+   file->compute_md5 = compute;
+   file->md5_valid = compute;
+   file->md5_pos = 0;
+
+   if (compute) {
+      bson_md5_init (&file->md5_ctx);
+   }
+}
+
+
+/* add bytes written at file->md5_pos to the digest */
+static void
+_mongoc_gridfs_file_md5_append (mongoc_gridfs_file_t *file,
+                                const uint8_t *data,
+                                size_t len)
+{
+   uint32_t n;
+
+   while (len) {
+      n = (uint32_t) BSON_MIN (len, (size_t) INT32_MAX);
+      bson_md5_append (&file->md5_ctx, data, n);
+      data += n;
+      len -= n;
+      file->md5_pos += n;
+   }
+}
+
+
+/* should a write at file->pos be digested: only an unbroken sequence of
+ * writes from the start of the file can be */
+static bool
+_mongoc_gridfs_file_md5_continues (mongoc_gridfs_file_t *file)
+{
+   if (!file->compute_md5) {
+      return false;
+   }
+
+   if (file->pos != file->md5_pos) {
+      file->md5_valid = false;
+   }
+
+   return file->md5_valid;
+}
+
 /** save a gridfs file */
 bool
 mongoc_gridfs_file_save (mongoc_gridfs_file_t *file)
@@ -129,6 +234,10 @@ mongoc_gridfs_file_save (mongoc_gridfs_file_t *file)
    const char *content_type;
    const bson_t *aliases;
    const bson_t *metadata;
+   bson_md5_t ctx;
+   uint8_t digest[16];
+   char digest_str[33];
+   size_t i;
    bool r;
 
    ENTRY;
@@ -141,6 +250,23 @@ mongoc_gridfs_file_save (mongoc_gridfs_file_t *file)
       _mongoc_gridfs_file_flush_page (file);
    }
 
+   if (!_mongoc_gridfs_file_send_chunks (file)) {
+      RETURN (false);
+   }
+
+   if (file->compute_md5 && file->md5_valid &&
+       file->md5_pos == (uint64_t) file->length) {
+      /* finish a copy, the file may be appended to after saving */
+      ctx = file->md5_ctx;
+      bson_md5_finish (&ctx, digest);
+      for (i = 0; i < sizeof digest; i++) {
+         bson_snprintf (&digest_str[i * 2], 3, "%02x", digest[i]);
+      }
+
+      bson_free (file->md5);
+      file->md5 = bson_strdup (digest_str);
+   }
+
    md5 = mongoc_gridfs_file_get_md5 (file);
    filename = mongoc_gridfs_file_get_filename (file);
    content_type = mongoc_gridfs_file_get_content_type (file);
@@ -368,6 +494,10 @@ mongoc_gridfs_file_destroy (mongoc_gridfs_file_t *file)
       _mongoc_gridfs_file_page_destroy (file->page);
    }
 
+   /* chunks flushed before destroy were always written */
+   (void) _mongoc_gridfs_file_send_chunks (file);
+   _mongoc_gridfs_file_write_behind_stop (file);
+
    if (file->bson.len) {
       bson_destroy (&file->bson);
    }
@@ -376,6 +506,17 @@ mongoc_gridfs_file_destroy (mongoc_gridfs_file_t *file)
       mongoc_cursor_destroy (file->cursor);
    }
 
+   _mongoc_gridfs_file_prefetch_stop (file);
+
+   if (file->chunk) {
+      bson_destroy (file->chunk);
+   }
+
+   _mongoc_gridfs_file_drop_first_chunks (file, 0);
+   if (file->first_chunks.element_size) {
+      _mongoc_array_destroy (&file->first_chunks);
+   }
+
    if (file->files_id.value_type) {
       bson_value_destroy (&file->files_id);
    }
@@ -477,18 +618,21 @@ mongoc_gridfs_file_readv (mongoc_gridfs_file_t *file,
 }
 
 
-/** writev against a gridfs file
- *  timeout_msec is unused */
-ssize_t
-mongoc_gridfs_file_writev (mongoc_gridfs_file_t *file,
-                           const mongoc_iovec_t *iov,
-                           size_t iovcnt,
-                           uint32_t timeout_msec)
+/* write @iov at file->pos. unless @wait, stop before a page is flushed if
+ * that would wait for the write-behind thread */
+static ssize_t
+_mongoc_gridfs_file_writev (mongoc_gridfs_file_t *file,
+                            const mongoc_iovec_t *iov,
+                            size_t iovcnt,
+                            bool wait)
 {
    uint32_t bytes_written = 0;
+   uint32_t remaining;
+   uint32_t n;
    int32_t r;
    size_t i;
    uint32_t iov_pos;
+   bool digest;
 
    ENTRY;
 
@@ -496,6 +640,10 @@ mongoc_gridfs_file_writev (mongoc_gridfs_file_t *file,
    BSON_ASSERT (iov);
    BSON_ASSERT (iovcnt);
 
+   /* digest the bytes once they're all written */
+   digest = _mongoc_gridfs_file_md5_continues (file);
+   file->md5_valid = false;
+
    /* Pull in the correct page */
    if (!file->page && !_mongoc_gridfs_file_refresh_page (file)) {
       return -1;
@@ -530,6 +678,9 @@ mongoc_gridfs_file_writev (mongoc_gridfs_file_t *file,
          if (iov_pos == iov[i].iov_len) {
             /** filled a bucket, keep going */
             break;
+         } else if (!wait && !_mongoc_gridfs_file_can_write (file)) {
+            /* keep the full page until the batch being sent is done */
+            goto done;
          } else {
             /** flush the buffer, the next pass through will bring in a new page
              */
@@ -540,12 +691,316 @@ mongoc_gridfs_file_writev (mongoc_gridfs_file_t *file,
       }
    }
 
+done:
    file->is_dirty = 1;
 
+   if (digest) {
+      remaining = bytes_written;
+      for (i = 0; i < iovcnt && remaining; i++) {
+         n = (uint32_t) BSON_MIN ((size_t) remaining, iov[i].iov_len);
+         _mongoc_gridfs_file_md5_append (
+            file, (const uint8_t *) iov[i].iov_base, n);
+         remaining -= n;
+      }
+
+      file->md5_valid = true;
+   }
+
    RETURN (bytes_written);
 }
 
 
+/** writev against a gridfs file
+ *  timeout_msec is unused */
+ssize_t
+mongoc_gridfs_file_writev (mongoc_gridfs_file_t *file,
+                           const mongoc_iovec_t *iov,
+                           size_t iovcnt,
+                           uint32_t timeout_msec)
+{
+   return _mongoc_gridfs_file_writev (file, iov, iovcnt, true);
+}
+
+
+/**
+ * _mongoc_gridfs_file_try_readv:
+ *
+ *    Read into @iov what is read without waiting for the server: the rest
+ *    of the current page, and chunks the prefetch thread already fetched.
+ *
+ * Returns:
+ *
+ *    The number of bytes read, 0 at the end of the file, or -1 with errno
+ *    EAGAIN if nothing could be read yet. -1 on error, then file->error is
+ *    set.
+ */
+ssize_t
+_mongoc_gridfs_file_try_readv (mongoc_gridfs_file_t *file,
+                               mongoc_iovec_t *iov,
+                               size_t iovcnt)
+{
+   uint32_t bytes_read = 0;
+   uint32_t iov_pos;
+   int32_t r;
+   size_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (file);
+   BSON_ASSERT (iov);
+   BSON_ASSERT (iovcnt);
+
+   for (i = 0; i < iovcnt; i++) {
+      iov_pos = 0;
+
+      while (iov_pos < iov[i].iov_len && file->pos < file->length) {
+         if (!file->page || _mongoc_gridfs_file_page_tell (file->page) >=
+                               _mongoc_gridfs_file_page_get_len (file->page)) {
+            if (!_mongoc_gridfs_file_can_read (file)) {
+               goto done;
+            }
+
+            if (!_mongoc_gridfs_file_refresh_page (file)) {
+               RETURN (bytes_read ? (ssize_t) bytes_read : -1);
+            }
+         }
+
+         r = _mongoc_gridfs_file_page_read (
+            file->page,
+            (uint8_t *) iov[i].iov_base + iov_pos,
+            (uint32_t) (iov[i].iov_len - iov_pos));
+         BSON_ASSERT (r >= 0);
+
+         iov_pos += r;
+         file->pos += r;
+         bytes_read += r;
+      }
+   }
+
+done:
+   if (!bytes_read && file->pos < file->length) {
+      errno = EAGAIN;
+      RETURN (-1);
+   }
+
+   RETURN (bytes_read);
+}
+
+
+/**
+ * _mongoc_gridfs_file_try_writev:
+ *
+ *    Write @iov at the file's position, stopping where a page would have
+ *    to wait for the write-behind thread to finish sending a batch.
+ *
+ * Returns:
+ *
+ *    The number of bytes written, or -1 with errno EAGAIN if none could
+ *    be. -1 on error, then file->error is set.
+ */
+ssize_t
+_mongoc_gridfs_file_try_writev (mongoc_gridfs_file_t *file,
+                                const mongoc_iovec_t *iov,
+                                size_t iovcnt)
+{
+   ssize_t r;
+
+   r = _mongoc_gridfs_file_writev (file, iov, iovcnt, false);
+   if (r == 0) {
+      errno = EAGAIN;
+      return -1;
+   }
+
+   return r;
+}
+
+
+/* copy @len bytes of @data into @iov, from the position *@iov_idx and
+ * *@iov_pos, and advance the position */
+static void
+_mongoc_gridfs_file_copy_to_iov (const uint8_t *data,
+                                 size_t len,
+                                 mongoc_iovec_t *iov,
+                                 size_t iovcnt,
+                                 size_t *iov_idx,
+                                 size_t *iov_pos)
+{
+   size_t n;
+
+   while (len && *iov_idx < iovcnt) {
+      n = BSON_MIN (len, iov[*iov_idx].iov_len - *iov_pos);
+      memcpy ((uint8_t *) iov[*iov_idx].iov_base + *iov_pos, data, n);
+      data += n;
+      len -= n;
+      *iov_pos += n;
+
+      if (*iov_pos == iov[*iov_idx].iov_len) {
+         (*iov_idx)++;
+         *iov_pos = 0;
+      }
+   }
+}
+
+
+/**
+ * mongoc_gridfs_file_read_range:
+ *
+ *    Read the bytes from @start up to @end, or the end of the file or of
+ *    @iov if sooner, with one query for just the chunks they span. The
+ *    chunk data is copied straight from the reply into @iov.
+ *
+ *    The file position is unchanged.
+ *
+ * Returns:
+ *
+ *    The number of bytes read, or -1 on error and the error can be
+ *    retrieved with mongoc_gridfs_file_error.
+ */
+ssize_t
+mongoc_gridfs_file_read_range (mongoc_gridfs_file_t *file,
+                               uint64_t start,
+                               uint64_t end,
+                               mongoc_iovec_t *iov,
+                               size_t iovcnt)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *chunk;
+   bson_iter_t iter;
+   bson_t query;
+   bson_t opts;
+   bson_t child;
+   uint64_t capacity = 0;
+   uint64_t chunk_start;
+   uint64_t from;
+   uint64_t to;
+   int32_t first;
+   int32_t last;
+   int32_t n;
+   const uint8_t *data;
+   uint32_t len = 0;
+   size_t iov_idx = 0;
+   size_t iov_pos = 0;
+   size_t i;
+   ssize_t bytes_read = 0;
+
+   ENTRY;
+
+   BSON_ASSERT (file);
+   BSON_ASSERT (iov || !iovcnt);
+
+   for (i = 0; i < iovcnt; i++) {
+      capacity += iov[i].iov_len;
+   }
+
+   end = BSON_MIN (end, (uint64_t) file->length);
+   if (start >= end || !capacity || file->chunk_size <= 0) {
+      RETURN (0);
+   }
+
+   end = BSON_MIN (end, start + capacity);
+
+   /* the server must have what we've written */
+   if (file->page && _mongoc_gridfs_file_page_is_dirty (file->page) &&
+       !_mongoc_gridfs_file_flush_page (file)) {
+      RETURN (-1);
+   }
+
+   if (!_mongoc_gridfs_file_send_chunks (file)) {
+      RETURN (-1);
+   }
+
+   first = (int32_t) (start / file->chunk_size);
+   last = (int32_t) ((end - 1) / file->chunk_size);
+
+   bson_init (&query);
+   BSON_APPEND_VALUE (&query, "files_id", &file->files_id);
+   BSON_APPEND_DOCUMENT_BEGIN (&query, "n", &child);
+   BSON_APPEND_INT32 (&child, "$gte", first);
+   BSON_APPEND_INT32 (&child, "$lte", last);
+   bson_append_document_end (&query, &child);
+
+   bson_init (&opts);
+   BSON_APPEND_DOCUMENT_BEGIN (&opts, "sort", &child);
+   BSON_APPEND_INT32 (&child, "n", 1);
+   bson_append_document_end (&opts, &child);
+
+   BSON_APPEND_DOCUMENT_BEGIN (&opts, "projection", &child);
+   BSON_APPEND_INT32 (&child, "n", 1);
+   BSON_APPEND_INT32 (&child, "data", 1);
+   BSON_APPEND_INT32 (&child, "_id", 0);
+   bson_append_document_end (&opts, &child);
+
+   /* all the chunks in one batch, if they fit in a reply */
+   BSON_APPEND_INT32 (&opts, "batchSize", last - first + 1);
+
+   cursor = mongoc_collection_find_with_opts (
+      file->gridfs->chunks, &query, &opts, NULL);
+
+   for (n = first; n <= last; n++) {
+      if (!mongoc_cursor_next (cursor, &chunk)) {
+         /* copy cursor error; if there's none, we're missing a chunk */
+         if (!mongoc_cursor_error (cursor, &file->error)) {
+            bson_set_error (&file->error,
+                            MONGOC_ERROR_GRIDFS,
+                            MONGOC_ERROR_GRIDFS_CHUNK_MISSING,
+                            "missing chunk number %" PRId32,
+                            n);
+         }
+
+         bytes_read = -1;
+         break;
+      }
+
+      data = NULL;
+      if (!bson_iter_init_find (&iter, chunk, "n") ||
+          bson_iter_as_int64 (&iter) != n) {
+         bson_set_error (&file->error,
+                         MONGOC_ERROR_GRIDFS,
+                         MONGOC_ERROR_GRIDFS_CHUNK_MISSING,
+                         "missing chunk number %" PRId32,
+                         n);
+         bytes_read = -1;
+         break;
+      }
+
+      if (bson_iter_init_find (&iter, chunk, "data") &&
+          BSON_ITER_HOLDS_BINARY (&iter)) {
+         bson_iter_binary (&iter, NULL, &len, &data);
+      }
+
+      chunk_start = (uint64_t) n * (uint64_t) file->chunk_size;
+      from = BSON_MAX (start, chunk_start);
+      to = BSON_MIN (end, chunk_start + (uint64_t) file->chunk_size);
+
+      /* every chunk but the file's last is full */
+      if (!data || chunk_start + len < to) {
+         bson_set_error (&file->error,
+                         MONGOC_ERROR_GRIDFS,
+                         MONGOC_ERROR_GRIDFS_CHUNK_MISSING,
+                         "corrupt chunk number %" PRId32,
+                         n);
+         bytes_read = -1;
+         break;
+      }
+
+      _mongoc_gridfs_file_copy_to_iov (data + (from - chunk_start),
+                                       (size_t) (to - from),
+                                       iov,
+                                       iovcnt,
+                                       &iov_idx,
+                                       &iov_pos);
+
+      bytes_read += (ssize_t) (to - from);
+   }
+
+   mongoc_cursor_destroy (cursor);
+   bson_destroy (&query);
+   bson_destroy (&opts);
+
+   RETURN (bytes_read);
+}
+
+
 /**
  * _mongoc_gridfs_file_extend:
  *
@@ -605,66 +1060,461 @@ _mongoc_gridfs_file_extend (mongoc_gridfs_file_t *file)
 }
 
 
+static void *
+_mongoc_gridfs_file_write_behind_run (void *data)
+{
+   mongoc_gridfs_file_write_behind_t *wb;
+   mongoc_bulk_operation_t *bulk;
+   bson_error_t error;
+   bool r;
+
+   wb = (mongoc_gridfs_file_write_behind_t *) data;
+
+   mongoc_mutex_lock (&wb->mutex);
+
+   for (;;) {
+      while (!wb->bulk && !wb->stop) {
+         mongoc_cond_wait (&wb->cond, &wb->mutex);
+      }
+
+      if (!wb->bulk) {
+         break;
+      }
+
+      /* the writer doesn't touch the batch until it's done */
+      bulk = wb->bulk;
+      mongoc_mutex_unlock (&wb->mutex);
+      r = mongoc_bulk_operation_execute (bulk, NULL, &error) != 0;
+      mongoc_bulk_operation_destroy (bulk);
+      mongoc_mutex_lock (&wb->mutex);
+
+      if (!r) {
+         memcpy (&wb->error, &error, sizeof (bson_error_t));
+      }
+
+      wb->bulk = NULL;
+      mongoc_cond_broadcast (&wb->cond);
+   }
+
+   mongoc_mutex_unlock (&wb->mutex);
+
+   return NULL;
+}
+
+
 /**
- * _mongoc_gridfs_file_flush_page:
- *
- *    Unconditionally flushes the file's current page to the database.
- *    The page to flush is determined by page->n.
- *
- * Side Effects:
+ * _mongoc_gridfs_file_write_behind_start:
  *
- *    On success, file->page is properly destroyed and set to NULL.
+ *    Start a thread on a client from file->write_behind_pool that sends
+ *    batches of chunks while the writer fills the next.
  *
  * Returns:
  *
- *    True on success; false otherwise.
+ *    False if the pool has no client to spare, then the writer sends its
+ *    chunks itself.
  */
 static bool
-_mongoc_gridfs_file_flush_page (mongoc_gridfs_file_t *file)
+_mongoc_gridfs_file_write_behind_start (mongoc_gridfs_file_t *file)
 {
-   bson_t *selector, *update;
-   bool r;
-   const uint8_t *buf;
-   uint32_t len;
+   mongoc_gridfs_file_write_behind_t *wb;
+   mongoc_client_t *client;
 
    ENTRY;
-   BSON_ASSERT (file);
-   BSON_ASSERT (file->page);
 
-   buf = _mongoc_gridfs_file_page_get_data (file->page);
-   len = _mongoc_gridfs_file_page_get_len (file->page);
+   client = mongoc_client_pool_try_pop (file->write_behind_pool);
+   if (!client) {
+      RETURN (false);
+   }
 
-   selector = bson_new ();
+   wb = (mongoc_gridfs_file_write_behind_t *) bson_malloc0 (sizeof *wb);
+   wb->client = client;
+   mongoc_mutex_init (&wb->mutex);
+   mongoc_cond_init (&wb->cond);
 
-   bson_append_value (selector, "files_id", -1, &file->files_id);
-   bson_append_int32 (selector, "n", -1, file->n);
+   _mongoc_thread_create (MONGOC_THREAD_GRIDFS_WRITE_BEHIND,
+                          &wb->thread,
+                          _mongoc_gridfs_file_write_behind_run,
+                          wb);
 
-   update = bson_sized_new (file->chunk_size + 100);
+   file->write_behind = wb;
 
-   bson_append_value (update, "files_id", -1, &file->files_id);
-   bson_append_int32 (update, "n", -1, file->n);
-   bson_append_binary (update, "data", -1, BSON_SUBTYPE_BINARY, buf, len);
+   RETURN (true);
+}
 
-   r = mongoc_collection_update (file->gridfs->chunks,
-                                 MONGOC_UPDATE_UPSERT,
-                                 selector,
-                                 update,
-                                 NULL,
-                                 &file->error);
+
+/* wait for the batch being sent, and move its error to file->error */
+static bool
+_mongoc_gridfs_file_write_behind_wait (mongoc_gridfs_file_t *file)
+{
+   mongoc_gridfs_file_write_behind_t *wb = file->write_behind;
+   bool r;
+
+   if (!wb) {
+      return true;
+   }
+
+   mongoc_mutex_lock (&wb->mutex);
+   while (wb->bulk) {
+      mongoc_cond_wait (&wb->cond, &wb->mutex);
+   }
+
+   r = !wb->error.domain;
+   if (!r) {
+      memcpy (&file->error, &wb->error, sizeof (bson_error_t));
+      memset (&wb->error, 0, sizeof (bson_error_t));
+   }
+
+   mongoc_mutex_unlock (&wb->mutex);
+
+   return r;
+}
+
+
+/**
+ * _mongoc_gridfs_file_write_behind_send:
+ *
+ *    Hand file->pending to the write-behind thread, once it has sent the
+ *    previous batch. Sends file->pending directly if the thread can't
+ *    start.
+ *
+ * Returns:
+ *
+ *    False if the previous batch or a direct send failed, and file->error
+ *    is set.
+ */
+static bool
+_mongoc_gridfs_file_write_behind_send (mongoc_gridfs_file_t *file)
+{
+   mongoc_gridfs_file_write_behind_t *wb;
+
+   ENTRY;
+
+   if (!file->write_behind &&
+       !_mongoc_gridfs_file_write_behind_start (file)) {
+      RETURN (_mongoc_gridfs_file_send_chunks (file));
+   }
+
+   if (!_mongoc_gridfs_file_write_behind_wait (file)) {
+      RETURN (false);
+   }
+
+   wb = file->write_behind;
+   mongoc_bulk_operation_set_client (file->pending, wb->client);
+
+   mongoc_mutex_lock (&wb->mutex);
+   wb->bulk = file->pending;
+   mongoc_cond_broadcast (&wb->cond);
+   mongoc_mutex_unlock (&wb->mutex);
+
+   file->pending = NULL;
+   file->pending_bytes = 0;
+
+   RETURN (true);
+}
+
+
+/* finish the batch being sent, if any, and end the thread */
+static void
+_mongoc_gridfs_file_write_behind_stop (mongoc_gridfs_file_t *file)
+{
+   mongoc_gridfs_file_write_behind_t *wb;
+
+   wb = file->write_behind;
+   if (!wb) {
+      return;
+   }
+
+   mongoc_mutex_lock (&wb->mutex);
+   wb->stop = true;
+   mongoc_cond_broadcast (&wb->cond);
+   mongoc_mutex_unlock (&wb->mutex);
+
+   mongoc_thread_join (wb->thread);
+
+   if (wb->error.domain && !file->error.domain) {
+      memcpy (&file->error, &wb->error, sizeof (bson_error_t));
+   }
+
+   mongoc_client_pool_push (file->write_behind_pool, wb->client);
+   mongoc_cond_destroy (&wb->cond);
+   mongoc_mutex_destroy (&wb->mutex);
+   bson_free (wb);
+
+   file->write_behind = NULL;
+}
+
+
+/**
+ * _mongoc_gridfs_file_set_write_behind:
+ *
+ *    With a @pool, a full batch of flushed chunks is sent by a thread on
+ *    one of its clients while the writer continues, instead of by the
+ *    writer. The files document is then saved only by
+ *    mongoc_gridfs_file_save or when the file is destroyed.
+ */
+void
+_mongoc_gridfs_file_set_write_behind (mongoc_gridfs_file_t *file,
+                                      mongoc_client_pool_t *pool)
+{
+   BSON_ASSERT (file);
+
+   (void) _mongoc_gridfs_file_write_behind_wait (file);
+   _mongoc_gridfs_file_write_behind_stop (file);
+
+   file->write_behind_pool = pool;
+}
+
+
+/**
+ * _mongoc_gridfs_file_send_chunks:
+ *
+ *    Send the chunks queued by _mongoc_gridfs_file_flush_page in one bulk
+ *    operation.
+ *
+ * Returns:
+ *
+ *    True on success or if no chunks are queued; false otherwise, and
+ *    file->error is set.
+ */
+static bool
+_mongoc_gridfs_file_send_chunks (mongoc_gridfs_file_t *file)
+{
+   bool r;
+
+   ENTRY;
+
+   /* the batch sent behind the writer goes first */
+   if (!_mongoc_gridfs_file_write_behind_wait (file)) {
+      RETURN (false);
+   }
+
+   if (!file->pending) {
+      RETURN (true);
+   }
+
+   r = mongoc_bulk_operation_execute (file->pending, NULL, &file->error) != 0;
+
+   mongoc_bulk_operation_destroy (file->pending);
+   file->pending = NULL;
+   file->pending_bytes = 0;
+
+   RETURN (r);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_gridfs_file_set_first_chunks --
+ *
+ *       Keep copies of the chunk documents in the array @chunks, sorted by
+ *       "n" from 0, so the file's first pages are read without a query.
+ *       Keeping stops at the first chunk out of sequence.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_gridfs_file_set_first_chunks (mongoc_gridfs_file_t *file,
+                                      const bson_t *chunks)
+{
+   bson_iter_t iter;
+   bson_iter_t n;
+   bson_t chunk;
+   bson_t *copy;
+   const uint8_t *data;
+   uint32_t len;
+
+   BSON_ASSERT (!file->first_chunks.element_size);
+
+   _mongoc_array_init (&file->first_chunks, sizeof (bson_t *));
+
+   if (!bson_iter_init (&iter, chunks)) {
+      return;
+   }
+
+   while (bson_iter_next (&iter) && BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_iter_document (&iter, &len, &data);
+      BSON_ASSERT (bson_init_static (&chunk, data, len));
+
+      if (!bson_iter_init_find (&n, &chunk, "n") ||
+          !BSON_ITER_HOLDS_INT32 (&n) ||
+          bson_iter_int32 (&n) != (int32_t) file->first_chunks.len) {
+         break;
+      }
+
+      copy = bson_copy (&chunk);
+      _mongoc_array_append_val (&file->first_chunks, copy);
+   }
+}
+
+
+/* forget first chunks from @n on, they're being overwritten */
+static void
+_mongoc_gridfs_file_drop_first_chunks (mongoc_gridfs_file_t *file, int32_t n)
+{
+   size_t i;
+
+   if (!file->first_chunks.element_size) {
+      return;
+   }
+
+   for (i = (size_t) n; i < file->first_chunks.len; i++) {
+      bson_destroy (_mongoc_array_index (&file->first_chunks, bson_t *, i));
+   }
+
+   if ((size_t) n < file->first_chunks.len) {
+      file->first_chunks.len = (size_t) n;
+   }
+}
+
+
+/* queue an upsert of chunk @n with @len bytes of @data */
+static void
+_mongoc_gridfs_file_queue_chunk (mongoc_gridfs_file_t *file,
+                                 int32_t n,
+                                 const uint8_t *data,
+                                 uint32_t len)
+{
+   bson_t *selector, *update;
+
+   if (file->gridfs->chunk_cache) {
+      _mongoc_gridfs_chunk_cache_remove (file->gridfs->chunk_cache, file, n);
+   }
+
+   _mongoc_gridfs_file_drop_first_chunks (file, n);
+
+   selector = bson_new ();
+
+   bson_append_value (selector, "files_id", -1, &file->files_id);
+   bson_append_int32 (selector, "n", -1, n);
+
+   update = bson_sized_new (file->chunk_size + 100);
+
+   bson_append_value (update, "files_id", -1, &file->files_id);
+   bson_append_int32 (update, "n", -1, n);
+   bson_append_binary (update, "data", -1, BSON_SUBTYPE_BINARY, data, len);
+
+   if (!file->pending) {
+      file->pending = mongoc_collection_create_bulk_operation (
+         file->gridfs->chunks, true, NULL);
+   }
+
+   mongoc_bulk_operation_replace_one (file->pending, selector, update, true);
+   file->pending_bytes += update->len;
 
    bson_destroy (selector);
    bson_destroy (update);
+}
 
-   if (r) {
-      _mongoc_gridfs_file_page_destroy (file->page);
-      file->page = NULL;
-      r = mongoc_gridfs_file_save (file);
+
+/**
+ * _mongoc_gridfs_file_flush_page:
+ *
+ *    Unconditionally flushes the file's current page to the database.
+ *    The page to flush is determined by page->n. The chunk is queued, and
+ *    sent with the following chunks once 16 MB are queued, or before the
+ *    file is read, saved, or destroyed.
+ *
+ * Side Effects:
+ *
+ *    On success, file->page is properly destroyed and set to NULL.
+ *
+ * Returns:
+ *
+ *    True on success; false otherwise.
+ */
+static bool
+_mongoc_gridfs_file_flush_page (mongoc_gridfs_file_t *file)
+{
+   bool r = true;
+
+   ENTRY;
+   BSON_ASSERT (file);
+   BSON_ASSERT (file->page);
+
+   /* chunks fetched ahead may be overwritten */
+   _mongoc_gridfs_file_prefetch_stop (file);
+
+   _mongoc_gridfs_file_queue_chunk (
+      file,
+      file->n,
+      _mongoc_gridfs_file_page_get_data (file->page),
+      _mongoc_gridfs_file_page_get_len (file->page));
+
+   _mongoc_gridfs_file_page_destroy (file->page);
+   file->page = NULL;
+
+   if (file->pending_bytes >= MONGOC_GRIDFS_FILE_MAX_PENDING_BYTES) {
+      if (file->write_behind_pool) {
+         /* the files document is saved with the file */
+         r = _mongoc_gridfs_file_write_behind_send (file);
+      } else {
+         r = _mongoc_gridfs_file_send_chunks (file) &&
+             mongoc_gridfs_file_save (file);
+      }
    }
 
    RETURN (r);
 }
 
 
+/**
+ * _mongoc_gridfs_file_append_chunks:
+ *
+ *    Append @len bytes of @data to a file whose length is a multiple of
+ *    its chunk size, queuing chunks built straight from @data without a
+ *    page. @data may be unmapped once this returns.
+ *
+ * Returns:
+ *
+ *    True on success; false otherwise, and file->error is set.
+ */
+bool
+_mongoc_gridfs_file_append_chunks (mongoc_gridfs_file_t *file,
+                                   const uint8_t *data,
+                                   size_t len)
+{
+   uint32_t chunk_len;
+   bool digest;
+
+   ENTRY;
+
+   BSON_ASSERT (file);
+   BSON_ASSERT (!file->page);
+   BSON_ASSERT (file->length % file->chunk_size == 0);
+
+   _mongoc_gridfs_file_prefetch_stop (file);
+
+   file->pos = (uint64_t) file->length;
+   digest = _mongoc_gridfs_file_md5_continues (file);
+
+   while (len) {
+      chunk_len = (uint32_t) BSON_MIN (len, (size_t) file->chunk_size);
+      file->n = (int32_t) (file->pos / file->chunk_size);
+
+      if (digest) {
+         _mongoc_gridfs_file_md5_append (file, data, chunk_len);
+      }
+
+      _mongoc_gridfs_file_queue_chunk (file, file->n, data, chunk_len);
+
+      data += chunk_len;
+      len -= chunk_len;
+      file->pos += chunk_len;
+      file->length = (int64_t) file->pos;
+      file->is_dirty = true;
+
+      if (file->pending_bytes >= MONGOC_GRIDFS_FILE_MAX_PENDING_BYTES &&
+          !(_mongoc_gridfs_file_send_chunks (file) &&
+            mongoc_gridfs_file_save (file))) {
+         RETURN (false);
+      }
+   }
+
+   RETURN (true);
+}
+
+
 /**
  * _mongoc_gridfs_file_keep_cursor:
  *
@@ -690,8 +1540,12 @@ _mongoc_gridfs_file_keep_cursor (mongoc_gridfs_file_t *file)
    }
 
    chunk_no = (uint32_t) file->n;
-   /* server returns roughly 4 MB batches by default */
-   chunks_per_batch = (4 * 1024 * 1024) / (uint32_t) file->chunk_size;
+   if (file->read_ahead) {
+      chunks_per_batch = file->read_ahead;
+   } else {
+      /* server returns roughly 4 MB batches by default */
+      chunks_per_batch = (4 * 1024 * 1024) / (uint32_t) file->chunk_size;
+   }
 
    return (
       /* cursor is on or before the desired chunk */
@@ -710,6 +1564,246 @@ divide_round_up (int64_t num, int64_t denom)
 }
 
 
+/* the filter and options for chunks from file->n on */
+static void
+_mongoc_gridfs_file_chunks_query (mongoc_gridfs_file_t *file,
+                                  bson_t *query,
+                                  bson_t *opts)
+{
+   bson_t child;
+
+   bson_init (query);
+   BSON_APPEND_VALUE (query, "files_id", &file->files_id);
+   BSON_APPEND_DOCUMENT_BEGIN (query, "n", &child);
+   BSON_APPEND_INT32 (&child, "$gte", file->n);
+   bson_append_document_end (query, &child);
+
+   bson_init (opts);
+   BSON_APPEND_DOCUMENT_BEGIN (opts, "sort", &child);
+   BSON_APPEND_INT32 (&child, "n", 1);
+   bson_append_document_end (opts, &child);
+
+   BSON_APPEND_DOCUMENT_BEGIN (opts, "projection", &child);
+   BSON_APPEND_INT32 (&child, "n", 1);
+   BSON_APPEND_INT32 (&child, "data", 1);
+   BSON_APPEND_INT32 (&child, "_id", 0);
+   bson_append_document_end (opts, &child);
+
+   if (file->read_ahead) {
+      BSON_APPEND_INT32 (opts, "batchSize", (int32_t) file->read_ahead);
+   }
+}
+
+
+static void *
+_mongoc_gridfs_file_prefetch_run (void *data)
+{
+   mongoc_gridfs_file_prefetch_t *prefetch;
+   mongoc_cursor_t *cursor;
+   const bson_t *chunk;
+   uint32_t slot;
+
+   prefetch = (mongoc_gridfs_file_prefetch_t *) data;
+   cursor = mongoc_collection_find_with_opts (
+      prefetch->chunks, &prefetch->query, &prefetch->opts, NULL);
+
+   while (mongoc_cursor_next (cursor, &chunk)) {
+      mongoc_mutex_lock (&prefetch->mutex);
+      while (prefetch->count == prefetch->n_slots && !prefetch->stop) {
+         mongoc_cond_wait (&prefetch->cond, &prefetch->mutex);
+      }
+
+      if (prefetch->stop) {
+         mongoc_mutex_unlock (&prefetch->mutex);
+         break;
+      }
+
+      slot = (prefetch->head + prefetch->count) % prefetch->n_slots;
+      prefetch->ring[slot] = bson_copy (chunk);
+      prefetch->count++;
+      mongoc_cond_broadcast (&prefetch->cond);
+      mongoc_mutex_unlock (&prefetch->mutex);
+   }
+
+   mongoc_mutex_lock (&prefetch->mutex);
+   (void) mongoc_cursor_error (cursor, &prefetch->error);
+   prefetch->done = true;
+   mongoc_cond_broadcast (&prefetch->cond);
+   mongoc_mutex_unlock (&prefetch->mutex);
+
+   mongoc_cursor_destroy (cursor);
+
+   return NULL;
+}
+
+
+/**
+ * _mongoc_gridfs_file_prefetch_start:
+ *
+ *    Start a thread on a client from file->read_ahead_pool that fetches
+ *    the chunks from file->n on, up to file->read_ahead chunks ahead of
+ *    the reader.
+ *
+ * Returns:
+ *
+ *    False if the pool has no client to spare, then the caller reads
+ *    chunks with its own cursor.
+ */
+static bool
+_mongoc_gridfs_file_prefetch_start (mongoc_gridfs_file_t *file)
+{
+   mongoc_gridfs_file_prefetch_t *prefetch;
+   mongoc_collection_t *chunks;
+   mongoc_client_t *client;
+
+   ENTRY;
+
+   client = mongoc_client_pool_try_pop (file->read_ahead_pool);
+   if (!client) {
+      RETURN (false);
+   }
+
+   chunks = file->gridfs->chunks;
+
+   prefetch = (mongoc_gridfs_file_prefetch_t *) bson_malloc0 (sizeof *prefetch);
+   prefetch->client = client;
+   prefetch->chunks =
+      mongoc_client_get_collection (client, chunks->db, chunks->collection);
+   mongoc_collection_set_read_prefs (prefetch->chunks,
+                                     mongoc_collection_get_read_prefs (chunks));
+   mongoc_collection_set_read_concern (
+      prefetch->chunks, mongoc_collection_get_read_concern (chunks));
+   _mongoc_gridfs_file_chunks_query (file, &prefetch->query, &prefetch->opts);
+   prefetch->n_slots = file->read_ahead;
+   prefetch->ring =
+      (bson_t **) bson_malloc0 (prefetch->n_slots * sizeof (bson_t *));
+   prefetch->n = file->n;
+   mongoc_mutex_init (&prefetch->mutex);
+   mongoc_cond_init (&prefetch->cond);
+
+   _mongoc_thread_create (MONGOC_THREAD_GRIDFS_PREFETCH,
+                          &prefetch->thread,
+                          _mongoc_gridfs_file_prefetch_run,
+                          prefetch);
+
+   file->prefetch = prefetch;
+
+   RETURN (true);
+}
+
+
+static void
+_mongoc_gridfs_file_prefetch_stop (mongoc_gridfs_file_t *file)
+{
+   mongoc_gridfs_file_prefetch_t *prefetch;
+   uint32_t i;
+
+   prefetch = file->prefetch;
+   if (!prefetch) {
+      return;
+   }
+
+   mongoc_mutex_lock (&prefetch->mutex);
+   prefetch->stop = true;
+   mongoc_cond_broadcast (&prefetch->cond);
+   mongoc_mutex_unlock (&prefetch->mutex);
+
+   mongoc_thread_join (prefetch->thread);
+
+   for (i = 0; i < prefetch->count; i++) {
+      bson_destroy (prefetch->ring[(prefetch->head + i) % prefetch->n_slots]);
+   }
+
+   bson_free (prefetch->ring);
+   bson_destroy (&prefetch->query);
+   bson_destroy (&prefetch->opts);
+   mongoc_collection_destroy (prefetch->chunks);
+   mongoc_client_pool_push (file->read_ahead_pool, prefetch->client);
+   mongoc_cond_destroy (&prefetch->cond);
+   mongoc_mutex_destroy (&prefetch->mutex);
+   bson_free (prefetch);
+
+   file->prefetch = NULL;
+}
+
+
+/* like _mongoc_gridfs_file_keep_cursor: is file->n fetched or about to be */
+static bool
+_mongoc_gridfs_file_keep_prefetch (mongoc_gridfs_file_t *file)
+{
+   mongoc_gridfs_file_prefetch_t *prefetch = file->prefetch;
+
+   return file->n >= prefetch->n &&
+          (int64_t) file->n < (int64_t) prefetch->n + 2 * prefetch->n_slots;
+}
+
+
+/**
+ * _mongoc_gridfs_file_prefetch_next:
+ *
+ *    Wait for chunk file->n from the prefetch thread, skipping chunks
+ *    before it. The chunk is owned by file->chunk.
+ *
+ * Returns:
+ *
+ *    True on success. False if the thread's cursor ended or failed first,
+ *    then file->error is set.
+ */
+static bool
+_mongoc_gridfs_file_prefetch_next (mongoc_gridfs_file_t *file,
+                                   const bson_t **chunk)
+{
+   mongoc_gridfs_file_prefetch_t *prefetch = file->prefetch;
+   bson_t *taken = NULL;
+   bool found = false;
+
+   mongoc_mutex_lock (&prefetch->mutex);
+
+   while (!found) {
+      while (!prefetch->count && !prefetch->done) {
+         mongoc_cond_wait (&prefetch->cond, &prefetch->mutex);
+      }
+
+      if (!prefetch->count) {
+         break;
+      }
+
+      taken = prefetch->ring[prefetch->head];
+      prefetch->ring[prefetch->head] = NULL;
+      prefetch->head = (prefetch->head + 1) % prefetch->n_slots;
+      prefetch->count--;
+      found = prefetch->n++ == file->n;
+      mongoc_cond_broadcast (&prefetch->cond);
+
+      if (!found) {
+         bson_destroy (taken);
+      }
+   }
+
+   if (!found && prefetch->error.domain) {
+      memcpy (&file->error, &prefetch->error, sizeof (bson_error_t));
+   }
+
+   mongoc_mutex_unlock (&prefetch->mutex);
+
+   if (!found) {
+      /* copy thread's error; if there's none, we're missing a chunk */
+      if (!prefetch->error.domain) {
+         missing_chunk (file);
+      } else {
+         _mongoc_gridfs_file_prefetch_stop (file);
+      }
+
+      return false;
+   }
+
+   file->chunk = taken;
+   *chunk = taken;
+
+   return true;
+}
+
+
 static void
 missing_chunk (mongoc_gridfs_file_t *file)
 {
@@ -723,6 +1817,84 @@ missing_chunk (mongoc_gridfs_file_t *file)
       mongoc_cursor_destroy (file->cursor);
       file->cursor = NULL;
    }
+
+   _mongoc_gridfs_file_prefetch_stop (file);
+}
+
+
+/**
+ * _mongoc_gridfs_file_fetch_chunk:
+ *
+ *    Fetch chunk file->n from the prefetch thread or the file's cursor,
+ *    starting either if needed.
+ *
+ * Returns:
+ *
+ *    True and sets @chunk on success. False if the chunk is missing or the
+ *    query failed, then file->error is set.
+ */
+static bool
+_mongoc_gridfs_file_fetch_chunk (mongoc_gridfs_file_t *file,
+                                 const bson_t **chunk)
+{
+   bson_t query;
+   bson_t opts;
+
+   /* restart the prefetch thread if we seeked away from its chunks */
+   if (file->prefetch && !_mongoc_gridfs_file_keep_prefetch (file)) {
+      _mongoc_gridfs_file_prefetch_stop (file);
+   }
+
+   if (file->read_ahead_pool && !file->prefetch) {
+      (void) _mongoc_gridfs_file_prefetch_start (file);
+   }
+
+   /* if we have a cursor, but the cursor doesn't have the chunk we're going
+    * to need, destroy it (we'll grab a new one immediately there after) */
+   if (file->cursor &&
+       (file->prefetch || !_mongoc_gridfs_file_keep_cursor (file))) {
+      mongoc_cursor_destroy (file->cursor);
+      file->cursor = NULL;
+   }
+
+   if (file->prefetch) {
+      if (!_mongoc_gridfs_file_prefetch_next (file, chunk)) {
+         return false;
+      }
+   } else {
+      if (!file->cursor) {
+         _mongoc_gridfs_file_chunks_query (file, &query, &opts);
+
+         /* find all chunks greater than or equal to our current file pos */
+         file->cursor = mongoc_collection_find_with_opts (
+            file->gridfs->chunks, &query, &opts, NULL);
+
+         file->cursor_range[0] = file->n;
+         file->cursor_range[1] = (uint32_t) (file->length / file->chunk_size);
+
+         bson_destroy (&query);
+         bson_destroy (&opts);
+
+         BSON_ASSERT (file->cursor);
+      }
+
+      /* we might have had a cursor before, then seeked ahead past a
+       * chunk. iterate until we're on the right chunk */
+      while (file->cursor_range[0] <= file->n) {
+         if (!mongoc_cursor_next (file->cursor, chunk)) {
+            /* copy cursor error; if there's none, we're missing a chunk */
+            if (!mongoc_cursor_error (file->cursor, &file->error)) {
+               missing_chunk (file);
+            }
+
+            return false;
+         }
+
+         file->cursor_range[0]++;
+      }
+   }
+
+   return true;
 }
 
 
@@ -734,7 +1906,8 @@ missing_chunk (mongoc_gridfs_file_t *file)
  *    from the database.
  *
  *    Note that this fetch is unconditional and the page is queried from the
- *    database even if the current page covers the same theoretical chunk.
+ *    database even if the current page covers the same theoretical chunk,
+ *    unless the GridFS's chunk cache has it.
  *
  *
  * Side Effects:
@@ -750,10 +1923,8 @@ missing_chunk (mongoc_gridfs_file_t *file)
 static bool
 _mongoc_gridfs_file_refresh_page (mongoc_gridfs_file_t *file)
 {
-   bson_t query;
-   bson_t child;
-   bson_t opts;
    const bson_t *chunk;
+   const bson_t *cached = NULL;
    const char *key;
    bson_iter_t iter;
    int64_t existing_chunks;
@@ -773,6 +1944,11 @@ _mongoc_gridfs_file_refresh_page (mongoc_gridfs_file_t *file)
       file->page = NULL;
    }
 
+   if (file->chunk) {
+      bson_destroy (file->chunk);
+      file->chunk = NULL;
+   }
+
    /* if the file pointer is past the end of the current file (i.e. pointing to
     * a new chunk), we'll pass the page constructor a new empty page. */
    existing_chunks = divide_round_up (file->length, file->chunk_size);
@@ -781,57 +1957,32 @@ _mongoc_gridfs_file_refresh_page (mongoc_gridfs_file_t *file)
       data = (uint8_t *) "";
       len = 0;
    } else {
-      /* if we have a cursor, but the cursor doesn't have the chunk we're going
-       * to need, destroy it (we'll grab a new one immediately there after) */
-      if (file->cursor && !_mongoc_gridfs_file_keep_cursor (file)) {
-         mongoc_cursor_destroy (file->cursor);
-         file->cursor = NULL;
+      /* read what we've written */
+      if (!_mongoc_gridfs_file_send_chunks (file)) {
+         RETURN (0);
       }
 
-      if (!file->cursor) {
-         bson_init (&query);
-         BSON_APPEND_VALUE (&query, "files_id", &file->files_id);
-         BSON_APPEND_DOCUMENT_BEGIN (&query, "n", &child);
-         BSON_APPEND_INT32 (&child, "$gte", file->n);
-         bson_append_document_end (&query, &child);
-
-         bson_init (&opts);
-         BSON_APPEND_DOCUMENT_BEGIN (&opts, "sort", &child);
-         BSON_APPEND_INT32 (&child, "n", 1);
-         bson_append_document_end (&opts, &child);
-
-         BSON_APPEND_DOCUMENT_BEGIN (&opts, "projection", &child);
-         BSON_APPEND_INT32 (&child, "n", 1);
-         BSON_APPEND_INT32 (&child, "data", 1);
-         BSON_APPEND_INT32 (&child, "_id", 0);
-         bson_append_document_end (&opts, &child);
-
-         /* find all chunks greater than or equal to our current file pos */
-         file->cursor = mongoc_collection_find_with_opts (
-            file->gridfs->chunks, &query, &opts, NULL);
-
-         file->cursor_range[0] = file->n;
-         file->cursor_range[1] = (uint32_t) (file->length / file->chunk_size);
-
-         bson_destroy (&query);
-         bson_destroy (&opts);
-
-         BSON_ASSERT (file->cursor);
+      if ((size_t) file->n < file->first_chunks.len) {
+         cached =
+            _mongoc_array_index (&file->first_chunks, bson_t *, file->n);
+      } else if (file->gridfs->chunk_cache) {
+         cached = _mongoc_gridfs_chunk_cache_get (
+            file->gridfs->chunk_cache, file, file->n);
       }
 
-      /* we might have had a cursor before, then seeked ahead past a chunk.
-       * iterate until we're on the right chunk */
-      while (file->cursor_range[0] <= file->n) {
-         if (!mongoc_cursor_next (file->cursor, &chunk)) {
-            /* copy cursor error; if there's none, we're missing a chunk */
-            if (!mongoc_cursor_error (file->cursor, &file->error)) {
-               missing_chunk (file);
-            }
-
+      if (cached) {
+         /* the page reads from file->chunk, which outlives the entry */
+         file->chunk = bson_copy (cached);
+         chunk = file->chunk;
+      } else {
+         if (!_mongoc_gridfs_file_fetch_chunk (file, &chunk)) {
             RETURN (0);
          }
 
-         file->cursor_range[0]++;
+         if (file->gridfs->chunk_cache) {
+            _mongoc_gridfs_chunk_cache_put (
+               file->gridfs->chunk_cache, file, file->n, chunk);
+         }
       }
 
       bson_iter_init (&iter, chunk);
@@ -875,6 +2026,166 @@ _mongoc_gridfs_file_refresh_page (mongoc_gridfs_file_t *file)
 }
 
 
+/**
+ * _mongoc_gridfs_file_can_read:
+ *
+ *    Whether a read at file->pos returns without waiting for the server:
+ *    the page has bytes left, or the next chunk is cached or already
+ *    fetched by the prefetch thread. Starts the prefetch thread for the
+ *    next chunk if needed. True at the end of the file or after an error,
+ *    since a read then returns at once.
+ */
+bool
+_mongoc_gridfs_file_can_read (mongoc_gridfs_file_t *file)
+{
+   mongoc_gridfs_file_prefetch_t *prefetch;
+   bool r;
+
+   BSON_ASSERT (file);
+
+   if (file->error.domain || file->pos >= (uint64_t) file->length) {
+      return true;
+   }
+
+   if (file->page && (_mongoc_gridfs_file_page_tell (file->page) <
+                         _mongoc_gridfs_file_page_get_len (file->page) ||
+                      _mongoc_gridfs_file_page_is_dirty (file->page))) {
+      return true;
+   }
+
+   /* chunks we've written are read back directly */
+   if (!file->read_ahead_pool || file->pending) {
+      return true;
+   }
+
+   file->n = (int32_t) (file->pos / file->chunk_size);
+
+   if ((size_t) file->n < file->first_chunks.len ||
+       (file->gridfs->chunk_cache &&
+        _mongoc_gridfs_chunk_cache_get (
+           file->gridfs->chunk_cache, file, file->n))) {
+      return true;
+   }
+
+   if (file->prefetch && !_mongoc_gridfs_file_keep_prefetch (file)) {
+      _mongoc_gridfs_file_prefetch_stop (file);
+   }
+
+   if (!file->prefetch && !_mongoc_gridfs_file_prefetch_start (file)) {
+      /* no client to spare, the reader fetches the chunk itself */
+      return true;
+   }
+
+   prefetch = file->prefetch;
+   mongoc_mutex_lock (&prefetch->mutex);
+   r = prefetch->done ||
+       (int64_t) file->n < (int64_t) prefetch->n + prefetch->count;
+   mongoc_mutex_unlock (&prefetch->mutex);
+
+   return r;
+}
+
+
+/**
+ * _mongoc_gridfs_file_can_write:
+ *
+ *    Whether a full page can be flushed without waiting for the
+ *    write-behind thread to finish sending the previous batch.
+ */
+bool
+_mongoc_gridfs_file_can_write (mongoc_gridfs_file_t *file)
+{
+   mongoc_gridfs_file_write_behind_t *wb;
+   bool r;
+
+   BSON_ASSERT (file);
+
+   wb = file->write_behind;
+   if (file->error.domain || !wb) {
+      return true;
+   }
+
+   /* a flush that doesn't fill the batch only queues the page */
+   if (file->pending_bytes + file->chunk_size + 100 <
+       MONGOC_GRIDFS_FILE_MAX_PENDING_BYTES) {
+      return true;
+   }
+
+   mongoc_mutex_lock (&wb->mutex);
+   r = !wb->bulk;
+   mongoc_mutex_unlock (&wb->mutex);
+
+   return r;
+}
+
+
+/**
+ * _mongoc_gridfs_file_wait:
+ *
+ *    Wait until _mongoc_gridfs_file_can_read, or can_write if @for_write,
+ *    would return true, or until the monotonic time @expire_at in
+ *    microseconds. Wait without a deadline if @expire_at is negative.
+ */
+void
+_mongoc_gridfs_file_wait (mongoc_gridfs_file_t *file,
+                          bool for_write,
+                          int64_t expire_at)
+{
+   mongoc_gridfs_file_prefetch_t *prefetch;
+   mongoc_gridfs_file_write_behind_t *wb;
+   int64_t remaining;
+
+   BSON_ASSERT (file);
+
+   if (for_write ? _mongoc_gridfs_file_can_write (file)
+                 : _mongoc_gridfs_file_can_read (file)) {
+      return;
+   }
+
+   if (for_write) {
+      wb = file->write_behind;
+      mongoc_mutex_lock (&wb->mutex);
+      while (wb->bulk) {
+         if (expire_at < 0) {
+            mongoc_cond_wait (&wb->cond, &wb->mutex);
+            continue;
+         }
+
+         remaining = expire_at - bson_get_monotonic_time ();
+         if (remaining <= 0) {
+            break;
+         }
+
+         mongoc_cond_timedwait (
+            &wb->cond, &wb->mutex, (remaining + 999) / 1000);
+      }
+
+      mongoc_mutex_unlock (&wb->mutex);
+   } else {
+      /* can_read started the prefetch thread */
+      prefetch = file->prefetch;
+      mongoc_mutex_lock (&prefetch->mutex);
+      while (!prefetch->done &&
+             (int64_t) file->n >= (int64_t) prefetch->n + prefetch->count) {
+         if (expire_at < 0) {
+            mongoc_cond_wait (&prefetch->cond, &prefetch->mutex);
+            continue;
+         }
+
+         remaining = expire_at - bson_get_monotonic_time ();
+         if (remaining <= 0) {
+            break;
+         }
+
+         mongoc_cond_timedwait (
+            &prefetch->cond, &prefetch->mutex, (remaining + 999) / 1000);
+      }
+
+      mongoc_mutex_unlock (&prefetch->mutex);
+   }
+}
+
+
 /**
  * mongoc_gridfs_file_seek:
  *
@@ -1025,6 +2336,17 @@ mongoc_gridfs_file_remove (mongoc_gridfs_file_t *file, bson_error_t *error)
 
    BSON_ASSERT (file);
 
+   /* a batch already sent behind the writer is removed with the rest */
+   _mongoc_gridfs_file_write_behind_stop (file);
+   memset (&file->error, 0, sizeof (bson_error_t));
+
+   /* don't send chunks of a removed file */
+   if (file->pending) {
+      mongoc_bulk_operation_destroy (file->pending);
+      file->pending = NULL;
+      file->pending_bytes = 0;
+   }
+
    BSON_APPEND_VALUE (&sel, "_id", &file->files_id);
 
    if (!mongoc_collection_remove (file->gridfs->files,
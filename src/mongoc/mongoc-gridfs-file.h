@@ -88,6 +88,12 @@ mongoc_gridfs_file_readv (mongoc_gridfs_file_t *file,
                           size_t iovcnt,
                           size_t min_bytes,
                           uint32_t timeout_msec);
+MONGOC_EXPORT (ssize_t)
+mongoc_gridfs_file_read_range (mongoc_gridfs_file_t *file,
+                               uint64_t start,
+                               uint64_t end,
+                               mongoc_iovec_t *iov,
+                               size_t iovcnt);
 MONGOC_EXPORT (int)
 mongoc_gridfs_file_seek (mongoc_gridfs_file_t *file, int64_t delta, int whence);
 
@@ -99,6 +105,14 @@ mongoc_gridfs_file_set_id (mongoc_gridfs_file_t *file,
                            const bson_value_t *id,
                            bson_error_t *error);
 
+MONGOC_EXPORT (void)
+mongoc_gridfs_file_set_read_ahead (mongoc_gridfs_file_t *file,
+                                   void *pool,
+                                   uint32_t n_chunks);
+
+MONGOC_EXPORT (void)
+mongoc_gridfs_file_set_compute_md5 (mongoc_gridfs_file_t *file, bool compute);
+
 MONGOC_EXPORT (bool)
 mongoc_gridfs_file_save (mongoc_gridfs_file_t *file);
 
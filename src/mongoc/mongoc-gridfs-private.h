@@ -26,6 +26,7 @@
 #include "mongoc-read-prefs.h"
 #include "mongoc-write-concern.h"
 #include "mongoc-client.h"
+#include "mongoc-gridfs-chunk-cache-private.h"
 
 
 BSON_BEGIN_DECLS
@@ -35,6 +36,7 @@ struct _mongoc_gridfs_t {
    mongoc_client_t *client;
    mongoc_collection_t *files;
    mongoc_collection_t *chunks;
+   mongoc_gridfs_chunk_cache_t *chunk_cache;
 };
 
 
@@ -18,6 +18,12 @@
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "gridfs"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "mongoc-bulk-operation.h"
 #include "mongoc-client-private.h"
 #include "mongoc-collection.h"
@@ -31,6 +37,8 @@
 #include "mongoc-gridfs-file-list.h"
 #include "mongoc-gridfs-file-list-private.h"
 #include "mongoc-client.h"
+#include "mongoc-stream-file.h"
+#include "mongoc-stream-private.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-cursor-private.h"
 #include "mongoc-util-private.h"
@@ -170,12 +178,47 @@ mongoc_gridfs_destroy (mongoc_gridfs_t *gridfs)
    mongoc_collection_destroy (gridfs->files);
    mongoc_collection_destroy (gridfs->chunks);
 
+   if (gridfs->chunk_cache) {
+      _mongoc_gridfs_chunk_cache_destroy (gridfs->chunk_cache);
+   }
+
    bson_free (gridfs);
 
    EXIT;
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_set_chunk_cache_size --
+ *
+ *       Cache up to @max_bytes of the chunks read through @gridfs's
+ *       files, so reads of popular files are served from memory. 0
+ *       disables the cache and frees it.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_gridfs_set_chunk_cache_size (mongoc_gridfs_t *gridfs, size_t max_bytes)
+{
+   BSON_ASSERT (gridfs);
+
+   if (!max_bytes) {
+      if (gridfs->chunk_cache) {
+         _mongoc_gridfs_chunk_cache_destroy (gridfs->chunk_cache);
+         gridfs->chunk_cache = NULL;
+      }
+   } else if (gridfs->chunk_cache) {
+      _mongoc_gridfs_chunk_cache_set_max_bytes (gridfs->chunk_cache,
+                                                max_bytes);
+   } else {
+      gridfs->chunk_cache = _mongoc_gridfs_chunk_cache_new (max_bytes);
+   }
+}
+
+
 /** find all matching gridfs files */
 mongoc_gridfs_file_list_t *
 mongoc_gridfs_find (mongoc_gridfs_t *gridfs, const bson_t *query)
@@ -277,6 +320,205 @@ mongoc_gridfs_find_one_by_filename (mongoc_gridfs_t *gridfs,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_find_one_with_chunks --
+ *
+ *       Like mongoc_gridfs_find_one_with_opts, but fetch the file's first
+ *       @n_chunks chunks along with it, in one aggregate on the files
+ *       collection whose $lookup reads the chunks collection. Reading a
+ *       file no bigger than that then takes no other round trip.
+ *
+ *       $lookup with a pipeline needs MongoDB 3.6, and can't read from
+ *       a sharded chunks collection, so older servers and mongos get
+ *       mongoc_gridfs_find_one_with_opts instead.
+ *
+ *--------------------------------------------------------------------------
+ */
+mongoc_gridfs_file_t *
+mongoc_gridfs_find_one_with_chunks (mongoc_gridfs_t *gridfs,
+                                    const bson_t *filter,
+                                    uint32_t n_chunks,
+                                    bson_error_t *error)
+{
+   mongoc_server_stream_t *server_stream;
+   mongoc_gridfs_file_t *file = NULL;
+   bson_t *pipeline;
+   bson_t doc;
+   bson_t file_doc = BSON_INITIALIZER;
+   bson_t chunks;
+   bson_iter_t iter;
+   const uint8_t *data;
+   uint32_t len;
+   bool lookup;
+
+   ENTRY;
+
+   BSON_ASSERT (gridfs);
+   BSON_ASSERT (filter);
+
+   server_stream = mongoc_cluster_stream_for_reads (
+      &gridfs->client->cluster,
+      mongoc_collection_get_read_prefs (gridfs->files),
+      error);
+
+   if (!server_stream) {
+      RETURN (NULL);
+   }
+
+   lookup = n_chunks > 0 && server_stream->sd->type != MONGOC_SERVER_MONGOS &&
+            server_stream->sd->max_wire_version >=
+               WIRE_VERSION_LOOKUP_PIPELINE;
+
+   mongoc_server_stream_cleanup (server_stream);
+
+   if (!lookup) {
+      RETURN (mongoc_gridfs_find_one_with_opts (gridfs, filter, NULL, error));
+   }
+
+   /* the chunks' "n" and "data", like _mongoc_gridfs_file_chunks_query */
+   pipeline = BCON_NEW ("pipeline",
+                        "[",
+                        "{",
+                        "$match",
+                        BCON_DOCUMENT (filter),
+                        "}",
+                        "{",
+                        "$limit",
+                        BCON_INT32 (1),
+                        "}",
+                        "{",
+                        "$lookup",
+                        "{",
+                        "from",
+                        BCON_UTF8 (mongoc_collection_get_name (gridfs->chunks)),
+                        "let",
+                        "{",
+                        "files_id",
+                        BCON_UTF8 ("$_id"),
+                        "}",
+                        "pipeline",
+                        "[",
+                        "{",
+                        "$match",
+                        "{",
+                        "$expr",
+                        "{",
+                        "$eq",
+                        "[",
+                        BCON_UTF8 ("$files_id"),
+                        BCON_UTF8 ("$$files_id"),
+                        "]",
+                        "}",
+                        "}",
+                        "}",
+                        "{",
+                        "$sort",
+                        "{",
+                        "n",
+                        BCON_INT32 (1),
+                        "}",
+                        "}",
+                        "{",
+                        "$limit",
+                        BCON_INT64 ((int64_t) n_chunks),
+                        "}",
+                        "{",
+                        "$project",
+                        "{",
+                        "_id",
+                        BCON_INT32 (0),
+                        "n",
+                        BCON_INT32 (1),
+                        "data",
+                        BCON_INT32 (1),
+                        "}",
+                        "}",
+                        "]",
+                        "as",
+                        BCON_UTF8 ("firstChunks"),
+                        "}",
+                        "}",
+                        "]");
+
+   if (!mongoc_collection_aggregate_one (
+          gridfs->files, pipeline, NULL, NULL, &doc, error)) {
+      GOTO (done);
+   }
+
+   if (bson_empty (&doc)) {
+      /* no such file, and no error */
+      bson_destroy (&doc);
+      GOTO (done);
+   }
+
+   bson_copy_to_excluding_noinit (
+      &doc, &file_doc, "firstChunks", (char *) NULL);
+   file = _mongoc_gridfs_file_new_from_bson (gridfs, &file_doc);
+
+   if (file && bson_iter_init_find (&iter, &doc, "firstChunks") &&
+       BSON_ITER_HOLDS_ARRAY (&iter)) {
+      bson_iter_array (&iter, &len, &data);
+      BSON_ASSERT (bson_init_static (&chunks, data, len));
+      _mongoc_gridfs_file_set_first_chunks (file, &chunks);
+   }
+
+   bson_destroy (&doc);
+
+done:
+   bson_destroy (&file_doc);
+   bson_destroy (pipeline);
+
+   RETURN (file);
+}
+
+
+#ifndef _WIN32
+/* upload the rest of a file stream from a read-only mapping, so chunks are
+ * built straight from the page cache instead of copied through a read
+ * buffer and a page. false if the file can't be mapped */
+static bool
+_mongoc_gridfs_upload_mapped (mongoc_gridfs_file_t *file,
+                              mongoc_stream_t *stream)
+{
+   struct stat st;
+   off_t offset;
+   size_t size;
+   void *map;
+   int fd;
+
+   ENTRY;
+
+   fd = mongoc_stream_file_get_fd ((mongoc_stream_file_t *) stream);
+   offset = lseek (fd, 0, SEEK_CUR);
+
+   if (offset < 0 || fstat (fd, &st) != 0 || !S_ISREG (st.st_mode) ||
+       st.st_size <= offset) {
+      RETURN (false);
+   }
+
+   size = (size_t) st.st_size;
+   map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED) {
+      RETURN (false);
+   }
+
+   (void) posix_madvise (map, size, POSIX_MADV_SEQUENTIAL);
+
+   (void) _mongoc_gridfs_file_append_chunks (
+      file, (const uint8_t *) map + offset, size - (size_t) offset);
+
+   munmap (map, size);
+
+   /* consumed, as if read to the end */
+   (void) lseek (fd, 0, SEEK_END);
+
+   RETURN (true);
+}
+#endif
+
+
 /** create a gridfs file from a stream
  *
  * The stream is fully consumed in creating the file
@@ -291,6 +533,7 @@ mongoc_gridfs_create_file_from_stream (mongoc_gridfs_t *gridfs,
    uint8_t buf[MONGOC_GRIDFS_STREAM_CHUNK];
    mongoc_iovec_t iov;
    int timeout;
+   bool mapped = false;
 
    ENTRY;
 
@@ -303,7 +546,12 @@ mongoc_gridfs_create_file_from_stream (mongoc_gridfs_t *gridfs,
    file = _mongoc_gridfs_file_new (gridfs, opt);
    timeout = gridfs->client->cluster.sockettimeoutms;
 
-   for (;;) {
+#ifndef _WIN32
+   mapped = stream->type == MONGOC_STREAM_FILE &&
+            _mongoc_gridfs_upload_mapped (file, stream);
+#endif
+
+   while (!mapped) {
       r = mongoc_stream_read (
          stream, iov.iov_base, MONGOC_GRIDFS_STREAM_CHUNK, 0, timeout);
 
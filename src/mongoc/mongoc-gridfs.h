@@ -65,6 +65,12 @@ MONGOC_EXPORT (mongoc_gridfs_file_t *)
 mongoc_gridfs_find_one_by_filename (mongoc_gridfs_t *gridfs,
                                     const char *filename,
                                     bson_error_t *error);
+MONGOC_EXPORT (mongoc_gridfs_file_t *)
+mongoc_gridfs_find_one_with_chunks (mongoc_gridfs_t *gridfs,
+                                    const bson_t *filter,
+                                    uint32_t n_chunks,
+                                    bson_error_t *error)
+   BSON_GNUC_WARN_UNUSED_RESULT;
 MONGOC_EXPORT (bool)
 mongoc_gridfs_drop (mongoc_gridfs_t *gridfs, bson_error_t *error);
 MONGOC_EXPORT (void)
@@ -77,6 +83,9 @@ MONGOC_EXPORT (bool)
 mongoc_gridfs_remove_by_filename (mongoc_gridfs_t *gridfs,
                                   const char *filename,
                                   bson_error_t *error);
+MONGOC_EXPORT (void)
+mongoc_gridfs_set_chunk_cache_size (mongoc_gridfs_t *gridfs,
+                                    size_t max_bytes);
 
 
 BSON_END_DECLS
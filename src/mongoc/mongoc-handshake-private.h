@@ -68,6 +68,8 @@ typedef enum {
    MONGOC_MD_FLAG_ENABLE_RES_NCLOSE = 1 << 24,
    MONGOC_MD_FLAG_ENABLE_RES_QUERY = 1 << 25,
    MONGOC_MD_FLAG_ENABLE_DNSAPI = 1 << 26,
+   MONGOC_MD_FLAG_ENABLE_COMPRESSION_ZSTD = 1 << 27,
+   MONGOC_MD_FLAG_ENABLE_COMPRESSION_LIBDEFLATE = 1 << 28,
 } mongoc_handshake_config_flags_t;
 
 
@@ -81,6 +83,7 @@ typedef struct _mongoc_handshake_t {
    char *driver_version;
    char *platform;
 
+   bool os_info_set; /* os name, version, and architecture computed */
    bool frozen;
 } mongoc_handshake_t;
 
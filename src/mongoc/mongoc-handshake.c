@@ -33,15 +33,21 @@
 #include "mongoc-client-private.h"
 #include "mongoc-error.h"
 #include "mongoc-log.h"
+#include "mongoc-thread-private.h"
 #include "mongoc-version.h"
 #include "mongoc-util-private.h"
 
 /*
  * Global handshake data instance. Initialized at startup from mongoc_init ()
+ * with the fields known at compile time. The OS name, version, and
+ * architecture are filled in by the first call to _mongoc_handshake_get (),
+ * so mongoc_init doesn't read /etc or call uname.
  *
- * Can be modified by calls to mongoc_handshake_data_append ()
+ * Can be modified by calls to mongoc_handshake_data_append () and
+ * mongoc_handshake_os_info_set ()
  */
 static mongoc_handshake_t gMongocHandshake;
+static mongoc_mutex_t gMongocHandshakeMutex;
 
 
 static uint32_t
@@ -157,6 +163,14 @@ _get_config_bitfield (void)
    bf |= MONGOC_MD_FLAG_ENABLE_DNSAPI;
 #endif
 
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+   bf |= MONGOC_MD_FLAG_ENABLE_COMPRESSION_ZSTD;
+#endif
+
+#ifdef MONGOC_ENABLE_COMPRESSION_LIBDEFLATE
+   bf |= MONGOC_MD_FLAG_ENABLE_COMPRESSION_LIBDEFLATE;
+#endif
+
    return bf;
 }
 
@@ -284,8 +298,6 @@ _get_os_version (void)
 static void
 _get_system_info (mongoc_handshake_t *handshake)
 {
-   handshake->os_type = _get_os_type ();
-
 #ifdef MONGOC_OS_IS_LINUX
    _mongoc_linux_distro_scanner_get_distro (&handshake->os_name,
                                             &handshake->os_version);
@@ -297,13 +309,43 @@ _get_system_info (mongoc_handshake_t *handshake)
    handshake->os_architecture = _get_os_architecture ();
 }
 
+static char *
+_strndup_or_null (const char *s, size_t max_len)
+{
+   return s ? bson_strndup (s, max_len) : NULL;
+}
+
+/* use MONGOC_HANDSHAKE_OS_NAME etc. if any is set, instead of detecting */
+static bool
+_get_system_info_from_env (mongoc_handshake_t *handshake)
+{
+   const char *name = getenv ("MONGOC_HANDSHAKE_OS_NAME");
+   const char *version = getenv ("MONGOC_HANDSHAKE_OS_VERSION");
+   const char *architecture = getenv ("MONGOC_HANDSHAKE_OS_ARCHITECTURE");
+
+   if (!name && !version && !architecture) {
+      return false;
+   }
+
+   handshake->os_name = _strndup_or_null (name, HANDSHAKE_OS_NAME_MAX);
+   handshake->os_version =
+      _strndup_or_null (version, HANDSHAKE_OS_VERSION_MAX);
+   handshake->os_architecture =
+      _strndup_or_null (architecture, HANDSHAKE_OS_ARCHITECTURE_MAX);
+
+   return true;
+}
+
 static void
 _free_system_info (mongoc_handshake_t *handshake)
 {
-   bson_free (handshake->os_type);
    bson_free (handshake->os_name);
    bson_free (handshake->os_version);
    bson_free (handshake->os_architecture);
+   handshake->os_name = NULL;
+   handshake->os_version = NULL;
+   handshake->os_architecture = NULL;
+   handshake->os_info_set = false;
 }
 
 static void
@@ -366,19 +408,25 @@ _free_platform_string (mongoc_handshake_t *handshake)
 void
 _mongoc_handshake_init (void)
 {
-   _get_system_info (_mongoc_handshake_get ());
-   _get_driver_info (_mongoc_handshake_get ());
-   _set_platform_string (_mongoc_handshake_get ());
+   mongoc_mutex_init (&gMongocHandshakeMutex);
+
+   gMongocHandshake.os_type = _get_os_type ();
+   gMongocHandshake.os_info_set = false;
+   _get_driver_info (&gMongocHandshake);
+   _set_platform_string (&gMongocHandshake);
 
-   _mongoc_handshake_get ()->frozen = false;
+   gMongocHandshake.frozen = false;
 }
 
 void
 _mongoc_handshake_cleanup (void)
 {
-   _free_system_info (_mongoc_handshake_get ());
-   _free_driver_info (_mongoc_handshake_get ());
-   _free_platform_string (_mongoc_handshake_get ());
+   bson_free (gMongocHandshake.os_type);
+   _free_system_info (&gMongocHandshake);
+   _free_driver_info (&gMongocHandshake);
+   _free_platform_string (&gMongocHandshake);
+
+   mongoc_mutex_destroy (&gMongocHandshakeMutex);
 }
 
 static bool
@@ -470,7 +518,7 @@ _mongoc_handshake_build_doc_with_application (bson_t *doc, const char *appname)
 void
 _mongoc_handshake_freeze (void)
 {
-   _mongoc_handshake_get ()->frozen = true;
+   gMongocHandshake.frozen = true;
 }
 
 /*
@@ -518,39 +566,84 @@ mongoc_handshake_data_append (const char *driver_name,
                               const char *driver_version,
                               const char *platform)
 {
+   /* don't detect the OS fields yet, the platform string is truncated again
+    * when the handshake is built */
+   mongoc_handshake_t *md = &gMongocHandshake;
    int max_size = 0;
 
-   if (_mongoc_handshake_get ()->frozen) {
+   if (md->frozen) {
       MONGOC_ERROR ("Cannot set handshake more than once");
       return false;
    }
 
-   _append_and_truncate (&_mongoc_handshake_get ()->driver_name,
-                         driver_name,
-                         HANDSHAKE_DRIVER_NAME_MAX);
-
-   _append_and_truncate (&_mongoc_handshake_get ()->driver_version,
-                         driver_version,
-                         HANDSHAKE_DRIVER_VERSION_MAX);
-
-   max_size =
-      HANDSHAKE_MAX_SIZE -
-      -_mongoc_strlen_or_zero (_mongoc_handshake_get ()->os_type) -
-      _mongoc_strlen_or_zero (_mongoc_handshake_get ()->os_name) -
-      _mongoc_strlen_or_zero (_mongoc_handshake_get ()->os_version) -
-      _mongoc_strlen_or_zero (_mongoc_handshake_get ()->os_architecture) -
-      _mongoc_strlen_or_zero (_mongoc_handshake_get ()->driver_name) -
-      _mongoc_strlen_or_zero (_mongoc_handshake_get ()->driver_version);
    _append_and_truncate (
-      &_mongoc_handshake_get ()->platform, platform, max_size);
+      &md->driver_name, driver_name, HANDSHAKE_DRIVER_NAME_MAX);
+
+   _append_and_truncate (
+      &md->driver_version, driver_version, HANDSHAKE_DRIVER_VERSION_MAX);
+
+   max_size = HANDSHAKE_MAX_SIZE - -_mongoc_strlen_or_zero (md->os_type) -
+              _mongoc_strlen_or_zero (md->os_name) -
+              _mongoc_strlen_or_zero (md->os_version) -
+              _mongoc_strlen_or_zero (md->os_architecture) -
+              _mongoc_strlen_or_zero (md->driver_name) -
+              _mongoc_strlen_or_zero (md->driver_version);
+   _append_and_truncate (&md->platform, platform, max_size);
 
    _mongoc_handshake_freeze ();
    return true;
 }
 
+
+/*
+ * Set the OS fields of our global handshake struct instead of detecting
+ * them, for example from values an application computed once and stored.
+ * Returns false and logs an error after we've connected to a mongod.
+ *
+ * All arguments are optional, NULL fields are omitted from the handshake.
+ */
+bool
+mongoc_handshake_os_info_set (const char *os_name,
+                              const char *os_version,
+                              const char *os_architecture)
+{
+   mongoc_handshake_t *md = &gMongocHandshake;
+
+   mongoc_mutex_lock (&gMongocHandshakeMutex);
+
+   if (md->frozen) {
+      mongoc_mutex_unlock (&gMongocHandshakeMutex);
+      MONGOC_ERROR ("Cannot set handshake OS info after connecting");
+      return false;
+   }
+
+   _free_system_info (md);
+   md->os_name = _strndup_or_null (os_name, HANDSHAKE_OS_NAME_MAX);
+   md->os_version = _strndup_or_null (os_version, HANDSHAKE_OS_VERSION_MAX);
+   md->os_architecture =
+      _strndup_or_null (os_architecture, HANDSHAKE_OS_ARCHITECTURE_MAX);
+   md->os_info_set = true;
+
+   mongoc_mutex_unlock (&gMongocHandshakeMutex);
+
+   return true;
+}
+
 mongoc_handshake_t *
 _mongoc_handshake_get (void)
 {
+   mongoc_mutex_lock (&gMongocHandshakeMutex);
+
+   if (!gMongocHandshake.os_info_set) {
+      if (!_get_system_info_from_env (&gMongocHandshake)) {
+         _get_system_info (&gMongocHandshake);
+      }
+
+      gMongocHandshake.os_info_set = true;
+   }
+
+   mongoc_mutex_unlock (&gMongocHandshakeMutex);
+
    return &gMongocHandshake;
 }
 
@@ -92,6 +92,28 @@ mongoc_handshake_data_append (const char *driver_name,
                               const char *driver_version,
                               const char *platform);
 
+/**
+ * mongoc_handshake_os_info_set:
+ *
+ * By default the OS name, version, and architecture sent in the handshake
+ * are detected when the first client connects. On Linux this reads several
+ * files in /etc. An application that starts often, such as a command-line
+ * tool, can call this function before connecting to send values it computed
+ * once instead. Setting any of the MONGOC_HANDSHAKE_OS_NAME,
+ * MONGOC_HANDSHAKE_OS_VERSION, or MONGOC_HANDSHAKE_OS_ARCHITECTURE
+ * environment variables has the same effect.
+ *
+ * The passed in strings are copied and may be truncated. NULL fields are
+ * omitted from the handshake.
+ *
+ * Returns true if the fields are set, or false and logs an error if a
+ * handshake has been initiated.
+ */
+MONGOC_EXPORT (bool)
+mongoc_handshake_os_info_set (const char *os_name,
+                              const char *os_version,
+                              const char *os_architecture);
+
 BSON_END_DECLS
 
 #endif
@@ -40,6 +40,16 @@ bool
 _mongoc_host_list_equal (const mongoc_host_list_t *host_a,
                          const mongoc_host_list_t *host_b);
 
+uint32_t
+_mongoc_host_list_hash_address (const char *host_and_port);
+
+bool
+_mongoc_host_list_local_unix (const mongoc_host_list_t *host,
+                              mongoc_host_list_t *unix_host);
+
+mongoc_host_list_t *
+_mongoc_host_list_copy_all (const mongoc_host_list_t *host);
+
 void
 _mongoc_host_list_destroy_all (mongoc_host_list_t *host);
 
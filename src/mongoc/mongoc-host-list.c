@@ -14,6 +14,12 @@
  * limitations under the License.
  */
 
+#include <ctype.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/socket.h>
+#endif
+
 #include "mongoc-host-list-private.h"
 /* strcasecmp on windows */
 #include "mongoc-util-private.h"
@@ -75,6 +81,106 @@ _mongoc_host_list_equal (const mongoc_host_list_t *host_a,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_host_list_hash_address --
+ *
+ *       FNV-1a hash of a "host:port" string, ignoring case, so addresses
+ *       that strcasecmp considers equal hash the same.
+ *
+ *--------------------------------------------------------------------------
+ */
+uint32_t
+_mongoc_host_list_hash_address (const char *host_and_port)
+{
+   const unsigned char *p;
+   uint32_t hash = 2166136261u;
+
+   for (p = (const unsigned char *) host_and_port; *p; p++) {
+      hash ^= (uint32_t) tolower (*p);
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_host_list_local_unix --
+ *
+ *       If @host is a TCP address on this machine and a mongod or mongos
+ *       is listening on the UNIX domain socket it creates by default for
+ *       that port, "/tmp/mongodb-<port>.sock", fill @unix_host with the
+ *       socket's address.
+ *
+ * Returns:
+ *       true if @unix_host was filled, false if @host isn't local or the
+ *       socket doesn't exist. Always false on Windows.
+ *
+ *--------------------------------------------------------------------------
+ */
+bool
+_mongoc_host_list_local_unix (const mongoc_host_list_t *host,
+                              mongoc_host_list_t *unix_host)
+{
+#ifdef _WIN32
+   return false;
+#else
+   char path[sizeof unix_host->host];
+   struct stat st;
+
+   if (host->family == AF_UNIX ||
+       (strcasecmp (host->host, "localhost") &&
+        strcmp (host->host, "127.0.0.1") && strcmp (host->host, "::1"))) {
+      return false;
+   }
+
+   bson_snprintf (path, sizeof path, "/tmp/mongodb-%hu.sock", host->port);
+
+   if (stat (path, &st) != 0 || !S_ISSOCK (st.st_mode)) {
+      return false;
+   }
+
+   memset (unix_host, 0, sizeof *unix_host);
+   bson_strncpy (unix_host->host, path, sizeof unix_host->host);
+   bson_strncpy (
+      unix_host->host_and_port, path, sizeof unix_host->host_and_port);
+   unix_host->family = AF_UNIX;
+
+   return true;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_host_list_copy_all --
+ *
+ *       Copy a whole linked list of hosts, preserving its order.
+ *
+ *--------------------------------------------------------------------------
+ */
+mongoc_host_list_t *
+_mongoc_host_list_copy_all (const mongoc_host_list_t *host)
+{
+   mongoc_host_list_t *head = NULL;
+   mongoc_host_list_t **tail = &head;
+
+   for (; host; host = host->next) {
+      *tail = bson_malloc (sizeof (mongoc_host_list_t));
+      memcpy (*tail, host, sizeof (mongoc_host_list_t));
+      (*tail)->next = NULL;
+      tail = &(*tail)->next;
+   }
+
+   return head;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
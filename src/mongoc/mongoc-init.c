@@ -19,6 +19,8 @@
 
 #include "mongoc-config.h"
 #include "mongoc-counters-private.h"
+#include "mongoc-crc32c-private.h"
+#include "mongoc-dns-private.h"
 #include "mongoc-init.h"
 
 #include "mongoc-handshake-private.h"
@@ -33,6 +35,7 @@
 #endif
 #endif
 #include "mongoc-thread-private.h"
+#include "mongoc-topology-private.h"
 #include "mongoc-trace-private.h"
 
 
@@ -119,6 +122,8 @@ static MONGOC_ONCE_FUN (_mongoc_do_init)
 
    _mongoc_counters_init ();
 
+   _mongoc_crc32c_init ();
+
 #ifdef _WIN32
    {
       WORD wVersionRequested;
@@ -137,6 +142,10 @@ static MONGOC_ONCE_FUN (_mongoc_do_init)
 
    _mongoc_handshake_init ();
 
+   _mongoc_dns_init ();
+
+   _mongoc_topology_registry_init ();
+
    MONGOC_ONCE_RETURN;
 }
 
@@ -166,10 +175,20 @@ static MONGOC_ONCE_FUN (_mongoc_do_cleanup)
    WSACleanup ();
 #endif
 
+#ifdef MONGOC_ENABLE_SSL
+   _mongoc_scram_cleanup ();
+#endif
+
    _mongoc_counters_cleanup ();
 
    _mongoc_handshake_cleanup ();
 
+   _mongoc_dns_cleanup ();
+
+   _mongoc_topology_registry_cleanup ();
+
+   _mongoc_log_cleanup ();
+
    MONGOC_ONCE_RETURN;
 }
 
@@ -38,4 +38,16 @@ mongoc_log_trace_iovec (const char *domain,
                         const mongoc_iovec_t *_iov,
                         size_t _iovcnt);
 
+/* nonzero while mongoc_log_trace_ring_enable () is in effect */
+extern int _mongoc_trace_ring_enabled;
+
+void
+_mongoc_trace_ring_record (const char *func,
+                           int line,
+                           const char *text,
+                           int64_t value);
+
+void
+_mongoc_log_cleanup (void);
+
 #endif /* MONGOC_LOG_PRIVATE_H */
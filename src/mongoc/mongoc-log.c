@@ -25,6 +25,7 @@
 #include <stdarg.h>
 #include <time.h>
 
+#include "mongoc-counters-private.h"
 #include "mongoc-log.h"
 #include "mongoc-log-private.h"
 #include "mongoc-thread-private.h"
@@ -38,9 +39,85 @@ static bool gLogTrace = true;
 #endif
 static void *gLogData;
 
+/* per-thread trace ring buffers: each thread writes only its own ring, so
+ * recording takes no lock. gTraceRingMutex guards the list of rings and is
+ * taken only when a thread creates its ring and when rings are dumped. */
+#define MONGOC_TRACE_RING_MAX_THREADS 256
+
+typedef struct {
+   int64_t time;
+   const char *func;
+   const char *text;
+   int64_t value;
+   int32_t line;
+} mongoc_trace_record_t;
+
+typedef struct {
+   uint64_t next;
+   uint32_t mask;
+   uint32_t thread_num;
+   int generation;
+   mongoc_trace_record_t *records;
+} mongoc_trace_ring_t;
+
+int _mongoc_trace_ring_enabled;
+static bool gTraceRingDumpOnError;
+static uint32_t gTraceRingSize;
+static int gTraceRingGeneration;
+static uint32_t gTraceRingCount;
+static mongoc_trace_ring_t *gTraceRings[MONGOC_TRACE_RING_MAX_THREADS];
+static mongoc_mutex_t gTraceRingMutex;
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+static MONGOC_THREAD_LOCAL mongoc_trace_ring_t *gThreadTraceRing;
+#endif
+
+/* asynchronous logging: formatted messages go into a bounded queue that a
+ * background thread drains by calling the handler. this is Vyukov's bounded
+ * MPMC queue with a single consumer: a slot's sequence number equals the
+ * ticket of the producer that may fill it, and that ticket plus one once it
+ * is filled. producers never wait; if the queue is full they drop. */
+#ifdef _MSC_VER
+#define _mongoc_log_cas64(_p, _old, _new)                           \
+   (InterlockedCompareExchange64 ((volatile LONGLONG *) (_p),       \
+                                  (LONGLONG) (_new),                \
+                                  (LONGLONG) (_old)) == (LONGLONG) (_old))
+#else
+#define _mongoc_log_cas64(_p, _old, _new) \
+   __sync_bool_compare_and_swap ((_p), (_old), (_new))
+#endif
+
+typedef struct {
+   volatile int64_t seq;
+   mongoc_log_level_t log_level;
+   char *log_domain;
+   char *message;
+} mongoc_log_slot_t;
+
+static struct {
+   volatile int enabled;
+   uint32_t mask;
+   mongoc_log_slot_t *slots;
+   volatile int64_t tail;
+   int64_t head;
+   volatile int64_t dropped;
+   int64_t dropped_reported;
+   int64_t dropped_report_time;
+   volatile int sleeping;
+   bool shutdown;
+   bool running;
+   mongoc_mutex_t mutex;
+   mongoc_cond_t cond;
+   mongoc_mutex_t config_mutex;
+   mongoc_thread_t thread;
+} gLogAsync;
+
 static MONGOC_ONCE_FUN (_mongoc_ensure_mutex_once)
 {
    mongoc_mutex_init (&gLogMutex);
+   mongoc_mutex_init (&gTraceRingMutex);
+   mongoc_mutex_init (&gLogAsync.mutex);
+   mongoc_cond_init (&gLogAsync.cond);
+   mongoc_mutex_init (&gLogAsync.config_mutex);
 
    MONGOC_ONCE_RETURN;
 }
@@ -57,6 +134,185 @@ mongoc_log_set_handler (mongoc_log_func_t log_func, void *user_data)
 }
 
 
+static void
+_mongoc_trace_ring_dump_one (const mongoc_trace_ring_t *ring, FILE *stream)
+{
+   const mongoc_trace_record_t *rec;
+   uint64_t first;
+   uint64_t i;
+
+   first = ring->next > ring->mask ? ring->next - ring->mask - 1 : 0;
+
+   fprintf (stream,
+            "trace ring for thread %u, %" PRIu64 " of %" PRIu64
+            " records:\n",
+            ring->thread_num,
+            ring->next - first,
+            ring->next);
+
+   for (i = first; i < ring->next; i++) {
+      rec = &ring->records[i & ring->mask];
+      if (!rec->func) {
+         continue;
+      }
+
+      fprintf (stream,
+               "  %" PRId64 ".%06" PRId64 " %s():%d %s",
+               rec->time / 1000000,
+               rec->time % 1000000,
+               rec->func,
+               (int) rec->line,
+               rec->text);
+      if (rec->value) {
+         fprintf (stream, " [%" PRId64 "]", rec->value);
+      }
+
+      fputc ('\n', stream);
+   }
+}
+
+
+static bool
+_mongoc_log_async_push (mongoc_log_level_t log_level,
+                        const char *log_domain,
+                        char *message)
+{
+   mongoc_log_slot_t *slot;
+   int64_t pos;
+   int64_t seq;
+
+   pos = gLogAsync.tail;
+   for (;;) {
+      slot = &gLogAsync.slots[pos & gLogAsync.mask];
+      seq = slot->seq;
+      bson_memory_barrier ();
+
+      if (seq == pos) {
+         if (_mongoc_log_cas64 (&gLogAsync.tail, pos, pos + 1)) {
+            break;
+         }
+      } else if (seq < pos) {
+         /* not yet consumed from the previous lap: the queue is full */
+         return false;
+      }
+
+      pos = gLogAsync.tail;
+   }
+
+   slot->log_level = log_level;
+   slot->log_domain = bson_strdup (log_domain);
+   slot->message = message;
+   bson_memory_barrier ();
+   slot->seq = pos + 1;
+
+   /* the consumer sets "sleeping" and rechecks the queue under the mutex
+    * before it waits, so taking the mutex here cannot miss the wakeup */
+   bson_memory_barrier ();
+   if (gLogAsync.sleeping) {
+      mongoc_mutex_lock (&gLogAsync.mutex);
+      gLogAsync.sleeping = 0;
+      mongoc_cond_signal (&gLogAsync.cond);
+      mongoc_mutex_unlock (&gLogAsync.mutex);
+   }
+
+   return true;
+}
+
+
+static bool
+_mongoc_log_async_ready (void)
+{
+   int64_t seq;
+
+   seq = gLogAsync.slots[gLogAsync.head & gLogAsync.mask].seq;
+   bson_memory_barrier ();
+
+   return seq == gLogAsync.head + 1;
+}
+
+
+static void
+_mongoc_log_async_deliver (mongoc_log_level_t log_level,
+                           const char *log_domain,
+                           const char *message)
+{
+   mongoc_mutex_lock (&gLogMutex);
+   if (gLogFunc) {
+      gLogFunc (log_level, log_domain, message, gLogData);
+   }
+   mongoc_mutex_unlock (&gLogMutex);
+}
+
+
+/* the only consumer: takes messages from the queue and calls the handler.
+ * drops are reported at most once a second, and when @final is true */
+static void
+_mongoc_log_async_drain (bool final)
+{
+   mongoc_log_slot_t *slot;
+   int64_t dropped;
+   int64_t now;
+   char *message;
+
+   while (_mongoc_log_async_ready ()) {
+      slot = &gLogAsync.slots[gLogAsync.head & gLogAsync.mask];
+      _mongoc_log_async_deliver (
+         slot->log_level, slot->log_domain, slot->message);
+      bson_free (slot->log_domain);
+      bson_free (slot->message);
+      slot->log_domain = NULL;
+      slot->message = NULL;
+      bson_memory_barrier ();
+      /* free for the producer one lap ahead */
+      slot->seq = gLogAsync.head + gLogAsync.mask + 1;
+      gLogAsync.head++;
+   }
+
+   dropped = gLogAsync.dropped;
+   now = bson_get_monotonic_time ();
+   if (dropped > gLogAsync.dropped_reported &&
+       (final || now - gLogAsync.dropped_report_time >= 1000 * 1000)) {
+      message = bson_strdup_printf (
+         "Dropped %" PRId64 " log messages, the asynchronous log queue "
+         "was full",
+         dropped - gLogAsync.dropped_reported);
+      _mongoc_log_async_deliver (MONGOC_LOG_LEVEL_WARNING, "log", message);
+      bson_free (message);
+      gLogAsync.dropped_reported = dropped;
+      gLogAsync.dropped_report_time = now;
+   }
+}
+
+
+static void *
+_mongoc_log_async_run (void *data)
+{
+   for (;;) {
+      _mongoc_log_async_drain (false);
+
+      mongoc_mutex_lock (&gLogAsync.mutex);
+      if (gLogAsync.shutdown) {
+         mongoc_mutex_unlock (&gLogAsync.mutex);
+         break;
+      }
+
+      gLogAsync.sleeping = 1;
+      bson_memory_barrier ();
+      if (!_mongoc_log_async_ready ()) {
+         mongoc_cond_timedwait (&gLogAsync.cond, &gLogAsync.mutex, 1000);
+      }
+
+      gLogAsync.sleeping = 0;
+      mongoc_mutex_unlock (&gLogAsync.mutex);
+   }
+
+   /* messages queued while shutting down */
+   _mongoc_log_async_drain (true);
+
+   return NULL;
+}
+
+
 /* just for testing */
 void
 _mongoc_log_get_handler (mongoc_log_func_t *log_func, void **user_data)
@@ -78,6 +334,17 @@ mongoc_log (mongoc_log_level_t log_level,
 
    mongoc_once (&once, &_mongoc_ensure_mutex_once);
 
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+   if (gTraceRingDumpOnError && log_level <= MONGOC_LOG_LEVEL_CRITICAL) {
+      mongoc_mutex_lock (&gTraceRingMutex);
+      if (gThreadTraceRing &&
+          gThreadTraceRing->generation == gTraceRingGeneration) {
+         _mongoc_trace_ring_dump_one (gThreadTraceRing, stderr);
+      }
+      mongoc_mutex_unlock (&gTraceRingMutex);
+   }
+#endif
+
    stop_logging = !gLogFunc;
 #ifdef MONGOC_TRACE
    stop_logging =
@@ -93,6 +360,16 @@ mongoc_log (mongoc_log_level_t log_level,
    message = bson_strdupv_printf (format, args);
    va_end (args);
 
+   if (gLogAsync.enabled) {
+      if (!_mongoc_log_async_push (log_level, log_domain, message)) {
+         bson_atomic_int64_add (&gLogAsync.dropped, 1);
+         mongoc_counter_log_dropped_inc ();
+         bson_free (message);
+      }
+
+      return;
+   }
+
    mongoc_mutex_lock (&gLogMutex);
    gLogFunc (log_level, log_domain, message, gLogData);
    mongoc_mutex_unlock (&gLogMutex);
@@ -324,3 +601,211 @@ mongoc_log_trace_iovec (const char *domain,
    bson_string_free (str, true);
    bson_string_free (astr, true);
 }
+
+
+void
+mongoc_log_set_async (bool async, uint32_t queue_size)
+{
+   uint32_t size = 1;
+   uint32_t i;
+
+   mongoc_once (&once, &_mongoc_ensure_mutex_once);
+
+   mongoc_mutex_lock (&gLogAsync.config_mutex);
+   if (async && !gLogAsync.running) {
+      /* the queue outlives mongoc_log_set_async (false), since a producer
+       * may still be pushing to it; its size is kept until mongoc_cleanup */
+      if (!gLogAsync.slots) {
+         if (queue_size == 0) {
+            queue_size = 4096;
+         }
+
+         while (size < queue_size && size < (1u << 24)) {
+            size <<= 1;
+         }
+
+         gLogAsync.slots = (mongoc_log_slot_t *) bson_malloc0 (
+            size * sizeof (mongoc_log_slot_t));
+         gLogAsync.mask = size - 1;
+         for (i = 0; i < size; i++) {
+            gLogAsync.slots[i].seq = i;
+         }
+      }
+
+      gLogAsync.shutdown = false;
+      gLogAsync.running = true;
+      _mongoc_thread_create (MONGOC_THREAD_ASYNC_LOG,
+                             &gLogAsync.thread,
+                             _mongoc_log_async_run,
+                             NULL);
+      gLogAsync.enabled = 1;
+   } else if (!async && gLogAsync.running) {
+      gLogAsync.enabled = 0;
+
+      mongoc_mutex_lock (&gLogAsync.mutex);
+      gLogAsync.shutdown = true;
+      mongoc_cond_signal (&gLogAsync.cond);
+      mongoc_mutex_unlock (&gLogAsync.mutex);
+
+      mongoc_thread_join (gLogAsync.thread);
+      gLogAsync.running = false;
+
+      /* from producers that saw "enabled" just before it was cleared */
+      _mongoc_log_async_drain (true);
+   }
+   mongoc_mutex_unlock (&gLogAsync.config_mutex);
+}
+
+
+int64_t
+mongoc_log_get_dropped_count (void)
+{
+   return gLogAsync.dropped;
+}
+
+
+void
+mongoc_log_trace_ring_enable (uint32_t n_records, bool dump_on_error)
+{
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+   uint32_t size = 1;
+
+   mongoc_once (&once, &_mongoc_ensure_mutex_once);
+
+   if (n_records == 0) {
+      n_records = 1024;
+   }
+
+   while (size < n_records && size < (1u << 24)) {
+      size <<= 1;
+   }
+
+   mongoc_mutex_lock (&gTraceRingMutex);
+   /* rings already created keep their size */
+   if (!gTraceRingSize) {
+      gTraceRingSize = size;
+   }
+
+   gTraceRingDumpOnError = dump_on_error;
+   _mongoc_trace_ring_enabled = 1;
+   mongoc_mutex_unlock (&gTraceRingMutex);
+#else
+   MONGOC_WARNING ("Trace ring buffers require thread-local storage");
+#endif
+}
+
+
+void
+mongoc_log_trace_ring_disable (void)
+{
+   _mongoc_trace_ring_enabled = 0;
+   gTraceRingDumpOnError = false;
+}
+
+
+void
+mongoc_log_trace_ring_dump (FILE *stream)
+{
+   uint32_t i;
+
+   mongoc_once (&once, &_mongoc_ensure_mutex_once);
+
+   if (!stream) {
+      stream = stderr;
+   }
+
+   mongoc_mutex_lock (&gTraceRingMutex);
+   for (i = 0; i < gTraceRingCount; i++) {
+      _mongoc_trace_ring_dump_one (gTraceRings[i], stream);
+   }
+   mongoc_mutex_unlock (&gTraceRingMutex);
+
+   fflush (stream);
+}
+
+
+void
+_mongoc_trace_ring_record (const char *func,
+                           int line,
+                           const char *text,
+                           int64_t value)
+{
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+   mongoc_trace_ring_t *ring = gThreadTraceRing;
+   mongoc_trace_record_t *rec;
+
+   if (BSON_UNLIKELY (!ring || ring->generation != gTraceRingGeneration)) {
+      mongoc_mutex_lock (&gTraceRingMutex);
+      if (!gTraceRingSize ||
+          gTraceRingCount == MONGOC_TRACE_RING_MAX_THREADS) {
+         /* too many threads: this one goes unrecorded */
+         mongoc_mutex_unlock (&gTraceRingMutex);
+         return;
+      }
+
+      ring = (mongoc_trace_ring_t *) bson_malloc0 (sizeof *ring);
+      ring->records = (mongoc_trace_record_t *) bson_malloc0 (
+         gTraceRingSize * sizeof (mongoc_trace_record_t));
+      ring->mask = gTraceRingSize - 1;
+      ring->thread_num = gTraceRingCount;
+      ring->generation = gTraceRingGeneration;
+      gTraceRings[gTraceRingCount++] = ring;
+      gThreadTraceRing = ring;
+      mongoc_mutex_unlock (&gTraceRingMutex);
+   }
+
+   rec = &ring->records[ring->next & ring->mask];
+   rec->time = bson_get_monotonic_time ();
+   rec->func = func;
+   rec->text = text;
+   rec->value = value;
+   rec->line = (int32_t) line;
+   ring->next++;
+#endif
+}
+
+
+/* rings still referenced by other threads' thread-local pointers are
+ * abandoned by bumping the generation. */
+static void
+_mongoc_trace_ring_cleanup (void)
+{
+   uint32_t i;
+
+   mongoc_mutex_lock (&gTraceRingMutex);
+   _mongoc_trace_ring_enabled = 0;
+   gTraceRingDumpOnError = false;
+   for (i = 0; i < gTraceRingCount; i++) {
+      bson_free (gTraceRings[i]->records);
+      bson_free (gTraceRings[i]);
+      gTraceRings[i] = NULL;
+   }
+
+   gTraceRingCount = 0;
+   gTraceRingSize = 0;
+   gTraceRingGeneration++;
+   mongoc_mutex_unlock (&gTraceRingMutex);
+}
+
+
+/* called from mongoc_cleanup */
+void
+_mongoc_log_cleanup (void)
+{
+   mongoc_once (&once, &_mongoc_ensure_mutex_once);
+
+   mongoc_log_set_async (false, 0);
+
+   mongoc_mutex_lock (&gLogAsync.config_mutex);
+   if (gLogAsync.slots) {
+      _mongoc_log_async_drain (true);
+   }
+
+   bson_free (gLogAsync.slots);
+   gLogAsync.slots = NULL;
+   gLogAsync.tail = 0;
+   gLogAsync.head = 0;
+   mongoc_mutex_unlock (&gLogAsync.config_mutex);
+
+   _mongoc_trace_ring_cleanup ();
+}
@@ -113,6 +113,30 @@ mongoc_log_default_handler (mongoc_log_level_t log_level,
                             void *user_data);
 
 
+/**
+ * mongoc_log_set_async:
+ * @async: Whether to log asynchronously.
+ * @queue_size: The most messages waiting for the handler, or 0 for 4096.
+ *
+ * When @async is true, mongoc_log() queues each message for a background
+ * thread that calls the log handler, instead of calling it under the
+ * logging lock. If the queue is full the message is dropped. When @async
+ * is false, waits for queued messages to be handled and stops the thread.
+ */
+MONGOC_EXPORT (void)
+mongoc_log_set_async (bool async, uint32_t queue_size);
+
+
+/**
+ * mongoc_log_get_dropped_count:
+ *
+ * Returns: The number of messages dropped because the asynchronous log
+ * queue was full.
+ */
+MONGOC_EXPORT (int64_t)
+mongoc_log_get_dropped_count (void);
+
+
 /**
  * mongoc_log_level_str:
  * @log_level: The log level.
@@ -141,6 +165,37 @@ MONGOC_EXPORT (void)
 mongoc_log_trace_disable (void);
 
 
+/**
+ * mongoc_log_trace_ring_enable:
+ * @n_records: Records kept per thread, rounded up to a power of two.
+ * @dump_on_error: Whether a thread dumps its records when it logs an error.
+ *
+ * Records the driver's trace points in a ring buffer per thread, whether or
+ * not tracing was enabled at compile time.
+ */
+MONGOC_EXPORT (void)
+mongoc_log_trace_ring_enable (uint32_t n_records, bool dump_on_error);
+
+
+/**
+ * mongoc_log_trace_ring_disable:
+ *
+ * Stops recording trace points. Records already taken can still be dumped.
+ */
+MONGOC_EXPORT (void)
+mongoc_log_trace_ring_disable (void);
+
+
+/**
+ * mongoc_log_trace_ring_dump:
+ * @stream: A stream to write to, or NULL for stderr.
+ *
+ * Writes every thread's recorded trace points, oldest first.
+ */
+MONGOC_EXPORT (void)
+mongoc_log_trace_ring_dump (FILE *stream);
+
+
 BSON_END_DECLS
 
 
@@ -23,6 +23,8 @@
 
 #include <bson.h>
 
+#include "mongoc-matcher-regex-private.h"
+
 
 BSON_BEGIN_DECLS
 
@@ -34,6 +36,10 @@ typedef struct _mongoc_matcher_op_compare_t mongoc_matcher_op_compare_t;
 typedef struct _mongoc_matcher_op_exists_t mongoc_matcher_op_exists_t;
 typedef struct _mongoc_matcher_op_type_t mongoc_matcher_op_type_t;
 typedef struct _mongoc_matcher_op_not_t mongoc_matcher_op_not_t;
+typedef struct _mongoc_matcher_op_regex_t mongoc_matcher_op_regex_t;
+typedef struct _mongoc_matcher_path_t mongoc_matcher_path_t;
+typedef struct _mongoc_matcher_value_t mongoc_matcher_value_t;
+typedef struct _mongoc_matcher_in_slot_t mongoc_matcher_in_slot_t;
 
 
 typedef enum {
@@ -51,6 +57,7 @@ typedef enum {
    MONGOC_MATCHER_OPCODE_NOR,
    MONGOC_MATCHER_OPCODE_EXISTS,
    MONGOC_MATCHER_OPCODE_TYPE,
+   MONGOC_MATCHER_OPCODE_REGEX,
 } mongoc_matcher_opcode_t;
 
 
@@ -59,6 +66,36 @@ struct _mongoc_matcher_op_base_t {
 };
 
 
+/* a dotted path, split into its keys when the op is created */
+struct _mongoc_matcher_path_t {
+   char *keys;         /* the path with each '.' replaced by '\0' */
+   uint32_t *key_lens; /* the length of each key */
+   uint32_t n_keys;
+};
+
+
+/* a spec value, decoded when the op is created */
+struct _mongoc_matcher_value_t {
+   bson_type_t type;
+   union {
+      double v_double;
+      int64_t v_int64;      /* int32 and int64 */
+      struct {
+         const uint8_t *data; /* utf8 and document */
+         uint32_t len;
+      } v_bytes;
+   } value;
+   bson_iter_t iter; /* for arrays */
+};
+
+
+/* a slot in the hash set of a $in or $nin op's values */
+struct _mongoc_matcher_in_slot_t {
+   uint32_t hash;
+   uint32_t index; /* in in_values, plus one; zero if the slot is empty */
+};
+
+
 struct _mongoc_matcher_op_logical_t {
    mongoc_matcher_op_base_t base;
    mongoc_matcher_op_t *left;
@@ -69,13 +106,22 @@ struct _mongoc_matcher_op_logical_t {
 struct _mongoc_matcher_op_compare_t {
    mongoc_matcher_op_base_t base;
    char *path;
+   mongoc_matcher_path_t keys;
    bson_iter_t iter;
+   mongoc_matcher_value_t value;      /* the value at @iter */
+   mongoc_matcher_value_t *in_values; /* the array at @iter, for $in, $nin */
+   uint32_t n_in_values;
+   mongoc_matcher_in_slot_t *in_set; /* hashes of @in_values, or NULL */
+   uint32_t in_set_mask;
+   bool in_has_arrays; /* arrays are not hashed, they're checked in turn */
+   mongoc_matcher_regex_t *in_regex; /* regexes in @in_values, or NULL */
 };
 
 
 struct _mongoc_matcher_op_exists_t {
    mongoc_matcher_op_base_t base;
    char *path;
+   mongoc_matcher_path_t keys;
    bool exists;
 };
 
@@ -84,6 +130,7 @@ struct _mongoc_matcher_op_type_t {
    mongoc_matcher_op_base_t base;
    bson_type_t type;
    char *path;
+   mongoc_matcher_path_t keys;
 };
 
 
@@ -94,6 +141,16 @@ struct _mongoc_matcher_op_not_t {
 };
 
 
+struct _mongoc_matcher_op_regex_t {
+   mongoc_matcher_op_base_t base;
+   char *path;
+   mongoc_matcher_path_t keys;
+   const char *pattern; /* in the query */
+   const char *options;
+   mongoc_matcher_regex_t *regex;
+};
+
+
 union _mongoc_matcher_op_t {
    mongoc_matcher_op_base_t base;
    mongoc_matcher_op_logical_t logical;
@@ -101,6 +158,7 @@ union _mongoc_matcher_op_t {
    mongoc_matcher_op_exists_t exists;
    mongoc_matcher_op_type_t type;
    mongoc_matcher_op_not_t not_;
+   mongoc_matcher_op_regex_t regex;
 };
 
 
@@ -111,18 +169,26 @@ _mongoc_matcher_op_logical_new (mongoc_matcher_opcode_t opcode,
 mongoc_matcher_op_t *
 _mongoc_matcher_op_compare_new (mongoc_matcher_opcode_t opcode,
                                 const char *path,
-                                const bson_iter_t *iter);
+                                const bson_iter_t *iter,
+                                bson_error_t *error);
 mongoc_matcher_op_t *
 _mongoc_matcher_op_exists_new (const char *path, bool exists);
 mongoc_matcher_op_t *
 _mongoc_matcher_op_type_new (const char *path, bson_type_t type);
 mongoc_matcher_op_t *
 _mongoc_matcher_op_not_new (const char *path, mongoc_matcher_op_t *child);
+mongoc_matcher_op_t *
+_mongoc_matcher_op_regex_new (const char *path,
+                              const char *pattern,
+                              const char *options,
+                              bson_error_t *error);
 bool
 _mongoc_matcher_op_match (mongoc_matcher_op_t *op, const bson_t *bson);
 void
 _mongoc_matcher_op_destroy (mongoc_matcher_op_t *op);
 void
+_mongoc_matcher_op_reorder (mongoc_matcher_op_t *op);
+void
 _mongoc_matcher_op_to_bson (mongoc_matcher_op_t *op, bson_t *bson);
 
 
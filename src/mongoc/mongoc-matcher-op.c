@@ -19,6 +19,323 @@
 #include "mongoc-matcher-op-private.h"
 #include "mongoc-util-private.h"
 
+
+/* $in and $nin lists at least this long are hashed */
+#define MONGOC_MATCHER_IN_SET_MIN 8
+
+
+static bool
+_mongoc_matcher_value_eq (const mongoc_matcher_value_t *value,
+                          const bson_iter_t *iter);
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_path_init --
+ *
+ *       Split the dotted path @dotted into its keys, so that matching
+ *       needn't scan it for dots again.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_matcher_path_init (mongoc_matcher_path_t *path, /* OUT */
+                           const char *dotted)          /* IN */
+{
+   char *key;
+   char *dot;
+   uint32_t i;
+
+   path->keys = bson_strdup (dotted);
+   path->n_keys = 1;
+
+   for (key = path->keys; *key; key++) {
+      if (*key == '.') {
+         path->n_keys++;
+      }
+   }
+
+   path->key_lens =
+      (uint32_t *) bson_malloc (sizeof (uint32_t) * path->n_keys);
+
+   key = path->keys;
+   for (i = 0; i < path->n_keys; i++) {
+      if ((dot = strchr (key, '.'))) {
+         *dot = '\0';
+      }
+
+      path->key_lens[i] = (uint32_t) strlen (key);
+      key += path->key_lens[i] + 1;
+   }
+}
+
+
+static void
+_mongoc_matcher_path_destroy (mongoc_matcher_path_t *path) /* IN */
+{
+   bson_free (path->keys);
+   bson_free (path->key_lens);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_path_find --
+ *
+ *       Find the field at @path in @bson, descending into documents and
+ *       arrays like bson_iter_find_descendant.
+ *
+ * Returns:
+ *       true and @iter is positioned on the field, or false if there is
+ *       none.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_matcher_path_find (const mongoc_matcher_path_t *path, /* IN */
+                           const bson_t *bson,                /* IN */
+                           bson_iter_t *iter)                 /* OUT */
+{
+   bson_iter_t child;
+   const char *key;
+   const char *iter_key;
+   uint32_t len;
+   uint32_t i;
+
+   if (!bson_iter_init (iter, bson)) {
+      return false;
+   }
+
+   key = path->keys;
+
+   for (i = 0; i < path->n_keys; i++) {
+      if (i > 0) {
+         if (!(BSON_ITER_HOLDS_DOCUMENT (iter) ||
+               BSON_ITER_HOLDS_ARRAY (iter)) ||
+             !bson_iter_recurse (iter, &child)) {
+            return false;
+         }
+
+         memcpy (iter, &child, sizeof child);
+      }
+
+      len = path->key_lens[i];
+
+      do {
+         if (!bson_iter_next (iter)) {
+            return false;
+         }
+
+         iter_key = bson_iter_key (iter);
+      } while (strncmp (iter_key, key, len) || iter_key[len] != '\0');
+
+      key += len + 1;
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_value_init --
+ *
+ *       Decode the spec value at @iter once, so that matching compares
+ *       native values without converting the spec again.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_matcher_value_init (mongoc_matcher_value_t *value, /* OUT */
+                            const bson_iter_t *iter)       /* IN */
+{
+   memset (value, 0, sizeof *value);
+   value->type = bson_iter_type (iter);
+   memcpy (&value->iter, iter, sizeof *iter);
+
+   switch (value->type) {
+   case BSON_TYPE_DOUBLE:
+      value->value.v_double = bson_iter_double (iter);
+      break;
+   case BSON_TYPE_INT32:
+      value->value.v_int64 = bson_iter_int32 (iter);
+      break;
+   case BSON_TYPE_INT64:
+      value->value.v_int64 = bson_iter_int64 (iter);
+      break;
+   case BSON_TYPE_UTF8:
+      value->value.v_bytes.data =
+         (const uint8_t *) bson_iter_utf8 (iter, &value->value.v_bytes.len);
+      break;
+   case BSON_TYPE_DOCUMENT:
+      bson_iter_document (
+         iter, &value->value.v_bytes.len, &value->value.v_bytes.data);
+      break;
+   default:
+      break;
+   }
+}
+
+
+/* FNV-1a, seeded with the class of value so that, e.g., a string and a
+ * document with the same bytes hash apart */
+static uint32_t
+_mongoc_matcher_hash_bytes (uint8_t hash_class,  /* IN */
+                            const uint8_t *data, /* IN */
+                            uint32_t len)        /* IN */
+{
+   uint32_t hash = 2166136261u;
+   uint32_t i;
+
+   hash = (hash ^ hash_class) * 16777619u;
+   for (i = 0; i < len; i++) {
+      hash = (hash ^ data[i]) * 16777619u;
+   }
+
+   return hash;
+}
+
+
+/* numbers that are equal as _mongoc_matcher_value_compare_number compares
+ * them have equal doubles, so they hash the same */
+static uint32_t
+_mongoc_matcher_hash_number (double d) /* IN */
+{
+   if (d == 0.0) {
+      d = 0.0; /* -0.0 == 0.0 */
+   }
+
+   return _mongoc_matcher_hash_bytes (
+      BSON_TYPE_DOUBLE, (const uint8_t *) &d, sizeof d);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_iter_hash --
+ *
+ *       Hash the field at @iter for a lookup in a $in set. Numbers and
+ *       bools hash by their value as a double, null and undefined alike.
+ *
+ * Returns:
+ *       false if the field is an array, or of a type that equals no spec
+ *       value, otherwise true and @hash is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_matcher_iter_hash (const bson_iter_t *iter, /* IN */
+                           uint32_t *hash)          /* OUT */
+{
+   const uint8_t *data;
+   uint32_t len;
+
+   switch (bson_iter_type (iter)) {
+   case BSON_TYPE_DOUBLE:
+      *hash = _mongoc_matcher_hash_number (bson_iter_double (iter));
+      return true;
+   case BSON_TYPE_BOOL:
+      *hash = _mongoc_matcher_hash_number (bson_iter_bool (iter) ? 1.0 : 0.0);
+      return true;
+   case BSON_TYPE_INT32:
+      *hash = _mongoc_matcher_hash_number ((double) bson_iter_int32 (iter));
+      return true;
+   case BSON_TYPE_INT64:
+      *hash = _mongoc_matcher_hash_number ((double) bson_iter_int64 (iter));
+      return true;
+   case BSON_TYPE_UTF8:
+      data = (const uint8_t *) bson_iter_utf8 (iter, &len);
+      *hash = _mongoc_matcher_hash_bytes (BSON_TYPE_UTF8, data, len);
+      return true;
+   case BSON_TYPE_DOCUMENT:
+      bson_iter_document (iter, &len, &data);
+      *hash = _mongoc_matcher_hash_bytes (BSON_TYPE_DOCUMENT, data, len);
+      return true;
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_UNDEFINED:
+      *hash = _mongoc_matcher_hash_bytes (BSON_TYPE_NULL, NULL, 0);
+      return true;
+   default:
+      return false;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_in_set_init --
+ *
+ *       Build the hash set of @compare's $in values, if there are enough
+ *       of them for hashing to beat checking each in turn. Values that
+ *       _mongoc_matcher_value_eq never matches are left out.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_matcher_in_set_init (mongoc_matcher_op_compare_t *compare) /* IN */
+{
+   const mongoc_matcher_value_t *value;
+   uint32_t n_slots;
+   uint32_t hash;
+   uint32_t slot;
+   uint32_t i;
+
+   if (compare->n_in_values < MONGOC_MATCHER_IN_SET_MIN) {
+      return;
+   }
+
+   /* a power of two, at most half full */
+   n_slots = 16;
+   while (n_slots < compare->n_in_values * 2) {
+      n_slots *= 2;
+   }
+
+   compare->in_set = (mongoc_matcher_in_slot_t *) bson_malloc0 (
+      sizeof (mongoc_matcher_in_slot_t) * n_slots);
+   compare->in_set_mask = n_slots - 1;
+
+   for (i = 0; i < compare->n_in_values; i++) {
+      value = &compare->in_values[i];
+
+      if (value->type == BSON_TYPE_ARRAY) {
+         compare->in_has_arrays = true;
+         continue;
+      }
+
+      switch (value->type) {
+      case BSON_TYPE_DOUBLE:
+      case BSON_TYPE_INT32:
+      case BSON_TYPE_INT64:
+      case BSON_TYPE_UTF8:
+      case BSON_TYPE_DOCUMENT:
+      case BSON_TYPE_NULL:
+         /* the spec value hashes as a field of its own type does */
+         _mongoc_matcher_iter_hash (&value->iter, &hash);
+         break;
+      default:
+         continue;
+      }
+
+      slot = hash & compare->in_set_mask;
+      while (compare->in_set[slot].index) {
+         slot = (slot + 1) & compare->in_set_mask;
+      }
+
+      compare->in_set[slot].hash = hash;
+      compare->in_set[slot].index = i + 1;
+   }
+}
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -47,6 +364,7 @@ _mongoc_matcher_op_exists_new (const char *path, /* IN */
    op = (mongoc_matcher_op_t *) bson_malloc0 (sizeof *op);
    op->exists.base.opcode = MONGOC_MATCHER_OPCODE_EXISTS;
    op->exists.path = bson_strdup (path);
+   _mongoc_matcher_path_init (&op->exists.keys, path);
    op->exists.exists = exists;
 
    return op;
@@ -82,6 +400,7 @@ _mongoc_matcher_op_type_new (const char *path, /* IN */
    op = (mongoc_matcher_op_t *) bson_malloc0 (sizeof *op);
    op->type.base.opcode = MONGOC_MATCHER_OPCODE_TYPE;
    op->type.path = bson_strdup (path);
+   _mongoc_matcher_path_init (&op->type.keys, path);
    op->type.type = type;
 
    return op;
@@ -145,12 +464,16 @@ _mongoc_matcher_op_logical_new (mongoc_matcher_opcode_t opcode, /* IN */
  *          {$in: [...]}
  *          {$nin: [...]}
  *
+ *       The regular expressions in a $in or $nin list are compiled
+ *       together, so a string field is scanned once for all of them.
+ *
  * Returns:
  *       A newly allocated mongoc_matcher_op_t that should be freed with
- *       _mongoc_matcher_op_destroy().
+ *       _mongoc_matcher_op_destroy(), or NULL if a regular expression
+ *       is invalid.
  *
  * Side effects:
- *       None.
+ *       @error may be set.
  *
  *--------------------------------------------------------------------------
  */
@@ -158,9 +481,15 @@ _mongoc_matcher_op_logical_new (mongoc_matcher_opcode_t opcode, /* IN */
 mongoc_matcher_op_t *
 _mongoc_matcher_op_compare_new (mongoc_matcher_opcode_t opcode, /* IN */
                                 const char *path,               /* IN */
-                                const bson_iter_t *iter)        /* IN */
+                                const bson_iter_t *iter,        /* IN */
+                                bson_error_t *error)            /* OUT */
 {
    mongoc_matcher_op_t *op;
+   mongoc_matcher_value_t *value;
+   bson_iter_t child;
+   const char *pattern;
+   const char *options;
+   uint32_t i;
 
    BSON_ASSERT (path);
    BSON_ASSERT (iter);
@@ -168,7 +497,45 @@ _mongoc_matcher_op_compare_new (mongoc_matcher_opcode_t opcode, /* IN */
    op = (mongoc_matcher_op_t *) bson_malloc0 (sizeof *op);
    op->compare.base.opcode = opcode;
    op->compare.path = bson_strdup (path);
+   _mongoc_matcher_path_init (&op->compare.keys, path);
    memcpy (&op->compare.iter, iter, sizeof *iter);
+   _mongoc_matcher_value_init (&op->compare.value, iter);
+
+   if ((opcode == MONGOC_MATCHER_OPCODE_IN ||
+        opcode == MONGOC_MATCHER_OPCODE_NIN) &&
+       BSON_ITER_HOLDS_ARRAY (iter) && bson_iter_recurse (iter, &child)) {
+      while (bson_iter_next (&child)) {
+         op->compare.n_in_values++;
+      }
+
+      op->compare.in_values = (mongoc_matcher_value_t *) bson_malloc (
+         sizeof (mongoc_matcher_value_t) * op->compare.n_in_values);
+
+      bson_iter_recurse (iter, &child);
+      for (i = 0; bson_iter_next (&child); i++) {
+         _mongoc_matcher_value_init (&op->compare.in_values[i], &child);
+      }
+
+      _mongoc_matcher_in_set_init (&op->compare);
+
+      for (i = 0; i < op->compare.n_in_values; i++) {
+         value = &op->compare.in_values[i];
+         if (value->type != BSON_TYPE_REGEX) {
+            continue;
+         }
+
+         if (!op->compare.in_regex) {
+            op->compare.in_regex = _mongoc_matcher_regex_new ();
+         }
+
+         pattern = bson_iter_regex (&value->iter, &options);
+         if (!_mongoc_matcher_regex_add (
+                op->compare.in_regex, pattern, options, error)) {
+            _mongoc_matcher_op_destroy (op);
+            return NULL;
+         }
+      }
+   }
 
    return op;
 }
@@ -209,6 +576,56 @@ _mongoc_matcher_op_not_new (const char *path,           /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_regex_new --
+ *
+ *       Create a new op for checking {"path": /pattern/options} or
+ *       {"path": {$regex: "pattern", $options: "options"}}. The pattern
+ *       is compiled once, here. @pattern and @options must outlive the
+ *       op.
+ *
+ * Returns:
+ *       A newly allocated mongoc_matcher_op_t that should be freed with
+ *       _mongoc_matcher_op_destroy(), or NULL if @pattern is invalid.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_matcher_op_t *
+_mongoc_matcher_op_regex_new (const char *path,    /* IN */
+                              const char *pattern, /* IN */
+                              const char *options, /* IN */
+                              bson_error_t *error) /* OUT */
+{
+   mongoc_matcher_regex_t *regex;
+   mongoc_matcher_op_t *op;
+
+   BSON_ASSERT (path);
+   BSON_ASSERT (pattern);
+
+   regex = _mongoc_matcher_regex_new ();
+   if (!_mongoc_matcher_regex_add (regex, pattern, options, error)) {
+      _mongoc_matcher_regex_destroy (regex);
+      return NULL;
+   }
+
+   op = (mongoc_matcher_op_t *) bson_malloc0 (sizeof *op);
+   op->regex.base.opcode = MONGOC_MATCHER_OPCODE_REGEX;
+   op->regex.path = bson_strdup (path);
+   _mongoc_matcher_path_init (&op->regex.keys, path);
+   op->regex.pattern = pattern;
+   op->regex.options = options ? options : "";
+   op->regex.regex = regex;
+
+   return op;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -239,6 +656,10 @@ _mongoc_matcher_op_destroy (mongoc_matcher_op_t *op) /* IN */
    case MONGOC_MATCHER_OPCODE_NE:
    case MONGOC_MATCHER_OPCODE_NIN:
       bson_free (op->compare.path);
+      _mongoc_matcher_path_destroy (&op->compare.keys);
+      bson_free (op->compare.in_values);
+      bson_free (op->compare.in_set);
+      _mongoc_matcher_regex_destroy (op->compare.in_regex);
       break;
    case MONGOC_MATCHER_OPCODE_OR:
    case MONGOC_MATCHER_OPCODE_AND:
@@ -254,9 +675,16 @@ _mongoc_matcher_op_destroy (mongoc_matcher_op_t *op) /* IN */
       break;
    case MONGOC_MATCHER_OPCODE_EXISTS:
       bson_free (op->exists.path);
+      _mongoc_matcher_path_destroy (&op->exists.keys);
       break;
    case MONGOC_MATCHER_OPCODE_TYPE:
       bson_free (op->type.path);
+      _mongoc_matcher_path_destroy (&op->type.keys);
+      break;
+   case MONGOC_MATCHER_OPCODE_REGEX:
+      bson_free (op->regex.path);
+      _mongoc_matcher_path_destroy (&op->regex.keys);
+      _mongoc_matcher_regex_destroy (op->regex.regex);
       break;
    default:
       break;
@@ -292,14 +720,12 @@ _mongoc_matcher_op_exists_match (mongoc_matcher_op_exists_t *exists, /* IN */
                                  const bson_t *bson)                 /* IN */
 {
    bson_iter_t iter;
-   bson_iter_t desc;
    bool found;
 
    BSON_ASSERT (exists);
    BSON_ASSERT (bson);
 
-   found = (bson_iter_init (&iter, bson) &&
-            bson_iter_find_descendant (&iter, exists->path, &desc));
+   found = _mongoc_matcher_path_find (&exists->keys, bson, &iter);
 
    return (found == exists->exists);
 }
@@ -327,13 +753,11 @@ _mongoc_matcher_op_type_match (mongoc_matcher_op_type_t *type, /* IN */
                                const bson_t *bson)             /* IN */
 {
    bson_iter_t iter;
-   bson_iter_t desc;
 
    BSON_ASSERT (type);
    BSON_ASSERT (bson);
 
-   if (bson_iter_init (&iter, bson) &&
-       bson_iter_find_descendant (&iter, type->path, &desc)) {
+   if (_mongoc_matcher_path_find (&type->keys, bson, &iter)) {
       return (bson_iter_type (&iter) == type->type);
    }
 
@@ -344,14 +768,12 @@ _mongoc_matcher_op_type_match (mongoc_matcher_op_type_t *type, /* IN */
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_op_not_match --
+ * _mongoc_matcher_op_regex_match --
  *
- *       Checks if the {$not: ...} expression matches by negating the
- *       child expression.
+ *       Checks if the string field at @regex's path matches its pattern.
  *
  * Returns:
- *       true if the child expression returned false.
- *       Otherwise false.
+ *       true if the field was found, is a string, and matched.
  *
  * Side effects:
  *       None.
@@ -360,49 +782,38 @@ _mongoc_matcher_op_type_match (mongoc_matcher_op_type_t *type, /* IN */
  */
 
 static bool
-_mongoc_matcher_op_not_match (mongoc_matcher_op_not_t *not_, /* IN */
-                              const bson_t *bson)            /* IN */
+_mongoc_matcher_op_regex_match (mongoc_matcher_op_regex_t *regex, /* IN */
+                                const bson_t *bson)               /* IN */
 {
-   BSON_ASSERT (not_);
+   bson_iter_t iter;
+   const char *str;
+   uint32_t len;
+
+   BSON_ASSERT (regex);
    BSON_ASSERT (bson);
 
-   return !_mongoc_matcher_op_match (not_->child, bson);
-}
+   if (!_mongoc_matcher_path_find (&regex->keys, bson, &iter) ||
+       !BSON_ITER_HOLDS_UTF8 (&iter)) {
+      return false;
+   }
 
+   str = bson_iter_utf8 (&iter, &len);
 
-#define _TYPE_CODE(l, r) ((((int) (l)) << 8) | ((int) (r)))
-#define _NATIVE_COMPARE(op, t1, t2) \
-   (bson_iter##t2 (iter) op bson_iter##t1 (compare_iter))
-#define _EQ_COMPARE(t1, t2) _NATIVE_COMPARE (==, t1, t2)
-#define _NE_COMPARE(t1, t2) _NATIVE_COMPARE (!=, t1, t2)
-#define _GT_COMPARE(t1, t2) _NATIVE_COMPARE (>, t1, t2)
-#define _GTE_COMPARE(t1, t2) _NATIVE_COMPARE (>=, t1, t2)
-#define _LT_COMPARE(t1, t2) _NATIVE_COMPARE (<, t1, t2)
-#define _LTE_COMPARE(t1, t2) _NATIVE_COMPARE (<=, t1, t2)
+   return _mongoc_matcher_regex_match (regex->regex, str, len);
+}
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_iter_eq_match --
- *
- *       Performs equality match for all types on either left or right
- *       side of the equation.
- *
- *       We try to default to what the compiler would do for comparing
- *       things like integers. Therefore, we just have MACRO'tized
- *       everything so that the compiler sees the native values. (Such
- *       as (double == int64).
- *
- *       The _TYPE_CODE() stuff allows us to shove the type of the left
- *       and the right into a single integer and then do a jump table
- *       with a switch/case for all our supported types.
+ * _mongoc_matcher_op_not_match --
  *
- *       I imagine a bunch more of these will need to be added, so feel
- *       free to submit patches.
+ *       Checks if the {$not: ...} expression matches by negating the
+ *       child expression.
  *
  * Returns:
- *       true if the equality match succeeded.
+ *       true if the child expression returned false.
+ *       Otherwise false.
  *
  * Side effects:
  *       None.
@@ -411,218 +822,140 @@ _mongoc_matcher_op_not_match (mongoc_matcher_op_not_t *not_, /* IN */
  */
 
 static bool
-_mongoc_matcher_iter_eq_match (bson_iter_t *compare_iter, /* IN */
-                               bson_iter_t *iter)         /* IN */
+_mongoc_matcher_op_not_match (mongoc_matcher_op_not_t *not_, /* IN */
+                              const bson_t *bson)            /* IN */
 {
-   int code;
-
-   BSON_ASSERT (compare_iter);
-   BSON_ASSERT (iter);
-
-   code = _TYPE_CODE (bson_iter_type (compare_iter), bson_iter_type (iter));
-
-   switch (code) {
-   /* Double on Left Side */
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_DOUBLE):
-      return _EQ_COMPARE (_double, _double);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_BOOL):
-      return _EQ_COMPARE (_double, _bool);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_INT32):
-      return _EQ_COMPARE (_double, _int32);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_INT64):
-      return _EQ_COMPARE (_double, _int64);
-
-   /* UTF8 on Left Side */
-   case _TYPE_CODE (BSON_TYPE_UTF8, BSON_TYPE_UTF8): {
-      uint32_t llen;
-      uint32_t rlen;
-      const char *lstr;
-      const char *rstr;
-
-      lstr = bson_iter_utf8 (compare_iter, &llen);
-      rstr = bson_iter_utf8 (iter, &rlen);
-
-      return ((llen == rlen) && (0 == memcmp (lstr, rstr, llen)));
-   }
-
-   /* Int32 on Left Side */
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_DOUBLE):
-      return _EQ_COMPARE (_int32, _double);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_BOOL):
-      return _EQ_COMPARE (_int32, _bool);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_INT32):
-      return _EQ_COMPARE (_int32, _int32);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_INT64):
-      return _EQ_COMPARE (_int32, _int64);
-
-   /* Int64 on Left Side */
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_DOUBLE):
-      return _EQ_COMPARE (_int64, _double);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_BOOL):
-      return _EQ_COMPARE (_int64, _bool);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_INT32):
-      return _EQ_COMPARE (_int64, _int32);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_INT64):
-      return _EQ_COMPARE (_int64, _int64);
-
-   /* Null on Left Side */
-   case _TYPE_CODE (BSON_TYPE_NULL, BSON_TYPE_NULL):
-   case _TYPE_CODE (BSON_TYPE_NULL, BSON_TYPE_UNDEFINED):
-      return true;
-
-   case _TYPE_CODE (BSON_TYPE_ARRAY, BSON_TYPE_ARRAY): {
-      bson_iter_t left_array;
-      bson_iter_t right_array;
-      bson_iter_recurse (compare_iter, &left_array);
-      bson_iter_recurse (iter, &right_array);
-
-      while (true) {
-         bool left_has_next = bson_iter_next (&left_array);
-         bool right_has_next = bson_iter_next (&right_array);
-
-         if (left_has_next != right_has_next) {
-            /* different lengths */
-            return false;
-         }
-
-         if (!left_has_next) {
-            /* finished */
-            return true;
-         }
-
-         if (!_mongoc_matcher_iter_eq_match (&left_array, &right_array)) {
-            return false;
-         }
-      }
-   }
-
-   case _TYPE_CODE (BSON_TYPE_DOCUMENT, BSON_TYPE_DOCUMENT): {
-      uint32_t llen;
-      uint32_t rlen;
-      const uint8_t *ldoc;
-      const uint8_t *rdoc;
-
-      bson_iter_document (compare_iter, &llen, &ldoc);
-      bson_iter_document (iter, &rlen, &rdoc);
-
-      return ((llen == rlen) && (0 == memcmp (ldoc, rdoc, llen)));
-   }
+   BSON_ASSERT (not_);
+   BSON_ASSERT (bson);
 
-   default:
-      return false;
-   }
+   return !_mongoc_matcher_op_match (not_->child, bson);
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_op_eq_match --
- *
- *       Performs equality match for all types on either left or right
- *       side of the equation.
- *
- * Returns:
- *       true if the equality match succeeded.
+ * _mongoc_matcher_compare_double --
+ * _mongoc_matcher_compare_int64 --
  *
- * Side effects:
- *       None.
+ *       Apply the comparison @opcode to two native values.
  *
  *--------------------------------------------------------------------------
  */
 
 static bool
-_mongoc_matcher_op_eq_match (mongoc_matcher_op_compare_t *compare, /* IN */
-                             bson_iter_t *iter)                    /* IN */
+_mongoc_matcher_compare_double (mongoc_matcher_opcode_t opcode, /* IN */
+                                double l,                       /* IN */
+                                double r)                       /* IN */
 {
-   BSON_ASSERT (compare);
-   BSON_ASSERT (iter);
+   switch ((int) opcode) {
+   case MONGOC_MATCHER_OPCODE_EQ:
+      return l == r;
+   case MONGOC_MATCHER_OPCODE_GT:
+      return l > r;
+   case MONGOC_MATCHER_OPCODE_GTE:
+      return l >= r;
+   case MONGOC_MATCHER_OPCODE_LT:
+      return l < r;
+   case MONGOC_MATCHER_OPCODE_LTE:
+      return l <= r;
+   default:
+      BSON_ASSERT (false);
+      return false;
+   }
+}
+
 
-   return _mongoc_matcher_iter_eq_match (&compare->iter, iter);
+static bool
+_mongoc_matcher_compare_int64 (mongoc_matcher_opcode_t opcode, /* IN */
+                               int64_t l,                      /* IN */
+                               int64_t r)                      /* IN */
+{
+   switch ((int) opcode) {
+   case MONGOC_MATCHER_OPCODE_EQ:
+      return l == r;
+   case MONGOC_MATCHER_OPCODE_GT:
+      return l > r;
+   case MONGOC_MATCHER_OPCODE_GTE:
+      return l >= r;
+   case MONGOC_MATCHER_OPCODE_LT:
+      return l < r;
+   case MONGOC_MATCHER_OPCODE_LTE:
+      return l <= r;
+   default:
+      BSON_ASSERT (false);
+      return false;
+   }
 }
 
+
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_op_gt_match --
+ * _mongoc_matcher_value_compare_number --
  *
- *       Perform {$gt: ...} match using @compare.
- *
- *       In general, we try to default to what the compiler would do
- *       for comparison between different types.
+ *       Compare the field at @iter to the double, int32, or int64 spec
+ *       @value with @opcode, the way the compiler compares the native
+ *       values: as doubles if either side is a double, otherwise as
+ *       integers. A bool field counts as 0 or 1.
  *
  * Returns:
- *       true if the document field was > the spec value.
- *
- * Side effects:
- *       None.
+ *       false if the field isn't a number or bool, otherwise true and
+ *       @match is set.
  *
  *--------------------------------------------------------------------------
  */
 
 static bool
-_mongoc_matcher_op_gt_match (mongoc_matcher_op_compare_t *compare, /* IN */
-                             bson_iter_t *iter)                    /* IN */
+_mongoc_matcher_value_compare_number (const mongoc_matcher_value_t *value,
+                                      mongoc_matcher_opcode_t opcode,
+                                      const bson_iter_t *iter,
+                                      bool *match) /* OUT */
 {
-   int code;
-   bson_iter_t *compare_iter = &compare->iter;
-
-   BSON_ASSERT (compare);
-   BSON_ASSERT (iter);
-
-   code = _TYPE_CODE (bson_iter_type (compare_iter), bson_iter_type (iter));
-
-   switch (code) {
-   /* Double on Left Side */
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_DOUBLE):
-      return _GT_COMPARE (_double, _double);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_BOOL):
-      return _GT_COMPARE (_double, _bool);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_INT32):
-      return _GT_COMPARE (_double, _int32);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_INT64):
-      return _GT_COMPARE (_double, _int64);
-
-   /* Int32 on Left Side */
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_DOUBLE):
-      return _GT_COMPARE (_int32, _double);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_BOOL):
-      return _GT_COMPARE (_int32, _bool);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_INT32):
-      return _GT_COMPARE (_int32, _int32);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_INT64):
-      return _GT_COMPARE (_int32, _int64);
-
-   /* Int64 on Left Side */
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_DOUBLE):
-      return _GT_COMPARE (_int64, _double);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_BOOL):
-      return _GT_COMPARE (_int64, _bool);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_INT32):
-      return _GT_COMPARE (_int64, _int32);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_INT64):
-      return _GT_COMPARE (_int64, _int64);
-
-   default:
-      MONGOC_WARNING ("Implement for (Type(%d) > Type(%d))",
-                      bson_iter_type (compare_iter),
-                      bson_iter_type (iter));
+   int64_t i;
+
+   switch (bson_iter_type (iter)) {
+   case BSON_TYPE_DOUBLE:
+      *match = _mongoc_matcher_compare_double (
+         opcode,
+         bson_iter_double (iter),
+         value->type == BSON_TYPE_DOUBLE ? value->value.v_double
+                                         : (double) value->value.v_int64);
+      return true;
+   case BSON_TYPE_BOOL:
+      i = bson_iter_bool (iter);
       break;
+   case BSON_TYPE_INT32:
+      i = bson_iter_int32 (iter);
+      break;
+   case BSON_TYPE_INT64:
+      i = bson_iter_int64 (iter);
+      break;
+   default:
+      return false;
    }
 
-   return false;
+   if (value->type == BSON_TYPE_DOUBLE) {
+      *match = _mongoc_matcher_compare_double (
+         opcode, (double) i, value->value.v_double);
+   } else {
+      *match = _mongoc_matcher_compare_int64 (opcode, i, value->value.v_int64);
+   }
+
+   return true;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_op_gte_match --
+ * _mongoc_matcher_iter_eq_match --
  *
- *       Perform a match of {"path": {"$gte": value}}.
+ *       Performs equality match of the spec value at @compare_iter and
+ *       the field at @iter, for array elements.
  *
  * Returns:
- *       true if the the spec matches, otherwise false.
+ *       true if the equality match succeeded.
  *
  * Side effects:
  *       None.
@@ -631,69 +964,33 @@ _mongoc_matcher_op_gt_match (mongoc_matcher_op_compare_t *compare, /* IN */
  */
 
 static bool
-_mongoc_matcher_op_gte_match (mongoc_matcher_op_compare_t *compare, /* IN */
-                              bson_iter_t *iter)                    /* IN */
+_mongoc_matcher_iter_eq_match (const bson_iter_t *compare_iter, /* IN */
+                               const bson_iter_t *iter)         /* IN */
 {
-   bson_iter_t *compare_iter;
-   int code;
+   mongoc_matcher_value_t value;
 
-   BSON_ASSERT (compare);
+   BSON_ASSERT (compare_iter);
    BSON_ASSERT (iter);
 
-   compare_iter = &compare->iter;
-   code = _TYPE_CODE (bson_iter_type (compare_iter), bson_iter_type (iter));
-
-   switch (code) {
-   /* Double on Left Side */
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_DOUBLE):
-      return _GTE_COMPARE (_double, _double);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_BOOL):
-      return _GTE_COMPARE (_double, _bool);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_INT32):
-      return _GTE_COMPARE (_double, _int32);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_INT64):
-      return _GTE_COMPARE (_double, _int64);
-
-   /* Int32 on Left Side */
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_DOUBLE):
-      return _GTE_COMPARE (_int32, _double);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_BOOL):
-      return _GTE_COMPARE (_int32, _bool);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_INT32):
-      return _GTE_COMPARE (_int32, _int32);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_INT64):
-      return _GTE_COMPARE (_int32, _int64);
-
-   /* Int64 on Left Side */
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_DOUBLE):
-      return _GTE_COMPARE (_int64, _double);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_BOOL):
-      return _GTE_COMPARE (_int64, _bool);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_INT32):
-      return _GTE_COMPARE (_int64, _int32);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_INT64):
-      return _GTE_COMPARE (_int64, _int64);
+   _mongoc_matcher_value_init (&value, compare_iter);
 
-   default:
-      MONGOC_WARNING ("Implement for (Type(%d) >= Type(%d))",
-                      bson_iter_type (compare_iter),
-                      bson_iter_type (iter));
-      break;
-   }
-
-   return false;
+   return _mongoc_matcher_value_eq (&value, iter);
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_op_in_match --
+ * _mongoc_matcher_value_eq --
  *
- *       Checks the spec {"path": {"$in": [value1, value2, ...]}}.
+ *       Performs equality match of the decoded spec @value and the field
+ *       at @iter. Numbers compare as the compiler compares the native
+ *       values, see _mongoc_matcher_value_compare_number. Strings,
+ *       arrays, and documents must be the same type and equal. Null
+ *       matches null or undefined.
  *
  * Returns:
- *       true if the spec matched, otherwise false.
+ *       true if the equality match succeeded.
  *
  * Side effects:
  *       None.
@@ -702,106 +999,94 @@ _mongoc_matcher_op_gte_match (mongoc_matcher_op_compare_t *compare, /* IN */
  */
 
 static bool
-_mongoc_matcher_op_in_match (mongoc_matcher_op_compare_t *compare, /* IN */
-                             bson_iter_t *iter)                    /* IN */
+_mongoc_matcher_value_eq (const mongoc_matcher_value_t *value, /* IN */
+                          const bson_iter_t *iter)             /* IN */
 {
-   mongoc_matcher_op_compare_t op;
+   bson_type_t type;
+   bson_iter_t left_array;
+   bson_iter_t right_array;
+   bool left_has_next;
+   bool right_has_next;
+   const uint8_t *data;
+   uint32_t len;
+   bool match;
+
+   type = bson_iter_type (iter);
+
+   switch (value->type) {
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_INT64:
+      return _mongoc_matcher_value_compare_number (
+                value, MONGOC_MATCHER_OPCODE_EQ, iter, &match) &&
+             match;
+
+   case BSON_TYPE_UTF8:
+      if (type != BSON_TYPE_UTF8) {
+         return false;
+      }
 
-   op.base.opcode = MONGOC_MATCHER_OPCODE_EQ;
-   op.path = compare->path;
+      data = (const uint8_t *) bson_iter_utf8 (iter, &len);
 
-   if (!BSON_ITER_HOLDS_ARRAY (&compare->iter) ||
-       !bson_iter_recurse (&compare->iter, &op.iter)) {
-      return false;
-   }
+      return ((len == value->value.v_bytes.len) &&
+              (0 == memcmp (data, value->value.v_bytes.data, len)));
 
-   while (bson_iter_next (&op.iter)) {
-      if (_mongoc_matcher_op_eq_match (&op, iter)) {
-         return true;
+   case BSON_TYPE_NULL:
+      return type == BSON_TYPE_NULL || type == BSON_TYPE_UNDEFINED;
+
+   case BSON_TYPE_ARRAY:
+      if (type != BSON_TYPE_ARRAY) {
+         return false;
       }
-   }
 
-   return false;
-}
+      bson_iter_recurse (&value->iter, &left_array);
+      bson_iter_recurse (iter, &right_array);
 
+      while (true) {
+         left_has_next = bson_iter_next (&left_array);
+         right_has_next = bson_iter_next (&right_array);
 
-/*
- *--------------------------------------------------------------------------
- *
- * _mongoc_matcher_op_lt_match --
- *
- *       Perform a {"path": "$lt": {value}} match.
- *
- * Returns:
- *       true if the spec matched, otherwise false.
- *
- * Side effects:
- *       None.
- *
- *--------------------------------------------------------------------------
- */
+         if (left_has_next != right_has_next) {
+            /* different lengths */
+            return false;
+         }
 
-static bool
-_mongoc_matcher_op_lt_match (mongoc_matcher_op_compare_t *compare, /* IN */
-                             bson_iter_t *iter)                    /* IN */
-{
-   bson_iter_t *compare_iter;
-   int code;
+         if (!left_has_next) {
+            /* finished */
+            return true;
+         }
 
-   BSON_ASSERT (compare);
-   BSON_ASSERT (iter);
+         if (!_mongoc_matcher_iter_eq_match (&left_array, &right_array)) {
+            return false;
+         }
+      }
+
+   case BSON_TYPE_DOCUMENT:
+      if (type != BSON_TYPE_DOCUMENT) {
+         return false;
+      }
 
-   compare_iter = &compare->iter;
-   code = _TYPE_CODE (bson_iter_type (compare_iter), bson_iter_type (iter));
-
-   switch (code) {
-   /* Double on Left Side */
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_DOUBLE):
-      return _LT_COMPARE (_double, _double);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_BOOL):
-      return _LT_COMPARE (_double, _bool);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_INT32):
-      return _LT_COMPARE (_double, _int32);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_INT64):
-      return _LT_COMPARE (_double, _int64);
-
-   /* Int32 on Left Side */
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_DOUBLE):
-      return _LT_COMPARE (_int32, _double);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_BOOL):
-      return _LT_COMPARE (_int32, _bool);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_INT32):
-      return _LT_COMPARE (_int32, _int32);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_INT64):
-      return _LT_COMPARE (_int32, _int64);
-
-   /* Int64 on Left Side */
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_DOUBLE):
-      return _LT_COMPARE (_int64, _double);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_BOOL):
-      return _LT_COMPARE (_int64, _bool);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_INT32):
-      return _LT_COMPARE (_int64, _int32);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_INT64):
-      return _LT_COMPARE (_int64, _int64);
+      bson_iter_document (iter, &len, &data);
+
+      return ((len == value->value.v_bytes.len) &&
+              (0 == memcmp (data, value->value.v_bytes.data, len)));
 
    default:
-      MONGOC_WARNING ("Implement for (Type(%d) < Type(%d))",
-                      bson_iter_type (compare_iter),
-                      bson_iter_type (iter));
-      break;
+      return false;
    }
-
-   return false;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_op_lte_match --
+ * _mongoc_matcher_op_order_match --
+ *
+ *       Perform a {"path": {"$gt": value}}, $gte, $lt, or $lte match
+ *       using @compare's decoded value.
  *
- *       Perform a {"$path": {"$lte": value}} match.
+ *       In general, we try to default to what the compiler would do
+ *       for comparison between different types.
  *
  * Returns:
  *       true if the spec matched, otherwise false.
@@ -813,56 +1098,48 @@ _mongoc_matcher_op_lt_match (mongoc_matcher_op_compare_t *compare, /* IN */
  */
 
 static bool
-_mongoc_matcher_op_lte_match (mongoc_matcher_op_compare_t *compare, /* IN */
-                              bson_iter_t *iter)                    /* IN */
+_mongoc_matcher_op_order_match (mongoc_matcher_op_compare_t *compare, /* IN */
+                                bson_iter_t *iter)                    /* IN */
 {
-   bson_iter_t *compare_iter;
-   int code;
+   const char *op_str;
+   bool match;
 
    BSON_ASSERT (compare);
    BSON_ASSERT (iter);
 
-   compare_iter = &compare->iter;
-   code = _TYPE_CODE (bson_iter_type (compare_iter), bson_iter_type (iter));
-
-   switch (code) {
-   /* Double on Left Side */
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_DOUBLE):
-      return _LTE_COMPARE (_double, _double);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_BOOL):
-      return _LTE_COMPARE (_double, _bool);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_INT32):
-      return _LTE_COMPARE (_double, _int32);
-   case _TYPE_CODE (BSON_TYPE_DOUBLE, BSON_TYPE_INT64):
-      return _LTE_COMPARE (_double, _int64);
-
-   /* Int32 on Left Side */
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_DOUBLE):
-      return _LTE_COMPARE (_int32, _double);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_BOOL):
-      return _LTE_COMPARE (_int32, _bool);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_INT32):
-      return _LTE_COMPARE (_int32, _int32);
-   case _TYPE_CODE (BSON_TYPE_INT32, BSON_TYPE_INT64):
-      return _LTE_COMPARE (_int32, _int64);
-
-   /* Int64 on Left Side */
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_DOUBLE):
-      return _LTE_COMPARE (_int64, _double);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_BOOL):
-      return _LTE_COMPARE (_int64, _bool);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_INT32):
-      return _LTE_COMPARE (_int64, _int32);
-   case _TYPE_CODE (BSON_TYPE_INT64, BSON_TYPE_INT64):
-      return _LTE_COMPARE (_int64, _int64);
+   switch (compare->value.type) {
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_INT64:
+      if (_mongoc_matcher_value_compare_number (
+             &compare->value, compare->base.opcode, iter, &match)) {
+         return match;
+      }
+      break;
+   default:
+      break;
+   }
 
+   switch ((int) compare->base.opcode) {
+   case MONGOC_MATCHER_OPCODE_GT:
+      op_str = ">";
+      break;
+   case MONGOC_MATCHER_OPCODE_GTE:
+      op_str = ">=";
+      break;
+   case MONGOC_MATCHER_OPCODE_LT:
+      op_str = "<";
+      break;
    default:
-      MONGOC_WARNING ("Implement for (Type(%d) <= Type(%d))",
-                      bson_iter_type (compare_iter),
-                      bson_iter_type (iter));
+      op_str = "<=";
       break;
    }
 
+   MONGOC_WARNING ("Implement for (Type(%d) %s Type(%d))",
+                   compare->value.type,
+                   op_str,
+                   bson_iter_type (iter));
+
    return false;
 }
 
@@ -870,13 +1147,15 @@ _mongoc_matcher_op_lte_match (mongoc_matcher_op_compare_t *compare, /* IN */
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_op_ne_match --
+ * _mongoc_matcher_op_in_match --
  *
- *       Perform a {"path": {"$ne": value}} match.
+ *       Checks the spec {"path": {"$in": [value1, value2, ...]}}.
+ *       Long lists are looked up in @compare's hash set, only array
+ *       fields are compared with each array value in turn. A string
+ *       field is scanned once for all the list's regular expressions.
  *
  * Returns:
- *       true if the field "path" was not found or the value is not-equal
- *       to value.
+ *       true if the spec matched, otherwise false.
  *
  * Side effects:
  *       None.
@@ -885,34 +1164,52 @@ _mongoc_matcher_op_lte_match (mongoc_matcher_op_compare_t *compare, /* IN */
  */
 
 static bool
-_mongoc_matcher_op_ne_match (mongoc_matcher_op_compare_t *compare, /* IN */
+_mongoc_matcher_op_in_match (mongoc_matcher_op_compare_t *compare, /* IN */
                              bson_iter_t *iter)                    /* IN */
 {
-   return !_mongoc_matcher_op_eq_match (compare, iter);
-}
+   const mongoc_matcher_in_slot_t *in_slot;
+   const char *str;
+   uint32_t hash;
+   uint32_t slot;
+   uint32_t len;
+   uint32_t i;
+
+   if (compare->in_regex && BSON_ITER_HOLDS_UTF8 (iter)) {
+      str = bson_iter_utf8 (iter, &len);
+      if (_mongoc_matcher_regex_match (compare->in_regex, str, len)) {
+         return true;
+      }
+   }
 
+   if (compare->in_set) {
+      if (_mongoc_matcher_iter_hash (iter, &hash)) {
+         slot = hash & compare->in_set_mask;
+         for (in_slot = &compare->in_set[slot]; in_slot->index;
+              in_slot = &compare->in_set[slot]) {
+            if (in_slot->hash == hash &&
+                _mongoc_matcher_value_eq (
+                   &compare->in_values[in_slot->index - 1], iter)) {
+               return true;
+            }
+
+            slot = (slot + 1) & compare->in_set_mask;
+         }
 
-/*
- *--------------------------------------------------------------------------
- *
- * _mongoc_matcher_op_nin_match --
- *
- *       Perform a {"path": {"$nin": value}} match.
- *
- * Returns:
- *       true if value was not found in the array at "path".
- *
- * Side effects:
- *       None.
- *
- *--------------------------------------------------------------------------
- */
+         return false;
+      }
 
-static bool
-_mongoc_matcher_op_nin_match (mongoc_matcher_op_compare_t *compare, /* IN */
-                              bson_iter_t *iter)                    /* IN */
-{
-   return !_mongoc_matcher_op_in_match (compare, iter);
+      if (!compare->in_has_arrays || !BSON_ITER_HOLDS_ARRAY (iter)) {
+         return false;
+      }
+   }
+
+   for (i = 0; i < compare->n_in_values; i++) {
+      if (_mongoc_matcher_value_eq (&compare->in_values[i], iter)) {
+         return true;
+      }
+   }
+
+   return false;
 }
 
 
@@ -937,38 +1234,29 @@ static bool
 _mongoc_matcher_op_compare_match (mongoc_matcher_op_compare_t *compare, /* IN */
                                   const bson_t *bson)                   /* IN */
 {
-   bson_iter_t tmp;
    bson_iter_t iter;
 
    BSON_ASSERT (compare);
    BSON_ASSERT (bson);
 
-   if (strchr (compare->path, '.')) {
-      if (!bson_iter_init (&tmp, bson) ||
-          !bson_iter_find_descendant (&tmp, compare->path, &iter)) {
-         return false;
-      }
-   } else if (!bson_iter_init_find (&iter, bson, compare->path)) {
+   if (!_mongoc_matcher_path_find (&compare->keys, bson, &iter)) {
       return false;
    }
 
    switch ((int) compare->base.opcode) {
    case MONGOC_MATCHER_OPCODE_EQ:
-      return _mongoc_matcher_op_eq_match (compare, &iter);
+      return _mongoc_matcher_value_eq (&compare->value, &iter);
    case MONGOC_MATCHER_OPCODE_GT:
-      return _mongoc_matcher_op_gt_match (compare, &iter);
    case MONGOC_MATCHER_OPCODE_GTE:
-      return _mongoc_matcher_op_gte_match (compare, &iter);
-   case MONGOC_MATCHER_OPCODE_IN:
-      return _mongoc_matcher_op_in_match (compare, &iter);
    case MONGOC_MATCHER_OPCODE_LT:
-      return _mongoc_matcher_op_lt_match (compare, &iter);
    case MONGOC_MATCHER_OPCODE_LTE:
-      return _mongoc_matcher_op_lte_match (compare, &iter);
+      return _mongoc_matcher_op_order_match (compare, &iter);
+   case MONGOC_MATCHER_OPCODE_IN:
+      return _mongoc_matcher_op_in_match (compare, &iter);
    case MONGOC_MATCHER_OPCODE_NE:
-      return _mongoc_matcher_op_ne_match (compare, &iter);
+      return !_mongoc_matcher_value_eq (&compare->value, &iter);
    case MONGOC_MATCHER_OPCODE_NIN:
-      return _mongoc_matcher_op_nin_match (compare, &iter);
+      return !_mongoc_matcher_op_in_match (compare, &iter);
    default:
       BSON_ASSERT (false);
       break;
@@ -1064,6 +1352,8 @@ _mongoc_matcher_op_match (mongoc_matcher_op_t *op, /* IN */
       return _mongoc_matcher_op_exists_match (&op->exists, bson);
    case MONGOC_MATCHER_OPCODE_TYPE:
       return _mongoc_matcher_op_type_match (&op->type, bson);
+   case MONGOC_MATCHER_OPCODE_REGEX:
+      return _mongoc_matcher_op_regex_match (&op->regex, bson);
    default:
       break;
    }
@@ -1072,6 +1362,141 @@ _mongoc_matcher_op_match (mongoc_matcher_op_t *op, /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_cost --
+ *
+ *       Estimate the cost of matching @op: the keys to look up, and the
+ *       values to compare.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint32_t
+_mongoc_matcher_op_cost (const mongoc_matcher_op_t *op) /* IN */
+{
+   switch (op->base.opcode) {
+   case MONGOC_MATCHER_OPCODE_EQ:
+   case MONGOC_MATCHER_OPCODE_GT:
+   case MONGOC_MATCHER_OPCODE_GTE:
+   case MONGOC_MATCHER_OPCODE_LT:
+   case MONGOC_MATCHER_OPCODE_LTE:
+   case MONGOC_MATCHER_OPCODE_NE:
+      return op->compare.keys.n_keys + 1;
+   case MONGOC_MATCHER_OPCODE_IN:
+   case MONGOC_MATCHER_OPCODE_NIN:
+      return op->compare.keys.n_keys +
+             (op->compare.in_set ? 1 : op->compare.n_in_values) +
+             (op->compare.in_regex ? 2 : 0);
+   case MONGOC_MATCHER_OPCODE_OR:
+   case MONGOC_MATCHER_OPCODE_AND:
+   case MONGOC_MATCHER_OPCODE_NOR:
+      return _mongoc_matcher_op_cost (op->logical.left) +
+             (op->logical.right ? _mongoc_matcher_op_cost (op->logical.right)
+                                : 0);
+   case MONGOC_MATCHER_OPCODE_NOT:
+      return _mongoc_matcher_op_cost (op->not_.child);
+   case MONGOC_MATCHER_OPCODE_EXISTS:
+      return op->exists.keys.n_keys;
+   case MONGOC_MATCHER_OPCODE_TYPE:
+      return op->type.keys.n_keys;
+   case MONGOC_MATCHER_OPCODE_REGEX:
+      /* scanning the string costs more than a comparison */
+      return op->regex.keys.n_keys + 2;
+   default:
+      return 0;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_reorder --
+ *
+ *       Reorder the operands of each chain of $and or $or ops in the tree
+ *       at @op from cheapest to most expensive, so that matching
+ *       short-circuits before the expensive ones where it can. Operands
+ *       of equal cost keep the query's order. $nor chains are left
+ *       alone, their nesting is not associative.
+ *
+ * Side effects:
+ *       The tree at @op is rearranged in place.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_matcher_op_reorder (mongoc_matcher_op_t *op) /* IN */
+{
+   mongoc_matcher_opcode_t opcode;
+   mongoc_matcher_op_t *node;
+   mongoc_matcher_op_t **slots[64];
+   mongoc_matcher_op_t *operand;
+   uint32_t costs[64];
+   uint32_t cost;
+   size_t n_slots;
+   size_t i;
+   size_t j;
+
+   BSON_ASSERT (op);
+
+   opcode = op->base.opcode;
+
+   if (opcode == MONGOC_MATCHER_OPCODE_NOT) {
+      _mongoc_matcher_op_reorder (op->not_.child);
+      return;
+   }
+
+   if (opcode != MONGOC_MATCHER_OPCODE_OR &&
+       opcode != MONGOC_MATCHER_OPCODE_AND &&
+       opcode != MONGOC_MATCHER_OPCODE_NOR) {
+      return;
+   }
+
+   /* the chain is right-leaning: each node's left is an operand, and the
+    * last node's right is the last operand */
+   n_slots = 0;
+   for (node = op;; node = node->logical.right) {
+      slots[n_slots++] = &node->logical.left;
+
+      if (!node->logical.right) {
+         break;
+      }
+
+      if (node->logical.right->base.opcode != opcode ||
+          n_slots == sizeof slots / sizeof slots[0] - 1) {
+         slots[n_slots++] = &node->logical.right;
+         break;
+      }
+   }
+
+   for (i = 0; i < n_slots; i++) {
+      _mongoc_matcher_op_reorder (*slots[i]);
+      costs[i] = _mongoc_matcher_op_cost (*slots[i]);
+   }
+
+   if (opcode == MONGOC_MATCHER_OPCODE_NOR) {
+      return;
+   }
+
+   /* stable insertion sort by cost */
+   for (i = 1; i < n_slots; i++) {
+      operand = *slots[i];
+      cost = costs[i];
+
+      for (j = i; j > 0 && costs[j - 1] > cost; j--) {
+         *slots[j] = *slots[j - 1];
+         costs[j] = costs[j - 1];
+      }
+
+      *slots[j] = operand;
+      costs[j] = cost;
+   }
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1182,6 +1607,13 @@ _mongoc_matcher_op_to_bson (mongoc_matcher_op_t *op, /* IN */
    case MONGOC_MATCHER_OPCODE_TYPE:
       BSON_APPEND_INT32 (bson, "$type", (int) op->type.type);
       break;
+   case MONGOC_MATCHER_OPCODE_REGEX:
+      if (bson_append_document_begin (bson, op->regex.path, -1, &child)) {
+         BSON_APPEND_UTF8 (&child, "$regex", op->regex.pattern);
+         BSON_APPEND_UTF8 (&child, "$options", op->regex.options);
+         bson_append_document_end (bson, &child);
+      }
+      break;
    default:
       BSON_ASSERT (false);
       break;
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_MATCHER_REGEX_PRIVATE_H
+#define MONGOC_MATCHER_REGEX_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+
+BSON_BEGIN_DECLS
+
+
+/* one or more regular expressions compiled into a single automaton, so a
+ * string is scanned once however many patterns there are */
+typedef struct _mongoc_matcher_regex_t mongoc_matcher_regex_t;
+
+
+mongoc_matcher_regex_t *
+_mongoc_matcher_regex_new (void);
+bool
+_mongoc_matcher_regex_add (mongoc_matcher_regex_t *regex,
+                           const char *pattern,
+                           const char *options,
+                           bson_error_t *error);
+uint32_t
+_mongoc_matcher_regex_n_patterns (const mongoc_matcher_regex_t *regex);
+bool
+_mongoc_matcher_regex_match (const mongoc_matcher_regex_t *regex,
+                             const char *str,
+                             uint32_t len);
+void
+_mongoc_matcher_regex_destroy (mongoc_matcher_regex_t *regex);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_MATCHER_REGEX_PRIVATE_H */
@@ -0,0 +1,1239 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoc-array-private.h"
+#include "mongoc-error.h"
+#include "mongoc-matcher-regex-private.h"
+
+
+/*
+ * Patterns are compiled to instructions for a Thompson NFA, all patterns
+ * into the same program, and a string is matched by stepping the states
+ * of every pattern together over its bytes once. There is no
+ * backtracking, so matching takes time proportional to the length of the
+ * string times the size of the program, whatever the patterns.
+ *
+ * The syntax is the common subset of PCRE that needs no backtracking:
+ * literals, ".", "[...]" classes and ranges, "^", "$", "\b", "\B", "\A",
+ * "\z", "*", "+", "?", "{n,m}", "|", "(...)", "(?:...)", and the escapes
+ * "\d", "\w", "\s", and their negations. The options are "i", "m", "s",
+ * and "x". Backreferences and lookaround are rejected.
+ *
+ * Each "." or negated class matches a whole UTF-8 character. Case-folding
+ * and the classes are ASCII only.
+ */
+
+
+/* the most instructions in a compiled regex, all patterns together */
+#define MONGOC_MATCHER_REGEX_MAX_INSTS 65536
+
+/* the most deeply nested groups, and the largest count in {n,m} */
+#define MONGOC_MATCHER_REGEX_MAX_DEPTH 256
+#define MONGOC_MATCHER_REGEX_MAX_REPEAT 1000
+
+/* programs this small match with scratch space on the stack */
+#define MONGOC_MATCHER_REGEX_INLINE_INSTS 128
+
+
+typedef enum {
+   MONGOC_REGEX_OP_BYTE,  /* arg: the byte */
+   MONGOC_REGEX_OP_CLASS, /* arg: the index of the class's bitmap */
+   MONGOC_REGEX_OP_BOL,   /* arg: 1 if multiline */
+   MONGOC_REGEX_OP_EOL,   /* arg: 1 if multiline, 2 for "\z" */
+   MONGOC_REGEX_OP_WORDB, /* arg: 1 for "\b", 0 for "\B" */
+   MONGOC_REGEX_OP_JMP,   /* to x */
+   MONGOC_REGEX_OP_SPLIT, /* to x and y */
+   MONGOC_REGEX_OP_MATCH,
+} mongoc_regex_opcode_t;
+
+
+/* jumps are relative to the instruction, so a compiled fragment can be
+ * moved or copied without fixing its jumps up */
+typedef struct {
+   mongoc_regex_opcode_t op;
+   uint32_t arg;
+   int32_t x;
+   int32_t y;
+} mongoc_regex_inst_t;
+
+
+typedef struct {
+   uint8_t bits[32];
+} mongoc_regex_class_t;
+
+
+typedef struct {
+   uint32_t pc;
+   bool anchored; /* starts with "^" outside multiline mode */
+} mongoc_regex_start_t;
+
+
+struct _mongoc_matcher_regex_t {
+   mongoc_array_t insts;   /* mongoc_regex_inst_t */
+   mongoc_array_t classes; /* mongoc_regex_class_t */
+   mongoc_array_t starts;  /* mongoc_regex_start_t, one per pattern */
+   bool all_anchored;
+};
+
+
+typedef struct {
+   mongoc_matcher_regex_t *regex;
+   const char *pattern;
+   const char *p;
+   bool icase;
+   bool multiline;
+   bool dotall;
+   bool extended;
+   int depth;
+   bson_error_t *error;
+} mongoc_regex_compiler_t;
+
+
+static bool
+_mongoc_regex_compile_alt (mongoc_regex_compiler_t *c);
+
+
+#define INST(_regex, _pc) \
+   (&_mongoc_array_index (&(_regex)->insts, mongoc_regex_inst_t, (_pc)))
+
+
+static void
+_mongoc_regex_class_set (mongoc_regex_class_t *cls, uint8_t b)
+{
+   cls->bits[b >> 3] |= (uint8_t) (1 << (b & 7));
+}
+
+
+static bool
+_mongoc_regex_class_has (const mongoc_regex_class_t *cls, uint8_t b)
+{
+   return (cls->bits[b >> 3] & (1 << (b & 7))) != 0;
+}
+
+
+static bool
+_mongoc_regex_is_word (uint8_t b)
+{
+   return (b >= 'a' && b <= 'z') || (b >= 'A' && b <= 'Z') ||
+          (b >= '0' && b <= '9') || b == '_';
+}
+
+
+static bool
+_mongoc_regex_is_space (uint8_t b)
+{
+   return b == ' ' || (b >= '\t' && b <= '\r');
+}
+
+
+static uint8_t
+_mongoc_regex_other_case (uint8_t b)
+{
+   if (b >= 'a' && b <= 'z') {
+      return (uint8_t) (b - 'a' + 'A');
+   }
+
+   if (b >= 'A' && b <= 'Z') {
+      return (uint8_t) (b - 'A' + 'a');
+   }
+
+   return b;
+}
+
+
+static bool
+_mongoc_regex_fail (mongoc_regex_compiler_t *c, const char *msg)
+{
+   bson_set_error (c->error,
+                   MONGOC_ERROR_MATCHER,
+                   MONGOC_ERROR_MATCHER_INVALID,
+                   "Invalid regular expression \"%s\": %s",
+                   c->pattern,
+                   msg);
+   return false;
+}
+
+
+static bool
+_mongoc_regex_emit (mongoc_regex_compiler_t *c,
+                    mongoc_regex_opcode_t op,
+                    uint32_t arg,
+                    int32_t x,
+                    int32_t y)
+{
+   mongoc_regex_inst_t inst;
+
+   if (c->regex->insts.len >= MONGOC_MATCHER_REGEX_MAX_INSTS) {
+      return _mongoc_regex_fail (c, "pattern is too large");
+   }
+
+   inst.op = op;
+   inst.arg = arg;
+   inst.x = x;
+   inst.y = y;
+   _mongoc_array_append_val (&c->regex->insts, inst);
+
+   return true;
+}
+
+
+/* insert a SPLIT at @pc, moving the fragment that starts there down */
+static bool
+_mongoc_regex_insert_split (mongoc_regex_compiler_t *c,
+                            size_t pc,
+                            int32_t x,
+                            int32_t y)
+{
+   mongoc_array_t *insts = &c->regex->insts;
+
+   if (!_mongoc_regex_emit (c, MONGOC_REGEX_OP_SPLIT, 0, x, y)) {
+      return false;
+   }
+
+   memmove (INST (c->regex, pc + 1),
+            INST (c->regex, pc),
+            (insts->len - 1 - pc) * sizeof (mongoc_regex_inst_t));
+   INST (c->regex, pc)->op = MONGOC_REGEX_OP_SPLIT;
+   INST (c->regex, pc)->arg = 0;
+   INST (c->regex, pc)->x = x;
+   INST (c->regex, pc)->y = y;
+
+   return true;
+}
+
+
+/* match a whole UTF-8 character if @cls matches its lead byte */
+static bool
+_mongoc_regex_emit_class (mongoc_regex_compiler_t *c,
+                          mongoc_regex_class_t *cls)
+{
+   bool multibyte = false;
+   int b;
+
+   for (b = 0x80; b <= 0xbf; b++) {
+      cls->bits[b >> 3] &= (uint8_t) ~(1 << (b & 7));
+   }
+
+   for (b = 0xc0; b <= 0xff; b++) {
+      multibyte = multibyte || _mongoc_regex_class_has (cls, (uint8_t) b);
+   }
+
+   _mongoc_array_append_val (&c->regex->classes, *cls);
+   if (!_mongoc_regex_emit (c,
+                            MONGOC_REGEX_OP_CLASS,
+                            (uint32_t) c->regex->classes.len - 1,
+                            0,
+                            0)) {
+      return false;
+   }
+
+   if (!multibyte) {
+      return true;
+   }
+
+   /* then any continuation bytes */
+   memset (cls, 0, sizeof *cls);
+   for (b = 0x80; b <= 0xbf; b++) {
+      _mongoc_regex_class_set (cls, (uint8_t) b);
+   }
+
+   _mongoc_array_append_val (&c->regex->classes, *cls);
+
+   return _mongoc_regex_emit (c, MONGOC_REGEX_OP_SPLIT, 0, 1, 3) &&
+          _mongoc_regex_emit (c,
+                              MONGOC_REGEX_OP_CLASS,
+                              (uint32_t) c->regex->classes.len - 1,
+                              0,
+                              0) &&
+          _mongoc_regex_emit (c, MONGOC_REGEX_OP_JMP, 0, -2, 0);
+}
+
+
+static bool
+_mongoc_regex_emit_byte (mongoc_regex_compiler_t *c, uint8_t b)
+{
+   mongoc_regex_class_t cls;
+
+   if (c->icase && _mongoc_regex_other_case (b) != b) {
+      memset (&cls, 0, sizeof cls);
+      _mongoc_regex_class_set (&cls, b);
+      _mongoc_regex_class_set (&cls, _mongoc_regex_other_case (b));
+      return _mongoc_regex_emit_class (c, &cls);
+   }
+
+   return _mongoc_regex_emit (c, MONGOC_REGEX_OP_BYTE, b, 0, 0);
+}
+
+
+/* add "\d", "\w", "\s" or their negations to @cls */
+static void
+_mongoc_regex_class_add_shorthand (mongoc_regex_class_t *cls, char type)
+{
+   int b;
+   bool in;
+
+   for (b = 0; b < 256; b++) {
+      switch (type) {
+      case 'd':
+      case 'D':
+         in = b >= '0' && b <= '9';
+         break;
+      case 'w':
+      case 'W':
+         in = _mongoc_regex_is_word ((uint8_t) b);
+         break;
+      default:
+         in = _mongoc_regex_is_space ((uint8_t) b);
+         break;
+      }
+
+      if (type == 'D' || type == 'W' || type == 'S') {
+         in = !in;
+      }
+
+      if (in) {
+         _mongoc_regex_class_set (cls, (uint8_t) b);
+      }
+   }
+}
+
+
+static int
+_mongoc_regex_hex (char ch)
+{
+   if (ch >= '0' && ch <= '9') {
+      return ch - '0';
+   }
+
+   if (ch >= 'a' && ch <= 'f') {
+      return ch - 'a' + 10;
+   }
+
+   if (ch >= 'A' && ch <= 'F') {
+      return ch - 'A' + 10;
+   }
+
+   return -1;
+}
+
+
+/*
+ * Parse the escape after a backslash at c->p that stands for one byte,
+ * such as "\n", "\x41", or "\.".
+ *
+ * Returns false if it isn't one.
+ */
+static bool
+_mongoc_regex_parse_escaped_byte (mongoc_regex_compiler_t *c, uint8_t *b)
+{
+   char ch = *c->p;
+   int hi;
+   int lo;
+
+   switch (ch) {
+   case 'n':
+      *b = '\n';
+      break;
+   case 't':
+      *b = '\t';
+      break;
+   case 'r':
+      *b = '\r';
+      break;
+   case 'f':
+      *b = '\f';
+      break;
+   case 'v':
+      *b = '\v';
+      break;
+   case 'e':
+      *b = 0x1b;
+      break;
+   case 'x':
+      if ((hi = _mongoc_regex_hex (c->p[1])) < 0 ||
+          (lo = _mongoc_regex_hex (c->p[2])) < 0) {
+         return false;
+      }
+
+      *b = (uint8_t) (hi * 16 + lo);
+      c->p += 3;
+      return true;
+   default:
+      /* an escaped punctuation character is itself */
+      if ((unsigned char) ch < 0x80 && ch >= ' ' &&
+          !_mongoc_regex_is_word ((uint8_t) ch)) {
+         *b = (uint8_t) ch;
+         break;
+      }
+
+      return false;
+   }
+
+   c->p++;
+   return true;
+}
+
+
+static bool
+_mongoc_regex_compile_class (mongoc_regex_compiler_t *c)
+{
+   mongoc_regex_class_t cls;
+   bool negate = false;
+   bool first = true;
+   uint8_t lo;
+   uint8_t hi;
+   int b;
+
+   memset (&cls, 0, sizeof cls);
+
+   /* past the "[" */
+   c->p++;
+   if (*c->p == '^') {
+      negate = true;
+      c->p++;
+   }
+
+   while (*c->p != ']' || first) {
+      first = false;
+
+      if (!*c->p) {
+         return _mongoc_regex_fail (c, "missing ]");
+      }
+
+      if (*c->p == '\\') {
+         c->p++;
+         if (*c->p && strchr ("dDwWsS", *c->p)) {
+            _mongoc_regex_class_add_shorthand (&cls, *c->p);
+            c->p++;
+            continue;
+         }
+
+         if (*c->p == 'b') {
+            /* a backspace inside a class */
+            lo = '\b';
+            c->p++;
+         } else if (!_mongoc_regex_parse_escaped_byte (c, &lo)) {
+            return _mongoc_regex_fail (c, "unsupported escape in class");
+         }
+      } else if ((unsigned char) *c->p >= 0x80) {
+         return _mongoc_regex_fail (c, "non-ASCII character in class");
+      } else {
+         lo = (uint8_t) *c->p++;
+      }
+
+      hi = lo;
+
+      if (c->p[0] == '-' && c->p[1] && c->p[1] != ']') {
+         c->p++;
+         if (*c->p == '\\') {
+            c->p++;
+            if (!_mongoc_regex_parse_escaped_byte (c, &hi)) {
+               return _mongoc_regex_fail (c, "unsupported escape in class");
+            }
+         } else if ((unsigned char) *c->p >= 0x80) {
+            return _mongoc_regex_fail (c, "non-ASCII character in class");
+         } else {
+            hi = (uint8_t) *c->p++;
+         }
+
+         if (hi < lo) {
+            return _mongoc_regex_fail (c, "range out of order in class");
+         }
+      }
+
+      for (b = lo; b <= hi; b++) {
+         _mongoc_regex_class_set (&cls, (uint8_t) b);
+         if (c->icase) {
+            _mongoc_regex_class_set (&cls,
+                                     _mongoc_regex_other_case ((uint8_t) b));
+         }
+      }
+   }
+
+   /* past the "]" */
+   c->p++;
+
+   if (negate) {
+      for (b = 0; b < 32; b++) {
+         cls.bits[b] = (uint8_t) ~cls.bits[b];
+      }
+   }
+
+   return _mongoc_regex_emit_class (c, &cls);
+}
+
+
+/* in extended mode, skip whitespace and comments between tokens */
+static void
+_mongoc_regex_skip_extended (mongoc_regex_compiler_t *c)
+{
+   if (!c->extended) {
+      return;
+   }
+
+   for (;;) {
+      if (_mongoc_regex_is_space ((uint8_t) *c->p)) {
+         c->p++;
+      } else if (*c->p == '#') {
+         while (*c->p && *c->p != '\n') {
+            c->p++;
+         }
+      } else {
+         return;
+      }
+   }
+}
+
+
+/*
+ * Compile one atom at c->p.
+ *
+ * Returns false and sets the error on failure. @repeatable is set false
+ * for assertions, which can't be quantified.
+ */
+static bool
+_mongoc_regex_compile_atom (mongoc_regex_compiler_t *c, bool *repeatable)
+{
+   mongoc_regex_class_t cls;
+   const char *start;
+   uint8_t b;
+   int n;
+   int i;
+
+   *repeatable = true;
+
+   switch (*c->p) {
+   case '(':
+      c->p++;
+      if (c->p[0] == '?') {
+         if (c->p[1] != ':') {
+            return _mongoc_regex_fail (c, "unsupported group");
+         }
+
+         c->p += 2;
+      }
+
+      if (++c->depth > MONGOC_MATCHER_REGEX_MAX_DEPTH) {
+         return _mongoc_regex_fail (c, "groups are nested too deeply");
+      }
+
+      if (!_mongoc_regex_compile_alt (c)) {
+         return false;
+      }
+
+      c->depth--;
+
+      if (*c->p != ')') {
+         return _mongoc_regex_fail (c, "missing )");
+      }
+
+      c->p++;
+      return true;
+
+   case '[':
+      return _mongoc_regex_compile_class (c);
+
+   case '.':
+      c->p++;
+      memset (&cls, 0xff, sizeof cls);
+      if (!c->dotall) {
+         cls.bits['\n' >> 3] &= (uint8_t) ~(1 << ('\n' & 7));
+      }
+
+      return _mongoc_regex_emit_class (c, &cls);
+
+   case '^':
+      c->p++;
+      *repeatable = false;
+      return _mongoc_regex_emit (
+         c, MONGOC_REGEX_OP_BOL, c->multiline ? 1 : 0, 0, 0);
+
+   case '$':
+      c->p++;
+      *repeatable = false;
+      return _mongoc_regex_emit (
+         c, MONGOC_REGEX_OP_EOL, c->multiline ? 1 : 0, 0, 0);
+
+   case '*':
+   case '+':
+   case '?':
+      return _mongoc_regex_fail (c, "nothing to repeat");
+
+   case '\\':
+      c->p++;
+      switch (*c->p) {
+      case 'd':
+      case 'D':
+      case 'w':
+      case 'W':
+      case 's':
+      case 'S':
+         memset (&cls, 0, sizeof cls);
+         _mongoc_regex_class_add_shorthand (&cls, *c->p);
+         c->p++;
+         return _mongoc_regex_emit_class (c, &cls);
+      case 'b':
+      case 'B':
+         *repeatable = false;
+         return _mongoc_regex_emit (
+            c, MONGOC_REGEX_OP_WORDB, *c->p++ == 'b' ? 1 : 0, 0, 0);
+      case 'A':
+         c->p++;
+         *repeatable = false;
+         return _mongoc_regex_emit (c, MONGOC_REGEX_OP_BOL, 0, 0, 0);
+      case 'z':
+         c->p++;
+         *repeatable = false;
+         return _mongoc_regex_emit (c, MONGOC_REGEX_OP_EOL, 2, 0, 0);
+      default:
+         if (!_mongoc_regex_parse_escaped_byte (c, &b)) {
+            return _mongoc_regex_fail (c, "unsupported escape");
+         }
+
+         return _mongoc_regex_emit_byte (c, b);
+      }
+
+   default:
+      /* a literal, a multibyte UTF-8 character is quantified as a whole */
+      start = c->p;
+      b = (uint8_t) *c->p;
+      n = b < 0xc0 ? 1 : b < 0xe0 ? 2 : b < 0xf0 ? 3 : 4;
+      for (i = 0; i < n; i++) {
+         if (!start[i]) {
+            return _mongoc_regex_fail (c, "invalid UTF-8");
+         }
+
+         if (!_mongoc_regex_emit_byte (c, (uint8_t) start[i])) {
+            return false;
+         }
+      }
+
+      c->p += n;
+      return true;
+   }
+}
+
+
+/* parse "{n}", "{n,}", or "{n,m}" at c->p, else it's a literal "{" */
+static bool
+_mongoc_regex_parse_count (mongoc_regex_compiler_t *c, int *min, int *max)
+{
+   const char *p = c->p + 1;
+   char *end;
+   long n;
+   long m;
+
+   if (*p < '0' || *p > '9') {
+      return false;
+   }
+
+   n = strtol (p, &end, 10);
+   p = end;
+
+   if (*p == '}') {
+      m = n;
+   } else if (*p == ',' && p[1] == '}') {
+      m = -1;
+      p++;
+   } else if (*p == ',' && p[1] >= '0' && p[1] <= '9') {
+      m = strtol (p + 1, &end, 10);
+      p = end;
+      if (*p != '}') {
+         return false;
+      }
+   } else {
+      return false;
+   }
+
+   if (n > MONGOC_MATCHER_REGEX_MAX_REPEAT ||
+       m > MONGOC_MATCHER_REGEX_MAX_REPEAT || (m >= 0 && m < n)) {
+      return false;
+   }
+
+   *min = (int) n;
+   *max = (int) m;
+   c->p = p + 1;
+
+   return true;
+}
+
+
+/* make the fragment from @pc to the end optional */
+static bool
+_mongoc_regex_quest (mongoc_regex_compiler_t *c, size_t pc)
+{
+   int32_t len = (int32_t) (c->regex->insts.len - pc);
+
+   return _mongoc_regex_insert_split (c, pc, 1, len + 1);
+}
+
+
+/* repeat the fragment from @pc to the end zero or more times */
+static bool
+_mongoc_regex_star (mongoc_regex_compiler_t *c, size_t pc)
+{
+   int32_t len = (int32_t) (c->regex->insts.len - pc);
+
+   /* SPLIT, fragment, JMP back to the SPLIT */
+   return _mongoc_regex_insert_split (c, pc, 1, len + 2) &&
+          _mongoc_regex_emit (c, MONGOC_REGEX_OP_JMP, 0, -(len + 1), 0);
+}
+
+
+static bool
+_mongoc_regex_repeat (mongoc_regex_compiler_t *c, size_t pc, int min, int max)
+{
+   mongoc_regex_inst_t *frag;
+   size_t frag_len;
+   size_t start;
+   bool ret = false;
+   int i;
+
+   frag_len = c->regex->insts.len - pc;
+   frag = (mongoc_regex_inst_t *) bson_malloc (
+      (frag_len ? frag_len : 1) * sizeof (mongoc_regex_inst_t));
+   memcpy (frag, INST (c->regex, pc), frag_len * sizeof *frag);
+   c->regex->insts.len = pc;
+
+   for (i = 0; i < min || (max < 0 && i == min) || i < max; i++) {
+      if (c->regex->insts.len + frag_len > MONGOC_MATCHER_REGEX_MAX_INSTS) {
+         _mongoc_regex_fail (c, "pattern is too large");
+         goto done;
+      }
+
+      start = c->regex->insts.len;
+      _mongoc_array_append_vals (&c->regex->insts, frag, (uint32_t) frag_len);
+
+      if (i >= min) {
+         if (max < 0 ? !_mongoc_regex_star (c, start)
+                     : !_mongoc_regex_quest (c, start)) {
+            goto done;
+         }
+      }
+   }
+
+   ret = true;
+
+done:
+   bson_free (frag);
+   return ret;
+}
+
+
+static bool
+_mongoc_regex_compile_repeat (mongoc_regex_compiler_t *c)
+{
+   size_t pc = c->regex->insts.len;
+   bool repeatable;
+   char quantifier;
+   int min;
+   int max;
+
+   if (!_mongoc_regex_compile_atom (c, &repeatable)) {
+      return false;
+   }
+
+   _mongoc_regex_skip_extended (c);
+
+   quantifier = *c->p;
+   switch (quantifier) {
+   case '*':
+   case '+':
+   case '?':
+      c->p++;
+      break;
+   case '{':
+      if (!_mongoc_regex_parse_count (c, &min, &max)) {
+         /* a literal "{" */
+         return true;
+      }
+      break;
+   default:
+      return true;
+   }
+
+   if (!repeatable) {
+      return _mongoc_regex_fail (c, "nothing to repeat");
+   }
+
+   switch (quantifier) {
+   case '*':
+      if (!_mongoc_regex_star (c, pc)) {
+         return false;
+      }
+      break;
+   case '+':
+      if (!_mongoc_regex_emit (c,
+                               MONGOC_REGEX_OP_SPLIT,
+                               0,
+                               -(int32_t) (c->regex->insts.len - pc),
+                               1)) {
+         return false;
+      }
+      break;
+   case '?':
+      if (!_mongoc_regex_quest (c, pc)) {
+         return false;
+      }
+      break;
+   default:
+      /* c->p is already past "{n,m}" */
+      if (!_mongoc_regex_repeat (c, pc, min, max)) {
+         return false;
+      }
+      break;
+   }
+
+   /* laziness doesn't change whether a string matches */
+   if (*c->p == '?') {
+      c->p++;
+   }
+
+   _mongoc_regex_skip_extended (c);
+   if (*c->p == '*' || *c->p == '+' || *c->p == '?') {
+      return _mongoc_regex_fail (c, "nothing to repeat");
+   }
+
+   return true;
+}
+
+
+static bool
+_mongoc_regex_compile_concat (mongoc_regex_compiler_t *c)
+{
+   for (;;) {
+      _mongoc_regex_skip_extended (c);
+
+      if (!*c->p || *c->p == '|' || *c->p == ')') {
+         return true;
+      }
+
+      if (!_mongoc_regex_compile_repeat (c)) {
+         return false;
+      }
+   }
+}
+
+
+static bool
+_mongoc_regex_compile_alt (mongoc_regex_compiler_t *c)
+{
+   mongoc_array_t jmps;
+   size_t start;
+   size_t jmp;
+   size_t end;
+   size_t i;
+   bool ret = false;
+
+   _mongoc_array_init (&jmps, sizeof (size_t));
+
+   start = c->regex->insts.len;
+   if (!_mongoc_regex_compile_concat (c)) {
+      goto done;
+   }
+
+   while (*c->p == '|') {
+      c->p++;
+
+      /* SPLIT to this branch and the next, this branch JMPs to the end */
+      if (!_mongoc_regex_insert_split (c, start, 1, 0)) {
+         goto done;
+      }
+
+      jmp = c->regex->insts.len;
+      if (!_mongoc_regex_emit (c, MONGOC_REGEX_OP_JMP, 0, 0, 0)) {
+         goto done;
+      }
+
+      _mongoc_array_append_val (&jmps, jmp);
+      INST (c->regex, start)->y = (int32_t) (jmp + 1 - start);
+
+      start = c->regex->insts.len;
+      if (!_mongoc_regex_compile_concat (c)) {
+         goto done;
+      }
+   }
+
+   end = c->regex->insts.len;
+   for (i = 0; i < jmps.len; i++) {
+      jmp = _mongoc_array_index (&jmps, size_t, i);
+      INST (c->regex, jmp)->x = (int32_t) (end - jmp);
+   }
+
+   ret = true;
+
+done:
+   _mongoc_array_destroy (&jmps);
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_regex_new --
+ *
+ *       Create an empty regex that matches nothing until patterns are
+ *       added with _mongoc_matcher_regex_add.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_matcher_regex_t *
+_mongoc_matcher_regex_new (void)
+{
+   mongoc_matcher_regex_t *regex;
+
+   regex = (mongoc_matcher_regex_t *) bson_malloc0 (sizeof *regex);
+   _mongoc_array_init (&regex->insts, sizeof (mongoc_regex_inst_t));
+   _mongoc_array_init (&regex->classes, sizeof (mongoc_regex_class_t));
+   _mongoc_array_init (&regex->starts, sizeof (mongoc_regex_start_t));
+   regex->all_anchored = true;
+
+   return regex;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_regex_add --
+ *
+ *       Compile @pattern with the $options letters in @options into
+ *       @regex, which then matches a string if any of its patterns does.
+ *
+ * Returns:
+ *       true if successful, otherwise false, @error is set, and @regex
+ *       is unchanged.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_matcher_regex_add (mongoc_matcher_regex_t *regex, /* IN */
+                           const char *pattern,           /* IN */
+                           const char *options,           /* IN */
+                           bson_error_t *error)           /* OUT */
+{
+   mongoc_regex_compiler_t c;
+   mongoc_regex_start_t start;
+   mongoc_regex_inst_t *first;
+   size_t n_insts;
+   size_t n_classes;
+   const char *o;
+
+   BSON_ASSERT (regex);
+   BSON_ASSERT (pattern);
+
+   memset (&c, 0, sizeof c);
+   c.regex = regex;
+   c.pattern = pattern;
+   c.p = pattern;
+   c.error = error;
+
+   for (o = options ? options : ""; *o; o++) {
+      switch (*o) {
+      case 'i':
+         c.icase = true;
+         break;
+      case 'm':
+         c.multiline = true;
+         break;
+      case 's':
+         c.dotall = true;
+         break;
+      case 'x':
+         c.extended = true;
+         break;
+      default:
+         bson_set_error (error,
+                         MONGOC_ERROR_MATCHER,
+                         MONGOC_ERROR_MATCHER_INVALID,
+                         "Invalid regular expression option '%c'",
+                         *o);
+         return false;
+      }
+   }
+
+   n_insts = regex->insts.len;
+   n_classes = regex->classes.len;
+
+   if (!_mongoc_regex_compile_alt (&c) ||
+       (*c.p == ')' && !_mongoc_regex_fail (&c, "unmatched )")) ||
+       !_mongoc_regex_emit (&c, MONGOC_REGEX_OP_MATCH, 0, 0, 0)) {
+      regex->insts.len = n_insts;
+      regex->classes.len = n_classes;
+      return false;
+   }
+
+   first = INST (regex, n_insts);
+   start.pc = (uint32_t) n_insts;
+   start.anchored = first->op == MONGOC_REGEX_OP_BOL && first->arg == 0;
+   _mongoc_array_append_val (&regex->starts, start);
+   regex->all_anchored = regex->all_anchored && start.anchored;
+
+   return true;
+}
+
+
+uint32_t
+_mongoc_matcher_regex_n_patterns (const mongoc_matcher_regex_t *regex)
+{
+   return (uint32_t) regex->starts.len;
+}
+
+
+typedef struct {
+   const mongoc_matcher_regex_t *regex;
+   const uint8_t *str;
+   uint32_t len;
+   uint32_t *marks; /* the generation each instruction was last added in */
+   uint32_t *stack;
+   uint32_t gen;
+} mongoc_regex_run_t;
+
+
+static bool
+_mongoc_regex_assert (const mongoc_regex_run_t *run,
+                      const mongoc_regex_inst_t *inst,
+                      uint32_t pos)
+{
+   bool before;
+   bool after;
+
+   switch (inst->op) {
+   case MONGOC_REGEX_OP_BOL:
+      return pos == 0 || (inst->arg == 1 && run->str[pos - 1] == '\n');
+   case MONGOC_REGEX_OP_EOL:
+      if (pos == run->len) {
+         return true;
+      }
+
+      if (inst->arg == 1) {
+         return run->str[pos] == '\n';
+      }
+
+      /* like PCRE, "$" also matches before a final newline */
+      return inst->arg == 0 && pos + 1 == run->len && run->str[pos] == '\n';
+   default:
+      before = pos > 0 && _mongoc_regex_is_word (run->str[pos - 1]);
+      after = pos < run->len && _mongoc_regex_is_word (run->str[pos]);
+      return (before != after) == (inst->arg == 1);
+   }
+}
+
+
+/*
+ * Add the instruction at @pc to @list for position @pos, following jumps
+ * and checking assertions.
+ *
+ * Returns true if a pattern matched.
+ */
+static bool
+_mongoc_regex_run_add (mongoc_regex_run_t *run,
+                       uint32_t *list,
+                       uint32_t *n_list,
+                       uint32_t pc,
+                       uint32_t pos)
+{
+   const mongoc_regex_inst_t *inst;
+   uint32_t n_stack = 0;
+
+   run->stack[n_stack++] = pc;
+
+   while (n_stack) {
+      pc = run->stack[--n_stack];
+      if (run->marks[pc] == run->gen) {
+         continue;
+      }
+
+      run->marks[pc] = run->gen;
+      inst = INST (run->regex, pc);
+
+      switch (inst->op) {
+      case MONGOC_REGEX_OP_JMP:
+         run->stack[n_stack++] = (uint32_t) ((int32_t) pc + inst->x);
+         break;
+      case MONGOC_REGEX_OP_SPLIT:
+         run->stack[n_stack++] = (uint32_t) ((int32_t) pc + inst->y);
+         run->stack[n_stack++] = (uint32_t) ((int32_t) pc + inst->x);
+         break;
+      case MONGOC_REGEX_OP_BOL:
+      case MONGOC_REGEX_OP_EOL:
+      case MONGOC_REGEX_OP_WORDB:
+         if (_mongoc_regex_assert (run, inst, pos)) {
+            run->stack[n_stack++] = pc + 1;
+         }
+         break;
+      case MONGOC_REGEX_OP_MATCH:
+         return true;
+      default:
+         list[(*n_list)++] = pc;
+         break;
+      }
+   }
+
+   return false;
+}
+
+
+/* start each pattern at @pos, the anchored ones only at the beginning */
+static bool
+_mongoc_regex_run_start (mongoc_regex_run_t *run,
+                         uint32_t *list,
+                         uint32_t *n_list,
+                         uint32_t pos)
+{
+   const mongoc_regex_start_t *start;
+   size_t i;
+
+   for (i = 0; i < run->regex->starts.len; i++) {
+      start =
+         &_mongoc_array_index (&run->regex->starts, mongoc_regex_start_t, i);
+      if ((pos == 0 || !start->anchored) &&
+          _mongoc_regex_run_add (run, list, n_list, start->pc, pos)) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_regex_match --
+ *
+ *       Check whether any of @regex's patterns matches somewhere in the
+ *       @len bytes at @str, scanning them once for all the patterns.
+ *
+ * Returns:
+ *       true if a pattern matched.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_matcher_regex_match (const mongoc_matcher_regex_t *regex, /* IN */
+                             const char *str,                     /* IN */
+                             uint32_t len)                        /* IN */
+{
+   uint32_t inline_scratch[MONGOC_MATCHER_REGEX_INLINE_INSTS * 5 + 1];
+   mongoc_regex_run_t run;
+   const mongoc_regex_inst_t *inst;
+   uint32_t *scratch;
+   uint32_t *clist;
+   uint32_t *nlist;
+   uint32_t *tmp;
+   uint32_t n_clist = 0;
+   uint32_t n_nlist;
+   uint32_t n_insts;
+   uint32_t pos;
+   uint32_t i;
+   uint8_t b;
+   bool matched = false;
+
+   BSON_ASSERT (regex);
+   BSON_ASSERT (str || !len);
+
+   n_insts = (uint32_t) regex->insts.len;
+   if (!n_insts) {
+      return false;
+   }
+
+   /* marks, two thread lists, and a stack of at most two per instruction */
+   if (n_insts <= MONGOC_MATCHER_REGEX_INLINE_INSTS) {
+      scratch = inline_scratch;
+   } else {
+      scratch = (uint32_t *) bson_malloc (sizeof (uint32_t) *
+                                          (n_insts * 5 + 1));
+   }
+
+   run.regex = regex;
+   run.str = (const uint8_t *) str;
+   run.len = len;
+   run.marks = scratch;
+   run.stack = scratch + n_insts * 3;
+   run.gen = 1;
+   memset (run.marks, 0, sizeof (uint32_t) * n_insts);
+   clist = scratch + n_insts;
+   nlist = scratch + n_insts * 2;
+
+   if (_mongoc_regex_run_start (&run, clist, &n_clist, 0)) {
+      matched = true;
+      goto done;
+   }
+
+   for (pos = 0; pos < len; pos++) {
+      if (!n_clist && regex->all_anchored) {
+         break;
+      }
+
+      b = run.str[pos];
+      run.gen++;
+      n_nlist = 0;
+
+      for (i = 0; i < n_clist; i++) {
+         inst = INST (regex, clist[i]);
+         if (inst->op == MONGOC_REGEX_OP_BYTE
+                ? inst->arg == b
+                : _mongoc_regex_class_has (
+                     &_mongoc_array_index (
+                        &regex->classes, mongoc_regex_class_t, inst->arg),
+                     b)) {
+            if (_mongoc_regex_run_add (
+                   &run, nlist, &n_nlist, clist[i] + 1, pos + 1)) {
+               matched = true;
+               goto done;
+            }
+         }
+      }
+
+      if (_mongoc_regex_run_start (&run, nlist, &n_nlist, pos + 1)) {
+         matched = true;
+         goto done;
+      }
+
+      tmp = clist;
+      clist = nlist;
+      nlist = tmp;
+      n_clist = n_nlist;
+   }
+
+done:
+   if (scratch != inline_scratch) {
+      bson_free (scratch);
+   }
+
+   return matched;
+}
+
+
+void
+_mongoc_matcher_regex_destroy (mongoc_matcher_regex_t *regex)
+{
+   if (regex) {
+      _mongoc_array_destroy (&regex->insts);
+      _mongoc_array_destroy (&regex->classes);
+      _mongoc_array_destroy (&regex->starts);
+      bson_free (regex);
+   }
+}
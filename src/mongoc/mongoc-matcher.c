@@ -30,12 +30,79 @@ _mongoc_matcher_parse_logical (mongoc_matcher_opcode_t opcode,
                                bson_error_t *error);
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_parse_regex --
+ *
+ *       Parse {$regex: "pattern", $options: "options"} at @iter, in
+ *       either order. The $regex may also be a BSON regular expression,
+ *       whose options are used unless $options is given.
+ *
+ * Returns:
+ *       A newly allocated mongoc_matcher_op_t if successful; otherwise
+ *       NULL and @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_matcher_op_t *
+_mongoc_matcher_parse_regex (bson_iter_t *iter,   /* IN */
+                             const char *path,    /* IN */
+                             bson_error_t *error) /* OUT */
+{
+   const char *pattern = NULL;
+   const char *options = NULL;
+   const char *regex_options = NULL;
+   bson_iter_t child;
+
+   bson_iter_recurse (iter, &child);
+
+   while (bson_iter_next (&child)) {
+      if (strcmp (bson_iter_key (&child), "$regex") == 0) {
+         if (BSON_ITER_HOLDS_UTF8 (&child)) {
+            pattern = bson_iter_utf8 (&child, NULL);
+         } else if (BSON_ITER_HOLDS_REGEX (&child)) {
+            pattern = bson_iter_regex (&child, &regex_options);
+         } else {
+            bson_set_error (error,
+                            MONGOC_ERROR_MATCHER,
+                            MONGOC_ERROR_MATCHER_INVALID,
+                            "$regex must be a string or regular expression");
+            return NULL;
+         }
+      } else if (strcmp (bson_iter_key (&child), "$options") == 0) {
+         if (!BSON_ITER_HOLDS_UTF8 (&child)) {
+            bson_set_error (error,
+                            MONGOC_ERROR_MATCHER,
+                            MONGOC_ERROR_MATCHER_INVALID,
+                            "$options must be a string");
+            return NULL;
+         }
+
+         options = bson_iter_utf8 (&child, NULL);
+      }
+   }
+
+   if (!pattern) {
+      bson_set_error (error,
+                      MONGOC_ERROR_MATCHER,
+                      MONGOC_ERROR_MATCHER_INVALID,
+                      "$options needs a $regex");
+      return NULL;
+   }
+
+   return _mongoc_matcher_op_regex_new (
+      path, pattern, options ? options : regex_options, error);
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
  * _mongoc_matcher_parse_compare --
  *
- *       Parse a compare spec such as $gt or $in.
+ *       Parse a compare spec such as $gt, $in, or $regex.
  *
  *       See the following link for more information.
  *
@@ -57,6 +124,8 @@ _mongoc_matcher_parse_compare (bson_iter_t *iter,   /* IN */
                                bson_error_t *error) /* OUT */
 {
    const char *key;
+   const char *pattern;
+   const char *options;
    mongoc_matcher_op_t *op = NULL, *op_child;
    bson_iter_t child;
 
@@ -76,7 +145,7 @@ _mongoc_matcher_parse_compare (bson_iter_t *iter,   /* IN */
 
       if (key[0] != '$') {
          op = _mongoc_matcher_op_compare_new (
-            MONGOC_MATCHER_OPCODE_EQ, path, iter);
+            MONGOC_MATCHER_OPCODE_EQ, path, iter, error);
       } else if (strcmp (key, "$not") == 0) {
          if (!(op_child =
                   _mongoc_matcher_parse_compare (&child, path, error))) {
@@ -85,29 +154,32 @@ _mongoc_matcher_parse_compare (bson_iter_t *iter,   /* IN */
          op = _mongoc_matcher_op_not_new (path, op_child);
       } else if (strcmp (key, "$gt") == 0) {
          op = _mongoc_matcher_op_compare_new (
-            MONGOC_MATCHER_OPCODE_GT, path, &child);
+            MONGOC_MATCHER_OPCODE_GT, path, &child, error);
       } else if (strcmp (key, "$gte") == 0) {
          op = _mongoc_matcher_op_compare_new (
-            MONGOC_MATCHER_OPCODE_GTE, path, &child);
+            MONGOC_MATCHER_OPCODE_GTE, path, &child, error);
       } else if (strcmp (key, "$in") == 0) {
          op = _mongoc_matcher_op_compare_new (
-            MONGOC_MATCHER_OPCODE_IN, path, &child);
+            MONGOC_MATCHER_OPCODE_IN, path, &child, error);
       } else if (strcmp (key, "$lt") == 0) {
          op = _mongoc_matcher_op_compare_new (
-            MONGOC_MATCHER_OPCODE_LT, path, &child);
+            MONGOC_MATCHER_OPCODE_LT, path, &child, error);
       } else if (strcmp (key, "$lte") == 0) {
          op = _mongoc_matcher_op_compare_new (
-            MONGOC_MATCHER_OPCODE_LTE, path, &child);
+            MONGOC_MATCHER_OPCODE_LTE, path, &child, error);
       } else if (strcmp (key, "$ne") == 0) {
          op = _mongoc_matcher_op_compare_new (
-            MONGOC_MATCHER_OPCODE_NE, path, &child);
+            MONGOC_MATCHER_OPCODE_NE, path, &child, error);
       } else if (strcmp (key, "$nin") == 0) {
          op = _mongoc_matcher_op_compare_new (
-            MONGOC_MATCHER_OPCODE_NIN, path, &child);
+            MONGOC_MATCHER_OPCODE_NIN, path, &child, error);
       } else if (strcmp (key, "$exists") == 0) {
          op = _mongoc_matcher_op_exists_new (path, bson_iter_bool (&child));
       } else if (strcmp (key, "$type") == 0) {
          op = _mongoc_matcher_op_type_new (path, bson_iter_type (&child));
+      } else if (strcmp (key, "$regex") == 0 ||
+                 strcmp (key, "$options") == 0) {
+         op = _mongoc_matcher_parse_regex (iter, path, error);
       } else {
          bson_set_error (error,
                          MONGOC_ERROR_MATCHER,
@@ -116,13 +188,14 @@ _mongoc_matcher_parse_compare (bson_iter_t *iter,   /* IN */
                          key);
          return NULL;
       }
+   } else if (bson_iter_type (iter) == BSON_TYPE_REGEX) {
+      pattern = bson_iter_regex (iter, &options);
+      op = _mongoc_matcher_op_regex_new (path, pattern, options, error);
    } else {
-      op =
-         _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_EQ, path, iter);
+      op = _mongoc_matcher_op_compare_new (
+         MONGOC_MATCHER_OPCODE_EQ, path, iter, error);
    }
 
-   BSON_ASSERT (op);
-
    return op;
 }
 
@@ -224,6 +297,7 @@ _mongoc_matcher_parse_logical (mongoc_matcher_opcode_t opcode, /* IN */
    mongoc_matcher_op_t *more;
    mongoc_matcher_op_t *more_wrap;
    bson_iter_t child;
+   bson_iter_t next;
 
    BSON_ASSERT (opcode);
    BSON_ASSERT (iter);
@@ -264,6 +338,7 @@ _mongoc_matcher_parse_logical (mongoc_matcher_opcode_t opcode, /* IN */
 
    if (is_root) {
       if (!(right = _mongoc_matcher_parse (iter, error))) {
+         _mongoc_matcher_op_destroy (left);
          return NULL;
       }
    } else {
@@ -272,6 +347,7 @@ _mongoc_matcher_parse_logical (mongoc_matcher_opcode_t opcode, /* IN */
                          MONGOC_ERROR_MATCHER,
                          MONGOC_ERROR_MATCHER_INVALID,
                          "Expected document in value.");
+         _mongoc_matcher_op_destroy (left);
          return NULL;
       }
 
@@ -279,18 +355,25 @@ _mongoc_matcher_parse_logical (mongoc_matcher_opcode_t opcode, /* IN */
       bson_iter_next (&child);
 
       if (!(right = _mongoc_matcher_parse (&child, error))) {
+         _mongoc_matcher_op_destroy (left);
          return NULL;
       }
    }
 
-   more = _mongoc_matcher_parse_logical (opcode, iter, is_root, error);
+   /* an invalid operand after the second fails the whole spec */
+   memcpy (&next, iter, sizeof next);
+   if (!bson_iter_next (&next)) {
+      return _mongoc_matcher_op_logical_new (opcode, left, right);
+   }
 
-   if (more) {
-      more_wrap = _mongoc_matcher_op_logical_new (opcode, right, more);
-      return _mongoc_matcher_op_logical_new (opcode, left, more_wrap);
+   if (!(more = _mongoc_matcher_parse_logical (opcode, iter, is_root, error))) {
+      _mongoc_matcher_op_destroy (left);
+      _mongoc_matcher_op_destroy (right);
+      return NULL;
    }
 
-   return _mongoc_matcher_op_logical_new (opcode, left, right);
+   more_wrap = _mongoc_matcher_op_logical_new (opcode, right, more);
+   return _mongoc_matcher_op_logical_new (opcode, left, more_wrap);
 }
 
 
@@ -303,7 +386,9 @@ _mongoc_matcher_parse_logical (mongoc_matcher_opcode_t opcode, /* IN */
  *       provided in @query.
  *
  *       This will build an operation tree that can be applied to arbitrary
- *       bson documents using mongoc_matcher_match().
+ *       bson documents using mongoc_matcher_match(). Paths are split and
+ *       spec values decoded once here, and cheap operands of $and and $or
+ *       are moved ahead of expensive ones.
  *
  * Returns:
  *       A newly allocated mongoc_matcher_t if successful; otherwise NULL
@@ -340,6 +425,7 @@ mongoc_matcher_new (const bson_t *query, /* IN */
       goto failure;
    }
 
+   _mongoc_matcher_op_reorder (op);
    matcher->optree = op;
 
    return matcher;
@@ -380,6 +466,77 @@ mongoc_matcher_match (const mongoc_matcher_t *matcher, /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_matcher_match_batch --
+ *
+ *       Read up to @max_documents documents from @reader, such as a
+ *       reader over a cursor batch or an exported file, and check each
+ *       against the query specified when creating @matcher.
+ *
+ *       @matches must have room for @max_documents indexes. The index of
+ *       each matching document, counting from zero at the first document
+ *       read by this call, is stored in order.
+ *
+ * Returns:
+ *       true if the documents were read, otherwise false and @error is
+ *       set. @n_documents is fewer than @max_documents at the end of
+ *       @reader's data.
+ *
+ * Side effects:
+ *       @n_documents, @matches, and @n_matches are set, even on error,
+ *       for the documents read before the invalid one.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_matcher_match_batch (const mongoc_matcher_t *matcher, /* IN */
+                            bson_reader_t *reader,           /* IN */
+                            uint32_t max_documents,          /* IN */
+                            uint32_t *n_documents,           /* OUT */
+                            uint32_t *matches,               /* OUT */
+                            uint32_t *n_matches,             /* OUT */
+                            bson_error_t *error)             /* OUT */
+{
+   const bson_t *document;
+   bool eof = false;
+   uint32_t i;
+   uint32_t n = 0;
+
+   BSON_ASSERT (matcher);
+   BSON_ASSERT (matcher->optree);
+   BSON_ASSERT (reader);
+   BSON_ASSERT (n_documents);
+   BSON_ASSERT (matches || !max_documents);
+   BSON_ASSERT (n_matches);
+
+   for (i = 0; i < max_documents; i++) {
+      if (!(document = bson_reader_read (reader, &eof))) {
+         break;
+      }
+
+      if (_mongoc_matcher_op_match (matcher->optree, document)) {
+         matches[n++] = i;
+      }
+   }
+
+   *n_documents = i;
+   *n_matches = n;
+
+   if (i < max_documents && !eof) {
+      bson_set_error (error,
+                      MONGOC_ERROR_BSON,
+                      MONGOC_ERROR_BSON_INVALID,
+                      "Invalid BSON document at index %" PRIu32,
+                      i);
+      return false;
+   }
+
+   return true;
+}
+
 /*
  *--------------------------------------------------------------------------
  *
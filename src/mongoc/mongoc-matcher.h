@@ -37,6 +37,14 @@ mongoc_matcher_new (const bson_t *query,
 MONGOC_EXPORT (bool)
 mongoc_matcher_match (const mongoc_matcher_t *matcher,
                       const bson_t *document) BSON_GNUC_DEPRECATED;
+MONGOC_EXPORT (bool)
+mongoc_matcher_match_batch (const mongoc_matcher_t *matcher,
+                            bson_reader_t *reader,
+                            uint32_t max_documents,
+                            uint32_t *n_documents,
+                            uint32_t *matches,
+                            uint32_t *n_matches,
+                            bson_error_t *error) BSON_GNUC_DEPRECATED;
 MONGOC_EXPORT (void)
 mongoc_matcher_destroy (mongoc_matcher_t *matcher) BSON_GNUC_DEPRECATED;
 
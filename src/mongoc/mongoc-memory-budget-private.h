@@ -0,0 +1,58 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_MEMORY_BUDGET_PRIVATE_H
+#define MONGOC_MEMORY_BUDGET_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+BSON_BEGIN_DECLS
+
+/* the least a batch is sized for under pressure */
+#define MONGOC_MEMORY_BUDGET_MIN_BATCH_BYTES (16 * 1024)
+
+/* For "memoryBudgetMB": the bytes held by a pool's clients, or a single
+ * client's, in reply buffers, cursor batches, bulk payloads and
+ * compression scratch space. The budget is soft: nothing fails for
+ * exceeding it, but once more than half is in use, cursors and bulk writes
+ * ask for smaller batches. */
+typedef struct _mongoc_memory_budget_t {
+   int64_t limit;
+   volatile int64_t used;
+} mongoc_memory_budget_t;
+
+mongoc_memory_budget_t *
+_mongoc_memory_budget_new (int64_t limit);
+
+void
+_mongoc_memory_budget_destroy (mongoc_memory_budget_t *budget);
+
+void
+_mongoc_memory_budget_charge (mongoc_memory_budget_t *budget, int64_t bytes);
+
+int64_t
+_mongoc_memory_budget_used (mongoc_memory_budget_t *budget);
+
+int64_t
+_mongoc_memory_budget_batch_bytes (mongoc_memory_budget_t *budget);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_MEMORY_BUDGET_PRIVATE_H */
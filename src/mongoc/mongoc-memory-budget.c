@@ -0,0 +1,105 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#include "mongoc-memory-budget-private.h"
+#include "mongoc-counters-private.h"
+
+
+mongoc_memory_budget_t *
+_mongoc_memory_budget_new (int64_t limit)
+{
+   mongoc_memory_budget_t *budget;
+
+   BSON_ASSERT (limit > 0);
+
+   budget = (mongoc_memory_budget_t *) bson_malloc0 (sizeof *budget);
+   budget->limit = limit;
+
+   return budget;
+}
+
+
+/* after everything charged to @budget has been released */
+void
+_mongoc_memory_budget_destroy (mongoc_memory_budget_t *budget)
+{
+   bson_free (budget);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_memory_budget_charge --
+ *
+ *       Add @bytes allocated, or subtract them if negative, to what
+ *       @budget holds. @budget may be NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_memory_budget_charge (mongoc_memory_budget_t *budget, int64_t bytes)
+{
+   if (budget && bytes) {
+      bson_atomic_int64_add (&budget->used, bytes);
+      mongoc_counter_memory_budgeted_add (bytes);
+   }
+}
+
+
+int64_t
+_mongoc_memory_budget_used (mongoc_memory_budget_t *budget)
+{
+   return bson_atomic_int64_add (&budget->used, 0);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_memory_budget_batch_bytes --
+ *
+ *       How large a cursor batch or write batch should be, if @budget is
+ *       under pressure: a quarter of what remains, but at least
+ *       MONGOC_MEMORY_BUDGET_MIN_BATCH_BYTES.
+ *
+ * Returns:
+ *       The size in bytes, or 0 if @budget is NULL or less than half used,
+ *       and batches need not be limited.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int64_t
+_mongoc_memory_budget_batch_bytes (mongoc_memory_budget_t *budget)
+{
+   int64_t used;
+
+   if (!budget) {
+      return 0;
+   }
+
+   used = _mongoc_memory_budget_used (budget);
+   if (used <= budget->limit / 2) {
+      return 0;
+   }
+
+   return BSON_MAX ((budget->limit - used) / 4,
+                    MONGOC_MEMORY_BUDGET_MIN_BATCH_BYTES);
+}
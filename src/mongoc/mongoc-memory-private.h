@@ -0,0 +1,57 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_MEMORY_PRIVATE_H
+#define MONGOC_MEMORY_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-memory.h"
+
+BSON_BEGIN_DECLS
+
+/* Allocations counted under a tag, and made with the tag's allocator if
+ * mongoc_memory_set_vtable gave it one. Each carries a small header with
+ * its size, so memory from these functions must be released with
+ * _mongoc_free_tagged or _mongoc_realloc_tagged with the same tag, never
+ * with bson_free. */
+void *
+_mongoc_malloc_tagged (mongoc_memory_tag_t tag, size_t num_bytes);
+
+void *
+_mongoc_malloc0_tagged (mongoc_memory_tag_t tag, size_t num_bytes);
+
+void *
+_mongoc_realloc_tagged (mongoc_memory_tag_t tag, void *mem, size_t num_bytes);
+
+void
+_mongoc_free_tagged (mongoc_memory_tag_t tag, void *mem);
+
+/* a bson_realloc_func, e.g. for a mongoc_buffer_t, whose ctx is
+ * _mongoc_memory_tag_ctx (tag). frees @mem if @num_bytes is 0 */
+void *
+_mongoc_realloc_tagged_ctx (void *mem, size_t num_bytes, void *ctx);
+
+void *
+_mongoc_memory_tag_ctx (mongoc_memory_tag_t tag);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_MEMORY_PRIVATE_H */
@@ -0,0 +1,307 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mongoc-log.h"
+#include "mongoc-memory-private.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "memory"
+
+/* before each allocation: its size, padded to keep the caller's memory as
+ * aligned as malloc's */
+#define MONGOC_MEMORY_HEADER_SIZE 16
+
+
+typedef struct {
+   const char *name;
+   /* the allocator set with mongoc_memory_set_vtable, if has_vtable */
+   bool has_vtable;
+   bson_mem_vtable_t vtable;
+   volatile int64_t bytes;
+   volatile int64_t allocations;
+   volatile int64_t total_allocations;
+} mongoc_memory_tag_state_t;
+
+
+static mongoc_memory_tag_state_t gMemoryTags[MONGOC_MEMORY_TAG_LAST] = {
+   {"cursor"},
+   {"bulk"},
+   {"compression"},
+   {"reply buffer"},
+   {"topology"},
+   {"tls"},
+};
+
+
+static mongoc_memory_tag_state_t *
+_mongoc_memory_tag_state (mongoc_memory_tag_t tag)
+{
+   BSON_ASSERT ((int) tag >= 0 && tag < MONGOC_MEMORY_TAG_LAST);
+
+   return &gMemoryTags[tag];
+}
+
+
+static uint8_t *
+_mongoc_memory_check (uint8_t *base, size_t num_bytes)
+{
+   /* like bson_malloc, fail loudly rather than return NULL */
+   if (BSON_UNLIKELY (!base)) {
+      fprintf (stderr,
+               "Failure to allocate memory in mongoc_memory. errno: %d.\n",
+               errno);
+      abort ();
+   }
+
+   memcpy (base, &num_bytes, sizeof num_bytes);
+
+   return base;
+}
+
+
+static void
+_mongoc_memory_count (mongoc_memory_tag_state_t *state,
+                      int64_t bytes,
+                      int64_t allocations)
+{
+   bson_atomic_int64_add (&state->bytes, bytes);
+
+   if (allocations) {
+      bson_atomic_int64_add (&state->allocations, allocations);
+   }
+
+   if (allocations > 0) {
+      bson_atomic_int64_add (&state->total_allocations, allocations);
+   }
+}
+
+
+void *
+_mongoc_malloc_tagged (mongoc_memory_tag_t tag, size_t num_bytes)
+{
+   mongoc_memory_tag_state_t *state;
+   size_t size;
+   uint8_t *base;
+
+   state = _mongoc_memory_tag_state (tag);
+   size = num_bytes + MONGOC_MEMORY_HEADER_SIZE;
+
+   if (state->has_vtable) {
+      base = (uint8_t *) state->vtable.malloc (size);
+   } else {
+      base = (uint8_t *) bson_malloc (size);
+   }
+
+   base = _mongoc_memory_check (base, num_bytes);
+   _mongoc_memory_count (state, (int64_t) num_bytes, 1);
+
+   return base + MONGOC_MEMORY_HEADER_SIZE;
+}
+
+
+void *
+_mongoc_malloc0_tagged (mongoc_memory_tag_t tag, size_t num_bytes)
+{
+   void *mem;
+
+   mem = _mongoc_malloc_tagged (tag, num_bytes);
+   memset (mem, 0, num_bytes);
+
+   return mem;
+}
+
+
+void *
+_mongoc_realloc_tagged (mongoc_memory_tag_t tag, void *mem, size_t num_bytes)
+{
+   mongoc_memory_tag_state_t *state;
+   size_t old_num_bytes;
+   size_t size;
+   uint8_t *base;
+
+   if (!mem) {
+      return _mongoc_malloc_tagged (tag, num_bytes);
+   }
+
+   if (!num_bytes) {
+      _mongoc_free_tagged (tag, mem);
+      return NULL;
+   }
+
+   state = _mongoc_memory_tag_state (tag);
+   base = (uint8_t *) mem - MONGOC_MEMORY_HEADER_SIZE;
+   memcpy (&old_num_bytes, base, sizeof old_num_bytes);
+   size = num_bytes + MONGOC_MEMORY_HEADER_SIZE;
+
+   if (state->has_vtable) {
+      base = (uint8_t *) state->vtable.realloc (base, size);
+   } else {
+      base = (uint8_t *) bson_realloc (base, size);
+   }
+
+   base = _mongoc_memory_check (base, num_bytes);
+   _mongoc_memory_count (
+      state, (int64_t) num_bytes - (int64_t) old_num_bytes, 0);
+
+   return base + MONGOC_MEMORY_HEADER_SIZE;
+}
+
+
+void
+_mongoc_free_tagged (mongoc_memory_tag_t tag, void *mem)
+{
+   mongoc_memory_tag_state_t *state;
+   size_t num_bytes;
+   uint8_t *base;
+
+   if (!mem) {
+      return;
+   }
+
+   state = _mongoc_memory_tag_state (tag);
+   base = (uint8_t *) mem - MONGOC_MEMORY_HEADER_SIZE;
+   memcpy (&num_bytes, base, sizeof num_bytes);
+   _mongoc_memory_count (state, -(int64_t) num_bytes, -1);
+
+   if (state->has_vtable) {
+      state->vtable.free (base);
+   } else {
+      bson_free (base);
+   }
+}
+
+
+void *
+_mongoc_realloc_tagged_ctx (void *mem, size_t num_bytes, void *ctx)
+{
+   mongoc_memory_tag_state_t *state;
+
+   state = (mongoc_memory_tag_state_t *) ctx;
+
+   return _mongoc_realloc_tagged (
+      (mongoc_memory_tag_t) (state - gMemoryTags), mem, num_bytes);
+}
+
+
+void *
+_mongoc_memory_tag_ctx (mongoc_memory_tag_t tag)
+{
+   return (void *) _mongoc_memory_tag_state (tag);
+}
+
+
+const char *
+mongoc_memory_tag_name (mongoc_memory_tag_t tag)
+{
+   if ((int) tag < 0 || tag >= MONGOC_MEMORY_TAG_LAST) {
+      return NULL;
+   }
+
+   return gMemoryTags[tag].name;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_memory_get_stats --
+ *
+ *       Sample the memory the driver holds under @tag, in all threads.
+ *
+ * Returns:
+ *       False if @tag is out of range.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_memory_get_stats (mongoc_memory_tag_t tag, mongoc_memory_stats_t *stats)
+{
+   mongoc_memory_tag_state_t *state;
+
+   BSON_ASSERT (stats);
+
+   if ((int) tag < 0 || tag >= MONGOC_MEMORY_TAG_LAST) {
+      return false;
+   }
+
+   state = &gMemoryTags[tag];
+   memset (stats, 0, sizeof *stats);
+   stats->bytes = bson_atomic_int64_add (&state->bytes, 0);
+   stats->allocations = bson_atomic_int64_add (&state->allocations, 0);
+   stats->total_allocations =
+      bson_atomic_int64_add (&state->total_allocations, 0);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_memory_set_vtable --
+ *
+ *       Allocate @tag's memory with @vtable's malloc, realloc and free, or
+ *       with bson_malloc and its relatives if @vtable is NULL. Not
+ *       thread-safe: call it before creating clients.
+ *
+ * Returns:
+ *       False if @tag is out of range, @vtable lacks a function, or memory
+ *       with @tag is allocated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_memory_set_vtable (mongoc_memory_tag_t tag,
+                          const bson_mem_vtable_t *vtable)
+{
+   mongoc_memory_tag_state_t *state;
+
+   if ((int) tag < 0 || tag >= MONGOC_MEMORY_TAG_LAST) {
+      return false;
+   }
+
+   state = &gMemoryTags[tag];
+
+   if (vtable && (!vtable->malloc || !vtable->realloc || !vtable->free)) {
+      MONGOC_ERROR ("Memory vtable for \"%s\" is missing a function",
+                    state->name);
+      return false;
+   }
+
+   /* the outstanding allocations must be freed by their own allocator */
+   if (bson_atomic_int64_add (&state->allocations, 0)) {
+      MONGOC_ERROR ("Cannot change the allocator for \"%s\" with memory "
+                    "allocated",
+                    state->name);
+      return false;
+   }
+
+   if (vtable) {
+      memcpy (&state->vtable, vtable, sizeof *vtable);
+      state->has_vtable = true;
+   } else {
+      state->has_vtable = false;
+   }
+
+   return true;
+}
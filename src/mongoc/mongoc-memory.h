@@ -0,0 +1,63 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_MEMORY_H
+#define MONGOC_MEMORY_H
+
+#if !defined(MONGOC_INSIDE) && !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-macros.h"
+
+BSON_BEGIN_DECLS
+
+
+/* the subsystems whose memory the driver accounts for separately */
+typedef enum {
+   MONGOC_MEMORY_TAG_CURSOR,
+   MONGOC_MEMORY_TAG_BULK,
+   MONGOC_MEMORY_TAG_COMPRESSION,
+   MONGOC_MEMORY_TAG_REPLY_BUFFER,
+   MONGOC_MEMORY_TAG_TOPOLOGY,
+   MONGOC_MEMORY_TAG_TLS,
+   MONGOC_MEMORY_TAG_LAST
+} mongoc_memory_tag_t;
+
+
+typedef struct {
+   int64_t bytes;
+   int64_t allocations;
+   int64_t total_allocations;
+   void *padding[8];
+} mongoc_memory_stats_t;
+
+
+MONGOC_EXPORT (const char *)
+mongoc_memory_tag_name (mongoc_memory_tag_t tag);
+MONGOC_EXPORT (bool)
+mongoc_memory_get_stats (mongoc_memory_tag_t tag, mongoc_memory_stats_t *stats);
+MONGOC_EXPORT (bool)
+mongoc_memory_set_vtable (mongoc_memory_tag_t tag,
+                          const bson_mem_vtable_t *vtable);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_MEMORY_H */
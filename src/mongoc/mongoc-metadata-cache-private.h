@@ -0,0 +1,90 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_METADATA_CACHE_PRIVATE_H
+#define MONGOC_METADATA_CACHE_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-client.h"
+#include "mongoc-cursor.h"
+
+BSON_BEGIN_DECLS
+
+/* the most listIndexes and listCollections results a client keeps */
+#define MONGOC_METADATA_CACHE_MAX_ENTRIES 64
+
+typedef struct _mongoc_metadata_cache_entry_t {
+   struct _mongoc_metadata_cache_entry_t *next;
+   char *db;
+   /* the listIndexes collection, or NULL for listCollections */
+   char *collection;
+   bson_t command;
+   /* the result documents, keyed "0", "1", ... */
+   bson_t docs;
+   int64_t expire_at;
+} mongoc_metadata_cache_entry_t;
+
+/* For "metadataCacheTTLMS": a client's recent listIndexes and
+ * listCollections results, newest first. Entries expire after the TTL, and
+ * are dropped early when the client runs a command that changes its
+ * database's collections or indexes. Like its client, not thread-safe. */
+typedef struct _mongoc_metadata_cache_t {
+   int64_t ttl_usec;
+   mongoc_metadata_cache_entry_t *entries;
+   uint32_t n_entries;
+} mongoc_metadata_cache_t;
+
+mongoc_metadata_cache_t *
+_mongoc_metadata_cache_new (int64_t ttl_usec);
+
+void
+_mongoc_metadata_cache_destroy (mongoc_metadata_cache_t *cache);
+
+mongoc_cursor_t *
+_mongoc_metadata_cache_find (mongoc_metadata_cache_t *cache,
+                             mongoc_client_t *client,
+                             const char *db,
+                             const bson_t *command);
+
+mongoc_cursor_t *
+_mongoc_metadata_cache_fill (mongoc_metadata_cache_t *cache,
+                             mongoc_client_t *client,
+                             const char *db,
+                             const char *collection,
+                             const bson_t *command,
+                             mongoc_cursor_t *cursor);
+
+void
+_mongoc_metadata_cache_invalidate (mongoc_metadata_cache_t *cache,
+                                   const char *db,
+                                   const char *collection);
+
+bool
+_mongoc_metadata_cache_pipeline_writes (const bson_t *command);
+
+void
+_mongoc_metadata_cache_command (mongoc_metadata_cache_t *cache,
+                                const char *db,
+                                const bson_t *command);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_METADATA_CACHE_PRIVATE_H */
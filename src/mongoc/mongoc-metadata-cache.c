@@ -0,0 +1,321 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-metadata-cache-private.h"
+#include "mongoc-cursor-array-private.h"
+#include "mongoc-cursor-private.h"
+#include "mongoc-trace-private.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "metadata-cache"
+
+
+mongoc_metadata_cache_t *
+_mongoc_metadata_cache_new (int64_t ttl_usec)
+{
+   mongoc_metadata_cache_t *cache;
+
+   BSON_ASSERT (ttl_usec > 0);
+
+   cache = (mongoc_metadata_cache_t *) bson_malloc0 (sizeof *cache);
+   cache->ttl_usec = ttl_usec;
+
+   return cache;
+}
+
+
+static void
+_mongoc_metadata_cache_entry_destroy (mongoc_metadata_cache_entry_t *entry)
+{
+   bson_free (entry->db);
+   bson_free (entry->collection);
+   bson_destroy (&entry->command);
+   bson_destroy (&entry->docs);
+   bson_free (entry);
+}
+
+
+void
+_mongoc_metadata_cache_destroy (mongoc_metadata_cache_t *cache)
+{
+   mongoc_metadata_cache_entry_t *entry;
+
+   while ((entry = cache->entries)) {
+      cache->entries = entry->next;
+      _mongoc_metadata_cache_entry_destroy (entry);
+   }
+
+   bson_free (cache);
+}
+
+
+/* unlink the entry @prev points to and destroy it */
+static void
+_mongoc_metadata_cache_remove (mongoc_metadata_cache_t *cache,
+                               mongoc_metadata_cache_entry_t **prev)
+{
+   mongoc_metadata_cache_entry_t *entry = *prev;
+
+   *prev = entry->next;
+   _mongoc_metadata_cache_entry_destroy (entry);
+   cache->n_entries--;
+}
+
+
+/* a cursor over documents from the cache, which sends no command */
+static mongoc_cursor_t *
+_mongoc_metadata_cache_cursor (mongoc_client_t *client,
+                               const char *db,
+                               const bson_t *docs)
+{
+   mongoc_cursor_t *cursor;
+
+   cursor = _mongoc_cursor_new_with_opts (
+      client, db, true /* is_command */, NULL, NULL, NULL, NULL);
+   _mongoc_cursor_array_init (cursor, NULL, NULL);
+   _mongoc_cursor_array_set_bson (cursor, docs);
+
+   return cursor;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_metadata_cache_find --
+ *
+ *       Look for a fresh result of @command on @db, and move it to the
+ *       front of the cache.
+ *
+ * Returns:
+ *       A cursor over the cached result, or NULL if there is none.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_cursor_t *
+_mongoc_metadata_cache_find (mongoc_metadata_cache_t *cache,
+                             mongoc_client_t *client,
+                             const char *db,
+                             const bson_t *command)
+{
+   mongoc_metadata_cache_entry_t **prev;
+   mongoc_metadata_cache_entry_t *entry;
+
+   ENTRY;
+
+   for (prev = &cache->entries; (entry = *prev); prev = &entry->next) {
+      if (!strcmp (entry->db, db) && bson_equal (&entry->command, command)) {
+         break;
+      }
+   }
+
+   if (!entry) {
+      RETURN (NULL);
+   }
+
+   if (entry->expire_at <= bson_get_monotonic_time ()) {
+      _mongoc_metadata_cache_remove (cache, prev);
+      RETURN (NULL);
+   }
+
+   *prev = entry->next;
+   entry->next = cache->entries;
+   cache->entries = entry;
+
+   RETURN (_mongoc_metadata_cache_cursor (client, db, &entry->docs));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_metadata_cache_fill --
+ *
+ *       Read all the documents from @cursor, the result of @command on
+ *       @db, and cache them. @collection is the listIndexes collection, or
+ *       NULL for listCollections.
+ *
+ * Returns:
+ *       A cursor over the cached documents. @cursor is destroyed.
+ *
+ *       If @cursor fails, it is returned instead, so the application
+ *       sees its error from mongoc_cursor_next.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_cursor_t *
+_mongoc_metadata_cache_fill (mongoc_metadata_cache_t *cache,
+                             mongoc_client_t *client,
+                             const char *db,
+                             const char *collection,
+                             const bson_t *command,
+                             mongoc_cursor_t *cursor)
+{
+   mongoc_metadata_cache_entry_t **prev;
+   mongoc_metadata_cache_entry_t *entry;
+   const bson_t *doc;
+   const char *key;
+   char buf[16];
+   uint32_t i = 0;
+
+   ENTRY;
+
+   entry = (mongoc_metadata_cache_entry_t *) bson_malloc0 (sizeof *entry);
+   bson_init (&entry->docs);
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      bson_uint32_to_string (i++, &key, buf, sizeof buf);
+      bson_append_document (&entry->docs, key, -1, doc);
+   }
+
+   if (mongoc_cursor_error (cursor, NULL)) {
+      bson_destroy (&entry->docs);
+      bson_free (entry);
+      RETURN (cursor);
+   }
+
+   mongoc_cursor_destroy (cursor);
+
+   entry->db = bson_strdup (db);
+   entry->collection = bson_strdup (collection);
+   bson_copy_to (command, &entry->command);
+   entry->expire_at = bson_get_monotonic_time () + cache->ttl_usec;
+   entry->next = cache->entries;
+   cache->entries = entry;
+   cache->n_entries++;
+
+   /* evict the least recently used */
+   if (cache->n_entries > MONGOC_METADATA_CACHE_MAX_ENTRIES) {
+      prev = &cache->entries;
+      while ((*prev)->next) {
+         prev = &(*prev)->next;
+      }
+
+      _mongoc_metadata_cache_remove (cache, prev);
+   }
+
+   RETURN (_mongoc_metadata_cache_cursor (client, db, &entry->docs));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_metadata_cache_invalidate --
+ *
+ *       Drop the cached listCollections results for @db, and its
+ *       listIndexes results for @collection, or for all its collections
+ *       if @collection is NULL. If @db is NULL, empty the cache.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_metadata_cache_invalidate (mongoc_metadata_cache_t *cache,
+                                   const char *db,
+                                   const char *collection)
+{
+   mongoc_metadata_cache_entry_t **prev;
+   mongoc_metadata_cache_entry_t *entry;
+
+   prev = &cache->entries;
+
+   while ((entry = *prev)) {
+      if (!db || (!strcmp (entry->db, db) &&
+                  (!collection || !entry->collection ||
+                   !strcmp (entry->collection, collection)))) {
+         _mongoc_metadata_cache_remove (cache, prev);
+      } else {
+         prev = &entry->next;
+      }
+   }
+}
+
+
+/* whether @command, an aggregate command, writes to a collection with
+ * "$out" */
+bool
+_mongoc_metadata_cache_pipeline_writes (const bson_t *command)
+{
+   bson_iter_t iter;
+   bson_iter_t stages;
+   bson_iter_t stage;
+
+   if (!bson_iter_init_find (&iter, command, "pipeline") ||
+       !BSON_ITER_HOLDS_ARRAY (&iter) || !bson_iter_recurse (&iter, &stages)) {
+      return false;
+   }
+
+   while (bson_iter_next (&stages)) {
+      if (BSON_ITER_HOLDS_DOCUMENT (&stages) &&
+          bson_iter_recurse (&stages, &stage) && bson_iter_next (&stage) &&
+          !strcmp (bson_iter_key (&stage), "$out")) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_metadata_cache_command --
+ *
+ *       Called for each command the client runs on @db. Drop cached
+ *       results that @command may make stale.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_metadata_cache_command (mongoc_metadata_cache_t *cache,
+                                const char *db,
+                                const bson_t *command)
+{
+   bson_iter_t iter;
+   const char *name;
+
+   if (!cache->entries || !bson_iter_init (&iter, command) ||
+       !bson_iter_next (&iter)) {
+      return;
+   }
+
+   name = bson_iter_key (&iter);
+
+   if (!strcmp (name, "create") || !strcmp (name, "drop") ||
+       !strcmp (name, "collMod") || !strcmp (name, "convertToCapped") ||
+       !strcmp (name, "createIndexes") || !strcmp (name, "dropIndexes") ||
+       !strcmp (name, "deleteIndexes")) {
+      _mongoc_metadata_cache_invalidate (
+         cache,
+         db,
+         BSON_ITER_HOLDS_UTF8 (&iter) ? bson_iter_utf8 (&iter, NULL) : NULL);
+   } else if (!strcmp (name, "dropDatabase") ||
+              !strcmp (name, "cloneCollectionAsCapped") ||
+              !strcmp (name, "mapReduce") ||
+              (!strcmp (name, "aggregate") &&
+               _mongoc_metadata_cache_pipeline_writes (command))) {
+      _mongoc_metadata_cache_invalidate (cache, db, NULL);
+   } else if (!strcmp (name, "renameCollection")) {
+      /* on "admin", naming collections in any database */
+      _mongoc_metadata_cache_invalidate (cache, NULL, NULL);
+   }
+}
@@ -0,0 +1,470 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-paginator.h"
+#include "mongoc-cursor.h"
+#include "mongoc-error.h"
+#include "mongoc-trace-private.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "paginator"
+
+
+struct _mongoc_paginator_t {
+   mongoc_collection_t *collection; /* not owned */
+   bson_t filter;
+   bson_t sort; /* the caller's, ending with "_id" as the tie-breaker */
+   bson_t opts; /* the caller's, without "sort", "skip" and "limit" */
+   uint32_t page_size;
+
+   /* the sort key of the last document returned, empty before the first */
+   bson_t position;
+
+   mongoc_cursor_t *cursor; /* the current page, NULL between pages */
+   uint32_t n_returned;     /* from the current page */
+   bool more;               /* the last page was full */
+   bson_error_t error;
+};
+
+
+static void
+_mongoc_paginator_init_sort (mongoc_paginator_t *paginator,
+                             const bson_t *sort)
+{
+   bson_iter_t iter;
+   int64_t direction;
+   bool has_id = false;
+
+   if (sort && bson_iter_init (&iter, sort)) {
+      while (bson_iter_next (&iter)) {
+         if (has_id) {
+            bson_set_error (&paginator->error,
+                            MONGOC_ERROR_COMMAND,
+                            MONGOC_ERROR_COMMAND_INVALID_ARG,
+                            "\"_id\" must be the paginator's last sort key");
+            return;
+         }
+
+         direction =
+            BSON_ITER_HOLDS_NUMBER (&iter) ? bson_iter_as_int64 (&iter) : 0;
+         if (direction != 1 && direction != -1) {
+            bson_set_error (&paginator->error,
+                            MONGOC_ERROR_COMMAND,
+                            MONGOC_ERROR_COMMAND_INVALID_ARG,
+                            "Paginator sort direction for \"%s\" must be 1 "
+                            "or -1",
+                            bson_iter_key (&iter));
+            return;
+         }
+
+         has_id = !strcmp (bson_iter_key (&iter), "_id");
+         BSON_APPEND_INT32 (
+            &paginator->sort, bson_iter_key (&iter), (int32_t) direction);
+      }
+   }
+
+   /* _id is unique, so no two documents have the same sort key */
+   if (!has_id) {
+      BSON_APPEND_INT32 (&paginator->sort, "_id", 1);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_paginator_new --
+ *
+ *       Create a paginator over the documents in @collection matching
+ *       @filter, in @sort order, @page_size at a time. Each page after the
+ *       first is a range query from the sort key of the last document
+ *       returned, so it costs the same however deep it is, if an index
+ *       covers @sort.
+ *
+ *       An invalid @sort or @page_size is reported by
+ *       mongoc_paginator_next and mongoc_paginator_error.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_paginator_t *
+mongoc_paginator_new (mongoc_collection_t *collection,
+                      const bson_t *filter,
+                      const bson_t *sort,
+                      const bson_t *opts,
+                      uint32_t page_size)
+{
+   mongoc_paginator_t *paginator;
+
+   BSON_ASSERT (collection);
+
+   paginator = (mongoc_paginator_t *) bson_malloc0 (sizeof *paginator);
+   paginator->collection = collection;
+   bson_init (&paginator->filter);
+   bson_init (&paginator->sort);
+   bson_init (&paginator->opts);
+   bson_init (&paginator->position);
+   paginator->page_size = page_size;
+   paginator->more = true;
+
+   if (filter) {
+      bson_concat (&paginator->filter, filter);
+   }
+
+   if (opts) {
+      bson_copy_to_excluding_noinit (
+         opts, &paginator->opts, "sort", "skip", "limit", "batchSize", NULL);
+   }
+
+   if (!page_size) {
+      bson_set_error (&paginator->error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Paginator page size must be positive");
+   } else {
+      _mongoc_paginator_init_sort (paginator, sort);
+   }
+
+   return paginator;
+}
+
+
+/* append to @clause: the sort keys before the @n'th equal to the
+ * position's, and the @n'th after it in sort order */
+static void
+_mongoc_paginator_append_clause (const mongoc_paginator_t *paginator,
+                                 uint32_t n,
+                                 bson_t *clause)
+{
+   bson_iter_t sort;
+   bson_iter_t position;
+   bson_t range;
+   uint32_t i;
+
+   BSON_ASSERT (bson_iter_init (&sort, &paginator->sort));
+   BSON_ASSERT (bson_iter_init (&position, &paginator->position));
+
+   for (i = 0; i < n; i++) {
+      BSON_ASSERT (bson_iter_next (&sort) && bson_iter_next (&position));
+      bson_append_iter (clause, NULL, 0, &position);
+   }
+
+   BSON_ASSERT (bson_iter_next (&sort) && bson_iter_next (&position));
+   bson_append_document_begin (clause, bson_iter_key (&position), -1, &range);
+   bson_append_iter (
+      &range, bson_iter_as_int64 (&sort) > 0 ? "$gt" : "$lt", -1, &position);
+   bson_append_document_end (clause, &range);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_paginator_append_query --
+ *
+ *       The filter for the next page: the caller's, and after the
+ *       position in sort order. With sort keys a, b, _id that's
+ *
+ *       {$or: [{a: {$gt: a0}},
+ *              {a: a0, b: {$gt: b0}},
+ *              {a: a0, b: b0, _id: {$gt: id0}}]}
+ *
+ *       with $lt instead for descending keys.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_paginator_append_query (const mongoc_paginator_t *paginator,
+                                bson_t *query)
+{
+   bson_t range = BSON_INITIALIZER;
+   bson_t filters;
+   bson_t clauses;
+   bson_t clause;
+   uint32_t n_keys;
+   uint32_t i;
+   const char *key;
+   char buf[16];
+
+   if (bson_empty (&paginator->position)) {
+      bson_concat (query, &paginator->filter);
+      return;
+   }
+
+   n_keys = bson_count_keys (&paginator->sort);
+   if (n_keys == 1) {
+      _mongoc_paginator_append_clause (paginator, 0, &range);
+   } else {
+      bson_append_array_begin (&range, "$or", 3, &clauses);
+      for (i = 0; i < n_keys; i++) {
+         bson_uint32_to_string (i, &key, buf, sizeof buf);
+         bson_append_document_begin (&clauses, key, -1, &clause);
+         _mongoc_paginator_append_clause (paginator, i, &clause);
+         bson_append_document_end (&clauses, &clause);
+      }
+      bson_append_array_end (&range, &clauses);
+   }
+
+   if (bson_empty (&paginator->filter)) {
+      bson_concat (query, &range);
+   } else {
+      bson_append_array_begin (query, "$and", 4, &filters);
+      bson_append_document (&filters, "0", 1, &paginator->filter);
+      bson_append_document (&filters, "1", 1, &range);
+      bson_append_array_end (query, &filters);
+   }
+
+   bson_destroy (&range);
+}
+
+
+static void
+_mongoc_paginator_start_page (mongoc_paginator_t *paginator)
+{
+   bson_t query = BSON_INITIALIZER;
+   bson_t opts = BSON_INITIALIZER;
+
+   _mongoc_paginator_append_query (paginator, &query);
+
+   bson_concat (&opts, &paginator->opts);
+   BSON_APPEND_DOCUMENT (&opts, "sort", &paginator->sort);
+   BSON_APPEND_INT64 (&opts, "limit", (int64_t) paginator->page_size);
+   /* the whole page in the first batch */
+   BSON_APPEND_INT64 (&opts, "batchSize", (int64_t) paginator->page_size);
+
+   paginator->cursor = mongoc_collection_find_with_opts (
+      paginator->collection, &query, &opts, NULL);
+   paginator->n_returned = 0;
+
+   bson_destroy (&opts);
+   bson_destroy (&query);
+}
+
+
+/* remember @doc's sort key, to start the next page after it */
+static bool
+_mongoc_paginator_set_position_from (mongoc_paginator_t *paginator,
+                                     const bson_t *doc)
+{
+   bson_iter_t sort;
+   bson_iter_t iter;
+   bson_iter_t value;
+
+   bson_reinit (&paginator->position);
+
+   BSON_ASSERT (bson_iter_init (&sort, &paginator->sort));
+   while (bson_iter_next (&sort)) {
+      if (!bson_iter_init (&iter, doc) ||
+          !bson_iter_find_descendant (&iter, bson_iter_key (&sort), &value)) {
+         bson_set_error (&paginator->error,
+                         MONGOC_ERROR_CURSOR,
+                         MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                         "Document has no sort key \"%s\", a projection "
+                         "must include the paginator's sort keys",
+                         bson_iter_key (&sort));
+         bson_reinit (&paginator->position);
+         return false;
+      }
+
+      bson_append_iter (
+         &paginator->position, bson_iter_key (&sort), -1, &value);
+   }
+
+   return true;
+}
+
+
+static void
+_mongoc_paginator_end_page (mongoc_paginator_t *paginator)
+{
+   if (paginator->cursor) {
+      mongoc_cursor_destroy (paginator->cursor);
+      paginator->cursor = NULL;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_paginator_next --
+ *
+ *       Like mongoc_cursor_next, the next document of the current page.
+ *       False at the end of the page; the call after that starts the next
+ *       page, unless mongoc_paginator_more is false.
+ *
+ * Returns:
+ *       True and sets @doc to a document valid until the next call.
+ *       Otherwise false, check mongoc_paginator_error.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_paginator_next (mongoc_paginator_t *paginator, const bson_t **doc)
+{
+   ENTRY;
+
+   BSON_ASSERT (paginator);
+   BSON_ASSERT (doc);
+
+   *doc = NULL;
+
+   if (paginator->error.domain) {
+      RETURN (false);
+   }
+
+   if (!paginator->cursor) {
+      if (!paginator->more) {
+         RETURN (false);
+      }
+
+      _mongoc_paginator_start_page (paginator);
+   }
+
+   if (mongoc_cursor_next (paginator->cursor, doc)) {
+      paginator->n_returned++;
+      if (!_mongoc_paginator_set_position_from (paginator, *doc)) {
+         *doc = NULL;
+         _mongoc_paginator_end_page (paginator);
+         RETURN (false);
+      }
+
+      RETURN (true);
+   }
+
+   mongoc_cursor_error (paginator->cursor, &paginator->error);
+
+   /* a short page was the last */
+   paginator->more = paginator->n_returned == paginator->page_size;
+   _mongoc_paginator_end_page (paginator);
+
+   RETURN (false);
+}
+
+
+/* false once a page had fewer than page_size documents, or on error */
+bool
+mongoc_paginator_more (const mongoc_paginator_t *paginator)
+{
+   BSON_ASSERT (paginator);
+
+   return paginator->more && !paginator->error.domain;
+}
+
+
+bool
+mongoc_paginator_error (const mongoc_paginator_t *paginator,
+                        bson_error_t *error)
+{
+   BSON_ASSERT (paginator);
+
+   if (paginator->error.domain) {
+      if (error) {
+         memcpy (error, &paginator->error, sizeof *error);
+      }
+
+      return true;
+   }
+
+   return false;
+}
+
+
+/* the sort key of the last document returned, to resume after it with
+ * mongoc_paginator_set_position, e.g. in a later request */
+const bson_t *
+mongoc_paginator_get_position (const mongoc_paginator_t *paginator)
+{
+   BSON_ASSERT (paginator);
+
+   return &paginator->position;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_paginator_set_position --
+ *
+ *       Start the next page after @position, from
+ *       mongoc_paginator_get_position on a paginator with the same sort,
+ *       or from the beginning if @position is empty or NULL.
+ *
+ * Returns:
+ *       False and sets @error if @position's keys aren't the sort keys.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_paginator_set_position (mongoc_paginator_t *paginator,
+                               const bson_t *position,
+                               bson_error_t *error)
+{
+   bson_iter_t sort;
+   bson_iter_t iter;
+   bool match;
+
+   BSON_ASSERT (paginator);
+
+   if (position && !bson_empty (position)) {
+      BSON_ASSERT (bson_iter_init (&sort, &paginator->sort));
+      match = bson_iter_init (&iter, position);
+      while (match && bson_iter_next (&sort)) {
+         match = bson_iter_next (&iter) &&
+                 !strcmp (bson_iter_key (&iter), bson_iter_key (&sort));
+      }
+
+      if (!match || bson_iter_next (&iter)) {
+         bson_set_error (error,
+                         MONGOC_ERROR_COMMAND,
+                         MONGOC_ERROR_COMMAND_INVALID_ARG,
+                         "Paginator position must have the sort keys, in "
+                         "sort order");
+         return false;
+      }
+   }
+
+   _mongoc_paginator_end_page (paginator);
+   bson_reinit (&paginator->position);
+   if (position) {
+      bson_concat (&paginator->position, position);
+   }
+
+   paginator->more = true;
+
+   return true;
+}
+
+
+void
+mongoc_paginator_destroy (mongoc_paginator_t *paginator)
+{
+   if (!paginator) {
+      return;
+   }
+
+   _mongoc_paginator_end_page (paginator);
+   bson_destroy (&paginator->filter);
+   bson_destroy (&paginator->sort);
+   bson_destroy (&paginator->opts);
+   bson_destroy (&paginator->position);
+   bson_free (paginator);
+}
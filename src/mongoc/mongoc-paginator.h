@@ -0,0 +1,62 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_PAGINATOR_H
+#define MONGOC_PAGINATOR_H
+
+#if !defined(MONGOC_INSIDE) && !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-macros.h"
+#include "mongoc-collection.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_paginator_t mongoc_paginator_t;
+
+
+MONGOC_EXPORT (mongoc_paginator_t *)
+mongoc_paginator_new (mongoc_collection_t *collection,
+                      const bson_t *filter,
+                      const bson_t *sort,
+                      const bson_t *opts,
+                      uint32_t page_size);
+MONGOC_EXPORT (bool)
+mongoc_paginator_next (mongoc_paginator_t *paginator, const bson_t **doc);
+MONGOC_EXPORT (bool)
+mongoc_paginator_more (const mongoc_paginator_t *paginator);
+MONGOC_EXPORT (bool)
+mongoc_paginator_error (const mongoc_paginator_t *paginator,
+                        bson_error_t *error);
+MONGOC_EXPORT (const bson_t *)
+mongoc_paginator_get_position (const mongoc_paginator_t *paginator);
+MONGOC_EXPORT (bool)
+mongoc_paginator_set_position (mongoc_paginator_t *paginator,
+                               const bson_t *position,
+                               bson_error_t *error);
+MONGOC_EXPORT (void)
+mongoc_paginator_destroy (mongoc_paginator_t *paginator);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_PAGINATOR_H */
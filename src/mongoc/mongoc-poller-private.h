@@ -0,0 +1,68 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_POLLER_PRIVATE_H
+#define MONGOC_POLLER_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-config.h"
+#include "mongoc-socket.h"
+
+BSON_BEGIN_DECLS
+
+#if defined(MONGOC_HAVE_EPOLL) || defined(MONGOC_HAVE_KQUEUE)
+#define MONGOC_ENABLE_POLLER 1
+#endif
+
+/* A persistent set of sockets, backed by epoll or kqueue. Sockets stay
+ * registered between waits, and a wait reports only the ready ones. */
+typedef struct _mongoc_poller_t mongoc_poller_t;
+
+typedef struct _mongoc_poller_event_t {
+   void *data;   /* as passed to _mongoc_poller_set */
+   int revents; /* POLLIN, POLLOUT, POLLERR, POLLHUP */
+} mongoc_poller_event_t;
+
+mongoc_poller_t *
+_mongoc_poller_new (void);
+
+void
+_mongoc_poller_destroy (mongoc_poller_t *poller);
+
+bool
+_mongoc_poller_set (mongoc_poller_t *poller,
+                    mongoc_socket_t *sock,
+                    bool registered,
+                    int events,
+                    void *data);
+
+void
+_mongoc_poller_remove (mongoc_poller_t *poller, int fd);
+
+int
+_mongoc_poller_wait (mongoc_poller_t *poller,
+                     mongoc_poller_event_t *events,
+                     int max_events,
+                     int32_t timeout_msec);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_POLLER_PRIVATE_H */
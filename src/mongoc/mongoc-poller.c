@@ -0,0 +1,286 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-poller-private.h"
+
+#ifdef MONGOC_ENABLE_POLLER
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(MONGOC_HAVE_EPOLL)
+#include <sys/epoll.h>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#include "mongoc-socket-private.h"
+#include "mongoc-trace-private.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "poller"
+
+
+struct _mongoc_poller_t {
+   int fd; /* the epoll or kqueue descriptor */
+#if defined(MONGOC_HAVE_EPOLL)
+   struct epoll_event *events;
+#else
+   struct kevent *events;
+#endif
+   int events_len;
+};
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_poller_new --
+ *
+ *       Create a poller.
+ *
+ * Returns:
+ *       A new poller, or NULL if the kernel refuses to create one. The
+ *       caller should fall back to mongoc_stream_poll.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_poller_t *
+_mongoc_poller_new (void)
+{
+   mongoc_poller_t *poller;
+   int fd;
+
+   ENTRY;
+
+#if defined(MONGOC_HAVE_EPOLL)
+   fd = epoll_create1 (EPOLL_CLOEXEC);
+#else
+   fd = kqueue ();
+   if (fd != -1) {
+      (void) fcntl (fd, F_SETFD, FD_CLOEXEC);
+   }
+#endif
+
+   if (fd == -1) {
+      TRACE ("could not create poller: %d", errno);
+      RETURN (NULL);
+   }
+
+   poller = (mongoc_poller_t *) bson_malloc0 (sizeof *poller);
+   poller->fd = fd;
+
+   RETURN (poller);
+}
+
+
+void
+_mongoc_poller_destroy (mongoc_poller_t *poller)
+{
+   if (poller) {
+      close (poller->fd);
+      bson_free (poller->events);
+      bson_free (poller);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_poller_set --
+ *
+ *       Register @sock for @events (POLLIN and/or POLLOUT), or if
+ *       @registered, change the events it was registered for. Errors and
+ *       hangups are always reported. Ready events carry @data.
+ *
+ * Returns:
+ *       true on success, false if the kernel rejected the socket.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_poller_set (mongoc_poller_t *poller,
+                    mongoc_socket_t *sock,
+                    bool registered,
+                    int events,
+                    void *data)
+{
+#if defined(MONGOC_HAVE_EPOLL)
+   struct epoll_event ev = {0};
+
+   ev.events = ((events & POLLIN) ? EPOLLIN : 0) |
+               ((events & POLLOUT) ? EPOLLOUT : 0) | EPOLLERR | EPOLLHUP;
+   ev.data.ptr = data;
+
+   return 0 == epoll_ctl (poller->fd,
+                          registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                          sock->sd,
+                          &ev);
+#else
+   struct kevent changes[2];
+
+   /* one filter per direction, disabled rather than deleted so that
+    * changing events never fails with ENOENT */
+   EV_SET (&changes[0],
+           sock->sd,
+           EVFILT_READ,
+           EV_ADD | ((events & POLLIN) ? EV_ENABLE : EV_DISABLE),
+           0,
+           0,
+           data);
+   EV_SET (&changes[1],
+           sock->sd,
+           EVFILT_WRITE,
+           EV_ADD | ((events & POLLOUT) ? EV_ENABLE : EV_DISABLE),
+           0,
+           0,
+           data);
+
+   return 0 == kevent (poller->fd, changes, 2, NULL, 0, NULL);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_poller_remove --
+ *
+ *       Stop watching @fd. Harmless if @fd was already closed, the kernel
+ *       forgets closed descriptors on its own.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_poller_remove (mongoc_poller_t *poller, int fd)
+{
+#if defined(MONGOC_HAVE_EPOLL)
+   /* pre-2.6.9 kernels require a non-NULL event */
+   struct epoll_event ev = {0};
+
+   (void) epoll_ctl (poller->fd, EPOLL_CTL_DEL, fd, &ev);
+#else
+   struct kevent changes[2];
+
+   EV_SET (&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+   EV_SET (&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+
+   (void) kevent (poller->fd, changes, 2, NULL, 0, NULL);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_poller_wait --
+ *
+ *       Wait up to @timeout_msec for registered sockets to become ready,
+ *       and fill out at most @max_events entries of @events, one per
+ *       ready socket.
+ *
+ * Returns:
+ *       The number of ready sockets, 0 on timeout, or -1 with errno set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+_mongoc_poller_wait (mongoc_poller_t *poller,
+                     mongoc_poller_event_t *events,
+                     int max_events,
+                     int32_t timeout_msec)
+{
+   int n;
+   int i;
+#if !defined(MONGOC_HAVE_EPOLL)
+   struct timespec ts;
+   int revents;
+   int j;
+   int n_merged;
+#endif
+
+   BSON_ASSERT (max_events > 0);
+
+   if (poller->events_len < max_events) {
+      poller->events = bson_realloc (poller->events,
+                                     sizeof (*poller->events) * max_events);
+      poller->events_len = max_events;
+   }
+
+#if defined(MONGOC_HAVE_EPOLL)
+   n = epoll_wait (poller->fd, poller->events, max_events, timeout_msec);
+
+   for (i = 0; i < n; i++) {
+      events[i].data = poller->events[i].data.ptr;
+      events[i].revents =
+         ((poller->events[i].events & EPOLLIN) ? POLLIN : 0) |
+         ((poller->events[i].events & EPOLLOUT) ? POLLOUT : 0) |
+         ((poller->events[i].events & EPOLLERR) ? POLLERR : 0) |
+         ((poller->events[i].events & EPOLLHUP) ? POLLHUP : 0);
+   }
+
+   return n;
+#else
+   ts.tv_sec = timeout_msec / 1000;
+   ts.tv_nsec = (timeout_msec % 1000) * 1000 * 1000;
+
+   n = kevent (poller->fd,
+               NULL,
+               0,
+               poller->events,
+               max_events,
+               timeout_msec < 0 ? NULL : &ts);
+
+   /* a socket can be ready for reading and writing, report it once */
+   n_merged = 0;
+   for (i = 0; i < n; i++) {
+      revents = poller->events[i].filter == EVFILT_READ ? POLLIN : POLLOUT;
+      if (poller->events[i].flags & EV_EOF) {
+         revents |= POLLHUP;
+      }
+
+      if (poller->events[i].flags & EV_ERROR) {
+         revents |= POLLERR;
+      }
+
+      for (j = 0; j < n_merged; j++) {
+         if (events[j].data == poller->events[i].udata) {
+            events[j].revents |= revents;
+            break;
+         }
+      }
+
+      if (j == n_merged) {
+         events[n_merged].data = poller->events[i].udata;
+         events[n_merged].revents = revents;
+         n_merged++;
+      }
+   }
+
+   return n < 0 ? n : n_merged;
+#endif
+}
+
+#endif /* MONGOC_ENABLE_POLLER */
@@ -0,0 +1,570 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-prepared-command.h"
+#include "mongoc-array-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-cmd-private.h"
+#include "mongoc-collection-private.h"
+#include "mongoc-error.h"
+#include "mongoc-read-concern-private.h"
+#include "mongoc-read-prefs-private.h"
+#include "mongoc-trace-private.h"
+#include "mongoc-util-private.h"
+#include "mongoc-write-concern-private.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "prepared-command"
+
+
+/* a placeholder {"$param": n} in the command template */
+typedef struct {
+   uint32_t offset; /* of the element's type byte */
+   uint32_t len;    /* of the whole element */
+   uint32_t key_len;
+   uint32_t index; /* of the parameter that replaces it */
+} mongoc_prepared_param_t;
+
+
+/* a document or array in the template that holds placeholders, its length
+ * changes with the parameters' */
+typedef struct {
+   uint32_t offset; /* of its length */
+   uint32_t first;  /* its placeholders are [first, last) */
+   uint32_t last;
+} mongoc_prepared_doc_t;
+
+
+struct _mongoc_prepared_command_t {
+   mongoc_client_t *client;
+   char db[128];
+   mongoc_command_mode_t mode;
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_read_concern_t *read_concern;
+   mongoc_write_concern_t *write_concern;
+   bson_t *opts;
+   uint32_t server_id; /* from opts, or 0 */
+
+   /* the template, its placeholders in order, and the documents that
+    * contain them */
+   bson_t *command;
+   mongoc_array_t params;
+   mongoc_array_t docs;
+   uint32_t n_params; /* the highest parameter index plus one */
+
+   /* opts and default read and write concern, validated and encoded for a
+    * server with extra_wire_version, or -1 until the first execution */
+   bson_t extra;
+   int32_t extra_wire_version;
+
+   /* reused by each execution: the parameters encoded with empty keys and
+    * each one's offset, the growth of the command before each placeholder,
+    * and the bound command */
+   bson_t values;
+   mongoc_array_t value_offsets;
+   mongoc_array_t deltas;
+   uint8_t *buf;
+   size_t buf_size;
+};
+
+
+static bool
+_mongoc_prepared_command_is_param (const uint8_t *data,
+                                   uint32_t len,
+                                   uint32_t *index)
+{
+   bson_t doc;
+   bson_iter_t iter;
+   int32_t i;
+
+   if (!bson_init_static (&doc, data, len) || !bson_iter_init (&iter, &doc) ||
+       !bson_iter_next (&iter) || strcmp (bson_iter_key (&iter), "$param") ||
+       !BSON_ITER_HOLDS_INT32 (&iter)) {
+      return false;
+   }
+
+   i = bson_iter_int32 (&iter);
+   if (i < 0 || bson_iter_next (&iter)) {
+      return false;
+   }
+
+   *index = (uint32_t) i;
+   return true;
+}
+
+
+/* record the placeholders in the document or array at @data */
+static void
+_mongoc_prepared_command_scan (mongoc_prepared_command_t *prepared,
+                               const uint8_t *data,
+                               uint32_t len)
+{
+   const uint8_t *root = bson_get_data (prepared->command);
+   mongoc_prepared_doc_t doc;
+   mongoc_prepared_param_t param;
+   const uint8_t *child;
+   uint32_t child_len;
+   const char *key;
+   bson_t b;
+   bson_iter_t iter;
+
+   doc.offset = (uint32_t) (data - root);
+   doc.first = (uint32_t) prepared->params.len;
+
+   BSON_ASSERT (bson_init_static (&b, data, len));
+   BSON_ASSERT (bson_iter_init (&iter, &b));
+
+   while (bson_iter_next (&iter)) {
+      if (BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         bson_iter_document (&iter, &child_len, &child);
+      } else if (BSON_ITER_HOLDS_ARRAY (&iter)) {
+         bson_iter_array (&iter, &child_len, &child);
+      } else {
+         continue;
+      }
+
+      key = bson_iter_key (&iter);
+
+      if (BSON_ITER_HOLDS_DOCUMENT (&iter) &&
+          _mongoc_prepared_command_is_param (child, child_len, &param.index)) {
+         /* the element, from the type byte before its key to its end */
+         param.offset = (uint32_t) ((const uint8_t *) key - 1 - root);
+         param.len = (uint32_t) (child + child_len - root) - param.offset;
+         param.key_len = (uint32_t) strlen (key);
+         _mongoc_array_append_val (&prepared->params, param);
+         prepared->n_params = BSON_MAX (prepared->n_params, param.index + 1);
+      } else {
+         _mongoc_prepared_command_scan (prepared, child, child_len);
+      }
+   }
+
+   doc.last = (uint32_t) prepared->params.len;
+   if (doc.last > doc.first) {
+      _mongoc_array_append_val (&prepared->docs, doc);
+   }
+}
+
+
+static mongoc_prepared_command_t *
+_mongoc_prepared_command_new (mongoc_collection_t *collection,
+                              const bson_t *command,
+                              mongoc_command_mode_t mode,
+                              const mongoc_read_prefs_t *read_prefs,
+                              const bson_t *opts,
+                              bson_error_t *error)
+{
+   mongoc_prepared_command_t *prepared;
+   uint32_t server_id;
+
+   BSON_ASSERT (collection);
+   BSON_ASSERT (command);
+
+   if (!_mongoc_get_command_name (command)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Empty command document");
+      return NULL;
+   }
+
+   if (!_mongoc_get_server_id_from_opts (opts,
+                                         MONGOC_ERROR_COMMAND,
+                                         MONGOC_ERROR_COMMAND_INVALID_ARG,
+                                         &server_id,
+                                         error)) {
+      return NULL;
+   }
+
+   if (mode == MONGOC_CMD_READ &&
+       !_mongoc_read_prefs_validate (read_prefs, error)) {
+      return NULL;
+   }
+
+   prepared = (mongoc_prepared_command_t *) bson_malloc0 (sizeof *prepared);
+   prepared->client = collection->client;
+   bson_strncpy (prepared->db, collection->db, sizeof prepared->db);
+   prepared->mode = mode;
+   if (read_prefs) {
+      prepared->read_prefs = mongoc_read_prefs_copy (read_prefs);
+   }
+   prepared->read_concern = mongoc_read_concern_copy (collection->read_concern);
+   prepared->write_concern =
+      mongoc_write_concern_copy (collection->write_concern);
+   prepared->opts = opts ? bson_copy (opts) : NULL;
+   prepared->server_id = server_id;
+
+   prepared->command = bson_copy (command);
+   _mongoc_array_init (&prepared->params, sizeof (mongoc_prepared_param_t));
+   _mongoc_array_init (&prepared->docs, sizeof (mongoc_prepared_doc_t));
+   _mongoc_prepared_command_scan (
+      prepared, bson_get_data (prepared->command), prepared->command->len);
+
+   bson_init (&prepared->extra);
+   prepared->extra_wire_version = -1;
+
+   bson_init (&prepared->values);
+   _mongoc_array_init (&prepared->value_offsets, sizeof (uint32_t));
+   _mongoc_array_init (&prepared->deltas, sizeof (int64_t));
+
+   return prepared;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_prepare_read_command --
+ *
+ *       Prepare @command, a template whose documents {"$param": n} are
+ *       replaced by the nth parameter of each execution, to be run as
+ *       with mongoc_collection_read_command_with_opts.
+ *
+ * Returns:
+ *       A prepared command, or NULL and @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_prepared_command_t *
+mongoc_collection_prepare_read_command (mongoc_collection_t *collection,
+                                        const bson_t *command,
+                                        const mongoc_read_prefs_t *read_prefs,
+                                        const bson_t *opts,
+                                        bson_error_t *error)
+{
+   BSON_ASSERT (collection);
+
+   return _mongoc_prepared_command_new (
+      collection,
+      command,
+      MONGOC_CMD_READ,
+      COALESCE (read_prefs, collection->read_prefs),
+      opts,
+      error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_prepare_write_command --
+ *
+ *       Like mongoc_collection_prepare_read_command, to be run as with
+ *       mongoc_collection_write_command_with_opts.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_prepared_command_t *
+mongoc_collection_prepare_write_command (mongoc_collection_t *collection,
+                                         const bson_t *command,
+                                         const bson_t *opts,
+                                         bson_error_t *error)
+{
+   return _mongoc_prepared_command_new (
+      collection, command, MONGOC_CMD_WRITE, NULL, opts, error);
+}
+
+
+/* build the command from the template and @params in prepared->buf, with
+ * one copy of each run of template bytes and of each parameter */
+static bool
+_mongoc_prepared_command_bind (mongoc_prepared_command_t *prepared,
+                               const bson_value_t *params,
+                               size_t n_params,
+                               bson_t *command,
+                               bson_error_t *error)
+{
+   const uint8_t *tmpl = bson_get_data (prepared->command);
+   const uint8_t *values;
+   const mongoc_prepared_param_t *param;
+   const mongoc_prepared_doc_t *doc;
+   const uint32_t *offsets;
+   const int64_t *deltas;
+   uint32_t value_len;
+   uint32_t offset;
+   int64_t delta = 0;
+   uint32_t pos;
+   uint8_t *out;
+   size_t len;
+   int32_t doc_len;
+   size_t i;
+
+   if (n_params < prepared->n_params) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "Prepared command needs %d parameters, not %d",
+                      (int) prepared->n_params,
+                      (int) n_params);
+      return false;
+   }
+
+   /* encode each parameter once, as an element with an empty key: its type,
+    * the key's terminator, and its value */
+   bson_reinit (&prepared->values);
+   _mongoc_array_clear (&prepared->value_offsets);
+   for (i = 0; i < prepared->n_params; i++) {
+      offset = prepared->values.len - 1;
+      _mongoc_array_append_val (&prepared->value_offsets, offset);
+      if (!bson_append_value (&prepared->values, "", 0, &params[i])) {
+         bson_set_error (error,
+                         MONGOC_ERROR_BSON,
+                         MONGOC_ERROR_BSON_INVALID,
+                         "Prepared command parameter %d is too large",
+                         (int) i);
+         return false;
+      }
+   }
+
+   offset = prepared->values.len - 1;
+   _mongoc_array_append_val (&prepared->value_offsets, offset);
+   values = bson_get_data (&prepared->values);
+   offsets = (const uint32_t *) prepared->value_offsets.data;
+
+   /* how much the command grows before each placeholder, and in all */
+   _mongoc_array_clear (&prepared->deltas);
+   _mongoc_array_append_val (&prepared->deltas, delta);
+   for (i = 0; i < prepared->params.len; i++) {
+      param = &_mongoc_array_index (
+         &prepared->params, mongoc_prepared_param_t, i);
+      value_len = offsets[param->index + 1] - offsets[param->index] - 2;
+      delta += (int64_t) (param->key_len + 2 + value_len) - param->len;
+      _mongoc_array_append_val (&prepared->deltas, delta);
+   }
+
+   deltas = (const int64_t *) prepared->deltas.data;
+
+   if ((int64_t) prepared->command->len + delta > INT32_MAX) {
+      bson_set_error (error,
+                      MONGOC_ERROR_BSON,
+                      MONGOC_ERROR_BSON_INVALID,
+                      "Prepared command is too large with its parameters");
+      return false;
+   }
+
+   len = (size_t) ((int64_t) prepared->command->len + delta);
+   if (len > prepared->buf_size) {
+      prepared->buf_size = len;
+      prepared->buf = (uint8_t *) bson_realloc (prepared->buf, len);
+   }
+
+   /* the template up to each placeholder, then the placeholder's type and
+    * key followed by its parameter's value */
+   out = prepared->buf;
+   pos = 0;
+   for (i = 0; i < prepared->params.len; i++) {
+      param = &_mongoc_array_index (
+         &prepared->params, mongoc_prepared_param_t, i);
+      offset = offsets[param->index];
+      value_len = offsets[param->index + 1] - offset - 2;
+
+      memcpy (out, tmpl + pos, param->offset - pos);
+      out += param->offset - pos;
+      *out++ = values[offset];
+      memcpy (out, tmpl + param->offset + 1, param->key_len + 1);
+      out += param->key_len + 1;
+      memcpy (out, values + offset + 2, value_len);
+      out += value_len;
+
+      pos = param->offset + param->len;
+   }
+
+   memcpy (out, tmpl + pos, prepared->command->len - pos);
+
+   /* the documents around placeholders, the root included, grow by their
+    * placeholders' deltas and move by those of the placeholders before */
+   for (i = 0; i < prepared->docs.len; i++) {
+      doc = &_mongoc_array_index (&prepared->docs, mongoc_prepared_doc_t, i);
+      memcpy (&doc_len, tmpl + doc->offset, sizeof doc_len);
+      doc_len = (int32_t) BSON_UINT32_FROM_LE (doc_len);
+      doc_len += (int32_t) (deltas[doc->last] - deltas[doc->first]);
+      doc_len = (int32_t) BSON_UINT32_TO_LE (doc_len);
+      memcpy (prepared->buf + doc->offset + deltas[doc->first],
+              &doc_len,
+              sizeof doc_len);
+   }
+
+   BSON_ASSERT (bson_init_static (command, prepared->buf, len));
+
+   return true;
+}
+
+
+/* validate and encode the opts for @server_stream's wire version */
+static bool
+_mongoc_prepared_command_compile_opts (
+   mongoc_prepared_command_t *prepared,
+   const mongoc_server_stream_t *server_stream,
+   bson_error_t *error)
+{
+   mongoc_cmd_parts_t parts;
+   bool ret;
+
+   mongoc_cmd_parts_init (
+      &parts, prepared->db, MONGOC_QUERY_NONE, prepared->command);
+
+   ret = _mongoc_client_command_append_opts (&parts,
+                                             prepared->mode,
+                                             prepared->opts,
+                                             prepared->read_concern,
+                                             prepared->write_concern,
+                                             server_stream,
+                                             error);
+   if (ret) {
+      bson_reinit (&prepared->extra);
+      bson_concat (&prepared->extra, &parts.extra);
+      prepared->extra_wire_version = server_stream->sd->max_wire_version;
+   }
+
+   mongoc_cmd_parts_cleanup (&parts);
+
+   return ret;
+}
+
+
+static mongoc_server_stream_t *
+_mongoc_prepared_command_stream (mongoc_prepared_command_t *prepared,
+                                 bson_error_t *error)
+{
+   mongoc_cluster_t *cluster = &prepared->client->cluster;
+
+   if (prepared->server_id) {
+      return mongoc_cluster_stream_for_server (
+         cluster, prepared->server_id, true /* reconnect ok */, error);
+   } else if (prepared->mode & MONGOC_CMD_WRITE) {
+      return mongoc_cluster_stream_for_writes (cluster, error);
+   }
+
+   return mongoc_cluster_stream_for_reads (
+      cluster, prepared->read_prefs, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_prepared_command_execute --
+ *
+ *       Run @prepared's command with its placeholders replaced by
+ *       @params. The opts are only validated again if the selected
+ *       server's wire version differs from the last execution's.
+ *
+ * Returns:
+ *       Success or failure, as mongoc_collection_read_command_with_opts
+ *       or mongoc_collection_write_command_with_opts.
+ *
+ * Side effects:
+ *       @reply is always initialized.
+ *       @error is filled out if the command fails.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_prepared_command_execute (mongoc_prepared_command_t *prepared,
+                                 const bson_value_t *params,
+                                 size_t n_params,
+                                 bson_t *reply,
+                                 bson_error_t *error)
+{
+   mongoc_server_stream_t *server_stream;
+   mongoc_cmd_parts_t parts;
+   bson_t command;
+   bson_t reply_local;
+   bson_t *reply_ptr;
+   bool ret;
+
+   ENTRY;
+
+   BSON_ASSERT (prepared);
+   BSON_ASSERT (params || !n_params);
+
+   if (!_mongoc_prepared_command_bind (
+          prepared, params, n_params, &command, error)) {
+      _mongoc_bson_init_if_set (reply);
+      RETURN (false);
+   }
+
+   server_stream = _mongoc_prepared_command_stream (prepared, error);
+   if (!server_stream) {
+      _mongoc_bson_init_if_set (reply);
+      RETURN (false);
+   }
+
+   if (server_stream->sd->max_wire_version != prepared->extra_wire_version &&
+       !_mongoc_prepared_command_compile_opts (
+          prepared, server_stream, error)) {
+      _mongoc_bson_init_if_set (reply);
+      mongoc_server_stream_cleanup (server_stream);
+      RETURN (false);
+   }
+
+   mongoc_cmd_parts_init (&parts, prepared->db, MONGOC_QUERY_NONE, &command);
+   parts.is_write_command = (prepared->mode & MONGOC_CMD_WRITE);
+
+   if (prepared->mode == MONGOC_CMD_READ) {
+      parts.read_prefs = prepared->read_prefs;
+   }
+
+   if (prepared->server_id &&
+       server_stream->sd->type != MONGOC_SERVER_MONGOS) {
+      parts.user_query_flags |= MONGOC_QUERY_SLAVE_OK;
+   }
+
+   bson_concat (&parts.extra, &prepared->extra);
+
+   reply_ptr = reply ? reply : &reply_local;
+   ret = _mongoc_client_command_with_stream (
+      prepared->client, &parts, server_stream, reply_ptr, error);
+
+   if (ret && (prepared->mode & MONGOC_CMD_WRITE)) {
+      ret = !_mongoc_parse_wc_err (reply_ptr, error);
+   }
+
+   if (reply_ptr == &reply_local) {
+      bson_destroy (reply_ptr);
+   }
+
+   mongoc_cmd_parts_cleanup (&parts);
+   mongoc_server_stream_cleanup (server_stream);
+
+   RETURN (ret);
+}
+
+
+void
+mongoc_prepared_command_destroy (mongoc_prepared_command_t *prepared)
+{
+   if (!prepared) {
+      return;
+   }
+
+   mongoc_read_prefs_destroy (prepared->read_prefs);
+   mongoc_read_concern_destroy (prepared->read_concern);
+   mongoc_write_concern_destroy (prepared->write_concern);
+   bson_destroy (prepared->opts);
+   bson_destroy (prepared->command);
+   _mongoc_array_destroy (&prepared->params);
+   _mongoc_array_destroy (&prepared->docs);
+   bson_destroy (&prepared->extra);
+   bson_destroy (&prepared->values);
+   _mongoc_array_destroy (&prepared->value_offsets);
+   _mongoc_array_destroy (&prepared->deltas);
+   bson_free (prepared->buf);
+   bson_free (prepared);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_PREPARED_COMMAND_H
+#define MONGOC_PREPARED_COMMAND_H
+
+#if !defined(MONGOC_INSIDE) && !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-macros.h"
+#include "mongoc-collection.h"
+
+BSON_BEGIN_DECLS
+
+typedef struct _mongoc_prepared_command_t mongoc_prepared_command_t;
+
+MONGOC_EXPORT (mongoc_prepared_command_t *)
+mongoc_collection_prepare_read_command (mongoc_collection_t *collection,
+                                        const bson_t *command,
+                                        const mongoc_read_prefs_t *read_prefs,
+                                        const bson_t *opts,
+                                        bson_error_t *error);
+MONGOC_EXPORT (mongoc_prepared_command_t *)
+mongoc_collection_prepare_write_command (mongoc_collection_t *collection,
+                                         const bson_t *command,
+                                         const bson_t *opts,
+                                         bson_error_t *error);
+MONGOC_EXPORT (bool)
+mongoc_prepared_command_execute (mongoc_prepared_command_t *prepared,
+                                 const bson_value_t *params,
+                                 size_t n_params,
+                                 bson_t *reply,
+                                 bson_error_t *error);
+MONGOC_EXPORT (void)
+mongoc_prepared_command_destroy (mongoc_prepared_command_t *prepared);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_PREPARED_COMMAND_H */
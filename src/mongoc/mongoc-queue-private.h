@@ -23,37 +23,30 @@
 
 #include <bson.h>
 
-#include "mongoc-list-private.h"
-
 
 BSON_BEGIN_DECLS
 
 
 #define MONGOC_QUEUE_INITIALIZER \
    {                             \
-      NULL, NULL                 \
+      NULL, 0, 0, 0              \
    }
 
 
-typedef struct _mongoc_queue_t mongoc_queue_t;
-typedef struct _mongoc_queue_item_t mongoc_queue_item_t;
-
-
-struct _mongoc_queue_t {
-   mongoc_queue_item_t *head;
-   mongoc_queue_item_t *tail;
+/* a double-ended queue in a ring buffer, which grows to the largest length
+ * the queue reaches and is reused, so pushing and popping don't allocate */
+typedef struct _mongoc_queue_t {
+   void **data;
+   uint32_t capacity; /* zero or a power of two */
+   uint32_t head;     /* index of the first item */
    uint32_t length;
-};
-
-
-struct _mongoc_queue_item_t {
-   mongoc_queue_item_t *next;
-   void *data;
-};
+} mongoc_queue_t;
 
 
 void
 _mongoc_queue_init (mongoc_queue_t *queue);
+void
+_mongoc_queue_destroy (mongoc_queue_t *queue);
 void *
 _mongoc_queue_pop_head (mongoc_queue_t *queue);
 void *
@@ -62,6 +55,8 @@ void
 _mongoc_queue_push_head (mongoc_queue_t *queue, void *data);
 void
 _mongoc_queue_push_tail (mongoc_queue_t *queue, void *data);
+void *
+_mongoc_queue_get (const mongoc_queue_t *queue, uint32_t i);
 uint32_t
 _mongoc_queue_get_length (const mongoc_queue_t *queue);
 
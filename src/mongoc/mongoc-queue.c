@@ -20,6 +20,12 @@
 #include "mongoc-queue-private.h"
 
 
+#define MONGOC_QUEUE_MIN_CAPACITY 8
+
+/* the slot @i items after the head */
+#define SLOT(queue, i) (((queue)->head + (i)) & ((queue)->capacity - 1))
+
+
 void
 _mongoc_queue_init (mongoc_queue_t *queue)
 {
@@ -30,23 +36,55 @@ _mongoc_queue_init (mongoc_queue_t *queue)
 
 
 void
-_mongoc_queue_push_head (mongoc_queue_t *queue, void *data)
+_mongoc_queue_destroy (mongoc_queue_t *queue)
 {
-   mongoc_queue_item_t *item;
-
    BSON_ASSERT (queue);
-   BSON_ASSERT (data);
 
-   item = (mongoc_queue_item_t *) bson_malloc0 (sizeof *item);
-   item->next = queue->head;
-   item->data = data;
+   bson_free (queue->data);
+   memset (queue, 0, sizeof *queue);
+}
 
-   queue->head = item;
 
-   if (!queue->tail) {
-      queue->tail = item;
+/* make room for one more item */
+static void
+_mongoc_queue_reserve (mongoc_queue_t *queue)
+{
+   void **data;
+   uint32_t capacity;
+   uint32_t i;
+
+   if (queue->length < queue->capacity) {
+      return;
    }
 
+   BSON_ASSERT (queue->capacity <= UINT32_MAX / 2);
+
+   capacity =
+      queue->capacity ? queue->capacity * 2 : MONGOC_QUEUE_MIN_CAPACITY;
+   data = (void **) bson_malloc (capacity * sizeof (void *));
+
+   /* unwrap the items to the start of the new buffer */
+   for (i = 0; i < queue->length; i++) {
+      data[i] = queue->data[SLOT (queue, i)];
+   }
+
+   bson_free (queue->data);
+   queue->data = data;
+   queue->capacity = capacity;
+   queue->head = 0;
+}
+
+
+void
+_mongoc_queue_push_head (mongoc_queue_t *queue, void *data)
+{
+   BSON_ASSERT (queue);
+   BSON_ASSERT (data);
+
+   _mongoc_queue_reserve (queue);
+
+   queue->head = (queue->head - 1) & (queue->capacity - 1);
+   queue->data[queue->head] = data;
    queue->length++;
 }
 
@@ -54,21 +92,12 @@ _mongoc_queue_push_head (mongoc_queue_t *queue, void *data)
 void
 _mongoc_queue_push_tail (mongoc_queue_t *queue, void *data)
 {
-   mongoc_queue_item_t *item;
-
    BSON_ASSERT (queue);
    BSON_ASSERT (data);
 
-   item = (mongoc_queue_item_t *) bson_malloc0 (sizeof *item);
-   item->data = data;
-
-   if (queue->tail) {
-      queue->tail->next = item;
-   } else {
-      queue->head = item;
-   }
+   _mongoc_queue_reserve (queue);
 
-   queue->tail = item;
+   queue->data[SLOT (queue, queue->length)] = data;
    queue->length++;
 }
 
@@ -76,21 +105,18 @@ _mongoc_queue_push_tail (mongoc_queue_t *queue, void *data)
 void *
 _mongoc_queue_pop_head (mongoc_queue_t *queue)
 {
-   mongoc_queue_item_t *item;
-   void *data = NULL;
+   void *data;
 
    BSON_ASSERT (queue);
 
-   if ((item = queue->head)) {
-      if (!item->next) {
-         queue->tail = NULL;
-      }
-      queue->head = item->next;
-      data = item->data;
-      bson_free (item);
-      queue->length--;
+   if (queue->length == 0) {
+      return NULL;
    }
 
+   data = queue->data[queue->head];
+   queue->head = SLOT (queue, 1);
+   queue->length--;
+
    return data;
 }
 
@@ -98,35 +124,26 @@ _mongoc_queue_pop_head (mongoc_queue_t *queue)
 void *
 _mongoc_queue_pop_tail (mongoc_queue_t *queue)
 {
-   mongoc_queue_item_t *item;
-   void *data = NULL;
-
    BSON_ASSERT (queue);
 
    if (queue->length == 0) {
       return NULL;
    }
 
-   data = queue->tail->data;
-
-   if (queue->length == 1) {
-      bson_free (queue->tail);
-      queue->head = queue->tail = NULL;
-   } else {
-      /* find item pointing at tail */
-      for (item = queue->head; item; item = item->next) {
-         if (item->next == queue->tail) {
-            item->next = NULL;
-            bson_free (queue->tail);
-            queue->tail = item;
-            break;
-         }
-      }
-   }
-
    queue->length--;
 
-   return data;
+   return queue->data[SLOT (queue, queue->length)];
+}
+
+
+/* the item @i places from the head, without removing it */
+void *
+_mongoc_queue_get (const mongoc_queue_t *queue, uint32_t i)
+{
+   BSON_ASSERT (queue);
+   BSON_ASSERT (i < queue->length);
+
+   return queue->data[SLOT (queue, i)];
 }
 
 
@@ -32,6 +32,9 @@ BSON_BEGIN_DECLS
 int
 _mongoc_rand_bytes (uint8_t *buf, int num);
 
+int
+_mongoc_rand_buffered_bytes (uint8_t *buf, int num);
+
 BSON_END_DECLS
 
 
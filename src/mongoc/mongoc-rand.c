@@ -0,0 +1,134 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mongoc-config.h"
+
+#ifdef MONGOC_ENABLE_CRYPTO
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "mongoc-rand-private.h"
+#include "mongoc-thread-private.h"
+
+
+/* random bytes are drawn from the crypto library this many at a time */
+#define MONGOC_RAND_BUFFER_SIZE 4096
+
+typedef struct {
+   uint8_t bytes[MONGOC_RAND_BUFFER_SIZE];
+   /* the bytes before pos have been used and wiped */
+   size_t pos;
+   int32_t fork_generation;
+} mongoc_rand_buffer_t;
+
+/* incremented in a child process after fork: the child inherits the
+ * parent's buffers, which it must not hand out a second time */
+static volatile int32_t gRandForkGeneration = 1;
+
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+static MONGOC_THREAD_LOCAL mongoc_rand_buffer_t gRandBuffer;
+#endif
+
+
+#if defined(MONGOC_HAVE_THREAD_LOCAL) && !defined(_WIN32)
+/* a new generation makes every thread's buffer stale */
+static void
+_mongoc_rand_atfork_child (void)
+{
+   bson_atomic_int_add (&gRandForkGeneration, 1);
+}
+
+
+static MONGOC_ONCE_FUN (_mongoc_rand_register_atfork)
+{
+   pthread_atfork (NULL, NULL, _mongoc_rand_atfork_child);
+   MONGOC_ONCE_RETURN;
+}
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_rand_buffered_bytes --
+ *
+ *       Fill @buf with @num cryptographically secure random bytes, for
+ *       session ids and nonces. Each thread takes them from its own
+ *       buffer of the crypto library's output, so only a refill, once
+ *       per MONGOC_RAND_BUFFER_SIZE bytes, goes through the library's
+ *       locked generator. Bytes are wiped from the buffer once handed
+ *       out, and a child process discards the buffers it inherits.
+ *
+ * Returns:
+ *       1 on success, 0 if the crypto library failed, like
+ *       _mongoc_rand_bytes.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+_mongoc_rand_buffered_bytes (uint8_t *buf, int num)
+{
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+   mongoc_rand_buffer_t *buffer = &gRandBuffer;
+   int32_t generation;
+   size_t n;
+
+#ifndef _WIN32
+   static mongoc_once_t once = MONGOC_ONCE_INIT;
+
+   mongoc_once (&once, _mongoc_rand_register_atfork);
+#endif
+
+   BSON_ASSERT (num >= 0);
+
+   /* large requests aren't worth buffering */
+   if (num > MONGOC_RAND_BUFFER_SIZE / 4) {
+      return _mongoc_rand_bytes (buf, num);
+   }
+
+   generation = bson_atomic_int_add (&gRandForkGeneration, 0);
+   if (buffer->fork_generation != generation) {
+      /* a new thread, or the first draw since fork */
+      buffer->pos = MONGOC_RAND_BUFFER_SIZE;
+      buffer->fork_generation = generation;
+   }
+
+   n = (size_t) num;
+   if (MONGOC_RAND_BUFFER_SIZE - buffer->pos < n) {
+      if (!_mongoc_rand_bytes (buffer->bytes, MONGOC_RAND_BUFFER_SIZE)) {
+         buffer->pos = MONGOC_RAND_BUFFER_SIZE;
+         return 0;
+      }
+
+      buffer->pos = 0;
+   }
+
+   memcpy (buf, buffer->bytes + buffer->pos, n);
+   memset (buffer->bytes + buffer->pos, 0, n);
+   buffer->pos += n;
+
+   return 1;
+#else
+   return _mongoc_rand_bytes (buf, num);
+#endif
+}
+
+#endif
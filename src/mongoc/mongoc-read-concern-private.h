@@ -32,12 +32,17 @@ struct _mongoc_read_concern_t {
    char *level;
    bool frozen;
    bson_t compiled;
+   /* references besides the creator's, from handles that share it */
+   volatile int32_t refs;
 };
 
 
 const bson_t *
 _mongoc_read_concern_get_bson (mongoc_read_concern_t *read_concern);
 
+mongoc_read_concern_t *
+_mongoc_read_concern_ref (const mongoc_read_concern_t *read_concern);
+
 BSON_END_DECLS
 
 
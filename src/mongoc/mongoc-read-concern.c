@@ -57,6 +57,19 @@ mongoc_read_concern_copy (const mongoc_read_concern_t *read_concern)
 }
 
 
+/* share @read_concern instead of copying it, for a handle that never
+ * modifies it. each reference is released with mongoc_read_concern_destroy */
+mongoc_read_concern_t *
+_mongoc_read_concern_ref (const mongoc_read_concern_t *read_concern)
+{
+   mongoc_read_concern_t *shared = (mongoc_read_concern_t *) read_concern;
+
+   bson_atomic_int_add (&shared->refs, 1);
+
+   return shared;
+}
+
+
 /**
  * mongoc_read_concern_destroy:
  * @read_concern: A mongoc_read_concern_t.
@@ -67,6 +80,11 @@ void
 mongoc_read_concern_destroy (mongoc_read_concern_t *read_concern)
 {
    if (read_concern) {
+      if (bson_atomic_int_add (&read_concern->refs, -1) >= 0) {
+         /* still shared */
+         return;
+      }
+
       if (read_concern->compiled.len) {
          bson_destroy (&read_concern->compiled);
       }
@@ -25,6 +25,7 @@
 
 #include "mongoc-cluster-private.h"
 #include "mongoc-read-prefs.h"
+#include "mongoc-server-description-private.h"
 
 
 BSON_BEGIN_DECLS
@@ -32,7 +33,21 @@ BSON_BEGIN_DECLS
 struct _mongoc_read_prefs_t {
    mongoc_read_mode_t mode;
    bson_t tags;
+   /* "tags" compiled whenever it changes, one entry per tag set */
+   mongoc_compiled_tag_set_t *compiled_tag_sets;
+   size_t n_compiled_tag_sets;
    int64_t max_staleness_seconds;
+   /* the "$readPreference" document, rebuilt whenever the fields change */
+   bson_t compiled;
+   /* unique across all read prefs, changes with each modification: it
+    * identifies the contents, e.g. to key server selection caches */
+   int64_t generation;
+   /* a causally consistent session's operation time, to prefer servers
+    * that have replicated it. not part of "$readPreference" */
+   uint32_t after_cluster_timestamp;
+   uint32_t after_cluster_increment;
+   /* references besides the creator's, from handles that share it */
+   volatile int32_t refs;
 };
 
 
@@ -51,6 +66,9 @@ typedef struct _mongoc_assemble_query_result_t {
 const char *
 _mongoc_read_mode_as_str (mongoc_read_mode_t mode);
 
+const bson_t *
+_mongoc_read_prefs_get_bson (const mongoc_read_prefs_t *read_prefs);
+
 void
 assemble_query (const mongoc_read_prefs_t *read_prefs,
                 const mongoc_server_stream_t *server_stream,
@@ -66,6 +84,14 @@ bool
 _mongoc_read_prefs_validate (const mongoc_read_prefs_t *read_prefs,
                              bson_error_t *error);
 
+mongoc_read_prefs_t *
+_mongoc_read_prefs_ref (const mongoc_read_prefs_t *read_prefs);
+
+void
+_mongoc_read_prefs_set_after_cluster_time (mongoc_read_prefs_t *read_prefs,
+                                           uint32_t timestamp,
+                                           uint32_t increment);
+
 BSON_END_DECLS
 
 
@@ -22,6 +22,92 @@
 #include "mongoc-client-private.h"
 
 
+static volatile int64_t gReadPrefsGeneration;
+
+
+/* encode the "$readPreference" document once per change, not per command */
+static void
+_mongoc_read_prefs_compile_bson (mongoc_read_prefs_t *read_prefs)
+{
+   bson_t *compiled = &read_prefs->compiled;
+
+   bson_reinit (compiled);
+   bson_append_utf8 (
+      compiled, "mode", 4, _mongoc_read_mode_as_str (read_prefs->mode), -1);
+
+   if (!bson_empty (&read_prefs->tags)) {
+      bson_append_array (compiled, "tags", 4, &read_prefs->tags);
+   }
+
+   if (read_prefs->max_staleness_seconds != MONGOC_NO_MAX_STALENESS) {
+      bson_append_int64 (compiled,
+                         "maxStalenessSeconds",
+                         19,
+                         read_prefs->max_staleness_seconds);
+   }
+}
+
+
+static void
+_mongoc_read_prefs_changed (mongoc_read_prefs_t *read_prefs)
+{
+   read_prefs->generation = bson_atomic_int64_add (&gReadPrefsGeneration, 1);
+   _mongoc_read_prefs_compile_bson (read_prefs);
+}
+
+
+static void
+_mongoc_read_prefs_clear_compiled_tags (mongoc_read_prefs_t *read_prefs)
+{
+   size_t i;
+
+   for (i = 0; i < read_prefs->n_compiled_tag_sets; i++) {
+      _mongoc_compiled_tag_set_cleanup (&read_prefs->compiled_tag_sets[i]);
+   }
+
+   bson_free (read_prefs->compiled_tag_sets);
+   read_prefs->compiled_tag_sets = NULL;
+   read_prefs->n_compiled_tag_sets = 0;
+}
+
+
+/* sort each tag set's pairs once, rather than walking the BSON for each
+ * server in each server selection */
+static void
+_mongoc_read_prefs_compile_tags (mongoc_read_prefs_t *read_prefs)
+{
+   mongoc_compiled_tag_set_t *tag_set;
+   bson_iter_t iter;
+   bson_t tag_doc;
+   const uint8_t *data;
+   uint32_t len;
+   uint32_t n;
+
+   _mongoc_read_prefs_clear_compiled_tags (read_prefs);
+
+   n = bson_count_keys (&read_prefs->tags);
+   if (!n || !bson_iter_init (&iter, &read_prefs->tags)) {
+      return;
+   }
+
+   read_prefs->compiled_tag_sets = (mongoc_compiled_tag_set_t *) bson_malloc (
+      n * sizeof (mongoc_compiled_tag_set_t));
+
+   while (bson_iter_next (&iter) && read_prefs->n_compiled_tag_sets < n) {
+      tag_set = &read_prefs->compiled_tag_sets[read_prefs->n_compiled_tag_sets];
+      _mongoc_compiled_tag_set_init (tag_set);
+      read_prefs->n_compiled_tag_sets++;
+
+      if (BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         bson_iter_document (&iter, &len, &data);
+         if (bson_init_static (&tag_doc, data, len)) {
+            _mongoc_compiled_tag_set_compile (tag_set, &tag_doc);
+         }
+      }
+   }
+}
+
+
 mongoc_read_prefs_t *
 mongoc_read_prefs_new (mongoc_read_mode_t mode)
 {
@@ -31,6 +117,8 @@ mongoc_read_prefs_new (mongoc_read_mode_t mode)
    read_prefs->mode = mode;
    bson_init (&read_prefs->tags);
    read_prefs->max_staleness_seconds = MONGOC_NO_MAX_STALENESS;
+   bson_init (&read_prefs->compiled);
+   _mongoc_read_prefs_changed (read_prefs);
 
    return read_prefs;
 }
@@ -51,6 +139,7 @@ mongoc_read_prefs_set_mode (mongoc_read_prefs_t *read_prefs,
    BSON_ASSERT (mode <= MONGOC_READ_NEAREST);
 
    read_prefs->mode = mode;
+   _mongoc_read_prefs_changed (read_prefs);
 }
 
 
@@ -74,6 +163,9 @@ mongoc_read_prefs_set_tags (mongoc_read_prefs_t *read_prefs, const bson_t *tags)
    } else {
       bson_init (&read_prefs->tags);
    }
+
+   _mongoc_read_prefs_compile_tags (read_prefs);
+   _mongoc_read_prefs_changed (read_prefs);
 }
 
 
@@ -94,6 +186,9 @@ mongoc_read_prefs_add_tag (mongoc_read_prefs_t *read_prefs, const bson_t *tag)
    } else {
       bson_append_document (&read_prefs->tags, str, -1, &empty);
    }
+
+   _mongoc_read_prefs_compile_tags (read_prefs);
+   _mongoc_read_prefs_changed (read_prefs);
 }
 
 
@@ -114,6 +209,7 @@ mongoc_read_prefs_set_max_staleness_seconds (mongoc_read_prefs_t *read_prefs,
    BSON_ASSERT (read_prefs);
 
    read_prefs->max_staleness_seconds = max_staleness_seconds;
+   _mongoc_read_prefs_changed (read_prefs);
 }
 
 
@@ -141,11 +237,31 @@ mongoc_read_prefs_is_valid (const mongoc_read_prefs_t *read_prefs)
 }
 
 
+/* share @read_prefs instead of copying it, for a handle that never
+ * modifies it. each reference is released with mongoc_read_prefs_destroy */
+mongoc_read_prefs_t *
+_mongoc_read_prefs_ref (const mongoc_read_prefs_t *read_prefs)
+{
+   mongoc_read_prefs_t *shared = (mongoc_read_prefs_t *) read_prefs;
+
+   bson_atomic_int_add (&shared->refs, 1);
+
+   return shared;
+}
+
+
 void
 mongoc_read_prefs_destroy (mongoc_read_prefs_t *read_prefs)
 {
    if (read_prefs) {
+      if (bson_atomic_int_add (&read_prefs->refs, -1) >= 0) {
+         /* still shared */
+         return;
+      }
+
+      _mongoc_read_prefs_clear_compiled_tags (read_prefs);
       bson_destroy (&read_prefs->tags);
+      bson_destroy (&read_prefs->compiled);
       bson_free (read_prefs);
    }
 }
@@ -159,7 +275,13 @@ mongoc_read_prefs_copy (const mongoc_read_prefs_t *read_prefs)
    if (read_prefs) {
       ret = mongoc_read_prefs_new (read_prefs->mode);
       bson_copy_to (&read_prefs->tags, &ret->tags);
+      _mongoc_read_prefs_compile_tags (ret);
       ret->max_staleness_seconds = read_prefs->max_staleness_seconds;
+      ret->after_cluster_timestamp = read_prefs->after_cluster_timestamp;
+      ret->after_cluster_increment = read_prefs->after_cluster_increment;
+      _mongoc_read_prefs_compile_bson (ret);
+      /* same contents, so a copy can share cached selection results */
+      ret->generation = read_prefs->generation;
    }
 
    return ret;
@@ -186,6 +308,16 @@ _mongoc_read_mode_as_str (mongoc_read_mode_t mode)
 }
 
 
+/* the "$readPreference" document for @read_prefs, which must not be NULL */
+const bson_t *
+_mongoc_read_prefs_get_bson (const mongoc_read_prefs_t *read_prefs)
+{
+   BSON_ASSERT (read_prefs);
+
+   return &read_prefs->compiled;
+}
+
+
 /* Update result with the read prefs, following Server Selection Spec.
  * The driver must have discovered the server is a mongos.
  */
@@ -197,9 +329,6 @@ _apply_read_preferences_mongos (
 {
    mongoc_read_mode_t mode;
    const bson_t *tags = NULL;
-   bson_t child;
-   const char *mode_str;
-   int64_t max_staleness_seconds;
 
    mode = mongoc_read_prefs_get_mode (read_prefs);
    if (read_prefs) {
@@ -247,23 +376,10 @@ _apply_read_preferences_mongos (
             result->assembled_query, "$query", 6, query_bson);
       }
 
-      bson_append_document_begin (
-         result->assembled_query, "$readPreference", 15, &child);
-      mode_str = _mongoc_read_mode_as_str (mode);
-      bson_append_utf8 (&child, "mode", 4, mode_str, -1);
-      if (!bson_empty0 (tags)) {
-         bson_append_array (&child, "tags", 4, tags);
-      }
-
-      max_staleness_seconds =
-         mongoc_read_prefs_get_max_staleness_seconds (read_prefs);
-
-      if (max_staleness_seconds != MONGOC_NO_MAX_STALENESS) {
-         bson_append_int64 (
-            &child, "maxStalenessSeconds", 19, max_staleness_seconds);
-      }
-
-      bson_append_document_end (result->assembled_query, &child);
+      bson_append_document (result->assembled_query,
+                            "$readPreference",
+                            15,
+                            _mongoc_read_prefs_get_bson (read_prefs));
    }
 }
 
@@ -404,3 +520,18 @@ _mongoc_read_prefs_validate (const mongoc_read_prefs_t *read_prefs,
    }
    return true;
 }
+
+
+/* prefer servers whose last write is at or after the given cluster time.
+ * selection may then choose different servers, so the generation changes */
+void
+_mongoc_read_prefs_set_after_cluster_time (mongoc_read_prefs_t *read_prefs,
+                                           uint32_t timestamp,
+                                           uint32_t increment)
+{
+   BSON_ASSERT (read_prefs);
+
+   read_prefs->after_cluster_timestamp = timestamp;
+   read_prefs->after_cluster_increment = increment;
+   _mongoc_read_prefs_changed (read_prefs);
+}
@@ -29,11 +29,17 @@
 #include "mongoc-iovec.h"
 #include "mongoc-write-concern.h"
 #include "mongoc-flags.h"
-/* forward declaration */
+/* forward declarations */
 struct _mongoc_cluster_t;
+struct _mongoc_compress_scratch_t;
 
 BSON_BEGIN_DECLS
 
+/* OP_MSG flagBits */
+#define MONGOC_MSG_CHECKSUM_PRESENT (1 << 0)
+#define MONGOC_MSG_MORE_TO_COME (1 << 1)
+#define MONGOC_MSG_EXHAUST_ALLOWED (1 << 16)
+
 typedef struct _mongoc_rpc_section_t {
    uint8_t payload_type;
    union {
@@ -131,8 +137,22 @@ BSON_STATIC_ASSERT (sizeof (mongoc_rpc_reply_header_t) == 36);
 #undef RAW_BUFFER_FIELD
 
 
+/* room for the iovecs _mongoc_rpc_gather makes for a command message, for
+ * arrays initialized with _mongoc_array_init_inline */
+#define MONGOC_RPC_INLINE_IOVECS 16
+
 void
 _mongoc_rpc_gather (mongoc_rpc_t *rpc, mongoc_array_t *array);
+uint8_t *
+_mongoc_rpc_encode_query (mongoc_rpc_t *rpc, size_t *len);
+void
+_mongoc_rpc_gather_encoded (const uint8_t *msg,
+                            size_t len,
+                            int32_t request_id,
+                            mongoc_rpc_header_t *header,
+                            mongoc_array_t *array);
+void
+_mongoc_rpc_append_checksum (mongoc_array_t *iov, uint32_t *checksum_le);
 void
 _mongoc_rpc_swab_to_le (mongoc_rpc_t *rpc);
 void
@@ -165,11 +185,15 @@ _mongoc_cmd_check_ok (const bson_t *doc,
                       bson_error_t *error);
 
 bool
-_mongoc_rpc_decompress (mongoc_rpc_t *rpc_le, uint8_t *buf, size_t buflen);
+_mongoc_rpc_decompress (mongoc_rpc_t *rpc_le,
+                        uint8_t *buf,
+                        size_t buflen,
+                        struct _mongoc_compress_scratch_t *scratch);
 
-char *
+bool
 _mongoc_rpc_compress (struct _mongoc_cluster_t *cluster,
                       int32_t compressor_id,
+                      const char *command_name,
                       mongoc_rpc_t *rpc_le,
                       bson_error_t *error);
 
@@ -20,6 +20,7 @@
 #include "mongoc.h"
 #include "mongoc-rpc-private.h"
 #include "mongoc-counters-private.h"
+#include "mongoc-crc32c-private.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-util-private.h"
 #include "mongoc-compression-private.h"
@@ -416,6 +417,67 @@
 #undef RAW_BUFFER_FIELD
 
 
+/* OP_MSG's sections, after the flags: the kind-0 body first, then at most
+ * one kind-1 document sequence, then a checksum if the flags say so. each
+ * section's length is checked against the bytes left. the checksum is not
+ * verified. */
+static bool
+_mongoc_rpc_scatter_sections (mongoc_rpc_msg_t *rpc,
+                              const uint8_t *buf,
+                              size_t buflen)
+{
+   mongoc_rpc_section_t *section;
+   const uint8_t *identifier_end;
+   uint32_t len;
+
+   if (BSON_UINT32_FROM_LE (rpc->flags) & MONGOC_MSG_CHECKSUM_PRESENT) {
+      if (buflen < 4) {
+         return false;
+      }
+
+      buflen -= 4;
+   }
+
+   rpc->n_sections = 0;
+   while (buflen) {
+      if ((size_t) rpc->n_sections ==
+             sizeof rpc->sections / sizeof rpc->sections[0] ||
+          buflen < 5) {
+         return false;
+      }
+
+      section = &rpc->sections[rpc->n_sections];
+      section->payload_type = buf[0];
+      memcpy (&len, buf + 1, 4);
+      len = BSON_UINT32_FROM_LE (len);
+      if (len < 5 || len > buflen - 1 ||
+          section->payload_type != (rpc->n_sections ? 1 : 0)) {
+         return false;
+      }
+
+      if (section->payload_type == 0) {
+         section->payload.bson_document = buf + 1;
+      } else {
+         /* the size, the identifier, then the documents */
+         identifier_end = (const uint8_t *) memchr (buf + 5, '\0', len - 4);
+         if (!identifier_end) {
+            return false;
+         }
+
+         section->payload.sequence.size = (int32_t) len;
+         section->payload.sequence.identifier = (const char *) (buf + 5);
+         section->payload.sequence.bson_documents = identifier_end + 1;
+      }
+
+      rpc->n_sections++;
+      buf += 1 + len;
+      buflen -= 1 + len;
+   }
+
+   return rpc->n_sections > 0;
+}
+
+
 #define RPC(_name, _code)                                             \
    static bool _mongoc_rpc_scatter_##_name (                          \
       mongoc_rpc_##_name##_t *rpc, const uint8_t *buf, size_t buflen) \
@@ -519,20 +581,12 @@
    rpc->n_##_name = 1;                        \
    buf = NULL;                                \
    buflen = 0;
-#define SECTION_ARRAY_FIELD(_name)                                 \
-   do {                                                            \
-      uint32_t __l;                                                \
-      mongoc_rpc_section_t *section = &rpc->_name[rpc->n_##_name]; \
-      section->payload_type = buf[0];                              \
-      buf++;                                                       \
-      buflen -= 1;                                                 \
-      memcpy (&__l, buf, 4);                                       \
-      __l = BSON_UINT32_FROM_LE (__l);                             \
-      section->payload.bson_document = (uint8_t *) buf;            \
-      buf += __l;                                                  \
-      buflen -= __l;                                               \
-   } while (0);                                                    \
-   rpc->n_##_name++;
+#define SECTION_ARRAY_FIELD(_name)                         \
+   if (!_mongoc_rpc_scatter_sections (rpc, buf, buflen)) { \
+      return false;                                        \
+   }                                                       \
+   buf = NULL;                                             \
+   buflen = 0;
 #define RAW_BUFFER_FIELD(_name)         \
    rpc->_name = (void *) buf;           \
    rpc->_name##_len = (int32_t) buflen; \
@@ -644,6 +698,94 @@ _mongoc_rpc_gather (mongoc_rpc_t *rpc, mongoc_array_t *array)
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_rpc_encode_query --
+ *
+ *       Encode an OP_QUERY in one buffer, for a message that is sent many
+ *       times. Each send gathers it with _mongoc_rpc_gather_encoded,
+ *       which only rewrites the request id.
+ *
+ * Returns:
+ *       A buffer of @len bytes to free with bson_free ().
+ *
+ * Side effects:
+ *       @rpc is swabbed to little-endian.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint8_t *
+_mongoc_rpc_encode_query (mongoc_rpc_t *rpc, size_t *len)
+{
+   mongoc_array_t array;
+   const mongoc_iovec_t *iov;
+   uint8_t *buf;
+   size_t offset = 0;
+   size_t i;
+
+   BSON_ASSERT (rpc->header.opcode == MONGOC_OPCODE_QUERY);
+
+   _mongoc_array_init (&array, sizeof (mongoc_iovec_t));
+   _mongoc_rpc_gather_query (&rpc->query, &rpc->header, &array);
+   *len = (size_t) rpc->header.msg_len;
+   _mongoc_rpc_swab_to_le (rpc);
+
+   buf = (uint8_t *) bson_malloc (*len);
+   iov = (const mongoc_iovec_t *) array.data;
+   for (i = 0; i < array.len; i++) {
+      memcpy (buf + offset, iov[i].iov_base, (size_t) iov[i].iov_len);
+      offset += (size_t) iov[i].iov_len;
+   }
+
+   BSON_ASSERT (offset == *len);
+   _mongoc_array_destroy (&array);
+
+   return buf;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_rpc_gather_encoded --
+ *
+ *       Append to @array the iovecs to send @msg, from
+ *       _mongoc_rpc_encode_query, with @request_id. @header is the
+ *       caller's storage for the rewritten message header, the rest is
+ *       sent from @msg. Both must outlive the send.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_rpc_gather_encoded (const uint8_t *msg,
+                            size_t len,
+                            int32_t request_id,
+                            mongoc_rpc_header_t *header,
+                            mongoc_array_t *array)
+{
+   mongoc_iovec_t iov;
+
+   BSON_ASSERT (len > sizeof *header);
+
+   mongoc_counter_op_egress_total_inc ();
+   mongoc_counter_op_egress_query_inc ();
+
+   memcpy (header, msg, sizeof *header);
+   header->request_id = (int32_t) BSON_UINT32_TO_LE (request_id);
+
+   iov.iov_base = (void *) header;
+   iov.iov_len = sizeof *header;
+   _mongoc_array_append_val (array, iov);
+
+   iov.iov_base = (void *) (msg + sizeof *header);
+   iov.iov_len = len - sizeof *header;
+   _mongoc_array_append_val (array, iov);
+}
+
+
 void
 _mongoc_rpc_swab_to_le (mongoc_rpc_t *rpc)
 {
@@ -784,6 +926,7 @@ _mongoc_rpc_printf (mongoc_rpc_t *rpc)
  *       Takes a (little endian) rpc struct assumed to be OP_COMPRESSED
  *       and decompresses the opcode into its original opcode.
  *       The in-place updated rpc struct remains little endian.
+ *       zlib's inflate state is reused from @scratch, if not NULL.
  *
  * Side effects:
  *       Overwrites the RPC, along with the provided buf with the
@@ -793,7 +936,10 @@ _mongoc_rpc_printf (mongoc_rpc_t *rpc)
  */
 
 bool
-_mongoc_rpc_decompress (mongoc_rpc_t *rpc_le, uint8_t *buf, size_t buflen)
+_mongoc_rpc_decompress (mongoc_rpc_t *rpc_le,
+                        uint8_t *buf,
+                        size_t buflen,
+                        mongoc_compress_scratch_t *scratch)
 {
    size_t uncompressed_size =
       BSON_UINT32_FROM_LE (rpc_le->compressed.uncompressed_size);
@@ -806,12 +952,17 @@ _mongoc_rpc_decompress (mongoc_rpc_t *rpc_le, uint8_t *buf, size_t buflen)
    memcpy (buf + 8, (void *) (&rpc_le->header.response_to), 4);
    memcpy (buf + 12, (void *) (&rpc_le->compressed.original_opcode), 4);
 
-   ok = mongoc_uncompress (rpc_le->compressed.compressor_id,
-                           rpc_le->compressed.compressed_message,
-                           rpc_le->compressed.compressed_message_len,
-                           buf + 16,
-                           &uncompressed_size);
+   ok = mongoc_uncompress_scratch (rpc_le->compressed.compressor_id,
+                                   rpc_le->compressed.compressed_message,
+                                   rpc_le->compressed.compressed_message_len,
+                                   buf + 16,
+                                   &uncompressed_size,
+                                   scratch);
    if (ok) {
+      mongoc_counter_compression_ingress_bytes_add (
+         (int64_t) uncompressed_size);
+      mongoc_counter_compression_ingress_compressed_add (
+         (int64_t) rpc_le->compressed.compressed_message_len);
       return _mongoc_rpc_scatter (rpc_le, buf, buflen);
    }
 
@@ -827,6 +978,18 @@ _mongoc_rpc_decompress (mongoc_rpc_t *rpc_le, uint8_t *buf, size_t buflen)
  *       compressed opcode based on the provided compressor_id.
  *       The in-place updated rpc struct remains little endian.
  *
+ *       The message is compressed straight from the cluster's iovecs into
+ *       the cluster's reusable scratch buffer, which the new iovecs point
+ *       to until the next compression.
+ *
+ *       Messages smaller than compressionMinSize are left uncompressed,
+ *       and with compressionAdaptive so are command types that have not
+ *       been shrinking. @command_name is NULL for legacy opcodes.
+ *
+ * Returns:
+ *       true if the message was compressed or left as is, false with
+ *       @error set if compression failed.
+ *
  * Side effects:
  *       Overwrites the RPC, and clears and overwrites the cluster buffer
  *       with the compressed results.
@@ -834,49 +997,112 @@ _mongoc_rpc_decompress (mongoc_rpc_t *rpc_le, uint8_t *buf, size_t buflen)
  *--------------------------------------------------------------------------
  */
 
-char *
+static const char *
+_mongoc_rpc_opcode_command_name (int32_t opcode)
+{
+   switch (opcode) {
+   case MONGOC_OPCODE_UPDATE:
+      return "update";
+   case MONGOC_OPCODE_INSERT:
+      return "insert";
+   case MONGOC_OPCODE_QUERY:
+      return "find";
+   case MONGOC_OPCODE_GET_MORE:
+      return "getMore";
+   case MONGOC_OPCODE_DELETE:
+      return "delete";
+   case MONGOC_OPCODE_KILL_CURSORS:
+      return "killCursors";
+   default:
+      return "unknown";
+   }
+}
+
+
+static void
+_mongoc_rpc_compress_count (const char *command_name, size_t in, size_t out)
+{
+#define COUNT(_type)                                                       \
+   do {                                                                    \
+      mongoc_counter_compression_##_type##_bytes_add ((int64_t) in);       \
+      mongoc_counter_compression_##_type##_compressed_add ((int64_t) out); \
+   } while (0)
+
+   if (!strcasecmp (command_name, "find")) {
+      COUNT (find);
+   } else if (!strcasecmp (command_name, "getMore")) {
+      COUNT (getmore);
+   } else if (!strcasecmp (command_name, "insert")) {
+      COUNT (insert);
+   } else if (!strcasecmp (command_name, "update")) {
+      COUNT (update);
+   } else if (!strcasecmp (command_name, "delete")) {
+      COUNT (delete);
+   } else if (!strcasecmp (command_name, "aggregate")) {
+      COUNT (aggregate);
+   } else {
+      COUNT (other);
+   }
+
+#undef COUNT
+}
+
+
+bool
 _mongoc_rpc_compress (struct _mongoc_cluster_t *cluster,
                       int32_t compressor_id,
+                      const char *command_name,
                       mongoc_rpc_t *rpc_le,
                       bson_error_t *error)
 {
-   char *output;
-   size_t output_length = 0;
-   size_t allocate = BSON_UINT32_FROM_LE (rpc_le->header.msg_len) - 16;
-   char *data;
-   int size;
+   size_t size = BSON_UINT32_FROM_LE (rpc_le->header.msg_len) - 16;
    int32_t compression_level = -1;
+   bool adaptive;
+
+   if (!command_name) {
+      command_name = _mongoc_rpc_opcode_command_name (
+         BSON_UINT32_FROM_LE (rpc_le->header.opcode));
+   }
+
+   if (size < (size_t) mongoc_uri_get_option_as_int32 (
+                 cluster->uri, MONGOC_URI_COMPRESSIONMINSIZE, 0)) {
+      mongoc_counter_compression_skipped_small_inc ();
+      return true;
+   }
+
+   adaptive = mongoc_uri_get_option_as_bool (
+      cluster->uri, MONGOC_URI_COMPRESSIONADAPTIVE, false);
+   if (adaptive && !mongoc_compress_history_wanted (&cluster->compress_history,
+                                                    command_name)) {
+      mongoc_counter_compression_skipped_adaptive_inc ();
+      return true;
+   }
 
    if (compressor_id == MONGOC_COMPRESSOR_ZLIB_ID) {
       compression_level = mongoc_uri_get_option_as_int32 (
          cluster->uri, MONGOC_URI_ZLIBCOMPRESSIONLEVEL, -1);
+   } else if (compressor_id == MONGOC_COMPRESSOR_ZSTD_ID) {
+      compression_level = mongoc_uri_get_option_as_int32 (
+         cluster->uri, MONGOC_URI_ZSTDCOMPRESSIONLEVEL, -1);
    }
 
-   BSON_ASSERT (allocate > 0);
-   data = bson_malloc0 (allocate);
-   size = _mongoc_cluster_buffer_iovec (
-      cluster->iov.data, cluster->iov.len, 16, data);
-   BSON_ASSERT (size);
+   BSON_ASSERT (size > 0);
 
-   output_length =
-      mongoc_compressor_max_compressed_length (compressor_id, size);
-   if (!output_length) {
+   if (!mongoc_compressor_max_compressed_length (compressor_id, size)) {
       bson_set_error (error,
                       MONGOC_ERROR_COMMAND,
                       MONGOC_ERROR_COMMAND_INVALID_ARG,
                       "Could not determine compression bounds for %s",
                       mongoc_compressor_id_to_name (compressor_id));
-      bson_free (data);
-      return NULL;
+      return false;
    }
 
-   output = (char *) bson_malloc0 (output_length);
-   if (mongoc_compress (compressor_id,
-                        compression_level,
-                        data,
-                        size,
-                        output,
-                        &output_length)) {
+   if (mongoc_compress_iovec (compressor_id,
+                              compression_level,
+                              (mongoc_iovec_t *) cluster->iov.data,
+                              cluster->iov.len,
+                              16,
+                              &cluster->compress)) {
       rpc_le->header.msg_len = 0;
       rpc_le->compressed.original_opcode =
          BSON_UINT32_FROM_LE (rpc_le->header.opcode);
@@ -886,27 +1112,142 @@ _mongoc_rpc_compress (struct _mongoc_cluster_t *cluster,
       rpc_le->header.response_to =
          BSON_UINT32_FROM_LE (rpc_le->header.response_to);
 
-      rpc_le->compressed.uncompressed_size = size;
+      rpc_le->compressed.uncompressed_size = (int32_t) size;
       rpc_le->compressed.compressor_id = compressor_id;
-      rpc_le->compressed.compressed_message = (const uint8_t *) output;
-      rpc_le->compressed.compressed_message_len = output_length;
-      bson_free (data);
-
+      rpc_le->compressed.compressed_message = cluster->compress.out;
+      rpc_le->compressed.compressed_message_len =
+         (int32_t) cluster->compress.out_len;
+
+      mongoc_counter_compression_egress_bytes_add ((int64_t) size);
+      mongoc_counter_compression_egress_compressed_add (
+         (int64_t) cluster->compress.out_len);
+      _mongoc_rpc_compress_count (
+         command_name, size, cluster->compress.out_len);
+
+      if (adaptive) {
+         mongoc_compress_history_record (&cluster->compress_history,
+                                         command_name,
+                                         size,
+                                         cluster->compress.out_len);
+      }
 
-      _mongoc_array_destroy (&cluster->iov);
-      _mongoc_array_init (&cluster->iov, sizeof (mongoc_iovec_t));
+      _mongoc_array_clear (&cluster->iov);
       _mongoc_rpc_gather (rpc_le, &cluster->iov);
       _mongoc_rpc_swab_to_le (rpc_le);
-      return output;
+      return true;
    } else {
       MONGOC_WARNING ("Could not compress data with %s",
                       mongoc_compressor_id_to_name (compressor_id));
    }
-   bson_free (data);
-   bson_free (output);
-   return NULL;
+
+   return false;
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_rpc_append_checksum --
+ *
+ *       Append an OP_MSG's checksum: the CRC-32C of the (little endian)
+ *       message in @iov, whose flags and length must already count it.
+ *       The iovec points to @checksum_le, which must outlive the write.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_rpc_append_checksum (mongoc_array_t *iov, uint32_t *checksum_le)
+{
+   mongoc_iovec_t checksum_iov;
+
+   *checksum_le = BSON_UINT32_TO_LE (
+      _mongoc_crc32c_iovec ((const mongoc_iovec_t *) iov->data, iov->len));
+
+   checksum_iov.iov_base = (void *) checksum_le;
+   checksum_iov.iov_len = 4;
+   _mongoc_array_append_val (iov, checksum_iov);
+}
+
+
+/* an OP_MSG with a checksum ends with the CRC-32C of all that precedes it */
+static bool
+_mongoc_rpc_msg_checksum_valid (const uint8_t *buf, size_t buflen)
+{
+   uint32_t checksum;
+   uint32_t flags;
+
+   memcpy (&flags, buf + 16, 4);
+   if (!(BSON_UINT32_FROM_LE (flags) & MONGOC_MSG_CHECKSUM_PRESENT)) {
+      return true;
+   }
+
+   memcpy (&checksum, buf + buflen - 4, 4);
+   if (BSON_UINT32_FROM_LE (checksum) != _mongoc_crc32c (0, buf, buflen - 4)) {
+      mongoc_counter_protocol_checksum_failures_inc ();
+      return false;
+   }
+
+   return true;
 }
 
+
+#if BSON_BYTE_ORDER == BSON_LITTLE_ENDIAN
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_rpc_scatter_msg_fast --
+ *
+ *       Scatter the usual reply: an OP_MSG with only a kind-0 section,
+ *       perhaps followed by a checksum. The header is in host order on a
+ *       little-endian host, so it's read in place, and the message must
+ *       be exactly the header and the section, so comparing their sum
+ *       with @buflen bounds it in one check.
+ *
+ * Returns:
+ *       false if the message is anything else, for _mongoc_rpc_scatter
+ *       to parse.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static BSON_INLINE bool
+_mongoc_rpc_scatter_msg_fast (mongoc_rpc_t *rpc,
+                              const uint8_t *buf,
+                              size_t buflen)
+{
+   mongoc_rpc_msg_t *msg = &rpc->msg;
+   uint32_t doc_len;
+   uint64_t expected_len;
+
+   /* the header, flags, section kind, and document length */
+   if (buflen < 25 || buf[20] != 0) {
+      return false;
+   }
+
+   memcpy (&msg->msg_len, buf, 4);
+   memcpy (&msg->request_id, buf + 4, 4);
+   memcpy (&msg->response_to, buf + 8, 4);
+   memcpy (&msg->opcode, buf + 12, 4);
+   memcpy (&msg->flags, buf + 16, 4);
+   memcpy (&doc_len, buf + 21, 4);
+
+   expected_len = (uint64_t) doc_len + 21 +
+                  (msg->flags & MONGOC_MSG_CHECKSUM_PRESENT ? 4 : 0);
+   if (msg->opcode != MONGOC_OPCODE_MSG || doc_len < 5 ||
+       expected_len != (uint64_t) buflen ||
+       (uint64_t) (uint32_t) msg->msg_len != expected_len) {
+      return false;
+   }
+
+   msg->sections[0].payload_type = 0;
+   msg->sections[0].payload.bson_document = buf + 21;
+   msg->n_sections = 1;
+
+   return true;
+}
+#endif
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -916,6 +1257,8 @@ _mongoc_rpc_compress (struct _mongoc_cluster_t *cluster,
  *       Caller should check if resulting opcode is OP_COMPRESSED
  *       BEFORE swabbing to native endianness.
  *
+ *       An OP_MSG with a checksum is rejected unless it matches.
+ *
  *--------------------------------------------------------------------------
  */
 
@@ -924,6 +1267,15 @@ _mongoc_rpc_scatter (mongoc_rpc_t *rpc, const uint8_t *buf, size_t buflen)
 {
    mongoc_opcode_t opcode;
 
+#if BSON_BYTE_ORDER == BSON_LITTLE_ENDIAN
+   /* skips zeroing the whole rpc: the reply's fields are all set */
+   if (BSON_LIKELY (_mongoc_rpc_scatter_msg_fast (rpc, buf, buflen))) {
+      mongoc_counter_op_ingress_total_inc ();
+      mongoc_counter_op_ingress_msg_inc ();
+      return _mongoc_rpc_msg_checksum_valid (buf, buflen);
+   }
+#endif
+
    memset (rpc, 0, sizeof *rpc);
 
    if (BSON_UNLIKELY (buflen < 16)) {
@@ -948,7 +1300,8 @@ _mongoc_rpc_scatter (mongoc_rpc_t *rpc, const uint8_t *buf, size_t buflen)
 
    case MONGOC_OPCODE_MSG:
       mongoc_counter_op_ingress_msg_inc ();
-      return _mongoc_rpc_scatter_msg (&rpc->msg, buf, buflen);
+      return _mongoc_rpc_scatter_msg (&rpc->msg, buf, buflen) &&
+             _mongoc_rpc_msg_checksum_valid (buf, buflen);
 
 
    /* useless, we are never *getting* these opcodes */
@@ -1047,6 +1400,8 @@ _mongoc_rpc_prep_command (mongoc_rpc_t *rpc,
    rpc->query.skip = 0;
    rpc->query.n_return = -1;
    rpc->query.fields = NULL;
+   /* only OP_MSG commands are sent in parts */
+   BSON_ASSERT (!cmd->command_suffix);
    rpc->query.query = bson_get_data (cmd->command);
 
    /* Find, getMore And killCursors Commands Spec: "When sending a find command
@@ -32,6 +32,8 @@ BSON_BEGIN_DECLS
 
 #define MONGOC_SCRAM_HASH_SIZE 20
 
+#define MONGOC_SCRAM_CACHE_SIZE 64
+
 typedef struct _mongoc_scram_t {
    bool done;
    int step;
@@ -53,6 +55,23 @@ typedef struct _mongoc_scram_t {
 void
 _mongoc_scram_startup ();
 
+void
+_mongoc_scram_cleanup (void);
+
+bool
+_mongoc_scram_cache_get (const char *hashed_password,
+                         const uint8_t *salt,
+                         uint32_t salt_len,
+                         uint32_t iterations,
+                         uint8_t *salted_password /* OUT */);
+
+void
+_mongoc_scram_cache_put (const char *hashed_password,
+                         const uint8_t *salt,
+                         uint32_t salt_len,
+                         uint32_t iterations,
+                         const uint8_t *salted_password);
+
 void
 _mongoc_scram_init (mongoc_scram_t *scram);
 
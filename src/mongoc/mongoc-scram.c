@@ -22,6 +22,7 @@
 #include "mongoc-error.h"
 #include "mongoc-scram-private.h"
 #include "mongoc-rand-private.h"
+#include "mongoc-thread-private.h"
 #include "mongoc-util-private.h"
 #include "mongoc-trace-private.h"
 
@@ -39,10 +40,152 @@
    MONGOC_SCRAM_B64_ENCODED_SIZE (MONGOC_SCRAM_HASH_SIZE)
 
 
+/* salted passwords shared by every client in the process, so that only the
+ * first connection for a user, password, salt, and iteration count pays for
+ * Hi(). entries are identified by an HMAC of the salt and iteration count
+ * keyed with the hashed password: the cache holds no password hashes */
+typedef struct {
+   bool used;
+   uint8_t id[MONGOC_SCRAM_HASH_SIZE];
+   uint8_t salted_password[MONGOC_SCRAM_HASH_SIZE];
+} mongoc_scram_cache_entry_t;
+
+
+static mongoc_mutex_t gSCRAMCacheMutex;
+static mongoc_scram_cache_entry_t gSCRAMCache[MONGOC_SCRAM_CACHE_SIZE];
+static int gSCRAMCacheNext; /* the slot to replace once all are used */
+
+
 void
 _mongoc_scram_startup ()
 {
    mongoc_b64_initialize_rmap ();
+   mongoc_mutex_init (&gSCRAMCacheMutex);
+}
+
+
+void
+_mongoc_scram_cleanup (void)
+{
+   memset (gSCRAMCache, 0, sizeof gSCRAMCache);
+   mongoc_mutex_destroy (&gSCRAMCacheMutex);
+}
+
+
+static void
+_mongoc_scram_cache_id (const char *hashed_password,
+                        const uint8_t *salt,
+                        uint32_t salt_len,
+                        uint32_t iterations,
+                        uint8_t *id /* OUT */)
+{
+   mongoc_crypto_t crypto;
+   uint8_t data[MONGOC_SCRAM_B64_HASH_SIZE + 4];
+
+   BSON_ASSERT (salt_len <= sizeof data - 4);
+
+   memcpy (data, salt, salt_len);
+   data[salt_len] = (uint8_t) (iterations >> 24);
+   data[salt_len + 1] = (uint8_t) (iterations >> 16);
+   data[salt_len + 2] = (uint8_t) (iterations >> 8);
+   data[salt_len + 3] = (uint8_t) iterations;
+
+   mongoc_crypto_init (&crypto);
+   mongoc_crypto_hmac_sha1 (&crypto,
+                            hashed_password,
+                            (int) strlen (hashed_password),
+                            data,
+                            (int) salt_len + 4,
+                            id);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_scram_cache_get --
+ *
+ *       Look up the salted password another connection computed for
+ *       @hashed_password with this @salt and @iterations. Every entry is
+ *       compared with mongoc_memcmp, without stopping at a match, so the
+ *       time taken does not depend on which entry, if any, matched.
+ *
+ * Returns:
+ *       true and @salted_password filled out if found.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_scram_cache_get (const char *hashed_password,
+                         const uint8_t *salt,
+                         uint32_t salt_len,
+                         uint32_t iterations,
+                         uint8_t *salted_password /* OUT */)
+{
+   uint8_t id[MONGOC_SCRAM_HASH_SIZE];
+   bool found = false;
+   int i;
+
+   _mongoc_scram_cache_id (hashed_password, salt, salt_len, iterations, id);
+
+   mongoc_mutex_lock (&gSCRAMCacheMutex);
+
+   for (i = 0; i < MONGOC_SCRAM_CACHE_SIZE; i++) {
+      if (gSCRAMCache[i].used &&
+          0 == mongoc_memcmp (gSCRAMCache[i].id, id, sizeof id)) {
+         memcpy (salted_password,
+                 gSCRAMCache[i].salted_password,
+                 MONGOC_SCRAM_HASH_SIZE);
+         found = true;
+      }
+   }
+
+   mongoc_mutex_unlock (&gSCRAMCacheMutex);
+
+   return found;
+}
+
+
+void
+_mongoc_scram_cache_put (const char *hashed_password,
+                         const uint8_t *salt,
+                         uint32_t salt_len,
+                         uint32_t iterations,
+                         const uint8_t *salted_password)
+{
+   uint8_t id[MONGOC_SCRAM_HASH_SIZE];
+   mongoc_scram_cache_entry_t *entry = NULL;
+   int i;
+
+   _mongoc_scram_cache_id (hashed_password, salt, salt_len, iterations, id);
+
+   mongoc_mutex_lock (&gSCRAMCacheMutex);
+
+   /* replace the same credentials' entry, or take a free one */
+   for (i = 0; i < MONGOC_SCRAM_CACHE_SIZE; i++) {
+      if (gSCRAMCache[i].used &&
+          0 == mongoc_memcmp (gSCRAMCache[i].id, id, sizeof id)) {
+         entry = &gSCRAMCache[i];
+      }
+   }
+
+   for (i = 0; !entry && i < MONGOC_SCRAM_CACHE_SIZE; i++) {
+      if (!gSCRAMCache[i].used) {
+         entry = &gSCRAMCache[i];
+      }
+   }
+
+   if (!entry) {
+      entry = &gSCRAMCache[gSCRAMCacheNext];
+      gSCRAMCacheNext = (gSCRAMCacheNext + 1) % MONGOC_SCRAM_CACHE_SIZE;
+   }
+
+   entry->used = true;
+   memcpy (entry->id, id, sizeof id);
+   memcpy (entry->salted_password, salted_password, MONGOC_SCRAM_HASH_SIZE);
+
+   mongoc_mutex_unlock (&gSCRAMCacheMutex);
 }
 
 
@@ -177,7 +320,7 @@ _mongoc_scram_start (mongoc_scram_t *scram,
    scram->auth_messagemax = outbufmax;
 
    /* the server uses a 24 byte random nonce.  so we do as well */
-   if (1 != _mongoc_rand_bytes (nonce, sizeof (nonce))) {
+   if (1 != _mongoc_rand_buffered_bytes (nonce, sizeof (nonce))) {
       bson_set_error (error,
                       MONGOC_ERROR_SCRAM,
                       MONGOC_ERROR_SCRAM_PROTOCOL_ERROR,
@@ -308,6 +451,18 @@ _mongoc_scram_salt_password (mongoc_scram_t *scram,
    int k;
    uint8_t *output = scram->salted_password;
 
+   /* the crypto library's PBKDF2 is several times faster than the loop */
+   if (mongoc_crypto_pbkdf2_hmac_sha1 (&scram->crypto,
+                                       password,
+                                       password_len,
+                                       salt,
+                                       salt_len,
+                                       iterations,
+                                       MONGOC_SCRAM_HASH_SIZE,
+                                       output)) {
+      return;
+   }
+
    memcpy (start_key, salt, salt_len);
 
    start_key[salt_len] = 0;
@@ -611,13 +766,23 @@ _mongoc_scram_step2 (mongoc_scram_t *scram,
       goto FAIL;
    }
 
-   if (!*scram->salted_password) {
+   if (!*scram->salted_password &&
+       !_mongoc_scram_cache_get (hashed_password,
+                                 decoded_salt,
+                                 (uint32_t) decoded_salt_len,
+                                 (uint32_t) iterations,
+                                 scram->salted_password)) {
       _mongoc_scram_salt_password (scram,
                                    hashed_password,
                                    (uint32_t) strlen (hashed_password),
                                    decoded_salt,
                                    decoded_salt_len,
                                    iterations);
+      _mongoc_scram_cache_put (hashed_password,
+                               decoded_salt,
+                               (uint32_t) decoded_salt_len,
+                               (uint32_t) iterations,
+                               scram->salted_password);
    }
 
    _mongoc_scram_generate_client_proof (scram, outbuf, outbufmax, outbuflen);
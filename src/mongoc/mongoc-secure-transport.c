@@ -408,18 +408,51 @@ mongoc_secure_transport_read (SSLConnectionRef connection,
                               size_t *data_length)
 {
    mongoc_stream_tls_t *tls = (mongoc_stream_tls_t *) connection;
+   mongoc_stream_tls_secure_transport_t *secure_transport =
+      (mongoc_stream_tls_secure_transport_t *) tls->ctx;
+   mongoc_iovec_t iov[2];
+   size_t got;
    ssize_t length;
    ENTRY;
 
+   /* Secure Transport asks for each record's header, then its body. read
+    * the next header along with each body if the server already sent it,
+    * saving a read per record without reading past it */
+   got = BSON_MIN (*data_length, secure_transport->read_ahead_len);
+   memcpy (data, secure_transport->read_ahead, got);
+   memmove (secure_transport->read_ahead,
+            secure_transport->read_ahead + got,
+            secure_transport->read_ahead_len - got);
+   secure_transport->read_ahead_len -= got;
+
+   if (got == *data_length) {
+      RETURN (noErr);
+   }
+
+   iov[0].iov_base = (char *) data + got;
+   iov[0].iov_len = *data_length - got;
+   iov[1].iov_base = secure_transport->read_ahead;
+   iov[1].iov_len = sizeof secure_transport->read_ahead;
+
    errno = 0;
    /* 4 arguments is *min_bytes* -- This is not a negotiation.
     * Secure Transport wants all or nothing. We must continue reading until
     * we get this amount, or timeout */
-   length = mongoc_stream_read (
-      tls->base_stream, data, *data_length, *data_length, tls->timeout_msec);
+   length = mongoc_stream_readv (
+      tls->base_stream, iov, 2, iov[0].iov_len, tls->timeout_msec);
+
+   if (length > (ssize_t) iov[0].iov_len) {
+      secure_transport->read_ahead_len = (size_t) length - iov[0].iov_len;
+      length = (ssize_t) iov[0].iov_len;
+   }
 
    if (length > 0) {
-      *data_length = length;
+      *data_length = got + length;
+      RETURN (noErr);
+   }
+
+   if (got) {
+      *data_length = got;
       RETURN (noErr);
    }
 
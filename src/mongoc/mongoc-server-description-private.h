@@ -18,6 +18,7 @@
 #define MONGOC_SERVER_DESCRIPTION_PRIVATE_H
 
 #include "mongoc-server-description.h"
+#include "mongoc-counters-private.h"
 
 
 #define MONGOC_DEFAULT_WIRE_VERSION 0
@@ -29,6 +30,9 @@
 /* represent a server or topology with no replica set config version */
 #define MONGOC_NO_SET_VERSION -1
 
+/* a server or topology without logicalSessionTimeoutMinutes */
+#define MONGOC_NO_SESSIONS -1
+
 typedef enum {
    MONGOC_SERVER_UNKNOWN,
    MONGOC_SERVER_STANDALONE,
@@ -42,6 +46,22 @@ typedef enum {
    MONGOC_SERVER_DESCRIPTION_TYPES,
 } mongoc_server_description_type_t;
 
+/* one {'key': 'value'} pair of a tag set, pointing into the BSON it was
+ * compiled from. "pos" is the pair's position in the document, so among
+ * duplicate keys the first one sorts first, as bson_iter_find sees it. */
+typedef struct {
+   const char *key;
+   const char *value;
+   uint32_t value_len;
+   uint32_t pos;
+} mongoc_compiled_tag_t;
+
+/* a tag set's pairs sorted by key, so matching is a merge of two arrays */
+typedef struct {
+   mongoc_compiled_tag_t *tags;
+   size_t n_tags;
+} mongoc_compiled_tag_set_t;
+
 struct _mongoc_server_description_t {
    uint32_t id;
    mongoc_host_list_t host;
@@ -64,18 +84,32 @@ struct _mongoc_server_description_t {
    int32_t max_msg_size;
    int32_t max_bson_obj_size;
    int32_t max_write_batch_size;
+   int64_t session_timeout_minutes;
 
    bson_t hosts;
    bson_t passives;
    bson_t arbiters;
 
    bson_t tags;
+   /* "tags" compiled once per isMaster reply, for server selection */
+   mongoc_compiled_tag_set_t compiled_tags;
    const char *current_primary;
    int64_t set_version;
    bson_oid_t election_id;
    int64_t last_write_date_ms;
+   /* "lastWrite.opTime.ts", the cluster time of the server's last write,
+    * or 0/0 if unknown */
+   uint32_t last_write_timestamp;
+   uint32_t last_write_increment;
 
    bson_t compressors;
+
+   /* the topology description's sdam_epoch when this server's reply was
+    * last fully processed */
+   int64_t sdam_epoch;
+
+   /* this process's traffic to the server, in the counters segment */
+   mongoc_server_counters_ref_t counters;
 };
 
 void
@@ -120,6 +154,20 @@ mongoc_server_description_handle_ismaster (mongoc_server_description_t *sd,
                                            int64_t rtt_msec,
                                            const bson_error_t *error /* IN */);
 
+bool
+_mongoc_server_description_ismaster_unchanged (
+   const mongoc_server_description_t *sd, const bson_t *ismaster_response);
+
+void
+_mongoc_server_description_update_unchanged (
+   mongoc_server_description_t *sd,
+   const bson_t *ismaster_response,
+   int64_t rtt_msec);
+
+bool
+_mongoc_server_description_equal (const mongoc_server_description_t *sd1,
+                                  const mongoc_server_description_t *sd2);
+
 void
 mongoc_server_description_filter_stale (mongoc_server_description_t **sds,
                                         size_t sds_len,
@@ -127,10 +175,30 @@ mongoc_server_description_filter_stale (mongoc_server_description_t **sds,
                                         int64_t heartbeat_frequency_ms,
                                         const mongoc_read_prefs_t *read_prefs);
 
+void
+_mongoc_compiled_tag_set_init (mongoc_compiled_tag_set_t *tag_set);
+
+void
+_mongoc_compiled_tag_set_compile (mongoc_compiled_tag_set_t *tag_set,
+                                  const bson_t *tags);
+
+bool
+_mongoc_compiled_tag_set_match (const mongoc_compiled_tag_set_t *tag_set,
+                                const mongoc_compiled_tag_set_t *server_tags);
+
+void
+_mongoc_compiled_tag_set_cleanup (mongoc_compiled_tag_set_t *tag_set);
+
 void
 mongoc_server_description_filter_tags (
    mongoc_server_description_t **descriptions,
    size_t description_len,
    const mongoc_read_prefs_t *read_prefs);
 
+void
+mongoc_server_description_filter_caught_up (
+   mongoc_server_description_t **descriptions,
+   size_t description_len,
+   const mongoc_read_prefs_t *read_prefs);
+
 #endif
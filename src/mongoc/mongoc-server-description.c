@@ -31,17 +31,15 @@
 
 static bson_oid_t kObjectIdZero = {{0}};
 
-static bool
-_match_tag_set (const mongoc_server_description_t *sd,
-                bson_iter_t *tag_set_iter);
-
 /* Destroy allocated resources within @description, but don't free it */
 void
 mongoc_server_description_cleanup (mongoc_server_description_t *sd)
 {
    BSON_ASSERT (sd);
 
+   _mongoc_server_counters_retire (&sd->counters);
    bson_destroy (&sd->last_is_master);
+   _mongoc_compiled_tag_set_cleanup (&sd->compiled_tags);
 }
 
 /* Reset fields inside this sd, but keep same id, host information, and RTT,
@@ -60,7 +58,10 @@ mongoc_server_description_reset (mongoc_server_description_t *sd)
    sd->max_msg_size = MONGOC_DEFAULT_MAX_MSG_SIZE;
    sd->max_bson_obj_size = MONGOC_DEFAULT_BSON_OBJ_SIZE;
    sd->max_write_batch_size = MONGOC_DEFAULT_WRITE_BATCH_SIZE;
+   sd->session_timeout_minutes = MONGOC_NO_SESSIONS;
    sd->last_write_date_ms = -1;
+   sd->last_write_timestamp = 0;
+   sd->last_write_increment = 0;
 
    /* always leave last ismaster in an init-ed state until we destroy sd */
    bson_destroy (&sd->last_is_master);
@@ -72,6 +73,8 @@ mongoc_server_description_reset (mongoc_server_description_t *sd)
    bson_init (&sd->passives);
    bson_init (&sd->arbiters);
    bson_init (&sd->tags);
+   _mongoc_compiled_tag_set_cleanup (&sd->compiled_tags);
+   _mongoc_compiled_tag_set_init (&sd->compiled_tags);
    bson_init (&sd->compressors);
 
    sd->me = NULL;
@@ -108,6 +111,7 @@ mongoc_server_description_init (mongoc_server_description_t *sd,
    sd->id = id;
    sd->type = MONGOC_SERVER_UNKNOWN;
    sd->round_trip_time_msec = -1;
+   memset (&sd->counters, 0, sizeof sd->counters);
 
    if (!_mongoc_host_list_from_string (&sd->host, address)) {
       MONGOC_WARNING ("Failed to parse uri for %s", address);
@@ -116,6 +120,7 @@ mongoc_server_description_init (mongoc_server_description_t *sd,
 
    sd->connection_address = sd->host.host_and_port;
    bson_init (&sd->last_is_master);
+   _mongoc_compiled_tag_set_init (&sd->compiled_tags);
 
    mongoc_server_description_reset (sd);
 
@@ -439,6 +444,9 @@ mongoc_server_description_update_rtt (mongoc_server_description_t *server,
       server->round_trip_time_msec = (int64_t) (
          ALPHA * rtt_msec + (1 - ALPHA) * server->round_trip_time_msec);
    }
+
+   _mongoc_server_counters_set_rtt (&server->counters,
+                                    server->round_trip_time_msec);
 }
 
 
@@ -461,6 +469,23 @@ _mongoc_server_description_set_error (mongoc_server_description_t *sd,
 }
 
 
+/* "opTime.ts" in the isMaster reply's "lastWrite" document */
+static void
+_mongoc_server_description_set_last_write_optime (
+   mongoc_server_description_t *sd, const bson_iter_t *last_write)
+{
+   bson_iter_t child;
+   bson_iter_t ts;
+
+   if (bson_iter_recurse (last_write, &child) &&
+       bson_iter_find_descendant (&child, "opTime.ts", &ts) &&
+       BSON_ITER_HOLDS_TIMESTAMP (&ts)) {
+      bson_iter_timestamp (
+         &ts, &sd->last_write_timestamp, &sd->last_write_increment);
+   }
+}
+
+
 /*
  *-------------------------------------------------------------------------
  *
@@ -531,6 +556,11 @@ mongoc_server_description_handle_ismaster (mongoc_server_description_t *sd,
          if (!BSON_ITER_HOLDS_INT32 (&iter))
             goto failure;
          sd->max_write_batch_size = bson_iter_int32 (&iter);
+      } else if (strcmp ("logicalSessionTimeoutMinutes",
+                         bson_iter_key (&iter)) == 0) {
+         if (!BSON_ITER_HOLDS_NUMBER (&iter))
+            goto failure;
+         sd->session_timeout_minutes = bson_iter_as_int64 (&iter);
       } else if (strcmp ("minWireVersion", bson_iter_key (&iter)) == 0) {
          if (!BSON_ITER_HOLDS_INT32 (&iter))
             goto failure;
@@ -590,6 +620,7 @@ mongoc_server_description_handle_ismaster (mongoc_server_description_t *sd,
             goto failure;
          bson_iter_document (&iter, &len, &bytes);
          bson_init_static (&sd->tags, bytes, len);
+         _mongoc_compiled_tag_set_compile (&sd->compiled_tags, &sd->tags);
       } else if (strcmp ("hidden", bson_iter_key (&iter)) == 0) {
          is_hidden = bson_iter_bool (&iter);
       } else if (strcmp ("lastWrite", bson_iter_key (&iter)) == 0) {
@@ -601,6 +632,7 @@ mongoc_server_description_handle_ismaster (mongoc_server_description_t *sd,
          }
 
          sd->last_write_date_ms = bson_iter_date_time (&child);
+         _mongoc_server_description_set_last_write_optime (sd, &iter);
       } else if (strcmp ("idleWritePeriodMillis", bson_iter_key (&iter)) == 0) {
          sd->last_write_date_ms = bson_iter_as_int64 (&iter);
       } else if (strcmp ("compression", bson_iter_key (&iter)) == 0) {
@@ -649,6 +681,170 @@ failure:
    EXIT;
 }
 
+/* fields that change in every isMaster reply, but don't change the server's
+ * role: see _mongoc_server_description_ismaster_unchanged */
+static bool
+_mongoc_server_description_is_volatile_field (const char *key)
+{
+   return !strcmp (key, "localTime") || !strcmp (key, "lastWrite") ||
+          !strcmp (key, "$clusterTime") || !strcmp (key, "operationTime");
+}
+
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_server_description_ismaster_unchanged --
+ *
+ *       Check if @ismaster_response matches the reply @sd was last updated
+ *       from, byte for byte, apart from the values of fields like
+ *       "localTime" that change every heartbeat. Those values must have
+ *       the same sizes as before, so the replies have the same layout.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_server_description_ismaster_unchanged (
+   const mongoc_server_description_t *sd, const bson_t *ismaster_response)
+{
+   bson_iter_t prev;
+   bson_iter_t iter;
+   bool prev_more;
+   bool more;
+
+   if (!sd->has_is_master || sd->type == MONGOC_SERVER_UNKNOWN ||
+       !ismaster_response ||
+       ismaster_response->len != sd->last_is_master.len) {
+      return false;
+   }
+
+   if (!bson_iter_init (&prev, &sd->last_is_master) ||
+       !bson_iter_init (&iter, ismaster_response)) {
+      return false;
+   }
+
+   for (;;) {
+      prev_more = bson_iter_next (&prev);
+      more = bson_iter_next (&iter);
+
+      if (prev_more != more) {
+         return false;
+      }
+
+      if (!more) {
+         return true;
+      }
+
+      if (prev.next_off - prev.off != iter.next_off - iter.off) {
+         return false;
+      }
+
+      if (_mongoc_server_description_is_volatile_field (
+             bson_iter_key (&iter))) {
+         if (strcmp (bson_iter_key (&prev), bson_iter_key (&iter))) {
+            return false;
+         }
+      } else if (memcmp (prev.raw + prev.off,
+                         iter.raw + iter.off,
+                         iter.next_off - iter.off)) {
+         return false;
+      }
+   }
+}
+
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_server_description_update_unchanged --
+ *
+ *       Update @sd from a reply for which
+ *       _mongoc_server_description_ismaster_unchanged returned true,
+ *       without parsing it again: overwrite the stored reply, which has the
+ *       same layout so the fields pointing into it stay valid, and update
+ *       the last write date and round trip time.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+void
+_mongoc_server_description_update_unchanged (
+   mongoc_server_description_t *sd,
+   const bson_t *ismaster_response,
+   int64_t rtt_msec)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+
+   BSON_ASSERT (ismaster_response->len == sd->last_is_master.len);
+
+   memcpy ((uint8_t *) bson_get_data (&sd->last_is_master),
+           bson_get_data (ismaster_response),
+           ismaster_response->len);
+
+   if (bson_iter_init_find (&iter, &sd->last_is_master, "lastWrite") &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter) && bson_iter_recurse (&iter, &child) &&
+       bson_iter_find (&child, "lastWriteDate") &&
+       BSON_ITER_HOLDS_DATE_TIME (&child)) {
+      sd->last_write_date_ms = bson_iter_date_time (&child);
+      _mongoc_server_description_set_last_write_optime (sd, &iter);
+   }
+
+   mongoc_server_description_update_rtt (sd, rtt_msec);
+}
+
+
+static bool
+_mongoc_server_description_str_equal (const char *a, const char *b, bool nocase)
+{
+   if (!a || !b) {
+      return a == b;
+   }
+
+   return nocase ? !strcasecmp (a, b) : !strcmp (a, b);
+}
+
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_server_description_equal --
+ *
+ *       Whether two descriptions of a server match in the fields the SDAM
+ *       Monitoring Spec compares to decide if a server changed: not the
+ *       round trip time or the time of the last update.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_server_description_equal (const mongoc_server_description_t *sd1,
+                                  const mongoc_server_description_t *sd2)
+{
+   return sd1->type == sd2->type &&
+          sd1->min_wire_version == sd2->min_wire_version &&
+          sd1->max_wire_version == sd2->max_wire_version &&
+          _mongoc_server_description_str_equal (
+             sd1->connection_address, sd2->connection_address, true) &&
+          _mongoc_server_description_str_equal (sd1->me, sd2->me, true) &&
+          bson_equal (&sd1->hosts, &sd2->hosts) &&
+          bson_equal (&sd1->passives, &sd2->passives) &&
+          bson_equal (&sd1->arbiters, &sd2->arbiters) &&
+          bson_equal (&sd1->tags, &sd2->tags) &&
+          _mongoc_server_description_str_equal (
+             sd1->set_name, sd2->set_name, false) &&
+          sd1->set_version == sd2->set_version &&
+          bson_oid_equal (&sd1->election_id, &sd2->election_id) &&
+          _mongoc_server_description_str_equal (
+             sd1->current_primary, sd2->current_primary, true) &&
+          sd1->session_timeout_minutes == sd2->session_timeout_minutes &&
+          sd1->error.domain == sd2->error.domain &&
+          sd1->error.code == sd2->error.code &&
+          !strcmp (sd1->error.message, sd2->error.message);
+}
+
+
 /*
  *-------------------------------------------------------------------------
  *
@@ -674,6 +870,8 @@ mongoc_server_description_new_copy (
    copy->opened = description->opened;
    memcpy (&copy->host, &description->host, sizeof (copy->host));
    copy->round_trip_time_msec = -1;
+   copy->counters.slot = description->counters.slot;
+   copy->counters.generation = description->counters.generation;
 
    copy->connection_address = copy->host.host_and_port;
    bson_init (&copy->last_is_master);
@@ -805,31 +1003,27 @@ mongoc_server_description_filter_tags (
    size_t description_len,
    const mongoc_read_prefs_t *read_prefs)
 {
-   const bson_t *rp_tags;
-   bson_iter_t rp_tagset_iter;
-   bson_iter_t tag_set_iter;
+   const mongoc_compiled_tag_set_t *tag_set;
    bool *sd_matched = NULL;
    bool found;
    size_t i;
+   size_t j;
 
    if (!read_prefs) {
       /* NULL read_prefs is PRIMARY, no tags to filter by */
       return;
    }
 
-   rp_tags = mongoc_read_prefs_get_tags (read_prefs);
-
-   if (bson_count_keys (rp_tags) == 0) {
+   if (read_prefs->n_compiled_tag_sets == 0) {
       /* no tags to filter by */
       return;
    }
 
    sd_matched = (bool *) bson_malloc0 (sizeof (bool) * description_len);
 
-   bson_iter_init (&rp_tagset_iter, rp_tags);
-
    /* for each read preference tag set */
-   while (bson_iter_next (&rp_tagset_iter)) {
+   for (j = 0; j < read_prefs->n_compiled_tag_sets; j++) {
+      tag_set = &read_prefs->compiled_tag_sets[j];
       found = false;
 
       for (i = 0; i < description_len; i++) {
@@ -838,8 +1032,8 @@ mongoc_server_description_filter_tags (
             continue;
          }
 
-         bson_iter_recurse (&rp_tagset_iter, &tag_set_iter);
-         sd_matched[i] = _match_tag_set (descriptions[i], &tag_set_iter);
+         sd_matched[i] = _mongoc_compiled_tag_set_match (
+            tag_set, &descriptions[i]->compiled_tags);
          if (sd_matched[i]) {
             found = true;
          }
@@ -875,42 +1069,113 @@ CLEANUP:
 }
 
 
+void
+_mongoc_compiled_tag_set_init (mongoc_compiled_tag_set_t *tag_set)
+{
+   tag_set->tags = NULL;
+   tag_set->n_tags = 0;
+}
+
+
+static int
+_compiled_tag_cmp (const void *a, const void *b)
+{
+   const mongoc_compiled_tag_t *tag_a = (const mongoc_compiled_tag_t *) a;
+   const mongoc_compiled_tag_t *tag_b = (const mongoc_compiled_tag_t *) b;
+   int r;
+
+   r = strcmp (tag_a->key, tag_b->key);
+   if (r) {
+      return r;
+   }
+
+   return tag_a->pos < tag_b->pos ? -1 : 1;
+}
+
+
 /*
  *-------------------------------------------------------------------------
  *
- * _match_tag_set --
+ * _mongoc_compiled_tag_set_compile --
  *
- *       Check if a server's tags match one tag set, like
- *       {'tag1': 'value1', 'tag2': 'value2'}.
+ *       Sort the pairs of one tag set, like {'tag1': 'value1'}, by key.
+ *       The result points into @tags, which must outlive it unmodified.
  *
  *-------------------------------------------------------------------------
  */
-static bool
-_match_tag_set (const mongoc_server_description_t *sd,
-                bson_iter_t *tag_set_iter)
-{
-   bson_iter_t sd_iter;
-   uint32_t read_pref_tag_len;
-   uint32_t sd_len;
-   const char *read_pref_tag;
-   const char *read_pref_val;
-   const char *server_val;
-
-   while (bson_iter_next (tag_set_iter)) {
-      /* one {'tag': 'value'} pair from the read preference's tag set */
-      read_pref_tag = bson_iter_key (tag_set_iter);
-      read_pref_val = bson_iter_utf8 (tag_set_iter, &read_pref_tag_len);
-
-      if (bson_iter_init_find (&sd_iter, &sd->tags, read_pref_tag)) {
-         /* The server has this tag - does it have the right value? */
-         server_val = bson_iter_utf8 (&sd_iter, &sd_len);
-         if (sd_len != read_pref_tag_len ||
-             memcmp (read_pref_val, server_val, read_pref_tag_len)) {
-            /* If the values don't match, no match */
-            return false;
-         }
-      } else {
-         /* If the server description doesn't have that key, no match */
+void
+_mongoc_compiled_tag_set_compile (mongoc_compiled_tag_set_t *tag_set,
+                                  const bson_t *tags)
+{
+   bson_iter_t iter;
+   mongoc_compiled_tag_t *tag;
+   uint32_t n;
+
+   _mongoc_compiled_tag_set_cleanup (tag_set);
+
+   n = bson_count_keys (tags);
+   if (!n || !bson_iter_init (&iter, tags)) {
+      return;
+   }
+
+   tag_set->tags =
+      (mongoc_compiled_tag_t *) bson_malloc (n * sizeof *tag_set->tags);
+
+   while (bson_iter_next (&iter) && tag_set->n_tags < n) {
+      tag = &tag_set->tags[tag_set->n_tags];
+      tag->key = bson_iter_key (&iter);
+      tag->value_len = 0;
+      /* a non-string value only matches another non-string or "" */
+      tag->value = bson_iter_utf8 (&iter, &tag->value_len);
+      tag->pos = (uint32_t) tag_set->n_tags++;
+   }
+
+   qsort (tag_set->tags,
+          tag_set->n_tags,
+          sizeof (mongoc_compiled_tag_t),
+          _compiled_tag_cmp);
+}
+
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_compiled_tag_set_match --
+ *
+ *       Check if a server's tags match one read preference tag set:
+ *       the server must have each of the tag set's keys with the same
+ *       value. Both are sorted by key, so walk them together.
+ *
+ *-------------------------------------------------------------------------
+ */
+bool
+_mongoc_compiled_tag_set_match (const mongoc_compiled_tag_set_t *tag_set,
+                                const mongoc_compiled_tag_set_t *server_tags)
+{
+   const mongoc_compiled_tag_t *tag;
+   const mongoc_compiled_tag_t *server_tag;
+   size_t i;
+   size_t j = 0;
+   int r = 0;
+
+   for (i = 0; i < tag_set->n_tags; i++) {
+      tag = &tag_set->tags[i];
+
+      /* stop at the first of the server's tags with this key, if any */
+      while (j < server_tags->n_tags &&
+             (r = strcmp (server_tags->tags[j].key, tag->key)) < 0) {
+         j++;
+      }
+
+      if (j == server_tags->n_tags || r != 0) {
+         /* the server doesn't have this key, no match */
+         return false;
+      }
+
+      server_tag = &server_tags->tags[j];
+      if (server_tag->value_len != tag->value_len ||
+          memcmp (server_tag->value, tag->value, tag->value_len)) {
+         /* the values don't match, no match */
          return false;
       }
    }
@@ -918,6 +1183,15 @@ _match_tag_set (const mongoc_server_description_t *sd,
    return true;
 }
 
+
+void
+_mongoc_compiled_tag_set_cleanup (mongoc_compiled_tag_set_t *tag_set)
+{
+   bson_free (tag_set->tags);
+   _mongoc_compiled_tag_set_init (tag_set);
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -948,3 +1222,95 @@ mongoc_server_description_compressor_id (
 
    return -1;
 }
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_server_description_get_counters --
+ *
+ *      Get this process's operations, bytes, errors, timeouts, and open
+ *      connections for the server, and its round trip time.
+ *
+ * Returns:
+ *      True if the server is counted. False if the counters segment had
+ *      no room for it, or it has left the topology and its slot has been
+ *      reused; @counters is zeroed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_server_description_get_counters (
+   const mongoc_server_description_t *description,
+   mongoc_server_counters_t *counters)
+{
+   BSON_ASSERT (description);
+   BSON_ASSERT (counters);
+
+   return _mongoc_server_counters_get (&description->counters, counters);
+}
+
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * mongoc_server_description_filter_caught_up --
+ *
+ *       For a read in a causally consistent session, prefer servers that
+ *       have replicated the session's last operation, so the server needn't
+ *       block until it catches up: if a primary or any secondary whose
+ *       last write is at or after @read_prefs' cluster time is a
+ *       candidate, sets the secondaries that are behind it to NULL. If
+ *       none has caught up, or their last writes are unknown, keeps them
+ *       all.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+void
+mongoc_server_description_filter_caught_up (
+   mongoc_server_description_t **descriptions,
+   size_t description_len,
+   const mongoc_read_prefs_t *read_prefs)
+{
+   mongoc_server_description_t *sd;
+   bool *behind;
+   bool found = false;
+   size_t i;
+
+   if (!read_prefs || (!read_prefs->after_cluster_timestamp &&
+                       !read_prefs->after_cluster_increment)) {
+      return;
+   }
+
+   behind = (bool *) bson_malloc0 (sizeof (bool) * description_len);
+
+   for (i = 0; i < description_len; i++) {
+      sd = descriptions[i];
+      if (sd && sd->type == MONGOC_SERVER_RS_PRIMARY) {
+         found = true;
+      }
+
+      if (!sd || sd->type != MONGOC_SERVER_RS_SECONDARY) {
+         continue;
+      }
+
+      behind[i] =
+         sd->last_write_timestamp < read_prefs->after_cluster_timestamp ||
+         (sd->last_write_timestamp == read_prefs->after_cluster_timestamp &&
+          sd->last_write_increment < read_prefs->after_cluster_increment);
+
+      found = found || !behind[i];
+   }
+
+   for (i = 0; found && i < description_len; i++) {
+      if (behind[i]) {
+         TRACE ("Rejected [%s], behind the session's operation time",
+                descriptions[i]->host.host_and_port);
+         descriptions[i] = NULL;
+      }
+   }
+
+   bson_free (behind);
+}
@@ -27,6 +27,17 @@ BSON_BEGIN_DECLS
 
 typedef struct _mongoc_server_description_t mongoc_server_description_t;
 
+typedef struct {
+   int64_t ops;
+   int64_t egress_bytes;
+   int64_t ingress_bytes;
+   int64_t errors;
+   int64_t timeouts;
+   int64_t connections;
+   int64_t round_trip_time_msec;
+   void *padding[8];
+} mongoc_server_counters_t;
+
 MONGOC_EXPORT (void)
 mongoc_server_description_destroy (mongoc_server_description_t *description);
 
@@ -55,6 +66,11 @@ MONGOC_EXPORT (int32_t)
 mongoc_server_description_compressor_id (
    const mongoc_server_description_t *description);
 
+MONGOC_EXPORT (bool)
+mongoc_server_description_get_counters (
+   const mongoc_server_description_t *description,
+   mongoc_server_counters_t *counters);
+
 BSON_END_DECLS
 
 #endif
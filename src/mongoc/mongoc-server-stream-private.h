@@ -25,6 +25,7 @@
 
 #include <bson.h>
 
+#include "mongoc-arena-private.h"
 #include "mongoc-topology-description-private.h"
 #include "mongoc-server-description-private.h"
 #include "mongoc-stream.h"
@@ -33,17 +34,40 @@ BSON_BEGIN_DECLS
 
 typedef struct _mongoc_server_stream_t {
    mongoc_topology_description_type_t topology_type;
-   mongoc_server_description_t *sd; /* owned */
+   mongoc_server_description_t *sd; /* owned, unless from snapshot */
    bson_t cluster_time;             /* owned */
    mongoc_stream_t *stream;         /* borrowed */
+   /* pooled: the topology snapshot that sd belongs to, released on
+    * cleanup */
+   struct _mongoc_topology_snapshot_t *snapshot;
+   /* with shared connections, node is returned to shared on cleanup */
+   struct _mongoc_cluster_shared_t *shared;
+   struct _mongoc_cluster_node_t *node;
+   /* without shared connections, the pooled client's cluster whose node is
+    * marked idle on cleanup */
+   struct _mongoc_cluster_t *cluster;
+   /* set if admitted under maxInFlightPerServer, released on cleanup */
+   struct _mongoc_topology_t *in_flight_topology;
+   /* the cluster's arena this struct was allocated from, or NULL */
+   mongoc_arena_t *arena;
+   /* the "timeoutMS" deadline of the operation it was fetched for, or 0 */
+   int64_t deadline;
 } mongoc_server_stream_t;
 
 
 mongoc_server_stream_t *
-mongoc_server_stream_new (const mongoc_topology_description_t *td,
+mongoc_server_stream_new (mongoc_arena_t *arena,
+                          const mongoc_topology_description_t *td,
                           mongoc_server_description_t *sd,
                           mongoc_stream_t *stream);
 
+mongoc_server_stream_t *
+_mongoc_server_stream_new_from_snapshot (
+   mongoc_arena_t *arena,
+   struct _mongoc_topology_snapshot_t *snapshot,
+   mongoc_server_description_t *sd,
+   mongoc_stream_t *stream);
+
 int32_t
 mongoc_server_stream_max_bson_obj_size (mongoc_server_stream_t *server_stream);
 
@@ -17,13 +17,15 @@
 
 #include "mongoc-cluster-private.h"
 #include "mongoc-server-stream-private.h"
+#include "mongoc-topology-private.h"
 #include "mongoc-util-private.h"
 
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "server-stream"
 
 mongoc_server_stream_t *
-mongoc_server_stream_new (const mongoc_topology_description_t *td,
+mongoc_server_stream_new (mongoc_arena_t *arena,
+                          const mongoc_topology_description_t *td,
                           mongoc_server_description_t *sd,
                           mongoc_stream_t *stream)
 {
@@ -32,11 +34,64 @@ mongoc_server_stream_new (const mongoc_topology_description_t *td,
    BSON_ASSERT (sd);
    BSON_ASSERT (stream);
 
-   server_stream = bson_malloc (sizeof (mongoc_server_stream_t));
+   server_stream = (mongoc_server_stream_t *) _mongoc_arena_alloc (
+      arena, sizeof (mongoc_server_stream_t));
    server_stream->topology_type = td->type;
-   bson_copy_to (&td->cluster_time, &server_stream->cluster_time);
+   /* unlike bson_copy_to, stays in inline storage if it fits */
+   bson_init (&server_stream->cluster_time);
+   bson_concat (&server_stream->cluster_time, &td->cluster_time);
    server_stream->sd = sd;         /* becomes owned */
    server_stream->stream = stream; /* merely borrowed */
+   server_stream->snapshot = NULL;
+   server_stream->shared = NULL;
+   server_stream->node = NULL;
+   server_stream->cluster = NULL;
+   server_stream->in_flight_topology = NULL;
+   server_stream->arena = arena;
+   server_stream->deadline = 0;
+
+   return server_stream;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_server_stream_new_from_snapshot --
+ *
+ *       Pooled mode: a server stream whose @sd is borrowed from @snapshot,
+ *       instead of copied. Takes ownership of a reference to @snapshot.
+ *       The caller appends the topology's latest $clusterTime to the
+ *       stream's empty cluster_time.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_server_stream_t *
+_mongoc_server_stream_new_from_snapshot (mongoc_arena_t *arena,
+                                         mongoc_topology_snapshot_t *snapshot,
+                                         mongoc_server_description_t *sd,
+                                         mongoc_stream_t *stream)
+{
+   mongoc_server_stream_t *server_stream;
+
+   BSON_ASSERT (snapshot);
+   BSON_ASSERT (sd);
+   BSON_ASSERT (stream);
+
+   server_stream = (mongoc_server_stream_t *) _mongoc_arena_alloc (
+      arena, sizeof (mongoc_server_stream_t));
+   server_stream->topology_type = snapshot->description.type;
+   bson_init (&server_stream->cluster_time);
+   server_stream->sd = sd;
+   server_stream->stream = stream;
+   server_stream->snapshot = snapshot;
+   server_stream->shared = NULL;
+   server_stream->node = NULL;
+   server_stream->cluster = NULL;
+   server_stream->in_flight_topology = NULL;
+   server_stream->arena = arena;
+   server_stream->deadline = 0;
 
    return server_stream;
 }
@@ -45,9 +100,30 @@ void
 mongoc_server_stream_cleanup (mongoc_server_stream_t *server_stream)
 {
    if (server_stream) {
-      mongoc_server_description_destroy (server_stream->sd);
+      if (server_stream->node) {
+         _mongoc_cluster_shared_release (
+            server_stream->shared, server_stream->sd->id, server_stream->node);
+      }
+
+      if (server_stream->cluster) {
+         _mongoc_cluster_node_released (server_stream->cluster,
+                                        server_stream->sd->id,
+                                        server_stream->stream);
+      }
+
+      if (server_stream->in_flight_topology) {
+         _mongoc_topology_in_flight_release (server_stream->in_flight_topology,
+                                             server_stream->sd->id);
+      }
+
+      if (server_stream->snapshot) {
+         _mongoc_topology_snapshot_release (server_stream->snapshot);
+      } else {
+         mongoc_server_description_destroy (server_stream->sd);
+      }
+
       bson_destroy (&server_stream->cluster_time);
-      bson_free (server_stream);
+      _mongoc_arena_free (server_stream->arena, server_stream);
    }
 }
 
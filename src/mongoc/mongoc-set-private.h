@@ -35,14 +35,24 @@ typedef struct {
    void *item;
 } mongoc_set_item_t;
 
+/* items are kept sorted by id. a set with at least this many items also
+ * keeps a hash index from id to position, so lookups don't bsearch */
+#define MONGOC_SET_INDEX_MIN 16
+
 typedef struct {
    mongoc_set_item_t *items;
    size_t items_len;
    size_t items_allocated;
    mongoc_set_item_dtor dtor;
    void *dtor_ctx;
+
+   /* open addressing with linear probing, each slot is a position in
+    * items plus one, or 0 if empty. NULL while the set is small. */
+   uint32_t *index;
+   size_t index_mask; /* index has index_mask + 1 slots, a power of two */
 } mongoc_set_t;
 
+/* @dtor may be NULL if the set doesn't own its items */
 mongoc_set_t *
 mongoc_set_new (size_t nitems, mongoc_set_item_dtor dtor, void *dtor_ctx);
 
@@ -52,6 +62,10 @@ mongoc_set_add (mongoc_set_t *set, uint32_t id, void *item);
 void
 mongoc_set_rm (mongoc_set_t *set, uint32_t id);
 
+/* remove and return the item without calling the set's dtor, or NULL */
+void *
+mongoc_set_take (mongoc_set_t *set, uint32_t id);
+
 void *
 mongoc_set_get (mongoc_set_t *set, uint32_t id);
 
@@ -22,12 +22,15 @@
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "set"
 
+/* for mongoc_set_for_each: sets this small are copied on the stack */
+#define MONGOC_SET_STACK_ITEMS 16
+
 mongoc_set_t *
 mongoc_set_new (size_t nitems, mongoc_set_item_dtor dtor, void *dtor_ctx)
 {
    mongoc_set_t *set = (mongoc_set_t *) bson_malloc (sizeof (*set));
 
-   set->items_allocated = nitems;
+   set->items_allocated = BSON_MAX (nitems, 1);
    set->items = (mongoc_set_item_t *) bson_malloc (sizeof (*set->items) *
                                                    set->items_allocated);
    set->items_len = 0;
@@ -35,6 +38,9 @@ mongoc_set_new (size_t nitems, mongoc_set_item_dtor dtor, void *dtor_ctx)
    set->dtor = dtor;
    set->dtor_ctx = dtor_ctx;
 
+   set->index = NULL;
+   set->index_mask = 0;
+
    return set;
 }
 
@@ -51,13 +57,91 @@ mongoc_set_id_cmp (const void *a_, const void *b_)
    return a->id < b->id ? -1 : 1;
 }
 
+/* ids are usually sequential, mix them so they don't fill adjacent slots */
+static size_t
+_mongoc_set_hash (uint32_t id)
+{
+   id *= 0x9E3779B1u;
+
+   return (size_t) (id ^ (id >> 16));
+}
+
+static void
+_mongoc_set_index_insert (mongoc_set_t *set, size_t pos)
+{
+   size_t slot;
+
+   slot = _mongoc_set_hash (set->items[pos].id) & set->index_mask;
+   while (set->index[slot]) {
+      slot = (slot + 1) & set->index_mask;
+   }
+
+   set->index[slot] = (uint32_t) pos + 1;
+}
+
+/* recreate the index after items moved, keeping it at most half full */
+static void
+_mongoc_set_index_rebuild (mongoc_set_t *set)
+{
+   size_t n_slots;
+   size_t i;
+
+   if (set->items_len < MONGOC_SET_INDEX_MIN) {
+      bson_free (set->index);
+      set->index = NULL;
+      set->index_mask = 0;
+      return;
+   }
+
+   n_slots = bson_next_power_of_two (set->items_allocated * 2);
+   if (!set->index || set->index_mask + 1 != n_slots) {
+      bson_free (set->index);
+      set->index = (uint32_t *) bson_malloc (sizeof (uint32_t) * n_slots);
+      set->index_mask = n_slots - 1;
+   }
+
+   memset (set->index, 0, sizeof (uint32_t) * n_slots);
+   for (i = 0; i < set->items_len; i++) {
+      _mongoc_set_index_insert (set, i);
+   }
+}
+
+static mongoc_set_item_t *
+_mongoc_set_lookup (mongoc_set_t *set, uint32_t id)
+{
+   mongoc_set_item_t key;
+   size_t slot;
+   uint32_t pos;
+
+   if (set->index) {
+      slot = _mongoc_set_hash (id) & set->index_mask;
+      while ((pos = set->index[slot])) {
+         if (set->items[pos - 1].id == id) {
+            return &set->items[pos - 1];
+         }
+
+         slot = (slot + 1) & set->index_mask;
+      }
+
+      return NULL;
+   }
+
+   key.id = id;
+
+   return (mongoc_set_item_t *) bsearch (
+      &key, set->items, set->items_len, sizeof (key), mongoc_set_id_cmp);
+}
+
 void
 mongoc_set_add (mongoc_set_t *set, uint32_t id, void *item)
 {
+   bool grew = false;
+
    if (set->items_len >= set->items_allocated) {
       set->items_allocated *= 2;
       set->items = (mongoc_set_item_t *) bson_realloc (
          set->items, sizeof (*set->items) * set->items_allocated);
+      grew = true;
    }
 
    set->items[set->items_len].id = id;
@@ -68,6 +152,33 @@ mongoc_set_add (mongoc_set_t *set, uint32_t id, void *item)
    if (set->items_len > 1 && set->items[set->items_len - 2].id > id) {
       qsort (
          set->items, set->items_len, sizeof (*set->items), mongoc_set_id_cmp);
+      _mongoc_set_index_rebuild (set);
+   } else if (grew || set->items_len == MONGOC_SET_INDEX_MIN) {
+      _mongoc_set_index_rebuild (set);
+   } else if (set->index) {
+      /* appended in order, nothing else moved */
+      _mongoc_set_index_insert (set, set->items_len - 1);
+   }
+}
+
+static void
+_mongoc_set_remove_at (mongoc_set_t *set, mongoc_set_item_t *ptr)
+{
+   size_t i;
+
+   i = ptr - set->items;
+
+   if (i != set->items_len - 1) {
+      memmove (set->items + i,
+               set->items + i + 1,
+               (set->items_len - (i + 1)) * sizeof (*ptr));
+   }
+
+   set->items_len--;
+
+   if (set->index) {
+      /* positions shifted; as cheap as the memmove */
+      _mongoc_set_index_rebuild (set);
    }
 }
 
@@ -75,39 +186,40 @@ void
 mongoc_set_rm (mongoc_set_t *set, uint32_t id)
 {
    mongoc_set_item_t *ptr;
-   mongoc_set_item_t key;
-   int i;
-
-   key.id = id;
 
-   ptr = (mongoc_set_item_t *) bsearch (
-      &key, set->items, set->items_len, sizeof (key), mongoc_set_id_cmp);
+   ptr = _mongoc_set_lookup (set, id);
 
    if (ptr) {
-      set->dtor (ptr->item, set->dtor_ctx);
+      if (set->dtor) {
+         set->dtor (ptr->item, set->dtor_ctx);
+      }
 
-      i = ptr - set->items;
+      _mongoc_set_remove_at (set, ptr);
+   }
+}
 
-      if (i != set->items_len - 1) {
-         memmove (set->items + i,
-                  set->items + i + 1,
-                  (set->items_len - (i + 1)) * sizeof (key));
-      }
+void *
+mongoc_set_take (mongoc_set_t *set, uint32_t id)
+{
+   mongoc_set_item_t *ptr;
+   void *item = NULL;
 
-      set->items_len--;
+   ptr = _mongoc_set_lookup (set, id);
+
+   if (ptr) {
+      item = ptr->item;
+      _mongoc_set_remove_at (set, ptr);
    }
+
+   return item;
 }
 
 void *
 mongoc_set_get (mongoc_set_t *set, uint32_t id)
 {
    mongoc_set_item_t *ptr;
-   mongoc_set_item_t key;
 
-   key.id = id;
-
-   ptr = (mongoc_set_item_t *) bsearch (
-      &key, set->items, set->items_len, sizeof (key), mongoc_set_id_cmp);
+   ptr = _mongoc_set_lookup (set, id);
 
    return ptr ? ptr->item : NULL;
 }
@@ -140,10 +252,11 @@ mongoc_set_destroy (mongoc_set_t *set)
 {
    int i;
 
-   for (i = 0; i < set->items_len; i++) {
+   for (i = 0; set->dtor && i < set->items_len; i++) {
       set->dtor (set->items[i].item, set->dtor_ctx);
    }
 
+   bson_free (set->index);
    bson_free (set->items);
    bson_free (set);
 }
@@ -152,6 +265,7 @@ void
 mongoc_set_for_each (mongoc_set_t *set, mongoc_set_for_each_cb_t cb, void *ctx)
 {
    size_t i;
+   mongoc_set_item_t stack_set[MONGOC_SET_STACK_ITEMS];
    mongoc_set_item_t *old_set;
    size_t items_len;
 
@@ -162,7 +276,14 @@ mongoc_set_for_each (mongoc_set_t *set, mongoc_set_for_each_cb_t cb, void *ctx)
       return;
    }
 
-   old_set = (mongoc_set_item_t *) bson_malloc (sizeof (*old_set) * items_len);
+   /* callbacks may change the set, iterate over a copy */
+   if (items_len <= MONGOC_SET_STACK_ITEMS) {
+      old_set = stack_set;
+   } else {
+      old_set =
+         (mongoc_set_item_t *) bson_malloc (sizeof (*old_set) * items_len);
+   }
+
    memcpy (old_set, set->items, sizeof (*old_set) * items_len);
 
    for (i = 0; i < items_len; i++) {
@@ -171,7 +292,9 @@ mongoc_set_for_each (mongoc_set_t *set, mongoc_set_for_each_cb_t cb, void *ctx)
       }
    }
 
-   bson_free (old_set);
+   if (old_set != stack_set) {
+      bson_free (old_set);
+   }
 }
 
 
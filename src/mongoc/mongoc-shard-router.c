@@ -0,0 +1,989 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-shard-router.h"
+#include "mongoc-shard-router-private.h"
+#include "mongoc-array-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-collection.h"
+#include "mongoc-cursor.h"
+#include "mongoc-error.h"
+#include "mongoc-read-prefs.h"
+#include "mongoc-trace-private.h"
+#include "mongoc-uri-private.h"
+#include "mongoc-util-private.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "shard-router"
+
+
+/* server error codes meaning the shard's chunk map is newer than ours */
+#define MONGOC_SHARD_ROUTER_STALE_SHARD_VERSION 63
+#define MONGOC_SHARD_ROUTER_STALE_EPOCH 150
+#define MONGOC_SHARD_ROUTER_STALE_CONFIG 13388
+
+
+typedef struct {
+   char *name;
+   char *set_name; /* NULL if the shard is a standalone */
+   char *hosts;    /* comma-separated "host:port" list */
+   /* the shard version: the greatest "lastmod" of the shard's chunks */
+   uint32_t version_t;
+   uint32_t version_i;
+   mongoc_client_t *client; /* connects directly, created on first use */
+} mongoc_shard_router_shard_t;
+
+
+typedef struct {
+   bson_t *min; /* inclusive */
+   bson_t *max; /* exclusive */
+   size_t shard; /* index in the router's shards */
+} mongoc_shard_router_chunk_t;
+
+
+struct _mongoc_shard_router_t {
+   mongoc_client_t *client; /* connected to mongos, not owned */
+   char *db;
+   char *collection;
+   char *ns;
+   mongoc_read_prefs_t *primary;
+
+   /* from config.collections. "key" is empty if the collection isn't
+    * sharded or its shard key is hashed: then every find goes to mongos */
+   bson_t key;
+   bson_oid_t epoch;
+   /* the collection version, the greatest "lastmod" of all chunks */
+   uint32_t version_t;
+   uint32_t version_i;
+
+   /* refresh before the next find: the chunk map was never loaded, or a
+    * shard said it's out of date */
+   bool stale;
+
+   mongoc_array_t shards; /* mongoc_shard_router_shard_t */
+   mongoc_array_t chunks; /* mongoc_shard_router_chunk_t, sorted by min */
+};
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_shard_router_new --
+ *
+ *       Create a router for finds on @db.@collection, a collection in the
+ *       sharded cluster @client is connected to. The chunk map is loaded
+ *       on the first find.
+ *
+ *--------------------------------------------------------------------------
+ */
+mongoc_shard_router_t *
+mongoc_shard_router_new (mongoc_client_t *client,
+                         const char *db,
+                         const char *collection)
+{
+   mongoc_shard_router_t *router;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (db);
+   BSON_ASSERT (collection);
+
+   router = (mongoc_shard_router_t *) bson_malloc0 (sizeof *router);
+   router->client = client;
+   router->db = bson_strdup (db);
+   router->collection = bson_strdup (collection);
+   router->ns = bson_strdup_printf ("%s.%s", db, collection);
+   router->primary = mongoc_read_prefs_new (MONGOC_READ_PRIMARY);
+   bson_init (&router->key);
+   router->stale = true;
+   _mongoc_array_init (&router->shards, sizeof (mongoc_shard_router_shard_t));
+   _mongoc_array_init (&router->chunks, sizeof (mongoc_shard_router_chunk_t));
+
+   return router;
+}
+
+
+static void
+_mongoc_shard_router_shards_destroy (mongoc_array_t *shards)
+{
+   mongoc_shard_router_shard_t *shard;
+   size_t i;
+
+   for (i = 0; i < shards->len; i++) {
+      shard = &_mongoc_array_index (shards, mongoc_shard_router_shard_t, i);
+      bson_free (shard->name);
+      bson_free (shard->set_name);
+      bson_free (shard->hosts);
+      if (shard->client) {
+         mongoc_client_destroy (shard->client);
+      }
+   }
+
+   _mongoc_array_destroy (shards);
+}
+
+
+static void
+_mongoc_shard_router_chunks_destroy (mongoc_array_t *chunks)
+{
+   mongoc_shard_router_chunk_t *chunk;
+   size_t i;
+
+   for (i = 0; i < chunks->len; i++) {
+      chunk = &_mongoc_array_index (chunks, mongoc_shard_router_chunk_t, i);
+      bson_destroy (chunk->min);
+      bson_destroy (chunk->max);
+   }
+
+   _mongoc_array_destroy (chunks);
+}
+
+
+void
+mongoc_shard_router_destroy (mongoc_shard_router_t *router)
+{
+   if (!router) {
+      return;
+   }
+
+   _mongoc_shard_router_shards_destroy (&router->shards);
+   _mongoc_shard_router_chunks_destroy (&router->chunks);
+   bson_destroy (&router->key);
+   mongoc_read_prefs_destroy (router->primary);
+   bson_free (router->ns);
+   bson_free (router->collection);
+   bson_free (router->db);
+   bson_free (router);
+}
+
+
+/* compare shard key values field by field, both in key pattern order */
+static bool
+_mongoc_shard_router_key_cmp (const bson_t *a, const bson_t *b, int *cmp)
+{
+   bson_iter_t iter_a;
+   bson_iter_t iter_b;
+   bool more_a;
+   bool more_b;
+
+   if (!bson_iter_init (&iter_a, a) || !bson_iter_init (&iter_b, b)) {
+      return false;
+   }
+
+   for (;;) {
+      more_a = bson_iter_next (&iter_a);
+      more_b = bson_iter_next (&iter_b);
+
+      if (more_a != more_b) {
+         /* not the same shard key */
+         return false;
+      }
+
+      if (!more_a) {
+         *cmp = 0;
+         return true;
+      }
+
+      if (!_mongoc_bson_iter_cmp (&iter_a, &iter_b, cmp)) {
+         return false;
+      }
+
+      if (*cmp) {
+         return true;
+      }
+   }
+}
+
+
+/* the chunk containing @key, or NULL if there's none or it can't be told */
+static mongoc_shard_router_chunk_t *
+_mongoc_shard_router_find_chunk (mongoc_shard_router_t *router,
+                                 const bson_t *key)
+{
+   mongoc_shard_router_chunk_t *chunks;
+   size_t lo = 0;
+   size_t hi;
+   size_t mid;
+   int cmp;
+
+   chunks = (mongoc_shard_router_chunk_t *) router->chunks.data;
+   hi = router->chunks.len;
+
+   /* the first chunk whose min is greater than the key */
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (!_mongoc_shard_router_key_cmp (chunks[mid].min, key, &cmp)) {
+         return NULL;
+      }
+
+      if (cmp <= 0) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   if (lo == 0) {
+      return NULL;
+   }
+
+   /* the chunk before it, unless there's a gap in the map */
+   if (!_mongoc_shard_router_key_cmp (key, chunks[lo - 1].max, &cmp) ||
+       cmp >= 0) {
+      return NULL;
+   }
+
+   return &chunks[lo - 1];
+}
+
+
+/* the shard key values @filter matches exactly, in key pattern order. false
+ * if @filter doesn't target one shard key value */
+static bool
+_mongoc_shard_router_key_from_filter (mongoc_shard_router_t *router,
+                                      const bson_t *filter,
+                                      bson_t *key /* OUT */)
+{
+   bson_iter_t key_iter;
+   bson_iter_t iter;
+   const char *field;
+
+   bson_init (key);
+
+   if (bson_empty (&router->key) || !bson_iter_init (&key_iter, &router->key)) {
+      goto fail;
+   }
+
+   while (bson_iter_next (&key_iter)) {
+      field = bson_iter_key (&key_iter);
+
+      /* an operator like {$gt: 1} is a document, and an array or a regex
+       * is not an equality */
+      if (!bson_iter_init_find (&iter, filter, field) ||
+          BSON_ITER_HOLDS_DOCUMENT (&iter) || BSON_ITER_HOLDS_ARRAY (&iter) ||
+          BSON_ITER_HOLDS_REGEX (&iter)) {
+         goto fail;
+      }
+
+      bson_append_iter (key, field, -1, &iter);
+   }
+
+   return true;
+
+fail:
+   bson_destroy (key);
+   return false;
+}
+
+
+/* the first document @collection_name in the config database has matching
+ * @filter, with @opts, copied to @doc. @doc is empty if there's none */
+static bool
+_mongoc_shard_router_config_find_one (mongoc_shard_router_t *router,
+                                      const char *collection_name,
+                                      const bson_t *filter,
+                                      const bson_t *opts,
+                                      bson_t *doc /* OUT */,
+                                      bson_error_t *error)
+{
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   const bson_t *found;
+   bool r;
+
+   bson_init (doc);
+   collection =
+      mongoc_client_get_collection (router->client, "config", collection_name);
+   cursor = mongoc_collection_find_with_opts (
+      collection, filter, opts, router->primary);
+
+   if (mongoc_cursor_next (cursor, &found)) {
+      bson_concat (doc, found);
+   }
+
+   r = !mongoc_cursor_error (cursor, error);
+
+   mongoc_cursor_destroy (cursor);
+   mongoc_collection_destroy (collection);
+
+   return r;
+}
+
+
+/* whether @shard_doc, from config.shards, has the name and hosts @shard
+ * was loaded from */
+static bool
+_mongoc_shard_router_shard_matches (const mongoc_shard_router_shard_t *shard,
+                                    const char *name,
+                                    const char *host)
+{
+   const char *hosts;
+
+   if (strcmp (shard->name, name)) {
+      return false;
+   }
+
+   hosts = strchr (host, '/');
+   if (hosts) {
+      return shard->set_name &&
+             strlen (shard->set_name) == (size_t) (hosts - host) &&
+             !strncmp (shard->set_name, host, (size_t) (hosts - host)) &&
+             !strcmp (shard->hosts, hosts + 1);
+   }
+
+   return !shard->set_name && !strcmp (shard->hosts, host);
+}
+
+
+static bool
+_mongoc_shard_router_load_shards (mongoc_shard_router_t *router,
+                                  mongoc_array_t *shards,
+                                  bson_error_t *error)
+{
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_iter_t iter;
+   const char *name;
+   const char *host;
+   const char *hosts;
+   mongoc_shard_router_shard_t shard;
+   mongoc_shard_router_shard_t *old;
+   bson_t filter = BSON_INITIALIZER;
+   size_t i;
+   bool r;
+
+   collection =
+      mongoc_client_get_collection (router->client, "config", "shards");
+   cursor = mongoc_collection_find_with_opts (
+      collection, &filter, NULL, router->primary);
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      if (!bson_iter_init_find (&iter, doc, "_id") ||
+          !BSON_ITER_HOLDS_UTF8 (&iter)) {
+         continue;
+      }
+
+      name = bson_iter_utf8 (&iter, NULL);
+
+      if (!bson_iter_init_find (&iter, doc, "host") ||
+          !BSON_ITER_HOLDS_UTF8 (&iter)) {
+         continue;
+      }
+
+      host = bson_iter_utf8 (&iter, NULL);
+      memset (&shard, 0, sizeof shard);
+
+      /* keep the connections to shards that haven't changed */
+      for (i = 0; i < router->shards.len; i++) {
+         old = &_mongoc_array_index (
+            &router->shards, mongoc_shard_router_shard_t, i);
+         if (old->client &&
+             _mongoc_shard_router_shard_matches (old, name, host)) {
+            shard.client = old->client;
+            old->client = NULL;
+            break;
+         }
+      }
+
+      /* "rs0/a:27018,b:27018" or "a:27018" */
+      hosts = strchr (host, '/');
+      shard.name = bson_strdup (name);
+      if (hosts) {
+         shard.set_name = bson_strndup (host, (size_t) (hosts - host));
+         shard.hosts = bson_strdup (hosts + 1);
+      } else {
+         shard.hosts = bson_strdup (host);
+      }
+
+      _mongoc_array_append_val (shards, shard);
+   }
+
+   r = !mongoc_cursor_error (cursor, error);
+
+   mongoc_cursor_destroy (cursor);
+   mongoc_collection_destroy (collection);
+   bson_destroy (&filter);
+
+   return r;
+}
+
+
+static bool
+_mongoc_shard_router_load_chunks (mongoc_shard_router_t *router,
+                                  mongoc_array_t *shards,
+                                  mongoc_array_t *chunks,
+                                  bson_error_t *error)
+{
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_iter_t iter;
+   bson_t bound;
+   mongoc_shard_router_chunk_t chunk;
+   mongoc_shard_router_shard_t *shard = NULL;
+   bson_t filter = BSON_INITIALIZER;
+   bson_t opts = BSON_INITIALIZER;
+   bson_t sort;
+   const char *name;
+   const uint8_t *data;
+   uint32_t len;
+   uint32_t t;
+   uint32_t i;
+   size_t j;
+   bool r = false;
+
+   BSON_APPEND_UTF8 (&filter, "ns", router->ns);
+   /* the server sorts the bounds in BSON order, as we compare them */
+   BSON_APPEND_DOCUMENT_BEGIN (&opts, "sort", &sort);
+   BSON_APPEND_INT32 (&sort, "min", 1);
+   bson_append_document_end (&opts, &sort);
+
+   collection =
+      mongoc_client_get_collection (router->client, "config", "chunks");
+   cursor = mongoc_collection_find_with_opts (
+      collection, &filter, &opts, router->primary);
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      if (!bson_iter_init_find (&iter, doc, "shard") ||
+          !BSON_ITER_HOLDS_UTF8 (&iter)) {
+         goto invalid;
+      }
+
+      name = bson_iter_utf8 (&iter, NULL);
+      if (!shard || strcmp (shard->name, name)) {
+         shard = NULL;
+         for (j = 0; j < shards->len; j++) {
+            if (!strcmp (_mongoc_array_index (
+                            shards, mongoc_shard_router_shard_t, j)
+                            .name,
+                         name)) {
+               shard = &_mongoc_array_index (
+                  shards, mongoc_shard_router_shard_t, j);
+               chunk.shard = j;
+               break;
+            }
+         }
+      }
+
+      if (!shard) {
+         bson_set_error (error,
+                         MONGOC_ERROR_PROTOCOL,
+                         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                         "Chunk of \"%s\" is on unknown shard \"%s\"",
+                         router->ns,
+                         name);
+         goto done;
+      }
+
+      if (!bson_iter_init_find (&iter, doc, "lastmod") ||
+          !BSON_ITER_HOLDS_TIMESTAMP (&iter)) {
+         goto invalid;
+      }
+
+      bson_iter_timestamp (&iter, &t, &i);
+      if (t > shard->version_t ||
+          (t == shard->version_t && i > shard->version_i)) {
+         shard->version_t = t;
+         shard->version_i = i;
+      }
+
+      if (!bson_iter_init_find (&iter, doc, "min") ||
+          !BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         goto invalid;
+      }
+
+      bson_iter_document (&iter, &len, &data);
+      BSON_ASSERT (bson_init_static (&bound, data, len));
+      chunk.min = bson_copy (&bound);
+
+      if (!bson_iter_init_find (&iter, doc, "max") ||
+          !BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         bson_destroy (chunk.min);
+         goto invalid;
+      }
+
+      bson_iter_document (&iter, &len, &data);
+      BSON_ASSERT (bson_init_static (&bound, data, len));
+      chunk.max = bson_copy (&bound);
+
+      _mongoc_array_append_val (chunks, chunk);
+   }
+
+   r = !mongoc_cursor_error (cursor, error);
+   goto done;
+
+invalid:
+   bson_set_error (error,
+                   MONGOC_ERROR_PROTOCOL,
+                   MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                   "Invalid chunk of \"%s\" in config.chunks",
+                   router->ns);
+
+done:
+   mongoc_cursor_destroy (cursor);
+   mongoc_collection_destroy (collection);
+   bson_destroy (&opts);
+   bson_destroy (&filter);
+
+   return r;
+}
+
+
+/* clear the chunk map, so every find goes to mongos */
+static void
+_mongoc_shard_router_clear (mongoc_shard_router_t *router)
+{
+   _mongoc_shard_router_chunks_destroy (&router->chunks);
+   _mongoc_array_init (&router->chunks, sizeof (mongoc_shard_router_chunk_t));
+   bson_reinit (&router->key);
+   memset (&router->epoch, 0, sizeof router->epoch);
+   router->version_t = 0;
+   router->version_i = 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_shard_router_refresh --
+ *
+ *       Bring the chunk map up to date from the config servers, through
+ *       mongos. The collection version is checked first: if the epoch and
+ *       the greatest chunk "lastmod" haven't changed, nothing is reloaded.
+ *
+ *--------------------------------------------------------------------------
+ */
+bool
+mongoc_shard_router_refresh (mongoc_shard_router_t *router,
+                             bson_error_t *error)
+{
+   bson_t filter = BSON_INITIALIZER;
+   bson_t opts = BSON_INITIALIZER;
+   bson_t sort;
+   bson_t doc;
+   bson_t key = BSON_INITIALIZER;
+   bson_t key_pattern;
+   bson_iter_t iter;
+   bson_oid_t epoch;
+   const uint8_t *data;
+   uint32_t len;
+   uint32_t t = 0;
+   uint32_t i = 0;
+   mongoc_array_t shards;
+   mongoc_array_t chunks;
+   bool r = false;
+
+   ENTRY;
+
+   BSON_ASSERT (router);
+
+   BSON_APPEND_UTF8 (&filter, "_id", router->ns);
+   if (!_mongoc_shard_router_config_find_one (
+          router, "collections", &filter, NULL, &doc, error)) {
+      GOTO (done);
+   }
+
+   if (bson_empty (&doc) ||
+       (bson_iter_init_find (&iter, &doc, "dropped") &&
+        bson_iter_as_bool (&iter)) ||
+       !bson_iter_init_find (&iter, &doc, "key") ||
+       !BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      /* not sharded */
+      _mongoc_shard_router_clear (router);
+      bson_destroy (&doc);
+      r = true;
+      GOTO (done);
+   }
+
+   bson_iter_document (&iter, &len, &data);
+   BSON_ASSERT (bson_init_static (&key_pattern, data, len));
+   bson_concat (&key, &key_pattern);
+
+   /* routing by a hashed shard key would need the server's hash function */
+   if (bson_iter_init (&iter, &key)) {
+      while (bson_iter_next (&iter)) {
+         if (BSON_ITER_HOLDS_UTF8 (&iter)) {
+            _mongoc_shard_router_clear (router);
+            bson_destroy (&doc);
+            r = true;
+            GOTO (done);
+         }
+      }
+   }
+
+   memset (&epoch, 0, sizeof epoch);
+   if (bson_iter_init_find (&iter, &doc, "lastmodEpoch") &&
+       BSON_ITER_HOLDS_OID (&iter)) {
+      bson_oid_copy (bson_iter_oid (&iter), &epoch);
+   }
+
+   /* the collection version */
+   bson_reinit (&filter);
+   BSON_APPEND_UTF8 (&filter, "ns", router->ns);
+   BSON_APPEND_DOCUMENT_BEGIN (&opts, "sort", &sort);
+   BSON_APPEND_INT32 (&sort, "lastmod", -1);
+   bson_append_document_end (&opts, &sort);
+   BSON_APPEND_INT64 (&opts, "limit", 1);
+
+   bson_destroy (&doc);
+   if (!_mongoc_shard_router_config_find_one (
+          router, "chunks", &filter, &opts, &doc, error)) {
+      GOTO (done);
+   }
+
+   if (bson_iter_init_find (&iter, &doc, "lastmod") &&
+       BSON_ITER_HOLDS_TIMESTAMP (&iter)) {
+      bson_iter_timestamp (&iter, &t, &i);
+   }
+
+   bson_destroy (&doc);
+
+   if (bson_equal (&key, &router->key) &&
+       bson_oid_equal (&epoch, &router->epoch) && t == router->version_t &&
+       i == router->version_i && router->chunks.len) {
+      r = true;
+      GOTO (done);
+   }
+
+   /* reload, keeping the old map until the new one is complete */
+   _mongoc_array_init (&shards, sizeof (mongoc_shard_router_shard_t));
+   _mongoc_array_init (&chunks, sizeof (mongoc_shard_router_chunk_t));
+
+   if (!_mongoc_shard_router_load_shards (router, &shards, error) ||
+       !_mongoc_shard_router_load_chunks (router, &shards, &chunks, error)) {
+      _mongoc_shard_router_shards_destroy (&shards);
+      _mongoc_shard_router_chunks_destroy (&chunks);
+      GOTO (done);
+   }
+
+   _mongoc_shard_router_shards_destroy (&router->shards);
+   _mongoc_shard_router_chunks_destroy (&router->chunks);
+   memcpy (&router->shards, &shards, sizeof shards);
+   memcpy (&router->chunks, &chunks, sizeof chunks);
+   bson_reinit (&router->key);
+   bson_concat (&router->key, &key);
+   bson_oid_copy (&epoch, &router->epoch);
+   router->version_t = t;
+   router->version_i = i;
+
+   TRACE ("loaded %d chunks of \"%s\" on %d shards",
+          (int) router->chunks.len,
+          router->ns,
+          (int) router->shards.len);
+
+   r = true;
+
+done:
+   if (r) {
+      router->stale = false;
+   }
+
+   bson_destroy (&key);
+   bson_destroy (&opts);
+   bson_destroy (&filter);
+
+   RETURN (r);
+}
+
+
+/* the shard that owns the one shard key value @filter matches, or NULL */
+static mongoc_shard_router_shard_t *
+_mongoc_shard_router_target (mongoc_shard_router_t *router,
+                             const bson_t *filter)
+{
+   mongoc_shard_router_chunk_t *chunk;
+   bson_t key;
+
+   if (!_mongoc_shard_router_key_from_filter (router, filter, &key)) {
+      return NULL;
+   }
+
+   chunk = _mongoc_shard_router_find_chunk (router, &key);
+   bson_destroy (&key);
+
+   if (!chunk) {
+      return NULL;
+   }
+
+   return &_mongoc_array_index (
+      &router->shards, mongoc_shard_router_shard_t, chunk->shard);
+}
+
+
+/* the group of an inserted document for _mongoc_write_command_group: the
+ * index of the shard that owns it, or the number of shards if it's unknown */
+static uint32_t
+_mongoc_shard_router_group (const bson_t *document, void *data)
+{
+   mongoc_shard_router_t *router = (mongoc_shard_router_t *) data;
+   mongoc_shard_router_chunk_t *chunk;
+   bson_t key;
+
+   if (!_mongoc_shard_router_key_from_filter (router, document, &key)) {
+      return (uint32_t) router->shards.len;
+   }
+
+   chunk = _mongoc_shard_router_find_chunk (router, &key);
+   bson_destroy (&key);
+
+   return chunk ? (uint32_t) chunk->shard : (uint32_t) router->shards.len;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_shard_router_group_inserts --
+ *
+ *       Order the documents of an unordered bulk's insert @command by the
+ *       shard that owns them, those that can't be routed last, so that
+ *       each batch mongos receives goes to as few shards as possible. The
+ *       chunk map is refreshed first if it's stale; if that fails the
+ *       documents are sent as they are.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_shard_router_group_inserts (mongoc_shard_router_t *router,
+                                    mongoc_write_command_t *command)
+{
+   bson_error_t error;
+
+   ENTRY;
+
+   BSON_ASSERT (router);
+   BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_INSERT);
+
+   if (router->stale && !mongoc_shard_router_refresh (router, &error)) {
+      TRACE ("not grouping inserts, can't refresh: %s", error.message);
+      EXIT;
+   }
+
+   if (bson_empty (&router->key) || !router->chunks.len) {
+      EXIT;
+   }
+
+   _mongoc_write_command_group (command,
+                                (uint32_t) router->shards.len + 1,
+                                _mongoc_shard_router_group,
+                                router);
+
+   EXIT;
+}
+
+
+/* a client connected directly to @shard, with the router's client's
+ * credentials and options */
+static mongoc_client_t *
+_mongoc_shard_router_shard_client (mongoc_shard_router_t *router,
+                                   mongoc_shard_router_shard_t *shard)
+{
+   mongoc_uri_t *uri;
+
+   if (shard->client) {
+      return shard->client;
+   }
+
+   uri = _mongoc_uri_copy_for_hosts (
+      router->client->uri, shard->set_name, shard->hosts);
+   if (!uri) {
+      MONGOC_WARNING ("Invalid host list for shard \"%s\": \"%s\"",
+                      shard->name,
+                      shard->hosts);
+      return NULL;
+   }
+
+   shard->client = mongoc_client_new_from_uri (uri);
+   mongoc_uri_destroy (uri);
+
+   if (!shard->client) {
+      return NULL;
+   }
+
+#ifdef MONGOC_ENABLE_SSL
+   if (router->client->use_ssl) {
+      mongoc_client_set_ssl_opts (shard->client, &router->client->ssl_opts);
+   }
+#endif
+
+   if (router->client->error_api_set) {
+      mongoc_client_set_error_api (shard->client,
+                                   router->client->error_api_version);
+   }
+
+   return shard->client;
+}
+
+
+/* whether to retry a find that failed on a shard through mongos: the
+ * shard's chunk map is newer than ours, or it can't be reached */
+static bool
+_mongoc_shard_router_should_fall_back (mongoc_shard_router_t *router,
+                                       const bson_error_t *error)
+{
+   if (error->domain == MONGOC_ERROR_SERVER_SELECTION ||
+       error->domain == MONGOC_ERROR_STREAM) {
+      return true;
+   }
+
+   if (error->code == MONGOC_SHARD_ROUTER_STALE_SHARD_VERSION ||
+       error->code == MONGOC_SHARD_ROUTER_STALE_EPOCH ||
+       error->code == MONGOC_SHARD_ROUTER_STALE_CONFIG) {
+      router->stale = true;
+      return true;
+   }
+
+   return false;
+}
+
+
+/* copy the first document of a find command's reply to @doc */
+static void
+_mongoc_shard_router_first_doc (const bson_t *reply, bson_t *doc)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_iter_t batch;
+   bson_t found;
+   const uint8_t *data;
+   uint32_t len;
+
+   if (bson_iter_init_find (&iter, reply, "cursor") &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter) && bson_iter_recurse (&iter, &child) &&
+       bson_iter_find (&child, "firstBatch") &&
+       BSON_ITER_HOLDS_ARRAY (&child) && bson_iter_recurse (&child, &batch) &&
+       bson_iter_next (&batch) && BSON_ITER_HOLDS_DOCUMENT (&batch)) {
+      bson_iter_document (&batch, &len, &data);
+      BSON_ASSERT (bson_init_static (&found, data, len));
+      bson_concat (doc, &found);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_shard_router_find_one --
+ *
+ *       Find one document matching @filter. If @filter matches one shard
+ *       key value exactly, the find goes straight to the primary of the
+ *       shard that owns it, with the shard version the server checks our
+ *       chunk map against. Otherwise, or if that shard's version is newer
+ *       or it can't be reached, the find goes through mongos.
+ *
+ *--------------------------------------------------------------------------
+ */
+bool
+mongoc_shard_router_find_one (mongoc_shard_router_t *router,
+                              const bson_t *filter,
+                              const bson_t *opts,
+                              bson_t *doc,
+                              bson_error_t *error)
+{
+   mongoc_shard_router_shard_t *shard = NULL;
+   mongoc_client_t *shard_client = NULL;
+   bson_t cmd = BSON_INITIALIZER;
+   bson_t shard_cmd;
+   bson_t version;
+   bson_t reply;
+   bson_error_t shard_error;
+   bool r;
+
+   ENTRY;
+
+   BSON_ASSERT (router);
+   BSON_ASSERT (filter);
+   BSON_ASSERT (doc);
+
+   bson_init (doc);
+
+   BSON_APPEND_UTF8 (&cmd, "find", router->collection);
+   BSON_APPEND_DOCUMENT (&cmd, "filter", filter);
+   if (opts) {
+      bson_concat (&cmd, opts);
+   }
+
+   BSON_APPEND_INT64 (&cmd, "limit", 1);
+   BSON_APPEND_BOOL (&cmd, "singleBatch", true);
+
+   if (router->stale && !mongoc_shard_router_refresh (router, &shard_error)) {
+      MONGOC_WARNING ("Could not refresh chunks of \"%s\": %s",
+                      router->ns,
+                      shard_error.message);
+   }
+
+   if (!router->stale) {
+      shard = _mongoc_shard_router_target (router, filter);
+   }
+
+   if (shard) {
+      shard_client = _mongoc_shard_router_shard_client (router, shard);
+   }
+
+   if (shard_client) {
+      bson_init (&shard_cmd);
+      bson_concat (&shard_cmd, &cmd);
+      BSON_APPEND_ARRAY_BEGIN (&shard_cmd, "shardVersion", &version);
+      BSON_APPEND_TIMESTAMP (
+         &version, "0", shard->version_t, shard->version_i);
+      BSON_APPEND_OID (&version, "1", &router->epoch);
+      bson_append_array_end (&shard_cmd, &version);
+
+      r = mongoc_client_read_command_with_opts (shard_client,
+                                                router->db,
+                                                &shard_cmd,
+                                                router->primary,
+                                                NULL,
+                                                &reply,
+                                                &shard_error);
+      bson_destroy (&shard_cmd);
+
+      if (r) {
+         _mongoc_shard_router_first_doc (&reply, doc);
+         bson_destroy (&reply);
+         GOTO (done);
+      }
+
+      bson_destroy (&reply);
+
+      if (!_mongoc_shard_router_should_fall_back (router, &shard_error)) {
+         if (error) {
+            memcpy (error, &shard_error, sizeof shard_error);
+         }
+
+         GOTO (done);
+      }
+
+      TRACE ("find on shard \"%s\" failed, using mongos: %s",
+             shard->name,
+             shard_error.message);
+   }
+
+   r = mongoc_client_read_command_with_opts (
+      router->client, router->db, &cmd, NULL, NULL, &reply, error);
+   if (r) {
+      _mongoc_shard_router_first_doc (&reply, doc);
+   }
+
+   bson_destroy (&reply);
+
+done:
+   bson_destroy (&cmd);
+
+   RETURN (r);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_SHARD_ROUTER_H
+#define MONGOC_SHARD_ROUTER_H
+
+#if !defined(MONGOC_INSIDE) && !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-macros.h"
+#include "mongoc-client.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_shard_router_t mongoc_shard_router_t;
+
+
+MONGOC_EXPORT (mongoc_shard_router_t *)
+mongoc_shard_router_new (mongoc_client_t *client,
+                         const char *db,
+                         const char *collection);
+MONGOC_EXPORT (bool)
+mongoc_shard_router_refresh (mongoc_shard_router_t *router,
+                             bson_error_t *error);
+MONGOC_EXPORT (bool)
+mongoc_shard_router_find_one (mongoc_shard_router_t *router,
+                              const bson_t *filter,
+                              const bson_t *opts,
+                              bson_t *doc,
+                              bson_error_t *error);
+MONGOC_EXPORT (void)
+mongoc_shard_router_destroy (mongoc_shard_router_t *router);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_SHARD_ROUTER_H */
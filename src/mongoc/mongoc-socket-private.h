@@ -34,13 +34,62 @@ struct _mongoc_socket_t {
    int errno_;
    int domain;
    int pid;
+   bool quickack; /* re-enable TCP_QUICKACK after each receive */
+   bool fastopen; /* connect with connectx for TCP Fast Open, on macOS */
+   /* send messages of at least this many bytes with MSG_ZEROCOPY, or 0 */
+   int32_t zerocopy_min_size;
+   uint32_t zerocopy_sent; /* MSG_ZEROCOPY sends so far */
+   uint32_t zerocopy_done; /* sends the kernel has released the pages of */
 };
 
+/* tuning for TCP sockets, from the URI's "tcp*" options. zero keeps the
+ * driver's or the kernel's default */
+typedef struct _mongoc_socket_opts_t {
+   int32_t rcvbuf;         /* SO_RCVBUF bytes */
+   int32_t sndbuf;         /* SO_SNDBUF bytes */
+   int32_t keepidle;       /* seconds idle before the first probe */
+   int32_t keepintvl;      /* seconds between probes */
+   int32_t keepcnt;        /* unanswered probes before the connection drops */
+   int32_t busy_poll_usec; /* SO_BUSY_POLL */
+   bool nodelay;           /* TCP_NODELAY, defaults to true */
+   bool quickack;          /* TCP_QUICKACK */
+   int32_t zerocopy_min_size; /* MSG_ZEROCOPY for larger messages */
+   bool fastopen;             /* TCP Fast Open */
+} mongoc_socket_opts_t;
+
 mongoc_socket_t *
 mongoc_socket_accept_ex (mongoc_socket_t *sock,
                          int64_t expire_at,
                          uint16_t *port);
 
+/* RFC 8305's "Connection Attempt Delay" */
+#define MONGOC_HAPPY_EYEBALLS_DELAY_MS 250
+
+struct addrinfo **
+_mongoc_addrinfo_interleave (struct addrinfo *results, size_t *n);
+
+mongoc_socket_t *
+_mongoc_socket_connect_happy_eyeballs (struct addrinfo *results,
+                                       uint16_t port,
+                                       int32_t timeout_msec,
+                                       const mongoc_socket_opts_t *opts);
+
+void
+_mongoc_socket_set_opts (mongoc_socket_t *sock,
+                         const mongoc_socket_opts_t *opts);
+
+void
+_mongoc_socket_quickack (mongoc_socket_t *sock);
+
+typedef enum {
+   MONGOC_SOCKET_ALIVE,
+   MONGOC_SOCKET_CLOSED,
+   MONGOC_SOCKET_LIVENESS_UNKNOWN,
+} mongoc_socket_liveness_t;
+
+mongoc_socket_liveness_t
+_mongoc_socket_check_liveness (mongoc_socket_t *sock);
+
 BSON_END_DECLS
 
 #endif /* MONGOC_SOCKET_PRIVATE_H */
@@ -17,6 +17,9 @@
 
 #include <errno.h>
 #include <string.h>
+#ifndef _WIN32
+#include <limits.h>
+#endif
 
 #include "mongoc-counters-private.h"
 #include "mongoc-errno-private.h"
@@ -27,6 +30,17 @@
 #ifdef _WIN32
 #include <Mstcpip.h>
 #endif
+#ifdef __linux__
+#include <linux/errqueue.h>
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && \
+   defined(SO_EE_ORIGIN_ZEROCOPY)
+#define MONGOC_SOCKET_ZEROCOPY 1
+#endif
+#endif
+#if defined(__APPLE__) && defined(CONNECT_RESUME_ON_READ_WRITE) && \
+   defined(CONNECT_DATA_IDEMPOTENT)
+#define MONGOC_SOCKET_CONNECTX 1
+#endif
 
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "socket"
@@ -36,6 +50,17 @@
    ((expire_at >= 0) && (expire_at < (bson_get_monotonic_time ())))
 
 
+/* mongoc_socket_poll only allocates for more sockets than this */
+#define MONGOC_SOCKET_POLL_LOCAL_SIZE 8
+
+
+/* sendmsg fails with EMSGSIZE past IOV_MAX iovecs, send that many at a
+ * time instead and let mongoc_socket_sendv continue with the rest */
+#if !defined(_WIN32) && !defined(IOV_MAX)
+#define IOV_MAX 1024
+#endif
+
+
 /* either struct sockaddr or void, depending on platform */
 typedef MONGOC_SOCKET_ARG2 mongoc_sockaddr_t;
 
@@ -274,6 +299,8 @@ mongoc_socket_poll (mongoc_socket_poll_t *sds, /* IN */
    fd_set error_fds;
    struct timeval timeout_tv;
 #else
+   /* most callers poll a single socket, don't malloc for them */
+   struct pollfd pfds_local[MONGOC_SOCKET_POLL_LOCAL_SIZE];
    struct pollfd *pfds;
 #endif
    int ret;
@@ -322,7 +349,11 @@ mongoc_socket_poll (mongoc_socket_poll_t *sds, /* IN */
       }
    }
 #else
-   pfds = (struct pollfd *) bson_malloc (sizeof (*pfds) * nsds);
+   if (nsds <= MONGOC_SOCKET_POLL_LOCAL_SIZE) {
+      pfds = pfds_local;
+   } else {
+      pfds = (struct pollfd *) bson_malloc (sizeof (*pfds) * nsds);
+   }
 
    for (i = 0; i < nsds; i++) {
       pfds[i].fd = sds[i].socket->sd;
@@ -335,7 +366,9 @@ mongoc_socket_poll (mongoc_socket_poll_t *sds, /* IN */
       sds[i].revents = pfds[i].revents;
    }
 
-   bson_free (pfds);
+   if (pfds != pfds_local) {
+      bson_free (pfds);
+   }
 #endif
 
    return ret;
@@ -569,6 +602,200 @@ _mongoc_socket_setnodelay (int sd) /* IN */
 }
 
 
+static void
+_mongoc_socket_setopt_int (mongoc_socket_t *sock,
+                           int level,
+                           int name,
+                           const char *name_str,
+                           int value)
+{
+   if (setsockopt (
+          sock->sd, level, name, (char *) &value, (int) sizeof value)) {
+      _mongoc_socket_capture_errno (sock);
+      MONGOC_WARNING (
+         "Failed to set %s to %d: %d", name_str, value, sock->errno_);
+   } else {
+      TRACE ("'%s' set to %d", name_str, value);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_set_opts --
+ *
+ *       Apply the tuning in @opts to a TCP socket, overriding the
+ *       defaults mongoc_socket_new chose. Call it before connecting, the
+ *       receive buffer size limits the window scale negotiated in the
+ *       handshake. Options the platform lacks are skipped, and failures
+ *       are logged rather than returned, like the defaults.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_socket_set_opts (mongoc_socket_t *sock,
+                         const mongoc_socket_opts_t *opts)
+{
+#ifdef _WIN32
+   struct tcp_keepalive keepalive;
+   DWORD lpcbBytesReturned = 0;
+#endif
+
+   ENTRY;
+
+   BSON_ASSERT (sock);
+
+   if (!opts || sock->domain == AF_UNIX) {
+      EXIT;
+   }
+
+   if (opts->rcvbuf > 0) {
+      _mongoc_socket_setopt_int (
+         sock, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", opts->rcvbuf);
+   }
+
+   if (opts->sndbuf > 0) {
+      _mongoc_socket_setopt_int (
+         sock, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", opts->sndbuf);
+   }
+
+   if (!opts->nodelay) {
+      _mongoc_socket_setopt_int (
+         sock, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", 0);
+   }
+
+#ifdef _WIN32
+   /* Windows sets both timings at once, and always sends 10 probes */
+   if (opts->keepidle > 0 || opts->keepintvl > 0) {
+      keepalive.onoff = true;
+      keepalive.keepalivetime =
+         (opts->keepidle > 0 ? opts->keepidle : MONGODB_KEEPIDLE) * 1000;
+      keepalive.keepaliveinterval =
+         (opts->keepintvl > 0 ? opts->keepintvl : MONGODB_KEEPALIVEINTVL) *
+         1000;
+      if (WSAIoctl (sock->sd,
+                    SIO_KEEPALIVE_VALS,
+                    &keepalive,
+                    sizeof keepalive,
+                    NULL,
+                    0,
+                    &lpcbBytesReturned,
+                    NULL,
+                    NULL) == SOCKET_ERROR) {
+         MONGOC_WARNING ("Failed to set keepalive values: %d",
+                         (int) WSAGetLastError ());
+      }
+   }
+#else
+   if (opts->keepidle > 0) {
+#if defined(TCP_KEEPIDLE)
+      _mongoc_socket_setopt_int (
+         sock, IPPROTO_TCP, TCP_KEEPIDLE, "TCP_KEEPIDLE", opts->keepidle);
+#elif defined(TCP_KEEPALIVE)
+      _mongoc_socket_setopt_int (
+         sock, IPPROTO_TCP, TCP_KEEPALIVE, "TCP_KEEPALIVE", opts->keepidle);
+#else
+      TRACE ("%s", "Neither TCP_KEEPIDLE nor TCP_KEEPALIVE available");
+#endif
+   }
+
+#ifdef TCP_KEEPINTVL
+   if (opts->keepintvl > 0) {
+      _mongoc_socket_setopt_int (
+         sock, IPPROTO_TCP, TCP_KEEPINTVL, "TCP_KEEPINTVL", opts->keepintvl);
+   }
+#endif
+
+#ifdef TCP_KEEPCNT
+   if (opts->keepcnt > 0) {
+      _mongoc_socket_setopt_int (
+         sock, IPPROTO_TCP, TCP_KEEPCNT, "TCP_KEEPCNT", opts->keepcnt);
+   }
+#endif
+#endif
+
+#ifdef SO_BUSY_POLL
+   if (opts->busy_poll_usec > 0) {
+      _mongoc_socket_setopt_int (
+         sock, SOL_SOCKET, SO_BUSY_POLL, "SO_BUSY_POLL", opts->busy_poll_usec);
+   }
+#endif
+
+#ifdef TCP_QUICKACK
+   if (opts->quickack) {
+      sock->quickack = true;
+      _mongoc_socket_quickack (sock);
+   }
+#endif
+
+   if (opts->fastopen) {
+#if defined(TCP_FASTOPEN_CONNECT)
+      /* connect returns at once if the kernel has a cookie for the server,
+       * and the first write goes out with the SYN. without a cookie, or if
+       * the server refuses, it is an ordinary handshake */
+      int one = 1;
+
+      if (setsockopt (sock->sd,
+                      IPPROTO_TCP,
+                      TCP_FASTOPEN_CONNECT,
+                      (char *) &one,
+                      (int) sizeof one)) {
+         /* kernels before 4.11, connect as usual */
+         _mongoc_socket_capture_errno (sock);
+         TRACE ("Failed to set TCP_FASTOPEN_CONNECT: %d", sock->errno_);
+      }
+#elif defined(MONGOC_SOCKET_CONNECTX)
+      sock->fastopen = true;
+#else
+      TRACE ("%s", "TCP Fast Open not available");
+#endif
+   }
+
+#ifdef MONGOC_SOCKET_ZEROCOPY
+   if (opts->zerocopy_min_size > 0) {
+      int one = 1;
+
+      if (setsockopt (sock->sd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof one)) {
+         _mongoc_socket_capture_errno (sock);
+         MONGOC_WARNING ("Failed to set SO_ZEROCOPY: %d", sock->errno_);
+      } else {
+         sock->zerocopy_min_size = opts->zerocopy_min_size;
+      }
+   }
+#endif
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_quickack --
+ *
+ *       If the socket was tuned with TCP_QUICKACK, set it again. Linux
+ *       returns to delayed acknowledgements on its own, so this is called
+ *       after each receive.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_socket_quickack (mongoc_socket_t *sock)
+{
+#ifdef TCP_QUICKACK
+   int optval = 1;
+
+   if (sock->quickack) {
+      (void) setsockopt (
+         sock->sd, IPPROTO_TCP, TCP_QUICKACK, &optval, sizeof optval);
+   }
+#endif
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -841,7 +1068,15 @@ mongoc_socket_connect (mongoc_socket_t *sock,       /* IN */
    BSON_ASSERT (addr);
    BSON_ASSERT (addrlen);
 
+#ifdef MONGOC_SOCKET_CONNECTX
+   if (sock->fastopen) {
+      ret = _mongoc_socket_connectx (sock, addr, addrlen);
+   } else {
+      ret = connect (sock->sd, addr, addrlen);
+   }
+#else
    ret = connect (sock->sd, addr, addrlen);
+#endif
 
 #ifdef _WIN32
    if (ret == SOCKET_ERROR) {
@@ -874,6 +1109,55 @@ mongoc_socket_connect (mongoc_socket_t *sock,       /* IN */
 }
 
 
+#ifdef MONGOC_SOCKET_CONNECTX
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_connectx --
+ *
+ *       Connect with TCP Fast Open on macOS. connectx returns at once and
+ *       the kernel sends the SYN with the first write, carrying its data
+ *       if it has a cookie for the server. If connectx is refused, fall
+ *       back to connect and stop trying connectx on @sock.
+ *
+ * Returns:
+ *       The result of connectx or connect.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int
+_mongoc_socket_connectx (mongoc_socket_t *sock,       /* IN */
+                         const struct sockaddr *addr, /* IN */
+                         mongoc_socklen_t addrlen)    /* IN */
+{
+   sa_endpoints_t endpoints = {0};
+   int ret;
+
+   endpoints.sae_dstaddr = addr;
+   endpoints.sae_dstaddrlen = addrlen;
+
+   ret = connectx (sock->sd,
+                   &endpoints,
+                   SAE_ASSOCID_ANY,
+                   CONNECT_RESUME_ON_READ_WRITE | CONNECT_DATA_IDEMPOTENT,
+                   NULL,
+                   0,
+                   NULL,
+                   NULL);
+
+   if (ret == -1 && (errno == EINVAL || errno == ENOTSUP ||
+                     errno == EOPNOTSUPP || errno == ENOSYS)) {
+      TRACE ("connectx failed: %d, falling back to connect", errno);
+      sock->fastopen = false;
+      ret = connect (sock->sd, addr, addrlen);
+   }
+
+   return ret;
+}
+#endif
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1074,6 +1358,7 @@ again:
    }
 
    mongoc_counter_streams_ingress_add (ret);
+   _mongoc_socket_quickack (sock);
 
    RETURN (ret);
 }
@@ -1237,7 +1522,8 @@ _mongoc_socket_try_sendv_slow (mongoc_socket_t *sock, /* IN */
 static ssize_t
 _mongoc_socket_try_sendv (mongoc_socket_t *sock, /* IN */
                           mongoc_iovec_t *iov,   /* IN */
-                          size_t iovcnt)         /* IN */
+                          size_t iovcnt,         /* IN */
+                          bool *zerocopy)        /* INOUT */
 {
 #ifdef _WIN32
    DWORD dwNumberofBytesSent = 0;
@@ -1245,6 +1531,7 @@ _mongoc_socket_try_sendv (mongoc_socket_t *sock, /* IN */
 #else
    struct msghdr msg;
    ssize_t ret;
+   int flags = 0;
 #endif
 
    ENTRY;
@@ -1252,6 +1539,9 @@ _mongoc_socket_try_sendv (mongoc_socket_t *sock, /* IN */
    BSON_ASSERT (sock);
    BSON_ASSERT (iov);
    BSON_ASSERT (iovcnt);
+#ifndef MONGOC_SOCKET_ZEROCOPY
+   (void) zerocopy;
+#endif
 
    DUMP_IOVEC (sendbuf, iov, iovcnt);
 
@@ -1265,13 +1555,26 @@ _mongoc_socket_try_sendv (mongoc_socket_t *sock, /* IN */
 #else
    memset (&msg, 0, sizeof msg);
    msg.msg_iov = iov;
-   msg.msg_iovlen = (int) iovcnt;
-   ret = sendmsg (sock->sd,
-                  &msg,
+   msg.msg_iovlen = (int) BSON_MIN (iovcnt, IOV_MAX);
 #ifdef MSG_NOSIGNAL
-                  MSG_NOSIGNAL);
+   flags |= MSG_NOSIGNAL;
+#endif
+#ifdef MONGOC_SOCKET_ZEROCOPY
+   if (*zerocopy) {
+      ret = sendmsg (sock->sd, &msg, flags | MSG_ZEROCOPY);
+      if (ret >= 0) {
+         /* the kernel numbers each zerocopy send for its notification */
+         sock->zerocopy_sent++;
+      } else if (errno == ENOBUFS) {
+         /* out of memory to pin pages, copy the rest of the message */
+         *zerocopy = false;
+         ret = sendmsg (sock->sd, &msg, flags);
+      }
+   } else {
+      ret = sendmsg (sock->sd, &msg, flags);
+   }
 #else
-                  0);
+   ret = sendmsg (sock->sd, &msg, flags);
 #endif
    TRACE ("Send %ld out of %ld bytes", ret, iov->iov_len);
 #endif
@@ -1308,6 +1611,94 @@ _mongoc_socket_try_sendv (mongoc_socket_t *sock, /* IN */
 }
 
 
+#ifdef MONGOC_SOCKET_ZEROCOPY
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_zerocopy_wait --
+ *
+ *       Wait for the kernel's notifications that it is done with the
+ *       pages of all MSG_ZEROCOPY sends on @sock, so the caller may free
+ *       or reuse the memory it sent.
+ *
+ * Returns:
+ *       true if all sends are complete, false on timeout or error.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_socket_zerocopy_wait (mongoc_socket_t *sock, /* IN */
+                              int64_t expire_at)     /* IN */
+{
+   char control[128];
+   struct msghdr msg;
+   struct cmsghdr *cm;
+   struct sock_extended_err *serr;
+   struct pollfd pfd;
+   int timeout;
+
+   ENTRY;
+
+   while ((int32_t) (sock->zerocopy_done - sock->zerocopy_sent) < 0) {
+      memset (&msg, 0, sizeof msg);
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof control;
+
+      if (recvmsg (sock->sd, &msg, MSG_ERRQUEUE) == -1) {
+         _mongoc_socket_capture_errno (sock);
+         if (!_mongoc_socket_errno_is_again (sock)) {
+            RETURN (false);
+         }
+
+         /* notifications are signaled with POLLERR */
+         timeout = -1;
+         if (expire_at >= 0) {
+            timeout =
+               (int) ((expire_at - bson_get_monotonic_time ()) / 1000L);
+            if (timeout < 0) {
+               RETURN (false);
+            }
+         }
+
+         pfd.fd = sock->sd;
+         pfd.events = 0;
+         pfd.revents = 0;
+         if (poll (&pfd, 1, timeout) <= 0) {
+            _mongoc_socket_capture_errno (sock);
+            RETURN (false);
+         }
+
+         continue;
+      }
+
+      for (cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (&msg, cm)) {
+         if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+             !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+            continue;
+         }
+
+         serr = (struct sock_extended_err *) CMSG_DATA (cm);
+         if (serr->ee_errno || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            continue;
+         }
+
+         /* sends ee_info through ee_data are complete */
+         sock->zerocopy_done = serr->ee_data + 1;
+
+         if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+            /* the kernel copied anyway, as over loopback: stop pinning */
+            TRACE ("%s", "MSG_ZEROCOPY fell back to copying, disabling");
+            sock->zerocopy_min_size = 0;
+         }
+      }
+   }
+
+   RETURN (true);
+}
+#endif
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1341,6 +1732,9 @@ mongoc_socket_sendv (mongoc_socket_t *sock,  /* IN */
    ssize_t sent;
    size_t cur = 0;
    mongoc_iovec_t *iov;
+   bool zerocopy = false;
+   size_t total = 0;
+   size_t i;
 
    ENTRY;
 
@@ -1351,8 +1745,19 @@ mongoc_socket_sendv (mongoc_socket_t *sock,  /* IN */
    iov = bson_malloc (sizeof (*iov) * iovcnt);
    memcpy (iov, in_iov, sizeof (*iov) * iovcnt);
 
+   /* pinning pages instead of copying pays off for large messages, if we
+    * may block until the kernel is done with them */
+   if (sock->zerocopy_min_size > 0 && expire_at != 0) {
+      for (i = 0; i < iovcnt; i++) {
+         total += iov[i].iov_len;
+      }
+
+      zerocopy = total >= (size_t) sock->zerocopy_min_size;
+   }
+
    for (;;) {
-      sent = _mongoc_socket_try_sendv (sock, &iov[cur], iovcnt - cur);
+      sent =
+         _mongoc_socket_try_sendv (sock, &iov[cur], iovcnt - cur, &zerocopy);
       TRACE (
          "Sent %ld (of %ld) out of iovcnt=%ld", sent, iov[cur].iov_len, iovcnt);
 
@@ -1391,6 +1796,13 @@ mongoc_socket_sendv (mongoc_socket_t *sock,  /* IN */
           */
          if (cur == iovcnt) {
             TRACE ("%s", "Finished the iovecs");
+#ifdef MONGOC_SOCKET_ZEROCOPY
+            /* the caller may free the iovecs once we return */
+            if (sock->zerocopy_done != sock->zerocopy_sent &&
+                !_mongoc_socket_zerocopy_wait (sock, expire_at)) {
+               ret = -1;
+            }
+#endif
             break;
          }
 
@@ -1492,6 +1904,59 @@ mongoc_socket_check_closed (mongoc_socket_t *sock) /* IN */
    return closed;
 }
 
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_check_liveness --
+ *
+ *       Check without blocking or sending anything whether an idle
+ *       connection is still open: poll for readability or hangup, then
+ *       peek at the first byte.
+ *
+ * Returns:
+ *       MONGOC_SOCKET_ALIVE if nothing is waiting to be read,
+ *       MONGOC_SOCKET_CLOSED if the peer hung up or the socket has an
+ *       error, MONGOC_SOCKET_LIVENESS_UNKNOWN if an idle connection
+ *       unexpectedly has data to read or the check was interrupted.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_socket_liveness_t
+_mongoc_socket_check_liveness (mongoc_socket_t *sock) /* IN */
+{
+   char buf[1];
+   ssize_t r;
+
+   BSON_ASSERT (sock);
+
+   if (!_mongoc_socket_wait (sock, POLLIN, 0)) {
+      /* a zero timeout sets EAGAIN, anything else is poll's own error */
+      return sock->errno_ == EAGAIN ? MONGOC_SOCKET_ALIVE
+                                    : MONGOC_SOCKET_LIVENESS_UNKNOWN;
+   }
+
+   sock->errno_ = 0;
+   r = recv (sock->sd, buf, 1, MSG_PEEK);
+
+   if (r > 0) {
+      return MONGOC_SOCKET_LIVENESS_UNKNOWN;
+   }
+
+   if (r < 0) {
+      _mongoc_socket_capture_errno (sock);
+      if (_mongoc_socket_errno_is_again (sock)) {
+         return MONGOC_SOCKET_LIVENESS_UNKNOWN;
+      }
+   }
+
+   return MONGOC_SOCKET_CLOSED;
+}
+
 /*
  *
  *--------------------------------------------------------------------------
@@ -1534,3 +1999,264 @@ mongoc_socket_inet_ntop (struct addrinfo *rp, /* IN */
       break;
    }
 }
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_addrinfo_interleave --
+ *
+ *       Order @results for connection attempts as RFC 8305 section 4
+ *       describes: alternate address families, beginning with the family
+ *       of the resolver's first choice.
+ *
+ * Returns:
+ *       An array of the @n entries of @results, free it with bson_free.
+ *       The entries remain owned by @results.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+struct addrinfo **
+_mongoc_addrinfo_interleave (struct addrinfo *results, /* IN */
+                             size_t *n)                /* OUT */
+{
+   struct addrinfo **addrs;
+   struct addrinfo *rp;
+   struct addrinfo *same;
+   struct addrinfo *other;
+   size_t count = 0;
+   size_t i;
+   bool turn_same = true;
+
+   BSON_ASSERT (results);
+
+   for (rp = results; rp; rp = rp->ai_next) {
+      count++;
+   }
+
+   addrs = (struct addrinfo **) bson_malloc (sizeof (*addrs) * count);
+   same = other = results;
+
+   for (i = 0; i < count; i++) {
+      while (same && same->ai_family != results->ai_family) {
+         same = same->ai_next;
+      }
+
+      while (other && other->ai_family == results->ai_family) {
+         other = other->ai_next;
+      }
+
+      if ((turn_same && same) || !other) {
+         addrs[i] = same;
+         same = same->ai_next;
+      } else {
+         addrs[i] = other;
+         other = other->ai_next;
+      }
+
+      turn_same = !turn_same;
+   }
+
+   *n = count;
+
+   return addrs;
+}
+
+
+static void
+_mongoc_socket_warn_connect_failed (mongoc_socket_t *sock, /* IN */
+                                    struct addrinfo *rp,   /* IN */
+                                    uint16_t port)         /* IN */
+{
+   char *errmsg;
+   char errmsg_buf[BSON_ERROR_BUFFER_SIZE];
+   char ip[255];
+
+   mongoc_socket_inet_ntop (rp, ip, sizeof ip);
+   errmsg = bson_strerror_r (
+      mongoc_socket_errno (sock), errmsg_buf, sizeof errmsg_buf);
+   MONGOC_WARNING ("Failed to connect to: %s:%d, error: %d, %s\n",
+                   ip,
+                   port,
+                   mongoc_socket_errno (sock),
+                   errmsg);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_connect_happy_eyeballs --
+ *
+ *       Connect to one of @results, racing the addresses as RFC 8305
+ *       describes. Begin a non-blocking connect to each address in
+ *       _mongoc_addrinfo_interleave order, starting the next attempt
+ *       MONGOC_HAPPY_EYEBALLS_DELAY_MS after the previous one, or as soon
+ *       as an attempt fails. Each attempt fails after @timeout_msec.
+ *
+ *       @port is only used in log messages. Each socket is tuned with
+ *       @opts, if not NULL, before it connects.
+ *
+ * Returns:
+ *       The first socket to connect, or NULL if all attempts failed.
+ *
+ * Side effects:
+ *       The losing attempts are closed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_socket_t *
+_mongoc_socket_connect_happy_eyeballs (struct addrinfo *results,
+                                       uint16_t port,
+                                       int32_t timeout_msec,
+                                       const mongoc_socket_opts_t *opts)
+{
+   struct addrinfo **addrs;
+   struct addrinfo **active_addrs;
+   struct addrinfo *rp;
+   mongoc_socket_poll_t *sds;
+   mongoc_socket_t *sock;
+   mongoc_socket_t *winner = NULL;
+   int64_t *expire_at;
+   int64_t now;
+   int64_t next_at;
+   int64_t wake_at;
+   size_t n_addrs;
+   size_t n_active = 0;
+   size_t next = 0;
+   size_t i;
+   ssize_t ret;
+   int optval;
+   mongoc_socklen_t optlen;
+   bool failed;
+
+   ENTRY;
+
+   addrs = _mongoc_addrinfo_interleave (results, &n_addrs);
+   active_addrs =
+      (struct addrinfo **) bson_malloc (sizeof (*active_addrs) * n_addrs);
+   sds = (mongoc_socket_poll_t *) bson_malloc (sizeof (*sds) * n_addrs);
+   expire_at = (int64_t *) bson_malloc (sizeof (*expire_at) * n_addrs);
+
+   now = next_at = bson_get_monotonic_time ();
+
+   while (!winner) {
+      /* start the next attempt when it's due, or when none are in flight */
+      if (next < n_addrs && (now >= next_at || !n_active)) {
+         rp = addrs[next];
+         sock = mongoc_socket_new (
+            rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+         if (!sock) {
+            next++;
+            continue;
+         }
+
+         _mongoc_socket_set_opts (sock, opts);
+
+         if (0 == mongoc_socket_connect (
+                     sock, rp->ai_addr, (mongoc_socklen_t) rp->ai_addrlen, 0)) {
+            winner = sock;
+            break;
+         }
+
+         if (!_mongoc_socket_errno_is_again (sock)) {
+            _mongoc_socket_warn_connect_failed (sock, rp, port);
+            mongoc_socket_destroy (sock);
+            next++;
+            continue;
+         }
+
+         sds[n_active].socket = sock;
+         sds[n_active].events = POLLOUT;
+         sds[n_active].revents = 0;
+         active_addrs[n_active] = rp;
+         expire_at[n_active] = now + timeout_msec * 1000L;
+         n_active++;
+         next++;
+         next_at = now + MONGOC_HAPPY_EYEBALLS_DELAY_MS * 1000L;
+      }
+
+      if (!n_active) {
+         /* every address failed */
+         break;
+      }
+
+      wake_at = next < n_addrs ? next_at : INT64_MAX;
+      for (i = 0; i < n_active; i++) {
+         wake_at = BSON_MIN (wake_at, expire_at[i]);
+      }
+
+      ret = mongoc_socket_poll (
+         sds, n_active, (int32_t) BSON_MAX (0, (wake_at - now) / 1000));
+
+      if (ret < 0 && !MONGOC_ERRNO_IS_AGAIN (errno)) {
+         TRACE ("poll failed: %d", errno);
+         break;
+      }
+
+      now = bson_get_monotonic_time ();
+
+      for (i = 0; i < n_active;) {
+         sock = sds[i].socket;
+         failed = false;
+
+         if (sds[i].revents) {
+            optval = -1;
+            optlen = (mongoc_socklen_t) sizeof optval;
+            if (0 == getsockopt (sock->sd,
+                                 SOL_SOCKET,
+                                 SO_ERROR,
+                                 (char *) &optval,
+                                 &optlen) &&
+                optval == 0) {
+               winner = sock;
+            } else {
+               sock->errno_ = optval;
+               failed = true;
+            }
+         } else if (now >= expire_at[i]) {
+#ifdef _WIN32
+            sock->errno_ = WSAETIMEDOUT;
+#else
+            sock->errno_ = ETIMEDOUT;
+#endif
+            failed = true;
+         }
+
+         if (!winner && !failed) {
+            i++;
+            continue;
+         }
+
+         if (failed) {
+            _mongoc_socket_warn_connect_failed (sock, active_addrs[i], port);
+            mongoc_socket_destroy (sock);
+            /* don't wait out the delay, the next address may connect */
+            next_at = now;
+         }
+
+         /* remove attempt i, keeping the arrays dense for polling */
+         n_active--;
+         sds[i] = sds[n_active];
+         active_addrs[i] = active_addrs[n_active];
+         expire_at[i] = expire_at[n_active];
+
+         if (winner) {
+            break;
+         }
+      }
+   }
+
+   for (i = 0; i < n_active; i++) {
+      mongoc_socket_destroy (sds[i].socket);
+   }
+
+   bson_free (expire_at);
+   bson_free (sds);
+   bson_free (active_addrs);
+   bson_free (addrs);
+
+   RETURN (winner);
+}
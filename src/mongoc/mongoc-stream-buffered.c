@@ -23,16 +23,24 @@
 #include "mongoc-stream-buffered.h"
 #include "mongoc-stream-private.h"
 #include "mongoc-trace-private.h"
+#include "mongoc-uri.h"
 
 
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "stream"
 
 
+/* shrink the buffer after this many reads that fit in a quarter of it */
+#define MONGOC_STREAM_BUFFERED_SHRINK_AFTER 16
+
+
 typedef struct {
    mongoc_stream_t stream;
    mongoc_stream_t *base_stream;
    mongoc_buffer_t buffer;
+   size_t initial_size;
+   size_t max_size;
+   uint32_t n_small_reads;
 } mongoc_stream_buffered_t;
 
 
@@ -216,6 +224,87 @@ mongoc_stream_buffered_writev (mongoc_stream_t *stream, /* IN */
  *--------------------------------------------------------------------------
  */
 
+/* keep the buffer near the size of recent reads: it grows with a read up to
+ * about max_size, and halves, down to initial_size, after a run of small
+ * reads once what it holds fits */
+static void
+_mongoc_stream_buffered_tune (mongoc_stream_buffered_t *buffered,
+                              size_t total_bytes)
+{
+   mongoc_buffer_t *buffer = &buffered->buffer;
+   size_t size;
+
+   if (total_bytes > buffer->datalen / 4 ||
+       buffer->datalen <= buffered->initial_size) {
+      buffered->n_small_reads = 0;
+      return;
+   }
+
+   if (buffered->n_small_reads < MONGOC_STREAM_BUFFERED_SHRINK_AFTER) {
+      buffered->n_small_reads++;
+      return;
+   }
+
+   size = BSON_MAX (buffer->datalen / 2, buffered->initial_size);
+   if (buffer->len <= size) {
+      _mongoc_buffer_shrink (buffer, size);
+      buffered->n_small_reads = 0;
+   }
+}
+
+
+/* copy what's buffered into @iov, then read the rest straight into @iov
+ * without growing the buffer past max_size or copying twice */
+static ssize_t
+_mongoc_stream_buffered_readv_direct (mongoc_stream_buffered_t *buffered,
+                                      mongoc_iovec_t *iov,
+                                      size_t iovcnt,
+                                      size_t total_bytes,
+                                      int32_t timeout_msec)
+{
+   mongoc_iovec_t *rest;
+   size_t n_rest = 0;
+   size_t copied = 0;
+   size_t n;
+   size_t i;
+   ssize_t ret;
+
+   rest = (mongoc_iovec_t *) bson_malloc (iovcnt * sizeof *rest);
+
+   for (i = 0; i < iovcnt; i++) {
+      n = BSON_MIN (iov[i].iov_len, buffered->buffer.len);
+      memcpy (iov[i].iov_base,
+              buffered->buffer.data + buffered->buffer.off,
+              n);
+      buffered->buffer.off += n;
+      buffered->buffer.len -= n;
+      copied += n;
+
+      if (n < iov[i].iov_len) {
+         rest[n_rest].iov_base = (char *) iov[i].iov_base + n;
+         rest[n_rest].iov_len = iov[i].iov_len - n;
+         n_rest++;
+      }
+   }
+
+   ret = mongoc_stream_readv (buffered->base_stream,
+                              rest,
+                              n_rest,
+                              total_bytes - copied,
+                              timeout_msec);
+
+   bson_free (rest);
+
+   if (ret < 0 || (size_t) ret < total_bytes - copied) {
+      MONGOC_WARNING ("Failed to read %u bytes",
+                      (unsigned) (total_bytes - copied));
+      return -1;
+   }
+
+   return (ssize_t) total_bytes;
+}
+
+
 static ssize_t
 mongoc_stream_buffered_readv (mongoc_stream_t *stream, /* IN */
                               mongoc_iovec_t *iov,     /* INOUT */
@@ -236,6 +325,14 @@ mongoc_stream_buffered_readv (mongoc_stream_t *stream, /* IN */
       total_bytes += iov[i].iov_len;
    }
 
+   _mongoc_stream_buffered_tune (buffered, total_bytes);
+
+   if (total_bytes > buffered->buffer.len &&
+       total_bytes - buffered->buffer.len > buffered->max_size) {
+      RETURN (_mongoc_stream_buffered_readv_direct (
+         buffered, iov, iovcnt, total_bytes, timeout_msec));
+   }
+
    if (-1 == _mongoc_buffer_fill (&buffered->buffer,
                                   buffered->base_stream,
                                   total_bytes,
@@ -310,6 +407,30 @@ _mongoc_stream_buffered_timed_out (mongoc_stream_t *stream) /* IN */
 mongoc_stream_t *
 mongoc_stream_buffered_new (mongoc_stream_t *base_stream, /* IN */
                             size_t buffer_size)           /* IN */
+{
+   return _mongoc_stream_buffered_new_with_max_size (
+      base_stream,
+      buffer_size,
+      BSON_MAX (buffer_size, MONGOC_STREAM_BUFFERED_DEFAULT_MAX_SIZE));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_buffered_new_with_max_size --
+ *
+ *       Like mongoc_stream_buffered_new, but reads of more than
+ *       @max_size bytes bypass the buffer, which is at most about
+ *       @max_size bytes.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_stream_t *
+_mongoc_stream_buffered_new_with_max_size (mongoc_stream_t *base_stream,
+                                           size_t buffer_size,
+                                           size_t max_size)
 {
    mongoc_stream_buffered_t *stream;
 
@@ -330,8 +451,41 @@ mongoc_stream_buffered_new (mongoc_stream_t *base_stream, /* IN */
    stream->base_stream = base_stream;
 
    _mongoc_buffer_init (&stream->buffer, NULL, buffer_size, NULL, NULL);
+   stream->initial_size = stream->buffer.datalen;
+   stream->max_size = BSON_MAX (max_size, stream->initial_size);
 
    mongoc_counter_streams_active_inc ();
 
    return (mongoc_stream_t *) stream;
 }
+
+
+/* a buffered stream sized by @uri's "streamBufferSize" and
+ * "streamBufferMaxSize" */
+mongoc_stream_t *
+_mongoc_stream_buffered_new_for_uri (mongoc_stream_t *base_stream,
+                                     const mongoc_uri_t *uri)
+{
+   int32_t size;
+   int32_t max_size;
+
+   size = mongoc_uri_get_option_as_int32 (
+      uri, MONGOC_URI_STREAMBUFFERSIZE, MONGOC_STREAM_BUFFERED_DEFAULT_SIZE);
+   max_size =
+      mongoc_uri_get_option_as_int32 (uri,
+                                      MONGOC_URI_STREAMBUFFERMAXSIZE,
+                                      MONGOC_STREAM_BUFFERED_DEFAULT_MAX_SIZE);
+
+   return _mongoc_stream_buffered_new_with_max_size (
+      base_stream, (size_t) size, (size_t) max_size);
+}
+
+
+/* the buffer's current size, for tests */
+size_t
+_mongoc_stream_buffered_get_buffer_size (mongoc_stream_t *stream)
+{
+   BSON_ASSERT (stream->type == MONGOC_STREAM_BUFFERED);
+
+   return ((mongoc_stream_buffered_t *) stream)->buffer.datalen;
+}
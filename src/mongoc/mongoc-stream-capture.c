@@ -0,0 +1,470 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "mongoc-counters-private.h"
+#include "mongoc-error.h"
+#include "mongoc-log.h"
+#include "mongoc-stream-capture.h"
+#include "mongoc-stream-private.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-trace-private.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "stream"
+
+
+/*
+ * Capture file format, all integers little-endian:
+ *
+ *   header:  "MONGOCAP" int32 version
+ *   record:  int64 usec since the capture began, uint32 connection id,
+ *            uint8 direction (0 to the server, 1 from it),
+ *            then one complete wire protocol message, length prefix included
+ *
+ * Records from all connections are interleaved in the order the messages
+ * were complete.
+ */
+#define MONGOC_CAPTURE_MAGIC "MONGOCAP"
+#define MONGOC_CAPTURE_VERSION 1
+#define MONGOC_CAPTURE_RECORD_HEADER_LEN 13
+#define MONGOC_CAPTURE_MAX_MSG_LEN (48 * 1024 * 1024)
+
+
+struct _mongoc_capture_t {
+   mongoc_mutex_t mutex;
+   FILE *file;
+   char *path;
+   int64_t started;
+   uint32_t next_connection_id;
+   int refs;
+   bool failed;
+};
+
+
+typedef struct {
+   uint8_t *data;
+   size_t len;
+   size_t allocated;
+   int64_t first_byte_at;
+   bool desynced;
+} mongoc_stream_capture_dir_t;
+
+
+typedef struct {
+   mongoc_stream_t stream;
+   mongoc_stream_t *base_stream;
+   mongoc_capture_t *capture;
+   uint32_t connection_id;
+   mongoc_stream_capture_dir_t out;
+   mongoc_stream_capture_dir_t in;
+} mongoc_stream_capture_t;
+
+
+static void
+_mongoc_capture_release (mongoc_capture_t *capture)
+{
+   bool last;
+
+   mongoc_mutex_lock (&capture->mutex);
+   last = (--capture->refs == 0);
+   mongoc_mutex_unlock (&capture->mutex);
+
+   if (!last) {
+      return;
+   }
+
+   if (fclose (capture->file) != 0 && !capture->failed) {
+      MONGOC_WARNING ("Failed to close capture file \"%s\": %s",
+                      capture->path,
+                      strerror (errno));
+   }
+
+   mongoc_mutex_destroy (&capture->mutex);
+   bson_free (capture->path);
+   bson_free (capture);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_capture_new --
+ *
+ *       Create the capture file at @path, replacing any file there, for
+ *       streams from mongoc_stream_capture_new to record their traffic in.
+ *
+ * Returns:
+ *       A new mongoc_capture_t, or NULL and @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_capture_t *
+mongoc_capture_new (const char *path, bson_error_t *error)
+{
+   mongoc_capture_t *capture;
+   uint8_t header[12];
+   uint32_t version = BSON_UINT32_TO_LE (MONGOC_CAPTURE_VERSION);
+   FILE *file;
+
+   BSON_ASSERT (path);
+
+   file = fopen (path, "wb");
+   if (!file) {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_INVALID_STATE,
+                      "Cannot open capture file \"%s\": %s",
+                      path,
+                      strerror (errno));
+      return NULL;
+   }
+
+   memcpy (header, MONGOC_CAPTURE_MAGIC, 8);
+   memcpy (header + 8, &version, 4);
+   if (fwrite (header, 1, sizeof header, file) != sizeof header) {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_INVALID_STATE,
+                      "Cannot write capture file \"%s\": %s",
+                      path,
+                      strerror (errno));
+      fclose (file);
+      return NULL;
+   }
+
+   capture = (mongoc_capture_t *) bson_malloc0 (sizeof *capture);
+   mongoc_mutex_init (&capture->mutex);
+   capture->file = file;
+   capture->path = bson_strdup (path);
+   capture->started = bson_get_monotonic_time ();
+   capture->next_connection_id = 1;
+   capture->refs = 1;
+
+   return capture;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_capture_destroy --
+ *
+ *       Release @capture. The file is closed once the streams recording
+ *       into it are destroyed, too.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_capture_destroy (mongoc_capture_t *capture)
+{
+   if (capture) {
+      _mongoc_capture_release (capture);
+   }
+}
+
+
+static void
+_mongoc_capture_write (mongoc_capture_t *capture,
+                       int64_t when,
+                       uint32_t connection_id,
+                       uint8_t direction,
+                       const uint8_t *msg,
+                       size_t len)
+{
+   uint8_t header[MONGOC_CAPTURE_RECORD_HEADER_LEN];
+   int64_t usec = BSON_UINT64_TO_LE (when - capture->started);
+   uint32_t id = BSON_UINT32_TO_LE (connection_id);
+
+   memcpy (header, &usec, 8);
+   memcpy (header + 8, &id, 4);
+   header[12] = direction;
+
+   mongoc_mutex_lock (&capture->mutex);
+
+   if (!capture->failed &&
+       (fwrite (header, 1, sizeof header, capture->file) != sizeof header ||
+        fwrite (msg, 1, len, capture->file) != len)) {
+      /* warn once, and stop rather than leave a truncated record behind */
+      capture->failed = true;
+      MONGOC_WARNING ("Stopped capturing to \"%s\": %s",
+                      capture->path,
+                      strerror (errno));
+   }
+
+   mongoc_mutex_unlock (&capture->mutex);
+}
+
+
+/* append @len bytes, then record each message they complete */
+static void
+_mongoc_stream_capture_append (mongoc_stream_capture_t *capture_stream,
+                               mongoc_stream_capture_dir_t *dir,
+                               uint8_t direction,
+                               mongoc_iovec_t *iov,
+                               size_t iovcnt,
+                               size_t len)
+{
+   int32_t msg_len;
+   size_t consumed = 0;
+   size_t n;
+   size_t i;
+
+   if (dir->desynced || !len) {
+      return;
+   }
+
+   if (!dir->len) {
+      dir->first_byte_at = bson_get_monotonic_time ();
+   }
+
+   if (dir->len + len > dir->allocated) {
+      dir->allocated = bson_next_power_of_two (dir->len + len);
+      dir->data = (uint8_t *) bson_realloc (dir->data, dir->allocated);
+   }
+
+   for (i = 0; i < iovcnt && len; i++) {
+      n = BSON_MIN (len, iov[i].iov_len);
+      memcpy (dir->data + dir->len, iov[i].iov_base, n);
+      dir->len += n;
+      len -= n;
+   }
+
+   while (dir->len - consumed >= sizeof msg_len) {
+      memcpy (&msg_len, dir->data + consumed, sizeof msg_len);
+      msg_len = BSON_UINT32_FROM_LE (msg_len);
+
+      if (msg_len < 16 || msg_len > MONGOC_CAPTURE_MAX_MSG_LEN) {
+         /* lost track of message boundaries: give up on this stream */
+         MONGOC_WARNING ("Not capturing connection %u: invalid message length",
+                         capture_stream->connection_id);
+         dir->desynced = true;
+         dir->len = 0;
+         return;
+      }
+
+      if (dir->len - consumed < (size_t) msg_len) {
+         break;
+      }
+
+      _mongoc_capture_write (capture_stream->capture,
+                             dir->first_byte_at,
+                             capture_stream->connection_id,
+                             direction,
+                             dir->data + consumed,
+                             (size_t) msg_len);
+
+      consumed += (size_t) msg_len;
+      dir->first_byte_at = bson_get_monotonic_time ();
+   }
+
+   if (consumed) {
+      memmove (dir->data, dir->data + consumed, dir->len - consumed);
+      dir->len -= consumed;
+   }
+}
+
+
+static void
+_mongoc_stream_capture_destroy (mongoc_stream_t *stream)
+{
+   mongoc_stream_capture_t *capture_stream = (mongoc_stream_capture_t *) stream;
+
+   BSON_ASSERT (stream);
+
+   mongoc_stream_destroy (capture_stream->base_stream);
+   capture_stream->base_stream = NULL;
+
+   _mongoc_capture_release (capture_stream->capture);
+   bson_free (capture_stream->out.data);
+   bson_free (capture_stream->in.data);
+   bson_free (stream);
+
+   mongoc_counter_streams_active_dec ();
+   mongoc_counter_streams_disposed_inc ();
+}
+
+
+static void
+_mongoc_stream_capture_failed (mongoc_stream_t *stream)
+{
+   _mongoc_stream_capture_destroy (stream);
+}
+
+
+static int
+_mongoc_stream_capture_close (mongoc_stream_t *stream)
+{
+   mongoc_stream_capture_t *capture_stream = (mongoc_stream_capture_t *) stream;
+   BSON_ASSERT (stream);
+   return mongoc_stream_close (capture_stream->base_stream);
+}
+
+
+static int
+_mongoc_stream_capture_flush (mongoc_stream_t *stream)
+{
+   mongoc_stream_capture_t *capture_stream = (mongoc_stream_capture_t *) stream;
+   BSON_ASSERT (stream);
+   return mongoc_stream_flush (capture_stream->base_stream);
+}
+
+
+static ssize_t
+_mongoc_stream_capture_writev (mongoc_stream_t *stream,
+                               mongoc_iovec_t *iov,
+                               size_t iovcnt,
+                               int32_t timeout_msec)
+{
+   mongoc_stream_capture_t *capture_stream = (mongoc_stream_capture_t *) stream;
+   ssize_t ret;
+
+   ENTRY;
+
+   BSON_ASSERT (capture_stream);
+
+   ret = mongoc_stream_writev (
+      capture_stream->base_stream, iov, iovcnt, timeout_msec);
+   if (ret > 0) {
+      _mongoc_stream_capture_append (
+         capture_stream, &capture_stream->out, 0, iov, iovcnt, (size_t) ret);
+   }
+
+   RETURN (ret);
+}
+
+
+static ssize_t
+_mongoc_stream_capture_readv (mongoc_stream_t *stream,
+                              mongoc_iovec_t *iov,
+                              size_t iovcnt,
+                              size_t min_bytes,
+                              int32_t timeout_msec)
+{
+   mongoc_stream_capture_t *capture_stream = (mongoc_stream_capture_t *) stream;
+   ssize_t ret;
+
+   ENTRY;
+
+   BSON_ASSERT (capture_stream);
+
+   ret = mongoc_stream_readv (
+      capture_stream->base_stream, iov, iovcnt, min_bytes, timeout_msec);
+   if (ret > 0) {
+      _mongoc_stream_capture_append (
+         capture_stream, &capture_stream->in, 1, iov, iovcnt, (size_t) ret);
+   }
+
+   RETURN (ret);
+}
+
+
+static int
+_mongoc_stream_capture_setsockopt (mongoc_stream_t *stream,
+                                   int level,
+                                   int optname,
+                                   void *optval,
+                                   mongoc_socklen_t optlen)
+{
+   mongoc_stream_capture_t *capture_stream = (mongoc_stream_capture_t *) stream;
+   BSON_ASSERT (stream);
+   return mongoc_stream_setsockopt (
+      capture_stream->base_stream, level, optname, optval, optlen);
+}
+
+
+static mongoc_stream_t *
+_mongoc_stream_capture_get_base_stream (mongoc_stream_t *stream)
+{
+   return ((mongoc_stream_capture_t *) stream)->base_stream;
+}
+
+
+static bool
+_mongoc_stream_capture_check_closed (mongoc_stream_t *stream)
+{
+   mongoc_stream_capture_t *capture_stream = (mongoc_stream_capture_t *) stream;
+   BSON_ASSERT (stream);
+   return mongoc_stream_check_closed (capture_stream->base_stream);
+}
+
+
+static bool
+_mongoc_stream_capture_timed_out (mongoc_stream_t *stream)
+{
+   mongoc_stream_capture_t *capture_stream = (mongoc_stream_capture_t *) stream;
+   BSON_ASSERT (stream);
+   return mongoc_stream_timed_out (capture_stream->base_stream);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_stream_capture_new --
+ *
+ *       Wrap @base_stream, recording each message sent and received, with
+ *       its time and a connection id, in @capture. Wrap the stream a
+ *       stream initiator returns: if it uses TLS, the messages are still
+ *       recorded as the driver sent and received them, not encrypted.
+ *
+ * Returns:
+ *       A newly allocated mongoc_stream_t that takes ownership of
+ *       @base_stream.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_stream_t *
+mongoc_stream_capture_new (mongoc_stream_t *base_stream,
+                           mongoc_capture_t *capture)
+{
+   mongoc_stream_capture_t *stream;
+
+   BSON_ASSERT (base_stream);
+   BSON_ASSERT (capture);
+
+   stream = (mongoc_stream_capture_t *) bson_malloc0 (sizeof *stream);
+   stream->stream.type = MONGOC_STREAM_CAPTURE;
+   stream->stream.destroy = _mongoc_stream_capture_destroy;
+   stream->stream.failed = _mongoc_stream_capture_failed;
+   stream->stream.close = _mongoc_stream_capture_close;
+   stream->stream.flush = _mongoc_stream_capture_flush;
+   stream->stream.writev = _mongoc_stream_capture_writev;
+   stream->stream.readv = _mongoc_stream_capture_readv;
+   stream->stream.setsockopt = _mongoc_stream_capture_setsockopt;
+   stream->stream.get_base_stream = _mongoc_stream_capture_get_base_stream;
+   stream->stream.check_closed = _mongoc_stream_capture_check_closed;
+   stream->stream.timed_out = _mongoc_stream_capture_timed_out;
+
+   stream->base_stream = base_stream;
+   stream->capture = capture;
+
+   mongoc_mutex_lock (&capture->mutex);
+   capture->refs++;
+   stream->connection_id = capture->next_connection_id++;
+   mongoc_mutex_unlock (&capture->mutex);
+
+   mongoc_counter_streams_active_inc ();
+
+   return (mongoc_stream_t *) stream;
+}
@@ -15,6 +15,7 @@
  */
 
 
+#include <errno.h>
 #include <limits.h>
 
 #include "mongoc-counters-private.h"
@@ -33,9 +34,126 @@
 typedef struct {
    mongoc_stream_t stream;
    mongoc_gridfs_file_t *file;
+   bool nonblocking;
 } mongoc_stream_gridfs_t;
 
 
+/* the monotonic time a call with @timeout_msec gives up, -1 for never */
+static int64_t
+_mongoc_stream_gridfs_expire_at (int32_t timeout_msec)
+{
+   if (timeout_msec < 0) {
+      return -1;
+   }
+
+   return bson_get_monotonic_time () + (int64_t) timeout_msec * 1000;
+}
+
+
+static bool
+_mongoc_stream_gridfs_expired (int64_t expire_at)
+{
+   return expire_at >= 0 && bson_get_monotonic_time () >= expire_at;
+}
+
+
+/* skip the first @n bytes of the iovecs in @iov, updating *@iovcnt */
+static mongoc_iovec_t *
+_mongoc_stream_gridfs_advance (mongoc_iovec_t *iov, size_t *iovcnt, size_t n)
+{
+   while (*iovcnt && n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      (*iovcnt)--;
+   }
+
+   if (*iovcnt) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
+   }
+
+   return iov;
+}
+
+
+/**
+ * _mongoc_stream_gridfs_transfer:
+ *
+ *    Read or write @iov without blocking on the server, waiting for the
+ *    file's prefetch or write-behind thread until @min_bytes are moved or
+ *    @timeout_msec passes. A timeout of 0 never waits, a negative one
+ *    waits as long as needed.
+ *
+ * Returns:
+ *
+ *    The number of bytes moved, 0 at the end of the file, or -1 with
+ *    errno EAGAIN if none could be moved in time. -1 on error.
+ */
+static ssize_t
+_mongoc_stream_gridfs_transfer (mongoc_gridfs_file_t *file,
+                                bool for_write,
+                                mongoc_iovec_t *iov,
+                                size_t iovcnt,
+                                size_t min_bytes,
+                                int32_t timeout_msec)
+{
+   mongoc_iovec_t *copy;
+   mongoc_iovec_t *cur;
+   int64_t expire_at;
+   size_t total = 0;
+   size_t len = 0;
+   ssize_t r = 0;
+   size_t i;
+
+   for (i = 0; i < iovcnt; i++) {
+      len += iov[i].iov_len;
+   }
+
+   /* writes are whole unless they time out */
+   if (for_write) {
+      min_bytes = len;
+   }
+
+   min_bytes = BSON_MIN (BSON_MAX (min_bytes, 1), len);
+   expire_at = _mongoc_stream_gridfs_expire_at (timeout_msec);
+
+   copy = (mongoc_iovec_t *) bson_malloc (iovcnt * sizeof *copy);
+   memcpy (copy, iov, iovcnt * sizeof *copy);
+   cur = copy;
+
+   while (total < min_bytes) {
+      r = for_write ? _mongoc_gridfs_file_try_writev (file, cur, iovcnt)
+                    : _mongoc_gridfs_file_try_readv (file, cur, iovcnt);
+
+      if (r == 0) {
+         /* end of file */
+         break;
+      }
+
+      if (r < 0) {
+         if (errno != EAGAIN || file->error.domain ||
+             _mongoc_stream_gridfs_expired (expire_at)) {
+            break;
+         }
+
+         _mongoc_gridfs_file_wait (file, for_write, expire_at);
+         continue;
+      }
+
+      total += (size_t) r;
+      cur = _mongoc_stream_gridfs_advance (cur, &iovcnt, (size_t) r);
+   }
+
+   bson_free (copy);
+
+   if (!total) {
+      return r;
+   }
+
+   return (ssize_t) total;
+}
+
+
 static void
 _mongoc_stream_gridfs_destroy (mongoc_stream_t *stream)
 {
@@ -112,10 +230,17 @@ _mongoc_stream_gridfs_readv (mongoc_stream_t *stream,
    BSON_ASSERT (iov);
    BSON_ASSERT (iovcnt);
 
-   /* timeout_msec is unused by mongoc_gridfs_file_readv */
-   ret = mongoc_gridfs_file_readv (file->file, iov, iovcnt, min_bytes, 0);
+   if (file->nonblocking) {
+      ret = _mongoc_stream_gridfs_transfer (
+         file->file, false, iov, iovcnt, min_bytes, timeout_msec);
+   } else {
+      /* timeout_msec is unused by mongoc_gridfs_file_readv */
+      ret = mongoc_gridfs_file_readv (file->file, iov, iovcnt, min_bytes, 0);
+   }
 
-   mongoc_counter_streams_ingress_add (ret);
+   if (ret > 0) {
+      mongoc_counter_streams_ingress_add (ret);
+   }
 
    RETURN (ret);
 }
@@ -136,10 +261,15 @@ _mongoc_stream_gridfs_writev (mongoc_stream_t *stream,
    BSON_ASSERT (iov);
    BSON_ASSERT (iovcnt);
 
-   /* timeout_msec is unused by mongoc_gridfs_file_writev */
-   ret = mongoc_gridfs_file_writev (file->file, iov, iovcnt, 0);
+   if (file->nonblocking) {
+      ret = _mongoc_stream_gridfs_transfer (
+         file->file, true, iov, iovcnt, 0, timeout_msec);
+   } else {
+      /* timeout_msec is unused by mongoc_gridfs_file_writev */
+      ret = mongoc_gridfs_file_writev (file->file, iov, iovcnt, 0);
+   }
 
-   if (!ret) {
+   if (ret <= 0) {
       RETURN (ret);
    }
 
@@ -156,6 +286,91 @@ _mongoc_stream_gridfs_check_closed (mongoc_stream_t *stream) /* IN */
 }
 
 
+/* set the revents of each stream that reads or writes without blocking on
+ * the server, return how many do */
+static ssize_t
+_mongoc_stream_gridfs_ready (mongoc_stream_poll_t *streams, size_t nstreams)
+{
+   mongoc_stream_gridfs_t *gridfs;
+   ssize_t ready = 0;
+   size_t i;
+
+   for (i = 0; i < nstreams; i++) {
+      gridfs = (mongoc_stream_gridfs_t *) streams[i].stream;
+      streams[i].revents = 0;
+
+      if (gridfs->file->error.domain) {
+         streams[i].revents = POLLERR;
+      } else if (!gridfs->nonblocking) {
+         /* reads and writes always proceed, they just block */
+         streams[i].revents = streams[i].events & (POLLIN | POLLOUT);
+      } else {
+         if ((streams[i].events & POLLIN) &&
+             _mongoc_gridfs_file_can_read (gridfs->file)) {
+            streams[i].revents |= POLLIN;
+         }
+
+         if ((streams[i].events & POLLOUT) &&
+             _mongoc_gridfs_file_can_write (gridfs->file)) {
+            streams[i].revents |= POLLOUT;
+         }
+      }
+
+      if (streams[i].revents) {
+         ready++;
+      }
+   }
+
+   return ready;
+}
+
+
+/**
+ * _mongoc_stream_gridfs_poll:
+ *
+ *    A GridFS file has no descriptor to poll: the streams are ready once
+ *    their prefetch or write-behind threads are. With several streams, wait
+ *    on each thread in turn in short slices until one is ready or the
+ *    timeout passes.
+ */
+static ssize_t
+_mongoc_stream_gridfs_poll (mongoc_stream_poll_t *streams,
+                            size_t nstreams,
+                            int32_t timeout_msec)
+{
+   mongoc_stream_gridfs_t *gridfs;
+   int64_t expire_at;
+   int64_t slice;
+   ssize_t ready;
+   bool for_write;
+   size_t i = 0;
+
+   ENTRY;
+
+   expire_at = _mongoc_stream_gridfs_expire_at (timeout_msec);
+
+   while (!(ready = _mongoc_stream_gridfs_ready (streams, nstreams)) &&
+          !_mongoc_stream_gridfs_expired (expire_at)) {
+      gridfs = (mongoc_stream_gridfs_t *) streams[i].stream;
+      for_write = !(streams[i].events & POLLIN);
+      i = (i + 1) % nstreams;
+
+      if (nstreams == 1) {
+         slice = expire_at;
+      } else {
+         slice = bson_get_monotonic_time () + 10 * 1000;
+         if (expire_at >= 0) {
+            slice = BSON_MIN (slice, expire_at);
+         }
+      }
+
+      _mongoc_gridfs_file_wait (gridfs->file, for_write, slice);
+   }
+
+   RETURN (ready);
+}
+
+
 mongoc_stream_t *
 mongoc_stream_gridfs_new (mongoc_gridfs_file_t *file)
 {
@@ -175,8 +390,32 @@ mongoc_stream_gridfs_new (mongoc_gridfs_file_t *file)
    stream->stream.writev = _mongoc_stream_gridfs_writev;
    stream->stream.readv = _mongoc_stream_gridfs_readv;
    stream->stream.check_closed = _mongoc_stream_gridfs_check_closed;
+   stream->stream.poll = _mongoc_stream_gridfs_poll;
 
    mongoc_counter_streams_active_inc ();
 
    RETURN ((mongoc_stream_t *) stream);
 }
+
+
+mongoc_stream_t *
+mongoc_stream_gridfs_new_nonblocking (mongoc_gridfs_file_t *file,
+                                      mongoc_client_pool_t *pool,
+                                      uint32_t n_chunks)
+{
+   mongoc_stream_gridfs_t *stream;
+
+   ENTRY;
+
+   BSON_ASSERT (file);
+   BSON_ASSERT (pool);
+   BSON_ASSERT (n_chunks);
+
+   mongoc_gridfs_file_set_read_ahead (file, pool, n_chunks);
+   _mongoc_gridfs_file_set_write_behind (file, pool);
+
+   stream = (mongoc_stream_gridfs_t *) mongoc_stream_gridfs_new (file);
+   stream->nonblocking = true;
+
+   RETURN ((mongoc_stream_t *) stream);
+}
@@ -24,6 +24,7 @@
 #include <bson.h>
 
 #include "mongoc-macros.h"
+#include "mongoc-client-pool.h"
 #include "mongoc-gridfs.h"
 #include "mongoc-stream.h"
 
@@ -33,6 +34,10 @@ BSON_BEGIN_DECLS
 
 MONGOC_EXPORT (mongoc_stream_t *)
 mongoc_stream_gridfs_new (mongoc_gridfs_file_t *file);
+MONGOC_EXPORT (mongoc_stream_t *)
+mongoc_stream_gridfs_new_nonblocking (mongoc_gridfs_file_t *file,
+                                      mongoc_client_pool_t *pool,
+                                      uint32_t n_chunks);
 
 
 BSON_END_DECLS
@@ -23,6 +23,7 @@
 
 #include "mongoc-iovec.h"
 #include "mongoc-stream.h"
+#include "mongoc-uri.h"
 
 
 BSON_BEGIN_DECLS
@@ -33,10 +34,21 @@ BSON_BEGIN_DECLS
 #define MONGOC_STREAM_BUFFERED 3
 #define MONGOC_STREAM_GRIDFS 4
 #define MONGOC_STREAM_TLS 5
+#define MONGOC_STREAM_SHAPED 6
+#define MONGOC_STREAM_CAPTURE 7
+
+#define MONGOC_STREAM_BUFFERED_DEFAULT_SIZE 1024
+#define MONGOC_STREAM_BUFFERED_DEFAULT_MAX_SIZE (64 * 1024)
 
 bool
 mongoc_stream_wait (mongoc_stream_t *stream, int64_t expire_at);
 
+mongoc_stream_t *
+mongoc_stream_get_root_stream (mongoc_stream_t *stream);
+
+bool
+_mongoc_stream_has_buffered_data (mongoc_stream_t *stream);
+
 bool
 _mongoc_stream_writev_full (mongoc_stream_t *stream,
                             mongoc_iovec_t *iov,
@@ -44,6 +56,21 @@ _mongoc_stream_writev_full (mongoc_stream_t *stream,
                             int32_t timeout_msec,
                             bson_error_t *error);
 
+bool
+_mongoc_stream_socket_use_uring (mongoc_stream_t *stream);
+
+mongoc_stream_t *
+_mongoc_stream_buffered_new_with_max_size (mongoc_stream_t *base_stream,
+                                           size_t buffer_size,
+                                           size_t max_size);
+
+mongoc_stream_t *
+_mongoc_stream_buffered_new_for_uri (mongoc_stream_t *base_stream,
+                                     const mongoc_uri_t *uri);
+
+size_t
+_mongoc_stream_buffered_get_buffer_size (mongoc_stream_t *stream);
+
 
 BSON_END_DECLS
 
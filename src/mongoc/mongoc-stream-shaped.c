@@ -0,0 +1,345 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-counters-private.h"
+#include "mongoc-log.h"
+#include "mongoc-stream-shaped.h"
+#include "mongoc-stream-private.h"
+#include "mongoc-trace-private.h"
+#include "mongoc-util-private.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "stream"
+
+
+typedef struct {
+   bool enabled;
+   mongoc_stream_shaping_t shaping;
+   int64_t link_free_at; /* when earlier bytes finish crossing the link */
+} mongoc_stream_shaped_dir_t;
+
+
+/*
+ * The wrapper has no thread of its own, so it delays data by sleeping in
+ * the caller. Writes sleep while the send direction's bandwidth is used up,
+ * and record when the bytes reach the server. Replies can't leave the
+ * server before that, so reads sleep until the latest request's arrival
+ * plus the receive direction's delays. Requests written back to back
+ * therefore overlap their latency, as pipelined requests do on a real link.
+ *
+ * The receive latency is charged to the first read after a write, not to
+ * every read, since a reply is usually read in pieces. Nothing is buffered
+ * here, so polling the underlying socket stays accurate.
+ */
+typedef struct {
+   mongoc_stream_t stream;
+   mongoc_stream_t *base_stream;
+   mongoc_stream_shaped_dir_t send;
+   mongoc_stream_shaped_dir_t recv;
+   int64_t request_arrives_at;
+   bool awaiting_reply;
+   uint32_t rand_state;
+} mongoc_stream_shaped_t;
+
+
+static double
+_mongoc_stream_shaped_rand (mongoc_stream_shaped_t *shaped)
+{
+   uint32_t x = shaped->rand_state;
+
+   /* xorshift32, reproducible for a given seed on every platform */
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   shaped->rand_state = x;
+
+   return (double) x / 4294967296.0;
+}
+
+
+/* the latency, jitter, and perhaps a stall, for one transfer */
+static int64_t
+_mongoc_stream_shaped_delay (mongoc_stream_shaped_t *shaped,
+                             mongoc_stream_shaped_dir_t *dir)
+{
+   int64_t usec;
+
+   usec = 1000 * (int64_t) dir->shaping.latency_ms;
+
+   if (dir->shaping.jitter_ms > 0) {
+      usec += (int64_t) (_mongoc_stream_shaped_rand (shaped) * 1000.0 *
+                         dir->shaping.jitter_ms);
+   }
+
+   if (dir->shaping.stall_probability > 0 &&
+       _mongoc_stream_shaped_rand (shaped) < dir->shaping.stall_probability) {
+      usec += 1000 * (int64_t) dir->shaping.stall_ms;
+   }
+
+   return usec;
+}
+
+
+/* when @len bytes sent at @now finish crossing a bandwidth-limited link */
+static int64_t
+_mongoc_stream_shaped_transmit (mongoc_stream_shaped_dir_t *dir,
+                                int64_t now,
+                                size_t len)
+{
+   if (dir->shaping.bytes_per_sec <= 0) {
+      return now;
+   }
+
+   dir->link_free_at = BSON_MAX (dir->link_free_at, now) +
+                       (int64_t) len * 1000000 / dir->shaping.bytes_per_sec;
+
+   return dir->link_free_at;
+}
+
+
+static void
+_mongoc_stream_shaped_sleep_until (int64_t when)
+{
+   int64_t now = bson_get_monotonic_time ();
+
+   if (when > now) {
+      _mongoc_usleep (when - now);
+   }
+}
+
+
+static void
+_mongoc_stream_shaped_destroy (mongoc_stream_t *stream)
+{
+   mongoc_stream_shaped_t *shaped = (mongoc_stream_shaped_t *) stream;
+
+   BSON_ASSERT (stream);
+
+   mongoc_stream_destroy (shaped->base_stream);
+   shaped->base_stream = NULL;
+
+   bson_free (stream);
+
+   mongoc_counter_streams_active_dec ();
+   mongoc_counter_streams_disposed_inc ();
+}
+
+
+static void
+_mongoc_stream_shaped_failed (mongoc_stream_t *stream)
+{
+   _mongoc_stream_shaped_destroy (stream);
+}
+
+
+static int
+_mongoc_stream_shaped_close (mongoc_stream_t *stream)
+{
+   mongoc_stream_shaped_t *shaped = (mongoc_stream_shaped_t *) stream;
+   BSON_ASSERT (stream);
+   return mongoc_stream_close (shaped->base_stream);
+}
+
+
+static int
+_mongoc_stream_shaped_flush (mongoc_stream_t *stream)
+{
+   mongoc_stream_shaped_t *shaped = (mongoc_stream_shaped_t *) stream;
+   BSON_ASSERT (stream);
+   return mongoc_stream_flush (shaped->base_stream);
+}
+
+
+static ssize_t
+_mongoc_stream_shaped_writev (mongoc_stream_t *stream,
+                              mongoc_iovec_t *iov,
+                              size_t iovcnt,
+                              int32_t timeout_msec)
+{
+   mongoc_stream_shaped_t *shaped = (mongoc_stream_shaped_t *) stream;
+   size_t total_bytes = 0;
+   int64_t sent;
+   size_t i;
+   ssize_t ret;
+
+   ENTRY;
+
+   BSON_ASSERT (shaped);
+
+   if (shaped->send.enabled) {
+      for (i = 0; i < iovcnt; i++) {
+         total_bytes += iov[i].iov_len;
+      }
+
+      /* a saturated link blocks the writer */
+      sent = _mongoc_stream_shaped_transmit (
+         &shaped->send, bson_get_monotonic_time (), total_bytes);
+      _mongoc_stream_shaped_sleep_until (sent);
+
+      shaped->request_arrives_at =
+         BSON_MAX (shaped->request_arrives_at,
+                   sent + _mongoc_stream_shaped_delay (shaped, &shaped->send));
+   }
+
+   ret = mongoc_stream_writev (shaped->base_stream, iov, iovcnt, timeout_msec);
+   if (ret > 0) {
+      shaped->awaiting_reply = true;
+   }
+
+   RETURN (ret);
+}
+
+
+static ssize_t
+_mongoc_stream_shaped_readv (mongoc_stream_t *stream,
+                             mongoc_iovec_t *iov,
+                             size_t iovcnt,
+                             size_t min_bytes,
+                             int32_t timeout_msec)
+{
+   mongoc_stream_shaped_t *shaped = (mongoc_stream_shaped_t *) stream;
+   int64_t visible_at;
+   ssize_t ret;
+
+   ENTRY;
+
+   BSON_ASSERT (shaped);
+
+   ret = mongoc_stream_readv (
+      shaped->base_stream, iov, iovcnt, min_bytes, timeout_msec);
+
+   if (ret > 0) {
+      /* the reply leaves the server once the request has arrived */
+      visible_at =
+         BSON_MAX (bson_get_monotonic_time (), shaped->request_arrives_at);
+
+      if (shaped->recv.enabled) {
+         visible_at = _mongoc_stream_shaped_transmit (
+            &shaped->recv, visible_at, (size_t) ret);
+         if (shaped->awaiting_reply) {
+            visible_at += _mongoc_stream_shaped_delay (shaped, &shaped->recv);
+         }
+      }
+
+      shaped->awaiting_reply = false;
+      _mongoc_stream_shaped_sleep_until (visible_at);
+   }
+
+   RETURN (ret);
+}
+
+
+static int
+_mongoc_stream_shaped_setsockopt (mongoc_stream_t *stream,
+                                  int level,
+                                  int optname,
+                                  void *optval,
+                                  mongoc_socklen_t optlen)
+{
+   mongoc_stream_shaped_t *shaped = (mongoc_stream_shaped_t *) stream;
+   BSON_ASSERT (stream);
+   return mongoc_stream_setsockopt (
+      shaped->base_stream, level, optname, optval, optlen);
+}
+
+
+static mongoc_stream_t *
+_mongoc_stream_shaped_get_base_stream (mongoc_stream_t *stream)
+{
+   return ((mongoc_stream_shaped_t *) stream)->base_stream;
+}
+
+
+static bool
+_mongoc_stream_shaped_check_closed (mongoc_stream_t *stream)
+{
+   mongoc_stream_shaped_t *shaped = (mongoc_stream_shaped_t *) stream;
+   BSON_ASSERT (stream);
+   return mongoc_stream_check_closed (shaped->base_stream);
+}
+
+
+static bool
+_mongoc_stream_shaped_timed_out (mongoc_stream_t *stream)
+{
+   mongoc_stream_shaped_t *shaped = (mongoc_stream_shaped_t *) stream;
+   BSON_ASSERT (stream);
+   return mongoc_stream_timed_out (shaped->base_stream);
+}
+
+
+static void
+_mongoc_stream_shaped_dir_init (mongoc_stream_shaped_dir_t *dir,
+                                const mongoc_stream_shaping_t *shaping)
+{
+   if (shaping) {
+      dir->enabled = true;
+      dir->shaping = *shaping;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_stream_shaped_new --
+ *
+ *       Wrap @base_stream, delaying the data sent and received to simulate
+ *       a slower network. @send and @recv describe each direction, NULL
+ *       means unshaped. @seed makes jitter and stalls reproducible.
+ *
+ * Returns:
+ *       A newly allocated mongoc_stream_t that takes ownership of
+ *       @base_stream.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_stream_t *
+mongoc_stream_shaped_new (mongoc_stream_t *base_stream,
+                          const mongoc_stream_shaping_t *send,
+                          const mongoc_stream_shaping_t *recv,
+                          uint32_t seed)
+{
+   mongoc_stream_shaped_t *stream;
+
+   BSON_ASSERT (base_stream);
+
+   stream = (mongoc_stream_shaped_t *) bson_malloc0 (sizeof *stream);
+   stream->stream.type = MONGOC_STREAM_SHAPED;
+   stream->stream.destroy = _mongoc_stream_shaped_destroy;
+   stream->stream.failed = _mongoc_stream_shaped_failed;
+   stream->stream.close = _mongoc_stream_shaped_close;
+   stream->stream.flush = _mongoc_stream_shaped_flush;
+   stream->stream.writev = _mongoc_stream_shaped_writev;
+   stream->stream.readv = _mongoc_stream_shaped_readv;
+   stream->stream.setsockopt = _mongoc_stream_shaped_setsockopt;
+   stream->stream.get_base_stream = _mongoc_stream_shaped_get_base_stream;
+   stream->stream.check_closed = _mongoc_stream_shaped_check_closed;
+   stream->stream.timed_out = _mongoc_stream_shaped_timed_out;
+
+   stream->base_stream = base_stream;
+   _mongoc_stream_shaped_dir_init (&stream->send, send);
+   _mongoc_stream_shaped_dir_init (&stream->recv, recv);
+   /* xorshift never leaves zero */
+   stream->rand_state = seed ? seed : 0x9e3779b9;
+
+   mongoc_counter_streams_active_inc ();
+
+   return (mongoc_stream_t *) stream;
+}
@@ -15,11 +15,13 @@
  */
 
 
+#include "mongoc-counters-private.h"
 #include "mongoc-stream-private.h"
 #include "mongoc-stream-socket.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-socket-private.h"
 #include "mongoc-errno-private.h"
+#include "mongoc-uring-private.h"
 
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "stream"
@@ -28,6 +30,9 @@
 struct _mongoc_stream_socket_t {
    mongoc_stream_t vtable;
    mongoc_socket_t *sock;
+#ifdef MONGOC_HAVE_IO_URING
+   mongoc_uring_t *ring; /* NULL unless the "iouring" URI option is set */
+#endif
 };
 
 
@@ -77,6 +82,10 @@ _mongoc_stream_socket_destroy (mongoc_stream_t *stream)
       ss->sock = NULL;
    }
 
+#ifdef MONGOC_HAVE_IO_URING
+   _mongoc_uring_destroy (ss->ring);
+#endif
+
    bson_free (ss);
 
    EXIT;
@@ -123,6 +132,106 @@ _mongoc_stream_socket_flush (mongoc_stream_t *stream)
 }
 
 
+#ifdef MONGOC_HAVE_IO_URING
+/* advance @iov past @n bytes, returns the index of the first unfinished
+ * vector */
+static size_t
+_mongoc_stream_socket_iov_advance (mongoc_iovec_t *iov,
+                                   size_t iovcnt,
+                                   size_t cur,
+                                   size_t n)
+{
+   while (cur < iovcnt && n >= iov[cur].iov_len) {
+      n -= iov[cur++].iov_len;
+   }
+
+   if (cur < iovcnt) {
+      iov[cur].iov_base = ((char *) iov[cur].iov_base) + n;
+      iov[cur].iov_len -= n;
+   }
+
+   return cur;
+}
+
+
+/* like _mongoc_stream_socket_readv, but each recvmsg and its timeout are
+ * one io_uring submission instead of a poll followed by a recv */
+static ssize_t
+_mongoc_stream_socket_uring_readv (mongoc_stream_socket_t *ss,
+                                   mongoc_iovec_t *iov,
+                                   size_t iovcnt,
+                                   size_t min_bytes,
+                                   int64_t expire_at)
+{
+   ssize_t ret = 0;
+   ssize_t nread;
+   size_t cur = 0;
+
+   ENTRY;
+
+   for (;;) {
+      nread = _mongoc_uring_recv (
+         ss->ring, ss->sock->sd, iov + cur, iovcnt - cur, expire_at);
+
+      if (nread <= 0) {
+         /* zero is a hangup, which mongoc_socket_recv leaves errno 0 for */
+         ss->sock->errno_ = nread == 0 ? 0 : errno;
+         if (ret >= (ssize_t) min_bytes) {
+            RETURN (ret);
+         }
+         errno = ss->sock->errno_;
+         RETURN (-1);
+      }
+
+      mongoc_counter_streams_ingress_add (nread);
+      _mongoc_socket_quickack (ss->sock);
+
+      ret += nread;
+      cur = _mongoc_stream_socket_iov_advance (iov, iovcnt, cur, nread);
+
+      if (cur == iovcnt || ret >= (ssize_t) min_bytes) {
+         RETURN (ret);
+      }
+   }
+}
+
+
+static ssize_t
+_mongoc_stream_socket_uring_writev (mongoc_stream_socket_t *ss,
+                                    mongoc_iovec_t *iov,
+                                    size_t iovcnt,
+                                    int64_t expire_at)
+{
+   ssize_t ret = 0;
+   ssize_t nwritten;
+   size_t cur = 0;
+
+   ENTRY;
+
+   /* like mongoc_socket_sendv, keep sending until done or timed out */
+   while (cur < iovcnt) {
+      nwritten = _mongoc_uring_send (
+         ss->ring, ss->sock->sd, iov + cur, iovcnt - cur, expire_at);
+
+      if (nwritten < 0) {
+         ss->sock->errno_ = errno;
+         RETURN (ret ? ret : -1);
+      }
+
+      mongoc_counter_streams_egress_add (nwritten);
+
+      ret += nwritten;
+      cur = _mongoc_stream_socket_iov_advance (iov, iovcnt, cur, nwritten);
+   }
+
+   ss->sock->errno_ = 0;
+   errno = 0;
+
+   RETURN (ret);
+}
+#endif /* MONGOC_HAVE_IO_URING */
+
+
 static ssize_t
 _mongoc_stream_socket_readv (mongoc_stream_t *stream,
                              mongoc_iovec_t *iov,
@@ -143,6 +252,14 @@ _mongoc_stream_socket_readv (mongoc_stream_t *stream,
 
    expire_at = get_expiration (timeout_msec);
 
+#ifdef MONGOC_HAVE_IO_URING
+   /* a nonblocking read is cheaper as a plain recv */
+   if (ss->ring && expire_at != 0) {
+      RETURN (_mongoc_stream_socket_uring_readv (
+         ss, iov, iovcnt, min_bytes, expire_at));
+   }
+#endif
+
    /*
     * This isn't ideal, we should plumb through to recvmsg(), but we
     * don't actually use this in any way but to a single buffer
@@ -200,6 +317,12 @@ _mongoc_stream_socket_writev (mongoc_stream_t *stream,
 
    if (ss->sock) {
       expire_at = get_expiration (timeout_msec);
+#ifdef MONGOC_HAVE_IO_URING
+      if (ss->ring && expire_at != 0) {
+         RETURN (_mongoc_stream_socket_uring_writev (
+            ss, iov, iovcnt, expire_at));
+      }
+#endif
       ret = mongoc_socket_sendv (ss->sock, iov, iovcnt, expire_at);
       errno = mongoc_socket_errno (ss->sock);
       RETURN (ret);
@@ -209,6 +332,10 @@ _mongoc_stream_socket_writev (mongoc_stream_t *stream,
 }
 
 
+/* _mongoc_stream_socket_poll only allocates for more streams than this */
+#define MONGOC_STREAM_SOCKET_POLL_LOCAL_SIZE 8
+
+
 static ssize_t
 _mongoc_stream_socket_poll (mongoc_stream_poll_t *streams,
                             size_t nstreams,
@@ -217,12 +344,17 @@ _mongoc_stream_socket_poll (mongoc_stream_poll_t *streams,
 {
    int i;
    ssize_t ret = -1;
+   mongoc_socket_poll_t sds_local[MONGOC_STREAM_SOCKET_POLL_LOCAL_SIZE];
    mongoc_socket_poll_t *sds;
    mongoc_stream_socket_t *ss;
 
    ENTRY;
 
-   sds = (mongoc_socket_poll_t *) bson_malloc (sizeof (*sds) * nstreams);
+   if (nstreams <= MONGOC_STREAM_SOCKET_POLL_LOCAL_SIZE) {
+      sds = sds_local;
+   } else {
+      sds = (mongoc_socket_poll_t *) bson_malloc (sizeof (*sds) * nstreams);
+   }
 
    for (i = 0; i < nstreams; i++) {
       ss = (mongoc_stream_socket_t *) streams[i].stream;
@@ -244,7 +376,9 @@ _mongoc_stream_socket_poll (mongoc_stream_poll_t *streams,
    }
 
 CLEANUP:
-   bson_free (sds);
+   if (sds != sds_local) {
+      bson_free (sds);
+   }
 
    RETURN (ret);
 }
@@ -290,6 +424,39 @@ _mongoc_stream_socket_timed_out (mongoc_stream_t *stream) /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_socket_use_uring --
+ *
+ *       Send and receive on @stream with io_uring, if the driver was
+ *       built with it and the kernel supports it.
+ *
+ * Returns:
+ *       true if @stream now uses io_uring, false if it still polls.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_stream_socket_use_uring (mongoc_stream_t *stream)
+{
+#ifdef MONGOC_HAVE_IO_URING
+   mongoc_stream_socket_t *ss = (mongoc_stream_socket_t *) stream;
+
+   BSON_ASSERT (stream->type == MONGOC_STREAM_SOCKET);
+
+   if (!ss->ring) {
+      ss->ring = _mongoc_uring_new ();
+   }
+
+   return ss->ring != NULL;
+#else
+   return false;
+#endif
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -24,6 +24,9 @@
 #ifdef MONGOC_ENABLE_SSL_OPENSSL
 #include <bson.h>
 
+#include "mongoc-stream-tls.h"
+#include "mongoc-stream-tls-private.h"
+
 BSON_BEGIN_DECLS
 
 
@@ -36,8 +39,19 @@ typedef struct {
    BIO *bio;
    BIO_METHOD *meth;
    SSL_CTX *ctx;
+   bool kernel_offload; /* the SSL BIO does I/O on the socket itself */
+   bool timed_out;      /* the last wait for the socket timed out */
 } mongoc_stream_tls_openssl_t;
 
+void
+_mongoc_stream_tls_openssl_resume (mongoc_stream_tls_t *tls);
+
+void
+_mongoc_stream_tls_openssl_kernel_offload (mongoc_stream_tls_t *tls);
+
+bool
+_mongoc_stream_tls_openssl_readable (mongoc_stream_tls_t *tls);
+
 
 BSON_END_DECLS
 
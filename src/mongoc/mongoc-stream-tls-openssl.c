@@ -29,11 +29,14 @@
 
 #include "mongoc-counters-private.h"
 #include "mongoc-errno-private.h"
+#include "mongoc-memory-private.h"
 #include "mongoc-stream-tls.h"
 #include "mongoc-stream-private.h"
 #include "mongoc-stream-tls-private.h"
 #include "mongoc-stream-tls-openssl-bio-private.h"
 #include "mongoc-stream-tls-openssl-private.h"
+#include "mongoc-stream-socket.h"
+#include "mongoc-socket-private.h"
 #include "mongoc-openssl-private.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-log.h"
@@ -45,6 +48,17 @@
 
 #define MONGOC_STREAM_TLS_OPENSSL_BUFFER_SIZE 4096
 
+/* with read-ahead OpenSSL fills this much of its record buffer per read
+ * from the shim BIO, taking whatever the socket has, instead of reading
+ * each record's header and then its body */
+#define MONGOC_STREAM_TLS_OPENSSL_READ_AHEAD_SIZE (64 * 1024)
+
+/* OpenSSL 3 hands the session's keys to Linux or FreeBSD when built with
+ * enable-ktls, and otherwise ignores SSL_OP_ENABLE_KTLS */
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(_WIN32)
+#define MONGOC_STREAM_TLS_OPENSSL_KTLS
+#endif
+
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 static void
 BIO_meth_free (BIO_METHOD *meth)
@@ -93,8 +107,8 @@ _mongoc_stream_tls_openssl_destroy (mongoc_stream_t *stream)
    SSL_CTX_free (openssl->ctx);
    openssl->ctx = NULL;
 
-   bson_free (openssl);
-   bson_free (stream);
+   _mongoc_free_tagged (MONGOC_MEMORY_TAG_TLS, openssl);
+   _mongoc_free_tagged (MONGOC_MEMORY_TAG_TLS, stream);
 
    mongoc_counter_streams_active_dec ();
    mongoc_counter_streams_disposed_inc ();
@@ -187,6 +201,43 @@ _mongoc_stream_tls_openssl_flush (mongoc_stream_t *stream)
 }
 
 
+/* with kernel offload the SSL BIO does I/O on the nonblocking socket
+ * itself: wait for the socket as the shim BIO's stream calls otherwise
+ * would, until @expire or forever if @expire is 0 */
+static bool
+_mongoc_stream_tls_openssl_wait (mongoc_stream_tls_t *tls, int64_t expire)
+{
+   mongoc_stream_tls_openssl_t *openssl =
+      (mongoc_stream_tls_openssl_t *) tls->ctx;
+   mongoc_stream_poll_t poller;
+   int32_t timeout_msec = -1;
+   ssize_t ret;
+
+   if (expire) {
+      timeout_msec = (int32_t) (
+         BSON_MAX (expire - bson_get_monotonic_time (), 0) / 1000L);
+   }
+
+   poller.stream = tls->base_stream;
+   poller.events = BIO_should_read (openssl->bio) ? POLLIN : POLLOUT;
+   poller.revents = 0;
+
+   errno = 0;
+   ret = mongoc_stream_poll (&poller, 1, timeout_msec);
+   if (ret > 0) {
+      return true;
+   }
+
+   if (ret == 0) {
+      openssl->timed_out = true;
+      mongoc_counter_streams_timeout_inc ();
+      errno = ETIMEDOUT;
+   }
+
+   return false;
+}
+
+
 static ssize_t
 _mongoc_stream_tls_openssl_write (mongoc_stream_tls_t *tls,
                                   char *buf,
@@ -209,6 +260,12 @@ _mongoc_stream_tls_openssl_write (mongoc_stream_tls_t *tls,
 
    ret = BIO_write (openssl->bio, buf, buf_len);
 
+   while (ret <= 0 && openssl->kernel_offload &&
+          BIO_should_retry (openssl->bio) &&
+          _mongoc_stream_tls_openssl_wait (tls, expire)) {
+      ret = BIO_write (openssl->bio, buf, buf_len);
+   }
+
    if (ret <= 0) {
       return ret;
    }
@@ -287,6 +344,7 @@ _mongoc_stream_tls_openssl_writev (mongoc_stream_t *stream,
    ENTRY;
 
    tls->timeout_msec = timeout_msec;
+   ((mongoc_stream_tls_openssl_t *) tls->ctx)->timed_out = false;
 
    for (i = 0; i < iovcnt; i++) {
       iov_pos = 0;
@@ -380,6 +438,64 @@ _mongoc_stream_tls_openssl_writev (mongoc_stream_t *stream,
 }
 
 
+/* true if OpenSSL holds received bytes that polling the socket can't
+ * see: decrypted bytes of the current record, or records read ahead */
+static bool
+_mongoc_stream_tls_openssl_buffered (SSL *ssl)
+{
+   if (SSL_pending (ssl) > 0) {
+      return true;
+   }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(LIBRESSL_VERSION_NUMBER)
+   return SSL_has_pending (ssl) == 1;
+#else
+   return false;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_tls_openssl_readable --
+ *
+ *       Check whether a read from @tls returns data without waiting for
+ *       the socket, which a poll on the socket can't tell once OpenSSL
+ *       has read records ahead. A record read ahead only in part needs
+ *       the rest from the socket, so it doesn't count.
+ *
+ * Returns:
+ *       true if buffered data can be read.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_stream_tls_openssl_readable (mongoc_stream_tls_t *tls)
+{
+   mongoc_stream_tls_openssl_t *openssl =
+      (mongoc_stream_tls_openssl_t *) tls->ctx;
+   SSL *ssl;
+   char c;
+
+   BIO_get_ssl (openssl->bio, &ssl);
+
+   if (SSL_pending (ssl) > 0) {
+      return true;
+   }
+
+   if (!_mongoc_stream_tls_openssl_buffered (ssl)) {
+      return false;
+   }
+
+   /* decrypt the next record without waiting for the socket */
+   tls->timeout_msec = 0;
+
+   return SSL_peek (ssl, &c, 1) > 0;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -416,13 +532,17 @@ _mongoc_stream_tls_openssl_readv (mongoc_stream_t *stream,
    size_t iov_pos = 0;
    int64_t now;
    int64_t expire = 0;
+   SSL *ssl;
    ENTRY;
 
    BSON_ASSERT (tls);
    BSON_ASSERT (iov);
    BSON_ASSERT (iovcnt);
 
+   BIO_get_ssl (openssl->bio, &ssl);
+
    tls->timeout_msec = timeout_msec;
+   openssl->timed_out = false;
 
    if (timeout_msec >= 0) {
       expire = bson_get_monotonic_time () + (timeout_msec * 1000UL);
@@ -436,6 +556,15 @@ _mongoc_stream_tls_openssl_readv (mongoc_stream_t *stream,
                               (char *) iov[i].iov_base + iov_pos,
                               (int) (iov[i].iov_len - iov_pos));
 
+         while (read_ret <= 0 && openssl->kernel_offload &&
+                (ret == 0 || (size_t) ret < min_bytes) &&
+                BIO_should_retry (openssl->bio) &&
+                _mongoc_stream_tls_openssl_wait (tls, expire)) {
+            read_ret = BIO_read (openssl->bio,
+                                 (char *) iov[i].iov_base + iov_pos,
+                                 (int) (iov[i].iov_len - iov_pos));
+         }
+
          /* https://www.openssl.org/docs/crypto/BIO_should_retry.html:
           *
           * If BIO_should_retry() returns false then the precise "error
@@ -443,7 +572,16 @@ _mongoc_stream_tls_openssl_readv (mongoc_stream_t *stream,
           * code of the BIO operation. For example if a call to BIO_read() on a
           * socket BIO returns 0 and BIO_should_retry() is false then the cause
           * will be that the connection closed.
+          *
+          * Past @min_bytes only buffered records are read: one read ahead
+          * in part needs the socket, which has nothing yet.
           */
+         if (read_ret <= 0 && ret > 0 && (size_t) ret >= min_bytes &&
+             BIO_should_retry (openssl->bio)) {
+            mongoc_counter_streams_ingress_add (ret);
+            RETURN (ret);
+         }
+
          if (read_ret < 0 ||
              (read_ret == 0 && !BIO_should_retry (openssl->bio))) {
             return -1;
@@ -470,13 +608,18 @@ _mongoc_stream_tls_openssl_readv (mongoc_stream_t *stream,
          }
 
          ret += read_ret;
+         iov_pos += read_ret;
 
          if ((size_t) ret >= min_bytes) {
-            mongoc_counter_streams_ingress_add (ret);
-            RETURN (ret);
-         }
+            /* a poll on the socket won't report what OpenSSL read ahead,
+             * so take it now, without waiting for more */
+            if (!_mongoc_stream_tls_openssl_buffered (ssl)) {
+               mongoc_counter_streams_ingress_add (ret);
+               RETURN (ret);
+            }
 
-         iov_pos += read_ret;
+            tls->timeout_msec = 0;
+         }
       }
    }
 
@@ -560,6 +703,26 @@ mongoc_stream_tls_openssl_handshake (mongoc_stream_t *stream,
    if (BIO_do_handshake (openssl->bio) == 1) {
       if (_mongoc_openssl_check_cert (
              ssl, host, tls->ssl_opts.allow_invalid_hostname)) {
+         if (tls->session_cache) {
+            if (SSL_session_reused (ssl)) {
+               mongoc_counter_tls_session_cache_hits_inc ();
+            } else {
+               mongoc_counter_tls_session_cache_misses_inc ();
+            }
+         }
+
+#ifdef MONGOC_STREAM_TLS_OPENSSL_KTLS
+         if (openssl->kernel_offload) {
+            bool ktls_send = BIO_get_ktls_send (SSL_get_wbio (ssl));
+            bool ktls_recv = BIO_get_ktls_recv (SSL_get_rbio (ssl));
+
+            TRACE ("kernel TLS send: %d, receive: %d", ktls_send, ktls_recv);
+            if (ktls_send || ktls_recv) {
+               mongoc_counter_tls_kernel_offload_inc ();
+            }
+         }
+#endif
+
          RETURN (true);
       }
 
@@ -617,14 +780,136 @@ _mongoc_stream_tls_openssl_sni (SSL *ssl, int *ad, void *arg)
    return SSL_TLSEXT_ERR_OK;
 }
 
+/* OpenSSL issued a session on a connection that has a cache: with TLS 1.2
+ * during the handshake, with TLS 1.3 in NewSessionTicket messages after
+ * it. Returning 1 keeps the reference OpenSSL passed */
+static int
+_mongoc_stream_tls_openssl_new_session (SSL *ssl, SSL_SESSION *session)
+{
+   mongoc_stream_tls_t *tls = (mongoc_stream_tls_t *) SSL_get_app_data (ssl);
+
+   if (!tls || !tls->session_cache) {
+      return 0;
+   }
+
+   _mongoc_tls_session_cache_put (
+      tls->session_cache, tls->session_key, session);
+
+   return 1;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_tls_openssl_resume --
+ *
+ *       Offer the session cached for @tls->session_key, and send the
+ *       sessions the server issues to the cache instead of the
+ *       per-connection SSL_CTX's internal store.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_stream_tls_openssl_resume (mongoc_stream_tls_t *tls)
+{
+   mongoc_stream_tls_openssl_t *openssl =
+      (mongoc_stream_tls_openssl_t *) tls->ctx;
+   SSL_SESSION *session;
+   SSL *ssl;
+
+   ENTRY;
+
+   BIO_get_ssl (openssl->bio, &ssl);
+   SSL_set_app_data (ssl, tls);
+
+   SSL_CTX_set_session_cache_mode (
+      openssl->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+   SSL_CTX_sess_set_new_cb (openssl->ctx,
+                            _mongoc_stream_tls_openssl_new_session);
+
+   session = (SSL_SESSION *) _mongoc_tls_session_cache_get (
+      tls->session_cache, tls->session_key);
+   if (session) {
+      TRACE ("resuming TLS session for %s", tls->session_key);
+      SSL_set_session (ssl, session);
+      SSL_SESSION_free (session);
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_tls_openssl_kernel_offload --
+ *
+ *       Replace the shim BIO with a socket BIO on the base stream's
+ *       descriptor and let OpenSSL enable kernel TLS when the handshake
+ *       completes. The kernel then encrypts the records OpenSSL writes to
+ *       the socket and decrypts those it reads, instead of OpenSSL
+ *       copying each record through a userspace buffer. OpenSSL still
+ *       frames records and handles alerts and TLS 1.3 post-handshake
+ *       messages, and falls back to userspace crypto if the kernel lacks
+ *       the "tls" module or the negotiated cipher.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_stream_tls_openssl_kernel_offload (mongoc_stream_tls_t *tls)
+{
+#ifdef MONGOC_STREAM_TLS_OPENSSL_KTLS
+   mongoc_stream_tls_openssl_t *openssl =
+      (mongoc_stream_tls_openssl_t *) tls->ctx;
+   mongoc_socket_t *sock;
+   BIO *bio_ssl = openssl->bio;
+   BIO *bio_socket;
+   SSL *ssl;
+
+   ENTRY;
+
+   if (tls->base_stream->type != MONGOC_STREAM_SOCKET) {
+      TRACE ("%s", "kernel TLS requires a socket stream");
+      EXIT;
+   }
+
+   sock = mongoc_stream_socket_get_socket (
+      (mongoc_stream_socket_t *) tls->base_stream);
+   bio_socket = BIO_new_socket ((int) sock->sd, BIO_NOCLOSE);
+   if (!bio_socket) {
+      EXIT;
+   }
+
+   /* destroying the shim clears openssl->bio */
+   BIO_free (BIO_pop (bio_ssl));
+   BIO_push (bio_ssl, bio_socket);
+   openssl->bio = bio_ssl;
+
+   BIO_get_ssl (bio_ssl, &ssl);
+   SSL_set_options (ssl, SSL_OP_ENABLE_KTLS);
+   /* the kernel assembles records, and OpenSSL will not enable kTLS for
+    * receiving while its own buffer may hold records read ahead */
+   SSL_set_read_ahead (ssl, 0);
+   openssl->kernel_offload = true;
+
+   EXIT;
+#endif
+}
+
+
 static bool
 _mongoc_stream_tls_openssl_timed_out (mongoc_stream_t *stream)
 {
    mongoc_stream_tls_t *tls = (mongoc_stream_tls_t *) stream;
+   mongoc_stream_tls_openssl_t *openssl =
+      (mongoc_stream_tls_openssl_t *) tls->ctx;
 
    ENTRY;
 
-   RETURN (mongoc_stream_timed_out (tls->base_stream));
+   RETURN (openssl->timed_out || mongoc_stream_timed_out (tls->base_stream));
 }
 
 /*
@@ -662,6 +947,7 @@ mongoc_stream_tls_openssl_new (mongoc_stream_t *base_stream,
    BIO *bio_ssl = NULL;
    BIO *bio_mongoc_shim = NULL;
    BIO_METHOD *meth;
+   SSL *ssl;
 
    BSON_ASSERT (base_stream);
    BSON_ASSERT (opt);
@@ -709,6 +995,16 @@ mongoc_stream_tls_openssl_new (mongoc_stream_t *base_stream,
       SSL_CTX_free (ssl_ctx);
       RETURN (NULL);
    }
+
+   BIO_get_ssl (bio_ssl, &ssl);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(LIBRESSL_VERSION_NUMBER)
+   /* only where SSL_has_pending can tell readv and the async loop about
+    * records read ahead, which a poll on the socket doesn't see */
+   SSL_set_read_ahead (ssl, 1);
+   SSL_set_default_read_buffer_len (ssl,
+                                    MONGOC_STREAM_TLS_OPENSSL_READ_AHEAD_SIZE);
+#endif
+
    meth = mongoc_stream_tls_openssl_bio_meth_new ();
    bio_mongoc_shim = BIO_new (meth);
    if (!bio_mongoc_shim) {
@@ -720,9 +1016,7 @@ mongoc_stream_tls_openssl_new (mongoc_stream_t *base_stream,
 /* Added in OpenSSL 0.9.8f, as a build time option */
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
    if (client) {
-      SSL *ssl;
       /* Set the SNI hostname we are expecting certificate for */
-      BIO_get_ssl (bio_ssl, &ssl);
       SSL_set_tlsext_host_name (ssl, host);
 #endif
    }
@@ -730,12 +1024,14 @@ mongoc_stream_tls_openssl_new (mongoc_stream_t *base_stream,
 
    BIO_push (bio_ssl, bio_mongoc_shim);
 
-   openssl = (mongoc_stream_tls_openssl_t *) bson_malloc0 (sizeof *openssl);
+   openssl = (mongoc_stream_tls_openssl_t *) _mongoc_malloc0_tagged (
+      MONGOC_MEMORY_TAG_TLS, sizeof *openssl);
    openssl->bio = bio_ssl;
    openssl->meth = meth;
    openssl->ctx = ssl_ctx;
 
-   tls = (mongoc_stream_tls_t *) bson_malloc0 (sizeof *tls);
+   tls = (mongoc_stream_tls_t *) _mongoc_malloc0_tagged (MONGOC_MEMORY_TAG_TLS,
+                                                         sizeof *tls);
    tls->parent.type = MONGOC_STREAM_TLS;
    tls->parent.destroy = _mongoc_stream_tls_openssl_destroy;
    tls->parent.failed = _mongoc_stream_tls_openssl_failed;
@@ -28,6 +28,11 @@
 
 BSON_BEGIN_DECLS
 
+/* TLS sessions from earlier connections, by "host:port", so new
+ * connections resume them instead of doing a full handshake. Each
+ * topology has one, shared by its clients and its scanner. */
+typedef struct _mongoc_tls_session_cache_t mongoc_tls_session_cache_t;
+
 /**
  * mongoc_stream_tls_t:
  *
@@ -45,9 +50,44 @@ struct _mongoc_stream_tls_t {
                       const char *host,
                       int *events /* OUT*/,
                       bson_error_t *error);
+   mongoc_tls_session_cache_t *session_cache; /* NULL if not resuming */
+   char session_key[BSON_HOST_NAME_MAX + 7];  /* "host:port" */
+   /* when the handshake began, and how long it took once it succeeded */
+   int64_t handshake_start;
+   int64_t handshake_usec;
 };
 
 
+mongoc_tls_session_cache_t *
+_mongoc_tls_session_cache_new (void);
+
+void
+_mongoc_tls_session_cache_destroy (mongoc_tls_session_cache_t *cache);
+
+void
+_mongoc_tls_session_cache_reset_after_fork (mongoc_tls_session_cache_t *cache);
+
+void *
+_mongoc_tls_session_cache_get (mongoc_tls_session_cache_t *cache,
+                               const char *key);
+
+void
+_mongoc_tls_session_cache_put (mongoc_tls_session_cache_t *cache,
+                               const char *key,
+                               void *session);
+
+void
+_mongoc_stream_tls_set_session_cache (mongoc_stream_t *stream,
+                                      mongoc_tls_session_cache_t *cache,
+                                      const char *host_and_port);
+
+void
+_mongoc_stream_tls_set_kernel_offload (mongoc_stream_t *stream);
+
+int64_t
+_mongoc_stream_tls_get_handshake_usec (mongoc_stream_t *stream);
+
+
 BSON_END_DECLS
 
 #endif /* MONGOC_STREAM_TLS_PRIVATE_H */
@@ -330,8 +330,9 @@ _mongoc_stream_tls_secure_channel_write (mongoc_stream_t *stream,
    return written;
 }
 
-/* This is copypasta from _mongoc_stream_tls_openssl_writev */
-#define MONGOC_STREAM_TLS_BUFFER_SIZE 4096
+/* This is copypasta from _mongoc_stream_tls_openssl_writev, but coalesces
+ * up to a full TLS record */
+#define MONGOC_STREAM_TLS_BUFFER_SIZE 16384
 static ssize_t
 _mongoc_stream_tls_secure_channel_writev (mongoc_stream_t *stream,
                                           mongoc_iovec_t *iov,
@@ -481,6 +482,9 @@ _mongoc_stream_tls_secure_channel_read (mongoc_stream_t *stream,
    /* we want the length of the encrypted buffer to be at least large enough
    *  that it can hold all the bytes requested and some TLS record overhead. */
    size_t min_encdata_length = len + MONGOC_SCHANNEL_BUFFER_FREE_SIZE;
+   /* bytes decrypted straight into @buf, ahead of any cached in
+    * decdata_buffer */
+   size_t direct = 0;
 
    /****************************************************************************
     * Don't return or set secure_channel->recv_unrecoverable_err unless in the
@@ -568,7 +572,7 @@ _mongoc_stream_tls_secure_channel_read (mongoc_stream_t *stream,
 
    /* decrypt loop */
    while (secure_channel->encdata_offset > 0 && sspi_status == SEC_E_OK &&
-          (!len || secure_channel->decdata_offset < len ||
+          (!len || direct + secure_channel->decdata_offset < len ||
            secure_channel->recv_connection_closed)) {
       /* prepare data buffer for DecryptMessage call */
       _mongoc_secure_channel_init_sec_buffer (
@@ -598,7 +602,16 @@ _mongoc_stream_tls_secure_channel_read (mongoc_stream_t *stream,
           sspi_status == SEC_I_CONTEXT_EXPIRED) {
          /* check for successfully decrypted data, even before actual
           * renegotiation or shutdown of the connection context */
-         if (inbuf[1].BufferType == SECBUFFER_DATA) {
+         if (inbuf[1].BufferType == SECBUFFER_DATA &&
+             !secure_channel->decdata_offset &&
+             inbuf[1].cbBuffer <= len - direct) {
+            /* DecryptMessage decrypted the record in place, copy it to the
+             * caller once rather than through decdata_buffer */
+            TRACE ("decrypted data length: %lu", inbuf[1].cbBuffer);
+
+            memcpy (buf + direct, inbuf[1].pvBuffer, inbuf[1].cbBuffer);
+            direct += inbuf[1].cbBuffer;
+         } else if (inbuf[1].BufferType == SECBUFFER_DATA) {
             TRACE ("decrypted data length: %lu", inbuf[1].cbBuffer);
 
             /* increase buffer in order to fit the received amount of data */
@@ -722,7 +735,7 @@ cleanup:
     * it
     * was graceful (close_notify) since there doesn't seem to be a way to tell.
     */
-   if (len && !secure_channel->decdata_offset &&
+   if (len && !direct && !secure_channel->decdata_offset &&
        secure_channel->recv_connection_closed &&
        !secure_channel->recv_sspi_close_notify) {
       error = 1;
@@ -735,21 +748,22 @@ cleanup:
       TRACE ("fatal error");
    }
 
-   size = len < secure_channel->decdata_offset ? len
-                                               : secure_channel->decdata_offset;
+   size = BSON_MIN (len - direct, secure_channel->decdata_offset);
 
    if (size) {
-      memcpy (buf, secure_channel->decdata_buffer, size);
+      memcpy (buf + direct, secure_channel->decdata_buffer, size);
       memmove (secure_channel->decdata_buffer,
                secure_channel->decdata_buffer + size,
                secure_channel->decdata_offset - size);
       secure_channel->decdata_offset -= size;
+   }
 
-      TRACE ("decrypted data returned %zu", size);
+   if (direct + size) {
+      TRACE ("decrypted data returned %zu", direct + size);
       TRACE ("decrypted data buffer: offset %zu length %zu",
              secure_channel->decdata_offset,
              secure_channel->decdata_length);
-      return (ssize_t) size;
+      return (ssize_t) (direct + size);
    }
 
    if (!error && !secure_channel->recv_connection_closed) {
@@ -805,10 +819,17 @@ _mongoc_stream_tls_secure_channel_readv (mongoc_stream_t *stream,
       iov_pos = 0;
 
       while (iov_pos < iov[i].iov_len) {
-         ssize_t read_ret = _mongoc_stream_tls_secure_channel_read (
-            stream,
-            (char *) iov[i].iov_base + iov_pos,
-            (int) (iov[i].iov_len - iov_pos));
+         size_t len = iov[i].iov_len - iov_pos;
+         ssize_t read_ret;
+
+         if (ret > 0 && (size_t) ret >= min_bytes) {
+            /* past min_bytes, fill the iovecs only with data that is
+             * already decrypted */
+            len = BSON_MIN (len, secure_channel->decdata_offset);
+         }
+
+         read_ret = _mongoc_stream_tls_secure_channel_read (
+            stream, (char *) iov[i].iov_base + iov_pos, len);
 
          if (read_ret < 0) {
             RETURN (-1);
@@ -831,13 +852,12 @@ _mongoc_stream_tls_secure_channel_readv (mongoc_stream_t *stream,
          }
 
          ret += read_ret;
+         iov_pos += read_ret;
 
-         if ((size_t) ret >= min_bytes) {
+         if ((size_t) ret >= min_bytes && !secure_channel->decdata_offset) {
             mongoc_counter_streams_ingress_add (ret);
             RETURN (ret);
          }
-
-         iov_pos += read_ret;
       }
    }
 
@@ -26,6 +26,9 @@
 
 #include <Security/Security.h>
 
+#include "mongoc-stream-tls.h"
+#include "mongoc-stream-tls-private.h"
+
 BSON_BEGIN_DECLS
 
 
@@ -38,8 +41,14 @@ typedef struct {
    SSLContextRef ssl_ctx_ref;
    CFArrayRef anchors;
    CFMutableArrayRef my_cert;
+   /* the start of the next TLS record, read with the previous one */
+   uint8_t read_ahead[5];
+   size_t read_ahead_len;
 } mongoc_stream_tls_secure_transport_t;
 
+void
+_mongoc_stream_tls_secure_transport_resume (mongoc_stream_tls_t *tls);
+
 
 BSON_END_DECLS
 
@@ -157,8 +157,9 @@ _mongoc_stream_tls_secure_transport_write (mongoc_stream_t *stream,
    RETURN (write_ret);
 }
 
-/* This is copypasta from _mongoc_stream_tls_openssl_writev */
-#define MONGOC_STREAM_TLS_BUFFER_SIZE 4096
+/* This is copypasta from _mongoc_stream_tls_openssl_writev, but coalesces
+ * up to a full TLS record */
+#define MONGOC_STREAM_TLS_BUFFER_SIZE 16384
 static ssize_t
 _mongoc_stream_tls_secure_transport_writev (mongoc_stream_t *stream,
                                             mongoc_iovec_t *iov,
@@ -296,6 +297,8 @@ _mongoc_stream_tls_secure_transport_readv (mongoc_stream_t *stream,
    size_t i;
    size_t read_ret;
    size_t iov_pos = 0;
+   size_t len;
+   size_t buffered = 0;
    int64_t now;
    int64_t expire = 0;
 
@@ -314,10 +317,20 @@ _mongoc_stream_tls_secure_transport_readv (mongoc_stream_t *stream,
       iov_pos = 0;
 
       while (iov_pos < iov[i].iov_len) {
-         OSStatus status = SSLRead (secure_transport->ssl_ctx_ref,
-                                    (char *) iov[i].iov_base + iov_pos,
-                                    (int) (iov[i].iov_len - iov_pos),
-                                    &read_ret);
+         OSStatus status;
+
+         len = iov[i].iov_len - iov_pos;
+
+         if (ret > 0 && (size_t) ret >= min_bytes) {
+            /* past min_bytes, fill the iovecs only with data that is
+             * already decrypted */
+            len = BSON_MIN (len, buffered);
+         }
+
+         status = SSLRead (secure_transport->ssl_ctx_ref,
+                           (char *) iov[i].iov_base + iov_pos,
+                           len,
+                           &read_ret);
 
          if (status != noErr) {
             RETURN (-1);
@@ -340,13 +353,15 @@ _mongoc_stream_tls_secure_transport_readv (mongoc_stream_t *stream,
          }
 
          ret += read_ret;
+         iov_pos += read_ret;
 
-         if ((size_t) ret >= min_bytes) {
+         if ((size_t) ret >= min_bytes &&
+             (SSLGetBufferedReadSize (secure_transport->ssl_ctx_ref,
+                                      &buffered) != noErr ||
+              !buffered)) {
             mongoc_counter_streams_ingress_add (ret);
             RETURN (ret);
          }
-
-         iov_pos += read_ret;
       }
    }
 
@@ -449,6 +464,26 @@ _mongoc_stream_tls_secure_channel_timed_out (mongoc_stream_t *stream)
    RETURN (mongoc_stream_timed_out (tls->base_stream));
 }
 
+/* Secure Transport caches sessions itself, process-wide, by peer ID.
+ * Including the cache's address keeps resumption within one topology */
+void
+_mongoc_stream_tls_secure_transport_resume (mongoc_stream_tls_t *tls)
+{
+   mongoc_stream_tls_secure_transport_t *secure_transport =
+      (mongoc_stream_tls_secure_transport_t *) tls->ctx;
+   char *peer_id;
+
+   ENTRY;
+
+   peer_id = bson_strdup_printf (
+      "%p/%s", (void *) tls->session_cache, tls->session_key);
+   SSLSetPeerID (secure_transport->ssl_ctx_ref, peer_id, strlen (peer_id));
+   bson_free (peer_id);
+
+   EXIT;
+}
+
+
 mongoc_stream_t *
 mongoc_stream_tls_secure_transport_new (mongoc_stream_t *base_stream,
                                         const char *host,
@@ -23,13 +23,18 @@
 #include <bson.h>
 
 #include "mongoc-log.h"
+#include "mongoc-memory-private.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-error.h"
 
+#include "mongoc-array-private.h"
 #include "mongoc-stream-tls-private.h"
 #include "mongoc-stream-private.h"
+#include "mongoc-thread-private.h"
 #if defined(MONGOC_ENABLE_SSL_OPENSSL)
+#include <openssl/ssl.h>
 #include "mongoc-stream-tls-openssl.h"
+#include "mongoc-stream-tls-openssl-private.h"
 #include "mongoc-openssl-private.h"
 #elif defined(MONGOC_ENABLE_SSL_LIBRESSL)
 #include "mongoc-libressl-private.h"
@@ -37,6 +42,7 @@
 #elif defined(MONGOC_ENABLE_SSL_SECURE_TRANSPORT)
 #include "mongoc-secure-transport-private.h"
 #include "mongoc-stream-tls-secure-transport.h"
+#include "mongoc-stream-tls-secure-transport-private.h"
 #elif defined(MONGOC_ENABLE_SSL_SECURE_CHANNEL)
 #include "mongoc-secure-channel-private.h"
 #include "mongoc-stream-tls-secure-channel.h"
@@ -61,13 +67,23 @@ mongoc_stream_tls_handshake (mongoc_stream_t *stream,
 {
    mongoc_stream_tls_t *stream_tls =
       (mongoc_stream_tls_t *) mongoc_stream_get_tls_stream (stream);
+   bool ret;
 
    BSON_ASSERT (stream_tls);
    BSON_ASSERT (stream_tls->handshake);
 
    stream_tls->timeout_msec = timeout_msec;
+   if (!stream_tls->handshake_start) {
+      stream_tls->handshake_start = bson_get_monotonic_time ();
+   }
+
+   ret = stream_tls->handshake (stream, host, events, error);
+   if (ret && !stream_tls->handshake_usec) {
+      stream_tls->handshake_usec =
+         bson_get_monotonic_time () - stream_tls->handshake_start;
+   }
 
-   return stream_tls->handshake (stream, host, events, error);
+   return ret;
 }
 
 bool
@@ -238,4 +254,252 @@ mongoc_stream_tls_new (mongoc_stream_t *base_stream,
    return mongoc_stream_tls_new_with_hostname (base_stream, NULL, opt, client);
 }
 
+
+typedef struct {
+   char key[BSON_HOST_NAME_MAX + 7];
+   void *session; /* the TLS library's session, the cache owns it */
+} mongoc_tls_session_cache_entry_t;
+
+
+struct _mongoc_tls_session_cache_t {
+   mongoc_mutex_t mutex;
+   mongoc_array_t entries; /* mongoc_tls_session_cache_entry_t */
+};
+
+
+static void
+_mongoc_tls_session_free (void *session)
+{
+#if defined(MONGOC_ENABLE_SSL_OPENSSL)
+   SSL_SESSION_free ((SSL_SESSION *) session);
+#endif
+}
+
+
+mongoc_tls_session_cache_t *
+_mongoc_tls_session_cache_new (void)
+{
+   mongoc_tls_session_cache_t *cache;
+
+   cache = (mongoc_tls_session_cache_t *) _mongoc_malloc0_tagged (
+      MONGOC_MEMORY_TAG_TLS, sizeof *cache);
+   mongoc_mutex_init (&cache->mutex);
+   _mongoc_array_init (&cache->entries,
+                       sizeof (mongoc_tls_session_cache_entry_t));
+
+   return cache;
+}
+
+
+void
+_mongoc_tls_session_cache_destroy (mongoc_tls_session_cache_t *cache)
+{
+   size_t i;
+
+   if (!cache) {
+      return;
+   }
+
+   for (i = 0; i < cache->entries.len; i++) {
+      _mongoc_tls_session_free (
+         _mongoc_array_index (
+            &cache->entries, mongoc_tls_session_cache_entry_t, i)
+            .session);
+   }
+
+   _mongoc_array_destroy (&cache->entries);
+   mongoc_mutex_destroy (&cache->mutex);
+   _mongoc_free_tagged (MONGOC_MEMORY_TAG_TLS, cache);
+}
+
+
+/* in a child process after fork. the sessions are kept: resuming one
+ * doesn't disturb the parent's connections */
+void
+_mongoc_tls_session_cache_reset_after_fork (mongoc_tls_session_cache_t *cache)
+{
+   mongoc_mutex_init (&cache->mutex);
+}
+
+
+/* cache->mutex must be held */
+static mongoc_tls_session_cache_entry_t *
+_mongoc_tls_session_cache_find (mongoc_tls_session_cache_t *cache,
+                                const char *key)
+{
+   mongoc_tls_session_cache_entry_t *entry;
+   size_t i;
+
+   for (i = 0; i < cache->entries.len; i++) {
+      entry = &_mongoc_array_index (
+         &cache->entries, mongoc_tls_session_cache_entry_t, i);
+      if (!strcmp (entry->key, key)) {
+         return entry;
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_tls_session_cache_get --
+ *
+ *       Find the latest session for @key.
+ *
+ * Returns:
+ *       A new reference to the TLS library's session, which the caller
+ *       must release, or NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+_mongoc_tls_session_cache_get (mongoc_tls_session_cache_t *cache,
+                               const char *key)
+{
+   mongoc_tls_session_cache_entry_t *entry;
+   void *session = NULL;
+
+   mongoc_mutex_lock (&cache->mutex);
+   entry = _mongoc_tls_session_cache_find (cache, key);
+   if (entry) {
+      session = entry->session;
+#if defined(MONGOC_ENABLE_SSL_OPENSSL)
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(LIBRESSL_VERSION_NUMBER)
+      SSL_SESSION_up_ref ((SSL_SESSION *) session);
+#else
+      CRYPTO_add (&((SSL_SESSION *) session)->references,
+                  1,
+                  CRYPTO_LOCK_SSL_SESSION);
+#endif
+#endif
+   }
+   mongoc_mutex_unlock (&cache->mutex);
+
+   return session;
+}
+
+
+/* take ownership of @session, replacing the one stored for @key. with TLS
+ * 1.3 each ticket is meant to be used once, and every connection that
+ * resumes receives a fresh one */
+void
+_mongoc_tls_session_cache_put (mongoc_tls_session_cache_t *cache,
+                               const char *key,
+                               void *session)
+{
+   mongoc_tls_session_cache_entry_t *entry;
+   mongoc_tls_session_cache_entry_t new_entry;
+   void *old = NULL;
+
+   mongoc_mutex_lock (&cache->mutex);
+   entry = _mongoc_tls_session_cache_find (cache, key);
+   if (entry) {
+      old = entry->session;
+      entry->session = session;
+   } else {
+      bson_strncpy (new_entry.key, key, sizeof new_entry.key);
+      new_entry.session = session;
+      _mongoc_array_append_val (&cache->entries, new_entry);
+   }
+   mongoc_mutex_unlock (&cache->mutex);
+
+   if (old) {
+      _mongoc_tls_session_free (old);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_tls_set_session_cache --
+ *
+ *       Before the handshake, offer the server the session @cache holds
+ *       for @host_and_port, and store the sessions the server issues on
+ *       this connection. Backends without a way to resume sessions
+ *       ignore the cache.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_stream_tls_set_session_cache (mongoc_stream_t *stream,
+                                      mongoc_tls_session_cache_t *cache,
+                                      const char *host_and_port)
+{
+   mongoc_stream_tls_t *tls = (mongoc_stream_tls_t *) stream;
+
+   BSON_ASSERT (stream->type == MONGOC_STREAM_TLS);
+
+   if (!cache) {
+      return;
+   }
+
+   tls->session_cache = cache;
+   bson_strncpy (tls->session_key, host_and_port, sizeof tls->session_key);
+
+#if defined(MONGOC_ENABLE_SSL_OPENSSL)
+   _mongoc_stream_tls_openssl_resume (tls);
+#elif defined(MONGOC_ENABLE_SSL_SECURE_TRANSPORT)
+   _mongoc_stream_tls_secure_transport_resume (tls);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_tls_set_kernel_offload --
+ *
+ *       Before the handshake, ask the TLS library to hand the session's
+ *       keys to the kernel once the handshake completes, so the kernel
+ *       encrypts and decrypts records on the socket. Ignored unless the
+ *       driver was built with OpenSSL 3 and @stream wraps a socket
+ *       stream, and silently ineffective if the kernel or the cipher
+ *       does not support it.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_stream_tls_set_kernel_offload (mongoc_stream_t *stream)
+{
+   BSON_ASSERT (stream->type == MONGOC_STREAM_TLS);
+
+#if defined(MONGOC_ENABLE_SSL_OPENSSL)
+   _mongoc_stream_tls_openssl_kernel_offload ((mongoc_stream_tls_t *) stream);
+#endif
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_tls_get_handshake_usec --
+ *
+ *       How long the TLS handshake on @stream, or on a TLS stream it
+ *       wraps, took to succeed, in microseconds. Includes waiting for the
+ *       socket to become writable if the handshake began before the
+ *       connection was established.
+ *
+ * Returns:
+ *       The duration, or 0 if there is no TLS stream or no handshake has
+ *       succeeded.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int64_t
+_mongoc_stream_tls_get_handshake_usec (mongoc_stream_t *stream)
+{
+   mongoc_stream_tls_t *tls;
+
+   tls = (mongoc_stream_tls_t *) mongoc_stream_get_tls_stream (stream);
+
+   return tls ? tls->handshake_usec : 0;
+}
+
 #endif
@@ -27,6 +27,10 @@
 #include "mongoc-rpc-private.h"
 #include "mongoc-stream.h"
 #include "mongoc-stream-private.h"
+#ifdef MONGOC_ENABLE_SSL_OPENSSL
+#include <openssl/ssl.h>
+#include "mongoc-stream-tls-openssl-private.h"
+#endif
 #include "mongoc-trace-private.h"
 #include "mongoc-util-private.h"
 
@@ -312,7 +316,7 @@ mongoc_stream_get_base_stream (mongoc_stream_t *stream) /* IN */
 }
 
 
-static mongoc_stream_t *
+mongoc_stream_t *
 mongoc_stream_get_root_stream (mongoc_stream_t *stream)
 
 {
@@ -337,6 +341,39 @@ mongoc_stream_get_tls_stream (mongoc_stream_t *stream) /* IN */
    return stream;
 }
 
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_has_buffered_data --
+ *
+ *       Check whether @stream's TLS layer holds received data that a
+ *       poll on the socket doesn't report, so that a read with a timeout
+ *       of 0 returns some of it.
+ *
+ * Returns:
+ *       true if data can be read without waiting for the socket.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_stream_has_buffered_data (mongoc_stream_t *stream)
+{
+#ifdef MONGOC_ENABLE_SSL_OPENSSL
+   /* a socket stream has no get_base_stream for get_tls_stream to call */
+   for (; stream->get_base_stream; stream = stream->get_base_stream (stream)) {
+      if (stream->type == MONGOC_STREAM_TLS) {
+         return _mongoc_stream_tls_openssl_readable (
+            (mongoc_stream_tls_t *) stream);
+      }
+   }
+#endif
+
+   return false;
+}
+
+
 ssize_t
 mongoc_stream_poll (mongoc_stream_poll_t *streams,
                     size_t nstreams,
@@ -25,6 +25,7 @@
 
 #include "mongoc-config.h"
 #include "mongoc-log.h"
+#include "mongoc-thread.h"
 
 
 #if !defined(_WIN32)
@@ -136,4 +137,23 @@ mongoc_cond_destroy (mongoc_cond_t *_ignored)
 #endif
 
 
+/* thread-local storage for per-thread hints; a plain static elsewhere */
+#if defined(_MSC_VER)
+#define MONGOC_THREAD_LOCAL __declspec(thread)
+#define MONGOC_HAVE_THREAD_LOCAL 1
+#elif defined(__GNUC__) || defined(__clang__)
+#define MONGOC_THREAD_LOCAL __thread
+#define MONGOC_HAVE_THREAD_LOCAL 1
+#else
+#define MONGOC_THREAD_LOCAL
+#endif
+
+
+int
+_mongoc_thread_create (mongoc_thread_kind_t kind,
+                       mongoc_thread_t *thread,
+                       mongoc_thread_func_t func,
+                       void *arg);
+
+
 #endif /* MONGOC_THREAD_PRIVATE_H */
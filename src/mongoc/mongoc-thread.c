@@ -0,0 +1,321 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "mongoc-log.h"
+#include "mongoc-thread-private.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "thread"
+
+
+/* set before the driver creates threads, then only read */
+static struct {
+   mongoc_thread_create_func_t create_func;
+   void *create_data;
+   bool has_affinity;
+#if defined(__linux__)
+   cpu_set_t affinity;
+#elif defined(_WIN32)
+   DWORD_PTR affinity;
+#endif
+   int nice; /* 0 to keep the creating thread's */
+} gThreadSettings;
+
+
+static const char *gThreadKindNames[] = {
+   "topology monitor",
+   "DNS resolver",
+   "connection establisher",
+   "async log",
+   "bulk worker",
+   "GridFS prefetch",
+   "GridFS write-behind",
+};
+
+
+/* a new thread's function and argument, when it applies the settings
+ * before running them */
+typedef struct {
+   mongoc_thread_func_t func;
+   void *arg;
+} mongoc_thread_start_t;
+
+
+#ifdef _WIN32
+static int
+_mongoc_thread_priority (int value)
+{
+   if (value >= 10) {
+      return THREAD_PRIORITY_LOWEST;
+   } else if (value > 0) {
+      return THREAD_PRIORITY_BELOW_NORMAL;
+   } else if (value <= -10) {
+      return THREAD_PRIORITY_HIGHEST;
+   }
+
+   return THREAD_PRIORITY_ABOVE_NORMAL;
+}
+#endif
+
+
+/* apply the affinity and nice value to the calling thread */
+static void
+_mongoc_thread_apply_settings (void)
+{
+#if defined(__linux__)
+   if (gThreadSettings.has_affinity &&
+       0 != sched_setaffinity (
+               0, sizeof gThreadSettings.affinity, &gThreadSettings.affinity)) {
+      MONGOC_WARNING ("Could not set thread CPU affinity: %d", errno);
+   }
+
+   /* on Linux the nice value is per-thread */
+   if (gThreadSettings.nice &&
+       0 != setpriority (PRIO_PROCESS,
+                         (id_t) syscall (SYS_gettid),
+                         gThreadSettings.nice)) {
+      MONGOC_WARNING ("Could not set thread nice value: %d", errno);
+   }
+#elif defined(_WIN32)
+   if (gThreadSettings.has_affinity &&
+       !SetThreadAffinityMask (GetCurrentThread (),
+                               gThreadSettings.affinity)) {
+      MONGOC_WARNING ("Could not set thread CPU affinity: 0x%.8X",
+                      (unsigned int) GetLastError ());
+   }
+
+   if (gThreadSettings.nice &&
+       !SetThreadPriority (GetCurrentThread (),
+                           _mongoc_thread_priority (gThreadSettings.nice))) {
+      MONGOC_WARNING ("Could not set thread priority: 0x%.8X",
+                      (unsigned int) GetLastError ());
+   }
+#endif
+}
+
+
+static void *
+_mongoc_thread_start (void *data)
+{
+   mongoc_thread_start_t *start = (mongoc_thread_start_t *) data;
+   mongoc_thread_func_t func;
+   void *arg;
+
+   func = start->func;
+   arg = start->arg;
+   bson_free (start);
+
+   _mongoc_thread_apply_settings ();
+
+   return func (arg);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_thread_create --
+ *
+ *       Start a thread the driver owns, with the function set by
+ *       mongoc_thread_set_create_func if any. If a CPU affinity or nice
+ *       value is set, the thread applies it before running @func.
+ *
+ * Returns:
+ *       0 on success, or an error number.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+_mongoc_thread_create (mongoc_thread_kind_t kind,
+                       mongoc_thread_t *thread,
+                       mongoc_thread_func_t func,
+                       void *arg)
+{
+   mongoc_thread_start_t *start = NULL;
+   int r;
+
+   if (gThreadSettings.has_affinity || gThreadSettings.nice) {
+      start = (mongoc_thread_start_t *) bson_malloc (sizeof *start);
+      start->func = func;
+      start->arg = arg;
+      func = _mongoc_thread_start;
+      arg = start;
+   }
+
+   if (gThreadSettings.create_func) {
+      r = gThreadSettings.create_func (
+         kind, func, arg, (void *) thread, gThreadSettings.create_data);
+   } else {
+      r = mongoc_thread_create (thread, func, arg);
+   }
+
+   if (r != 0) {
+      bson_free (start);
+   }
+
+   return r;
+}
+
+
+const char *
+mongoc_thread_kind_name (mongoc_thread_kind_t kind)
+{
+   if ((int) kind < 0 || kind > MONGOC_THREAD_GRIDFS_WRITE_BEHIND) {
+      return NULL;
+   }
+
+   return gThreadKindNames[kind];
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_thread_set_create_func --
+ *
+ *       Create the driver's threads with @create_func, or with
+ *       pthread_create or CreateThread if it is NULL. Not thread-safe:
+ *       call it before creating clients.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_thread_set_create_func (mongoc_thread_create_func_t create_func,
+                               void *user_data)
+{
+   gThreadSettings.create_func = create_func;
+   gThreadSettings.create_data = create_func ? user_data : NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_thread_set_cpu_affinity --
+ *
+ *       Run the driver's threads created from now on only on @cpus, or on
+ *       the creating thread's CPUs if @n_cpus is 0. Not thread-safe: call
+ *       it before creating clients.
+ *
+ * Returns:
+ *       False if a CPU is out of range, or CPU affinity isn't supported on
+ *       this platform.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_thread_set_cpu_affinity (const uint32_t *cpus, size_t n_cpus)
+{
+#if defined(__linux__)
+   cpu_set_t affinity;
+   size_t i;
+#elif defined(_WIN32)
+   DWORD_PTR affinity;
+   size_t i;
+#endif
+
+   if (!n_cpus) {
+      gThreadSettings.has_affinity = false;
+      return true;
+   }
+
+   BSON_ASSERT (cpus);
+
+#if defined(__linux__)
+   CPU_ZERO (&affinity);
+
+   for (i = 0; i < n_cpus; i++) {
+      if (cpus[i] >= CPU_SETSIZE) {
+         MONGOC_ERROR ("CPU %" PRIu32 " is out of range", cpus[i]);
+         return false;
+      }
+
+      CPU_SET (cpus[i], &affinity);
+   }
+#elif defined(_WIN32)
+   affinity = 0;
+
+   for (i = 0; i < n_cpus; i++) {
+      if (cpus[i] >= sizeof (DWORD_PTR) * 8) {
+         MONGOC_ERROR ("CPU %" PRIu32 " is out of range", cpus[i]);
+         return false;
+      }
+
+      affinity |= (DWORD_PTR) 1 << cpus[i];
+   }
+#else
+   MONGOC_ERROR ("Thread CPU affinity is not supported on this platform");
+   return false;
+#endif
+
+#if defined(__linux__) || defined(_WIN32)
+   memcpy (&gThreadSettings.affinity, &affinity, sizeof affinity);
+   gThreadSettings.has_affinity = true;
+
+   return true;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_thread_set_nice --
+ *
+ *       Give the driver's threads created from now on the nice @value,
+ *       from -20 to 19, or the creating thread's if @value is 0. Windows
+ *       maps it to a thread priority. Not thread-safe: call it before
+ *       creating clients.
+ *
+ * Returns:
+ *       False if @value is out of range, or per-thread nice values aren't
+ *       supported on this platform.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_thread_set_nice (int value)
+{
+   if (value < -20 || value > 19) {
+      MONGOC_ERROR ("Nice value %d is out of range", value);
+      return false;
+   }
+
+#if !defined(__linux__) && !defined(_WIN32)
+   if (value) {
+      MONGOC_ERROR ("Thread nice values are not supported on this platform");
+      return false;
+   }
+#endif
+
+   gThreadSettings.nice = value;
+
+   return true;
+}
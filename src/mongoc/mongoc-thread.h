@@ -0,0 +1,68 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_THREAD_H
+#define MONGOC_THREAD_H
+
+#if !defined(MONGOC_INSIDE) && !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-macros.h"
+
+BSON_BEGIN_DECLS
+
+
+/* what a thread the driver creates is for */
+typedef enum {
+   MONGOC_THREAD_TOPOLOGY_MONITOR,
+   MONGOC_THREAD_DNS_RESOLVER,
+   MONGOC_THREAD_CONNECTION_ESTABLISHER,
+   MONGOC_THREAD_ASYNC_LOG,
+   MONGOC_THREAD_BULK_WORKER,
+   MONGOC_THREAD_GRIDFS_PREFETCH,
+   MONGOC_THREAD_GRIDFS_WRITE_BEHIND
+} mongoc_thread_kind_t;
+
+
+typedef void *(*mongoc_thread_func_t) (void *arg);
+
+/* start a thread that runs func (arg), and store it in *thread: a pthread_t,
+ * or a HANDLE on Windows, that the driver joins. returns 0 on success */
+typedef int (*mongoc_thread_create_func_t) (mongoc_thread_kind_t kind,
+                                            mongoc_thread_func_t func,
+                                            void *arg,
+                                            void *thread,
+                                            void *user_data);
+
+
+MONGOC_EXPORT (const char *)
+mongoc_thread_kind_name (mongoc_thread_kind_t kind);
+MONGOC_EXPORT (void)
+mongoc_thread_set_create_func (mongoc_thread_create_func_t create_func,
+                               void *user_data);
+MONGOC_EXPORT (bool)
+mongoc_thread_set_cpu_affinity (const uint32_t *cpus, size_t n_cpus);
+MONGOC_EXPORT (bool)
+mongoc_thread_set_nice (int value);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_THREAD_H */
@@ -39,6 +39,12 @@ struct _mongoc_topology_description_t {
    mongoc_topology_description_type_t type;
    int64_t heartbeat_msec;
    mongoc_set_t *servers;
+   /* open addressing with linear probing from a hash of each server's
+    * connection_address to its id, 0 if empty. NULL until the first
+    * lookup, and rebuilt lazily after servers are removed. */
+   uint32_t *host_index;
+   size_t host_index_mask;
+   bool host_index_stale;
    char *set_name;
    int64_t max_set_version;
    bson_oid_t max_election_id;
@@ -47,6 +53,22 @@ struct _mongoc_topology_description_t {
    bool stale;
    unsigned int rand_seed;
 
+   /* localZone, zoneTag, and zonePenaltyMS: a server whose zoneTag tag
+    * isn't local_zone counts as zone_penalty_ms farther away in server
+    * selection. local_zone is NULL if the client has no zone. */
+   char *local_zone;
+   char *zone_tag;
+   int64_t zone_penalty_ms;
+
+   /* unique across all descriptions, changes whenever servers are added,
+    * removed, or updated. copies share it, since their contents match. */
+   int64_t generation;
+
+   /* changes when servers are added or removed, or a server's isMaster reply
+    * changes. a server whose reply is unchanged since the current epoch
+    * skips the SDAM transitions, which would change nothing. */
+   int64_t sdam_epoch;
+
    /* the greatest seen cluster time, for a MongoDB 3.6+ sharded cluster.
     * see Driver Sessions Spec. */
    uint32_t cluster_time_t;
@@ -59,6 +81,15 @@ struct _mongoc_topology_description_t {
 
 typedef enum { MONGOC_SS_READ, MONGOC_SS_WRITE } mongoc_ss_optype_t;
 
+/* slots in a server load table, server ids share slots modulo this */
+#define MONGOC_SERVER_LOAD_SLOTS 64
+
+/* approximate load this process puts on a server, updated without locks */
+typedef struct _mongoc_server_load_t {
+   volatile int32_t in_flight;    /* operations started and not finished */
+   volatile int32_t latency_usec; /* moving average, 0 until measured */
+} mongoc_server_load_t;
+
 void
 mongoc_topology_description_init (mongoc_topology_description_t *description,
                                   int64_t heartbeat_msec);
@@ -85,6 +116,15 @@ mongoc_topology_description_select (mongoc_topology_description_t *description,
                                     const mongoc_read_prefs_t *read_pref,
                                     int64_t local_threshold_ms);
 
+mongoc_server_description_t *
+_mongoc_topology_description_select_r (
+   mongoc_topology_description_t *description,
+   mongoc_ss_optype_t optype,
+   const mongoc_read_prefs_t *read_pref,
+   int64_t local_threshold_ms,
+   const mongoc_server_load_t *load,
+   unsigned int *rand_seed);
+
 mongoc_server_description_t *
 mongoc_topology_description_server_by_id (
    mongoc_topology_description_t *description,
@@ -99,12 +139,25 @@ bool
 mongoc_topology_description_all_sds_have_write_date (
    const mongoc_topology_description_t *td);
 
+int64_t
+_mongoc_topology_description_session_timeout_minutes (
+   const mongoc_topology_description_t *td);
+
+bool
+_mongoc_topology_description_in_local_zone (
+   const mongoc_topology_description_t *topology,
+   const mongoc_server_description_t *sd);
+
 bool
 _mongoc_topology_description_validate_max_staleness (
    const mongoc_topology_description_t *td,
    int64_t max_staleness_seconds,
    bson_error_t *error);
 
+/* stack room for the suitable servers of most deployments, for arrays
+ * initialized with _mongoc_array_init_inline */
+#define MONGOC_SS_INLINE_SERVERS 16
+
 void
 mongoc_topology_description_suitable_servers (
    mongoc_array_t *set, /* OUT */
@@ -124,6 +177,10 @@ mongoc_topology_description_add_server (mongoc_topology_description_t *topology,
                                         const char *server,
                                         uint32_t *id /* OUT */);
 
+void
+_mongoc_topology_description_reconcile (mongoc_topology_description_t *td,
+                                        const mongoc_host_list_t *host_list);
+
 void
 mongoc_topology_description_update_cluster_time (
    mongoc_topology_description_t *td, const bson_t *reply);
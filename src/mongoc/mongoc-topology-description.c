@@ -16,6 +16,7 @@
 
 #include "mongoc-array-private.h"
 #include "mongoc-error.h"
+#include "mongoc-host-list-private.h"
 #include "mongoc-server-description-private.h"
 #include "mongoc-topology-description-apm-private.h"
 #include "mongoc-trace-private.h"
@@ -26,12 +27,45 @@
 #include "mongoc-thread-private.h"
 
 
+/* the most suitable servers a cache entry can hold */
+#define MONGOC_SS_CACHE_MAX_SERVERS 32
+/* entries per thread */
+#define MONGOC_SS_CACHE_SIZE 8
+
+typedef struct _mongoc_ss_cache_entry_t {
+   int64_t td_generation; /* 0 if the entry is unused */
+   int64_t read_prefs_generation;
+   mongoc_ss_optype_t optype;
+   int64_t local_threshold_ms;
+   uint32_t n_ids;
+   uint32_t ids[MONGOC_SS_CACHE_MAX_SERVERS];
+} mongoc_ss_cache_entry_t;
+
+static volatile int64_t gTopologyDescriptionGeneration;
+
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+/* per-thread, so selecting from a shared snapshot needs no locking */
+static MONGOC_THREAD_LOCAL mongoc_ss_cache_entry_t
+   gSSCache[MONGOC_SS_CACHE_SIZE];
+static MONGOC_THREAD_LOCAL uint32_t gSSCacheNext;
+#endif
+
+
 static void
 _mongoc_topology_server_dtor (void *server_, void *ctx_)
 {
    mongoc_server_description_destroy ((mongoc_server_description_t *) server_);
 }
 
+
+/* call after any change that could affect server selection */
+static void
+_mongoc_topology_description_changed (mongoc_topology_description_t *td)
+{
+   td->generation =
+      bson_atomic_int64_add (&gTopologyDescriptionGeneration, 1);
+}
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -70,6 +104,7 @@ mongoc_topology_description_init (mongoc_topology_description_t *description,
    description->cluster_time_t = 0;
    description->cluster_time_i = 0;
    bson_init (&description->cluster_time);
+   _mongoc_topology_description_changed (description);
 
    EXIT;
 }
@@ -120,6 +155,10 @@ _mongoc_topology_description_copy_to (const mongoc_topology_description_t *src,
          dst->servers, id, mongoc_server_description_new_copy (sd));
    }
 
+   dst->host_index = NULL;
+   dst->host_index_mask = 0;
+   dst->host_index_stale = false;
+
    dst->set_name = bson_strdup (src->set_name);
    dst->max_set_version = src->max_set_version;
    memcpy (&dst->compatibility_error,
@@ -127,6 +166,10 @@ _mongoc_topology_description_copy_to (const mongoc_topology_description_t *src,
            sizeof (bson_error_t));
    dst->max_server_id = src->max_server_id;
    dst->stale = src->stale;
+   dst->local_zone = bson_strdup (src->local_zone);
+   dst->zone_tag = bson_strdup (src->zone_tag);
+   dst->zone_penalty_ms = src->zone_penalty_ms;
+   dst->generation = src->generation;
    memcpy (&dst->apm_callbacks,
            &src->apm_callbacks,
            sizeof (mongoc_apm_callbacks_t));
@@ -166,10 +209,14 @@ mongoc_topology_description_destroy (mongoc_topology_description_t *description)
       mongoc_set_destroy (description->servers);
    }
 
+   bson_free (description->host_index);
+
    if (description->set_name) {
       bson_free (description->set_name);
    }
 
+   bson_free (description->local_zone);
+   bson_free (description->zone_tag);
    bson_destroy (&description->cluster_time);
 
    EXIT;
@@ -487,6 +534,53 @@ mongoc_topology_description_all_sds_have_write_date (
    return true;
 }
 
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_topology_description_session_timeout_minutes --
+ *
+ *       The least logicalSessionTimeoutMinutes of the data-bearing
+ *       servers. See the Driver Sessions Spec.
+ *
+ * Returns:
+ *       The timeout, or MONGOC_NO_SESSIONS if a data-bearing server lacks
+ *       it or none is known.
+ *
+ *-------------------------------------------------------------------------
+ */
+int64_t
+_mongoc_topology_description_session_timeout_minutes (
+   const mongoc_topology_description_t *td)
+{
+   int64_t timeout = MONGOC_NO_SESSIONS;
+   mongoc_server_description_t *sd;
+   size_t i;
+
+   for (i = 0; i < td->servers->items_len; i++) {
+      sd = (mongoc_server_description_t *) mongoc_set_get_item (td->servers,
+                                                                (int) i);
+
+      if (sd->type != MONGOC_SERVER_STANDALONE &&
+          sd->type != MONGOC_SERVER_MONGOS &&
+          sd->type != MONGOC_SERVER_RS_PRIMARY &&
+          sd->type != MONGOC_SERVER_RS_SECONDARY) {
+         continue;
+      }
+
+      if (sd->session_timeout_minutes == MONGOC_NO_SESSIONS) {
+         return MONGOC_NO_SESSIONS;
+      }
+
+      if (timeout == MONGOC_NO_SESSIONS ||
+          sd->session_timeout_minutes < timeout) {
+         timeout = sd->session_timeout_minutes;
+      }
+   }
+
+   return timeout;
+}
+
 /*
  *-------------------------------------------------------------------------
  *
@@ -553,13 +647,80 @@ _mongoc_topology_description_validate_max_staleness (
 }
 
 
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_topology_description_in_local_zone --
+ *
+ *       Whether @sd's zone tag names the client's zone. False if the
+ *       client has no zone.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_topology_description_in_local_zone (
+   const mongoc_topology_description_t *topology,
+   const mongoc_server_description_t *sd)
+{
+   const mongoc_compiled_tag_t *tag;
+   size_t zone_len;
+   size_t i;
+
+   if (!topology->local_zone) {
+      return false;
+   }
+
+   zone_len = strlen (topology->local_zone);
+
+   /* the first tag with the key, as bson_iter_find would see it */
+   for (i = 0; i < sd->compiled_tags.n_tags; i++) {
+      tag = &sd->compiled_tags.tags[i];
+      if (!strcmp (tag->key, topology->zone_tag)) {
+         return tag->value_len == zone_len &&
+                !memcmp (tag->value, topology->local_zone, zone_len);
+      }
+   }
+
+   return false;
+}
+
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_topology_description_zone_penalty_ms --
+ *
+ *       How much farther away than its round trip time @sd counts in
+ *       server selection: zonePenaltyMS, unless the client has no zone
+ *       or @sd's zone tag names the client's zone.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+static int64_t
+_mongoc_topology_description_zone_penalty_ms (
+   const mongoc_topology_description_t *topology,
+   const mongoc_server_description_t *sd)
+{
+   if (!topology->local_zone ||
+       _mongoc_topology_description_in_local_zone (topology, sd)) {
+      return 0;
+   }
+
+   return topology->zone_penalty_ms;
+}
+
+
 /*
  *-------------------------------------------------------------------------
  *
  * mongoc_topology_description_suitable_servers --
  *
  *       Fill out an array of servers matching the read preference and
- *       localThresholdMS.
+ *       localThresholdMS. With a local zone, servers in other zones are
+ *       measured with zonePenaltyMS added to their round trip times, so
+ *       they are only suitable once the local zone's servers are as slow.
  *
  *       NOTE: this method should only be called while holding the mutex on
  *       the owning topology object.
@@ -582,6 +743,7 @@ mongoc_topology_description_suitable_servers (
    mongoc_server_description_t **candidates;
    mongoc_server_description_t *server;
    int64_t nearest = -1;
+   int64_t distance;
    int i;
    mongoc_read_mode_t read_mode = mongoc_read_prefs_get_mode (read_pref);
 
@@ -669,6 +831,9 @@ mongoc_topology_description_suitable_servers (
 
          mongoc_server_description_filter_tags (
             data.candidates, data.candidates_len, read_pref);
+
+         mongoc_server_description_filter_caught_up (
+            data.candidates, data.candidates_len, read_pref);
       } else if (topology->type == MONGOC_TOPOLOGY_RS_WITH_PRIMARY) {
          /* includes optype == MONGOC_SS_WRITE as the exclusion of the above if
           */
@@ -694,18 +859,26 @@ mongoc_topology_description_suitable_servers (
     *   - secondary preferred read
     *   - primary_preferred and no primary read
     *   - sharded anything
-    * Find the nearest, then select within the window */
+    * Find the nearest, then select within the window, both counting each
+    * server's zone penalty */
 
    for (i = 0; i < data.candidates_len; i++) {
-      if (candidates[i] &&
-          (nearest == -1 || nearest > candidates[i]->round_trip_time_msec)) {
-         nearest = candidates[i]->round_trip_time_msec;
+      if (candidates[i]) {
+         distance = candidates[i]->round_trip_time_msec +
+                    _mongoc_topology_description_zone_penalty_ms (
+                       topology, candidates[i]);
+         if (nearest == -1 || nearest > distance) {
+            nearest = distance;
+         }
       }
    }
 
    for (i = 0; i < data.candidates_len; i++) {
-      if (candidates[i] && (candidates[i]->round_trip_time_msec <=
-                            nearest + local_threshold_ms)) {
+      if (candidates[i] &&
+          (candidates[i]->round_trip_time_msec +
+              _mongoc_topology_description_zone_penalty_ms (
+                 topology, candidates[i]) <=
+           nearest + (int64_t) local_threshold_ms)) {
          _mongoc_array_append_val (set, candidates[i]);
       }
    }
@@ -746,10 +919,217 @@ mongoc_topology_description_select (mongoc_topology_description_t *topology,
                                     mongoc_ss_optype_t optype,
                                     const mongoc_read_prefs_t *read_pref,
                                     int64_t local_threshold_ms)
+{
+   return _mongoc_topology_description_select_r (
+      topology,
+      optype,
+      read_pref,
+      local_threshold_ms,
+      NULL /* load */,
+      &topology->rand_seed);
+}
+
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_ss_cache_find --
+ *
+ *      Find this thread's cached list of suitable servers for @topology's
+ *      current contents and the given selection criteria.
+ *
+ * Returns:
+ *      A cache entry, or NULL.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+static mongoc_ss_cache_entry_t *
+_mongoc_ss_cache_find (const mongoc_topology_description_t *topology,
+                       mongoc_ss_optype_t optype,
+                       const mongoc_read_prefs_t *read_pref,
+                       int64_t local_threshold_ms)
+{
+   int64_t read_prefs_generation = read_pref ? read_pref->generation : 0;
+   mongoc_ss_cache_entry_t *entry;
+   int i;
+
+   for (i = 0; i < MONGOC_SS_CACHE_SIZE; i++) {
+      entry = &gSSCache[i];
+      if (entry->td_generation == topology->generation &&
+          entry->read_prefs_generation == read_prefs_generation &&
+          entry->optype == optype &&
+          entry->local_threshold_ms == local_threshold_ms) {
+         return entry;
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_ss_cache_add --
+ *
+ *      Remember the ids of the servers in @suitable_servers, replacing this
+ *      thread's oldest cache entry. Does nothing if there are too many.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_ss_cache_add (const mongoc_topology_description_t *topology,
+                      mongoc_ss_optype_t optype,
+                      const mongoc_read_prefs_t *read_pref,
+                      int64_t local_threshold_ms,
+                      const mongoc_array_t *suitable_servers)
+{
+   mongoc_ss_cache_entry_t *entry;
+   uint32_t i;
+
+   if (suitable_servers->len > MONGOC_SS_CACHE_MAX_SERVERS) {
+      return;
+   }
+
+   entry = &gSSCache[gSSCacheNext++ % MONGOC_SS_CACHE_SIZE];
+   entry->td_generation = topology->generation;
+   entry->read_prefs_generation = read_pref ? read_pref->generation : 0;
+   entry->optype = optype;
+   entry->local_threshold_ms = local_threshold_ms;
+   entry->n_ids = (uint32_t) suitable_servers->len;
+   for (i = 0; i < entry->n_ids; i++) {
+      entry->ids[i] = _mongoc_array_index (
+                         suitable_servers, mongoc_server_description_t *, i)
+                         ->id;
+   }
+}
+#endif
+
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_server_load_cost --
+ *
+ *      Estimate how long a new operation on @sd would take: its average
+ *      operation latency times one more than the operations it is
+ *      already running for this process. Until an operation completes,
+ *      the heartbeat round trip time stands in for the latency. A server
+ *      outside the client's zone also costs its zone penalty, so load
+ *      spills over to other zones only once the local servers are busy.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+static int64_t
+_mongoc_server_load_cost (const mongoc_topology_description_t *topology,
+                          const mongoc_server_load_t *load,
+                          const mongoc_server_description_t *sd)
+{
+   const mongoc_server_load_t *slot;
+   int64_t latency_usec;
+   int32_t in_flight;
+
+   slot = &load[sd->id % MONGOC_SERVER_LOAD_SLOTS];
+   latency_usec = slot->latency_usec;
+   in_flight = slot->in_flight;
+
+   if (latency_usec <= 0) {
+      latency_usec = BSON_MAX (sd->round_trip_time_msec, 1) * 1000;
+   }
+
+   return (BSON_MAX (in_flight, 0) + 1) * latency_usec +
+          _mongoc_topology_description_zone_penalty_ms (topology, sd) * 1000;
+}
+
+
+/* the less loaded of @a and @b, or @a if @load is NULL */
+static mongoc_server_description_t *
+_mongoc_server_load_better (const mongoc_topology_description_t *topology,
+                            const mongoc_server_load_t *load,
+                            mongoc_server_description_t *a,
+                            mongoc_server_description_t *b)
+{
+   if (!load || a == b) {
+      return a;
+   }
+
+   return _mongoc_server_load_cost (topology, load, b) <
+                _mongoc_server_load_cost (topology, load, a)
+             ? b
+             : a;
+}
+
+
+/* choose index @i at random out of @n, and for the power of two choices a
+ * distinct index @j if @load is set and there is more than one server */
+static void
+_mongoc_ss_pick (uint32_t n,
+                 const mongoc_server_load_t *load,
+                 unsigned int *rand_seed,
+                 uint32_t *i,
+                 uint32_t *j)
+{
+   BSON_ASSERT (n > 0);
+
+   *i = (uint32_t) _mongoc_rand_simple (rand_seed) % n;
+   *j = *i;
+
+   if (load && n > 1) {
+      *j = (uint32_t) _mongoc_rand_simple (rand_seed) % (n - 1);
+      if (*j >= *i) {
+         (*j)++;
+      }
+   }
+}
+
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_topology_description_select_r --
+ *
+ *      Like mongoc_topology_description_select, but uses @rand_seed
+ *      instead of @topology's seed, so it doesn't write to @topology.
+ *      Several threads may select from a shared, immutable topology
+ *      description at once, each passing its own seed.
+ *
+ *      The suitable servers are cached per thread, keyed by @topology's
+ *      generation and @read_pref's, so repeated selections with an
+ *      unchanged topology skip filtering and just pick a random server.
+ *
+ *      If @load is not NULL, it is a table of MONGOC_SERVER_LOAD_SLOTS
+ *      entries. Instead of one random server, pick two and select the
+ *      one this process is loading less, see _mongoc_server_load_cost.
+ *
+ * Returns:
+ *      Selected server description, or NULL upon failure.
+ *
+ * Side effects:
+ *      Updates @rand_seed.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+mongoc_server_description_t *
+_mongoc_topology_description_select_r (mongoc_topology_description_t *topology,
+                                       mongoc_ss_optype_t optype,
+                                       const mongoc_read_prefs_t *read_pref,
+                                       int64_t local_threshold_ms,
+                                       const mongoc_server_load_t *load,
+                                       unsigned int *rand_seed)
 {
    mongoc_array_t suitable_servers;
+   mongoc_server_description_t *suitable_buf[MONGOC_SS_INLINE_SERVERS];
    mongoc_server_description_t *sd = NULL;
-   int rand_n;
+   mongoc_server_description_t *other;
+   uint32_t i;
+   uint32_t j;
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+   mongoc_ss_cache_entry_t *entry;
+#endif
 
    ENTRY;
 
@@ -765,16 +1145,48 @@ mongoc_topology_description_select (mongoc_topology_description_t *topology,
       }
    }
 
-   _mongoc_array_init (&suitable_servers,
-                       sizeof (mongoc_server_description_t *));
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+   entry = _mongoc_ss_cache_find (
+      topology, optype, read_pref, local_threshold_ms);
+   if (entry) {
+      if (entry->n_ids == 0) {
+         TRACE ("%s", "No suitable servers (cached)");
+         RETURN (NULL);
+      }
+
+      _mongoc_ss_pick (entry->n_ids, load, rand_seed, &i, &j);
+      sd = (mongoc_server_description_t *) mongoc_set_get (topology->servers,
+                                                           entry->ids[i]);
+      other = (mongoc_server_description_t *) mongoc_set_get (
+         topology->servers, entry->ids[j]);
+      if (sd && other) {
+         RETURN (_mongoc_server_load_better (topology, load, sd, other));
+      }
+
+      /* unreachable while generations are maintained; recompute */
+      entry->td_generation = 0;
+   }
+#endif
+
+   _mongoc_array_init_inline (&suitable_servers,
+                              sizeof (mongoc_server_description_t *),
+                              suitable_buf,
+                              sizeof suitable_buf);
 
    mongoc_topology_description_suitable_servers (
       &suitable_servers, optype, topology, read_pref, local_threshold_ms);
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+   _mongoc_ss_cache_add (
+      topology, optype, read_pref, local_threshold_ms, &suitable_servers);
+#endif
    if (suitable_servers.len != 0) {
-      rand_n = _mongoc_rand_simple (&topology->rand_seed);
-      sd = _mongoc_array_index (&suitable_servers,
-                                mongoc_server_description_t *,
-                                rand_n % suitable_servers.len);
+      _mongoc_ss_pick (
+         (uint32_t) suitable_servers.len, load, rand_seed, &i, &j);
+      sd = _mongoc_array_index (
+         &suitable_servers, mongoc_server_description_t *, i);
+      other = _mongoc_array_index (
+         &suitable_servers, mongoc_server_description_t *, j);
+      sd = _mongoc_server_load_better (topology, load, sd, other);
    }
 
    _mongoc_array_destroy (&suitable_servers);
@@ -858,28 +1270,128 @@ _mongoc_topology_description_remove_server (
 
    _mongoc_topology_description_monitor_server_closed (description, server);
    mongoc_set_rm (description->servers, server->id);
+   description->host_index_stale = true;
+   description->sdam_epoch++;
+   _mongoc_topology_description_changed (description);
 }
 
-typedef struct _mongoc_address_and_id_t {
-   const char *address; /* IN */
-   bool found;          /* OUT */
-   uint32_t id;         /* OUT */
-} mongoc_address_and_id_t;
 
-/* find the given server and stop iterating */
-static bool
-_mongoc_topology_description_has_server_cb (void *item,
-                                            void *ctx /* IN - OUT */)
+static int
+_mongoc_topology_description_id_cmp (const void *a_, const void *b_)
 {
-   mongoc_server_description_t *server = (mongoc_server_description_t *) item;
-   mongoc_address_and_id_t *data = (mongoc_address_and_id_t *) ctx;
+   uint32_t a = *(const uint32_t *) a_;
+   uint32_t b = *(const uint32_t *) b_;
 
-   if (strcasecmp (data->address, server->connection_address) == 0) {
-      data->found = true;
-      data->id = server->id;
-      return false;
+   if (a == b) {
+      return 0;
+   }
+
+   return a < b ? -1 : 1;
+}
+
+
+/* remove the servers whose ids aren't in @keep, an array of uint32_t that
+ * this sorts. servers are sorted by id too, so this is one walk over both
+ * instead of a search of @keep per server. */
+static void
+_mongoc_topology_description_remove_servers_except (
+   mongoc_topology_description_t *td, mongoc_array_t *keep)
+{
+   mongoc_array_t to_remove;
+   mongoc_server_description_t *server;
+   const uint32_t *ids;
+   uint32_t id;
+   size_t i;
+   size_t j = 0;
+
+   ids = (const uint32_t *) keep->data;
+   qsort (keep->data,
+          keep->len,
+          sizeof (uint32_t),
+          _mongoc_topology_description_id_cmp);
+
+   _mongoc_array_init (&to_remove, sizeof (mongoc_server_description_t *));
+
+   /* accumulate first: removing a server may destroy one the caller holds,
+    * such as a primary that doesn't report its own address */
+   for (i = 0; i < td->servers->items_len; i++) {
+      server = mongoc_set_get_item_and_id (td->servers, (int) i, &id);
+      while (j < keep->len && ids[j] < id) {
+         j++;
+      }
+
+      if (j == keep->len || ids[j] != id) {
+         _mongoc_array_append_val (&to_remove, server);
+      }
+   }
+
+   for (i = 0; i < to_remove.len; i++) {
+      server =
+         _mongoc_array_index (&to_remove, mongoc_server_description_t *, i);
+      _mongoc_topology_description_remove_server (td, server);
+   }
+
+   _mongoc_array_destroy (&to_remove);
+}
+
+static void
+_mongoc_topology_description_host_index_insert (
+   mongoc_topology_description_t *td, mongoc_server_description_t *server)
+{
+   size_t slot;
+
+   slot = _mongoc_host_list_hash_address (server->connection_address) &
+          td->host_index_mask;
+   while (td->host_index[slot]) {
+      slot = (slot + 1) & td->host_index_mask;
+   }
+
+   td->host_index[slot] = server->id;
+}
+
+/* recreate the index, keeping it at most half full */
+static void
+_mongoc_topology_description_host_index_rebuild (
+   mongoc_topology_description_t *td)
+{
+   size_t n_slots;
+   size_t i;
+
+   n_slots = bson_next_power_of_two (td->servers->items_len * 2);
+   if (n_slots < 16) {
+      n_slots = 16;
+   }
+
+   if (!td->host_index || td->host_index_mask + 1 != n_slots) {
+      bson_free (td->host_index);
+      td->host_index = (uint32_t *) bson_malloc (sizeof (uint32_t) * n_slots);
+      td->host_index_mask = n_slots - 1;
+   }
+
+   memset (td->host_index, 0, sizeof (uint32_t) * n_slots);
+   for (i = 0; i < td->servers->items_len; i++) {
+      _mongoc_topology_description_host_index_insert (
+         td, mongoc_set_get_item (td->servers, (int) i));
+   }
+
+   td->host_index_stale = false;
+}
+
+/* call after adding @server to td->servers */
+static void
+_mongoc_topology_description_host_index_add (
+   mongoc_topology_description_t *td, mongoc_server_description_t *server)
+{
+   if (!td->host_index || td->host_index_stale) {
+      /* built on the next lookup */
+      return;
+   }
+
+   if (td->servers->items_len * 2 > td->host_index_mask + 1) {
+      td->host_index_stale = true;
+   } else {
+      _mongoc_topology_description_host_index_insert (td, server);
    }
-   return true;
 }
 
 /*
@@ -925,21 +1437,34 @@ _mongoc_topology_description_has_server (
    const char *address,
    uint32_t *id /* OUT */)
 {
-   mongoc_address_and_id_t data;
+   mongoc_server_description_t *server;
+   size_t slot;
+   uint32_t server_id;
 
    BSON_ASSERT (description);
    BSON_ASSERT (address);
 
-   data.address = address;
-   data.found = false;
-   mongoc_set_for_each (
-      description->servers, _mongoc_topology_description_has_server_cb, &data);
+   if (!description->host_index || description->host_index_stale) {
+      _mongoc_topology_description_host_index_rebuild (description);
+   }
+
+   slot = _mongoc_host_list_hash_address (address) &
+          description->host_index_mask;
+   while ((server_id = description->host_index[slot])) {
+      server = (mongoc_server_description_t *) mongoc_set_get (
+         description->servers, server_id);
+      if (server && strcasecmp (address, server->connection_address) == 0) {
+         if (id) {
+            *id = server_id;
+         }
 
-   if (data.found && id) {
-      *id = data.id;
+         return true;
+      }
+
+      slot = (slot + 1) & description->host_index_mask;
    }
 
-   return data.found;
+   return false;
 }
 
 typedef struct _mongoc_address_and_type_t {
@@ -1123,8 +1648,13 @@ mongoc_topology_description_add_server (mongoc_topology_description_t *topology,
       description =
          (mongoc_server_description_t *) bson_malloc0 (sizeof *description);
       mongoc_server_description_init (description, server, server_id);
+      _mongoc_server_counters_claim (&description->counters,
+                                     description->host.host_and_port);
 
       mongoc_set_add (topology->servers, server_id, description);
+      _mongoc_topology_description_host_index_add (topology, description);
+      topology->sdam_epoch++;
+      _mongoc_topology_description_changed (topology);
 
       /* if we're in topology_new then no callbacks are registered and this is
        * a no-op. later, if we discover a new RS member this sends an event. */
@@ -1140,6 +1670,40 @@ mongoc_topology_description_add_server (mongoc_topology_description_t *topology,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_description_reconcile --
+ *
+ *       Make @td's servers match @host_list: add hosts that aren't servers
+ *       yet and remove servers that aren't in @host_list. Used when polling
+ *       the SRV records of a mongodb+srv URI.
+ *
+ *       NOTE: this method should only be called while holding the mutex on
+ *       the owning topology object.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_topology_description_reconcile (mongoc_topology_description_t *td,
+                                        const mongoc_host_list_t *host_list)
+{
+   const mongoc_host_list_t *host;
+   mongoc_array_t keep;
+   uint32_t id;
+
+   _mongoc_array_init (&keep, sizeof (uint32_t));
+
+   for (host = host_list; host; host = host->next) {
+      mongoc_topology_description_add_server (td, host->host_and_port, &id);
+      _mongoc_array_append_val (&keep, id);
+   }
+
+   _mongoc_topology_description_remove_servers_except (td, &keep);
+   _mongoc_array_destroy (&keep);
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1260,37 +1824,38 @@ _mongoc_topology_description_remove_unreported_servers (
    mongoc_topology_description_t *topology,
    mongoc_server_description_t *primary)
 {
-   mongoc_array_t to_remove;
+   mongoc_array_t keep;
+   bson_iter_t member_iter;
+   const bson_t *rs_members[3];
+   uint32_t id;
    int i;
-   mongoc_server_description_t *member;
-   const char *address;
-
-   _mongoc_array_init (&to_remove, sizeof (mongoc_server_description_t *));
 
-   /* Accumulate servers to be removed - do this before calling
-    * _mongoc_topology_description_remove_server, which could call
-    * mongoc_server_description_cleanup on the primary itself if it
-    * doesn't report its own connection_address in its hosts list.
-    * See hosts_differ_from_seeds.json */
-   for (i = 0; i < topology->servers->items_len; i++) {
-      member = (mongoc_server_description_t *) mongoc_set_get_item (
-         topology->servers, i);
-      address = member->connection_address;
-      if (!mongoc_server_description_has_rs_member (primary, address)) {
-         _mongoc_array_append_val (&to_remove, member);
+   _mongoc_array_init (&keep, sizeof (uint32_t));
+
+   /* look up each reported member instead of searching the primary's
+    * lists for each server. the primary itself may be removed, if it
+    * doesn't report its own connection_address in its hosts list. See
+    * hosts_differ_from_seeds.json */
+   if (primary->type != MONGOC_SERVER_UNKNOWN) {
+      rs_members[0] = &primary->hosts;
+      rs_members[1] = &primary->arbiters;
+      rs_members[2] = &primary->passives;
+
+      for (i = 0; i < 3; i++) {
+         bson_iter_init (&member_iter, rs_members[i]);
+
+         while (bson_iter_next (&member_iter)) {
+            if (BSON_ITER_HOLDS_UTF8 (&member_iter) &&
+                _mongoc_topology_description_has_server (
+                   topology, bson_iter_utf8 (&member_iter, NULL), &id)) {
+               _mongoc_array_append_val (&keep, id);
+            }
+         }
       }
    }
 
-   /* now it's safe to call _mongoc_topology_description_remove_server,
-    * even on the primary */
-   for (i = 0; i < to_remove.len; i++) {
-      member =
-         _mongoc_array_index (&to_remove, mongoc_server_description_t *, i);
-
-      _mongoc_topology_description_remove_server (topology, member);
-   }
-
-   _mongoc_array_destroy (&to_remove);
+   _mongoc_topology_description_remove_servers_except (topology, &keep);
+   _mongoc_array_destroy (&keep);
 }
 
 
@@ -1816,6 +2381,51 @@ _mongoc_topology_description_check_compatible (
    }
 }
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_description_equal --
+ *
+ *       Whether two descriptions of a topology match in the fields the
+ *       SDAM Monitoring Spec compares, including each server's, see
+ *       _mongoc_server_description_equal.
+ *
+ *--------------------------------------------------------------------------
+ */
+static bool
+_mongoc_topology_description_equal (const mongoc_topology_description_t *td1,
+                                    const mongoc_topology_description_t *td2)
+{
+   mongoc_server_description_t *sd1;
+   mongoc_server_description_t *sd2;
+   uint32_t id1;
+   uint32_t id2;
+   size_t i;
+
+   if (td1->type != td2->type || td1->max_set_version != td2->max_set_version ||
+       !bson_oid_equal (&td1->max_election_id, &td2->max_election_id) ||
+       td1->compatibility_error.code != td2->compatibility_error.code ||
+       td1->servers->items_len != td2->servers->items_len) {
+      return false;
+   }
+
+   if (td1->set_name && td2->set_name ? strcmp (td1->set_name, td2->set_name)
+                                      : td1->set_name != td2->set_name) {
+      return false;
+   }
+
+   /* both sets are sorted by id */
+   for (i = 0; i < td1->servers->items_len; i++) {
+      sd1 = mongoc_set_get_item_and_id (td1->servers, (int) i, &id1);
+      sd2 = mongoc_set_get_item_and_id (td2->servers, (int) i, &id2);
+      if (id1 != id2 || !_mongoc_server_description_equal (sd1, sd2)) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1842,6 +2452,7 @@ mongoc_topology_description_handle_ismaster (
    mongoc_topology_description_t *prev_td = NULL;
    mongoc_server_description_t *prev_sd = NULL;
    mongoc_server_description_t *sd;
+   bool unchanged;
 
    BSON_ASSERT (topology);
    BSON_ASSERT (server_id != 0);
@@ -1851,6 +2462,22 @@ mongoc_topology_description_handle_ismaster (
       return; /* server already removed from topology */
    }
 
+   unchanged = (!error || !error->code) &&
+               _mongoc_server_description_ismaster_unchanged (
+                  sd, ismaster_response);
+
+   /* the usual heartbeat: same reply, and nothing else changed since this
+    * server's last full update. neither the server nor the topology changes
+    * in ways SDAM monitoring reports, so there are no events either. */
+   if (unchanged && sd->sdam_epoch == topology->sdam_epoch) {
+      _mongoc_server_description_update_unchanged (
+         sd, ismaster_response, rtt_msec);
+      _mongoc_topology_description_changed (topology);
+      mongoc_topology_description_update_cluster_time (topology,
+                                                       ismaster_response);
+      return;
+   }
+
    if (topology->apm_callbacks.topology_changed) {
       prev_td = bson_malloc0 (sizeof (mongoc_topology_description_t));
       _mongoc_topology_description_copy_to (topology, prev_td);
@@ -1863,10 +2490,15 @@ mongoc_topology_description_handle_ismaster (
    /* pass the current error in */
    mongoc_server_description_handle_ismaster (
       sd, ismaster_response, rtt_msec, error);
+   /* before SDAM callbacks can observe the change */
+   _mongoc_topology_description_changed (topology);
 
    mongoc_topology_description_update_cluster_time (topology,
                                                     ismaster_response);
-   _mongoc_topology_description_monitor_server_changed (topology, prev_sd, sd);
+   if (prev_sd && !_mongoc_server_description_equal (prev_sd, sd)) {
+      _mongoc_topology_description_monitor_server_changed (
+         topology, prev_sd, sd);
+   }
 
    if (gSDAMTransitionTable[sd->type][topology->type]) {
       TRACE ("Transitioning to %s for %s",
@@ -1883,7 +2515,24 @@ mongoc_topology_description_handle_ismaster (
    if (ismaster_response && (!error || !error->code)) {
       _mongoc_topology_description_check_compatible (topology);
    }
-   _mongoc_topology_description_monitor_changed (prev_td, topology);
+
+   /* a new reply may change how the others' replies apply. an unchanged
+    * reply was only checked against the current epoch. */
+   if (!unchanged) {
+      topology->sdam_epoch++;
+   }
+
+   /* the transition may have removed the server */
+   sd = mongoc_topology_description_server_by_id (topology, server_id, NULL);
+   if (sd) {
+      sd->sdam_epoch = topology->sdam_epoch;
+   }
+
+   /* again, in case a callback cached a selection from a partial update */
+   _mongoc_topology_description_changed (topology);
+   if (prev_td && !_mongoc_topology_description_equal (prev_td, topology)) {
+      _mongoc_topology_description_monitor_changed (prev_td, topology);
+   }
 
    if (prev_td) {
       mongoc_topology_description_destroy (prev_td);
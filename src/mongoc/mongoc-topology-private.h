@@ -17,6 +17,8 @@
 #ifndef MONGOC_TOPOLOGY_PRIVATE_H
 #define MONGOC_TOPOLOGY_PRIVATE_H
 
+#include "mongoc-array-private.h"
+#include "mongoc-client-session-private.h"
 #include "mongoc-topology-scanner-private.h"
 #include "mongoc-server-description-private.h"
 #include "mongoc-topology-description-private.h"
@@ -30,6 +32,11 @@
 #define MONGOC_TOPOLOGY_SERVER_SELECTION_TIMEOUT_MS 30000
 #define MONGOC_TOPOLOGY_HEARTBEAT_FREQUENCY_MS_MULTI_THREADED 10000
 #define MONGOC_TOPOLOGY_HEARTBEAT_FREQUENCY_MS_SINGLE_THREADED 60000
+#define MONGOC_TOPOLOGY_SRV_RESCAN_INTERVAL_MS 60000
+#define MONGOC_TOPOLOGY_ZONE_TAG "zone"
+#define MONGOC_TOPOLOGY_ZONE_PENALTY_MS 50
+#define MONGOC_TOPOLOGY_CIRCUIT_BREAKER_OPEN_MS 1000
+#define MONGOC_TOPOLOGY_UNSTABLE_MS 5000
 
 typedef enum {
    MONGOC_TOPOLOGY_SCANNER_OFF,
@@ -38,11 +45,49 @@ typedef enum {
    MONGOC_TOPOLOGY_SCANNER_SINGLE_THREADED,
 } mongoc_topology_scanner_state_t;
 
+/* called by the background thread after each scan, with the mutex held.
+ * mongoc_cluster_node_t pointers appended to @reaped are destroyed after
+ * the mutex is released */
+typedef void (*mongoc_topology_maintenance_cb_t) (void *ctx,
+                                                  mongoc_array_t *reaped);
+
+typedef struct _mongoc_topology_maintenance_t {
+   mongoc_topology_maintenance_cb_t cb;
+   void *ctx;
+} mongoc_topology_maintenance_t;
+
+/* threads blocked in server selection that need the same kind of server:
+ * the same operation type and read preference. each update wakes only the
+ * groups whose selection now succeeds, see _mongoc_topology_wake_selectors.
+ * guarded by the topology mutex */
+typedef struct _mongoc_topology_selector_t {
+   mongoc_ss_optype_t optype;
+   mongoc_read_prefs_t *read_prefs; /* a copy, NULL for writes or primary */
+   mongoc_cond_t cond;
+   int32_t n_waiters;
+   struct _mongoc_topology_selector_t *prev, *next;
+} mongoc_topology_selector_t;
+
+/* an immutable, reference-counted copy of the topology description */
+typedef struct _mongoc_topology_snapshot_t {
+   volatile int32_t ref_count;
+   mongoc_topology_description_t description;
+} mongoc_topology_snapshot_t;
+
+/* a server's circuit breaker. open_until_usec is guarded by the mutex. */
+typedef struct _mongoc_server_breaker_t {
+   volatile int32_t failures; /* network errors since the last reply */
+   int64_t open_until_usec;   /* 0 unless open or awaiting its probe */
+} mongoc_server_breaker_t;
+
 typedef struct _mongoc_topology_t {
    mongoc_topology_description_t description;
    mongoc_uri_t *uri;
    mongoc_topology_scanner_t *scanner;
    bool server_selection_try_once;
+   /* single-threaded serverSelectionEager: a blocking scan ends once a
+    * suitable server replied, other checks finish in later operations */
+   bool server_selection_eager;
 
    int64_t last_scan;
    int64_t local_threshold_msec;
@@ -52,13 +97,91 @@ typedef struct _mongoc_topology_t {
    mongoc_mutex_t mutex;
    mongoc_cond_t cond_client;
    mongoc_cond_t cond_server;
+   mongoc_topology_selector_t *selectors;
    mongoc_thread_t thread;
 
+   /* pooled: the latest published description, for lock-free selection.
+    * snapshot_mutex is a leaf lock that only guards the pointer swap, and
+    * the latest $clusterTime, which changes too often to publish a new
+    * snapshot for */
+   mongoc_mutex_t snapshot_mutex;
+   mongoc_topology_snapshot_t *snapshot;
+   uint32_t cluster_time_t;
+   uint32_t cluster_time_i;
+   bson_t cluster_time;
+   /* the description's $clusterTime as (timestamp << 32 | increment), read
+    * without the mutex to skip replies that don't advance it. it may lag
+    * the description, never lead it */
+   volatile int64_t cluster_time_seen;
+
+   /* pooled: the background thread scans every
+    * MONGOC_TOPOLOGY_MIN_HEARTBEAT_FREQUENCY_MS instead of heartbeat_msec
+    * while a replica set has no primary, or until unstable_until after a
+    * known server changed type, so failovers are discovered quickly */
+   int64_t unstable_until;
+
    mongoc_topology_scanner_state_t scanner_state;
    bool scan_requested;
    bool shutdown_requested;
    bool single_threaded;
    bool stale;
+
+   /* heartbeatPiggyback: application connections check servers whose
+    * description is older than heartbeat_msec, claiming the check in
+    * piggyback_claimed, and the background thread closes its idle
+    * connections to servers they keep up to date */
+   bool heartbeat_piggyback;
+   int64_t piggyback_claimed[MONGOC_SERVER_LOAD_SLOTS];
+
+   /* mongoc_topology_maintenance_t, one per client pool using the
+    * topology */
+   mongoc_array_t maintenance;
+
+   /* serverSelectionLoadAware: operations update the load table, and
+    * selection prefers the less loaded of two random suitable servers */
+   bool load_aware;
+   mongoc_server_load_t load[MONGOC_SERVER_LOAD_SLOTS];
+
+   /* circuitBreakerThreshold: after this many network errors in a row in
+    * operations on a server, it is marked Unknown and its isMaster replies
+    * are ignored for circuitBreakerOpenMS, then it's probed again. 0 if
+    * disabled. servers share slots like in the load table. */
+   int32_t breaker_threshold;
+   int64_t breaker_open_msec;
+   mongoc_server_breaker_t breakers[MONGOC_SERVER_LOAD_SLOTS];
+
+   /* maxInFlightPerServer: at most this many server streams checked out
+    * per server, 0 if unlimited. with inFlightFailFast checkout fails at
+    * once, otherwise it waits on cond_in_flight for up to
+    * serverSelectionTimeoutMS. servers share slots like in the load table. */
+   int32_t max_in_flight;
+   bool in_flight_fail_fast;
+   volatile int32_t in_flight[MONGOC_SERVER_LOAD_SLOTS];
+   volatile int32_t in_flight_waiters;
+   mongoc_cond_t cond_in_flight;
+
+   /* mongodb+srv: the SRV record name, like "_mongodb._tcp.example.com".
+    * a pooled topology resolves it on the background thread, and polls it
+    * every srv_rescan_msec while the topology is Unknown or Sharded. */
+   char *srv_service;
+   bool srv_pending; /* the first lookup hasn't finished */
+   bson_error_t srv_error;
+   int64_t srv_rescan_msec;
+
+   /* server sessions to reuse, most recently used first. guarded by mutex,
+    * and shared by a client pool's clients like the rest of the topology */
+   mongoc_server_session_t *session_pool;
+
+   /* shareTopology: the key of a topology in the process's registry, the
+    * number of client pools that use it, and the process that last reset it
+    * after a fork, all guarded by the registry's mutex. a registered
+    * topology monitors with the TLS options in its URI, not a pool's */
+   char *registry_key;
+   int32_t registry_refs;
+   int registry_pid;
+#ifdef MONGOC_ENABLE_SSL
+   mongoc_ssl_opt_t registry_ssl_opts;
+#endif
 } mongoc_topology_t;
 
 mongoc_topology_t *
@@ -89,6 +212,26 @@ mongoc_topology_select_server_id (mongoc_topology_t *topology,
                                   const mongoc_read_prefs_t *read_prefs,
                                   bson_error_t *error);
 
+uint32_t
+_mongoc_topology_select_server_id_until (mongoc_topology_t *topology,
+                                         mongoc_ss_optype_t optype,
+                                         const mongoc_read_prefs_t *read_prefs,
+                                         int64_t deadline,
+                                         bson_error_t *error);
+
+bool
+_mongoc_topology_try_select_server_id (mongoc_topology_t *topology,
+                                       mongoc_ss_optype_t optype,
+                                       const mongoc_read_prefs_t *read_prefs,
+                                       int64_t expire_at,
+                                       uint32_t *server_id,
+                                       bson_error_t *error);
+
+uint32_t
+_mongoc_topology_select_hedge_server_id (mongoc_topology_t *topology,
+                                         const mongoc_read_prefs_t *read_prefs,
+                                         uint32_t exclude_id);
+
 mongoc_server_description_t *
 mongoc_topology_server_by_id (mongoc_topology_t *topology,
                               uint32_t id,
@@ -99,6 +242,11 @@ _mongoc_topology_host_by_id (mongoc_topology_t *topology,
                              uint32_t id,
                              bson_error_t *error);
 
+void
+_mongoc_topology_server_counters (mongoc_topology_t *topology,
+                                  uint32_t id,
+                                  mongoc_server_counters_ref_t *ref);
+
 void
 mongoc_topology_invalidate_server (mongoc_topology_t *topology,
                                    uint32_t id,
@@ -108,6 +256,13 @@ bool
 _mongoc_topology_update_from_handshake (mongoc_topology_t *topology,
                                         const mongoc_server_description_t *sd);
 
+void
+_mongoc_topology_scanner_cb (uint32_t id,
+                             const bson_t *ismaster_response,
+                             int64_t rtt_msec,
+                             void *data,
+                             const bson_error_t *error);
+
 int64_t
 mongoc_topology_server_timestamp (mongoc_topology_t *topology, uint32_t id);
 
@@ -117,10 +272,91 @@ _mongoc_topology_get_type (mongoc_topology_t *topology);
 bool
 _mongoc_topology_start_background_scanner (mongoc_topology_t *topology);
 
+void
+_mongoc_topology_load_begin (mongoc_topology_t *topology, uint32_t server_id);
+
+void
+_mongoc_topology_load_end (mongoc_topology_t *topology,
+                           uint32_t server_id,
+                           int64_t started);
+
+void
+_mongoc_topology_breaker_success (mongoc_topology_t *topology,
+                                  uint32_t server_id);
+
+void
+_mongoc_topology_breaker_failure (mongoc_topology_t *topology,
+                                  uint32_t server_id,
+                                  const bson_error_t *why);
+
+bool
+_mongoc_topology_in_flight_admit (mongoc_topology_t *topology,
+                                  uint32_t server_id,
+                                  bson_error_t *error);
+
+void
+_mongoc_topology_in_flight_release (mongoc_topology_t *topology,
+                                    uint32_t server_id);
+
 bool
 _mongoc_topology_set_appname (mongoc_topology_t *topology, const char *appname);
 
+void
+_mongoc_topology_set_maintenance_cb (mongoc_topology_t *topology,
+                                     mongoc_topology_maintenance_cb_t cb,
+                                     void *ctx);
+
+void
+_mongoc_topology_reset_after_fork (mongoc_topology_t *topology);
+
+void
+_mongoc_topology_registry_init (void);
+
+void
+_mongoc_topology_registry_cleanup (void);
+
+mongoc_topology_t *
+_mongoc_topology_registry_acquire (const mongoc_uri_t *uri);
+
+void
+_mongoc_topology_registry_release (mongoc_topology_t *topology);
+
+bool
+_mongoc_topology_registry_is_shared (mongoc_topology_t *topology);
+
+void
+_mongoc_topology_registry_reset_after_fork (mongoc_topology_t *topology);
+
 void
 _mongoc_topology_update_cluster_time (mongoc_topology_t *topology,
                                       const bson_t *reply);
+
+void
+_mongoc_topology_publish_snapshot (mongoc_topology_t *topology);
+
+mongoc_topology_snapshot_t *
+_mongoc_topology_get_snapshot (mongoc_topology_t *topology);
+
+void
+_mongoc_topology_finish_server_check (mongoc_topology_t *topology,
+                                      uint32_t server_id);
+
+bool
+_mongoc_topology_piggyback_due (mongoc_topology_t *topology,
+                                uint32_t server_id);
+
+void
+_mongoc_topology_snapshot_release (mongoc_topology_snapshot_t *snapshot);
+
+void
+_mongoc_topology_get_cluster_time (mongoc_topology_t *topology,
+                                   bson_t *cluster_time);
+
+mongoc_server_session_t *
+_mongoc_topology_pop_server_session (mongoc_topology_t *topology,
+                                     bson_error_t *error);
+
+void
+_mongoc_topology_push_server_session (mongoc_topology_t *topology,
+                                      mongoc_server_session_t *server_session);
 #endif
@@ -0,0 +1,363 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "mongoc-array-private.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-topology-private.h"
+#include "mongoc-trace-private.h"
+#include "mongoc-uri-private.h"
+#include "mongoc-util-private.h"
+
+#ifdef MONGOC_ENABLE_SSL
+#include "mongoc-ssl-private.h"
+#endif
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "topology"
+
+
+/* the process's shared topologies, guarded by gTopologyRegistryMutex */
+static mongoc_mutex_t gTopologyRegistryMutex;
+static mongoc_array_t gTopologyRegistry;
+
+
+/* options that configure client pools and their clients, not how the
+ * topology is monitored: pools that differ only in these share one */
+static const char *gPoolOnlyOptions[] = {MONGOC_URI_COALESCEINSERTSMAX,
+                                         MONGOC_URI_COALESCEINSERTSMS,
+                                         MONGOC_URI_DEFERKILLCURSORS,
+                                         MONGOC_URI_JOURNAL,
+                                         MONGOC_URI_MAXCONNECTING,
+                                         MONGOC_URI_MAXCONNECTIONLIFETIMEMS,
+                                         MONGOC_URI_MAXIDLETIMEMS,
+                                         MONGOC_URI_MAXPOOLSIZE,
+                                         MONGOC_URI_MAXSTALENESSSECONDS,
+                                         MONGOC_URI_MEMORYBUDGETMB,
+                                         MONGOC_URI_METADATACACHETTLMS,
+                                         MONGOC_URI_MINPOOLSIZE,
+                                         MONGOC_URI_POOLSHARDS,
+                                         MONGOC_URI_READCONCERNLEVEL,
+                                         MONGOC_URI_READPREFERENCE,
+                                         MONGOC_URI_READPREFERENCETAGS,
+                                         MONGOC_URI_RESERVEDPOOLSIZE,
+                                         MONGOC_URI_RETRYREADS,
+                                         MONGOC_URI_RETRYWRITES,
+                                         MONGOC_URI_SAFE,
+                                         MONGOC_URI_SHAREDCONNECTIONS,
+                                         MONGOC_URI_SHARETOPOLOGY,
+                                         MONGOC_URI_SLAVEOK,
+                                         MONGOC_URI_SLOWOPTHRESHOLDMS,
+                                         MONGOC_URI_STANDBYCONNECTIONS,
+                                         MONGOC_URI_TIMEOUTMS,
+                                         MONGOC_URI_W,
+                                         MONGOC_URI_WAITQUEUEMULTIPLE,
+                                         MONGOC_URI_WAITQUEUETIMEOUTMS,
+                                         MONGOC_URI_WTIMEOUTMS,
+                                         NULL};
+
+
+void
+_mongoc_topology_registry_init (void)
+{
+   mongoc_mutex_init (&gTopologyRegistryMutex);
+   _mongoc_array_init (&gTopologyRegistry, sizeof (mongoc_topology_t *));
+}
+
+
+/* pools must be destroyed before mongoc_cleanup, so the registry is empty */
+void
+_mongoc_topology_registry_cleanup (void)
+{
+   _mongoc_array_destroy (&gTopologyRegistry);
+   mongoc_mutex_destroy (&gTopologyRegistryMutex);
+}
+
+
+static int
+_mongoc_topology_registry_cmp (const void *a, const void *b)
+{
+   return strcmp (*(const char **) a, *(const char **) b);
+}
+
+
+static bool
+_mongoc_topology_registry_pool_only (const char *option)
+{
+   const char **name;
+
+   for (name = gPoolOnlyOptions; *name; name++) {
+      if (!strcasecmp (option, *name)) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_registry_key --
+ *
+ *       The seed list, or SRV service name, and the options that affect
+ *       monitoring, normalized so URIs for the same deployment written
+ *       with hosts or options in a different order or case get the same
+ *       key. Credentials and per-pool options aren't part of it.
+ *
+ * Returns:
+ *       A string to free with bson_free.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static char *
+_mongoc_topology_registry_key (const mongoc_uri_t *uri)
+{
+   const mongoc_host_list_t *host;
+   const bson_t *options;
+   bson_string_t *key;
+   mongoc_array_t names;
+   bson_iter_t iter;
+   bson_t value;
+   char *name;
+   char *json;
+   char *p;
+   size_t i;
+
+   key = bson_string_new (NULL);
+   _mongoc_array_init (&names, sizeof (char *));
+
+   if (mongoc_uri_get_service (uri)) {
+      bson_string_append_printf (key, "srv=%s", mongoc_uri_get_service (uri));
+   } else {
+      for (host = mongoc_uri_get_hosts (uri); host; host = host->next) {
+         name = bson_strdup (host->host_and_port);
+         for (p = name; *p; p++) {
+            *p = (char) tolower (*p);
+         }
+
+         _mongoc_array_append_val (&names, name);
+      }
+
+      qsort (names.data,
+             names.len,
+             sizeof (char *),
+             _mongoc_topology_registry_cmp);
+
+      bson_string_append (key, "hosts=");
+      for (i = 0; i < names.len; i++) {
+         name = _mongoc_array_index (&names, char *, i);
+         bson_string_append_printf (key, i ? ",%s" : "%s", name);
+         bson_free (name);
+      }
+   }
+
+   _mongoc_array_clear (&names);
+
+   /* option names are stored in lowercase */
+   options = mongoc_uri_get_options (uri);
+   if (options && bson_iter_init (&iter, options)) {
+      while (bson_iter_next (&iter)) {
+         if (!_mongoc_topology_registry_pool_only (bson_iter_key (&iter))) {
+            name = (char *) bson_iter_key (&iter);
+            _mongoc_array_append_val (&names, name);
+         }
+      }
+
+      qsort (names.data,
+             names.len,
+             sizeof (char *),
+             _mongoc_topology_registry_cmp);
+
+      for (i = 0; i < names.len; i++) {
+         name = _mongoc_array_index (&names, char *, i);
+         BSON_ASSERT (bson_iter_init_find (&iter, options, name));
+         bson_init (&value);
+         BSON_ASSERT (bson_append_iter (&value, "v", 1, &iter));
+         json = bson_as_json (&value, NULL);
+         bson_string_append_printf (key, "&%s=%s", name, json);
+         bson_free (json);
+         bson_destroy (&value);
+      }
+   }
+
+   _mongoc_array_destroy (&names);
+
+   return bson_string_free (key, false);
+}
+
+
+static int
+_mongoc_topology_registry_getpid (void)
+{
+#ifdef _WIN32
+   return (int) _getpid ();
+#else
+   return (int) getpid ();
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_registry_acquire --
+ *
+ *       The pooled topology for @uri that other client pools in the
+ *       process already use, or a new one they can share. Release it
+ *       with _mongoc_topology_registry_release.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_topology_t *
+_mongoc_topology_registry_acquire (const mongoc_uri_t *uri)
+{
+   mongoc_topology_t *topology;
+   const char *appname;
+   char *key;
+   size_t i;
+
+   ENTRY;
+
+   key = _mongoc_topology_registry_key (uri);
+
+   mongoc_mutex_lock (&gTopologyRegistryMutex);
+
+   for (i = 0; i < gTopologyRegistry.len; i++) {
+      topology =
+         _mongoc_array_index (&gTopologyRegistry, mongoc_topology_t *, i);
+      if (!strcmp (topology->registry_key, key)) {
+         topology->registry_refs++;
+         mongoc_mutex_unlock (&gTopologyRegistryMutex);
+         TRACE ("sharing topology %s", key);
+         bson_free (key);
+         RETURN (topology);
+      }
+   }
+
+   topology = mongoc_topology_new (uri, false);
+   topology->registry_key = key;
+   topology->registry_refs = 1;
+   topology->registry_pid = _mongoc_topology_registry_getpid ();
+
+   /* the appname is part of the key, and should have been validated */
+   appname =
+      mongoc_uri_get_option_as_utf8 (topology->uri, MONGOC_URI_APPNAME, NULL);
+   if (appname) {
+      BSON_ASSERT (_mongoc_topology_set_appname (topology, appname));
+   }
+
+#ifdef MONGOC_ENABLE_SSL
+   if (mongoc_uri_get_ssl (topology->uri)) {
+      /* points into topology->uri, which lives as long as the topology */
+      _mongoc_ssl_opts_from_uri (&topology->registry_ssl_opts, topology->uri);
+      mongoc_topology_scanner_set_ssl_opts (topology->scanner,
+                                            &topology->registry_ssl_opts);
+   }
+#endif
+
+   _mongoc_array_append_val (&gTopologyRegistry, topology);
+
+   mongoc_mutex_unlock (&gTopologyRegistryMutex);
+
+   RETURN (topology);
+}
+
+
+/* the last pool to release a shared topology destroys it */
+void
+_mongoc_topology_registry_release (mongoc_topology_t *topology)
+{
+   mongoc_topology_t **registered;
+   size_t i;
+
+   ENTRY;
+
+   mongoc_mutex_lock (&gTopologyRegistryMutex);
+
+   BSON_ASSERT (topology->registry_refs > 0);
+   if (--topology->registry_refs) {
+      mongoc_mutex_unlock (&gTopologyRegistryMutex);
+      EXIT;
+   }
+
+   for (i = 0; i < gTopologyRegistry.len; i++) {
+      registered =
+         &_mongoc_array_index (&gTopologyRegistry, mongoc_topology_t *, i);
+      if (*registered == topology) {
+         memmove (registered,
+                  registered + 1,
+                  (gTopologyRegistry.len - i - 1) * sizeof *registered);
+         gTopologyRegistry.len--;
+         break;
+      }
+   }
+
+   mongoc_mutex_unlock (&gTopologyRegistryMutex);
+
+   /* stops the background thread */
+   mongoc_topology_destroy (topology);
+
+   EXIT;
+}
+
+
+/* true if another client pool uses @topology */
+bool
+_mongoc_topology_registry_is_shared (mongoc_topology_t *topology)
+{
+   bool ret;
+
+   if (!topology->registry_key) {
+      return false;
+   }
+
+   mongoc_mutex_lock (&gTopologyRegistryMutex);
+   ret = topology->registry_refs > 1;
+   mongoc_mutex_unlock (&gTopologyRegistryMutex);
+
+   return ret;
+}
+
+
+/* in a child process after fork, each pool resets its topology, but a
+ * shared topology must be reset only once */
+void
+_mongoc_topology_registry_reset_after_fork (mongoc_topology_t *topology)
+{
+   int pid;
+
+   mongoc_mutex_init (&gTopologyRegistryMutex);
+
+   pid = _mongoc_topology_registry_getpid ();
+   if (topology->registry_pid != pid) {
+      topology->registry_pid = pid;
+      _mongoc_topology_reset_after_fork (topology);
+   }
+}
@@ -26,11 +26,14 @@
 #include <bson.h>
 #include "mongoc-async-private.h"
 #include "mongoc-async-cmd-private.h"
+#include "mongoc-dns-private.h"
 #include "mongoc-host-list.h"
 #include "mongoc-apm-private.h"
+#include "mongoc-set-private.h"
 
 #ifdef MONGOC_ENABLE_SSL
 #include "mongoc-ssl.h"
+#include "mongoc-stream-tls-private.h"
 #endif
 
 BSON_BEGIN_DECLS
@@ -46,18 +49,39 @@ typedef void (*mongoc_topology_scanner_cb_t) (
    const bson_error_t *error /* IN */);
 
 struct mongoc_topology_scanner;
+struct mongoc_topology_scanner_node;
+
+/* one of a node's racing connection attempts, one per resolved address */
+typedef struct mongoc_topology_scanner_candidate {
+   struct mongoc_topology_scanner_node *node;
+   struct addrinfo *addr;   /* owned by node->dns_results */
+   mongoc_async_cmd_t *cmd; /* NULL once finished */
+   mongoc_stream_t *stream; /* NULL until the attempt begins */
+   bool canceled;
+} mongoc_topology_scanner_candidate_t;
 
 typedef struct mongoc_topology_scanner_node {
    uint32_t id;
    mongoc_async_cmd_t *cmd;
    mongoc_stream_t *stream;
+   /* while racing addresses, the first to answer ismaster becomes stream */
+   mongoc_topology_scanner_candidate_t *candidates;
+   size_t n_candidates;
+   size_t n_pending;
    int64_t timestamp;
    int64_t last_used;
    int64_t last_failed;
+   /* when the last check succeeded or failed, 0 if never checked */
+   int64_t last_checked;
+   /* the stream was closed while idle, not because it failed: reopening it
+    * keeps "timestamp", so application connections stay valid */
+   bool closed_idle;
    bool has_auth;
    mongoc_host_list_t host;
    struct addrinfo *dns_results;
    struct addrinfo *current_dns_result;
+   /* a lookup running on ts->resolver */
+   mongoc_dns_request_t *dns_request;
    struct mongoc_topology_scanner *ts;
 
    struct mongoc_topology_scanner_node *next;
@@ -69,11 +93,21 @@ typedef struct mongoc_topology_scanner_node {
 
 typedef struct mongoc_topology_scanner {
    mongoc_async_t *async;
+   /* if use_resolver, started when a scan first misses the DNS cache */
+   bool use_resolver;
+   mongoc_dns_resolver_t *resolver;
    mongoc_topology_scanner_node_t *nodes;
+   mongoc_set_t *nodes_by_id; /* doesn't own the nodes */
    bson_t ismaster_cmd;
+   /* ismaster_cmd encoded once, sent by each heartbeat */
+   uint8_t *ismaster_cmd_msg;
+   size_t ismaster_cmd_msg_len;
 
    bson_t ismaster_cmd_with_handshake;
    bool handshake_ok_to_send;
+   /* the handshake encoded once, see _mongoc_topology_scanner_get_ismaster */
+   uint8_t *ismaster_msg;
+   size_t ismaster_msg_len;
    const char *appname;
 
    mongoc_topology_scanner_setup_err_cb_t setup_err_cb;
@@ -88,6 +122,8 @@ typedef struct mongoc_topology_scanner {
 
 #ifdef MONGOC_ENABLE_SSL
    mongoc_ssl_opt_t *ssl_opts;
+   /* shared with the topology's clients, which reach it through it */
+   mongoc_tls_session_cache_t *tls_sessions;
 #endif
 
    mongoc_apm_callbacks_t apm_callbacks;
@@ -120,6 +156,10 @@ mongoc_topology_scanner_scan (mongoc_topology_scanner_t *ts,
 void
 mongoc_topology_scanner_node_retire (mongoc_topology_scanner_node_t *node);
 
+bool
+mongoc_topology_scanner_node_in_progress (
+   const mongoc_topology_scanner_node_t *node);
+
 void
 mongoc_topology_scanner_node_disconnect (mongoc_topology_scanner_node_t *node,
                                          bool failed);
@@ -146,6 +186,9 @@ mongoc_topology_scanner_get_error (mongoc_topology_scanner_t *ts,
 void
 mongoc_topology_scanner_reset (mongoc_topology_scanner_t *ts);
 
+void
+_mongoc_topology_scanner_reset_after_fork (mongoc_topology_scanner_t *ts);
+
 bool
 mongoc_topology_scanner_node_setup (mongoc_topology_scanner_node_t *node,
                                     bson_error_t *error);
@@ -156,6 +199,10 @@ mongoc_topology_scanner_get_node (mongoc_topology_scanner_t *ts, uint32_t id);
 bson_t *
 _mongoc_topology_scanner_get_ismaster (mongoc_topology_scanner_t *ts);
 
+const uint8_t *
+_mongoc_topology_scanner_get_ismaster_msg (mongoc_topology_scanner_t *ts,
+                                           size_t *len);
+
 bool
 mongoc_topology_scanner_has_node_for_host (mongoc_topology_scanner_t *ts,
                                            mongoc_host_list_t *host);
@@ -21,6 +21,7 @@
 #include "mongoc-error.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-topology-scanner-private.h"
+#include "mongoc-socket-private.h"
 #include "mongoc-stream-socket.h"
 
 #include "mongoc-handshake.h"
@@ -34,6 +35,7 @@
 #include "utlist.h"
 #include "mongoc-topology-private.h"
 #include "mongoc-host-list-private.h"
+#include "mongoc-uri-private.h"
 
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "topology_scanner"
@@ -47,6 +49,51 @@ mongoc_topology_scanner_ismaster_handler (
    void *data,
    bson_error_t *error);
 
+static void
+_mongoc_topology_scanner_candidate_handler (
+   mongoc_async_cmd_result_t async_status,
+   const bson_t *ismaster_response,
+   int64_t rtt_msec,
+   void *data,
+   bson_error_t *error);
+
+/* tune a new TCP socket with the URI's "tcp*" options */
+static void
+_mongoc_topology_scanner_set_socket_opts (mongoc_topology_scanner_t *ts,
+                                          mongoc_socket_t *sock)
+{
+   mongoc_socket_opts_t opts;
+
+   if (ts->uri) {
+      _mongoc_uri_get_socket_opts (ts->uri, &opts);
+      _mongoc_socket_set_opts (sock, &opts);
+   }
+}
+
+
+/* with "preferUnixSocket", find the UNIX domain socket of a mongod or
+ * mongos on this machine. monitoring and the application both use it */
+static bool
+_mongoc_topology_scanner_local_unix (mongoc_topology_scanner_t *ts,
+                                     const mongoc_host_list_t *host,
+                                     mongoc_host_list_t *unix_host)
+{
+   return ts->uri &&
+          mongoc_uri_get_option_as_bool (
+             ts->uri, MONGOC_URI_PREFERUNIXSOCKET, false) &&
+          _mongoc_host_list_local_unix (host, unix_host);
+}
+
+
+static mongoc_stream_t *
+_mongoc_topology_scanner_candidate_initiate (mongoc_async_cmd_t *acmd,
+                                             bson_error_t *error);
+
+static void
+_mongoc_topology_scanner_node_begin (mongoc_topology_scanner_t *ts,
+                                     mongoc_topology_scanner_node_t *node,
+                                     int64_t timeout_msec);
+
 static void
 _mongoc_topology_scanner_monitor_heartbeat_started (
    const mongoc_topology_scanner_t *ts, const mongoc_host_list_t *host);
@@ -106,6 +153,27 @@ _build_ismaster_with_handshake (mongoc_topology_scanner_t *ts)
    return res;
 }
 
+/* encode an isMaster once as a complete OP_QUERY message, which each
+ * check sends with only the request id changed */
+static uint8_t *
+_encode_ismaster_msg (const bson_t *cmd, size_t *len)
+{
+   mongoc_rpc_t rpc;
+
+   rpc.header.msg_len = 0;
+   rpc.header.request_id = 0;
+   rpc.header.response_to = 0;
+   rpc.header.opcode = MONGOC_OPCODE_QUERY;
+   rpc.query.flags = MONGOC_QUERY_SLAVE_OK;
+   rpc.query.collection = "admin.$cmd";
+   rpc.query.skip = 0;
+   rpc.query.n_return = -1;
+   rpc.query.query = bson_get_data (cmd);
+   rpc.query.fields = NULL;
+
+   return _mongoc_rpc_encode_query (&rpc, len);
+}
+
 bson_t *
 _mongoc_topology_scanner_get_ismaster (mongoc_topology_scanner_t *ts)
 {
@@ -116,6 +184,12 @@ _mongoc_topology_scanner_get_ismaster (mongoc_topology_scanner_t *ts)
       if (!ts->handshake_ok_to_send) {
          MONGOC_WARNING ("Handshake doc too big, not including in isMaster");
       }
+
+      bson_free (ts->ismaster_msg);
+      ts->ismaster_msg = _encode_ismaster_msg (
+         ts->handshake_ok_to_send ? &ts->ismaster_cmd_with_handshake
+                                  : &ts->ismaster_cmd,
+         &ts->ismaster_msg_len);
    }
 
    /* If the doc turned out to be too big */
@@ -126,32 +200,131 @@ _mongoc_topology_scanner_get_ismaster (mongoc_topology_scanner_t *ts)
    return &ts->ismaster_cmd_with_handshake;
 }
 
+const uint8_t *
+_mongoc_topology_scanner_get_ismaster_msg (mongoc_topology_scanner_t *ts,
+                                           size_t *len)
+{
+   _mongoc_topology_scanner_get_ismaster (ts);
+
+   *len = ts->ismaster_msg_len;
+   return ts->ismaster_msg;
+}
+
+/* send the node's isMaster from a message encoded once: the handshake for
+ * a new connection or one that failed, otherwise the plain isMaster */
 static void
-_begin_ismaster_cmd (mongoc_topology_scanner_t *ts,
-                     mongoc_topology_scanner_node_t *node,
-                     int64_t timeout_msec)
+_mongoc_topology_scanner_node_set_msg (mongoc_topology_scanner_t *ts,
+                                       mongoc_topology_scanner_node_t *node,
+                                       mongoc_async_cmd_t *acmd)
 {
-   const bson_t *command;
+   const uint8_t *msg;
+   size_t len;
 
    if (node->last_used != -1 && node->last_failed == -1) {
       /* The node's been used before and not failed recently */
-      command = &ts->ismaster_cmd;
+      msg = ts->ismaster_cmd_msg;
+      len = ts->ismaster_cmd_msg_len;
    } else {
-      command = _mongoc_topology_scanner_get_ismaster (ts);
+      msg = _mongoc_topology_scanner_get_ismaster_msg (ts, &len);
    }
 
+   mongoc_async_cmd_set_msg (acmd, msg, len);
+}
 
-   node->cmd = mongoc_async_cmd_new (ts->async,
-                                     node->stream,
-                                     ts->setup,
-                                     node->host.host,
-                                     "admin",
-                                     command,
-                                     &mongoc_topology_scanner_ismaster_handler,
-                                     node,
-                                     timeout_msec);
+static void
+_begin_ismaster_cmd (mongoc_topology_scanner_t *ts,
+                     mongoc_topology_scanner_node_t *node,
+                     int64_t timeout_msec)
+{
+   node->cmd =
+      mongoc_async_cmd_new (ts->async,
+                            node->stream,
+                            ts->setup,
+                            node->host.host,
+                            "admin",
+                            NULL,
+                            &mongoc_topology_scanner_ismaster_handler,
+                            node,
+                            timeout_msec);
+
+   _mongoc_topology_scanner_node_set_msg (ts, node, node->cmd);
 }
 
+/* call ismaster on each of the node's addresses, RFC 8305 style: start an
+ * attempt every MONGOC_HAPPY_EYEBALLS_DELAY_MS, alternating families */
+static void
+_begin_ismaster_race (mongoc_topology_scanner_t *ts,
+                      mongoc_topology_scanner_node_t *node,
+                      int64_t timeout_msec)
+{
+   mongoc_topology_scanner_candidate_t *candidate;
+   struct addrinfo **addrs;
+   size_t i;
+
+   BSON_ASSERT (!node->cmd);
+   BSON_ASSERT (!node->candidates);
+
+   addrs = _mongoc_addrinfo_interleave (node->dns_results, &node->n_candidates);
+   node->candidates = (mongoc_topology_scanner_candidate_t *) bson_malloc0 (
+      sizeof (*node->candidates) * node->n_candidates);
+   node->n_pending = node->n_candidates;
+
+   for (i = 0; i < node->n_candidates; i++) {
+      candidate = &node->candidates[i];
+      candidate->node = node;
+      candidate->addr = addrs[i];
+      candidate->cmd = mongoc_async_cmd_new_delayed (
+         ts->async,
+         &_mongoc_topology_scanner_candidate_initiate,
+         (int64_t) i * MONGOC_HAPPY_EYEBALLS_DELAY_MS,
+         ts->setup,
+         node->host.host,
+         "admin",
+         NULL,
+         &_mongoc_topology_scanner_candidate_handler,
+         candidate,
+         timeout_msec);
+
+      _mongoc_topology_scanner_node_set_msg (ts, node, candidate->cmd);
+   }
+
+   bson_free (addrs);
+}
+
+static void
+_mongoc_topology_scanner_node_cancel_race (
+   mongoc_topology_scanner_node_t *node)
+{
+   size_t i;
+
+   for (i = 0; i < node->n_candidates; i++) {
+      if (node->candidates[i].cmd) {
+         node->candidates[i].canceled = true;
+         node->candidates[i].cmd->state = MONGOC_ASYNC_CMD_CANCELED_STATE;
+      }
+   }
+}
+
+static void
+_mongoc_topology_scanner_node_end_race (mongoc_topology_scanner_node_t *node)
+{
+   size_t i;
+
+   for (i = 0; i < node->n_candidates; i++) {
+      if (node->candidates[i].cmd) {
+         mongoc_async_cmd_destroy (node->candidates[i].cmd);
+      }
+
+      if (node->candidates[i].stream) {
+         mongoc_stream_destroy (node->candidates[i].stream);
+      }
+   }
+
+   bson_free (node->candidates);
+   node->candidates = NULL;
+   node->n_candidates = 0;
+   node->n_pending = 0;
+}
 
 mongoc_topology_scanner_t *
 mongoc_topology_scanner_new (
@@ -164,9 +337,12 @@ mongoc_topology_scanner_new (
       (mongoc_topology_scanner_t *) bson_malloc0 (sizeof (*ts));
 
    ts->async = mongoc_async_new ();
+   ts->nodes_by_id = mongoc_set_new (8, NULL, NULL);
 
    bson_init (&ts->ismaster_cmd);
    _add_ismaster (&ts->ismaster_cmd);
+   ts->ismaster_cmd_msg =
+      _encode_ismaster_msg (&ts->ismaster_cmd, &ts->ismaster_cmd_msg_len);
    bson_init (&ts->ismaster_cmd_with_handshake);
 
    ts->setup_err_cb = setup_err_cb;
@@ -175,6 +351,9 @@ mongoc_topology_scanner_new (
    ts->uri = uri;
    ts->appname = NULL;
    ts->handshake_ok_to_send = false;
+#ifdef MONGOC_ENABLE_SSL
+   ts->tls_sessions = _mongoc_tls_session_cache_new ();
+#endif
 
    return ts;
 }
@@ -209,13 +388,22 @@ mongoc_topology_scanner_destroy (mongoc_topology_scanner_t *ts)
       mongoc_topology_scanner_node_destroy (ele, false);
    }
 
+   mongoc_set_destroy (ts->nodes_by_id);
    mongoc_async_destroy (ts->async);
+   _mongoc_dns_resolver_destroy (ts->resolver);
    bson_destroy (&ts->ismaster_cmd);
+   bson_free (ts->ismaster_cmd_msg);
    bson_destroy (&ts->ismaster_cmd_with_handshake);
+   bson_free (ts->ismaster_msg);
 
    /* This field can be set by a mongoc_client */
    bson_free ((char *) ts->appname);
 
+#ifdef MONGOC_ENABLE_SSL
+   /* after the nodes, whose streams may refer to it */
+   _mongoc_tls_session_cache_destroy (ts->tls_sessions);
+#endif
+
    bson_free (ts);
 }
 
@@ -244,6 +432,7 @@ mongoc_topology_scanner_add (mongoc_topology_scanner_t *ts,
    node->last_used = -1;
 
    DL_APPEND (ts->nodes, node);
+   mongoc_set_add (ts->nodes_by_id, id, node);
 }
 
 void
@@ -258,8 +447,8 @@ mongoc_topology_scanner_scan (mongoc_topology_scanner_t *ts,
    node = mongoc_topology_scanner_get_node (ts, id);
 
    /* begin non-blocking connection, don't wait for success */
-   if (node && mongoc_topology_scanner_node_setup (node, &node->last_error)) {
-      _begin_ismaster_cmd (ts, node, timeout_msec);
+   if (node) {
+      _mongoc_topology_scanner_node_begin (ts, node, timeout_msec);
    }
 
    /* if setup fails the node stays in the scanner. destroyed after the scan. */
@@ -272,15 +461,34 @@ mongoc_topology_scanner_node_retire (mongoc_topology_scanner_node_t *node)
       node->cmd->state = MONGOC_ASYNC_CMD_CANCELED_STATE;
    }
 
+   _mongoc_topology_scanner_node_cancel_race (node);
+
    node->retired = true;
 }
 
+/* true while the node's ismaster, connection race, or DNS lookup runs */
+bool
+mongoc_topology_scanner_node_in_progress (
+   const mongoc_topology_scanner_node_t *node)
+{
+   return node->cmd || node->n_pending || node->dns_request;
+}
+
 void
 mongoc_topology_scanner_node_disconnect (mongoc_topology_scanner_node_t *node,
                                          bool failed)
 {
+   if (node->candidates) {
+      _mongoc_topology_scanner_node_end_race (node);
+   }
+
+   if (node->dns_request) {
+      _mongoc_dns_request_destroy (node->dns_request);
+      node->dns_request = NULL;
+   }
+
    if (node->dns_results) {
-      freeaddrinfo (node->dns_results);
+      _mongoc_dns_results_free (node->dns_results);
       node->dns_results = NULL;
       node->current_dns_result = NULL;
    }
@@ -306,6 +514,7 @@ mongoc_topology_scanner_node_destroy (mongoc_topology_scanner_node_t *node,
                                       bool failed)
 {
    DL_DELETE (node->ts->nodes, node);
+   mongoc_set_rm (node->ts->nodes_by_id, node->id);
    mongoc_topology_scanner_node_disconnect (node, failed);
    bson_free (node);
 }
@@ -322,20 +531,8 @@ mongoc_topology_scanner_node_destroy (mongoc_topology_scanner_node_t *node,
 mongoc_topology_scanner_node_t *
 mongoc_topology_scanner_get_node (mongoc_topology_scanner_t *ts, uint32_t id)
 {
-   mongoc_topology_scanner_node_t *ele, *tmp;
-
-   DL_FOREACH_SAFE (ts->nodes, ele, tmp)
-   {
-      if (ele->id == id) {
-         return ele;
-      }
-
-      if (ele->id > id) {
-         break;
-      }
-   }
-
-   return NULL;
+   return (mongoc_topology_scanner_node_t *) mongoc_set_get (
+      ts->nodes_by_id, id);
 }
 
 /*
@@ -373,35 +570,28 @@ mongoc_topology_scanner_has_node_for_host (mongoc_topology_scanner_t *ts,
  */
 
 static void
-mongoc_topology_scanner_ismaster_handler (
+_mongoc_topology_scanner_node_ismaster_done (
+   mongoc_topology_scanner_node_t *node,
    mongoc_async_cmd_result_t async_status,
    const bson_t *ismaster_response,
    int64_t rtt_msec,
-   void *data,
    bson_error_t *error)
 {
-   mongoc_topology_scanner_node_t *node;
    mongoc_topology_scanner_t *ts;
    int64_t now;
    const char *message;
 
-   BSON_ASSERT (data);
-
-   node = (mongoc_topology_scanner_node_t *) data;
    ts = node->ts;
-   node->cmd = NULL;
-
-   if (node->retired) {
-      return;
-   }
-
    now = bson_get_monotonic_time ();
 
    /* if no ismaster response, async cmd had an error or timed out */
    if (!ismaster_response || async_status == MONGOC_ASYNC_CMD_ERROR ||
        async_status == MONGOC_ASYNC_CMD_TIMEOUT) {
-      mongoc_stream_failed (node->stream);
-      node->stream = NULL;
+      if (node->stream) {
+         mongoc_stream_failed (node->stream);
+         node->stream = NULL;
+      }
+
       node->last_failed = now;
       if (error->code) {
          message = error->message;
@@ -429,9 +619,195 @@ mongoc_topology_scanner_ismaster_handler (
    }
 
    node->last_used = now;
+   node->last_checked = now;
    ts->cb (node->id, ismaster_response, rtt_msec, ts->cb_data, error);
 }
 
+static void
+mongoc_topology_scanner_ismaster_handler (
+   mongoc_async_cmd_result_t async_status,
+   const bson_t *ismaster_response,
+   int64_t rtt_msec,
+   void *data,
+   bson_error_t *error)
+{
+   mongoc_topology_scanner_node_t *node;
+
+   BSON_ASSERT (data);
+
+   node = (mongoc_topology_scanner_node_t *) data;
+   node->cmd = NULL;
+
+   if (node->retired) {
+      return;
+   }
+
+   if (!node->stream) {
+      /* this command's DNS lookup failed or began a race, see
+       * _mongoc_topology_scanner_resolve_initiate */
+      return;
+   }
+
+   _mongoc_topology_scanner_node_ismaster_done (
+      node, async_status, ismaster_response, rtt_msec, error);
+}
+
+
+/*
+ *-----------------------------------------------------------------------
+ *
+ * _mongoc_topology_scanner_candidate_handler --
+ *
+ *      Handle the ismaster reply, or failure, of one of a node's
+ *      racing connection attempts. The first success becomes the node's
+ *      stream and cancels the rest. A failure starts the next attempt
+ *      without waiting out its delay; the node fails only once every
+ *      attempt has.
+ *
+ *-----------------------------------------------------------------------
+ */
+
+static void
+_mongoc_topology_scanner_candidate_handler (
+   mongoc_async_cmd_result_t async_status,
+   const bson_t *ismaster_response,
+   int64_t rtt_msec,
+   void *data,
+   bson_error_t *error)
+{
+   mongoc_topology_scanner_candidate_t *candidate;
+   mongoc_topology_scanner_node_t *node;
+   mongoc_stream_t *stream;
+   size_t i;
+
+   BSON_ASSERT (data);
+
+   candidate = (mongoc_topology_scanner_candidate_t *) data;
+   node = candidate->node;
+   stream = candidate->stream;
+   candidate->cmd = NULL;
+   candidate->stream = NULL;
+   node->n_pending--;
+
+   if (node->retired || candidate->canceled) {
+      if (stream) {
+         mongoc_stream_destroy (stream);
+      }
+
+      if (!node->n_pending) {
+         _mongoc_topology_scanner_node_end_race (node);
+      }
+
+      return;
+   }
+
+   if (ismaster_response && async_status == MONGOC_ASYNC_CMD_SUCCESS) {
+      node->stream = stream;
+      node->has_auth = false;
+      if (!node->closed_idle) {
+         node->timestamp = bson_get_monotonic_time ();
+      }
+
+      node->closed_idle = false;
+      _mongoc_topology_scanner_node_cancel_race (node);
+   } else {
+      if (stream) {
+         mongoc_stream_failed (stream);
+      }
+
+      if (node->n_pending) {
+         /* don't wait out the delay, the next address may answer */
+         for (i = 0; i < node->n_candidates; i++) {
+            if (node->candidates[i].cmd &&
+                node->candidates[i].cmd->state == MONGOC_ASYNC_CMD_INITIATE) {
+               node->candidates[i].cmd->initiate_at =
+                  bson_get_monotonic_time ();
+               break;
+            }
+         }
+
+         return;
+      }
+   }
+
+   if (!node->n_pending) {
+      _mongoc_topology_scanner_node_end_race (node);
+   }
+
+   _mongoc_topology_scanner_node_ismaster_done (
+      node, async_status, ismaster_response, rtt_msec, error);
+}
+
+
+static mongoc_stream_t *
+_mongoc_topology_scanner_candidate_initiate (mongoc_async_cmd_t *acmd,
+                                             bson_error_t *error)
+{
+   mongoc_topology_scanner_candidate_t *candidate;
+   mongoc_socket_t *sock;
+   mongoc_stream_t *stream;
+   struct addrinfo *rp;
+
+   candidate = (mongoc_topology_scanner_candidate_t *) acmd->data;
+   rp = candidate->addr;
+
+   sock = mongoc_socket_new (rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+   if (!sock) {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_SOCKET,
+                      "Failed to create socket.");
+      return NULL;
+   }
+
+   _mongoc_topology_scanner_set_socket_opts (candidate->node->ts, sock);
+   mongoc_socket_connect (
+      sock, rp->ai_addr, (mongoc_socklen_t) rp->ai_addrlen, 0);
+
+   stream = mongoc_stream_socket_new (sock);
+
+#ifdef MONGOC_ENABLE_SSL
+   if (candidate->node->ts->ssl_opts) {
+      mongoc_stream_t *original = stream;
+
+      stream = mongoc_stream_tls_new_with_hostname (
+         stream, candidate->node->host.host, candidate->node->ts->ssl_opts, 1);
+      if (!stream) {
+         mongoc_stream_destroy (original);
+         bson_set_error (error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_SOCKET,
+                         "Failed to initialize TLS state.");
+         return NULL;
+      }
+
+      _mongoc_stream_tls_set_session_cache (
+         stream,
+         candidate->node->ts->tls_sessions,
+         candidate->node->host.host_and_port);
+   }
+#endif
+
+   candidate->stream = stream;
+
+   return stream;
+}
+
+
+static bool
+_mongoc_topology_scanner_node_resolve (mongoc_topology_scanner_node_t *node,
+                                       bson_error_t *error)
+{
+   node->dns_results = _mongoc_dns_getaddrinfo (&node->host, error);
+   if (!node->dns_results) {
+      return false;
+   }
+
+   node->current_dns_result = node->dns_results;
+
+   return true;
+}
+
 
 /*
  *--------------------------------------------------------------------------
@@ -452,40 +828,16 @@ mongoc_topology_scanner_node_connect_tcp (mongoc_topology_scanner_node_t *node,
                                           bson_error_t *error)
 {
    mongoc_socket_t *sock = NULL;
-   struct addrinfo hints;
    struct addrinfo *rp;
-   char portstr[8];
    mongoc_host_list_t *host;
-   int s;
 
    ENTRY;
 
    host = &node->host;
 
-   if (!node->dns_results) {
-      bson_snprintf (portstr, sizeof portstr, "%hu", host->port);
-
-      memset (&hints, 0, sizeof hints);
-      hints.ai_family = host->family;
-      hints.ai_socktype = SOCK_STREAM;
-      hints.ai_flags = 0;
-      hints.ai_protocol = 0;
-
-      s = getaddrinfo (host->host, portstr, &hints, &node->dns_results);
-
-      if (s != 0) {
-         mongoc_counter_dns_failure_inc ();
-         bson_set_error (error,
-                         MONGOC_ERROR_STREAM,
-                         MONGOC_ERROR_STREAM_NAME_RESOLUTION,
-                         "Failed to resolve '%s'",
-                         host->host);
-         RETURN (NULL);
-      }
-
-      node->current_dns_result = node->dns_results;
-
-      mongoc_counter_dns_success_inc ();
+   if (!node->dns_results &&
+       !_mongoc_topology_scanner_node_resolve (node, error)) {
+      RETURN (NULL);
    }
 
    for (; node->current_dns_result;
@@ -500,6 +852,7 @@ mongoc_topology_scanner_node_connect_tcp (mongoc_topology_scanner_node_t *node,
          continue;
       }
 
+      _mongoc_topology_scanner_set_socket_opts (node->ts, sock);
       mongoc_socket_connect (
          sock, rp->ai_addr, (mongoc_socklen_t) rp->ai_addrlen, 0);
 
@@ -512,7 +865,7 @@ mongoc_topology_scanner_node_connect_tcp (mongoc_topology_scanner_node_t *node,
                       MONGOC_ERROR_STREAM_CONNECT,
                       "Failed to connect to target host: '%s'",
                       host->host_and_port);
-      freeaddrinfo (node->dns_results);
+      _mongoc_dns_results_free (node->dns_results);
       node->dns_results = NULL;
       node->current_dns_result = NULL;
       RETURN (NULL);
@@ -522,7 +875,7 @@ mongoc_topology_scanner_node_connect_tcp (mongoc_topology_scanner_node_t *node,
 }
 
 static mongoc_stream_t *
-mongoc_topology_scanner_node_connect_unix (mongoc_topology_scanner_node_t *node,
+mongoc_topology_scanner_node_connect_unix (const mongoc_host_list_t *host,
                                            bson_error_t *error)
 {
 #ifdef _WIN32
@@ -536,12 +889,9 @@ mongoc_topology_scanner_node_connect_unix (mongoc_topology_scanner_node_t *node,
    struct sockaddr_un saddr;
    mongoc_socket_t *sock;
    mongoc_stream_t *ret = NULL;
-   mongoc_host_list_t *host;
 
    ENTRY;
 
-   host = &node->host;
-
    memset (&saddr, 0, sizeof saddr);
    saddr.sun_family = AF_UNIX;
    bson_snprintf (saddr.sun_path, sizeof saddr.sun_path - 1, "%s", host->host);
@@ -579,6 +929,23 @@ mongoc_topology_scanner_node_connect_unix (mongoc_topology_scanner_node_t *node,
 }
 
 
+static void
+_mongoc_topology_scanner_node_setup_failed (
+   mongoc_topology_scanner_node_t *node, const bson_error_t *error)
+{
+   _mongoc_topology_scanner_monitor_heartbeat_failed (
+      node->ts, &node->host, error);
+
+   node->last_checked = bson_get_monotonic_time ();
+   node->ts->setup_err_cb (node->id, node->ts->cb_data, error);
+}
+
+
+static bool
+_mongoc_topology_scanner_node_open (mongoc_topology_scanner_node_t *node,
+                                    bson_error_t *error);
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -596,14 +963,25 @@ bool
 mongoc_topology_scanner_node_setup (mongoc_topology_scanner_node_t *node,
                                     bson_error_t *error)
 {
-   mongoc_stream_t *sock_stream;
-
    _mongoc_topology_scanner_monitor_heartbeat_started (node->ts, &node->host);
 
    if (node->stream) {
       return true;
    }
 
+   return _mongoc_topology_scanner_node_open (node, error);
+}
+
+
+/* create the node's stream, and report an error to the topology if we
+ * can't */
+static bool
+_mongoc_topology_scanner_node_open (mongoc_topology_scanner_node_t *node,
+                                    bson_error_t *error)
+{
+   mongoc_stream_t *sock_stream;
+   mongoc_host_list_t unix_host;
+
    BSON_ASSERT (!node->retired);
 
    if (node->ts->initiator) {
@@ -611,9 +989,20 @@ mongoc_topology_scanner_node_setup (mongoc_topology_scanner_node_t *node,
          node->ts->uri, &node->host, node->ts->initiator_context, error);
    } else {
       if (node->host.family == AF_UNIX) {
-         sock_stream = mongoc_topology_scanner_node_connect_unix (node, error);
+         sock_stream =
+            mongoc_topology_scanner_node_connect_unix (&node->host, error);
       } else {
-         sock_stream = mongoc_topology_scanner_node_connect_tcp (node, error);
+         sock_stream = NULL;
+         if (_mongoc_topology_scanner_local_unix (
+                node->ts, &node->host, &unix_host)) {
+            sock_stream =
+               mongoc_topology_scanner_node_connect_unix (&unix_host, NULL);
+         }
+
+         if (!sock_stream) {
+            sock_stream =
+               mongoc_topology_scanner_node_connect_tcp (node, error);
+         }
       }
 
 #ifdef MONGOC_ENABLE_SSL
@@ -624,26 +1013,181 @@ mongoc_topology_scanner_node_setup (mongoc_topology_scanner_node_t *node,
             sock_stream, node->host.host, node->ts->ssl_opts, 1);
          if (!sock_stream) {
             mongoc_stream_destroy (original);
+         } else {
+            _mongoc_stream_tls_set_session_cache (
+               sock_stream, node->ts->tls_sessions, node->host.host_and_port);
          }
       }
 #endif
    }
 
    if (!sock_stream) {
-      _mongoc_topology_scanner_monitor_heartbeat_failed (
-         node->ts, &node->host, error);
-
-      node->ts->setup_err_cb (node->id, node->ts->cb_data, error);
+      _mongoc_topology_scanner_node_setup_failed (node, error);
       return false;
    }
 
    node->stream = sock_stream;
    node->has_auth = false;
-   node->timestamp = bson_get_monotonic_time ();
+   if (!node->closed_idle) {
+      node->timestamp = bson_get_monotonic_time ();
+   }
+
+   node->closed_idle = false;
 
    return true;
 }
 
+
+/* poll a running DNS lookup this often, see
+ * _mongoc_topology_scanner_resolve_initiate */
+#define MONGOC_TOPOLOGY_SCANNER_DNS_POLL_MS 10
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_scanner_resolve_initiate --
+ *
+ *      The initiator of a node's ismaster while its host is resolved.
+ *      Until the lookup finishes, postpone the command. Then open the
+ *      stream, or if there are several addresses, hand over to
+ *      _begin_ismaster_race and let the command fail silently.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_stream_t *
+_mongoc_topology_scanner_resolve_initiate (mongoc_async_cmd_t *acmd,
+                                           bson_error_t *error)
+{
+   mongoc_topology_scanner_node_t *node;
+   int64_t now;
+
+   node = (mongoc_topology_scanner_node_t *) acmd->data;
+   now = bson_get_monotonic_time ();
+
+   if (!_mongoc_dns_request_take (
+          node->dns_request, &node->dns_results, &node->last_error)) {
+      if (now < acmd->connect_started + acmd->timeout_msec * 1000) {
+         acmd->initiate_at = now + MONGOC_TOPOLOGY_SCANNER_DNS_POLL_MS * 1000;
+         return NULL;
+      }
+
+      bson_set_error (&node->last_error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_NAME_RESOLUTION,
+                      "Timed out resolving '%s'",
+                      node->host.host);
+   }
+
+   _mongoc_dns_request_destroy (node->dns_request);
+   node->dns_request = NULL;
+
+   if (!node->dns_results) {
+      _mongoc_topology_scanner_node_setup_failed (node, &node->last_error);
+      return NULL;
+   }
+
+   node->current_dns_result = node->dns_results;
+
+   if (node->dns_results->ai_next) {
+      node->cmd = NULL;
+      _begin_ismaster_race (node->ts, node, acmd->timeout_msec);
+      return NULL;
+   }
+
+   if (!_mongoc_topology_scanner_node_open (node, &node->last_error)) {
+      return NULL;
+   }
+
+   return node->stream;
+}
+
+
+static void
+_begin_resolve (mongoc_topology_scanner_t *ts,
+                mongoc_topology_scanner_node_t *node,
+                int64_t timeout_msec)
+{
+   BSON_ASSERT (!node->cmd);
+   BSON_ASSERT (!node->dns_request);
+
+   if (!ts->resolver) {
+      ts->resolver = _mongoc_dns_resolver_new ();
+   }
+
+   node->dns_request = _mongoc_dns_resolver_lookup (ts->resolver, &node->host);
+   node->cmd = mongoc_async_cmd_new_delayed (
+      ts->async,
+      &_mongoc_topology_scanner_resolve_initiate,
+      0,
+      ts->setup,
+      node->host.host,
+      "admin",
+      NULL,
+      &mongoc_topology_scanner_ismaster_handler,
+      node,
+      timeout_msec);
+
+   _mongoc_topology_scanner_node_set_msg (ts, node, node->cmd);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_scanner_node_begin --
+ *
+ *      Begin checking a node without waiting for the result. If the
+ *      node has no stream and its address isn't cached, a pooled client's
+ *      scanner resolves it on the resolver thread first. If it resolves
+ *      to several addresses, race connections to all of them, see
+ *      _begin_ismaster_race.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_topology_scanner_node_begin (mongoc_topology_scanner_t *ts,
+                                     mongoc_topology_scanner_node_t *node,
+                                     int64_t timeout_msec)
+{
+   mongoc_host_list_t unix_host;
+
+   if (!node->stream && !ts->initiator && node->host.family != AF_UNIX &&
+       !_mongoc_topology_scanner_local_unix (ts, &node->host, &unix_host)) {
+      BSON_ASSERT (!node->retired);
+
+      if (ts->use_resolver && !node->dns_results &&
+          !_mongoc_dns_cache_get (
+             &node->host, &node->dns_results, &node->last_error)) {
+         /* don't stall the other nodes' checks on a slow resolver */
+         _mongoc_topology_scanner_monitor_heartbeat_started (ts, &node->host);
+         _begin_resolve (ts, node, timeout_msec);
+         return;
+      }
+
+      if (!node->dns_results &&
+          !_mongoc_topology_scanner_node_resolve (node, &node->last_error)) {
+         _mongoc_topology_scanner_monitor_heartbeat_started (ts, &node->host);
+         _mongoc_topology_scanner_node_setup_failed (node, &node->last_error);
+         return;
+      }
+
+      node->current_dns_result = node->dns_results;
+
+      if (node->dns_results->ai_next) {
+         _mongoc_topology_scanner_monitor_heartbeat_started (ts, &node->host);
+         _begin_ismaster_race (ts, node, timeout_msec);
+         return;
+      }
+   }
+
+   if (mongoc_topology_scanner_node_setup (node, &node->last_error)) {
+      BSON_ASSERT (!node->cmd);
+      _begin_ismaster_cmd (ts, node, timeout_msec);
+   }
+}
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -690,12 +1234,14 @@ mongoc_topology_scanner_start (mongoc_topology_scanner_t *ts,
 
    DL_FOREACH_SAFE (ts->nodes, node, tmp)
    {
+      /* a check left running by an earlier scan continues */
+      if (mongoc_topology_scanner_node_in_progress (node)) {
+         continue;
+      }
+
       /* check node if it last failed before current cooldown period began */
       if (node->last_failed < cooldown) {
-         if (mongoc_topology_scanner_node_setup (node, &node->last_error)) {
-            BSON_ASSERT (!node->cmd);
-            _begin_ismaster_cmd (ts, node, timeout_msec);
-         }
+         _mongoc_topology_scanner_node_begin (ts, node, timeout_msec);
       }
    }
 }
@@ -784,7 +1330,7 @@ mongoc_topology_scanner_get_error (mongoc_topology_scanner_t *ts,
  * mongoc_topology_scanner_reset --
  *
  *      Reset "retired" nodes that failed or were removed in the previous
- *      scan.
+ *      scan, once their checks are done.
  *
  *--------------------------------------------------------------------------
  */
@@ -796,12 +1342,50 @@ mongoc_topology_scanner_reset (mongoc_topology_scanner_t *ts)
 
    DL_FOREACH_SAFE (ts->nodes, node, tmp)
    {
-      if (node->retired) {
+      if (node->retired && !mongoc_topology_scanner_node_in_progress (node)) {
          mongoc_topology_scanner_node_destroy (node, true);
       }
    }
 }
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_scanner_reset_after_fork --
+ *
+ *      In a child process after fork: close the monitoring connections,
+ *      and abandon the checks and lookups in progress, inherited from the
+ *      parent. The nodes and the TLS sessions are kept, and the next scan
+ *      reconnects.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_topology_scanner_reset_after_fork (mongoc_topology_scanner_t *ts)
+{
+   mongoc_topology_scanner_node_t *node;
+
+   _mongoc_async_reset_after_fork (ts->async);
+
+   if (ts->resolver) {
+      _mongoc_dns_resolver_reset_after_fork (ts->resolver);
+   }
+
+#ifdef MONGOC_ENABLE_SSL
+   _mongoc_tls_session_cache_reset_after_fork (ts->tls_sessions);
+#endif
+
+   /* the sockets are closed without shutting them down, and TLS streams
+    * are freed without sending close_notify, see mongoc_socket_close */
+   DL_FOREACH (ts->nodes, node)
+   {
+      mongoc_topology_scanner_node_disconnect (node, false);
+   }
+
+   ts->in_progress = false;
+}
+
 /*
  * Set a field in the topology scanner.
  */
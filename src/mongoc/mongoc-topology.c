@@ -21,12 +21,16 @@
 
 #include "mongoc-error.h"
 #include "mongoc-log.h"
+#include "mongoc-memory-private.h"
 #include "mongoc-topology-private.h"
 #include "mongoc-topology-description-apm-private.h"
 #include "mongoc-client-private.h"
+#include "mongoc-counters-private.h"
+#include "mongoc-read-prefs-private.h"
 #include "mongoc-uri-private.h"
 #include "mongoc-util-private.h"
 #include "mongoc-host-list-private.h"
+#include "mongoc-trace-private.h"
 
 #include "utlist.h"
 
@@ -36,6 +40,9 @@ _mongoc_topology_background_thread_stop (mongoc_topology_t *topology);
 static void
 _mongoc_topology_request_scan (mongoc_topology_t *topology);
 
+static void
+_mongoc_topology_wake_selectors (mongoc_topology_t *topology);
+
 static bool
 _mongoc_topology_reconcile_add_nodes (void *item, void *ctx)
 {
@@ -80,6 +87,78 @@ mongoc_topology_reconcile (mongoc_topology_t *topology)
 }
 
 
+/* call this while already holding the lock. false if server @id's circuit
+ * breaker is open: its isMaster replies are ignored, so it stays Unknown.
+ * once the open period is over, the next reply is the probe: it closes the
+ * breaker half-way, so one more network error opens it again. */
+static bool
+_mongoc_topology_breaker_admit (mongoc_topology_t *topology,
+                                uint32_t id,
+                                bson_error_t *error)
+{
+   mongoc_server_breaker_t *breaker;
+
+   if (!topology->breaker_threshold) {
+      return true;
+   }
+
+   breaker = &topology->breakers[id % MONGOC_SERVER_LOAD_SLOTS];
+   if (!breaker->open_until_usec) {
+      return true;
+   }
+
+   if (bson_get_monotonic_time () < breaker->open_until_usec) {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_SOCKET,
+                      "Circuit breaker open for server %u",
+                      id);
+      return false;
+   }
+
+   breaker->open_until_usec = 0;
+   breaker->failures = topology->breaker_threshold - 1;
+
+   return true;
+}
+
+
+/* call this while already holding the lock. a known server that changed
+ * type, e.g. a primary that stepped down, starts a period of fast scans */
+static void
+_mongoc_topology_note_server_type (mongoc_topology_t *topology,
+                                   uint32_t id,
+                                   mongoc_server_description_type_t old_type)
+{
+   mongoc_server_description_t *sd;
+
+   if (old_type == MONGOC_SERVER_UNKNOWN) {
+      return;
+   }
+
+   sd = mongoc_topology_description_server_by_id (
+      &topology->description, id, NULL);
+
+   if (!sd || sd->type != old_type) {
+      topology->unstable_until =
+         bson_get_monotonic_time () + MONGOC_TOPOLOGY_UNSTABLE_MS * 1000;
+   }
+}
+
+
+/* call this while already holding the lock */
+static mongoc_server_description_type_t
+_mongoc_topology_server_type (mongoc_topology_t *topology, uint32_t id)
+{
+   mongoc_server_description_t *sd;
+
+   sd = mongoc_topology_description_server_by_id (
+      &topology->description, id, NULL);
+
+   return sd ? sd->type : MONGOC_SERVER_UNKNOWN;
+}
+
+
 /* call this while already holding the lock */
 static bool
 _mongoc_topology_update_no_lock (uint32_t id,
@@ -88,13 +167,24 @@ _mongoc_topology_update_no_lock (uint32_t id,
                                  mongoc_topology_t *topology,
                                  const bson_error_t *error /* IN */)
 {
+   bson_error_t breaker_error;
+   mongoc_server_description_type_t old_type;
+
+   if (!_mongoc_topology_breaker_admit (topology, id, &breaker_error)) {
+      ismaster_response = NULL;
+      error = &breaker_error;
+   }
+
+   old_type = _mongoc_topology_server_type (topology, id);
    mongoc_topology_description_handle_ismaster (
       &topology->description, id, ismaster_response, rtt_msec, error);
+   _mongoc_topology_note_server_type (topology, id, old_type);
 
    /* The processing of the ismaster results above may have added/removed
     * server descriptions. We need to reconcile that with our monitoring agents
     */
    mongoc_topology_reconcile (topology);
+   _mongoc_topology_publish_snapshot (topology);
 
    /* return false if server removed from topology */
    return mongoc_topology_description_server_by_id (
@@ -178,12 +268,44 @@ _mongoc_topology_scanner_cb (uint32_t id,
       _mongoc_topology_update_no_lock (
          id, ismaster_response, rtt_msec, topology, error);
 
-      mongoc_cond_broadcast (&topology->cond_client);
+      _mongoc_topology_wake_selectors (topology);
    }
 
    mongoc_mutex_unlock (&topology->mutex);
 }
 
+/* call this while already holding the lock, or from mongoc_topology_new */
+static void
+_mongoc_topology_add_seeds (mongoc_topology_t *topology,
+                            const mongoc_host_list_t *hl)
+{
+   uint32_t id;
+
+   /*
+    * Set topology type from URI:
+    *   - if we've got a replicaSet name, initialize to RS_NO_PRIMARY
+    *   - otherwise, if the seed list has a single host, initialize to SINGLE,
+    *     unless it came from SRV records, which may list more hosts later
+    *   - everything else gets initialized to UNKNOWN
+    */
+   if (mongoc_uri_get_replica_set (topology->uri)) {
+      topology->description.type = MONGOC_TOPOLOGY_RS_NO_PRIMARY;
+   } else if ((hl && hl->next) || topology->srv_service) {
+      topology->description.type = MONGOC_TOPOLOGY_UNKNOWN;
+   } else {
+      topology->description.type = MONGOC_TOPOLOGY_SINGLE;
+   }
+
+   while (hl) {
+      mongoc_topology_description_add_server (
+         &topology->description, hl->host_and_port, &id);
+      mongoc_topology_scanner_add (topology->scanner, hl, id);
+
+      hl = hl->next;
+   }
+}
+
+
 /*
  *-------------------------------------------------------------------------
  *
@@ -205,15 +327,15 @@ mongoc_topology_new (const mongoc_uri_t *uri, bool single_threaded)
    int64_t heartbeat_default;
    int64_t heartbeat;
    mongoc_topology_t *topology;
-   mongoc_topology_description_type_t init_type;
    const char *service;
-   char *prefixed_service;
-   uint32_t id;
-   const mongoc_host_list_t *hl;
+   const char *local_zone;
+   mongoc_host_list_t *hl;
 
    BSON_ASSERT (uri);
 
    topology = (mongoc_topology_t *) bson_malloc0 (sizeof *topology);
+   _mongoc_array_init (&topology->maintenance,
+                       sizeof (mongoc_topology_maintenance_t));
 
    heartbeat_default =
       single_threaded ? MONGOC_TOPOLOGY_HEARTBEAT_FREQUENCY_MS_SINGLE_THREADED
@@ -236,6 +358,8 @@ mongoc_topology_new (const mongoc_uri_t *uri, bool single_threaded)
                                    topology);
 
    topology->single_threaded = single_threaded;
+   /* single-threaded clients start no threads, they resolve inline */
+   topology->scanner->use_resolver = !single_threaded;
    if (single_threaded) {
       /* Server Selection Spec:
        *
@@ -248,6 +372,8 @@ mongoc_topology_new (const mongoc_uri_t *uri, bool single_threaded)
        */
       topology->server_selection_try_once = mongoc_uri_get_option_as_bool (
          uri, MONGOC_URI_SERVERSELECTIONTRYONCE, true);
+      topology->server_selection_eager = mongoc_uri_get_option_as_bool (
+         uri, MONGOC_URI_SERVERSELECTIONEAGER, false);
    } else {
       topology->server_selection_try_once = false;
    }
@@ -260,6 +386,57 @@ mongoc_topology_new (const mongoc_uri_t *uri, bool single_threaded)
    topology->local_threshold_msec =
       mongoc_uri_get_local_threshold_option (topology->uri);
 
+   topology->load_aware = mongoc_uri_get_option_as_bool (
+      topology->uri, MONGOC_URI_SERVERSELECTIONLOADAWARE, false);
+
+   if (!single_threaded) {
+      topology->heartbeat_piggyback = mongoc_uri_get_option_as_bool (
+         topology->uri, MONGOC_URI_HEARTBEATPIGGYBACK, false);
+   }
+
+   topology->breaker_threshold = mongoc_uri_get_option_as_int32 (
+      topology->uri, MONGOC_URI_CIRCUITBREAKERTHRESHOLD, 0);
+   if (topology->breaker_threshold < 0) {
+      MONGOC_WARNING ("Invalid circuitBreakerThreshold: %d",
+                      topology->breaker_threshold);
+      topology->breaker_threshold = 0;
+   }
+
+   topology->breaker_open_msec = mongoc_uri_get_option_as_int32 (
+      topology->uri,
+      MONGOC_URI_CIRCUITBREAKEROPENMS,
+      MONGOC_TOPOLOGY_CIRCUIT_BREAKER_OPEN_MS);
+
+   topology->max_in_flight = mongoc_uri_get_option_as_int32 (
+      topology->uri, MONGOC_URI_MAXINFLIGHTPERSERVER, 0);
+   if (topology->max_in_flight < 0) {
+      MONGOC_WARNING ("Invalid maxInFlightPerServer: %d",
+                      topology->max_in_flight);
+      topology->max_in_flight = 0;
+   }
+
+   topology->in_flight_fail_fast = mongoc_uri_get_option_as_bool (
+      topology->uri, MONGOC_URI_INFLIGHTFAILFAST, false);
+
+   local_zone =
+      mongoc_uri_get_option_as_utf8 (topology->uri, MONGOC_URI_LOCALZONE, NULL);
+   if (local_zone && *local_zone) {
+      topology->description.local_zone = bson_strdup (local_zone);
+      topology->description.zone_tag = bson_strdup (
+         mongoc_uri_get_option_as_utf8 (
+            topology->uri, MONGOC_URI_ZONETAG, MONGOC_TOPOLOGY_ZONE_TAG));
+      topology->description.zone_penalty_ms =
+         mongoc_uri_get_option_as_int32 (topology->uri,
+                                         MONGOC_URI_ZONEPENALTYMS,
+                                         MONGOC_TOPOLOGY_ZONE_PENALTY_MS);
+      if (topology->description.zone_penalty_ms < 0) {
+         MONGOC_WARNING ("Invalid zonePenaltyMS: %" PRId64,
+                         topology->description.zone_penalty_ms);
+         topology->description.zone_penalty_ms =
+            MONGOC_TOPOLOGY_ZONE_PENALTY_MS;
+      }
+   }
+
    /* Total time allowed to check a server is connectTimeoutMS.
     * Server Discovery And Monitoring Spec:
     *
@@ -273,48 +450,33 @@ mongoc_topology_new (const mongoc_uri_t *uri, bool single_threaded)
                                       MONGOC_DEFAULT_CONNECTTIMEOUTMS);
 
    mongoc_mutex_init (&topology->mutex);
+   mongoc_mutex_init (&topology->snapshot_mutex);
+   bson_init (&topology->cluster_time);
    mongoc_cond_init (&topology->cond_client);
    mongoc_cond_init (&topology->cond_server);
+   mongoc_cond_init (&topology->cond_in_flight);
+
+   topology->srv_rescan_msec = MONGOC_TOPOLOGY_SRV_RESCAN_INTERVAL_MS;
 
    service = mongoc_uri_get_service (uri);
    if (service) {
-      /* a mongodb+srv URI. on error, hl is NULL and error is set. */
-      prefixed_service = bson_strdup_printf ("_mongodb._tcp.%s", service);
-      hl = _mongoc_client_get_srv (prefixed_service, &topology->scanner->error);
-      bson_free (prefixed_service);
-   } else {
-      hl = mongoc_uri_get_hosts (uri);
+      topology->srv_service = bson_strdup_printf ("_mongodb._tcp.%s", service);
    }
 
-   /*
-    * Set topology type from URI:
-    *   - if we've got a replicaSet name, initialize to RS_NO_PRIMARY
-    *   - otherwise, if the seed list has a single host, initialize to SINGLE
-    *   - everything else gets initialized to UNKNOWN
-    */
-   if (mongoc_uri_get_replica_set (uri)) {
-      init_type = MONGOC_TOPOLOGY_RS_NO_PRIMARY;
+   if (service && !single_threaded) {
+      /* a mongodb+srv URI, resolved on the background thread so creating a
+       * pool doesn't wait for DNS. see _mongoc_topology_poll_srv. */
+      topology->srv_pending = true;
+   } else if (service) {
+      /* on error, hl is NULL and error is set. */
+      hl = _mongoc_client_get_srv (topology->srv_service, &topology->srv_error);
+      _mongoc_topology_add_seeds (topology, hl);
+      _mongoc_host_list_destroy_all (hl);
    } else {
-      if (hl && hl->next) {
-         init_type = MONGOC_TOPOLOGY_UNKNOWN;
-      } else {
-         init_type = MONGOC_TOPOLOGY_SINGLE;
-      }
-   }
-
-   topology->description.type = init_type;
-
-   while (hl) {
-      mongoc_topology_description_add_server (
-         &topology->description, hl->host_and_port, &id);
-      mongoc_topology_scanner_add (topology->scanner, hl, id);
-
-      hl = hl->next;
+      _mongoc_topology_add_seeds (topology, mongoc_uri_get_hosts (uri));
    }
 
-   if (service) {
-      _mongoc_host_list_destroy_all ((mongoc_host_list_t *) hl);
-   }
+   _mongoc_topology_publish_snapshot (topology);
 
    return topology;
 }
@@ -363,6 +525,8 @@ mongoc_topology_set_apm_callbacks (mongoc_topology_t *topology,
 void
 mongoc_topology_destroy (mongoc_topology_t *topology)
 {
+   mongoc_server_session_t *server_session, *tmp;
+
    if (!topology) {
       return;
    }
@@ -370,32 +534,80 @@ mongoc_topology_destroy (mongoc_topology_t *topology)
    _mongoc_topology_background_thread_stop (topology);
    _mongoc_topology_description_monitor_closed (&topology->description);
 
+   _mongoc_array_destroy (&topology->maintenance);
+   bson_free (topology->registry_key);
    mongoc_uri_destroy (topology->uri);
+   bson_free (topology->srv_service);
    mongoc_topology_description_destroy (&topology->description);
    mongoc_topology_scanner_destroy (topology->scanner);
    mongoc_cond_destroy (&topology->cond_client);
    mongoc_cond_destroy (&topology->cond_server);
+   mongoc_cond_destroy (&topology->cond_in_flight);
    mongoc_mutex_destroy (&topology->mutex);
+   _mongoc_topology_snapshot_release (topology->snapshot);
+   bson_destroy (&topology->cluster_time);
+   mongoc_mutex_destroy (&topology->snapshot_mutex);
+
+   DL_FOREACH_SAFE (topology->session_pool, server_session, tmp)
+   {
+      _mongoc_server_session_destroy (server_session);
+   }
+
+   /* no thread may be selecting a server by now */
+   BSON_ASSERT (!topology->selectors);
 
    bson_free (topology);
 }
 
 
+typedef struct {
+   mongoc_topology_t *topology;
+   mongoc_ss_optype_t optype;
+   const mongoc_read_prefs_t *read_prefs;
+} mongoc_topology_eager_scan_t;
+
+
+/* serverSelectionEager: stop scanning once a server is suitable, or the
+ * topology is incompatible and selection fails anyway */
+static bool
+_mongoc_topology_eager_scan_done (void *ctx)
+{
+   mongoc_topology_eager_scan_t *eager = (mongoc_topology_eager_scan_t *) ctx;
+   mongoc_topology_t *topology = eager->topology;
+
+   if (!mongoc_topology_compatible (
+          &topology->description, eager->read_prefs, NULL)) {
+      return true;
+   }
+
+   return mongoc_topology_description_select (&topology->description,
+                                              eager->optype,
+                                              eager->read_prefs,
+                                              topology->local_threshold_msec) !=
+          NULL;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
  * _mongoc_topology_do_blocking_scan --
  *
  *       Monitoring entry for single-threaded use case. Assumes the caller
- *       has checked that it's the right time to scan.
+ *       has checked that it's the right time to scan. With
+ *       serverSelectionEager, return once a server is suitable for
+ *       @optype and @read_prefs, leaving the other checks running.
  *
  *--------------------------------------------------------------------------
  */
 static void
 _mongoc_topology_do_blocking_scan (mongoc_topology_t *topology,
+                                   mongoc_ss_optype_t optype,
+                                   const mongoc_read_prefs_t *read_prefs,
                                    bson_error_t *error)
 {
    mongoc_topology_scanner_t *scanner;
+   mongoc_topology_eager_scan_t eager;
 
    topology->scanner_state = MONGOC_TOPOLOGY_SCANNER_SINGLE_THREADED;
 
@@ -405,7 +617,15 @@ _mongoc_topology_do_blocking_scan (mongoc_topology_t *topology,
    mongoc_topology_scanner_start (
       scanner, (int32_t) topology->connect_timeout_msec, true);
 
-   mongoc_topology_scanner_work (topology->scanner);
+   if (topology->server_selection_eager) {
+      eager.topology = topology;
+      eager.optype = optype;
+      eager.read_prefs = read_prefs;
+      mongoc_async_run_until (
+         scanner->async, _mongoc_topology_eager_scan_done, &eager);
+   } else {
+      mongoc_topology_scanner_work (topology->scanner);
+   }
 
    mongoc_mutex_lock (&topology->mutex);
    _mongoc_topology_scanner_finish (scanner);
@@ -419,6 +639,84 @@ _mongoc_topology_do_blocking_scan (mongoc_topology_t *topology,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_finish_server_check --
+ *
+ *       Single-threaded: if an eager scan left server @server_id's check
+ *       running, wait for it, so an operation doesn't share the stream
+ *       with its isMaster.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_topology_finish_server_check (mongoc_topology_t *topology,
+                                      uint32_t server_id)
+{
+   mongoc_topology_scanner_node_t *node;
+
+   for (;;) {
+      node = mongoc_topology_scanner_get_node (topology->scanner, server_id);
+      if (!node || !mongoc_topology_scanner_node_in_progress (node)) {
+         return;
+      }
+
+      mongoc_async_run_once (topology->scanner->async, -1);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_piggyback_due --
+ *
+ *       heartbeatPiggyback: whether the caller, about to use an
+ *       application connection to server @server_id, should check the
+ *       server on it first because there's been no news from the server
+ *       for heartbeatFrequencyMS. At most one caller per interval is told
+ *       to.
+ *
+ *       NOTE: this method uses @topology's mutex.
+ *
+ *--------------------------------------------------------------------------
+ */
+bool
+_mongoc_topology_piggyback_due (mongoc_topology_t *topology,
+                                uint32_t server_id)
+{
+   mongoc_server_description_t *sd;
+   int64_t *claimed;
+   int64_t interval_usec;
+   int64_t now;
+   bool due = false;
+
+   if (!topology->heartbeat_piggyback) {
+      return false;
+   }
+
+   interval_usec = topology->description.heartbeat_msec * 1000;
+   claimed = &topology->piggyback_claimed[server_id % MONGOC_SERVER_LOAD_SLOTS];
+
+   mongoc_mutex_lock (&topology->mutex);
+   sd = mongoc_topology_description_server_by_id (
+      &topology->description, server_id, NULL);
+
+   now = bson_get_monotonic_time ();
+   if (sd && sd->type != MONGOC_SERVER_UNKNOWN &&
+       now - sd->last_update_time_usec >= interval_usec &&
+       now - *claimed >= interval_usec) {
+      *claimed = now;
+      due = true;
+   }
+
+   mongoc_mutex_unlock (&topology->mutex);
+
+   return due;
+}
+
+
 bool
 mongoc_topology_compatible (const mongoc_topology_description_t *td,
                             const mongoc_read_prefs_t *read_prefs,
@@ -539,61 +837,271 @@ mongoc_topology_select (mongoc_topology_t *topology,
    }
 }
 
+/* the load table for selection, or NULL to select uniformly at random */
+static const mongoc_server_load_t *
+_mongoc_topology_load (const mongoc_topology_t *topology)
+{
+   return topology->load_aware ? topology->load : NULL;
+}
+
+
+/* whether @a and @b, either of which may be NULL for primary, select the
+ * same servers */
+static bool
+_mongoc_topology_same_read_prefs (const mongoc_read_prefs_t *a,
+                                  const mongoc_read_prefs_t *b)
+{
+   if (!a || !b) {
+      return a == b;
+   }
+
+   /* an after cluster time only narrows a non-empty selection, so it
+    * doesn't change when selection succeeds */
+   return a->mode == b->mode &&
+          a->max_staleness_seconds == b->max_staleness_seconds &&
+          bson_equal (&a->tags, &b->tags);
+}
+
+
+/* join the group of selecting threads that need what @optype and
+ * @read_prefs select, creating it if needed. topology->mutex must be held */
+static mongoc_topology_selector_t *
+_mongoc_topology_selector_join (mongoc_topology_t *topology,
+                                mongoc_ss_optype_t optype,
+                                const mongoc_read_prefs_t *read_prefs)
+{
+   mongoc_topology_selector_t *selector;
+
+   if (optype == MONGOC_SS_WRITE ||
+       (read_prefs && read_prefs->mode == MONGOC_READ_PRIMARY)) {
+      read_prefs = NULL;
+   }
+
+   DL_FOREACH (topology->selectors, selector)
+   {
+      if (selector->optype == optype &&
+          _mongoc_topology_same_read_prefs (selector->read_prefs,
+                                            read_prefs)) {
+         selector->n_waiters++;
+         return selector;
+      }
+   }
+
+   selector = (mongoc_topology_selector_t *) bson_malloc0 (sizeof *selector);
+   selector->optype = optype;
+   selector->read_prefs = mongoc_read_prefs_copy (read_prefs);
+   mongoc_cond_init (&selector->cond);
+   selector->n_waiters = 1;
+   DL_APPEND (topology->selectors, selector);
+
+   return selector;
+}
+
+
+static void
+_mongoc_topology_selector_destroy (mongoc_topology_selector_t *selector)
+{
+   mongoc_read_prefs_destroy (selector->read_prefs);
+   mongoc_cond_destroy (&selector->cond);
+   bson_free (selector);
+}
+
+
+/* the last thread to leave a group destroys it. topology->mutex must be
+ * held */
+static void
+_mongoc_topology_selector_leave (mongoc_topology_t *topology,
+                                 mongoc_topology_selector_t *selector)
+{
+   if (--selector->n_waiters == 0) {
+      DL_DELETE (topology->selectors, selector);
+      _mongoc_topology_selector_destroy (selector);
+   }
+}
+
+
 /*
  *-------------------------------------------------------------------------
  *
- * mongoc_topology_select_server_id --
+ * _mongoc_topology_wake_selectors --
  *
- *       Alternative to mongoc_topology_select when you only need the id.
+ *       After the description changed, wake the threads waiting in server
+ *       selection whose selection now succeeds, or fails because the
+ *       topology became incompatible. Others go on waiting, so that an
+ *       update during a failover doesn't wake every thread that needs the
+ *       primary just to find there is none. Selection runs once per group
+ *       of waiters that need the same kind of server, not once per thread.
+ *
+ *       topology->mutex must be held.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_topology_wake_selectors (mongoc_topology_t *topology)
+{
+   mongoc_topology_selector_t *selector;
+
+   DL_FOREACH (topology->selectors, selector)
+   {
+      if (!mongoc_topology_compatible (
+             &topology->description, selector->read_prefs, NULL) ||
+          _mongoc_topology_description_select_r (
+             &topology->description,
+             selector->optype,
+             selector->read_prefs,
+             topology->local_threshold_msec,
+             _mongoc_topology_load (topology),
+             &topology->description.rand_seed)) {
+         mongoc_cond_broadcast (&selector->cond);
+      }
+   }
+}
+
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_topology_select_from_snapshot --
+ *
+ *       Pooled fast path for mongoc_topology_select_server_id: select from
+ *       the latest published snapshot without locking @topology's mutex.
  *
  * Returns:
- *       A server id, or 0 on failure, in which case @error will be set.
+ *       True if selection is finished: @server_id is set to the selected
+ *       server, or to 0 if the topology is incompatible with @read_prefs,
+ *       in which case @error is set. False if no server is suitable; the
+ *       caller must wait for the background thread to rescan.
  *
  *-------------------------------------------------------------------------
  */
-uint32_t
-mongoc_topology_select_server_id (mongoc_topology_t *topology,
-                                  mongoc_ss_optype_t optype,
-                                  const mongoc_read_prefs_t *read_prefs,
-                                  bson_error_t *error)
+static bool
+_mongoc_topology_select_from_snapshot (mongoc_topology_t *topology,
+                                       mongoc_ss_optype_t optype,
+                                       const mongoc_read_prefs_t *read_prefs,
+                                       int64_t local_threshold_ms,
+                                       uint32_t *server_id,
+                                       bson_error_t *error)
 {
-   static const char *timeout_msg =
-      "No suitable servers found: `serverSelectionTimeoutMS` expired";
-   int r;
-   int64_t local_threshold_ms;
-   mongoc_server_description_t *selected_server = NULL;
-   bool try_once;
-   int64_t sleep_usec;
-   bool tried_once;
-   bson_error_t scanner_error = {0};
-   int64_t heartbeat_msec;
-   uint32_t server_id;
+   /* each thread needs its own seed, the snapshot is shared and immutable */
+   static MONGOC_THREAD_LOCAL unsigned int rand_seed;
+   mongoc_topology_snapshot_t *snapshot;
+   mongoc_server_description_t *sd;
+   bool done = false;
 
-   /* These names come from the Server Selection Spec pseudocode */
-   int64_t loop_start;  /* when we entered this function */
-   int64_t loop_end;    /* when we last completed a loop (single-threaded) */
-   int64_t scan_ready;  /* the soonest we can do a blocking scan */
-   int64_t next_update; /* the latest we must do a blocking scan */
-   int64_t expire_at;   /* when server selection timeout expires */
+   *server_id = 0;
+   snapshot = _mongoc_topology_get_snapshot (topology);
+   if (!snapshot) {
+      return false;
+   }
 
-   BSON_ASSERT (topology);
-   if (!mongoc_topology_scanner_valid (topology->scanner)) {
-      mongoc_topology_scanner_get_error (topology->scanner, error);
-      error->domain = MONGOC_ERROR_SERVER_SELECTION;
-      error->code = MONGOC_ERROR_SERVER_SELECTION_FAILURE;
-      return 0;
+   if (!rand_seed) {
+      rand_seed = (unsigned int) bson_get_monotonic_time () ^
+                  (unsigned int) (uintptr_t) &rand_seed;
    }
 
-   heartbeat_msec = topology->description.heartbeat_msec;
+   if (!mongoc_topology_compatible (
+          &snapshot->description, read_prefs, error)) {
+      done = true;
+   } else {
+      sd = _mongoc_topology_description_select_r (
+         &snapshot->description,
+         optype,
+         read_prefs,
+         local_threshold_ms,
+         _mongoc_topology_load (topology),
+         &rand_seed);
+      if (sd) {
+         *server_id = sd->id;
+         done = true;
+      }
+   }
+
+   _mongoc_topology_snapshot_release (snapshot);
+
+   return done;
+}
+
+
+/* false if there are no servers to select from, and no mongodb+srv lookup is
+ * pending that could add some */
+static bool
+_mongoc_topology_has_seeds (mongoc_topology_t *topology, bson_error_t *error)
+{
+   bool ret;
+
+   mongoc_mutex_lock (&topology->mutex);
+
+   ret = topology->srv_pending ||
+         mongoc_topology_scanner_valid (topology->scanner);
+
+   if (!ret) {
+      if (topology->srv_error.code) {
+         memcpy (error, &topology->srv_error, sizeof (bson_error_t));
+      } else {
+         mongoc_topology_scanner_get_error (topology->scanner, error);
+      }
+
+      error->domain = MONGOC_ERROR_SERVER_SELECTION;
+      error->code = MONGOC_ERROR_SERVER_SELECTION_FAILURE;
+   }
+
+   mongoc_mutex_unlock (&topology->mutex);
+
+   return ret;
+}
+
+static uint32_t
+_mongoc_topology_select_server_id (mongoc_topology_t *topology,
+                                   mongoc_ss_optype_t optype,
+                                   const mongoc_read_prefs_t *read_prefs,
+                                   int64_t deadline,
+                                   bson_error_t *error)
+{
+   static const char *timeout_msg =
+      "No suitable servers found: `serverSelectionTimeoutMS` expired";
+   int r;
+   int64_t local_threshold_ms;
+   mongoc_server_description_t *selected_server = NULL;
+   mongoc_topology_selector_t *selector;
+   bool try_once;
+   int64_t sleep_usec;
+   bool tried_once;
+   bson_error_t scanner_error = {0};
+   int64_t heartbeat_msec;
+   uint32_t server_id;
+
+   /* These names come from the Server Selection Spec pseudocode */
+   int64_t loop_start;  /* when we entered this function */
+   int64_t loop_end;    /* when we last completed a loop (single-threaded) */
+   int64_t scan_ready;  /* the soonest we can do a blocking scan */
+   int64_t next_update; /* the latest we must do a blocking scan */
+   int64_t expire_at;   /* when server selection timeout expires */
+
+   BSON_ASSERT (topology);
+   if (!_mongoc_topology_has_seeds (topology, error)) {
+      return 0;
+   }
+
+   heartbeat_msec = topology->description.heartbeat_msec;
    local_threshold_ms = topology->local_threshold_msec;
    try_once = topology->server_selection_try_once;
    loop_start = loop_end = bson_get_monotonic_time ();
    expire_at =
       loop_start + ((int64_t) topology->server_selection_timeout_msec * 1000);
+   if (deadline && deadline < expire_at) {
+      /* the operation's timeoutMS expires first */
+      expire_at = deadline;
+   }
 
    if (topology->single_threaded) {
       _mongoc_topology_description_monitor_opening (&topology->description);
 
+      if (topology->scanner->async->ncmds) {
+         /* make progress on checks an eager scan left running */
+         mongoc_async_run_once (topology->scanner->async, 0);
+      }
+
       tried_once = false;
       next_update = topology->last_scan + heartbeat_msec * 1000;
       if (next_update < loop_start) {
@@ -626,7 +1134,8 @@ mongoc_topology_select_server_id (mongoc_topology_t *topology,
             }
 
             /* takes up to connectTimeoutMS. sets "last_scan", clears "stale" */
-            _mongoc_topology_do_blocking_scan (topology, &scanner_error);
+            _mongoc_topology_do_blocking_scan (
+               topology, optype, read_prefs, &scanner_error);
             loop_end = topology->last_scan;
             tried_once = true;
          }
@@ -636,8 +1145,13 @@ mongoc_topology_select_server_id (mongoc_topology_t *topology,
             return 0;
          }
 
-         selected_server = mongoc_topology_description_select (
-            &topology->description, optype, read_prefs, local_threshold_ms);
+         selected_server = _mongoc_topology_description_select_r (
+            &topology->description,
+            optype,
+            read_prefs,
+            local_threshold_ms,
+            _mongoc_topology_load (topology),
+            &topology->description.rand_seed);
 
          if (selected_server) {
             return selected_server->id;
@@ -668,7 +1182,17 @@ mongoc_topology_select_server_id (mongoc_topology_t *topology,
       }
    }
 
-   /* With background thread */
+   /* With background thread. Try the published snapshot first, without
+    * taking the topology mutex */
+   if (_mongoc_topology_select_from_snapshot (topology,
+                                              optype,
+                                              read_prefs,
+                                              local_threshold_ms,
+                                              &server_id,
+                                              error)) {
+      return server_id;
+   }
+
    /* we break out when we've found a server or timed out */
    for (;;) {
       mongoc_mutex_lock (&topology->mutex);
@@ -679,15 +1203,22 @@ mongoc_topology_select_server_id (mongoc_topology_t *topology,
          return 0;
       }
 
-      selected_server = mongoc_topology_description_select (
-         &topology->description, optype, read_prefs, local_threshold_ms);
+      selected_server = _mongoc_topology_description_select_r (
+         &topology->description,
+         optype,
+         read_prefs,
+         local_threshold_ms,
+         _mongoc_topology_load (topology),
+         &topology->description.rand_seed);
 
       if (!selected_server) {
          _mongoc_topology_request_scan (topology);
 
-         r = mongoc_cond_timedwait (&topology->cond_client,
-                                    &topology->mutex,
-                                    (expire_at - loop_start) / 1000);
+         selector =
+            _mongoc_topology_selector_join (topology, optype, read_prefs);
+         r = mongoc_cond_timedwait (
+            &selector->cond, &topology->mutex, (expire_at - loop_start) / 1000);
+         _mongoc_topology_selector_leave (topology, selector);
 
          mongoc_topology_scanner_get_error (topology->scanner, &scanner_error);
          mongoc_mutex_unlock (&topology->mutex);
@@ -726,6 +1257,200 @@ mongoc_topology_select_server_id (mongoc_topology_t *topology,
    }
 }
 
+/*
+ *-------------------------------------------------------------------------
+ *
+ * mongoc_topology_select_server_id --
+ *
+ *       Alternative to mongoc_topology_select when you only need the id.
+ *       Records the time taken in the "Server Selection" histogram.
+ *
+ * Returns:
+ *       A server id, or 0 on failure, in which case @error will be set.
+ *
+ *-------------------------------------------------------------------------
+ */
+uint32_t
+mongoc_topology_select_server_id (mongoc_topology_t *topology,
+                                  mongoc_ss_optype_t optype,
+                                  const mongoc_read_prefs_t *read_prefs,
+                                  bson_error_t *error)
+{
+   int64_t started = bson_get_monotonic_time ();
+   uint32_t server_id;
+
+   server_id = _mongoc_topology_select_server_id (
+      topology, optype, read_prefs, 0, error);
+   mongoc_histogram_server_selection_record_since (started);
+
+   return server_id;
+}
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_topology_select_server_id_until --
+ *
+ *       Like mongoc_topology_select_server_id, but give up at @deadline,
+ *       a monotonic time in microseconds, if it comes before
+ *       serverSelectionTimeoutMS expires. A @deadline of 0 means none.
+ *
+ * Returns:
+ *       A server id, or 0 on failure, in which case @error will be set.
+ *
+ *-------------------------------------------------------------------------
+ */
+uint32_t
+_mongoc_topology_select_server_id_until (mongoc_topology_t *topology,
+                                         mongoc_ss_optype_t optype,
+                                         const mongoc_read_prefs_t *read_prefs,
+                                         int64_t deadline,
+                                         bson_error_t *error)
+{
+   int64_t started = bson_get_monotonic_time ();
+   uint32_t server_id;
+
+   server_id = _mongoc_topology_select_server_id (
+      topology, optype, read_prefs, deadline, error);
+   mongoc_histogram_server_selection_record_since (started);
+
+   return server_id;
+}
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_topology_try_select_server_id --
+ *
+ *       Server selection for a pooled topology that doesn't wait for the
+ *       background thread. If no server is suitable now, request a scan
+ *       and return false; the caller retries later, until @expire_at.
+ *
+ * Returns:
+ *       True when selection is done: @server_id is set to the selected
+ *       server, or to 0 if the topology is incompatible with @read_prefs
+ *       or @expire_at has passed, in which case @error is set.
+ *
+ *-------------------------------------------------------------------------
+ */
+bool
+_mongoc_topology_try_select_server_id (mongoc_topology_t *topology,
+                                       mongoc_ss_optype_t optype,
+                                       const mongoc_read_prefs_t *read_prefs,
+                                       int64_t expire_at,
+                                       uint32_t *server_id,
+                                       bson_error_t *error)
+{
+   mongoc_server_description_t *selected_server;
+   bson_error_t scanner_error = {0};
+   bool done = false;
+
+   BSON_ASSERT (!topology->single_threaded);
+
+   *server_id = 0;
+
+   if (!_mongoc_topology_has_seeds (topology, error)) {
+      return true;
+   }
+
+   if (_mongoc_topology_select_from_snapshot (topology,
+                                              optype,
+                                              read_prefs,
+                                              topology->local_threshold_msec,
+                                              server_id,
+                                              error)) {
+      return true;
+   }
+
+   mongoc_mutex_lock (&topology->mutex);
+
+   if (!mongoc_topology_compatible (
+          &topology->description, read_prefs, error)) {
+      done = true;
+   } else {
+      selected_server = _mongoc_topology_description_select_r (
+         &topology->description,
+         optype,
+         read_prefs,
+         topology->local_threshold_msec,
+         _mongoc_topology_load (topology),
+         &topology->description.rand_seed);
+
+      if (selected_server) {
+         *server_id = selected_server->id;
+         done = true;
+      } else if (bson_get_monotonic_time () > expire_at) {
+         mongoc_topology_scanner_get_error (topology->scanner, &scanner_error);
+         _mongoc_server_selection_error (
+            "No suitable servers found: `serverSelectionTimeoutMS` expired",
+            &scanner_error,
+            error);
+         done = true;
+      } else {
+         _mongoc_topology_request_scan (topology);
+      }
+   }
+
+   mongoc_mutex_unlock (&topology->mutex);
+
+   return done;
+}
+
+/*
+ *-------------------------------------------------------------------------
+ *
+ * _mongoc_topology_select_hedge_server_id --
+ *
+ *       For a hedged read, select a server other than @exclude_id that is
+ *       suitable for @read_prefs. Does no I/O and doesn't wait for a scan.
+ *
+ * Returns:
+ *       A server id, or 0 if no other server is suitable now.
+ *
+ *-------------------------------------------------------------------------
+ */
+uint32_t
+_mongoc_topology_select_hedge_server_id (mongoc_topology_t *topology,
+                                         const mongoc_read_prefs_t *read_prefs,
+                                         uint32_t exclude_id)
+{
+   mongoc_array_t suitable_servers;
+   mongoc_server_description_t *suitable_buf[MONGOC_SS_INLINE_SERVERS];
+   mongoc_server_description_t *sd;
+   uint32_t server_id = 0;
+   size_t offset;
+   size_t i;
+
+   _mongoc_array_init_inline (&suitable_servers,
+                              sizeof (mongoc_server_description_t *),
+                              suitable_buf,
+                              sizeof suitable_buf);
+
+   mongoc_mutex_lock (&topology->mutex);
+   mongoc_topology_description_suitable_servers (
+      &suitable_servers,
+      MONGOC_SS_READ,
+      &topology->description,
+      read_prefs,
+      (size_t) topology->local_threshold_msec);
+
+   offset = (size_t) _mongoc_rand_simple (&topology->description.rand_seed);
+   for (i = 0; i < suitable_servers.len; i++) {
+      sd = _mongoc_array_index (&suitable_servers,
+                                mongoc_server_description_t *,
+                                (offset + i) % suitable_servers.len);
+      if (sd->id != exclude_id) {
+         server_id = sd->id;
+         break;
+      }
+   }
+
+   mongoc_mutex_unlock (&topology->mutex);
+   _mongoc_array_destroy (&suitable_servers);
+
+   return server_id;
+}
+
 /*
  *-------------------------------------------------------------------------
  *
@@ -738,7 +1463,8 @@ mongoc_topology_select_server_id (mongoc_topology_t *topology,
  *      NOTE: this method returns a copy of the original server
  *      description. Callers must own and clean up this copy.
  *
- *      NOTE: this method locks and unlocks @topology's mutex.
+ *      NOTE: in single-threaded mode this method locks and unlocks
+ *      @topology's mutex, in pooled mode it reads the latest snapshot.
  *
  * Returns:
  *      A mongoc_server_description_t, or NULL.
@@ -754,8 +1480,20 @@ mongoc_topology_server_by_id (mongoc_topology_t *topology,
                               uint32_t id,
                               bson_error_t *error)
 {
+   mongoc_topology_snapshot_t *snapshot;
    mongoc_server_description_t *sd;
 
+   snapshot = _mongoc_topology_get_snapshot (topology);
+   if (snapshot) {
+      sd = mongoc_server_description_new_copy (
+         mongoc_topology_description_server_by_id (
+            &snapshot->description, id, error));
+
+      _mongoc_topology_snapshot_release (snapshot);
+
+      return sd;
+   }
+
    mongoc_mutex_lock (&topology->mutex);
 
    sd = mongoc_server_description_new_copy (
@@ -814,6 +1552,30 @@ _mongoc_topology_host_by_id (mongoc_topology_t *topology,
    return host;
 }
 
+/* copy the counters reference of the server with @id, or zero it */
+void
+_mongoc_topology_server_counters (mongoc_topology_t *topology,
+                                  uint32_t id,
+                                  mongoc_server_counters_ref_t *ref /* OUT */)
+{
+   mongoc_server_description_t *sd;
+
+   memset (ref, 0, sizeof *ref);
+
+   mongoc_mutex_lock (&topology->mutex);
+
+   /* not a copy - direct pointer into topology description data */
+   sd = mongoc_topology_description_server_by_id (
+      &topology->description, id, NULL);
+
+   if (sd) {
+      ref->slot = sd->counters.slot;
+      ref->generation = sd->counters.generation;
+   }
+
+   mongoc_mutex_unlock (&topology->mutex);
+}
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -849,11 +1611,16 @@ mongoc_topology_invalidate_server (mongoc_topology_t *topology,
                                    uint32_t id,
                                    const bson_error_t *error)
 {
+   mongoc_server_description_type_t old_type;
+
    BSON_ASSERT (error);
 
    mongoc_mutex_lock (&topology->mutex);
+   old_type = _mongoc_topology_server_type (topology, id);
    mongoc_topology_description_invalidate_server (
       &topology->description, id, error);
+   _mongoc_topology_note_server_type (topology, id, old_type);
+   _mongoc_topology_publish_snapshot (topology);
    mongoc_mutex_unlock (&topology->mutex);
 }
 
@@ -877,25 +1644,32 @@ bool
 _mongoc_topology_update_from_handshake (mongoc_topology_t *topology,
                                         const mongoc_server_description_t *sd)
 {
+   bson_error_t error;
    bool has_server;
+   mongoc_server_description_type_t old_type;
 
    BSON_ASSERT (topology);
    BSON_ASSERT (sd);
 
    mongoc_mutex_lock (&topology->mutex);
 
-   mongoc_topology_description_handle_ismaster (&topology->description,
-                                                sd->id,
-                                                &sd->last_is_master,
-                                                sd->round_trip_time_msec,
-                                                NULL);
+   if (_mongoc_topology_breaker_admit (topology, sd->id, &error)) {
+      old_type = _mongoc_topology_server_type (topology, sd->id);
+      mongoc_topology_description_handle_ismaster (&topology->description,
+                                                   sd->id,
+                                                   &sd->last_is_master,
+                                                   sd->round_trip_time_msec,
+                                                   NULL);
+      _mongoc_topology_note_server_type (topology, sd->id, old_type);
+      _mongoc_topology_publish_snapshot (topology);
+   }
 
    /* return false if server was removed from topology */
    has_server = mongoc_topology_description_server_by_id (
                    &topology->description, sd->id, NULL) != NULL;
 
-   /* if pooled, wake threads waiting in mongoc_topology_server_by_id */
-   mongoc_cond_broadcast (&topology->cond_client);
+   /* if pooled, wake threads waiting in server selection */
+   _mongoc_topology_wake_selectors (topology);
    mongoc_mutex_unlock (&topology->mutex);
 
    return has_server;
@@ -941,7 +1715,8 @@ mongoc_topology_server_timestamp (mongoc_topology_t *topology, uint32_t id)
  *
  *      Return the topology's description's type.
  *
- *      NOTE: this method uses @topology's mutex.
+ *      NOTE: this method uses @topology's mutex, or in pooled mode the
+ *      latest snapshot.
  *
  * Returns:
  *      The topology description type.
@@ -951,8 +1726,17 @@ mongoc_topology_server_timestamp (mongoc_topology_t *topology, uint32_t id)
 mongoc_topology_description_type_t
 _mongoc_topology_get_type (mongoc_topology_t *topology)
 {
+   mongoc_topology_snapshot_t *snapshot;
    mongoc_topology_description_type_t td_type;
 
+   snapshot = _mongoc_topology_get_snapshot (topology);
+   if (snapshot) {
+      td_type = snapshot->description.type;
+      _mongoc_topology_snapshot_release (snapshot);
+
+      return td_type;
+   }
+
    mongoc_mutex_lock (&topology->mutex);
 
    td_type = topology->description.type;
@@ -965,120 +1749,302 @@ _mongoc_topology_get_type (mongoc_topology_t *topology)
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_topology_run_background --
+ * _mongoc_topology_poll_srv --
  *
- *       The background topology monitoring thread runs in this loop.
+ *       Look up a mongodb+srv topology's SRV records, on the background
+ *       thread between scans. The first lookup seeds the topology. Later,
+ *       if the topology is Unknown or Sharded, servers are added and removed
+ *       to match the records, so mongos added to a cluster are discovered;
+ *       the next scan checks new servers. A failed poll changes nothing.
  *
  *       NOTE: this method uses @topology's mutex.
  *
  *--------------------------------------------------------------------------
  */
-static void *
-_mongoc_topology_run_background (void *data)
+static void
+_mongoc_topology_poll_srv (mongoc_topology_t *topology)
 {
-   mongoc_topology_t *topology;
-   int64_t now;
-   int64_t last_scan;
-   int64_t timeout;
-   int64_t force_timeout;
-   int64_t heartbeat_msec;
-   int r;
+   mongoc_topology_scanner_node_t *node, *tmp;
+   mongoc_topology_description_t *td;
+   mongoc_server_description_t *sd;
+   mongoc_host_list_t *hosts;
+   bson_error_t error;
+   bool poll;
+   size_t i;
 
-   BSON_ASSERT (data);
+   td = &topology->description;
 
-   last_scan = 0;
-   topology = (mongoc_topology_t *) data;
-   heartbeat_msec = topology->description.heartbeat_msec;
+   mongoc_mutex_lock (&topology->mutex);
+   poll = !td->servers->items_len || td->type == MONGOC_TOPOLOGY_UNKNOWN ||
+          td->type == MONGOC_TOPOLOGY_SHARDED;
+   mongoc_mutex_unlock (&topology->mutex);
 
-   /* we exit this loop when shutdown_requested, or on error */
-   for (;;) {
-      /* unlocked after starting a scan or after breaking out of the loop */
-      mongoc_mutex_lock (&topology->mutex);
+   if (!poll) {
+      return;
+   }
 
-      /* we exit this loop on error, or when we should scan immediately */
-      for (;;) {
-         if (topology->shutdown_requested)
-            goto DONE;
+   /* don't hold the lock while waiting for DNS */
+   hosts = _mongoc_client_get_srv (topology->srv_service, &error);
 
-         now = bson_get_monotonic_time ();
+   mongoc_mutex_lock (&topology->mutex);
 
-         if (last_scan == 0) {
-            /* set up the "last scan" as exactly long enough to force an
-             * immediate scan on the first pass */
-            last_scan = now - (heartbeat_msec * 1000);
+   if (!hosts) {
+      if (topology->srv_pending) {
+         memcpy (&topology->srv_error, &error, sizeof (bson_error_t));
+      }
+   } else if (!td->servers->items_len) {
+      /* the first successful lookup */
+      memset (&topology->srv_error, 0, sizeof (bson_error_t));
+      _mongoc_topology_add_seeds (topology, hosts);
+   } else {
+      _mongoc_topology_description_reconcile (td, hosts);
+
+      /* like mongoc_topology_reconcile, but no scan is in progress to join:
+       * the next scan checks new nodes */
+      for (i = 0; i < td->servers->items_len; i++) {
+         sd = (mongoc_server_description_t *) mongoc_set_get_item (
+            td->servers, (int) i);
+         if (!mongoc_topology_scanner_get_node (topology->scanner, sd->id)) {
+            mongoc_topology_scanner_add (topology->scanner, &sd->host, sd->id);
          }
+      }
 
-         timeout = heartbeat_msec - ((now - last_scan) / 1000);
-
-         /* if someone's specifically asked for a scan, use a shorter interval
-          */
-         if (topology->scan_requested) {
-            force_timeout = MONGOC_TOPOLOGY_MIN_HEARTBEAT_FREQUENCY_MS -
-                            ((now - last_scan) / 1000);
-
-            timeout = BSON_MIN (timeout, force_timeout);
+      DL_FOREACH_SAFE (topology->scanner->nodes, node, tmp)
+      {
+         if (!mongoc_topology_description_server_by_id (td, node->id, NULL)) {
+            mongoc_topology_scanner_node_destroy (node, false);
          }
+      }
+   }
 
-         /* if we can start scanning, do so immediately */
-         if (timeout <= 0) {
-            mongoc_topology_scanner_start (
-               topology->scanner, topology->connect_timeout_msec, false);
-            break;
-         } else {
-            /* otherwise wait until someone:
-             *   o requests a scan
-             *   o we time out
-             *   o requests a shutdown
-             */
-            r = mongoc_cond_timedwait (
-               &topology->cond_server, &topology->mutex, timeout);
-
-#ifdef _WIN32
-            if (!(r == 0 || r == WSAETIMEDOUT)) {
-#else
-            if (!(r == 0 || r == ETIMEDOUT)) {
-#endif
-               /* handle errors */
-               goto DONE;
-            }
+   topology->srv_pending = false;
+   _mongoc_topology_publish_snapshot (topology);
+   _mongoc_topology_wake_selectors (topology);
+   mongoc_mutex_unlock (&topology->mutex);
 
-            /* if we timed out, or were woken up, check if it's time to scan
-             * again, or bail out */
-         }
-      }
+   _mongoc_host_list_destroy_all (hosts);
+}
 
-      topology->scan_requested = false;
 
-      /* scanning locks and unlocks the mutex itself until the scan is done */
-      mongoc_mutex_unlock (&topology->mutex);
-      mongoc_topology_scanner_work (topology->scanner);
+/* call this while already holding the lock. start checking each server
+ * that's due: its last check finished @interval_msec ago, or its circuit
+ * breaker's open period is over and it should be probed. checks already
+ * running are left alone. returns when the next server is due, in usec */
+static int64_t
+_mongoc_topology_check_due_servers (mongoc_topology_t *topology,
+                                    int64_t now,
+                                    int64_t interval_msec)
+{
+   mongoc_topology_scanner_t *scanner = topology->scanner;
+   mongoc_topology_scanner_node_t *node, *tmp;
+   mongoc_server_description_t *sd;
+   mongoc_server_breaker_t *breaker;
+   int64_t next_due = INT64_MAX;
+   int64_t due;
 
-      mongoc_mutex_lock (&topology->mutex);
+   DL_FOREACH_SAFE (scanner->nodes, node, tmp)
+   {
+      if (node->retired || mongoc_topology_scanner_node_in_progress (node)) {
+         continue;
+      }
 
-      _mongoc_topology_scanner_finish (topology->scanner);
-      /* "retired" nodes can be checked again in the next scan */
-      mongoc_topology_scanner_reset (topology->scanner);
+      due = node->last_checked ? node->last_checked + interval_msec * 1000 : 0;
+
+      if (topology->heartbeat_piggyback && node->last_checked) {
+         sd = mongoc_topology_description_server_by_id (
+            &topology->description, node->id, NULL);
+
+         /* an application connection updated the server since our check.
+          * give application connections a whole extra interval to check
+          * it again before we reconnect and check it ourselves */
+         if (sd && sd->type != MONGOC_SERVER_UNKNOWN &&
+             sd->last_update_time_usec > node->last_checked) {
+            due = sd->last_update_time_usec + 2 * interval_msec * 1000;
+            if (node->stream) {
+               mongoc_topology_scanner_node_disconnect (node, false);
+               node->closed_idle = true;
+               node->last_used = -1; /* handshake the next stream */
+            }
+         }
+      }
 
-      topology->last_scan = bson_get_monotonic_time ();
-      mongoc_mutex_unlock (&topology->mutex);
+      if (topology->breaker_threshold) {
+         breaker = &topology->breakers[node->id % MONGOC_SERVER_LOAD_SLOTS];
+         if (breaker->open_until_usec) {
+            due = BSON_MIN (due, breaker->open_until_usec);
+         }
+      }
 
-      last_scan = bson_get_monotonic_time ();
+      if (due <= now) {
+         /* if setup fails the failure is reported at once */
+         mongoc_topology_scanner_scan (
+            scanner, node->id, topology->connect_timeout_msec);
+      } else {
+         next_due = BSON_MIN (next_due, due);
+      }
    }
 
-DONE:
-   mongoc_mutex_unlock (&topology->mutex);
+   return next_due;
+}
 
-   return NULL;
+
+/* call this while already holding the lock */
+static bool
+_mongoc_topology_is_unstable (mongoc_topology_t *topology, int64_t now)
+{
+   return topology->description.type == MONGOC_TOPOLOGY_RS_NO_PRIMARY ||
+          now < topology->unstable_until;
 }
 
+
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_topology_start_background_scanner
+ * _mongoc_topology_run_background --
  *
- *       Start the topology background thread running. This should only be
- *       called once per pool. If clients are created separately (not
- *       through a pool) the SDAM logic will not be run in a background
+ *       The background topology monitoring thread runs in this loop.
+ *
+ *       NOTE: this method uses @topology's mutex.
+ *
+ *--------------------------------------------------------------------------
+ */
+static void *
+_mongoc_topology_run_background (void *data)
+{
+   mongoc_topology_t *topology;
+   mongoc_topology_maintenance_t *maintenance;
+   mongoc_array_t reaped;
+   int64_t now;
+   int64_t next_due;
+   int64_t interval_msec;
+   int64_t heartbeat_msec;
+   int64_t last_srv_poll;
+   int64_t last_maintenance;
+   int64_t timeout;
+   size_t i;
+   int r;
+
+   BSON_ASSERT (data);
+
+   last_srv_poll = 0;
+   last_maintenance = 0;
+   topology = (mongoc_topology_t *) data;
+   _mongoc_array_init (&reaped, sizeof (mongoc_cluster_node_t *));
+   heartbeat_msec = topology->description.heartbeat_msec;
+
+   /* each server is checked on its own schedule, and each result is applied
+    * as soon as it arrives, so an unreachable server doesn't hold back the
+    * others' checks. we exit this loop when shutdown_requested, or on
+    * error */
+   for (;;) {
+      /* srv_service and srv_rescan_msec don't change after topology_new */
+      if (topology->srv_service &&
+          (!last_srv_poll || bson_get_monotonic_time () - last_srv_poll >=
+                                topology->srv_rescan_msec * 1000)) {
+         _mongoc_topology_poll_srv (topology);
+         last_srv_poll = bson_get_monotonic_time ();
+      }
+
+      mongoc_mutex_lock (&topology->mutex);
+
+      if (topology->shutdown_requested) {
+         goto DONE;
+      }
+
+      now = bson_get_monotonic_time ();
+
+      /* if someone's specifically asked for a scan, or there's no primary
+       * or a server just changed type, use a shorter interval */
+      interval_msec = heartbeat_msec;
+      if (topology->scan_requested ||
+          _mongoc_topology_is_unstable (topology, now)) {
+         interval_msec = MONGOC_TOPOLOGY_MIN_HEARTBEAT_FREQUENCY_MS;
+      }
+
+      /* servers checked less than interval_msec ago are fresh enough */
+      next_due =
+         _mongoc_topology_check_due_servers (topology, now, interval_msec);
+      topology->scan_requested = false;
+
+      timeout = next_due == INT64_MAX ? heartbeat_msec
+                                      : BSON_MAX (next_due - now, 0) / 1000;
+
+      if (!topology->scanner->async->ncmds) {
+         /* nothing in progress: wait until someone:
+          *   o requests a scan
+          *   o a server is due
+          *   o requests a shutdown
+          */
+         r = mongoc_cond_timedwait (
+            &topology->cond_server, &topology->mutex, BSON_MAX (timeout, 1));
+
+#ifdef _WIN32
+         if (!(r == 0 || r == WSAETIMEDOUT)) {
+#else
+         if (!(r == 0 || r == ETIMEDOUT)) {
+#endif
+            /* handle errors */
+            goto DONE;
+         }
+
+         mongoc_mutex_unlock (&topology->mutex);
+         continue;
+      }
+
+      /* checks lock and unlock the mutex themselves as results arrive. wake
+       * up at least every MONGOC_TOPOLOGY_MIN_HEARTBEAT_FREQUENCY_MS for
+       * scan requests and shutdown */
+      mongoc_mutex_unlock (&topology->mutex);
+      mongoc_async_run_once (
+         topology->scanner->async,
+         (int32_t) BSON_MIN (timeout,
+                             MONGOC_TOPOLOGY_MIN_HEARTBEAT_FREQUENCY_MS));
+
+      mongoc_mutex_lock (&topology->mutex);
+
+      _mongoc_topology_scanner_finish (topology->scanner);
+      /* "retired" nodes are destroyed once their checks are done */
+      mongoc_topology_scanner_reset (topology->scanner);
+
+      now = bson_get_monotonic_time ();
+      if (topology->maintenance.len &&
+          now - last_maintenance >= heartbeat_msec * 1000) {
+         for (i = 0; i < topology->maintenance.len; i++) {
+            maintenance = &_mongoc_array_index (
+               &topology->maintenance, mongoc_topology_maintenance_t, i);
+            maintenance->cb (maintenance->ctx, &reaped);
+         }
+
+         last_maintenance = now;
+      }
+
+      topology->last_scan = now;
+      mongoc_mutex_unlock (&topology->mutex);
+
+      /* closing a connection may block, e.g. on a TLS shutdown */
+      for (i = 0; i < reaped.len; i++) {
+         _mongoc_cluster_node_destroy (
+            _mongoc_array_index (&reaped, mongoc_cluster_node_t *, i));
+      }
+
+      reaped.len = 0;
+   }
+
+DONE:
+   mongoc_mutex_unlock (&topology->mutex);
+   _mongoc_array_destroy (&reaped);
+
+   return NULL;
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_topology_start_background_scanner
+ *
+ *       Start the topology background thread running. This should only be
+ *       called once per pool. If clients are created separately (not
+ *       through a pool) the SDAM logic will not be run in a background
  *       thread. Returns whether or not the scanner is running on termination
  *       of the function.
  *
@@ -1102,9 +2068,12 @@ _mongoc_topology_start_background_scanner (mongoc_topology_t *topology)
 
       _mongoc_handshake_freeze ();
       _mongoc_topology_description_monitor_opening (&topology->description);
+      _mongoc_topology_publish_snapshot (topology);
 
-      r = mongoc_thread_create (
-         &topology->thread, _mongoc_topology_run_background, topology);
+      r = _mongoc_thread_create (MONGOC_THREAD_TOPOLOGY_MONITOR,
+                                 &topology->thread,
+                                 _mongoc_topology_run_background,
+                                 topology);
 
       if (r != 0) {
          MONGOC_ERROR ("could not start topology scanner thread: %s",
@@ -1167,6 +2136,71 @@ _mongoc_topology_background_thread_stop (mongoc_topology_t *topology)
    }
 }
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_reset_after_fork --
+ *
+ *       In a child process after fork, where only the forking thread
+ *       runs. Reinitialize the locks, which the parent's threads may have
+ *       held, forget the parent's operations in progress and its server
+ *       sessions, which the parent goes on using, and reset the scanner.
+ *       The description and the published snapshot are kept. If the
+ *       background thread was running, start a new one.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_topology_reset_after_fork (mongoc_topology_t *topology)
+{
+   mongoc_server_session_t *server_session, *tmp;
+   mongoc_topology_selector_t *selector, *selector_tmp;
+   bool was_running;
+   int i;
+
+   mongoc_mutex_init (&topology->mutex);
+   mongoc_mutex_init (&topology->snapshot_mutex);
+   mongoc_cond_init (&topology->cond_client);
+   mongoc_cond_init (&topology->cond_server);
+   mongoc_cond_init (&topology->cond_in_flight);
+
+   was_running = topology->scanner_state != MONGOC_TOPOLOGY_SCANNER_OFF;
+   topology->scanner_state = MONGOC_TOPOLOGY_SCANNER_OFF;
+   topology->shutdown_requested = false;
+
+   for (i = 0; i < MONGOC_SERVER_LOAD_SLOTS; i++) {
+      topology->load[i].in_flight = 0;
+      topology->in_flight[i] = 0;
+   }
+
+   topology->in_flight_waiters = 0;
+
+   /* the parent's selecting threads don't run here. like the topology's,
+    * their conditions aren't destroyed */
+   DL_FOREACH_SAFE (topology->selectors, selector, selector_tmp)
+   {
+      mongoc_read_prefs_destroy (selector->read_prefs);
+      bson_free (selector);
+   }
+
+   topology->selectors = NULL;
+
+   /* not ended: two processes must not use a session at once */
+   DL_FOREACH_SAFE (topology->session_pool, server_session, tmp)
+   {
+      _mongoc_server_session_destroy (server_session);
+   }
+
+   topology->session_pool = NULL;
+
+   _mongoc_topology_scanner_reset_after_fork (topology->scanner);
+
+   if (was_running) {
+      _mongoc_topology_start_background_scanner (topology);
+   }
+}
+
 bool
 _mongoc_topology_set_appname (mongoc_topology_t *topology, const char *appname)
 {
@@ -1182,6 +2216,103 @@ _mongoc_topology_set_appname (mongoc_topology_t *topology, const char *appname)
    return ret;
 }
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_set_maintenance_cb --
+ *
+ *       Internal function. Register a callback the background thread runs
+ *       with @ctx after each scan, with @topology's mutex held; a client
+ *       pool uses it to expire idle connections. Each @ctx has at most one
+ *       callback, since pools may share a topology. Pass a NULL @cb to
+ *       unregister @ctx's: once this returns the callback is not running
+ *       and won't be called again.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_topology_set_maintenance_cb (mongoc_topology_t *topology,
+                                     mongoc_topology_maintenance_cb_t cb,
+                                     void *ctx)
+{
+   mongoc_topology_maintenance_t *maintenance;
+   mongoc_topology_maintenance_t entry;
+   size_t i;
+
+   mongoc_mutex_lock (&topology->mutex);
+
+   for (i = 0; i < topology->maintenance.len; i++) {
+      maintenance = &_mongoc_array_index (
+         &topology->maintenance, mongoc_topology_maintenance_t, i);
+      if (maintenance->ctx == ctx) {
+         /* unregister, keep the others in order */
+         memmove (maintenance,
+                  maintenance + 1,
+                  (topology->maintenance.len - i - 1) * sizeof *maintenance);
+         topology->maintenance.len--;
+         break;
+      }
+   }
+
+   if (cb) {
+      entry.cb = cb;
+      entry.ctx = ctx;
+      _mongoc_array_append_val (&topology->maintenance, entry);
+   }
+
+   mongoc_mutex_unlock (&topology->mutex);
+}
+
+/* a $clusterTime's timestamp and increment, ordered like the pair */
+static uint64_t
+_mongoc_cluster_time_pack (uint32_t timestamp, uint32_t increment)
+{
+   return ((uint64_t) timestamp << 32) | increment;
+}
+
+
+static uint64_t
+_mongoc_topology_cluster_time_seen (mongoc_topology_t *topology)
+{
+   return (uint64_t) bson_atomic_int64_add (&topology->cluster_time_seen, 0);
+}
+
+
+/* if the description's $clusterTime has advanced, record it for the
+ * unlocked check in _mongoc_topology_update_cluster_time, and in pooled
+ * mode copy it for _mongoc_topology_get_cluster_time. call with the mutex
+ * held */
+static void
+_mongoc_topology_publish_cluster_time (mongoc_topology_t *topology)
+{
+   mongoc_topology_description_t *td = &topology->description;
+   uint64_t seen;
+   uint64_t latest;
+
+   /* the mutex makes this the only writer */
+   seen = _mongoc_topology_cluster_time_seen (topology);
+   latest = _mongoc_cluster_time_pack (td->cluster_time_t, td->cluster_time_i);
+   if (latest > seen) {
+      bson_atomic_int64_add (&topology->cluster_time_seen,
+                             (int64_t) (latest - seen));
+   }
+
+   if (topology->single_threaded ||
+       (td->cluster_time_t == topology->cluster_time_t &&
+        td->cluster_time_i == topology->cluster_time_i)) {
+      return;
+   }
+
+   mongoc_mutex_lock (&topology->snapshot_mutex);
+   topology->cluster_time_t = td->cluster_time_t;
+   topology->cluster_time_i = td->cluster_time_i;
+   bson_reinit (&topology->cluster_time);
+   bson_concat (&topology->cluster_time, &td->cluster_time);
+   mongoc_mutex_unlock (&topology->snapshot_mutex);
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1198,8 +2329,513 @@ void
 _mongoc_topology_update_cluster_time (mongoc_topology_t *topology,
                                       const bson_t *reply)
 {
+   bson_iter_t iter;
+   bson_iter_t child;
+   uint32_t timestamp;
+   uint32_t increment;
+
+   if (!reply || !bson_iter_init_find (&iter, reply, "$clusterTime")) {
+      return;
+   }
+
+   /* most replies repeat a $clusterTime already seen, compare it without
+    * the mutex. the description logs any we can't parse */
+   if (BSON_ITER_HOLDS_DOCUMENT (&iter) && bson_iter_recurse (&iter, &child) &&
+       bson_iter_find (&child, "clusterTime") &&
+       BSON_ITER_HOLDS_TIMESTAMP (&child)) {
+      bson_iter_timestamp (&child, &timestamp, &increment);
+      if (_mongoc_cluster_time_pack (timestamp, increment) <=
+          _mongoc_topology_cluster_time_seen (topology)) {
+         return;
+      }
+   }
+
    mongoc_mutex_lock (&topology->mutex);
    mongoc_topology_description_update_cluster_time (&topology->description,
                                                     reply);
+   _mongoc_topology_publish_cluster_time (topology);
    mongoc_mutex_unlock (&topology->mutex);
 }
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_publish_snapshot --
+ *
+ *       Pooled mode: copy the current topology description into a new
+ *       immutable snapshot and make it the one server selection reads.
+ *       Threads still holding the previous snapshot keep using it until
+ *       they release it.
+ *
+ *       NOTE: call this with @topology's mutex held, after each change to
+ *       @topology->description that affects server selection. Does nothing
+ *       in single-threaded mode.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_topology_publish_snapshot (mongoc_topology_t *topology)
+{
+   mongoc_topology_snapshot_t *snapshot;
+   mongoc_topology_snapshot_t *old;
+
+   if (topology->single_threaded) {
+      return;
+   }
+
+   snapshot = (mongoc_topology_snapshot_t *) _mongoc_malloc0_tagged (
+      MONGOC_MEMORY_TAG_TOPOLOGY, sizeof *snapshot);
+   snapshot->ref_count = 1;
+   _mongoc_topology_description_copy_to (&topology->description,
+                                         &snapshot->description);
+   snapshot->description.rand_seed = topology->description.rand_seed;
+
+   mongoc_mutex_lock (&topology->snapshot_mutex);
+   old = topology->snapshot;
+   topology->snapshot = snapshot;
+   mongoc_mutex_unlock (&topology->snapshot_mutex);
+
+   _mongoc_topology_snapshot_release (old);
+
+   /* an isMaster reply may have advanced it */
+   _mongoc_topology_publish_cluster_time (topology);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_get_snapshot --
+ *
+ *       Return a reference to the latest published snapshot, or NULL in
+ *       single-threaded mode. Release it with
+ *       _mongoc_topology_snapshot_release. Does not lock @topology's mutex.
+ *
+ *--------------------------------------------------------------------------
+ */
+mongoc_topology_snapshot_t *
+_mongoc_topology_get_snapshot (mongoc_topology_t *topology)
+{
+   mongoc_topology_snapshot_t *snapshot;
+
+   mongoc_mutex_lock (&topology->snapshot_mutex);
+   snapshot = topology->snapshot;
+   if (snapshot) {
+      bson_atomic_int_add (&snapshot->ref_count, 1);
+   }
+   mongoc_mutex_unlock (&topology->snapshot_mutex);
+
+   return snapshot;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_snapshot_release --
+ *
+ *       Drop a reference to @snapshot, freeing it with the last reference.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_topology_snapshot_release (mongoc_topology_snapshot_t *snapshot)
+{
+   if (!snapshot) {
+      return;
+   }
+
+   if (bson_atomic_int_add (&snapshot->ref_count, -1) == 0) {
+      mongoc_topology_description_destroy (&snapshot->description);
+      _mongoc_free_tagged (MONGOC_MEMORY_TAG_TOPOLOGY, snapshot);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_get_cluster_time --
+ *
+ *       Pooled mode: append the latest $clusterTime's fields to
+ *       @cluster_time, an empty document. Does not lock @topology's mutex.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_topology_get_cluster_time (mongoc_topology_t *topology,
+                                   bson_t *cluster_time)
+{
+   BSON_ASSERT (!topology->single_threaded);
+
+   /* no $clusterTime yet, e.g. not connected to a replica set or mongos */
+   if (!_mongoc_topology_cluster_time_seen (topology)) {
+      return;
+   }
+
+   mongoc_mutex_lock (&topology->snapshot_mutex);
+   bson_concat (cluster_time, &topology->cluster_time);
+   mongoc_mutex_unlock (&topology->snapshot_mutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_load_begin --
+ *
+ *       Count an operation starting on server @server_id, if the
+ *       serverSelectionLoadAware option is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_topology_load_begin (mongoc_topology_t *topology, uint32_t server_id)
+{
+   if (topology->load_aware) {
+      bson_atomic_int_add (
+         &topology->load[server_id % MONGOC_SERVER_LOAD_SLOTS].in_flight, 1);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_breaker_success --
+ *
+ *       A reply arrived from server @server_id, reset its count of
+ *       network errors in a row, if circuitBreakerThreshold is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_topology_breaker_success (mongoc_topology_t *topology,
+                                  uint32_t server_id)
+{
+   mongoc_server_breaker_t *breaker;
+
+   if (!topology->breaker_threshold) {
+      return;
+   }
+
+   breaker = &topology->breakers[server_id % MONGOC_SERVER_LOAD_SLOTS];
+   if (breaker->failures) {
+      breaker->failures = 0;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_breaker_failure --
+ *
+ *       An operation on server @server_id failed with network error @why.
+ *       After circuitBreakerThreshold of these in a row, open the server's
+ *       circuit breaker: mark it Unknown so server selection skips it, and
+ *       ignore its isMaster replies for circuitBreakerOpenMS. A pooled
+ *       topology's background thread probes it right after that.
+ *
+ *       NOTE: this method uses @topology's mutex.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_topology_breaker_failure (mongoc_topology_t *topology,
+                                  uint32_t server_id,
+                                  const bson_error_t *why)
+{
+   mongoc_server_breaker_t *breaker;
+   bson_error_t error;
+
+   if (!topology->breaker_threshold) {
+      return;
+   }
+
+   breaker = &topology->breakers[server_id % MONGOC_SERVER_LOAD_SLOTS];
+
+   /* only the failure that reaches the threshold opens the breaker */
+   if (bson_atomic_int_add (&breaker->failures, 1) !=
+       topology->breaker_threshold) {
+      return;
+   }
+
+   bson_set_error (&error,
+                   MONGOC_ERROR_STREAM,
+                   MONGOC_ERROR_STREAM_SOCKET,
+                   "Circuit breaker opened after %d network errors: %s",
+                   topology->breaker_threshold,
+                   why->message);
+
+   mongoc_mutex_lock (&topology->mutex);
+   breaker->open_until_usec =
+      bson_get_monotonic_time () + topology->breaker_open_msec * 1000;
+   mongoc_topology_description_invalidate_server (
+      &topology->description, server_id, &error);
+   _mongoc_topology_publish_snapshot (topology);
+
+   /* the background thread recalculates when to scan next */
+   mongoc_cond_signal (&topology->cond_server);
+   mongoc_mutex_unlock (&topology->mutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_in_flight_admit --
+ *
+ *       Count a server stream checked out for server @server_id, if the
+ *       maxInFlightPerServer option is set. If the server is at its limit,
+ *       fail at once when inFlightFailFast is set, else wait up to
+ *       serverSelectionTimeoutMS for another checkout to be released.
+ *
+ * Returns:
+ *       True if admitted; the caller must call
+ *       _mongoc_topology_in_flight_release. Otherwise false and @error is
+ *       set to MONGOC_ERROR_CLIENT_SERVER_BUSY.
+ *
+ *       NOTE: this method uses @topology's mutex if it waits.
+ *
+ *--------------------------------------------------------------------------
+ */
+bool
+_mongoc_topology_in_flight_admit (mongoc_topology_t *topology,
+                                  uint32_t server_id,
+                                  bson_error_t *error)
+{
+   volatile int32_t *in_flight;
+   int64_t expire_at;
+   int64_t remaining_msec;
+   bool r = true;
+
+   if (!topology->max_in_flight) {
+      return true;
+   }
+
+   in_flight = &topology->in_flight[server_id % MONGOC_SERVER_LOAD_SLOTS];
+
+   /* fast path: no lock unless the server is at its limit */
+   if (bson_atomic_int_add (in_flight, 1) <= topology->max_in_flight) {
+      return true;
+   }
+
+   bson_atomic_int_add (in_flight, -1);
+
+   if (topology->in_flight_fail_fast) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_SERVER_BUSY,
+                      "Server %u already has %d operations in flight",
+                      server_id,
+                      topology->max_in_flight);
+      return false;
+   }
+
+   expire_at = bson_get_monotonic_time () +
+               topology->server_selection_timeout_msec * 1000;
+
+   mongoc_mutex_lock (&topology->mutex);
+   /* count ourselves before retrying, so a release that misses our retry
+    * sees us waiting and signals */
+   bson_atomic_int_add (&topology->in_flight_waiters, 1);
+
+   while (bson_atomic_int_add (in_flight, 1) > topology->max_in_flight) {
+      bson_atomic_int_add (in_flight, -1);
+
+      remaining_msec = (expire_at - bson_get_monotonic_time ()) / 1000;
+      if (remaining_msec <= 0) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_SERVER_BUSY,
+                         "Timed out after %" PRId64 "ms waiting for one of"
+                         " %d operations in flight on server %u",
+                         topology->server_selection_timeout_msec,
+                         topology->max_in_flight,
+                         server_id);
+         r = false;
+         break;
+      }
+
+      mongoc_cond_timedwait (
+         &topology->cond_in_flight, &topology->mutex, remaining_msec);
+   }
+
+   bson_atomic_int_add (&topology->in_flight_waiters, -1);
+   mongoc_mutex_unlock (&topology->mutex);
+
+   return r;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_in_flight_release --
+ *
+ *       A server stream admitted by _mongoc_topology_in_flight_admit was
+ *       released, wake any threads waiting to check out a stream.
+ *
+ *       NOTE: this method uses @topology's mutex if threads are waiting.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_topology_in_flight_release (mongoc_topology_t *topology,
+                                    uint32_t server_id)
+{
+   if (!topology->max_in_flight) {
+      return;
+   }
+
+   bson_atomic_int_add (
+      &topology->in_flight[server_id % MONGOC_SERVER_LOAD_SLOTS], -1);
+
+   /* waiters may be waiting for other servers, wake them all */
+   if (bson_atomic_int_add (&topology->in_flight_waiters, 0)) {
+      mongoc_mutex_lock (&topology->mutex);
+      mongoc_cond_broadcast (&topology->cond_in_flight);
+      mongoc_mutex_unlock (&topology->mutex);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_load_end --
+ *
+ *       Count an operation on server @server_id as finished, and fold its
+ *       latency since @started (from bson_get_monotonic_time) into the
+ *       server's moving average.
+ *
+ *       Threads race to store the average; a lost update only costs one
+ *       sample, the table is a heuristic for selection.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_topology_load_end (mongoc_topology_t *topology,
+                           uint32_t server_id,
+                           int64_t started)
+{
+   mongoc_server_load_t *slot;
+   int64_t latency_usec;
+   int32_t avg;
+
+   if (!topology->load_aware) {
+      return;
+   }
+
+   slot = &topology->load[server_id % MONGOC_SERVER_LOAD_SLOTS];
+   latency_usec = BSON_MAX (bson_get_monotonic_time () - started, 1);
+   latency_usec = BSON_MIN (latency_usec, INT32_MAX);
+   avg = slot->latency_usec;
+
+   /* same weight as the heartbeat round trip time's moving average */
+   slot->latency_usec =
+      avg ? (int32_t) (0.2 * latency_usec + 0.8 * avg) : (int32_t) latency_usec;
+
+   bson_atomic_int_add (&slot->in_flight, -1);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_pop_server_session --
+ *
+ *       Take the most recently used server session from the pool,
+ *       discarding any the server may have expired. See the Driver
+ *       Sessions Spec.
+ *
+ * Returns:
+ *       A server session, or NULL with @error set if the pool is empty
+ *       and a new session id can't be generated.
+ *
+ *--------------------------------------------------------------------------
+ */
+mongoc_server_session_t *
+_mongoc_topology_pop_server_session (mongoc_topology_t *topology,
+                                     bson_error_t *error)
+{
+   int64_t timeout;
+   mongoc_server_session_t *server_session = NULL;
+
+   ENTRY;
+
+   mongoc_mutex_lock (&topology->mutex);
+
+   timeout = _mongoc_topology_description_session_timeout_minutes (
+      &topology->description);
+
+   while (topology->session_pool) {
+      server_session = topology->session_pool;
+      DL_DELETE (topology->session_pool, server_session);
+
+      if (!_mongoc_server_session_timed_out (server_session, timeout)) {
+         break;
+      }
+
+      _mongoc_server_session_destroy (server_session);
+      server_session = NULL;
+   }
+
+   mongoc_mutex_unlock (&topology->mutex);
+
+   if (!server_session) {
+      server_session = _mongoc_server_session_new (error);
+   }
+
+   RETURN (server_session);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_topology_push_server_session --
+ *
+ *       Return a server session to the front of the pool, unless it is
+ *       about to expire. The least recently used sessions at the back of
+ *       the pool are discarded once they are about to expire, too.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+_mongoc_topology_push_server_session (mongoc_topology_t *topology,
+                                      mongoc_server_session_t *server_session)
+{
+   int64_t timeout;
+   mongoc_server_session_t *oldest;
+
+   ENTRY;
+
+   mongoc_mutex_lock (&topology->mutex);
+
+   timeout = _mongoc_topology_description_session_timeout_minutes (
+      &topology->description);
+
+   /* utlist's head->prev is the tail */
+   while (topology->session_pool) {
+      oldest = topology->session_pool->prev;
+      if (!_mongoc_server_session_timed_out (oldest, timeout)) {
+         break;
+      }
+
+      DL_DELETE (topology->session_pool, oldest);
+      _mongoc_server_session_destroy (oldest);
+   }
+
+   if (_mongoc_server_session_timed_out (server_session, timeout)) {
+      _mongoc_server_session_destroy (server_session);
+   } else {
+      DL_PREPEND (topology->session_pool, server_session);
+   }
+
+   mongoc_mutex_unlock (&topology->mutex);
+
+   EXIT;
+}
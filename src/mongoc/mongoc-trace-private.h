@@ -29,9 +29,20 @@
 BSON_BEGIN_DECLS
 
 
+/* record a trace point in the calling thread's ring buffer, if
+ * mongoc_log_trace_ring_enable () is in effect. @text must be a string
+ * literal: the record stores only the pointer. */
+#define _MONGOC_TRACE_RING(text, value)                                   \
+   do {                                                                   \
+      if (BSON_UNLIKELY (_mongoc_trace_ring_enabled)) {                   \
+         _mongoc_trace_ring_record (BSON_FUNC, __LINE__, text, (value)); \
+      }                                                                   \
+   } while (0)
+
 #ifdef MONGOC_TRACE
 #define TRACE(msg, ...)                   \
    do {                                   \
+      _MONGOC_TRACE_RING (msg, 0);        \
       mongoc_log (MONGOC_LOG_LEVEL_TRACE, \
                   MONGOC_LOG_DOMAIN,      \
                   "TRACE: %s():%d " msg,  \
@@ -41,6 +52,7 @@ BSON_BEGIN_DECLS
    } while (0)
 #define ENTRY                             \
    do {                                   \
+      _MONGOC_TRACE_RING ("ENTRY", 0);    \
       mongoc_log (MONGOC_LOG_LEVEL_TRACE, \
                   MONGOC_LOG_DOMAIN,      \
                   "ENTRY: %s():%d",       \
@@ -49,6 +61,7 @@ BSON_BEGIN_DECLS
    } while (0)
 #define EXIT                              \
    do {                                   \
+      _MONGOC_TRACE_RING (" EXIT", 0);    \
       mongoc_log (MONGOC_LOG_LEVEL_TRACE, \
                   MONGOC_LOG_DOMAIN,      \
                   " EXIT: %s():%d",       \
@@ -58,6 +71,7 @@ BSON_BEGIN_DECLS
    } while (0)
 #define RETURN(ret)                       \
    do {                                   \
+      _MONGOC_TRACE_RING (" EXIT", 0);    \
       mongoc_log (MONGOC_LOG_LEVEL_TRACE, \
                   MONGOC_LOG_DOMAIN,      \
                   " EXIT: %s():%d",       \
@@ -67,6 +81,7 @@ BSON_BEGIN_DECLS
    } while (0)
 #define GOTO(label)                       \
    do {                                   \
+      _MONGOC_TRACE_RING (" GOTO " #label, 0); \
       mongoc_log (MONGOC_LOG_LEVEL_TRACE, \
                   MONGOC_LOG_DOMAIN,      \
                   " GOTO: %s():%d %s",    \
@@ -77,6 +92,7 @@ BSON_BEGIN_DECLS
    } while (0)
 #define DUMP_BYTES(_n, _b, _l)                            \
    do {                                                   \
+      _MONGOC_TRACE_RING (#_n, (int64_t) (_l));           \
       mongoc_log (MONGOC_LOG_LEVEL_TRACE,                 \
                   MONGOC_LOG_DOMAIN,                      \
                   "TRACE: %s():%d %s = %p [%d]",          \
@@ -89,6 +105,7 @@ BSON_BEGIN_DECLS
    } while (0)
 #define DUMP_IOVEC(_n, _iov, _iovcnt)                            \
    do {                                                          \
+      _MONGOC_TRACE_RING (#_n, (int64_t) (_iovcnt));             \
       mongoc_log (MONGOC_LOG_LEVEL_TRACE,                        \
                   MONGOC_LOG_DOMAIN,                             \
                   "TRACE: %s():%d %s = %p [%d]",                 \
@@ -100,13 +117,26 @@ BSON_BEGIN_DECLS
       mongoc_log_trace_iovec (MONGOC_LOG_DOMAIN, _iov, _iovcnt); \
    } while (0)
 #else
-#define TRACE(msg, ...)
-#define ENTRY
-#define EXIT return
-#define RETURN(ret) return ret
-#define GOTO(label) goto label
-#define DUMP_BYTES(_n, _b, _l)
-#define DUMP_IOVEC(_n, _iov, _iovcnt)
+#define TRACE(msg, ...) _MONGOC_TRACE_RING (msg, 0)
+#define ENTRY _MONGOC_TRACE_RING ("ENTRY", 0)
+#define EXIT                           \
+   do {                                \
+      _MONGOC_TRACE_RING (" EXIT", 0); \
+      return;                          \
+   } while (0)
+#define RETURN(ret)                    \
+   do {                                \
+      _MONGOC_TRACE_RING (" EXIT", 0); \
+      return ret;                      \
+   } while (0)
+#define GOTO(label)                              \
+   do {                                          \
+      _MONGOC_TRACE_RING (" GOTO " #label, 0); \
+      goto label;                                \
+   } while (0)
+#define DUMP_BYTES(_n, _b, _l) _MONGOC_TRACE_RING (#_n, (int64_t) (_l))
+#define DUMP_IOVEC(_n, _iov, _iovcnt) \
+   _MONGOC_TRACE_RING (#_n, (int64_t) (_iovcnt))
 #endif
 
 
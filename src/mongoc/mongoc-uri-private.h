@@ -21,6 +21,7 @@
 #error "Only <mongoc.h> can be included directly."
 #endif
 
+#include "mongoc-socket-private.h"
 #include "mongoc-uri.h"
 
 
@@ -35,6 +36,15 @@ mongoc_uri_parse_host (mongoc_uri_t *uri, const char *str, bool downcase);
 int32_t
 mongoc_uri_get_local_threshold_option (const mongoc_uri_t *uri);
 
+void
+_mongoc_uri_get_socket_opts (const mongoc_uri_t *uri,
+                             mongoc_socket_opts_t *opts);
+
+mongoc_uri_t *
+_mongoc_uri_copy_for_hosts (const mongoc_uri_t *uri,
+                            const char *set_name,
+                            const char *hosts);
+
 BSON_END_DECLS
 
 
@@ -635,7 +635,13 @@ mongoc_uri_bson_append_or_replace_key (bson_t *options,
 bool
 mongoc_uri_option_is_int32 (const char *key)
 {
-   return !strcasecmp (key, MONGOC_URI_CONNECTTIMEOUTMS) ||
+   return !strcasecmp (key, MONGOC_URI_COALESCEINSERTSMAX) ||
+          !strcasecmp (key, MONGOC_URI_COALESCEINSERTSMS) ||
+          !strcasecmp (key, MONGOC_URI_CIRCUITBREAKEROPENMS) ||
+          !strcasecmp (key, MONGOC_URI_CIRCUITBREAKERTHRESHOLD) ||
+          !strcasecmp (key, MONGOC_URI_COMPRESSIONMINRTTMS) ||
+          !strcasecmp (key, MONGOC_URI_COMPRESSIONMINSIZE) ||
+          !strcasecmp (key, MONGOC_URI_CONNECTTIMEOUTMS) ||
           !strcasecmp (key, MONGOC_URI_HEARTBEATFREQUENCYMS) ||
           !strcasecmp (key, MONGOC_URI_SERVERSELECTIONTIMEOUTMS) ||
           !strcasecmp (key, MONGOC_URI_SOCKETCHECKINTERVALMS) ||
@@ -643,36 +649,80 @@ mongoc_uri_option_is_int32 (const char *key)
           !strcasecmp (key, MONGOC_URI_LOCALTHRESHOLDMS) ||
           !strcasecmp (key, MONGOC_URI_MAXPOOLSIZE) ||
           !strcasecmp (key, MONGOC_URI_MAXSTALENESSSECONDS) ||
+          !strcasecmp (key, MONGOC_URI_MEMORYBUDGETMB) ||
+          !strcasecmp (key, MONGOC_URI_METADATACACHETTLMS) ||
           !strcasecmp (key, MONGOC_URI_MINPOOLSIZE) ||
+          !strcasecmp (key, MONGOC_URI_MAXCONNECTING) ||
+          !strcasecmp (key, MONGOC_URI_MAXCONNECTIONLIFETIMEMS) ||
           !strcasecmp (key, MONGOC_URI_MAXIDLETIMEMS) ||
+          !strcasecmp (key, MONGOC_URI_POOLSHARDS) ||
+          !strcasecmp (key, MONGOC_URI_MAXINFLIGHTPERSERVER) ||
+          !strcasecmp (key, MONGOC_URI_REPLYBUFFERMAXSIZE) ||
+          !strcasecmp (key, MONGOC_URI_RESERVEDPOOLSIZE) ||
+          !strcasecmp (key, MONGOC_URI_SLOWOPTHRESHOLDMS) ||
+          !strcasecmp (key, MONGOC_URI_STANDBYCONNECTIONS) ||
+          !strcasecmp (key, MONGOC_URI_STREAMBUFFERMAXSIZE) ||
+          !strcasecmp (key, MONGOC_URI_STREAMBUFFERSIZE) ||
+          !strcasecmp (key, MONGOC_URI_TCPBUSYPOLLUSECS) ||
+          !strcasecmp (key, MONGOC_URI_TCPKEEPALIVECOUNT) ||
+          !strcasecmp (key, MONGOC_URI_TCPKEEPALIVEIDLESECS) ||
+          !strcasecmp (key, MONGOC_URI_TCPKEEPALIVEINTERVALSECS) ||
+          !strcasecmp (key, MONGOC_URI_TCPRECEIVEBUFFERSIZE) ||
+          !strcasecmp (key, MONGOC_URI_TCPSENDBUFFERSIZE) ||
+          !strcasecmp (key, MONGOC_URI_TCPZEROCOPYMINSIZE) ||
+          !strcasecmp (key, MONGOC_URI_TIMEOUTMS) ||
           !strcasecmp (key, MONGOC_URI_WAITQUEUEMULTIPLE) ||
           !strcasecmp (key, MONGOC_URI_WAITQUEUETIMEOUTMS) ||
           !strcasecmp (key, MONGOC_URI_WTIMEOUTMS) ||
-          !strcasecmp (key, MONGOC_URI_ZLIBCOMPRESSIONLEVEL);
+          !strcasecmp (key, MONGOC_URI_ZONEPENALTYMS) ||
+          !strcasecmp (key, MONGOC_URI_ZLIBCOMPRESSIONLEVEL) ||
+          !strcasecmp (key, MONGOC_URI_ZSTDCOMPRESSIONLEVEL);
 }
 
 bool
 mongoc_uri_option_is_bool (const char *key)
 {
    return !strcasecmp (key, MONGOC_URI_CANONICALIZEHOSTNAME) ||
+          !strcasecmp (key, MONGOC_URI_COMPRESSIONADAPTIVE) ||
+          !strcasecmp (key, MONGOC_URI_COMPRESSIONOUTSIDEZONE) ||
+          !strcasecmp (key, MONGOC_URI_DEFERKILLCURSORS) ||
+          !strcasecmp (key, MONGOC_URI_SOCKETCHECKLOCAL) ||
+          !strcasecmp (key, MONGOC_URI_HEARTBEATPIGGYBACK) ||
+          !strcasecmp (key, MONGOC_URI_INFLIGHTFAILFAST) ||
+          !strcasecmp (key, MONGOC_URI_IOURING) ||
           !strcasecmp (key, MONGOC_URI_JOURNAL) ||
+          !strcasecmp (key, MONGOC_URI_OPMSGCHECKSUM) ||
+          !strcasecmp (key, MONGOC_URI_PREFERUNIXSOCKET) ||
+          !strcasecmp (key, MONGOC_URI_RETRYREADS) ||
+          !strcasecmp (key, MONGOC_URI_RETRYWRITES) ||
           !strcasecmp (key, MONGOC_URI_SAFE) ||
+          !strcasecmp (key, MONGOC_URI_SERVERSELECTIONEAGER) ||
+          !strcasecmp (key, MONGOC_URI_SERVERSELECTIONLOADAWARE) ||
           !strcasecmp (key, MONGOC_URI_SERVERSELECTIONTRYONCE) ||
+          !strcasecmp (key, MONGOC_URI_SHAREDCONNECTIONS) ||
+          !strcasecmp (key, MONGOC_URI_SHARETOPOLOGY) ||
           !strcasecmp (key, MONGOC_URI_SLAVEOK) ||
           !strcasecmp (key, MONGOC_URI_SSL) ||
           !strcasecmp (key, MONGOC_URI_SSLALLOWINVALIDCERTIFICATES) ||
-          !strcasecmp (key, MONGOC_URI_SSLALLOWINVALIDHOSTNAMES);
+          !strcasecmp (key, MONGOC_URI_SSLALLOWINVALIDHOSTNAMES) ||
+          !strcasecmp (key, MONGOC_URI_SSLKERNELOFFLOAD) ||
+          !strcasecmp (key, MONGOC_URI_TCPFASTOPEN) ||
+          !strcasecmp (key, MONGOC_URI_TCPNODELAY) ||
+          !strcasecmp (key, MONGOC_URI_TCPQUICKACK);
 }
 
 bool
 mongoc_uri_option_is_utf8 (const char *key)
 {
    return !strcasecmp (key, MONGOC_URI_APPNAME) ||
+          !strcasecmp (key, MONGOC_URI_COMPRESSIONHOSTS) ||
+          !strcasecmp (key, MONGOC_URI_LOCALZONE) ||
           !strcasecmp (key, MONGOC_URI_REPLICASET) ||
           !strcasecmp (key, MONGOC_URI_READPREFERENCE) ||
           !strcasecmp (key, MONGOC_URI_SSLCLIENTCERTIFICATEKEYFILE) ||
           !strcasecmp (key, MONGOC_URI_SSLCLIENTCERTIFICATEKEYPASSWORD) ||
-          !strcasecmp (key, MONGOC_URI_SSLCERTIFICATEAUTHORITYFILE);
+          !strcasecmp (key, MONGOC_URI_SSLCERTIFICATEAUTHORITYFILE) ||
+          !strcasecmp (key, MONGOC_URI_ZONETAG);
 }
 
 static bool
@@ -1297,6 +1347,36 @@ _mongoc_uri_get_max_staleness_option (const mongoc_uri_t *uri)
    return retval;
 }
 
+
+/* the URI's "tcp*" options, for _mongoc_socket_set_opts */
+void
+_mongoc_uri_get_socket_opts (const mongoc_uri_t *uri,
+                             mongoc_socket_opts_t *opts)
+{
+   memset (opts, 0, sizeof *opts);
+
+   opts->rcvbuf =
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_TCPRECEIVEBUFFERSIZE, 0);
+   opts->sndbuf =
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_TCPSENDBUFFERSIZE, 0);
+   opts->keepidle =
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_TCPKEEPALIVEIDLESECS, 0);
+   opts->keepintvl = mongoc_uri_get_option_as_int32 (
+      uri, MONGOC_URI_TCPKEEPALIVEINTERVALSECS, 0);
+   opts->keepcnt =
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_TCPKEEPALIVECOUNT, 0);
+   opts->busy_poll_usec =
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_TCPBUSYPOLLUSECS, 0);
+   opts->zerocopy_min_size =
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_TCPZEROCOPYMINSIZE, 0);
+   opts->nodelay =
+      mongoc_uri_get_option_as_bool (uri, MONGOC_URI_TCPNODELAY, true);
+   opts->quickack =
+      mongoc_uri_get_option_as_bool (uri, MONGOC_URI_TCPQUICKACK, false);
+   opts->fastopen =
+      mongoc_uri_get_option_as_bool (uri, MONGOC_URI_TCPFASTOPEN, false);
+}
+
 mongoc_uri_t *
 mongoc_uri_new_with_error (const char *uri_string, bson_error_t *error)
 {
@@ -1682,6 +1762,61 @@ mongoc_uri_copy (const mongoc_uri_t *uri)
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_uri_copy_for_hosts --
+ *
+ *       Copy @uri, with its credentials and options, to connect to the
+ *       comma-separated "host:port" list @hosts instead of its own hosts:
+ *       the replica set @set_name, or standalone servers if it's NULL.
+ *
+ * Returns:
+ *       A new URI, or NULL if @hosts is invalid.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_uri_t *
+_mongoc_uri_copy_for_hosts (const mongoc_uri_t *uri,
+                            const char *set_name,
+                            const char *hosts)
+{
+   mongoc_uri_t *copy;
+   bson_t options = BSON_INITIALIZER;
+
+   BSON_ASSERT (uri);
+   BSON_ASSERT (hosts);
+
+   copy = mongoc_uri_copy (uri);
+   if (!copy) {
+      return NULL;
+   }
+
+   _mongoc_host_list_destroy_all (copy->hosts);
+   copy->hosts = NULL;
+   copy->is_srv = false;
+   copy->srv[0] = '\0';
+
+   if (!mongoc_uri_parse_hosts (copy, hosts)) {
+      bson_destroy (&options);
+      mongoc_uri_destroy (copy);
+      return NULL;
+   }
+
+   bson_copy_to_excluding_noinit (
+      &copy->options, &options, MONGOC_URI_REPLICASET, (char *) NULL);
+   bson_destroy (&copy->options);
+   bson_steal (&copy->options, &options);
+
+   if (set_name) {
+      mongoc_uri_set_option_as_utf8 (copy, MONGOC_URI_REPLICASET, set_name);
+   }
+
+   return copy;
+}
+
+
 const char *
 mongoc_uri_get_string (const mongoc_uri_t *uri)
 {
@@ -1945,6 +2080,47 @@ mongoc_uri_set_option_as_int32 (mongoc_uri_t *uri,
       return false;
    }
 
+   if ((!bson_strcasecmp (option, MONGOC_URI_COMPRESSIONMINRTTMS) ||
+        !bson_strcasecmp (option, MONGOC_URI_COMPRESSIONMINSIZE) ||
+        !bson_strcasecmp (option, MONGOC_URI_STANDBYCONNECTIONS)) &&
+       value < 0) {
+      MONGOC_WARNING (
+         "Invalid \"%s\" of %d: must be at least 0", option, value);
+      return false;
+   }
+
+   if ((!bson_strcasecmp (option, MONGOC_URI_METADATACACHETTLMS) ||
+        !bson_strcasecmp (option, MONGOC_URI_REPLYBUFFERMAXSIZE) ||
+        !bson_strcasecmp (option, MONGOC_URI_SLOWOPTHRESHOLDMS) ||
+        !bson_strcasecmp (option, MONGOC_URI_TIMEOUTMS)) &&
+       value < 0) {
+      MONGOC_WARNING (
+         "Invalid \"%s\" of %d: must be at least 0", option, value);
+      return false;
+   }
+
+   if ((!bson_strcasecmp (option, MONGOC_URI_STREAMBUFFERSIZE) ||
+        !bson_strcasecmp (option, MONGOC_URI_STREAMBUFFERMAXSIZE)) &&
+       value < 1) {
+      MONGOC_WARNING (
+         "Invalid \"%s\" of %d: must be at least 1", option, value);
+      return false;
+   }
+
+   /* socket tuning, where 0 means the default */
+   if ((!bson_strcasecmp (option, MONGOC_URI_TCPBUSYPOLLUSECS) ||
+        !bson_strcasecmp (option, MONGOC_URI_TCPKEEPALIVECOUNT) ||
+        !bson_strcasecmp (option, MONGOC_URI_TCPKEEPALIVEIDLESECS) ||
+        !bson_strcasecmp (option, MONGOC_URI_TCPKEEPALIVEINTERVALSECS) ||
+        !bson_strcasecmp (option, MONGOC_URI_TCPRECEIVEBUFFERSIZE) ||
+        !bson_strcasecmp (option, MONGOC_URI_TCPSENDBUFFERSIZE) ||
+        !bson_strcasecmp (option, MONGOC_URI_TCPZEROCOPYMINSIZE)) &&
+       value < 0) {
+      MONGOC_WARNING (
+         "Invalid \"%s\" of %d: must be at least 0", option, value);
+      return false;
+   }
+
    /* zlib levels are from -1 (default) through 9 (best compression) */
    if (!bson_strcasecmp (option, MONGOC_URI_ZLIBCOMPRESSIONLEVEL) &&
        (value < -1 || value > 9)) {
@@ -1953,6 +2129,15 @@ mongoc_uri_set_option_as_int32 (mongoc_uri_t *uri,
       return false;
    }
 
+   /* zstd levels are -1 (default) or 1 (fastest) through 22 (best) */
+   if (!bson_strcasecmp (option, MONGOC_URI_ZSTDCOMPRESSIONLEVEL) &&
+       (value < -1 || value == 0 || value > 22)) {
+      MONGOC_WARNING ("Invalid \"%s\" of %d: must be -1 or between 1 and 22",
+                      option,
+                      value);
+      return false;
+   }
+
    return _mongoc_uri_set_option_as_int32 (uri, option, value);
 }
 
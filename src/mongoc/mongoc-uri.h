@@ -40,26 +40,59 @@
 #define MONGOC_URI_AUTHMECHANISMPROPERTIES "authmechanismproperties"
 #define MONGOC_URI_AUTHSOURCE "authsource"
 #define MONGOC_URI_CANONICALIZEHOSTNAME "canonicalizehostname"
+#define MONGOC_URI_CIRCUITBREAKEROPENMS "circuitbreakeropenms"
+#define MONGOC_URI_CIRCUITBREAKERTHRESHOLD "circuitbreakerthreshold"
 #define MONGOC_URI_CONNECTTIMEOUTMS "connecttimeoutms"
+#define MONGOC_URI_COALESCEINSERTSMAX "coalesceinsertsmax"
+#define MONGOC_URI_COALESCEINSERTSMS "coalesceinsertsms"
 #define MONGOC_URI_COMPRESSORS "compressors"
+#define MONGOC_URI_COMPRESSIONADAPTIVE "compressionadaptive"
+#define MONGOC_URI_COMPRESSIONHOSTS "compressionhosts"
+#define MONGOC_URI_COMPRESSIONMINRTTMS "compressionminrttms"
+#define MONGOC_URI_COMPRESSIONMINSIZE "compressionminsize"
+#define MONGOC_URI_COMPRESSIONOUTSIDEZONE "compressionoutsidezone"
+#define MONGOC_URI_DEFERKILLCURSORS "deferkillcursors"
 #define MONGOC_URI_GSSAPISERVICENAME "gssapiservicename"
 #define MONGOC_URI_HEARTBEATFREQUENCYMS "heartbeatfrequencyms"
+#define MONGOC_URI_HEARTBEATPIGGYBACK "heartbeatpiggyback"
+#define MONGOC_URI_INFLIGHTFAILFAST "inflightfailfast"
+#define MONGOC_URI_IOURING "iouring"
 #define MONGOC_URI_JOURNAL "journal"
 #define MONGOC_URI_LOCALTHRESHOLDMS "localthresholdms"
+#define MONGOC_URI_LOCALZONE "localzone"
+#define MONGOC_URI_MAXCONNECTING "maxconnecting"
+#define MONGOC_URI_MAXCONNECTIONLIFETIMEMS "maxconnectionlifetimems"
 #define MONGOC_URI_MAXIDLETIMEMS "maxidletimems"
+#define MONGOC_URI_MAXINFLIGHTPERSERVER "maxinflightperserver"
 #define MONGOC_URI_MAXPOOLSIZE "maxpoolsize"
 #define MONGOC_URI_MAXSTALENESSSECONDS "maxstalenessseconds"
+#define MONGOC_URI_MEMORYBUDGETMB "memorybudgetmb"
+#define MONGOC_URI_METADATACACHETTLMS "metadatacachettlms"
 #define MONGOC_URI_MINPOOLSIZE "minpoolsize"
+#define MONGOC_URI_OPMSGCHECKSUM "opmsgchecksum"
+#define MONGOC_URI_POOLSHARDS "poolshards"
+#define MONGOC_URI_PREFERUNIXSOCKET "preferunixsocket"
 #define MONGOC_URI_READCONCERNLEVEL "readconcernlevel"
 #define MONGOC_URI_READPREFERENCE "readpreference"
 #define MONGOC_URI_READPREFERENCETAGS "readpreferencetags"
 #define MONGOC_URI_REPLICASET "replicaset"
+#define MONGOC_URI_REPLYBUFFERMAXSIZE "replybuffermaxsize"
+#define MONGOC_URI_RESERVEDPOOLSIZE "reservedpoolsize"
+#define MONGOC_URI_RETRYREADS "retryreads"
+#define MONGOC_URI_RETRYWRITES "retrywrites"
 #define MONGOC_URI_SAFE "safe"
+#define MONGOC_URI_SERVERSELECTIONEAGER "serverselectioneager"
+#define MONGOC_URI_SERVERSELECTIONLOADAWARE "serverselectionloadaware"
 #define MONGOC_URI_SERVERSELECTIONTIMEOUTMS "serverselectiontimeoutms"
 #define MONGOC_URI_SERVERSELECTIONTRYONCE "serverselectiontryonce"
+#define MONGOC_URI_SHAREDCONNECTIONS "sharedconnections"
+#define MONGOC_URI_SHARETOPOLOGY "sharetopology"
 #define MONGOC_URI_SLAVEOK "slaveok"
+#define MONGOC_URI_SLOWOPTHRESHOLDMS "slowopthresholdms"
 #define MONGOC_URI_SOCKETCHECKINTERVALMS "socketcheckintervalms"
+#define MONGOC_URI_SOCKETCHECKLOCAL "socketchecklocal"
 #define MONGOC_URI_SOCKETTIMEOUTMS "sockettimeoutms"
+#define MONGOC_URI_STANDBYCONNECTIONS "standbyconnections"
 #define MONGOC_URI_SSL "ssl"
 #define MONGOC_URI_SSLCLIENTCERTIFICATEKEYFILE "sslclientcertificatekeyfile"
 #define MONGOC_URI_SSLCLIENTCERTIFICATEKEYPASSWORD \
@@ -67,11 +100,28 @@
 #define MONGOC_URI_SSLCERTIFICATEAUTHORITYFILE "sslcertificateauthorityfile"
 #define MONGOC_URI_SSLALLOWINVALIDCERTIFICATES "sslallowinvalidcertificates"
 #define MONGOC_URI_SSLALLOWINVALIDHOSTNAMES "sslallowinvalidhostnames"
+#define MONGOC_URI_SSLKERNELOFFLOAD "sslkerneloffload"
+#define MONGOC_URI_STREAMBUFFERMAXSIZE "streambuffermaxsize"
+#define MONGOC_URI_STREAMBUFFERSIZE "streambuffersize"
+#define MONGOC_URI_TCPBUSYPOLLUSECS "tcpbusypollusecs"
+#define MONGOC_URI_TCPFASTOPEN "tcpfastopen"
+#define MONGOC_URI_TCPKEEPALIVECOUNT "tcpkeepalivecount"
+#define MONGOC_URI_TCPKEEPALIVEIDLESECS "tcpkeepaliveidlesecs"
+#define MONGOC_URI_TCPKEEPALIVEINTERVALSECS "tcpkeepaliveintervalsecs"
+#define MONGOC_URI_TCPNODELAY "tcpnodelay"
+#define MONGOC_URI_TCPQUICKACK "tcpquickack"
+#define MONGOC_URI_TCPRECEIVEBUFFERSIZE "tcpreceivebuffersize"
+#define MONGOC_URI_TCPSENDBUFFERSIZE "tcpsendbuffersize"
+#define MONGOC_URI_TCPZEROCOPYMINSIZE "tcpzerocopyminsize"
+#define MONGOC_URI_TIMEOUTMS "timeoutms"
 #define MONGOC_URI_W "w"
 #define MONGOC_URI_WAITQUEUEMULTIPLE "waitqueuemultiple"
 #define MONGOC_URI_WAITQUEUETIMEOUTMS "waitqueuetimeoutms"
 #define MONGOC_URI_WTIMEOUTMS "wtimeoutms"
+#define MONGOC_URI_ZONEPENALTYMS "zonepenaltyms"
+#define MONGOC_URI_ZONETAG "zonetag"
 #define MONGOC_URI_ZLIBCOMPRESSIONLEVEL "zlibcompressionlevel"
+#define MONGOC_URI_ZSTDCOMPRESSIONLEVEL "zstdcompressionlevel"
 
 BSON_BEGIN_DECLS
 
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_URING_PRIVATE_H
+#define MONGOC_URING_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-config.h"
+#include "mongoc-iovec.h"
+
+BSON_BEGIN_DECLS
+
+#ifdef MONGOC_HAVE_IO_URING
+
+/* A Linux io_uring with room for one socket operation and its timeout.
+ * Each send or receive is submitted and waited for with one system call,
+ * instead of poll followed by recv or sendmsg. */
+typedef struct _mongoc_uring_t mongoc_uring_t;
+
+mongoc_uring_t *
+_mongoc_uring_new (void);
+
+void
+_mongoc_uring_destroy (mongoc_uring_t *ring);
+
+ssize_t
+_mongoc_uring_recv (mongoc_uring_t *ring,
+                    int fd,
+                    mongoc_iovec_t *iov,
+                    size_t iovcnt,
+                    int64_t expire_at);
+
+ssize_t
+_mongoc_uring_send (mongoc_uring_t *ring,
+                    int fd,
+                    mongoc_iovec_t *iov,
+                    size_t iovcnt,
+                    int64_t expire_at);
+
+#endif /* MONGOC_HAVE_IO_URING */
+
+BSON_END_DECLS
+
+#endif /* MONGOC_URING_PRIVATE_H */
@@ -0,0 +1,355 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-uring-private.h"
+
+#ifdef MONGOC_HAVE_IO_URING
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+#include "mongoc-trace-private.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "uring"
+
+
+/* an operation and its linked timeout */
+#define MONGOC_URING_ENTRIES 2
+
+/* user_data of the operation's completion, the timeout's is 0 */
+#define MONGOC_URING_OP 1
+
+
+struct _mongoc_uring_t {
+   int fd;
+
+   void *sq_ring;
+   size_t sq_ring_size;
+   unsigned *sq_head;
+   unsigned *sq_tail;
+   unsigned *sq_mask;
+   unsigned *sq_array;
+   struct io_uring_sqe *sqes;
+   size_t sqes_size;
+
+   void *cq_ring;
+   size_t cq_ring_size;
+   unsigned *cq_head;
+   unsigned *cq_tail;
+   unsigned *cq_mask;
+   struct io_uring_cqe *cqes;
+};
+
+
+static int
+_mongoc_uring_enter (mongoc_uring_t *ring,
+                     unsigned to_submit,
+                     unsigned min_complete)
+{
+   return (int) syscall (__NR_io_uring_enter,
+                         ring->fd,
+                         to_submit,
+                         min_complete,
+                         IORING_ENTER_GETEVENTS,
+                         NULL,
+                         0);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_uring_new --
+ *
+ *       Create a ring and map its queues.
+ *
+ * Returns:
+ *       A new ring, or NULL if the kernel lacks io_uring or polls for
+ *       socket readiness itself (Linux 5.7). The caller should fall
+ *       back to poll.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_uring_t *
+_mongoc_uring_new (void)
+{
+   struct io_uring_params p;
+   mongoc_uring_t *ring;
+   int fd;
+
+   ENTRY;
+
+   memset (&p, 0, sizeof p);
+   fd = (int) syscall (__NR_io_uring_setup, MONGOC_URING_ENTRIES, &p);
+   if (fd < 0) {
+      TRACE ("could not create io_uring: %d", errno);
+      RETURN (NULL);
+   }
+
+   /* the driver's sockets are nonblocking, without fast poll (Linux 5.7)
+    * the kernel would complete a recv on an idle socket with EAGAIN */
+   if (!(p.features & IORING_FEAT_FAST_POLL)) {
+      close (fd);
+      RETURN (NULL);
+   }
+
+   ring = (mongoc_uring_t *) bson_malloc0 (sizeof *ring);
+   ring->fd = fd;
+
+   ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+   ring->sq_ring = mmap (NULL,
+                         ring->sq_ring_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         fd,
+                         IORING_OFF_SQ_RING);
+
+   ring->cq_ring_size =
+      p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+   ring->cq_ring = mmap (NULL,
+                         ring->cq_ring_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         fd,
+                         IORING_OFF_CQ_RING);
+
+   ring->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+   ring->sqes = (struct io_uring_sqe *) mmap (NULL,
+                                              ring->sqes_size,
+                                              PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE,
+                                              fd,
+                                              IORING_OFF_SQES);
+
+   if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+       (void *) ring->sqes == MAP_FAILED) {
+      TRACE ("could not map io_uring: %d", errno);
+      _mongoc_uring_destroy (ring);
+      RETURN (NULL);
+   }
+
+   ring->sq_head = (unsigned *) ((char *) ring->sq_ring + p.sq_off.head);
+   ring->sq_tail = (unsigned *) ((char *) ring->sq_ring + p.sq_off.tail);
+   ring->sq_mask = (unsigned *) ((char *) ring->sq_ring + p.sq_off.ring_mask);
+   ring->sq_array = (unsigned *) ((char *) ring->sq_ring + p.sq_off.array);
+
+   ring->cq_head = (unsigned *) ((char *) ring->cq_ring + p.cq_off.head);
+   ring->cq_tail = (unsigned *) ((char *) ring->cq_ring + p.cq_off.tail);
+   ring->cq_mask = (unsigned *) ((char *) ring->cq_ring + p.cq_off.ring_mask);
+   ring->cqes =
+      (struct io_uring_cqe *) ((char *) ring->cq_ring + p.cq_off.cqes);
+
+   RETURN (ring);
+}
+
+
+void
+_mongoc_uring_destroy (mongoc_uring_t *ring)
+{
+   if (!ring) {
+      return;
+   }
+
+   if (ring->sq_ring && ring->sq_ring != MAP_FAILED) {
+      munmap (ring->sq_ring, ring->sq_ring_size);
+   }
+
+   if (ring->cq_ring && ring->cq_ring != MAP_FAILED) {
+      munmap (ring->cq_ring, ring->cq_ring_size);
+   }
+
+   if (ring->sqes && (void *) ring->sqes != MAP_FAILED) {
+      munmap (ring->sqes, ring->sqes_size);
+   }
+
+   close (ring->fd);
+   bson_free (ring);
+}
+
+
+/* the next free submission entry. the ring is empty between operations */
+static struct io_uring_sqe *
+_mongoc_uring_sqe (mongoc_uring_t *ring, unsigned i)
+{
+   unsigned idx;
+   struct io_uring_sqe *sqe;
+
+   idx = (*ring->sq_tail + i) & *ring->sq_mask;
+   sqe = &ring->sqes[idx];
+   memset (sqe, 0, sizeof *sqe);
+   ring->sq_array[idx] = idx;
+
+   return sqe;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_uring_msg --
+ *
+ *       Submit a sendmsg or recvmsg on @fd, with a linked timeout unless
+ *       @expire_at is -1, and wait for the operation and its timeout to
+ *       complete.
+ *
+ * Returns:
+ *       The operation's result, or -1 with errno set. errno is ETIMEDOUT
+ *       if @expire_at passed first.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static ssize_t
+_mongoc_uring_msg (mongoc_uring_t *ring,
+                   int opcode,
+                   int fd,
+                   mongoc_iovec_t *iov,
+                   size_t iovcnt,
+                   int64_t expire_at)
+{
+   struct __kernel_timespec ts;
+   struct io_uring_sqe *sqe;
+   struct io_uring_cqe *cqe;
+   struct msghdr msg;
+   unsigned n_submit;
+   unsigned n_done = 0;
+   unsigned head;
+   unsigned tail;
+   int64_t remaining;
+   int32_t res = 0;
+   int r;
+
+   memset (&msg, 0, sizeof msg);
+   msg.msg_iov = (struct iovec *) iov;
+   msg.msg_iovlen = iovcnt;
+
+   sqe = _mongoc_uring_sqe (ring, 0);
+   sqe->opcode = (uint8_t) opcode;
+   sqe->fd = fd;
+   sqe->addr = (uint64_t) (uintptr_t) &msg;
+   sqe->len = 1;
+   /* like mongoc_socket_sendv, don't raise SIGPIPE */
+   sqe->msg_flags = opcode == IORING_OP_SENDMSG ? MSG_NOSIGNAL : 0;
+   sqe->user_data = MONGOC_URING_OP;
+   n_submit = 1;
+
+   if (expire_at >= 0) {
+      remaining = expire_at - bson_get_monotonic_time ();
+      if (remaining <= 0) {
+         errno = ETIMEDOUT;
+         return -1;
+      }
+
+      ts.tv_sec = remaining / 1000000;
+      ts.tv_nsec = (remaining % 1000000) * 1000;
+
+      sqe->flags |= IOSQE_IO_LINK;
+
+      sqe = _mongoc_uring_sqe (ring, 1);
+      sqe->opcode = IORING_OP_LINK_TIMEOUT;
+      sqe->fd = -1;
+      sqe->addr = (uint64_t) (uintptr_t) &ts;
+      sqe->len = 1;
+      sqe->user_data = 0;
+      n_submit = 2;
+   }
+
+   __atomic_store_n (
+      ring->sq_tail, *ring->sq_tail + n_submit, __ATOMIC_RELEASE);
+
+   r = _mongoc_uring_enter (ring, n_submit, n_submit);
+   if (r < 0 && errno != EINTR) {
+      /* nothing was submitted */
+      __atomic_store_n (
+         ring->sq_tail, *ring->sq_tail - n_submit, __ATOMIC_RELEASE);
+      return -1;
+   }
+
+   /* reap both completions: the operation and the timeout it canceled or
+    * that canceled it. an interrupted wait returns early */
+   for (;;) {
+      head = *ring->cq_head;
+      tail = __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE);
+
+      while (head != tail) {
+         cqe = &ring->cqes[head & *ring->cq_mask];
+         if (cqe->user_data == MONGOC_URING_OP) {
+            res = cqe->res;
+         }
+
+         head++;
+         n_done++;
+      }
+
+      __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+
+      if (n_done >= n_submit) {
+         break;
+      }
+
+      r = _mongoc_uring_enter (ring, 0, n_submit - n_done);
+      if (r < 0 && errno != EINTR) {
+         return -1;
+      }
+   }
+
+   if (res == -ECANCELED) {
+      errno = ETIMEDOUT;
+      return -1;
+   }
+
+   if (res < 0) {
+      errno = -res;
+      return -1;
+   }
+
+   return (ssize_t) res;
+}
+
+
+ssize_t
+_mongoc_uring_recv (mongoc_uring_t *ring,
+                    int fd,
+                    mongoc_iovec_t *iov,
+                    size_t iovcnt,
+                    int64_t expire_at)
+{
+   return _mongoc_uring_msg (
+      ring, IORING_OP_RECVMSG, fd, iov, iovcnt, expire_at);
+}
+
+
+ssize_t
+_mongoc_uring_send (mongoc_uring_t *ring,
+                    int fd,
+                    mongoc_iovec_t *iov,
+                    size_t iovcnt,
+                    int64_t expire_at)
+{
+   return _mongoc_uring_msg (
+      ring, IORING_OP_SENDMSG, fd, iov, iovcnt, expire_at);
+}
+
+#endif /* MONGOC_HAVE_IO_URING */
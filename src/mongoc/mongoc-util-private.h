@@ -103,21 +103,43 @@ _mongoc_get_server_id_from_opts (const bson_t *opts,
                                  uint32_t *server_id,
                                  bson_error_t *error);
 
+/* how inserted and replacement documents are validated by default */
+extern const bson_validate_flags_t _mongoc_insert_vflags;
+
+bool
+_mongoc_validate_flags_from_opts (const bson_t *opts,
+                                  bson_validate_flags_t *vflags,
+                                  bson_error_t *error);
+
 bool
-_mongoc_validate_new_document (const bson_t *insert, bson_error_t *error);
+_mongoc_validate_new_document (const bson_t *insert,
+                               bson_validate_flags_t vflags,
+                               bson_error_t *error);
 
 bool
-_mongoc_validate_replace (const bson_t *insert, bson_error_t *error);
+_mongoc_validate_replace (const bson_t *insert,
+                          bson_validate_flags_t vflags,
+                          bson_error_t *error);
 
 bool
 _mongoc_validate_update (const bson_t *update, bson_error_t *error);
 
+bool
+_mongoc_update_diff (const bson_t *old_doc,
+                     const bson_t *new_doc,
+                     bson_t *update);
+
 void
 mongoc_lowercase (const char *src, char *buf /* OUT */);
 
 bool
 mongoc_parse_port (uint16_t *port, const char *str);
 
+bool
+_mongoc_bson_iter_cmp (const bson_iter_t *a,
+                       const bson_iter_t *b,
+                       int *cmp /* OUT */);
+
 BSON_END_DECLS
 
 #endif /* MONGOC_UTIL_PRIVATE_H */
@@ -15,6 +15,7 @@
  */
 
 
+#include <math.h>
 #include <string.h>
 
 #include "mongoc-util-private.h"
@@ -200,17 +201,73 @@ _mongoc_get_server_id_from_opts (const bson_t *opts,
 }
 
 
-const bson_validate_flags_t insert_vflags =
+const bson_validate_flags_t _mongoc_insert_vflags =
    (bson_validate_flags_t) BSON_VALIDATE_UTF8 | BSON_VALIDATE_UTF8_ALLOW_NULL |
    BSON_VALIDATE_EMPTY_KEYS | BSON_VALIDATE_DOT_KEYS |
    BSON_VALIDATE_DOLLAR_KEYS;
 
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_validate_flags_from_opts --
+ *
+ *       Read the "validate" option from @opts, if present, into @vflags:
+ *       true keeps @vflags, false means BSON_VALIDATE_NONE, and an integer
+ *       is a bitwise-or of bson_validate_flags_t.
+ *
+ * Returns:
+ *       True on success, false and sets @error if "validate" is invalid.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_validate_flags_from_opts (const bson_t *opts,
+                                  bson_validate_flags_t *vflags,
+                                  bson_error_t *error)
+{
+   bson_iter_t iter;
+
+   if (!opts || !bson_iter_init_find (&iter, opts, "validate")) {
+      return true;
+   }
+
+   if (BSON_ITER_HOLDS_BOOL (&iter)) {
+      if (!bson_iter_bool (&iter)) {
+         *vflags = BSON_VALIDATE_NONE;
+      }
+
+      return true;
+   }
+
+   if (BSON_ITER_HOLDS_INT32 (&iter) && bson_iter_int32 (&iter) >= 0) {
+      *vflags = (bson_validate_flags_t) bson_iter_int32 (&iter);
+      return true;
+   }
+
+   bson_set_error (error,
+                   MONGOC_ERROR_COMMAND,
+                   MONGOC_ERROR_COMMAND_INVALID_ARG,
+                   "Invalid option \"validate\": must be a boolean or"
+                   " bson_validate_flags_t");
+
+   return false;
+}
+
+
 bool
-_mongoc_validate_new_document (const bson_t *doc, bson_error_t *error)
+_mongoc_validate_new_document (const bson_t *doc,
+                               bson_validate_flags_t vflags,
+                               bson_error_t *error)
 {
    bson_error_t validate_err;
 
-   if (!bson_validate_with_error (doc, insert_vflags, &validate_err)) {
+   if (vflags == BSON_VALIDATE_NONE) {
+      return true;
+   }
+
+   if (!bson_validate_with_error (doc, vflags, &validate_err)) {
       bson_set_error (error,
                       MONGOC_ERROR_COMMAND,
                       MONGOC_ERROR_COMMAND_INVALID_ARG,
@@ -224,11 +281,17 @@ _mongoc_validate_new_document (const bson_t *doc, bson_error_t *error)
 
 
 bool
-_mongoc_validate_replace (const bson_t *doc, bson_error_t *error)
+_mongoc_validate_replace (const bson_t *doc,
+                          bson_validate_flags_t vflags,
+                          bson_error_t *error)
 {
    bson_error_t validate_err;
 
-   if (!bson_validate_with_error (doc, insert_vflags, &validate_err)) {
+   if (vflags == BSON_VALIDATE_NONE) {
+      return true;
+   }
+
+   if (!bson_validate_with_error (doc, vflags, &validate_err)) {
       bson_set_error (error,
                       MONGOC_ERROR_COMMAND,
                       MONGOC_ERROR_COMMAND_INVALID_ARG,
@@ -307,3 +370,414 @@ mongoc_parse_port (uint16_t *port, const char *str)
    *port = (uint16_t) ul_port;
    return true;
 }
+
+
+/* position of @type in the server's BSON sort order */
+static int
+_mongoc_bson_type_rank (bson_type_t type)
+{
+   switch (type) {
+   case BSON_TYPE_MINKEY:
+      return -1;
+   case BSON_TYPE_UNDEFINED:
+      return 0;
+   case BSON_TYPE_NULL:
+      return 5;
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_INT64:
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_DECIMAL128:
+      return 10;
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_SYMBOL:
+      return 15;
+   case BSON_TYPE_DOCUMENT:
+      return 20;
+   case BSON_TYPE_ARRAY:
+      return 25;
+   case BSON_TYPE_BINARY:
+      return 30;
+   case BSON_TYPE_OID:
+      return 35;
+   case BSON_TYPE_BOOL:
+      return 40;
+   case BSON_TYPE_DATE_TIME:
+      return 45;
+   case BSON_TYPE_TIMESTAMP:
+      return 47;
+   case BSON_TYPE_REGEX:
+      return 50;
+   case BSON_TYPE_DBPOINTER:
+      return 55;
+   case BSON_TYPE_CODE:
+      return 60;
+   case BSON_TYPE_CODEWSCOPE:
+      return 65;
+   case BSON_TYPE_MAXKEY:
+      return 127;
+   case BSON_TYPE_EOD:
+   default:
+      return -2;
+   }
+}
+
+
+#define SIGN(_a, _b) ((_a) < (_b) ? -1 : (_a) > (_b) ? 1 : 0)
+
+
+static int
+_mongoc_str_cmp (const char *a, uint32_t len_a, const char *b, uint32_t len_b)
+{
+   int cmp;
+
+   cmp = memcmp (a, b, BSON_MIN (len_a, len_b));
+   if (!cmp) {
+      return SIGN (len_a, len_b);
+   }
+
+   return SIGN (cmp, 0);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bson_iter_cmp --
+ *
+ *       Compare the values at @a and @b in the server's BSON sort order:
+ *       by type, with all numbers comparable, then by value. Documents
+ *       and arrays compare element by element.
+ *
+ * Returns:
+ *       false if the values are of a type that isn't compared here:
+ *       Decimal128, DBPointer, or code with scope. Otherwise true, with
+ *       @cmp set to -1, 0, or 1 as @a is less than, equal to, or greater
+ *       than @b.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_bson_iter_cmp (const bson_iter_t *a,
+                       const bson_iter_t *b,
+                       int *cmp /* OUT */)
+{
+   bson_iter_t child_a;
+   bson_iter_t child_b;
+   bool more_a;
+   bool more_b;
+   const char *str_a;
+   const char *str_b;
+   const char *opts_a;
+   const char *opts_b;
+   const uint8_t *data_a;
+   const uint8_t *data_b;
+   bson_subtype_t subtype_a;
+   bson_subtype_t subtype_b;
+   uint32_t len_a;
+   uint32_t len_b;
+   uint32_t t_a, i_a;
+   uint32_t t_b, i_b;
+   double d_a;
+   double d_b;
+   int rank_a;
+   int rank_b;
+
+   rank_a = _mongoc_bson_type_rank (bson_iter_type (a));
+   rank_b = _mongoc_bson_type_rank (bson_iter_type (b));
+
+   if (rank_a != rank_b) {
+      *cmp = SIGN (rank_a, rank_b);
+      return true;
+   }
+
+   switch (bson_iter_type (a)) {
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_INT64:
+   case BSON_TYPE_DOUBLE:
+      if (BSON_ITER_HOLDS_DECIMAL128 (b)) {
+         return false;
+      }
+
+      if (!BSON_ITER_HOLDS_DOUBLE (a) && !BSON_ITER_HOLDS_DOUBLE (b)) {
+         *cmp = SIGN (bson_iter_as_int64 (a), bson_iter_as_int64 (b));
+         return true;
+      }
+
+      d_a = bson_iter_as_double (a);
+      d_b = bson_iter_as_double (b);
+
+      /* NaN sorts before all other numbers */
+      if (isnan (d_a) || isnan (d_b)) {
+         *cmp = SIGN (!isnan (d_a), !isnan (d_b));
+      } else {
+         *cmp = SIGN (d_a, d_b);
+      }
+
+      return true;
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_SYMBOL:
+      str_a = BSON_ITER_HOLDS_UTF8 (a) ? bson_iter_utf8 (a, &len_a)
+                                       : bson_iter_symbol (a, &len_a);
+      str_b = BSON_ITER_HOLDS_UTF8 (b) ? bson_iter_utf8 (b, &len_b)
+                                       : bson_iter_symbol (b, &len_b);
+      *cmp = _mongoc_str_cmp (str_a, len_a, str_b, len_b);
+      return true;
+   case BSON_TYPE_CODE:
+      str_a = bson_iter_code (a, &len_a);
+      str_b = bson_iter_code (b, &len_b);
+      *cmp = _mongoc_str_cmp (str_a, len_a, str_b, len_b);
+      return true;
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+      if (!bson_iter_recurse (a, &child_a) ||
+          !bson_iter_recurse (b, &child_b)) {
+         return false;
+      }
+
+      /* by each element's type, then its key, then its value */
+      for (;;) {
+         more_a = bson_iter_next (&child_a);
+         more_b = bson_iter_next (&child_b);
+
+         if (!more_a || !more_b) {
+            *cmp = SIGN (more_a, more_b);
+            return true;
+         }
+
+         *cmp = SIGN (_mongoc_bson_type_rank (bson_iter_type (&child_a)),
+                      _mongoc_bson_type_rank (bson_iter_type (&child_b)));
+         if (!*cmp) {
+            *cmp = SIGN (
+               strcmp (bson_iter_key (&child_a), bson_iter_key (&child_b)), 0);
+         }
+
+         if (!*cmp && !_mongoc_bson_iter_cmp (&child_a, &child_b, cmp)) {
+            return false;
+         }
+
+         if (*cmp) {
+            return true;
+         }
+      }
+   case BSON_TYPE_BINARY:
+      /* by length, then subtype, then bytes */
+      bson_iter_binary (a, &subtype_a, &len_a, &data_a);
+      bson_iter_binary (b, &subtype_b, &len_b, &data_b);
+      *cmp = SIGN (len_a, len_b);
+      if (!*cmp) {
+         *cmp = SIGN (subtype_a, subtype_b);
+      }
+
+      if (!*cmp) {
+         *cmp = SIGN (memcmp (data_a, data_b, len_a), 0);
+      }
+
+      return true;
+   case BSON_TYPE_OID:
+      *cmp = SIGN (bson_oid_compare (bson_iter_oid (a), bson_iter_oid (b)), 0);
+      return true;
+   case BSON_TYPE_BOOL:
+      *cmp = SIGN (bson_iter_bool (a), bson_iter_bool (b));
+      return true;
+   case BSON_TYPE_DATE_TIME:
+      *cmp = SIGN (bson_iter_date_time (a), bson_iter_date_time (b));
+      return true;
+   case BSON_TYPE_TIMESTAMP:
+      bson_iter_timestamp (a, &t_a, &i_a);
+      bson_iter_timestamp (b, &t_b, &i_b);
+      *cmp = t_a != t_b ? SIGN (t_a, t_b) : SIGN (i_a, i_b);
+      return true;
+   case BSON_TYPE_REGEX:
+      str_a = bson_iter_regex (a, &opts_a);
+      str_b = bson_iter_regex (b, &opts_b);
+      *cmp = SIGN (strcmp (str_a, str_b), 0);
+      if (!*cmp) {
+         *cmp = SIGN (strcmp (opts_a, opts_b), 0);
+      }
+
+      return true;
+   case BSON_TYPE_UNDEFINED:
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_MAXKEY:
+   case BSON_TYPE_MINKEY:
+      *cmp = 0;
+      return true;
+   case BSON_TYPE_EOD:
+   case BSON_TYPE_DBPOINTER:
+   case BSON_TYPE_CODEWSCOPE:
+   case BSON_TYPE_DECIMAL128:
+   default:
+      return false;
+   }
+}
+
+
+/* same key, type, and value, byte for byte: 1 and 1.0 differ */
+static bool
+_mongoc_update_diff_same (const bson_iter_t *a, const bson_iter_t *b)
+{
+   return a->next_off - a->off == b->next_off - b->off &&
+          !memcmp (a->raw + a->off, b->raw + b->off, b->next_off - b->off);
+}
+
+
+/* a field $set and $unset can name with a dotted path */
+static bool
+_mongoc_update_diff_key_ok (const char *key)
+{
+   return key[0] && key[0] != '$' && !strchr (key, '.');
+}
+
+
+/* find @key in the document @start iterates. documents usually keep their
+ * fields' order, so @in_order, just after the previous match, is tried
+ * first */
+static bool
+_mongoc_update_diff_find (const bson_iter_t *start,
+                          bson_iter_t *in_order,
+                          const char *key,
+                          bson_iter_t *found)
+{
+   *found = *in_order;
+   if (bson_iter_next (found) && !strcmp (bson_iter_key (found), key)) {
+      *in_order = *found;
+      return true;
+   }
+
+   *found = *start;
+   if (bson_iter_find (found, key)) {
+      *in_order = *found;
+      return true;
+   }
+
+   return false;
+}
+
+
+static void
+_mongoc_update_diff_path (bson_string_t *path,
+                          uint32_t prefix_len,
+                          const char *key)
+{
+   bson_string_truncate (path, prefix_len);
+   if (prefix_len) {
+      bson_string_append_c (path, '.');
+   }
+
+   bson_string_append (path, key);
+}
+
+
+/* diff one level of the documents, @path is the level's dotted path */
+static bool
+_mongoc_update_diff_level (const bson_iter_t *old_level,
+                           const bson_iter_t *new_level,
+                           bson_string_t *path,
+                           bson_t *set,
+                           bson_t *unset)
+{
+   uint32_t prefix_len = path->len;
+   bson_iter_t iter;
+   bson_iter_t in_order;
+   bson_iter_t found;
+   bson_iter_t old_child;
+   bson_iter_t new_child;
+   const char *key;
+
+   iter = *new_level;
+   in_order = *old_level;
+   while (bson_iter_next (&iter)) {
+      key = bson_iter_key (&iter);
+      if (!_mongoc_update_diff_key_ok (key)) {
+         return false;
+      }
+
+      _mongoc_update_diff_path (path, prefix_len, key);
+
+      if (!_mongoc_update_diff_find (old_level, &in_order, key, &found)) {
+         bson_append_iter (set, path->str, (int) path->len, &iter);
+      } else if (_mongoc_update_diff_same (&found, &iter)) {
+         continue;
+      } else if (BSON_ITER_HOLDS_DOCUMENT (&found) &&
+                 BSON_ITER_HOLDS_DOCUMENT (&iter) &&
+                 bson_iter_recurse (&found, &old_child) &&
+                 bson_iter_recurse (&iter, &new_child)) {
+         if (!_mongoc_update_diff_level (
+                &old_child, &new_child, path, set, unset)) {
+            return false;
+         }
+      } else {
+         /* changed scalars, arrays, and types are set whole */
+         bson_append_iter (set, path->str, (int) path->len, &iter);
+      }
+   }
+
+   iter = *old_level;
+   in_order = *new_level;
+   while (bson_iter_next (&iter)) {
+      key = bson_iter_key (&iter);
+      if (!_mongoc_update_diff_find (new_level, &in_order, key, &found)) {
+         if (!_mongoc_update_diff_key_ok (key)) {
+            return false;
+         }
+
+         _mongoc_update_diff_path (path, prefix_len, key);
+         bson_append_utf8 (unset, path->str, (int) path->len, "", 0);
+      }
+   }
+
+   bson_string_truncate (path, prefix_len);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_update_diff --
+ *
+ *       Append to @update the "$set" and "$unset" that turn @old_doc into
+ *       @new_doc, recursing into subdocuments so only changed fields are
+ *       sent. Empty if the documents are the same.
+ *
+ * Returns:
+ *       False if a field name can't be part of a dotted path, because it
+ *       has a "." or starts with "$": then replace the document instead.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_update_diff (const bson_t *old_doc,
+                     const bson_t *new_doc,
+                     bson_t *update)
+{
+   bson_t set = BSON_INITIALIZER;
+   bson_t unset = BSON_INITIALIZER;
+   bson_string_t *path;
+   bson_iter_t old_iter;
+   bson_iter_t new_iter;
+   bool ret;
+
+   path = bson_string_new (NULL);
+
+   ret = bson_iter_init (&old_iter, old_doc) &&
+         bson_iter_init (&new_iter, new_doc) &&
+         _mongoc_update_diff_level (&old_iter, &new_iter, path, &set, &unset);
+
+   if (ret && !bson_empty (&set)) {
+      BSON_APPEND_DOCUMENT (update, "$set", &set);
+   }
+
+   if (ret && !bson_empty (&unset)) {
+      BSON_APPEND_DOCUMENT (update, "$unset", &unset);
+   }
+
+   bson_string_free (path, true);
+   bson_destroy (&set);
+   bson_destroy (&unset);
+
+   return ret;
+}
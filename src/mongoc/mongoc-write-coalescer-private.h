@@ -0,0 +1,55 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_WRITE_COALESCER_PRIVATE_H
+#define MONGOC_WRITE_COALESCER_PRIVATE_H
+
+#if !defined(MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-collection.h"
+#include "mongoc-write-command-private.h"
+#include "mongoc-write-concern.h"
+
+BSON_BEGIN_DECLS
+
+/* Shared by a pool's clients: single-document inserts to the same
+ * collection from several threads within a short window are sent as one
+ * insert command, and each caller gets its own document's result. */
+typedef struct _mongoc_write_coalescer_t mongoc_write_coalescer_t;
+
+mongoc_write_coalescer_t *
+_mongoc_write_coalescer_new (int32_t window_msec, uint32_t max_documents);
+
+void
+_mongoc_write_coalescer_destroy (mongoc_write_coalescer_t *coalescer);
+
+void
+_mongoc_write_coalescer_reset_after_fork (mongoc_write_coalescer_t *coalescer);
+
+void
+_mongoc_write_coalescer_insert (mongoc_write_coalescer_t *coalescer,
+                                const mongoc_collection_t *collection,
+                                const bson_t *document,
+                                const mongoc_write_concern_t *write_concern,
+                                mongoc_write_result_t *result);
+
+BSON_END_DECLS
+
+#endif /* MONGOC_WRITE_COALESCER_PRIVATE_H */
@@ -0,0 +1,339 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-write-coalescer-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-cluster-private.h"
+#include "mongoc-collection-private.h"
+#include "mongoc-counters-private.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-trace-private.h"
+#include "mongoc-write-concern-private.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "coalescer"
+
+
+/* inserts to one collection with one write concern. the first caller, the
+ * leader, sends them all once the window ends or the group is full, while
+ * the other callers wait for the result */
+typedef struct _mongoc_write_coalescer_group_t {
+   char ns[128];
+   bson_t *write_concern;
+   mongoc_array_t documents; /* const bson_t *, owned by waiting callers */
+   bool closed;              /* being sent, add no more documents */
+   bool done;                /* result is ready */
+   uint32_t refs;            /* callers yet to read the result */
+   mongoc_write_result_t result;
+   mongoc_cond_t cond;
+   struct _mongoc_write_coalescer_group_t *next;
+} mongoc_write_coalescer_group_t;
+
+
+struct _mongoc_write_coalescer_t {
+   mongoc_mutex_t mutex;
+   int32_t window_msec;
+   uint32_t max_documents;
+   mongoc_write_coalescer_group_t *open; /* groups accepting documents */
+};
+
+
+mongoc_write_coalescer_t *
+_mongoc_write_coalescer_new (int32_t window_msec, uint32_t max_documents)
+{
+   mongoc_write_coalescer_t *coalescer;
+
+   coalescer = (mongoc_write_coalescer_t *) bson_malloc0 (sizeof *coalescer);
+   mongoc_mutex_init (&coalescer->mutex);
+   coalescer->window_msec = BSON_MAX (window_msec, 0);
+   coalescer->max_documents = BSON_MAX (max_documents, 1);
+
+   return coalescer;
+}
+
+
+void
+_mongoc_write_coalescer_destroy (mongoc_write_coalescer_t *coalescer)
+{
+   if (coalescer) {
+      /* clients are destroyed first, so no caller is waiting */
+      BSON_ASSERT (!coalescer->open);
+      mongoc_mutex_destroy (&coalescer->mutex);
+      bson_free (coalescer);
+   }
+}
+
+
+/* in a child process after fork: the open groups' leaders and waiters are
+ * the parent's threads, which don't exist here. the groups are leaked,
+ * since destroying a condition that had waiters may block */
+void
+_mongoc_write_coalescer_reset_after_fork (mongoc_write_coalescer_t *coalescer)
+{
+   if (!coalescer) {
+      return;
+   }
+
+   mongoc_mutex_init (&coalescer->mutex);
+   coalescer->open = NULL;
+}
+
+
+static mongoc_write_coalescer_group_t *
+_mongoc_write_coalescer_group_new (const char *ns, const bson_t *write_concern)
+{
+   mongoc_write_coalescer_group_t *group;
+
+   group = (mongoc_write_coalescer_group_t *) bson_malloc0 (sizeof *group);
+   bson_strncpy (group->ns, ns, sizeof group->ns);
+   group->write_concern = bson_copy (write_concern);
+   _mongoc_array_init (&group->documents, sizeof (const bson_t *));
+   _mongoc_write_result_init (&group->result);
+   mongoc_cond_init (&group->cond);
+
+   return group;
+}
+
+
+static void
+_mongoc_write_coalescer_group_destroy (mongoc_write_coalescer_group_t *group)
+{
+   bson_destroy (group->write_concern);
+   _mongoc_array_destroy (&group->documents);
+   _mongoc_write_result_destroy (&group->result);
+   mongoc_cond_destroy (&group->cond);
+   bson_free (group);
+}
+
+
+/* stop adding documents to @group. coalescer->mutex must be held */
+static void
+_mongoc_write_coalescer_close (mongoc_write_coalescer_t *coalescer,
+                               mongoc_write_coalescer_group_t *group)
+{
+   mongoc_write_coalescer_group_t **link;
+
+   for (link = &coalescer->open; *link; link = &(*link)->next) {
+      if (*link == group) {
+         *link = group->next;
+         break;
+      }
+   }
+
+   group->closed = true;
+}
+
+
+/* send the group's documents as one unordered insert on the leader's
+ * client, like _mongoc_collection_write_command_execute */
+static void
+_mongoc_write_coalescer_send (mongoc_write_coalescer_group_t *group,
+                              const mongoc_collection_t *collection,
+                              const mongoc_write_concern_t *write_concern)
+{
+   mongoc_bulk_write_flags_t write_flags = MONGOC_BULK_WRITE_FLAGS_INIT;
+   mongoc_write_command_t command;
+   mongoc_server_stream_t *server_stream;
+   size_t i;
+
+   ENTRY;
+
+   /* each caller's insert is independent of the others */
+   write_flags.ordered = false;
+
+   _mongoc_write_command_init_insert (
+      &command,
+      NULL,
+      write_flags,
+      ++collection->client->cluster.operation_id,
+      false);
+   /* the leader's client: this thread is using it */
+   command.oid_context = _mongoc_client_get_oid_context (collection->client);
+
+   for (i = 0; i < group->documents.len; i++) {
+      _mongoc_write_command_insert_borrow (
+         &command,
+         _mongoc_array_index (&group->documents, const bson_t *, i));
+   }
+
+   server_stream = mongoc_cluster_stream_for_writes (
+      &collection->client->cluster, &group->result.error);
+
+   if (server_stream) {
+      _mongoc_write_command_execute (&command,
+                                     collection->client,
+                                     server_stream,
+                                     collection->db,
+                                     collection->collection,
+                                     write_concern,
+                                     0 /* offset */,
+                                     NULL /* session */,
+                                     &group->result);
+
+      mongoc_server_stream_cleanup (server_stream);
+   }
+
+   _mongoc_write_command_destroy (&command);
+
+   if (group->documents.len > 1) {
+      mongoc_counter_op_egress_coalesced_add ((int64_t) group->documents.len);
+   }
+
+   EXIT;
+}
+
+
+/* the part of the group's result for the document at @index: its own write
+ * error, if any, and the errors that apply to every document */
+static void
+_mongoc_write_coalescer_result (const mongoc_write_coalescer_group_t *group,
+                                uint32_t index,
+                                mongoc_write_result_t *result)
+{
+   const mongoc_write_result_t *src = &group->result;
+   const mongoc_write_error_t *src_error;
+   mongoc_write_error_t write_error;
+   size_t i;
+
+   if (src->error.domain) {
+      /* like server selection or network errors */
+      memcpy (&result->error, &src->error, sizeof result->error);
+      result->failed = src->failed;
+      result->must_stop = src->must_stop;
+      return;
+   }
+
+   result->nInserted = 1;
+
+   for (i = 0; i < src->writeErrors.len; i++) {
+      src_error =
+         &_mongoc_array_index (&src->writeErrors, mongoc_write_error_t, i);
+      if (src_error->index == index) {
+         write_error.index = 0;
+         write_error.error = bson_copy (src_error->error);
+         _mongoc_array_append_val (&result->writeErrors, write_error);
+         result->nInserted = 0;
+         result->failed = true;
+         break;
+      }
+   }
+
+   if (src->n_writeConcernErrors) {
+      bson_destroy (&result->writeConcernErrors);
+      bson_copy_to (&src->writeConcernErrors, &result->writeConcernErrors);
+      result->n_writeConcernErrors = src->n_writeConcernErrors;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_coalescer_insert --
+ *
+ *       Insert @document into @collection, together with other threads'
+ *       inserts into the same collection with the same write concern.
+ *       The first caller waits for up to the window for others to join,
+ *       or until max_documents have joined, then sends them all. The
+ *       others wait for its reply.
+ *
+ * Side effects:
+ *       @result is filled out as if @document were inserted alone.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_write_coalescer_insert (mongoc_write_coalescer_t *coalescer,
+                                const mongoc_collection_t *collection,
+                                const bson_t *document,
+                                const mongoc_write_concern_t *write_concern,
+                                mongoc_write_result_t *result)
+{
+   mongoc_write_coalescer_group_t *group;
+   const bson_t *wc_bson;
+   uint32_t index;
+   int64_t deadline;
+   int64_t remaining;
+   bool leader;
+
+   ENTRY;
+
+   wc_bson = _mongoc_write_concern_get_bson (
+      (mongoc_write_concern_t *) write_concern);
+
+   mongoc_mutex_lock (&coalescer->mutex);
+
+   for (group = coalescer->open; group; group = group->next) {
+      if (!strcmp (group->ns, collection->ns) &&
+          bson_equal (group->write_concern, wc_bson)) {
+         break;
+      }
+   }
+
+   leader = !group;
+   if (leader) {
+      group = _mongoc_write_coalescer_group_new (collection->ns, wc_bson);
+      group->next = coalescer->open;
+      coalescer->open = group;
+   }
+
+   index = (uint32_t) group->documents.len;
+   _mongoc_array_append_val (&group->documents, document);
+   group->refs++;
+
+   if (group->documents.len >= coalescer->max_documents) {
+      _mongoc_write_coalescer_close (coalescer, group);
+      mongoc_cond_broadcast (&group->cond);
+   }
+
+   if (leader) {
+      deadline = bson_get_monotonic_time () +
+                 (int64_t) coalescer->window_msec * 1000;
+
+      while (!group->closed) {
+         remaining = (deadline - bson_get_monotonic_time ()) / 1000;
+         if (remaining <= 0) {
+            _mongoc_write_coalescer_close (coalescer, group);
+            break;
+         }
+
+         mongoc_cond_timedwait (&group->cond, &coalescer->mutex, remaining);
+      }
+
+      mongoc_mutex_unlock (&coalescer->mutex);
+      _mongoc_write_coalescer_send (group, collection, write_concern);
+      mongoc_mutex_lock (&coalescer->mutex);
+
+      group->done = true;
+      mongoc_cond_broadcast (&group->cond);
+   } else {
+      while (!group->done) {
+         mongoc_cond_wait (&group->cond, &coalescer->mutex);
+      }
+   }
+
+   _mongoc_write_coalescer_result (group, index, result);
+
+   if (--group->refs == 0) {
+      _mongoc_write_coalescer_group_destroy (group);
+   }
+
+   mongoc_mutex_unlock (&coalescer->mutex);
+
+   EXIT;
+}
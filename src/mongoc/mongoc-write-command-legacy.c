@@ -20,6 +20,32 @@
 #include "mongoc-trace-private.h"
 #include "mongoc-util-private.h"
 
+typedef struct {
+   mongoc_write_command_t *command;
+   const char *collection;
+} _mongoc_legacy_write_ctx_t;
+
+
+/* the modern write command equivalent to @command, with all its documents */
+static void
+_mongoc_build_legacy_write (void *ctx, bson_t *doc)
+{
+   _mongoc_legacy_write_ctx_t *write_ctx = (_mongoc_legacy_write_ctx_t *) ctx;
+   mongoc_write_concern_t *wc;
+
+   wc = mongoc_write_concern_new ();
+   mongoc_write_concern_set_w (wc, 0);
+
+   _mongoc_write_command_init (
+      doc, write_ctx->command, write_ctx->collection, wc);
+   _append_array_from_command (write_ctx->command, doc);
+
+   mongoc_write_concern_destroy (wc);
+}
+
+
+/* fire command-started event as if we'd used a modern write command. the
+ * command copies every document, so it's only built if a callback asks */
 static void
 _mongoc_monitor_legacy_write (mongoc_client_t *client,
                               mongoc_write_command_t *command,
@@ -28,25 +54,24 @@ _mongoc_monitor_legacy_write (mongoc_client_t *client,
                               mongoc_server_stream_t *stream,
                               int64_t request_id)
 {
-   bson_t doc;
    mongoc_apm_command_started_t event;
-   mongoc_write_concern_t *wc;
+   _mongoc_legacy_write_ctx_t write_ctx;
 
    ENTRY;
 
-   if (!client->apm_callbacks.started) {
+   if (!client->apm_callbacks.started ||
+       !_mongoc_apm_command_sampled (&client->apm_callbacks,
+                                     command->operation_id)) {
       EXIT;
    }
-   wc = mongoc_write_concern_new ();
-   mongoc_write_concern_set_w (wc, 0);
 
-   bson_init (&doc);
-   _mongoc_write_command_init (&doc, command, collection, wc);
-   _append_array_from_command (command, &doc);
+   write_ctx.command = command;
+   write_ctx.collection = collection;
 
-   mongoc_apm_command_started_init (
+   mongoc_apm_command_started_init_lazy (
       &event,
-      &doc,
+      _mongoc_build_legacy_write,
+      &write_ctx,
       db,
       _mongoc_command_type_to_name (command->type),
       request_id,
@@ -58,8 +83,8 @@ _mongoc_monitor_legacy_write (mongoc_client_t *client,
    client->apm_callbacks.started (&event);
 
    mongoc_apm_command_started_cleanup (&event);
-   mongoc_write_concern_destroy (wc);
-   bson_destroy (&doc);
+
+   EXIT;
 }
 
 
@@ -81,7 +106,9 @@ _mongoc_monitor_legacy_write_succeeded (mongoc_client_t *client,
 
    ENTRY;
 
-   if (!client->apm_callbacks.succeeded) {
+   if (!client->apm_callbacks.succeeded ||
+       !_mongoc_apm_command_sampled (&client->apm_callbacks,
+                                     command->operation_id)) {
       EXIT;
    }
 
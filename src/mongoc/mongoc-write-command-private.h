@@ -28,6 +28,7 @@
 #include "mongoc-write-concern.h"
 #include "mongoc-server-stream-private.h"
 #include "mongoc-buffer-private.h"
+#include "mongoc-array-private.h"
 
 
 BSON_BEGIN_DECLS
@@ -37,6 +38,19 @@ BSON_BEGIN_DECLS
 #define MONGOC_WRITE_COMMAND_INSERT 1
 #define MONGOC_WRITE_COMMAND_UPDATE 2
 
+/* documents smaller than this are copied into the payload even when they
+ * could be borrowed, an iovec per tiny document costs more than memcpy */
+#define MONGOC_WRITE_COMMAND_BORROW_MIN 512
+
+
+/* a document sent in place: @data points at a borrowed or owned bson_t's
+ * buffer, or is NULL if the document was copied to @offset in the payload */
+typedef struct {
+   const uint8_t *data;
+   uint32_t offset;
+   uint32_t len;
+} mongoc_write_doc_t;
+
 
 typedef enum {
    MONGOC_BYPASS_DOCUMENT_VALIDATION_FALSE = 0,
@@ -54,9 +68,18 @@ struct _mongoc_bulk_write_flags_t {
 typedef struct {
    int type;
    mongoc_buffer_t payload;
+   /* once a document is borrowed, every document has a mongoc_write_doc_t
+    * here, in order; until then docs.element_size is 0 */
+   mongoc_array_t docs;
+   mongoc_array_t owned; /* bson_t *, destroyed with the command */
    uint32_t n_documents;
+   /* after _mongoc_write_command_group, each statement's index as it was
+    * appended, or NULL if the statements are still in that order */
+   uint32_t *order;
    mongoc_bulk_write_flags_t flags;
    int64_t operation_id;
+   /* generates missing "_id"s, or NULL for libbson's default context */
+   bson_context_t *oid_context;
    union {
       struct {
          bool allow_bulk_op_insert;
@@ -65,6 +88,20 @@ typedef struct {
 } mongoc_write_command_t;
 
 
+/* an upserted document, and its index into the whole bulk operation */
+typedef struct {
+   uint32_t index;
+   bson_value_t id;
+} mongoc_write_upsert_t;
+
+
+/* a write error document from the server, its "index" is into the batch */
+typedef struct {
+   uint32_t index; /* into the whole bulk operation */
+   bson_t *error;
+} mongoc_write_error_t;
+
+
 typedef struct {
    /* true after a legacy update prevents us from calculating nModified */
    uint32_t nInserted;
@@ -72,17 +109,16 @@ typedef struct {
    uint32_t nModified;
    uint32_t nRemoved;
    uint32_t nUpserted;
-   /* like [{"index": int, "_id": value}, ...] */
-   bson_t writeErrors;
-   /* like [{"index": int, "code": int, "errmsg": str}, ...] */
-   bson_t upserted;
+   /* mongoc_write_error_t and mongoc_write_upsert_t, merged without
+    * copying BSON, and built into the reply's arrays only at the end */
+   mongoc_array_t writeErrors;
+   mongoc_array_t upserted;
    /* like [{"code": 64, "errmsg": "duplicate"}, ...] */
    uint32_t n_writeConcernErrors;
    bson_t writeConcernErrors;
    bool failed;    /* The command failed */
    bool must_stop; /* The stream may have been disonnected */
    bson_error_t error;
-   uint32_t upsert_append_count;
 } mongoc_write_result_t;
 
 
@@ -121,11 +157,30 @@ void
 _mongoc_write_command_insert_append (mongoc_write_command_t *command,
                                      const bson_t *document);
 void
+_mongoc_write_command_insert_borrow (mongoc_write_command_t *command,
+                                     const bson_t *document);
+void
+_mongoc_write_command_insert_steal (mongoc_write_command_t *command,
+                                    bson_t *document);
+void
+_mongoc_write_command_insert_raw (mongoc_write_command_t *command,
+                                  const uint8_t *data,
+                                  size_t len);
+void
 _mongoc_write_command_update_append (mongoc_write_command_t *command,
                                      const bson_t *selector,
                                      const bson_t *update,
                                      const bson_t *opts);
 
+void
+_mongoc_write_command_coalesce_updates (mongoc_write_command_t *command);
+void
+_mongoc_write_command_group (mongoc_write_command_t *command,
+                             uint32_t n_groups,
+                             uint32_t (*group) (const bson_t *document,
+                                                void *data),
+                             void *data);
+
 void
 _mongoc_write_command_delete_append (mongoc_write_command_t *command,
                                      const bson_t *selector,
@@ -162,6 +217,10 @@ _mongoc_write_result_merge (mongoc_write_result_t *result,
                             mongoc_write_command_t *command,
                             const bson_t *reply,
                             uint32_t offset);
+void
+_mongoc_write_result_merge_result (mongoc_write_result_t *result,
+                                   const mongoc_write_result_t *src,
+                                   uint32_t offset);
 bool
 _mongoc_write_result_complete (mongoc_write_result_t *result,
                                int32_t error_api_version,
@@ -17,7 +17,10 @@
 #include <bson.h>
 
 #include "mongoc-client-private.h"
+#include "mongoc-client-session-private.h"
+#include "mongoc-counters-private.h"
 #include "mongoc-error.h"
+#include "mongoc-memory-private.h"
 #include "mongoc-trace-private.h"
 #include "mongoc-write-command-private.h"
 #include "mongoc-write-command-legacy-private.h"
@@ -70,13 +73,94 @@ _mongoc_command_type_to_field_name (int command_type)
    return gCommandFields[command_type];
 }
 
+/* copy @document to the end of the payload */
+static void
+_mongoc_write_command_copy (mongoc_write_command_t *command,
+                            const bson_t *document)
+{
+   mongoc_write_doc_t doc;
+
+   doc.data = NULL;
+   doc.offset = (uint32_t) command->payload.len;
+   doc.len = document->len;
+
+   _mongoc_buffer_append (
+      &command->payload, bson_get_data (document), document->len);
+
+   if (command->docs.element_size) {
+      _mongoc_array_append_val (&command->docs, doc);
+   }
+}
+
+
+/* give each document copied so far a mongoc_write_doc_t, so documents can
+ * be borrowed or reordered */
+static void
+_mongoc_write_command_index (mongoc_write_command_t *command)
+{
+   mongoc_write_doc_t doc;
+   int32_t len;
+
+   if (command->docs.element_size) {
+      return;
+   }
+
+   _mongoc_array_init (&command->docs, sizeof (mongoc_write_doc_t));
+
+   doc.data = NULL;
+   doc.offset = 0;
+   while (doc.offset < command->payload.len) {
+      memcpy (&len, command->payload.data + doc.offset, 4);
+      doc.len = BSON_UINT32_FROM_LE (len);
+      _mongoc_array_append_val (&command->docs, doc);
+      doc.offset += doc.len;
+   }
+}
+
+
+/* send the document at @data in place, it must outlive the command */
+static void
+_mongoc_write_command_borrow (mongoc_write_command_t *command,
+                              const uint8_t *data,
+                              uint32_t doc_len)
+{
+   mongoc_write_doc_t doc;
+
+   _mongoc_write_command_index (command);
+
+   doc.data = data;
+   doc.offset = 0;
+   doc.len = doc_len;
+   _mongoc_array_append_val (&command->docs, doc);
+}
+
+
+/* if @document has no "_id", a new document with a generated one */
+static bson_t *
+_mongoc_write_command_with_id (mongoc_write_command_t *command,
+                               const bson_t *document)
+{
+   bson_oid_t oid;
+   bson_t *tmp;
+
+   if (bson_has_field (document, "_id")) {
+      return NULL;
+   }
+
+   tmp = bson_sized_new (document->len + 17);
+   bson_oid_init (&oid, command->oid_context);
+   BSON_APPEND_OID (tmp, "_id", &oid);
+   bson_concat (tmp, document);
+
+   return tmp;
+}
+
+
 void
 _mongoc_write_command_insert_append (mongoc_write_command_t *command,
                                      const bson_t *document)
 {
-   bson_iter_t iter;
-   bson_oid_t oid;
-   bson_t tmp;
+   bson_t *tmp;
 
    ENTRY;
 
@@ -87,18 +171,105 @@ _mongoc_write_command_insert_append (mongoc_write_command_t *command,
 
    /*
     * If the document does not contain an "_id" field, we need to generate
-    * a new oid for "_id".
+    * a new oid for "_id". The new document is ours, so keep it rather
+    * than copying it again.
     */
-   if (!bson_iter_init_find (&iter, document, "_id")) {
-      bson_init (&tmp);
-      bson_oid_init (&oid, NULL);
-      BSON_APPEND_OID (&tmp, "_id", &oid);
-      bson_concat (&tmp, document);
-      _mongoc_buffer_append (&command->payload, bson_get_data (&tmp), tmp.len);
-      bson_destroy (&tmp);
+   if ((tmp = _mongoc_write_command_with_id (command, document))) {
+      _mongoc_write_command_insert_steal (command, tmp);
+      EXIT;
+   }
+
+   _mongoc_write_command_copy (command, document);
+   command->n_documents++;
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_insert_borrow --
+ *
+ *       Like _mongoc_write_command_insert_append, but the OP_MSG document
+ *       sequence points at @document's buffer instead of a copy. The
+ *       caller guarantees @document is neither modified nor freed before
+ *       the command is destroyed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_write_command_insert_borrow (mongoc_write_command_t *command,
+                                     const bson_t *document)
+{
+   bson_t *tmp;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_INSERT);
+   BSON_ASSERT (document);
+   BSON_ASSERT (document->len >= 5);
+
+   if ((tmp = _mongoc_write_command_with_id (command, document))) {
+      _mongoc_write_command_insert_steal (command, tmp);
+      EXIT;
+   }
+
+   if (document->len < MONGOC_WRITE_COMMAND_BORROW_MIN) {
+      _mongoc_write_command_copy (command, document);
    } else {
-      _mongoc_buffer_append (
-         &command->payload, bson_get_data (document), document->len);
+      _mongoc_write_command_borrow (
+         command, bson_get_data (document), document->len);
+   }
+
+   command->n_documents++;
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_insert_steal --
+ *
+ *       Like _mongoc_write_command_insert_borrow, but the command takes
+ *       ownership of @document, a heap-allocated bson_t, and destroys it.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_write_command_insert_steal (mongoc_write_command_t *command,
+                                    bson_t *document)
+{
+   bson_t *tmp;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_INSERT);
+   BSON_ASSERT (document);
+   BSON_ASSERT (document->len >= 5);
+
+   if ((tmp = _mongoc_write_command_with_id (command, document))) {
+      bson_destroy (document);
+      document = tmp;
+   }
+
+   if (document->len < MONGOC_WRITE_COMMAND_BORROW_MIN) {
+      _mongoc_write_command_copy (command, document);
+      bson_destroy (document);
+   } else {
+      if (!command->owned.element_size) {
+         _mongoc_array_init (&command->owned, sizeof (bson_t *));
+      }
+
+      _mongoc_array_append_val (&command->owned, document);
+      _mongoc_write_command_borrow (
+         command, bson_get_data (document), document->len);
    }
 
    command->n_documents++;
@@ -106,6 +277,143 @@ _mongoc_write_command_insert_append (mongoc_write_command_t *command,
    EXIT;
 }
 
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_insert_raw --
+ *
+ *       Like _mongoc_write_command_insert_borrow for each of the
+ *       documents laid end to end in @data, which the caller has checked
+ *       are framed correctly. A document whose first field is "_id" is
+ *       borrowed whatever its size, so a run of them is sent as one
+ *       iovec; only the others are copied, with a generated "_id".
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_write_command_insert_raw (mongoc_write_command_t *command,
+                                  const uint8_t *data,
+                                  size_t len)
+{
+   bson_t document;
+   uint32_t doc_len;
+   size_t offset = 0;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_INSERT);
+   BSON_ASSERT (data || len == 0);
+
+   while (offset < len) {
+      memcpy (&doc_len, data + offset, 4);
+      doc_len = BSON_UINT32_FROM_LE (doc_len);
+      BSON_ASSERT (doc_len >= 5 && doc_len <= len - offset);
+
+      if (doc_len > 9 && data[offset + 4] != BSON_TYPE_EOD &&
+          !memcmp (data + offset + 5, "_id", 4)) {
+         _mongoc_write_command_borrow (command, data + offset, doc_len);
+         command->n_documents++;
+      } else {
+         BSON_ASSERT (bson_init_static (&document, data + offset, doc_len));
+         _mongoc_write_command_insert_borrow (command, &document);
+      }
+
+      offset += doc_len;
+   }
+
+   EXIT;
+}
+
+
+/* pre-OP_MSG paths read the payload, move borrowed documents into it */
+static void
+_mongoc_write_command_flatten (mongoc_write_command_t *command)
+{
+   mongoc_buffer_t payload;
+   mongoc_write_doc_t *doc;
+   size_t i;
+
+   if (!command->docs.element_size) {
+      return;
+   }
+
+   _mongoc_buffer_init_tagged (&payload, MONGOC_MEMORY_TAG_BULK);
+   _mongoc_buffer_set_budget (&payload, command->payload.budget);
+
+   for (i = 0; i < command->docs.len; i++) {
+      doc = &_mongoc_array_index (&command->docs, mongoc_write_doc_t, i);
+      _mongoc_buffer_append (
+         &payload,
+         doc->data ? doc->data : command->payload.data + doc->offset,
+         doc->len);
+   }
+
+   _mongoc_buffer_destroy (&command->payload);
+   command->payload = payload;
+
+   _mongoc_array_destroy (&command->docs);
+   memset (&command->docs, 0, sizeof command->docs);
+}
+
+
+/* end of the documents, as a position for _mongoc_write_command_peek */
+static size_t
+_mongoc_write_command_end (const mongoc_write_command_t *command)
+{
+   return command->docs.element_size ? command->docs.len
+                                     : command->payload.len;
+}
+
+
+/* the document at @pos, and the position of the next one */
+static void
+_mongoc_write_command_peek (const mongoc_write_command_t *command,
+                            size_t pos,
+                            mongoc_iovec_t *iov,
+                            size_t *next)
+{
+   const mongoc_write_doc_t *doc;
+   int32_t len;
+
+   if (command->docs.element_size) {
+      doc = &_mongoc_array_index (&command->docs, mongoc_write_doc_t, pos);
+      iov->iov_base = (void *) (doc->data ? doc->data
+                                          : command->payload.data +
+                                               doc->offset);
+      iov->iov_len = doc->len;
+      *next = pos + 1;
+   } else {
+      memcpy (&len, command->payload.data + pos, 4);
+      iov->iov_base = (void *) (command->payload.data + pos);
+      iov->iov_len = BSON_UINT32_FROM_LE (len);
+      *next = pos + iov->iov_len;
+   }
+}
+
+
+/* add a document to a batch, merging it with the previous iovec when it
+ * follows it in memory, as copied documents do */
+static void
+_mongoc_write_iov_append (mongoc_array_t *iov, const mongoc_iovec_t *doc)
+{
+   mongoc_iovec_t *last;
+
+   if (iov->len) {
+      last = &_mongoc_array_index (iov, mongoc_iovec_t, iov->len - 1);
+      if ((uint8_t *) last->iov_base + last->iov_len ==
+          (uint8_t *) doc->iov_base) {
+         last->iov_len += doc->iov_len;
+         return;
+      }
+   }
+
+   _mongoc_array_append_val (iov, *doc);
+}
+
+
 void
 _mongoc_write_command_update_append (mongoc_write_command_t *command,
                                      const bson_t *selector,
@@ -137,6 +445,392 @@ _mongoc_write_command_update_append (mongoc_write_command_t *command,
    EXIT;
 }
 
+/* one document's updates in a run being coalesced */
+typedef struct {
+   /* {_id: value}, in the original payload */
+   const uint8_t *q_data;
+   uint32_t q_len;
+   bson_t *set; /* the merged $set */
+   bool upsert;
+   uint32_t hash;
+   int32_t next; /* the next entry in its hash bucket, or -1 */
+} mongoc_write_coalesced_t;
+
+
+/* if @statement is {q: {_id: value}, u: {$set: {...}}}, with at most
+ * "upsert" and "multi": false besides, view its parts in @q and @set */
+static bool
+_mongoc_write_update_coalescable (const bson_t *statement,
+                                  bson_t *q,
+                                  bson_t *set,
+                                  bool *upsert)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_iter_t op;
+   const uint8_t *data;
+   uint32_t len;
+   const char *key;
+   bool has_q = false;
+   bool has_u = false;
+   bson_t u;
+
+   *upsert = false;
+
+   BSON_ASSERT (bson_iter_init (&iter, statement));
+   while (bson_iter_next (&iter)) {
+      key = bson_iter_key (&iter);
+      if (!strcmp (key, "q") && BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         bson_iter_document (&iter, &len, &data);
+         BSON_ASSERT (bson_init_static (q, data, len));
+
+         /* an exact _id, not {$in: [...]} or a regex */
+         if (bson_count_keys (q) != 1 ||
+             !bson_iter_init_find (&child, q, "_id") ||
+             BSON_ITER_HOLDS_REGEX (&child) ||
+             (BSON_ITER_HOLDS_DOCUMENT (&child) &&
+              bson_iter_recurse (&child, &op) && bson_iter_next (&op) &&
+              bson_iter_key (&op)[0] == '$')) {
+            return false;
+         }
+
+         has_q = true;
+      } else if (!strcmp (key, "u") && BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         bson_iter_document (&iter, &len, &data);
+         BSON_ASSERT (bson_init_static (&u, data, len));
+
+         if (!bson_iter_init (&child, &u) || !bson_iter_next (&child) ||
+             strcmp (bson_iter_key (&child), "$set") ||
+             !BSON_ITER_HOLDS_DOCUMENT (&child) || bson_iter_next (&child)) {
+            return false;
+         }
+
+         BSON_ASSERT (bson_iter_init_find (&child, &u, "$set"));
+         bson_iter_document (&child, &len, &data);
+         BSON_ASSERT (bson_init_static (set, data, len));
+         if (bson_empty (set)) {
+            return false;
+         }
+
+         has_u = true;
+      } else if (!strcmp (key, "upsert") && BSON_ITER_HOLDS_BOOL (&iter)) {
+         *upsert = bson_iter_bool (&iter);
+      } else if (strcmp (key, "multi") || !BSON_ITER_HOLDS_BOOL (&iter) ||
+                 bson_iter_bool (&iter)) {
+         return false;
+      }
+   }
+
+   return has_q && has_u;
+}
+
+
+/* true if path @b is within path @a, like "a.b" within "a" */
+static bool
+_mongoc_write_path_within (const char *a, const char *b)
+{
+   size_t len = strlen (a);
+
+   return !strncmp (a, b, len) && b[len] == '.';
+}
+
+
+/* true if setting @later's fields after @earlier's does what setting them
+ * at once does: no path of one is within a path of the other */
+static bool
+_mongoc_write_sets_compatible (const bson_t *earlier, const bson_t *later)
+{
+   bson_iter_t a;
+   bson_iter_t b;
+
+   BSON_ASSERT (bson_iter_init (&b, later));
+   while (bson_iter_next (&b)) {
+      BSON_ASSERT (bson_iter_init (&a, earlier));
+      while (bson_iter_next (&a)) {
+         if (_mongoc_write_path_within (bson_iter_key (&a),
+                                        bson_iter_key (&b)) ||
+             _mongoc_write_path_within (bson_iter_key (&b),
+                                        bson_iter_key (&a))) {
+            return false;
+         }
+      }
+   }
+
+   return true;
+}
+
+
+/* @entry's $set, then @later's, with @later's values for fields in both */
+static void
+_mongoc_write_sets_merge (mongoc_write_coalesced_t *entry,
+                          const bson_t *later)
+{
+   bson_iter_t iter;
+   bson_t *merged;
+
+   merged = bson_sized_new (entry->set->len + later->len);
+   BSON_ASSERT (bson_iter_init (&iter, entry->set));
+   while (bson_iter_next (&iter)) {
+      if (!bson_has_field (later, bson_iter_key (&iter))) {
+         BSON_ASSERT (bson_append_iter (merged, NULL, 0, &iter));
+      }
+   }
+
+   bson_concat (merged, later);
+   bson_destroy (entry->set);
+   entry->set = merged;
+}
+
+
+/* append the run's merged updates to @payload, in the order of each
+ * document's first update, and empty the run */
+static void
+_mongoc_write_coalesced_flush (mongoc_array_t *run,
+                               int32_t *buckets,
+                               uint32_t mask,
+                               mongoc_buffer_t *payload,
+                               uint32_t *n_documents)
+{
+   mongoc_write_coalesced_t *entry;
+   bson_t statement;
+   bson_t q;
+   bson_t u;
+   size_t i;
+
+   for (i = 0; i < run->len; i++) {
+      entry = &_mongoc_array_index (run, mongoc_write_coalesced_t, i);
+      BSON_ASSERT (bson_init_static (&q, entry->q_data, entry->q_len));
+
+      bson_init (&statement);
+      BSON_APPEND_DOCUMENT (&statement, "q", &q);
+      BSON_APPEND_DOCUMENT_BEGIN (&statement, "u", &u);
+      BSON_APPEND_DOCUMENT (&u, "$set", entry->set);
+      bson_append_document_end (&statement, &u);
+      if (entry->upsert) {
+         BSON_APPEND_BOOL (&statement, "upsert", true);
+      }
+
+      _mongoc_buffer_append (
+         payload, bson_get_data (&statement), statement.len);
+      (*n_documents)++;
+
+      buckets[entry->hash & mask] = -1;
+      bson_destroy (&statement);
+      bson_destroy (entry->set);
+   }
+
+   _mongoc_array_clear (run);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_coalesce_updates --
+ *
+ *       For an unordered bulk's update command: merge each run of
+ *       consecutive single-document updates by _id with only $set into
+ *       one update per document, when their paths don't overlap. Any
+ *       other statement ends the run, so what the updates do is unchanged;
+ *       only the number of statements, and so the reply's counts, drop.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_write_command_coalesce_updates (mongoc_write_command_t *command)
+{
+   mongoc_write_coalesced_t *entry;
+   mongoc_write_coalesced_t added;
+   mongoc_buffer_t payload;
+   mongoc_array_t run;
+   bson_t statement;
+   bson_t q;
+   bson_t set;
+   bool upsert;
+   int32_t *buckets;
+   int32_t i;
+   uint32_t n_buckets = 16;
+   uint32_t n_documents = 0;
+   uint32_t hash;
+   uint32_t len;
+   uint32_t j;
+   size_t offset = 0;
+
+   ENTRY;
+
+   BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_UPDATE);
+   BSON_ASSERT (!command->docs.element_size);
+
+   if (command->n_documents < 2) {
+      EXIT;
+   }
+
+   while (n_buckets < command->n_documents) {
+      n_buckets <<= 1;
+   }
+
+   buckets = (int32_t *) bson_malloc (n_buckets * sizeof (int32_t));
+   memset (buckets, 0xff, n_buckets * sizeof (int32_t));
+
+   _mongoc_buffer_init_tagged (&payload, MONGOC_MEMORY_TAG_BULK);
+   _mongoc_buffer_set_budget (&payload, command->payload.budget);
+   _mongoc_array_init (&run, sizeof (mongoc_write_coalesced_t));
+
+   while (offset < command->payload.len) {
+      memcpy (&len, command->payload.data + offset, 4);
+      len = BSON_UINT32_FROM_LE (len);
+      BSON_ASSERT (
+         bson_init_static (&statement, command->payload.data + offset, len));
+      offset += len;
+
+      if (!_mongoc_write_update_coalescable (&statement, &q, &set, &upsert)) {
+         _mongoc_write_coalesced_flush (
+            &run, buckets, n_buckets - 1, &payload, &n_documents);
+         _mongoc_buffer_append (&payload, bson_get_data (&statement), len);
+         n_documents++;
+         continue;
+      }
+
+      /* FNV-1a of the selector */
+      hash = 2166136261u;
+      for (j = 0; j < q.len; j++) {
+         hash = (hash ^ bson_get_data (&q)[j]) * 16777619u;
+      }
+
+      entry = NULL;
+      i = buckets[hash & (n_buckets - 1)];
+      while (i >= 0) {
+         entry = &_mongoc_array_index (&run, mongoc_write_coalesced_t, i);
+         if (entry->hash == hash && entry->q_len == q.len &&
+             !memcmp (entry->q_data, bson_get_data (&q), q.len)) {
+            break;
+         }
+
+         i = entry->next;
+         entry = NULL;
+      }
+
+      if (entry && entry->upsert == upsert &&
+          _mongoc_write_sets_compatible (entry->set, &set)) {
+         _mongoc_write_sets_merge (entry, &set);
+         continue;
+      }
+
+      if (entry) {
+         /* the updates must stay in order, start a new run */
+         _mongoc_write_coalesced_flush (
+            &run, buckets, n_buckets - 1, &payload, &n_documents);
+      }
+
+      added.q_data = bson_get_data (&q);
+      added.q_len = q.len;
+      added.set = bson_copy (&set);
+      added.upsert = upsert;
+      added.hash = hash;
+      added.next = buckets[hash & (n_buckets - 1)];
+      buckets[hash & (n_buckets - 1)] = (int32_t) run.len;
+      _mongoc_array_append_val (&run, added);
+   }
+
+   _mongoc_write_coalesced_flush (
+      &run, buckets, n_buckets - 1, &payload, &n_documents);
+
+   _mongoc_array_destroy (&run);
+   bson_free (buckets);
+
+   _mongoc_buffer_destroy (&command->payload);
+   command->payload = payload;
+   command->n_documents = n_documents;
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_group --
+ *
+ *       For an unordered bulk's command: move the statements so that those
+ *       @group puts in the same group, from 0 to @n_groups - 1, are
+ *       consecutive, keeping their order within each group. Statements are
+ *       still split into batches afterward, so a batch holds as few groups
+ *       as possible. Write errors and upserts are reported by each
+ *       statement's index before grouping.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_write_command_group (mongoc_write_command_t *command,
+                             uint32_t n_groups,
+                             uint32_t (*group) (const bson_t *document,
+                                                void *data),
+                             void *data)
+{
+   mongoc_write_doc_t *docs;
+   mongoc_write_doc_t *unsorted;
+   bson_t document;
+   uint32_t *groups;
+   uint32_t *starts;
+   uint32_t *order;
+   uint32_t n;
+   uint32_t i;
+   uint32_t j;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (!command->flags.ordered);
+
+   if (command->n_documents < 2 || n_groups < 2) {
+      EXIT;
+   }
+
+   _mongoc_write_command_index (command);
+
+   n = (uint32_t) command->docs.len;
+   docs = (mongoc_write_doc_t *) command->docs.data;
+   groups = (uint32_t *) bson_malloc (n * sizeof (uint32_t));
+   starts = (uint32_t *) bson_malloc0 ((n_groups + 1) * sizeof (uint32_t));
+
+   for (i = 0; i < n; i++) {
+      BSON_ASSERT (bson_init_static (
+         &document,
+         docs[i].data ? docs[i].data : command->payload.data + docs[i].offset,
+         docs[i].len));
+      groups[i] = group (&document, data);
+      BSON_ASSERT (groups[i] < n_groups);
+      starts[groups[i] + 1]++;
+   }
+
+   for (i = 0; i < n_groups; i++) {
+      starts[i + 1] += starts[i];
+   }
+
+   /* a stable counting sort */
+   unsorted = (mongoc_write_doc_t *) bson_malloc (n * sizeof *unsorted);
+   memcpy (unsorted, docs, n * sizeof *unsorted);
+   order = (uint32_t *) bson_malloc (n * sizeof (uint32_t));
+
+   for (i = 0; i < n; i++) {
+      j = starts[groups[i]]++;
+      docs[j] = unsorted[i];
+      order[j] = command->order ? command->order[i] : i;
+   }
+
+   bson_free (command->order);
+   command->order = order;
+
+   bson_free (unsorted);
+   bson_free (starts);
+   bson_free (groups);
+
+   EXIT;
+}
+
+
 void
 _mongoc_write_command_delete_append (mongoc_write_command_t *command,
                                      const bson_t *selector,
@@ -181,9 +875,13 @@ _mongoc_write_command_init_bulk (mongoc_write_command_t *command,
    command->type = type;
    command->flags = flags;
    command->operation_id = operation_id;
+   command->oid_context = NULL;
 
-   _mongoc_buffer_init (&command->payload, NULL, 0, NULL, NULL);
+   _mongoc_buffer_init_tagged (&command->payload, MONGOC_MEMORY_TAG_BULK);
+   memset (&command->docs, 0, sizeof command->docs);
+   memset (&command->owned, 0, sizeof command->owned);
    command->n_documents = 0;
+   command->order = NULL;
 
    EXIT;
 }
@@ -361,6 +1059,87 @@ _mongoc_write_command_will_overflow (uint32_t len_so_far,
 }
 
 
+/* a replica set member or mongos that supports retryable writes */
+static bool
+_mongoc_write_server_can_retry (const mongoc_server_stream_t *server_stream)
+{
+   const mongoc_server_description_t *sd = server_stream->sd;
+
+   return sd->max_wire_version >= WIRE_VERSION_RETRYABLE_WRITES &&
+          sd->session_timeout_minutes != MONGOC_NO_SESSIONS &&
+          sd->type != MONGOC_SERVER_STANDALONE;
+}
+
+
+/* inserts, and updates and deletes that each affect one document, can be
+ * retried: the server remembers the statements it applied per txnNumber */
+static bool
+_mongoc_write_command_can_retry (const mongoc_write_command_t *command)
+{
+   mongoc_iovec_t doc;
+   bson_iter_t iter;
+   bson_t statement;
+   size_t pos = 0;
+   size_t next;
+   size_t end;
+
+   if (command->type == MONGOC_WRITE_COMMAND_INSERT) {
+      return true;
+   }
+
+   end = _mongoc_write_command_end (command);
+
+   while (pos < end) {
+      _mongoc_write_command_peek (command, pos, &doc, &next);
+      pos = next;
+
+      if (!bson_init_static (
+             &statement, (const uint8_t *) doc.iov_base, doc.iov_len)) {
+         return false;
+      }
+
+      if (command->type == MONGOC_WRITE_COMMAND_UPDATE) {
+         if (bson_iter_init_find (&iter, &statement, "multi") &&
+             bson_iter_as_bool (&iter)) {
+            return false;
+         }
+      } else if (!bson_iter_init_find (&iter, &statement, "limit") ||
+                 bson_iter_as_int64 (&iter) != 1) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
+/* after a retryable error from @server_stream, select a new primary for the
+ * retry, or return NULL to report the original error */
+static mongoc_server_stream_t *
+_mongoc_write_retry_stream (mongoc_client_t *client,
+                            const mongoc_server_stream_t *server_stream,
+                            const bson_error_t *error)
+{
+   mongoc_server_stream_t *retry_stream;
+   bson_error_t ignored;
+
+   _mongoc_cluster_invalidate_for_retry (
+      &client->cluster, server_stream->sd->id, error);
+
+   retry_stream = mongoc_cluster_stream_for_writes (&client->cluster, &ignored);
+   if (retry_stream && !_mongoc_write_server_can_retry (retry_stream)) {
+      mongoc_server_stream_cleanup (retry_stream);
+      retry_stream = NULL;
+   }
+
+   if (retry_stream) {
+      mongoc_counter_op_egress_retried_writes_inc ();
+   }
+
+   return retry_stream;
+}
+
+
 static void
 _mongoc_write_opmsg (mongoc_write_command_t *command,
                      mongoc_client_t *client,
@@ -369,6 +1148,7 @@ _mongoc_write_opmsg (mongoc_write_command_t *command,
                      const char *collection,
                      const mongoc_write_concern_t *write_concern,
                      uint32_t index_offset,
+                     mongoc_client_session_t *session,
                      mongoc_write_result_t *result,
                      bson_error_t *error)
 {
@@ -381,10 +1161,22 @@ _mongoc_write_opmsg (mongoc_write_command_t *command,
    int32_t max_document_count;
    uint32_t header = 16 * 1024;
    uint32_t payload_batch_size = 0;
-   uint32_t payload_total_offset = 0;
+   mongoc_array_t iov;
+   mongoc_iovec_t iov_buf[MONGOC_RPC_INLINE_IOVECS];
+   mongoc_iovec_t doc;
+   size_t pos = 0;
+   size_t next;
+   size_t end;
    bool ship_it = false;
    int document_count = 0;
    int32_t len;
+   int64_t budget_bytes;
+   bool retry_writes;
+   bool in_transaction;
+   mongoc_client_session_t *implicit_session = NULL;
+   mongoc_server_stream_t *retry_stream = NULL;
+   bson_iter_t txn_number;
+   bson_error_t ignored;
 
    ENTRY;
 
@@ -394,6 +1186,20 @@ _mongoc_write_opmsg (mongoc_write_command_t *command,
    BSON_ASSERT (server_stream);
    BSON_ASSERT (collection);
 
+   /* a transaction's statements are acknowledged, its write concern applies
+    * to the commit. they aren't retried one by one */
+   in_transaction = _mongoc_client_session_in_transaction (session);
+   retry_writes = !in_transaction && client->cluster.retry_writes &&
+                  mongoc_write_concern_is_acknowledged (write_concern) &&
+                  _mongoc_write_server_can_retry (server_stream) &&
+                  _mongoc_write_command_can_retry (command);
+
+   if (retry_writes && !session) {
+      implicit_session = _mongoc_client_session_new (client, NULL, &ignored);
+      session = implicit_session;
+      retry_writes = session != NULL;
+   }
+
 /* MongoDB has a extra allowance to allow updating 16mb document,
  * as the update operators would otherwise overflow the 16mb object limit
  */
@@ -403,16 +1209,33 @@ _mongoc_write_opmsg (mongoc_write_command_t *command,
    max_document_count =
       mongoc_server_stream_max_write_batch_size (server_stream);
 
+   /* under memory pressure, send the documents in smaller batches */
+   budget_bytes = _mongoc_memory_budget_batch_bytes (client->budget);
+
    bson_init (&cmd);
    _mongoc_write_command_init (&cmd, command, collection, write_concern);
+   if (retry_writes) {
+      /* set for each batch, the body is sent without copying it */
+      BSON_APPEND_INT64 (&cmd, "txnNumber", 0);
+      BSON_ASSERT (bson_iter_init_find (&txn_number, &cmd, "txnNumber"));
+   }
+
    mongoc_cmd_parts_init (&parts, database, MONGOC_QUERY_NONE, &cmd);
+   parts.session = session;
    parts.assembled.operation_id = command->operation_id;
    if (!mongoc_cmd_parts_assemble (&parts, server_stream, error)) {
       bson_destroy (&cmd);
       mongoc_cmd_parts_cleanup (&parts);
+      if (implicit_session) {
+         mongoc_client_session_destroy (implicit_session);
+      }
       EXIT;
    }
 
+   /* no reply to wait for, the connection is free once the batch is sent */
+   parts.assembled.more_to_come =
+      !in_transaction && !mongoc_write_concern_is_acknowledged (write_concern);
+
    /*
     * OP_MSG header == 16 byte
     * + 4 bytes flagBits
@@ -424,15 +1247,18 @@ _mongoc_write_opmsg (mongoc_write_command_t *command,
     * + Y command identifier ("documents", "deletes", "updates") ( + \0)
     */
 
-   header =
-      26 + parts.assembled.command->len + gCommandFieldLens[command->type] + 1;
+   header = 26 + mongoc_cmd_get_len (&parts.assembled) +
+            gCommandFieldLens[command->type] + 1;
+
+   /* the batch's documents, sent from where they are: the payload for
+    * copied documents, the caller's buffers for borrowed ones */
+   _mongoc_array_init_inline (
+      &iov, sizeof (mongoc_iovec_t), iov_buf, sizeof iov_buf);
+   end = _mongoc_write_command_end (command);
 
    do {
-      len = 0;
-      memcpy (&len,
-              command->payload.data + payload_batch_size + payload_total_offset,
-              4);
-      len = BSON_UINT32_FROM_LE (len);
+      _mongoc_write_command_peek (command, pos, &doc, &next);
+      len = (int32_t) doc.iov_len;
 
       /* Skip the document if it's too large */
       if (len > max_bson_obj_size + BSON_OBJECT_ALLOWANCE) {
@@ -440,42 +1266,74 @@ _mongoc_write_opmsg (mongoc_write_command_t *command,
             error, index_offset, len, max_bson_obj_size);
          result->failed = true;
 
-         /* skip this document */
-         payload_batch_size = 0;
-         document_count = 0;
-         payload_total_offset += len;
-         ship_it = false;
+         /* skip this document, send what we have if it was the last */
+         pos = next;
+         ship_it = document_count > 0 && pos == end;
          /* Does adding this document to our current batch keep us under
           * the maximum batch size in bytes */
-      } else if ((payload_batch_size + header) + len <= max_msg_size) {
+      } else if ((payload_batch_size + header) + len <= max_msg_size &&
+                 !(budget_bytes && document_count &&
+                   payload_batch_size + len > budget_bytes)) {
+         _mongoc_write_iov_append (&iov, &doc);
          payload_batch_size += len;
+         pos = next;
 
          /* If this document filled the maximum document count */
          if (++document_count == max_document_count) {
             ship_it = true;
             /* If this document is the last document we have */
-         } else if (payload_batch_size + payload_total_offset ==
-                    command->payload.len) {
+         } else if (pos == end) {
             ship_it = true;
          } else {
             ship_it = false;
          }
       } else {
+         if ((payload_batch_size + header) + len <= max_msg_size) {
+            mongoc_counter_memory_smaller_batches_inc ();
+         }
+
          ship_it = true;
       }
 
       if (ship_it) {
-         /* Seek passed the document offset we have already sent */
-         parts.assembled.payload = command->payload.data + payload_total_offset;
-         /* Only send the documents up to this size */
+         /* Only send the documents in this batch */
+         parts.assembled.payload_iov = (mongoc_iovec_t *) iov.data;
+         parts.assembled.payload_iovcnt = iov.len;
          parts.assembled.payload_size = payload_batch_size;
          parts.assembled.payload_identifier = gCommandFields[command->type];
 
+         if (retry_writes) {
+            bson_iter_overwrite_int64 (&txn_number,
+                                       ++session->server_session->txn_number);
+         }
+
          ret = mongoc_cluster_run_command_monitored (
             &client->cluster, &parts.assembled, &reply, error);
 
-         /* Add this batch size so we skip these documents next time */
-         payload_total_offset += payload_batch_size;
+         if (in_transaction) {
+            mongoc_cmd_parts_continue_transaction (&parts);
+         }
+
+         if (!ret && retry_writes &&
+             _mongoc_cluster_error_is_retryable (error)) {
+            /* once, with the same txnNumber, on the new primary. later
+             * batches go there too */
+            if (retry_stream) {
+               mongoc_server_stream_cleanup (retry_stream);
+            }
+
+            retry_stream = _mongoc_write_retry_stream (
+               client, parts.assembled.server_stream, error);
+
+            if (retry_stream) {
+               parts.assembled.server_stream = retry_stream;
+               bson_destroy (&reply);
+               ret = mongoc_cluster_run_command_monitored (
+                  &client->cluster, &parts.assembled, &reply, error);
+            }
+         }
+
+         _mongoc_array_clear (&iov);
          payload_batch_size = 0;
 
          /* Result merge needs to know the absolute index for a document
@@ -494,10 +1352,15 @@ _mongoc_write_opmsg (mongoc_write_command_t *command,
          bson_destroy (&reply);
       }
       /* While we have more documents to write */
-   } while (payload_total_offset < command->payload.len);
+   } while (pos < end);
 
+   _mongoc_array_destroy (&iov);
    bson_destroy (&cmd);
    mongoc_cmd_parts_cleanup (&parts);
+   mongoc_server_stream_cleanup (retry_stream);
+   if (implicit_session) {
+      mongoc_client_session_destroy (implicit_session);
+   }
 
    EXIT;
 }
@@ -563,6 +1426,7 @@ _mongoc_write_opquery (mongoc_write_command_t *command,
    bson_reader_t *reader;
    const bson_t *bson;
    bool eof;
+   int64_t budget_bytes;
 
    ENTRY;
 
@@ -576,6 +1440,7 @@ _mongoc_write_opquery (mongoc_write_command_t *command,
    max_bson_obj_size = mongoc_server_stream_max_bson_obj_size (server_stream);
    max_write_batch_size =
       mongoc_server_stream_max_write_batch_size (server_stream);
+   budget_bytes = _mongoc_memory_budget_batch_bytes (client->budget);
 
 again:
    has_more = false;
@@ -607,6 +1472,14 @@ again:
          has_more = true;
          break;
       }
+
+      if (budget_bytes && i && ar.len + len > budget_bytes) {
+         /* under memory pressure, send the rest in another batch */
+         mongoc_counter_memory_smaller_batches_inc ();
+         has_more = true;
+         break;
+      }
+
       BSON_APPEND_DOCUMENT (&ar, key, bson);
       data_offset += len;
       i++;
@@ -661,6 +1534,40 @@ again:
 }
 
 
+/* after a grouped command, index write errors and upserts from
+ * @n_write_errors and @n_upserted on by each statement's original index */
+static void
+_mongoc_write_result_reorder (const mongoc_write_command_t *command,
+                              uint32_t offset,
+                              size_t n_write_errors,
+                              size_t n_upserted,
+                              mongoc_write_result_t *result)
+{
+   mongoc_write_error_t *write_error;
+   mongoc_write_upsert_t *upsert;
+   uint32_t stmt;
+   size_t i;
+
+   for (i = n_write_errors; i < result->writeErrors.len; i++) {
+      write_error =
+         &_mongoc_array_index (&result->writeErrors, mongoc_write_error_t, i);
+      stmt = write_error->index - offset;
+      if (stmt < command->n_documents) {
+         write_error->index = offset + command->order[stmt];
+      }
+   }
+
+   for (i = n_upserted; i < result->upserted.len; i++) {
+      upsert =
+         &_mongoc_array_index (&result->upserted, mongoc_write_upsert_t, i);
+      stmt = upsert->index - offset;
+      if (stmt < command->n_documents) {
+         upsert->index = offset + command->order[stmt];
+      }
+   }
+}
+
+
 void
 _mongoc_write_command_execute (
    mongoc_write_command_t *command,             /* IN */
@@ -673,6 +1580,9 @@ _mongoc_write_command_execute (
    mongoc_client_session_t *session,            /* IN */
    mongoc_write_result_t *result)               /* OUT */
 {
+   size_t n_write_errors;
+   size_t n_upserted;
+
    ENTRY;
 
    BSON_ASSERT (command);
@@ -682,6 +1592,9 @@ _mongoc_write_command_execute (
    BSON_ASSERT (collection);
    BSON_ASSERT (result);
 
+   n_write_errors = result->writeErrors.len;
+   n_upserted = result->upserted.len;
+
    if (!write_concern) {
       write_concern = client->write_concern;
    }
@@ -725,11 +1638,21 @@ _mongoc_write_command_execute (
          EXIT;
       }
    }
-   if (command->payload.len == 0) {
+   if (_mongoc_write_command_end (command) == 0) {
       _empty_error (command, &result->error);
       EXIT;
    }
 
+   if (_mongoc_client_session_in_transaction (session) &&
+       server_stream->sd->max_wire_version < WIRE_VERSION_TRANSACTIONS) {
+      bson_set_error (&result->error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_PROTOCOL_BAD_WIRE_VERSION,
+                      "The selected server does not support transactions");
+      result->failed = true;
+      EXIT;
+   }
+
    if (server_stream->sd->max_wire_version >= WIRE_VERSION_OP_MSG) {
       _mongoc_write_opmsg (command,
                            client,
@@ -738,9 +1661,12 @@ _mongoc_write_command_execute (
                            collection,
                            write_concern,
                            offset,
+                           session,
                            result,
                            &result->error);
    } else {
+      _mongoc_write_command_flatten (command);
+
       if (mongoc_write_concern_is_acknowledged (write_concern)) {
          _mongoc_write_opquery (command,
                                 client,
@@ -764,6 +1690,11 @@ _mongoc_write_command_execute (
       }
    }
 
+   if (command->order) {
+      _mongoc_write_result_reorder (
+         command, offset, n_write_errors, n_upserted, result);
+   }
+
    EXIT;
 }
 
@@ -771,10 +1702,26 @@ _mongoc_write_command_execute (
 void
 _mongoc_write_command_destroy (mongoc_write_command_t *command)
 {
+   size_t i;
+
    ENTRY;
 
    if (command) {
       _mongoc_buffer_destroy (&command->payload);
+
+      if (command->docs.element_size) {
+         _mongoc_array_destroy (&command->docs);
+      }
+
+      if (command->owned.element_size) {
+         for (i = 0; i < command->owned.len; i++) {
+            bson_destroy (_mongoc_array_index (&command->owned, bson_t *, i));
+         }
+
+         _mongoc_array_destroy (&command->owned);
+      }
+
+      bson_free (command->order);
    }
 
    EXIT;
@@ -790,9 +1737,9 @@ _mongoc_write_result_init (mongoc_write_result_t *result) /* IN */
 
    memset (result, 0, sizeof *result);
 
-   bson_init (&result->upserted);
+   _mongoc_array_init (&result->upserted, sizeof (mongoc_write_upsert_t));
    bson_init (&result->writeConcernErrors);
-   bson_init (&result->writeErrors);
+   _mongoc_array_init (&result->writeErrors, sizeof (mongoc_write_error_t));
 
    EXIT;
 }
@@ -801,13 +1748,29 @@ _mongoc_write_result_init (mongoc_write_result_t *result) /* IN */
 void
 _mongoc_write_result_destroy (mongoc_write_result_t *result)
 {
+   mongoc_write_upsert_t *upsert;
+   mongoc_write_error_t *write_error;
+   size_t i;
+
    ENTRY;
 
    BSON_ASSERT (result);
 
-   bson_destroy (&result->upserted);
+   for (i = 0; i < result->upserted.len; i++) {
+      upsert =
+         &_mongoc_array_index (&result->upserted, mongoc_write_upsert_t, i);
+      bson_value_destroy (&upsert->id);
+   }
+
+   for (i = 0; i < result->writeErrors.len; i++) {
+      write_error =
+         &_mongoc_array_index (&result->writeErrors, mongoc_write_error_t, i);
+      bson_destroy (write_error->error);
+   }
+
+   _mongoc_array_destroy (&result->upserted);
    bson_destroy (&result->writeConcernErrors);
-   bson_destroy (&result->writeErrors);
+   _mongoc_array_destroy (&result->writeErrors);
 
    EXIT;
 }
@@ -818,23 +1781,110 @@ _mongoc_write_result_append_upsert (mongoc_write_result_t *result,
                                     int32_t idx,
                                     const bson_value_t *value)
 {
-   bson_t child;
+   mongoc_write_upsert_t upsert;
+
+   BSON_ASSERT (result);
+   BSON_ASSERT (value);
+
+   upsert.index = (uint32_t) idx;
+   bson_value_copy (value, &upsert.id);
+   _mongoc_array_append_val (&result->upserted, upsert);
+}
+
+
+/* add errors from a reply's "writeErrors": [{"index": 1, ...}, ...] */
+static void
+_mongoc_write_result_append_write_errors (mongoc_write_result_t *result,
+                                          uint32_t offset,
+                                          bson_iter_t *iter)
+{
+   mongoc_write_error_t write_error;
+   const uint8_t *data;
+   uint32_t len;
+   bson_iter_t ar;
+   bson_iter_t citer;
+   bson_t doc;
+
+   if (!bson_iter_recurse (iter, &ar)) {
+      return;
+   }
+
+   while (bson_iter_next (&ar)) {
+      if (!BSON_ITER_HOLDS_DOCUMENT (&ar)) {
+         continue;
+      }
+
+      bson_iter_document (&ar, &len, &data);
+      BSON_ASSERT (bson_init_static (&doc, data, len));
+
+      write_error.index = offset;
+      if (bson_iter_init_find (&citer, &doc, "index") &&
+          BSON_ITER_HOLDS_INT32 (&citer)) {
+         write_error.index += (uint32_t) bson_iter_int32 (&citer);
+      }
+
+      write_error.error = bson_copy (&doc);
+      _mongoc_array_append_val (&result->writeErrors, write_error);
+   }
+}
+
+
+/* build [{"index": 0, "_id": value}, ...] in @array */
+static void
+_mongoc_write_result_build_upserted (const mongoc_write_result_t *result,
+                                     bson_t *array)
+{
+   const mongoc_write_upsert_t *upsert;
    const char *keyptr = NULL;
    char key[12];
+   bson_t child;
+   size_t i;
    int len;
 
-   BSON_ASSERT (result);
-   BSON_ASSERT (value);
+   for (i = 0; i < result->upserted.len; i++) {
+      upsert =
+         &_mongoc_array_index (&result->upserted, mongoc_write_upsert_t, i);
+      len = (int) bson_uint32_to_string (
+         (uint32_t) i, &keyptr, key, sizeof key);
+      bson_append_document_begin (array, keyptr, len, &child);
+      BSON_APPEND_INT32 (&child, "index", (int32_t) upsert->index);
+      BSON_APPEND_VALUE (&child, "_id", &upsert->id);
+      bson_append_document_end (array, &child);
+   }
+}
 
-   len = (int) bson_uint32_to_string (
-      result->upsert_append_count, &keyptr, key, sizeof key);
 
-   bson_append_document_begin (&result->upserted, keyptr, len, &child);
-   BSON_APPEND_INT32 (&child, "index", idx);
-   BSON_APPEND_VALUE (&child, "_id", value);
-   bson_append_document_end (&result->upserted, &child);
+/* build [{"index": 0, "code": 1, "errmsg": "..."}, ...] in @array, with
+ * indexes into the whole bulk operation */
+static void
+_mongoc_write_result_build_write_errors (const mongoc_write_result_t *result,
+                                         bson_t *array)
+{
+   const mongoc_write_error_t *write_error;
+   const char *keyptr = NULL;
+   char key[12];
+   bson_iter_t iter;
+   bson_t child;
+   size_t i;
+   int len;
 
-   result->upsert_append_count++;
+   for (i = 0; i < result->writeErrors.len; i++) {
+      write_error =
+         &_mongoc_array_index (&result->writeErrors, mongoc_write_error_t, i);
+      len = (int) bson_uint32_to_string (
+         (uint32_t) i, &keyptr, key, sizeof key);
+      bson_append_document_begin (array, keyptr, len, &child);
+      BSON_ASSERT (bson_iter_init (&iter, write_error->error));
+      while (bson_iter_next (&iter)) {
+         if (BSON_ITER_IS_KEY (&iter, "index")) {
+            BSON_APPEND_INT32 (&child, "index", (int32_t) write_error->index);
+         } else {
+            BSON_APPEND_VALUE (
+               &child, bson_iter_key (&iter), bson_iter_value (&iter));
+         }
+      }
+      bson_append_document_end (array, &child);
+   }
 }
 
 
@@ -972,8 +2022,7 @@ _mongoc_write_result_merge (mongoc_write_result_t *result,   /* IN */
 
    if (bson_iter_init_find (&iter, reply, "writeErrors") &&
        BSON_ITER_HOLDS_ARRAY (&iter)) {
-      _mongoc_write_result_merge_arrays (
-         offset, result, &result->writeErrors, &iter);
+      _mongoc_write_result_append_write_errors (result, offset, &iter);
    }
 
    if (bson_iter_init_find (&iter, reply, "writeConcernError") &&
@@ -1002,6 +2051,80 @@ _mongoc_write_result_merge (mongoc_write_result_t *result,   /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_result_merge_result --
+ *
+ *       Add @src, the result of commands run separately, to @result,
+ *       adding @offset to the indexes in @src.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_write_result_merge_result (mongoc_write_result_t *result,
+                                   const mongoc_write_result_t *src,
+                                   uint32_t offset)
+{
+   const mongoc_write_upsert_t *src_upsert;
+   const mongoc_write_error_t *src_error;
+   mongoc_write_upsert_t upsert;
+   mongoc_write_error_t write_error;
+   bson_iter_t iter;
+   bson_t arrays;
+   size_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (result);
+   BSON_ASSERT (src);
+
+   result->nInserted += src->nInserted;
+   result->nMatched += src->nMatched;
+   result->nModified += src->nModified;
+   result->nRemoved += src->nRemoved;
+   result->nUpserted += src->nUpserted;
+
+   for (i = 0; i < src->writeErrors.len; i++) {
+      src_error =
+         &_mongoc_array_index (&src->writeErrors, mongoc_write_error_t, i);
+      write_error.index = src_error->index + offset;
+      write_error.error = bson_copy (src_error->error);
+      _mongoc_array_append_val (&result->writeErrors, write_error);
+   }
+
+   for (i = 0; i < src->upserted.len; i++) {
+      src_upsert =
+         &_mongoc_array_index (&src->upserted, mongoc_write_upsert_t, i);
+      upsert.index = src_upsert->index + offset;
+      bson_value_copy (&src_upsert->id, &upsert.id);
+      _mongoc_array_append_val (&result->upserted, upsert);
+   }
+
+   if (src->n_writeConcernErrors) {
+      /* _mongoc_write_result_merge_arrays reads arrays from an iterator */
+      bson_init (&arrays);
+      BSON_APPEND_ARRAY (
+         &arrays, "writeConcernErrors", &src->writeConcernErrors);
+      BSON_ASSERT (
+         bson_iter_init_find (&iter, &arrays, "writeConcernErrors"));
+      result->n_writeConcernErrors += _mongoc_write_result_merge_arrays (
+         offset, result, &result->writeConcernErrors, &iter);
+      bson_destroy (&arrays);
+   }
+
+   if (src->error.domain && !result->error.domain) {
+      memcpy (&result->error, &src->error, sizeof result->error);
+   }
+
+   result->failed |= src->failed;
+   result->must_stop |= src->must_stop;
+
+   EXIT;
+}
+
+
 /*
  * If error is not set, set code from first document in array like
  * [{"code": 64, "errmsg": "duplicate"}, ...]. Format the error message
@@ -1079,6 +2202,8 @@ _mongoc_write_result_complete (
    bson_error_t *error)                       /* OUT */
 {
    mongoc_error_domain_t domain;
+   bson_t write_errors;
+   bson_t upserted;
 
    ENTRY;
 
@@ -1094,16 +2219,21 @@ _mongoc_write_result_complete (
       domain = MONGOC_ERROR_COLLECTION;
    }
 
+   bson_init (&write_errors);
+   _mongoc_write_result_build_write_errors (result, &write_errors);
+
    if (bson && mongoc_write_concern_is_acknowledged (wc)) {
       BSON_APPEND_INT32 (bson, "nInserted", result->nInserted);
       BSON_APPEND_INT32 (bson, "nMatched", result->nMatched);
       BSON_APPEND_INT32 (bson, "nModified", result->nModified);
       BSON_APPEND_INT32 (bson, "nRemoved", result->nRemoved);
       BSON_APPEND_INT32 (bson, "nUpserted", result->nUpserted);
-      if (!bson_empty0 (&result->upserted)) {
-         BSON_APPEND_ARRAY (bson, "upserted", &result->upserted);
+      if (result->upserted.len) {
+         bson_append_array_begin (bson, "upserted", 8, &upserted);
+         _mongoc_write_result_build_upserted (result, &upserted);
+         bson_append_array_end (bson, &upserted);
       }
-      BSON_APPEND_ARRAY (bson, "writeErrors", &result->writeErrors);
+      BSON_APPEND_ARRAY (bson, "writeErrors", &write_errors);
       if (result->n_writeConcernErrors) {
          BSON_APPEND_ARRAY (
             bson, "writeConcernErrors", &result->writeConcernErrors);
@@ -1111,8 +2241,8 @@ _mongoc_write_result_complete (
    }
 
    /* set bson_error_t from first write error or write concern error */
-   _set_error_from_response (
-      &result->writeErrors, domain, "write", &result->error);
+   _set_error_from_response (&write_errors, domain, "write", &result->error);
+   bson_destroy (&write_errors);
 
    if (!result->error.code) {
       _set_error_from_response (&result->writeConcernErrors,
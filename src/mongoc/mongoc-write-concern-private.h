@@ -40,6 +40,8 @@ struct _mongoc_write_concern_t {
    bool frozen;
    bson_t compiled;
    bool is_default;
+   /* references besides the creator's, from handles that share it */
+   volatile int32_t refs;
 };
 
 
@@ -49,6 +51,8 @@ bool
 _mongoc_write_concern_iter_is_valid (bson_iter_t *iter);
 const bson_t *
 _mongoc_write_concern_get_bson (mongoc_write_concern_t *write_concern);
+mongoc_write_concern_t *
+_mongoc_write_concern_ref (const mongoc_write_concern_t *write_concern);
 bool
 _mongoc_write_concern_validate (const mongoc_write_concern_t *write_concern,
                                 bson_error_t *error);
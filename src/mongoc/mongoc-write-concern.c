@@ -79,6 +79,19 @@ mongoc_write_concern_copy (const mongoc_write_concern_t *write_concern)
 }
 
 
+/* share @write_concern instead of copying it, for a handle that never
+ * modifies it. each reference is released with mongoc_write_concern_destroy */
+mongoc_write_concern_t *
+_mongoc_write_concern_ref (const mongoc_write_concern_t *write_concern)
+{
+   mongoc_write_concern_t *shared = (mongoc_write_concern_t *) write_concern;
+
+   bson_atomic_int_add (&shared->refs, 1);
+
+   return shared;
+}
+
+
 /**
  * mongoc_write_concern_destroy:
  * @write_concern: A mongoc_write_concern_t.
@@ -89,6 +102,11 @@ void
 mongoc_write_concern_destroy (mongoc_write_concern_t *write_concern)
 {
    if (write_concern) {
+      if (bson_atomic_int_add (&write_concern->refs, -1) >= 0) {
+         /* still shared */
+         return;
+      }
+
       if (write_concern->compiled.len) {
          bson_destroy (&write_concern->compiled);
       }
@@ -24,13 +24,18 @@
 #define MONGOC_INSIDE
 #include "mongoc-macros.h"
 #include "mongoc-apm.h"
+#include "mongoc-async-client.h"
 #include "mongoc-bulk-operation.h"
+#include "mongoc-bulk-writer.h"
 #include "mongoc-change-stream.h"
+#include "mongoc-change-stream-mux.h"
 #include "mongoc-client.h"
 #include "mongoc-client-pool.h"
 #include "mongoc-collection.h"
+#include "mongoc-columns.h"
 #include "mongoc-config.h"
 #include "mongoc-cursor.h"
+#include "mongoc-cursor-group.h"
 #include "mongoc-database.h"
 #include "mongoc-index.h"
 #include "mongoc-error.h"
@@ -44,14 +49,21 @@
 #include "mongoc-matcher.h"
 #include "mongoc-handshake.h"
 #include "mongoc-opcode.h"
+#include "mongoc-paginator.h"
+#include "mongoc-prepared-command.h"
 #include "mongoc-log.h"
+#include "mongoc-memory.h"
+#include "mongoc-shard-router.h"
 #include "mongoc-socket.h"
 #include "mongoc-client-session.h"
 #include "mongoc-stream.h"
 #include "mongoc-stream-buffered.h"
+#include "mongoc-stream-capture.h"
+#include "mongoc-stream-shaped.h"
 #include "mongoc-stream-file.h"
 #include "mongoc-stream-gridfs.h"
 #include "mongoc-stream-socket.h"
+#include "mongoc-thread.h"
 #include "mongoc-uri.h"
 #include "mongoc-write-concern.h"
 #include "mongoc-version.h"
@@ -0,0 +1,552 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * mongoc-connect: a connection storm, like the one after a failover when
+ * every application server reconnects at once. Each round, CONNECTIONS
+ * threads are released together and each opens a connection and runs
+ * "ping" on it.
+ *
+ *   mongoc-connect [-c CONNECTIONS] [-r ROUNDS] [-m pool|scanner] [-f]
+ *                  URI [URI...]
+ *
+ * In "pool" mode the threads pop distinct clients from one client pool,
+ * whose maxPoolSize defaults to CONNECTIONS, and the time of each phase
+ * (TCP connect, TLS, the MongoDB handshake, authentication) comes from the
+ * pool's connection-ready events. After each round the connections are
+ * closed, so the next round opens new ones. The pool keeps the TLS sessions
+ * of the first round, so later rounds resume them; with -f each round uses
+ * a new pool and never does.
+ *
+ * In "scanner" mode each thread creates a single-threaded client, like a
+ * separate application process would, and its topology scanner connects,
+ * so only the time until "ping" succeeded is known.
+ *
+ * Pass several URIs to compare configurations, such as with and without
+ * "ssl", "compressors", or credentials and "authMechanism". The SCRAM keys
+ * derived from a password are cached for the whole process, so only each
+ * URI's first round derives them. Per round it prints the rate connections
+ * were established, the client's CPU time per connection (all threads of
+ * the process, including the pool's monitor), percentiles in microseconds
+ * of the time from the round's start until each connection was ready and
+ * of each phase, and the number of TLS sessions resumed and authentications
+ * done in the handshake.
+ */
+
+
+#include <mongoc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "mongoc-array-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-cluster-private.h"
+#include "mongoc-counters-private.h"
+#include "mongoc-thread-private.h"
+
+
+#define CONNECT_PHASES MONGOC_APM_CONNECTION_PHASE_LAST
+
+
+/* durations of connection phases, from connection-ready events on any
+ * of the pool's threads */
+typedef struct {
+   mongoc_mutex_t mutex;
+   mongoc_array_t phases[CONNECT_PHASES]; /* int64_t */
+} connect_phases_t;
+
+
+typedef struct {
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool; /* NULL in scanner mode */
+   mongoc_mutex_t mutex;
+   mongoc_cond_t cond;
+   int n_threads;
+   int waiting;
+   int done;
+   bool go;
+   bool finish;
+   int64_t start;
+} connect_round_t;
+
+
+typedef struct {
+   connect_round_t *round;
+   bool ok;
+   int64_t ready; /* from the round's start until "ping" succeeded */
+   bson_error_t error;
+} connect_thread_t;
+
+
+static int gConnections = 100;
+static int gRounds = 3;
+static bool gScanner = false;
+static bool gFreshPool = false;
+
+
+static int64_t
+connect_cpu_usec (void)
+{
+#ifdef _WIN32
+   FILETIME created;
+   FILETIME exited;
+   FILETIME kernel;
+   FILETIME user;
+   uint64_t ticks;
+
+   GetProcessTimes (GetCurrentProcess (), &created, &exited, &kernel, &user);
+
+   /* in units of 100 nanoseconds */
+   ticks = ((uint64_t) kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) +
+           ((uint64_t) user.dwHighDateTime << 32 | user.dwLowDateTime);
+
+   return (int64_t) (ticks / 10);
+#else
+   struct rusage usage;
+
+   getrusage (RUSAGE_SELF, &usage);
+
+   return (int64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+             1000 * 1000 +
+          usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+
+/* a counter's total over all CPUs */
+static int64_t
+connect_counter_sum (const mongoc_counter_t *counter, int slot)
+{
+   int64_t sum = 0;
+   unsigned i;
+
+   for (i = 0; i < _mongoc_get_cpu_count (); i++) {
+      sum += counter->cpus[i].slots[slot % SLOTS_PER_CACHELINE];
+   }
+
+   return sum;
+}
+
+
+#define CONNECT_COUNTER(ident) \
+   connect_counter_sum (&__mongoc_counter_##ident, COUNTER_##ident)
+
+
+static int
+connect_cmp_int64 (const void *a, const void *b)
+{
+   int64_t x = *(const int64_t *) a;
+   int64_t y = *(const int64_t *) b;
+
+   return x < y ? -1 : x > y;
+}
+
+
+static int64_t
+connect_percentile (const int64_t *sorted, size_t n, double percentile)
+{
+   size_t i;
+
+   if (!n) {
+      return 0;
+   }
+
+   i = (size_t) ((double) n * percentile / 100.0 + 0.5);
+   i = BSON_MAX (i, 1);
+   return sorted[BSON_MIN (i, n) - 1];
+}
+
+
+static void
+connect_ready (const mongoc_apm_connection_ready_t *event)
+{
+   connect_phases_t *phases;
+   int64_t usec;
+   int i;
+
+   phases =
+      (connect_phases_t *) mongoc_apm_connection_ready_get_context (event);
+
+   mongoc_mutex_lock (&phases->mutex);
+   for (i = 0; i < CONNECT_PHASES; i++) {
+      usec = mongoc_apm_connection_ready_get_phase_duration (
+         event, (mongoc_apm_connection_phase_t) i);
+      _mongoc_array_append_val (&phases->phases[i], usec);
+   }
+   mongoc_mutex_unlock (&phases->mutex);
+}
+
+
+static mongoc_client_pool_t *
+connect_pool_new (mongoc_uri_t *uri, connect_phases_t *phases)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_apm_callbacks_t *callbacks;
+   mongoc_client_t *client;
+   mongoc_server_description_t *sd;
+   bson_error_t error;
+
+   pool = mongoc_client_pool_new (uri);
+   mongoc_client_pool_set_error_api (pool, MONGOC_ERROR_API_VERSION_2);
+
+   callbacks = mongoc_apm_callbacks_new ();
+   mongoc_apm_set_connection_ready_cb (callbacks, connect_ready);
+   mongoc_client_pool_set_apm_callbacks (pool, callbacks, phases);
+   mongoc_apm_callbacks_destroy (callbacks);
+
+   /* discover the topology first, the storm is of application connections */
+   client = mongoc_client_pool_pop (pool);
+   sd = mongoc_client_select_server (client, false, NULL, &error);
+   if (!sd) {
+      fprintf (stderr, "mongoc-connect: %s\n", error.message);
+   }
+
+   mongoc_server_description_destroy (sd);
+   mongoc_client_pool_push (pool, client);
+
+   return pool;
+}
+
+
+static void *
+connect_thread (void *data)
+{
+   connect_thread_t *ct = (connect_thread_t *) data;
+   connect_round_t *round = ct->round;
+   mongoc_client_t *client;
+   mongoc_server_description_t *sd;
+   bson_t cmd = BSON_INITIALIZER;
+   uint32_t server_id = 0;
+
+   BSON_APPEND_INT32 (&cmd, "ping", 1);
+
+   mongoc_mutex_lock (&round->mutex);
+   round->waiting++;
+   mongoc_cond_broadcast (&round->cond);
+   while (!round->go) {
+      mongoc_cond_wait (&round->cond, &round->mutex);
+   }
+   mongoc_mutex_unlock (&round->mutex);
+
+   if (round->pool) {
+      client = mongoc_client_pool_pop (round->pool);
+   } else {
+      client = mongoc_client_new_from_uri (round->uri);
+      mongoc_client_set_error_api (client, MONGOC_ERROR_API_VERSION_2);
+   }
+
+   sd = mongoc_client_select_server (client, false, NULL, &ct->error);
+   if (sd) {
+      server_id = mongoc_server_description_id (sd);
+      ct->ok = mongoc_client_command_simple_with_server_id (
+         client, "admin", &cmd, NULL, server_id, NULL, &ct->error);
+      mongoc_server_description_destroy (sd);
+   }
+
+   ct->ready = bson_get_monotonic_time () - round->start;
+
+   /* close connections after the round is timed */
+   mongoc_mutex_lock (&round->mutex);
+   round->done++;
+   mongoc_cond_broadcast (&round->cond);
+   while (!round->finish) {
+      mongoc_cond_wait (&round->cond, &round->mutex);
+   }
+   mongoc_mutex_unlock (&round->mutex);
+
+   if (round->pool) {
+      if (server_id) {
+         /* so the next round connects again */
+         mongoc_cluster_disconnect_node (
+            &client->cluster, server_id, false, NULL);
+      }
+
+      mongoc_client_pool_push (round->pool, client);
+   } else {
+      mongoc_client_destroy (client);
+   }
+
+   bson_destroy (&cmd);
+
+   return NULL;
+}
+
+
+static void
+connect_print_header (void)
+{
+   printf ("%5s %6s %6s %8s %8s   %8s %8s %8s   %8s %8s   %8s %8s   %8s "
+           "%8s   %8s %8s   %7s %7s\n",
+           "round",
+           "conns",
+           "errors",
+           "conns/s",
+           "cpu/conn",
+           "rdy p50",
+           "p99",
+           "max",
+           "tcp p50",
+           "p99",
+           "tls p50",
+           "p99",
+           "hs p50",
+           "p99",
+           "auth p50",
+           "p99",
+           "resumed",
+           "spec");
+}
+
+
+static void
+connect_run_round (mongoc_uri_t *uri,
+                   mongoc_client_pool_t *pool,
+                   connect_phases_t *phases,
+                   int n)
+{
+   connect_round_t round = {0};
+   connect_thread_t *cts;
+   mongoc_thread_t *threads;
+   int64_t *ready;
+   int64_t *sorted[CONNECT_PHASES];
+   size_t n_sorted[CONNECT_PHASES];
+   int64_t resumed;
+   int64_t speculative;
+   int64_t cpu;
+   int64_t elapsed;
+   int n_ready = 0;
+   int errors = 0;
+   int i;
+
+   round.uri = uri;
+   round.pool = pool;
+   round.n_threads = gConnections;
+   mongoc_mutex_init (&round.mutex);
+   mongoc_cond_init (&round.cond);
+
+   cts = (connect_thread_t *) bson_malloc0 (gConnections * sizeof *cts);
+   threads = (mongoc_thread_t *) bson_malloc0 (gConnections * sizeof *threads);
+   ready = (int64_t *) bson_malloc0 (gConnections * sizeof *ready);
+
+   mongoc_mutex_lock (&phases->mutex);
+   for (i = 0; i < CONNECT_PHASES; i++) {
+      phases->phases[i].len = 0;
+   }
+   mongoc_mutex_unlock (&phases->mutex);
+
+   for (i = 0; i < gConnections; i++) {
+      cts[i].round = &round;
+      mongoc_thread_create (&threads[i], connect_thread, &cts[i]);
+   }
+
+   /* release the threads together once all have started */
+   mongoc_mutex_lock (&round.mutex);
+   while (round.waiting < round.n_threads) {
+      mongoc_cond_wait (&round.cond, &round.mutex);
+   }
+
+   resumed = CONNECT_COUNTER (tls_session_cache_hits);
+   speculative = CONNECT_COUNTER (auth_speculative);
+   cpu = connect_cpu_usec ();
+   round.start = bson_get_monotonic_time ();
+   round.go = true;
+   mongoc_cond_broadcast (&round.cond);
+
+   while (round.done < round.n_threads) {
+      mongoc_cond_wait (&round.cond, &round.mutex);
+   }
+
+   elapsed = bson_get_monotonic_time () - round.start;
+   cpu = connect_cpu_usec () - cpu;
+   resumed = CONNECT_COUNTER (tls_session_cache_hits) - resumed;
+   speculative = CONNECT_COUNTER (auth_speculative) - speculative;
+   round.finish = true;
+   mongoc_cond_broadcast (&round.cond);
+   mongoc_mutex_unlock (&round.mutex);
+
+   for (i = 0; i < gConnections; i++) {
+      mongoc_thread_join (threads[i]);
+   }
+
+   for (i = 0; i < gConnections; i++) {
+      if (cts[i].ok) {
+         ready[n_ready++] = cts[i].ready;
+      } else {
+         errors++;
+         fprintf (stderr, "mongoc-connect: %s\n", cts[i].error.message);
+      }
+   }
+
+   qsort (ready, (size_t) n_ready, sizeof (int64_t), connect_cmp_int64);
+
+   for (i = 0; i < CONNECT_PHASES; i++) {
+      sorted[i] = (int64_t *) phases->phases[i].data;
+      n_sorted[i] = phases->phases[i].len;
+      qsort (sorted[i], n_sorted[i], sizeof (int64_t), connect_cmp_int64);
+   }
+
+#define PHASE(p, percentile)                                       \
+   connect_percentile (sorted[MONGOC_APM_CONNECTION_PHASE_##p],   \
+                       n_sorted[MONGOC_APM_CONNECTION_PHASE_##p], \
+                       percentile)
+
+   printf ("%5d %6d %6d %8.0f %8" PRId64 "   %8" PRId64 " %8" PRId64
+           " %8" PRId64 "   %8" PRId64 " %8" PRId64 "   %8" PRId64 " %8" PRId64
+           "   %8" PRId64 " %8" PRId64 "   %8" PRId64 " %8" PRId64
+           "   %7" PRId64 " %7" PRId64 "\n",
+           n,
+           n_ready,
+           errors,
+           (double) n_ready * 1e6 / (double) BSON_MAX (elapsed, 1),
+           cpu / BSON_MAX (n_ready, 1),
+           connect_percentile (ready, (size_t) n_ready, 50),
+           connect_percentile (ready, (size_t) n_ready, 99),
+           connect_percentile (ready, (size_t) n_ready, 100),
+           PHASE (CONNECT, 50),
+           PHASE (CONNECT, 99),
+           PHASE (TLS, 50),
+           PHASE (TLS, 99),
+           PHASE (HANDSHAKE, 50),
+           PHASE (HANDSHAKE, 99),
+           PHASE (AUTH, 50),
+           PHASE (AUTH, 99),
+           resumed,
+           speculative);
+   fflush (stdout);
+
+#undef PHASE
+
+   mongoc_cond_destroy (&round.cond);
+   mongoc_mutex_destroy (&round.mutex);
+   bson_free (ready);
+   bson_free (threads);
+   bson_free (cts);
+}
+
+
+static void
+connect_run_uri (const char *uri_string)
+{
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool = NULL;
+   connect_phases_t phases;
+   bson_error_t error;
+   int i;
+
+   uri = mongoc_uri_new_with_error (uri_string, &error);
+   if (!uri) {
+      fprintf (stderr, "mongoc-connect: %s\n", error.message);
+      exit (EXIT_FAILURE);
+   }
+
+   /* a connection for every thread, unless the URI says otherwise */
+   if (!mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_MAXPOOLSIZE, 0)) {
+      mongoc_uri_set_option_as_int32 (
+         uri, MONGOC_URI_MAXPOOLSIZE, gConnections);
+   }
+
+   mongoc_mutex_init (&phases.mutex);
+   for (i = 0; i < CONNECT_PHASES; i++) {
+      _mongoc_array_init (&phases.phases[i], sizeof (int64_t));
+   }
+
+   printf ("%s\n", uri_string);
+   connect_print_header ();
+
+   for (i = 1; i <= gRounds; i++) {
+      if (!gScanner && (!pool || gFreshPool)) {
+         if (pool) {
+            mongoc_client_pool_destroy (pool);
+         }
+
+         pool = connect_pool_new (uri, &phases);
+      }
+
+      connect_run_round (uri, pool, &phases, i);
+   }
+
+   if (pool) {
+      mongoc_client_pool_destroy (pool);
+   }
+
+   for (i = 0; i < CONNECT_PHASES; i++) {
+      _mongoc_array_destroy (&phases.phases[i]);
+   }
+
+   mongoc_mutex_destroy (&phases.mutex);
+   mongoc_uri_destroy (uri);
+}
+
+
+static void
+usage (void)
+{
+   fprintf (stderr,
+            "usage: mongoc-connect [-c CONNECTIONS] [-r ROUNDS]"
+            " [-m pool|scanner] [-f]\n"
+            "                      URI [URI...]\n");
+   exit (EXIT_FAILURE);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+   int i;
+
+   for (i = 1; i < argc; i++) {
+      if (!strcmp (argv[i], "-c") && i + 1 < argc) {
+         gConnections = atoi (argv[++i]);
+      } else if (!strcmp (argv[i], "-r") && i + 1 < argc) {
+         gRounds = atoi (argv[++i]);
+      } else if (!strcmp (argv[i], "-m") && i + 1 < argc) {
+         i++;
+         if (!strcmp (argv[i], "pool")) {
+            gScanner = false;
+         } else if (!strcmp (argv[i], "scanner")) {
+            gScanner = true;
+         } else {
+            usage ();
+         }
+      } else if (!strcmp (argv[i], "-f")) {
+         gFreshPool = true;
+      } else if (argv[i][0] == '-') {
+         usage ();
+      } else {
+         break;
+      }
+   }
+
+   if (gConnections <= 0 || gRounds <= 0 || i == argc) {
+      usage ();
+   }
+
+   mongoc_init ();
+
+   for (; i < argc; i++) {
+      connect_run_uri (argv[i]);
+   }
+
+   mongoc_cleanup ();
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,480 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * mongoc-load: an open-loop load generator. Operations are scheduled at a
+ * fixed rate, whether or not earlier ones have finished, and each one's
+ * latency is measured from when it was scheduled to start, not from when a
+ * thread got around to it. A closed-loop benchmark waits for each reply
+ * before sending the next request, so it slows down with the system under
+ * test and never sees the queueing delay in mongoc_client_pool_pop or
+ * server selection ("coordinated omission").
+ *
+ *   mongoc-load [-r RATE[,RATE...]] [-d SECONDS] [-j THREADS]
+ *               [-o ping|find|insert] [-n DB.COLLECTION] URI
+ *
+ * For each target rate in operations per second, it prints the achieved
+ * rate and latency percentiles in microseconds, both from the scheduled
+ * start ("latency") and from the actual start ("service"). Where they
+ * diverge, requests are queueing: that is the throughput knee. THREADS must
+ * be enough to keep RATE operations in flight, or the generator itself
+ * queues, which the latency percentiles include.
+ */
+
+
+#include <mongoc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoc-thread-private.h"
+#include "mongoc-util-private.h"
+
+
+/*
+ * HDR histogram: values under 2^LOAD_SUB_BITS have a bucket each, and each
+ * power of two above is split into 2^(LOAD_SUB_BITS - 1) linear buckets, so
+ * a bucket's width is at most 1/32 of its lower bound. Values up to 2^36
+ * microseconds, about 19 hours, are recorded.
+ */
+#define LOAD_SUB_BITS 6
+#define LOAD_SUB_COUNT (1 << LOAD_SUB_BITS)
+#define LOAD_HALF_COUNT (LOAD_SUB_COUNT / 2)
+#define LOAD_MAX_MSB 36
+#define LOAD_BUCKETS \
+   (LOAD_SUB_COUNT + (LOAD_MAX_MSB - LOAD_SUB_BITS + 1) * LOAD_HALF_COUNT)
+
+
+typedef struct {
+   int64_t buckets[LOAD_BUCKETS];
+   int64_t count;
+   int64_t max;
+} load_histogram_t;
+
+
+typedef enum { LOAD_PING, LOAD_FIND, LOAD_INSERT } load_op_t;
+
+
+typedef struct {
+   mongoc_client_pool_t *pool;
+   load_op_t op;
+   const char *db;
+   const char *coll;
+   double rate;
+   int64_t n_ops;
+   int64_t start;
+   int64_t give_up; /* ops not begun by then are skipped */
+   volatile int64_t next;
+} load_run_t;
+
+
+typedef struct {
+   load_run_t *run;
+   load_histogram_t latency; /* from the scheduled start */
+   load_histogram_t service; /* from the actual start */
+   int64_t errors;
+   int64_t skipped;
+   bson_error_t last_error;
+} load_thread_t;
+
+
+static int64_t gDurationUsec = 10 * 1000 * 1000;
+static int gThreads = 64;
+
+
+static uint32_t
+load_bucket (int64_t usec)
+{
+   uint64_t v;
+   uint32_t msb;
+
+   if (usec < LOAD_SUB_COUNT) {
+      return usec > 0 ? (uint32_t) usec : 0;
+   }
+
+   v = (uint64_t) usec;
+   for (msb = LOAD_SUB_BITS; v >> (msb + 1); msb++) {
+   }
+
+   if (msb > LOAD_MAX_MSB) {
+      return LOAD_BUCKETS - 1;
+   }
+
+   /* the bits below the most significant one pick the linear bucket */
+   return LOAD_SUB_COUNT + (msb - LOAD_SUB_BITS) * LOAD_HALF_COUNT +
+          (uint32_t) ((v >> (msb - LOAD_SUB_BITS + 1)) & (LOAD_HALF_COUNT - 1));
+}
+
+
+/* the highest value that lands in @bucket */
+static int64_t
+load_bucket_max (uint32_t bucket)
+{
+   uint32_t msb;
+   uint32_t sub;
+
+   if (bucket < LOAD_SUB_COUNT) {
+      return (int64_t) bucket;
+   }
+
+   msb = (bucket - LOAD_SUB_COUNT) / LOAD_HALF_COUNT + LOAD_SUB_BITS;
+   sub = (bucket - LOAD_SUB_COUNT) % LOAD_HALF_COUNT;
+
+   return ((int64_t) (LOAD_HALF_COUNT + sub + 1) << (msb - LOAD_SUB_BITS + 1)) -
+          1;
+}
+
+
+static void
+load_histogram_record (load_histogram_t *h, int64_t usec)
+{
+   h->buckets[load_bucket (usec)]++;
+   h->count++;
+   h->max = BSON_MAX (h->max, usec);
+}
+
+
+static void
+load_histogram_merge (load_histogram_t *to, const load_histogram_t *from)
+{
+   uint32_t i;
+
+   for (i = 0; i < LOAD_BUCKETS; i++) {
+      to->buckets[i] += from->buckets[i];
+   }
+
+   to->count += from->count;
+   to->max = BSON_MAX (to->max, from->max);
+}
+
+
+static int64_t
+load_percentile (const load_histogram_t *h, double percentile)
+{
+   int64_t threshold;
+   int64_t seen = 0;
+   uint32_t i;
+
+   if (!h->count) {
+      return 0;
+   }
+
+   threshold = (int64_t) ((double) h->count * percentile / 100.0 + 0.5);
+   threshold = BSON_MAX (threshold, 1);
+
+   for (i = 0; i < LOAD_BUCKETS; i++) {
+      seen += h->buckets[i];
+      if (seen >= threshold) {
+         /* a bucket's upper bound can exceed the largest value seen */
+         return BSON_MIN (load_bucket_max (i), h->max);
+      }
+   }
+
+   return h->max;
+}
+
+
+static bool
+load_op (load_run_t *run, mongoc_client_t *client, bson_error_t *error)
+{
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_t cmd = BSON_INITIALIZER;
+   bson_t filter = BSON_INITIALIZER;
+   bson_t opts = BSON_INITIALIZER;
+   bool r;
+
+   switch (run->op) {
+   case LOAD_PING:
+      BSON_APPEND_INT32 (&cmd, "ping", 1);
+      r = mongoc_client_command_simple (
+         client, "admin", &cmd, NULL, NULL, error);
+      bson_destroy (&cmd);
+      return r;
+   case LOAD_FIND:
+      collection = mongoc_client_get_collection (client, run->db, run->coll);
+      BSON_APPEND_INT32 (&filter, "_id", 0);
+      BSON_APPEND_INT32 (&opts, "limit", 1);
+      cursor =
+         mongoc_collection_find_with_opts (collection, &filter, &opts, NULL);
+      mongoc_cursor_next (cursor, &doc);
+      r = !mongoc_cursor_error (cursor, error);
+      mongoc_cursor_destroy (cursor);
+      mongoc_collection_destroy (collection);
+      bson_destroy (&filter);
+      bson_destroy (&opts);
+      return r;
+   case LOAD_INSERT:
+      collection = mongoc_client_get_collection (client, run->db, run->coll);
+      BSON_APPEND_UTF8 (&cmd, "load", "mongoc-load");
+      r = mongoc_collection_insert (
+         collection, MONGOC_INSERT_NONE, &cmd, NULL, error);
+      mongoc_collection_destroy (collection);
+      bson_destroy (&cmd);
+      return r;
+   default:
+      abort ();
+   }
+}
+
+
+static void *
+load_thread (void *data)
+{
+   load_thread_t *lt = (load_thread_t *) data;
+   load_run_t *run = lt->run;
+   mongoc_client_t *client;
+   int64_t i;
+   int64_t scheduled;
+   int64_t started;
+   int64_t now;
+   bool r;
+
+   for (;;) {
+      i = bson_atomic_int64_add (&run->next, 1) - 1;
+      if (i >= run->n_ops) {
+         break;
+      }
+
+      scheduled = run->start + (int64_t) ((double) i * 1e6 / run->rate);
+      now = bson_get_monotonic_time ();
+      if (now < scheduled) {
+         _mongoc_usleep (scheduled - now);
+      } else if (now > run->give_up) {
+         lt->skipped++;
+         continue;
+      }
+
+      started = bson_get_monotonic_time ();
+      client = mongoc_client_pool_pop (run->pool);
+      r = load_op (run, client, &lt->last_error);
+      mongoc_client_pool_push (run->pool, client);
+      now = bson_get_monotonic_time ();
+
+      if (!r) {
+         lt->errors++;
+         continue;
+      }
+
+      load_histogram_record (&lt->latency, now - scheduled);
+      load_histogram_record (&lt->service, now - started);
+   }
+
+   return NULL;
+}
+
+
+static void
+load_print_header (void)
+{
+   printf ("%10s %10s %8s %8s   %9s %9s %9s %9s %9s %9s   %9s %9s %9s\n",
+           "target/s",
+           "actual/s",
+           "errors",
+           "skipped",
+           "lat p50",
+           "p90",
+           "p99",
+           "p99.9",
+           "p99.99",
+           "max",
+           "svc p50",
+           "p99",
+           "p99.9");
+}
+
+
+static void
+load_run_rate (mongoc_client_pool_t *pool,
+               load_op_t op,
+               const char *db,
+               const char *coll,
+               double rate)
+{
+   load_run_t run = {0};
+   load_thread_t *lts;
+   mongoc_thread_t *threads;
+   load_histogram_t *latency;
+   load_histogram_t *service;
+   int64_t errors = 0;
+   int64_t skipped = 0;
+   int64_t elapsed;
+   int i;
+
+   run.pool = pool;
+   run.op = op;
+   run.db = db;
+   run.coll = coll;
+   run.rate = rate;
+   run.n_ops = (int64_t) (rate * (double) gDurationUsec / 1e6);
+   /* let the threads start before the first operation is due */
+   run.start = bson_get_monotonic_time () + 100 * 1000;
+   /* when far over capacity, don't drain the backlog forever */
+   run.give_up = run.start + 2 * gDurationUsec;
+
+   lts = (load_thread_t *) bson_malloc0 (gThreads * sizeof *lts);
+   threads = (mongoc_thread_t *) bson_malloc0 (gThreads * sizeof *threads);
+   latency = (load_histogram_t *) bson_malloc0 (sizeof *latency);
+   service = (load_histogram_t *) bson_malloc0 (sizeof *service);
+
+   for (i = 0; i < gThreads; i++) {
+      lts[i].run = &run;
+      mongoc_thread_create (&threads[i], load_thread, &lts[i]);
+   }
+
+   for (i = 0; i < gThreads; i++) {
+      mongoc_thread_join (threads[i]);
+   }
+
+   elapsed = bson_get_monotonic_time () - run.start;
+
+   for (i = 0; i < gThreads; i++) {
+      load_histogram_merge (latency, &lts[i].latency);
+      load_histogram_merge (service, &lts[i].service);
+      errors += lts[i].errors;
+      skipped += lts[i].skipped;
+      if (lts[i].errors) {
+         fprintf (stderr, "mongoc-load: %s\n", lts[i].last_error.message);
+      }
+   }
+
+   printf ("%10.0f %10.0f %8" PRId64 " %8" PRId64 "   %9" PRId64 " %9" PRId64
+           " %9" PRId64 " %9" PRId64 " %9" PRId64 " %9" PRId64 "   %9" PRId64
+           " %9" PRId64 " %9" PRId64 "\n",
+           rate,
+           (double) latency->count * 1e6 / (double) elapsed,
+           errors,
+           skipped,
+           load_percentile (latency, 50),
+           load_percentile (latency, 90),
+           load_percentile (latency, 99),
+           load_percentile (latency, 99.9),
+           load_percentile (latency, 99.99),
+           latency->max,
+           load_percentile (service, 50),
+           load_percentile (service, 99),
+           load_percentile (service, 99.9));
+   fflush (stdout);
+
+   bson_free (service);
+   bson_free (latency);
+   bson_free (threads);
+   bson_free (lts);
+}
+
+
+static void
+usage (void)
+{
+   fprintf (stderr,
+            "usage: mongoc-load [-r RATE[,RATE...]] [-d SECONDS] [-j THREADS]\n"
+            "                   [-o ping|find|insert] [-n DB.COLLECTION] URI\n");
+   exit (EXIT_FAILURE);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   bson_error_t error;
+   const char *rates = "1000";
+   const char *ns = "test.mongoc_load";
+   load_op_t op = LOAD_PING;
+   char *db;
+   char *dot;
+   char *end;
+   const char *p;
+   double rate;
+   int i;
+
+   for (i = 1; i < argc; i++) {
+      if (!strcmp (argv[i], "-r") && i + 1 < argc) {
+         rates = argv[++i];
+      } else if (!strcmp (argv[i], "-d") && i + 1 < argc) {
+         gDurationUsec = (int64_t) (atof (argv[++i]) * 1000 * 1000);
+      } else if (!strcmp (argv[i], "-j") && i + 1 < argc) {
+         gThreads = atoi (argv[++i]);
+      } else if (!strcmp (argv[i], "-o") && i + 1 < argc) {
+         i++;
+         if (!strcmp (argv[i], "ping")) {
+            op = LOAD_PING;
+         } else if (!strcmp (argv[i], "find")) {
+            op = LOAD_FIND;
+         } else if (!strcmp (argv[i], "insert")) {
+            op = LOAD_INSERT;
+         } else {
+            usage ();
+         }
+      } else if (!strcmp (argv[i], "-n") && i + 1 < argc) {
+         ns = argv[++i];
+      } else if (argv[i][0] == '-') {
+         usage ();
+      } else {
+         break;
+      }
+   }
+
+   if (gDurationUsec <= 0 || gThreads <= 0 || i != argc - 1) {
+      usage ();
+   }
+
+   db = bson_strdup (ns);
+   dot = strchr (db, '.');
+   if (!dot || dot == db || !dot[1]) {
+      usage ();
+   }
+
+   *dot = '\0';
+
+   mongoc_init ();
+
+   uri = mongoc_uri_new_with_error (argv[i], &error);
+   if (!uri) {
+      fprintf (stderr, "mongoc-load: %s\n", error.message);
+      return EXIT_FAILURE;
+   }
+
+   /* enough connections for every thread, unless the URI says otherwise */
+   if (!mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_MAXPOOLSIZE, 0)) {
+      mongoc_uri_set_option_as_int32 (uri, MONGOC_URI_MAXPOOLSIZE, gThreads);
+   }
+
+   pool = mongoc_client_pool_new (uri);
+   mongoc_client_pool_set_error_api (pool, MONGOC_ERROR_API_VERSION_2);
+
+   load_print_header ();
+
+   for (p = rates; *p; p = *end ? end + 1 : end) {
+      rate = strtod (p, &end);
+      if (end == p || rate <= 0 || (*end && *end != ',')) {
+         usage ();
+      }
+
+      load_run_rate (pool, op, db, dot + 1, rate);
+   }
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   bson_free (db);
+
+   mongoc_cleanup ();
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,934 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * mongoc-replay: re-issue the commands in a file recorded with
+ * mongoc_stream_capture_new against another deployment, keeping their
+ * original timing, and compare each command's latency then and now.
+ *
+ *   mongoc-replay [-s SPEED] [-j THREADS] FILE URI
+ *
+ * Each recorded connection's commands are replayed in order by one thread,
+ * which has its own client from a pool; with fewer threads than recorded
+ * connections, a thread replays several. An operation is due at its
+ * recorded time divided by SPEED (default 1), and is sent then even if the
+ * deployment is slower than the original. SPEED 0 replays as fast as
+ * possible.
+ *
+ * Handshakes and authentication are skipped, since the replaying client
+ * does its own. Session ids and cluster times are removed. Cursor ids in
+ * getMore and killCursors are translated to those of the replayed cursors,
+ * and a getMore is sent to the server its cursor is on. Legacy opcodes
+ * other than OP_QUERY commands are not replayed.
+ */
+
+
+#include <mongoc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoc-array-private.h"
+#include "mongoc-compression-private.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-util-private.h"
+
+
+#define REPLAY_MAGIC "MONGOCAP"
+#define REPLAY_VERSION 1
+#define REPLAY_MAX_MSG_LEN (48 * 1024 * 1024)
+
+/* how far back to look for the request a recorded reply answers */
+#define REPLAY_MAX_IN_FLIGHT 1024
+
+
+typedef struct {
+   int64_t usec; /* recorded send time */
+   uint32_t connection_id;
+   int32_t request_id;
+   char *db;
+   bson_t *cmd;
+   mongoc_read_prefs_t *prefs;
+   int64_t recorded_cursor_id; /* from the recorded reply */
+   int64_t recorded_latency;   /* -1 without a recorded reply */
+   int64_t latency;            /* -1 if not replayed */
+   bool failed;
+} replay_op_t;
+
+
+typedef struct {
+   int64_t recorded_id;
+   int64_t id;
+   uint32_t server_id;
+} replay_cursor_t;
+
+
+typedef struct {
+   mongoc_client_pool_t *pool;
+   mongoc_array_t *ops;
+   mongoc_array_t op_indexes; /* size_t, in recorded order */
+   mongoc_array_t cursors;    /* replay_cursor_t */
+   int64_t start;
+   int64_t first_usec;
+   double speed;
+   int64_t max_lag;
+   int64_t errors;
+   int64_t orphans; /* getMores for cursors that weren't replayed */
+   bson_error_t last_error;
+} replay_thread_t;
+
+
+typedef struct {
+   int64_t skipped;
+   int64_t unsupported;
+   uint32_t max_connection_id;
+} replay_stats_t;
+
+
+static bool
+replay_read (FILE *file, void *buf, size_t len)
+{
+   return fread (buf, 1, len, file) == len;
+}
+
+
+static int32_t
+replay_int32 (const uint8_t *p)
+{
+   int32_t v;
+
+   memcpy (&v, p, sizeof v);
+   return (int32_t) BSON_UINT32_FROM_LE (v);
+}
+
+
+/* decompress an OP_COMPRESSED message, or return a copy of any other */
+static uint8_t *
+replay_uncompress (const uint8_t *msg, size_t len, size_t *out_len)
+{
+   uint8_t *out;
+   size_t uncompressed_size;
+   int32_t opcode;
+
+   if (replay_int32 (msg + 12) != MONGOC_OPCODE_COMPRESSED) {
+      out = bson_malloc (len);
+      memcpy (out, msg, len);
+      *out_len = len;
+      return out;
+   }
+
+   if (len < 25) {
+      return NULL;
+   }
+
+   uncompressed_size = (size_t) replay_int32 (msg + 20);
+   if (uncompressed_size > REPLAY_MAX_MSG_LEN) {
+      return NULL;
+   }
+
+   /* rebuild the header with the original opcode */
+   out = bson_malloc (16 + uncompressed_size);
+   memcpy (out, msg, 12);
+   opcode = (int32_t) BSON_UINT32_TO_LE (replay_int32 (msg + 16));
+   memcpy (out + 12, &opcode, 4);
+
+   if (!mongoc_uncompress (msg[24],
+                           msg + 25,
+                           len - 25,
+                           out + 16,
+                           &uncompressed_size)) {
+      bson_free (out);
+      return NULL;
+   }
+
+   *out_len = 16 + uncompressed_size;
+   return out;
+}
+
+
+/* the first document of an OP_REPLY */
+static bool
+replay_reply_doc (const uint8_t *msg, size_t len, bson_t *doc)
+{
+   int32_t doc_len;
+
+   if (len < 36 + 5) {
+      return false;
+   }
+
+   doc_len = replay_int32 (msg + 36);
+   return doc_len >= 5 && (size_t) doc_len <= len - 36 &&
+          bson_init_static (doc, msg + 36, (size_t) doc_len);
+}
+
+
+static int64_t
+replay_reply_cursor_id (const bson_t *reply)
+{
+   bson_iter_t iter;
+
+   if (bson_iter_init_find (&iter, reply, "cursor") &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter) && bson_iter_recurse (&iter, &iter) &&
+       bson_iter_find (&iter, "id") && BSON_ITER_HOLDS_INT64 (&iter)) {
+      return bson_iter_int64 (&iter);
+   }
+
+   return 0;
+}
+
+
+static mongoc_read_prefs_t *
+replay_read_prefs (const bson_iter_t *rp_iter)
+{
+   mongoc_read_prefs_t *prefs;
+   mongoc_read_mode_t mode;
+   bson_iter_t iter;
+   const char *name;
+   const uint8_t *data;
+   uint32_t len;
+   bson_t tags;
+
+   if (!BSON_ITER_HOLDS_DOCUMENT (rp_iter) ||
+       !bson_iter_recurse (rp_iter, &iter) || !bson_iter_find (&iter, "mode") ||
+       !BSON_ITER_HOLDS_UTF8 (&iter)) {
+      return NULL;
+   }
+
+   name = bson_iter_utf8 (&iter, NULL);
+   if (!strcmp (name, "primaryPreferred")) {
+      mode = MONGOC_READ_PRIMARY_PREFERRED;
+   } else if (!strcmp (name, "secondary")) {
+      mode = MONGOC_READ_SECONDARY;
+   } else if (!strcmp (name, "secondaryPreferred")) {
+      mode = MONGOC_READ_SECONDARY_PREFERRED;
+   } else if (!strcmp (name, "nearest")) {
+      mode = MONGOC_READ_NEAREST;
+   } else {
+      return NULL;
+   }
+
+   prefs = mongoc_read_prefs_new (mode);
+
+   if (bson_iter_recurse (rp_iter, &iter) && bson_iter_find (&iter, "tags") &&
+       BSON_ITER_HOLDS_ARRAY (&iter)) {
+      bson_iter_array (&iter, &len, &data);
+      if (bson_init_static (&tags, data, len)) {
+         mongoc_read_prefs_set_tags (prefs, &tags);
+      }
+   }
+
+   return prefs;
+}
+
+
+static bool
+replay_skip_command (const char *name)
+{
+   static const char *skip[] = {"isMaster",
+                                "ismaster",
+                                "saslStart",
+                                "saslContinue",
+                                "getnonce",
+                                "authenticate",
+                                "logout",
+                                "endSessions",
+                                NULL};
+   int i;
+
+   for (i = 0; skip[i]; i++) {
+      if (!strcmp (name, skip[i])) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/* parse an OP_QUERY command into @op, return false if it isn't one */
+static bool
+replay_parse_query (const uint8_t *msg,
+                    size_t len,
+                    replay_op_t *op,
+                    replay_stats_t *stats)
+{
+   const uint8_t *ns;
+   const uint8_t *end;
+   const uint8_t *query_at;
+   bson_t query;
+   bson_t *cmd;
+   bson_iter_t iter;
+   const bson_t *source = &query;
+   const uint8_t *data;
+   uint32_t data_len;
+   bson_t inner;
+   int32_t doc_len;
+   size_t ns_len;
+
+   if (len < 21) {
+      stats->unsupported++;
+      return false;
+   }
+
+   /* flags, then the namespace */
+   ns = msg + 20;
+   end = memchr (ns, '\0', len - 20);
+   if (!end) {
+      stats->unsupported++;
+      return false;
+   }
+
+   ns_len = (size_t) (end - ns);
+   query_at = end + 1 + 8; /* skip and limit */
+   if (ns_len < 6 || strcmp ((const char *) end - 5, ".$cmd") != 0 ||
+       query_at + 5 > msg + len) {
+      stats->unsupported++;
+      return false;
+   }
+
+   doc_len = replay_int32 (query_at);
+   if (doc_len < 5 || query_at + doc_len > msg + len ||
+       !bson_init_static (&query, query_at, (size_t) doc_len)) {
+      stats->unsupported++;
+      return false;
+   }
+
+   /* commands through mongos are wrapped in $query with a $readPreference */
+   if (bson_iter_init_find (&iter, &query, "$query") &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_iter_document (&iter, &data_len, &data);
+      if (!bson_init_static (&inner, data, data_len)) {
+         stats->unsupported++;
+         return false;
+      }
+
+      source = &inner;
+      if (bson_iter_init_find (&iter, &query, "$readPreference")) {
+         op->prefs = replay_read_prefs (&iter);
+      }
+   }
+
+   if (!bson_iter_init (&iter, source) || !bson_iter_next (&iter)) {
+      stats->unsupported++;
+      return false;
+   }
+
+   if (replay_skip_command (bson_iter_key (&iter))) {
+      stats->skipped++;
+      return false;
+   }
+
+   /* the replaying client has its own sessions and cluster time */
+   cmd = bson_new ();
+   bson_copy_to_excluding_noinit (source,
+                                  cmd,
+                                  "lsid",
+                                  "txnNumber",
+                                  "$clusterTime",
+                                  "$readPreference",
+                                  "$db",
+                                  NULL);
+
+   op->db = bson_strndup ((const char *) ns, ns_len - 5);
+   op->cmd = cmd;
+   op->request_id = replay_int32 (msg + 4);
+
+   return true;
+}
+
+
+/* the request on @connection_id that the reply @response_to answers */
+static replay_op_t *
+replay_find_request (mongoc_array_t *ops,
+                     uint32_t connection_id,
+                     int32_t response_to)
+{
+   replay_op_t *op;
+   size_t i;
+
+   for (i = ops->len; i > 0 && ops->len - i < REPLAY_MAX_IN_FLIGHT; i--) {
+      op = &_mongoc_array_index (ops, replay_op_t, i - 1);
+      if (op->connection_id == connection_id &&
+          op->request_id == response_to) {
+         return op;
+      }
+   }
+
+   return NULL;
+}
+
+
+static bool
+replay_load (const char *path,
+             mongoc_array_t *ops,
+             replay_stats_t *stats,
+             bson_error_t *error)
+{
+   FILE *file;
+   uint8_t header[13];
+   uint8_t *msg = NULL;
+   uint8_t *uncompressed;
+   size_t uncompressed_len;
+   int32_t msg_len;
+   int64_t usec;
+   uint32_t connection_id;
+   replay_op_t op;
+   replay_op_t *request;
+   bson_t reply;
+   bool ret = false;
+
+   file = fopen (path, "rb");
+   if (!file) {
+      bson_set_error (error, 0, 0, "cannot open %s", path);
+      return false;
+   }
+
+   if (!replay_read (file, header, 12) || memcmp (header, REPLAY_MAGIC, 8) ||
+       replay_int32 (header + 8) != REPLAY_VERSION) {
+      bson_set_error (error, 0, 0, "%s is not a capture file", path);
+      goto done;
+   }
+
+   while (replay_read (file, header, sizeof header)) {
+      memcpy (&usec, header, 8);
+      usec = (int64_t) BSON_UINT64_FROM_LE (usec);
+      memcpy (&connection_id, header + 8, 4);
+      connection_id = BSON_UINT32_FROM_LE (connection_id);
+
+      msg = bson_malloc (4);
+      if (!replay_read (file, msg, 4)) {
+         break;
+      }
+
+      msg_len = replay_int32 (msg);
+      if (msg_len < 16 || msg_len > REPLAY_MAX_MSG_LEN) {
+         bson_set_error (error, 0, 0, "%s is corrupt", path);
+         goto done;
+      }
+
+      msg = bson_realloc (msg, (size_t) msg_len);
+      if (!replay_read (file, msg + 4, (size_t) msg_len - 4)) {
+         break;
+      }
+
+      uncompressed = replay_uncompress (msg, (size_t) msg_len, &uncompressed_len);
+      bson_free (msg);
+      msg = NULL;
+
+      if (!uncompressed) {
+         stats->unsupported++;
+         continue;
+      }
+
+      if (header[12] == 0) {
+         memset (&op, 0, sizeof op);
+         op.usec = usec;
+         op.connection_id = connection_id;
+         op.recorded_latency = -1;
+         op.latency = -1;
+
+         if (replay_int32 (uncompressed + 12) != MONGOC_OPCODE_QUERY) {
+            stats->unsupported++;
+         } else if (replay_parse_query (
+                       uncompressed, uncompressed_len, &op, stats)) {
+            _mongoc_array_append_val (ops, op);
+            stats->max_connection_id =
+               BSON_MAX (stats->max_connection_id, connection_id);
+         } else {
+            mongoc_read_prefs_destroy (op.prefs);
+         }
+      } else if (replay_int32 (uncompressed + 12) == MONGOC_OPCODE_REPLY &&
+                 (request = replay_find_request (
+                     ops, connection_id, replay_int32 (uncompressed + 8)))) {
+         request->recorded_latency = usec - request->usec;
+         if (replay_reply_doc (uncompressed, uncompressed_len, &reply)) {
+            request->recorded_cursor_id = replay_reply_cursor_id (&reply);
+         }
+      }
+
+      bson_free (uncompressed);
+   }
+
+   /* a record cut short at the end of the file is from an unclean exit */
+   ret = true;
+
+done:
+   bson_free (msg);
+   fclose (file);
+
+   return ret;
+}
+
+
+static replay_cursor_t *
+replay_find_cursor (replay_thread_t *rt, int64_t recorded_id)
+{
+   replay_cursor_t *cursor;
+   size_t i;
+
+   for (i = 0; i < rt->cursors.len; i++) {
+      cursor = &_mongoc_array_index (&rt->cursors, replay_cursor_t, i);
+      if (cursor->recorded_id == recorded_id) {
+         return cursor;
+      }
+   }
+
+   return NULL;
+}
+
+
+static void
+replay_forget_cursor (replay_thread_t *rt, replay_cursor_t *cursor)
+{
+   /* swap with the last */
+   *cursor = _mongoc_array_index (
+      &rt->cursors, replay_cursor_t, rt->cursors.len - 1);
+   rt->cursors.len--;
+}
+
+
+/* translate cursor ids in getMore or killCursors, return false to skip */
+static bool
+replay_translate (replay_thread_t *rt,
+                  const bson_t *recorded,
+                  bson_t *cmd,
+                  uint32_t *server_id,
+                  replay_cursor_t **get_more_cursor)
+{
+   replay_cursor_t *cursor;
+   bson_iter_t iter;
+   bson_iter_t ids;
+   bson_t array;
+   const char *key;
+   char buf[16];
+   uint32_t n = 0;
+
+   bson_iter_init (&iter, recorded);
+   bson_iter_next (&iter);
+   key = bson_iter_key (&iter);
+
+   if (!strcmp (key, "getMore")) {
+      cursor = replay_find_cursor (rt, bson_iter_as_int64 (&iter));
+      if (!cursor) {
+         return false;
+      }
+
+      BSON_APPEND_INT64 (cmd, "getMore", cursor->id);
+      bson_copy_to_excluding_noinit (recorded, cmd, "getMore", NULL);
+      *server_id = cursor->server_id;
+      *get_more_cursor = cursor;
+      return true;
+   }
+
+   if (!strcmp (key, "killCursors")) {
+      BSON_APPEND_UTF8 (cmd, "killCursors", bson_iter_utf8 (&iter, NULL));
+      BSON_APPEND_ARRAY_BEGIN (cmd, "cursors", &array);
+      if (bson_iter_find (&iter, "cursors") && BSON_ITER_HOLDS_ARRAY (&iter) &&
+          bson_iter_recurse (&iter, &ids)) {
+         while (bson_iter_next (&ids)) {
+            cursor = replay_find_cursor (rt, bson_iter_as_int64 (&ids));
+            if (cursor) {
+               bson_uint32_to_string (n++, &key, buf, sizeof buf);
+               bson_append_int64 (&array, key, -1, cursor->id);
+               *server_id = cursor->server_id;
+               replay_forget_cursor (rt, cursor);
+            }
+         }
+      }
+      bson_append_array_end (cmd, &array);
+      return n > 0;
+   }
+
+   bson_copy_to_excluding_noinit (recorded, cmd, NULL);
+   return true;
+}
+
+
+static void
+replay_op (replay_thread_t *rt, mongoc_client_t *client, replay_op_t *op)
+{
+   mongoc_server_description_t *sd;
+   replay_cursor_t *get_more_cursor = NULL;
+   replay_cursor_t new_cursor;
+   uint32_t server_id = 0;
+   bson_t cmd = BSON_INITIALIZER;
+   bson_t reply;
+   int64_t started;
+   int64_t cursor_id;
+   bool r;
+
+   if (!replay_translate (rt, op->cmd, &cmd, &server_id, &get_more_cursor)) {
+      rt->orphans++;
+      bson_destroy (&cmd);
+      return;
+   }
+
+   started = bson_get_monotonic_time ();
+
+   if (!server_id) {
+      sd = mongoc_client_select_server (
+         client, op->prefs == NULL, op->prefs, &rt->last_error);
+      if (!sd) {
+         op->failed = true;
+         rt->errors++;
+         bson_destroy (&cmd);
+         return;
+      }
+
+      server_id = mongoc_server_description_id (sd);
+      mongoc_server_description_destroy (sd);
+   }
+
+   r = mongoc_client_command_simple_with_server_id (
+      client, op->db, &cmd, op->prefs, server_id, &reply, &rt->last_error);
+   op->latency = bson_get_monotonic_time () - started;
+
+   if (!r) {
+      op->failed = true;
+      rt->errors++;
+   }
+
+   /* remember where the replayed cursor is, for later getMores */
+   cursor_id = r ? replay_reply_cursor_id (&reply) : 0;
+
+   if (get_more_cursor) {
+      if (!cursor_id) {
+         replay_forget_cursor (rt, get_more_cursor);
+      }
+   } else if (op->recorded_cursor_id && cursor_id) {
+      new_cursor.recorded_id = op->recorded_cursor_id;
+      new_cursor.id = cursor_id;
+      new_cursor.server_id = server_id;
+      _mongoc_array_append_val (&rt->cursors, new_cursor);
+   }
+
+   bson_destroy (&reply);
+   bson_destroy (&cmd);
+}
+
+
+static void *
+replay_thread (void *data)
+{
+   replay_thread_t *rt = (replay_thread_t *) data;
+   mongoc_client_t *client;
+   replay_op_t *op;
+   int64_t scheduled;
+   int64_t now;
+   size_t i;
+
+   client = mongoc_client_pool_pop (rt->pool);
+
+   for (i = 0; i < rt->op_indexes.len; i++) {
+      op = &_mongoc_array_index (
+         rt->ops, replay_op_t, _mongoc_array_index (&rt->op_indexes, size_t, i));
+
+      if (rt->speed > 0) {
+         scheduled =
+            rt->start + (int64_t) ((double) (op->usec - rt->first_usec) /
+                                   rt->speed);
+         now = bson_get_monotonic_time ();
+         if (now < scheduled) {
+            _mongoc_usleep (scheduled - now);
+         } else {
+            rt->max_lag = BSON_MAX (rt->max_lag, now - scheduled);
+         }
+      }
+
+      replay_op (rt, client, op);
+   }
+
+   mongoc_client_pool_push (rt->pool, client);
+
+   return NULL;
+}
+
+
+static int
+replay_cmp_int64 (const void *a, const void *b)
+{
+   int64_t x = *(const int64_t *) a;
+   int64_t y = *(const int64_t *) b;
+
+   return x < y ? -1 : x > y;
+}
+
+
+static int64_t
+replay_percentile (const int64_t *sorted, size_t n, double percentile)
+{
+   size_t i;
+
+   if (!n) {
+      return 0;
+   }
+
+   i = (size_t) ((double) n * percentile / 100.0 + 0.5);
+   i = BSON_MAX (i, 1);
+   return sorted[BSON_MIN (i, n) - 1];
+}
+
+
+static int
+replay_cmp_op_name (const void *a, const void *b)
+{
+   const replay_op_t *x = *(const replay_op_t **) a;
+   const replay_op_t *y = *(const replay_op_t **) b;
+
+   return strcmp (_mongoc_get_command_name (x->cmd),
+                  _mongoc_get_command_name (y->cmd));
+}
+
+
+/* print latency percentiles, then and now, for @n ops named @name */
+static void
+replay_print_row (const char *name, replay_op_t **ops, size_t n)
+{
+   int64_t *recorded;
+   int64_t *replayed;
+   size_t n_recorded = 0;
+   size_t n_replayed = 0;
+   size_t n_failed = 0;
+   size_t i;
+
+   recorded = bson_malloc0 ((n + 1) * sizeof (int64_t));
+   replayed = bson_malloc0 ((n + 1) * sizeof (int64_t));
+
+   for (i = 0; i < n; i++) {
+      if (ops[i]->recorded_latency >= 0) {
+         recorded[n_recorded++] = ops[i]->recorded_latency;
+      }
+
+      if (ops[i]->failed) {
+         n_failed++;
+      } else if (ops[i]->latency >= 0) {
+         replayed[n_replayed++] = ops[i]->latency;
+      }
+   }
+
+   qsort (recorded, n_recorded, sizeof (int64_t), replay_cmp_int64);
+   qsort (replayed, n_replayed, sizeof (int64_t), replay_cmp_int64);
+
+   printf ("%-20s %8" PRIu64 " %8" PRIu64 "   %9" PRId64 " %9" PRId64 " %9" PRId64
+           "   %9" PRId64 " %9" PRId64 " %9" PRId64 "\n",
+           name,
+           (uint64_t) n_replayed,
+           (uint64_t) n_failed,
+           replay_percentile (recorded, n_recorded, 50),
+           replay_percentile (recorded, n_recorded, 99),
+           n_recorded ? recorded[n_recorded - 1] : 0,
+           replay_percentile (replayed, n_replayed, 50),
+           replay_percentile (replayed, n_replayed, 99),
+           n_replayed ? replayed[n_replayed - 1] : 0);
+
+   bson_free (replayed);
+   bson_free (recorded);
+}
+
+
+static void
+replay_print (mongoc_array_t *ops)
+{
+   replay_op_t **sorted;
+   const char *name;
+   size_t first;
+   size_t i;
+
+   printf ("%-20s %8s %8s   %9s %9s %9s   %9s %9s %9s\n",
+           "command",
+           "replayed",
+           "errors",
+           "was p50",
+           "p99",
+           "max",
+           "now p50",
+           "p99",
+           "max");
+
+   sorted = bson_malloc0 ((ops->len + 1) * sizeof *sorted);
+   for (i = 0; i < ops->len; i++) {
+      sorted[i] = &_mongoc_array_index (ops, replay_op_t, i);
+   }
+
+   qsort (sorted, ops->len, sizeof *sorted, replay_cmp_op_name);
+
+   for (first = 0; first < ops->len; first = i) {
+      name = _mongoc_get_command_name (sorted[first]->cmd);
+      for (i = first + 1; i < ops->len; i++) {
+         if (strcmp (name, _mongoc_get_command_name (sorted[i]->cmd))) {
+            break;
+         }
+      }
+
+      replay_print_row (name, sorted + first, i - first);
+   }
+
+   replay_print_row ("(all)", sorted, ops->len);
+
+   bson_free (sorted);
+}
+
+
+static void
+usage (void)
+{
+   fprintf (stderr, "usage: mongoc-replay [-s SPEED] [-j THREADS] FILE URI\n");
+   exit (EXIT_FAILURE);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+   mongoc_array_t ops;
+   replay_stats_t stats = {0};
+   replay_thread_t *rts;
+   mongoc_thread_t *threads;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   bson_error_t error;
+   replay_op_t *op;
+   double speed = 1.0;
+   int n_threads = 0;
+   int64_t start;
+   int64_t elapsed;
+   int64_t errors = 0;
+   int64_t orphans = 0;
+   int64_t max_lag = 0;
+   size_t i;
+   int t;
+
+   for (t = 1; t < argc; t++) {
+      if (!strcmp (argv[t], "-s") && t + 1 < argc) {
+         speed = atof (argv[++t]);
+      } else if (!strcmp (argv[t], "-j") && t + 1 < argc) {
+         n_threads = atoi (argv[++t]);
+      } else if (argv[t][0] == '-') {
+         usage ();
+      } else {
+         break;
+      }
+   }
+
+   if (speed < 0 || n_threads < 0 || t != argc - 2) {
+      usage ();
+   }
+
+   mongoc_init ();
+
+   _mongoc_array_init (&ops, sizeof (replay_op_t));
+   if (!replay_load (argv[t], &ops, &stats, &error)) {
+      fprintf (stderr, "mongoc-replay: %s\n", error.message);
+      return EXIT_FAILURE;
+   }
+
+   uri = mongoc_uri_new_with_error (argv[t + 1], &error);
+   if (!uri) {
+      fprintf (stderr, "mongoc-replay: %s\n", error.message);
+      return EXIT_FAILURE;
+   }
+
+   /* by default, a thread per recorded connection */
+   if (!n_threads) {
+      n_threads = (int) BSON_MIN (stats.max_connection_id, 1024);
+      n_threads = BSON_MAX (n_threads, 1);
+   }
+
+   if (!mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_MAXPOOLSIZE, 0)) {
+      mongoc_uri_set_option_as_int32 (uri, MONGOC_URI_MAXPOOLSIZE, n_threads);
+   }
+
+   pool = mongoc_client_pool_new (uri);
+   mongoc_client_pool_set_error_api (pool, MONGOC_ERROR_API_VERSION_2);
+
+   rts = (replay_thread_t *) bson_malloc0 (n_threads * sizeof *rts);
+   threads = (mongoc_thread_t *) bson_malloc0 (n_threads * sizeof *threads);
+
+   /* let the threads start before the first operation is due */
+   start = bson_get_monotonic_time () + 100 * 1000;
+
+   for (t = 0; t < n_threads; t++) {
+      rts[t].pool = pool;
+      rts[t].ops = &ops;
+      rts[t].start = start;
+      rts[t].first_usec =
+         ops.len ? _mongoc_array_index (&ops, replay_op_t, 0).usec : 0;
+      rts[t].speed = speed;
+      _mongoc_array_init (&rts[t].op_indexes, sizeof (size_t));
+      _mongoc_array_init (&rts[t].cursors, sizeof (replay_cursor_t));
+   }
+
+   for (i = 0; i < ops.len; i++) {
+      op = &_mongoc_array_index (&ops, replay_op_t, i);
+      _mongoc_array_append_val (
+         &rts[op->connection_id % n_threads].op_indexes, i);
+   }
+
+   for (t = 0; t < n_threads; t++) {
+      mongoc_thread_create (&threads[t], replay_thread, &rts[t]);
+   }
+
+   for (t = 0; t < n_threads; t++) {
+      mongoc_thread_join (threads[t]);
+   }
+
+   elapsed = bson_get_monotonic_time () - start;
+
+   for (t = 0; t < n_threads; t++) {
+      errors += rts[t].errors;
+      orphans += rts[t].orphans;
+      max_lag = BSON_MAX (max_lag, rts[t].max_lag);
+      if (rts[t].errors) {
+         fprintf (stderr, "mongoc-replay: %s\n", rts[t].last_error.message);
+      }
+
+      _mongoc_array_destroy (&rts[t].op_indexes);
+      _mongoc_array_destroy (&rts[t].cursors);
+   }
+
+   printf ("replayed %" PRIu64 " commands with %d threads in %.1f s, %" PRId64
+           " errors\n",
+           (uint64_t) ops.len,
+           n_threads,
+           (double) elapsed / 1e6,
+           errors);
+   printf ("not replayed: %" PRId64 " handshakes and authentication, %" PRId64
+           " unsupported, %" PRId64 " for cursors not replayed\n",
+           stats.skipped,
+           stats.unsupported,
+           orphans);
+   printf ("most behind schedule: %" PRId64 " usec\n\n", max_lag);
+
+   replay_print (&ops);
+
+   for (i = 0; i < ops.len; i++) {
+      op = &_mongoc_array_index (&ops, replay_op_t, i);
+      bson_free (op->db);
+      bson_destroy (op->cmd);
+      mongoc_read_prefs_destroy (op->prefs);
+   }
+
+   _mongoc_array_destroy (&ops);
+   bson_free (threads);
+   bson_free (rts);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+
+   mongoc_cleanup ();
+
+   return EXIT_SUCCESS;
+}
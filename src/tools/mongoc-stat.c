@@ -21,11 +21,14 @@
 #ifdef BSON_OS_UNIX
 
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 
@@ -43,6 +46,48 @@ typedef struct {
 BSON_STATIC_ASSERT (sizeof (mongoc_counter_info_t) == 128);
 
 
+#pragma pack(1)
+typedef struct {
+   uint32_t offset;
+   uint32_t n_buckets;
+   char category[24];
+   char name[32];
+   char description[64];
+} mongoc_histogram_info_t;
+#pragma pack()
+
+
+BSON_STATIC_ASSERT (sizeof (mongoc_histogram_info_t) == 128);
+
+
+#pragma pack(1)
+typedef struct {
+   uint32_t offset;
+   uint32_t state;
+   uint32_t generation;
+   uint32_t padding;
+   int64_t round_trip_time_msec;
+   char host_and_port[104];
+} mongoc_server_counters_info_t;
+#pragma pack()
+
+
+BSON_STATIC_ASSERT (sizeof (mongoc_server_counters_info_t) == 128);
+
+
+/* slot states and per-server counter order, see mongoc-counters-private.h */
+enum { SERVER_FREE, SERVER_ACTIVE, SERVER_RETIRED };
+enum {
+   SERVER_OPS,
+   SERVER_EGRESS_BYTES,
+   SERVER_INGRESS_BYTES,
+   SERVER_ERRORS,
+   SERVER_TIMEOUTS,
+   SERVER_CONNECTIONS,
+   SERVER_LAST
+};
+
+
 #pragma pack(1)
 typedef struct {
    uint32_t size;
@@ -50,7 +95,13 @@ typedef struct {
    uint32_t n_counters;
    uint32_t infos_offset;
    uint32_t values_offset;
-   uint8_t padding[44];
+   uint32_t n_histograms;
+   uint32_t histogram_infos_offset;
+   uint32_t histogram_values_offset;
+   uint32_t n_server_slots;
+   uint32_t server_infos_offset;
+   uint32_t server_values_offset;
+   uint8_t padding[20];
 } mongoc_counters_t;
 #pragma pack()
 
@@ -66,11 +117,6 @@ typedef struct {
 BSON_STATIC_ASSERT (sizeof (mongoc_counter_slots_t) == 64);
 
 
-typedef struct {
-   mongoc_counter_slots_t *cpus;
-} mongoc_counter_t;
-
-
 static void
 mongoc_counters_destroy (mongoc_counters_t *counters)
 {
@@ -146,82 +192,828 @@ mongoc_counters_get_infos (mongoc_counters_t *counters, uint32_t *n_infos)
 }
 
 
+static mongoc_histogram_info_t *
+mongoc_counters_get_histogram_infos (mongoc_counters_t *counters,
+                                     uint32_t *n_infos)
+{
+   char *base = (char *) counters;
+
+   BSON_ASSERT (counters);
+   BSON_ASSERT (n_infos);
+
+   /* segments from drivers without histograms have zeroes here */
+   *n_infos = counters->n_histograms;
+   if (!counters->n_histograms) {
+      return NULL;
+   }
+
+   return (mongoc_histogram_info_t *) (base + counters->histogram_infos_offset);
+}
+
+
+/* the highest value that lands in @bucket, see _mongoc_histogram_bucket */
 static int64_t
-mongoc_counters_get_value (mongoc_counters_t *counters,
-                           mongoc_counter_info_t *info,
-                           mongoc_counter_t *counter)
+mongoc_histogram_bucket_max (uint32_t bucket)
 {
-   int64_t value = 0;
-   unsigned i;
+   uint32_t msb;
 
-   for (i = 0; i < counters->n_cpu; i++) {
-      value += counter->cpus[i].slots[info->slot];
+   if (bucket < 4) {
+      return (int64_t) bucket;
    }
 
-   return value;
+   msb = bucket / 4 + 1;
+
+   return (((int64_t) (4 + bucket % 4) + 1) << (msb - 2)) - 1;
+}
+
+
+static int64_t
+mongoc_histogram_percentile (const int64_t *buckets,
+                             uint32_t n_buckets,
+                             int64_t total,
+                             double percentile)
+{
+   int64_t target;
+   int64_t seen = 0;
+   uint32_t i;
+
+   target = (int64_t) (total * percentile + 0.5);
+   if (target < 1) {
+      target = 1;
+   }
+
+   for (i = 0; i < n_buckets; i++) {
+      seen += buckets[i];
+      if (seen >= target) {
+         return mongoc_histogram_bucket_max (i);
+      }
+   }
+
+   return mongoc_histogram_bucket_max (n_buckets - 1);
+}
+
+
+static mongoc_server_counters_info_t *
+mongoc_counters_get_server_infos (mongoc_counters_t *counters,
+                                  uint32_t *n_infos)
+{
+   char *base = (char *) counters;
+
+   BSON_ASSERT (counters);
+   BSON_ASSERT (n_infos);
+
+   /* segments from drivers without per-server counters have zeroes here */
+   *n_infos = counters->n_server_slots;
+   if (!counters->n_server_slots) {
+      return NULL;
+   }
+
+   return (mongoc_server_counters_info_t *) (base +
+                                             counters->server_infos_offset);
+}
+
+
+typedef enum {
+   MONGOC_STAT_TEXT,
+   MONGOC_STAT_JSON,
+   MONGOC_STAT_PROMETHEUS,
+} mongoc_stat_format_t;
+
+
+/* one reading of the segment, each value summed over the CPUs */
+typedef struct {
+   int64_t time_usec;
+   int64_t *counters;  /* one per counter */
+   int64_t *buckets;   /* max_buckets per histogram */
+   int64_t *servers;   /* SERVER_LAST per server slot */
+   uint32_t *states;   /* one per server slot */
+   int64_t *rtts;      /* one per server slot */
+} mongoc_stat_sample_t;
+
+
+typedef struct {
+   mongoc_counters_t *counters;
+   unsigned pid;
+   mongoc_counter_info_t *infos;
+   uint32_t n_counters;
+   mongoc_histogram_info_t *histogram_infos;
+   uint32_t n_histograms;
+   uint32_t max_buckets;
+   mongoc_server_counters_info_t *server_infos;
+   uint32_t n_servers;
+} mongoc_stat_t;
+
+
+static const char *gServerFields[SERVER_LAST] = {"ops",
+                                                 "egress_bytes",
+                                                 "ingress_bytes",
+                                                 "errors",
+                                                 "timeouts",
+                                                 "connections"};
+
+
+static int64_t
+mongoc_stat_now (void)
+{
+   struct timespec ts;
+
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+
+   return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
 
 static void
-mongoc_counters_print_info (mongoc_counters_t *counters,
-                            mongoc_counter_info_t *info,
-                            FILE *file)
+mongoc_stat_init (mongoc_stat_t *stat,
+                  mongoc_counters_t *counters,
+                  unsigned pid)
 {
-   mongoc_counter_t ctr;
-   int64_t value;
+   uint32_t i;
+
+   stat->counters = counters;
+   stat->pid = pid;
+   stat->infos = mongoc_counters_get_infos (counters, &stat->n_counters);
+   stat->histogram_infos =
+      mongoc_counters_get_histogram_infos (counters, &stat->n_histograms);
+   stat->server_infos =
+      mongoc_counters_get_server_infos (counters, &stat->n_servers);
+
+   stat->max_buckets = 0;
+   for (i = 0; i < stat->n_histograms; i++) {
+      stat->max_buckets =
+         BSON_MAX (stat->max_buckets, stat->histogram_infos[i].n_buckets);
+   }
+}
+
+
+static bool
+mongoc_stat_sample_init (mongoc_stat_t *stat, mongoc_stat_sample_t *sample)
+{
+   sample->counters = (int64_t *) calloc (stat->n_counters + 1, 8);
+   sample->buckets = (int64_t *) calloc (
+      (size_t) stat->n_histograms * stat->max_buckets + 1, 8);
+   sample->servers =
+      (int64_t *) calloc ((size_t) stat->n_servers * SERVER_LAST + 1, 8);
+   sample->states = (uint32_t *) calloc (stat->n_servers + 1, 4);
+   sample->rtts = (int64_t *) calloc (stat->n_servers + 1, 8);
+
+   return sample->counters && sample->buckets && sample->servers &&
+          sample->states && sample->rtts;
+}
+
+
+static void
+mongoc_stat_sample_destroy (mongoc_stat_sample_t *sample)
+{
+   free (sample->counters);
+   free (sample->buckets);
+   free (sample->servers);
+   free (sample->states);
+   free (sample->rtts);
+}
 
-   BSON_ASSERT (info);
-   BSON_ASSERT (file);
-   BSON_ASSERT ((info->offset & 0x7) == 0);
 
 #ifdef __clang__
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wcast-align"
 #endif
-   ctr.cpus = (mongoc_counter_slots_t *) (((char *) counters) + info->offset);
+static void
+mongoc_stat_sample_read (mongoc_stat_t *stat, mongoc_stat_sample_t *sample)
+{
+   char *base = (char *) stat->counters;
+   mongoc_counter_slots_t *slots;
+   const int64_t *buckets;
+   int64_t *sum;
+   uint32_t n_cpu = stat->counters->n_cpu;
+   uint32_t i;
+   uint32_t j;
+   uint32_t k;
+
+   sample->time_usec = mongoc_stat_now ();
+
+   for (i = 0; i < stat->n_counters; i++) {
+      BSON_ASSERT ((stat->infos[i].offset & 0x7) == 0);
+      slots = (mongoc_counter_slots_t *) (base + stat->infos[i].offset);
+      sample->counters[i] = 0;
+      for (j = 0; j < n_cpu; j++) {
+         sample->counters[i] += slots[j].slots[stat->infos[i].slot];
+      }
+   }
+
+   for (i = 0; i < stat->n_histograms; i++) {
+      BSON_ASSERT ((stat->histogram_infos[i].offset & 0x7) == 0);
+      sum = &sample->buckets[(size_t) i * stat->max_buckets];
+      memset (sum, 0, stat->max_buckets * sizeof *sum);
+      for (j = 0; j < n_cpu; j++) {
+         buckets = (const int64_t *) (base + stat->histogram_infos[i].offset) +
+                   (size_t) j * stat->histogram_infos[i].n_buckets;
+         for (k = 0; k < stat->histogram_infos[i].n_buckets; k++) {
+            sum[k] += buckets[k];
+         }
+      }
+   }
+
+   for (i = 0; i < stat->n_servers; i++) {
+      sample->states[i] = stat->server_infos[i].state;
+      sample->rtts[i] = stat->server_infos[i].round_trip_time_msec;
+      slots = (mongoc_counter_slots_t *) (base + stat->server_infos[i].offset);
+      sum = &sample->servers[(size_t) i * SERVER_LAST];
+      memset (sum, 0, SERVER_LAST * sizeof *sum);
+      for (j = 0; j < n_cpu; j++) {
+         for (k = 0; k < SERVER_LAST; k++) {
+            sum[k] += slots[j].slots[k];
+         }
+      }
+   }
+}
 #ifdef __clang__
 #pragma clang diagnostic pop
 #endif
 
-   value = mongoc_counters_get_value (counters, info, &ctr);
+
+/* per second between @prev and @cur */
+static double
+mongoc_stat_rate (const mongoc_stat_sample_t *prev,
+                  const mongoc_stat_sample_t *cur,
+                  int64_t prev_value,
+                  int64_t cur_value)
+{
+   int64_t usec = cur->time_usec - prev->time_usec;
+
+   if (usec <= 0) {
+      return 0.0;
+   }
+
+   return (double) (cur_value - prev_value) * 1000000.0 / (double) usec;
+}
+
+
+/* @out is the histogram's buckets in @cur, less those in @prev if any */
+static int64_t
+mongoc_stat_histogram (mongoc_stat_t *stat,
+                       const mongoc_stat_sample_t *prev,
+                       const mongoc_stat_sample_t *cur,
+                       uint32_t i,
+                       int64_t *out)
+{
+   size_t offset = (size_t) i * stat->max_buckets;
+   int64_t total = 0;
+   uint32_t k;
+
+   for (k = 0; k < stat->histogram_infos[i].n_buckets; k++) {
+      out[k] = cur->buckets[offset + k];
+      if (prev) {
+         out[k] -= prev->buckets[offset + k];
+      }
+      total += out[k];
+   }
+
+   return total;
+}
+
+
+/* a slot counts once a server has claimed it, and it stays visible after
+ * the server is retired */
+static bool
+mongoc_stat_server_visible (const mongoc_stat_sample_t *sample, uint32_t i)
+{
+   return sample->states[i] != SERVER_FREE;
+}
+
+
+/* the original one-shot report */
+static void
+mongoc_stat_print_text (mongoc_stat_t *stat,
+                        const mongoc_stat_sample_t *cur,
+                        int64_t *buckets,
+                        FILE *file)
+{
+   mongoc_histogram_info_t *hinfo;
+   const int64_t *values;
+   int64_t total;
+   uint32_t i;
+
+   for (i = 0; i < stat->n_counters; i++) {
+      fprintf (file,
+               "%24s : %-24s : %-50s : %lld\n",
+               stat->infos[i].category,
+               stat->infos[i].name,
+               stat->infos[i].description,
+               (long long) cur->counters[i]);
+   }
+
+   for (i = 0; i < stat->n_histograms; i++) {
+      hinfo = &stat->histogram_infos[i];
+      total = mongoc_stat_histogram (stat, NULL, cur, i, buckets);
+      if (total) {
+         fprintf (
+            file,
+            "%24s : %-24s : %-50s : n=%lld p50=%lld p99=%lld p999=%lld\n",
+            hinfo->category,
+            hinfo->name,
+            hinfo->description,
+            (long long) total,
+            (long long) mongoc_histogram_percentile (
+               buckets, hinfo->n_buckets, total, 0.5),
+            (long long) mongoc_histogram_percentile (
+               buckets, hinfo->n_buckets, total, 0.99),
+            (long long) mongoc_histogram_percentile (
+               buckets, hinfo->n_buckets, total, 0.999));
+      } else {
+         fprintf (file,
+                  "%24s : %-24s : %-50s : n=0\n",
+                  hinfo->category,
+                  hinfo->name,
+                  hinfo->description);
+      }
+   }
+
+   for (i = 0; i < stat->n_servers; i++) {
+      if (!mongoc_stat_server_visible (cur, i)) {
+         continue;
+      }
+
+      values = &cur->servers[(size_t) i * SERVER_LAST];
+      fprintf (file,
+               "%24s : %s : ops=%lld egress=%lld ingress=%lld errors=%lld"
+               " timeouts=%lld connections=%lld rtt=%lldms\n",
+               cur->states[i] == SERVER_ACTIVE ? "Server" : "Server (retired)",
+               stat->server_infos[i].host_and_port,
+               (long long) values[SERVER_OPS],
+               (long long) values[SERVER_EGRESS_BYTES],
+               (long long) values[SERVER_INGRESS_BYTES],
+               (long long) values[SERVER_ERRORS],
+               (long long) values[SERVER_TIMEOUTS],
+               (long long) values[SERVER_CONNECTIONS],
+               (long long) cur->rtts[i]);
+   }
+}
+
+
+/* the live view: rates since the last sample, and percentiles of the
+ * latencies recorded since then */
+static void
+mongoc_stat_print_rates (mongoc_stat_t *stat,
+                         const mongoc_stat_sample_t *prev,
+                         const mongoc_stat_sample_t *cur,
+                         int64_t *buckets,
+                         int64_t interval_msec,
+                         FILE *file)
+{
+   mongoc_histogram_info_t *hinfo;
+   const int64_t *values;
+   const int64_t *prev_values;
+   int64_t total;
+   uint32_t i;
+
+   /* clear the terminal and home the cursor, like top */
+   fprintf (file, "\033[H\033[2J");
+   fprintf (file,
+            "mongoc-stat %u, every %.1f seconds\n\n",
+            stat->pid,
+            interval_msec / 1000.0);
+   fprintf (file,
+            "%24s : %-24s : %16s : %14s\n",
+            "Category",
+            "Name",
+            "Value",
+            "Per Second");
+
+   for (i = 0; i < stat->n_counters; i++) {
+      fprintf (
+         file,
+         "%24s : %-24s : %16lld : %14.1f\n",
+         stat->infos[i].category,
+         stat->infos[i].name,
+         (long long) cur->counters[i],
+         mongoc_stat_rate (prev, cur, prev->counters[i], cur->counters[i]));
+   }
+
+   fprintf (file, "\n");
+
+   for (i = 0; i < stat->n_histograms; i++) {
+      hinfo = &stat->histogram_infos[i];
+      total = mongoc_stat_histogram (stat, prev, cur, i, buckets);
+      fprintf (file,
+               "%24s : %-24s : %8.1f/s",
+               hinfo->category,
+               hinfo->name,
+               mongoc_stat_rate (prev, cur, 0, total));
+      if (total) {
+         fprintf (file,
+                  " p50=%lldus p99=%lldus p999=%lldus",
+                  (long long) mongoc_histogram_percentile (
+                     buckets, hinfo->n_buckets, total, 0.5),
+                  (long long) mongoc_histogram_percentile (
+                     buckets, hinfo->n_buckets, total, 0.99),
+                  (long long) mongoc_histogram_percentile (
+                     buckets, hinfo->n_buckets, total, 0.999));
+      }
+      fprintf (file, "\n");
+   }
+
+   fprintf (file, "\n");
+
+   for (i = 0; i < stat->n_servers; i++) {
+      if (!mongoc_stat_server_visible (cur, i)) {
+         continue;
+      }
+
+      values = &cur->servers[(size_t) i * SERVER_LAST];
+      prev_values = &prev->servers[(size_t) i * SERVER_LAST];
+      fprintf (
+         file,
+         "%s%s : ops=%.1f/s egress=%.0fB/s ingress=%.0fB/s errors=%.1f/s"
+         " timeouts=%.1f/s connections=%lld rtt=%lldms\n",
+         stat->server_infos[i].host_and_port,
+         cur->states[i] == SERVER_ACTIVE ? "" : " (retired)",
+         mongoc_stat_rate (
+            prev, cur, prev_values[SERVER_OPS], values[SERVER_OPS]),
+         mongoc_stat_rate (prev,
+                           cur,
+                           prev_values[SERVER_EGRESS_BYTES],
+                           values[SERVER_EGRESS_BYTES]),
+         mongoc_stat_rate (prev,
+                           cur,
+                           prev_values[SERVER_INGRESS_BYTES],
+                           values[SERVER_INGRESS_BYTES]),
+         mongoc_stat_rate (
+            prev, cur, prev_values[SERVER_ERRORS], values[SERVER_ERRORS]),
+         mongoc_stat_rate (
+            prev, cur, prev_values[SERVER_TIMEOUTS], values[SERVER_TIMEOUTS]),
+         (long long) values[SERVER_CONNECTIONS],
+         (long long) cur->rtts[i]);
+   }
+
+   fflush (file);
+}
+
+
+/* write @str as a JSON string or a Prometheus label value; both escape
+ * backslash, double quote, and newline the same way */
+static void
+mongoc_stat_print_quoted (const char *str, size_t max, FILE *file)
+{
+   size_t i;
+
+   fputc ('"', file);
+
+   for (i = 0; i < max && str[i]; i++) {
+      if (str[i] == '"' || str[i] == '\\') {
+         fputc ('\\', file);
+         fputc (str[i], file);
+      } else if (str[i] == '\n') {
+         fputs ("\\n", file);
+      } else if ((unsigned char) str[i] < 0x20) {
+         fprintf (file, "\\u%04x", (unsigned) str[i]);
+      } else {
+         fputc (str[i], file);
+      }
+   }
+
+   fputc ('"', file);
+}
+
+
+#define QUOTED(_field) mongoc_stat_print_quoted (_field, sizeof (_field), file)
+
+
+/* one JSON object per line, with rates if there was a previous sample */
+static void
+mongoc_stat_print_json (mongoc_stat_t *stat,
+                        const mongoc_stat_sample_t *prev,
+                        const mongoc_stat_sample_t *cur,
+                        int64_t *buckets,
+                        FILE *file)
+{
+   mongoc_histogram_info_t *hinfo;
+   const int64_t *values;
+   int64_t total;
+   bool first;
+   uint32_t i;
+   int k;
+
+   fprintf (file, "{\"pid\": %u, \"counters\": [", stat->pid);
+
+   for (i = 0; i < stat->n_counters; i++) {
+      fprintf (file, "%s{\"category\": ", i ? ", " : "");
+      QUOTED (stat->infos[i].category);
+      fprintf (file, ", \"name\": ");
+      QUOTED (stat->infos[i].name);
+      fprintf (file, ", \"value\": %lld", (long long) cur->counters[i]);
+      if (prev) {
+         fprintf (
+            file,
+            ", \"rate\": %.3f",
+            mongoc_stat_rate (prev, cur, prev->counters[i], cur->counters[i]));
+      }
+      fprintf (file, "}");
+   }
+
+   fprintf (file, "], \"histograms\": [");
+
+   for (i = 0; i < stat->n_histograms; i++) {
+      hinfo = &stat->histogram_infos[i];
+      total = mongoc_stat_histogram (stat, NULL, cur, i, buckets);
+      fprintf (file, "%s{\"category\": ", i ? ", " : "");
+      QUOTED (hinfo->category);
+      fprintf (file, ", \"name\": ");
+      QUOTED (hinfo->name);
+      fprintf (file, ", \"count\": %lld", (long long) total);
+      if (total) {
+         fprintf (file,
+                  ", \"p50\": %lld, \"p99\": %lld, \"p999\": %lld",
+                  (long long) mongoc_histogram_percentile (
+                     buckets, hinfo->n_buckets, total, 0.5),
+                  (long long) mongoc_histogram_percentile (
+                     buckets, hinfo->n_buckets, total, 0.99),
+                  (long long) mongoc_histogram_percentile (
+                     buckets, hinfo->n_buckets, total, 0.999));
+      }
+      fprintf (file, "}");
+   }
+
+   fprintf (file, "], \"servers\": [");
+
+   first = true;
+   for (i = 0; i < stat->n_servers; i++) {
+      if (!mongoc_stat_server_visible (cur, i)) {
+         continue;
+      }
+
+      values = &cur->servers[(size_t) i * SERVER_LAST];
+      fprintf (file, "%s{\"host\": ", first ? "" : ", ");
+      QUOTED (stat->server_infos[i].host_and_port);
+      fprintf (file,
+               ", \"retired\": %s",
+               cur->states[i] == SERVER_ACTIVE ? "false" : "true");
+      for (k = 0; k < SERVER_LAST; k++) {
+         fprintf (
+            file, ", \"%s\": %lld", gServerFields[k], (long long) values[k]);
+      }
+      fprintf (file,
+               ", \"round_trip_time_msec\": %lld",
+               (long long) cur->rtts[i]);
+      if (prev) {
+         for (k = 0; k < SERVER_CONNECTIONS; k++) {
+            fprintf (file,
+                     ", \"%s_rate\": %.3f",
+                     gServerFields[k],
+                     mongoc_stat_rate (
+                        prev,
+                        cur,
+                        prev->servers[(size_t) i * SERVER_LAST + k],
+                        values[k]));
+         }
+      }
+      fprintf (file, "}");
+      first = false;
+   }
+
+   fprintf (file, "]}\n");
+   fflush (file);
+}
+
+
+/* the Prometheus text exposition format, version 0.0.4 */
+static void
+mongoc_stat_print_prometheus (mongoc_stat_t *stat,
+                              const mongoc_stat_sample_t *cur,
+                              int64_t *buckets,
+                              FILE *file)
+{
+   static const double quantiles[] = {0.5, 0.99, 0.999};
+   static const char *server_types[SERVER_LAST] = {
+      "counter", "counter", "counter", "counter", "counter", "gauge"};
+   mongoc_histogram_info_t *hinfo;
+   int64_t total;
+   uint32_t i;
+   int k;
+   int q;
 
    fprintf (file,
-            "%24s : %-24s : %-50s : %lld\n",
-            info->category,
-            info->name,
-            info->description,
-            (long long) value);
+            "# HELP mongoc_counter MongoDB C Driver performance counter.\n"
+            "# TYPE mongoc_counter untyped\n");
+   for (i = 0; i < stat->n_counters; i++) {
+      fprintf (file, "mongoc_counter{pid=\"%u\",category=", stat->pid);
+      QUOTED (stat->infos[i].category);
+      fprintf (file, ",name=");
+      QUOTED (stat->infos[i].name);
+      fprintf (file, "} %lld\n", (long long) cur->counters[i]);
+   }
+
+   if (stat->n_histograms) {
+      fprintf (file,
+               "# HELP mongoc_latency_microseconds MongoDB C Driver latency,"
+               " rounded up to its histogram bucket.\n"
+               "# TYPE mongoc_latency_microseconds summary\n");
+   }
+   for (i = 0; i < stat->n_histograms; i++) {
+      hinfo = &stat->histogram_infos[i];
+      total = mongoc_stat_histogram (stat, NULL, cur, i, buckets);
+      for (q = 0; total && q < 3; q++) {
+         fprintf (
+            file, "mongoc_latency_microseconds{pid=\"%u\",category=", stat->pid);
+         QUOTED (hinfo->category);
+         fprintf (file, ",name=");
+         QUOTED (hinfo->name);
+         fprintf (file,
+                  ",quantile=\"%g\"} %lld\n",
+                  quantiles[q],
+                  (long long) mongoc_histogram_percentile (
+                     buckets, hinfo->n_buckets, total, quantiles[q]));
+      }
+      fprintf (
+         file, "mongoc_latency_microseconds_count{pid=\"%u\",category=", stat->pid);
+      QUOTED (hinfo->category);
+      fprintf (file, ",name=");
+      QUOTED (hinfo->name);
+      fprintf (file, "} %lld\n", (long long) total);
+   }
+
+   for (k = 0; stat->n_servers && k < SERVER_LAST; k++) {
+      fprintf (file,
+               "# TYPE mongoc_server_%s%s %s\n",
+               gServerFields[k],
+               k == SERVER_CONNECTIONS ? "" : "_total",
+               server_types[k]);
+      for (i = 0; i < stat->n_servers; i++) {
+         if (!mongoc_stat_server_visible (cur, i)) {
+            continue;
+         }
+
+         fprintf (file,
+                  "mongoc_server_%s%s{pid=\"%u\",host=",
+                  gServerFields[k],
+                  k == SERVER_CONNECTIONS ? "" : "_total",
+                  stat->pid);
+         QUOTED (stat->server_infos[i].host_and_port);
+         fprintf (file,
+                  ",state=\"%s\"} %lld\n",
+                  cur->states[i] == SERVER_ACTIVE ? "active" : "retired",
+                  (long long) cur->servers[(size_t) i * SERVER_LAST + k]);
+      }
+   }
+
+   if (stat->n_servers) {
+      fprintf (file, "# TYPE mongoc_server_round_trip_time_milliseconds gauge\n");
+   }
+   for (i = 0; i < stat->n_servers; i++) {
+      if (!mongoc_stat_server_visible (cur, i) || cur->rtts[i] < 0) {
+         continue;
+      }
+
+      fprintf (file,
+               "mongoc_server_round_trip_time_milliseconds{pid=\"%u\",host=",
+               stat->pid);
+      QUOTED (stat->server_infos[i].host_and_port);
+      fprintf (file,
+               ",state=\"%s\"} %lld\n",
+               cur->states[i] == SERVER_ACTIVE ? "active" : "retired",
+               (long long) cur->rtts[i]);
+   }
+
+   fflush (file);
+}
+
+
+#undef QUOTED
+
+
+static void
+usage (const char *prog)
+{
+   fprintf (stderr,
+            "usage: %s [-i SECONDS] [-n COUNT] [-f text|json|prometheus] PID\n"
+            "\n"
+            "  -i SECONDS  Sample every SECONDS and show rates.\n"
+            "  -n COUNT    Stop after COUNT samples, default 1, or unlimited"
+            " with -i.\n"
+            "  -f FORMAT   Output text, one JSON object per sample, or the"
+            " Prometheus\n"
+            "              text exposition format.\n",
+            prog);
 }
 
 
 int
 main (int argc, char *argv[])
 {
-   mongoc_counter_info_t *infos;
+   mongoc_stat_format_t format = MONGOC_STAT_TEXT;
+   mongoc_stat_sample_t samples[2];
+   mongoc_stat_sample_t *prev = NULL;
+   mongoc_stat_sample_t *cur;
    mongoc_counters_t *counters;
-   uint32_t n_counters = 0;
-   unsigned i;
+   mongoc_stat_t stat;
+   struct timespec ts;
+   int64_t interval_msec = 0;
+   int64_t *buckets;
+   long count = -1;
+   long n;
+   int ret = EXIT_SUCCESS;
+   int opt;
    int pid;
 
-   if (argc != 2) {
-      fprintf (stderr, "usage: %s PID\n", argv[0]);
-      return 1;
+   while ((opt = getopt (argc, argv, "i:n:f:h")) != -1) {
+      switch (opt) {
+      case 'i':
+         interval_msec = (int64_t) (strtod (optarg, NULL) * 1000);
+         if (interval_msec <= 0) {
+            usage (argv[0]);
+            return EXIT_FAILURE;
+         }
+         break;
+      case 'n':
+         count = strtol (optarg, NULL, 10);
+         if (count <= 0) {
+            usage (argv[0]);
+            return EXIT_FAILURE;
+         }
+         break;
+      case 'f':
+         if (!strcmp (optarg, "text")) {
+            format = MONGOC_STAT_TEXT;
+         } else if (!strcmp (optarg, "json")) {
+            format = MONGOC_STAT_JSON;
+         } else if (!strcmp (optarg, "prometheus")) {
+            format = MONGOC_STAT_PROMETHEUS;
+         } else {
+            usage (argv[0]);
+            return EXIT_FAILURE;
+         }
+         break;
+      case 'h':
+      default:
+         usage (argv[0]);
+         return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+   }
+
+   if (optind != argc - 1) {
+      usage (argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if (count == -1) {
+      count = interval_msec ? 0 : 1;
    }
 
-   pid = strtol (argv[1], NULL, 10);
+   pid = strtol (argv[optind], NULL, 10);
    if (!(counters = mongoc_counters_new_from_pid (pid))) {
       fprintf (stderr, "Failed to load shared memory for pid %u.\n", pid);
       return EXIT_FAILURE;
    }
 
-   infos = mongoc_counters_get_infos (counters, &n_counters);
-   for (i = 0; i < n_counters; i++) {
-      mongoc_counters_print_info (counters, &infos[i], stdout);
+   mongoc_stat_init (&stat, counters, (unsigned) pid);
+   buckets = (int64_t *) calloc (stat.max_buckets + 1, sizeof *buckets);
+   if (!buckets || !mongoc_stat_sample_init (&stat, &samples[0]) ||
+       !mongoc_stat_sample_init (&stat, &samples[1])) {
+      fprintf (stderr, "Out of memory.\n");
+      return EXIT_FAILURE;
+   }
+
+   for (n = 0; !count || n < count; n++) {
+      cur = &samples[n % 2];
+      mongoc_stat_sample_read (&stat, cur);
+
+      switch (format) {
+      case MONGOC_STAT_JSON:
+         mongoc_stat_print_json (&stat, prev, cur, buckets, stdout);
+         break;
+      case MONGOC_STAT_PROMETHEUS:
+         if (n) {
+            /* separate the expositions */
+            fprintf (stdout, "\n");
+         }
+         mongoc_stat_print_prometheus (&stat, cur, buckets, stdout);
+         break;
+      case MONGOC_STAT_TEXT:
+      default:
+         if (prev) {
+            mongoc_stat_print_rates (
+               &stat, prev, cur, buckets, interval_msec, stdout);
+         } else if (!interval_msec) {
+            mongoc_stat_print_text (&stat, cur, buckets, stdout);
+         }
+         break;
+      }
+
+      prev = cur;
+
+      if (interval_msec && (!count || n + 1 < count)) {
+         ts.tv_sec = (time_t) (interval_msec / 1000);
+         ts.tv_nsec = (long) (interval_msec % 1000) * 1000000;
+         while (nanosleep (&ts, &ts) == -1 && errno == EINTR) {
+         }
+      }
    }
 
+   mongoc_stat_sample_destroy (&samples[0]);
+   mongoc_stat_sample_destroy (&samples[1]);
+   free (buckets);
    mongoc_counters_destroy (counters);
 
-   return EXIT_SUCCESS;
+   return ret;
 }
 
 #else
@@ -1052,6 +1052,19 @@ test_suite_valgrind (void)
 }
 
 
+int
+test_suite_mock_server_log_enabled (void)
+{
+   int ret;
+
+   mongoc_mutex_lock (&gTestMutex);
+   ret = gTestSuite->mock_server_log || gTestSuite->mock_server_log_buf;
+   mongoc_mutex_unlock (&gTestMutex);
+
+   return ret;
+}
+
+
 void
 test_suite_mock_server_log (const char *msg, ...)
 {
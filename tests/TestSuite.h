@@ -517,6 +517,8 @@ int
 test_suite_valgrind (void);
 void
 test_suite_mock_server_log (const char *msg, ...);
+int
+test_suite_mock_server_log_enabled (void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,894 @@
+/*
+ * Copyright 2017 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * mongoc-perf: the standard cross-driver benchmark workloads, run against
+ * a live deployment:
+ *
+ *   mongoc-perf [-t SECONDS] [-j THREADS] URI [FILTER...]
+ *
+ * single_doc/   find 10,000 small documents by _id, insert 10,000 small
+ *               documents or 10 large ones, one at a time
+ * multi_doc/    find 10,000 small documents with one cursor, bulk insert
+ *               10,000 small documents or 10 large ones, upload and
+ *               download a 50 MB GridFS file
+ * parallel/     import and export 100 files of 5,000 documents as line
+ *               delimited JSON, from THREADS threads sharing a client pool
+ *
+ * Documents are generated, not read from the benchmark's data files, so
+ * their sizes are close to but not exactly the published ones.
+ *
+ * Each task repeats until it has taken SECONDS (default 10) and run at
+ * least 3 times, or has run 100 times. The median iteration is reported in
+ * MB/s and documents/s, as one JSON document like mongoc-bench's. Choose
+ * compressors, TLS, and the pool size with URI options.
+ *
+ * The workloads use the database "perftest", and drop it when they finish.
+ * Files are written to the current directory and removed afterward.
+ */
+
+
+#include <mongoc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoc-thread-private.h"
+
+
+#define PERF_DB "perftest"
+#define PERF_COLL "corpus"
+#define PERF_SMALL_DOCS 10000
+#define PERF_LARGE_DOCS 10
+#define PERF_GRIDFS_SIZE (50 * 1000 * 1000)
+#define PERF_LDJSON_FILES 100
+#define PERF_LDJSON_DOCS 5000
+#define PERF_MIN_ITERATIONS 3
+#define PERF_MAX_ITERATIONS 100
+
+
+typedef struct _perf_task_t perf_task_t;
+typedef void (*perf_func_t) (perf_task_t *task);
+
+
+struct _perf_task_t {
+   const char *name;
+   perf_func_t before; /* once, untimed; sets ops and bytes */
+   perf_func_t setup;  /* before each iteration, untimed */
+   perf_func_t run;
+   int64_t ops;   /* documents per iteration */
+   int64_t bytes; /* per iteration */
+};
+
+
+static int64_t gMinUsec = 10 * 1000 * 1000;
+static int gThreads = 8;
+static char **gFilters;
+static int gNumFilters;
+static bson_t gResults;
+static uint32_t gNumResults;
+
+static mongoc_client_pool_t *gPool;
+static mongoc_client_t *gClient;
+static mongoc_collection_t *gCollection;
+static bson_t gSmallDoc;
+static bson_t gLargeDoc;
+static uint8_t *gGridFSData;
+static volatile int32_t gNextFile;
+
+
+static bool
+perf_wanted (const char *name)
+{
+   int i;
+
+   if (!gNumFilters) {
+      return true;
+   }
+
+   for (i = 0; i < gNumFilters; i++) {
+      if (strstr (name, gFilters[i])) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+static void
+perf_check (bool r, const bson_error_t *error)
+{
+   if (!r) {
+      fprintf (stderr, "mongoc-perf: %s\n", error->message);
+      exit (EXIT_FAILURE);
+   }
+}
+
+
+static void
+perf_drop (void)
+{
+   bson_error_t error;
+
+   /* fails if the collection doesn't exist */
+   mongoc_collection_drop (gCollection, &error);
+}
+
+
+static void
+perf_file_name (char *buf, size_t len, const char *kind, int i)
+{
+   bson_snprintf (buf, len, "mongoc-perf-%s-%03d.json", kind, i);
+}
+
+
+/*
+ * documents
+ */
+
+/* about 300 bytes, like the benchmark's tweet */
+static void
+perf_make_small_doc (bson_t *doc)
+{
+   bson_t user;
+   bson_t tags;
+
+   bson_init (doc);
+   BSON_APPEND_UTF8 (doc, "created_at", "Thu Jun 13 17:32:00 +0000 2017");
+   BSON_APPEND_INT64 (doc, "id", 875015124);
+   BSON_APPEND_UTF8 (doc,
+                     "text",
+                     "Lorem ipsum dolor sit amet, consectetur adipiscing "
+                     "elit, sed do eiusmod tempor incididunt ut labore et "
+                     "dolore magna aliqua. Ut enim ad minim veniam");
+   BSON_APPEND_DOCUMENT_BEGIN (doc, "user", &user);
+   BSON_APPEND_INT64 (&user, "id", 2875715311);
+   BSON_APPEND_UTF8 (&user, "name", "benchmark user");
+   BSON_APPEND_UTF8 (&user, "screen_name", "mongoc_perf");
+   BSON_APPEND_INT32 (&user, "followers_count", 1024);
+   BSON_APPEND_BOOL (&user, "verified", false);
+   bson_append_document_end (doc, &user);
+   BSON_APPEND_ARRAY_BEGIN (doc, "hashtags", &tags);
+   BSON_APPEND_UTF8 (&tags, "0", "mongodb");
+   BSON_APPEND_UTF8 (&tags, "1", "benchmark");
+   bson_append_array_end (doc, &tags);
+   BSON_APPEND_INT32 (doc, "retweet_count", 7);
+   BSON_APPEND_UTF8 (doc, "lang", "en");
+}
+
+
+/* about 2.7 MB, like the benchmark's large document */
+static void
+perf_make_large_doc (bson_t *doc)
+{
+   bson_t items;
+   bson_t item;
+   char key[16];
+   const char *k;
+   uint32_t i;
+
+   bson_init (doc);
+   BSON_APPEND_ARRAY_BEGIN (doc, "items", &items);
+   for (i = 0; i < 27000; i++) {
+      bson_uint32_to_string (i, &k, key, sizeof key);
+      BSON_APPEND_DOCUMENT_BEGIN (&items, k, &item);
+      BSON_APPEND_INT32 (&item, "n", (int32_t) i);
+      BSON_APPEND_DOUBLE (&item, "x", i * 0.5);
+      BSON_APPEND_UTF8 (&item, "s", "sed ut perspiciatis unde omnis iste");
+      bson_append_document_end (&items, &item);
+   }
+   bson_append_array_end (doc, &items);
+}
+
+
+/* insert the small document with _ids 0 through @n - 1 */
+static void
+perf_load_small_docs (int n)
+{
+   mongoc_bulk_operation_t *bulk;
+   bson_error_t error;
+   bson_t doc;
+   int i;
+
+   perf_drop ();
+   bulk = mongoc_collection_create_bulk_operation (gCollection, false, NULL);
+   for (i = 0; i < n; i++) {
+      bson_init (&doc);
+      BSON_APPEND_INT32 (&doc, "_id", i);
+      bson_concat (&doc, &gSmallDoc);
+      mongoc_bulk_operation_insert (bulk, &doc);
+      bson_destroy (&doc);
+   }
+
+   perf_check (mongoc_bulk_operation_execute (bulk, NULL, &error) != 0,
+               &error);
+   mongoc_bulk_operation_destroy (bulk);
+}
+
+
+/*
+ * single-document tasks
+ */
+
+static void
+perf_find_one_by_id_before (perf_task_t *task)
+{
+   task->ops = PERF_SMALL_DOCS;
+   task->bytes = PERF_SMALL_DOCS * (int64_t) gSmallDoc.len;
+   perf_load_small_docs (PERF_SMALL_DOCS);
+}
+
+
+static void
+perf_find_one_by_id (perf_task_t *task)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t filter;
+   bson_t opts = BSON_INITIALIZER;
+   int i;
+
+   BSON_APPEND_INT32 (&opts, "limit", 1);
+
+   for (i = 0; i < PERF_SMALL_DOCS; i++) {
+      bson_init (&filter);
+      BSON_APPEND_INT32 (&filter, "_id", i);
+      cursor =
+         mongoc_collection_find_with_opts (gCollection, &filter, &opts, NULL);
+      if (!mongoc_cursor_next (cursor, &doc)) {
+         perf_check (!mongoc_cursor_error (cursor, &error), &error);
+         fprintf (stderr, "mongoc-perf: document %d not found\n", i);
+         exit (EXIT_FAILURE);
+      }
+
+      mongoc_cursor_destroy (cursor);
+      bson_destroy (&filter);
+   }
+
+   bson_destroy (&opts);
+}
+
+
+static void
+perf_small_before (perf_task_t *task)
+{
+   task->ops = PERF_SMALL_DOCS;
+   task->bytes = PERF_SMALL_DOCS * (int64_t) gSmallDoc.len;
+}
+
+
+static void
+perf_large_before (perf_task_t *task)
+{
+   task->ops = PERF_LARGE_DOCS;
+   task->bytes = PERF_LARGE_DOCS * (int64_t) gLargeDoc.len;
+}
+
+
+static void
+perf_insert_one (const bson_t *doc, int n)
+{
+   bson_error_t error;
+   int i;
+
+   for (i = 0; i < n; i++) {
+      perf_check (mongoc_collection_insert (
+                     gCollection, MONGOC_INSERT_NONE, doc, NULL, &error),
+                  &error);
+   }
+}
+
+
+static void
+perf_small_insert (perf_task_t *task)
+{
+   perf_insert_one (&gSmallDoc, PERF_SMALL_DOCS);
+}
+
+
+static void
+perf_large_insert (perf_task_t *task)
+{
+   perf_insert_one (&gLargeDoc, PERF_LARGE_DOCS);
+}
+
+
+/*
+ * multi-document tasks
+ */
+
+static void
+perf_find_many (perf_task_t *task)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t filter = BSON_INITIALIZER;
+   int n = 0;
+
+   cursor = mongoc_collection_find_with_opts (gCollection, &filter, NULL, NULL);
+   while (mongoc_cursor_next (cursor, &doc)) {
+      n++;
+   }
+
+   perf_check (!mongoc_cursor_error (cursor, &error), &error);
+   if (n != PERF_SMALL_DOCS) {
+      fprintf (stderr, "mongoc-perf: found %d documents\n", n);
+      exit (EXIT_FAILURE);
+   }
+
+   mongoc_cursor_destroy (cursor);
+}
+
+
+static void
+perf_bulk_insert (const bson_t *doc, int n)
+{
+   mongoc_bulk_operation_t *bulk;
+   bson_error_t error;
+   int i;
+
+   bulk = mongoc_collection_create_bulk_operation (gCollection, true, NULL);
+   for (i = 0; i < n; i++) {
+      mongoc_bulk_operation_insert (bulk, doc);
+   }
+
+   perf_check (mongoc_bulk_operation_execute (bulk, NULL, &error) != 0,
+               &error);
+   mongoc_bulk_operation_destroy (bulk);
+}
+
+
+static void
+perf_small_bulk_insert (perf_task_t *task)
+{
+   perf_bulk_insert (&gSmallDoc, PERF_SMALL_DOCS);
+}
+
+
+static void
+perf_large_bulk_insert (perf_task_t *task)
+{
+   perf_bulk_insert (&gLargeDoc, PERF_LARGE_DOCS);
+}
+
+
+static mongoc_gridfs_t *
+perf_gridfs (void)
+{
+   mongoc_gridfs_t *gridfs;
+   bson_error_t error;
+
+   gridfs = mongoc_client_get_gridfs (gClient, PERF_DB, NULL, &error);
+   perf_check (gridfs != NULL, &error);
+
+   return gridfs;
+}
+
+
+static void
+perf_gridfs_upload_file (void)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_file_opt_t opt = {0};
+   mongoc_iovec_t iov;
+   bson_error_t error;
+
+   gridfs = perf_gridfs ();
+   opt.filename = "perf";
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+
+   iov.iov_base = (void *) gGridFSData;
+   iov.iov_len = PERF_GRIDFS_SIZE;
+   if (mongoc_gridfs_file_writev (file, &iov, 1, 0) != PERF_GRIDFS_SIZE ||
+       !mongoc_gridfs_file_save (file)) {
+      mongoc_gridfs_file_error (file, &error);
+      perf_check (false, &error);
+   }
+
+   mongoc_gridfs_file_destroy (file);
+   mongoc_gridfs_destroy (gridfs);
+}
+
+
+static void
+perf_gridfs_before (perf_task_t *task)
+{
+   task->ops = 1;
+   task->bytes = PERF_GRIDFS_SIZE;
+}
+
+
+static void
+perf_gridfs_drop (perf_task_t *task)
+{
+   mongoc_gridfs_t *gridfs;
+   bson_error_t error;
+
+   gridfs = perf_gridfs ();
+   /* fails if the bucket doesn't exist */
+   mongoc_gridfs_drop (gridfs, &error);
+   mongoc_gridfs_destroy (gridfs);
+}
+
+
+static void
+perf_gridfs_upload (perf_task_t *task)
+{
+   perf_gridfs_upload_file ();
+}
+
+
+static void
+perf_gridfs_download_before (perf_task_t *task)
+{
+   perf_gridfs_before (task);
+   perf_gridfs_drop (task);
+   perf_gridfs_upload_file ();
+}
+
+
+static void
+perf_gridfs_download (perf_task_t *task)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_stream_t *stream;
+   bson_error_t error;
+   uint8_t *buf;
+   size_t total = 0;
+   ssize_t r;
+
+   gridfs = perf_gridfs ();
+   file = mongoc_gridfs_find_one_by_filename (gridfs, "perf", &error);
+   perf_check (file != NULL, &error);
+
+   buf = (uint8_t *) bson_malloc (PERF_GRIDFS_SIZE);
+   stream = mongoc_stream_gridfs_new (file);
+   while (total < PERF_GRIDFS_SIZE) {
+      r = mongoc_stream_read (
+         stream, buf + total, PERF_GRIDFS_SIZE - total, 1, -1);
+      if (r <= 0) {
+         mongoc_gridfs_file_error (file, &error);
+         perf_check (false, &error);
+      }
+
+      total += (size_t) r;
+   }
+
+   bson_free (buf);
+   mongoc_stream_destroy (stream);
+   mongoc_gridfs_file_destroy (file);
+   mongoc_gridfs_destroy (gridfs);
+}
+
+
+/*
+ * parallel tasks: each thread takes the next file until none are left
+ */
+
+static int
+perf_next_file (void)
+{
+   return bson_atomic_int_add (&gNextFile, 1) - 1;
+}
+
+
+static void *
+perf_import_thread (void *data)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_bulk_operation_t *bulk;
+   bson_error_t error;
+   bson_t doc;
+   char path[64];
+   char line[4096];
+   FILE *f;
+   int i;
+
+   client = mongoc_client_pool_pop (gPool);
+   collection = mongoc_client_get_collection (client, PERF_DB, PERF_COLL);
+
+   while ((i = perf_next_file ()) < PERF_LDJSON_FILES) {
+      perf_file_name (path, sizeof path, "import", i);
+      if (!(f = fopen (path, "r"))) {
+         perror (path);
+         exit (EXIT_FAILURE);
+      }
+
+      bulk = mongoc_collection_create_bulk_operation (collection, false, NULL);
+      while (fgets (line, sizeof line, f)) {
+         perf_check (bson_init_from_json (&doc, line, -1, &error), &error);
+         mongoc_bulk_operation_insert (bulk, &doc);
+         bson_destroy (&doc);
+      }
+
+      fclose (f);
+      perf_check (mongoc_bulk_operation_execute (bulk, NULL, &error) != 0,
+                  &error);
+      mongoc_bulk_operation_destroy (bulk);
+   }
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (gPool, client);
+
+   return NULL;
+}
+
+
+static void *
+perf_export_thread (void *data)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t filter;
+   bson_t range;
+   char path[64];
+   char *json;
+   FILE *f;
+   int i;
+
+   client = mongoc_client_pool_pop (gPool);
+   collection = mongoc_client_get_collection (client, PERF_DB, PERF_COLL);
+
+   while ((i = perf_next_file ()) < PERF_LDJSON_FILES) {
+      perf_file_name (path, sizeof path, "export", i);
+      if (!(f = fopen (path, "w"))) {
+         perror (path);
+         exit (EXIT_FAILURE);
+      }
+
+      /* the imported documents' _ids number them file by file */
+      bson_init (&filter);
+      BSON_APPEND_DOCUMENT_BEGIN (&filter, "_id", &range);
+      BSON_APPEND_INT32 (&range, "$gte", i * PERF_LDJSON_DOCS);
+      BSON_APPEND_INT32 (&range, "$lt", (i + 1) * PERF_LDJSON_DOCS);
+      bson_append_document_end (&filter, &range);
+
+      cursor =
+         mongoc_collection_find_with_opts (collection, &filter, NULL, NULL);
+      while (mongoc_cursor_next (cursor, &doc)) {
+         json = bson_as_json (doc, NULL);
+         fprintf (f, "%s\n", json);
+         bson_free (json);
+      }
+
+      perf_check (!mongoc_cursor_error (cursor, &error), &error);
+      mongoc_cursor_destroy (cursor);
+      bson_destroy (&filter);
+      fclose (f);
+   }
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (gPool, client);
+
+   return NULL;
+}
+
+
+static void
+perf_run_threads (void *(*func) (void *))
+{
+   mongoc_thread_t *threads;
+   int i;
+
+   gNextFile = 0;
+   threads = (mongoc_thread_t *) bson_malloc0 (gThreads * sizeof *threads);
+
+   for (i = 0; i < gThreads; i++) {
+      mongoc_thread_create (&threads[i], func, NULL);
+   }
+
+   for (i = 0; i < gThreads; i++) {
+      mongoc_thread_join (threads[i]);
+   }
+
+   bson_free (threads);
+}
+
+
+static void
+perf_ldjson_before (perf_task_t *task)
+{
+   char path[64];
+   bson_t doc;
+   char *json;
+   FILE *f;
+   int i;
+   int j;
+
+   task->ops = PERF_LDJSON_FILES * PERF_LDJSON_DOCS;
+   task->bytes = 0;
+
+   for (i = 0; i < PERF_LDJSON_FILES; i++) {
+      perf_file_name (path, sizeof path, "import", i);
+      if (!(f = fopen (path, "w"))) {
+         perror (path);
+         exit (EXIT_FAILURE);
+      }
+
+      for (j = 0; j < PERF_LDJSON_DOCS; j++) {
+         bson_init (&doc);
+         BSON_APPEND_INT32 (&doc, "_id", i * PERF_LDJSON_DOCS + j);
+         bson_concat (&doc, &gSmallDoc);
+         task->bytes += doc.len;
+         json = bson_as_json (&doc, NULL);
+         fprintf (f, "%s\n", json);
+         bson_free (json);
+         bson_destroy (&doc);
+      }
+
+      fclose (f);
+   }
+}
+
+
+static void
+perf_ldjson_import (perf_task_t *task)
+{
+   perf_run_threads (perf_import_thread);
+}
+
+
+static void
+perf_ldjson_export_before (perf_task_t *task)
+{
+   perf_ldjson_before (task);
+   perf_drop ();
+   perf_ldjson_import (task);
+}
+
+
+static void
+perf_ldjson_export (perf_task_t *task)
+{
+   perf_run_threads (perf_export_thread);
+}
+
+
+static void
+perf_drop_setup (perf_task_t *task)
+{
+   perf_drop ();
+}
+
+
+static perf_task_t gTasks[] = {
+   {"single_doc/find_one_by_id",
+    perf_find_one_by_id_before,
+    NULL,
+    perf_find_one_by_id},
+   {"single_doc/small_insert",
+    perf_small_before,
+    perf_drop_setup,
+    perf_small_insert},
+   {"single_doc/large_insert",
+    perf_large_before,
+    perf_drop_setup,
+    perf_large_insert},
+   {"multi_doc/find_many", perf_find_one_by_id_before, NULL, perf_find_many},
+   {"multi_doc/small_bulk_insert",
+    perf_small_before,
+    perf_drop_setup,
+    perf_small_bulk_insert},
+   {"multi_doc/large_bulk_insert",
+    perf_large_before,
+    perf_drop_setup,
+    perf_large_bulk_insert},
+   {"multi_doc/gridfs_upload",
+    perf_gridfs_before,
+    perf_gridfs_drop,
+    perf_gridfs_upload},
+   {"multi_doc/gridfs_download",
+    perf_gridfs_download_before,
+    NULL,
+    perf_gridfs_download},
+   {"parallel/ldjson_import",
+    perf_ldjson_before,
+    perf_drop_setup,
+    perf_ldjson_import},
+   {"parallel/ldjson_export",
+    perf_ldjson_export_before,
+    NULL,
+    perf_ldjson_export},
+};
+
+
+static int
+perf_cmp_usec (const void *a, const void *b)
+{
+   int64_t x = *(const int64_t *) a;
+   int64_t y = *(const int64_t *) b;
+
+   return x < y ? -1 : x > y;
+}
+
+
+static void
+perf_report (perf_task_t *task, int64_t *usecs, int iterations)
+{
+   bson_t result;
+   char key[16];
+   const char *k;
+   double median;
+
+   qsort (usecs, (size_t) iterations, sizeof *usecs, perf_cmp_usec);
+   median = (double) usecs[iterations / 2] / (1000.0 * 1000.0);
+
+   bson_uint32_to_string (gNumResults++, &k, key, sizeof key);
+   bson_append_document_begin (&gResults, k, -1, &result);
+   BSON_APPEND_UTF8 (&result, "name", task->name);
+   BSON_APPEND_INT32 (&result, "iterations", iterations);
+   BSON_APPEND_DOUBLE (&result, "medianSeconds", median);
+   BSON_APPEND_DOUBLE (
+      &result, "megabytesPerSec", (double) task->bytes / median / 1e6);
+   BSON_APPEND_DOUBLE (&result, "opsPerSec", (double) task->ops / median);
+   bson_append_document_end (&gResults, &result);
+
+   fprintf (stderr,
+            "%-32s %10.2f MB/s %12.1f docs/s\n",
+            task->name,
+            (double) task->bytes / median / 1e6,
+            (double) task->ops / median);
+}
+
+
+static void
+perf_run (perf_task_t *task)
+{
+   int64_t usecs[PERF_MAX_ITERATIONS];
+   int64_t total = 0;
+   int64_t start;
+   int i;
+
+   if (!perf_wanted (task->name)) {
+      return;
+   }
+
+   task->before (task);
+
+   for (i = 0; i < PERF_MAX_ITERATIONS; i++) {
+      if (total >= gMinUsec && i >= PERF_MIN_ITERATIONS) {
+         break;
+      }
+
+      if (task->setup) {
+         task->setup (task);
+      }
+
+      start = bson_get_monotonic_time ();
+      task->run (task);
+      usecs[i] = bson_get_monotonic_time () - start;
+      total += usecs[i];
+   }
+
+   perf_report (task, usecs, i);
+}
+
+
+static void
+perf_remove_files (void)
+{
+   char path[64];
+   int i;
+
+   for (i = 0; i < PERF_LDJSON_FILES; i++) {
+      perf_file_name (path, sizeof path, "import", i);
+      remove (path);
+      perf_file_name (path, sizeof path, "export", i);
+      remove (path);
+   }
+}
+
+
+static void
+usage (void)
+{
+   fprintf (stderr,
+            "usage: mongoc-perf [-t SECONDS] [-j THREADS] URI [FILTER...]\n");
+   exit (EXIT_FAILURE);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+   mongoc_uri_t *uri;
+   mongoc_database_t *db;
+   bson_error_t error;
+   bson_t out;
+   char *json;
+   size_t j;
+   int i;
+
+   for (i = 1; i < argc; i++) {
+      if (!strcmp (argv[i], "-t") && i + 1 < argc) {
+         gMinUsec = (int64_t) (atof (argv[++i]) * 1000 * 1000);
+      } else if (!strcmp (argv[i], "-j") && i + 1 < argc) {
+         gThreads = atoi (argv[++i]);
+      } else if (argv[i][0] == '-') {
+         usage ();
+      } else {
+         break;
+      }
+   }
+
+   if (gMinUsec <= 0 || gThreads <= 0 || i == argc) {
+      usage ();
+   }
+
+   mongoc_init ();
+
+   uri = mongoc_uri_new_with_error (argv[i], &error);
+   perf_check (uri != NULL, &error);
+
+   gFilters = &argv[i + 1];
+   gNumFilters = argc - i - 1;
+
+   gPool = mongoc_client_pool_new (uri);
+   mongoc_client_pool_set_error_api (gPool, MONGOC_ERROR_API_VERSION_2);
+   gClient = mongoc_client_pool_pop (gPool);
+   gCollection = mongoc_client_get_collection (gClient, PERF_DB, PERF_COLL);
+
+   perf_make_small_doc (&gSmallDoc);
+   perf_make_large_doc (&gLargeDoc);
+   gGridFSData = (uint8_t *) bson_malloc (PERF_GRIDFS_SIZE);
+   for (j = 0; j < PERF_GRIDFS_SIZE; j++) {
+      gGridFSData[j] = (uint8_t) (j * 31 + (j >> 13));
+   }
+
+   bson_init (&gResults);
+
+   for (j = 0; j < sizeof gTasks / sizeof gTasks[0]; j++) {
+      perf_run (&gTasks[j]);
+   }
+
+   db = mongoc_client_get_database (gClient, PERF_DB);
+   perf_check (mongoc_database_drop (db, &error), &error);
+   perf_remove_files ();
+
+   bson_init (&out);
+   BSON_APPEND_UTF8 (&out, "version", MONGOC_VERSION_S);
+   BSON_APPEND_INT32 (&out, "threads", gThreads);
+   BSON_APPEND_DOCUMENT (&out, "uriOptions", mongoc_uri_get_options (uri));
+   BSON_APPEND_ARRAY (&out, "results", &gResults);
+   json = bson_as_json (&out, NULL);
+   printf ("%s\n", json);
+
+   bson_free (json);
+   bson_destroy (&out);
+   bson_destroy (&gResults);
+   bson_free (gGridFSData);
+   bson_destroy (&gLargeDoc);
+   bson_destroy (&gSmallDoc);
+   mongoc_database_destroy (db);
+   mongoc_collection_destroy (gCollection);
+   mongoc_client_pool_push (gPool, gClient);
+   mongoc_client_pool_destroy (gPool);
+   mongoc_uri_destroy (uri);
+
+   mongoc_cleanup ();
+
+   return EXIT_SUCCESS;
+}
@@ -388,6 +388,8 @@ test_server_selection_logic_cb (bson_t *test)
          bson_init (&sd->tags);
       }
 
+      _mongoc_compiled_tag_set_compile (&sd->compiled_tags, &sd->tags);
+
       /* add new server to our topology description */
       mongoc_set_add (topology.servers, sd->id, sd);
    }
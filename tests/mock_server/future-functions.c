@@ -96,6 +96,31 @@ background_mongoc_client_read_command_with_opts (void *data)
    return NULL;
 }
 
+static void *
+background_mongoc_client_read_commands_pipelined (void *data)
+{
+   future_t *future = (future_t *) data;
+   future_value_t return_value;
+
+   return_value.type = future_value_bool_type;
+
+   future_value_set_bool (
+      &return_value,
+      mongoc_client_read_commands_pipelined (
+         future_value_get_mongoc_client_ptr (future_get_param (future, 0)),
+         future_value_get_const_char_ptr (future_get_param (future, 1)),
+         future_value_get_const_bson_ptr_ptr (future_get_param (future, 2)),
+         future_value_get_size_t (future_get_param (future, 3)),
+         future_value_get_const_mongoc_read_prefs_ptr (future_get_param (future, 4)),
+         future_value_get_bson_ptr (future_get_param (future, 5)),
+         future_value_get_bson_error_ptr (future_get_param (future, 6))
+      ));
+
+   future_resolve (future, return_value);
+
+   return NULL;
+}
+
 static void *
 background_mongoc_client_write_command_with_opts (void *data)
 {
@@ -162,6 +187,47 @@ background_mongoc_client_kill_cursor (void *data)
    return NULL;
 }
 
+static void *
+background_mongoc_client_session_abort_transaction (void *data)
+{
+   future_t *future = (future_t *) data;
+   future_value_t return_value;
+
+   return_value.type = future_value_bool_type;
+
+   future_value_set_bool (
+      &return_value,
+      mongoc_client_session_abort_transaction (
+         future_value_get_mongoc_client_session_ptr (future_get_param (future, 0)),
+         future_value_get_bson_error_ptr (future_get_param (future, 1))
+      ));
+
+   future_resolve (future, return_value);
+
+   return NULL;
+}
+
+static void *
+background_mongoc_client_session_commit_transaction (void *data)
+{
+   future_t *future = (future_t *) data;
+   future_value_t return_value;
+
+   return_value.type = future_value_bool_type;
+
+   future_value_set_bool (
+      &return_value,
+      mongoc_client_session_commit_transaction (
+         future_value_get_mongoc_client_session_ptr (future_get_param (future, 0)),
+         future_value_get_bson_ptr (future_get_param (future, 1)),
+         future_value_get_bson_error_ptr (future_get_param (future, 2))
+      ));
+
+   future_resolve (future, return_value);
+
+   return NULL;
+}
+
 static void *
 background_mongoc_collection_aggregate (void *data)
 {
@@ -185,6 +251,30 @@ background_mongoc_collection_aggregate (void *data)
    return NULL;
 }
 
+static void *
+background_mongoc_collection_aggregate_one (void *data)
+{
+   future_t *future = (future_t *) data;
+   future_value_t return_value;
+
+   return_value.type = future_value_bool_type;
+
+   future_value_set_bool (
+      &return_value,
+      mongoc_collection_aggregate_one (
+         future_value_get_mongoc_collection_ptr (future_get_param (future, 0)),
+         future_value_get_const_bson_ptr (future_get_param (future, 1)),
+         future_value_get_const_bson_ptr (future_get_param (future, 2)),
+         future_value_get_const_mongoc_read_prefs_ptr (future_get_param (future, 3)),
+         future_value_get_bson_ptr (future_get_param (future, 4)),
+         future_value_get_bson_error_ptr (future_get_param (future, 5))
+      ));
+
+   future_resolve (future, return_value);
+
+   return NULL;
+}
+
 static void *
 background_mongoc_collection_count (void *data)
 {
@@ -236,6 +326,29 @@ background_mongoc_collection_count_with_opts (void *data)
    return NULL;
 }
 
+static void *
+background_mongoc_collection_estimated_document_count (void *data)
+{
+   future_t *future = (future_t *) data;
+   future_value_t return_value;
+
+   return_value.type = future_value_int64_t_type;
+
+   future_value_set_int64_t (
+      &return_value,
+      mongoc_collection_estimated_document_count (
+         future_value_get_mongoc_collection_ptr (future_get_param (future, 0)),
+         future_value_get_const_bson_ptr (future_get_param (future, 1)),
+         future_value_get_const_mongoc_read_prefs_ptr (future_get_param (future, 2)),
+         future_value_get_bson_ptr (future_get_param (future, 3)),
+         future_value_get_bson_error_ptr (future_get_param (future, 4))
+      ));
+
+   future_resolve (future, return_value);
+
+   return NULL;
+}
+
 static void *
 background_mongoc_collection_create_index_with_opts (void *data)
 {
@@ -283,6 +396,30 @@ background_mongoc_collection_find_and_modify_with_opts (void *data)
    return NULL;
 }
 
+static void *
+background_mongoc_collection_find_one_with_opts (void *data)
+{
+   future_t *future = (future_t *) data;
+   future_value_t return_value;
+
+   return_value.type = future_value_bool_type;
+
+   future_value_set_bool (
+      &return_value,
+      mongoc_collection_find_one_with_opts (
+         future_value_get_mongoc_collection_ptr (future_get_param (future, 0)),
+         future_value_get_const_bson_ptr (future_get_param (future, 1)),
+         future_value_get_const_bson_ptr (future_get_param (future, 2)),
+         future_value_get_const_mongoc_read_prefs_ptr (future_get_param (future, 3)),
+         future_value_get_bson_ptr (future_get_param (future, 4)),
+         future_value_get_bson_error_ptr (future_get_param (future, 5))
+      ));
+
+   future_resolve (future, return_value);
+
+   return NULL;
+}
+
 static void *
 background_mongoc_collection_find_and_modify (void *data)
 {
@@ -609,6 +746,25 @@ background_mongoc_gridfs_file_remove (void *data)
    return NULL;
 }
 
+static void *
+background_mongoc_gridfs_file_save (void *data)
+{
+   future_t *future = (future_t *) data;
+   future_value_t return_value;
+
+   return_value.type = future_value_bool_type;
+
+   future_value_set_bool (
+      &return_value,
+      mongoc_gridfs_file_save (
+         future_value_get_mongoc_gridfs_file_ptr (future_get_param (future, 0))
+      ));
+
+   future_resolve (future, return_value);
+
+   return NULL;
+}
+
 static void *
 background_mongoc_gridfs_file_seek (void *data)
 {
@@ -674,6 +830,28 @@ background_mongoc_gridfs_find_one_with_opts (void *data)
    return NULL;
 }
 
+static void *
+background_mongoc_gridfs_find_one_with_chunks (void *data)
+{
+   future_t *future = (future_t *) data;
+   future_value_t return_value;
+
+   return_value.type = future_value_mongoc_gridfs_file_ptr_type;
+
+   future_value_set_mongoc_gridfs_file_ptr (
+      &return_value,
+      mongoc_gridfs_find_one_with_chunks (
+         future_value_get_mongoc_gridfs_ptr (future_get_param (future, 0)),
+         future_value_get_const_bson_ptr (future_get_param (future, 1)),
+         future_value_get_uint32_t (future_get_param (future, 2)),
+         future_value_get_bson_error_ptr (future_get_param (future, 3))
+      ));
+
+   future_resolve (future, return_value);
+
+   return NULL;
+}
+
 static void *
 background_mongoc_topology_select (void *data)
 {
@@ -814,6 +992,44 @@ future_client_read_command_with_opts (
    return future;
 }
 
+future_t *
+future_client_read_commands_pipelined (
+   mongoc_client_ptr client,
+   const_char_ptr db_name,
+   const_bson_ptr_ptr commands,
+   size_t n_commands,
+   const_mongoc_read_prefs_ptr read_prefs,
+   bson_ptr replies,
+   bson_error_ptr error)
+{
+   future_t *future = future_new (future_value_bool_type,
+                                  7);
+   
+   future_value_set_mongoc_client_ptr (
+      future_get_param (future, 0), client);
+   
+   future_value_set_const_char_ptr (
+      future_get_param (future, 1), db_name);
+   
+   future_value_set_const_bson_ptr_ptr (
+      future_get_param (future, 2), commands);
+   
+   future_value_set_size_t (
+      future_get_param (future, 3), n_commands);
+   
+   future_value_set_const_mongoc_read_prefs_ptr (
+      future_get_param (future, 4), read_prefs);
+   
+   future_value_set_bson_ptr (
+      future_get_param (future, 5), replies);
+   
+   future_value_set_bson_error_ptr (
+      future_get_param (future, 6), error);
+   
+   future_start (future, background_mongoc_client_read_commands_pipelined);
+   return future;
+}
+
 future_t *
 future_client_write_command_with_opts (
    mongoc_client_ptr client,
@@ -904,6 +1120,46 @@ future_client_kill_cursor (
    return future;
 }
 
+future_t *
+future_client_session_abort_transaction (
+   mongoc_client_session_ptr session,
+   bson_error_ptr error)
+{
+   future_t *future = future_new (future_value_bool_type,
+                                  2);
+   
+   future_value_set_mongoc_client_session_ptr (
+      future_get_param (future, 0), session);
+   
+   future_value_set_bson_error_ptr (
+      future_get_param (future, 1), error);
+   
+   future_start (future, background_mongoc_client_session_abort_transaction);
+   return future;
+}
+
+future_t *
+future_client_session_commit_transaction (
+   mongoc_client_session_ptr session,
+   bson_ptr reply,
+   bson_error_ptr error)
+{
+   future_t *future = future_new (future_value_bool_type,
+                                  3);
+   
+   future_value_set_mongoc_client_session_ptr (
+      future_get_param (future, 0), session);
+   
+   future_value_set_bson_ptr (
+      future_get_param (future, 1), reply);
+   
+   future_value_set_bson_error_ptr (
+      future_get_param (future, 2), error);
+   
+   future_start (future, background_mongoc_client_session_commit_transaction);
+   return future;
+}
+
 future_t *
 future_collection_aggregate (
    mongoc_collection_ptr collection,
@@ -934,6 +1190,40 @@ future_collection_aggregate (
    return future;
 }
 
+future_t *
+future_collection_aggregate_one (
+   mongoc_collection_ptr collection,
+   const_bson_ptr pipeline,
+   const_bson_ptr opts,
+   const_mongoc_read_prefs_ptr read_prefs,
+   bson_ptr doc,
+   bson_error_ptr error)
+{
+   future_t *future = future_new (future_value_bool_type,
+                                  6);
+   
+   future_value_set_mongoc_collection_ptr (
+      future_get_param (future, 0), collection);
+   
+   future_value_set_const_bson_ptr (
+      future_get_param (future, 1), pipeline);
+   
+   future_value_set_const_bson_ptr (
+      future_get_param (future, 2), opts);
+   
+   future_value_set_const_mongoc_read_prefs_ptr (
+      future_get_param (future, 3), read_prefs);
+   
+   future_value_set_bson_ptr (
+      future_get_param (future, 4), doc);
+   
+   future_value_set_bson_error_ptr (
+      future_get_param (future, 5), error);
+   
+   future_start (future, background_mongoc_collection_aggregate_one);
+   return future;
+}
+
 future_t *
 future_collection_count (
    mongoc_collection_ptr collection,
@@ -1014,6 +1304,36 @@ future_collection_count_with_opts (
    return future;
 }
 
+future_t *
+future_collection_estimated_document_count (
+   mongoc_collection_ptr collection,
+   const_bson_ptr opts,
+   const_mongoc_read_prefs_ptr read_prefs,
+   bson_ptr reply,
+   bson_error_ptr error)
+{
+   future_t *future = future_new (future_value_int64_t_type,
+                                  5);
+   
+   future_value_set_mongoc_collection_ptr (
+      future_get_param (future, 0), collection);
+   
+   future_value_set_const_bson_ptr (
+      future_get_param (future, 1), opts);
+   
+   future_value_set_const_mongoc_read_prefs_ptr (
+      future_get_param (future, 2), read_prefs);
+   
+   future_value_set_bson_ptr (
+      future_get_param (future, 3), reply);
+   
+   future_value_set_bson_error_ptr (
+      future_get_param (future, 4), error);
+   
+   future_start (future, background_mongoc_collection_estimated_document_count);
+   return future;
+}
+
 future_t *
 future_collection_create_index_with_opts (
    mongoc_collection_ptr collection,
@@ -1078,6 +1398,40 @@ future_collection_find_and_modify_with_opts (
    return future;
 }
 
+future_t *
+future_collection_find_one_with_opts (
+   mongoc_collection_ptr collection,
+   const_bson_ptr filter,
+   const_bson_ptr opts,
+   const_mongoc_read_prefs_ptr read_prefs,
+   bson_ptr doc,
+   bson_error_ptr error)
+{
+   future_t *future = future_new (future_value_bool_type,
+                                  6);
+   
+   future_value_set_mongoc_collection_ptr (
+      future_get_param (future, 0), collection);
+   
+   future_value_set_const_bson_ptr (
+      future_get_param (future, 1), filter);
+   
+   future_value_set_const_bson_ptr (
+      future_get_param (future, 2), opts);
+   
+   future_value_set_const_mongoc_read_prefs_ptr (
+      future_get_param (future, 3), read_prefs);
+   
+   future_value_set_bson_ptr (
+      future_get_param (future, 4), doc);
+   
+   future_value_set_bson_error_ptr (
+      future_get_param (future, 5), error);
+   
+   future_start (future, background_mongoc_collection_find_one_with_opts);
+   return future;
+}
+
 future_t *
 future_collection_find_and_modify (
    mongoc_collection_ptr collection,
@@ -1464,6 +1818,20 @@ future_gridfs_file_remove (
    return future;
 }
 
+future_t *
+future_gridfs_file_save (
+   mongoc_gridfs_file_ptr file)
+{
+   future_t *future = future_new (future_value_bool_type,
+                                  1);
+   
+   future_value_set_mongoc_gridfs_file_ptr (
+      future_get_param (future, 0), file);
+   
+   future_start (future, background_mongoc_gridfs_file_save);
+   return future;
+}
+
 future_t *
 future_gridfs_file_seek (
    mongoc_gridfs_file_ptr file,
@@ -1538,6 +1906,32 @@ future_gridfs_find_one_with_opts (
    return future;
 }
 
+future_t *
+future_gridfs_find_one_with_chunks (
+   mongoc_gridfs_ptr gridfs,
+   const_bson_ptr filter,
+   uint32_t n_chunks,
+   bson_error_ptr error)
+{
+   future_t *future = future_new (future_value_mongoc_gridfs_file_ptr_type,
+                                  4);
+   
+   future_value_set_mongoc_gridfs_ptr (
+      future_get_param (future, 0), gridfs);
+   
+   future_value_set_const_bson_ptr (
+      future_get_param (future, 1), filter);
+   
+   future_value_set_uint32_t (
+      future_get_param (future, 2), n_chunks);
+   
+   future_value_set_bson_error_ptr (
+      future_get_param (future, 3), error);
+   
+   future_start (future, background_mongoc_gridfs_find_one_with_chunks);
+   return future;
+}
+
 future_t *
 future_topology_select (
    mongoc_topology_ptr topology,
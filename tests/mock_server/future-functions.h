@@ -49,6 +49,19 @@ future_client_read_command_with_opts (
 );
 
 
+future_t *
+future_client_read_commands_pipelined (
+
+   mongoc_client_ptr client,
+   const_char_ptr db_name,
+   const_bson_ptr_ptr commands,
+   size_t n_commands,
+   const_mongoc_read_prefs_ptr read_prefs,
+   bson_ptr replies,
+   bson_error_ptr error
+);
+
+
 future_t *
 future_client_write_command_with_opts (
 
@@ -82,6 +95,23 @@ future_client_kill_cursor (
 );
 
 
+future_t *
+future_client_session_abort_transaction (
+
+   mongoc_client_session_ptr session,
+   bson_error_ptr error
+);
+
+
+future_t *
+future_client_session_commit_transaction (
+
+   mongoc_client_session_ptr session,
+   bson_ptr reply,
+   bson_error_ptr error
+);
+
+
 future_t *
 future_collection_aggregate (
 
@@ -93,6 +123,18 @@ future_collection_aggregate (
 );
 
 
+future_t *
+future_collection_aggregate_one (
+
+   mongoc_collection_ptr collection,
+   const_bson_ptr pipeline,
+   const_bson_ptr opts,
+   const_mongoc_read_prefs_ptr read_prefs,
+   bson_ptr doc,
+   bson_error_ptr error
+);
+
+
 future_t *
 future_collection_count (
 
@@ -120,6 +162,17 @@ future_collection_count_with_opts (
 );
 
 
+future_t *
+future_collection_estimated_document_count (
+
+   mongoc_collection_ptr collection,
+   const_bson_ptr opts,
+   const_mongoc_read_prefs_ptr read_prefs,
+   bson_ptr reply,
+   bson_error_ptr error
+);
+
+
 future_t *
 future_collection_create_index_with_opts (
 
@@ -143,6 +196,18 @@ future_collection_find_and_modify_with_opts (
 );
 
 
+future_t *
+future_collection_find_one_with_opts (
+
+   mongoc_collection_ptr collection,
+   const_bson_ptr filter,
+   const_bson_ptr opts,
+   const_mongoc_read_prefs_ptr read_prefs,
+   bson_ptr doc,
+   bson_error_ptr error
+);
+
+
 future_t *
 future_collection_find_and_modify (
 
@@ -292,6 +357,13 @@ future_gridfs_file_remove (
 );
 
 
+future_t *
+future_gridfs_file_save (
+
+   mongoc_gridfs_file_ptr file
+);
+
+
 future_t *
 future_gridfs_file_seek (
 
@@ -321,6 +393,16 @@ future_gridfs_find_one_with_opts (
 );
 
 
+future_t *
+future_gridfs_find_one_with_chunks (
+
+   mongoc_gridfs_ptr gridfs,
+   const_bson_ptr filter,
+   uint32_t n_chunks,
+   bson_error_ptr error
+);
+
+
 future_t *
 future_topology_select (
 
@@ -238,6 +238,20 @@ future_value_get_mongoc_client_ptr (future_value_t *future_value)
    return future_value->mongoc_client_ptr_value;
 }
 
+void
+future_value_set_mongoc_client_session_ptr (future_value_t *future_value, mongoc_client_session_ptr value)
+{
+   future_value->type = future_value_mongoc_client_session_ptr_type;
+   future_value->mongoc_client_session_ptr_value = value;
+}
+
+mongoc_client_session_ptr
+future_value_get_mongoc_client_session_ptr (future_value_t *future_value)
+{
+   BSON_ASSERT (future_value->type == future_value_mongoc_client_session_ptr_type);
+   return future_value->mongoc_client_session_ptr_value;
+}
+
 void
 future_value_set_mongoc_collection_ptr (future_value_t *future_value, mongoc_collection_ptr value)
 {
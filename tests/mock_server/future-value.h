@@ -28,6 +28,7 @@ typedef const bson_t * const_bson_ptr;
 typedef const bson_t ** const_bson_ptr_ptr;
 typedef mongoc_bulk_operation_t * mongoc_bulk_operation_ptr;
 typedef mongoc_client_t * mongoc_client_ptr;
+typedef mongoc_client_session_t * mongoc_client_session_ptr;
 typedef mongoc_collection_t * mongoc_collection_ptr;
 typedef mongoc_cursor_t * mongoc_cursor_ptr;
 typedef mongoc_database_t * mongoc_database_ptr;
@@ -60,6 +61,7 @@ typedef enum {
    future_value_const_bson_ptr_ptr_type,
    future_value_mongoc_bulk_operation_ptr_type,
    future_value_mongoc_client_ptr_type,
+   future_value_mongoc_client_session_ptr_type,
    future_value_mongoc_collection_ptr_type,
    future_value_mongoc_cursor_ptr_type,
    future_value_mongoc_database_ptr_type,
@@ -100,6 +102,7 @@ typedef struct _future_value_t
       const_bson_ptr_ptr const_bson_ptr_ptr_value;
       mongoc_bulk_operation_ptr mongoc_bulk_operation_ptr_value;
       mongoc_client_ptr mongoc_client_ptr_value;
+      mongoc_client_session_ptr mongoc_client_session_ptr_value;
       mongoc_collection_ptr mongoc_collection_ptr_value;
       mongoc_cursor_ptr mongoc_cursor_ptr_value;
       mongoc_database_ptr mongoc_database_ptr_value;
@@ -268,6 +271,15 @@ mongoc_client_ptr
 future_value_get_mongoc_client_ptr (
    future_value_t *future_value);
 
+void
+future_value_set_mongoc_client_session_ptr(
+   future_value_t *future_value,
+   mongoc_client_session_ptr value);
+
+mongoc_client_session_ptr
+future_value_get_mongoc_client_session_ptr (
+   future_value_t *future_value);
+
 void
 future_value_set_mongoc_collection_ptr(
    future_value_t *future_value,
@@ -1746,21 +1746,26 @@ _mock_server_reply_with_stream (mock_server_t *server,
    int n_docs = reply->n_docs;
    int64_t cursor_id = reply->cursor_id;
 
-   docs_json = bson_string_new ("");
-   for (i = 0; i < n_docs; i++) {
-      doc_json = bson_as_json (&docs[i], NULL);
-      bson_string_append (docs_json, doc_json);
-      bson_free (doc_json);
-      if (i < n_docs - 1) {
-         bson_string_append (docs_json, ", ");
+   /* formatting replies is costly, skip it unless they're logged */
+   if (test_suite_mock_server_log_enabled ()) {
+      docs_json = bson_string_new ("");
+      for (i = 0; i < n_docs; i++) {
+         doc_json = bson_as_json (&docs[i], NULL);
+         bson_string_append (docs_json, doc_json);
+         bson_free (doc_json);
+         if (i < n_docs - 1) {
+            bson_string_append (docs_json, ", ");
+         }
       }
-   }
 
-   test_suite_mock_server_log ("%5.2f  %hu <- %hu \t%s",
-                               mock_server_get_uptime_sec (server),
-                               reply->client_port,
-                               mock_server_get_port (server),
-                               docs_json->str);
+      test_suite_mock_server_log ("%5.2f  %hu <- %hu \t%s",
+                                  mock_server_get_uptime_sec (server),
+                                  reply->client_port,
+                                  mock_server_get_port (server),
+                                  docs_json->str);
+
+      bson_string_free (docs_json, true);
+   }
 
    len = 0;
 
@@ -1810,7 +1815,6 @@ _mock_server_reply_with_stream (mock_server_t *server,
 
    BSON_ASSERT (n_written == expected);
 
-   bson_string_free (docs_json, true);
    _mongoc_array_destroy (&ar);
    bson_free (buf);
 }
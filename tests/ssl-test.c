@@ -8,6 +8,7 @@
 #endif
 
 #include "mongoc-stream-tls.h"
+#include "mongoc-stream-tls-private.h"
 
 #include "ssl-test.h"
 #include "TestSuite.h"
@@ -229,6 +230,10 @@ ssl_test_client (void *ptr)
    }
    BSON_ASSERT (ssl_stream);
 
+   if (data->kernel_offload) {
+      _mongoc_stream_tls_set_kernel_offload (ssl_stream);
+   }
+
    r = mongoc_stream_tls_handshake_block (
       ssl_stream, data->host, TIMEOUT, &error);
 
@@ -286,12 +291,13 @@ ssl_test_client (void *ptr)
  * client and server speak a simple echo protocol, so all we're really testing
  * here is that any given configuration succeeds or fails as it should
  */
-void
-ssl_test (mongoc_ssl_opt_t *client,
-          mongoc_ssl_opt_t *server,
-          const char *host,
-          ssl_test_result_t *client_result,
-          ssl_test_result_t *server_result)
+static void
+_ssl_test (mongoc_ssl_opt_t *client,
+           mongoc_ssl_opt_t *server,
+           const char *host,
+           bool kernel_offload,
+           ssl_test_result_t *client_result,
+           ssl_test_result_t *server_result)
 {
    ssl_test_data_t data = {0};
    mongoc_thread_t threads[2];
@@ -302,6 +308,7 @@ ssl_test (mongoc_ssl_opt_t *client,
    data.client_result = client_result;
    data.server_result = server_result;
    data.host = host;
+   data.kernel_offload = kernel_offload;
 
    mongoc_mutex_init (&data.cond_mutex);
    mongoc_cond_init (&data.cond);
@@ -320,3 +327,27 @@ ssl_test (mongoc_ssl_opt_t *client,
    mongoc_mutex_destroy (&data.cond_mutex);
    mongoc_cond_destroy (&data.cond);
 }
+
+
+void
+ssl_test (mongoc_ssl_opt_t *client,
+          mongoc_ssl_opt_t *server,
+          const char *host,
+          ssl_test_result_t *client_result,
+          ssl_test_result_t *server_result)
+{
+   _ssl_test (client, server, host, false, client_result, server_result);
+}
+
+
+/* the same, with the client asking for kernel TLS: whether or not the
+ * kernel takes over, the echo must round-trip */
+void
+ssl_test_kernel_offload (mongoc_ssl_opt_t *client,
+                         mongoc_ssl_opt_t *server,
+                         const char *host,
+                         ssl_test_result_t *client_result,
+                         ssl_test_result_t *server_result)
+{
+   _ssl_test (client, server, host, true, client_result, server_result);
+}
@@ -27,6 +27,7 @@ typedef struct ssl_test_data {
    mongoc_ssl_opt_t *server;
    ssl_test_behavior_t behavior;
    int64_t handshake_stall_ms;
+   bool kernel_offload; /* client asks for kernel TLS */
    const char *host;
    unsigned short server_port;
    mongoc_cond_t cond;
@@ -41,3 +42,10 @@ ssl_test (mongoc_ssl_opt_t *client,
           const char *host,
           ssl_test_result_t *client_result,
           ssl_test_result_t *server_result);
+
+void
+ssl_test_kernel_offload (mongoc_ssl_opt_t *client,
+                         mongoc_ssl_opt_t *server,
+                         const char *host,
+                         ssl_test_result_t *client_result,
+                         ssl_test_result_t *server_result);
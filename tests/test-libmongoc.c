@@ -37,12 +37,22 @@
 extern void
 test_array_install (TestSuite *suite);
 extern void
+test_alloc_budget_install (TestSuite *suite);
+extern void
+test_arena_install (TestSuite *suite);
+extern void
 test_async_install (TestSuite *suite);
 extern void
+test_async_client_install (TestSuite *suite);
+extern void
 test_buffer_install (TestSuite *suite);
 extern void
 test_bulk_install (TestSuite *suite);
 extern void
+test_change_stream_install (TestSuite *suite);
+extern void
+test_change_stream_mux_install (TestSuite *suite);
+extern void
 test_client_install (TestSuite *suite);
 extern void
 test_client_max_staleness_install (TestSuite *suite);
@@ -57,12 +67,16 @@ test_collection_find_install (TestSuite *suite);
 extern void
 test_collection_find_with_opts_install (TestSuite *suite);
 extern void
+test_columns_install (TestSuite *suite);
+extern void
 test_connection_uri_install (TestSuite *suite);
 extern void
 test_command_monitoring_install (TestSuite *suite);
 extern void
 test_cursor_install (TestSuite *suite);
 extern void
+test_cursor_group_install (TestSuite *suite);
+extern void
 test_database_install (TestSuite *suite);
 extern void
 test_error_install (TestSuite *suite);
@@ -83,8 +97,14 @@ test_log_install (TestSuite *suite);
 extern void
 test_matcher_install (TestSuite *suite);
 extern void
+test_memory_install (TestSuite *suite);
+extern void
+test_mock_bench_install (TestSuite *suite);
+extern void
 test_handshake_install (TestSuite *suite);
 extern void
+test_paginator_install (TestSuite *suite);
+extern void
 test_queue_install (TestSuite *suite);
 extern void
 test_read_prefs_install (TestSuite *suite);
@@ -108,6 +128,8 @@ extern void test_server_selection_errors_install (TestSuite *suite);
 extern void
 test_set_install (TestSuite *suite);
 extern void
+test_shard_router_install (TestSuite *suite);
+extern void
 test_socket_install (TestSuite *suite);
 extern void
 test_stream_install (TestSuite *suite);
@@ -1926,6 +1948,18 @@ test_framework_skip_if_not_rs_version_5 (void)
              : 0;
 }
 
+int
+test_framework_skip_if_not_rs_version_6 (void)
+{
+   if (!TestSuite_CheckLive ()) {
+      return 0;
+   }
+   return (test_framework_max_wire_version_at_least (6) &&
+           test_framework_is_replset ())
+             ? 1
+             : 0;
+}
+
 int
 test_framework_skip_if_rs_version_5 (void)
 {
@@ -1967,20 +2001,27 @@ main (int argc, char *argv[])
    TestSuite_Add (&suite, "/TestSuite/version_cmp", test_version_cmp);
 
    test_array_install (&suite);
+   test_alloc_budget_install (&suite);
+   test_arena_install (&suite);
    test_async_install (&suite);
+   test_async_client_install (&suite);
    test_buffer_install (&suite);
    test_client_install (&suite);
    test_client_max_staleness_install (&suite);
    test_client_pool_install (&suite);
    test_write_command_install (&suite);
    test_bulk_install (&suite);
+   test_change_stream_install (&suite);
+   test_change_stream_mux_install (&suite);
    test_cluster_install (&suite);
    test_collection_install (&suite);
    test_collection_find_install (&suite);
    test_collection_find_with_opts_install (&suite);
+   test_columns_install (&suite);
    test_connection_uri_install (&suite);
    test_command_monitoring_install (&suite);
    test_cursor_install (&suite);
+   test_cursor_group_install (&suite);
    test_database_install (&suite);
    test_error_install (&suite);
    test_exhaust_install (&suite);
@@ -1992,6 +2033,9 @@ main (int argc, char *argv[])
    test_list_install (&suite);
    test_log_install (&suite);
    test_matcher_install (&suite);
+   test_memory_install (&suite);
+   test_mock_bench_install (&suite);
+   test_paginator_install (&suite);
    test_queue_install (&suite);
    test_read_prefs_install (&suite);
    test_rpc_install (&suite);
@@ -2008,6 +2052,7 @@ main (int argc, char *argv[])
 #endif
    test_session_install (&suite);
    test_set_install (&suite);
+   test_shard_router_install (&suite);
    test_stream_install (&suite);
    test_thread_install (&suite);
    test_topology_install (&suite);
@@ -116,6 +116,8 @@ test_framework_skip_if_max_wire_version_less_than_6 (void);
 int
 test_framework_skip_if_not_rs_version_5 (void);
 int
+test_framework_skip_if_not_rs_version_6 (void);
+int
 test_framework_skip_if_rs_version_5 (void);
 int
 test_framework_skip_if_mongos (void);
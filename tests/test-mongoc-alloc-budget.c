@@ -0,0 +1,573 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Allocation budgets: a counting allocator installed with bson_mem_set_vtable
+ * measures the mallocs and bytes the driver needs for each hot operation
+ * against a mock server, and each test fails if the operation needs more than
+ * the budget in gAllocWorkloads. Only the calling thread is counted, not the
+ * mock server's threads or the pool's background monitor.
+ *
+ * A budget that is exceeded on purpose is raised in the same commit, and one
+ * that a change beats by a wide margin is lowered, so the savings stay. To
+ * see the current numbers, set MONGOC_TEST_BENCH_RESULTS to a file: one JSON
+ * line per operation is appended to it.
+ */
+
+#include <errno.h>
+#include <mongoc.h>
+
+#include "mongoc-client-private.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-topology-private.h"
+
+#include "TestSuite.h"
+#include "test-libmongoc.h"
+#include "mock_server/mock-server.h"
+
+
+#define ALLOC_DB "alloc"
+#define ALLOC_BATCH_SIZE 10
+#define ALLOC_BULK_SIZE 1000
+#define ALLOC_CURSOR_ID 1234
+#define ALLOC_WARMUP_OPS 10
+#define ALLOC_OPS 100
+
+
+typedef enum {
+   ALLOC_FIND_ONE,
+   ALLOC_INSERT_ONE,
+   ALLOC_GETMORE,
+   ALLOC_BULK,
+   ALLOC_SELECT_SERVER,
+   ALLOC_POOL_POP_PUSH,
+   ALLOC_HEARTBEAT,
+   ALLOC_GET_COLLECTION,
+} alloc_op_t;
+
+
+/* the workload's name is also the collection it uses. the budgets are per
+ * operation: calls to malloc, calloc, and realloc, and the bytes requested */
+typedef struct {
+   const char *name;
+   alloc_op_t op;
+   int64_t max_allocations;
+   int64_t max_bytes;
+} alloc_workload_t;
+
+
+static alloc_workload_t gAllocWorkloads[] = {
+   {"find_one", ALLOC_FIND_ONE, 150, 64 * 1024},
+   {"insert_one", ALLOC_INSERT_ONE, 120, 64 * 1024},
+   {"getmore", ALLOC_GETMORE, 100, 64 * 1024},
+   {"bulk", ALLOC_BULK, 6000, 1024 * 1024},
+   {"select_server", ALLOC_SELECT_SERVER, 64, 32 * 1024},
+   {"pool_pop_push", ALLOC_POOL_POP_PUSH, 16, 4 * 1024},
+   {"heartbeat", ALLOC_HEARTBEAT, 2, 512},
+   {"get_collection", ALLOC_GET_COLLECTION, 1, 1024},
+};
+
+
+typedef struct {
+   bson_t find;
+   bson_t cursor;
+   bson_t getmore;
+   bson_t insert;
+   bson_t bulk;
+   bson_t ok;
+} alloc_replies_t;
+
+
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+static MONGOC_THREAD_LOCAL bool gAllocCounting;
+#else
+static bool gAllocCounting;
+#endif
+
+/* only touched by the counting thread */
+static int64_t gAllocCount;
+static int64_t gAllocBytes;
+
+
+static void *
+alloc_budget_malloc (size_t num_bytes)
+{
+   if (gAllocCounting) {
+      gAllocCount++;
+      gAllocBytes += (int64_t) num_bytes;
+   }
+
+   return malloc (num_bytes);
+}
+
+
+static void *
+alloc_budget_calloc (size_t n_members, size_t num_bytes)
+{
+   if (gAllocCounting) {
+      gAllocCount++;
+      gAllocBytes += (int64_t) (n_members * num_bytes);
+   }
+
+   return calloc (n_members, num_bytes);
+}
+
+
+/* a realloc may move the memory, count it like a new allocation */
+static void *
+alloc_budget_realloc (void *mem, size_t num_bytes)
+{
+   if (gAllocCounting) {
+      gAllocCount++;
+      gAllocBytes += (int64_t) num_bytes;
+   }
+
+   return realloc (mem, num_bytes);
+}
+
+
+static void
+alloc_budget_free (void *mem)
+{
+   free (mem);
+}
+
+
+static void
+alloc_counting_start (void)
+{
+   gAllocCount = gAllocBytes = 0;
+   gAllocCounting = true;
+}
+
+
+static void
+alloc_counting_stop (void)
+{
+   gAllocCounting = false;
+}
+
+
+static int
+skip_if_no_thread_local (void)
+{
+#ifdef MONGOC_HAVE_THREAD_LOCAL
+   return TestSuite_CheckMockServerAllowed ();
+#else
+   /* the mock server's allocations would be counted too */
+   return 0;
+#endif
+}
+
+
+static void
+alloc_append_batch (bson_t *reply,
+                    int64_t cursor_id,
+                    const char *ns,
+                    const char *batch_name,
+                    int n_docs)
+{
+   bson_t cursor;
+   bson_t batch;
+   bson_t doc;
+   char buf[16];
+   const char *key;
+   int i;
+
+   BSON_APPEND_DOCUMENT_BEGIN (reply, "cursor", &cursor);
+   BSON_APPEND_INT64 (&cursor, "id", cursor_id);
+   BSON_APPEND_UTF8 (&cursor, "ns", ns);
+   BSON_APPEND_ARRAY_BEGIN (&cursor, batch_name, &batch);
+
+   for (i = 0; i < n_docs; i++) {
+      bson_uint32_to_string ((uint32_t) i, &key, buf, sizeof buf);
+      BSON_APPEND_DOCUMENT_BEGIN (&batch, key, &doc);
+      BSON_APPEND_INT32 (&doc, "_id", i);
+      BSON_APPEND_UTF8 (&doc, "name", "budget document");
+      bson_append_document_end (&batch, &doc);
+   }
+
+   bson_append_array_end (&cursor, &batch);
+   bson_append_document_end (reply, &cursor);
+   BSON_APPEND_DOUBLE (reply, "ok", 1.0);
+}
+
+
+static void
+alloc_replies_init (alloc_replies_t *replies)
+{
+   bson_init (&replies->find);
+   alloc_append_batch (
+      &replies->find, 0, ALLOC_DB ".find_one", "firstBatch", 1);
+
+   bson_init (&replies->cursor);
+   alloc_append_batch (
+      &replies->cursor, ALLOC_CURSOR_ID, ALLOC_DB ".getmore", "firstBatch", 0);
+
+   bson_init (&replies->getmore);
+   alloc_append_batch (&replies->getmore,
+                       ALLOC_CURSOR_ID,
+                       ALLOC_DB ".getmore",
+                       "nextBatch",
+                       ALLOC_BATCH_SIZE);
+
+   bson_init (&replies->insert);
+   BSON_APPEND_INT32 (&replies->insert, "n", 1);
+   BSON_APPEND_DOUBLE (&replies->insert, "ok", 1.0);
+
+   bson_init (&replies->bulk);
+   BSON_APPEND_INT32 (&replies->bulk, "n", ALLOC_BULK_SIZE);
+   BSON_APPEND_DOUBLE (&replies->bulk, "ok", 1.0);
+
+   bson_init (&replies->ok);
+   BSON_APPEND_DOUBLE (&replies->ok, "ok", 1.0);
+}
+
+
+static void
+alloc_replies_destroy (alloc_replies_t *replies)
+{
+   bson_destroy (&replies->find);
+   bson_destroy (&replies->cursor);
+   bson_destroy (&replies->getmore);
+   bson_destroy (&replies->insert);
+   bson_destroy (&replies->bulk);
+   bson_destroy (&replies->ok);
+}
+
+
+/* answer each command with a prebuilt reply, leave ismaster to the
+ * auto-ismaster responder */
+static bool
+alloc_responder (request_t *request, void *data)
+{
+   alloc_replies_t *replies = (alloc_replies_t *) data;
+   const char *cmd = request->command_name;
+   const bson_t *reply;
+   bson_iter_t iter;
+
+   if (!request->is_command || !cmd) {
+      return false;
+   }
+
+   if (!strcmp (cmd, "find")) {
+      if (bson_iter_init_find (&iter, request_get_doc (request, 0), "find") &&
+          BSON_ITER_HOLDS_UTF8 (&iter) &&
+          !strcmp (bson_iter_utf8 (&iter, NULL), "getmore")) {
+         reply = &replies->cursor;
+      } else {
+         reply = &replies->find;
+      }
+   } else if (!strcmp (cmd, "getMore")) {
+      reply = &replies->getmore;
+   } else if (!strcmp (cmd, "insert")) {
+      if (bson_iter_init_find (&iter, request_get_doc (request, 0), "insert") &&
+          BSON_ITER_HOLDS_UTF8 (&iter) &&
+          !strcmp (bson_iter_utf8 (&iter, NULL), "bulk")) {
+         reply = &replies->bulk;
+      } else {
+         reply = &replies->insert;
+      }
+   } else if (!strcmp (cmd, "killCursors")) {
+      reply = &replies->ok;
+   } else {
+      return false;
+   }
+
+   mock_server_reply_multi (request, MONGOC_REPLY_NONE, reply, 1, 0);
+   request_destroy (request);
+
+   return true;
+}
+
+
+static void
+alloc_find_one (mongoc_collection_t *collection)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_t filter = BSON_INITIALIZER;
+   bson_error_t error;
+
+   cursor = mongoc_collection_find_with_opts (collection, &filter, NULL, NULL);
+   BSON_ASSERT (mongoc_cursor_next (cursor, &doc));
+   BSON_ASSERT (!mongoc_cursor_next (cursor, &doc));
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+   mongoc_cursor_destroy (cursor);
+}
+
+
+static void
+alloc_insert_one (mongoc_collection_t *collection, const bson_t *doc)
+{
+   bson_error_t error;
+   bool r;
+
+   r = mongoc_collection_insert (
+      collection, MONGOC_INSERT_NONE, doc, NULL, &error);
+   ASSERT_OR_PRINT (r, error);
+}
+
+
+/* one getMore returns ALLOC_BATCH_SIZE documents */
+static void
+alloc_getmore (mongoc_cursor_t *cursor)
+{
+   const bson_t *doc;
+   bson_error_t error;
+   int i;
+
+   for (i = 0; i < ALLOC_BATCH_SIZE; i++) {
+      if (!mongoc_cursor_next (cursor, &doc)) {
+         ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+         test_error ("cursor ended early");
+      }
+   }
+}
+
+
+static void
+alloc_bulk (mongoc_collection_t *collection, const bson_t *doc)
+{
+   mongoc_bulk_operation_t *bulk;
+   bson_error_t error;
+   uint32_t r;
+   int i;
+
+   bulk = mongoc_collection_create_bulk_operation (collection, true, NULL);
+   for (i = 0; i < ALLOC_BULK_SIZE; i++) {
+      mongoc_bulk_operation_insert (bulk, doc);
+   }
+
+   r = mongoc_bulk_operation_execute (bulk, NULL, &error);
+   ASSERT_OR_PRINT (r, error);
+   mongoc_bulk_operation_destroy (bulk);
+}
+
+
+static void
+alloc_select_server (mongoc_client_t *client)
+{
+   mongoc_server_description_t *sd;
+   bson_error_t error;
+
+   sd = mongoc_client_select_server (client, false, NULL, &error);
+   ASSERT_OR_PRINT (sd, error);
+   mongoc_server_description_destroy (sd);
+}
+
+
+/* one isMaster on the client's monitoring connection, with the same reply
+ * as the last one. @client is single-threaded, so it runs on this thread */
+static void
+alloc_heartbeat (mongoc_client_t *client)
+{
+   mongoc_topology_scanner_t *scanner;
+
+   scanner = client->topology->scanner;
+   mongoc_topology_scanner_start (scanner, get_future_timeout_ms (), false);
+   mongoc_topology_scanner_work (scanner);
+   ASSERT (!scanner->async->ncmds);
+}
+
+
+static void
+alloc_run_op (const alloc_workload_t *workload,
+              mongoc_client_pool_t *pool,
+              mongoc_client_t *client,
+              mongoc_collection_t *collection,
+              mongoc_cursor_t *cursor,
+              const bson_t *doc)
+{
+   switch (workload->op) {
+   case ALLOC_FIND_ONE:
+      alloc_find_one (collection);
+      break;
+   case ALLOC_INSERT_ONE:
+      alloc_insert_one (collection, doc);
+      break;
+   case ALLOC_GETMORE:
+      alloc_getmore (cursor);
+      break;
+   case ALLOC_BULK:
+      alloc_bulk (collection, doc);
+      break;
+   case ALLOC_SELECT_SERVER:
+      alloc_select_server (client);
+      break;
+   case ALLOC_POOL_POP_PUSH:
+      mongoc_client_pool_push (pool, mongoc_client_pool_pop (pool));
+      break;
+   case ALLOC_HEARTBEAT:
+      alloc_heartbeat (client);
+      break;
+   case ALLOC_GET_COLLECTION:
+      /* the handle shares the client's read prefs and concerns */
+      mongoc_collection_destroy (
+         mongoc_client_get_collection (client, ALLOC_DB, workload->name));
+      break;
+   default:
+      BSON_ASSERT (false);
+   }
+}
+
+
+static void
+alloc_report (const alloc_workload_t *workload,
+              double allocations,
+              double bytes)
+{
+   char *results_path;
+   FILE *out;
+   bson_t result;
+   char *json;
+
+   results_path = test_framework_getenv ("MONGOC_TEST_BENCH_RESULTS");
+   if (!results_path) {
+      return;
+   }
+
+   bson_init (&result);
+   BSON_APPEND_UTF8 (&result, "name", workload->name);
+   BSON_APPEND_DOUBLE (&result, "allocationsPerOp", allocations);
+   BSON_APPEND_DOUBLE (&result, "bytesPerOp", bytes);
+   BSON_APPEND_INT64 (
+      &result, "maxAllocationsPerOp", workload->max_allocations);
+   BSON_APPEND_INT64 (&result, "maxBytesPerOp", workload->max_bytes);
+
+   json = bson_as_json (&result, NULL);
+   out = fopen (results_path, "a");
+   ASSERT_OR_PRINT_ERRNO (out, errno);
+   fprintf (out, "%s\n", json);
+   fclose (out);
+
+   bson_free (json);
+   bson_destroy (&result);
+   bson_free (results_path);
+}
+
+
+static void
+test_alloc_budget (void *ctx)
+{
+   const alloc_workload_t *workload = (const alloc_workload_t *) ctx;
+   bson_mem_vtable_t vtable = {alloc_budget_malloc,
+                               alloc_budget_calloc,
+                               alloc_budget_realloc,
+                               alloc_budget_free};
+   alloc_replies_t replies;
+   mock_server_t *server;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor = NULL;
+   bson_t filter = BSON_INITIALIZER;
+   bson_t *doc;
+   double allocations;
+   double bytes;
+   int i;
+
+   /* before any thread allocates: the vtable isn't swapped atomically */
+   bson_mem_set_vtable (&vtable);
+
+   alloc_replies_init (&replies);
+   doc = BCON_NEW ("name", "budget document", "value", BCON_DOUBLE (1.5));
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_autoresponds (server, alloc_responder, &replies, NULL);
+   mock_server_run (server);
+
+   pool = mongoc_client_pool_new (mock_server_get_uri (server));
+   if (workload->op == ALLOC_HEARTBEAT) {
+      client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   } else {
+      client = mongoc_client_pool_pop (pool);
+   }
+
+   collection = mongoc_client_get_collection (client, ALLOC_DB, workload->name);
+
+   if (workload->op == ALLOC_GETMORE) {
+      /* an open cursor with an empty first batch, so each
+       * ALLOC_BATCH_SIZE calls to mongoc_cursor_next run one getMore */
+      cursor =
+         mongoc_collection_find_with_opts (collection, &filter, NULL, NULL);
+   }
+
+   /* connect, and fill whatever the driver caches */
+   for (i = 0; i < ALLOC_WARMUP_OPS; i++) {
+      alloc_run_op (workload, pool, client, collection, cursor, doc);
+   }
+
+   alloc_counting_start ();
+   for (i = 0; i < ALLOC_OPS; i++) {
+      alloc_run_op (workload, pool, client, collection, cursor, doc);
+   }
+
+   alloc_counting_stop ();
+
+   allocations = (double) gAllocCount / ALLOC_OPS;
+   bytes = (double) gAllocBytes / ALLOC_OPS;
+   alloc_report (workload, allocations, bytes);
+
+   if (allocations > workload->max_allocations ||
+       bytes > workload->max_bytes) {
+      test_error ("%s: %.1f allocations and %.1f bytes per operation, the "
+                  "budget is %" PRId64 " allocations and %" PRId64 " bytes",
+                  workload->name,
+                  allocations,
+                  bytes,
+                  workload->max_allocations,
+                  workload->max_bytes);
+   }
+
+   if (cursor) {
+      mongoc_cursor_destroy (cursor);
+   }
+
+   mongoc_collection_destroy (collection);
+   if (workload->op == ALLOC_HEARTBEAT) {
+      mongoc_client_destroy (client);
+   } else {
+      mongoc_client_pool_push (pool, client);
+   }
+
+   mongoc_client_pool_destroy (pool);
+   mock_server_destroy (server);
+   bson_destroy (doc);
+   alloc_replies_destroy (&replies);
+
+   /* after every thread but this one has exited */
+   bson_mem_restore_vtable ();
+}
+
+
+void
+test_alloc_budget_install (TestSuite *suite)
+{
+   char *name;
+   size_t i;
+
+   for (i = 0; i < sizeof gAllocWorkloads / sizeof gAllocWorkloads[0]; i++) {
+      name = bson_strdup_printf ("/AllocBudget/%s", gAllocWorkloads[i].name);
+      TestSuite_AddFull (suite,
+                         name,
+                         test_alloc_budget,
+                         NULL,
+                         &gAllocWorkloads[i],
+                         skip_if_no_thread_local);
+      bson_free (name);
+   }
+}
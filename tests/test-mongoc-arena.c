@@ -0,0 +1,77 @@
+#include "mongoc-arena-private.h"
+#include "TestSuite.h"
+
+
+static void
+test_arena (void)
+{
+   mongoc_arena_t arena;
+   uint8_t *a;
+   uint8_t *b;
+   uint8_t *c;
+
+   _mongoc_arena_init (&arena);
+   BSON_ASSERT (!arena.block);
+
+   a = (uint8_t *) _mongoc_arena_alloc (&arena, 10);
+   BSON_ASSERT (a == arena.block);
+   b = (uint8_t *) _mongoc_arena_alloc0 (&arena, 10);
+   /* aligned */
+   BSON_ASSERT (b == a + 16);
+   BSON_ASSERT (b[9] == 0);
+   ASSERT_CMPUINT32 (arena.n_live, ==, (uint32_t) 2);
+
+   /* the block rewinds once both are freed */
+   _mongoc_arena_free (&arena, a);
+   ASSERT_CMPSIZE_T (arena.used, ==, (size_t) 32);
+   _mongoc_arena_free (&arena, b);
+   ASSERT_CMPSIZE_T (arena.used, ==, (size_t) 0);
+
+   c = (uint8_t *) _mongoc_arena_alloc (&arena, 1);
+   BSON_ASSERT (c == a);
+   _mongoc_arena_free (&arena, c);
+
+   _mongoc_arena_destroy (&arena);
+}
+
+
+/* allocations that don't fit come from the heap */
+static void
+test_arena_overflow (void)
+{
+   mongoc_arena_t arena;
+   uint8_t *a;
+   uint8_t *b;
+   uint8_t *c;
+
+   _mongoc_arena_init (&arena);
+
+   a = (uint8_t *) _mongoc_arena_alloc (&arena, MONGOC_ARENA_SIZE - 16);
+   BSON_ASSERT (a == arena.block);
+   b = (uint8_t *) _mongoc_arena_alloc (&arena, 32);
+   BSON_ASSERT (b < arena.block || b >= arena.block + MONGOC_ARENA_SIZE);
+   c = (uint8_t *) _mongoc_arena_alloc (&arena, 16);
+   BSON_ASSERT (c == a + MONGOC_ARENA_SIZE - 16);
+   ASSERT_CMPUINT32 (arena.n_live, ==, (uint32_t) 2);
+
+   /* a heap allocation doesn't count */
+   _mongoc_arena_free (&arena, b);
+   ASSERT_CMPUINT32 (arena.n_live, ==, (uint32_t) 2);
+   _mongoc_arena_free (&arena, a);
+   _mongoc_arena_free (&arena, c);
+   ASSERT_CMPSIZE_T (arena.used, ==, (size_t) 0);
+
+   /* no arena */
+   a = (uint8_t *) _mongoc_arena_alloc (NULL, 8);
+   _mongoc_arena_free (NULL, a);
+
+   _mongoc_arena_destroy (&arena);
+}
+
+
+void
+test_arena_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/Arena/basic", test_arena);
+   TestSuite_Add (suite, "/Arena/overflow", test_arena_overflow);
+}
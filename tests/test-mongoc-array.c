@@ -37,8 +37,50 @@ test_array (void)
 }
 
 
+/* elements stay in the caller's buffer until it's outgrown */
+static void
+test_array_inline (void)
+{
+   mongoc_array_t ar;
+   int buf[4];
+   int i;
+
+   _mongoc_array_init_inline (&ar, sizeof i, buf, sizeof buf);
+   BSON_ASSERT (ar.len == 0);
+   BSON_ASSERT (ar.data == (void *) buf);
+
+   for (i = 0; i < 4; i++) {
+      _mongoc_array_append_val (&ar, i);
+   }
+
+   BSON_ASSERT (ar.data == (void *) buf);
+   BSON_ASSERT (buf[3] == 3);
+
+   _mongoc_array_clear (&ar);
+   for (i = 0; i < 100; i++) {
+      _mongoc_array_append_val (&ar, i);
+   }
+
+   /* spilled to the heap */
+   BSON_ASSERT (ar.data != (void *) buf);
+   BSON_ASSERT (ar.allocated >= (100 * sizeof i));
+
+   for (i = 0; i < 100; i++) {
+      BSON_ASSERT (_mongoc_array_index (&ar, int, i) == i);
+   }
+
+   _mongoc_array_destroy (&ar);
+
+   /* destroying an array that never spilled frees nothing */
+   _mongoc_array_init_inline (&ar, sizeof i, buf, sizeof buf);
+   _mongoc_array_append_val (&ar, i);
+   _mongoc_array_destroy (&ar);
+}
+
+
 void
 test_array_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Array/Basic", test_array);
+   TestSuite_Add (suite, "/Array/inline", test_array_inline);
 }
@@ -0,0 +1,485 @@
+#include <mongoc.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+#include "mongoc-thread-private.h"
+#include "TestSuite.h"
+#include "mock_server/mock-server.h"
+#include "test-conveniences.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "async-client-test"
+
+#define N_OPS 10
+
+/* larger than a TLS record, which is at most 16KB */
+#define LARGE_REPLY_SIZE (256 * 1024)
+
+
+typedef struct {
+   bool called;
+   bool success;
+   int32_t n;
+   bson_error_t error;
+} op_result_t;
+
+
+static void
+_op_cb (bool success,
+        const bson_t *reply,
+        const bson_error_t *error,
+        void *ctx)
+{
+   op_result_t *result = (op_result_t *) ctx;
+
+   ASSERT (!result->called);
+   result->called = true;
+   result->success = success;
+
+   if (success) {
+      ASSERT (!error);
+      if (bson_has_field (reply, "n")) {
+         result->n = bson_lookup_int32 (reply, "n");
+      }
+   } else {
+      memcpy (&result->error, error, sizeof result->error);
+   }
+}
+
+
+static bool
+_echo_responder (request_t *request, void *data)
+{
+   const bson_t *cmd;
+   char *reply;
+
+   if (!strcmp (request->command_name, "echo")) {
+      cmd = request_get_doc (request, 0);
+      reply = bson_strdup_printf ("{'ok': 1, 'n': %d}",
+                                  bson_lookup_int32 (cmd, "echo"));
+      mock_server_replies_simple (request, reply);
+      bson_free (reply);
+      request_destroy (request);
+      return true;
+   }
+
+   if (!strcmp (request->command_name, "createIndexes")) {
+      cmd = request_get_doc (request, 0);
+      ASSERT (match_bson (cmd,
+                          tmp_bson ("{'indexes': [{'key': {'a': 1},"
+                                    "              'name': 'a_1'},"
+                                    "             {'key': {'b': 1},"
+                                    "              'name': 'b'}]}"),
+                          false));
+      mock_server_replies_simple (
+         request, "{'ok': 1, 'numIndexesBefore': 1, 'numIndexesAfter': 3}");
+      request_destroy (request);
+      return true;
+   }
+
+   if (!strcmp (request->command_name, "fail")) {
+      mock_server_replies_simple (request,
+                                  "{'ok': 0, 'code': 2, 'errmsg': 'bad'}");
+      request_destroy (request);
+      return true;
+   }
+
+   return false;
+}
+
+
+/* more commands than maxPoolSize all complete on one thread */
+static void
+test_async_client_commands (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_async_client_t *async_client;
+   op_result_t results[N_OPS] = {{0}};
+   op_result_t failed = {0};
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_autoresponds (server, _echo_responder, NULL, NULL);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "maxPoolSize", 2);
+   pool = mongoc_client_pool_new (uri);
+   async_client = mongoc_async_client_new (pool);
+
+   for (i = 0; i < N_OPS; i++) {
+      mongoc_async_client_command (async_client,
+                                   "db",
+                                   tmp_bson ("{'echo': %d}", i),
+                                   NULL,
+                                   _op_cb,
+                                   &results[i]);
+   }
+
+   mongoc_async_client_command (
+      async_client, "db", tmp_bson ("{'fail': 1}"), NULL, _op_cb, &failed);
+
+   /* nothing completes before the loop runs */
+   for (i = 0; i < N_OPS; i++) {
+      ASSERT (!results[i].called);
+   }
+
+   mongoc_async_client_run (async_client);
+   ASSERT_CMPSIZE_T (
+      mongoc_async_client_run_once (async_client, 0), ==, (size_t) 0);
+
+   for (i = 0; i < N_OPS; i++) {
+      ASSERT (results[i].called);
+      ASSERT (results[i].success);
+      ASSERT_CMPINT (results[i].n, ==, i);
+   }
+
+   ASSERT (failed.called);
+   ASSERT (!failed.success);
+   ASSERT_ERROR_CONTAINS (failed.error, MONGOC_ERROR_QUERY, 2, "bad");
+
+   mongoc_async_client_destroy (async_client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+#ifndef _WIN32
+/* drive the async client from a poll () loop, as an application's own
+ * event loop would */
+static void
+test_async_client_external_loop (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_async_client_t *async_client;
+   op_result_t results[N_OPS] = {{0}};
+   mongoc_async_client_fd_t *fds = NULL;
+   struct pollfd *pfds = NULL;
+   size_t n_fds = 0;
+   size_t n;
+   size_t i;
+   int32_t timeout_msec;
+   int r;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_autoresponds (server, _echo_responder, NULL, NULL);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "maxPoolSize", 2);
+   pool = mongoc_client_pool_new (uri);
+   async_client = mongoc_async_client_new (pool);
+
+   for (i = 0; i < N_OPS; i++) {
+      mongoc_async_client_command (async_client,
+                                   "db",
+                                   tmp_bson ("{'echo': %d}", (int) i),
+                                   NULL,
+                                   _op_cb,
+                                   &results[i]);
+   }
+
+   do {
+      n = mongoc_async_client_get_fds (
+         async_client, fds, n_fds, &timeout_msec);
+
+      if (n > n_fds) {
+         n_fds = n;
+         fds = (mongoc_async_client_fd_t *) bson_realloc (
+            fds, n_fds * sizeof (mongoc_async_client_fd_t));
+         pfds = (struct pollfd *) bson_realloc (
+            pfds, n_fds * sizeof (struct pollfd));
+         continue;
+      }
+
+      /* operations are in progress, so there is something to wait for */
+      ASSERT_CMPINT (timeout_msec, >=, 0);
+
+      for (i = 0; i < n; i++) {
+         pfds[i].fd = fds[i].fd;
+         pfds[i].events = (short) fds[i].events;
+         pfds[i].revents = 0;
+      }
+
+      r = poll (pfds, (nfds_t) n, timeout_msec);
+      ASSERT_CMPINT (r, >=, 0);
+
+      for (i = 0; i < n; i++) {
+         fds[i].revents = pfds[i].revents;
+      }
+   } while (mongoc_async_client_process (async_client, fds, n));
+
+   for (i = 0; i < N_OPS; i++) {
+      ASSERT (results[i].called);
+      ASSERT (results[i].success);
+      ASSERT_CMPINT (results[i].n, ==, (int32_t) i);
+   }
+
+   /* nothing left to wait for */
+   ASSERT_CMPSIZE_T (mongoc_async_client_get_fds (
+                        async_client, fds, n_fds, &timeout_msec),
+                     ==,
+                     (size_t) 0);
+   ASSERT_CMPINT (timeout_msec, ==, -1);
+
+   bson_free (fds);
+   bson_free (pfds);
+   mongoc_async_client_destroy (async_client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+#endif
+
+
+#ifdef MONGOC_ENABLE_SSL_OPENSSL
+static bool
+_large_reply_responder (request_t *request, void *data)
+{
+   const char *padding = (const char *) data;
+   const bson_t *cmd;
+   char *reply;
+
+   if (strcmp (request->command_name, "echo")) {
+      return false;
+   }
+
+   cmd = request_get_doc (request, 0);
+   reply = bson_strdup_printf ("{'ok': 1, 'n': %d, 'padding': '%s'}",
+                               bson_lookup_int32 (cmd, "echo"),
+                               padding);
+   mock_server_replies_simple (request, reply);
+   bson_free (reply);
+   request_destroy (request);
+
+   return true;
+}
+
+
+/* replies span many TLS records: those OpenSSL reads ahead are invisible
+ * to polling the socket, and must not stall the loop */
+static void
+test_async_client_tls_large_reply (void)
+{
+   mock_server_t *server;
+   mongoc_ssl_opt_t client_opts = {0};
+   mongoc_ssl_opt_t server_opts = {0};
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_async_client_t *async_client;
+   op_result_t results[N_OPS] = {{0}};
+   char *padding;
+   int i;
+
+   padding = (char *) bson_malloc (LARGE_REPLY_SIZE + 1);
+   memset (padding, 'a', LARGE_REPLY_SIZE);
+   padding[LARGE_REPLY_SIZE] = '\0';
+
+   client_opts.ca_file = CERT_CA;
+   server_opts.weak_cert_validation = true;
+   server_opts.ca_file = CERT_CA;
+   server_opts.pem_file = CERT_SERVER;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_set_ssl_opts (server, &server_opts);
+   mock_server_autoresponds (server, _large_reply_responder, padding, NULL);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "maxPoolSize", 2);
+   mongoc_uri_set_option_as_int32 (uri, "socketTimeoutMS", 10000);
+   pool = mongoc_client_pool_new (uri);
+   mongoc_client_pool_set_ssl_opts (pool, &client_opts);
+   async_client = mongoc_async_client_new (pool);
+
+   for (i = 0; i < N_OPS; i++) {
+      mongoc_async_client_command (async_client,
+                                   "db",
+                                   tmp_bson ("{'echo': %d}", i),
+                                   NULL,
+                                   _op_cb,
+                                   &results[i]);
+   }
+
+   mongoc_async_client_run (async_client);
+
+   for (i = 0; i < N_OPS; i++) {
+      ASSERT (results[i].called);
+      ASSERT_OR_PRINT (results[i].success, results[i].error);
+      ASSERT_CMPINT (results[i].n, ==, i);
+   }
+
+   mongoc_async_client_destroy (async_client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+   bson_free (padding);
+}
+#endif
+
+
+/* one createIndexes command per collection, run concurrently */
+static void
+test_async_client_create_indexes (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_async_client_t *async_client;
+   const bson_t *models[2];
+   op_result_t results[N_OPS] = {{0}};
+   op_result_t invalid = {0};
+   char *collection_name;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_autoresponds (server, _echo_responder, NULL, NULL);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "maxPoolSize", 4);
+   pool = mongoc_client_pool_new (uri);
+   async_client = mongoc_async_client_new (pool);
+
+   models[0] = tmp_bson ("{'key': {'a': 1}}");
+   models[1] = tmp_bson ("{'key': {'b': 1}, 'name': 'b'}");
+
+   for (i = 0; i < N_OPS; i++) {
+      collection_name = bson_strdup_printf ("collection%d", i);
+      mongoc_async_client_create_indexes (async_client,
+                                          "db",
+                                          collection_name,
+                                          models,
+                                          2,
+                                          _op_cb,
+                                          &results[i]);
+      bson_free (collection_name);
+   }
+
+   /* an invalid spec is reported through the callback */
+   models[1] = tmp_bson ("{'name': 'b'}");
+   mongoc_async_client_create_indexes (
+      async_client, "db", "collection", models, 2, _op_cb, &invalid);
+
+   mongoc_async_client_run (async_client);
+
+   for (i = 0; i < N_OPS; i++) {
+      ASSERT (results[i].called);
+      ASSERT (results[i].success);
+   }
+
+   ASSERT (invalid.called);
+   ASSERT (!invalid.success);
+   ASSERT_ERROR_CONTAINS (invalid.error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "no \"key\" document");
+
+   mongoc_async_client_destroy (async_client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+typedef struct {
+   mongoc_mutex_t mutex;
+   request_t *request;
+} hang_t;
+
+
+/* keep the request without replying */
+static bool
+_hang_responder (request_t *request, void *data)
+{
+   hang_t *hang = (hang_t *) data;
+
+   if (!strcmp (request->command_name, "hang")) {
+      mongoc_mutex_lock (&hang->mutex);
+      hang->request = request;
+      mongoc_mutex_unlock (&hang->mutex);
+      return true;
+   }
+
+   return false;
+}
+
+
+static bool
+_hung (hang_t *hang)
+{
+   bool ret;
+
+   mongoc_mutex_lock (&hang->mutex);
+   ret = hang->request != NULL;
+   mongoc_mutex_unlock (&hang->mutex);
+
+   return ret;
+}
+
+
+/* destroying the async client calls back for operations in progress */
+static void
+test_async_client_destroy_cancels (void)
+{
+   mock_server_t *server;
+   mongoc_client_pool_t *pool;
+   mongoc_async_client_t *async_client;
+   op_result_t result = {0};
+   hang_t hang = {0};
+
+   mongoc_mutex_init (&hang.mutex);
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_autoresponds (server, _hang_responder, &hang, NULL);
+   mock_server_run (server);
+   pool = mongoc_client_pool_new (mock_server_get_uri (server));
+   async_client = mongoc_async_client_new (pool);
+
+   mongoc_async_client_command (
+      async_client, "db", tmp_bson ("{'hang': 1}"), NULL, _op_cb, &result);
+
+   /* connect and send the command, which gets no reply */
+   while (!_hung (&hang)) {
+      ASSERT_CMPSIZE_T (
+         mongoc_async_client_run_once (async_client, 10), ==, (size_t) 1);
+   }
+
+   ASSERT (!result.called);
+
+   mongoc_async_client_destroy (async_client);
+   ASSERT (result.called);
+   ASSERT (!result.success);
+   ASSERT_ERROR_CONTAINS (result.error,
+                          MONGOC_ERROR_CLIENT,
+                          MONGOC_ERROR_CLIENT_OPERATION_CANCELED,
+                          "destroyed");
+
+   request_destroy (hang.request);
+   mongoc_client_pool_destroy (pool);
+   mock_server_destroy (server);
+   mongoc_mutex_destroy (&hang.mutex);
+}
+
+
+void
+test_async_client_install (TestSuite *suite)
+{
+   TestSuite_AddMockServerTest (
+      suite, "/AsyncClient/commands", test_async_client_commands);
+#ifndef _WIN32
+   TestSuite_AddMockServerTest (
+      suite, "/AsyncClient/external_loop", test_async_client_external_loop);
+#endif
+#ifdef MONGOC_ENABLE_SSL_OPENSSL
+   TestSuite_AddMockServerTest (suite,
+                                "/AsyncClient/tls_large_reply",
+                                test_async_client_tls_large_reply);
+#endif
+   TestSuite_AddMockServerTest (
+      suite, "/AsyncClient/create_indexes", test_async_client_create_indexes);
+   TestSuite_AddMockServerTest (
+      suite, "/AsyncClient/destroy_cancels", test_async_client_destroy_cancels);
+}
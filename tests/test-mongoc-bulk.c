@@ -376,6 +376,215 @@ test_insert (bool ordered)
 }
 
 
+static void
+test_insert_steal (void)
+{
+   mongoc_bulk_operation_t *bulk;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_write_command_t *command;
+   bson_error_t error;
+   bson_t reply;
+   bson_t *doc;
+   char *big;
+   const bson_t *found;
+   mongoc_cursor_t *cursor;
+   bson_t *query;
+
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "test_insert_steal");
+   bulk = mongoc_collection_create_bulk_operation (collection, true, NULL);
+
+   big = bson_malloc (MONGOC_WRITE_COMMAND_BORROW_MIN + 1);
+   memset (big, 'a', MONGOC_WRITE_COMMAND_BORROW_MIN);
+   big[MONGOC_WRITE_COMMAND_BORROW_MIN] = '\0';
+
+   /* small, copied */
+   doc = BCON_NEW ("_id", BCON_INT32 (0));
+   ASSERT_OR_PRINT (
+      mongoc_bulk_operation_insert_steal (bulk, doc, NULL, &error), error);
+   /* big, kept */
+   doc = BCON_NEW ("_id", BCON_INT32 (1), "s", big);
+   ASSERT_OR_PRINT (
+      mongoc_bulk_operation_insert_steal (bulk, doc, NULL, &error), error);
+   /* big without _id, replaced by a copy with one and kept */
+   doc = BCON_NEW ("s", big);
+   ASSERT_OR_PRINT (
+      mongoc_bulk_operation_insert_steal (bulk, doc, NULL, &error), error);
+   /* copied after documents were kept */
+   ASSERT_OR_PRINT (mongoc_bulk_operation_insert_with_opts (
+                       bulk, tmp_bson ("{'_id': 3}"), NULL, &error),
+                    error);
+
+   /* rejected, and destroyed anyway */
+   doc = BCON_NEW ("$bad", BCON_INT32 (1));
+   BSON_ASSERT (
+      !mongoc_bulk_operation_insert_steal (bulk, doc, NULL, &error));
+
+   ASSERT_CMPSIZE_T (bulk->commands.len, ==, (size_t) 1);
+   command = &_mongoc_array_index (&bulk->commands, mongoc_write_command_t, 0);
+   ASSERT_CMPUINT32 (command->n_documents, ==, (uint32_t) 4);
+   ASSERT_CMPSIZE_T (command->docs.len, ==, (size_t) 4);
+   ASSERT_CMPSIZE_T (command->owned.len, ==, (size_t) 2);
+
+   ASSERT_OR_PRINT (mongoc_bulk_operation_execute (bulk, &reply, &error),
+                    error);
+   ASSERT_MATCH (&reply, "{'nInserted': 4}");
+   bson_destroy (&reply);
+   ASSERT_COUNT (4, collection);
+
+   query = BCON_NEW ("_id", BCON_INT32 (1));
+   cursor = mongoc_collection_find_with_opts (collection, query, NULL, NULL);
+   BSON_ASSERT (mongoc_cursor_next (cursor, &found));
+   ASSERT_CMPSTR (bson_lookup_utf8 (found, "s"), big);
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+
+   mongoc_cursor_destroy (cursor);
+   bson_destroy (query);
+   bson_free (big);
+   mongoc_bulk_operation_destroy (bulk);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_insert_raw (void)
+{
+   mongoc_bulk_operation_t *bulk;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_write_command_t *command;
+   const mongoc_write_doc_t *doc;
+   bson_error_t error;
+   bson_t reply;
+   bson_t *docs[3];
+   uint8_t *data;
+   size_t len = 0;
+   int i;
+
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "test_insert_raw");
+   bulk = mongoc_collection_create_bulk_operation (collection, false, NULL);
+
+   /* "_id" first, "_id" later, and none: documents end to end */
+   docs[0] = BCON_NEW ("_id", BCON_INT32 (0));
+   docs[1] = BCON_NEW ("x", BCON_INT32 (1), "_id", BCON_INT32 (1));
+   docs[2] = BCON_NEW ("x", BCON_INT32 (2));
+   data = bson_malloc (docs[0]->len + docs[1]->len + docs[2]->len);
+   for (i = 0; i < 3; i++) {
+      memcpy (data + len, bson_get_data (docs[i]), docs[i]->len);
+      len += docs[i]->len;
+   }
+
+   /* a truncated run queues nothing */
+   BSON_ASSERT (
+      !mongoc_bulk_operation_insert_raw (bulk, data, len - 1, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_BSON,
+                          MONGOC_ERROR_BSON_INVALID,
+                          "Invalid document at byte");
+   ASSERT_CMPSIZE_T (bulk->commands.len, ==, (size_t) 0);
+
+   ASSERT_OR_PRINT (
+      mongoc_bulk_operation_insert_raw (bulk, data, len, &error), error);
+
+   /* the first is sent from @data, however small; the third gets an _id */
+   command = &_mongoc_array_index (&bulk->commands, mongoc_write_command_t, 0);
+   ASSERT_CMPUINT32 (command->n_documents, ==, (uint32_t) 3);
+   ASSERT_CMPSIZE_T (command->docs.len, ==, (size_t) 3);
+   doc = &_mongoc_array_index (&command->docs, mongoc_write_doc_t, 0);
+   BSON_ASSERT (doc->data == data);
+   ASSERT_CMPSIZE_T (command->owned.len, ==, (size_t) 0);
+
+   ASSERT_OR_PRINT (mongoc_bulk_operation_execute (bulk, &reply, &error),
+                    error);
+   ASSERT_MATCH (&reply, "{'nInserted': 3}");
+   ASSERT_COUNT (3, collection);
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+
+   bson_destroy (&reply);
+   mongoc_bulk_operation_destroy (bulk);
+   bson_free (data);
+   for (i = 0; i < 3; i++) {
+      bson_destroy (docs[i]);
+   }
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_coalesce_updates (void)
+{
+   mongoc_bulk_operation_t *bulk;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_write_command_t *command;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t reply;
+   bson_t *sets[6];
+   int ids[6] = {1, 2, 1, 1, 1, 1};
+   int i;
+
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "test_coalesce_updates");
+   bulk = mongoc_collection_create_bulk_operation (collection, false, NULL);
+   mongoc_bulk_operation_set_coalesce_updates (bulk, true);
+
+   sets[0] = BCON_NEW ("$set", "{", "a", BCON_INT32 (1), "}");
+   sets[1] = BCON_NEW ("$set", "{", "a", BCON_INT32 (1), "}");
+   sets[2] = BCON_NEW ("$set", "{", "b", BCON_INT32 (2), "}");
+   sets[3] = BCON_NEW ("$set", "{", "a", BCON_INT32 (3), "}");
+   sets[4] = BCON_NEW ("$set", "{", "c.d", BCON_INT32 (4), "}");
+   /* "c" overlaps "c.d": ends the run */
+   sets[5] = BCON_NEW ("$set", "{", "c", BCON_INT32 (5), "}");
+
+   for (i = 0; i < 6; i++) {
+      ASSERT_OR_PRINT (mongoc_bulk_operation_update_one_with_opts (
+                          bulk,
+                          tmp_bson ("{'_id': %d}", ids[i]),
+                          sets[i],
+                          tmp_bson ("{'upsert': true}"),
+                          &error),
+                       error);
+   }
+
+   ASSERT_OR_PRINT (mongoc_bulk_operation_execute (bulk, &reply, &error),
+                    error);
+
+   /* {_id: 1} with a, b and c.d, {_id: 2}, then {_id: 1} with c */
+   command = &_mongoc_array_index (&bulk->commands, mongoc_write_command_t, 0);
+   ASSERT_CMPUINT32 (command->n_documents, ==, (uint32_t) 3);
+   ASSERT_MATCH (&reply, "{'nUpserted': 2, 'nMatched': 1}");
+
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson (NULL), tmp_bson ("{'sort': {'_id': 1}}"), NULL);
+   ASSERT_CURSOR_NEXT (cursor, &doc);
+   ASSERT_MATCH (doc, "{'_id': 1, 'a': 3, 'b': 2, 'c': 5}");
+   ASSERT_CURSOR_NEXT (cursor, &doc);
+   ASSERT_MATCH (doc, "{'_id': 2, 'a': 1}");
+   ASSERT_CURSOR_DONE (cursor);
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+
+   mongoc_cursor_destroy (cursor);
+   bson_destroy (&reply);
+   for (i = 0; i < 6; i++) {
+      bson_destroy (sets[i]);
+   }
+
+   mongoc_bulk_operation_destroy (bulk);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
 static void
 test_insert_ordered (void)
 {
@@ -3552,6 +3761,285 @@ test_bulk_reply_w0 (void)
    mongoc_client_destroy (client);
 }
 
+
+/* unacknowledged OP_MSG writes set moreToCome and read no reply */
+static void
+test_bulk_w0_more_to_come (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_write_concern_t *wc;
+   mongoc_bulk_operation_t *bulk;
+   mongoc_apm_callbacks_t *callbacks;
+   stats_t stats = {0};
+   bson_error_t error;
+   bson_t reply;
+   int i;
+
+   if (!test_framework_max_wire_version_at_least (WIRE_VERSION_OP_MSG)) {
+      return;
+   }
+
+   client = test_framework_client_new ();
+   callbacks = mongoc_apm_callbacks_new ();
+   mongoc_apm_set_command_succeeded_cb (callbacks, command_succeeded);
+   mongoc_client_set_apm_callbacks (client, callbacks, (void *) &stats);
+   collection = get_test_collection (client, "test_w0_more_to_come");
+   wc = mongoc_write_concern_new ();
+   mongoc_write_concern_set_w (wc, 0);
+   bulk = mongoc_collection_create_bulk_operation (collection, true, wc);
+   for (i = 0; i < 100; i++) {
+      mongoc_bulk_operation_insert (bulk, tmp_bson ("{'_id': %d}", i));
+   }
+
+   ASSERT_OR_PRINT (mongoc_bulk_operation_execute (bulk, &reply, &error),
+                    error);
+   ASSERT (bson_empty (&reply));
+   ASSERT_CMPINT (stats.succeeded, ==, 1);
+
+   /* the server runs the inserts before the next command on the socket */
+   ASSERT_COUNT (100, collection);
+
+   bson_destroy (&reply);
+   mongoc_bulk_operation_destroy (bulk);
+   mongoc_write_concern_destroy (wc);
+   mongoc_collection_drop (collection, NULL);
+   mongoc_collection_destroy (collection);
+   mongoc_apm_callbacks_destroy (callbacks);
+   mongoc_client_destroy (client);
+}
+
+
+/* unordered batches sent on several pooled clients merge like serial ones */
+static void
+test_bulk_concurrency (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_bulk_operation_t *bulk;
+   bson_error_t error;
+   bson_t reply;
+   char key[64];
+   int g;
+   int j;
+
+   pool = test_framework_client_pool_new ();
+   client = mongoc_client_pool_pop (pool);
+   collection = get_test_collection (client, "test_bulk_concurrency");
+   ASSERT_OR_PRINT (mongoc_collection_insert (collection,
+                                              MONGOC_INSERT_NONE,
+                                              tmp_bson ("{'_id': 32}"),
+                                              NULL,
+                                              &error),
+                    error);
+
+   /* alternate inserts and upserts, so each group is its own batch. the
+    * insert of _id 32, at index 20, fails */
+   bulk = mongoc_collection_create_bulk_operation (collection, false, NULL);
+   mongoc_bulk_operation_set_concurrency (bulk, pool, 4);
+   for (g = 0; g < 10; g++) {
+      for (j = 0; j < 5; j++) {
+         mongoc_bulk_operation_insert (bulk,
+                                       tmp_bson ("{'_id': %d}", g * 10 + j));
+      }
+
+      mongoc_bulk_operation_update_one (bulk,
+                                        tmp_bson ("{'_id': %d}", 1000 + g),
+                                        tmp_bson ("{'$set': {'x': 1}}"),
+                                        true /* upsert */);
+   }
+
+   ASSERT (!mongoc_bulk_operation_execute (bulk, &reply, &error));
+   ASSERT_CMPINT (error.code, ==, 11000);
+
+   ASSERT_MATCH (&reply,
+                 "{'nInserted': 49,"
+                 " 'nMatched':  0,"
+                 " 'nModified': 0,"
+                 " 'nRemoved':  0,"
+                 " 'nUpserted': 10,"
+                 " 'writeErrors': [{'index': 20, 'code': 11000}]}");
+   ASSERT (!bson_has_field (&reply, "writeErrors.1"));
+
+   for (g = 0; g < 10; g++) {
+      bson_snprintf (key, sizeof key, "upserted.%d.index", g);
+      ASSERT_CMPINT32 (bson_lookup_int32 (&reply, key), ==, g * 6 + 5);
+      bson_snprintf (key, sizeof key, "upserted.%d._id", g);
+      ASSERT_CMPINT32 (bson_lookup_int32 (&reply, key), ==, 1000 + g);
+   }
+
+   ASSERT_COUNT (60, collection);
+
+   bson_destroy (&reply);
+   mongoc_bulk_operation_destroy (bulk);
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+/* a writer sends full batches as it goes, and finish reports them all */
+static void
+test_bulk_writer (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_bulk_writer_t *writer;
+   bson_error_t error;
+   bson_t reply;
+   int i;
+
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "test_bulk_writer");
+   ASSERT_OR_PRINT (mongoc_collection_insert (collection,
+                                              MONGOC_INSERT_NONE,
+                                              tmp_bson ("{'_id': 32}"),
+                                              NULL,
+                                              &error),
+                    error);
+
+   writer = mongoc_bulk_writer_new (collection, false /* ordered */);
+   mongoc_bulk_writer_set_max_batch (writer, 7, 0);
+   for (i = 0; i < 50; i++) {
+      ASSERT_OR_PRINT (mongoc_bulk_writer_insert (
+                          writer, tmp_bson ("{'_id': %d}", i), NULL, &error),
+                       error);
+
+      if (i == 6) {
+         /* the first batch is sent as soon as it is full */
+         ASSERT_COUNT (8, collection);
+      }
+   }
+
+   ASSERT_OR_PRINT (
+      mongoc_bulk_writer_remove_one (
+         writer, tmp_bson ("{'_id': 0}"), NULL, &error),
+      error);
+
+   ASSERT (!mongoc_bulk_writer_finish (writer, &reply, &error));
+   ASSERT_CMPINT (error.code, ==, 11000);
+   ASSERT_MATCH (&reply,
+                 "{'nInserted': 49,"
+                 " 'nRemoved':  1,"
+                 " 'writeErrors': [{'index': 32, 'code': 11000}]}");
+   ASSERT (!bson_has_field (&reply, "writeErrors.1"));
+   ASSERT_COUNT (49, collection);
+   bson_destroy (&reply);
+
+   ASSERT (!mongoc_bulk_writer_insert (
+      writer, tmp_bson ("{'_id': 100}"), NULL, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Cannot add operations to a finished bulk writer");
+
+   mongoc_bulk_writer_destroy (writer);
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+/* an ordered writer refuses operations after a batch fails */
+static void
+test_bulk_writer_ordered (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_bulk_writer_t *writer;
+   bson_error_t error;
+   bson_t reply;
+
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "test_bulk_writer_ordered");
+   ASSERT_OR_PRINT (mongoc_collection_insert (collection,
+                                              MONGOC_INSERT_NONE,
+                                              tmp_bson ("{'_id': 1}"),
+                                              NULL,
+                                              &error),
+                    error);
+
+   writer = mongoc_bulk_writer_new (collection, true /* ordered */);
+   mongoc_bulk_writer_set_max_batch (writer, 2, 0);
+   ASSERT_OR_PRINT (mongoc_bulk_writer_insert (
+                       writer, tmp_bson ("{'_id': 0}"), NULL, &error),
+                    error);
+   /* fills the batch, which fails */
+   ASSERT_OR_PRINT (mongoc_bulk_writer_insert (
+                       writer, tmp_bson ("{'_id': 1}"), NULL, &error),
+                    error);
+   ASSERT (!mongoc_bulk_writer_insert (
+      writer, tmp_bson ("{'_id': 2}"), NULL, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Bulk writer is stopped from prior error");
+
+   ASSERT (!mongoc_bulk_writer_finish (writer, &reply, &error));
+   ASSERT_MATCH (&reply,
+                 "{'nInserted': 1,"
+                 " 'writeErrors': [{'index': 1, 'code': 11000}]}");
+   ASSERT_COUNT (2, collection);
+
+   bson_destroy (&reply);
+   mongoc_bulk_writer_destroy (writer);
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+/* batches sent from pooled clients in the background merge like serial
+ * ones, with indexes into the whole stream */
+static void
+test_bulk_writer_pool (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_bulk_writer_t *writer;
+   bson_error_t error;
+   bson_t reply;
+   int i;
+
+   pool = test_framework_client_pool_new ();
+   client = mongoc_client_pool_pop (pool);
+   collection = get_test_collection (client, "test_bulk_writer_pool");
+   ASSERT_OR_PRINT (mongoc_collection_insert (collection,
+                                              MONGOC_INSERT_NONE,
+                                              tmp_bson ("{'_id': 57}"),
+                                              NULL,
+                                              &error),
+                    error);
+
+   writer = mongoc_bulk_writer_new (collection, false /* ordered */);
+   mongoc_bulk_writer_set_max_batch (writer, 10, 0);
+   mongoc_bulk_writer_set_pool (writer, pool, 3);
+   for (i = 0; i < 100; i++) {
+      ASSERT_OR_PRINT (mongoc_bulk_writer_insert (
+                          writer, tmp_bson ("{'_id': %d}", i), NULL, &error),
+                       error);
+   }
+
+   ASSERT (!mongoc_bulk_writer_finish (writer, &reply, &error));
+   ASSERT_CMPINT (error.code, ==, 11000);
+   ASSERT_MATCH (&reply,
+                 "{'nInserted': 99,"
+                 " 'writeErrors': [{'index': 57, 'code': 11000}]}");
+   ASSERT (!bson_has_field (&reply, "writeErrors.1"));
+   ASSERT_COUNT (100, collection);
+
+   bson_destroy (&reply);
+   mongoc_bulk_writer_destroy (writer);
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+}
+
+
 typedef enum {
    BULK_REMOVE,
    BULK_REMOVE_ONE,
@@ -3887,6 +4375,66 @@ test_bulk_update_one_error_message (void)
 }
 
 
+static void
+test_bulk_validate_opt (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_bulk_operation_t *bulk;
+   bson_t *doc = tmp_bson ("{'$dollar': 1}");
+   bson_error_t error;
+
+   client = mongoc_client_new ("mongodb://server");
+   collection = mongoc_client_get_collection (client, "test", "test");
+   ASSERT_CMPINT (mongoc_collection_get_validate_flags (collection),
+                  ==,
+                  _mongoc_insert_vflags);
+
+   bulk = mongoc_collection_create_bulk_operation (collection, true, NULL);
+   ASSERT (!mongoc_bulk_operation_insert_with_opts (bulk, doc, NULL, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "keys cannot begin with \"$\"");
+   mongoc_bulk_operation_destroy (bulk);
+
+   /* per-document override */
+   bulk = mongoc_collection_create_bulk_operation (collection, true, NULL);
+   ASSERT_OR_PRINT (mongoc_bulk_operation_insert_with_opts (
+                       bulk, doc, tmp_bson ("{'validate': false}"), &error),
+                    error);
+   ASSERT_OR_PRINT (
+      mongoc_bulk_operation_replace_one_with_opts (bulk,
+                                                   tmp_bson ("{'_id': 1}"),
+                                                   doc,
+                                                   tmp_bson ("{'validate': 0}"),
+                                                   &error),
+      error);
+   ASSERT (!mongoc_bulk_operation_insert_with_opts (
+      bulk, doc, tmp_bson ("{'validate': 'foo'}"), &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Invalid option \"validate\"");
+   mongoc_bulk_operation_destroy (bulk);
+
+   /* collection-wide setting, inherited by new bulk operations */
+   mongoc_collection_set_validate_flags (collection, BSON_VALIDATE_NONE);
+   bulk = mongoc_collection_create_bulk_operation (collection, true, NULL);
+   ASSERT_OR_PRINT (
+      mongoc_bulk_operation_insert_with_opts (bulk, doc, NULL, &error), error);
+   ASSERT (!mongoc_bulk_operation_insert_with_opts (
+      bulk,
+      doc,
+      tmp_bson ("{'validate': %d}", (int) BSON_VALIDATE_DOLLAR_KEYS),
+      &error));
+   mongoc_bulk_operation_destroy (bulk);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
 void
 test_bulk_install (TestSuite *suite)
 {
@@ -3900,6 +4448,10 @@ test_bulk_install (TestSuite *suite)
       suite, "/BulkOperation/insert_unordered", test_insert_unordered);
    TestSuite_AddLive (
       suite, "/BulkOperation/insert_check_keys", test_insert_check_keys);
+   TestSuite_AddLive (suite, "/BulkOperation/insert_steal", test_insert_steal);
+   TestSuite_AddLive (suite, "/BulkOperation/insert_raw", test_insert_raw);
+   TestSuite_AddLive (
+      suite, "/BulkOperation/coalesce_updates", test_coalesce_updates);
    TestSuite_AddLive (
       suite, "/BulkOperation/update_ordered", test_update_ordered);
    TestSuite_AddLive (
@@ -4114,6 +4666,15 @@ test_bulk_install (TestSuite *suite)
                                 "/BulkOperation/hint/pooled/command/primary",
                                 test_hint_pooled_command_primary);
    TestSuite_AddLive (suite, "/BulkOperation/reply_w0", test_bulk_reply_w0);
+   TestSuite_AddLive (
+      suite, "/BulkOperation/w0/more_to_come", test_bulk_w0_more_to_come);
+   TestSuite_AddLive (
+      suite, "/BulkOperation/concurrency", test_bulk_concurrency);
+   TestSuite_AddLive (suite, "/BulkOperation/writer", test_bulk_writer);
+   TestSuite_AddLive (
+      suite, "/BulkOperation/writer/ordered", test_bulk_writer_ordered);
+   TestSuite_AddLive (
+      suite, "/BulkOperation/writer/pool", test_bulk_writer_pool);
    TestSuite_AddMockServerTest (suite,
                                 "/BulkOperation/opts/collation/w0/wire5",
                                 test_bulk_collation_w0_wire5);
@@ -4141,4 +4702,6 @@ test_bulk_install (TestSuite *suite)
    TestSuite_Add (suite,
                   "/BulkOperation/update_one/error_message",
                   test_bulk_update_one_error_message);
+   TestSuite_Add (
+      suite, "/BulkOperation/validate_opt", test_bulk_validate_opt);
 }
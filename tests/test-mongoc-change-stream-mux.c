@@ -0,0 +1,124 @@
+#include <mongoc.h>
+
+#include "mongoc-change-stream-private.h"
+
+#include "TestSuite.h"
+#include "test-conveniences.h"
+#include "test-libmongoc.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "change-stream-mux-test"
+
+
+typedef struct {
+   int n_events;
+   bson_t last_event;
+} subscriber_t;
+
+
+static void
+subscriber_cb (const bson_t *event, void *context)
+{
+   subscriber_t *subscriber = (subscriber_t *) context;
+
+   subscriber->n_events++;
+   bson_destroy (&subscriber->last_event);
+   bson_copy_to (event, &subscriber->last_event);
+}
+
+
+static void
+test_change_stream_mux_dispatch (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_change_stream_mux_t *mux;
+   subscriber_t all = {0};
+   subscriber_t inserts = {0};
+   uint32_t all_id;
+   uint32_t inserts_id;
+   bson_error_t error;
+
+   bson_init (&all.last_event);
+   bson_init (&inserts.last_event);
+
+   client = mongoc_client_new ("mongodb://localhost");
+   collection = mongoc_client_get_collection (client, "db", "collection");
+   mux = mongoc_change_stream_mux_new (collection, NULL, NULL);
+
+   all_id = mongoc_change_stream_mux_subscribe (
+      mux, NULL, subscriber_cb, &all, &error);
+   ASSERT_OR_PRINT (all_id, error);
+   inserts_id = mongoc_change_stream_mux_subscribe (
+      mux,
+      tmp_bson ("{'operationType': 'insert'}"),
+      subscriber_cb,
+      &inserts,
+      &error);
+   ASSERT_OR_PRINT (inserts_id, error);
+   ASSERT_CMPUINT32 (all_id, !=, inserts_id);
+
+   _mongoc_change_stream_mux_dispatch (
+      mux, tmp_bson ("{'_id': {'token': 1}, 'operationType': 'insert'}"));
+   _mongoc_change_stream_mux_dispatch (
+      mux, tmp_bson ("{'_id': {'token': 2}, 'operationType': 'delete'}"));
+
+   ASSERT_CMPINT (all.n_events, ==, 2);
+   ASSERT_MATCH (&all.last_event, "{'operationType': 'delete'}");
+   ASSERT_CMPINT (inserts.n_events, ==, 1);
+   ASSERT_MATCH (&inserts.last_event, "{'_id': {'token': 1}}");
+
+   /* unsubscribed callbacks get no more events */
+   BSON_ASSERT (mongoc_change_stream_mux_unsubscribe (mux, inserts_id));
+   BSON_ASSERT (!mongoc_change_stream_mux_unsubscribe (mux, inserts_id));
+   _mongoc_change_stream_mux_dispatch (
+      mux, tmp_bson ("{'_id': {'token': 3}, 'operationType': 'insert'}"));
+
+   ASSERT_CMPINT (all.n_events, ==, 3);
+   ASSERT_CMPINT (inserts.n_events, ==, 1);
+
+   mongoc_change_stream_mux_destroy (mux);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   bson_destroy (&all.last_event);
+   bson_destroy (&inserts.last_event);
+}
+
+
+static void
+test_change_stream_mux_bad_filter (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_change_stream_mux_t *mux;
+   subscriber_t subscriber = {0};
+   bson_error_t error;
+
+   client = mongoc_client_new ("mongodb://localhost");
+   collection = mongoc_client_get_collection (client, "db", "collection");
+   mux = mongoc_change_stream_mux_new (collection, NULL, NULL);
+
+   ASSERT_CMPUINT32 (
+      mongoc_change_stream_mux_subscribe (mux,
+                                          tmp_bson ("{'x': {'$bad': 1}}"),
+                                          subscriber_cb,
+                                          &subscriber,
+                                          &error),
+      ==,
+      (uint32_t) 0);
+   ASSERT_CMPINT (error.domain, ==, MONGOC_ERROR_MATCHER);
+
+   mongoc_change_stream_mux_destroy (mux);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+void
+test_change_stream_mux_install (TestSuite *suite)
+{
+   TestSuite_Add (
+      suite, "/ChangeStreamMux/dispatch", test_change_stream_mux_dispatch);
+   TestSuite_Add (
+      suite, "/ChangeStreamMux/bad_filter", test_change_stream_mux_bad_filter);
+}
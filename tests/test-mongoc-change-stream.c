@@ -0,0 +1,167 @@
+#include <mongoc.h>
+
+#include "mongoc-client-private.h"
+#include "mongoc-thread-private.h"
+
+#include "TestSuite.h"
+#include "test-conveniences.h"
+#include "test-libmongoc.h"
+#include "mock_server/mock-server.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "change-stream-test"
+
+
+typedef struct {
+   mongoc_change_stream_t *stream;
+   const bson_t *events;
+   size_t n_events;
+   bool ret;
+} next_batch_t;
+
+
+static void *
+next_batch_thread (void *data)
+{
+   next_batch_t *next_batch = (next_batch_t *) data;
+
+   next_batch->ret = mongoc_change_stream_next_batch (
+      next_batch->stream, &next_batch->events, &next_batch->n_events);
+
+   return NULL;
+}
+
+
+/* the events of one reply are returned at once, and after a network error
+ * the stream resumes after the last of them */
+static void
+test_change_stream_next_batch_resume (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   next_batch_t next_batch = {0};
+   mongoc_thread_t thread;
+   request_t *request;
+   bson_error_t error;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "collection");
+   next_batch.stream = mongoc_collection_watch (
+      collection, tmp_bson ("[]"), tmp_bson ("{'maxAwaitTimeMS': 1000}"));
+
+   mongoc_thread_create (&thread, next_batch_thread, &next_batch);
+   request = mock_server_receives_request (server);
+   ASSERT_MATCH (request_get_doc (request, 0),
+                 "{'aggregate': 'collection',"
+                 " 'pipeline': [{'$changeStream': {"
+                 "    'fullDocument': 'default',"
+                 "    'resumeAfter': {'$exists': false}}}],"
+                 " 'tailable': {'$exists': false},"
+                 " 'awaitData': {'$exists': false}}");
+   mock_server_replies_simple (request,
+                               "{'ok': 1, 'cursor': {"
+                               "   'id': {'$numberLong': '123'},"
+                               "   'ns': 'db.collection',"
+                               "   'firstBatch': ["
+                               "      {'_id': {'t': 1}, 'x': 1},"
+                               "      {'_id': {'t': 2}, 'x': 2}]}}");
+   mongoc_thread_join (thread);
+   request_destroy (request);
+
+   BSON_ASSERT (next_batch.ret);
+   ASSERT_CMPSIZE_T (next_batch.n_events, ==, (size_t) 2);
+   ASSERT_MATCH (&next_batch.events[0], "{'x': 1}");
+   ASSERT_MATCH (&next_batch.events[1], "{'x': 2}");
+
+   mongoc_thread_create (&thread, next_batch_thread, &next_batch);
+   request = mock_server_receives_request (server);
+   ASSERT_MATCH (request_get_doc (request, 0),
+                 "{'getMore': {'$numberLong': '123'},"
+                 " 'collection': 'collection',"
+                 " 'maxTimeMS': 1000}");
+   mock_server_hangs_up (request);
+   request_destroy (request);
+
+   request = mock_server_receives_request (server);
+   ASSERT_MATCH (request_get_doc (request, 0),
+                 "{'aggregate': 'collection',"
+                 " 'pipeline': [{'$changeStream': {"
+                 "    'resumeAfter': {'t': 2}}}]}");
+   mock_server_replies_simple (request,
+                               "{'ok': 1, 'cursor': {"
+                               "   'id': 0,"
+                               "   'ns': 'db.collection',"
+                               "   'firstBatch': ["
+                               "      {'_id': {'t': 3}, 'x': 3}]}}");
+   mongoc_thread_join (thread);
+   request_destroy (request);
+
+   BSON_ASSERT (next_batch.ret);
+   ASSERT_CMPSIZE_T (next_batch.n_events, ==, (size_t) 1);
+   ASSERT_MATCH (&next_batch.events[0], "{'x': 3}");
+   BSON_ASSERT (
+      !mongoc_change_stream_error_document (next_batch.stream, &error, NULL));
+
+   mongoc_change_stream_destroy (next_batch.stream);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
+static void
+test_change_stream_missing_resume_token (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   next_batch_t next_batch = {0};
+   mongoc_thread_t thread;
+   request_t *request;
+   bson_error_t error;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "collection");
+   next_batch.stream = mongoc_collection_watch (collection, NULL, NULL);
+
+   mongoc_thread_create (&thread, next_batch_thread, &next_batch);
+   request = mock_server_receives_request (server);
+   /* a $project stage removed the _id */
+   mock_server_replies_simple (request,
+                               "{'ok': 1, 'cursor': {"
+                               "   'id': 0,"
+                               "   'ns': 'db.collection',"
+                               "   'firstBatch': [{'x': 1}]}}");
+   mongoc_thread_join (thread);
+   request_destroy (request);
+
+   BSON_ASSERT (!next_batch.ret);
+   BSON_ASSERT (
+      mongoc_change_stream_error_document (next_batch.stream, &error, NULL));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "the resume token is missing");
+
+   mongoc_change_stream_destroy (next_batch.stream);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
+void
+test_change_stream_install (TestSuite *suite)
+{
+   TestSuite_AddMockServerTest (suite,
+                                "/ChangeStream/next_batch/resume",
+                                test_change_stream_next_batch_resume);
+   TestSuite_AddMockServerTest (suite,
+                                "/ChangeStream/missing_resume_token",
+                                test_change_stream_missing_resume_token);
+}
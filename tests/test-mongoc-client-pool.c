@@ -1,10 +1,22 @@
 #include <mongoc.h>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
 #include "mongoc-client-pool-private.h"
+#include "mongoc-client-private.h"
 #include "mongoc-array-private.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-util-private.h"
 
 
 #include "TestSuite.h"
 #include "test-libmongoc.h"
+#include "test-conveniences.h"
+#include "mock_server/future-functions.h"
+#include "mock_server/mock-rs.h"
+#include "mock_server/mock-server.h"
 
 
 static void
@@ -208,6 +220,539 @@ test_mongoc_client_pool_set_min_size (void)
    mongoc_client_pool_destroy (pool);
 }
 
+typedef struct {
+   mongoc_client_pool_t *pool;
+   int n_iterations;
+} pool_thread_ctx_t;
+
+
+static void *
+pool_pop_push_thread (void *data)
+{
+   pool_thread_ctx_t *ctx = (pool_thread_ctx_t *) data;
+   mongoc_client_t *client;
+   int i;
+
+   for (i = 0; i < ctx->n_iterations; i++) {
+      client = mongoc_client_pool_pop (ctx->pool);
+      BSON_ASSERT (client);
+      mongoc_client_pool_push (ctx->pool, client);
+   }
+
+   return NULL;
+}
+
+
+static void
+test_mongoc_client_pool_threads (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_uri_t *uri;
+   mongoc_thread_t threads[8];
+   pool_thread_ctx_t ctx;
+   int i;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1/?maxpoolsize=3");
+   pool = mongoc_client_pool_new (uri);
+   ctx.pool = pool;
+   ctx.n_iterations = 1000;
+
+   for (i = 0; i < 8; i++) {
+      mongoc_thread_create (&threads[i], pool_pop_push_thread, &ctx);
+   }
+
+   for (i = 0; i < 8; i++) {
+      mongoc_thread_join (threads[i]);
+   }
+
+   /* every client was returned, and the pool never grew past its max */
+   ASSERT_CMPSIZE_T (mongoc_client_pool_get_size (pool), <=, (size_t) 3);
+   ASSERT_CMPSIZE_T (mongoc_client_pool_num_pushed (pool),
+                     ==,
+                     mongoc_client_pool_get_size (pool));
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+
+static void
+test_mongoc_client_pool_wait_queue_timeout (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+   int64_t start;
+
+   uri = mongoc_uri_new (
+      "mongodb://127.0.0.1/?maxpoolsize=1&waitqueuetimeoutms=100");
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+   BSON_ASSERT (client);
+
+   start = bson_get_monotonic_time ();
+   BSON_ASSERT (!mongoc_client_pool_pop_with_error (pool, &error));
+   ASSERT_CMPINT64 (bson_get_monotonic_time () - start, >=, (int64_t) 50000);
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_CLIENT,
+                          MONGOC_ERROR_CLIENT_POOL_WAIT_TIMEOUT,
+                          "Timed out after 100ms");
+
+   /* still usable once a client is returned */
+   mongoc_client_pool_push (pool, client);
+   client = mongoc_client_pool_pop_with_error (pool, &error);
+   ASSERT_OR_PRINT (client, error);
+   mongoc_client_pool_push (pool, client);
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+
+
+static void
+test_mongoc_client_pool_stats (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_pool_stats_t stats;
+   mongoc_client_t *client;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+
+   uri = mongoc_uri_new (
+      "mongodb://127.0.0.1/?maxpoolsize=1&waitqueuetimeoutms=100");
+   pool = mongoc_client_pool_new (uri);
+
+   mongoc_client_pool_get_stats (pool, &stats);
+   ASSERT_CMPINT64 (stats.clients_created, ==, (int64_t) 0);
+   ASSERT_CMPINT64 (stats.waits, ==, (int64_t) 0);
+
+   client = mongoc_client_pool_pop (pool);
+   BSON_ASSERT (client);
+   mongoc_client_pool_get_stats (pool, &stats);
+   ASSERT_CMPINT64 (stats.clients_created, ==, (int64_t) 1);
+   ASSERT_CMPINT64 (stats.clients_in_use, ==, (int64_t) 1);
+   ASSERT_CMPINT64 (stats.clients_idle, ==, (int64_t) 0);
+
+   /* a timed-out wait counts */
+   BSON_ASSERT (!mongoc_client_pool_pop_with_error (pool, &error));
+   mongoc_client_pool_get_stats (pool, &stats);
+   ASSERT_CMPINT64 (stats.waiters, ==, (int64_t) 0);
+   ASSERT_CMPINT64 (stats.peak_waiters, ==, (int64_t) 1);
+   ASSERT_CMPINT64 (stats.waits, ==, (int64_t) 1);
+   ASSERT_CMPINT64 (stats.max_wait_time_msec, >=, (int64_t) 50);
+   ASSERT_CMPINT64 (stats.wait_time_msec, ==, stats.max_wait_time_msec);
+
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_get_stats (pool, &stats);
+   ASSERT_CMPINT64 (stats.clients_created, ==, (int64_t) 1);
+   ASSERT_CMPINT64 (stats.clients_destroyed, ==, (int64_t) 0);
+   ASSERT_CMPINT64 (stats.clients_in_use, ==, (int64_t) 0);
+   ASSERT_CMPINT64 (stats.clients_idle, ==, (int64_t) 1);
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+
+
+static void *
+pool_pop_thread (void *data)
+{
+   return mongoc_client_pool_pop ((mongoc_client_pool_t *) data);
+}
+
+
+static void
+test_mongoc_client_pool_wait_queue_multiple (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_uri_t *uri;
+   mongoc_thread_t thread;
+   bson_error_t error;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1/?maxpoolsize=1"
+                         "&waitqueuemultiple=1&waitqueuetimeoutms=10000");
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+   BSON_ASSERT (client);
+
+   /* one thread waits, filling the wait queue */
+   mongoc_thread_create (&thread, pool_pop_thread, pool);
+   _mongoc_usleep (100 * 1000);
+
+   BSON_ASSERT (!mongoc_client_pool_pop_with_error (pool, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_CLIENT,
+                          MONGOC_ERROR_CLIENT_POOL_WAIT_QUEUE_FULL,
+                          "Too many threads are already waiting");
+
+   /* wakes the waiting thread, which checks the client out */
+   mongoc_client_pool_push (pool, client);
+   mongoc_thread_join (thread);
+   mongoc_client_pool_push (pool, client);
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+
+
+typedef struct {
+   mongoc_client_pool_t *pool;
+   mongoc_client_pool_priority_t priority;
+   mongoc_client_t *client;
+} priority_pop_t;
+
+
+static void *
+pool_pop_priority_thread (void *data)
+{
+   priority_pop_t *pop = (priority_pop_t *) data;
+
+   pop->client =
+      mongoc_client_pool_pop_with_priority (pop->pool, pop->priority, NULL);
+
+   return NULL;
+}
+
+
+static void
+test_mongoc_client_pool_priority (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_client_t *client_high;
+   mongoc_uri_t *uri;
+   mongoc_thread_t thread;
+   mongoc_thread_t thread_high;
+   priority_pop_t pop = {0};
+   priority_pop_t pop_high = {0};
+   bson_error_t error;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1/?maxpoolsize=1"
+                         "&waitqueuetimeoutms=10000");
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+   BSON_ASSERT (client);
+
+   /* a normal-priority thread starts waiting first */
+   pop.pool = pool;
+   pop.priority = MONGOC_CLIENT_POOL_PRIORITY_NORMAL;
+   mongoc_thread_create (&thread, pool_pop_priority_thread, &pop);
+   _mongoc_usleep (100 * 1000);
+   pop_high.pool = pool;
+   pop_high.priority = MONGOC_CLIENT_POOL_PRIORITY_HIGH;
+   mongoc_thread_create (&thread_high, pool_pop_priority_thread, &pop_high);
+   _mongoc_usleep (100 * 1000);
+
+   /* the high-priority thread gets the client */
+   mongoc_client_pool_push (pool, client);
+   mongoc_thread_join (thread_high);
+   BSON_ASSERT (pop_high.client == client);
+
+   /* then the other */
+   mongoc_client_pool_push (pool, client);
+   mongoc_thread_join (thread);
+   BSON_ASSERT (pop.client == client);
+   mongoc_client_pool_push (pool, client);
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+
+   /* one of two clients is reserved for high priority */
+   uri = mongoc_uri_new ("mongodb://127.0.0.1/?maxpoolsize=2"
+                         "&reservedpoolsize=1&waitqueuetimeoutms=100");
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+   BSON_ASSERT (client);
+   BSON_ASSERT (!mongoc_client_pool_try_pop (pool));
+   BSON_ASSERT (!mongoc_client_pool_pop_with_error (pool, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_CLIENT,
+                          MONGOC_ERROR_CLIENT_POOL_WAIT_TIMEOUT,
+                          "Timed out after 100ms");
+
+   client_high = mongoc_client_pool_pop_with_priority (
+      pool, MONGOC_CLIENT_POOL_PRIORITY_HIGH, &error);
+   ASSERT_OR_PRINT (client_high, error);
+   mongoc_client_pool_push (pool, client_high);
+
+   /* with both clients idle, a normal pop may take one */
+   mongoc_client_pool_push (pool, client);
+   client = mongoc_client_pool_pop_with_error (pool, &error);
+   ASSERT_OR_PRINT (client, error);
+   mongoc_client_pool_push (pool, client);
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+
+
+/* clients pushed to one shard are found from any other */
+static void
+test_mongoc_client_pool_shards (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *clients[4];
+   mongoc_uri_t *uri;
+   mongoc_thread_t thread;
+   priority_pop_t pop = {0};
+   int i;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1/?maxpoolsize=4&poolshards=4");
+   pool = mongoc_client_pool_new (uri);
+
+   for (i = 0; i < 4; i++) {
+      clients[i] = mongoc_client_pool_pop (pool);
+      BSON_ASSERT (clients[i]);
+   }
+
+   for (i = 0; i < 4; i++) {
+      mongoc_client_pool_push (pool, clients[i]);
+   }
+
+   ASSERT_CMPSIZE_T (mongoc_client_pool_num_pushed (pool), ==, (size_t) 4);
+
+   /* another thread, likely with another home shard, steals one */
+   pop.pool = pool;
+   pop.priority = MONGOC_CLIENT_POOL_PRIORITY_NORMAL;
+   mongoc_thread_create (&thread, pool_pop_priority_thread, &pop);
+   mongoc_thread_join (thread);
+   BSON_ASSERT (pop.client);
+   mongoc_client_pool_push (pool, pop.client);
+
+   for (i = 0; i < 4; i++) {
+      clients[i] = mongoc_client_pool_try_pop (pool);
+      BSON_ASSERT (clients[i]);
+   }
+
+   BSON_ASSERT (!mongoc_client_pool_try_pop (pool));
+   ASSERT_CMPSIZE_T (mongoc_client_pool_get_size (pool), ==, (size_t) 4);
+
+   for (i = 0; i < 4; i++) {
+      mongoc_client_pool_push (pool, clients[i]);
+   }
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+
+
+static void
+test_mongoc_client_pool_warm (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *clients[2];
+   bson_error_t error;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "minPoolSize", 2);
+   pool = mongoc_client_pool_new (uri);
+
+   ASSERT_OR_PRINT (mongoc_client_pool_warm (pool, &error), error);
+   ASSERT_CMPSIZE_T (mongoc_client_pool_get_size (pool), ==, (size_t) 2);
+
+   /* each client is already connected to the server */
+   for (i = 0; i < 2; i++) {
+      clients[i] = mongoc_client_pool_pop (pool);
+      ASSERT_CMPSIZE_T (clients[i]->cluster.nodes->items_len, ==, (size_t) 1);
+   }
+
+   for (i = 0; i < 2; i++) {
+      mongoc_client_pool_push (pool, clients[i]);
+   }
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+#ifndef _WIN32
+/* a child resets the pool it inherited: its client reconnects, and the
+ * parent's connection is undisturbed */
+static void
+test_mongoc_client_pool_reset_after_fork (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   bson_error_t error;
+   pid_t pid;
+   int status;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "minPoolSize", 1);
+   pool = mongoc_client_pool_new (uri);
+
+   ASSERT_OR_PRINT (mongoc_client_pool_warm (pool, &error), error);
+
+   pid = fork ();
+   ASSERT_CMPINT ((int) pid, !=, -1);
+
+   if (pid == 0) {
+      mongoc_client_pool_reset_after_fork (pool);
+
+      client = mongoc_client_pool_pop (pool);
+      ASSERT_CMPSIZE_T (client->cluster.nodes->items_len, ==, (size_t) 0);
+      /* the server the parent discovered is still known */
+      ASSERT_CMPINT (
+         _mongoc_client_pool_get_topology (pool)->description.type,
+         ==,
+         MONGOC_TOPOLOGY_SINGLE);
+      mongoc_client_pool_push (pool, client);
+
+      ASSERT_OR_PRINT (mongoc_client_pool_warm (pool, &error), error);
+      client = mongoc_client_pool_pop (pool);
+      ASSERT_CMPSIZE_T (client->cluster.nodes->items_len, ==, (size_t) 1);
+      mongoc_client_pool_push (pool, client);
+
+      mongoc_client_pool_destroy (pool);
+      _exit (0);
+   }
+
+   ASSERT_CMPINT ((int) waitpid (pid, &status, 0), ==, (int) pid);
+   BSON_ASSERT (WIFEXITED (status));
+   ASSERT_CMPINT (WEXITSTATUS (status), ==, 0);
+
+   client = mongoc_client_pool_pop (pool);
+   ASSERT_CMPSIZE_T (client->cluster.nodes->items_len, ==, (size_t) 1);
+   mongoc_client_pool_push (pool, client);
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+#endif
+
+
+/* warming a pool runs the SCRAM conversation of each new connection in
+ * the same async loop as its isMaster */
+static void
+test_mongoc_client_pool_warm_auth (void *ctx)
+{
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *clients[2];
+   bson_error_t error;
+   int i;
+
+   uri = test_framework_get_uri ();
+   mongoc_uri_set_option_as_int32 (uri, "minPoolSize", 2);
+   pool = mongoc_client_pool_new (uri);
+   test_framework_set_pool_ssl_opts (pool);
+
+   ASSERT_OR_PRINT (mongoc_client_pool_warm (pool, &error), error);
+
+   for (i = 0; i < 2; i++) {
+      clients[i] = mongoc_client_pool_pop (pool);
+      ASSERT_CMPSIZE_T (clients[i]->cluster.nodes->items_len, >, (size_t) 0);
+      ASSERT_OR_PRINT (mongoc_client_command_simple (clients[i],
+                                                     "admin",
+                                                     tmp_bson ("{'ping': 1}"),
+                                                     NULL,
+                                                     NULL,
+                                                     &error),
+                       error);
+   }
+
+   for (i = 0; i < 2; i++) {
+      mongoc_client_pool_push (pool, clients[i]);
+   }
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+
+
+/* concurrent inserts from a pool's clients are sent as one command, and
+ * each caller gets its own document's write error */
+static void
+test_mongoc_client_pool_coalesce_inserts (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *clients[3];
+   mongoc_collection_t *collections[3];
+   bson_error_t errors[3];
+   future_t *futures[3];
+   request_t *request;
+   char *reply;
+   char key[32];
+   int dup = -1;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_WRITE_CMD);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   /* a long window, the group is sent once three documents join it */
+   mongoc_uri_set_option_as_int32 (uri, "coalesceInsertsMS", 60 * 1000);
+   mongoc_uri_set_option_as_int32 (uri, "coalesceInsertsMax", 3);
+   pool = mongoc_client_pool_new (uri);
+
+   for (i = 0; i < 3; i++) {
+      clients[i] = mongoc_client_pool_pop (pool);
+      collections[i] =
+         mongoc_client_get_collection (clients[i], "db", "collection");
+      futures[i] = future_collection_insert (collections[i],
+                                             MONGOC_INSERT_NONE,
+                                             tmp_bson ("{'_id': %d}", i),
+                                             NULL,
+                                             &errors[i]);
+   }
+
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'insert': 'collection', 'ordered': false,"
+      " 'documents': [{}, {}, {}]}",
+      NULL);
+
+   /* the documents are in the order the threads joined the group */
+   for (i = 0; i < 3; i++) {
+      bson_snprintf (key, sizeof key, "documents.%d._id", i);
+      if (bson_lookup_int32 (request_get_doc (request, 0), key) == 1) {
+         dup = i;
+      }
+   }
+
+   ASSERT_CMPINT (dup, !=, -1);
+   reply = bson_strdup_printf ("{'ok': 1, 'n': 2, 'writeErrors': [{'index': "
+                               "%d, 'code': 11000, 'errmsg': 'dupe'}]}",
+                               dup);
+   mock_server_replies_simple (request, reply);
+
+   for (i = 0; i < 3; i++) {
+      if (i == 1) {
+         ASSERT (!future_get_bool (futures[i]));
+         ASSERT_ERROR_CONTAINS (
+            errors[i], MONGOC_ERROR_COLLECTION, 11000, "dupe");
+      } else {
+         ASSERT_OR_PRINT (future_get_bool (futures[i]), errors[i]);
+      }
+
+      future_destroy (futures[i]);
+      mongoc_collection_destroy (collections[i]);
+      mongoc_client_pool_push (pool, clients[i]);
+   }
+
+   bson_free (reply);
+   request_destroy (request);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
 #ifndef MONGOC_ENABLE_SSL
 static void
 test_mongoc_client_pool_ssl_disabled (void)
@@ -272,6 +817,210 @@ test_mongoc_client_pool_handshake (void)
    mongoc_client_pool_destroy (pool);
 }
 
+/* with shareTopology, pools for the same hosts and monitoring options share
+ * one topology, whatever the order of the hosts and their per-pool options */
+static void
+test_mongoc_client_pool_share_topology (void)
+{
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool_a;
+   mongoc_client_pool_t *pool_b;
+   mongoc_client_pool_t *pool_c;
+   mongoc_client_pool_t *pool_d;
+   mongoc_topology_t *topology;
+   mongoc_client_t *client;
+
+   uri = mongoc_uri_new ("mongodb://A:1,b:2/?shareTopology=true"
+                         "&maxPoolSize=2&heartbeatFrequencyMS=1000");
+   pool_a = mongoc_client_pool_new (uri);
+   mongoc_uri_destroy (uri);
+
+   uri = mongoc_uri_new ("mongodb://b:2,a:1/?heartbeatfrequencyms=1000"
+                         "&sharetopology=true&w=2&minPoolSize=1");
+   pool_b = mongoc_client_pool_new (uri);
+   mongoc_uri_destroy (uri);
+
+   /* a different monitoring option */
+   uri = mongoc_uri_new ("mongodb://a:1,b:2/?shareTopology=true"
+                         "&heartbeatFrequencyMS=2000");
+   pool_c = mongoc_client_pool_new (uri);
+   mongoc_uri_destroy (uri);
+
+   /* not shared */
+   uri = mongoc_uri_new ("mongodb://a:1,b:2/?heartbeatFrequencyMS=1000");
+   pool_d = mongoc_client_pool_new (uri);
+   mongoc_uri_destroy (uri);
+
+   topology = _mongoc_client_pool_get_topology (pool_a);
+   BSON_ASSERT (topology == _mongoc_client_pool_get_topology (pool_b));
+   BSON_ASSERT (topology != _mongoc_client_pool_get_topology (pool_c));
+   BSON_ASSERT (topology != _mongoc_client_pool_get_topology (pool_d));
+   ASSERT_CMPINT32 (topology->registry_refs, ==, 2);
+   BSON_ASSERT (_mongoc_topology_registry_is_shared (topology));
+   BSON_ASSERT (!_mongoc_topology_registry_is_shared (
+      _mongoc_client_pool_get_topology (pool_c)));
+   BSON_ASSERT (!_mongoc_client_pool_get_topology (pool_d)->registry_key);
+
+   client = mongoc_client_pool_pop (pool_a);
+   BSON_ASSERT (client->topology == topology);
+   mongoc_client_pool_push (pool_a, client);
+
+   /* the topology outlives the first pool */
+   mongoc_client_pool_destroy (pool_a);
+   ASSERT_CMPINT32 (topology->registry_refs, ==, 1);
+   client = mongoc_client_pool_pop (pool_b);
+   BSON_ASSERT (client->topology == topology);
+   mongoc_client_pool_push (pool_b, client);
+
+   mongoc_client_pool_destroy (pool_b);
+   mongoc_client_pool_destroy (pool_c);
+   mongoc_client_pool_destroy (pool_d);
+}
+
+
+/* a pool's clients share its URI and the defaults it implies, until a
+ * client sets its own */
+static void
+test_mongoc_client_pool_shared_uri (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *a;
+   mongoc_client_t *b;
+   mongoc_uri_t *uri;
+   mongoc_read_prefs_t *prefs;
+   mongoc_write_concern_t *wc;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1/?maxpoolsize=2"
+                         "&readPreference=secondary&w=2");
+   pool = mongoc_client_pool_new (uri);
+   a = mongoc_client_pool_pop (pool);
+   b = mongoc_client_pool_pop (pool);
+
+   ASSERT (mongoc_client_get_uri (a) == mongoc_client_get_uri (b));
+   ASSERT (mongoc_client_get_read_prefs (a) ==
+           mongoc_client_get_read_prefs (b));
+   ASSERT (mongoc_client_get_write_concern (a) ==
+           mongoc_client_get_write_concern (b));
+   ASSERT (mongoc_client_get_read_concern (a) ==
+           mongoc_client_get_read_concern (b));
+   ASSERT_CMPINT (mongoc_read_prefs_get_mode (mongoc_client_get_read_prefs (a)),
+                  ==,
+                  MONGOC_READ_SECONDARY);
+   ASSERT_CMPINT (
+      mongoc_write_concern_get_w (mongoc_client_get_write_concern (a)), ==, 2);
+
+   /* overriding doesn't affect the other client */
+   prefs = mongoc_read_prefs_new (MONGOC_READ_NEAREST);
+   mongoc_client_set_read_prefs (a, prefs);
+   wc = mongoc_write_concern_new ();
+   mongoc_write_concern_set_w (wc, 3);
+   mongoc_client_set_write_concern (a, wc);
+
+   ASSERT_CMPINT (mongoc_read_prefs_get_mode (mongoc_client_get_read_prefs (a)),
+                  ==,
+                  MONGOC_READ_NEAREST);
+   ASSERT_CMPINT (mongoc_read_prefs_get_mode (mongoc_client_get_read_prefs (b)),
+                  ==,
+                  MONGOC_READ_SECONDARY);
+   ASSERT_CMPINT (
+      mongoc_write_concern_get_w (mongoc_client_get_write_concern (b)), ==, 2);
+
+   /* and setting it again frees the client's own copy */
+   mongoc_client_set_read_prefs (a, NULL);
+   ASSERT_CMPINT (mongoc_read_prefs_get_mode (mongoc_client_get_read_prefs (a)),
+                  ==,
+                  MONGOC_READ_PRIMARY);
+
+   mongoc_read_prefs_destroy (prefs);
+   mongoc_write_concern_destroy (wc);
+   mongoc_client_pool_push (pool, a);
+   mongoc_client_pool_push (pool, b);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+
+
+static int64_t
+_server_connections (mongoc_client_t *client, uint32_t server_id)
+{
+   mongoc_server_description_t *sd;
+   mongoc_server_counters_t counters;
+
+   sd = mongoc_client_get_server_description (client, server_id);
+   BSON_ASSERT (sd);
+   BSON_ASSERT (mongoc_server_description_get_counters (sd, &counters));
+   mongoc_server_description_destroy (sd);
+
+   return counters.connections;
+}
+
+
+/* the pool keeps a connection to the secondary, and the client's first
+ * operation there takes it over instead of connecting */
+static void
+test_mongoc_client_pool_standby_connections (void)
+{
+   mock_rs_t *rs;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_read_prefs_t *secondary;
+   mongoc_server_description_t *sd;
+   uint32_t secondary_id;
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+
+   rs = mock_rs_with_autoismaster (WIRE_VERSION_MIN,
+                                   true /* has primary */,
+                                   1 /* secondary */,
+                                   0 /* arbiters */);
+   mock_rs_run (rs);
+   uri = mongoc_uri_copy (mock_rs_get_uri (rs));
+   mongoc_uri_set_option_as_int32 (uri, "standbyConnections", 1);
+   mongoc_uri_set_option_as_int32 (uri, "heartbeatFrequencyMS", 500);
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+   secondary = mongoc_read_prefs_new (MONGOC_READ_SECONDARY);
+
+   /* the client's first connection starts the background connections */
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+   request =
+      mock_rs_receives_command (rs, "db", MONGOC_QUERY_NONE, "{'ping': 1}");
+   BSON_ASSERT (mock_rs_request_is_to_primary (rs, request));
+   mock_rs_replies_simple (request, "{'ok': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+   request_destroy (request);
+
+   sd = mongoc_client_select_server (client, false, secondary, &error);
+   ASSERT_OR_PRINT (sd, error);
+   secondary_id = mongoc_server_description_id (sd);
+   mongoc_server_description_destroy (sd);
+
+   WAIT_UNTIL (_server_connections (client, secondary_id) == 1);
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), secondary, NULL, &error);
+   request = mock_rs_receives_command (
+      rs, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   BSON_ASSERT (mock_rs_request_is_to_secondary (rs, request));
+   mock_rs_replies_simple (request, "{'ok': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+   request_destroy (request);
+
+   /* the client owns the standby connection now */
+   ASSERT_CMPSIZE_T (client->cluster.nodes->items_len, ==, (size_t) 2);
+
+   mongoc_read_prefs_destroy (secondary);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_rs_destroy (rs);
+}
+
 void
 test_client_pool_install (TestSuite *suite)
 {
@@ -291,6 +1040,41 @@ test_client_pool_install (TestSuite *suite)
 
    TestSuite_Add (
       suite, "/ClientPool/handshake", test_mongoc_client_pool_handshake);
+   TestSuite_Add (
+      suite, "/ClientPool/shared_uri", test_mongoc_client_pool_shared_uri);
+   TestSuite_Add (suite,
+                  "/ClientPool/share_topology",
+                  test_mongoc_client_pool_share_topology);
+   TestSuite_Add (suite, "/ClientPool/threads", test_mongoc_client_pool_threads);
+   TestSuite_Add (suite,
+                  "/ClientPool/wait_queue_timeout",
+                  test_mongoc_client_pool_wait_queue_timeout);
+   TestSuite_Add (suite, "/ClientPool/stats", test_mongoc_client_pool_stats);
+   TestSuite_Add (suite,
+                  "/ClientPool/wait_queue_multiple",
+                  test_mongoc_client_pool_wait_queue_multiple);
+   TestSuite_Add (
+      suite, "/ClientPool/priority", test_mongoc_client_pool_priority);
+   TestSuite_Add (suite, "/ClientPool/shards", test_mongoc_client_pool_shards);
+   TestSuite_AddMockServerTest (
+      suite, "/ClientPool/warm", test_mongoc_client_pool_warm);
+   TestSuite_AddFull (suite,
+                      "/ClientPool/warm_auth",
+                      test_mongoc_client_pool_warm_auth,
+                      NULL,
+                      NULL,
+                      test_framework_skip_if_no_auth);
+   TestSuite_AddMockServerTest (suite,
+                                "/ClientPool/coalesce_inserts",
+                                test_mongoc_client_pool_coalesce_inserts);
+   TestSuite_AddMockServerTest (suite,
+                                "/ClientPool/standby_connections",
+                                test_mongoc_client_pool_standby_connections);
+#ifndef _WIN32
+   TestSuite_AddMockServerTest (suite,
+                                "/ClientPool/reset_after_fork",
+                                test_mongoc_client_pool_reset_after_fork);
+#endif
 
 #ifndef MONGOC_ENABLE_SSL
    TestSuite_Add (
@@ -1,7 +1,18 @@
 #include "mongoc.h"
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "mongoc-rand-private.h"
+#include "mongoc-read-prefs-private.h"
+#include "mongoc-server-description-private.h"
 #include "TestSuite.h"
 #include "test-conveniences.h"
 #include "test-libmongoc.h"
+#include "mock_server/future-functions.h"
+#include "mock_server/mock-server.h"
 
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "session-test"
@@ -27,8 +38,536 @@ test_session_opts_clone (void)
 }
 
 
+#ifdef MONGOC_ENABLE_CRYPTO
+static void
+test_session_pool_lifo (void)
+{
+   mongoc_client_t *client;
+   mongoc_client_session_t *a;
+   mongoc_client_session_t *b;
+   bson_t lsid_a;
+   bson_t lsid_b;
+   bson_error_t error;
+
+   client = test_framework_client_new ();
+
+   a = mongoc_client_start_session (client, NULL, &error);
+   ASSERT_OR_PRINT (a, error);
+   b = mongoc_client_start_session (client, NULL, &error);
+   ASSERT_OR_PRINT (b, error);
+
+   bson_copy_to (mongoc_client_session_get_session_id (a), &lsid_a);
+   bson_copy_to (mongoc_client_session_get_session_id (b), &lsid_b);
+   BSON_ASSERT (!bson_equal (&lsid_a, &lsid_b));
+
+   /* the last session returned to the pool is reused first */
+   mongoc_client_session_destroy (a);
+   mongoc_client_session_destroy (b);
+
+   a = mongoc_client_start_session (client, NULL, &error);
+   ASSERT_OR_PRINT (a, error);
+   BSON_ASSERT (bson_equal (mongoc_client_session_get_session_id (a), &lsid_b));
+   b = mongoc_client_start_session (client, NULL, &error);
+   ASSERT_OR_PRINT (b, error);
+   BSON_ASSERT (bson_equal (mongoc_client_session_get_session_id (b), &lsid_a));
+
+   mongoc_client_session_destroy (a);
+   mongoc_client_session_destroy (b);
+   bson_destroy (&lsid_a);
+   bson_destroy (&lsid_b);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_session_pool_timeout (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_client_session_t *session;
+   mongoc_server_description_t *sd;
+   bson_t lsid;
+   bson_error_t error;
+
+   server = mock_server_new ();
+   /* a session unused for a minute less than the timeout is discarded, so
+    * with a timeout of a minute, no session is reused */
+   mock_server_auto_ismaster (server,
+                              "{'ok': 1.0,"
+                              " 'ismaster': true,"
+                              " 'maxWireVersion': 6,"
+                              " 'logicalSessionTimeoutMinutes': 1}");
+   mock_server_run (server);
+
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   sd = mongoc_client_select_server (client, true, NULL, &error);
+   ASSERT_OR_PRINT (sd, error);
+
+   session = mongoc_client_start_session (client, NULL, &error);
+   ASSERT_OR_PRINT (session, error);
+   bson_copy_to (mongoc_client_session_get_session_id (session), &lsid);
+   mongoc_client_session_destroy (session);
+
+   session = mongoc_client_start_session (client, NULL, &error);
+   ASSERT_OR_PRINT (session, error);
+   BSON_ASSERT (
+      !bson_equal (mongoc_client_session_get_session_id (session), &lsid));
+   mongoc_client_session_destroy (session);
+
+   bson_destroy (&lsid);
+   mongoc_server_description_destroy (sd);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
+/* session ids come from each thread's buffer of random bytes: draws don't
+ * repeat, including across refills */
+static void
+test_session_rand_buffered (void)
+{
+   uint8_t ids[600][16];
+   uint8_t big[8192];
+   int i;
+   int j;
+
+   for (i = 0; i < 600; i++) {
+      ASSERT (_mongoc_rand_buffered_bytes (ids[i], 16));
+      for (j = 0; j < i; j++) {
+         ASSERT (memcmp (ids[i], ids[j], 16) != 0);
+      }
+   }
+
+   /* more than the buffer holds, taken straight from the crypto library */
+   memset (big, 0, sizeof big);
+   ASSERT (_mongoc_rand_buffered_bytes (big, (int) sizeof big));
+   ASSERT (memcmp (big, big + 4096, 4096) != 0);
+}
+
+
+#ifndef _WIN32
+/* a child process doesn't hand out the bytes its parent buffered */
+static void
+test_session_rand_fork (void)
+{
+   uint8_t parent_id[16];
+   uint8_t child_id[16];
+   int fds[2];
+   pid_t pid;
+   int status;
+
+   /* fill this thread's buffer */
+   ASSERT (_mongoc_rand_buffered_bytes (parent_id, 16));
+   ASSERT_CMPINT (pipe (fds), ==, 0);
+
+   pid = fork ();
+   ASSERT_CMPINT ((int) pid, !=, -1);
+
+   if (pid == 0) {
+      close (fds[0]);
+      if (!_mongoc_rand_buffered_bytes (child_id, 16) ||
+          write (fds[1], child_id, 16) != 16) {
+         _exit (1);
+      }
+
+      _exit (0);
+   }
+
+   close (fds[1]);
+   ASSERT_CMPINT ((int) read (fds[0], child_id, 16), ==, 16);
+   close (fds[0]);
+   ASSERT_CMPINT ((int) waitpid (pid, &status, 0), ==, (int) pid);
+   BSON_ASSERT (WIFEXITED (status));
+   ASSERT_CMPINT (WEXITSTATUS (status), ==, 0);
+
+   ASSERT (_mongoc_rand_buffered_bytes (parent_id, 16));
+   ASSERT (memcmp (parent_id, child_id, 16) != 0);
+}
+#endif
+#endif
+
+#ifdef MONGOC_ENABLE_CRYPTO
+/* reads in a causally consistent session wait for the last operation time
+ * the session has seen, merged into their readConcern */
+static void
+test_session_causal_after_cluster_time (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_session_opt_t *session_opts;
+   mongoc_client_session_t *session;
+   bson_t opts = BSON_INITIALIZER;
+   bson_t rc_opts = BSON_INITIALIZER;
+   uint32_t timestamp;
+   uint32_t increment;
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_OP_MSG);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+
+   session_opts = mongoc_session_opts_new ();
+   mongoc_session_opts_set_causally_consistent_reads (session_opts, true);
+   session = mongoc_client_start_session (client, session_opts, &error);
+   ASSERT_OR_PRINT (session, error);
+   ASSERT_OR_PRINT (mongoc_client_session_append (session, &opts, &error),
+                    error);
+
+   /* no operation time yet */
+   future = future_client_read_command_with_opts (
+      client, "db", tmp_bson ("{'count': 'c'}"), NULL, &opts, NULL, &error);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'count': 'c', 'lsid': {'$exists': true},"
+      " 'readConcern': {'$exists': false}, 'sessionId': {'$exists': false}}");
+   mock_server_replies_simple (
+      request,
+      "{'ok': 1, 'n': 1, 'operationTime': {'$timestamp': {'t': 5, 'i': 1}}}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+   request_destroy (request);
+
+   mongoc_client_session_get_operation_time (session, &timestamp, &increment);
+   ASSERT_CMPUINT32 (timestamp, ==, (uint32_t) 5);
+   ASSERT_CMPUINT32 (increment, ==, (uint32_t) 1);
+
+   /* an older operation time doesn't move the session's back */
+   future = future_client_read_command_with_opts (
+      client, "db", tmp_bson ("{'count': 'c'}"), NULL, &opts, NULL, &error);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'count': 'c', 'readConcern': {"
+      "    'afterClusterTime': {'$timestamp': {'t': 5, 'i': 1}}}}");
+   mock_server_replies_simple (
+      request,
+      "{'ok': 1, 'n': 1, 'operationTime': {'$timestamp': {'t': 4, 'i': 9}}}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+   request_destroy (request);
+
+   mongoc_client_session_get_operation_time (session, &timestamp, &increment);
+   ASSERT_CMPUINT32 (timestamp, ==, (uint32_t) 5);
+   ASSERT_CMPUINT32 (increment, ==, (uint32_t) 1);
+
+   /* merged with a readConcern from opts */
+   bson_copy_to (&opts, &rc_opts);
+   BCON_APPEND (&rc_opts, "readConcern", "{", "level", "majority", "}");
+   future = future_client_read_command_with_opts (
+      client, "db", tmp_bson ("{'count': 'c'}"), NULL, &rc_opts, NULL, &error);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'count': 'c', 'readConcern': {'level': 'majority',"
+      "    'afterClusterTime': {'$timestamp': {'t': 5, 'i': 1}}}}");
+   mock_server_replies_simple (request, "{'ok': 1, 'n': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+   request_destroy (request);
+
+   /* and with one in the command itself */
+   future = future_client_read_command_with_opts (
+      client,
+      "db",
+      tmp_bson ("{'distinct': 'c', 'key': 'x',"
+                " 'readConcern': {'level': 'local'}}"),
+      NULL,
+      &opts,
+      NULL,
+      &error);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'distinct': 'c', 'key': 'x', 'readConcern': {'level': 'local',"
+      "    'afterClusterTime': {'$timestamp': {'t': 5, 'i': 1}}}}");
+   mock_server_replies_simple (request, "{'ok': 1, 'values': []}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+   request_destroy (request);
+
+   /* commands that aren't reads don't wait */
+   future = future_client_read_command_with_opts (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, &opts, NULL, &error);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'ping': 1, 'readConcern': {'$exists': false}}");
+   mock_server_replies_simple (request, "{'ok': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+   request_destroy (request);
+
+   bson_destroy (&opts);
+   bson_destroy (&rc_opts);
+   mongoc_client_session_destroy (session);
+   mongoc_session_opts_destroy (session_opts);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
+/* a transaction's statements carry its number, the first one starts it,
+ * and the transaction's concerns replace the statements' own */
+static void
+test_session_transaction (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_client_session_t *session;
+   mongoc_bulk_operation_t *bulk;
+   bson_t opts = BSON_INITIALIZER;
+   bson_t wc_opts = BSON_INITIALIZER;
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+   bson_t reply;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_TRANSACTIONS);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+
+   session = mongoc_client_start_session (client, NULL, &error);
+   ASSERT_OR_PRINT (session, error);
+   ASSERT_OR_PRINT (mongoc_client_session_append (session, &opts, &error),
+                    error);
+   BSON_ASSERT (!mongoc_client_session_in_transaction (session));
+
+   ASSERT_OR_PRINT (mongoc_client_session_start_transaction (
+                       session,
+                       tmp_bson ("{'readConcern': {'level': 'snapshot'},"
+                                 " 'writeConcern': {'w': 'majority'}}"),
+                       &error),
+                    error);
+   BSON_ASSERT (mongoc_client_session_in_transaction (session));
+
+   /* the first statement starts the transaction in the same message */
+   bson_copy_to (&opts, &wc_opts);
+   BCON_APPEND (&wc_opts, "writeConcern", "{", "w", BCON_INT32 (2), "}");
+   future = future_client_write_command_with_opts (
+      client,
+      "db",
+      tmp_bson ("{'insert': 'c', 'documents': [{}]}"),
+      &wc_opts,
+      NULL,
+      &error);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'insert': 'c', 'lsid': {'$exists': true},"
+      " 'txnNumber': {'$numberLong': '1'}, 'startTransaction': true,"
+      " 'autocommit': false, 'readConcern': {'level': 'snapshot'},"
+      " 'writeConcern': {'$exists': false}}");
+   mock_server_replies_simple (request, "{'ok': 1, 'n': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+   request_destroy (request);
+
+   /* the next only continues it */
+   future = future_client_read_command_with_opts (
+      client, "db", tmp_bson ("{'count': 'c'}"), NULL, &opts, NULL, &error);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'count': 'c', 'txnNumber': {'$numberLong': '1'},"
+      " 'startTransaction': {'$exists': false}, 'autocommit': false,"
+      " 'readConcern': {'$exists': false}}");
+   mock_server_replies_simple (request, "{'ok': 1, 'n': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+   request_destroy (request);
+
+   /* the commit has the transaction's write concern */
+   future = future_client_session_commit_transaction (session, &reply, &error);
+   request = mock_server_receives_command (
+      server,
+      "admin",
+      MONGOC_QUERY_NONE,
+      "{'commitTransaction': 1, 'lsid': {'$exists': true},"
+      " 'txnNumber': {'$numberLong': '1'}, 'autocommit': false,"
+      " 'writeConcern': {'w': 'majority'}}");
+   mock_server_replies_simple (request, "{'ok': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+   request_destroy (request);
+   bson_destroy (&reply);
+   BSON_ASSERT (!mongoc_client_session_in_transaction (session));
+
+   BSON_ASSERT (!mongoc_client_session_abort_transaction (session, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Cannot call abortTransaction");
+
+   /* a bulk operation's commands are statements too */
+   ASSERT_OR_PRINT (
+      mongoc_client_session_start_transaction (session, NULL, &error), error);
+   bulk = mongoc_bulk_operation_new (true);
+   mongoc_bulk_operation_set_client (bulk, client);
+   mongoc_bulk_operation_set_database (bulk, "db");
+   mongoc_bulk_operation_set_collection (bulk, "c");
+   mongoc_bulk_operation_set_client_session (bulk, session);
+   mongoc_bulk_operation_insert (bulk, tmp_bson ("{}"));
+   future = future_bulk_operation_execute (bulk, NULL, &error);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'insert': 'c', 'txnNumber': {'$numberLong': '2'},"
+      " 'startTransaction': true, 'autocommit': false,"
+      " 'readConcern': {'$exists': false},"
+      " 'writeConcern': {'$exists': false}}");
+   mock_server_replies_simple (request, "{'ok': 1, 'n': 1}");
+   ASSERT_OR_PRINT (future_get_uint32_t (future), error);
+   future_destroy (future);
+   request_destroy (request);
+   mongoc_bulk_operation_destroy (bulk);
+
+   future = future_client_session_abort_transaction (session, &error);
+   request = mock_server_receives_command (
+      server,
+      "admin",
+      MONGOC_QUERY_NONE,
+      "{'abortTransaction': 1, 'txnNumber': {'$numberLong': '2'},"
+      " 'autocommit': false}");
+   mock_server_replies_simple (request, "{'ok': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+   request_destroy (request);
+   BSON_ASSERT (!mongoc_client_session_in_transaction (session));
+
+   bson_destroy (&opts);
+   bson_destroy (&wc_opts);
+   mongoc_client_session_destroy (session);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
+static void
+test_session_invalid_session_id (void)
+{
+   mongoc_client_t *client;
+   bson_error_t error;
+   bool r;
+
+   client = mongoc_client_new ("mongodb://localhost");
+   r = mongoc_client_read_command_with_opts (client,
+                                             "db",
+                                             tmp_bson ("{'count': 'c'}"),
+                                             NULL,
+                                             tmp_bson ("{'sessionId': 1}"),
+                                             NULL,
+                                             &error);
+   BSON_ASSERT (!r);
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Invalid sessionId");
+
+   mongoc_client_destroy (client);
+}
+#endif
+
+
+static void
+_init_secondary (mongoc_server_description_t *sd,
+                 uint32_t id,
+                 uint32_t timestamp,
+                 uint32_t increment)
+{
+   char *host;
+
+   host = bson_strdup_printf ("host%u:27017", id);
+   mongoc_server_description_init (sd, host, id);
+   mongoc_server_description_handle_ismaster (
+      sd,
+      tmp_bson ("{'ok': 1, 'ismaster': false, 'secondary': true,"
+                " 'setName': 'rs', 'minWireVersion': 2, 'maxWireVersion': 6,"
+                " 'lastWrite': {"
+                "    'opTime': {'ts': {'$timestamp': {'t': %u, 'i': %u}},"
+                "               't': {'$numberLong': '1'}},"
+                "    'lastWriteDate': {'$date': 1000}}}",
+                timestamp,
+                increment),
+      10,
+      NULL);
+   bson_free (host);
+}
+
+
+/* selection prefers secondaries that have replicated the session's last
+ * operation, but falls back to all of them if none has */
+static void
+test_session_causal_filter_caught_up (void)
+{
+   mongoc_server_description_t a;
+   mongoc_server_description_t b;
+   mongoc_server_description_t c;
+   mongoc_server_description_t *sds[3];
+   mongoc_read_prefs_t *prefs;
+
+   _init_secondary (&a, 1, 5, 1);
+   _init_secondary (&b, 2, 4, 9);
+   _init_secondary (&c, 3, 5, 2);
+   ASSERT_CMPUINT32 (a.last_write_timestamp, ==, (uint32_t) 5);
+   ASSERT_CMPUINT32 (a.last_write_increment, ==, (uint32_t) 1);
+
+   prefs = mongoc_read_prefs_new (MONGOC_READ_SECONDARY);
+
+   /* no operation time, no preference */
+   sds[0] = &a, sds[1] = &b, sds[2] = &c;
+   mongoc_server_description_filter_caught_up (sds, 3, prefs);
+   BSON_ASSERT (sds[0] == &a && sds[1] == &b && sds[2] == &c);
+
+   _mongoc_read_prefs_set_after_cluster_time (prefs, 5, 1);
+   mongoc_server_description_filter_caught_up (sds, 3, prefs);
+   BSON_ASSERT (sds[0] == &a && !sds[1] && sds[2] == &c);
+
+   /* none has caught up */
+   sds[0] = &a, sds[1] = &b, sds[2] = &c;
+   _mongoc_read_prefs_set_after_cluster_time (prefs, 6, 0);
+   mongoc_server_description_filter_caught_up (sds, 3, prefs);
+   BSON_ASSERT (sds[0] == &a && sds[1] == &b && sds[2] == &c);
+
+   mongoc_read_prefs_destroy (prefs);
+   mongoc_server_description_cleanup (&a);
+   mongoc_server_description_cleanup (&b);
+   mongoc_server_description_cleanup (&c);
+}
+
+
 void
 test_session_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Session/opts/clone", test_session_opts_clone);
+   TestSuite_Add (suite,
+                  "/Session/causal/filter_caught_up",
+                  test_session_causal_filter_caught_up);
+#ifdef MONGOC_ENABLE_CRYPTO
+   TestSuite_AddMockServerTest (suite,
+                                "/Session/causal/after_cluster_time",
+                                test_session_causal_after_cluster_time);
+   TestSuite_AddMockServerTest (
+      suite, "/Session/transaction", test_session_transaction);
+   TestSuite_Add (suite,
+                  "/Session/invalid_session_id",
+                  test_session_invalid_session_id);
+   TestSuite_Add (suite, "/Session/pool/lifo", test_session_pool_lifo);
+   TestSuite_AddMockServerTest (
+      suite, "/Session/pool/timeout", test_session_pool_timeout);
+   TestSuite_Add (suite, "/Session/rand/buffered", test_session_rand_buffered);
+#ifndef _WIN32
+   TestSuite_Add (suite, "/Session/rand/fork", test_session_rand_fork);
+#endif
+#endif
 }
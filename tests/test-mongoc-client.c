@@ -9,6 +9,7 @@
 #include "mongoc-util-private.h"
 
 #include "mongoc-handshake-private.h"
+#include "mongoc-scram-private.h"
 
 #include "TestSuite.h"
 #include "test-conveniences.h"
@@ -170,6 +171,146 @@ test_server_id_option (void *ctx)
 }
 
 
+static void
+test_read_commands_pipelined (void *ctx)
+{
+   mongoc_client_t *client;
+   const bson_t *commands[3];
+   bson_t replies[3];
+   bson_error_t error;
+   int i;
+
+   client = test_framework_client_new ();
+   commands[0] = tmp_bson ("{'ping': 1}");
+   commands[1] = tmp_bson ("{'foo': 1}");
+   commands[2] = tmp_bson ("{'buildinfo': 1}");
+
+   /* the unknown command fails, the others succeed */
+   BSON_ASSERT (!mongoc_client_read_commands_pipelined (
+      client, "admin", commands, 3, NULL, replies, &error));
+   ASSERT_CMPINT (error.domain, ==, MONGOC_ERROR_QUERY);
+   ASSERT_MATCH (&replies[0], "{'ok': 1}");
+   ASSERT_MATCH (&replies[1], "{'ok': 0}");
+   ASSERT_MATCH (&replies[2], "{'ok': 1, 'version': {'$exists': true}}");
+
+   for (i = 0; i < 3; i++) {
+      bson_destroy (&replies[i]);
+   }
+
+   ASSERT_OR_PRINT (mongoc_client_read_commands_pipelined (
+                       client, "admin", commands, 1, NULL, replies, &error),
+                    error);
+   bson_destroy (&replies[0]);
+
+   mongoc_client_destroy (client);
+}
+
+
+/* requests and replies together are far larger than the socket buffers:
+ * a pipeline that writes every request before reading would deadlock with
+ * the server, blocked writing replies the client doesn't read */
+static void
+test_read_commands_pipelined_large_batch (void *ctx)
+{
+   enum { N_COMMANDS = 128 };
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   bson_t *commands[N_COMMANDS];
+   bson_t replies[N_COMMANDS];
+   bson_t doc = BSON_INITIALIZER;
+   bson_error_t error;
+   char *padding;
+   int i;
+
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "pipelined_large_batch");
+
+   /* each reply is 256KB and each request 32KB */
+   padding = (char *) bson_malloc (256 * 1024 + 1);
+   memset (padding, 'a', 256 * 1024);
+   padding[256 * 1024] = '\0';
+   BSON_APPEND_UTF8 (&doc, "padding", padding);
+   ASSERT_OR_PRINT (mongoc_collection_insert (
+                       collection, MONGOC_INSERT_NONE, &doc, NULL, &error),
+                    error);
+
+   padding[32 * 1024] = '\0';
+
+   for (i = 0; i < N_COMMANDS; i++) {
+      commands[i] =
+         BCON_NEW ("find",
+                   BCON_UTF8 (mongoc_collection_get_name (collection)),
+                   "comment",
+                   BCON_UTF8 (padding));
+   }
+
+   ASSERT_OR_PRINT (
+      mongoc_client_read_commands_pipelined (client,
+                                             "test",
+                                             (const bson_t **) commands,
+                                             N_COMMANDS,
+                                             NULL,
+                                             replies,
+                                             &error),
+      error);
+
+   for (i = 0; i < N_COMMANDS; i++) {
+      ASSERT_MATCH (&replies[i],
+                    "{'ok': 1, 'cursor': {'firstBatch': [{'padding': {"
+                    "'$exists': true}}]}}");
+      bson_destroy (&replies[i]);
+      bson_destroy (commands[i]);
+   }
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+
+   bson_free (padding);
+   bson_destroy (&doc);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+/* without OP_MSG, the commands run in order on one connection */
+static void
+test_read_commands_pipelined_legacy (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   const bson_t *commands[2];
+   bson_t replies[2];
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   commands[0] = tmp_bson ("{'a': 1}");
+   commands[1] = tmp_bson ("{'b': 1}");
+
+   future = future_client_read_commands_pipelined (
+      client, "db", commands, 2, NULL, replies, &error);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'a': 1}");
+   mock_server_replies_simple (request, "{'ok': 1, 'n': 1}");
+   request_destroy (request);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'b': 1}");
+   mock_server_replies_simple (request, "{'ok': 1, 'n': 2}");
+   request_destroy (request);
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   ASSERT_MATCH (&replies[0], "{'n': 1}");
+   ASSERT_MATCH (&replies[1], "{'n': 2}");
+
+   bson_destroy (&replies[0]);
+   bson_destroy (&replies[1]);
+   future_destroy (future);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
 static void
 test_client_cmd_w_write_concern (void)
 {
@@ -505,6 +646,76 @@ test_mongoc_client_authenticate_cached_single (void *context)
 }
 
 
+#ifdef MONGOC_ENABLE_CRYPTO
+/* salted passwords are shared process-wide, by password, salt, and
+ * iteration count */
+static void
+test_mongoc_client_authenticate_cached_process (void)
+{
+   const char *hashed_password = "0123456789abcdef0123456789abcdef";
+   uint8_t salt[16] = "sixteen byte sal";
+   uint8_t salted_password[MONGOC_SCRAM_HASH_SIZE];
+   uint8_t found[MONGOC_SCRAM_HASH_SIZE];
+
+   memset (salted_password, 'x', sizeof salted_password);
+   BSON_ASSERT (!_mongoc_scram_cache_get (
+      hashed_password, salt, sizeof salt, 10000, found));
+
+   _mongoc_scram_cache_put (
+      hashed_password, salt, sizeof salt, 10000, salted_password);
+   BSON_ASSERT (_mongoc_scram_cache_get (
+      hashed_password, salt, sizeof salt, 10000, found));
+   BSON_ASSERT (0 == memcmp (found, salted_password, sizeof found));
+
+   /* any other password, salt, or iteration count misses */
+   BSON_ASSERT (!_mongoc_scram_cache_get (
+      "fedcba9876543210fedcba9876543210", salt, sizeof salt, 10000, found));
+   BSON_ASSERT (!_mongoc_scram_cache_get (
+      hashed_password, salt, sizeof salt, 10001, found));
+   salt[0] = 'S';
+   BSON_ASSERT (!_mongoc_scram_cache_get (
+      hashed_password, salt, sizeof salt, 10000, found));
+}
+
+
+/* the crypto library's PBKDF2 matches RFC 6070's test vectors */
+static void
+test_mongoc_client_authenticate_pbkdf2 (void)
+{
+   mongoc_crypto_t crypto;
+   uint8_t output[MONGOC_SCRAM_HASH_SIZE];
+   const uint8_t one[] = {0x0c, 0x60, 0xc8, 0x0f, 0x96, 0x1f, 0x0e,
+                          0x71, 0xf3, 0xa9, 0xb5, 0x24, 0xaf, 0x60,
+                          0x12, 0x06, 0x2f, 0xe0, 0x37, 0xa6};
+   const uint8_t many[] = {0x4b, 0x00, 0x79, 0x01, 0xb7, 0x65, 0x48,
+                           0x9a, 0xbe, 0xad, 0x49, 0xd9, 0x26, 0xf7,
+                           0x21, 0xd0, 0x65, 0xa4, 0x29, 0xc1};
+
+   mongoc_crypto_init (&crypto);
+
+   BSON_ASSERT (mongoc_crypto_pbkdf2_hmac_sha1 (&crypto,
+                                                "password",
+                                                8,
+                                                (const uint8_t *) "salt",
+                                                4,
+                                                1,
+                                                sizeof output,
+                                                output));
+   BSON_ASSERT (0 == memcmp (output, one, sizeof output));
+
+   BSON_ASSERT (mongoc_crypto_pbkdf2_hmac_sha1 (&crypto,
+                                                "password",
+                                                8,
+                                                (const uint8_t *) "salt",
+                                                4,
+                                                4096,
+                                                sizeof output,
+                                                output));
+   BSON_ASSERT (0 == memcmp (output, many, sizeof output));
+}
+#endif
+
+
 static void
 test_mongoc_client_authenticate_failure (void *context)
 {
@@ -618,6 +829,144 @@ test_mongoc_client_authenticate_timeout (void *context)
 }
 
 
+#ifdef MONGOC_ENABLE_CRYPTO
+/* record the "speculativeAuthenticate" field of an isMaster, and reply as a
+ * server that ignores it */
+static bool
+auto_ismaster_speculative (request_t *request, void *data)
+{
+   bson_t *speculative = (bson_t *) data;
+   bson_iter_t iter;
+   const uint8_t *doc_data;
+   uint32_t doc_len;
+   bson_t doc;
+
+   if (!request->is_command ||
+       strcasecmp (request->command_name, "isMaster") ||
+       !bson_iter_init_find (
+          &iter, request_get_doc (request, 0), "speculativeAuthenticate") ||
+       !BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      return false;
+   }
+
+   bson_iter_document (&iter, &doc_len, &doc_data);
+   BSON_ASSERT (bson_init_static (&doc, doc_data, doc_len));
+   bson_concat (speculative, &doc);
+
+   mock_server_replies_simple (request,
+                               "{'ok': 1,"
+                               " 'ismaster': true,"
+                               " 'minWireVersion': 0,"
+                               " 'maxWireVersion': 3}");
+   request_destroy (request);
+
+   return true;
+}
+
+
+/* a new connection begins SCRAM-SHA-1 in its isMaster, and starts over if
+ * the server ignores it */
+static void
+test_mongoc_client_authenticate_speculative (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   bson_t speculative = BSON_INITIALIZER;
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+
+   server = mock_server_with_autoismaster (3);
+   mock_server_autoresponds (
+      server, auto_ismaster_speculative, &speculative, NULL);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_username (uri, "user");
+   mongoc_uri_set_password (uri, "password");
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+
+   future = future_client_command_simple (
+      client, "test", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+
+   request = mock_server_receives_command (
+      server,
+      "admin",
+      MONGOC_QUERY_SLAVE_OK,
+      "{'saslStart': 1, 'mechanism': 'SCRAM-SHA-1'}");
+   ASSERT (request);
+   mock_server_replies_simple (request, "{'ok': 0, 'errmsg': 'auth failed'}");
+
+   BSON_ASSERT (!future_get_bool (future));
+   ASSERT_ERROR_CONTAINS (
+      error, MONGOC_ERROR_CLIENT, MONGOC_ERROR_CLIENT_AUTHENTICATE, "");
+
+   ASSERT_MATCH (&speculative,
+                 "{'saslStart': 1,"
+                 " 'mechanism': 'SCRAM-SHA-1',"
+                 " 'payload': {'$exists': true},"
+                 " 'db': 'admin'}");
+
+   bson_destroy (&speculative);
+   future_destroy (future);
+   request_destroy (request);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+#endif
+
+
+/* with or without io_uring in this build and kernel, "iouring" connections
+ * send, receive, and time out like polled ones */
+static void
+test_iouring (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_t *client;
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_bool (uri, MONGOC_URI_IOURING, true);
+   mongoc_uri_set_option_as_int32 (uri, MONGOC_URI_SOCKETTIMEOUTMS, 100);
+   client = mongoc_client_new_from_uri (uri);
+
+   future = future_client_command_simple (
+      client, "admin", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+   request = mock_server_receives_command (
+      server, "admin", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+
+   future = future_client_command_simple (
+      client, "admin", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+   request = mock_server_receives_command (
+      server, "admin", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+
+   /* don't reply */
+   BSON_ASSERT (!future_get_bool (future));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_STREAM,
+                          MONGOC_ERROR_STREAM_SOCKET,
+                          "socket error or timeout");
+
+   future_destroy (future);
+   request_destroy (request);
+   mongoc_client_destroy (client);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
 static void
 test_wire_version (void)
 {
@@ -2516,6 +2865,47 @@ test_mongoc_client_fetch_stream_retry_fail (void)
 }
 
 
+/* with socketCheckLocal, an idle socket that polls clean is used without
+ * a ping */
+static void
+test_mongoc_client_socket_check_local (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_t *client;
+   bson_error_t error;
+   request_t *request;
+   future_t *future;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "socketCheckIntervalMS", 50);
+   mongoc_uri_set_option_as_bool (uri, "socketCheckLocal", true);
+   client = mongoc_client_new_from_uri (uri);
+
+   for (i = 0; i < 2; i++) {
+      /* let socketCheckIntervalMS pass before the second command */
+      if (i) {
+         _mongoc_usleep (100 * 1000);
+      }
+
+      future = future_client_command_simple (
+         client, "admin", tmp_bson ("{'foo': 1}"), NULL, NULL, &error);
+      request = mock_server_receives_command (
+         server, "admin", MONGOC_QUERY_SLAVE_OK, "{'foo': 1}");
+      mock_server_replies_ok_and_destroys (request);
+      ASSERT_OR_PRINT (future_get_bool (future), error);
+      future_destroy (future);
+   }
+
+   mongoc_client_destroy (client);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
 #if defined(MONGOC_ENABLE_SSL_OPENSSL) || \
    defined(MONGOC_ENABLE_SSL_SECURE_TRANSPORT)
 static bool
@@ -3150,6 +3540,22 @@ test_client_install (TestSuite *suite)
          suite, "/Client/ipv6/single", test_mongoc_client_ipv6_pooled);
    }
 
+   TestSuite_AddFull (suite,
+                      "/Client/read_commands_pipelined",
+                      test_read_commands_pipelined,
+                      NULL,
+                      NULL,
+                      test_framework_skip_if_max_wire_version_less_than_6);
+   TestSuite_AddFull (suite,
+                      "/Client/read_commands_pipelined/large_batch",
+                      test_read_commands_pipelined_large_batch,
+                      NULL,
+                      NULL,
+                      test_framework_skip_if_max_wire_version_less_than_6);
+   TestSuite_AddMockServerTest (suite,
+                                "/Client/read_commands_pipelined/legacy",
+                                test_read_commands_pipelined_legacy);
+   TestSuite_AddMockServerTest (suite, "/Client/iouring", test_iouring);
    TestSuite_AddFull (suite,
                       "/Client/authenticate",
                       test_mongoc_client_authenticate,
@@ -3168,6 +3574,17 @@ test_client_install (TestSuite *suite)
                       NULL,
                       NULL,
                       test_framework_skip_if_no_auth);
+#ifdef MONGOC_ENABLE_CRYPTO
+   TestSuite_Add (suite,
+                  "/Client/authenticate_cached/process",
+                  test_mongoc_client_authenticate_cached_process);
+   TestSuite_Add (suite,
+                  "/Client/authenticate_pbkdf2",
+                  test_mongoc_client_authenticate_pbkdf2);
+   TestSuite_AddMockServerTest (suite,
+                                "/Client/authenticate_speculative",
+                                test_mongoc_client_authenticate_speculative);
+#endif
    TestSuite_AddFull (suite,
                       "/Client/authenticate_failure",
                       test_mongoc_client_authenticate_failure,
@@ -3366,6 +3783,9 @@ test_client_install (TestSuite *suite)
    TestSuite_AddMockServerTest (suite,
                                 "/Client/fetch_stream/retry/fail",
                                 test_mongoc_client_fetch_stream_retry_fail);
+   TestSuite_AddMockServerTest (suite,
+                                "/Client/socket_check_local",
+                                test_mongoc_client_socket_check_local);
    TestSuite_AddFull (suite,
                       "/Client/null_error_pointer/single",
                       test_null_error_pointer_single,
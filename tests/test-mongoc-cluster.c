@@ -2,6 +2,7 @@
 #include <mongoc.h>
 
 #include "mongoc-client-private.h"
+#include "mongoc-client-pool-private.h"
 #include "mongoc-uri-private.h"
 
 #include "mock_server/mock-server.h"
@@ -314,6 +315,520 @@ test_cluster_command_timeout_pooled (void)
 }
 
 
+/* test that a pooled connection idle past maxIdleTimeMS is closed */
+static void
+test_cluster_max_idle_time (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_cluster_node_t *node;
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+   uint16_t client_port;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "maxIdleTimeMS", 1000);
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'foo': 1}"), NULL, NULL, &error);
+   request =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   client_port = request_get_client_port (request);
+   mock_server_replies_simple (request, "{'ok': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   request_destroy (request);
+   future_destroy (future);
+
+   node = (mongoc_cluster_node_t *) mongoc_set_get (client->cluster.nodes, 1);
+   BSON_ASSERT (node);
+
+   /* an operation longer than maxIdleTimeMS leaves the connection idle from
+    * when it finished */
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'foo': 1}"), NULL, NULL, &error);
+   request =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   node->last_used -= 2000 * 1000;
+   mock_server_replies_simple (request, "{'ok': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   request_destroy (request);
+   future_destroy (future);
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'foo': 1}"), NULL, NULL, &error);
+   request =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   ASSERT_CMPUINT16 (client_port, ==, request_get_client_port (request));
+   mock_server_replies_simple (request, "{'ok': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   request_destroy (request);
+   future_destroy (future);
+
+   /* not idle long enough */
+   ASSERT_CMPUINT32 (_mongoc_cluster_reap_idle_nodes (
+                        &client->cluster, bson_get_monotonic_time (), NULL),
+                     ==,
+                     (uint32_t) 0);
+
+   /* pretend the connection was last used two seconds ago */
+   node->last_used -= 2000 * 1000;
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'foo': 1}"), NULL, NULL, &error);
+   request =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   /* the idle connection was replaced */
+   ASSERT_CMPUINT16 (client_port, !=, request_get_client_port (request));
+   mock_server_replies_simple (request, "{'ok': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   request_destroy (request);
+   future_destroy (future);
+
+   /* the background reaper closes it without a checkout */
+   node = (mongoc_cluster_node_t *) mongoc_set_get (client->cluster.nodes, 1);
+   node->last_used -= 2000 * 1000;
+   ASSERT_CMPUINT32 (_mongoc_cluster_reap_idle_nodes (
+                        &client->cluster, bson_get_monotonic_time (), NULL),
+                     ==,
+                     (uint32_t) 1);
+   BSON_ASSERT (!mongoc_set_get (client->cluster.nodes, 1));
+
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+/* test that a pooled connection past maxConnectionLifetimeMS is replaced,
+ * even if it is in use */
+static void
+test_cluster_max_connection_lifetime (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_cluster_node_t *node;
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+   uint16_t client_port;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "maxConnectionLifetimeMS", 10000);
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'foo': 1}"), NULL, NULL, &error);
+   request =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   client_port = request_get_client_port (request);
+   mock_server_replies_simple (request, "{'ok': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   request_destroy (request);
+   future_destroy (future);
+
+   /* expires up to 10% early */
+   node = (mongoc_cluster_node_t *) mongoc_set_get (client->cluster.nodes, 1);
+   BSON_ASSERT (node);
+   ASSERT_CMPINT64 (
+      node->expire_at, >, node->timestamp + (int64_t) 9000 * 1000);
+   ASSERT_CMPINT64 (
+      node->expire_at, <=, node->timestamp + (int64_t) 10000 * 1000);
+   ASSERT_CMPUINT32 (_mongoc_cluster_reap_idle_nodes (
+                        &client->cluster, bson_get_monotonic_time (), NULL),
+                     ==,
+                     (uint32_t) 0);
+
+   /* pretend the connection expired, though it was just used */
+   node->expire_at = bson_get_monotonic_time () - 1;
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'foo': 1}"), NULL, NULL, &error);
+   request =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   ASSERT_CMPUINT16 (client_port, !=, request_get_client_port (request));
+   mock_server_replies_simple (request, "{'ok': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   request_destroy (request);
+   future_destroy (future);
+
+   /* the background reaper closes it without a checkout */
+   node = (mongoc_cluster_node_t *) mongoc_set_get (client->cluster.nodes, 1);
+   node->expire_at = bson_get_monotonic_time () - 1;
+   ASSERT_CMPUINT32 (_mongoc_cluster_reap_idle_nodes (
+                        &client->cluster, bson_get_monotonic_time (), NULL),
+                     ==,
+                     (uint32_t) 1);
+   BSON_ASSERT (!mongoc_set_get (client->cluster.nodes, 1));
+
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+/* test that commands over slowOpThresholdMS are logged with their shape */
+static void
+test_cluster_slow_op_log (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_t *client;
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "slowOpThresholdMS", 0);
+   client = mongoc_client_new_from_uri (uri);
+
+   capture_logs (true);
+   future = future_client_command_simple (
+      client,
+      "db",
+      tmp_bson ("{'count': 'coll', 'query': {'a': 1, 'b': {'$gt': 2}}}"),
+      NULL,
+      NULL,
+      &error);
+   request =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   mock_server_replies_simple (request, "{'ok': 1, 'n': 1}");
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   request_destroy (request);
+   future_destroy (future);
+
+   ASSERT_CAPTURED_LOG ("slowOpThresholdMS",
+                        MONGOC_LOG_LEVEL_MESSAGE,
+                        "command=count ns=db.coll server=");
+   ASSERT_CAPTURED_LOG ("slowOpThresholdMS",
+                        MONGOC_LOG_LEVEL_MESSAGE,
+                        "filter={ \"a\" : ?, \"b\" : { \"$gt\" : ? } }");
+
+   mongoc_client_destroy (client);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+/* timeoutMS limits the whole operation, including waiting for the reply */
+static void
+test_cluster_timeout_ms (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_t *client;
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "timeoutMS", 200);
+   client = mongoc_client_new_from_uri (uri);
+   ASSERT_CMPINT32 (client->cluster.timeout_msec, ==, 200);
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   BSON_ASSERT (!future_get_bool (future));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_CLIENT,
+                          MONGOC_ERROR_CLIENT_OPERATION_TIMEOUT,
+                          "Operation exceeded timeoutMS");
+   BSON_ASSERT (!client->cluster.deadline);
+   request_destroy (request);
+   future_destroy (future);
+
+   /* "timeoutMS" in opts overrides the URI's, and isn't sent */
+   future = future_client_read_command_with_opts (
+      client,
+      "db",
+      tmp_bson ("{'ping': 2}"),
+      NULL,
+      tmp_bson ("{'timeoutMS': 0}"),
+      NULL,
+      &error);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_SLAVE_OK,
+      "{'ping': 2, 'timeoutMS': {'$exists': false}}");
+   _mongoc_usleep (400 * 1000);
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+
+   mongoc_client_destroy (client);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+static void
+_timeout_ms_started_cb (const mongoc_apm_command_started_t *event)
+{
+   int *n_started;
+
+   n_started = (int *) mongoc_apm_command_started_get_context (event);
+   (*n_started)++;
+
+   ASSERT_MATCH (mongoc_apm_command_started_get_command (event),
+                 "{'ping': 1, 'maxTimeMS': {'$exists': true}}");
+}
+
+
+/* a command sent with OP_MSG tells the server the time left */
+static void
+test_cluster_timeout_ms_max_time_ms (void *ctx)
+{
+   mongoc_client_t *client;
+   mongoc_apm_callbacks_t *callbacks;
+   bson_iter_t iter;
+   bson_t reply;
+   bson_error_t error;
+   int n_started = 0;
+
+   client = test_framework_client_new ();
+   callbacks = mongoc_apm_callbacks_new ();
+   mongoc_apm_set_command_started_cb (callbacks, _timeout_ms_started_cb);
+   mongoc_client_set_apm_callbacks (client, callbacks, &n_started);
+
+   ASSERT_OR_PRINT (
+      mongoc_client_read_command_with_opts (client,
+                                            "admin",
+                                            tmp_bson ("{'ping': 1}"),
+                                            NULL,
+                                            tmp_bson ("{'timeoutMS': 10000}"),
+                                            &reply,
+                                            &error),
+      error);
+   ASSERT_CMPINT (n_started, ==, 1);
+   BSON_ASSERT (!bson_iter_init_find (&iter, &reply, "maxTimeMS"));
+
+   bson_destroy (&reply);
+   mongoc_apm_callbacks_destroy (callbacks);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+_opmsg_suffix_started_cb (const mongoc_apm_command_started_t *event)
+{
+   int *n_started;
+
+   n_started = (int *) mongoc_apm_command_started_get_context (event);
+   (*n_started)++;
+
+   ASSERT_MATCH (mongoc_apm_command_started_get_command (event),
+                 "{'ping': 1, '$db': 'admin'}");
+}
+
+
+/* test that an OP_MSG command is sent from the caller's body, followed by
+ * the fields the driver appends, without copying the body */
+static void
+test_cluster_opmsg_suffix (void *ctx)
+{
+   mongoc_client_t *client;
+   mongoc_apm_callbacks_t *callbacks;
+   mongoc_server_stream_t *server_stream;
+   mongoc_cmd_parts_t parts;
+   bson_t *body;
+   const bson_t *command;
+   bson_t storage;
+   bson_t reply;
+   bson_error_t error;
+   int n_started = 0;
+
+   client = test_framework_client_new ();
+   callbacks = mongoc_apm_callbacks_new ();
+   mongoc_apm_set_command_started_cb (callbacks, _opmsg_suffix_started_cb);
+   mongoc_client_set_apm_callbacks (client, callbacks, &n_started);
+
+   server_stream =
+      mongoc_cluster_stream_for_reads (&client->cluster, NULL, &error);
+   ASSERT_OR_PRINT (server_stream, error);
+
+   body = tmp_bson ("{'ping': 1}");
+   mongoc_cmd_parts_init (&parts, "admin", MONGOC_QUERY_NONE, body);
+   ASSERT_OR_PRINT (
+      mongoc_cmd_parts_assemble (&parts, server_stream, &error), error);
+
+   BSON_ASSERT (parts.assembled.command == body);
+   BSON_ASSERT (parts.assembled.command_suffix);
+
+   command = mongoc_cmd_get_command (&parts.assembled, &storage);
+   ASSERT_MATCH (command, "{'ping': 1, '$db': 'admin'}");
+   ASSERT_CMPUINT32 (mongoc_cmd_get_len (&parts.assembled), ==, command->len);
+   bson_destroy (&storage);
+
+   ASSERT_OR_PRINT (mongoc_cluster_run_command_monitored (
+                       &client->cluster, &parts.assembled, &reply, &error),
+                    error);
+   ASSERT_CMPINT (n_started, ==, 1);
+
+   bson_destroy (&reply);
+   mongoc_cmd_parts_cleanup (&parts);
+   mongoc_server_stream_cleanup (server_stream);
+   mongoc_apm_callbacks_destroy (callbacks);
+   mongoc_client_destroy (client);
+}
+
+
+static uint16_t
+_shared_connection_command (mock_server_t *server,
+                            mongoc_client_t *client,
+                            bool hang_up)
+{
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+   uint16_t client_port;
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'foo': 1}"), NULL, NULL, &error);
+   request =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   client_port = request_get_client_port (request);
+
+   if (hang_up) {
+      mock_server_hangs_up (request);
+      BSON_ASSERT (!future_get_bool (future));
+   } else {
+      mock_server_replies_simple (request, "{'ok': 1}");
+      ASSERT_OR_PRINT (future_get_bool (future), error);
+   }
+
+   request_destroy (request);
+   future_destroy (future);
+
+   return client_port;
+}
+
+
+static void
+test_cluster_shared_connections (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client_a;
+   mongoc_client_t *client_b;
+   uint16_t client_port;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_bool (uri, "sharedConnections", true);
+   pool = mongoc_client_pool_new (uri);
+   client_a = mongoc_client_pool_pop (pool);
+   client_b = mongoc_client_pool_pop (pool);
+
+   /* both clients borrow the same connection in turn */
+   client_port = _shared_connection_command (server, client_a, false);
+   ASSERT_CMPUINT16 (
+      client_port, ==, _shared_connection_command (server, client_b, false));
+
+   /* neither holds a connection between operations */
+   ASSERT_CMPSIZE_T (client_a->cluster.nodes->items_len, ==, (size_t) 0);
+   ASSERT_CMPSIZE_T (client_b->cluster.nodes->items_len, ==, (size_t) 0);
+
+   /* a network error closes the shared connection */
+   capture_logs (true);
+   _shared_connection_command (server, client_b, true);
+   ASSERT_CMPUINT16 (
+      client_port, !=, _shared_connection_command (server, client_a, false));
+
+   mongoc_client_pool_push (pool, client_a);
+   mongoc_client_pool_push (pool, client_b);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+/* a client that finds no idle shared connection waits for a background
+ * connection, or for another client to return one */
+static void
+test_cluster_shared_connections_background (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *clients[3];
+   future_t *futures[3];
+   request_t *requests[3];
+   bson_error_t errors[3];
+   uint16_t client_port;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_bool (uri, "sharedConnections", true);
+   mongoc_uri_set_option_as_int32 (uri, "maxConnecting", 1);
+   pool = mongoc_client_pool_new (uri);
+
+   for (i = 0; i < 3; i++) {
+      clients[i] = mongoc_client_pool_pop (pool);
+   }
+
+   futures[0] = future_client_command_simple (
+      clients[0], "db", tmp_bson ("{'foo': 1}"), NULL, NULL, &errors[0]);
+   requests[0] =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   client_port = request_get_client_port (requests[0]);
+
+   /* the connection is in use, so another is opened for the next client */
+   for (i = 1; i < 3; i++) {
+      futures[i] = future_client_command_simple (
+         clients[i], "db", tmp_bson ("{'foo': 1}"), NULL, NULL, &errors[i]);
+   }
+
+   requests[1] =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   ASSERT_CMPUINT16 (client_port, !=, request_get_client_port (requests[1]));
+
+   /* the last client takes a returned connection or a new one */
+   mock_server_replies_simple (requests[0], "{'ok': 1}");
+   requests[2] =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   mock_server_replies_simple (requests[1], "{'ok': 1}");
+   mock_server_replies_simple (requests[2], "{'ok': 1}");
+
+   for (i = 0; i < 3; i++) {
+      ASSERT_OR_PRINT (future_get_bool (futures[i]), errors[i]);
+      future_destroy (futures[i]);
+      request_destroy (requests[i]);
+      mongoc_client_pool_push (pool, clients[i]);
+   }
+
+   /* the establishers' client is not one of the pool's */
+   ASSERT_CMPSIZE_T (mongoc_client_pool_get_size (pool), ==, (size_t) 3);
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
 static void
 _test_write_disconnect (void)
 {
@@ -1085,6 +1600,136 @@ dollar_query_test_t tests[] = {
    {NULL}};
 
 
+/* a pooled client's server streams share the topology snapshot's server
+ * description, and carry the latest $clusterTime */
+static void
+test_cluster_server_stream_snapshot (void)
+{
+   mock_server_t *server;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_server_stream_t *server_stream;
+   mongoc_server_stream_t *server_stream2;
+   bson_error_t error;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   pool = mongoc_client_pool_new (mock_server_get_uri (server));
+   client = mongoc_client_pool_pop (pool);
+
+   server_stream =
+      mongoc_cluster_stream_for_reads (&client->cluster, NULL, &error);
+   ASSERT_OR_PRINT (server_stream, error);
+   BSON_ASSERT (server_stream->snapshot);
+   BSON_ASSERT (bson_empty (&server_stream->cluster_time));
+
+   _mongoc_topology_update_cluster_time (
+      client->topology,
+      tmp_bson ("{'$clusterTime': {'clusterTime': {'$timestamp': "
+                "{'t': 1, 'i': 1}}}}"));
+
+   server_stream2 =
+      mongoc_cluster_stream_for_reads (&client->cluster, NULL, &error);
+   ASSERT_OR_PRINT (server_stream2, error);
+   BSON_ASSERT (server_stream2->sd == server_stream->sd);
+   ASSERT_MATCH (&server_stream2->cluster_time,
+                 "{'clusterTime': {'$timestamp': {'t': 1, 'i': 1}}}");
+
+   mongoc_server_stream_cleanup (server_stream2);
+   mongoc_server_stream_cleanup (server_stream);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mock_server_destroy (server);
+}
+
+
+#define CLUSTER_TIME_REPLY(_t, _i)                                      \
+   tmp_bson ("{'$clusterTime': {'clusterTime': {'$timestamp': "        \
+             "{'t': %d, 'i': %d}}, 'signature': %d}}",                 \
+             (_t),                                                      \
+             (_i),                                                      \
+             (_t) * 10 + (_i))
+
+/* a reply's $clusterTime only replaces a lower one, whether or not the
+ * unlocked check lets it through */
+static void
+test_cluster_time_seen (void)
+{
+   mongoc_client_t *client;
+   mongoc_topology_t *topology;
+
+   client = mongoc_client_new ("mongodb://server");
+   topology = client->topology;
+   ASSERT_CMPINT64 (topology->cluster_time_seen, ==, (int64_t) 0);
+
+   _mongoc_topology_update_cluster_time (topology, tmp_bson ("{'ok': 1}"));
+   ASSERT_CMPINT64 (topology->cluster_time_seen, ==, (int64_t) 0);
+
+   _mongoc_topology_update_cluster_time (topology, CLUSTER_TIME_REPLY (2, 2));
+   ASSERT_CMPINT64 (
+      topology->cluster_time_seen, ==, ((int64_t) 2 << 32) | 2);
+   ASSERT_MATCH (&topology->description.cluster_time, "{'signature': 22}");
+
+   /* earlier, and equal */
+   _mongoc_topology_update_cluster_time (topology, CLUSTER_TIME_REPLY (1, 3));
+   _mongoc_topology_update_cluster_time (topology, CLUSTER_TIME_REPLY (2, 1));
+   _mongoc_topology_update_cluster_time (topology, CLUSTER_TIME_REPLY (2, 2));
+   ASSERT_CMPINT64 (
+      topology->cluster_time_seen, ==, ((int64_t) 2 << 32) | 2);
+   ASSERT_MATCH (&topology->description.cluster_time, "{'signature': 22}");
+
+   /* a later increment, then a later timestamp */
+   _mongoc_topology_update_cluster_time (topology, CLUSTER_TIME_REPLY (2, 3));
+   ASSERT_MATCH (&topology->description.cluster_time, "{'signature': 23}");
+   _mongoc_topology_update_cluster_time (topology, CLUSTER_TIME_REPLY (3, 0));
+   ASSERT_CMPINT64 (topology->cluster_time_seen, ==, (int64_t) 3 << 32);
+   ASSERT_MATCH (&topology->description.cluster_time, "{'signature': 30}");
+
+   mongoc_client_destroy (client);
+}
+
+
+/* which errors a read or write is retried after, and the "retryReads" URI
+ * option */
+static void
+test_cluster_retryable_errors (void)
+{
+   mongoc_client_t *client;
+   bson_error_t error = {0};
+
+   error.domain = MONGOC_ERROR_STREAM;
+   error.code = MONGOC_ERROR_STREAM_SOCKET;
+   ASSERT (_mongoc_cluster_error_is_retryable (&error));
+
+   error.domain = MONGOC_ERROR_SERVER;
+   error.code = 10107; /* NotMaster */
+   ASSERT (_mongoc_cluster_error_is_retryable (&error));
+
+   error.domain = MONGOC_ERROR_QUERY;
+   error.code = 11600; /* InterruptedAtShutdown */
+   ASSERT (_mongoc_cluster_error_is_retryable (&error));
+
+   error.domain = MONGOC_ERROR_SERVER;
+   error.code = 2; /* BadValue */
+   ASSERT (!_mongoc_cluster_error_is_retryable (&error));
+
+   error.domain = MONGOC_ERROR_SERVER_SELECTION;
+   error.code = MONGOC_ERROR_SERVER_SELECTION_FAILURE;
+   ASSERT (!_mongoc_cluster_error_is_retryable (&error));
+
+   client = mongoc_client_new ("mongodb://server");
+   ASSERT (!client->cluster.retry_reads);
+   mongoc_client_destroy (client);
+
+   client = mongoc_client_new ("mongodb://server/?retryReads=true");
+   ASSERT (client->cluster.retry_reads);
+   ASSERT (!client->cluster.retry_writes);
+   mongoc_client_destroy (client);
+}
+
+#undef CLUSTER_TIME_REPLY
+
+
 void
 test_cluster_install (TestSuite *suite)
 {
@@ -1126,6 +1771,35 @@ test_cluster_install (TestSuite *suite)
    TestSuite_AddMockServerTest (suite,
                                 "/Cluster/command/timeout/pooled",
                                 test_cluster_command_timeout_pooled);
+   TestSuite_AddMockServerTest (
+      suite, "/Cluster/max_idle_time", test_cluster_max_idle_time);
+   TestSuite_AddMockServerTest (suite,
+                                "/Cluster/max_connection_lifetime",
+                                test_cluster_max_connection_lifetime);
+   TestSuite_AddMockServerTest (
+      suite, "/Cluster/shared_connections", test_cluster_shared_connections);
+   TestSuite_AddMockServerTest (suite,
+                                "/Cluster/shared_connections/background",
+                                test_cluster_shared_connections_background);
+   TestSuite_AddMockServerTest (
+      suite, "/Cluster/slow_op_log", test_cluster_slow_op_log);
+   TestSuite_AddMockServerTest (
+      suite, "/Cluster/timeout_ms", test_cluster_timeout_ms);
+   TestSuite_AddFull (suite,
+                      "/Cluster/timeout_ms/max_time_ms",
+                      test_cluster_timeout_ms_max_time_ms,
+                      NULL,
+                      NULL,
+                      test_framework_skip_if_max_wire_version_less_than_6);
+   TestSuite_Add (suite, "/Cluster/cluster_time/seen", test_cluster_time_seen);
+   TestSuite_Add (
+      suite, "/Cluster/retryable_errors", test_cluster_retryable_errors);
+   TestSuite_AddFull (suite,
+                      "/Cluster/opmsg_suffix",
+                      test_cluster_opmsg_suffix,
+                      NULL,
+                      NULL,
+                      test_framework_skip_if_max_wire_version_less_than_6);
    TestSuite_AddFull (suite,
                       "/Cluster/write_command/disconnect",
                       test_write_command_disconnect,
@@ -1168,6 +1842,9 @@ test_cluster_install (TestSuite *suite)
    TestSuite_AddLive (suite,
                       "/Cluster/cluster_time/insert/pooled",
                       test_cluster_time_insert_pooled);
+   TestSuite_AddMockServerTest (suite,
+                                "/Cluster/server_stream/snapshot",
+                                test_cluster_server_stream_snapshot);
 #ifdef TODO_MOCK_SERVER_OP_MSG
    TestSuite_AddMockServerTest (suite,
                                 "/Cluster/cluster_time/comparison/single",
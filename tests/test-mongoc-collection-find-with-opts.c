@@ -947,6 +947,67 @@ test_server_id_option (void)
    mongoc_client_destroy (client);
 }
 
+/* hedgeDelayMS is the driver's option, not the server's */
+static void
+test_hedge_delay (void)
+{
+   test_collection_find_with_opts_t test_data = {0};
+
+   test_data.opts = "{'hedgeDelayMS': 10}";
+   test_data.read_prefs = mongoc_read_prefs_new (MONGOC_READ_NEAREST);
+   test_data.expected_op_query =
+      "{'$query': {}, '$hedgeDelayMS': {'$exists': false}}";
+   test_data.expected_find_command = "{'find': 'collection', 'filter': {},"
+                                     " 'hedgeDelayMS': {'$exists': false}}";
+
+   _test_collection_find_with_opts (&test_data);
+
+   mongoc_read_prefs_destroy (test_data.read_prefs);
+}
+
+
+static void
+test_hedge_delay_option (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   bson_t *q;
+   bson_error_t error;
+   mongoc_cursor_t *cursor;
+
+   /* options are validated when the cursor is created, without I/O */
+   client = mongoc_client_new ("mongodb://localhost");
+   collection = mongoc_client_get_collection (client, "db", "collection");
+   q = tmp_bson (NULL);
+   cursor = mongoc_collection_find_with_opts (
+      collection, q, tmp_bson ("{'hedgeDelayMS': 'foo'}"), NULL);
+
+   ASSERT_ERROR_CONTAINS (cursor->error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "must be a non-negative 32-bit integer");
+
+   mongoc_cursor_destroy (cursor);
+   cursor = mongoc_collection_find_with_opts (
+      collection, q, tmp_bson ("{'hedgeDelayMS': -1}"), NULL);
+
+   ASSERT_ERROR_CONTAINS (cursor->error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "must be a non-negative 32-bit integer");
+
+   mongoc_cursor_destroy (cursor);
+   cursor = mongoc_collection_find_with_opts (
+      collection, q, tmp_bson ("{'hedgeDelayMS': 5}"), NULL);
+
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+   ASSERT_CMPINT (cursor->hedge_delay_msec, ==, 5);
+
+   mongoc_cursor_destroy (cursor);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
 static void
 test_find_with_opts_collation_error (void *ctx)
 {
@@ -1059,6 +1120,11 @@ test_collection_find_with_opts_install (TestSuite *suite)
    TestSuite_AddLive (suite,
                       "/Collection/find_with_opts/server_id/option",
                       test_server_id_option);
+   TestSuite_AddMockServerTest (
+      suite, "/Collection/find_with_opts/hedge_delay", test_hedge_delay);
+   TestSuite_Add (suite,
+                  "/Collection/find_with_opts/hedge_delay/option",
+                  test_hedge_delay_option);
    TestSuite_AddFull (suite,
                       "/Collection/find_with_opts/collation/error",
                       test_find_with_opts_collation_error,
@@ -426,6 +426,69 @@ test_copy (void)
 }
 
 
+/* handles share their client's read prefs and concerns until they set their
+ * own, and may outlive the client's */
+static void
+test_shared_concerns (void)
+{
+   mongoc_client_t *client;
+   mongoc_database_t *database;
+   mongoc_collection_t *collection;
+   mongoc_collection_t *copy;
+   mongoc_write_concern_t *wc;
+
+   client = mongoc_client_new ("mongodb://localhost/?w=2&readConcernLevel=local"
+                               "&readPreference=secondary");
+   database = mongoc_client_get_database (client, "db");
+   collection = mongoc_database_get_collection (database, "c");
+   copy = mongoc_collection_copy (collection);
+
+   ASSERT (mongoc_collection_get_write_concern (collection) ==
+           mongoc_client_get_write_concern (client));
+   ASSERT (mongoc_collection_get_read_concern (copy) ==
+           mongoc_client_get_read_concern (client));
+   ASSERT (mongoc_collection_get_read_prefs (copy) ==
+           mongoc_client_get_read_prefs (client));
+
+   /* setting one copies it, the others are unaffected */
+   wc = mongoc_write_concern_new ();
+   mongoc_write_concern_set_w (wc, 3);
+   mongoc_collection_set_write_concern (copy, wc);
+   mongoc_write_concern_destroy (wc);
+   ASSERT_CMPINT (
+      mongoc_write_concern_get_w (mongoc_collection_get_write_concern (copy)),
+      ==,
+      3);
+   ASSERT_CMPINT (mongoc_write_concern_get_w (
+                     mongoc_collection_get_write_concern (collection)),
+                  ==,
+                  2);
+
+   /* replacing the client's leaves the handles theirs */
+   wc = mongoc_write_concern_new ();
+   mongoc_write_concern_set_w (wc, 4);
+   mongoc_client_set_write_concern (client, wc);
+   mongoc_write_concern_destroy (wc);
+   ASSERT_CMPINT (mongoc_write_concern_get_w (
+                     mongoc_database_get_write_concern (database)),
+                  ==,
+                  2);
+
+   mongoc_client_destroy (client);
+   ASSERT_CMPSTR (mongoc_read_concern_get_level (
+                     mongoc_collection_get_read_concern (collection)),
+                  "local");
+   ASSERT_CMPINT (mongoc_read_prefs_get_mode (
+                     mongoc_collection_get_read_prefs (collection)),
+                  ==,
+                  MONGOC_READ_SECONDARY);
+
+   mongoc_collection_destroy (copy);
+   mongoc_collection_destroy (collection);
+   mongoc_database_destroy (database);
+}
+
+
 static void
 test_insert (void)
 {
@@ -2303,6 +2366,106 @@ test_count_with_opts (void)
 }
 
 
+static int64_t
+_estimated_count_from_server (mock_server_t *server,
+                              mongoc_collection_t *collection,
+                              const bson_t *opts,
+                              int64_t n)
+{
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+   bson_t reply;
+   char *reply_json;
+   int64_t count;
+
+   future = future_collection_estimated_document_count (
+      collection, opts, NULL, &reply, &error);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'count': 'collection', 'query': {'$exists': false},"
+      " 'cacheTTLMS': {'$exists': false}}");
+   reply_json = bson_strdup_printf ("{'ok': 1, 'n': %" PRId64 "}", n);
+   mock_server_replies_simple (request, reply_json);
+
+   count = future_get_int64_t (future);
+   ASSERT_OR_PRINT (count != -1, error);
+   ASSERT_MATCH (&reply, "{'n': %" PRId64 "}", n);
+
+   bson_destroy (&reply);
+   bson_free (reply_json);
+   request_destroy (request);
+   future_destroy (future);
+
+   return count;
+}
+
+
+/* a count without a query, which can be reused for "cacheTTLMS" */
+static void
+test_estimated_document_count (void)
+{
+   mock_server_t *server;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_t *cache_opts;
+   bson_error_t error;
+   bson_t reply;
+
+   server = mock_mongos_new (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "collection");
+   cache_opts = tmp_bson ("{'cacheTTLMS': 60000}");
+
+   ASSERT_CMPINT64 (
+      _estimated_count_from_server (server, collection, NULL, 1),
+      ==,
+      (int64_t) 1);
+
+   /* not reused, since the first count had no "cacheTTLMS" */
+   ASSERT_CMPINT64 (
+      _estimated_count_from_server (server, collection, cache_opts, 2),
+      ==,
+      (int64_t) 2);
+
+   /* the mock server would fail the test if it received a command */
+   ASSERT_CMPINT64 (mongoc_collection_estimated_document_count (
+                       collection, cache_opts, NULL, &reply, &error),
+                    ==,
+                    (int64_t) 2);
+   ASSERT_MATCH (&reply, "{'ok': 1, 'n': 2}");
+   bson_destroy (&reply);
+
+   ASSERT_CMPINT64 (mongoc_collection_estimated_document_count (
+                       collection,
+                       tmp_bson ("{'cacheTTLMS': 'a'}"),
+                       NULL,
+                       &reply,
+                       &error),
+                    ==,
+                    (int64_t) -1);
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "\"cacheTTLMS\" must be a non-negative int32");
+   ASSERT (bson_empty (&reply));
+   bson_destroy (&reply);
+
+   /* a count without "cacheTTLMS" is always sent */
+   ASSERT_CMPINT64 (
+      _estimated_count_from_server (server, collection, NULL, 3),
+      ==,
+      (int64_t) 3);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
 static void
 test_count_with_collation (int wire)
 {
@@ -3546,6 +3709,136 @@ test_many_return (void)
 }
 
 
+static void
+test_parallel_scan (void *ctx)
+{
+   enum { N_DOCS = 1000, N_CURSORS = 4 };
+
+   mongoc_client_t *clients[N_CURSORS];
+   mongoc_collection_t *collections[N_CURSORS];
+   mongoc_cursor_t *cursors[N_CURSORS];
+   mongoc_collection_t *other;
+   bool seen[N_DOCS] = {false};
+   uint32_t n_cursors;
+   const bson_t *doc;
+   bson_iter_t iter;
+   bson_error_t error;
+   int32_t id;
+   int n_seen = 0;
+   int i;
+
+   for (i = 0; i < N_CURSORS; i++) {
+      clients[i] = test_framework_client_new ();
+      collections[i] =
+         mongoc_client_get_collection (clients[i], "test", "parallel_scan");
+   }
+
+   mongoc_collection_drop (collections[0], NULL);
+   for (i = 0; i < N_DOCS; i++) {
+      ASSERT_OR_PRINT (mongoc_collection_insert (collections[0],
+                                                 MONGOC_INSERT_NONE,
+                                                 tmp_bson ("{'_id': %d}", i),
+                                                 NULL,
+                                                 &error),
+                       error);
+   }
+
+   ASSERT_OR_PRINT (mongoc_collection_parallel_scan (collections,
+                                                     N_CURSORS,
+                                                     tmp_bson ("{}"),
+                                                     NULL,
+                                                     NULL,
+                                                     cursors,
+                                                     &n_cursors,
+                                                     &error),
+                    error);
+
+   ASSERT_CMPUINT32 (n_cursors, ==, (uint32_t) N_CURSORS);
+
+   /* each document is in exactly one range */
+   for (i = 0; i < (int) n_cursors; i++) {
+      while (mongoc_cursor_next (cursors[i], &doc)) {
+         ASSERT (bson_iter_init_find (&iter, doc, "_id"));
+         id = bson_iter_int32 (&iter);
+         ASSERT (id >= 0 && id < N_DOCS);
+         ASSERT (!seen[id]);
+         seen[id] = true;
+         n_seen++;
+      }
+
+      ASSERT_OR_PRINT (!mongoc_cursor_error (cursors[i], &error), error);
+      mongoc_cursor_destroy (cursors[i]);
+   }
+
+   ASSERT_CMPINT (n_seen, ==, N_DOCS);
+
+   /* a filter matching one document gives one range */
+   ASSERT_OR_PRINT (mongoc_collection_parallel_scan (collections,
+                                                     N_CURSORS,
+                                                     tmp_bson ("{'_id': 7}"),
+                                                     NULL,
+                                                     NULL,
+                                                     cursors,
+                                                     &n_cursors,
+                                                     &error),
+                    error);
+
+   ASSERT_CMPUINT32 (n_cursors, <=, (uint32_t) 2);
+   n_seen = 0;
+   for (i = 0; i < (int) n_cursors; i++) {
+      while (mongoc_cursor_next (cursors[i], &doc)) {
+         n_seen++;
+      }
+
+      ASSERT_OR_PRINT (!mongoc_cursor_error (cursors[i], &error), error);
+      mongoc_cursor_destroy (cursors[i]);
+   }
+
+   ASSERT_CMPINT (n_seen, ==, 1);
+
+   /* invalid arguments */
+   ASSERT (!mongoc_collection_parallel_scan (collections,
+                                             N_CURSORS,
+                                             tmp_bson ("{}"),
+                                             tmp_bson ("{'hint': {'_id': 1}}"),
+                                             NULL,
+                                             cursors,
+                                             &n_cursors,
+                                             &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Cannot use \"min\", \"max\", or \"hint\"");
+   ASSERT_CMPUINT32 (n_cursors, ==, (uint32_t) 0);
+
+   other = collections[1];
+   collections[1] =
+      mongoc_client_get_collection (clients[1], "test", "parallel_scan_other");
+   ASSERT (!mongoc_collection_parallel_scan (collections,
+                                             N_CURSORS,
+                                             tmp_bson ("{}"),
+                                             NULL,
+                                             NULL,
+                                             cursors,
+                                             &n_cursors,
+                                             &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Cannot scan \"test.parallel_scan\" and "
+                          "\"test.parallel_scan_other\" together");
+   mongoc_collection_destroy (collections[1]);
+   collections[1] = other;
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collections[0], &error), error);
+
+   for (i = 0; i < N_CURSORS; i++) {
+      mongoc_collection_destroy (collections[i]);
+      mongoc_client_destroy (clients[i]);
+   }
+}
+
+
 /* use a mock server to test the "limit" parameter */
 static void
 test_find_limit (void)
@@ -3900,6 +4193,209 @@ test_find_indexes_err (void)
 }
 
 
+/* run listIndexes on the mock server, which replies with one index named
+ * @name */
+static void
+_find_indexes_from_server (mock_server_t *server,
+                           mongoc_collection_t *collection,
+                           const char *name)
+{
+   future_t *future;
+   request_t *request;
+   mongoc_cursor_t *cursor;
+   bson_error_t error;
+   const bson_t *doc;
+   char *index_json;
+
+   index_json = bson_strdup_printf ("{'name': '%s'}", name);
+   future = future_collection_find_indexes (collection, &error);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'listIndexes': 'collection'}");
+   mock_server_replies_to_find (request,
+                                MONGOC_QUERY_SLAVE_OK,
+                                0,
+                                1,
+                                "db.collection",
+                                index_json,
+                                true);
+
+   cursor = future_get_mongoc_cursor_ptr (future);
+   BSON_ASSERT (cursor);
+   BSON_ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT_MATCH (doc, "{'name': '%s'}", name);
+   BSON_ASSERT (!mongoc_cursor_next (cursor, &doc));
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+
+   mongoc_cursor_destroy (cursor);
+   request_destroy (request);
+   future_destroy (future);
+   bson_free (index_json);
+}
+
+
+/* with "metadataCacheTTLMS", repeated listIndexes are answered locally until
+ * the client changes the collection's indexes */
+static void
+test_find_indexes_cached (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_t *client;
+   mongoc_database_t *database;
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+   const bson_t *doc;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "metadataCacheTTLMS", 60 * 1000);
+   client = mongoc_client_new_from_uri (uri);
+   database = mongoc_client_get_database (client, "db");
+   collection = mongoc_client_get_collection (client, "db", "collection");
+
+   _find_indexes_from_server (server, collection, "_id_");
+
+   /* the mock server would fail the test if it received a command */
+   for (i = 0; i < 2; i++) {
+      cursor = mongoc_collection_find_indexes (collection, &error);
+      BSON_ASSERT (cursor);
+      BSON_ASSERT (mongoc_cursor_next (cursor, &doc));
+      ASSERT_MATCH (doc, "{'name': '_id_'}");
+      BSON_ASSERT (!mongoc_cursor_next (cursor, &doc));
+      mongoc_cursor_destroy (cursor);
+   }
+
+   future = future_database_command_simple (
+      database,
+      tmp_bson ("{'dropIndexes': 'collection', 'index': '*'}"),
+      NULL,
+      NULL,
+      &error);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_NONE, "{'dropIndexes': 'collection'}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+
+   _find_indexes_from_server (server, collection, "a_1");
+
+   mongoc_client_invalidate_metadata_cache (client, "db", NULL);
+   _find_indexes_from_server (server, collection, "b_1");
+
+   mongoc_collection_destroy (collection);
+   mongoc_database_destroy (database);
+   mongoc_client_destroy (client);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+static void
+_find_one_from_server (mock_server_t *server,
+                       mongoc_collection_t *collection,
+                       int value)
+{
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+   bson_t doc;
+   char *reply;
+
+   future = future_collection_find_one_with_opts (
+      collection, tmp_bson ("{'a': 1}"), NULL, NULL, &doc, &error);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_SLAVE_OK,
+      "{'find': 'collection', 'filter': {'a': 1}, 'limit': 1}");
+   reply = bson_strdup_printf ("{'ok': 1, 'cursor': {'id': 0,"
+                               " 'ns': 'db.collection',"
+                               " 'firstBatch': [{'a': 1, 'b': %d}]}}",
+                               value);
+   mock_server_replies_simple (request, reply);
+
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   ASSERT_MATCH (&doc, "{'a': 1, 'b': %d}", value);
+
+   bson_destroy (&doc);
+   bson_free (reply);
+   request_destroy (request);
+   future_destroy (future);
+}
+
+
+/* with a find cache, repeated finds are answered locally until they expire
+ * or the client writes to the collection */
+static void
+test_find_cache (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+   bson_t doc;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "collection");
+
+   ASSERT (!mongoc_collection_enable_find_cache (
+      collection, tmp_bson ("{'ttlMS': 0}"), &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "\"ttlMS\" must be an int32 of at least 1");
+   ASSERT (!mongoc_collection_enable_find_cache (
+      collection, tmp_bson ("{'foo': 1}"), &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Invalid find cache option \"foo\"");
+
+   ASSERT_OR_PRINT (mongoc_collection_enable_find_cache (
+                       collection, tmp_bson ("{'ttlMS': 60000}"), &error),
+                    error);
+
+   _find_one_from_server (server, collection, 1);
+
+   /* the mock server would fail the test if it received a command */
+   for (i = 0; i < 2; i++) {
+      ASSERT_OR_PRINT (
+         mongoc_collection_find_one_with_opts (
+            collection, tmp_bson ("{'a': 1}"), NULL, NULL, &doc, &error),
+         error);
+      ASSERT_MATCH (&doc, "{'a': 1, 'b': 1}");
+      bson_destroy (&doc);
+   }
+
+   future = future_collection_insert (
+      collection, MONGOC_INSERT_NONE, tmp_bson ("{'_id': 1}"), NULL, &error);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_NONE, "{'insert': 'collection'}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+
+   _find_one_from_server (server, collection, 2);
+
+   mongoc_collection_disable_find_cache (collection);
+   _find_one_from_server (server, collection, 3);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
 static void
 test_aggregate_install (TestSuite *suite)
 {
@@ -4555,26 +5051,583 @@ test_create_index_fail (void *context)
    mongoc_client_destroy (client);
 }
 
-void
-test_collection_install (TestSuite *suite)
+static void
+test_create_indexes (void)
 {
-   test_aggregate_install (suite);
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   const bson_t *models[2];
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_t reply;
+   bson_error_t error;
+   int n = 0;
 
-   TestSuite_AddLive (suite,
-                      "/Collection/aggregate/write_concern",
-                      test_aggregate_w_write_concern);
-   TestSuite_AddLive (
-      suite, "/Collection/read_prefs_is_valid", test_read_prefs_is_valid);
-   TestSuite_AddLive (suite, "/Collection/insert_bulk", test_insert_bulk);
-   TestSuite_AddLive (
-      suite, "/Collection/insert_bulk_empty", test_insert_bulk_empty);
-   TestSuite_AddLive (suite, "/Collection/copy", test_copy);
-   TestSuite_AddLive (suite, "/Collection/insert", test_insert);
-   TestSuite_AddLive (
-      suite, "/Collection/insert/null_string", test_insert_null);
-   TestSuite_AddFull (suite,
-                      "/Collection/insert/oversize",
-                      test_insert_oversize,
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "test_create_indexes");
+
+   models[0] = tmp_bson ("{'key': {'a': 1}}");
+   models[1] = tmp_bson ("{'key': {'b': -1}, 'name': 'b', 'sparse': true}");
+
+   ASSERT_OR_PRINT (mongoc_collection_create_indexes_with_opts (
+                       collection, models, 2, NULL, &reply, &error),
+                    error);
+   bson_destroy (&reply);
+
+   cursor = mongoc_collection_find_indexes (collection, &error);
+   ASSERT_OR_PRINT (cursor, error);
+   while (mongoc_cursor_next (cursor, &doc)) {
+      n++;
+   }
+
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+   /* _id_, a_1 and b */
+   ASSERT_CMPINT (n, ==, 3);
+   mongoc_cursor_destroy (cursor);
+
+   /* a spec without keys fails before anything is sent */
+   models[1] = tmp_bson ("{'name': 'nokey'}");
+   ASSERT (!mongoc_collection_create_indexes_with_opts (
+      collection, models, 2, NULL, &reply, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Index 1 has no \"key\" document");
+   ASSERT (bson_empty (&reply));
+
+   ASSERT (!mongoc_collection_create_indexes_with_opts (
+      collection, models, 0, NULL, NULL, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "empty list of indexes");
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+static void
+test_find_one_with_opts (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   bson_t doc;
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "collection");
+
+   /* a "find" command for one document, without the cursor's limit */
+   future = future_collection_find_one_with_opts (
+      collection,
+      tmp_bson ("{'a': 1}"),
+      tmp_bson ("{'projection': {'a': 1}, 'limit': 5}"),
+      NULL,
+      &doc,
+      &error);
+
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_SLAVE_OK,
+      "{'find': 'collection', 'filter': {'a': 1}, 'limit': 1,"
+      " 'singleBatch': true, 'projection': {'a': 1}}");
+
+   mock_server_replies_simple (request,
+                               "{'ok': 1, 'cursor': {'id': 0,"
+                               " 'ns': 'db.collection',"
+                               " 'firstBatch': [{'_id': 1, 'a': 1}]}}");
+
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   ASSERT_MATCH (&doc, "{'_id': 1, 'a': 1}");
+   bson_destroy (&doc);
+   future_destroy (future);
+   request_destroy (request);
+
+   /* no match */
+   future = future_collection_find_one_with_opts (
+      collection, tmp_bson ("{'a': 2}"), NULL, NULL, &doc, &error);
+
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'find': 'collection'}");
+
+   mock_server_replies_simple (request,
+                               "{'ok': 1, 'cursor': {'id': 0,"
+                               " 'ns': 'db.collection', 'firstBatch': []}}");
+
+   ASSERT (!future_get_bool (future));
+   ASSERT_CMPUINT32 (error.domain, ==, (uint32_t) 0);
+   ASSERT_CMPUINT32 (error.code, ==, (uint32_t) 0);
+   ASSERT (bson_empty (&doc));
+   bson_destroy (&doc);
+   future_destroy (future);
+   request_destroy (request);
+
+   /* a server error */
+   future = future_collection_find_one_with_opts (
+      collection, tmp_bson ("{}"), NULL, NULL, &doc, &error);
+
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'find': 'collection'}");
+
+   mock_server_replies_simple (request,
+                               "{'ok': 0, 'code': 2, 'errmsg': 'bad'}");
+
+   ASSERT (!future_get_bool (future));
+   ASSERT_ERROR_CONTAINS (error, MONGOC_ERROR_QUERY, 2, "bad");
+   bson_destroy (&doc);
+   future_destroy (future);
+   request_destroy (request);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
+/* servers older than 3.2 have no "find" command */
+static void
+test_find_one_with_opts_legacy (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   bson_t doc;
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD - 1);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "collection");
+
+   future = future_collection_find_one_with_opts (
+      collection, tmp_bson ("{'a': 1}"), NULL, NULL, &doc, &error);
+
+   request = mock_server_receives_query (server,
+                                         "db.collection",
+                                         MONGOC_QUERY_SLAVE_OK,
+                                         0 /* skip */,
+                                         -1 /* n_return */,
+                                         "{'a': 1}",
+                                         NULL);
+
+   mock_server_replies_simple (request, "{'_id': 1, 'a': 1}");
+
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   ASSERT_MATCH (&doc, "{'_id': 1, 'a': 1}");
+   bson_destroy (&doc);
+   future_destroy (future);
+   request_destroy (request);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
+static void
+test_aggregate_one (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   bson_t doc;
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "collection");
+
+   /* an "aggregate" command for a batch of two, without the caller's */
+   future = future_collection_aggregate_one (
+      collection,
+      tmp_bson ("{'pipeline': [{'$count': 'n'}]}"),
+      tmp_bson ("{'maxTimeMS': 100, 'batchSize': 5}"),
+      NULL,
+      &doc,
+      &error);
+
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_SLAVE_OK,
+      "{'aggregate': 'collection', 'pipeline': [{'$count': 'n'}],"
+      " 'cursor': {'batchSize': 2}, 'maxTimeMS': 100}");
+
+   mock_server_replies_simple (request,
+                               "{'ok': 1, 'cursor': {'id': 0,"
+                               " 'ns': 'db.collection',"
+                               " 'firstBatch': [{'n': 3}]}}");
+
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   ASSERT_MATCH (&doc, "{'n': 3}");
+   bson_destroy (&doc);
+   future_destroy (future);
+   request_destroy (request);
+
+   /* no result */
+   future = future_collection_aggregate_one (
+      collection, tmp_bson ("[{'$count': 'n'}]"), NULL, NULL, &doc, &error);
+
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'aggregate': 'collection'}");
+
+   mock_server_replies_simple (request,
+                               "{'ok': 1, 'cursor': {'id': 0,"
+                               " 'ns': 'db.collection', 'firstBatch': []}}");
+
+   ASSERT (!future_get_bool (future));
+   ASSERT_CMPUINT32 (error.domain, ==, (uint32_t) 0);
+   ASSERT_CMPUINT32 (error.code, ==, (uint32_t) 0);
+   ASSERT (bson_empty (&doc));
+   bson_destroy (&doc);
+   future_destroy (future);
+   request_destroy (request);
+
+   /* more than one result */
+   future = future_collection_aggregate_one (
+      collection, tmp_bson ("[]"), NULL, NULL, &doc, &error);
+
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'aggregate': 'collection'}");
+
+   mock_server_replies_simple (request,
+                               "{'ok': 1, 'cursor': {'id': 0,"
+                               " 'ns': 'db.collection',"
+                               " 'firstBatch': [{'_id': 1}, {'_id': 2}]}}");
+
+   ASSERT (!future_get_bool (future));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "more than one document");
+   ASSERT (bson_empty (&doc));
+   bson_destroy (&doc);
+   future_destroy (future);
+   request_destroy (request);
+
+   /* a cursor the server left open is killed */
+   future = future_collection_aggregate_one (
+      collection, tmp_bson ("[]"), NULL, NULL, &doc, &error);
+
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'aggregate': 'collection'}");
+
+   mock_server_replies_simple (request,
+                               "{'ok': 1, 'cursor': {'id': 123,"
+                               " 'ns': 'db.collection',"
+                               " 'firstBatch': [{'_id': 1}]}}");
+
+   request_destroy (request);
+   request = mock_server_receives_command (server,
+                                           "db",
+                                           MONGOC_QUERY_SLAVE_OK,
+                                           "{'killCursors': 'collection'}");
+   mock_server_replies_simple (request, "{'ok': 1}");
+
+   ASSERT (!future_get_bool (future));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "more than one document");
+   bson_destroy (&doc);
+   future_destroy (future);
+   request_destroy (request);
+
+   /* $out is rejected without a round trip */
+   ASSERT (!mongoc_collection_aggregate_one (collection,
+                                             tmp_bson ("[{'$out': 'other'}]"),
+                                             NULL,
+                                             NULL,
+                                             &doc,
+                                             &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Cannot use $out");
+   bson_destroy (&doc);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
+/* keep a copy of each command and reply with a cursor, which the "update"
+ * command ignores */
+static bool
+_prepared_command_responder (request_t *request, void *data)
+{
+   bson_t **last = (bson_t **) data;
+
+   if (strcmp (request->command_name, "find") &&
+       strcmp (request->command_name, "update")) {
+      return false;
+   }
+
+   bson_destroy (*last);
+   *last = bson_copy (request_get_doc (request, 0));
+   mock_server_replies_simple (request,
+                               "{'ok': 1, 'n': 1, 'cursor': {'id': 0,"
+                               " 'ns': 'db.collection', 'firstBatch': []}}");
+   request_destroy (request);
+
+   return true;
+}
+
+
+static void
+test_prepared_command (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_prepared_command_t *prepared;
+   bson_value_t params[3];
+   bson_t *doc;
+   const char *tags[] = {"a", "a much longer tag than the placeholder", ""};
+   bson_t *last = NULL;
+   bson_t reply;
+   bson_error_t error;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_READ_CONCERN);
+   mock_server_autoresponds (server, _prepared_command_responder, &last, NULL);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "collection");
+
+   prepared = mongoc_collection_prepare_read_command (
+      collection,
+      tmp_bson ("{'find': 'collection',"
+                " 'filter': {'_id': {'$param': 0},"
+                "            'tags': {'$in': [{'$param': 1}, 'x']}},"
+                " 'limit': {'$param': 2}}"),
+      NULL,
+      tmp_bson ("{'readConcern': {'level': 'local'}}"),
+      &error);
+   ASSERT_OR_PRINT (prepared, error);
+
+   /* parameters shorter and longer than their placeholders */
+   for (i = 0; i < 3; i++) {
+      params[0].value_type = BSON_TYPE_INT32;
+      params[0].value.v_int32 = i;
+      params[1].value_type = BSON_TYPE_UTF8;
+      params[1].value.v_utf8.str = (char *) tags[i];
+      params[1].value.v_utf8.len = (uint32_t) strlen (tags[i]);
+      params[2].value_type = BSON_TYPE_INT64;
+      params[2].value.v_int64 = i + 1;
+
+      ASSERT_OR_PRINT (
+         mongoc_prepared_command_execute (prepared, params, 3, &reply, &error),
+         error);
+      ASSERT_MATCH (last,
+                    "{'find': 'collection',"
+                    " 'filter': {'_id': %d, 'tags': {'$in': ['%s', 'x']}},"
+                    " 'limit': %d,"
+                    " 'readConcern': {'level': 'local'}}",
+                    i,
+                    tags[i],
+                    i + 1);
+      bson_destroy (&reply);
+   }
+
+   ASSERT (
+      !mongoc_prepared_command_execute (prepared, params, 2, &reply, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Prepared command needs 3 parameters, not 2");
+   bson_destroy (&reply);
+   mongoc_prepared_command_destroy (prepared);
+
+   /* a write with a document parameter, used twice */
+   prepared = mongoc_collection_prepare_write_command (
+      collection,
+      tmp_bson ("{'update': 'collection',"
+                " 'updates': [{'q': {'_id': {'$param': 0}},"
+                "              'u': {'$set': {'x': {'$param': 1},"
+                "                             'y': {'$param': 1}}}}]}"),
+      tmp_bson ("{'writeConcern': {'w': 2}}"),
+      &error);
+   ASSERT_OR_PRINT (prepared, error);
+
+   params[0].value_type = BSON_TYPE_UTF8;
+   params[0].value.v_utf8.str = "id";
+   params[0].value.v_utf8.len = 2;
+   params[1].value_type = BSON_TYPE_DOCUMENT;
+   doc = tmp_bson ("{'z': 1}");
+   params[1].value.v_doc.data = (uint8_t *) bson_get_data (doc);
+   params[1].value.v_doc.data_len = doc->len;
+
+   ASSERT_OR_PRINT (
+      mongoc_prepared_command_execute (prepared, params, 2, &reply, &error),
+      error);
+   ASSERT_MATCH (last,
+                 "{'update': 'collection',"
+                 " 'updates': [{'q': {'_id': 'id'},"
+                 "              'u': {'$set': {'x': {'z': 1},"
+                 "                             'y': {'z': 1}}}}],"
+                 " 'writeConcern': {'w': 2}}");
+   bson_destroy (&reply);
+   mongoc_prepared_command_destroy (prepared);
+
+   /* the template must name a command */
+   ASSERT (!mongoc_collection_prepare_write_command (
+      collection, tmp_bson ("{}"), NULL, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Empty command document");
+
+   bson_destroy (last);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
+static void
+test_update_diff (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   bson_t *old_doc;
+   bson_t *last = NULL;
+   bson_error_t error;
+   char *big;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_READ_CONCERN);
+   mock_server_autoresponds (server, _prepared_command_responder, &last, NULL);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "collection");
+
+   big = bson_malloc0 (1000);
+   memset (big, 'x', 999);
+   old_doc = BCON_NEW ("_id",
+                       BCON_INT32 (1),
+                       "a",
+                       BCON_INT32 (1),
+                       "b",
+                       "{",
+                       "c",
+                       BCON_INT32 (1),
+                       "d",
+                       BCON_INT32 (2),
+                       "}",
+                       "big",
+                       BCON_UTF8 (big),
+                       "gone",
+                       BCON_INT32 (1));
+
+   /* changed fields, including in a subdocument, and a removed one */
+   ASSERT_OR_PRINT (
+      mongoc_collection_update_diff (
+         collection,
+         old_doc,
+         tmp_bson ("{'_id': 1, 'a': 1.0, 'b': {'c': 1, 'd': 3, 'e': 4},"
+                   " 'big': '%s'}",
+                   big),
+         NULL,
+         &error),
+      error);
+   ASSERT_MATCH (last,
+                 "{'update': 'collection',"
+                 " 'updates': [{'q': {'_id': 1},"
+                 "              'u': {'$set': {'a': {'$numberDouble': '1.0'},"
+                 "                             'b.d': 3, 'b.e': 4},"
+                 "                    '$unset': {'gone': ''}}}]}");
+   bson_destroy (last);
+   last = NULL;
+
+   /* a diff no smaller than the document is a replacement */
+   ASSERT_OR_PRINT (
+      mongoc_collection_update_diff (collection,
+                                     tmp_bson ("{'_id': 1, 'a': 1}"),
+                                     tmp_bson ("{'_id': 1, 'b': 1}"),
+                                     NULL,
+                                     &error),
+      error);
+   ASSERT_MATCH (last,
+                 "{'updates': [{'q': {'_id': 1},"
+                 "              'u': {'_id': 1, 'b': 1}}]}");
+   bson_destroy (last);
+   last = NULL;
+
+   /* a field name that can't be in a path can't be in a replacement */
+   ASSERT (!mongoc_collection_update_diff (
+      collection,
+      old_doc,
+      tmp_bson ("{'_id': 1, 'a': 2, 'b': {'c': 1, 'd': 2, 'x.y': 1},"
+                " 'big': '%s', 'gone': 1}",
+                big),
+      NULL,
+      &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "replacement document contains invalid key");
+   ASSERT (!last);
+
+   /* nothing changed, nothing is sent */
+   ASSERT_OR_PRINT (mongoc_collection_update_diff (
+                       collection, old_doc, old_doc, NULL, &error),
+                    error);
+   ASSERT (!last);
+
+   ASSERT (!mongoc_collection_update_diff (collection,
+                                           old_doc,
+                                           tmp_bson ("{'_id': 2, 'a': 1}"),
+                                           NULL,
+                                           &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "must have the same \"_id\"");
+   ASSERT (!last);
+
+   bson_free (big);
+   bson_destroy (old_doc);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
+void
+test_collection_install (TestSuite *suite)
+{
+   test_aggregate_install (suite);
+
+   TestSuite_AddLive (suite,
+                      "/Collection/aggregate/write_concern",
+                      test_aggregate_w_write_concern);
+   TestSuite_AddLive (
+      suite, "/Collection/read_prefs_is_valid", test_read_prefs_is_valid);
+   TestSuite_AddLive (suite, "/Collection/insert_bulk", test_insert_bulk);
+   TestSuite_AddLive (
+      suite, "/Collection/insert_bulk_empty", test_insert_bulk_empty);
+   TestSuite_AddLive (suite, "/Collection/copy", test_copy);
+   TestSuite_Add (suite, "/Collection/shared_concerns", test_shared_concerns);
+   TestSuite_AddLive (suite, "/Collection/insert", test_insert);
+   TestSuite_AddLive (
+      suite, "/Collection/insert/null_string", test_insert_null);
+   TestSuite_AddFull (suite,
+                      "/Collection/insert/oversize",
+                      test_insert_oversize,
                       NULL,
                       NULL,
                       test_framework_skip_if_slow_or_live);
@@ -4619,6 +5672,9 @@ test_collection_install (TestSuite *suite)
    TestSuite_AddLive (suite, "/Collection/count", test_count);
    TestSuite_AddMockServerTest (
       suite, "/Collection/count_with_opts", test_count_with_opts);
+   TestSuite_AddMockServerTest (suite,
+                                "/Collection/estimated_document_count",
+                                test_estimated_document_count);
    TestSuite_AddMockServerTest (
       suite, "/Collection/count/read_pref", test_count_read_pref);
    TestSuite_AddMockServerTest (
@@ -4705,6 +5761,12 @@ test_collection_install (TestSuite *suite)
                       NULL,
                       test_framework_skip_if_slow_or_live);
    TestSuite_AddLive (suite, "/Collection/many_return", test_many_return);
+   TestSuite_AddFull (suite,
+                      "/Collection/parallel_scan",
+                      test_parallel_scan,
+                      NULL,
+                      NULL,
+                      test_framework_skip_if_max_wire_version_less_than_4);
    TestSuite_AddMockServerTest (suite, "/Collection/limit", test_find_limit);
    TestSuite_AddMockServerTest (
       suite, "/Collection/batch_size", test_find_batch_size);
@@ -4717,6 +5779,10 @@ test_collection_install (TestSuite *suite)
    TestSuite_AddLive (suite, "/Collection/get_index_info", test_get_index_info);
    TestSuite_AddMockServerTest (
       suite, "/Collection/find_indexes/error", test_find_indexes_err);
+   TestSuite_AddMockServerTest (
+      suite, "/Collection/find_indexes/cached", test_find_indexes_cached);
+   TestSuite_AddMockServerTest (
+      suite, "/Collection/find_cache", test_find_cache);
    TestSuite_AddLive (
       suite, "/Collection/insert/duplicate_key", test_insert_duplicate_key);
    TestSuite_AddFull (suite,
@@ -4725,4 +5791,16 @@ test_collection_install (TestSuite *suite)
                       NULL,
                       NULL,
                       test_framework_skip_if_offline);
+   TestSuite_AddLive (suite, "/Collection/create_indexes", test_create_indexes);
+   TestSuite_AddMockServerTest (
+      suite, "/Collection/find_one_with_opts", test_find_one_with_opts);
+   TestSuite_AddMockServerTest (suite,
+                                "/Collection/find_one_with_opts/legacy",
+                                test_find_one_with_opts_legacy);
+   TestSuite_AddMockServerTest (
+      suite, "/Collection/aggregate_one", test_aggregate_one);
+   TestSuite_AddMockServerTest (
+      suite, "/Collection/prepared_command", test_prepared_command);
+   TestSuite_AddMockServerTest (
+      suite, "/Collection/update_diff", test_update_diff);
 }
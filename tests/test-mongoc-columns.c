@@ -0,0 +1,189 @@
+#include <mongoc.h>
+
+#include "TestSuite.h"
+#include "test-conveniences.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "columns-test"
+
+
+/* a finished cursor on the documents in @batch_json */
+static mongoc_cursor_t *
+_cursor_from_batch (mongoc_client_t *client, const char *batch_json)
+{
+   bson_t reply;
+   char *json;
+
+   json = bson_strdup_printf (
+      "{'ok': 1, 'cursor': {'id': 0, 'ns': 'db.c', 'firstBatch': %s}}",
+      batch_json);
+   bson_copy_to (tmp_bson (json), &reply);
+   bson_free (json);
+
+   return mongoc_cursor_new_from_command_reply (client, &reply, 0);
+}
+
+
+static bool
+_valid (const mongoc_column_t *column, uint32_t row)
+{
+   return (column->validity[row / 8] & (1u << (row % 8))) != 0;
+}
+
+
+static void
+test_columns_decode (void)
+{
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   mongoc_columns_t *columns;
+   const mongoc_column_t *column;
+   const int32_t *i32;
+   const int64_t *i64;
+   const double *d;
+   const uint8_t *b;
+   const char *str;
+   uint32_t n_rows;
+   bson_error_t error;
+
+   client = mongoc_client_new ("mongodb://localhost");
+   cursor = _cursor_from_batch (
+      client,
+      "[{'a': 1, 'b': {'c': 'x', 'd': true}, 's': 'hello'},"
+      " {'a': 'wrong type', 'b': {'d': false}, 'e': [10, 20]},"
+      " {'s': '', 'a': {'$numberLong': '2'}, 'b': 5, 'f': 1.5},"
+      " {'a': 3, 'a': 4, 'f': {'$numberLong': '7'},"
+      "  't': {'$date': {'$numberLong': '1000'}}}]");
+
+   columns = mongoc_columns_new ();
+   ASSERT_OR_PRINT (
+      mongoc_columns_add (columns, "a", BSON_TYPE_INT32, &error), error);
+   ASSERT_OR_PRINT (
+      mongoc_columns_add (columns, "b.c", BSON_TYPE_UTF8, &error), error);
+   ASSERT_OR_PRINT (
+      mongoc_columns_add (columns, "b.d", BSON_TYPE_BOOL, &error), error);
+   ASSERT_OR_PRINT (
+      mongoc_columns_add (columns, "s", BSON_TYPE_UTF8, &error), error);
+   ASSERT_OR_PRINT (
+      mongoc_columns_add (columns, "e.1", BSON_TYPE_INT64, &error), error);
+   ASSERT_OR_PRINT (
+      mongoc_columns_add (columns, "f", BSON_TYPE_DOUBLE, &error), error);
+   ASSERT_OR_PRINT (
+      mongoc_columns_add (columns, "t", BSON_TYPE_DATE_TIME, &error), error);
+
+   ASSERT (mongoc_cursor_next_columns (cursor, columns, &n_rows));
+   ASSERT_CMPUINT32 (n_rows, ==, (uint32_t) 4);
+
+   /* a value of another type is null, the first of duplicate keys wins */
+   column = mongoc_columns_get (columns, 0);
+   i32 = (const int32_t *) column->values;
+   ASSERT_CMPUINT32 (column->null_count, ==, (uint32_t) 2);
+   ASSERT (_valid (column, 0));
+   ASSERT_CMPINT32 (i32[0], ==, 1);
+   ASSERT (!_valid (column, 1));
+   ASSERT (!_valid (column, 2));
+   ASSERT (_valid (column, 3));
+   ASSERT_CMPINT32 (i32[3], ==, 3);
+
+   /* strings end to end, with an offset per row and one more */
+   column = mongoc_columns_get (columns, 1);
+   str = (const char *) column->values;
+   ASSERT_CMPUINT32 (column->null_count, ==, (uint32_t) 3);
+   ASSERT (_valid (column, 0));
+   ASSERT_CMPINT32 (column->offsets[0], ==, 0);
+   ASSERT_CMPINT32 (column->offsets[1], ==, 1);
+   ASSERT_CMPINT32 (column->offsets[4], ==, 1);
+   ASSERT_CMPINT (str[0], ==, 'x');
+
+   column = mongoc_columns_get (columns, 3);
+   str = (const char *) column->values;
+   ASSERT_CMPUINT32 (column->null_count, ==, (uint32_t) 2);
+   ASSERT (_valid (column, 2));
+   ASSERT_CMPINT32 (column->offsets[1], ==, 5);
+   ASSERT_CMPINT32 (column->offsets[2], ==, 5);
+   ASSERT_CMPINT32 (column->offsets[3], ==, 5);
+   ASSERT (!memcmp (str, "hello", 5));
+
+   /* booleans are bit-packed */
+   column = mongoc_columns_get (columns, 2);
+   b = (const uint8_t *) column->values;
+   ASSERT_CMPUINT32 (column->null_count, ==, (uint32_t) 2);
+   ASSERT (_valid (column, 0));
+   ASSERT (_valid (column, 1));
+   ASSERT_CMPINT (b[0] & 3, ==, 1);
+
+   /* an array element, int32 widens to int64 */
+   column = mongoc_columns_get (columns, 4);
+   i64 = (const int64_t *) column->values;
+   ASSERT_CMPUINT32 (column->null_count, ==, (uint32_t) 3);
+   ASSERT (_valid (column, 1));
+   ASSERT_CMPINT64 (i64[1], ==, (int64_t) 20);
+
+   /* any number converts to double */
+   column = mongoc_columns_get (columns, 5);
+   d = (const double *) column->values;
+   ASSERT_CMPUINT32 (column->null_count, ==, (uint32_t) 2);
+   ASSERT (d[2] == 1.5);
+   ASSERT (d[3] == 7.0);
+
+   column = mongoc_columns_get (columns, 6);
+   i64 = (const int64_t *) column->values;
+   ASSERT_CMPUINT32 (column->null_count, ==, (uint32_t) 3);
+   ASSERT_CMPINT64 (i64[3], ==, (int64_t) 1000);
+
+   ASSERT (!mongoc_cursor_next_columns (cursor, columns, &n_rows));
+   ASSERT_CMPUINT32 (n_rows, ==, (uint32_t) 0);
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+
+   mongoc_columns_destroy (columns);
+   mongoc_cursor_destroy (cursor);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_columns_add_errors (void)
+{
+   mongoc_columns_t *columns;
+   bson_error_t error;
+
+   columns = mongoc_columns_new ();
+   ASSERT (mongoc_columns_add (columns, "a.b", BSON_TYPE_INT32, &error));
+
+   /* a column may be the parent of another */
+   ASSERT (mongoc_columns_add (columns, "a", BSON_TYPE_INT32, &error));
+
+   ASSERT (!mongoc_columns_add (columns, "a.b", BSON_TYPE_INT64, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Column \"a.b\" was already added");
+
+   ASSERT (!mongoc_columns_add (columns, "c", BSON_TYPE_OID, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Cannot decode column \"c\" as BSON type 0x07");
+
+   ASSERT (!mongoc_columns_add (columns, "", BSON_TYPE_INT32, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Invalid column path \"\"");
+
+   ASSERT (!mongoc_columns_add (columns, "c..d", BSON_TYPE_INT32, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "Invalid column path \"c..d\"");
+
+   mongoc_columns_destroy (columns);
+}
+
+
+void
+test_columns_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/Columns/decode", test_columns_decode);
+   TestSuite_Add (suite, "/Columns/add_errors", test_columns_add_errors);
+}
@@ -5,6 +5,7 @@
 #include <mongoc-cursor-private.h>
 #include <mongoc-bulk-operation-private.h>
 #include <mongoc-client-private.h>
+#include <mongoc-util-private.h>
 
 #include "json-test.h"
 #include "test-libmongoc.h"
@@ -318,7 +319,8 @@ started_cb (const mongoc_apm_command_started_t *event)
    bson_t *new_event;
 
    if (context->verbose) {
-      cmd_json = bson_as_canonical_extended_json (event->command, NULL);
+      cmd_json = bson_as_canonical_extended_json (
+         mongoc_apm_command_started_get_command (event), NULL);
       printf ("%s\n", cmd_json);
       fflush (stdout);
       bson_free (cmd_json);
@@ -867,6 +869,222 @@ test_get_error (void)
 }
 
 
+typedef struct {
+   int calls;
+   bool succeeded;
+   char cmd_name[32];
+   int64_t duration;
+   int64_t phases[MONGOC_APM_SPAN_LAST];
+} span_test_t;
+
+
+static void
+test_span_cb (const mongoc_apm_command_span_t *event)
+{
+   span_test_t *test;
+   int i;
+
+   test = (span_test_t *) mongoc_apm_command_span_get_context (event);
+   test->calls++;
+   test->succeeded = mongoc_apm_command_span_get_succeeded (event);
+   bson_strncpy (test->cmd_name,
+                 mongoc_apm_command_span_get_command_name (event),
+                 sizeof test->cmd_name);
+   test->duration = mongoc_apm_command_span_get_duration (event);
+   for (i = 0; i < MONGOC_APM_SPAN_LAST; i++) {
+      test->phases[i] = mongoc_apm_command_span_get_phase_duration (
+         event, (mongoc_apm_span_phase_t) i);
+   }
+
+   ASSERT_CMPINT64 (
+      mongoc_apm_command_span_get_start_time (event), >, (int64_t) 0);
+   ASSERT_CMPINT64 (
+      mongoc_apm_command_span_get_phase_duration (event, MONGOC_APM_SPAN_LAST),
+      ==,
+      (int64_t) 0);
+}
+
+
+static void
+test_span (void)
+{
+   mock_server_t *server;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_apm_callbacks_t *callbacks;
+   future_t *future;
+   request_t *request;
+   span_test_t test = {0};
+   int64_t sum = 0;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+
+   pool = mongoc_client_pool_new (mock_server_get_uri (server));
+   callbacks = mongoc_apm_callbacks_new ();
+   mongoc_apm_set_command_span_cb (callbacks, test_span_cb);
+   mongoc_client_pool_set_apm_callbacks (pool, callbacks, (void *) &test);
+   client = mongoc_client_pool_pop (pool);
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, NULL);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   /* the reply is late, so the time is spent waiting for the server */
+   _mongoc_usleep (10 * 1000);
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT (future_get_bool (future));
+
+   ASSERT_CMPINT (test.calls, ==, 1);
+   ASSERT (test.succeeded);
+   ASSERT_CMPSTR (test.cmd_name, "ping");
+   ASSERT_CMPINT64 (
+      test.phases[MONGOC_APM_SPAN_SERVER_WAIT], >=, (int64_t) 10000);
+   for (i = 0; i < MONGOC_APM_SPAN_LAST; i++) {
+      ASSERT_CMPINT64 (test.phases[i], >=, (int64_t) 0);
+      sum += test.phases[i];
+   }
+
+   /* the phases don't overlap */
+   ASSERT_CMPINT64 (sum, <=, test.duration);
+
+   future_destroy (future);
+   mongoc_client_pool_push (pool, client);
+   mongoc_apm_callbacks_destroy (callbacks);
+   mongoc_client_pool_destroy (pool);
+   mock_server_destroy (server);
+}
+
+
+typedef struct {
+   int created;
+   int ready;
+   int closed;
+   uint32_t server_id;
+   int64_t duration;
+   int64_t phases[MONGOC_APM_CONNECTION_PHASE_LAST];
+   mongoc_apm_connection_closed_reason_t reason;
+} connection_test_t;
+
+
+static void
+test_connection_created_cb (const mongoc_apm_connection_created_t *event)
+{
+   connection_test_t *test;
+
+   test = (connection_test_t *) mongoc_apm_connection_created_get_context (
+      event);
+   test->created++;
+   test->server_id = mongoc_apm_connection_created_get_server_id (event);
+   ASSERT (mongoc_apm_connection_created_get_host (event)->port);
+}
+
+
+static void
+test_connection_ready_cb (const mongoc_apm_connection_ready_t *event)
+{
+   connection_test_t *test;
+   int i;
+
+   test =
+      (connection_test_t *) mongoc_apm_connection_ready_get_context (event);
+   test->ready++;
+   ASSERT_CMPUINT32 (
+      mongoc_apm_connection_ready_get_server_id (event), ==, test->server_id);
+   test->duration = mongoc_apm_connection_ready_get_duration (event);
+   for (i = 0; i < MONGOC_APM_CONNECTION_PHASE_LAST; i++) {
+      test->phases[i] = mongoc_apm_connection_ready_get_phase_duration (
+         event, (mongoc_apm_connection_phase_t) i);
+   }
+}
+
+
+static void
+test_connection_closed_cb (const mongoc_apm_connection_closed_t *event)
+{
+   connection_test_t *test;
+
+   test =
+      (connection_test_t *) mongoc_apm_connection_closed_get_context (event);
+   test->closed++;
+   test->reason = mongoc_apm_connection_closed_get_reason (event);
+   ASSERT_CMPUINT32 (
+      mongoc_apm_connection_closed_get_server_id (event), ==, test->server_id);
+}
+
+
+static void
+test_connection_events (void)
+{
+   mock_server_t *server;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_apm_callbacks_t *callbacks;
+   mongoc_connection_stats_t *stats;
+   size_t n;
+   future_t *future;
+   request_t *request;
+   connection_test_t test = {0};
+   int64_t sum = 0;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+
+   pool = mongoc_client_pool_new (mock_server_get_uri (server));
+   callbacks = mongoc_apm_callbacks_new ();
+   mongoc_apm_set_connection_created_cb (callbacks, test_connection_created_cb);
+   mongoc_apm_set_connection_ready_cb (callbacks, test_connection_ready_cb);
+   mongoc_apm_set_connection_closed_cb (callbacks, test_connection_closed_cb);
+   mongoc_client_pool_set_apm_callbacks (pool, callbacks, (void *) &test);
+   client = mongoc_client_pool_pop (pool);
+
+   stats = mongoc_client_get_connection_stats (client, &n);
+   ASSERT (!stats);
+   ASSERT_CMPSIZE_T (n, ==, (size_t) 0);
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, NULL);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT (future_get_bool (future));
+
+   ASSERT_CMPINT (test.created, ==, 1);
+   ASSERT_CMPINT (test.ready, ==, 1);
+   ASSERT_CMPINT (test.closed, ==, 0);
+   for (i = 0; i < MONGOC_APM_CONNECTION_PHASE_LAST; i++) {
+      ASSERT_CMPINT64 (test.phases[i], >=, (int64_t) 0);
+      sum += test.phases[i];
+   }
+
+   ASSERT_CMPINT64 (sum, <=, test.duration);
+
+   stats = mongoc_client_get_connection_stats (client, &n);
+   ASSERT_CMPSIZE_T (n, ==, (size_t) 1);
+   ASSERT_CMPUINT32 (stats[0].server_id, ==, test.server_id);
+   ASSERT_CMPSTR (stats[0].host_and_port,
+                  mongoc_uri_get_hosts (mock_server_get_uri (server))
+                     ->host_and_port);
+   ASSERT_CMPINT64 (stats[0].ops, >=, (int64_t) 1);
+   ASSERT_CMPINT64 (stats[0].egress_bytes, >, (int64_t) 0);
+   ASSERT_CMPINT64 (stats[0].ingress_bytes, >, (int64_t) 0);
+   ASSERT_CMPINT64 (stats[0].in_use_usec, >=, stats[0].round_trip_time_usec);
+   bson_free (stats);
+
+   future_destroy (future);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+
+   ASSERT_CMPINT (test.closed, ==, 1);
+   ASSERT_CMPINT (test.reason, ==, MONGOC_APM_CONNECTION_CLOSED_CLIENT_CLOSED);
+
+   mongoc_apm_callbacks_destroy (callbacks);
+   mock_server_destroy (server);
+}
+
+
 static void
 insert_200_docs (mongoc_collection_t *collection)
 {
@@ -1590,6 +1808,44 @@ test_client_cmd (void)
 }
 
 
+static void
+test_sample_rate (void)
+{
+   cmd_test_t test;
+   mongoc_client_t *client;
+   mongoc_apm_callbacks_t *callbacks;
+   bson_error_t error;
+   bool r;
+   int i;
+
+   cmd_test_init (&test);
+   client = test_framework_client_new ();
+   callbacks = mongoc_apm_callbacks_new ();
+   mongoc_apm_set_command_started_cb (callbacks, cmd_started_cb);
+   mongoc_apm_set_command_succeeded_cb (callbacks, cmd_succeeded_cb);
+   mongoc_apm_set_command_failed_cb (callbacks, cmd_failed_cb);
+   mongoc_apm_set_command_sample_rate (callbacks, 4);
+   ASSERT (mongoc_client_set_apm_callbacks (client, callbacks, &test));
+   mongoc_apm_callbacks_destroy (callbacks);
+
+   /* each command is a separate operation */
+   for (i = 0; i < 100; i++) {
+      r = mongoc_client_command_simple (
+         client, "admin", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+      ASSERT_OR_PRINT (r, error);
+   }
+
+   /* about one in four, and each started event has its succeeded event */
+   ASSERT_CMPINT (test.started_calls, >, 10);
+   ASSERT_CMPINT (test.started_calls, <, 40);
+   ASSERT_CMPINT (test.started_calls, ==, test.succeeded_calls);
+   ASSERT_CMPINT (0, ==, test.failed_calls);
+
+   cmd_test_cleanup (&test);
+   mongoc_client_destroy (client);
+}
+
+
 static void
 test_client_cmd_simple (void)
 {
@@ -1722,6 +1978,9 @@ test_command_monitoring_install (TestSuite *suite)
    test_all_spec_tests (suite);
    TestSuite_AddMockServerTest (
       suite, "/command_monitoring/get_error", test_get_error);
+   TestSuite_AddMockServerTest (suite, "/command_monitoring/span", test_span);
+   TestSuite_AddMockServerTest (
+      suite, "/command_monitoring/connection_events", test_connection_events);
    TestSuite_AddLive (suite,
                       "/command_monitoring/set_callbacks/single",
                       test_set_callbacks_single);
@@ -1756,6 +2015,8 @@ test_command_monitoring_install (TestSuite *suite)
    TestSuite_AddLive (suite, "/command_monitoring/client_cmd", test_client_cmd);
    TestSuite_AddLive (
       suite, "/command_monitoring/client_cmd_simple", test_client_cmd_simple);
+   TestSuite_AddLive (
+      suite, "/command_monitoring/sample_rate", test_sample_rate);
    TestSuite_AddLive (
       suite, "/command_monitoring/client_cmd/op_ids", test_client_cmd_op_ids);
    TestSuite_AddLive (suite,
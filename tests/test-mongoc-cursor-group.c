@@ -0,0 +1,271 @@
+#include <mongoc.h>
+
+#include "mongoc-thread-private.h"
+#include "TestSuite.h"
+#include "mock_server/mock-server.h"
+#include "test-conveniences.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "cursor-group-test"
+
+#define N_CURSORS 3
+
+
+typedef struct {
+   mongoc_mutex_t mutex;
+   int n_get_mores[N_CURSORS];
+   request_t *hung; /* a getMore left without a reply */
+} tail_t;
+
+
+/* cursor i on collection "c<i>" has id 100 + i. Its first getMore gets no
+ * documents, as if maxAwaitTimeMS passed, its second gets two documents,
+ * and its third closes it. The cursor on "hang" never gets a getMore
+ * reply, and a find on "fail" fails */
+static bool
+_tail_responder (request_t *request, void *data)
+{
+   tail_t *tail = (tail_t *) data;
+   const bson_t *cmd;
+   const char *collection;
+   int i;
+   int n;
+   char *reply;
+
+   cmd = request_get_doc (request, 0);
+
+   if (!strcmp (request->command_name, "find")) {
+      collection = bson_lookup_utf8 (cmd, "find");
+      if (!strcmp (collection, "fail")) {
+         mock_server_replies_simple (request,
+                                     "{'ok': 0, 'code': 2, 'errmsg': 'bad'}");
+         request_destroy (request);
+         return true;
+      }
+
+      if (!strcmp (collection, "hang")) {
+         mock_server_replies_simple (request,
+                                     "{'ok': 1, 'cursor': {'id': 99, 'ns':"
+                                     " 'db.hang', 'firstBatch': []}}");
+         request_destroy (request);
+         return true;
+      }
+
+      ASSERT (sscanf (collection, "c%d", &i) == 1);
+      reply = bson_strdup_printf ("{'ok': 1, 'cursor': {'id': %d, 'ns': "
+                                  "'db.c%d', 'firstBatch': [{'i': %d, "
+                                  "'n': 0}]}}",
+                                  100 + i,
+                                  i,
+                                  i);
+      mock_server_replies_simple (request, reply);
+      bson_free (reply);
+      request_destroy (request);
+      return true;
+   }
+
+   if (!strcmp (request->command_name, "getMore")) {
+      ASSERT_CMPINT64 (
+         bson_lookup_int64 (cmd, "maxTimeMS"), ==, (int64_t) 1000);
+
+      if (bson_lookup_int64 (cmd, "getMore") == 99) {
+         ASSERT_CMPSTR (bson_lookup_utf8 (cmd, "collection"), "hang");
+         mongoc_mutex_lock (&tail->mutex);
+         tail->hung = request;
+         mongoc_mutex_unlock (&tail->mutex);
+         return true;
+      }
+
+      i = (int) bson_lookup_int64 (cmd, "getMore") - 100;
+      ASSERT_CMPINT (i, >=, 0);
+      ASSERT_CMPINT (i, <, N_CURSORS);
+      collection = bson_lookup_utf8 (cmd, "collection");
+      ASSERT_CMPINT (collection[0], ==, 'c');
+      ASSERT_CMPINT (atoi (collection + 1), ==, i);
+
+      mongoc_mutex_lock (&tail->mutex);
+      n = ++tail->n_get_mores[i];
+      mongoc_mutex_unlock (&tail->mutex);
+
+      if (n == 1) {
+         reply = bson_strdup_printf (
+            "{'ok': 1, 'cursor': {'id': %d, 'nextBatch': []}}", 100 + i);
+      } else if (n == 2) {
+         reply = bson_strdup_printf (
+            "{'ok': 1, 'cursor': {'id': %d, 'nextBatch': [{'i': %d, 'n': 1},"
+            " {'i': %d, 'n': 2}]}}",
+            100 + i,
+            i,
+            i);
+      } else {
+         reply =
+            bson_strdup ("{'ok': 1, 'cursor': {'id': 0, 'nextBatch': []}}");
+      }
+
+      mock_server_replies_simple (request, reply);
+      bson_free (reply);
+      request_destroy (request);
+      return true;
+   }
+
+   return false;
+}
+
+
+static mongoc_cursor_group_t *
+_group_new (mock_server_t **server,
+            mongoc_client_pool_t **pool,
+            tail_t *tail)
+{
+   memset (tail, 0, sizeof *tail);
+   mongoc_mutex_init (&tail->mutex);
+   *server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_autoresponds (*server, _tail_responder, tail, NULL);
+   mock_server_run (*server);
+   *pool = mongoc_client_pool_new (mock_server_get_uri (*server));
+
+   return mongoc_cursor_group_new (*pool);
+}
+
+
+static void
+_add (mongoc_cursor_group_t *group, const char *collection, void *ctx)
+{
+   mongoc_cursor_group_add (
+      group,
+      "db",
+      tmp_bson ("{'find': '%s', 'tailable': true, 'awaitData': true}",
+                collection),
+      NULL,
+      1000,
+      ctx);
+}
+
+
+/* documents from all cursors come back on one thread */
+static void
+test_cursor_group_tail (void)
+{
+   mock_server_t *server;
+   mongoc_client_pool_t *pool;
+   mongoc_cursor_group_t *group;
+   tail_t tail;
+   int ids[N_CURSORS];
+   int n_docs[N_CURSORS] = {0};
+   int n_closed = 0;
+   const bson_t *doc;
+   void *ctx;
+   bson_error_t error;
+   char collection[16];
+   int i;
+
+   group = _group_new (&server, &pool, &tail);
+
+   for (i = 0; i < N_CURSORS; i++) {
+      ids[i] = i;
+      bson_snprintf (collection, sizeof collection, "c%d", i);
+      _add (group, collection, &ids[i]);
+   }
+
+   ASSERT_CMPSIZE_T (
+      mongoc_cursor_group_size (group), ==, (size_t) N_CURSORS);
+
+   while (mongoc_cursor_group_size (group)) {
+      if (mongoc_cursor_group_next (group, -1, &doc, &ctx, &error)) {
+         i = *(int *) ctx;
+         ASSERT_CMPINT32 (bson_lookup_int32 (doc, "i"), ==, i);
+         /* each cursor's documents are in order */
+         ASSERT_CMPINT32 (bson_lookup_int32 (doc, "n"), ==, n_docs[i]);
+         n_docs[i]++;
+      } else {
+         /* closed by the server, not failed */
+         ASSERT (ctx);
+         ASSERT_CMPUINT32 (error.domain, ==, (uint32_t) 0);
+         i = *(int *) ctx;
+         ASSERT_CMPINT (n_docs[i], ==, 3);
+         n_closed++;
+      }
+   }
+
+   ASSERT_CMPINT (n_closed, ==, N_CURSORS);
+   for (i = 0; i < N_CURSORS; i++) {
+      ASSERT_CMPINT (tail.n_get_mores[i], ==, 3);
+   }
+
+   /* an empty group returns at once */
+   ASSERT (!mongoc_cursor_group_next (group, -1, &doc, &ctx, &error));
+   ASSERT (!ctx);
+
+   mongoc_cursor_group_destroy (group);
+   mongoc_client_pool_destroy (pool);
+   mock_server_destroy (server);
+   mongoc_mutex_destroy (&tail.mutex);
+}
+
+
+static bool
+_hung (tail_t *tail)
+{
+   bool ret;
+
+   mongoc_mutex_lock (&tail->mutex);
+   ret = tail->hung != NULL;
+   mongoc_mutex_unlock (&tail->mutex);
+
+   return ret;
+}
+
+
+/* a failed cursor is removed with its error, and next () times out while
+ * a getMore is outstanding */
+static void
+test_cursor_group_error_and_timeout (void)
+{
+   mock_server_t *server;
+   mongoc_client_pool_t *pool;
+   mongoc_cursor_group_t *group;
+   tail_t tail;
+   int fail_id = 1;
+   int hang_id = 2;
+   const bson_t *doc;
+   void *ctx;
+   bson_error_t error;
+
+   group = _group_new (&server, &pool, &tail);
+   _add (group, "fail", &fail_id);
+   _add (group, "hang", &hang_id);
+
+   ASSERT (!mongoc_cursor_group_next (group, -1, &doc, &ctx, &error));
+   ASSERT (ctx == &fail_id);
+   ASSERT_ERROR_CONTAINS (error, MONGOC_ERROR_QUERY, 2, "bad");
+   ASSERT_CMPSIZE_T (mongoc_cursor_group_size (group), ==, (size_t) 1);
+
+   while (!_hung (&tail)) {
+      ASSERT (!mongoc_cursor_group_next (group, 10, &doc, &ctx, &error));
+      ASSERT (!ctx);
+      ASSERT (!doc);
+   }
+
+   ASSERT (!mongoc_cursor_group_next (group, 10, &doc, &ctx, &error));
+   ASSERT (!ctx);
+   ASSERT_CMPUINT32 (error.domain, ==, (uint32_t) 0);
+   ASSERT_CMPSIZE_T (mongoc_cursor_group_size (group), ==, (size_t) 1);
+
+   /* cancels the getMore */
+   mongoc_cursor_group_destroy (group);
+   request_destroy (tail.hung);
+   mongoc_client_pool_destroy (pool);
+   mock_server_destroy (server);
+   mongoc_mutex_destroy (&tail.mutex);
+}
+
+
+void
+test_cursor_group_install (TestSuite *suite)
+{
+   TestSuite_AddMockServerTest (
+      suite, "/CursorGroup/tail", test_cursor_group_tail);
+   TestSuite_AddMockServerTest (suite,
+                                "/CursorGroup/error_and_timeout",
+                                test_cursor_group_error_and_timeout);
+}
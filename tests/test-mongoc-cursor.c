@@ -424,6 +424,143 @@ test_kill_cursors_pooled_cmd (void)
 }
 
 
+/* open a cursor with id @cursor_id on @collection */
+static mongoc_cursor_t *
+_deferred_kill_cursor (mock_server_t *server,
+                       mongoc_collection_t *collection,
+                       int64_t cursor_id)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   future_t *future;
+   request_t *request;
+   char *reply;
+
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{}"), NULL, NULL);
+   future = future_cursor_next (cursor, &doc);
+   request =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   reply = bson_strdup_printf ("{'ok': 1,"
+                               " 'cursor': {"
+                               "    'id': {'$numberLong': '%" PRId64 "'},"
+                               "    'ns': 'db.%s',"
+                               "    'firstBatch': [{}]}}",
+                               cursor_id,
+                               mongoc_collection_get_name (collection));
+   mock_server_replies_simple (request, reply);
+   ASSERT (future_get_bool (future));
+
+   bson_free (reply);
+   request_destroy (request);
+   future_destroy (future);
+
+   return cursor;
+}
+
+
+static void
+_assert_killcursors (request_t *request,
+                     const char *collection,
+                     int64_t cursor_id_0,
+                     int64_t cursor_id_1)
+{
+   const bson_t *cmd = request_get_doc (request, 0);
+
+   ASSERT_CMPSTR (bson_lookup_utf8 (cmd, "killCursors"), collection);
+   ASSERT_CMPINT64 (bson_lookup_int64 (cmd, "cursors.0"), ==, cursor_id_0);
+   if (cursor_id_1) {
+      ASSERT_CMPINT64 (bson_lookup_int64 (cmd, "cursors.1"), ==, cursor_id_1);
+   } else {
+      ASSERT (!bson_has_field (cmd, "cursors.1"));
+   }
+
+   mock_server_replies_simple (request, "{'ok': 1}");
+   request_destroy (request);
+}
+
+
+/* record the cursor killed while the client is destroyed */
+static bool
+_deferred_kill_responder (request_t *request, void *data)
+{
+   if (!strcmp (request->command_name, "killCursors")) {
+      *(int64_t *) data =
+         bson_lookup_int64 (request_get_doc (request, 0), "cursors.0");
+      mock_server_replies_simple (request, "{'ok': 1}");
+      request_destroy (request);
+      return true;
+   }
+
+   return false;
+}
+
+
+/* with deferKillCursors, destroyed cursors are killed in one killCursors
+ * per collection before the next command */
+static void
+test_kill_cursors_deferred (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_t *client;
+   mongoc_collection_t *coll;
+   mongoc_collection_t *coll2;
+   mongoc_cursor_t *cursors[3];
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+   int64_t killed = 0;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_KILLCURSORS_CMD);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_bool (uri, MONGOC_URI_DEFERKILLCURSORS, true);
+   client = mongoc_client_new_from_uri (uri);
+   coll = mongoc_client_get_collection (client, "db", "coll");
+   coll2 = mongoc_client_get_collection (client, "db", "coll2");
+
+   cursors[0] = _deferred_kill_cursor (server, coll, 123);
+   cursors[1] = _deferred_kill_cursor (server, coll2, 124);
+   cursors[2] = _deferred_kill_cursor (server, coll, 125);
+
+   /* no round trips */
+   for (i = 0; i < 3; i++) {
+      mongoc_cursor_destroy (cursors[i]);
+   }
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+
+   request =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   _assert_killcursors (request, "coll", 123, 125);
+   request =
+      mock_server_receives_command (server, "db", MONGOC_QUERY_SLAVE_OK, NULL);
+   _assert_killcursors (request, "coll2", 124, 0);
+
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+
+   /* a cursor still queued is killed when the client is destroyed */
+   cursors[0] = _deferred_kill_cursor (server, coll, 126);
+   mongoc_cursor_destroy (cursors[0]);
+   mongoc_collection_destroy (coll);
+   mongoc_collection_destroy (coll2);
+
+   mock_server_autoresponds (server, _deferred_kill_responder, &killed, NULL);
+   mongoc_client_destroy (client);
+   ASSERT_CMPINT64 (killed, ==, (int64_t) 126);
+
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
 /* We already test that mongoc_cursor_destroy sends OP_KILLCURSORS in
  * test_kill_cursors_single / pooled. Here, test explicit
  * mongoc_client_kill_cursor. */
@@ -1567,6 +1704,751 @@ test_error_document_getmore (void)
 }
 
 
+typedef struct {
+   int started;
+   int succeeded;
+} prefetch_test_t;
+
+
+static void
+prefetch_started (const mongoc_apm_command_started_t *event)
+{
+   prefetch_test_t *test =
+      (prefetch_test_t *) mongoc_apm_command_started_get_context (event);
+
+   if (!strcmp (mongoc_apm_command_started_get_command_name (event),
+                "getMore")) {
+      test->started++;
+   }
+}
+
+
+static void
+prefetch_succeeded (const mongoc_apm_command_succeeded_t *event)
+{
+   prefetch_test_t *test =
+      (prefetch_test_t *) mongoc_apm_command_succeeded_get_context (event);
+
+   if (!strcmp (mongoc_apm_command_succeeded_get_command_name (event),
+                "getMore")) {
+      test->succeeded++;
+   }
+}
+
+
+/* with prefetch, the getMore goes out halfway through the batch */
+static void
+test_cursor_prefetch (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_apm_callbacks_t *callbacks;
+   prefetch_test_t test = {0};
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_t *opts;
+   bson_error_t error;
+   int i;
+
+   if (!test_framework_max_wire_version_at_least (WIRE_VERSION_OP_MSG)) {
+      return;
+   }
+
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "test_cursor_prefetch");
+   for (i = 0; i < 10; i++) {
+      ASSERT_OR_PRINT (mongoc_collection_insert (collection,
+                                                 MONGOC_INSERT_NONE,
+                                                 tmp_bson ("{'_id': %d}", i),
+                                                 NULL,
+                                                 &error),
+                       error);
+   }
+
+   callbacks = mongoc_apm_callbacks_new ();
+   mongoc_apm_set_command_started_cb (callbacks, prefetch_started);
+   mongoc_apm_set_command_succeeded_cb (callbacks, prefetch_succeeded);
+   mongoc_client_set_apm_callbacks (client, callbacks, &test);
+
+   opts = tmp_bson ("{'batchSize': 4, 'prefetch': true}");
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{}"), opts, NULL);
+
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT (!cursor->prefetched);
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT (cursor->prefetched);
+   ASSERT_CMPINT (test.started, ==, 1);
+   ASSERT_CMPINT (test.succeeded, ==, 0);
+
+   /* another operation reads the getMore's reply off the connection */
+   ASSERT_COUNT (10, collection);
+   ASSERT (cursor->prefetched);
+   ASSERT_CMPINT (test.succeeded, ==, 1);
+
+   for (i = 2; mongoc_cursor_next (cursor, &doc); i++) {
+   }
+
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+   ASSERT_CMPINT (i, ==, 10);
+   ASSERT_CMPINT (test.started, ==, 2);
+   ASSERT_CMPINT (test.succeeded, ==, 2);
+   mongoc_cursor_destroy (cursor);
+
+   /* destroying a cursor with a prefetch in flight leaves the client
+    * usable */
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{}"), opts, NULL);
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT (cursor->prefetched);
+   mongoc_cursor_destroy (cursor);
+   ASSERT_COUNT (10, collection);
+
+   /* the option must be a boolean */
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{}"), tmp_bson ("{'prefetch': 1}"), NULL);
+   ASSERT (!mongoc_cursor_next (cursor, &doc));
+   ASSERT_ERROR_CONTAINS (cursor->error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "The prefetch option must be a boolean");
+   mongoc_cursor_destroy (cursor);
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+   mongoc_apm_callbacks_destroy (callbacks);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+/* read a find command's first batch of 3 documents, then expect a getMore
+ * with @batch_size */
+static void
+_test_adaptive_batch_size (mongoc_collection_t *collection,
+                           mock_server_t *server,
+                           const char *opts_json,
+                           int64_t batch_size)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   request_t *request;
+   future_t *future;
+   bson_error_t error;
+
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{}"), tmp_bson (opts_json), NULL);
+
+   future = future_cursor_next (cursor, &doc);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_SLAVE_OK,
+      "{'find': 'coll',"
+      " 'batchSize': {'$exists': false},"
+      " 'adaptiveBatchBytes': {'$exists': false}}");
+
+   mock_server_replies_simple (request,
+                               "{'ok': 1,"
+                               " 'cursor': {"
+                               "    'id': {'$numberLong': '123'},"
+                               "    'ns': 'db.coll',"
+                               "    'firstBatch': ["
+                               "       {'_id': 0}, {'_id': 1}, {'_id': 2}]}}");
+
+   ASSERT (future_get_bool (future));
+   future_destroy (future);
+   request_destroy (request);
+
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+
+   future = future_cursor_next (cursor, &doc);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_SLAVE_OK,
+      "{'getMore': {'$numberLong': '123'}, 'batchSize': %" PRId64 "}",
+      batch_size);
+
+   mock_server_replies_simple (request,
+                               "{'ok': 1,"
+                               " 'cursor': {"
+                               "    'id': 0,"
+                               "    'ns': 'db.coll',"
+                               "    'nextBatch': [{'_id': 3}]}}");
+
+   ASSERT (future_get_bool (future));
+   future_destroy (future);
+   request_destroy (request);
+
+   ASSERT (!mongoc_cursor_next (cursor, &doc));
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+   mongoc_cursor_destroy (cursor);
+}
+
+
+/* with adaptiveBatchBytes, getMores ask for what fits the target */
+static void
+test_cursor_adaptive_batch_size (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "coll");
+
+   /* the first batch averages 18 bytes per document, room for 2 */
+   _test_adaptive_batch_size (
+      collection, server, "{'adaptiveBatchBytes': 40}", 2);
+
+   /* no more than the limit leaves */
+   _test_adaptive_batch_size (
+      collection, server, "{'adaptiveBatchBytes': 10000, 'limit': 4}", 1);
+
+   cursor = mongoc_collection_find_with_opts (
+      collection,
+      tmp_bson ("{}"),
+      tmp_bson ("{'adaptiveBatchBytes': -1}"),
+      NULL);
+   ASSERT (!mongoc_cursor_next (cursor, &doc));
+   ASSERT_ERROR_CONTAINS (cursor->error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "The adaptiveBatchBytes option must be a "
+                          "non-negative 32-bit integer");
+   mongoc_cursor_destroy (cursor);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
+/* with memoryBudgetMB, getMores ask for smaller batches under pressure */
+static void
+test_cursor_memory_budget (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   int64_t used;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "memoryBudgetMB", 1);
+   client = mongoc_client_new_from_uri (uri);
+   collection = mongoc_client_get_collection (client, "db", "coll");
+
+   /* the client's reply buffer is accounted for */
+   used = _mongoc_memory_budget_used (client->budget);
+   ASSERT_CMPINT64 (used, >, (int64_t) 0);
+
+   /* over budget, batches are sized for 16k, or 910 documents of the
+    * first batch's average 18 bytes */
+   _mongoc_memory_budget_charge (client->budget, 2 * 1024 * 1024);
+   _test_adaptive_batch_size (collection, server, "{}", 910);
+
+   /* a smaller adaptive batch is kept */
+   _test_adaptive_batch_size (
+      collection, server, "{'adaptiveBatchBytes': 40}", 2);
+
+   _mongoc_memory_budget_charge (client->budget, -2 * 1024 * 1024);
+
+   /* destroyed cursors are cached with their buffers */
+   ASSERT_CMPINT64 (_mongoc_memory_budget_used (client->budget), >=, used);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+#ifndef _WIN32
+/* with spillBatchBytes, larger batches are iterated from a mapped file */
+static void
+test_cursor_spill (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   request_t *request;
+   future_t *future;
+   bson_error_t error;
+   int i;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "coll");
+
+   cursor = mongoc_collection_find_with_opts (
+      collection,
+      tmp_bson ("{}"),
+      tmp_bson ("{'spillBatchBytes': 100}"),
+      NULL);
+
+   future = future_cursor_next (cursor, &doc);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_SLAVE_OK,
+      "{'find': 'coll', 'spillBatchBytes': {'$exists': false}}");
+
+   /* more than 100 bytes */
+   mock_server_replies_simple (request,
+                               "{'ok': 1,"
+                               " 'cursor': {"
+                               "    'id': {'$numberLong': '123'},"
+                               "    'ns': 'db.coll',"
+                               "    'firstBatch': ["
+                               "       {'_id': 0}, {'_id': 1},"
+                               "       {'_id': 2}, {'_id': 3}]}}");
+
+   ASSERT (future_get_bool (future));
+   future_destroy (future);
+   request_destroy (request);
+
+   ASSERT (cursor->spill_map);
+   ASSERT_CMPINT32 (bson_lookup_int32 (doc, "_id"), ==, 0);
+   for (i = 1; i < 4; i++) {
+      ASSERT (mongoc_cursor_next (cursor, &doc));
+      ASSERT_CMPINT32 (bson_lookup_int32 (doc, "_id"), ==, i);
+   }
+
+   /* a smaller batch stays in memory, the file is released */
+   future = future_cursor_next (cursor, &doc);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_SLAVE_OK,
+      "{'getMore': {'$numberLong': '123'}}");
+
+   mock_server_replies_simple (request,
+                               "{'ok': 1,"
+                               " 'cursor': {"
+                               "    'id': 0,"
+                               "    'ns': 'db.coll',"
+                               "    'nextBatch': [{'_id': 4}]}}");
+
+   ASSERT (future_get_bool (future));
+   future_destroy (future);
+   request_destroy (request);
+
+   ASSERT (!cursor->spill_map);
+   ASSERT_CMPINT32 (bson_lookup_int32 (doc, "_id"), ==, 4);
+   ASSERT (!mongoc_cursor_next (cursor, &doc));
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+   mongoc_cursor_destroy (cursor);
+
+   cursor = mongoc_collection_find_with_opts (
+      collection,
+      tmp_bson ("{}"),
+      tmp_bson ("{'spillBatchBytes': -1}"),
+      NULL);
+   ASSERT (!mongoc_cursor_next (cursor, &doc));
+   ASSERT_ERROR_CONTAINS (cursor->error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "The spillBatchBytes option must be a "
+                          "non-negative 32-bit integer");
+   mongoc_cursor_destroy (cursor);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+#endif
+
+
+/* with streamBatches, a getMore's documents are returned as they arrive */
+static void
+test_cursor_stream_batches (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_apm_callbacks_t *callbacks;
+   prefetch_test_t test = {0};
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_t *opts;
+   bson_error_t error;
+   char padding[1001];
+   int i;
+
+   if (!test_framework_max_wire_version_at_least (WIRE_VERSION_OP_MSG)) {
+      return;
+   }
+
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "test_cursor_stream_batches");
+
+   /* the batch is more than the driver reads ahead */
+   memset (padding, 'x', sizeof padding - 1);
+   padding[sizeof padding - 1] = '\0';
+   for (i = 0; i < 10; i++) {
+      ASSERT_OR_PRINT (
+         mongoc_collection_insert (
+            collection,
+            MONGOC_INSERT_NONE,
+            tmp_bson ("{'_id': %d, 'padding': '%s'}", i, padding),
+            NULL,
+            &error),
+         error);
+   }
+
+   callbacks = mongoc_apm_callbacks_new ();
+   mongoc_apm_set_command_started_cb (callbacks, prefetch_started);
+   mongoc_apm_set_command_succeeded_cb (callbacks, prefetch_succeeded);
+   mongoc_client_set_apm_callbacks (client, callbacks, &test);
+
+   opts = tmp_bson ("{'batchSize': 1, 'streamBatches': true}");
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{}"), opts, NULL);
+
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT (!cursor->streaming);
+
+   /* the getMore asks for the rest, and returns the first document before
+    * the others are read */
+   mongoc_cursor_set_batch_size (cursor, 0);
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT_CMPINT32 (bson_lookup_int32 (doc, "_id"), ==, 1);
+   ASSERT (cursor->streaming);
+   ASSERT_CMPINT (test.started, ==, 1);
+   ASSERT_CMPINT (test.succeeded, ==, 0);
+
+   /* another operation reads the rest of the batch off the connection */
+   ASSERT_COUNT (10, collection);
+   ASSERT (cursor->streaming);
+
+   for (i = 2; mongoc_cursor_next (cursor, &doc); i++) {
+      ASSERT_CMPINT32 (bson_lookup_int32 (doc, "_id"), ==, i);
+   }
+
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+   ASSERT_CMPINT (i, ==, 10);
+   ASSERT (!cursor->streaming);
+   ASSERT_CMPINT (test.started, ==, 1);
+   ASSERT_CMPINT (test.succeeded, ==, 1);
+   mongoc_cursor_destroy (cursor);
+
+   /* destroying a cursor partway through a batch leaves the client usable */
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{}"), opts, NULL);
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   mongoc_cursor_set_batch_size (cursor, 0);
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT (cursor->streaming);
+   mongoc_cursor_destroy (cursor);
+   ASSERT_COUNT (10, collection);
+
+   /* the option must be a boolean */
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{}"), tmp_bson ("{'streamBatches': 1}"), NULL);
+   ASSERT (!mongoc_cursor_next (cursor, &doc));
+   ASSERT_ERROR_CONTAINS (cursor->error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "The streamBatches option must be a boolean");
+   mongoc_cursor_destroy (cursor);
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+   mongoc_apm_callbacks_destroy (callbacks);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+_assert_next_batch (mongoc_cursor_t *cursor, int first_id, uint32_t n)
+{
+   const uint8_t *data;
+   size_t data_len;
+   const uint32_t *offsets;
+   uint32_t n_docs;
+   uint32_t i;
+   int32_t len;
+   bson_t doc;
+
+   ASSERT_OR_PRINT (mongoc_cursor_next_batch (
+                       cursor, &data, &data_len, &offsets, &n_docs),
+                    cursor->error);
+   ASSERT_CMPUINT32 (n_docs, ==, n);
+   ASSERT_CMPUINT32 (offsets[0], ==, (uint32_t) 0);
+
+   for (i = 0; i < n_docs; i++) {
+      memcpy (&len, data + offsets[i], sizeof len);
+      len = BSON_UINT32_FROM_LE (len);
+      ASSERT_CMPSIZE_T ((size_t) offsets[i] + len, <=, data_len);
+      ASSERT (bson_init_static (&doc, data + offsets[i], (uint32_t) len));
+      ASSERT_CMPINT32 (
+         bson_lookup_int32 (&doc, "_id"), ==, (int32_t) (first_id + i));
+   }
+
+   /* the view ends with the last document */
+   ASSERT_CMPSIZE_T ((size_t) offsets[n_docs - 1] + len, ==, data_len);
+}
+
+
+static void
+test_cursor_next_batch (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   const uint8_t *data;
+   size_t data_len;
+   const uint32_t *offsets;
+   uint32_t n_docs;
+   bson_error_t error;
+   int i;
+
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "test_cursor_next_batch");
+   for (i = 0; i < 10; i++) {
+      ASSERT_OR_PRINT (mongoc_collection_insert (collection,
+                                                 MONGOC_INSERT_NONE,
+                                                 tmp_bson ("{'_id': %d}", i),
+                                                 NULL,
+                                                 &error),
+                       error);
+   }
+
+   cursor = mongoc_collection_find_with_opts (
+      collection,
+      tmp_bson ("{}"),
+      tmp_bson ("{'batchSize': 4, 'sort': {'_id': 1}}"),
+      NULL);
+
+   _assert_next_batch (cursor, 0, 4);
+
+   /* mixed with mongoc_cursor_next, the rest of the batch is returned */
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT_CMPINT32 (bson_lookup_int32 (doc, "_id"), ==, 4);
+   _assert_next_batch (cursor, 5, 3);
+   _assert_next_batch (cursor, 8, 2);
+   ASSERT (!mongoc_cursor_next_batch (
+      cursor, &data, &data_len, &offsets, &n_docs));
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+   ASSERT_CMPUINT32 (n_docs, ==, (uint32_t) 0);
+   mongoc_cursor_destroy (cursor);
+
+   /* a batch never goes past the limit */
+   cursor = mongoc_collection_find_with_opts (
+      collection,
+      tmp_bson ("{}"),
+      tmp_bson ("{'batchSize': 4, 'limit': 6, 'sort': {'_id': 1}}"),
+      NULL);
+
+   _assert_next_batch (cursor, 0, 4);
+   _assert_next_batch (cursor, 4, 2);
+   ASSERT (!mongoc_cursor_next_batch (
+      cursor, &data, &data_len, &offsets, &n_docs));
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+   mongoc_cursor_destroy (cursor);
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+/* a destroyed cursor's allocation is reused by the client's next cursor */
+static void
+test_cursor_recycle (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   mongoc_cursor_t *cursors[MONGOC_CLIENT_CURSOR_CACHE_SIZE + 1];
+   mongoc_cursor_t *recycled;
+   bson_error_t error;
+   int i;
+
+   client = mongoc_client_new ("mongodb://localhost");
+   collection = mongoc_client_get_collection (client, "db", "collection");
+
+   /* a failed cursor, which must not leave its error to the next one */
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{}"), tmp_bson ("{'$bad': 1}"), NULL);
+   ASSERT (mongoc_cursor_error (cursor, &error));
+   recycled = cursor;
+   mongoc_cursor_destroy (cursor);
+   ASSERT_CMPUINT32 (client->n_cached_cursors, ==, (uint32_t) 1);
+
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{'a': 1}"), NULL, NULL);
+   ASSERT (cursor == recycled);
+   ASSERT_CMPUINT32 (client->n_cached_cursors, ==, (uint32_t) 0);
+   ASSERT (!mongoc_cursor_error (cursor, &error));
+   ASSERT (mongoc_cursor_is_alive (cursor));
+   ASSERT_MATCH (&cursor->filter, "{'a': 1}");
+   mongoc_cursor_destroy (cursor);
+
+   /* the cache is bounded */
+   for (i = 0; i < MONGOC_CLIENT_CURSOR_CACHE_SIZE + 1; i++) {
+      cursors[i] = mongoc_collection_find_with_opts (
+         collection, tmp_bson ("{}"), NULL, NULL);
+   }
+
+   for (i = 0; i < MONGOC_CLIENT_CURSOR_CACHE_SIZE + 1; i++) {
+      mongoc_cursor_destroy (cursors[i]);
+   }
+
+   ASSERT_CMPUINT32 (client->n_cached_cursors,
+                     ==,
+                     (uint32_t) MONGOC_CLIENT_CURSOR_CACHE_SIZE);
+
+   /* frees the cached cursors */
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+/* a finished cursor on the documents in @batch_json */
+static mongoc_cursor_t *
+_cursor_from_batch (mongoc_client_t *client, const char *batch_json)
+{
+   bson_t reply;
+   char *json;
+
+   json = bson_strdup_printf (
+      "{'ok': 1, 'cursor': {'id': 0, 'ns': 'db.c', 'firstBatch': %s}}",
+      batch_json);
+   bson_copy_to (tmp_bson (json), &reply);
+   bson_free (json);
+
+   return mongoc_cursor_new_from_command_reply (client, &reply, 0);
+}
+
+
+static void
+_test_cursor_merged (const char *sort_json,
+                     const char *batches_json[3],
+                     const char *expected_json)
+{
+   mongoc_client_t *client;
+   mongoc_cursor_t *children[3];
+   mongoc_cursor_t *cursor;
+   bson_t expected;
+   bson_iter_t iter;
+   const bson_t *doc;
+   bson_error_t error;
+   int i;
+
+   client = mongoc_client_new ("mongodb://localhost");
+   for (i = 0; i < 3; i++) {
+      children[i] = _cursor_from_batch (client, batches_json[i]);
+   }
+
+   cursor = mongoc_cursor_new_merged (children, 3, tmp_bson (sort_json));
+   bson_copy_to (tmp_bson (expected_json), &expected);
+   ASSERT (bson_iter_init_find (&iter, &expected, "docs"));
+   ASSERT (bson_iter_recurse (&iter, &iter));
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      ASSERT (bson_iter_next (&iter));
+      ASSERT_CMPINT32 (
+         bson_lookup_int32 (doc, "_id"), ==, bson_iter_int32 (&iter));
+   }
+
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+   ASSERT (!bson_iter_next (&iter));
+   ASSERT (!mongoc_cursor_more (cursor));
+
+   bson_destroy (&expected);
+   mongoc_cursor_destroy (cursor);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_cursor_merged (void)
+{
+   const char *ascending[3] = {
+      "[{'_id': 1, 'a': 1}, {'_id': 4, 'a': 3}, {'_id': 7, 'a': 'x'}]",
+      "[{'_id': 2, 'a': 1.5}, {'_id': 5, 'a': {'$numberLong': '3'}}]",
+      "[{'_id': 0}, {'_id': 3, 'a': 2}, {'_id': 6, 'a': 10}]"};
+   const char *descending[3] = {
+      "[{'_id': 1, 'a': {'b': 9}}, {'_id': 3, 'a': {'b': 1}}]",
+      "[]",
+      "[{'_id': 2, 'a': {'b': 2.5}}, {'_id': 4, 'a': {'b': null}}]"};
+   const char *compound[3] = {"[{'_id': 0, 'a': 1, 'b': 2}]",
+                              "[{'_id': 1, 'a': 1, 'b': 1}]",
+                              "[{'_id': 2, 'a': 2, 'b': 3}]"};
+
+   /* a missing field sorts as null, numbers before strings, ties in order
+    * of the children */
+   _test_cursor_merged (
+      "{'a': 1}", ascending, "{'docs': [0, 1, 2, 3, 4, 5, 6, 7]}");
+   /* dotted fields, an empty child */
+   _test_cursor_merged ("{'a.b': -1}", descending, "{'docs': [1, 2, 3, 4]}");
+   _test_cursor_merged (
+      "{'a': 1, 'b': -1}", compound, "{'docs': [0, 1, 2]}");
+}
+
+
+static void
+test_cursor_merged_errors (void)
+{
+   mongoc_client_t *client;
+   mongoc_cursor_t *children[2];
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t reply = BSON_INITIALIZER;
+
+   client = mongoc_client_new ("mongodb://localhost");
+
+   /* a failed child fails the merge */
+   children[0] = _cursor_from_batch (client, "[{'_id': 0}]");
+   children[1] = mongoc_cursor_new_from_command_reply (client, &reply, 0);
+   cursor = mongoc_cursor_new_merged (children, 2, tmp_bson ("{'_id': 1}"));
+   ASSERT (!mongoc_cursor_next (cursor, &doc));
+   ASSERT (mongoc_cursor_error (cursor, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "Couldn't parse cursor document");
+   ASSERT (!mongoc_cursor_more (cursor));
+   mongoc_cursor_destroy (cursor);
+
+   /* invalid sort specifications */
+   children[0] = _cursor_from_batch (client, "[{'_id': 0}]");
+   cursor = mongoc_cursor_new_merged (children, 1, tmp_bson ("{}"));
+   ASSERT (mongoc_cursor_error (cursor, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "without a sort specification");
+   ASSERT (!mongoc_cursor_next (cursor, &doc));
+   mongoc_cursor_destroy (cursor);
+
+   children[0] = _cursor_from_batch (client, "[{'_id': 0}]");
+   cursor = mongoc_cursor_new_merged (children, 1, tmp_bson ("{'a': 'x'}"));
+   ASSERT (mongoc_cursor_error (cursor, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_CURSOR,
+                          MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                          "Invalid sort direction for \"a\"");
+   mongoc_cursor_destroy (cursor);
+
+   mongoc_client_destroy (client);
+}
+
+
 void
 test_cursor_install (TestSuite *suite)
 {
@@ -1582,6 +2464,8 @@ test_cursor_install (TestSuite *suite)
       suite, "/Cursor/kill/single/cmd", test_kill_cursors_single_cmd);
    TestSuite_AddMockServerTest (
       suite, "/Cursor/kill/pooled/cmd", test_kill_cursors_pooled_cmd);
+   TestSuite_AddMockServerTest (
+      suite, "/Cursor/kill/deferred", test_kill_cursors_deferred);
    TestSuite_AddMockServerTest (suite,
                                 "/Cursor/client_kill_cursor/with_primary",
                                 test_client_kill_cursor_with_primary);
@@ -1652,4 +2536,18 @@ test_cursor_install (TestSuite *suite)
       suite, "/Cursor/error_document/getmore", test_error_document_getmore);
    TestSuite_AddLive (
       suite, "/Cursor/error_document/command", test_error_document_command);
+   TestSuite_AddLive (suite, "/Cursor/prefetch", test_cursor_prefetch);
+   TestSuite_AddLive (suite, "/Cursor/next_batch", test_cursor_next_batch);
+   TestSuite_AddMockServerTest (
+      suite, "/Cursor/adaptive_batch_size", test_cursor_adaptive_batch_size);
+   TestSuite_AddMockServerTest (
+      suite, "/Cursor/memory_budget", test_cursor_memory_budget);
+#ifndef _WIN32
+   TestSuite_AddMockServerTest (suite, "/Cursor/spill", test_cursor_spill);
+#endif
+   TestSuite_AddLive (
+      suite, "/Cursor/stream_batches", test_cursor_stream_batches);
+   TestSuite_Add (suite, "/Cursor/recycle", test_cursor_recycle);
+   TestSuite_Add (suite, "/Cursor/merged", test_cursor_merged);
+   TestSuite_Add (suite, "/Cursor/merged/errors", test_cursor_merged_errors);
 }
@@ -28,6 +28,19 @@ skip_if_mongos (void)
 }
 
 
+static int
+skip_if_no_opmsg_exhaust (void)
+{
+   if (!TestSuite_CheckLive ()) {
+      return 0;
+   }
+   return test_framework_max_wire_version_at_least (
+             WIRE_VERSION_OP_MSG_EXHAUST)
+             ? 1
+             : 0;
+}
+
+
 static int64_t
 get_timestamp (mongoc_client_t *client, mongoc_cursor_t *cursor)
 {
@@ -533,6 +546,70 @@ test_exhaust_server_err_2nd_batch_pooled (void)
    _mock_test_exhaust (true, SECOND_BATCH, SERVER_ERROR);
 }
 
+/* with exhaustAllowed, getMore batches stream over OP_MSG */
+static void
+test_exhaust_opmsg (void *context)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_bulk_operation_t *bulk;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_t *opts;
+   bson_error_t error;
+   int i;
+
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "test_exhaust_opmsg");
+   bulk = mongoc_collection_create_bulk_operation (collection, true, NULL);
+   for (i = 0; i < 1000; i++) {
+      mongoc_bulk_operation_insert (bulk, tmp_bson ("{'_id': %d}", i));
+   }
+
+   ASSERT_OR_PRINT (mongoc_bulk_operation_execute (bulk, NULL, &error), error);
+
+   opts = tmp_bson ("{'batchSize': 10, 'exhaustAllowed': true}");
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{}"), opts, NULL);
+
+   /* the first batch is the find command's reply */
+   for (i = 0; i < 10; i++) {
+      ASSERT (mongoc_cursor_next (cursor, &doc));
+      ASSERT (!client->in_exhaust);
+   }
+
+   /* the first getMore starts the stream */
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT (cursor->in_exhaust);
+   ASSERT (client->in_exhaust);
+
+   for (i = 11; mongoc_cursor_next (cursor, &doc); i++) {
+   }
+
+   ASSERT_OR_PRINT (!mongoc_cursor_error (cursor, &error), error);
+   ASSERT_CMPINT (i, ==, 1000);
+   ASSERT (!client->in_exhaust);
+   mongoc_cursor_destroy (cursor);
+
+   /* destroying a streaming cursor frees the client */
+   cursor = mongoc_collection_find_with_opts (
+      collection, tmp_bson ("{}"), opts, NULL);
+   for (i = 0; i < 20; i++) {
+      ASSERT (mongoc_cursor_next (cursor, &doc));
+   }
+
+   ASSERT (client->in_exhaust);
+   mongoc_cursor_destroy (cursor);
+   ASSERT (!client->in_exhaust);
+   ASSERT_COUNT (1000, collection);
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+   mongoc_bulk_operation_destroy (bulk);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
 void
 test_exhaust_install (TestSuite *suite)
 {
@@ -554,6 +631,12 @@ test_exhaust_install (TestSuite *suite)
                       NULL,
                       NULL,
                       skip_if_mongos);
+   TestSuite_AddFull (suite,
+                      "/Client/exhaust_cursor/opmsg",
+                      test_exhaust_opmsg,
+                      NULL,
+                      NULL,
+                      skip_if_no_opmsg_exhaust);
    TestSuite_AddLive (suite,
                       "/Client/set_max_await_time_ms",
                       test_cursor_set_max_await_time_ms);
@@ -558,6 +558,90 @@ test_find_and_modify_collation_fail (void)
    test_find_and_modify_collation (WIRE_VERSION_COLLATION - 1);
 }
 
+/* claim jobs from a queue, several per round trip */
+static void
+test_find_and_modify_pipelined (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_find_and_modify_opts_t *opts;
+   bson_t *ready = tmp_bson ("{'state': 'ready'}");
+   bson_t docs[3];
+   uint32_t n_docs;
+   bson_error_t error;
+   uint32_t i;
+   int j;
+
+   client = test_framework_client_new ();
+   collection = get_test_collection (client, "test_find_and_modify_pipelined");
+
+   for (j = 0; j < 5; j++) {
+      ASSERT_OR_PRINT (mongoc_collection_insert (
+                          collection,
+                          MONGOC_INSERT_NONE,
+                          tmp_bson ("{'_id': %d, 'state': 'ready'}", j),
+                          NULL,
+                          &error),
+                       error);
+   }
+
+   opts = mongoc_find_and_modify_opts_new ();
+   mongoc_find_and_modify_opts_set_update (
+      opts, tmp_bson ("{'$set': {'state': 'claimed'}}"));
+   mongoc_find_and_modify_opts_set_sort (opts, tmp_bson ("{'_id': 1}"));
+   mongoc_find_and_modify_opts_set_flags (opts,
+                                          MONGOC_FIND_AND_MODIFY_RETURN_NEW);
+
+   /* each command claims the next job */
+   ASSERT_OR_PRINT (
+      mongoc_collection_find_and_modify_pipelined (
+         collection, ready, opts, 3, docs, &n_docs, &error),
+      error);
+   ASSERT_CMPUINT32 (n_docs, ==, (uint32_t) 3);
+   for (i = 0; i < n_docs; i++) {
+      ASSERT_MATCH (&docs[i], "{'state': 'claimed'}");
+   }
+
+   for (i = 0; i < 3; i++) {
+      bson_destroy (&docs[i]);
+   }
+
+   /* two are left */
+   ASSERT_OR_PRINT (
+      mongoc_collection_find_and_modify_pipelined (
+         collection, ready, opts, 3, docs, &n_docs, &error),
+      error);
+   ASSERT_CMPUINT32 (n_docs, ==, (uint32_t) 2);
+   ASSERT_MATCH (&docs[0], "{'_id': 3, 'state': 'claimed'}");
+   ASSERT_MATCH (&docs[1], "{'_id': 4, 'state': 'claimed'}");
+
+   for (i = 0; i < 3; i++) {
+      bson_destroy (&docs[i]);
+   }
+
+   /* without an update or remove, each command finds the same document */
+   mongoc_find_and_modify_opts_destroy (opts);
+   opts = mongoc_find_and_modify_opts_new ();
+   BSON_ASSERT (!mongoc_collection_find_and_modify_pipelined (
+      collection, tmp_bson ("{}"), opts, 3, docs, &n_docs, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "must update or remove");
+   ASSERT_CMPUINT32 (n_docs, ==, (uint32_t) 0);
+
+   for (i = 0; i < 3; i++) {
+      bson_destroy (&docs[i]);
+   }
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+
+   mongoc_find_and_modify_opts_destroy (opts);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
 void
 test_find_and_modify_install (TestSuite *suite)
 {
@@ -594,4 +678,7 @@ test_find_and_modify_install (TestSuite *suite)
    TestSuite_AddMockServerTest (suite,
                                 "/find_and_modify/collation/fail",
                                 test_find_and_modify_collation_fail);
+   TestSuite_AddLive (suite,
+                      "/find_and_modify/pipelined",
+                      test_find_and_modify_pipelined);
 }
@@ -1,10 +1,16 @@
 #include <mongoc.h>
 #define MONGOC_INSIDE
 #include <mongoc-gridfs-file-private.h>
+#include <mongoc-gridfs-private.h>
 #include <mongoc-client-private.h>
+#include <mongoc-util-private.h>
 
 #undef MONGOC_INSIDE
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 #include "test-libmongoc.h"
 #include "TestSuite.h"
 #include "test-conveniences.h"
@@ -406,6 +412,72 @@ test_find_one_with_opts_limit (void)
 }
 
 
+/* a small file and its chunks come back from one aggregate, and reading it
+ * sends nothing more */
+static void
+test_find_one_with_chunks (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+   char buf[16];
+   mongoc_iovec_t iov;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_LOOKUP_PIPELINE);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   gridfs = _get_gridfs (server, client);
+
+   future = future_gridfs_find_one_with_chunks (
+      gridfs, tmp_bson ("{'filename': 'f'}"), 2, &error);
+
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'aggregate': 'fs.files', 'pipeline': ["
+      " {'$match': {'filename': 'f'}},"
+      " {'$limit': 1},"
+      " {'$lookup': {'from': 'fs.chunks',"
+      "              'let': {'files_id': '$_id'},"
+      "              'pipeline': [{'$match': {'$expr': {'$eq': ["
+      "                              '$files_id', '$$files_id']}}},"
+      "                           {'$sort': {'n': 1}},"
+      "                           {'$limit': {'$numberLong': '2'}},"
+      "                           {'$project': {'_id': 0}}],"
+      "              'as': 'firstChunks'}}]}");
+
+   mock_server_replies_simple (
+      request,
+      "{'ok': 1, 'cursor': {'id': 0, 'ns': 'db.fs.files', 'firstBatch': [{"
+      " '_id': 1, 'length': 6, 'chunkSize': 4, 'filename': 'f',"
+      " 'firstChunks': ["
+      "  {'n': 0, 'data': {'$binary': 'YWJjZA==', '$type': '00'}},"
+      "  {'n': 1, 'data': {'$binary': 'ZWY=', '$type': '00'}}]}]}}");
+
+   file = future_get_mongoc_gridfs_file_ptr (future);
+   ASSERT_OR_PRINT (file, error);
+   ASSERT_CMPINT64 (mongoc_gridfs_file_get_length (file), ==, (int64_t) 6);
+
+   iov.iov_base = buf;
+   iov.iov_len = sizeof buf;
+   ASSERT_CMPSSIZE_T (
+      mongoc_gridfs_file_readv (file, &iov, 1, 6, 0), ==, (ssize_t) 6);
+   ASSERT (!memcmp (buf, "abcdef", 6));
+
+   mongoc_gridfs_file_destroy (file);
+   future_destroy (future);
+   request_destroy (request);
+   mongoc_gridfs_destroy (gridfs);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
 static void
 test_properties (void)
 {
@@ -529,6 +601,69 @@ test_create_from_stream (void)
 }
 
 
+#ifndef _WIN32
+/* a file stream is uploaded from a mapping, starting at its offset */
+static void
+test_create_from_stream_offset (void)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_file_opt_t opt = {0};
+   mongoc_stream_t *stream;
+   mongoc_client_t *client;
+   mongoc_iovec_t iov;
+   bson_error_t error;
+   FILE *fp;
+   char *expected;
+   char *actual;
+   long size;
+   ssize_t r;
+   int fd;
+
+   fp = fopen (BINARY_DIR "/gridfs-large.dat", "rb");
+   ASSERT_OR_PRINT_ERRNO (fp, errno);
+   ASSERT_CMPINT (fseek (fp, 0, SEEK_END), ==, 0);
+   size = ftell (fp);
+   ASSERT_CMPINT (fseek (fp, 100, SEEK_SET), ==, 0);
+   expected = bson_malloc ((size_t) size - 100);
+   ASSERT_CMPSIZE_T (
+      fread (expected, 1, (size_t) size - 100, fp), ==, (size_t) size - 100);
+   fclose (fp);
+
+   client = test_framework_client_new ();
+   ASSERT_OR_PRINT (gridfs = get_test_gridfs (client, "offset", &error),
+                    error);
+
+   stream = mongoc_stream_file_new_for_path (
+      BINARY_DIR "/gridfs-large.dat", O_RDONLY, 0);
+   ASSERT_OR_PRINT_ERRNO (stream, errno);
+   fd = mongoc_stream_file_get_fd ((mongoc_stream_file_t *) stream);
+   ASSERT_CMPINT64 ((int64_t) lseek (fd, 100, SEEK_SET), ==, (int64_t) 100);
+
+   opt.chunk_size = 1000;
+   file = mongoc_gridfs_create_file_from_stream (gridfs, stream, &opt);
+   ASSERT (file);
+   ASSERT (mongoc_gridfs_file_save (file));
+   ASSERT_CMPINT64 (
+      mongoc_gridfs_file_get_length (file), ==, (int64_t) size - 100);
+
+   actual = bson_malloc ((size_t) size - 100);
+   iov.iov_base = actual;
+   iov.iov_len = (size_t) size - 100;
+   r = mongoc_gridfs_file_readv (file, &iov, 1, iov.iov_len, 0);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) size - 100);
+   ASSERT_MEMCMP (actual, expected, (int) (size - 100));
+
+   bson_free (actual);
+   bson_free (expected);
+   mongoc_gridfs_file_destroy (file);
+   drop_collections (gridfs, &error);
+   mongoc_gridfs_destroy (gridfs);
+   mongoc_client_destroy (client);
+}
+#endif
+
+
 static void
 test_seek (void)
 {
@@ -956,6 +1091,96 @@ test_stream (void)
 }
 
 
+/* poll, then read or write without blocking, past the size of a batch of
+ * chunks so one is sent behind the writer */
+static void
+test_stream_nonblocking (void)
+{
+   const size_t len = 17 * 1024 * 1024;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_file_opt_t opt = {0};
+   mongoc_stream_t *stream;
+   mongoc_stream_poll_t poller;
+   bson_error_t error;
+   mongoc_iovec_t iov;
+   char buf[64 * 1024];
+   size_t pos;
+   size_t i;
+   ssize_t r;
+
+   pool = test_framework_client_pool_new ();
+   client = mongoc_client_pool_pop (pool);
+   gridfs = get_test_gridfs (client, "nonblocking", &error);
+   ASSERT_OR_PRINT (gridfs, error);
+
+   opt.filename = "filename";
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   ASSERT (file);
+   stream = mongoc_stream_gridfs_new_nonblocking (file, pool, 4);
+
+   poller.stream = stream;
+   poller.events = POLLOUT;
+
+   for (pos = 0; pos < len; pos += (size_t) r) {
+      r = mongoc_stream_poll (&poller, 1, 10000);
+      ASSERT_CMPSSIZE_T (r, ==, (ssize_t) 1);
+      ASSERT_CMPINT (poller.revents, ==, POLLOUT);
+
+      for (i = 0; i < sizeof buf; i++) {
+         buf[i] = (char) ((pos + i) % 251);
+      }
+
+      iov.iov_base = buf;
+      iov.iov_len = BSON_MIN (sizeof buf, len - pos);
+      r = mongoc_stream_writev (stream, &iov, 1, 0);
+      if (r < 0) {
+         ASSERT_CMPINT (errno, ==, EAGAIN);
+         r = 0;
+      }
+   }
+
+   ASSERT (!mongoc_gridfs_file_error (file, &error));
+   ASSERT_CMPINT (mongoc_stream_flush (stream), ==, 1);
+   ASSERT_CMPINT64 (mongoc_gridfs_file_get_length (file), ==, (int64_t) len);
+
+   ASSERT_CMPINT (mongoc_gridfs_file_seek (file, 0, SEEK_SET), ==, 0);
+   poller.events = POLLIN;
+
+   for (pos = 0; pos < len; pos += (size_t) r) {
+      r = mongoc_stream_poll (&poller, 1, 10000);
+      ASSERT_CMPSSIZE_T (r, ==, (ssize_t) 1);
+      ASSERT_CMPINT (poller.revents, ==, POLLIN);
+
+      iov.iov_base = buf;
+      iov.iov_len = sizeof buf;
+      r = mongoc_stream_readv (stream, &iov, 1, 1, 0);
+      if (r < 0) {
+         ASSERT_CMPINT (errno, ==, EAGAIN);
+         r = 0;
+      }
+
+      for (i = 0; i < (size_t) r; i++) {
+         ASSERT_CMPINT ((int) (uint8_t) buf[i], ==, (int) ((pos + i) % 251));
+      }
+   }
+
+   /* at the end of the file */
+   r = mongoc_stream_readv (stream, &iov, 1, 1, 0);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) 0);
+   ASSERT (!mongoc_gridfs_file_error (file, &error));
+
+   mongoc_stream_destroy (stream);
+   mongoc_gridfs_file_destroy (file);
+   ASSERT_OR_PRINT (drop_collections (gridfs, &error), error);
+   mongoc_gridfs_destroy (gridfs);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+}
+
+
 #define ASSERT_TELL(file_, position_) \
    ASSERT_CMPUINT64 (mongoc_gridfs_file_tell (file_), ==, position_)
 
@@ -1039,6 +1264,334 @@ test_long_seek (void *ctx)
 }
 
 
+/* read the file in @read_size pieces from @offset and check each byte */
+static void
+_check_read_ahead (mongoc_gridfs_file_t *file,
+                   uint64_t offset,
+                   size_t read_size,
+                   uint64_t end)
+{
+   char buf[1000];
+   mongoc_iovec_t iov;
+   ssize_t r;
+   uint64_t pos;
+   size_t i;
+
+   BSON_ASSERT (read_size <= sizeof buf);
+
+   ASSERT_CMPINT (mongoc_gridfs_file_seek (file, offset, SEEK_SET), ==, 0);
+
+   iov.iov_base = buf;
+   iov.iov_len = read_size;
+
+   for (pos = offset; pos < end; pos += (uint64_t) r) {
+      r = mongoc_gridfs_file_readv (file, &iov, 1, read_size, 0);
+      ASSERT_CMPSSIZE_T (r, >, (ssize_t) 0);
+      for (i = 0; i < (size_t) r; i++) {
+         ASSERT_CMPINT ((int) (uint8_t) buf[i], ==, (int) ((pos + i) % 251));
+      }
+   }
+}
+
+
+static void
+test_read_ahead (void)
+{
+   const int32_t chunk_size = 1024;
+   const int n_chunks = 100;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   bson_error_t error;
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_file_opt_t opt = {0};
+   mongoc_iovec_t iov;
+   char buf[1024];
+   ssize_t r;
+   int i;
+   int j;
+
+   pool = test_framework_client_pool_new ();
+   client = mongoc_client_pool_pop (pool);
+   gridfs = get_test_gridfs (client, "read_ahead", &error);
+   ASSERT_OR_PRINT (gridfs, error);
+
+   opt.filename = "filename";
+   opt.chunk_size = (uint32_t) chunk_size;
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   ASSERT (file);
+
+   iov.iov_base = buf;
+   iov.iov_len = sizeof buf;
+
+   for (i = 0; i < n_chunks; i++) {
+      for (j = 0; j < chunk_size; j++) {
+         buf[j] = (char) ((i * chunk_size + j) % 251);
+      }
+
+      r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+      ASSERT_CMPSSIZE_T (r, ==, (ssize_t) sizeof buf);
+   }
+
+   ASSERT (mongoc_gridfs_file_save (file));
+   mongoc_gridfs_file_destroy (file);
+
+   file = mongoc_gridfs_find_one_with_opts (
+      gridfs, tmp_bson ("{'filename': 'filename'}"), NULL, &error);
+   ASSERT_OR_PRINT (file, error);
+
+   /* larger batches on the file's own client */
+   mongoc_gridfs_file_set_read_ahead (file, NULL, 10);
+   _check_read_ahead (file, 0, 1000, (uint64_t) (n_chunks * chunk_size));
+   ASSERT (!file->prefetch);
+
+   /* fetched ahead on a thread: read across chunk boundaries */
+   mongoc_gridfs_file_set_read_ahead (file, pool, 4);
+   _check_read_ahead (file, 0, 1000, (uint64_t) (n_chunks * chunk_size));
+   ASSERT (file->prefetch);
+
+   /* seek back, then forward past the window, then within it */
+   _check_read_ahead (file, 10, 100, 2000);
+   _check_read_ahead (file, 50 * chunk_size + 7, 100, 51 * chunk_size);
+   _check_read_ahead (file, 52 * chunk_size, 1000, 60 * chunk_size);
+
+   /* the thread is restarted after writing */
+   ASSERT_CMPINT (mongoc_gridfs_file_seek (file, 0, SEEK_SET), ==, 0);
+   for (j = 0; j < 10; j++) {
+      buf[j] = (char) (j % 251);
+   }
+
+   iov.iov_len = 10;
+   r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) 10);
+   ASSERT_CMPINT (
+      mongoc_gridfs_file_seek (file, 5 * chunk_size, SEEK_SET), ==, 0);
+   ASSERT (!file->prefetch);
+   _check_read_ahead (file, 0, 1000, (uint64_t) (n_chunks * chunk_size));
+
+   mongoc_gridfs_file_destroy (file);
+   ASSERT_OR_PRINT (drop_collections (gridfs, &error), error);
+   mongoc_gridfs_destroy (gridfs);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+static void
+test_chunk_cache (void)
+{
+   const int32_t chunk_size = 1024;
+   const int n_chunks = 10;
+   mongoc_client_t *client;
+   bson_error_t error;
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_file_opt_t opt = {0};
+   mongoc_collection_t *chunks;
+   mongoc_iovec_t iov;
+   char buf[1024];
+   ssize_t r;
+   int i;
+   int j;
+
+   client = test_framework_client_new ();
+   gridfs = get_test_gridfs (client, "chunk_cache", &error);
+   ASSERT_OR_PRINT (gridfs, error);
+
+   opt.filename = "filename";
+   opt.chunk_size = (uint32_t) chunk_size;
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   ASSERT (file);
+
+   iov.iov_base = buf;
+   iov.iov_len = sizeof buf;
+
+   for (i = 0; i < n_chunks; i++) {
+      for (j = 0; j < chunk_size; j++) {
+         buf[j] = (char) ((i * chunk_size + j) % 251);
+      }
+
+      r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+      ASSERT_CMPSSIZE_T (r, ==, (ssize_t) sizeof buf);
+   }
+
+   ASSERT (mongoc_gridfs_file_save (file));
+   mongoc_gridfs_file_destroy (file);
+
+   mongoc_gridfs_set_chunk_cache_size (gridfs, 1024 * 1024);
+
+   file = mongoc_gridfs_find_one_by_filename (gridfs, "filename", &error);
+   ASSERT_OR_PRINT (file, error);
+   _check_read_ahead (file, 0, 1000, (uint64_t) (n_chunks * chunk_size));
+   mongoc_gridfs_file_destroy (file);
+
+   /* another file object reads the cached chunks without the server */
+   chunks = mongoc_gridfs_get_chunks (gridfs);
+   ASSERT_OR_PRINT (
+      mongoc_collection_remove (
+         chunks, MONGOC_REMOVE_NONE, tmp_bson ("{}"), NULL, &error),
+      error);
+
+   file = mongoc_gridfs_find_one_by_filename (gridfs, "filename", &error);
+   ASSERT_OR_PRINT (file, error);
+   _check_read_ahead (file, 0, 1000, (uint64_t) (n_chunks * chunk_size));
+   _check_read_ahead (file, 5 * chunk_size + 3, 100, 6 * chunk_size);
+
+   /* shrinking the cache evicts the least recently used chunks, 0-4 */
+   mongoc_gridfs_set_chunk_cache_size (gridfs,
+                                       gridfs->chunk_cache->n_bytes / 2);
+   ASSERT_CMPINT (mongoc_gridfs_file_seek (file, 0, SEEK_SET), ==, 0);
+   r = mongoc_gridfs_file_readv (file, &iov, 1, sizeof buf, 0);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) -1);
+   ASSERT (mongoc_gridfs_file_error (file, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_GRIDFS,
+                          MONGOC_ERROR_GRIDFS_CHUNK_MISSING,
+                          "missing chunk number 0");
+   mongoc_gridfs_file_destroy (file);
+
+   file = mongoc_gridfs_find_one_by_filename (gridfs, "filename", &error);
+   ASSERT_OR_PRINT (file, error);
+   _check_read_ahead (file, 6 * chunk_size, 1000, 9 * chunk_size);
+   mongoc_gridfs_file_destroy (file);
+
+   mongoc_gridfs_set_chunk_cache_size (gridfs, 0);
+   ASSERT (!gridfs->chunk_cache);
+
+   mongoc_collection_destroy (chunks);
+   ASSERT_OR_PRINT (drop_collections (gridfs, &error), error);
+   mongoc_gridfs_destroy (gridfs);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_read_range (void)
+{
+   const int32_t chunk_size = 1024;
+   mongoc_client_t *client;
+   bson_error_t error;
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_file_opt_t opt = {0};
+   mongoc_iovec_t iov[2];
+   char buf[3 * 1024];
+   char buf2[2000];
+   ssize_t r;
+   int i;
+
+   client = test_framework_client_new ();
+   gridfs = get_test_gridfs (client, "read_range", &error);
+   ASSERT_OR_PRINT (gridfs, error);
+
+   opt.filename = "filename";
+   opt.chunk_size = (uint32_t) chunk_size;
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   ASSERT (file);
+
+   for (i = 0; i < (int) sizeof buf; i++) {
+      buf[i] = (char) (i % 251);
+   }
+
+   /* the third chunk is short */
+   iov[0].iov_base = buf;
+   iov[0].iov_len = sizeof buf - 100;
+   r = mongoc_gridfs_file_writev (file, iov, 1, 0);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) (sizeof buf - 100));
+   ASSERT (mongoc_gridfs_file_save (file));
+   ASSERT_TELL (file, (uint64_t) (sizeof buf - 100));
+
+   /* across the three chunks, into two iovecs */
+   iov[0].iov_base = buf2;
+   iov[0].iov_len = 1000;
+   iov[1].iov_base = buf2 + 1000;
+   iov[1].iov_len = 1000;
+   r = mongoc_gridfs_file_read_range (file, 1000, 2500, iov, 2);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) 1500);
+   ASSERT_MEMCMP (buf2, buf + 1000, 1500);
+
+   /* clipped by the iovecs */
+   r = mongoc_gridfs_file_read_range (file, 10, 3000, iov, 2);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) 2000);
+   ASSERT_MEMCMP (buf2, buf + 10, 2000);
+
+   /* clipped by the end of the file */
+   r = mongoc_gridfs_file_read_range (file, 2500, 10000, iov, 2);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) (sizeof buf - 100 - 2500));
+   ASSERT_MEMCMP (buf2, buf + 2500, (int) (sizeof buf - 100 - 2500));
+
+   /* past the end */
+   r = mongoc_gridfs_file_read_range (file, 5000, 6000, iov, 2);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) 0);
+
+   /* the position is unchanged */
+   ASSERT_TELL (file, (uint64_t) (sizeof buf - 100));
+
+   mongoc_gridfs_file_destroy (file);
+   ASSERT_OR_PRINT (drop_collections (gridfs, &error), error);
+   mongoc_gridfs_destroy (gridfs);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_compute_md5 (void)
+{
+   mongoc_client_t *client;
+   bson_error_t error;
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_file_t *file2;
+   mongoc_gridfs_file_opt_t opt = {0};
+   mongoc_iovec_t iov[2];
+   char *expected;
+   ssize_t r;
+
+   client = test_framework_client_new ();
+   gridfs = get_test_gridfs (client, "compute_md5", &error);
+   ASSERT_OR_PRINT (gridfs, error);
+
+   opt.filename = "filename";
+   opt.chunk_size = 4;
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   ASSERT (file);
+   mongoc_gridfs_file_set_compute_md5 (file, true);
+
+   /* digested across writes and chunks */
+   iov[0].iov_base = (void *) "foo bar";
+   iov[0].iov_len = 7;
+   iov[1].iov_base = (void *) " baz";
+   iov[1].iov_len = 4;
+   r = mongoc_gridfs_file_writev (file, iov, 2, 0);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) 11);
+   r = mongoc_gridfs_file_writev (file, iov + 1, 1, 0);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) 4);
+   ASSERT (mongoc_gridfs_file_save (file));
+
+   expected = _mongoc_hex_md5 ("foo bar baz baz");
+   ASSERT_CMPSTR (mongoc_gridfs_file_get_md5 (file), expected);
+
+   file2 = mongoc_gridfs_find_one_with_opts (
+      gridfs, tmp_bson ("{'filename': 'filename'}"), NULL, &error);
+   ASSERT_OR_PRINT (file2, error);
+   ASSERT_CMPSTR (mongoc_gridfs_file_get_md5 (file2), expected);
+   mongoc_gridfs_file_destroy (file2);
+
+   /* overwriting breaks the digest, the saved one is kept */
+   ASSERT_CMPINT (mongoc_gridfs_file_seek (file, 0, SEEK_SET), ==, 0);
+   r = mongoc_gridfs_file_writev (file, iov + 1, 1, 0);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) 4);
+   ASSERT (mongoc_gridfs_file_save (file));
+   ASSERT_CMPSTR (mongoc_gridfs_file_get_md5 (file), expected);
+
+   bson_free (expected);
+   mongoc_gridfs_file_destroy (file);
+   ASSERT_OR_PRINT (drop_collections (gridfs, &error), error);
+   mongoc_gridfs_destroy (gridfs);
+   mongoc_client_destroy (client);
+}
+
+
 static void
 test_remove_by_filename (void)
 {
@@ -1337,6 +1890,68 @@ test_inherit_client_config (void)
    mock_server_destroy (server);
 }
 
+/* chunks are sent together, not one update per chunk */
+static void
+test_write_batched (void)
+{
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_file_opt_t opt = {0};
+   mongoc_iovec_t iov;
+   char buf[] = "foo bar baz!";
+   future_t *future;
+   request_t *request;
+   bson_t updates;
+   ssize_t r;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   gridfs = _get_gridfs (server, client);
+
+   opt.filename = "filename";
+   opt.chunk_size = 4;
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   ASSERT (file);
+
+   /* three chunks, two of them flushed before save */
+   iov.iov_base = buf;
+   iov.iov_len = sizeof buf - 1;
+   r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) 12);
+
+   future = future_gridfs_file_save (file);
+   request = mock_server_receives_command (
+      server,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'update': 'fs.chunks', 'updates': ["
+      " {'q': {'n': 0}, 'u': {'n': 0}, 'upsert': true},"
+      " {'q': {'n': 1}, 'u': {'n': 1}, 'upsert': true},"
+      " {'q': {'n': 2}, 'u': {'n': 2}, 'upsert': true}]}");
+
+   bson_lookup_doc (request_get_doc (request, 0), "updates", &updates);
+   ASSERT_CMPUINT32 (bson_count_keys (&updates), ==, (uint32_t) 3);
+   mock_server_replies_simple (request, "{'ok': 1, 'n': 3}");
+   request_destroy (request);
+
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_NONE, "{'update': 'fs.files'}");
+   mock_server_replies_simple (request, "{'ok': 1, 'n': 1}");
+   request_destroy (request);
+
+   ASSERT (future_get_bool (future));
+   future_destroy (future);
+
+   mongoc_gridfs_file_destroy (file);
+   mongoc_gridfs_destroy (gridfs);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+}
+
+
 static void
 test_find_one_empty (void)
 {
@@ -1369,22 +1984,37 @@ test_gridfs_install (TestSuite *suite)
    TestSuite_AddLive (suite, "/GridFS/find_with_opts", test_find_with_opts);
    TestSuite_AddMockServerTest (
       suite, "/GridFS/find_one_with_opts/limit", test_find_one_with_opts_limit);
+   TestSuite_AddMockServerTest (
+      suite, "/GridFS/find_one_with_chunks", test_find_one_with_chunks);
+#ifndef _WIN32
+   TestSuite_AddLive (suite,
+                      "/GridFS/create_from_stream_offset",
+                      test_create_from_stream_offset);
+#endif
    TestSuite_AddLive (suite, "/GridFS/properties", test_properties);
    TestSuite_AddLive (suite, "/GridFS/empty", test_empty);
    TestSuite_AddLive (suite, "/GridFS/read", test_read);
    TestSuite_AddLive (suite, "/GridFS/seek", test_seek);
    TestSuite_AddLive (suite, "/GridFS/stream", test_stream);
+   TestSuite_AddLive (
+      suite, "/GridFS/stream_nonblocking", test_stream_nonblocking);
    TestSuite_AddLive (suite, "/GridFS/remove", test_remove);
    TestSuite_AddLive (suite, "/GridFS/write", test_write);
    TestSuite_AddLive (
       suite, "/GridFS/write_at_boundary", test_write_at_boundary);
    TestSuite_AddLive (suite, "/GridFS/write_past_end", test_write_past_end);
+   TestSuite_AddMockServerTest (
+      suite, "/GridFS/write_batched", test_write_batched);
    TestSuite_AddFull (suite,
                       "/GridFS/test_long_seek",
                       test_long_seek,
                       NULL,
                       NULL,
                       test_framework_skip_if_slow_or_live);
+   TestSuite_AddLive (suite, "/GridFS/read_ahead", test_read_ahead);
+   TestSuite_AddLive (suite, "/GridFS/chunk_cache", test_chunk_cache);
+   TestSuite_AddLive (suite, "/GridFS/read_range", test_read_range);
+   TestSuite_AddLive (suite, "/GridFS/compute_md5", test_compute_md5);
    TestSuite_AddLive (
       suite, "/GridFS/remove_by_filename", test_remove_by_filename);
    TestSuite_AddFull (suite,
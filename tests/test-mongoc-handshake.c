@@ -276,6 +276,34 @@ test_mongoc_handshake_data_append_success (void)
    _reset_handshake ();
 }
 
+/* precomputed OS fields are sent instead of detected ones */
+static void
+test_mongoc_handshake_os_info_set (void)
+{
+   bson_t doc = BSON_INITIALIZER;
+
+   _reset_handshake ();
+
+   ASSERT (mongoc_handshake_os_info_set ("my os", "1.2.3", NULL));
+   ASSERT (_mongoc_handshake_build_doc_with_application (&doc, NULL));
+   ASSERT_MATCH (&doc,
+                 "{'os': {'name': 'my os',"
+                 "        'version': '1.2.3',"
+                 "        'architecture': {'$exists': false}}}");
+
+   /* can't change them after connecting */
+   _mongoc_handshake_freeze ();
+   capture_logs (true);
+   ASSERT (!mongoc_handshake_os_info_set ("other os", NULL, NULL));
+   ASSERT_CAPTURED_LOG ("mongoc_handshake_os_info_set",
+                        MONGOC_LOG_LEVEL_ERROR,
+                        "Cannot set handshake OS info after connecting");
+   capture_logs (false);
+
+   bson_destroy (&doc);
+   _reset_handshake ();
+}
+
 static void
 test_mongoc_handshake_data_append_after_cmd (void)
 {
@@ -480,6 +508,9 @@ test_handshake_install (TestSuite *suite)
    TestSuite_Add (suite,
                   "/MongoDB/handshake/failure",
                   test_mongoc_handshake_data_append_after_cmd);
+   TestSuite_Add (suite,
+                  "/MongoDB/handshake/os_info_set",
+                  test_mongoc_handshake_os_info_set);
    TestSuite_AddMockServerTest (
       suite, "/MongoDB/handshake/too_big", test_mongoc_handshake_too_big);
    TestSuite_AddMockServerTest (suite,
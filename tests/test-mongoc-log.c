@@ -113,6 +113,89 @@ test_mongoc_log_null (void)
    restore_state (&old_state);
 }
 
+static void
+count_log_func (mongoc_log_level_t log_level,
+                const char *log_domain,
+                const char *message,
+                void *user_data)
+{
+   int *n = (int *) user_data;
+
+   if (log_level == MONGOC_LOG_LEVEL_INFO &&
+       !strcmp (log_domain, "async-domain") && !strcmp (message, "async!")) {
+      (*n)++;
+   }
+}
+
+
+static void
+test_mongoc_log_async (void)
+{
+   struct log_state old_state;
+   int n = 0;
+   int i;
+
+   save_state (&old_state);
+   mongoc_log_set_handler (count_log_func, &n);
+   mongoc_log_set_async (true, 0);
+
+   for (i = 0; i < 100; i++) {
+      mongoc_log (MONGOC_LOG_LEVEL_INFO, "async-domain", "async!");
+   }
+
+   /* waits for queued messages */
+   mongoc_log_set_async (false, 0);
+   ASSERT_CMPINT (n, ==, 100 - (int) mongoc_log_get_dropped_count ());
+
+   /* synchronous again */
+   mongoc_log (MONGOC_LOG_LEVEL_INFO, "async-domain", "async!");
+   ASSERT_CMPINT (n, ==, 101 - (int) mongoc_log_get_dropped_count ());
+
+   restore_state (&old_state);
+}
+
+
+static int
+ring_traced_func (int n)
+{
+   ENTRY;
+
+   if (n > 0) {
+      GOTO (done);
+   }
+
+done:
+   RETURN (n);
+}
+
+
+static void
+test_mongoc_log_trace_ring (void)
+{
+   FILE *stream;
+   char buf[4096];
+   size_t n;
+
+   mongoc_log_trace_ring_enable (16, false);
+   ring_traced_func (1);
+   mongoc_log_trace_ring_disable ();
+   /* not recorded */
+   ring_traced_func (2);
+
+   stream = tmpfile ();
+   ASSERT (stream);
+   mongoc_log_trace_ring_dump (stream);
+   rewind (stream);
+   n = fread (buf, 1, sizeof buf - 1, stream);
+   buf[n] = '\0';
+   fclose (stream);
+
+   ASSERT_CONTAINS (buf, "ring_traced_func():");
+   ASSERT_CONTAINS (buf, "ENTRY");
+   ASSERT_CONTAINS (buf, "GOTO done");
+   ASSERT_CONTAINS (buf, "EXIT");
+}
+
 static int
 should_run_trace_tests (void)
 {
@@ -199,4 +282,6 @@ test_log_install (TestSuite *suite)
                       NULL,
                       should_not_run_trace_tests);
    TestSuite_Add (suite, "/Log/null", test_mongoc_log_null);
+   TestSuite_Add (suite, "/Log/trace_ring", test_mongoc_log_trace_ring);
+   TestSuite_Add (suite, "/Log/async", test_mongoc_log_async);
 }
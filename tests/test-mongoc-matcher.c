@@ -2,6 +2,7 @@
 #include <bcon.h>
 #include <mongoc.h>
 #include <mongoc-matcher-private.h>
+#include <mongoc-matcher-regex-private.h>
 #include <mongoc-util-private.h>
 
 #include "TestSuite.h"
@@ -548,6 +549,490 @@ test_mongoc_matcher_in_basic (void)
    mongoc_matcher_destroy (matcher);
 }
 
+
+static void
+test_mongoc_matcher_in_long (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t spec = BSON_INITIALIZER;
+   bson_t in;
+   bson_t arr;
+   bson_t *pair;
+   bson_t *doc;
+   const char *key;
+   char buf[16];
+   uint32_t i;
+
+   /* long enough to be hashed */
+   bson_append_document_begin (&spec, "key", -1, &in);
+   bson_append_array_begin (&in, "$in", -1, &arr);
+   for (i = 0; i < 100; i++) {
+      bson_uint32_to_string (i, &key, buf, sizeof buf);
+      bson_append_int32 (&arr, key, -1, (int32_t) i * 2);
+   }
+
+   bson_append_utf8 (&arr, "100", -1, "foo", -1);
+   bson_append_null (&arr, "101", -1);
+   pair = BCON_NEW ("0", BCON_INT32 (1), "1", BCON_INT32 (2));
+   bson_append_array (&arr, "102", -1, pair);
+   bson_destroy (pair);
+   bson_append_array_end (&in, &arr);
+   bson_append_document_end (&spec, &in);
+
+   matcher = mongoc_matcher_new (&spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   ASSERT (matcher->optree->compare.in_set);
+
+   doc = BCON_NEW ("key", BCON_INT32 (42));
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", BCON_INT32 (43));
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", BCON_INT64 (198));
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", BCON_DOUBLE (4.0));
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", BCON_DOUBLE (-0.0));
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", BCON_DOUBLE (4.5));
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", BCON_UTF8 ("foo"));
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", BCON_UTF8 ("bar"));
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", BCON_UNDEFINED);
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", "[", BCON_INT64 (1), BCON_INT32 (2), "]");
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", "[", BCON_INT32 (2), BCON_INT32 (1), "]");
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", "{", "a", BCON_INT32 (1), "}");
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   mongoc_matcher_destroy (matcher);
+
+   /* $nin with the same values */
+   bson_reinit (&spec);
+   bson_append_document_begin (&spec, "key", -1, &in);
+   bson_append_array_begin (&in, "$nin", -1, &arr);
+   for (i = 0; i < 100; i++) {
+      bson_uint32_to_string (i, &key, buf, sizeof buf);
+      bson_append_int32 (&arr, key, -1, (int32_t) i * 2);
+   }
+
+   bson_append_array_end (&in, &arr);
+   bson_append_document_end (&spec, &in);
+
+   matcher = mongoc_matcher_new (&spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   doc = BCON_NEW ("key", BCON_INT32 (42));
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("key", BCON_INT32 (43));
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   mongoc_matcher_destroy (matcher);
+
+   bson_destroy (&spec);
+}
+
+
+static void
+test_mongoc_matcher_match_batch (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_reader_t *reader;
+   bson_t *spec;
+   bson_t *doc;
+   uint8_t buf[1024];
+   size_t len = 0;
+   uint32_t matches[4];
+   uint32_t n_documents;
+   uint32_t n_matches;
+   bool r;
+   int i;
+
+   /* {a: 0}, {a: 1}, ... {a: 5} */
+   for (i = 0; i < 6; i++) {
+      doc = BCON_NEW ("a", BCON_INT32 (i));
+      memcpy (buf + len, bson_get_data (doc), doc->len);
+      len += doc->len;
+      bson_destroy (doc);
+   }
+
+   spec = BCON_NEW ("a",
+                    "{",
+                    "$in",
+                    "[",
+                    BCON_INT32 (1),
+                    BCON_INT32 (4),
+                    BCON_INT32 (5),
+                    "]",
+                    "}");
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+
+   reader = bson_reader_new_from_data (buf, len);
+   r = mongoc_matcher_match_batch (
+      matcher, reader, 4, &n_documents, matches, &n_matches, &error);
+   ASSERT_OR_PRINT (r, error);
+   ASSERT_CMPUINT32 (n_documents, ==, (uint32_t) 4);
+   ASSERT_CMPUINT32 (n_matches, ==, (uint32_t) 1);
+   ASSERT_CMPUINT32 (matches[0], ==, (uint32_t) 1);
+
+   /* indexes count from the first document of this call */
+   r = mongoc_matcher_match_batch (
+      matcher, reader, 4, &n_documents, matches, &n_matches, &error);
+   ASSERT_OR_PRINT (r, error);
+   ASSERT_CMPUINT32 (n_documents, ==, (uint32_t) 2);
+   ASSERT_CMPUINT32 (n_matches, ==, (uint32_t) 2);
+   ASSERT_CMPUINT32 (matches[0], ==, (uint32_t) 0);
+   ASSERT_CMPUINT32 (matches[1], ==, (uint32_t) 1);
+   bson_reader_destroy (reader);
+
+   /* a truncated last document */
+   reader = bson_reader_new_from_data (buf, len - 1);
+   r = mongoc_matcher_match_batch (
+      matcher, reader, 4, &n_documents, matches, &n_matches, &error);
+   ASSERT_OR_PRINT (r, error);
+   r = mongoc_matcher_match_batch (
+      matcher, reader, 4, &n_documents, matches, &n_matches, &error);
+   ASSERT (!r);
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_BSON,
+                          MONGOC_ERROR_BSON_INVALID,
+                          "Invalid BSON document at index 1");
+   ASSERT_CMPUINT32 (n_documents, ==, (uint32_t) 1);
+   ASSERT_CMPUINT32 (n_matches, ==, (uint32_t) 1);
+   ASSERT_CMPUINT32 (matches[0], ==, (uint32_t) 0);
+   bson_reader_destroy (reader);
+
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+}
+
+
+static void
+test_mongoc_matcher_dotted (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t *spec;
+   bson_t *doc;
+
+   /* $type checks the element at the dotted path */
+   spec = BCON_NEW ("a.b", "{", "$type", BCON_INT32 (BSON_TYPE_UTF8), "}");
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   doc = BCON_NEW ("a", "{", "b", BCON_UTF8 ("x"), "}");
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("a", "{", "b", BCON_INT32 (1), "}");
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+
+   /* a key that is a prefix of another doesn't match it */
+   spec = BCON_NEW ("a.b", "{", "$exists", BCON_BOOL (true), "}");
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   doc = BCON_NEW ("a", "{", "bc", BCON_INT32 (1), "}");
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+
+   /* a dotted path into an array */
+   spec = BCON_NEW ("a.1", BCON_INT32 (2));
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   doc = BCON_NEW ("a", "[", BCON_INT32 (1), BCON_INT32 (2), "]");
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("a", "[", BCON_INT32 (2), BCON_INT32 (1), "]");
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+}
+
+
+static void
+test_mongoc_matcher_compare_mixed (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t *spec;
+   bson_t *doc;
+
+   spec = BCON_NEW ("a", "{", "$gt", BCON_DOUBLE (1.5), "}");
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   doc = BCON_NEW ("a", BCON_INT32 (2));
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("a", BCON_INT64 (1));
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("a", BCON_BOOL (true));
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+
+   spec = BCON_NEW ("a", "{", "$lte", BCON_INT64 (2), "}");
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   doc = BCON_NEW ("a", BCON_DOUBLE (1.9));
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("a", BCON_DOUBLE (2.1));
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("a", BCON_INT32 (2));
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+}
+
+
+static void
+test_mongoc_matcher_reorder (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t *spec;
+   bson_t *doc;
+
+   spec = BCON_NEW (
+      "a.b.c", BCON_INT32 (1), "x", "{", "$exists", BCON_BOOL (true), "}");
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+
+   /* the cheaper $exists is checked first */
+   ASSERT_CMPINT (
+      matcher->optree->base.opcode, ==, MONGOC_MATCHER_OPCODE_AND);
+   ASSERT_CMPINT (matcher->optree->logical.left->base.opcode,
+                  ==,
+                  MONGOC_MATCHER_OPCODE_EXISTS);
+
+   doc = BCON_NEW (
+      "a", "{", "b", "{", "c", BCON_INT32 (1), "}", "}", "x", BCON_NULL);
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("a", "{", "b", "{", "c", BCON_INT32 (1), "}", "}");
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW (
+      "a", "{", "b", "{", "c", BCON_INT32 (2), "}", "}", "x", BCON_NULL);
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+}
+
+
+/* match @str at "key" against @matcher */
+static bool
+_match_utf8 (mongoc_matcher_t *matcher, const char *str)
+{
+   bson_t *doc;
+   bool r;
+
+   doc = BCON_NEW ("key", BCON_UTF8 (str));
+   r = mongoc_matcher_match (matcher, doc);
+   bson_destroy (doc);
+
+   return r;
+}
+
+
+static void
+test_mongoc_matcher_regex (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t *spec;
+   bson_t *doc;
+
+   /* a BSON regular expression */
+   spec = BCON_NEW ("key", BCON_REGEX ("^ab+c$", "i"));
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   ASSERT_CMPINT (
+      matcher->optree->base.opcode, ==, MONGOC_MATCHER_OPCODE_REGEX);
+   ASSERT (_match_utf8 (matcher, "abbbc"));
+   ASSERT (_match_utf8 (matcher, "ABC"));
+   ASSERT (!_match_utf8 (matcher, "ac"));
+   ASSERT (!_match_utf8 (matcher, "xabc"));
+   doc = BCON_NEW ("key", BCON_INT32 (1));
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("other", BCON_UTF8 ("abc"));
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+
+   /* $regex and $options, in either order */
+   spec = BCON_NEW (
+      "key", "{", "$options", "m", "$regex", BCON_UTF8 ("^\\d{3}$"), "}");
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   ASSERT (_match_utf8 (matcher, "x\n123\ny"));
+   ASSERT (!_match_utf8 (matcher, "x1234"));
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+
+   /* $not and a dotted path */
+   spec = BCON_NEW ("a.b", "{", "$not", BCON_REGEX ("foo|bar", ""), "}");
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   doc = BCON_NEW ("a", "{", "b", BCON_UTF8 ("xbarx"), "}");
+   ASSERT (!mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   doc = BCON_NEW ("a", "{", "b", BCON_UTF8 ("baz"), "}");
+   ASSERT (mongoc_matcher_match (matcher, doc));
+   bson_destroy (doc);
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+
+   /* a UTF-8 character is one "." */
+   spec = BCON_NEW ("key", BCON_REGEX ("^caf.$", ""));
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   ASSERT (_match_utf8 (matcher, "caf\xc3\xa9"));
+   ASSERT (!_match_utf8 (matcher, "caf"));
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+
+   /* invalid patterns and options */
+   spec = BCON_NEW ("key", BCON_REGEX ("(abc", ""));
+   ASSERT (!mongoc_matcher_new (spec, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_MATCHER,
+                          MONGOC_ERROR_MATCHER_INVALID,
+                          "Invalid regular expression \"(abc\": missing )");
+   bson_destroy (spec);
+
+   spec = BCON_NEW ("key", BCON_REGEX ("(a)\\1", ""));
+   ASSERT (!mongoc_matcher_new (spec, &error));
+   bson_destroy (spec);
+
+   spec = BCON_NEW ("key", "{", "$regex", "abc", "$options", "q", "}");
+   ASSERT (!mongoc_matcher_new (spec, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_MATCHER,
+                          MONGOC_ERROR_MATCHER_INVALID,
+                          "Invalid regular expression option 'q'");
+   bson_destroy (spec);
+
+   /* an invalid operand after the second fails the whole spec */
+   spec = BCON_NEW ("a",
+                    BCON_INT32 (1),
+                    "b",
+                    BCON_INT32 (2),
+                    "c",
+                    BCON_REGEX ("[abc", ""));
+   ASSERT (!mongoc_matcher_new (spec, &error));
+   bson_destroy (spec);
+}
+
+
+static void
+test_mongoc_matcher_in_regex (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t spec = BSON_INITIALIZER;
+   bson_t in;
+   bson_t arr;
+   const char *key;
+   char buf[16];
+   char pattern[32];
+   uint32_t i;
+
+   /* many regexes on one path are compiled together */
+   bson_append_document_begin (&spec, "key", -1, &in);
+   bson_append_array_begin (&in, "$in", -1, &arr);
+   for (i = 0; i < 100; i++) {
+      bson_uint32_to_string (i, &key, buf, sizeof buf);
+      bson_snprintf (pattern, sizeof pattern, "^user%u@", i);
+      bson_append_regex (&arr, key, -1, pattern, "i");
+   }
+
+   bson_append_utf8 (&arr, "100", -1, "admin", -1);
+   bson_append_array_end (&in, &arr);
+   bson_append_document_end (&spec, &in);
+
+   matcher = mongoc_matcher_new (&spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   ASSERT (matcher->optree->compare.in_regex);
+   ASSERT_CMPUINT32 (
+      _mongoc_matcher_regex_n_patterns (matcher->optree->compare.in_regex),
+      ==,
+      (uint32_t) 100);
+
+   ASSERT (_match_utf8 (matcher, "user42@example.com"));
+   ASSERT (_match_utf8 (matcher, "USER99@example.com"));
+   ASSERT (!_match_utf8 (matcher, "user100@example.com"));
+   ASSERT (!_match_utf8 (matcher, "xuser42@example.com"));
+   /* plain values still match */
+   ASSERT (_match_utf8 (matcher, "admin"));
+   ASSERT (!_match_utf8 (matcher, "admins"));
+   mongoc_matcher_destroy (matcher);
+
+   /* $nin with the same values */
+   bson_reinit (&spec);
+   bson_append_document_begin (&spec, "key", -1, &in);
+   bson_append_array_begin (&in, "$nin", -1, &arr);
+   for (i = 0; i < 100; i++) {
+      bson_uint32_to_string (i, &key, buf, sizeof buf);
+      bson_snprintf (pattern, sizeof pattern, "^user%u@", i);
+      bson_append_regex (&arr, key, -1, pattern, "");
+   }
+
+   bson_append_array_end (&in, &arr);
+   bson_append_document_end (&spec, &in);
+
+   matcher = mongoc_matcher_new (&spec, &error);
+   ASSERT_OR_PRINT (matcher, error);
+   ASSERT (!_match_utf8 (matcher, "user42@example.com"));
+   ASSERT (_match_utf8 (matcher, "user100@example.com"));
+   mongoc_matcher_destroy (matcher);
+
+   /* an invalid regex in the list */
+   bson_reinit (&spec);
+   bson_append_document_begin (&spec, "key", -1, &in);
+   bson_append_array_begin (&in, "$in", -1, &arr);
+   bson_append_regex (&arr, "0", -1, "abc", "");
+   bson_append_regex (&arr, "1", -1, "a**", "");
+   bson_append_array_end (&in, &arr);
+   bson_append_document_end (&spec, &in);
+   ASSERT (!mongoc_matcher_new (&spec, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_MATCHER,
+                          MONGOC_ERROR_MATCHER_INVALID,
+                          "nothing to repeat");
+
+   bson_destroy (&spec);
+}
+
 END_IGNORE_DEPRECATIONS;
 
 void
@@ -563,4 +1048,12 @@ test_matcher_install (TestSuite *suite)
    TestSuite_Add (suite, "/Matcher/eq/int64", test_mongoc_matcher_eq_int64);
    TestSuite_Add (suite, "/Matcher/eq/doc", test_mongoc_matcher_eq_doc);
    TestSuite_Add (suite, "/Matcher/in/basic", test_mongoc_matcher_in_basic);
+   TestSuite_Add (suite, "/Matcher/in/long", test_mongoc_matcher_in_long);
+   TestSuite_Add (suite, "/Matcher/dotted", test_mongoc_matcher_dotted);
+   TestSuite_Add (suite, "/Matcher/batch", test_mongoc_matcher_match_batch);
+   TestSuite_Add (
+      suite, "/Matcher/compare/mixed", test_mongoc_matcher_compare_mixed);
+   TestSuite_Add (suite, "/Matcher/reorder", test_mongoc_matcher_reorder);
+   TestSuite_Add (suite, "/Matcher/regex", test_mongoc_matcher_regex);
+   TestSuite_Add (suite, "/Matcher/in/regex", test_mongoc_matcher_in_regex);
 }
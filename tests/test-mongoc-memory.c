@@ -0,0 +1,133 @@
+#include <mongoc.h>
+
+#include "mongoc-buffer-private.h"
+#include "mongoc-memory-private.h"
+#include "test-libmongoc.h"
+#include "TestSuite.h"
+
+
+static void
+test_memory_stats (void)
+{
+   mongoc_memory_tag_t tag = MONGOC_MEMORY_TAG_COMPRESSION;
+   mongoc_memory_stats_t before;
+   mongoc_memory_stats_t stats;
+   uint8_t *mem;
+
+   ASSERT_CMPSTR (mongoc_memory_tag_name (MONGOC_MEMORY_TAG_CURSOR), "cursor");
+   ASSERT_CMPSTR (mongoc_memory_tag_name (MONGOC_MEMORY_TAG_TLS), "tls");
+   BSON_ASSERT (!mongoc_memory_tag_name (MONGOC_MEMORY_TAG_LAST));
+   BSON_ASSERT (!mongoc_memory_get_stats (MONGOC_MEMORY_TAG_LAST, &stats));
+
+   BSON_ASSERT (mongoc_memory_get_stats (tag, &before));
+
+   mem = (uint8_t *) _mongoc_malloc0_tagged (tag, 10);
+   BSON_ASSERT (mem[9] == 0);
+   BSON_ASSERT (mongoc_memory_get_stats (tag, &stats));
+   ASSERT_CMPINT64 (stats.bytes, ==, before.bytes + 10);
+   ASSERT_CMPINT64 (stats.allocations, ==, before.allocations + 1);
+   ASSERT_CMPINT64 (stats.total_allocations, ==, before.total_allocations + 1);
+
+   /* realloc moves the bytes, not the allocations */
+   mem = (uint8_t *) _mongoc_realloc_tagged (tag, mem, 100);
+   mem[99] = 1;
+   BSON_ASSERT (mongoc_memory_get_stats (tag, &stats));
+   ASSERT_CMPINT64 (stats.bytes, ==, before.bytes + 100);
+   ASSERT_CMPINT64 (stats.allocations, ==, before.allocations + 1);
+
+   _mongoc_free_tagged (tag, mem);
+   BSON_ASSERT (mongoc_memory_get_stats (tag, &stats));
+   ASSERT_CMPINT64 (stats.bytes, ==, before.bytes);
+   ASSERT_CMPINT64 (stats.allocations, ==, before.allocations);
+   ASSERT_CMPINT64 (stats.total_allocations, ==, before.total_allocations + 1);
+}
+
+
+static int gMallocCount;
+static int gFreeCount;
+
+
+static void *
+counting_malloc (size_t num_bytes)
+{
+   gMallocCount++;
+   return malloc (num_bytes);
+}
+
+
+static void *
+counting_calloc (size_t n_members, size_t num_bytes)
+{
+   gMallocCount++;
+   return calloc (n_members, num_bytes);
+}
+
+
+static void *
+counting_realloc (void *mem, size_t num_bytes)
+{
+   return realloc (mem, num_bytes);
+}
+
+
+static void
+counting_free (void *mem)
+{
+   gFreeCount++;
+   free (mem);
+}
+
+
+static void
+test_memory_vtable (void)
+{
+   bson_mem_vtable_t vtable = {
+      counting_malloc, counting_calloc, counting_realloc, counting_free};
+   bson_mem_vtable_t incomplete = {counting_malloc};
+   mongoc_buffer_t buffer;
+   void *mem;
+
+   gMallocCount = gFreeCount = 0;
+
+   capture_logs (true);
+   BSON_ASSERT (
+      !mongoc_memory_set_vtable (MONGOC_MEMORY_TAG_LAST, &vtable));
+   BSON_ASSERT (
+      !mongoc_memory_set_vtable (MONGOC_MEMORY_TAG_BULK, &incomplete));
+   ASSERT_CAPTURED_LOG (
+      "mongoc_memory_set_vtable", MONGOC_LOG_LEVEL_ERROR, "missing");
+
+   ASSERT (mongoc_memory_set_vtable (MONGOC_MEMORY_TAG_BULK, &vtable));
+
+   mem = _mongoc_malloc_tagged (MONGOC_MEMORY_TAG_BULK, 8);
+   ASSERT_CMPINT (gMallocCount, ==, 1);
+
+   /* not while memory from the current allocator is outstanding */
+   BSON_ASSERT (!mongoc_memory_set_vtable (MONGOC_MEMORY_TAG_BULK, NULL));
+   ASSERT_CAPTURED_LOG ("mongoc_memory_set_vtable",
+                        MONGOC_LOG_LEVEL_ERROR,
+                        "with memory allocated");
+
+   _mongoc_free_tagged (MONGOC_MEMORY_TAG_BULK, mem);
+   ASSERT_CMPINT (gFreeCount, ==, 1);
+
+   /* a tagged buffer grows with the tag's allocator */
+   _mongoc_buffer_init_tagged (&buffer, MONGOC_MEMORY_TAG_BULK);
+   ASSERT_CMPINT (gMallocCount, ==, 2);
+   _mongoc_buffer_destroy (&buffer);
+   ASSERT_CMPINT (gFreeCount, ==, 2);
+
+   ASSERT (mongoc_memory_set_vtable (MONGOC_MEMORY_TAG_BULK, NULL));
+   mem = _mongoc_malloc_tagged (MONGOC_MEMORY_TAG_BULK, 8);
+   _mongoc_free_tagged (MONGOC_MEMORY_TAG_BULK, mem);
+   ASSERT_CMPINT (gMallocCount, ==, 2);
+   ASSERT_CMPINT (gFreeCount, ==, 2);
+}
+
+
+void
+test_memory_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/Memory/stats", test_memory_stats);
+   TestSuite_Add (suite, "/Memory/vtable", test_memory_vtable);
+}
@@ -0,0 +1,606 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * End-to-end throughput benchmarks: many threads share a client pool and run
+ * finds, inserts, bulk inserts, or getMores against a mock server that answers
+ * from canned replies, so the numbers measure the driver's own overhead on
+ * the full path from the public API to the socket and back.
+ *
+ * The benchmarks are skipped unless MONGOC_TEST_BENCH=on. Each workload runs
+ * for MONGOC_TEST_BENCH_SECONDS (default 1) at 1, 2, 4, ... threads, up to
+ * MONGOC_TEST_BENCH_MAX_THREADS (default 128). One JSON line per run is
+ * appended to the file named by MONGOC_TEST_BENCH_RESULTS, or written to
+ * stderr.
+ */
+
+#include <errno.h>
+#include <mongoc.h>
+
+#include "mongoc-client-private.h"
+#include "mongoc-counters-private.h"
+#include "mongoc-thread-private.h"
+
+#include "TestSuite.h"
+#include "test-libmongoc.h"
+#include "mock_server/mock-server.h"
+
+
+#define BENCH_DB "bench"
+#define BENCH_BATCH_SIZE 10
+#define BENCH_BULK_SIZE 100
+#define BENCH_CURSOR_ID 1234
+#define BENCH_GETMORES_PER_CURSOR 100
+#define BENCH_WARMUP_USEC (200 * 1000)
+
+
+typedef enum {
+   BENCH_FIND,
+   BENCH_INSERT,
+   BENCH_BULK,
+   BENCH_GETMORE,
+} bench_op_t;
+
+
+/* the workload's name is also the collection it uses */
+typedef struct {
+   const char *name;
+   bench_op_t op;
+} bench_workload_t;
+
+
+static bench_workload_t gBenchWorkloads[] = {
+   {"find", BENCH_FIND},
+   {"insert", BENCH_INSERT},
+   {"bulk", BENCH_BULK},
+   {"getmore", BENCH_GETMORE},
+};
+
+
+typedef struct {
+   bson_t find;    /* a whole result set in the first batch */
+   bson_t cursor;  /* an open cursor with an empty first batch */
+   bson_t getmore; /* a full batch, the cursor stays open */
+   bson_t insert;
+   bson_t bulk;
+   bson_t ok;
+} bench_replies_t;
+
+
+typedef struct {
+   mongoc_client_pool_t *pool;
+   const bench_workload_t *workload;
+   const bson_t *doc;
+   int64_t start;
+   int64_t deadline;
+   int64_t ops;
+   int64_t max_usec;
+   int64_t histogram[MONGOC_HISTOGRAM_BUCKETS];
+   bool failed;
+   bson_error_t error;
+} bench_thread_t;
+
+
+static int
+skip_if_no_bench (void)
+{
+   return test_framework_getenv_bool ("MONGOC_TEST_BENCH") &&
+          TestSuite_CheckMockServerAllowed ();
+}
+
+
+static void
+bench_append_batch (bson_t *reply,
+                    int64_t cursor_id,
+                    const char *ns,
+                    const char *batch_name,
+                    int n_docs)
+{
+   bson_t cursor;
+   bson_t batch;
+   bson_t doc;
+   char buf[16];
+   const char *key;
+   int i;
+
+   BSON_APPEND_DOCUMENT_BEGIN (reply, "cursor", &cursor);
+   BSON_APPEND_INT64 (&cursor, "id", cursor_id);
+   BSON_APPEND_UTF8 (&cursor, "ns", ns);
+   BSON_APPEND_ARRAY_BEGIN (&cursor, batch_name, &batch);
+
+   for (i = 0; i < n_docs; i++) {
+      bson_uint32_to_string ((uint32_t) i, &key, buf, sizeof buf);
+      BSON_APPEND_DOCUMENT_BEGIN (&batch, key, &doc);
+      BSON_APPEND_INT32 (&doc, "_id", i);
+      BSON_APPEND_UTF8 (&doc, "name", "benchmark document");
+      BSON_APPEND_DOUBLE (&doc, "value", i * 1.5);
+      bson_append_document_end (&batch, &doc);
+   }
+
+   bson_append_array_end (&cursor, &batch);
+   bson_append_document_end (reply, &cursor);
+   BSON_APPEND_DOUBLE (reply, "ok", 1.0);
+}
+
+
+static void
+bench_replies_init (bench_replies_t *replies)
+{
+   bson_init (&replies->find);
+   bench_append_batch (
+      &replies->find, 0, BENCH_DB ".find", "firstBatch", BENCH_BATCH_SIZE);
+
+   bson_init (&replies->cursor);
+   bench_append_batch (
+      &replies->cursor, BENCH_CURSOR_ID, BENCH_DB ".getmore", "firstBatch", 0);
+
+   bson_init (&replies->getmore);
+   bench_append_batch (&replies->getmore,
+                       BENCH_CURSOR_ID,
+                       BENCH_DB ".getmore",
+                       "nextBatch",
+                       BENCH_BATCH_SIZE);
+
+   bson_init (&replies->insert);
+   BSON_APPEND_INT32 (&replies->insert, "n", 1);
+   BSON_APPEND_DOUBLE (&replies->insert, "ok", 1.0);
+
+   bson_init (&replies->bulk);
+   BSON_APPEND_INT32 (&replies->bulk, "n", BENCH_BULK_SIZE);
+   BSON_APPEND_DOUBLE (&replies->bulk, "ok", 1.0);
+
+   bson_init (&replies->ok);
+   BSON_APPEND_DOUBLE (&replies->ok, "ok", 1.0);
+}
+
+
+static void
+bench_replies_destroy (bench_replies_t *replies)
+{
+   bson_destroy (&replies->find);
+   bson_destroy (&replies->cursor);
+   bson_destroy (&replies->getmore);
+   bson_destroy (&replies->insert);
+   bson_destroy (&replies->bulk);
+   bson_destroy (&replies->ok);
+}
+
+
+/* answer each command with a prebuilt reply, leave ismaster to the
+ * auto-ismaster responder */
+static bool
+bench_responder (request_t *request, void *data)
+{
+   bench_replies_t *replies = (bench_replies_t *) data;
+   const char *cmd = request->command_name;
+   const bson_t *reply;
+   bson_iter_t iter;
+
+   if (!request->is_command || !cmd) {
+      return false;
+   }
+
+   if (!strcmp (cmd, "find")) {
+      if (bson_iter_init_find (&iter, request_get_doc (request, 0), "find") &&
+          BSON_ITER_HOLDS_UTF8 (&iter) &&
+          !strcmp (bson_iter_utf8 (&iter, NULL), "getmore")) {
+         reply = &replies->cursor;
+      } else {
+         reply = &replies->find;
+      }
+   } else if (!strcmp (cmd, "getMore")) {
+      reply = &replies->getmore;
+   } else if (!strcmp (cmd, "insert")) {
+      if (bson_iter_init_find (&iter, request_get_doc (request, 0), "insert") &&
+          BSON_ITER_HOLDS_UTF8 (&iter) &&
+          !strcmp (bson_iter_utf8 (&iter, NULL), "bulk")) {
+         reply = &replies->bulk;
+      } else {
+         reply = &replies->insert;
+      }
+   } else if (!strcmp (cmd, "killCursors")) {
+      reply = &replies->ok;
+   } else {
+      return false;
+   }
+
+   mock_server_reply_multi (request, MONGOC_REPLY_NONE, reply, 1, 0);
+   request_destroy (request);
+
+   return true;
+}
+
+
+static void
+bench_record (bench_thread_t *bt, int64_t started)
+{
+   int64_t now;
+   int64_t usec;
+
+   now = bson_get_monotonic_time ();
+
+   /* operations begun during the warmup open connections, don't count them */
+   if (started < bt->start) {
+      return;
+   }
+
+   usec = now - started;
+   bt->ops++;
+   bt->histogram[_mongoc_histogram_bucket (usec)]++;
+   bt->max_usec = BSON_MAX (bt->max_usec, usec);
+}
+
+
+static bool
+bench_find (bench_thread_t *bt, mongoc_collection_t *collection)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_t filter = BSON_INITIALIZER;
+   int n = 0;
+   bool r;
+
+   cursor = mongoc_collection_find_with_opts (collection, &filter, NULL, NULL);
+   while (mongoc_cursor_next (cursor, &doc)) {
+      n++;
+   }
+
+   r = !mongoc_cursor_error (cursor, &bt->error);
+   if (r && n != BENCH_BATCH_SIZE) {
+      bson_set_error (&bt->error,
+                      MONGOC_ERROR_CURSOR,
+                      MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                      "expected %d documents, got %d",
+                      BENCH_BATCH_SIZE,
+                      n);
+      r = false;
+   }
+
+   mongoc_cursor_destroy (cursor);
+
+   return r;
+}
+
+
+static bool
+bench_bulk (bench_thread_t *bt, mongoc_collection_t *collection)
+{
+   mongoc_bulk_operation_t *bulk;
+   uint32_t r;
+   int i;
+
+   bulk = mongoc_collection_create_bulk_operation (collection, true, NULL);
+   for (i = 0; i < BENCH_BULK_SIZE; i++) {
+      mongoc_bulk_operation_insert (bulk, bt->doc);
+   }
+
+   r = mongoc_bulk_operation_execute (bulk, NULL, &bt->error);
+   mongoc_bulk_operation_destroy (bulk);
+
+   return r != 0;
+}
+
+
+/* each getMore returns BENCH_BATCH_SIZE documents, so timing that many calls
+ * to mongoc_cursor_next times one getMore round trip */
+static bool
+bench_getmores (bench_thread_t *bt, mongoc_collection_t *collection)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_t filter = BSON_INITIALIZER;
+   int64_t started;
+   bool r = true;
+   int i;
+   int j;
+
+   cursor = mongoc_collection_find_with_opts (collection, &filter, NULL, NULL);
+
+   for (i = 0; i < BENCH_GETMORES_PER_CURSOR; i++) {
+      started = bson_get_monotonic_time ();
+      if (started >= bt->deadline) {
+         break;
+      }
+
+      for (j = 0; j < BENCH_BATCH_SIZE; j++) {
+         if (!mongoc_cursor_next (cursor, &doc)) {
+            if (!mongoc_cursor_error (cursor, &bt->error)) {
+               bson_set_error (&bt->error,
+                               MONGOC_ERROR_CURSOR,
+                               MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                               "cursor ended early");
+            }
+
+            r = false;
+            goto done;
+         }
+      }
+
+      bench_record (bt, started);
+   }
+
+done:
+   /* sends killCursors */
+   mongoc_cursor_destroy (cursor);
+
+   return r;
+}
+
+
+static void *
+bench_thread (void *data)
+{
+   bench_thread_t *bt = (bench_thread_t *) data;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   int64_t started;
+   bool r;
+
+   while (!bt->failed) {
+      started = bson_get_monotonic_time ();
+      if (started >= bt->deadline) {
+         break;
+      }
+
+      client = mongoc_client_pool_pop (bt->pool);
+      collection =
+         mongoc_client_get_collection (client, BENCH_DB, bt->workload->name);
+
+      switch (bt->workload->op) {
+      case BENCH_FIND:
+         r = bench_find (bt, collection);
+         break;
+      case BENCH_INSERT:
+         r = mongoc_collection_insert (
+            collection, MONGOC_INSERT_NONE, bt->doc, NULL, &bt->error);
+         break;
+      case BENCH_BULK:
+         r = bench_bulk (bt, collection);
+         break;
+      case BENCH_GETMORE:
+         /* records its own timings, one per getMore */
+         r = bench_getmores (bt, collection);
+         break;
+      default:
+         BSON_ASSERT (false);
+         return NULL;
+      }
+
+      mongoc_collection_destroy (collection);
+      mongoc_client_pool_push (bt->pool, client);
+
+      if (!r) {
+         bt->failed = true;
+      } else if (bt->workload->op != BENCH_GETMORE) {
+         bench_record (bt, started);
+      }
+   }
+
+   return NULL;
+}
+
+
+/* the highest value that lands in @bucket, see _mongoc_histogram_bucket */
+static int64_t
+bench_bucket_max (uint32_t bucket)
+{
+   uint32_t msb;
+
+   if (bucket < MONGOC_HISTOGRAM_SUB_BUCKETS) {
+      return (int64_t) bucket;
+   }
+
+   msb = bucket / MONGOC_HISTOGRAM_SUB_BUCKETS + 1;
+
+   return (((int64_t) (MONGOC_HISTOGRAM_SUB_BUCKETS +
+                       bucket % MONGOC_HISTOGRAM_SUB_BUCKETS) +
+            1)
+           << (msb - 2)) -
+          1;
+}
+
+
+static int64_t
+bench_percentile (const int64_t *histogram, int64_t count, double percentile)
+{
+   int64_t threshold;
+   int64_t seen = 0;
+   uint32_t i;
+
+   threshold = (int64_t) ((double) count * percentile / 100.0);
+   threshold = BSON_MAX (threshold, 1);
+
+   for (i = 0; i < MONGOC_HISTOGRAM_BUCKETS; i++) {
+      seen += histogram[i];
+      if (seen >= threshold) {
+         return bench_bucket_max (i);
+      }
+   }
+
+   return bench_bucket_max (MONGOC_HISTOGRAM_BUCKETS - 1);
+}
+
+
+static void
+bench_report (const bench_workload_t *workload,
+              int n_threads,
+              double seconds,
+              int64_t ops,
+              const int64_t *histogram,
+              int64_t max_usec)
+{
+   char *results_path;
+   FILE *out;
+   bson_t result;
+   bson_t latency;
+   char *json;
+
+   bson_init (&result);
+   BSON_APPEND_UTF8 (&result, "name", workload->name);
+   BSON_APPEND_INT32 (&result, "threads", n_threads);
+   BSON_APPEND_DOUBLE (&result, "seconds", seconds);
+   BSON_APPEND_INT64 (&result, "ops", ops);
+   BSON_APPEND_DOUBLE (&result, "opsPerSec", (double) ops / seconds);
+   BSON_APPEND_DOCUMENT_BEGIN (&result, "latencyMicros", &latency);
+   BSON_APPEND_INT64 (&latency, "p50", bench_percentile (histogram, ops, 50));
+   BSON_APPEND_INT64 (&latency, "p90", bench_percentile (histogram, ops, 90));
+   BSON_APPEND_INT64 (&latency, "p99", bench_percentile (histogram, ops, 99));
+   BSON_APPEND_INT64 (
+      &latency, "p99.9", bench_percentile (histogram, ops, 99.9));
+   BSON_APPEND_INT64 (&latency, "max", max_usec);
+   bson_append_document_end (&result, &latency);
+
+   json = bson_as_json (&result, NULL);
+
+   /* stdout may carry the test suite's own JSON output */
+   results_path = test_framework_getenv ("MONGOC_TEST_BENCH_RESULTS");
+   out = results_path ? fopen (results_path, "a") : stderr;
+   ASSERT_OR_PRINT_ERRNO (out, errno);
+   fprintf (out, "%s\n", json);
+
+   if (results_path) {
+      fclose (out);
+   } else {
+      fflush (out);
+   }
+
+   bson_free (results_path);
+   bson_free (json);
+   bson_destroy (&result);
+}
+
+
+static void
+bench_run (mongoc_client_pool_t *pool,
+           const bench_workload_t *workload,
+           const bson_t *doc,
+           int n_threads,
+           int64_t duration_usec)
+{
+   bench_thread_t *bts;
+   mongoc_thread_t *threads;
+   int64_t histogram[MONGOC_HISTOGRAM_BUCKETS] = {0};
+   int64_t ops = 0;
+   int64_t max_usec = 0;
+   int64_t start;
+   int i;
+   uint32_t j;
+
+   bts = bson_malloc0 (n_threads * sizeof (bench_thread_t));
+   threads = bson_malloc0 (n_threads * sizeof (mongoc_thread_t));
+
+   start = bson_get_monotonic_time () + BENCH_WARMUP_USEC;
+
+   for (i = 0; i < n_threads; i++) {
+      bts[i].pool = pool;
+      bts[i].workload = workload;
+      bts[i].doc = doc;
+      bts[i].start = start;
+      bts[i].deadline = start + duration_usec;
+      ASSERT_CMPINT (
+         0, ==, mongoc_thread_create (&threads[i], bench_thread, &bts[i]));
+   }
+
+   for (i = 0; i < n_threads; i++) {
+      mongoc_thread_join (threads[i]);
+   }
+
+   for (i = 0; i < n_threads; i++) {
+      ASSERT_OR_PRINT (!bts[i].failed, bts[i].error);
+
+      ops += bts[i].ops;
+      max_usec = BSON_MAX (max_usec, bts[i].max_usec);
+      for (j = 0; j < MONGOC_HISTOGRAM_BUCKETS; j++) {
+         histogram[j] += bts[i].histogram[j];
+      }
+   }
+
+   bench_report (workload,
+                 n_threads,
+                 (double) duration_usec / 1e6,
+                 ops,
+                 histogram,
+                 max_usec);
+
+   bson_free (threads);
+   bson_free (bts);
+}
+
+
+static void
+test_mock_bench (void *ctx)
+{
+   const bench_workload_t *workload = (const bench_workload_t *) ctx;
+   bench_replies_t replies;
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   bson_t *doc;
+   int64_t duration_usec;
+   int64_t max_threads;
+   int n_threads;
+
+   duration_usec =
+      test_framework_getenv_int64 ("MONGOC_TEST_BENCH_SECONDS", 1) * 1000 * 1000;
+   max_threads =
+      test_framework_getenv_int64 ("MONGOC_TEST_BENCH_MAX_THREADS", 128);
+
+   bench_replies_init (&replies);
+   doc = BCON_NEW ("name", "benchmark document", "value", BCON_DOUBLE (1.5));
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_autoresponds (server, bench_responder, &replies, NULL);
+   mock_server_run (server);
+
+   /* one connection per thread */
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (
+      uri, MONGOC_URI_MAXPOOLSIZE, (int32_t) BSON_MAX (max_threads, 1));
+   pool = mongoc_client_pool_new (uri);
+
+   /* the benchmark would measure log formatting, not the driver */
+   capture_logs (true);
+
+   for (n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+      bench_run (pool, workload, doc, n_threads, duration_usec);
+   }
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+   bson_destroy (doc);
+   bench_replies_destroy (&replies);
+}
+
+
+void
+test_mock_bench_install (TestSuite *suite)
+{
+   char *name;
+   size_t i;
+
+   for (i = 0; i < sizeof gBenchWorkloads / sizeof gBenchWorkloads[0]; i++) {
+      name = bson_strdup_printf ("/Bench/mock_server/%s",
+                                 gBenchWorkloads[i].name);
+      TestSuite_AddFull (suite,
+                         name,
+                         test_mock_bench,
+                         NULL,
+                         &gBenchWorkloads[i],
+                         skip_if_no_bench);
+      bson_free (name);
+   }
+}
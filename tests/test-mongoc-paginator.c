@@ -0,0 +1,222 @@
+#include <mongoc.h>
+
+#include "mongoc-client-private.h"
+#include "TestSuite.h"
+#include "mock_server/mock-server.h"
+#include "test-conveniences.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "paginator-test"
+
+
+/* replies to each "find" with the next of @batches, and keeps the find
+ * commands to check */
+typedef struct {
+   const char **batches;
+   int n_finds;
+   bson_t finds[4];
+} pages_t;
+
+
+static bool
+_find_responder (request_t *request, void *data)
+{
+   pages_t *pages = (pages_t *) data;
+   char *reply;
+
+   if (strcmp (request->command_name, "find")) {
+      return false;
+   }
+
+   ASSERT_CMPINT (pages->n_finds, <, 4);
+   bson_copy_to (request_get_doc (request, 0), &pages->finds[pages->n_finds]);
+
+   reply = bson_strdup_printf ("{'ok': 1, 'cursor': {'id': 0, 'ns': 'db.c',"
+                               " 'firstBatch': [%s]}}",
+                               pages->batches[pages->n_finds]);
+   pages->n_finds++;
+   mock_server_replies_simple (request, reply);
+   bson_free (reply);
+   request_destroy (request);
+
+   return true;
+}
+
+
+static int
+_read_page (mongoc_paginator_t *paginator)
+{
+   const bson_t *doc;
+   bson_error_t error;
+   int n = 0;
+
+   while (mongoc_paginator_next (paginator, &doc)) {
+      n++;
+   }
+
+   ASSERT_OR_PRINT (!mongoc_paginator_error (paginator, &error), error);
+
+   return n;
+}
+
+
+static void
+_pages_destroy (pages_t *pages)
+{
+   int i;
+
+   for (i = 0; i < pages->n_finds; i++) {
+      bson_destroy (&pages->finds[i]);
+   }
+}
+
+
+/* each page after the first is a range query after the last document */
+static void
+test_paginator_pages (void)
+{
+   const char *batches[] = {"{'_id': 1, 'a': 9}, {'_id': 2, 'a': 8}",
+                            "{'_id': 3, 'a': 8}"};
+   pages_t pages = {batches, 0};
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_paginator_t *paginator;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_autoresponds (server, _find_responder, &pages, NULL);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "c");
+
+   paginator = mongoc_paginator_new (collection,
+                                     tmp_bson ("{'x': 1}"),
+                                     tmp_bson ("{'a': -1}"),
+                                     tmp_bson ("{'skip': 5, 'maxTimeMS': 10}"),
+                                     2);
+
+   ASSERT_CMPINT (_read_page (paginator), ==, 2);
+   ASSERT (mongoc_paginator_more (paginator));
+   ASSERT_MATCH (mongoc_paginator_get_position (paginator),
+                 "{'a': 8, '_id': 2}");
+   ASSERT_MATCH (&pages.finds[0],
+                 "{'find': 'c', 'filter': {'x': 1},"
+                 " 'sort': {'a': -1, '_id': 1}, 'limit': 2, 'batchSize': 2,"
+                 " 'skip': {'$exists': false}, 'maxTimeMS': 10}");
+
+   /* after a=8 in descending order, or at a=8 after _id 2 */
+   ASSERT_CMPINT (_read_page (paginator), ==, 1);
+   ASSERT (!mongoc_paginator_more (paginator));
+   ASSERT_MATCH (&pages.finds[1],
+                 "{'filter': {'$and': [{'x': 1},"
+                 "                     {'$or': [{'a': {'$lt': 8}},"
+                 "                              {'a': 8, '_id': {'$gt': 2}}]}"
+                 "]}}");
+
+   /* the short page was the last */
+   ASSERT_CMPINT (_read_page (paginator), ==, 0);
+   ASSERT_CMPINT (pages.n_finds, ==, 2);
+
+   mongoc_paginator_destroy (paginator);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+   _pages_destroy (&pages);
+}
+
+
+/* a position from an earlier paginator resumes after it */
+static void
+test_paginator_position (void)
+{
+   const char *batches[] = {"{'_id': 6}"};
+   pages_t pages = {batches, 0};
+   mock_server_t *server;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_paginator_t *paginator;
+   bson_error_t error;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_FIND_CMD);
+   mock_server_autoresponds (server, _find_responder, &pages, NULL);
+   mock_server_run (server);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (server));
+   collection = mongoc_client_get_collection (client, "db", "c");
+
+   paginator = mongoc_paginator_new (collection, NULL, NULL, NULL, 10);
+
+   ASSERT (!mongoc_paginator_set_position (
+      paginator, tmp_bson ("{'a': 1, '_id': 5}"), &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          "must have the sort keys");
+
+   ASSERT_OR_PRINT (mongoc_paginator_set_position (
+                       paginator, tmp_bson ("{'_id': 5}"), &error),
+                    error);
+   ASSERT_CMPINT (_read_page (paginator), ==, 1);
+   ASSERT (!mongoc_paginator_more (paginator));
+   ASSERT_MATCH (&pages.finds[0],
+                 "{'filter': {'_id': {'$gt': 5}}, 'sort': {'_id': 1}}");
+   ASSERT_MATCH (mongoc_paginator_get_position (paginator), "{'_id': 6}");
+
+   mongoc_paginator_destroy (paginator);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_destroy (server);
+   _pages_destroy (&pages);
+}
+
+
+static void
+_assert_invalid (mongoc_paginator_t *paginator, const char *msg)
+{
+   const bson_t *doc;
+   bson_error_t error;
+
+   ASSERT (!mongoc_paginator_next (paginator, &doc));
+   ASSERT (!doc);
+   ASSERT (!mongoc_paginator_more (paginator));
+   ASSERT (mongoc_paginator_error (paginator, &error));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_COMMAND,
+                          MONGOC_ERROR_COMMAND_INVALID_ARG,
+                          msg);
+   mongoc_paginator_destroy (paginator);
+}
+
+
+static void
+test_paginator_invalid (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+
+   client = mongoc_client_new ("mongodb://localhost");
+   collection = mongoc_client_get_collection (client, "db", "c");
+
+   _assert_invalid (
+      mongoc_paginator_new (collection, NULL, tmp_bson ("{'a': 'x'}"), NULL, 1),
+      "must be 1 or -1");
+   _assert_invalid (
+      mongoc_paginator_new (
+         collection, NULL, tmp_bson ("{'_id': 1, 'a': 1}"), NULL, 1),
+      "must be the paginator's last sort key");
+   _assert_invalid (mongoc_paginator_new (collection, NULL, NULL, NULL, 0),
+                    "page size must be positive");
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+void
+test_paginator_install (TestSuite *suite)
+{
+   TestSuite_AddMockServerTest (
+      suite, "/Paginator/pages", test_paginator_pages);
+   TestSuite_AddMockServerTest (
+      suite, "/Paginator/position", test_paginator_position);
+   TestSuite_Add (suite, "/Paginator/invalid", test_paginator_invalid);
+}
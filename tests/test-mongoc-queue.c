@@ -23,6 +23,8 @@ test_mongoc_queue_basic (void)
    ASSERT (_mongoc_queue_pop_head (&q) == (void *) 2);
    ASSERT (_mongoc_queue_pop_head (&q) == (void *) 4);
    ASSERT (!_mongoc_queue_pop_head (&q));
+
+   _mongoc_queue_destroy (&q);
 }
 
 
@@ -46,6 +48,52 @@ test_mongoc_queue_pop_tail (void)
    ASSERT_CMPVOID (_mongoc_queue_pop_tail (&q), ==, (void *) 3);
    ASSERT_CMPUINT32 (_mongoc_queue_get_length (&q), ==, (uint32_t) 0);
    ASSERT_CMPVOID (_mongoc_queue_pop_tail (&q), ==, (void *) NULL);
+
+   _mongoc_queue_destroy (&q);
+}
+
+
+/* the ring buffer keeps order as it wraps around and grows */
+static void
+test_mongoc_queue_grow (void)
+{
+   mongoc_queue_t q;
+   uintptr_t i;
+
+   _mongoc_queue_init (&q);
+
+   /* move the head into the middle of the buffer, so the items wrap */
+   for (i = 1; i <= 5; i++) {
+      _mongoc_queue_push_tail (&q, (void *) i);
+   }
+
+   for (i = 1; i <= 5; i++) {
+      ASSERT_CMPVOID (_mongoc_queue_pop_head (&q), ==, (void *) i);
+   }
+
+   /* LIFO at the head, as the client pool uses it, past several growths */
+   for (i = 1; i <= 100; i++) {
+      _mongoc_queue_push_head (&q, (void *) i);
+   }
+
+   ASSERT_CMPUINT32 (_mongoc_queue_get_length (&q), ==, (uint32_t) 100);
+
+   for (i = 0; i < 100; i++) {
+      ASSERT_CMPVOID (
+         _mongoc_queue_get (&q, (uint32_t) i), ==, (void *) (100 - i));
+   }
+
+   ASSERT_CMPVOID (_mongoc_queue_pop_tail (&q), ==, (void *) 1);
+   ASSERT_CMPVOID (_mongoc_queue_pop_head (&q), ==, (void *) 100);
+
+   for (i = 99; i >= 2; i--) {
+      ASSERT_CMPVOID (_mongoc_queue_pop_head (&q), ==, (void *) i);
+   }
+
+   ASSERT_CMPUINT32 (_mongoc_queue_get_length (&q), ==, (uint32_t) 0);
+   ASSERT_CMPVOID (_mongoc_queue_pop_head (&q), ==, (void *) NULL);
+
+   _mongoc_queue_destroy (&q);
 }
 
 
@@ -54,4 +102,5 @@ test_queue_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Queue/basic", test_mongoc_queue_basic);
    TestSuite_Add (suite, "/Queue/pop_tail", test_mongoc_queue_pop_tail);
+   TestSuite_Add (suite, "/Queue/grow", test_mongoc_queue_grow);
 }
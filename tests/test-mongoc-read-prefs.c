@@ -1,5 +1,7 @@
 #include <mongoc.h>
 #include <mongoc-uri-private.h>
+#include <mongoc-read-prefs-private.h>
+#include <mongoc-server-description-private.h>
 
 #include "TestSuite.h"
 #include "mock_server/future.h"
@@ -675,9 +677,144 @@ test_read_prefs_mongos_tags (void)
 }
 
 
+/* tag sets are compiled into sorted pairs, order within a tag set and
+ * changes to the read prefs must not affect which servers match */
+static void
+test_read_prefs_compiled_tags (void)
+{
+   mongoc_server_description_t sds[3];
+   mongoc_server_description_t *candidates[3];
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_read_prefs_t *copy;
+   const char *tags[3] = {"{'dc': 'ny', 'rack': '1', 'ssd': 'yes'}",
+                          "{'rack': '2', 'dc': 'ny'}",
+                          "{'dc': 'sf', 'rack': 2}"};
+   char *reply;
+   int i;
+
+   for (i = 0; i < 3; i++) {
+      mongoc_server_description_init (&sds[i], "host:27017", (uint32_t) i + 1);
+      reply = bson_strdup_printf (
+         "{'ok': 1, 'ismaster': false, 'secondary': true, 'setName': 'rs',"
+         " 'tags': %s}",
+         tags[i]);
+      mongoc_server_description_handle_ismaster (
+         &sds[i], tmp_bson (reply), 1, NULL);
+      bson_free (reply);
+   }
+
+#define FILTER(_rp)                                              \
+   do {                                                          \
+      for (i = 0; i < 3; i++) {                                  \
+         candidates[i] = &sds[i];                                \
+      }                                                          \
+      mongoc_server_description_filter_tags (candidates, 3, _rp); \
+   } while (0)
+
+   read_prefs = mongoc_read_prefs_new (MONGOC_READ_SECONDARY);
+
+   /* no tags, everything matches */
+   FILTER (read_prefs);
+   ASSERT (candidates[0] && candidates[1] && candidates[2]);
+
+   /* keys in a different order than the servers' */
+   mongoc_read_prefs_add_tag (read_prefs,
+                              tmp_bson ("{'ssd': 'yes', 'dc': 'ny'}"));
+   FILTER (read_prefs);
+   ASSERT (candidates[0] && !candidates[1] && !candidates[2]);
+
+   /* the first tag set matches, the second is not consulted */
+   mongoc_read_prefs_set_tags (
+      read_prefs, tmp_bson ("[{'dc': 'ny', 'rack': '2'}, {'dc': 'ny'}]"));
+   FILTER (read_prefs);
+   ASSERT (!candidates[0] && candidates[1] && !candidates[2]);
+
+   /* values must be equal strings, a missing key never matches */
+   mongoc_read_prefs_set_tags (
+      read_prefs,
+      tmp_bson ("[{'dc': 'sf', 'rack': '2'}, {'zone': 'a'}, {'dc': 'n'}]"));
+   FILTER (read_prefs);
+   ASSERT (!candidates[0] && !candidates[1] && !candidates[2]);
+
+   /* falls back to a later tag set, and the empty tag set matches all */
+   mongoc_read_prefs_add_tag (read_prefs, tmp_bson ("{'dc': 'sf'}"));
+   mongoc_read_prefs_add_tag (read_prefs, NULL);
+   FILTER (read_prefs);
+   ASSERT (!candidates[0] && !candidates[1] && candidates[2]);
+
+   /* a copy has its own compiled tags */
+   copy = mongoc_read_prefs_copy (read_prefs);
+   mongoc_read_prefs_destroy (read_prefs);
+   FILTER (copy);
+   ASSERT (!candidates[0] && !candidates[1] && candidates[2]);
+
+   /* a server's tags are recompiled with each reply */
+   mongoc_server_description_handle_ismaster (
+      &sds[0],
+      tmp_bson ("{'ok': 1, 'ismaster': false, 'secondary': true,"
+                " 'setName': 'rs', 'tags': {'dc': 'sf'}}"),
+      1,
+      NULL);
+   FILTER (copy);
+   ASSERT (candidates[0] && !candidates[1] && candidates[2]);
+
+#undef FILTER
+
+   mongoc_read_prefs_destroy (copy);
+
+   for (i = 0; i < 3; i++) {
+      mongoc_server_description_cleanup (&sds[i]);
+   }
+}
+
+
+/* the encoded $readPreference follows each change, and copies */
+static void
+test_read_prefs_compiled_bson (void)
+{
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_read_prefs_t *copy;
+   const bson_t *compiled;
+
+   read_prefs = mongoc_read_prefs_new (MONGOC_READ_PRIMARY);
+   compiled = _mongoc_read_prefs_get_bson (read_prefs);
+   ASSERT_MATCH (compiled,
+                 "{'mode': 'primary', 'tags': {'$exists': false},"
+                 " 'maxStalenessSeconds': {'$exists': false}}");
+
+   mongoc_read_prefs_set_mode (read_prefs, MONGOC_READ_NEAREST);
+   mongoc_read_prefs_add_tag (read_prefs, tmp_bson ("{'dc': 'ny'}"));
+   mongoc_read_prefs_set_max_staleness_seconds (read_prefs, 120);
+   compiled = _mongoc_read_prefs_get_bson (read_prefs);
+   ASSERT_MATCH (compiled,
+                 "{'mode': 'nearest', 'tags': [{'dc': 'ny'}],"
+                 " 'maxStalenessSeconds': 120}");
+
+   copy = mongoc_read_prefs_copy (read_prefs);
+   mongoc_read_prefs_destroy (read_prefs);
+   ASSERT_MATCH (_mongoc_read_prefs_get_bson (copy),
+                 "{'mode': 'nearest', 'tags': [{'dc': 'ny'}],"
+                 " 'maxStalenessSeconds': 120}");
+
+   mongoc_read_prefs_set_tags (copy, NULL);
+   mongoc_read_prefs_set_max_staleness_seconds (copy,
+                                                MONGOC_NO_MAX_STALENESS);
+   compiled = _mongoc_read_prefs_get_bson (copy);
+   ASSERT_MATCH (compiled,
+                 "{'mode': 'nearest', 'tags': {'$exists': false},"
+                 " 'maxStalenessSeconds': {'$exists': false}}");
+
+   mongoc_read_prefs_destroy (copy);
+}
+
+
 void
 test_read_prefs_install (TestSuite *suite)
 {
+   TestSuite_Add (
+      suite, "/ReadPrefs/compiled_tags", test_read_prefs_compiled_tags);
+   TestSuite_Add (
+      suite, "/ReadPrefs/compiled_bson", test_read_prefs_compiled_bson);
    TestSuite_AddMockServerTest (
       suite, "/ReadPrefs/standalone/null", test_read_prefs_standalone_null);
    TestSuite_AddMockServerTest (suite,
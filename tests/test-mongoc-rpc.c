@@ -8,6 +8,7 @@
 
 #include "TestSuite.h"
 #include "mongoc-cluster-private.h"
+#include "mongoc-crc32c-private.h"
 
 
 static uint8_t *
@@ -354,6 +355,62 @@ test_mongoc_rpc_query_gather (void)
 }
 
 
+/* a query encoded once and sent with a new request id matches one gathered
+ * with that id */
+static void
+test_mongoc_rpc_query_encoded (void)
+{
+   mongoc_rpc_t rpc;
+   mongoc_rpc_header_t header;
+   mongoc_array_t ar;
+   mongoc_iovec_t *iov;
+   uint8_t *msg;
+   uint8_t *data;
+   size_t msg_len;
+   size_t length;
+   size_t off = 0;
+   size_t i;
+   bson_t b;
+
+   memset (&rpc, 0xFFFFFFFF, sizeof rpc);
+
+   bson_init (&b);
+
+   rpc.header.msg_len = 0;
+   rpc.header.request_id = 0;
+   rpc.header.response_to = -1;
+   rpc.header.opcode = MONGOC_OPCODE_QUERY;
+   rpc.query.flags = MONGOC_QUERY_SLAVE_OK;
+   rpc.query.collection = "test.test";
+   rpc.query.skip = 5;
+   rpc.query.n_return = 1;
+   rpc.query.query = bson_get_data (&b);
+   rpc.query.fields = bson_get_data (&b);
+
+   msg = _mongoc_rpc_encode_query (&rpc, &msg_len);
+
+   _mongoc_array_init (&ar, sizeof (mongoc_iovec_t));
+   _mongoc_rpc_gather_encoded (msg, msg_len, 1234, &header, &ar);
+   ASSERT_CMPSIZE_T (ar.len, ==, (size_t) 2);
+
+   data = get_test_file ("query1.dat", &length);
+   ASSERT_CMPSIZE_T (msg_len, ==, length);
+
+   for (i = 0; i < ar.len; i++) {
+      iov = &_mongoc_array_index (&ar, mongoc_iovec_t, i);
+      ASSERT (iov->iov_len <= (length - off));
+      ASSERT (!memcmp (&data[off], iov->iov_base, iov->iov_len));
+      off += iov->iov_len;
+   }
+
+   ASSERT_CMPSIZE_T (off, ==, length);
+
+   _mongoc_array_destroy (&ar);
+   bson_free (data);
+   bson_free (msg);
+}
+
+
 static void
 test_mongoc_rpc_query_scatter (void)
 {
@@ -649,6 +706,350 @@ test_mongoc_rpc_buffer_iov (void)
 }
 
 
+static void
+_test_compress_iovec (int32_t compressor_id)
+{
+   mongoc_compress_scratch_t scratch;
+   mongoc_iovec_t iov[5];
+   uint8_t *data;
+   uint8_t *out;
+   size_t size = 3 * MONGOC_COMPRESS_CHUNK_SIZE + 100;
+   size_t out_len;
+   size_t i;
+   int round;
+
+   data = bson_malloc (size);
+   for (i = 0; i < size; i++) {
+      data[i] = (uint8_t) ((i * 7) % 251);
+   }
+
+   /* odd splits: a header to skip, an empty iovec, a whole chunk */
+   iov[0].iov_base = (void *) data;
+   iov[0].iov_len = 16;
+   iov[1].iov_base = (void *) (data + 16);
+   iov[1].iov_len = 0;
+   iov[2].iov_base = (void *) (data + 16);
+   iov[2].iov_len = 1000;
+   iov[3].iov_base = (void *) (data + 1016);
+   iov[3].iov_len = MONGOC_COMPRESS_CHUNK_SIZE;
+   iov[4].iov_base = (void *) (data + 1016 + MONGOC_COMPRESS_CHUNK_SIZE);
+   iov[4].iov_len = size - 1016 - MONGOC_COMPRESS_CHUNK_SIZE;
+
+   mongoc_compress_scratch_init (&scratch);
+   out = bson_malloc (size);
+
+   /* later rounds reuse the scratch buffers and compression state, the
+    * last with another level, and decompress with reused state too, after
+    * a failed attempt with truncated input */
+   for (round = 0; round < 3; round++) {
+      BSON_ASSERT (mongoc_compress_iovec (
+         compressor_id, round == 2 ? 1 : -1, iov, 5, 16, &scratch));
+
+      out_len = size - 16;
+      if (round == 0) {
+         BSON_ASSERT (mongoc_uncompress (
+            compressor_id, scratch.out, scratch.out_len, out, &out_len));
+      } else {
+         if (compressor_id != MONGOC_COMPRESSOR_NOOP_ID) {
+            BSON_ASSERT (!mongoc_uncompress_scratch (compressor_id,
+                                                     scratch.out,
+                                                     scratch.out_len / 2,
+                                                     out,
+                                                     &out_len,
+                                                     &scratch));
+            out_len = size - 16;
+         }
+
+         BSON_ASSERT (mongoc_uncompress_scratch (compressor_id,
+                                                 scratch.out,
+                                                 scratch.out_len,
+                                                 out,
+                                                 &out_len,
+                                                 &scratch));
+      }
+
+      ASSERT_CMPSIZE_T (out_len, ==, size - 16);
+      ASSERT_MEMCMP (out, data + 16, (int) out_len);
+   }
+
+   bson_free (out);
+   mongoc_compress_scratch_destroy (&scratch);
+   bson_free (data);
+}
+
+
+static void
+test_mongoc_rpc_compress_iovec (void)
+{
+   _test_compress_iovec (MONGOC_COMPRESSOR_NOOP_ID);
+#ifdef MONGOC_ENABLE_COMPRESSION_ZLIB
+   _test_compress_iovec (MONGOC_COMPRESSOR_ZLIB_ID);
+#endif
+#ifdef MONGOC_ENABLE_COMPRESSION_SNAPPY
+   _test_compress_iovec (MONGOC_COMPRESSOR_SNAPPY_ID);
+#endif
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+   _test_compress_iovec (MONGOC_COMPRESSOR_ZSTD_ID);
+#endif
+}
+
+
+static void
+test_mongoc_rpc_compress_history (void)
+{
+   mongoc_compress_history_t history;
+   int i;
+
+   mongoc_compress_history_init (&history);
+   BSON_ASSERT (mongoc_compress_history_wanted (&history, "getMore"));
+   BSON_ASSERT (mongoc_compress_history_wanted (&history, "insert"));
+
+   /* getMores barely shrink, inserts shrink by half */
+   for (i = 0; i < MONGOC_COMPRESS_HISTORY_SAMPLES; i++) {
+      BSON_ASSERT (mongoc_compress_history_wanted (&history, "getMore"));
+      mongoc_compress_history_record (&history, "getMore", 200, 190);
+      mongoc_compress_history_record (&history, "insert", 2000, 1000);
+   }
+
+   BSON_ASSERT (!mongoc_compress_history_wanted (&history, "GETMORE"));
+   BSON_ASSERT (mongoc_compress_history_wanted (&history, "insert"));
+   BSON_ASSERT (mongoc_compress_history_wanted (&history, "find"));
+
+   /* the first skipped message was above, the last one resamples */
+   for (i = 2; i < MONGOC_COMPRESS_HISTORY_RETRY; i++) {
+      BSON_ASSERT (!mongoc_compress_history_wanted (&history, "getMore"));
+   }
+
+   BSON_ASSERT (mongoc_compress_history_wanted (&history, "getMore"));
+   BSON_ASSERT (mongoc_compress_history_wanted (&history, "getMore"));
+}
+
+
+static void
+append_le32 (uint8_t *buf, size_t *len, uint32_t v)
+{
+   v = BSON_UINT32_TO_LE (v);
+   memcpy (buf + *len, &v, 4);
+   *len += 4;
+}
+
+
+/* an OP_MSG reply with a body, maybe a sequence of @doc twice, and maybe
+ * a checksum */
+static size_t
+make_msg (uint8_t *buf, const bson_t *body, const bson_t *doc, bool checksum)
+{
+   size_t len = 0;
+   uint32_t msg_len;
+
+   append_le32 (buf, &len, 0);
+   append_le32 (buf, &len, 1);
+   append_le32 (buf, &len, 2);
+   append_le32 (buf, &len, MONGOC_OPCODE_MSG);
+   append_le32 (buf, &len, checksum ? MONGOC_MSG_CHECKSUM_PRESENT : 0);
+
+   buf[len++] = 0;
+   memcpy (buf + len, bson_get_data (body), body->len);
+   len += body->len;
+
+   if (doc) {
+      buf[len++] = 1;
+      append_le32 (buf, &len, 4 + sizeof "documents" + 2 * doc->len);
+      memcpy (buf + len, "documents", sizeof "documents");
+      len += sizeof "documents";
+      memcpy (buf + len, bson_get_data (doc), doc->len);
+      len += doc->len;
+      memcpy (buf + len, bson_get_data (doc), doc->len);
+      len += doc->len;
+   }
+
+   msg_len = (uint32_t) len + (checksum ? 4 : 0);
+   len = 0;
+   append_le32 (buf, &len, msg_len);
+
+   if (checksum) {
+      len = msg_len - 4;
+      append_le32 (buf, &len, _mongoc_crc32c (0, buf, len));
+   }
+
+   return msg_len;
+}
+
+
+static void
+test_mongoc_rpc_msg_scatter (void)
+{
+   uint8_t buf[256];
+   mongoc_rpc_t rpc;
+   bson_t *body;
+   bson_t *doc;
+   size_t len;
+   int checksum;
+
+   body = BCON_NEW ("ok", BCON_DOUBLE (1.0));
+   doc = BCON_NEW ("_id", BCON_INT32 (1));
+
+   for (checksum = 0; checksum < 2; checksum++) {
+      /* the usual reply */
+      len = make_msg (buf, body, NULL, checksum);
+      memset (&rpc, 0xFF, sizeof rpc);
+      ASSERT (_mongoc_rpc_scatter (&rpc, buf, len));
+      _mongoc_rpc_swab_from_le (&rpc);
+
+      ASSERT_CMPINT (rpc.header.msg_len, ==, (int32_t) len);
+      ASSERT_CMPINT (rpc.header.request_id, ==, 1);
+      ASSERT_CMPINT (rpc.header.response_to, ==, 2);
+      ASSERT_CMPINT (rpc.header.opcode, ==, MONGOC_OPCODE_MSG);
+      ASSERT_CMPUINT32 (rpc.msg.flags,
+                        ==,
+                        checksum ? MONGOC_MSG_CHECKSUM_PRESENT : 0);
+      ASSERT_CMPINT (rpc.msg.n_sections, ==, 1);
+      ASSERT_CMPINT (rpc.msg.sections[0].payload_type, ==, 0);
+      ASSERT (rpc.msg.sections[0].payload.bson_document == buf + 21);
+
+      /* with a document sequence */
+      len = make_msg (buf, body, doc, checksum);
+      memset (&rpc, 0xFF, sizeof rpc);
+      ASSERT (_mongoc_rpc_scatter (&rpc, buf, len));
+      _mongoc_rpc_swab_from_le (&rpc);
+
+      ASSERT_CMPINT (rpc.header.msg_len, ==, (int32_t) len);
+      ASSERT_CMPINT (rpc.msg.n_sections, ==, 2);
+      ASSERT (rpc.msg.sections[0].payload.bson_document == buf + 21);
+      ASSERT_CMPINT (rpc.msg.sections[1].payload_type, ==, 1);
+      ASSERT_CMPINT (rpc.msg.sections[1].payload.sequence.size,
+                     ==,
+                     (int32_t) (4 + sizeof "documents" + 2 * doc->len));
+      ASSERT_CMPSTR (rpc.msg.sections[1].payload.sequence.identifier,
+                     "documents");
+      ASSERT (rpc.msg.sections[1].payload.sequence.bson_documents ==
+              buf + 21 + body->len + 1 + 4 + sizeof "documents");
+   }
+
+   bson_destroy (doc);
+   bson_destroy (body);
+}
+
+
+static void
+test_mongoc_rpc_msg_scatter_invalid (void)
+{
+   uint8_t buf[256];
+   mongoc_rpc_t rpc;
+   bson_t *body;
+   bson_t *doc;
+   size_t len;
+   size_t i;
+   int checksum;
+
+   body = BCON_NEW ("ok", BCON_DOUBLE (1.0));
+   doc = BCON_NEW ("_id", BCON_INT32 (1));
+
+   /* truncated anywhere, including the checksum */
+   for (checksum = 0; checksum < 2; checksum++) {
+      len = make_msg (buf, body, NULL, checksum);
+      for (i = 0; i < len; i++) {
+         ASSERT (!_mongoc_rpc_scatter (&rpc, buf, i));
+      }
+   }
+
+   len = make_msg (buf, body, doc, false);
+   for (i = 22 + body->len; i < len; i++) {
+      ASSERT (!_mongoc_rpc_scatter (&rpc, buf, i));
+   }
+
+   /* an unknown section kind */
+   len = make_msg (buf, body, doc, false);
+   buf[21 + body->len] = 2;
+   ASSERT (!_mongoc_rpc_scatter (&rpc, buf, len));
+
+   /* a document sequence before the body */
+   len = make_msg (buf, body, NULL, false);
+   buf[20] = 1;
+   ASSERT (!_mongoc_rpc_scatter (&rpc, buf, len));
+
+   /* a document sequence's identifier runs past the section */
+   len = make_msg (buf, body, doc, false);
+   memset (buf + 21 + body->len + 5, 'x', len - (21 + body->len + 5));
+   ASSERT (!_mongoc_rpc_scatter (&rpc, buf, len));
+
+   /* the body's length is too short, or too long */
+   len = make_msg (buf, body, NULL, false);
+   i = 21;
+   append_le32 (buf, &i, 4);
+   ASSERT (!_mongoc_rpc_scatter (&rpc, buf, len));
+   i = 21;
+   append_le32 (buf, &i, body->len + 1);
+   ASSERT (!_mongoc_rpc_scatter (&rpc, buf, len));
+
+   /* any bit flipped after the length breaks the checksum, with one or two
+    * sections */
+   len = make_msg (buf, body, NULL, true);
+   for (i = 4; i < len; i++) {
+      buf[i] ^= 0x10;
+      ASSERT (!_mongoc_rpc_scatter (&rpc, buf, len));
+      buf[i] ^= 0x10;
+   }
+
+   ASSERT (_mongoc_rpc_scatter (&rpc, buf, len));
+
+   len = make_msg (buf, body, doc, true);
+   buf[len - 1] ^= 1;
+   ASSERT (!_mongoc_rpc_scatter (&rpc, buf, len));
+   buf[len - 1] ^= 1;
+   ASSERT (_mongoc_rpc_scatter (&rpc, buf, len));
+
+   bson_destroy (doc);
+   bson_destroy (body);
+}
+
+
+static void
+test_mongoc_rpc_crc32c (void)
+{
+   uint8_t buf[1024 + 8];
+   mongoc_iovec_t iov[3];
+   size_t len;
+   size_t offset;
+   uint32_t crc;
+   uint32_t part;
+
+   /* the standard check value, and RFC 3720's test vectors */
+   ASSERT_CMPUINT32 (_mongoc_crc32c (0, "123456789", 9), ==, 0xe3069283);
+   ASSERT_CMPUINT32 (_mongoc_crc32c_sw (0, "123456789", 9), ==, 0xe3069283);
+   memset (buf, 0, 32);
+   ASSERT_CMPUINT32 (_mongoc_crc32c (0, buf, 32), ==, 0x8a9136aa);
+   memset (buf, 0xff, 32);
+   ASSERT_CMPUINT32 (_mongoc_crc32c (0, buf, 32), ==, 0x62a8ab43);
+   ASSERT_CMPUINT32 (_mongoc_crc32c (0, buf, 0), ==, 0);
+
+   for (len = 0; len < sizeof buf; len++) {
+      buf[len] = (uint8_t) (len * 7 + 3);
+   }
+
+   /* the chosen implementation agrees with the table at every length and
+    * alignment, whole or in pieces */
+   for (offset = 0; offset < 8; offset++) {
+      for (len = 0; len <= 1024; len += (len < 64 ? 1 : 61)) {
+         crc = _mongoc_crc32c_sw (0, buf + offset, len);
+         ASSERT_CMPUINT32 (_mongoc_crc32c (0, buf + offset, len), ==, crc);
+
+         part = _mongoc_crc32c (0, buf + offset, len / 3);
+         part = _mongoc_crc32c (part, buf + offset + len / 3, len - len / 3);
+         ASSERT_CMPUINT32 (part, ==, crc);
+
+         iov[0].iov_base = (void *) (buf + offset);
+         iov[0].iov_len = len / 2;
+         iov[1].iov_base = (void *) (buf + offset + len / 2);
+         iov[1].iov_len = 0;
+         iov[2].iov_base = (void *) (buf + offset + len / 2);
+         iov[2].iov_len = len - len / 2;
+         ASSERT_CMPUINT32 (_mongoc_crc32c_iovec (iov, 3), ==, crc);
+      }
+   }
+}
+
+
 void
 test_rpc_install (TestSuite *suite)
 {
@@ -665,11 +1066,20 @@ test_rpc_install (TestSuite *suite)
    TestSuite_Add (
       suite, "/Rpc/kill_cursors/scatter", test_mongoc_rpc_kill_cursors_scatter);
    TestSuite_Add (suite, "/Rpc/query/gather", test_mongoc_rpc_query_gather);
+   TestSuite_Add (suite, "/Rpc/query/encoded", test_mongoc_rpc_query_encoded);
    TestSuite_Add (suite, "/Rpc/query/scatter", test_mongoc_rpc_query_scatter);
+   TestSuite_Add (suite, "/Rpc/msg/scatter", test_mongoc_rpc_msg_scatter);
+   TestSuite_Add (
+      suite, "/Rpc/msg/scatter_invalid", test_mongoc_rpc_msg_scatter_invalid);
+   TestSuite_Add (suite, "/Rpc/crc32c", test_mongoc_rpc_crc32c);
    TestSuite_Add (suite, "/Rpc/reply/gather", test_mongoc_rpc_reply_gather);
    TestSuite_Add (suite, "/Rpc/reply/scatter", test_mongoc_rpc_reply_scatter);
    TestSuite_Add (suite, "/Rpc/reply/scatter2", test_mongoc_rpc_reply_scatter2);
    TestSuite_Add (suite, "/Rpc/update/gather", test_mongoc_rpc_update_gather);
    TestSuite_Add (suite, "/Rpc/update/scatter", test_mongoc_rpc_update_scatter);
    TestSuite_Add (suite, "/Rpc/buffer/iov", test_mongoc_rpc_buffer_iov);
+   TestSuite_Add (
+      suite, "/Rpc/compress/iovec", test_mongoc_rpc_compress_iovec);
+   TestSuite_Add (
+      suite, "/Rpc/compress/history", test_mongoc_rpc_compress_history);
 }
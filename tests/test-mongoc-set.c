@@ -85,8 +85,67 @@ test_set_new (void)
 }
 
 
+/* large enough to use the hash index */
+static void
+test_set_index (void)
+{
+   int items[100];
+   uint32_t id;
+   int i;
+   int destroyed = 0;
+   mongoc_set_t *set = mongoc_set_new (1, &test_set_dtor, &destroyed);
+
+   /* out of order */
+   for (i = 99; i >= 50; i--) {
+      mongoc_set_add (set, (uint32_t) i, &items[i]);
+   }
+
+   for (i = 0; i < 50; i++) {
+      mongoc_set_add (set, (uint32_t) i, &items[i]);
+   }
+
+   BSON_ASSERT (set->index);
+   ASSERT_CMPSIZE_T (set->items_len, ==, (size_t) 100);
+
+   for (i = 0; i < 100; i++) {
+      BSON_ASSERT (mongoc_set_get (set, (uint32_t) i) == &items[i]);
+
+      /* still sorted by id */
+      BSON_ASSERT (mongoc_set_get_item_and_id (set, i, &id) == &items[i]);
+      ASSERT_CMPUINT32 (id, ==, (uint32_t) i);
+   }
+
+   BSON_ASSERT (!mongoc_set_get (set, 100));
+
+   /* remove the even ids */
+   for (i = 0; i < 100; i += 2) {
+      mongoc_set_rm (set, (uint32_t) i);
+   }
+
+   ASSERT_CMPINT (destroyed, ==, 50);
+   for (i = 0; i < 100; i++) {
+      BSON_ASSERT (mongoc_set_get (set, (uint32_t) i) ==
+                   (i % 2 ? &items[i] : NULL));
+   }
+
+   /* shrinks below the threshold and drops the index */
+   for (i = 1; i < 90; i += 2) {
+      mongoc_set_rm (set, (uint32_t) i);
+   }
+
+   BSON_ASSERT (!set->index);
+   for (i = 91; i < 100; i += 2) {
+      BSON_ASSERT (mongoc_set_get (set, (uint32_t) i) == &items[i]);
+   }
+
+   mongoc_set_destroy (set);
+   ASSERT_CMPINT (destroyed, ==, 100);
+}
+
+
 void
 test_set_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Set/new", test_set_new);
+   TestSuite_Add (suite, "/Set/index", test_set_index);
 }
@@ -0,0 +1,378 @@
+#include <mongoc.h>
+
+#include "mongoc-thread-private.h"
+#include "TestSuite.h"
+#include "mock_server/future-functions.h"
+#include "mock_server/mock-server.h"
+#include "test-conveniences.h"
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "shard-router-test"
+
+#define EPOCH "{'$oid': '0123456789abcdef01234567'}"
+
+
+/* a mongos and two replica set shards: shard0 owns a < 10, shard1 the rest */
+typedef struct {
+   mongoc_mutex_t mutex;
+   mock_server_t *mongos;
+   mock_server_t *shards[2];
+   bool sharded;
+   int stale_replies; /* shard0 replies StaleConfig this many times */
+   int n_collection_finds;
+   int n_mongos_finds;
+   int n_shard_finds[2];
+} cluster_t;
+
+
+typedef struct {
+   cluster_t *cluster;
+   int index;
+} shard_t;
+
+
+static void
+_replies_to_find (request_t *request, const char *ns, const char *docs)
+{
+   char *reply;
+
+   reply = bson_strdup_printf (
+      "{'ok': 1, 'cursor': {'id': 0, 'ns': '%s', 'firstBatch': [%s]}}",
+      ns,
+      docs);
+   mock_server_replies_simple (request, reply);
+   bson_free (reply);
+   request_destroy (request);
+}
+
+
+static bool
+_mongos_responder (request_t *request, void *data)
+{
+   cluster_t *cluster = (cluster_t *) data;
+   const bson_t *cmd;
+   const char *collection;
+   char *docs;
+
+   if (strcmp (request->command_name, "find")) {
+      return false;
+   }
+
+   cmd = request_get_doc (request, 0);
+   collection = bson_lookup_utf8 (cmd, "find");
+
+   if (!strcmp (collection, "collections")) {
+      mongoc_mutex_lock (&cluster->mutex);
+      cluster->n_collection_finds++;
+      mongoc_mutex_unlock (&cluster->mutex);
+      ASSERT (
+         match_bson (cmd, tmp_bson ("{'filter': {'_id': 'db.c'}}"), false));
+      _replies_to_find (request,
+                        "config.collections",
+                        cluster->sharded ? "{'_id': 'db.c', 'key': {'a': 1},"
+                                           " 'lastmodEpoch': " EPOCH "}"
+                                         : "");
+   } else if (!strcmp (collection, "chunks")) {
+      ASSERT (
+         match_bson (cmd, tmp_bson ("{'filter': {'ns': 'db.c'}}"), false));
+      /* the collection version, or all chunks */
+      if (bson_has_field (cmd, "limit")) {
+         _replies_to_find (request,
+                           "config.chunks",
+                           "{'ns': 'db.c', 'min': {'a': 10},"
+                           " 'max': {'a': {'$maxKey': 1}}, 'shard': 'shard1',"
+                           " 'lastmod': {'$timestamp': {'t': 1, 'i': 2}}}");
+      } else {
+         _replies_to_find (request,
+                           "config.chunks",
+                           "{'ns': 'db.c', 'min': {'a': {'$minKey': 1}},"
+                           " 'max': {'a': 10}, 'shard': 'shard0',"
+                           " 'lastmod': {'$timestamp': {'t': 1, 'i': 1}}},"
+                           "{'ns': 'db.c', 'min': {'a': 10},"
+                           " 'max': {'a': {'$maxKey': 1}}, 'shard': 'shard1',"
+                           " 'lastmod': {'$timestamp': {'t': 1, 'i': 2}}}");
+      }
+   } else if (!strcmp (collection, "shards")) {
+      docs = bson_strdup_printf (
+         "{'_id': 'shard0', 'host': 'rs0/%s'}, {'_id': 'shard1', 'host': "
+         "'rs1/%s'}",
+         mock_server_get_host_and_port (cluster->shards[0]),
+         mock_server_get_host_and_port (cluster->shards[1]));
+      _replies_to_find (request, "config.shards", docs);
+      bson_free (docs);
+   } else {
+      ASSERT_CMPSTR (collection, "c");
+      ASSERT (!bson_has_field (cmd, "shardVersion"));
+      mongoc_mutex_lock (&cluster->mutex);
+      cluster->n_mongos_finds++;
+      mongoc_mutex_unlock (&cluster->mutex);
+      _replies_to_find (request, "db.c", "{'_id': 'mongos'}");
+   }
+
+   return true;
+}
+
+
+static bool
+_shard_responder (request_t *request, void *data)
+{
+   shard_t *shard = (shard_t *) data;
+   cluster_t *cluster = shard->cluster;
+   const bson_t *cmd;
+   bool stale = false;
+   char *doc;
+
+   if (strcmp (request->command_name, "find")) {
+      return false;
+   }
+
+   cmd = request_get_doc (request, 0);
+   ASSERT_CMPSTR (bson_lookup_utf8 (cmd, "find"), "c");
+   ASSERT (match_bson (
+      cmd,
+      tmp_bson ("{'limit': {'$numberLong': '1'}, 'singleBatch': true,"
+                " 'shardVersion': [{'$timestamp': {'t': 1, 'i': %d}}, " EPOCH
+                "]}",
+                shard->index + 1),
+      false));
+
+   mongoc_mutex_lock (&cluster->mutex);
+   cluster->n_shard_finds[shard->index]++;
+   if (shard->index == 0 && cluster->stale_replies > 0) {
+      cluster->stale_replies--;
+      stale = true;
+   }
+   mongoc_mutex_unlock (&cluster->mutex);
+
+   if (stale) {
+      mock_server_replies_simple (
+         request, "{'ok': 0, 'code': 13388, 'errmsg': 'stale config'}");
+      request_destroy (request);
+      return true;
+   }
+
+   doc = bson_strdup_printf ("{'_id': 'shard%d'}", shard->index);
+   _replies_to_find (request, "db.c", doc);
+   bson_free (doc);
+
+   return true;
+}
+
+
+static void
+_cluster_init (cluster_t *cluster, shard_t shards[2], bool sharded)
+{
+   int i;
+
+   memset (cluster, 0, sizeof *cluster);
+   mongoc_mutex_init (&cluster->mutex);
+   cluster->sharded = sharded;
+
+   for (i = 0; i < 2; i++) {
+      shards[i].cluster = cluster;
+      shards[i].index = i;
+      cluster->shards[i] = mock_server_new ();
+      mock_server_run (cluster->shards[i]);
+      mock_server_auto_ismaster (
+         cluster->shards[i],
+         "{'ok': 1, 'ismaster': true, 'setName': 'rs%d', 'hosts': ['%s'],"
+         " 'maxWireVersion': %d}",
+         i,
+         mock_server_get_host_and_port (cluster->shards[i]),
+         WIRE_VERSION_FIND_CMD);
+      mock_server_autoresponds (
+         cluster->shards[i], _shard_responder, &shards[i], NULL);
+   }
+
+   cluster->mongos = mock_mongos_new (WIRE_VERSION_FIND_CMD);
+   mock_server_autoresponds (cluster->mongos, _mongos_responder, cluster, NULL);
+   mock_server_run (cluster->mongos);
+}
+
+
+static void
+_cluster_destroy (cluster_t *cluster)
+{
+   mock_server_destroy (cluster->mongos);
+   mock_server_destroy (cluster->shards[0]);
+   mock_server_destroy (cluster->shards[1]);
+   mongoc_mutex_destroy (&cluster->mutex);
+}
+
+
+static void
+_find_one (mongoc_shard_router_t *router,
+           const char *filter_json,
+           const char *expected_id)
+{
+   bson_t doc;
+   bson_error_t error;
+
+   ASSERT_OR_PRINT (mongoc_shard_router_find_one (
+                       router, tmp_bson (filter_json), NULL, &doc, &error),
+                    error);
+   ASSERT_CMPSTR (bson_lookup_utf8 (&doc, "_id"), expected_id);
+   bson_destroy (&doc);
+}
+
+
+/* a filter on one shard key value goes straight to the shard that owns it */
+static void
+test_shard_router_routes (void)
+{
+   cluster_t cluster;
+   shard_t shards[2];
+   mongoc_client_t *client;
+   mongoc_shard_router_t *router;
+
+   _cluster_init (&cluster, shards, true);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (cluster.mongos));
+   router = mongoc_shard_router_new (client, "db", "c");
+
+   _find_one (router, "{'a': 1}", "shard0");
+   _find_one (router, "{'a': -100, 'b': 1}", "shard0");
+   _find_one (router, "{'a': 10}", "shard1");
+   _find_one (router, "{'a': 1.5e10}", "shard1");
+
+   /* not one shard key value */
+   _find_one (router, "{'b': 1}", "mongos");
+   _find_one (router, "{'a': {'$gt': 1}}", "mongos");
+
+   ASSERT_CMPINT (cluster.n_collection_finds, ==, 1);
+   ASSERT_CMPINT (cluster.n_shard_finds[0], ==, 2);
+   ASSERT_CMPINT (cluster.n_shard_finds[1], ==, 2);
+   ASSERT_CMPINT (cluster.n_mongos_finds, ==, 2);
+
+   mongoc_shard_router_destroy (router);
+   mongoc_client_destroy (client);
+   _cluster_destroy (&cluster);
+}
+
+
+/* a find a shard rejects as stale goes through mongos, and the next one
+ * refreshes the chunk map first */
+static void
+test_shard_router_stale (void)
+{
+   cluster_t cluster;
+   shard_t shards[2];
+   mongoc_client_t *client;
+   mongoc_shard_router_t *router;
+
+   _cluster_init (&cluster, shards, true);
+   cluster.stale_replies = 1;
+   client = mongoc_client_new_from_uri (mock_server_get_uri (cluster.mongos));
+   router = mongoc_shard_router_new (client, "db", "c");
+
+   _find_one (router, "{'a': 1}", "mongos");
+   ASSERT_CMPINT (cluster.n_shard_finds[0], ==, 1);
+   ASSERT_CMPINT (cluster.n_collection_finds, ==, 1);
+
+   _find_one (router, "{'a': 1}", "shard0");
+   ASSERT_CMPINT (cluster.n_shard_finds[0], ==, 2);
+   ASSERT_CMPINT (cluster.n_collection_finds, ==, 2);
+
+   mongoc_shard_router_destroy (router);
+   mongoc_client_destroy (client);
+   _cluster_destroy (&cluster);
+}
+
+
+/* every find on an unsharded collection goes through mongos */
+static void
+test_shard_router_unsharded (void)
+{
+   cluster_t cluster;
+   shard_t shards[2];
+   mongoc_client_t *client;
+   mongoc_shard_router_t *router;
+   bson_error_t error;
+
+   _cluster_init (&cluster, shards, false);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (cluster.mongos));
+   router = mongoc_shard_router_new (client, "db", "c");
+
+   ASSERT_OR_PRINT (mongoc_shard_router_refresh (router, &error), error);
+   _find_one (router, "{'a': 1}", "mongos");
+   _find_one (router, "{'a': 20}", "mongos");
+
+   ASSERT_CMPINT (cluster.n_collection_finds, ==, 1);
+   ASSERT_CMPINT (cluster.n_shard_finds[0], ==, 0);
+   ASSERT_CMPINT (cluster.n_shard_finds[1], ==, 0);
+   ASSERT_CMPINT (cluster.n_mongos_finds, ==, 2);
+
+   mongoc_shard_router_destroy (router);
+   mongoc_client_destroy (client);
+   _cluster_destroy (&cluster);
+}
+
+
+/* an unordered bulk sends its inserts grouped by shard, those it can't route
+ * last, and reports write errors by the order they were queued in */
+static void
+test_shard_router_bulk (void)
+{
+   cluster_t cluster;
+   shard_t shards[2];
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_shard_router_t *router;
+   mongoc_bulk_operation_t *bulk;
+   bson_t reply;
+   bson_error_t error;
+   future_t *future;
+   request_t *request;
+
+   _cluster_init (&cluster, shards, true);
+   client = mongoc_client_new_from_uri (mock_server_get_uri (cluster.mongos));
+   collection = mongoc_client_get_collection (client, "db", "c");
+   router = mongoc_shard_router_new (client, "db", "c");
+
+   bulk = mongoc_collection_create_bulk_operation (collection, false, NULL);
+   mongoc_bulk_operation_set_shard_router (bulk, router);
+   mongoc_bulk_operation_insert (bulk, tmp_bson ("{'_id': 0, 'a': 20}"));
+   mongoc_bulk_operation_insert (bulk, tmp_bson ("{'_id': 1, 'a': 1}"));
+   mongoc_bulk_operation_insert (bulk, tmp_bson ("{'_id': 2, 'b': 1}"));
+   mongoc_bulk_operation_insert (bulk, tmp_bson ("{'_id': 3, 'a': 2}"));
+   future = future_bulk_operation_execute (bulk, &reply, &error);
+
+   request = mock_server_receives_command (
+      cluster.mongos,
+      "db",
+      MONGOC_QUERY_NONE,
+      "{'insert': 'c', 'ordered': false, 'documents': ["
+      " {'_id': 1}, {'_id': 3}, {'_id': 0}, {'_id': 2}]}");
+   mock_server_replies_simple (
+      request,
+      "{'ok': 1, 'n': 3,"
+      " 'writeErrors': [{'index': 1, 'code': 11000, 'errmsg': 'dup'}]}");
+
+   ASSERT (!future_get_uint32_t (future));
+   ASSERT_MATCH (&reply,
+                 "{'nInserted': 3,"
+                 " 'writeErrors': [{'index': 3, 'code': 11000}]}");
+   ASSERT_CMPINT (cluster.n_collection_finds, ==, 1);
+
+   bson_destroy (&reply);
+   request_destroy (request);
+   future_destroy (future);
+   mongoc_bulk_operation_destroy (bulk);
+   mongoc_shard_router_destroy (router);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   _cluster_destroy (&cluster);
+}
+
+
+void
+test_shard_router_install (TestSuite *suite)
+{
+   TestSuite_AddMockServerTest (
+      suite, "/ShardRouter/routes", test_shard_router_routes);
+   TestSuite_AddMockServerTest (
+      suite, "/ShardRouter/stale", test_shard_router_stale);
+   TestSuite_AddMockServerTest (
+      suite, "/ShardRouter/unsharded", test_shard_router_unsharded);
+   TestSuite_AddMockServerTest (
+      suite, "/ShardRouter/bulk", test_shard_router_bulk);
+}
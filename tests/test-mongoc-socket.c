@@ -1,10 +1,16 @@
 #include <fcntl.h>
 #include <mongoc.h>
 #include <mongoc-util-private.h>
+#ifndef _WIN32
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
+#include "mongoc-host-list-private.h"
 #include "mongoc-socket-private.h"
 #include "mongoc-thread-private.h"
 #include "mongoc-errno-private.h"
+#include "mongoc-poller-private.h"
 #include "TestSuite.h"
 
 #include "test-libmongoc.h"
@@ -403,6 +409,311 @@ test_mongoc_socket_sendv (void *ctx)
 }
 
 
+#ifdef MONGOC_ENABLE_POLLER
+static void
+test_mongoc_socket_poller (void)
+{
+   struct sockaddr_in server_addr = {0};
+   mongoc_socklen_t sock_len;
+   mongoc_socket_t *listen_sock;
+   mongoc_socket_t *client_sock;
+   mongoc_socket_t *conn_sock;
+   mongoc_poller_t *poller;
+   mongoc_poller_event_t events[1];
+   int64_t expire_at;
+   int marker;
+   ssize_t r;
+
+   listen_sock = mongoc_socket_new (AF_INET, SOCK_STREAM, 0);
+   BSON_ASSERT (listen_sock);
+
+   server_addr.sin_family = AF_INET;
+   server_addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+   server_addr.sin_port = htons (0);
+   r = mongoc_socket_bind (
+      listen_sock, (struct sockaddr *) &server_addr, sizeof server_addr);
+   BSON_ASSERT (r == 0);
+
+   sock_len = sizeof (server_addr);
+   r = mongoc_socket_getsockname (
+      listen_sock, (struct sockaddr *) &server_addr, &sock_len);
+   BSON_ASSERT (r == 0);
+   r = mongoc_socket_listen (listen_sock, 10);
+   BSON_ASSERT (r == 0);
+
+   expire_at = bson_get_monotonic_time () + TIMEOUT * 1000;
+   client_sock = mongoc_socket_new (AF_INET, SOCK_STREAM, 0);
+   BSON_ASSERT (client_sock);
+   r = mongoc_socket_connect (client_sock,
+                              (struct sockaddr *) &server_addr,
+                              sizeof server_addr,
+                              expire_at);
+   BSON_ASSERT (r == 0);
+   conn_sock = mongoc_socket_accept (listen_sock, expire_at);
+   BSON_ASSERT (conn_sock);
+
+   poller = _mongoc_poller_new ();
+   BSON_ASSERT (poller);
+
+   /* a connected socket is writable */
+   BSON_ASSERT (
+      _mongoc_poller_set (poller, client_sock, false, POLLOUT, &marker));
+   ASSERT_CMPINT (1, ==, _mongoc_poller_wait (poller, events, 1, WAIT));
+   BSON_ASSERT (events[0].data == &marker);
+   BSON_ASSERT (events[0].revents & POLLOUT);
+
+   /* but not readable until the peer sends something */
+   BSON_ASSERT (
+      _mongoc_poller_set (poller, client_sock, true, POLLIN, &marker));
+   ASSERT_CMPINT (0, ==, _mongoc_poller_wait (poller, events, 1, 0));
+
+   r = mongoc_socket_send (conn_sock, "x", 1, expire_at);
+   ASSERT_CMPINT ((int) r, ==, 1);
+   ASSERT_CMPINT (1, ==, _mongoc_poller_wait (poller, events, 1, WAIT));
+   BSON_ASSERT (events[0].data == &marker);
+   BSON_ASSERT (events[0].revents & POLLIN);
+
+   /* removed sockets aren't reported */
+   _mongoc_poller_remove (poller, client_sock->sd);
+   ASSERT_CMPINT (0, ==, _mongoc_poller_wait (poller, events, 1, 0));
+
+   _mongoc_poller_destroy (poller);
+   mongoc_socket_destroy (conn_sock);
+   mongoc_socket_destroy (client_sock);
+   mongoc_socket_destroy (listen_sock);
+}
+#endif
+
+
+
+static void
+test_mongoc_socket_addrinfo_interleave (void)
+{
+   struct addrinfo results[5] = {{0}};
+   struct addrinfo **addrs;
+   int families[5] = {AF_INET6, AF_INET6, AF_INET6, AF_INET, AF_INET};
+   int expected[5] = {AF_INET6, AF_INET, AF_INET6, AF_INET, AF_INET6};
+   size_t n;
+   size_t i;
+
+   for (i = 0; i < 5; i++) {
+      results[i].ai_family = families[i];
+      results[i].ai_next = i < 4 ? &results[i + 1] : NULL;
+   }
+
+   addrs = _mongoc_addrinfo_interleave (results, &n);
+   ASSERT_CMPSIZE_T (n, ==, (size_t) 5);
+   for (i = 0; i < 5; i++) {
+      ASSERT_CMPINT (addrs[i]->ai_family, ==, expected[i]);
+   }
+
+   /* each family keeps the resolver's order */
+   BSON_ASSERT (addrs[0] == &results[0]);
+   BSON_ASSERT (addrs[2] == &results[1]);
+   BSON_ASSERT (addrs[4] == &results[2]);
+   BSON_ASSERT (addrs[1] == &results[3]);
+   BSON_ASSERT (addrs[3] == &results[4]);
+
+   bson_free (addrs);
+}
+
+
+static void
+test_mongoc_socket_happy_eyeballs (void)
+{
+   struct sockaddr_in server_addr = {0};
+   struct sockaddr_in closed_addr = {0};
+   struct addrinfo results[2] = {{0}};
+   mongoc_socklen_t sock_len;
+   mongoc_socket_t *listen_sock;
+   mongoc_socket_t *closed_sock;
+   mongoc_socket_t *client_sock;
+   int64_t start;
+   ssize_t r;
+
+   listen_sock = mongoc_socket_new (AF_INET, SOCK_STREAM, 0);
+   BSON_ASSERT (listen_sock);
+
+   server_addr.sin_family = AF_INET;
+   server_addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+   server_addr.sin_port = htons (0);
+   r = mongoc_socket_bind (
+      listen_sock, (struct sockaddr *) &server_addr, sizeof server_addr);
+   BSON_ASSERT (r == 0);
+
+   sock_len = sizeof (server_addr);
+   r = mongoc_socket_getsockname (
+      listen_sock, (struct sockaddr *) &server_addr, &sock_len);
+   BSON_ASSERT (r == 0);
+   r = mongoc_socket_listen (listen_sock, 10);
+   BSON_ASSERT (r == 0);
+
+   /* a port nobody listens on refuses connections */
+   closed_sock = mongoc_socket_new (AF_INET, SOCK_STREAM, 0);
+   BSON_ASSERT (closed_sock);
+   closed_addr = server_addr;
+   closed_addr.sin_port = htons (0);
+   r = mongoc_socket_bind (
+      closed_sock, (struct sockaddr *) &closed_addr, sizeof closed_addr);
+   BSON_ASSERT (r == 0);
+   sock_len = sizeof (closed_addr);
+   r = mongoc_socket_getsockname (
+      closed_sock, (struct sockaddr *) &closed_addr, &sock_len);
+   BSON_ASSERT (r == 0);
+   mongoc_socket_destroy (closed_sock);
+
+   results[0].ai_family = AF_INET;
+   results[0].ai_socktype = SOCK_STREAM;
+   results[0].ai_addr = (struct sockaddr *) &closed_addr;
+   results[0].ai_addrlen = sizeof closed_addr;
+   results[0].ai_next = &results[1];
+   results[1].ai_family = AF_INET;
+   results[1].ai_socktype = SOCK_STREAM;
+   results[1].ai_addr = (struct sockaddr *) &server_addr;
+   results[1].ai_addrlen = sizeof server_addr;
+
+   capture_logs (true);
+   start = bson_get_monotonic_time ();
+   client_sock = _mongoc_socket_connect_happy_eyeballs (
+      results, ntohs (server_addr.sin_port), 10 * 1000, NULL);
+   BSON_ASSERT (client_sock);
+
+   /* the refused address didn't cost the full attempt delay */
+   ASSERT_CMPINT64 (bson_get_monotonic_time () - start,
+                    <,
+                    (int64_t) MONGOC_HAPPY_EYEBALLS_DELAY_MS * 1000);
+   ASSERT_CAPTURED_LOG (
+      "happy eyeballs", MONGOC_LOG_LEVEL_WARNING, "Failed to connect to");
+
+   mongoc_socket_destroy (client_sock);
+   mongoc_socket_destroy (listen_sock);
+}
+
+static int
+_getsockopt_int (mongoc_socket_t *sock, int level, int name)
+{
+   int optval = -1;
+   mongoc_socklen_t optlen = (mongoc_socklen_t) sizeof optval;
+
+   ASSERT_CMPINT (
+      0, ==, getsockopt (sock->sd, level, name, (char *) &optval, &optlen));
+
+   return optval;
+}
+
+
+static void
+test_mongoc_socket_set_opts (void)
+{
+   mongoc_socket_t *sock;
+   mongoc_socket_opts_t opts = {0};
+
+   sock = mongoc_socket_new (AF_INET, SOCK_STREAM, 0);
+   BSON_ASSERT (sock);
+
+   /* mongoc_socket_new's defaults */
+   ASSERT_CMPINT (_getsockopt_int (sock, IPPROTO_TCP, TCP_NODELAY), !=, 0);
+#ifdef TCP_KEEPINTVL
+   ASSERT_CMPINT (_getsockopt_int (sock, IPPROTO_TCP, TCP_KEEPINTVL), <=, 10);
+#endif
+
+   /* NULL changes nothing */
+   _mongoc_socket_set_opts (sock, NULL);
+   ASSERT_CMPINT (_getsockopt_int (sock, IPPROTO_TCP, TCP_NODELAY), !=, 0);
+
+   opts.rcvbuf = 256 * 1024;
+   opts.sndbuf = 128 * 1024;
+   opts.keepintvl = 42;
+   opts.keepcnt = 3;
+   opts.nodelay = false;
+   _mongoc_socket_set_opts (sock, &opts);
+
+   /* Linux doubles the requested buffer sizes for bookkeeping */
+   ASSERT_CMPINT (
+      _getsockopt_int (sock, SOL_SOCKET, SO_RCVBUF), >=, opts.rcvbuf);
+   ASSERT_CMPINT (
+      _getsockopt_int (sock, SOL_SOCKET, SO_SNDBUF), >=, opts.sndbuf);
+   ASSERT_CMPINT (_getsockopt_int (sock, IPPROTO_TCP, TCP_NODELAY), ==, 0);
+#if defined(TCP_KEEPINTVL) && !defined(_WIN32)
+   ASSERT_CMPINT (_getsockopt_int (sock, IPPROTO_TCP, TCP_KEEPINTVL), ==, 42);
+#endif
+#if defined(TCP_KEEPCNT) && !defined(_WIN32)
+   ASSERT_CMPINT (_getsockopt_int (sock, IPPROTO_TCP, TCP_KEEPCNT), ==, 3);
+#endif
+
+   mongoc_socket_destroy (sock);
+}
+
+
+#ifndef _WIN32
+static void
+test_mongoc_socket_prefer_unix (void)
+{
+   uint16_t port;
+   struct sockaddr_un saddr;
+   mongoc_socket_t *listen_sock;
+   mongoc_socket_t *conn_sock;
+   mongoc_host_list_t host;
+   mongoc_host_list_t unix_host;
+   char *host_and_port;
+   char *uri_str;
+   mongoc_client_t *client;
+   mongoc_stream_t *stream;
+   bson_error_t error;
+
+   /* a port nothing listens on over TCP */
+   port = (uint16_t) (20000 + getpid () % 10000);
+   host_and_port = bson_strdup_printf ("localhost:%hu", port);
+   BSON_ASSERT (_mongoc_host_list_from_string (&host, host_and_port));
+   ASSERT (!_mongoc_host_list_local_unix (&host, &unix_host));
+
+   /* listen where mongod would */
+   memset (&saddr, 0, sizeof saddr);
+   saddr.sun_family = AF_UNIX;
+   bson_snprintf (
+      saddr.sun_path, sizeof saddr.sun_path, "/tmp/mongodb-%hu.sock", port);
+   unlink (saddr.sun_path);
+   listen_sock = mongoc_socket_new (AF_UNIX, SOCK_STREAM, 0);
+   BSON_ASSERT (listen_sock);
+   ASSERT_CMPINT (
+      mongoc_socket_bind (
+         listen_sock, (struct sockaddr *) &saddr, sizeof saddr),
+      ==,
+      0);
+   ASSERT_CMPINT (mongoc_socket_listen (listen_sock, 10), ==, 0);
+
+   ASSERT (_mongoc_host_list_local_unix (&host, &unix_host));
+   ASSERT_CMPINT (unix_host.family, ==, AF_UNIX);
+   ASSERT_CMPSTR (unix_host.host, saddr.sun_path);
+
+   /* only for hosts on this machine */
+   BSON_ASSERT (_mongoc_host_list_from_string (&host, "example.com"));
+   host.port = port;
+   ASSERT (!_mongoc_host_list_local_unix (&host, &unix_host));
+
+   /* the default stream initiator connects to the socket */
+   uri_str = bson_strdup_printf ("mongodb://%s/?preferUnixSocket=true",
+                                 host_and_port);
+   client = mongoc_client_new (uri_str);
+   BSON_ASSERT (_mongoc_host_list_from_string (&host, host_and_port));
+   stream = mongoc_client_default_stream_initiator (
+      mongoc_client_get_uri (client), &host, client, &error);
+   ASSERT_OR_PRINT (stream, error);
+
+   conn_sock = mongoc_socket_accept (listen_sock, -1);
+   BSON_ASSERT (conn_sock);
+
+   mongoc_socket_destroy (conn_sock);
+   mongoc_stream_destroy (stream);
+   mongoc_client_destroy (client);
+   mongoc_socket_destroy (listen_sock);
+   unlink (saddr.sun_path);
+   bson_free (uri_str);
+   bson_free (host_and_port);
+}
+#endif
+
+
 void
 test_socket_install (TestSuite *suite)
 {
@@ -420,4 +731,17 @@ test_socket_install (TestSuite *suite)
                       NULL,
                       NULL,
                       test_framework_skip_if_slow);
+#ifdef MONGOC_ENABLE_POLLER
+   TestSuite_Add (suite, "/Socket/poller", test_mongoc_socket_poller);
+#endif
+   TestSuite_Add (suite,
+                  "/Socket/addrinfo_interleave",
+                  test_mongoc_socket_addrinfo_interleave);
+   TestSuite_Add (
+      suite, "/Socket/happy_eyeballs", test_mongoc_socket_happy_eyeballs);
+   TestSuite_Add (suite, "/Socket/set_opts", test_mongoc_socket_set_opts);
+#ifndef _WIN32
+   TestSuite_Add (
+      suite, "/Socket/prefer_unix", test_mongoc_socket_prefer_unix);
+#endif
 }
@@ -1,8 +1,12 @@
 #include "mongoc.h"
+#include "mongoc-client-pool-private.h"
+#include "mongoc-dns-private.h"
 #include "mongoc-host-list-private.h"
 #include "mongoc-thread-private.h"
+#include "mongoc-topology-private.h"
 
 #include "json-test.h"
+#include "mock_server/mock-server.h"
 #include "test-libmongoc.h"
 
 
@@ -199,8 +203,168 @@ test_all_spec_tests (TestSuite *suite)
 }
 
 
+static void
+test_srv_cache (void)
+{
+   const char *service = "_mongodb._tcp.a.example.com";
+   mongoc_host_list_t *hosts;
+   mongoc_host_list_t *cached;
+   bson_error_t error;
+
+   _mongoc_dns_cache_clear ();
+   BSON_ASSERT (!_mongoc_dns_srv_cache_get (service, &cached, &error));
+
+   hosts = _mongoc_host_list_push ("b.example.com", 2, AF_UNSPEC, NULL);
+   hosts = _mongoc_host_list_push ("a.example.com", 1, AF_UNSPEC, hosts);
+   _mongoc_dns_srv_cache_put (service, hosts, 0, NULL);
+
+   /* case-insensitive, and the order of the records is kept */
+   BSON_ASSERT (_mongoc_dns_srv_cache_get (
+      "_mongodb._tcp.A.example.com", &cached, &error));
+   BSON_ASSERT (cached && cached->next && !cached->next->next);
+   ASSERT_CMPSTR (cached->host_and_port, "a.example.com:1");
+   ASSERT_CMPSTR (cached->next->host_and_port, "b.example.com:2");
+   _mongoc_host_list_destroy_all (cached);
+
+   /* a failure replaces the answer */
+   bson_set_error (&error,
+                   MONGOC_ERROR_STREAM,
+                   MONGOC_ERROR_STREAM_NAME_RESOLUTION,
+                   "lookup failed");
+   _mongoc_dns_srv_cache_put (service, NULL, 0, &error);
+   memset (&error, 0, sizeof error);
+   BSON_ASSERT (_mongoc_dns_srv_cache_get (service, &cached, &error));
+   BSON_ASSERT (!cached);
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_STREAM,
+                          MONGOC_ERROR_STREAM_NAME_RESOLUTION,
+                          "lookup failed");
+
+   _mongoc_host_list_destroy_all (hosts);
+   _mongoc_dns_cache_clear ();
+}
+
+
+static void
+_srv_cache_put (const char *service, mock_server_t *a, mock_server_t *b)
+{
+   mongoc_host_list_t *hosts = NULL;
+   const mongoc_host_list_t *h;
+
+   if (b) {
+      h = mongoc_uri_get_hosts (mock_server_get_uri (b));
+      hosts = _mongoc_host_list_push (h->host, h->port, AF_UNSPEC, hosts);
+   }
+
+   if (a) {
+      h = mongoc_uri_get_hosts (mock_server_get_uri (a));
+      hosts = _mongoc_host_list_push (h->host, h->port, AF_UNSPEC, hosts);
+   }
+
+   _mongoc_dns_srv_cache_put (service, hosts, 0, NULL);
+   _mongoc_host_list_destroy_all (hosts);
+}
+
+
+static bool
+_has_server (mongoc_topology_description_t *td, mock_server_t *server)
+{
+   mongoc_server_description_t *sd;
+   size_t i;
+
+   for (i = 0; i < td->servers->items_len; i++) {
+      sd = (mongoc_server_description_t *) mongoc_set_get_item (td->servers,
+                                                                (int) i);
+      if (!strcmp (sd->host.host_and_port,
+                   mock_server_get_host_and_port (server))) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+static bool
+_topology_has_servers (mongoc_topology_t *topology,
+                       mock_server_t *a,
+                       mock_server_t *b)
+{
+   mongoc_topology_description_t *td = &topology->description;
+   size_t n = 0;
+   bool ret;
+
+   mongoc_mutex_lock (&topology->mutex);
+   ret = td->type == MONGOC_TOPOLOGY_SHARDED;
+   if (a) {
+      n++;
+      ret = ret && _has_server (td, a);
+   }
+
+   if (b) {
+      n++;
+      ret = ret && _has_server (td, b);
+   }
+
+   ret = ret && td->servers->items_len == n;
+   mongoc_mutex_unlock (&topology->mutex);
+
+   return ret;
+}
+
+
+/* a pooled topology follows the SRV records as mongos come and go */
+static void
+test_srv_polling (void)
+{
+   const char *service = "_mongodb._tcp.srv-polling.example.com";
+   mock_server_t *a;
+   mock_server_t *b;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_topology_t *topology;
+
+   a = mock_mongos_new (WIRE_VERSION_MIN);
+   b = mock_mongos_new (WIRE_VERSION_MIN);
+   mock_server_run (a);
+   mock_server_run (b);
+
+   /* resolve from the cache, the host doesn't exist */
+   _mongoc_dns_cache_clear ();
+   _srv_cache_put (service, a, NULL);
+
+   uri = mongoc_uri_new (
+      "mongodb+srv://srv-polling.example.com/?heartbeatFrequencyMS=500");
+   pool = mongoc_client_pool_new (uri);
+   topology = _mongoc_client_pool_get_topology (pool);
+   topology->srv_rescan_msec = 100;
+
+   /* no lookup until the background thread starts */
+   ASSERT_CMPSIZE_T (topology->description.servers->items_len, ==, (size_t) 0);
+
+   client = mongoc_client_pool_pop (pool);
+   WAIT_UNTIL (_topology_has_servers (topology, a, NULL));
+
+   /* a mongos is added, then the first one is removed */
+   _srv_cache_put (service, a, b);
+   WAIT_UNTIL (_topology_has_servers (topology, a, b));
+   _srv_cache_put (service, NULL, b);
+   WAIT_UNTIL (_topology_has_servers (topology, NULL, b));
+
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (b);
+   mock_server_destroy (a);
+   _mongoc_dns_cache_clear ();
+}
+
+
 void
 test_srv_install (TestSuite *suite)
 {
    test_all_spec_tests (suite);
+   TestSuite_Add (suite, "/srv/cache", test_srv_cache);
+   TestSuite_AddMockServerTest (suite, "/srv/polling", test_srv_polling);
 }
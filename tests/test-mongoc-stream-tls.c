@@ -3,8 +3,10 @@
 
 #ifdef MONGOC_ENABLE_SSL_OPENSSL
 #include <openssl/err.h>
+#include <openssl/ssl.h>
 #endif
 
+#include "mongoc-stream-tls-private.h"
 #include "ssl-test.h"
 #include "TestSuite.h"
 #include "test-libmongoc.h"
@@ -360,6 +362,64 @@ test_mongoc_tls_ip (void)
    ASSERT_CMPINT (cr.result, ==, SSL_TEST_SUCCESS);
    ASSERT_CMPINT (sr.result, ==, SSL_TEST_SUCCESS);
 }
+
+
+static void
+test_mongoc_tls_session_cache (void)
+{
+   mongoc_tls_session_cache_t *cache;
+   SSL_SESSION *a;
+   SSL_SESSION *b;
+
+   cache = _mongoc_tls_session_cache_new ();
+   BSON_ASSERT (!_mongoc_tls_session_cache_get (cache, "localhost:27017"));
+
+   /* the cache takes the references */
+   a = SSL_SESSION_new ();
+   b = SSL_SESSION_new ();
+   _mongoc_tls_session_cache_put (cache, "localhost:27017", a);
+   _mongoc_tls_session_cache_put (cache, "localhost:27018", b);
+
+   ASSERT_CMPVOID (_mongoc_tls_session_cache_get (cache, "localhost:27017"),
+                   ==,
+                   a);
+   SSL_SESSION_free (a);
+   ASSERT_CMPVOID (_mongoc_tls_session_cache_get (cache, "localhost:27018"),
+                   ==,
+                   b);
+   SSL_SESSION_free (b);
+
+   /* a newer session replaces and releases the old one */
+   a = SSL_SESSION_new ();
+   _mongoc_tls_session_cache_put (cache, "localhost:27017", a);
+   ASSERT_CMPVOID (_mongoc_tls_session_cache_get (cache, "localhost:27017"),
+                   ==,
+                   a);
+   SSL_SESSION_free (a);
+
+   _mongoc_tls_session_cache_destroy (cache);
+}
+
+
+static void
+test_mongoc_tls_kernel_offload (void)
+{
+   mongoc_ssl_opt_t sopt = {0};
+   mongoc_ssl_opt_t copt = {0};
+   ssl_test_result_t sr;
+   ssl_test_result_t cr;
+
+   sopt.ca_file = CERT_CA;
+   sopt.pem_file = CERT_SERVER;
+
+   copt.ca_file = CERT_CA;
+   copt.pem_file = CERT_CLIENT;
+
+   ssl_test_kernel_offload (&copt, &sopt, "localhost", &cr, &sr);
+
+   ASSERT_CMPINT (cr.result, ==, SSL_TEST_SUCCESS);
+   ASSERT_CMPINT (sr.result, ==, SSL_TEST_SUCCESS);
+}
 #endif
 
 
@@ -412,6 +472,9 @@ test_stream_tls_install (TestSuite *suite)
    TestSuite_Add (
       suite, "/TLS/weak_cert_validation", test_mongoc_tls_weak_cert_validation);
    TestSuite_Add (suite, "/TLS/crl", test_mongoc_tls_crl);
+   TestSuite_Add (suite, "/TLS/session_cache", test_mongoc_tls_session_cache);
+   TestSuite_Add (
+      suite, "/TLS/kernel_offload", test_mongoc_tls_kernel_offload);
 #endif
 
 #if !defined(__APPLE__) && !defined(_WIN32) && \
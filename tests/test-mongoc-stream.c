@@ -79,6 +79,94 @@ test_buffered_oversized (void)
 }
 
 
+/* read @len bytes from @stream, and check they're the next @len bytes of
+ * @expected, which is at @pos */
+static void
+_read_and_compare (mongoc_stream_t *stream,
+                   const char *expected,
+                   size_t *pos,
+                   size_t len)
+{
+   mongoc_iovec_t iov[2];
+   char buf[16236];
+   ssize_t r;
+
+   BSON_ASSERT (len <= sizeof buf);
+
+   /* two iovecs, to check each is filled in turn */
+   iov[0].iov_base = buf;
+   iov[0].iov_len = len / 2;
+   iov[1].iov_base = buf + len / 2;
+   iov[1].iov_len = len - len / 2;
+
+   r = mongoc_stream_readv (stream, iov, 2, len, -1);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) len);
+   BSON_ASSERT (!memcmp (buf, expected + *pos, len));
+   *pos += len;
+}
+
+
+/* reads larger than the maximum bypass the buffer, and the buffer shrinks
+ * back after a run of small reads */
+static void
+test_buffered_adaptive (void)
+{
+   mongoc_stream_t *stream;
+   mongoc_stream_t *buffered;
+   mongoc_iovec_t iov;
+   char expected[16236];
+   size_t pos = 0;
+   ssize_t r;
+   int i;
+
+   stream =
+      mongoc_stream_file_new_for_path (BINARY_DIR "/reply2.dat", O_RDONLY, 0);
+   BSON_ASSERT (stream);
+   iov.iov_base = expected;
+   iov.iov_len = sizeof expected;
+   r = mongoc_stream_readv (stream, &iov, 1, iov.iov_len, -1);
+   ASSERT_CMPSSIZE_T (r, ==, (ssize_t) sizeof expected);
+   mongoc_stream_destroy (stream);
+
+   stream =
+      mongoc_stream_file_new_for_path (BINARY_DIR "/reply2.dat", O_RDONLY, 0);
+   BSON_ASSERT (stream);
+   buffered = _mongoc_stream_buffered_new_with_max_size (stream, 1024, 8192);
+   ASSERT_CMPSIZE_T (
+      _mongoc_stream_buffered_get_buffer_size (buffered), ==, (size_t) 1024);
+
+   /* a message header, then a message larger than the maximum, which is
+    * read directly without growing the buffer */
+   _read_and_compare (buffered, expected, &pos, 4);
+   _read_and_compare (buffered, expected, &pos, 10000);
+   ASSERT_CMPSIZE_T (
+      _mongoc_stream_buffered_get_buffer_size (buffered), ==, (size_t) 1024);
+
+   /* a message that grows the buffer */
+   _read_and_compare (buffered, expected, &pos, 4);
+   _read_and_compare (buffered, expected, &pos, 5000);
+   ASSERT_CMPSIZE_T (
+      _mongoc_stream_buffered_get_buffer_size (buffered), ==, (size_t) 8192);
+
+   /* runs of small reads halve it, back to its initial size */
+   for (i = 0; i < 52; i++) {
+      _read_and_compare (buffered, expected, &pos, 4);
+      if (i == 16) {
+         ASSERT_CMPSIZE_T (_mongoc_stream_buffered_get_buffer_size (buffered),
+                           ==,
+                           (size_t) 4096);
+      }
+   }
+
+   ASSERT_CMPSIZE_T (
+      _mongoc_stream_buffered_get_buffer_size (buffered), ==, (size_t) 1024);
+
+   _read_and_compare (buffered, expected, &pos, sizeof expected - pos);
+
+   mongoc_stream_destroy (buffered);
+}
+
+
 typedef struct {
    mongoc_stream_t vtable;
    ssize_t rval;
@@ -161,10 +249,94 @@ test_stream_writev_full (void)
 }
 
 
+static void
+test_stream_capture (void)
+{
+   const char *path = "test-stream-capture.dat";
+   const char *sent_path = "test-stream-capture-sent.dat";
+   mongoc_capture_t *capture;
+   mongoc_stream_t *out;
+   mongoc_stream_t *in;
+   mongoc_iovec_t iov[2];
+   bson_error_t error;
+   uint8_t msg[32] = {32, 0, 0, 0, 7, 0, 0, 0, 0, 0, 0, 0, 0xd4, 0x07, 0, 0};
+   char reply[16236];
+   uint8_t *captured;
+   const uint8_t *record;
+   uint32_t connection_id;
+   FILE *file;
+   size_t len;
+
+   capture = mongoc_capture_new (path, &error);
+   ASSERT_OR_PRINT (capture, error);
+
+   out = mongoc_stream_capture_new (
+      mongoc_stream_file_new_for_path (
+         sent_path, O_WRONLY | O_CREAT | O_TRUNC, 0600),
+      capture);
+   in = mongoc_stream_capture_new (
+      mongoc_stream_file_new_for_path (BINARY_DIR "/reply2.dat", O_RDONLY, 0),
+      capture);
+
+   /* the streams keep the capture file open */
+   mongoc_capture_destroy (capture);
+
+   /* a message split across iovecs is one record */
+   iov[0].iov_base = msg;
+   iov[0].iov_len = 10;
+   iov[1].iov_base = msg + 10;
+   iov[1].iov_len = sizeof msg - 10;
+   ASSERT_CMPSSIZE_T (
+      mongoc_stream_writev (out, iov, 2, 0), ==, (ssize_t) sizeof msg);
+
+   /* so is one read in pieces */
+   iov[0].iov_base = reply;
+   iov[0].iov_len = 4;
+   ASSERT_CMPSSIZE_T (mongoc_stream_readv (in, iov, 1, 4, -1), ==, (ssize_t) 4);
+   iov[0].iov_base = reply + 4;
+   iov[0].iov_len = sizeof reply - 4;
+   ASSERT_CMPSSIZE_T (mongoc_stream_readv (in, iov, 1, sizeof reply - 4, -1),
+                      ==,
+                      (ssize_t) sizeof reply - 4);
+
+   mongoc_stream_destroy (out);
+   mongoc_stream_destroy (in);
+
+   len = 12 + 13 + sizeof msg + 13 + sizeof reply;
+   captured = bson_malloc0 (len + 1);
+   file = fopen (path, "rb");
+   BSON_ASSERT (file);
+   ASSERT_CMPSIZE_T (fread (captured, 1, len + 1, file), ==, len);
+   fclose (file);
+
+   ASSERT_MEMCMP (captured, "MONGOCAP\x01\x00\x00\x00", 12);
+
+   /* the request: time, connection id, direction, message */
+   record = captured + 12;
+   memcpy (&connection_id, record + 8, 4);
+   ASSERT_CMPUINT32 (BSON_UINT32_FROM_LE (connection_id), ==, (uint32_t) 1);
+   ASSERT_CMPINT (record[12], ==, 0);
+   BSON_ASSERT (!memcmp (record + 13, msg, sizeof msg));
+
+   /* the reply */
+   record += 13 + sizeof msg;
+   memcpy (&connection_id, record + 8, 4);
+   ASSERT_CMPUINT32 (BSON_UINT32_FROM_LE (connection_id), ==, (uint32_t) 2);
+   ASSERT_CMPINT (record[12], ==, 1);
+   BSON_ASSERT (!memcmp (record + 13, reply, sizeof reply));
+
+   bson_free (captured);
+   remove (path);
+   remove (sent_path);
+}
+
+
 void
 test_stream_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Stream/buffered/basic", test_buffered_basic);
    TestSuite_Add (suite, "/Stream/buffered/oversized", test_buffered_oversized);
+   TestSuite_Add (suite, "/Stream/buffered/adaptive", test_buffered_adaptive);
    TestSuite_Add (suite, "/Stream/writev_full", test_stream_writev_full);
+   TestSuite_Add (suite, "/Stream/capture", test_stream_capture);
 }
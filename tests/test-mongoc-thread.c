@@ -1,6 +1,13 @@
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <mongoc.h>
+
 #include "mongoc-thread-private.h"
 
 #include "TestSuite.h"
+#include "test-libmongoc.h"
 
 
 static void
@@ -29,8 +36,125 @@ test_cond_wait (void)
 }
 
 
+typedef struct {
+   int n_calls;
+   mongoc_thread_kind_t kind;
+} create_func_data_t;
+
+
+static int
+create_func (mongoc_thread_kind_t kind,
+             mongoc_thread_func_t func,
+             void *arg,
+             void *thread,
+             void *user_data)
+{
+   create_func_data_t *data = (create_func_data_t *) user_data;
+
+   data->n_calls++;
+   data->kind = kind;
+
+   return mongoc_thread_create ((mongoc_thread_t *) thread, func, arg);
+}
+
+
+static void *
+set_flag (void *arg)
+{
+   *(bool *) arg = true;
+
+   return NULL;
+}
+
+
+static void
+test_create_func (void)
+{
+   create_func_data_t data = {0};
+   mongoc_thread_t thread;
+   bool ran = false;
+
+   mongoc_thread_set_create_func (create_func, &data);
+   ASSERT_CMPINT (0,
+                  ==,
+                  _mongoc_thread_create (
+                     MONGOC_THREAD_BULK_WORKER, &thread, set_flag, &ran));
+   mongoc_thread_join (thread);
+   mongoc_thread_set_create_func (NULL, NULL);
+
+   ASSERT_CMPINT (data.n_calls, ==, 1);
+   ASSERT_CMPINT (data.kind, ==, MONGOC_THREAD_BULK_WORKER);
+   ASSERT (ran);
+   ASSERT_CMPSTR (mongoc_thread_kind_name (data.kind), "bulk worker");
+
+   /* the default creates the thread itself */
+   ran = false;
+   ASSERT_CMPINT (0,
+                  ==,
+                  _mongoc_thread_create (
+                     MONGOC_THREAD_BULK_WORKER, &thread, set_flag, &ran));
+   mongoc_thread_join (thread);
+   ASSERT_CMPINT (data.n_calls, ==, 1);
+   ASSERT (ran);
+}
+
+
+static void
+test_invalid_settings (void)
+{
+   uint32_t cpu = UINT32_MAX;
+
+   capture_logs (true);
+   ASSERT (!mongoc_thread_set_cpu_affinity (&cpu, 1));
+   ASSERT (!mongoc_thread_set_nice (-21));
+   ASSERT (!mongoc_thread_set_nice (20));
+   capture_logs (false);
+
+   ASSERT (mongoc_thread_set_cpu_affinity (NULL, 0));
+   ASSERT (mongoc_thread_set_nice (0));
+   ASSERT (!mongoc_thread_kind_name ((mongoc_thread_kind_t) 100));
+}
+
+
+#ifdef __linux__
+static void *
+get_cpu (void *arg)
+{
+   *(int *) arg = sched_getcpu ();
+
+   return NULL;
+}
+
+
+static void
+test_cpu_affinity (void)
+{
+   uint32_t cpu = 0;
+   mongoc_thread_t thread;
+   int thread_cpu = -1;
+
+   ASSERT (mongoc_thread_set_cpu_affinity (&cpu, 1));
+   ASSERT (mongoc_thread_set_nice (5));
+   ASSERT_CMPINT (0,
+                  ==,
+                  _mongoc_thread_create (
+                     MONGOC_THREAD_BULK_WORKER, &thread, get_cpu, &thread_cpu));
+   mongoc_thread_join (thread);
+   ASSERT (mongoc_thread_set_cpu_affinity (NULL, 0));
+   ASSERT (mongoc_thread_set_nice (0));
+
+   ASSERT_CMPINT (thread_cpu, ==, 0);
+}
+#endif
+
+
 void
 test_thread_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Thread/cond_wait", test_cond_wait);
+   TestSuite_Add (suite, "/Thread/create_func", test_create_func);
+   TestSuite_Add (suite, "/Thread/invalid_settings", test_invalid_settings);
+#ifdef __linux__
+   TestSuite_Add (suite, "/Thread/cpu_affinity", test_cpu_affinity);
+#endif
 }
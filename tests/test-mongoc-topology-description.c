@@ -2,6 +2,9 @@
 #include "mongoc-set-private.h"
 #include "mongoc-client-pool-private.h"
 #include "mongoc-client-private.h"
+#include "mongoc-host-list-private.h"
+#include "mongoc-read-prefs-private.h"
+#include "mongoc-server-description-private.h"
 
 #include "TestSuite.h"
 #include "test-libmongoc.h"
@@ -138,6 +141,449 @@ test_get_servers (void)
 }
 
 
+static void
+test_select_cached (void)
+{
+   mongoc_uri_t *uri;
+   mongoc_topology_t *topology;
+   mongoc_topology_description_t *td;
+   mongoc_server_description_t *sd_a;
+   mongoc_server_description_t *sd_c;
+   mongoc_server_description_t *sd;
+   mongoc_read_prefs_t *prefs;
+   mongoc_read_prefs_t *prefs_copy;
+   int64_t generation;
+   bson_error_t error;
+   int i;
+
+   uri = mongoc_uri_new ("mongodb://a,b,c");
+   topology = mongoc_topology_new (uri, true /* single-threaded */);
+   td = &topology->description;
+   prefs = mongoc_read_prefs_new (MONGOC_READ_NEAREST);
+
+   sd_a = _sd_for_host (td, "a");
+   mongoc_topology_description_handle_ismaster (
+      td, sd_a->id, tmp_bson ("{'ok': 1, 'msg': 'isdbgrid'}"), 10, NULL);
+
+   sd_c = _sd_for_host (td, "c");
+   mongoc_topology_description_handle_ismaster (
+      td, sd_c->id, tmp_bson ("{'ok': 1, 'msg': 'isdbgrid'}"), 10, NULL);
+
+   /* repeated selections hit the cache, "b" is never suitable */
+   for (i = 0; i < 20; i++) {
+      sd = mongoc_topology_description_select (td, MONGOC_SS_READ, prefs, 15);
+      BSON_ASSERT (sd == sd_a || sd == sd_c);
+   }
+
+   /* any change to the description invalidates cached selections */
+   generation = td->generation;
+   bson_set_error (
+      &error, MONGOC_ERROR_STREAM, MONGOC_ERROR_STREAM_SOCKET, "error");
+   mongoc_topology_description_invalidate_server (td, sd_c->id, &error);
+   ASSERT_CMPINT64 (generation, !=, td->generation);
+
+   for (i = 0; i < 20; i++) {
+      sd = mongoc_topology_description_select (td, MONGOC_SS_READ, prefs, 15);
+      BSON_ASSERT (sd == sd_a);
+   }
+
+   /* read prefs with the same contents share a generation */
+   prefs_copy = mongoc_read_prefs_copy (prefs);
+   ASSERT_CMPINT64 (prefs->generation, ==, prefs_copy->generation);
+   mongoc_read_prefs_add_tag (prefs_copy, tmp_bson ("{'dc': 'ny'}"));
+   ASSERT_CMPINT64 (prefs->generation, !=, prefs_copy->generation);
+
+   mongoc_read_prefs_destroy (prefs_copy);
+   mongoc_read_prefs_destroy (prefs);
+   mongoc_topology_destroy (topology);
+   mongoc_uri_destroy (uri);
+}
+
+
+static void
+test_select_load_aware (void)
+{
+   mongoc_uri_t *uri;
+   mongoc_topology_t *topology;
+   mongoc_topology_description_t *td;
+   mongoc_server_description_t *sd_a;
+   mongoc_server_description_t *sd_b;
+   mongoc_server_description_t *sd_c;
+   mongoc_server_description_t *sd;
+   mongoc_read_prefs_t *prefs;
+   unsigned int rand_seed = 1;
+   int64_t started;
+   int i;
+
+   uri = mongoc_uri_new ("mongodb://a,b,c/?serverSelectionLoadAware=true");
+   topology = mongoc_topology_new (uri, true /* single-threaded */);
+   BSON_ASSERT (topology->load_aware);
+   td = &topology->description;
+   prefs = mongoc_read_prefs_new (MONGOC_READ_NEAREST);
+
+   sd_a = _sd_for_host (td, "a");
+   sd_b = _sd_for_host (td, "b");
+   sd_c = _sd_for_host (td, "c");
+   mongoc_topology_description_handle_ismaster (
+      td, sd_a->id, tmp_bson ("{'ok': 1, 'msg': 'isdbgrid'}"), 10, NULL);
+   mongoc_topology_description_handle_ismaster (
+      td, sd_b->id, tmp_bson ("{'ok': 1, 'msg': 'isdbgrid'}"), 10, NULL);
+   mongoc_topology_description_handle_ismaster (
+      td, sd_c->id, tmp_bson ("{'ok': 1, 'msg': 'isdbgrid'}"), 10, NULL);
+
+   /* "a" is busy, it loses every comparison with another server */
+   for (i = 0; i < 10; i++) {
+      _mongoc_topology_load_begin (topology, sd_a->id);
+   }
+
+   ASSERT_CMPINT (
+      10, ==, topology->load[sd_a->id % MONGOC_SERVER_LOAD_SLOTS].in_flight);
+
+   for (i = 0; i < 50; i++) {
+      sd = _mongoc_topology_description_select_r (
+         td, MONGOC_SS_READ, prefs, 15, topology->load, &rand_seed);
+      BSON_ASSERT (sd == sd_b || sd == sd_c);
+   }
+
+   /* "a" finishes quickly, and "b" took a second for its last operation */
+   started = bson_get_monotonic_time ();
+   for (i = 0; i < 10; i++) {
+      _mongoc_topology_load_end (topology, sd_a->id, started);
+   }
+
+   _mongoc_topology_load_begin (topology, sd_b->id);
+   _mongoc_topology_load_end (
+      topology, sd_b->id, bson_get_monotonic_time () - 1000 * 1000);
+
+   ASSERT_CMPINT (
+      0, ==, topology->load[sd_a->id % MONGOC_SERVER_LOAD_SLOTS].in_flight);
+
+   for (i = 0; i < 50; i++) {
+      sd = _mongoc_topology_description_select_r (
+         td, MONGOC_SS_READ, prefs, 15, topology->load, &rand_seed);
+      BSON_ASSERT (sd == sd_a || sd == sd_c);
+   }
+
+   mongoc_read_prefs_destroy (prefs);
+   mongoc_topology_destroy (topology);
+   mongoc_uri_destroy (uri);
+}
+
+
+static bson_t *
+_secondary_in_zone (const char *zone)
+{
+   return tmp_bson ("{'ok': 1, 'ismaster': false, 'secondary': true,"
+                    " 'setName': 'rs', 'tags': {'zone': '%s'},"
+                    " 'hosts': ['a:27017', 'b:27017', 'c:27017']}",
+                    zone);
+}
+
+
+/* servers outside localZone count as zonePenaltyMS farther away */
+static void
+test_select_local_zone (void)
+{
+   mongoc_uri_t *uri;
+   mongoc_topology_t *topology;
+   mongoc_topology_description_t *td;
+   mongoc_server_description_t *sd_a;
+   mongoc_server_description_t *sd_b;
+   mongoc_server_description_t *sd_c;
+   mongoc_server_description_t *sd;
+   mongoc_read_prefs_t *prefs;
+   unsigned int rand_seed = 1;
+   int i;
+
+   uri = mongoc_uri_new (
+      "mongodb://a,b,c/?replicaSet=rs&localZone=east&zonePenaltyMS=50");
+   topology = mongoc_topology_new (uri, true /* single-threaded */);
+   td = &topology->description;
+   ASSERT_CMPSTR (td->local_zone, "east");
+   ASSERT_CMPSTR (td->zone_tag, "zone");
+   ASSERT_CMPINT64 (td->zone_penalty_ms, ==, (int64_t) 50);
+   prefs = mongoc_read_prefs_new (MONGOC_READ_NEAREST);
+
+   sd_a = _sd_for_host (td, "a");
+   sd_b = _sd_for_host (td, "b");
+   sd_c = _sd_for_host (td, "c");
+   mongoc_topology_description_handle_ismaster (
+      td, sd_a->id, _secondary_in_zone ("east"), 10, NULL);
+   mongoc_topology_description_handle_ismaster (
+      td, sd_b->id, _secondary_in_zone ("west"), 2, NULL);
+   mongoc_topology_description_handle_ismaster (
+      td, sd_c->id, _secondary_in_zone ("eastern"), 2, NULL);
+
+   /* "b" and "c" are nearer, but outside the local zone */
+   for (i = 0; i < 50; i++) {
+      sd = _mongoc_topology_description_select_r (
+         td, MONGOC_SS_READ, prefs, 15, NULL, &rand_seed);
+      BSON_ASSERT (sd == sd_a);
+   }
+
+   /* "a" slows down past the penalty, reads spill over to other zones */
+   for (i = 0; i < 20; i++) {
+      mongoc_topology_description_handle_ismaster (
+         td, sd_a->id, _secondary_in_zone ("east"), 100, NULL);
+   }
+
+   ASSERT_CMPINT64 (sd_a->round_trip_time_msec, >, (int64_t) 67);
+
+   for (i = 0; i < 50; i++) {
+      sd = _mongoc_topology_description_select_r (
+         td, MONGOC_SS_READ, prefs, 15, NULL, &rand_seed);
+      BSON_ASSERT (sd == sd_b || sd == sd_c);
+   }
+
+   mongoc_read_prefs_destroy (prefs);
+   mongoc_topology_destroy (topology);
+   mongoc_uri_destroy (uri);
+
+   /* without a local zone, the nearest servers are selected */
+   uri = mongoc_uri_new ("mongodb://a,b,c/?replicaSet=rs&zoneTag=dc");
+   topology = mongoc_topology_new (uri, true /* single-threaded */);
+   td = &topology->description;
+   BSON_ASSERT (!td->local_zone);
+   prefs = mongoc_read_prefs_new (MONGOC_READ_NEAREST);
+
+   sd_a = _sd_for_host (td, "a");
+   sd_b = _sd_for_host (td, "b");
+   mongoc_topology_description_handle_ismaster (
+      td, sd_a->id, _secondary_in_zone ("east"), 30, NULL);
+   mongoc_topology_description_handle_ismaster (
+      td, sd_b->id, _secondary_in_zone ("west"), 2, NULL);
+
+   for (i = 0; i < 50; i++) {
+      sd = _mongoc_topology_description_select_r (
+         td, MONGOC_SS_READ, prefs, 15, NULL, &rand_seed);
+      BSON_ASSERT (sd == sd_b);
+   }
+
+   mongoc_read_prefs_destroy (prefs);
+   mongoc_topology_destroy (topology);
+   mongoc_uri_destroy (uri);
+}
+
+
+static bson_t *
+_primary_reply (const char *hosts, int64_t date)
+{
+   return tmp_bson ("{'ok': 1, 'ismaster': true, 'setName': 'rs',"
+                    " 'hosts': %s, 'localTime': {'$date': %" PRId64 "},"
+                    " 'lastWrite': {'lastWriteDate': {'$date': %" PRId64 "}}}",
+                    hosts,
+                    date,
+                    date);
+}
+
+
+/* a reply that differs only in fields like "localTime" skips the SDAM
+ * transitions, but still updates the last write date and round trip time */
+static void
+test_ismaster_unchanged (void)
+{
+   mongoc_uri_t *uri;
+   mongoc_topology_t *topology;
+   mongoc_topology_description_t *td;
+   mongoc_server_description_t *sd_a;
+   mongoc_server_description_t *sd_b;
+   int64_t epoch;
+   bson_iter_t iter;
+
+   uri = mongoc_uri_new ("mongodb://a,b/?replicaSet=rs");
+   topology = mongoc_topology_new (uri, true /* single-threaded */);
+   td = &topology->description;
+
+   sd_a = _sd_for_host (td, "a");
+   sd_b = _sd_for_host (td, "b");
+   mongoc_topology_description_handle_ismaster (
+      td, sd_a->id, _primary_reply ("['a:27017', 'b:27017']", 1000), 10, NULL);
+   mongoc_topology_description_handle_ismaster (
+      td,
+      sd_b->id,
+      tmp_bson ("{'ok': 1, 'ismaster': false, 'secondary': true,"
+                " 'setName': 'rs', 'hosts': ['a:27017', 'b:27017']}"),
+      10,
+      NULL);
+
+   ASSERT_CMPINT (td->type, ==, MONGOC_TOPOLOGY_RS_WITH_PRIMARY);
+   ASSERT_CMPINT (sd_a->type, ==, MONGOC_SERVER_RS_PRIMARY);
+
+   /* the other server's first reply needs another full update of "a" */
+   mongoc_topology_description_handle_ismaster (
+      td, sd_a->id, _primary_reply ("['a:27017', 'b:27017']", 1000), 10, NULL);
+   epoch = td->sdam_epoch;
+   ASSERT_CMPINT64 (sd_a->sdam_epoch, ==, epoch);
+
+   BSON_ASSERT (_mongoc_server_description_ismaster_unchanged (
+      sd_a, _primary_reply ("['a:27017', 'b:27017']", 2000)));
+   BSON_ASSERT (!_mongoc_server_description_ismaster_unchanged (
+      sd_a, _primary_reply ("['a:27017', 'c:27017']", 2000)));
+   BSON_ASSERT (!_mongoc_server_description_ismaster_unchanged (
+      sd_a, tmp_bson ("{'ok': 1, 'msg': 'isdbgrid'}")));
+
+   mongoc_topology_description_handle_ismaster (
+      td, sd_a->id, _primary_reply ("['a:27017', 'b:27017']", 2000), 20, NULL);
+   ASSERT_CMPINT64 (td->sdam_epoch, ==, epoch);
+   ASSERT_CMPINT64 (sd_a->last_write_date_ms, ==, (int64_t) 2000);
+   ASSERT_CMPINT64 (sd_a->round_trip_time_msec, >, (int64_t) 10);
+   BSON_ASSERT (
+      bson_iter_init_find (&iter, &sd_a->last_is_master, "localTime"));
+   ASSERT_CMPINT64 (bson_iter_date_time (&iter), ==, (int64_t) 2000);
+   ASSERT_CMPSTR (sd_a->set_name, "rs");
+   ASSERT_CMPINT (sd_a->type, ==, MONGOC_SERVER_RS_PRIMARY);
+
+   /* a changed host list is processed, and "b" is removed */
+   mongoc_topology_description_handle_ismaster (
+      td, sd_a->id, _primary_reply ("['a:27017']", 3000), 10, NULL);
+   ASSERT_CMPINT64 (td->sdam_epoch, !=, epoch);
+   ASSERT_CMPSIZE_T (td->servers->items_len, ==, (size_t) 1);
+
+   mongoc_topology_destroy (topology);
+   mongoc_uri_destroy (uri);
+}
+
+
+typedef struct {
+   int n_server_changed;
+   int n_topology_changed;
+} sdam_counts_t;
+
+
+static void
+_count_server_changed (const mongoc_apm_server_changed_t *event)
+{
+   ((sdam_counts_t *) mongoc_apm_server_changed_get_context (event))
+      ->n_server_changed++;
+}
+
+
+static void
+_count_topology_changed (const mongoc_apm_topology_changed_t *event)
+{
+   ((sdam_counts_t *) mongoc_apm_topology_changed_get_context (event))
+      ->n_topology_changed++;
+}
+
+
+/* SDAM monitoring events are only sent when a description really changes */
+static void
+test_sdam_events_unchanged (void)
+{
+   mongoc_uri_t *uri;
+   mongoc_topology_t *topology;
+   mongoc_topology_description_t *td;
+   mongoc_server_description_t *sd_a;
+   sdam_counts_t counts = {0};
+
+   uri = mongoc_uri_new ("mongodb://a,b/?replicaSet=rs");
+   topology = mongoc_topology_new (uri, true /* single-threaded */);
+   td = &topology->description;
+   td->apm_callbacks.server_changed = _count_server_changed;
+   td->apm_callbacks.topology_changed = _count_topology_changed;
+   td->apm_context = &counts;
+
+   sd_a = _sd_for_host (td, "a");
+   mongoc_topology_description_handle_ismaster (
+      td, sd_a->id, _primary_reply ("['a:27017', 'b:27017']", 1000), 10, NULL);
+   ASSERT_CMPINT (counts.n_server_changed, ==, 1);
+   ASSERT_CMPINT (counts.n_topology_changed, ==, 1);
+
+   /* the usual heartbeat */
+   mongoc_topology_description_handle_ismaster (
+      td, sd_a->id, _primary_reply ("['a:27017', 'b:27017']", 2000), 20, NULL);
+   ASSERT_CMPINT (counts.n_server_changed, ==, 1);
+   ASSERT_CMPINT (counts.n_topology_changed, ==, 1);
+
+   /* a different reply, but no different description */
+   mongoc_topology_description_handle_ismaster (
+      td,
+      sd_a->id,
+      tmp_bson ("{'ok': 1, 'ismaster': true, 'setName': 'rs',"
+                " 'hosts': ['a:27017', 'b:27017'], 'foo': 1}"),
+      30,
+      NULL);
+   ASSERT_CMPINT (counts.n_server_changed, ==, 1);
+   ASSERT_CMPINT (counts.n_topology_changed, ==, 1);
+
+   /* "b" is removed */
+   mongoc_topology_description_handle_ismaster (
+      td, sd_a->id, _primary_reply ("['a:27017']", 3000), 10, NULL);
+   ASSERT_CMPINT (counts.n_server_changed, ==, 2);
+   ASSERT_CMPINT (counts.n_topology_changed, ==, 2);
+
+   mongoc_topology_destroy (topology);
+   mongoc_uri_destroy (uri);
+}
+
+
+/* servers are found by address in large topologies, such as hundreds of
+ * seeded mongos, and as servers are added and removed */
+static void
+test_many_hosts (void)
+{
+   mongoc_topology_description_t td;
+   mongoc_host_list_t *hosts = NULL;
+   mongoc_server_description_t *sd;
+   char address[64];
+   uint32_t ids[300];
+   uint32_t id;
+   int i;
+
+   mongoc_topology_description_init (&td, 10000);
+
+   for (i = 0; i < 300; i++) {
+      bson_snprintf (address, sizeof address, "host-%d:27017", i);
+      BSON_ASSERT (
+         mongoc_topology_description_add_server (&td, address, &ids[i]));
+   }
+
+   ASSERT_CMPSIZE_T (td.servers->items_len, ==, (size_t) 300);
+
+   /* addresses are case-insensitive */
+   for (i = 0; i < 300; i++) {
+      bson_snprintf (address, sizeof address, "HOST-%d:27017", i);
+      BSON_ASSERT (mongoc_topology_description_add_server (&td, address, &id));
+      ASSERT_CMPUINT32 (id, ==, ids[i]);
+   }
+
+   ASSERT_CMPSIZE_T (td.servers->items_len, ==, (size_t) 300);
+
+   /* keep the even hosts, in reverse order, and add a new one */
+   for (i = 0; i < 300; i += 2) {
+      bson_snprintf (address, sizeof address, "host-%d", i);
+      hosts = _mongoc_host_list_push (address, 27017, AF_UNSPEC, hosts);
+   }
+
+   hosts = _mongoc_host_list_push ("new-host", 27017, AF_UNSPEC, hosts);
+   _mongoc_topology_description_reconcile (&td, hosts);
+   ASSERT_CMPSIZE_T (td.servers->items_len, ==, (size_t) 151);
+
+   for (i = 0; i < 300; i++) {
+      sd = mongoc_topology_description_server_by_id (&td, ids[i], NULL);
+      if (i % 2) {
+         BSON_ASSERT (!sd);
+      } else {
+         BSON_ASSERT (sd);
+         bson_snprintf (address, sizeof address, "host-%d:27017", i);
+         ASSERT_CMPSTR (sd->connection_address, address);
+      }
+   }
+
+   /* lookups after removals still find the remaining servers */
+   BSON_ASSERT (
+      mongoc_topology_description_add_server (&td, "host-298:27017", &id));
+   ASSERT_CMPUINT32 (id, ==, ids[298]);
+   BSON_ASSERT (
+      mongoc_topology_description_add_server (&td, "host-1:27017", &id));
+   ASSERT_CMPUINT32 (id, >, ids[299]);
+   ASSERT_CMPSIZE_T (td.servers->items_len, ==, (size_t) 152);
+
+   _mongoc_host_list_destroy_all (hosts);
+   mongoc_topology_description_destroy (&td);
+}
+
+
 void
 test_topology_description_install (TestSuite *suite)
 {
@@ -148,4 +594,17 @@ test_topology_description_install (TestSuite *suite)
                       "/TopologyDescription/readable_writable/pooled",
                       test_has_readable_writable_server_pooled);
    TestSuite_Add (suite, "/TopologyDescription/get_servers", test_get_servers);
+   TestSuite_Add (
+      suite, "/TopologyDescription/select_cached", test_select_cached);
+   TestSuite_Add (
+      suite, "/TopologyDescription/select_load_aware", test_select_load_aware);
+   TestSuite_Add (
+      suite, "/TopologyDescription/select_local_zone", test_select_local_zone);
+   TestSuite_Add (suite,
+                  "/TopologyDescription/ismaster_unchanged",
+                  test_ismaster_unchanged);
+   TestSuite_Add (suite,
+                  "/TopologyDescription/sdam_events_unchanged",
+                  test_sdam_events_unchanged);
+   TestSuite_Add (suite, "/TopologyDescription/many_hosts", test_many_hosts);
 }
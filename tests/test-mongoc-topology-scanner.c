@@ -2,6 +2,8 @@
 
 #include "mongoc-util-private.h"
 #include "mongoc-client-private.h"
+#include "mongoc-dns-private.h"
+#include "mongoc-host-list-private.h"
 
 #include "TestSuite.h"
 #include "mock_server/mock-server.h"
@@ -402,6 +404,47 @@ test_topology_scanner_blocking_initiator (void)
 }
 
 
+
+static void
+test_topology_scanner_resolver (void)
+{
+   mongoc_dns_resolver_t *resolver;
+   mongoc_dns_request_t *request;
+   mongoc_host_list_t host;
+   struct addrinfo *results = NULL;
+   bson_error_t error;
+   int64_t expire_at;
+
+   _mongoc_dns_cache_clear ();
+   BSON_ASSERT (_mongoc_host_list_from_string (&host, "localhost:27017"));
+
+   resolver = _mongoc_dns_resolver_new ();
+   request = _mongoc_dns_resolver_lookup (resolver, &host);
+
+   expire_at = bson_get_monotonic_time () + 10 * 1000 * 1000;
+   while (!_mongoc_dns_request_take (request, &results, &error)) {
+      BSON_ASSERT (bson_get_monotonic_time () < expire_at);
+      _mongoc_usleep (1000);
+   }
+
+   ASSERT_OR_PRINT (results, error);
+   _mongoc_dns_request_destroy (request);
+   _mongoc_dns_results_free (results);
+
+   /* the answer is cached */
+   results = NULL;
+   BSON_ASSERT (_mongoc_dns_cache_get (&host, &results, &error));
+   BSON_ASSERT (results);
+   _mongoc_dns_results_free (results);
+
+   /* abandon a lookup that may be running */
+   _mongoc_dns_cache_clear ();
+   request = _mongoc_dns_resolver_lookup (resolver, &host);
+   _mongoc_dns_request_destroy (request);
+
+   _mongoc_dns_resolver_destroy (resolver);
+}
+
 void
 test_topology_scanner_install (TestSuite *suite)
 {
@@ -424,4 +467,6 @@ test_topology_scanner_install (TestSuite *suite)
    TestSuite_AddMockServerTest (suite,
                                 "/TOPOLOGY/blocking_initiator",
                                 test_topology_scanner_blocking_initiator);
+   TestSuite_Add (
+      suite, "/TOPOLOGY/scanner_resolver", test_topology_scanner_resolver);
 }
@@ -1042,6 +1042,68 @@ test_add_and_scan_failure (void)
 }
 
 
+/* pooled selection reads an immutable snapshot that outlives updates */
+static void
+test_topology_snapshot (void)
+{
+   mock_server_t *server;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_topology_t *topology;
+   mongoc_topology_snapshot_t *old_snapshot;
+   mongoc_topology_snapshot_t *snapshot;
+   mongoc_server_description_t *sd;
+   bson_error_t error;
+   uint32_t id;
+
+   server = mock_server_with_autoismaster (5);
+   mock_server_run (server);
+   pool = mongoc_client_pool_new (mock_server_get_uri (server));
+   client = mongoc_client_pool_pop (pool);
+   topology = client->topology;
+
+   id = mongoc_topology_select_server_id (
+      topology, MONGOC_SS_READ, NULL, &error);
+   ASSERT_OR_PRINT (id, error);
+
+   old_snapshot = _mongoc_topology_get_snapshot (topology);
+   BSON_ASSERT (old_snapshot);
+   BSON_ASSERT (old_snapshot == topology->snapshot);
+   sd = mongoc_topology_description_server_by_id (
+      &old_snapshot->description, id, NULL);
+   BSON_ASSERT (sd);
+   ASSERT_CMPSTR (mongoc_server_description_type (sd), "Standalone");
+
+   bson_set_error (
+      &error, MONGOC_ERROR_STREAM, MONGOC_ERROR_STREAM_SOCKET, "error");
+   mongoc_topology_invalidate_server (topology, id, &error);
+
+   /* a new snapshot is published, the old one is untouched */
+   snapshot = _mongoc_topology_get_snapshot (topology);
+   BSON_ASSERT (snapshot != old_snapshot);
+   sd = mongoc_topology_description_server_by_id (
+      &snapshot->description, id, NULL);
+   BSON_ASSERT (sd);
+   ASSERT_CMPSTR (mongoc_server_description_type (sd), "Unknown");
+   _mongoc_topology_snapshot_release (snapshot);
+
+   sd = mongoc_topology_description_server_by_id (
+      &old_snapshot->description, id, NULL);
+   BSON_ASSERT (sd);
+   ASSERT_CMPSTR (mongoc_server_description_type (sd), "Standalone");
+   _mongoc_topology_snapshot_release (old_snapshot);
+
+   /* selection waits for the rescan and finds the server again */
+   ASSERT_OR_PRINT (mongoc_topology_select_server_id (
+                       topology, MONGOC_SS_READ, NULL, &error),
+                    error);
+
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mock_server_destroy (server);
+}
+
+
 typedef struct {
    int n_started;
    int n_succeeded;
@@ -1364,6 +1426,570 @@ test_ismaster_retry_pooled_timeout_fail (void)
 }
 
 
+static void
+test_server_counters (void)
+{
+   mock_server_t *server;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+   mongoc_server_description_t *sd;
+   mongoc_server_counters_t counters;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MAX_STALENESS);
+   mock_server_run (server);
+   pool = mongoc_client_pool_new (mock_server_get_uri (server));
+   client = mongoc_client_pool_pop (pool);
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   mock_server_replies_simple (request, "{'ok': 0, 'errmsg': 'failed'}");
+   request_destroy (request);
+   BSON_ASSERT (!future_get_bool (future));
+   future_destroy (future);
+
+   sd = mongoc_client_get_server_description (client, 1);
+   BSON_ASSERT (sd);
+   BSON_ASSERT (mongoc_server_description_get_counters (sd, &counters));
+
+   /* at least the connection's ismaster handshake and two pings */
+   ASSERT_CMPINT64 (counters.ops, >=, (int64_t) 3);
+   ASSERT_CMPINT64 (counters.egress_bytes, >, (int64_t) 0);
+   ASSERT_CMPINT64 (counters.ingress_bytes, >, (int64_t) 0);
+   ASSERT_CMPINT64 (counters.errors, ==, (int64_t) 1);
+   ASSERT_CMPINT64 (counters.timeouts, ==, (int64_t) 0);
+   ASSERT_CMPINT64 (counters.connections, ==, (int64_t) 1);
+   ASSERT_CMPINT64 (counters.round_trip_time_msec, >=, (int64_t) 0);
+
+   mongoc_server_description_destroy (sd);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mock_server_destroy (server);
+}
+
+
+/* send a ping the server doesn't answer, it times out */
+static void
+_ping_times_out (mongoc_client_t *client, mock_server_t *server)
+{
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   BSON_ASSERT (!future_get_bool (future));
+   ASSERT_ERROR_CONTAINS (error,
+                          MONGOC_ERROR_STREAM,
+                          MONGOC_ERROR_STREAM_SOCKET,
+                          "socket error or timeout");
+   future_destroy (future);
+   request_destroy (request);
+}
+
+
+static void
+test_circuit_breaker (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_t *client;
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "socketTimeoutMS", 100);
+   mongoc_uri_set_option_as_int32 (uri, "circuitBreakerThreshold", 2);
+   mongoc_uri_set_option_as_int32 (uri, "circuitBreakerOpenMS", 1000);
+   client = mongoc_client_new_from_uri (uri);
+   ASSERT_CMPINT (client->topology->breaker_threshold, ==, 2);
+   ASSERT_CMPINT64 (client->topology->breaker_open_msec, ==, (int64_t) 1000);
+
+   /* a reply in between resets the count of errors in a row */
+   _ping_times_out (client, server);
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   mock_server_replies_simple (request, "{'ok': 0, 'errmsg': 'failed'}");
+   request_destroy (request);
+   BSON_ASSERT (!future_get_bool (future));
+   future_destroy (future);
+
+   /* two timeouts in a row open the breaker */
+   _ping_times_out (client, server);
+   _ping_times_out (client, server);
+
+   /* the server is Unknown despite answering isMaster, fail fast */
+   BSON_ASSERT (!mongoc_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, &error));
+   ASSERT_CMPINT (error.domain, ==, MONGOC_ERROR_SERVER_SELECTION);
+   ASSERT_CMPINT (error.code, ==, MONGOC_ERROR_SERVER_SELECTION_FAILURE);
+
+   /* after circuitBreakerOpenMS the server is probed and selected again */
+   _mongoc_usleep (1100 * 1000);
+   future = future_client_command_simple (
+      client, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+
+   mongoc_client_destroy (client);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+static void
+test_in_flight_limit (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client_a;
+   mongoc_client_t *client_b;
+   future_t *future_a;
+   future_t *future_b;
+   request_t *request;
+   bson_error_t error_a;
+   bson_error_t error_b;
+
+   server = mock_server_with_autoismaster (WIRE_VERSION_MIN);
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, "maxInFlightPerServer", 1);
+   mongoc_uri_set_option_as_int32 (uri, "serverSelectionTimeoutMS", 500);
+   pool = mongoc_client_pool_new (uri);
+   client_a = mongoc_client_pool_pop (pool);
+   client_b = mongoc_client_pool_pop (pool);
+   ASSERT_CMPINT (client_a->topology->max_in_flight, ==, 1);
+
+   /* client_b waits until client_a's command finishes */
+   future_a = future_client_command_simple (
+      client_a, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, &error_a);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   future_b = future_client_command_simple (
+      client_b, "db", tmp_bson ("{'ping': 2}"), NULL, NULL, &error_b);
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future_a), error_a);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 2}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future_b), error_b);
+   future_destroy (future_a);
+   future_destroy (future_b);
+
+   /* it gives up after serverSelectionTimeoutMS */
+   future_a = future_client_command_simple (
+      client_a, "db", tmp_bson ("{'ping': 1}"), NULL, NULL, &error_a);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   BSON_ASSERT (!mongoc_client_command_simple (
+      client_b, "db", tmp_bson ("{'ping': 2}"), NULL, NULL, &error_b));
+   ASSERT_ERROR_CONTAINS (error_b,
+                          MONGOC_ERROR_CLIENT,
+                          MONGOC_ERROR_CLIENT_SERVER_BUSY,
+                          "Timed out after 500ms");
+
+   /* with inFlightFailFast it fails at once */
+   client_b->topology->in_flight_fail_fast = true;
+   BSON_ASSERT (!mongoc_client_command_simple (
+      client_b, "db", tmp_bson ("{'ping': 2}"), NULL, NULL, &error_b));
+   ASSERT_ERROR_CONTAINS (error_b,
+                          MONGOC_ERROR_CLIENT,
+                          MONGOC_ERROR_CLIENT_SERVER_BUSY,
+                          "already has 1 operations in flight");
+
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future_a), error_a);
+   future_destroy (future_a);
+
+   /* the busy server wasn't marked Unknown */
+   future_b = future_client_command_simple (
+      client_b, "db", tmp_bson ("{'ping': 2}"), NULL, NULL, &error_b);
+   request = mock_server_receives_command (
+      server, "db", MONGOC_QUERY_SLAVE_OK, "{'ping': 2}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future_b), error_b);
+   future_destroy (future_b);
+
+   mongoc_client_pool_push (pool, client_a);
+   mongoc_client_pool_push (pool, client_b);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+/* the background thread scans every 500ms, not heartbeatFrequencyMS, while
+ * there's no primary and for a while after a server changes type */
+static void
+test_adaptive_heartbeat (void *ctx)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   char *secondary;
+   char *primary;
+   request_t *request;
+   int64_t t;
+   int64_t changed;
+
+   server = mock_server_new ();
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, MONGOC_URI_HEARTBEATFREQUENCYMS, 60000);
+   mongoc_uri_set_option_as_utf8 (uri, MONGOC_URI_REPLICASET, "rs");
+   pool = mongoc_client_pool_new (uri);
+
+   secondary = bson_strdup_printf ("{'ok': 1, 'ismaster': false,"
+                                   " 'secondary': true, 'setName': 'rs',"
+                                   " 'hosts': ['%s']}",
+                                   mock_server_get_host_and_port (server));
+   primary = bson_strdup_printf ("{'ok': 1, 'ismaster': true,"
+                                 " 'setName': 'rs', 'hosts': ['%s']}",
+                                 mock_server_get_host_and_port (server));
+
+   /* starts the background thread */
+   client = mongoc_client_pool_pop (pool);
+
+   /* no primary: scan again soon */
+   request = mock_server_receives_ismaster (server);
+   mock_server_replies_simple (request, secondary);
+   request_destroy (request);
+   t = bson_get_monotonic_time ();
+   request = mock_server_receives_ismaster (server);
+   ASSERT_CMPINT64 (bson_get_monotonic_time () - t, <, (int64_t) 2000 * 1000);
+
+   /* the secondary became primary, keep scanning quickly for a while */
+   mock_server_replies_simple (request, primary);
+   request_destroy (request);
+   changed = bson_get_monotonic_time ();
+   do {
+      request = mock_server_receives_ismaster (server);
+      ASSERT_CMPINT64 (bson_get_monotonic_time () - changed,
+                       <,
+                       (int64_t) (MONGOC_TOPOLOGY_UNSTABLE_MS + 2000) * 1000);
+      mock_server_replies_simple (request, primary);
+      request_destroy (request);
+   } while (bson_get_monotonic_time () - changed <
+            (int64_t) MONGOC_TOPOLOGY_UNSTABLE_MS * 1000);
+
+   /* then back off to heartbeatFrequencyMS */
+   mock_server_set_request_timeout_msec (server, 1500);
+   BSON_ASSERT (!mock_server_receives_ismaster (server));
+   mock_server_set_request_timeout_msec (server, get_future_timeout_ms ());
+
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+   bson_free (secondary);
+   bson_free (primary);
+}
+
+
+/* an unresponsive server doesn't delay the checks of the others */
+static void
+test_independent_server_checks (void)
+{
+   mock_server_t *server_a;
+   mock_server_t *server_b;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   char *primary;
+   request_t *request;
+   request_t *hung;
+   int64_t t;
+   int i;
+
+   server_a = mock_server_new ();
+   server_b = mock_server_new ();
+   mock_server_run (server_a);
+   mock_server_run (server_b);
+   uri = mongoc_uri_copy (mock_server_get_uri (server_a));
+   mongoc_uri_set_option_as_int32 (uri, MONGOC_URI_HEARTBEATFREQUENCYMS, 500);
+   mongoc_uri_set_option_as_int32 (uri, MONGOC_URI_CONNECTTIMEOUTMS, 10000);
+   mongoc_uri_set_option_as_utf8 (uri, MONGOC_URI_REPLICASET, "rs");
+   pool = mongoc_client_pool_new (uri);
+
+   primary = bson_strdup_printf ("{'ok': 1, 'ismaster': true,"
+                                 " 'setName': 'rs', 'hosts': ['%s', '%s']}",
+                                 mock_server_get_host_and_port (server_a),
+                                 mock_server_get_host_and_port (server_b));
+
+   /* starts the background thread */
+   client = mongoc_client_pool_pop (pool);
+
+   request = mock_server_receives_ismaster (server_a);
+   mock_server_replies_simple (request, primary);
+   request_destroy (request);
+
+   /* B is discovered and checked, but never replies */
+   hung = mock_server_receives_ismaster (server_b);
+   BSON_ASSERT (hung);
+
+   /* meanwhile A is checked every heartbeatFrequencyMS */
+   for (i = 0; i < 2; i++) {
+      t = bson_get_monotonic_time ();
+      request = mock_server_receives_ismaster (server_a);
+      ASSERT_CMPINT64 (
+         bson_get_monotonic_time () - t, <, (int64_t) 2000 * 1000);
+      mock_server_replies_simple (request, primary);
+      request_destroy (request);
+   }
+
+   request_destroy (hung);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server_b);
+   mock_server_destroy (server_a);
+   bson_free (primary);
+}
+
+
+/* with serverSelectionEager a single-threaded client doesn't wait for an
+ * unresponsive server before selecting a suitable one */
+static void
+test_server_selection_eager (void)
+{
+   mock_server_t *server_a;
+   mock_server_t *server_b;
+   mongoc_uri_t *uri;
+   mongoc_client_t *client;
+   char *primary;
+   future_t *future;
+   request_t *request;
+   request_t *hung;
+   bson_error_t error;
+   int64_t t;
+
+   server_a = mock_server_new ();
+   server_b = mock_server_new ();
+   mock_server_run (server_a);
+   mock_server_run (server_b);
+   uri = mongoc_uri_copy (mock_server_get_uri (server_a));
+   mongoc_uri_set_option_as_int32 (uri, MONGOC_URI_CONNECTTIMEOUTMS, 10000);
+   mongoc_uri_set_option_as_utf8 (uri, MONGOC_URI_REPLICASET, "rs");
+   mongoc_uri_set_option_as_bool (uri, MONGOC_URI_SERVERSELECTIONEAGER, true);
+   client = mongoc_client_new_from_uri (uri);
+   BSON_ASSERT (client->topology->server_selection_eager);
+
+   primary = bson_strdup_printf ("{'ok': 1, 'ismaster': true,"
+                                 " 'setName': 'rs', 'hosts': ['%s', '%s']}",
+                                 mock_server_get_host_and_port (server_a),
+                                 mock_server_get_host_and_port (server_b));
+
+   t = bson_get_monotonic_time ();
+   future = future_client_command_simple (
+      client, "admin", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+
+   request = mock_server_receives_ismaster (server_a);
+   mock_server_replies_simple (request, primary);
+   request_destroy (request);
+
+   /* B is discovered and checked, but never replies */
+   hung = mock_server_receives_ismaster (server_b);
+   BSON_ASSERT (hung);
+
+   /* the primary is selected without waiting for B */
+   request = mock_server_receives_command (
+      server_a, "admin", MONGOC_QUERY_NONE, "{'ping': 1}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   ASSERT_CMPINT64 (bson_get_monotonic_time () - t, <, (int64_t) 5000 * 1000);
+   future_destroy (future);
+
+   request_destroy (hung);
+   mongoc_client_destroy (client);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server_b);
+   mock_server_destroy (server_a);
+   bson_free (primary);
+}
+
+
+static int
+_n_selectors (mongoc_topology_t *topology)
+{
+   mongoc_topology_selector_t *selector;
+   int n = 0;
+
+   mongoc_mutex_lock (&topology->mutex);
+   for (selector = topology->selectors; selector; selector = selector->next) {
+      n++;
+   }
+   mongoc_mutex_unlock (&topology->mutex);
+
+   return n;
+}
+
+
+/* pooled threads waiting in server selection are grouped by the kind of
+ * server they need, and an update wakes only the groups it satisfies */
+static void
+test_server_selection_wake_selectors (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_read_prefs_t *secondary;
+   future_t *write_future;
+   future_t *read_future;
+   request_t *request;
+   bson_error_t write_error;
+   bson_error_t read_error;
+   mongoc_server_description_t *sd;
+   char *reply;
+
+   server = mock_server_new ();
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_utf8 (uri, MONGOC_URI_REPLICASET, "rs");
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+   secondary = mongoc_read_prefs_new (MONGOC_READ_SECONDARY);
+
+   write_future = future_topology_select (
+      client->topology, MONGOC_SS_WRITE, NULL, &write_error);
+   read_future = future_topology_select (
+      client->topology, MONGOC_SS_READ, secondary, &read_error);
+
+   /* one group needs the primary, the other a secondary */
+   WAIT_UNTIL (_n_selectors (client->topology) == 2);
+
+   reply = bson_strdup_printf ("{'ok': 1, 'ismaster': false,"
+                               " 'secondary': true, 'setName': 'rs',"
+                               " 'minWireVersion': 2, 'maxWireVersion': 5,"
+                               " 'hosts': ['%s']}",
+                               mock_server_get_host_and_port (server));
+   request = mock_server_receives_ismaster (server);
+   mock_server_replies_simple (request, reply);
+   request_destroy (request);
+   bson_free (reply);
+
+   sd = future_get_mongoc_server_description_ptr (read_future);
+   ASSERT_OR_PRINT (sd, read_error);
+   mongoc_server_description_destroy (sd);
+   future_destroy (read_future);
+
+   /* the writer wasn't woken, it still waits for a primary */
+   BSON_ASSERT (!future_wait_max (write_future, 100));
+   ASSERT_CMPINT (_n_selectors (client->topology), ==, 1);
+
+   reply = bson_strdup_printf ("{'ok': 1, 'ismaster': true, 'setName': 'rs',"
+                               " 'minWireVersion': 2, 'maxWireVersion': 5,"
+                               " 'hosts': ['%s']}",
+                               mock_server_get_host_and_port (server));
+   request = mock_server_receives_ismaster (server);
+   mock_server_replies_simple (request, reply);
+   request_destroy (request);
+   bson_free (reply);
+
+   sd = future_get_mongoc_server_description_ptr (write_future);
+   ASSERT_OR_PRINT (sd, write_error);
+   mongoc_server_description_destroy (sd);
+   future_destroy (write_future);
+   ASSERT_CMPINT (_n_selectors (client->topology), ==, 0);
+
+   mongoc_read_prefs_destroy (secondary);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
+/* with heartbeatPiggyback a pooled client checks a server on its own
+ * connection, without resending its client metadata */
+static void
+test_heartbeat_piggyback (void)
+{
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   future_t *future;
+   request_t *request;
+   bson_error_t error;
+
+   server = mock_server_new ();
+   mock_server_run (server);
+   uri = mongoc_uri_copy (mock_server_get_uri (server));
+   mongoc_uri_set_option_as_int32 (uri, MONGOC_URI_HEARTBEATFREQUENCYMS, 500);
+   mongoc_uri_set_option_as_bool (uri, MONGOC_URI_HEARTBEATPIGGYBACK, true);
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+   BSON_ASSERT (client->topology->heartbeat_piggyback);
+
+   future = future_client_command_simple (
+      client, "admin", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+
+   /* the background thread's check */
+   request = mock_server_receives_ismaster (server);
+   ASSERT (bson_has_field (request_get_doc (request, 0), "client"));
+   mock_server_replies_simple (request, "{'ok': 1, 'ismaster': true}");
+   request_destroy (request);
+
+   /* the application connection's handshake */
+   request = mock_server_receives_ismaster (server);
+   ASSERT (bson_has_field (request_get_doc (request, 0), "client"));
+   mock_server_replies_simple (request, "{'ok': 1, 'ismaster': true}");
+   request_destroy (request);
+
+   request = mock_server_receives_command (
+      server, "admin", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+
+   /* past heartbeatFrequencyMS, the next operation checks the server first */
+   _mongoc_usleep (600 * 1000);
+   future = future_client_command_simple (
+      client, "admin", tmp_bson ("{'ping': 1}"), NULL, NULL, &error);
+
+   request = mock_server_receives_ismaster (server);
+   ASSERT (!bson_has_field (request_get_doc (request, 0), "client"));
+   mock_server_replies_simple (request, "{'ok': 1, 'ismaster': true}");
+   request_destroy (request);
+
+   request = mock_server_receives_command (
+      server, "admin", MONGOC_QUERY_SLAVE_OK, "{'ping': 1}");
+   mock_server_replies_ok_and_destroys (request);
+   ASSERT_OR_PRINT (future_get_bool (future), error);
+   future_destroy (future);
+
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_destroy (server);
+}
+
+
 void
 test_topology_install (TestSuite *suite)
 {
@@ -1396,6 +2022,8 @@ test_topology_install (TestSuite *suite)
    TestSuite_AddLive (suite,
                       "/Topology/invalidate_server/pooled",
                       test_topology_invalidate_server_pooled);
+   TestSuite_AddMockServerTest (
+      suite, "/Topology/snapshot", test_topology_snapshot);
    TestSuite_AddFull (suite,
                       "/Topology/invalid_cluster_node",
                       test_invalid_cluster_node,
@@ -1470,4 +2098,26 @@ test_topology_install (TestSuite *suite)
    TestSuite_AddMockServerTest (suite,
                                 "/Topology/ismaster_retry/pooled/timeout/fail",
                                 test_ismaster_retry_pooled_timeout_fail);
+   TestSuite_AddMockServerTest (
+      suite, "/Topology/server_counters", test_server_counters);
+   TestSuite_AddMockServerTest (
+      suite, "/Topology/circuit_breaker", test_circuit_breaker);
+   TestSuite_AddMockServerTest (
+      suite, "/Topology/in_flight_limit", test_in_flight_limit);
+   TestSuite_AddFull (suite,
+                      "/Topology/adaptive_heartbeat",
+                      test_adaptive_heartbeat,
+                      NULL,
+                      NULL,
+                      test_framework_skip_if_slow);
+   TestSuite_AddMockServerTest (suite,
+                                "/Topology/independent_server_checks",
+                                test_independent_server_checks);
+   TestSuite_AddMockServerTest (
+      suite, "/Topology/server_selection_eager", test_server_selection_eager);
+   TestSuite_AddMockServerTest (suite,
+                                "/Topology/server_selection_wake_selectors",
+                                test_server_selection_wake_selectors);
+   TestSuite_AddMockServerTest (
+      suite, "/Topology/heartbeat_piggyback", test_heartbeat_piggyback);
 }
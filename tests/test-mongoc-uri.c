@@ -1076,6 +1076,162 @@ test_mongoc_uri_compressors (void)
    mongoc_uri_destroy (uri);
 
 #endif
+
+#ifdef MONGOC_ENABLE_COMPRESSION_ZSTD
+   uri = mongoc_uri_new (
+      "mongodb://localhost/?compressors=zstd&zstdCompressionLevel=19");
+   ASSERT (bson_has_field (mongoc_uri_get_compressors (uri), "zstd"));
+   ASSERT_CMPINT32 (
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_ZSTDCOMPRESSIONLEVEL, 1),
+      ==,
+      19);
+   mongoc_uri_destroy (uri);
+
+   capture_logs (true);
+   uri = mongoc_uri_new (
+      "mongodb://localhost/?compressors=zstd&zstdCompressionLevel=23");
+   ASSERT_CAPTURED_LOG (
+      "mongoc_uri_set_compressors",
+      MONGOC_LOG_LEVEL_WARNING,
+      "Invalid \"zstdcompressionlevel\" of 23: must be -1 or between 1 and 22");
+   mongoc_uri_destroy (uri);
+#endif
+
+   uri = mongoc_uri_new (
+      "mongodb://localhost/?compressionMinSize=512&compressionAdaptive=true");
+   ASSERT_CMPINT32 (
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_COMPRESSIONMINSIZE, 0),
+      ==,
+      512);
+   ASSERT (mongoc_uri_get_option_as_bool (
+      uri, MONGOC_URI_COMPRESSIONADAPTIVE, false));
+   mongoc_uri_destroy (uri);
+
+   capture_logs (true);
+   uri = mongoc_uri_new ("mongodb://localhost/?compressionMinSize=-1");
+   ASSERT_CAPTURED_LOG ("mongoc_uri_set_option_as_int32",
+                        MONGOC_LOG_LEVEL_WARNING,
+                        "Invalid \"compressionminsize\" of -1: must be at "
+                        "least 0");
+   mongoc_uri_destroy (uri);
+
+   uri = mongoc_uri_new ("mongodb://localhost/?compressionMinRTTMS=20"
+                         "&compressionOutsideZone=true"
+                         "&compressionHosts=*.east.example.com,10.1.*");
+   ASSERT_CMPINT32 (
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_COMPRESSIONMINRTTMS, 0),
+      ==,
+      20);
+   ASSERT (mongoc_uri_get_option_as_bool (
+      uri, MONGOC_URI_COMPRESSIONOUTSIDEZONE, false));
+   ASSERT_CMPSTR (
+      mongoc_uri_get_option_as_utf8 (uri, MONGOC_URI_COMPRESSIONHOSTS, NULL),
+      "*.east.example.com,10.1.*");
+   mongoc_uri_destroy (uri);
+
+   capture_logs (true);
+   uri = mongoc_uri_new ("mongodb://localhost/?compressionMinRTTMS=-1");
+   ASSERT_CAPTURED_LOG ("mongoc_uri_set_option_as_int32",
+                        MONGOC_LOG_LEVEL_WARNING,
+                        "Invalid \"compressionminrttms\" of -1: must be at "
+                        "least 0");
+   mongoc_uri_destroy (uri);
+}
+
+
+static void
+test_mongoc_uri_standby_connections (void)
+{
+   mongoc_uri_t *uri;
+
+   uri = mongoc_uri_new ("mongodb://localhost/?standbyConnections=2");
+   ASSERT_CMPINT32 (
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_STANDBYCONNECTIONS, 0),
+      ==,
+      2);
+   mongoc_uri_destroy (uri);
+
+   capture_logs (true);
+   uri = mongoc_uri_new ("mongodb://localhost/?standbyConnections=-1");
+   ASSERT_CAPTURED_LOG ("mongoc_uri_set_option_as_int32",
+                        MONGOC_LOG_LEVEL_WARNING,
+                        "Invalid \"standbyconnections\" of -1: must be at "
+                        "least 0");
+   mongoc_uri_destroy (uri);
+}
+
+
+static void
+test_mongoc_uri_tcp_options (void)
+{
+   mongoc_uri_t *uri;
+   mongoc_socket_opts_t opts;
+
+   uri = mongoc_uri_new ("mongodb://localhost/?tcpReceiveBufferSize=1048576"
+                         "&tcpKeepAliveIdleSecs=60&tcpNoDelay=false"
+                         "&tcpQuickAck=true&tcpBusyPollUsecs=50"
+                         "&tcpZeroCopyMinSize=65536&tcpFastOpen=true");
+   _mongoc_uri_get_socket_opts (uri, &opts);
+   ASSERT_CMPINT32 (opts.rcvbuf, ==, 1048576);
+   ASSERT_CMPINT32 (opts.sndbuf, ==, 0);
+   ASSERT_CMPINT32 (opts.keepidle, ==, 60);
+   ASSERT_CMPINT32 (opts.keepintvl, ==, 0);
+   ASSERT_CMPINT32 (opts.busy_poll_usec, ==, 50);
+   ASSERT_CMPINT32 (opts.zerocopy_min_size, ==, 65536);
+   BSON_ASSERT (!opts.nodelay);
+   BSON_ASSERT (opts.quickack);
+   BSON_ASSERT (opts.fastopen);
+   mongoc_uri_destroy (uri);
+
+   capture_logs (true);
+   uri = mongoc_uri_new ("mongodb://localhost/?tcpSendBufferSize=-1");
+   ASSERT_CAPTURED_LOG ("mongoc_uri_set_option_as_int32",
+                        MONGOC_LOG_LEVEL_WARNING,
+                        "Invalid \"tcpsendbuffersize\" of -1: must be at "
+                        "least 0");
+   mongoc_uri_destroy (uri);
+}
+
+
+static void
+test_mongoc_uri_buffer_options (void)
+{
+   mongoc_uri_t *uri;
+
+   uri = mongoc_uri_new (
+      "mongodb://localhost/?streamBufferSize=4096&streamBufferMaxSize=1048576");
+   ASSERT_CMPINT32 (
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_STREAMBUFFERSIZE, 0),
+      ==,
+      4096);
+   ASSERT_CMPINT32 (
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_STREAMBUFFERMAXSIZE, 0),
+      ==,
+      1048576);
+   mongoc_uri_destroy (uri);
+
+   capture_logs (true);
+   uri = mongoc_uri_new ("mongodb://localhost/?streamBufferSize=0");
+   ASSERT_CAPTURED_LOG ("mongoc_uri_set_option_as_int32",
+                        MONGOC_LOG_LEVEL_WARNING,
+                        "Invalid \"streambuffersize\" of 0: must be at "
+                        "least 1");
+   mongoc_uri_destroy (uri);
+
+   uri = mongoc_uri_new ("mongodb://localhost/?replyBufferMaxSize=1024");
+   ASSERT_CMPINT32 (
+      mongoc_uri_get_option_as_int32 (uri, MONGOC_URI_REPLYBUFFERMAXSIZE, 0),
+      ==,
+      1024);
+   mongoc_uri_destroy (uri);
+
+   capture_logs (true);
+   uri = mongoc_uri_new ("mongodb://localhost/?replyBufferMaxSize=-1");
+   ASSERT_CAPTURED_LOG ("mongoc_uri_set_option_as_int32",
+                        MONGOC_LOG_LEVEL_WARNING,
+                        "Invalid \"replybuffermaxsize\" of -1: must be at "
+                        "least 0");
+   mongoc_uri_destroy (uri);
 }
 
 static void
@@ -1773,6 +1929,10 @@ test_uri_install (TestSuite *suite)
    TestSuite_Add (
       suite, "/Uri/new_for_host_port", test_mongoc_uri_new_for_host_port);
    TestSuite_Add (suite, "/Uri/compressors", test_mongoc_uri_compressors);
+   TestSuite_Add (
+      suite, "/Uri/standby_connections", test_mongoc_uri_standby_connections);
+   TestSuite_Add (suite, "/Uri/tcp_options", test_mongoc_uri_tcp_options);
+   TestSuite_Add (suite, "/Uri/buffer_options", test_mongoc_uri_buffer_options);
    TestSuite_Add (suite, "/Uri/unescape", test_mongoc_uri_unescape);
    TestSuite_Add (suite, "/Uri/read_prefs", test_mongoc_uri_read_prefs);
    TestSuite_Add (suite, "/Uri/read_concern", test_mongoc_uri_read_concern);
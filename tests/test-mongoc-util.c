@@ -47,9 +47,60 @@ test_rand_simple (void)
 }
 
 
+/* the sign of comparing doc's "a" with its "b", or 2 if incomparable */
+static int
+_bson_iter_cmp (const char *json)
+{
+   bson_t *doc;
+   bson_iter_t a;
+   bson_iter_t b;
+   int cmp;
+
+   doc = tmp_bson (json);
+   BSON_ASSERT (bson_iter_init_find (&a, doc, "a"));
+   BSON_ASSERT (bson_iter_init_find (&b, doc, "b"));
+
+   if (!_mongoc_bson_iter_cmp (&a, &b, &cmp)) {
+      return 2;
+   }
+
+   return cmp < 0 ? -1 : cmp > 0 ? 1 : 0;
+}
+
+
+static void
+test_bson_iter_cmp (void)
+{
+   /* numbers compare by value across types */
+   ASSERT_CMPINT (_bson_iter_cmp ("{'a': 1, 'b': 1.0}"), ==, 0);
+   ASSERT_CMPINT (
+      _bson_iter_cmp ("{'a': {'$numberLong': '2'}, 'b': 1.5}"), ==, 1);
+
+   /* types in the server's order */
+   ASSERT_CMPINT (_bson_iter_cmp ("{'a': null, 'b': 0}"), ==, -1);
+   ASSERT_CMPINT (_bson_iter_cmp ("{'a': 'x', 'b': 100}"), ==, 1);
+   ASSERT_CMPINT (_bson_iter_cmp ("{'a': {'$minKey': 1}, 'b': null}"), ==, -1);
+   ASSERT_CMPINT (_bson_iter_cmp ("{'a': {'$maxKey': 1}, 'b': true}"), ==, 1);
+
+   /* strings by bytes, documents element by element */
+   ASSERT_CMPINT (_bson_iter_cmp ("{'a': 'ab', 'b': 'abc'}"), ==, -1);
+   ASSERT_CMPINT (_bson_iter_cmp ("{'a': {'x': 2}, 'b': {'x': 1}}"), ==, 1);
+   ASSERT_CMPINT (_bson_iter_cmp ("{'a': [1, 2], 'b': [1, 2]}"), ==, 0);
+   ASSERT_CMPINT (_bson_iter_cmp ("{'a': [1], 'b': [1, 0]}"), ==, -1);
+
+   ASSERT_CMPINT (_bson_iter_cmp ("{'a': false, 'b': true}"), ==, -1);
+
+   /* not compared */
+   ASSERT_CMPINT (_bson_iter_cmp ("{'a': {'$numberDecimal': '1'}, 'b': 1}"),
+                  ==,
+                  2);
+}
+
+
 void
 test_util_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Util/command_name", test_command_name);
    TestSuite_Add (suite, "/Util/rand_simple", test_rand_simple);
+   TestSuite_Add (suite, "/Util/bson_iter_cmp", test_bson_iter_cmp);
 }
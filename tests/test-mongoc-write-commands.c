@@ -265,6 +265,199 @@ test_bypass_validation (void *context)
    mongoc_client_destroy (client);
 }
 
+/* a batch's result merges into the bulk's at an offset, and the reply's
+ * arrays are built from both at the end */
+static void
+test_merge_result (void)
+{
+   mongoc_write_command_t command = {0};
+   mongoc_write_result_t batch;
+   mongoc_write_result_t result;
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_t reply;
+
+   command.type = MONGOC_WRITE_COMMAND_UPDATE;
+
+   _mongoc_write_result_init (&batch);
+   _mongoc_write_result_merge (
+      &batch,
+      &command,
+      tmp_bson ("{'ok': 1, 'n': 2, 'nModified': 0,"
+                " 'upserted': [{'index': 1, '_id': 'a'}],"
+                " 'writeErrors': [{'index': 0, 'code': 11000,"
+                "                  'errmsg': 'dupe'}]}"),
+      10);
+
+   _mongoc_write_result_init (&result);
+   BSON_ASSERT (bson_iter_init_find (&iter, tmp_bson ("{'_id': 'b'}"), "_id"));
+   _mongoc_write_result_append_upsert (&result, 3, bson_iter_value (&iter));
+   _mongoc_write_result_merge_result (&result, &batch, 100);
+   _mongoc_write_result_destroy (&batch);
+
+   ASSERT (!_mongoc_write_result_complete (&result,
+                                           MONGOC_ERROR_API_VERSION_2,
+                                           NULL /* write concern */,
+                                           MONGOC_ERROR_COMMAND,
+                                           &reply,
+                                           &error));
+   ASSERT_ERROR_CONTAINS (error, MONGOC_ERROR_SERVER, 11000, "dupe");
+   ASSERT_MATCH (&reply,
+                 "{'nMatched': 1,"
+                 " 'nUpserted': 1,"
+                 " 'upserted': [{'index': 3, '_id': 'b'},"
+                 "              {'index': 111, '_id': 'a'}],"
+                 " 'writeErrors': [{'index': 110, 'code': 11000,"
+                 "                  'errmsg': 'dupe'}]}");
+   ASSERT (!bson_has_field (&reply, "upserted.2"));
+   ASSERT (!bson_has_field (&reply, "writeErrors.1"));
+
+   bson_destroy (&reply);
+   _mongoc_write_result_destroy (&result);
+}
+
+
+/* the ObjectId counter, bytes 9 to 11 */
+static uint32_t
+_oid_counter (const bson_t *doc)
+{
+   bson_iter_t iter;
+   const bson_oid_t *oid;
+
+   BSON_ASSERT (bson_iter_init_find (&iter, doc, "_id"));
+   BSON_ASSERT (BSON_ITER_HOLDS_OID (&iter));
+   oid = bson_iter_oid (&iter);
+
+   return ((uint32_t) oid->bytes[9] << 16) | ((uint32_t) oid->bytes[10] << 8) |
+          (uint32_t) oid->bytes[11];
+}
+
+
+static void
+test_oid_context (void)
+{
+   mongoc_bulk_write_flags_t write_flags = MONGOC_BULK_WRITE_FLAGS_INIT;
+   mongoc_write_command_t command;
+   mongoc_client_t *client;
+   bson_context_t *context;
+   uint32_t len;
+   bson_t first;
+   bson_t second;
+
+   client = mongoc_client_new ("mongodb://server");
+   context = _mongoc_client_get_oid_context (client);
+   ASSERT (context);
+   ASSERT (context == _mongoc_client_get_oid_context (client));
+
+   _mongoc_write_command_init_insert (&command, NULL, write_flags, 1, false);
+   command.oid_context = context;
+   _mongoc_write_command_insert_append (&command, tmp_bson ("{'x': 1}"));
+   _mongoc_write_command_insert_append (&command, tmp_bson ("{'x': 2}"));
+   ASSERT_CMPUINT32 (command.n_documents, ==, (uint32_t) 2);
+
+   memcpy (&len, command.payload.data, 4);
+   len = BSON_UINT32_FROM_LE (len);
+   ASSERT (bson_init_static (&first, command.payload.data, len));
+   ASSERT (bson_init_static (&second,
+                             command.payload.data + len,
+                             command.payload.len - len));
+   ASSERT_MATCH (&first, "{'_id': {'$exists': true}, 'x': 1}");
+   ASSERT_MATCH (&second, "{'_id': {'$exists': true}, 'x': 2}");
+
+   /* consecutive ids from the client's own counter */
+   ASSERT_CMPUINT32 (_oid_counter (&second),
+                     ==,
+                     (_oid_counter (&first) + 1) & 0xffffff);
+
+   _mongoc_write_command_destroy (&command);
+   mongoc_client_destroy (client);
+}
+
+
+typedef struct {
+   int n_started;
+   int n_txn_numbers;
+   int64_t last_txn_number;
+} retry_writes_test_t;
+
+
+static void
+_retry_writes_started_cb (const mongoc_apm_command_started_t *event)
+{
+   retry_writes_test_t *test;
+   const bson_t *cmd;
+   bson_iter_t iter;
+
+   test =
+      (retry_writes_test_t *) mongoc_apm_command_started_get_context (event);
+   cmd = mongoc_apm_command_started_get_command (event);
+   test->n_started++;
+
+   if (bson_iter_init_find (&iter, cmd, "txnNumber")) {
+      ASSERT (BSON_ITER_HOLDS_INT64 (&iter));
+      ASSERT_HAS_FIELD (cmd, "lsid");
+      test->n_txn_numbers++;
+      test->last_txn_number = bson_iter_int64 (&iter);
+   }
+}
+
+
+/* with retryWrites, single-document writes carry a transaction number */
+static void
+test_retry_writes (void *ctx)
+{
+   mongoc_uri_t *uri;
+   mongoc_client_t *client;
+   mongoc_apm_callbacks_t *callbacks;
+   mongoc_collection_t *collection;
+   mongoc_bulk_operation_t *bulk;
+   retry_writes_test_t test = {0};
+   bson_error_t error;
+   uint32_t r;
+
+   uri = test_framework_get_uri ();
+   mongoc_uri_set_option_as_bool (uri, MONGOC_URI_RETRYWRITES, true);
+   client = mongoc_client_new_from_uri (uri);
+   test_framework_set_ssl_opts (client);
+   ASSERT (client->cluster.retry_writes);
+
+   callbacks = mongoc_apm_callbacks_new ();
+   mongoc_apm_set_command_started_cb (callbacks, _retry_writes_started_cb);
+   mongoc_client_set_apm_callbacks (client, callbacks, &test);
+   collection = get_test_collection (client, "test_retry_writes");
+
+   bulk = mongoc_collection_create_bulk_operation (collection, true, NULL);
+   mongoc_bulk_operation_insert (bulk, tmp_bson ("{'x': 1}"));
+   mongoc_bulk_operation_insert (bulk, tmp_bson ("{'x': 1}"));
+   mongoc_bulk_operation_remove_one (bulk, tmp_bson ("{'x': 1}"));
+   r = mongoc_bulk_operation_execute (bulk, NULL, &error);
+   ASSERT_OR_PRINT (r, error);
+   mongoc_bulk_operation_destroy (bulk);
+
+   /* one insert command and one delete command */
+   ASSERT_CMPINT (test.n_started, ==, 2);
+   ASSERT_CMPINT (test.n_txn_numbers, ==, 2);
+   ASSERT_CMPINT64 (test.last_txn_number, >=, (int64_t) 2);
+
+   /* multi-document updates can't be retried */
+   bulk = mongoc_collection_create_bulk_operation (collection, true, NULL);
+   mongoc_bulk_operation_update (
+      bulk, tmp_bson ("{}"), tmp_bson ("{'$set': {'x': 2}}"), false);
+   r = mongoc_bulk_operation_execute (bulk, NULL, &error);
+   ASSERT_OR_PRINT (r, error);
+   mongoc_bulk_operation_destroy (bulk);
+
+   ASSERT_CMPINT (test.n_started, ==, 3);
+   ASSERT_CMPINT (test.n_txn_numbers, ==, 2);
+
+   ASSERT_OR_PRINT (mongoc_collection_drop (collection, &error), error);
+   mongoc_collection_destroy (collection);
+   mongoc_apm_callbacks_destroy (callbacks);
+   mongoc_client_destroy (client);
+   mongoc_uri_destroy (uri);
+}
+
+
 void
 test_write_command_install (TestSuite *suite)
 {
@@ -277,4 +470,12 @@ test_write_command_install (TestSuite *suite)
                       NULL,
                       NULL,
                       test_framework_skip_if_max_wire_version_less_than_4);
+   TestSuite_Add (suite, "/WriteCommand/merge_result", test_merge_result);
+   TestSuite_Add (suite, "/WriteCommand/oid_context", test_oid_context);
+   TestSuite_AddFull (suite,
+                      "/WriteCommand/retry_writes",
+                      test_retry_writes,
+                      NULL,
+                      NULL,
+                      test_framework_skip_if_not_rs_version_6);
 }